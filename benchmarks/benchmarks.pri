@@ -0,0 +1,23 @@
+include(../qxmpp.pri)
+
+QT -= gui
+QT += testlib
+CONFIG -= app_bundle
+
+QMAKE_LIBDIR += ../../src
+QMAKE_RPATHDIR += $$OUT_PWD/../../src
+INCLUDEPATH += $$PWD $$PWD/../tests $$QXMPP_INCLUDEPATH
+HEADERS += $$PWD/processusage.h
+LIBS += $$QXMPP_LIBS
+
+# "make benchmark" writes machine-readable results, by default in
+# QTestLib's XML format
+isEmpty(BENCHMARK_ARGS) {
+    BENCHMARK_ARGS = -xml -o $(TARGET).xml
+}
+benchmark.commands = ./$(TARGET) $$BENCHMARK_ARGS
+benchmark.depends = $(TARGET)
+QMAKE_EXTRA_TARGETS += benchmark
+
+# do not install benchmarks
+target.CONFIG += no_default_install
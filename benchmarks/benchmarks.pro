@@ -0,0 +1,12 @@
+TEMPLATE = subdirs
+SUBDIRS = \
+    qxmppclientfleet \
+    qxmppice \
+    qxmppidlememory \
+    qxmppmedia \
+    qxmppperfgate \
+    qxmppreplay \
+    qxmppserverload \
+    qxmppstream \
+    qxmppstanzas \
+    qxmpptransferload
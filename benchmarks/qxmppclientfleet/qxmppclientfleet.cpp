@@ -0,0 +1,623 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+// Runs a fleet of QXmppClient instances in one process, each of which logs
+// in, fetches its roster, exchanges presence with its contacts, joins a
+// chat room and then chats with its contacts and room, and reports the
+// memory used per client, the lag of the event loops and how the clients'
+// CPU time is split across their extensions.
+//
+// By default the clients connect to a QXmppServer which runs in a child
+// process, so that the reported memory and CPU time only cover the
+// clients. In that case, user N has the users N-1, N+1 and so on as
+// contacts. Use --host to connect to another server, whose accounts all
+// share the same password.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QProcess>
+#include <QStringList>
+#include <QTextStream>
+#include <QTimer>
+
+#include "QXmppClient.h"
+#include "QXmppClientPool.h"
+#include "QXmppMessage.h"
+#include "QXmppMetrics.h"
+#include "QXmppMucManager.h"
+#include "QXmppPasswordChecker.h"
+#include "QXmppRosterManager.h"
+#include "QXmppServer.h"
+#include "QXmppServerMuc.h"
+#include "QXmppServerRoster.h"
+#include "processusage.h"
+
+static const int messagesSent = QXmppMetrics::counter("fleet.messages-sent");
+static const int messagesReceived = QXmppMetrics::counter("fleet.messages-received");
+static const int presencesReceived = QXmppMetrics::counter("fleet.presences-received");
+static const int loginTime = QXmppMetrics::histogram("fleet.login-time");
+static const int eventLoopLag = QXmppMetrics::histogram("fleet.event-loop-lag");
+
+struct FleetOptions
+{
+    FleetOptions()
+        : clients(1000)
+        , threads(4)
+        , contacts(10)
+        , rooms(50)
+        , loginRate(200)
+        , duration(30)
+        , interval(10.0)
+        , port(15222)
+        , password("testpwd")
+        , userPrefix("user")
+        , serve(false)
+    {
+    }
+
+    int clients;
+    int threads;
+    int contacts;
+    int rooms;
+    int loginRate;
+    int duration;
+    double interval;
+    quint16 port;
+    QString host;
+    QString domain;
+    QString mucService;
+    QString password;
+    QString userPrefix;
+    QString output;
+    bool serve;
+};
+
+// Accepts any password, so that the server needs no accounts.
+class FleetPasswordChecker : public QXmppPasswordChecker
+{
+public:
+    QXmppPasswordReply *checkPassword(const QXmppPasswordRequest &request)
+    {
+        Q_UNUSED(request);
+        QXmppPasswordReply *reply = new QXmppPasswordReply;
+        reply->finishLater();
+        return reply;
+    }
+};
+
+// Gives each user the neighbouring users as contacts.
+class FleetRosterStore : public QXmppRosterStore
+{
+    Q_OBJECT
+
+public:
+    FleetRosterStore(const FleetOptions &options)
+        : m_options(options)
+    {
+    }
+
+    void loadRoster(const QString &bareJid)
+    {
+        // the roster is delivered from the event loop, as a real store would
+        if (m_pending.isEmpty())
+            QTimer::singleShot(0, this, SLOT(_q_deliver()));
+        m_pending << bareJid;
+    }
+
+    void saveItem(const QString &bareJid, const QXmppRosterIq::Item &item)
+    {
+        Q_UNUSED(bareJid);
+        Q_UNUSED(item);
+    }
+
+private slots:
+    void _q_deliver()
+    {
+        const QStringList pending = m_pending;
+        m_pending.clear();
+        foreach (const QString &bareJid, pending) {
+            const QString user = bareJid.section('@', 0, 0);
+            const int index = user.mid(m_options.userPrefix.size()).toInt();
+            QList<QXmppRosterIq::Item> items;
+            for (int i = 1; i <= m_options.contacts / 2; ++i) {
+                items << item(index + i);
+                items << item(index - i);
+            }
+            emit rosterLoaded(bareJid, items);
+        }
+    }
+
+private:
+    QXmppRosterIq::Item item(int index) const
+    {
+        index = (index + m_options.clients) % m_options.clients;
+        QXmppRosterIq::Item item;
+        item.setBareJid(QString("%1%2@%3").arg(m_options.userPrefix, QString::number(index), m_options.domain));
+        item.setSubscriptionType(QXmppRosterIq::Item::Both);
+        return item;
+    }
+
+    FleetOptions m_options;
+    QStringList m_pending;
+};
+
+// Measures how late the timers of the event loop it lives in fire.
+class LagProbe : public QObject
+{
+    Q_OBJECT
+
+public:
+    LagProbe(QObject *parent)
+        : QObject(parent)
+    {
+    }
+
+public slots:
+    void start()
+    {
+        m_timer.start();
+        QTimer::singleShot(probeInterval, this, SLOT(_q_probe()));
+    }
+
+private slots:
+    void _q_probe()
+    {
+        QXmppMetrics::recordValue(eventLoopLag, qMax(qint64(0), m_timer.nsecsElapsed() / 1000 - probeInterval * 1000));
+        start();
+    }
+
+private:
+    static const int probeInterval = 100;
+    QElapsedTimer m_timer;
+};
+
+// Drives one client, from the thread the client lives in.
+class FleetBot : public QObject
+{
+    Q_OBJECT
+
+public:
+    FleetBot(QXmppClient *client, int index, const FleetOptions &options)
+        : QObject(client)
+        , m_client(client)
+        , m_room(0)
+        , m_index(index)
+        , m_options(options)
+        , m_ready(false)
+    {
+        m_muc = new QXmppMucManager;
+        client->addExtension(m_muc);
+        client->setStanzaTraceInterval(1000000);
+
+        connect(client, SIGNAL(connected()), this, SLOT(_q_connected()));
+        connect(client, SIGNAL(messageReceived(QXmppMessage)), this, SLOT(_q_messageReceived(QXmppMessage)));
+        connect(client, SIGNAL(presenceReceived(QXmppPresence)), this, SLOT(_q_presenceReceived()));
+        connect(&client->rosterManager(), SIGNAL(rosterReceived()), this, SLOT(_q_rosterReceived()));
+        connect(&m_chatTimer, SIGNAL(timeout()), this, SLOT(_q_chat()));
+    }
+
+signals:
+    void ready();
+
+public slots:
+    void startLogin()
+    {
+        m_loginTimer.start();
+    }
+
+    void startChat()
+    {
+        // spread the messages of the clients over the interval
+        qsrand(m_index + 1);
+        m_chatTimer.start(int(m_options.interval * 1000));
+        QTimer::singleShot(qrand() % qMax(1, int(m_options.interval * 1000)), this, SLOT(_q_chat()));
+    }
+
+    void stopChat()
+    {
+        m_chatTimer.stop();
+    }
+
+private slots:
+    void _q_connected()
+    {
+        QXmppMetrics::recordValue(loginTime, m_loginTimer.elapsed());
+    }
+
+    void _q_rosterReceived()
+    {
+        if (m_room || m_options.rooms <= 0) {
+            setReady();
+            return;
+        }
+        const QString roomJid = QString("room%1@%2").arg(QString::number(m_index % m_options.rooms), m_options.mucService);
+        m_room = m_muc->addRoom(roomJid);
+        m_room->setNickName(QString("bot%1").arg(m_index));
+        connect(m_room, SIGNAL(joined()), this, SLOT(_q_joined()));
+        m_room->join();
+    }
+
+    void _q_joined()
+    {
+        setReady();
+    }
+
+    void _q_messageReceived(const QXmppMessage &message)
+    {
+        if (!message.body().isEmpty())
+            QXmppMetrics::updateCounter(messagesReceived);
+    }
+
+    void _q_presenceReceived()
+    {
+        QXmppMetrics::updateCounter(presencesReceived);
+    }
+
+    void _q_chat()
+    {
+        if (!m_client->isConnected())
+            return;
+
+        const QStringList contacts = m_client->rosterManager().getRosterBareJids();
+        if (!contacts.isEmpty()) {
+            m_client->sendMessage(contacts.at(qrand() % contacts.size()), "Hello, this is a fleet message.");
+            QXmppMetrics::updateCounter(messagesSent);
+        }
+        if (m_room && m_room->isJoined() && qrand() % 4 == 0) {
+            m_room->sendMessage("Hello room, this is a fleet message.");
+            QXmppMetrics::updateCounter(messagesSent);
+        }
+    }
+
+private:
+    void setReady()
+    {
+        if (m_ready)
+            return;
+        m_ready = true;
+        emit ready();
+    }
+
+    QXmppClient *m_client;
+    QXmppMucManager *m_muc;
+    QXmppMucRoom *m_room;
+    int m_index;
+    FleetOptions m_options;
+    QElapsedTimer m_loginTimer;
+    QTimer m_chatTimer;
+    bool m_ready;
+};
+
+// Creates the clients, runs the scenario and reports the results.
+class FleetController : public QObject
+{
+    Q_OBJECT
+
+public:
+    FleetController(const FleetOptions &options)
+        : m_options(options)
+        , m_server(0)
+        , m_connecting(0)
+        , m_readyCount(0)
+        , m_loginSeconds(0)
+        , m_baselineSize(0)
+        , m_readySize(0)
+        , m_cpuTime(0)
+    {
+        m_clock.start();
+    }
+
+    ~FleetController()
+    {
+        if (m_server) {
+            m_server->kill();
+            m_server->waitForFinished();
+        }
+    }
+
+    bool start()
+    {
+        // start the server in a child process, so that it is not measured
+        if (m_options.host.isEmpty()) {
+            QStringList arguments;
+            arguments << "--serve"
+                      << "--clients" << QString::number(m_options.clients)
+                      << "--contacts" << QString::number(m_options.contacts)
+                      << "--port" << QString::number(m_options.port);
+            m_server = new QProcess(this);
+            m_server->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+            m_server->start(QCoreApplication::applicationFilePath(), arguments);
+            if (!m_server->waitForReadyRead(10000) || !m_server->readLine().startsWith("ready")) {
+                qWarning("Could not start the server");
+                return false;
+            }
+            m_options.host = "127.0.0.1";
+        }
+
+        m_baselineSize = residentSize();
+        m_pool.setThreadCount(m_options.threads);
+        for (int i = 0; i < m_options.clients; ++i) {
+            QXmppClient *client = new QXmppClient;
+            FleetBot *bot = new FleetBot(client, i, m_options);
+            connect(bot, SIGNAL(ready()), this, SLOT(_q_clientReady()));
+            m_bots << bot;
+
+            // one probe for each thread
+            if (i < qMax(1, m_options.threads))
+                m_probes << new LagProbe(client);
+            m_pool.addClient(client);
+        }
+        foreach (LagProbe *probe, m_probes)
+            QMetaObject::invokeMethod(probe, "start", Qt::QueuedConnection);
+
+        // log in at the configured rate
+        connect(&m_loginTimer, SIGNAL(timeout()), this, SLOT(_q_login()));
+        m_loginTimer.start(100);
+        QTimer::singleShot(300000, this, SLOT(_q_readyTimeout()));
+        return true;
+    }
+
+private slots:
+    void _q_login()
+    {
+        const QList<QXmppClient*> clients = m_pool.clients();
+        const int batch = qMax(1, m_options.loginRate / 10);
+        for (int i = 0; i < batch && m_connecting < clients.size(); ++i, ++m_connecting) {
+            QXmppConfiguration config;
+            config.setHost(m_options.host);
+            config.setPort(m_options.port);
+            config.setDomain(m_options.domain);
+            config.setUser(m_options.userPrefix + QString::number(m_connecting));
+            config.setPassword(m_options.password);
+            config.setResource("fleet");
+            config.setAutoReconnectionEnabled(false);
+            config.setStreamSecurityMode(QXmppConfiguration::TLSDisabled);
+            QMetaObject::invokeMethod(m_bots.at(m_connecting), "startLogin", Qt::QueuedConnection);
+            m_pool.connectToServer(clients.at(m_connecting), config);
+        }
+        if (m_connecting >= clients.size())
+            m_loginTimer.stop();
+    }
+
+    void _q_clientReady()
+    {
+        if (++m_readyCount < m_options.clients)
+            return;
+
+        m_loginSeconds = m_clock.elapsed() / 1000.0;
+        m_readySize = residentSize();
+        qDebug("%i clients ready in %.1f s", m_readyCount, m_loginSeconds);
+
+        m_before = QXmppMetrics::snapshot();
+        m_cpuTime = cpuTime();
+        m_chatClock.start();
+        foreach (FleetBot *bot, m_bots)
+            QMetaObject::invokeMethod(bot, "startChat", Qt::QueuedConnection);
+        QTimer::singleShot(m_options.duration * 1000, this, SLOT(_q_report()));
+    }
+
+    void _q_readyTimeout()
+    {
+        if (m_readyCount < m_options.clients) {
+            qWarning("Only %i of %i clients are ready", m_readyCount, m_options.clients);
+            QCoreApplication::exit(1);
+        }
+    }
+
+    void _q_report()
+    {
+        const double elapsed = m_chatClock.elapsed() / 1000.0;
+        const double cpu = (cpuTime() - m_cpuTime) / 1000000.0;
+        foreach (FleetBot *bot, m_bots)
+            QMetaObject::invokeMethod(bot, "stopChat", Qt::QueuedConnection);
+
+        const QVariantMap after = QXmppMetrics::snapshot();
+        const qint64 sent = after.value("fleet.messages-sent").toLongLong() -
+                            m_before.value("fleet.messages-sent").toLongLong();
+        const qint64 received = after.value("fleet.messages-received").toLongLong() -
+                                m_before.value("fleet.messages-received").toLongLong();
+
+        QString json;
+        QTextStream stream(&json);
+        stream << "{\n";
+        stream << "  \"clients\": " << m_options.clients << ",\n";
+        stream << "  \"threads\": " << m_options.threads << ",\n";
+        stream << "  \"login-seconds\": " << m_loginSeconds << ",\n";
+        stream << "  \"login-p50-ms\": " << after.value("fleet.login-time.p50").toLongLong() << ",\n";
+        stream << "  \"login-p99-ms\": " << after.value("fleet.login-time.p99").toLongLong() << ",\n";
+        stream << "  \"presences-received\": " << after.value("fleet.presences-received").toLongLong() << ",\n";
+        stream << "  \"messages-sent\": " << sent << ",\n";
+        stream << "  \"messages-received\": " << received << ",\n";
+        stream << "  \"messages-per-second\": " << received / elapsed << ",\n";
+        stream << "  \"rss-bytes-per-client\": " << (m_readySize - m_baselineSize) / m_options.clients << ",\n";
+        stream << "  \"event-loop-lag-p50-us\": " << after.value("fleet.event-loop-lag.p50").toLongLong() << ",\n";
+        stream << "  \"event-loop-lag-p99-us\": " << after.value("fleet.event-loop-lag.p99").toLongLong() << ",\n";
+        stream << "  \"event-loop-lag-max-us\": " << after.value("fleet.event-loop-lag.max").toLongLong() << ",\n";
+        stream << "  \"cpu-seconds\": " << cpu << ",\n";
+        stream << "  \"cpu-percent\": " << 100.0 * cpu / elapsed << ",\n";
+
+        // time spent in each extension, over the whole run
+        stream << "  \"extensions-cpu-ms\": {";
+        const QString prefix = "stanza-trace.dispatch.";
+        bool first = true;
+        for (QVariantMap::const_iterator it = after.constBegin(); it != after.constEnd(); ++it) {
+            if (!it.key().startsWith(prefix) || !it.key().endsWith(".count"))
+                continue;
+            const QString name = it.key().mid(prefix.size(), it.key().size() - prefix.size() - 6);
+            const double total = it.value().toDouble() * after.value(prefix + name + ".mean").toDouble() / 1000.0;
+            stream << (first ? "\n" : ",\n") << "    \"" << name << "\": " << total;
+            first = false;
+        }
+        stream << "\n  }\n";
+        stream << "}\n";
+        stream.flush();
+
+        if (m_options.output.isEmpty()) {
+            QTextStream(stdout) << json;
+        } else {
+            QFile file(m_options.output);
+            if (!file.open(QIODevice::WriteOnly)) {
+                qWarning("Could not write %s", qPrintable(m_options.output));
+                QCoreApplication::exit(1);
+                return;
+            }
+            file.write(json.toUtf8());
+        }
+        QCoreApplication::exit(0);
+    }
+
+private:
+    FleetOptions m_options;
+    QProcess *m_server;
+    QXmppClientPool m_pool;
+    QList<FleetBot*> m_bots;
+    QList<LagProbe*> m_probes;
+    QTimer m_loginTimer;
+    QElapsedTimer m_clock;
+    QElapsedTimer m_chatClock;
+    QVariantMap m_before;
+    int m_connecting;
+    int m_readyCount;
+    double m_loginSeconds;
+    qint64 m_baselineSize;
+    qint64 m_readySize;
+    qint64 m_cpuTime;
+};
+
+// Runs the server for the fleet, in the child process.
+static int serve(const FleetOptions &options)
+{
+    FleetPasswordChecker passwordChecker;
+    FleetRosterStore store(options);
+
+    QXmppServer server;
+    server.setDomain(options.domain);
+    server.setPasswordChecker(&passwordChecker);
+
+    QXmppServerRoster *roster = new QXmppServerRoster;
+    roster->setStore(&store);
+    server.addExtension(roster);
+
+    QXmppServerMuc *muc = new QXmppServerMuc;
+    muc->setJid(options.mucService);
+    server.addExtension(muc);
+
+    if (!server.listenForClients(QHostAddress::LocalHost, options.port)) {
+        qWarning("Could not listen on port %i", options.port);
+        return 1;
+    }
+    QTextStream(stdout) << "ready" << endl;
+    return QCoreApplication::exec();
+}
+
+static void usage()
+{
+    QTextStream(stderr) <<
+        "Usage: qxmppclientfleet [options]\n"
+        "\n"
+        "  --clients <count>         number of clients (default: 1000)\n"
+        "  --threads <count>         number of client threads (default: 4)\n"
+        "  --contacts <count>        contacts of each user on the local server (default: 10)\n"
+        "  --rooms <count>           number of chat rooms, 0 to join none (default: 50)\n"
+        "  --login-rate <count>      clients logging in per second (default: 200)\n"
+        "  --duration <secs>         duration of the chatter (default: 30)\n"
+        "  --interval <secs>         interval between the messages of a client (default: 10)\n"
+        "  --host <host>             connect to this server instead of a local one\n"
+        "  --domain <domain>         domain of the accounts (default: localhost)\n"
+        "  --muc-service <jid>       multi-user chat service (default: muc.<domain>)\n"
+        "  --user-prefix <prefix>    accounts are named <prefix><index> (default: user)\n"
+        "  --password <password>     password of the accounts (default: testpwd)\n"
+        "  --port <port>             port of the server (default: 15222)\n"
+        "  --output <file>           write the JSON results to a file instead of stdout\n";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    FleetOptions options;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        const QString arg = args.at(i);
+        const QString value = (i + 1 < args.size()) ? args.at(i + 1) : QString();
+        bool ok = true;
+        if (arg == "--serve") {
+            options.serve = true;
+            continue;
+        } else if (arg == "--clients") {
+            options.clients = value.toInt(&ok);
+        } else if (arg == "--threads") {
+            options.threads = value.toInt(&ok);
+        } else if (arg == "--contacts") {
+            options.contacts = value.toInt(&ok);
+        } else if (arg == "--rooms") {
+            options.rooms = value.toInt(&ok);
+        } else if (arg == "--login-rate") {
+            options.loginRate = value.toInt(&ok);
+        } else if (arg == "--duration") {
+            options.duration = value.toInt(&ok);
+        } else if (arg == "--interval") {
+            options.interval = value.toDouble(&ok);
+            ok = ok && options.interval > 0;
+        } else if (arg == "--host") {
+            options.host = value;
+        } else if (arg == "--domain") {
+            options.domain = value;
+        } else if (arg == "--muc-service") {
+            options.mucService = value;
+        } else if (arg == "--user-prefix") {
+            options.userPrefix = value;
+        } else if (arg == "--password") {
+            options.password = value;
+        } else if (arg == "--port") {
+            options.port = value.toUShort(&ok);
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+        if (!ok || options.clients < 1) {
+            usage();
+            return 1;
+        }
+        ++i;
+    }
+    if (options.domain.isEmpty())
+        options.domain = "localhost";
+    if (options.mucService.isEmpty())
+        options.mucService = "muc." + options.domain;
+
+    if (options.serve)
+        return serve(options);
+
+    FleetController controller(options);
+    if (!controller.start())
+        return 1;
+    return app.exec();
+}
+
+#include "qxmppclientfleet.moc"
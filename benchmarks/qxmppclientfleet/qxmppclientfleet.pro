@@ -0,0 +1,5 @@
+BENCHMARK_ARGS = --output $(TARGET).json
+include(../benchmarks.pri)
+CONFIG += console
+TARGET = qxmppclientfleet
+SOURCES += qxmppclientfleet.cpp
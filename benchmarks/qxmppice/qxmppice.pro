@@ -0,0 +1,3 @@
+include(../benchmarks.pri)
+TARGET = tst_qxmppice
+SOURCES += tst_qxmppice.cpp
@@ -0,0 +1,642 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <QtTest>
+
+#include "QXmppStun.h"
+#include "QXmppStun_p.h"
+#include "QXmppUtils.h"
+
+enum NatType
+{
+    NoNat,
+    FullConeNat,
+    PortRestrictedNat,
+    SymmetricNat
+};
+Q_DECLARE_METATYPE(NatType)
+
+enum CallMode
+{
+    RegularMode,
+    TrickleMode,
+    RestartMode
+};
+Q_DECLARE_METATYPE(CallMode)
+
+static const quint16 stunPort = 3478;
+
+static QString endpoint(const QHostAddress &host, quint16 port)
+{
+    return host.toString() + ":" + QString::number(port);
+}
+
+class SimulatedTransport;
+
+// A host with one or more interfaces. Only the first interface can reach
+// other hosts, through the host's NAT if it has one. The other interfaces
+// are on isolated networks, like a VPN which is down.
+struct SimulatedHost
+{
+    NatType nat;
+    QHostAddress publicAddress;
+    QList<QHostAddress> interfaces;
+    quint16 nextPort;
+
+    // NAT state
+    QHash<QString, quint16> mappings;
+    QHash<quint16, SimulatedTransport*> mappedTransports;
+    QSet<QString> permissions;
+};
+
+// A UDP network with a fixed one-way latency and a random loss, and a
+// STUN server on a public address.
+class SimulatedNetwork : public QObject
+{
+    Q_OBJECT
+
+public:
+    SimulatedNetwork(int latency, int lossPercent);
+    ~SimulatedNetwork();
+
+    SimulatedHost *addHost(NatType nat, int interfaces);
+    QList<QXmppIceTransport*> createTransports(SimulatedHost *host);
+    QHostAddress stunAddress() const;
+
+    qint64 elapsed() const;
+    void reset();
+    void send(SimulatedTransport *transport, const QByteArray &data, const QHostAddress &host, quint16 port);
+    void removeTransport(SimulatedTransport *transport);
+
+    qint64 firstValidPair;
+    int stunMessages;
+
+private slots:
+    void deliver();
+
+private:
+    struct Datagram
+    {
+        qint64 due;
+        QByteArray data;
+        SimulatedHost *fromHost;
+        QHostAddress fromAddress;
+        quint16 fromPort;
+        QHostAddress toAddress;
+        quint16 toPort;
+    };
+
+    void arrive(const Datagram &datagram);
+    void schedule(const Datagram &datagram);
+
+    int m_latency;
+    int m_lossPercent;
+    QList<SimulatedHost*> m_hosts;
+    QHash<QString, SimulatedTransport*> m_transports;
+    QSet<QByteArray> m_checkIds;
+    QList<Datagram> m_queue;
+    QElapsedTimer m_clock;
+    QTimer *m_timer;
+};
+
+class SimulatedTransport : public QXmppIceTransport
+{
+    Q_OBJECT
+
+public:
+    SimulatedTransport(SimulatedNetwork *network, SimulatedHost *host, int index, quint16 port)
+        : m_network(network)
+        , m_host(host)
+        , m_index(index)
+        , m_port(port)
+        , m_open(true)
+    {
+    }
+
+    ~SimulatedTransport()
+    {
+        m_network->removeTransport(this);
+    }
+
+    QHostAddress address() const
+    {
+        return m_host->interfaces.at(m_index);
+    }
+
+    SimulatedHost *host() const
+    {
+        return m_host;
+    }
+
+    int index() const
+    {
+        return m_index;
+    }
+
+    quint16 port() const
+    {
+        return m_port;
+    }
+
+    QXmppJingleCandidate localCandidate(int component) const
+    {
+        QXmppJingleCandidate candidate;
+        candidate.setComponent(component);
+        candidate.setFoundation(QString::number(qHash(address().toString())));
+        candidate.setHost(address());
+        candidate.setId(QXmppUtils::generateStanzaHash(10));
+        candidate.setPort(m_port);
+        candidate.setPriority((126 << 24) | ((65535 - m_index) << 8) | (256 - component));
+        candidate.setProtocol("udp");
+        candidate.setType(QXmppJingleCandidate::HostType);
+        return candidate;
+    }
+
+    qint64 writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port)
+    {
+        if (!m_open)
+            return -1;
+        m_network->send(this, data, host, port);
+        return data.size();
+    }
+
+    void receive(const QByteArray &data, const QHostAddress &host, quint16 port)
+    {
+        if (m_open)
+            emit datagramReceived(data, host, port);
+    }
+
+public slots:
+    void disconnectFromHost()
+    {
+        m_open = false;
+    }
+
+private:
+    SimulatedNetwork *m_network;
+    SimulatedHost *m_host;
+    int m_index;
+    quint16 m_port;
+    bool m_open;
+};
+
+SimulatedNetwork::SimulatedNetwork(int latency, int lossPercent)
+    : firstValidPair(-1)
+    , stunMessages(0)
+    , m_latency(latency)
+    , m_lossPercent(lossPercent)
+{
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    connect(m_timer, SIGNAL(timeout()), this, SLOT(deliver()));
+    m_clock.start();
+}
+
+SimulatedNetwork::~SimulatedNetwork()
+{
+    qDeleteAll(m_hosts);
+}
+
+SimulatedHost *SimulatedNetwork::addHost(NatType nat, int interfaces)
+{
+    const int number = m_hosts.size() + 1;
+
+    SimulatedHost *host = new SimulatedHost;
+    host->nat = nat;
+    host->publicAddress = QHostAddress(QString("198.51.100.%1").arg(number));
+    host->nextPort = 5000;
+    if (nat == NoNat)
+        host->interfaces << host->publicAddress;
+    else
+        host->interfaces << QHostAddress(QString("192.168.%1.2").arg(number));
+    for (int i = 1; i < interfaces; ++i)
+        host->interfaces << QHostAddress(QString("10.%1.%2.2").arg(QString::number(i), QString::number(number)));
+    m_hosts << host;
+    return host;
+}
+
+// Returns a new transport on each of the host's interfaces.
+QList<QXmppIceTransport*> SimulatedNetwork::createTransports(SimulatedHost *host)
+{
+    QList<QXmppIceTransport*> transports;
+    for (int i = 0; i < host->interfaces.size(); ++i) {
+        SimulatedTransport *transport = new SimulatedTransport(this, host, i, host->nextPort++);
+        m_transports.insert(endpoint(transport->address(), transport->port()), transport);
+        transports << transport;
+    }
+    return transports;
+}
+
+void SimulatedNetwork::removeTransport(SimulatedTransport *transport)
+{
+    m_transports.remove(endpoint(transport->address(), transport->port()));
+    SimulatedHost *host = transport->host();
+    QHash<quint16, SimulatedTransport*>::iterator it = host->mappedTransports.begin();
+    while (it != host->mappedTransports.end()) {
+        if (it.value() == transport)
+            it = host->mappedTransports.erase(it);
+        else
+            ++it;
+    }
+}
+
+QHostAddress SimulatedNetwork::stunAddress() const
+{
+    return QHostAddress("203.0.113.1");
+}
+
+qint64 SimulatedNetwork::elapsed() const
+{
+    return m_clock.elapsed();
+}
+
+// Resets the clock and the counters.
+void SimulatedNetwork::reset()
+{
+    firstValidPair = -1;
+    stunMessages = 0;
+    m_clock.restart();
+}
+
+void SimulatedNetwork::send(SimulatedTransport *transport, const QByteArray &data, const QHostAddress &host, quint16 port)
+{
+    quint32 cookie;
+    QByteArray id;
+    const quint16 type = QXmppStunMessage::peekType(data, cookie, id);
+    if (type) {
+        ++stunMessages;
+        if (type == (QXmppStunMessage::Binding | QXmppStunMessage::Request) && host != stunAddress())
+            m_checkIds.insert(id);
+    }
+
+    Datagram datagram;
+    datagram.data = data;
+    datagram.fromHost = transport->host();
+    datagram.fromAddress = transport->address();
+    datagram.fromPort = transport->port();
+    datagram.toAddress = host;
+    datagram.toPort = port;
+
+    // traffic between the interfaces of a host is not translated
+    SimulatedHost *fromHost = transport->host();
+    if (!fromHost->interfaces.contains(host)) {
+        if (transport->index() > 0)
+            return;
+
+        if (fromHost->nat != NoNat) {
+            const QString remote = endpoint(host, port);
+            const QString key = (fromHost->nat == SymmetricNat)
+                ? QString::number(transport->port()) + "|" + remote
+                : QString::number(transport->port());
+            quint16 mappedPort = fromHost->mappings.value(key);
+            if (!mappedPort) {
+                mappedPort = 40000 + fromHost->mappings.size();
+                fromHost->mappings.insert(key, mappedPort);
+                fromHost->mappedTransports.insert(mappedPort, transport);
+            }
+            fromHost->permissions.insert(QString::number(mappedPort) + "|" + remote);
+            datagram.fromAddress = fromHost->publicAddress;
+            datagram.fromPort = mappedPort;
+        }
+    }
+    schedule(datagram);
+}
+
+// Queues a datagram, unless it is lost. As the latency is fixed, the
+// queue is sorted by due time.
+void SimulatedNetwork::schedule(const Datagram &datagram)
+{
+    if (int(qrand() % 100) < m_lossPercent)
+        return;
+
+    m_queue << datagram;
+    m_queue.last().due = m_clock.elapsed() + m_latency;
+    if (!m_timer->isActive())
+        m_timer->start(qMax(qint64(0), m_queue.first().due - m_clock.elapsed()));
+}
+
+void SimulatedNetwork::deliver()
+{
+    while (!m_queue.isEmpty() && m_queue.first().due <= m_clock.elapsed())
+        arrive(m_queue.takeFirst());
+    if (!m_queue.isEmpty())
+        m_timer->start(qMax(qint64(0), m_queue.first().due - m_clock.elapsed()));
+}
+
+void SimulatedNetwork::arrive(const Datagram &datagram)
+{
+    // the STUN server answers binding requests with the source address
+    if (datagram.toAddress == stunAddress() && datagram.toPort == stunPort) {
+        QXmppStunMessage request;
+        if (!request.decode(datagram.data) ||
+            request.type() != (QXmppStunMessage::Binding | QXmppStunMessage::Request))
+            return;
+
+        QXmppStunMessage response;
+        response.setId(request.id());
+        response.setType(QXmppStunMessage::Binding | QXmppStunMessage::Response);
+        response.xorMappedHost = datagram.fromAddress;
+        response.xorMappedPort = datagram.fromPort;
+
+        Datagram reply;
+        reply.data = response.encode();
+        reply.fromHost = 0;
+        reply.fromAddress = stunAddress();
+        reply.fromPort = stunPort;
+        reply.toAddress = datagram.fromAddress;
+        reply.toPort = datagram.fromPort;
+        ++stunMessages;
+        schedule(reply);
+        return;
+    }
+
+    // find the destination
+    SimulatedTransport *transport = m_transports.value(endpoint(datagram.toAddress, datagram.toPort));
+    if (transport) {
+        SimulatedHost *host = transport->host();
+        if (host != datagram.fromHost && datagram.toAddress != host->publicAddress)
+            return;
+    } else {
+        foreach (SimulatedHost *host, m_hosts) {
+            if (host->publicAddress == datagram.toAddress && host->nat != NoNat) {
+                transport = host->mappedTransports.value(datagram.toPort);
+                if (host->nat != FullConeNat &&
+                    !host->permissions.contains(QString::number(datagram.toPort) + "|" + endpoint(datagram.fromAddress, datagram.fromPort)))
+                    return;
+                break;
+            }
+        }
+        if (!transport)
+            return;
+    }
+
+    // the first successful connectivity check
+    if (firstValidPair < 0) {
+        quint32 cookie;
+        QByteArray id;
+        if (QXmppStunMessage::peekType(datagram.data, cookie, id) == (QXmppStunMessage::Binding | QXmppStunMessage::Response) &&
+            m_checkIds.contains(id))
+            firstValidPair = m_clock.elapsed();
+    }
+
+    transport->receive(datagram.data, datagram.fromAddress, datagram.fromPort);
+}
+
+// Two parties negotiating ICE over a simulated network, with instant
+// signalling between them.
+class IceCall : public QObject
+{
+    Q_OBJECT
+
+public:
+    IceCall(SimulatedNetwork *network, NatType leftNat, NatType rightNat, int interfaces, int checkInterval);
+
+    bool connectCall(bool trickle, int timeout);
+    bool restartCall(int timeout);
+
+private slots:
+    void candidatesChanged();
+    void connected();
+    void gatheringStateChanged();
+
+private:
+    void exchangeCandidates();
+    void startChecks();
+    bool wait(int timeout);
+
+    SimulatedNetwork *m_network;
+    SimulatedHost *m_leftHost;
+    SimulatedHost *m_rightHost;
+    QXmppIceConnection m_left;
+    QXmppIceConnection m_right;
+    int m_leftSent;
+    int m_rightSent;
+    bool m_trickle;
+    bool m_checking;
+    QEventLoop m_loop;
+    QTimer m_timeout;
+};
+
+IceCall::IceCall(SimulatedNetwork *network, NatType leftNat, NatType rightNat, int interfaces, int checkInterval)
+    : m_network(network)
+    , m_leftSent(0)
+    , m_rightSent(0)
+    , m_trickle(false)
+    , m_checking(false)
+{
+    m_leftHost = network->addHost(leftNat, interfaces);
+    m_rightHost = network->addHost(rightNat, interfaces);
+
+    m_timeout.setSingleShot(true);
+    connect(&m_timeout, SIGNAL(timeout()), &m_loop, SLOT(quit()));
+
+    m_left.setIceControlling(true);
+    m_right.setIceControlling(false);
+    QXmppIceConnection *connections[] = { &m_left, &m_right };
+    for (int i = 0; i < 2; ++i) {
+        QXmppIceConnection *connection = connections[i];
+        connection->setCheckInterval(checkInterval);
+        connection->setStunServer(network->stunAddress(), stunPort);
+        connection->addComponent(1);
+        connect(connection, SIGNAL(connected()), this, SLOT(connected()));
+        connect(connection, SIGNAL(gatheringStateChanged()), this, SLOT(gatheringStateChanged()));
+        connect(connection, SIGNAL(localCandidatesChanged()), this, SLOT(candidatesChanged()));
+    }
+}
+
+// Binds both parties and negotiates ICE, either once gathering completes
+// or, with trickle, as candidates are found.
+bool IceCall::connectCall(bool trickle, int timeout)
+{
+    m_trickle = trickle;
+    m_checking = false;
+    m_leftSent = m_rightSent = 0;
+
+    m_left.bind(m_network->createTransports(m_leftHost));
+    m_right.bind(m_network->createTransports(m_rightHost));
+    m_left.setRemoteUser(m_right.localUser());
+    m_left.setRemotePassword(m_right.localPassword());
+    m_right.setRemoteUser(m_left.localUser());
+    m_right.setRemotePassword(m_left.localPassword());
+
+    if (m_trickle)
+        startChecks();
+    else
+        gatheringStateChanged();
+    return wait(timeout);
+}
+
+// Restarts ICE on new transports, as after a change of network.
+bool IceCall::restartCall(int timeout)
+{
+    m_checking = false;
+    m_leftSent = m_rightSent = 0;
+
+    m_left.restart(m_network->createTransports(m_leftHost));
+    m_right.restart(m_network->createTransports(m_rightHost));
+    m_left.setRemoteUser(m_right.localUser());
+    m_left.setRemotePassword(m_right.localPassword());
+    m_right.setRemoteUser(m_left.localUser());
+    m_right.setRemotePassword(m_left.localPassword());
+    gatheringStateChanged();
+    return wait(timeout);
+}
+
+// Waits until both parties are connected.
+bool IceCall::wait(int timeout)
+{
+    if (!m_left.isConnected() || !m_right.isConnected()) {
+        m_timeout.start(timeout);
+        m_loop.exec();
+        m_timeout.stop();
+    }
+    return m_left.isConnected() && m_right.isConnected();
+}
+
+void IceCall::candidatesChanged()
+{
+    if (m_checking)
+        exchangeCandidates();
+}
+
+void IceCall::connected()
+{
+    if (m_left.isConnected() && m_right.isConnected())
+        m_loop.quit();
+}
+
+void IceCall::gatheringStateChanged()
+{
+    if (!m_checking &&
+        m_left.gatheringState() == QXmppIceConnection::CompleteGatheringState &&
+        m_right.gatheringState() == QXmppIceConnection::CompleteGatheringState)
+        startChecks();
+}
+
+void IceCall::exchangeCandidates()
+{
+    const QList<QXmppJingleCandidate> leftCandidates = m_left.localCandidates();
+    for (; m_leftSent < leftCandidates.size(); ++m_leftSent)
+        m_right.addRemoteCandidate(leftCandidates.at(m_leftSent));
+
+    const QList<QXmppJingleCandidate> rightCandidates = m_right.localCandidates();
+    for (; m_rightSent < rightCandidates.size(); ++m_rightSent)
+        m_left.addRemoteCandidate(rightCandidates.at(m_rightSent));
+}
+
+void IceCall::startChecks()
+{
+    m_checking = true;
+    exchangeCandidates();
+    m_left.connectToHost();
+    m_right.connectToHost();
+}
+
+class tst_QXmppIce : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void negotiate_data();
+    void negotiate();
+};
+
+void tst_QXmppIce::negotiate_data()
+{
+    QTest::addColumn<CallMode>("mode");
+    QTest::addColumn<int>("latency");
+    QTest::addColumn<int>("loss");
+    QTest::addColumn<NatType>("leftNat");
+    QTest::addColumn<NatType>("rightNat");
+    QTest::addColumn<int>("interfaces");
+    QTest::addColumn<int>("checkInterval");
+
+    QTest::newRow("lan") << RegularMode << 1 << 0 << NoNat << NoNat << 1 << 20;
+    QTest::newRow("wan") << RegularMode << 50 << 0 << PortRestrictedNat << FullConeNat << 1 << 20;
+    QTest::newRow("wan-loss-5%") << RegularMode << 50 << 5 << PortRestrictedNat << FullConeNat << 1 << 20;
+    QTest::newRow("wan-symmetric") << RegularMode << 50 << 0 << SymmetricNat << FullConeNat << 1 << 20;
+    QTest::newRow("wan-3-interfaces") << RegularMode << 50 << 0 << PortRestrictedNat << FullConeNat << 3 << 20;
+    QTest::newRow("wan-3-interfaces-pacing-5ms") << RegularMode << 50 << 0 << PortRestrictedNat << FullConeNat << 3 << 5;
+    QTest::newRow("trickle-wan") << TrickleMode << 50 << 0 << PortRestrictedNat << FullConeNat << 1 << 20;
+    QTest::newRow("trickle-wan-3-interfaces") << TrickleMode << 50 << 0 << PortRestrictedNat << FullConeNat << 3 << 20;
+    QTest::newRow("restart-wan") << RestartMode << 50 << 0 << PortRestrictedNat << FullConeNat << 1 << 20;
+}
+
+void tst_QXmppIce::negotiate()
+{
+    QFETCH(CallMode, mode);
+    QFETCH(int, latency);
+    QFETCH(int, loss);
+    QFETCH(NatType, leftNat);
+    QFETCH(NatType, rightNat);
+    QFETCH(int, interfaces);
+    QFETCH(int, checkInterval);
+
+    // average a few calls, timing from the start of gathering, or from
+    // the restart
+    const int runs = 5;
+    const int timeout = 10000;
+    qint64 firstValidPair = 0;
+    qint64 nomination = 0;
+    qint64 stunMessages = 0;
+    int failures = 0;
+    for (int run = 0; run < runs; ++run) {
+        qsrand(run + 1);
+        SimulatedNetwork network(latency, loss);
+        IceCall call(&network, leftNat, rightNat, interfaces, checkInterval);
+
+        if (mode == RestartMode) {
+            QVERIFY(call.connectCall(false, timeout));
+            network.reset();
+            if (!call.restartCall(timeout)) {
+                ++failures;
+                continue;
+            }
+        } else {
+            network.reset();
+            if (!call.connectCall(mode == TrickleMode, timeout)) {
+                ++failures;
+                continue;
+            }
+        }
+        nomination += network.elapsed();
+        firstValidPair += network.firstValidPair;
+        stunMessages += network.stunMessages;
+    }
+    QVERIFY2(failures < runs, "No call connected");
+
+    const int connected = runs - failures;
+    qDebug("first validated pair %lld ms, nomination %lld ms, %lld STUN messages, %d failed calls",
+           firstValidPair / connected, nomination / connected, stunMessages / connected, failures);
+    QTest::setBenchmarkResult(double(nomination) / connected, QTest::WalltimeMilliseconds);
+}
+
+QTEST_MAIN(tst_QXmppIce)
+#include "tst_qxmppice.moc"
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+// Measures the memory held by QXmppServer for each idle, authenticated
+// and bound client connection.
+//
+// The resident size covers the raw client sockets too, as they live in
+// the same process. The per-subsystem breakdown is only available when
+// QXmpp is built with QXMPP_MEMORY_STATS=1.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+
+#include "QXmppServer.h"
+#include "processusage.h"
+#include "util.h"
+
+static const QByteArray streamHeader("<?xml version='1.0'?><stream:stream to='localhost' version='1.0'"
+                                     " xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>");
+
+#ifdef QXMPP_MEMORY_STATS
+static const char *memoryCategories[] = {
+    "stream-buffers",
+    "client-state",
+    "stanza-parsing",
+    "stream-management",
+    "routing-table"
+};
+static const int memoryCategoryCount = sizeof(memoryCategories) / sizeof(memoryCategories[0]);
+#endif
+
+struct IdleOptions
+{
+    IdleOptions()
+        : clients(1000)
+        , idle(2)
+        , streamManagement(false)
+        , port(15222)
+    {
+    }
+
+    int clients;
+    int idle;
+    bool streamManagement;
+    quint16 port;
+    QString output;
+};
+
+// A raw XMPP client, which authenticates, binds a resource and then
+// stays idle.
+struct IdleClient
+{
+    enum State
+    {
+        Connecting,
+        Authenticating,
+        Restarting,
+        Binding,
+        Enabling,
+        Idle
+    };
+
+    IdleClient()
+        : socket(0), state(Connecting)
+    {
+    }
+
+    QTcpSocket *socket;
+    State state;
+    QByteArray user;
+    QByteArray buffer;
+};
+
+class IdleController : public QObject
+{
+    Q_OBJECT
+
+public:
+    IdleController(const IdleOptions &options)
+        : m_options(options)
+        , m_idleCount(0)
+        , m_baselineSize(0)
+    {
+        m_clock.start();
+    }
+
+    ~IdleController()
+    {
+        qDeleteAll(m_clients);
+    }
+
+    bool start()
+    {
+        for (int i = 0; i < m_options.clients; ++i)
+            m_passwordChecker.addCredentials("user" + QString::number(i), "testpwd");
+
+        m_server.setDomain("localhost");
+        m_server.setPasswordChecker(&m_passwordChecker);
+        if (!m_server.listenForClients(QHostAddress::LocalHost, m_options.port)) {
+            qWarning("Could not listen on port %i", m_options.port);
+            return false;
+        }
+
+        m_baseline = m_server.statistics();
+        m_baselineSize = residentSize();
+
+        for (int i = 0; i < m_options.clients; ++i) {
+            IdleClient *client = new IdleClient;
+            client->user = "user" + QByteArray::number(i);
+            client->socket = new QTcpSocket(this);
+            m_clients << client;
+            m_sockets.insert(client->socket, client);
+            connect(client->socket, SIGNAL(connected()), this, SLOT(_q_connected()));
+            connect(client->socket, SIGNAL(readyRead()), this, SLOT(_q_readyRead()));
+            client->socket->connectToHost(QHostAddress(QHostAddress::LocalHost), m_options.port);
+        }
+
+        QTimer::singleShot(120000, this, SLOT(_q_connectTimeout()));
+        return true;
+    }
+
+private slots:
+    void _q_connected()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+        if (socket)
+            socket->write(streamHeader);
+    }
+
+    void _q_readyRead()
+    {
+        IdleClient *client = m_sockets.value(sender());
+        if (!client)
+            return;
+        client->buffer += client->socket->readAll();
+
+        switch (client->state) {
+        case IdleClient::Connecting:
+            if (client->buffer.contains("</stream:features>")) {
+                client->buffer.clear();
+                client->socket->write("<auth xmlns='urn:ietf:params:xml:ns:xmpp-sasl' mechanism='PLAIN'>" +
+                    (QByteArray(1, '\0') + client->user + QByteArray("\0testpwd", 8)).toBase64() + "</auth>");
+                client->state = IdleClient::Authenticating;
+            }
+            break;
+        case IdleClient::Authenticating:
+            if (client->buffer.contains("<success")) {
+                client->buffer.clear();
+                client->socket->write(streamHeader);
+                client->state = IdleClient::Restarting;
+            }
+            break;
+        case IdleClient::Restarting:
+            if (client->buffer.contains("</stream:features>")) {
+                client->buffer.clear();
+                client->socket->write("<iq type='set' id='bind'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+                                      "<resource>idle</resource></bind></iq>");
+                client->state = IdleClient::Binding;
+            }
+            break;
+        case IdleClient::Binding:
+            if (client->buffer.contains("</iq>")) {
+                client->buffer.clear();
+                if (m_options.streamManagement) {
+                    client->socket->write("<enable xmlns='urn:xmpp:sm:3' resume='true'/>");
+                    client->state = IdleClient::Enabling;
+                } else {
+                    clientIdle(client);
+                }
+            }
+            break;
+        case IdleClient::Enabling:
+            if (client->buffer.contains("<enabled")) {
+                client->buffer.clear();
+                clientIdle(client);
+            }
+            break;
+        case IdleClient::Idle:
+            client->buffer.clear();
+            break;
+        }
+    }
+
+    void _q_connectTimeout()
+    {
+        if (m_idleCount < m_options.clients) {
+            qWarning("Only %i of %i clients connected", m_idleCount, m_options.clients);
+            QCoreApplication::exit(1);
+        }
+    }
+
+    void _q_report()
+    {
+        const QVariantMap stats = m_server.statistics();
+        const double clients = m_options.clients;
+        const double rssPerClient = (residentSize() - m_baselineSize) / clients;
+
+        QString json;
+        QTextStream stream(&json);
+        stream << "{\n";
+        stream << "  \"clients\": " << m_options.clients << ",\n";
+        stream << "  \"stream-management\": " << (m_options.streamManagement ? "true" : "false") << ",\n";
+#ifdef QXMPP_MEMORY_STATS
+        qint64 total = 0;
+        for (int i = 0; i < memoryCategoryCount; ++i) {
+            const QString key = QString("memory.%1.bytes").arg(QLatin1String(memoryCategories[i]));
+            const qint64 bytes = stats.value(key).toLongLong() - m_baseline.value(key).toLongLong();
+            total += bytes;
+            stream << "  \"" << memoryCategories[i] << "-bytes-per-client\": " << bytes / clients << ",\n";
+        }
+        stream << "  \"accounted-bytes-per-client\": " << total / clients << ",\n";
+#else
+        Q_UNUSED(stats);
+#endif
+        stream << "  \"rss-bytes-per-client\": " << rssPerClient << "\n";
+        stream << "}\n";
+        stream.flush();
+
+        if (m_options.output.isEmpty()) {
+            QTextStream(stdout) << json;
+        } else {
+            QFile file(m_options.output);
+            if (!file.open(QIODevice::WriteOnly)) {
+                qWarning("Could not write %s", qPrintable(m_options.output));
+                QCoreApplication::exit(1);
+                return;
+            }
+            file.write(json.toUtf8());
+        }
+        QCoreApplication::exit(0);
+    }
+
+private:
+    void clientIdle(IdleClient *client)
+    {
+        client->state = IdleClient::Idle;
+        if (++m_idleCount < m_options.clients)
+            return;
+
+        // let the connections settle before measuring them
+        qDebug("%i clients connected in %.1f s", m_idleCount, m_clock.elapsed() / 1000.0);
+        QTimer::singleShot(m_options.idle * 1000, this, SLOT(_q_report()));
+    }
+
+    IdleOptions m_options;
+    QXmppServer m_server;
+    TestPasswordChecker m_passwordChecker;
+    QList<IdleClient*> m_clients;
+    QHash<QObject*, IdleClient*> m_sockets;
+    QElapsedTimer m_clock;
+    QVariantMap m_baseline;
+    int m_idleCount;
+    qint64 m_baselineSize;
+};
+
+static void usage()
+{
+    QTextStream(stderr) <<
+        "Usage: qxmppidlememory [options]\n"
+        "\n"
+        "  --clients <count>         number of idle clients (default: 1000)\n"
+        "  --idle <secs>             time to wait before measuring (default: 2)\n"
+        "  --stream-management       enable stream management on each client\n"
+        "  --port <port>             port on which the server listens (default: 15222)\n"
+        "  --output <file>           write the JSON results to a file instead of stdout\n";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    IdleOptions options;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        const QString arg = args.at(i);
+        const QString value = (i + 1 < args.size()) ? args.at(i + 1) : QString();
+        bool ok = true;
+        if (arg == "--stream-management") {
+            options.streamManagement = true;
+            continue;
+        } else if (arg == "--clients") {
+            options.clients = value.toInt(&ok);
+        } else if (arg == "--idle") {
+            options.idle = value.toInt(&ok);
+        } else if (arg == "--port") {
+            options.port = value.toUShort(&ok);
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+        if (!ok || options.clients < 1) {
+            usage();
+            return 1;
+        }
+        ++i;
+    }
+
+    IdleController controller(options);
+    if (!controller.start())
+        return 1;
+    return app.exec();
+}
+
+#include "qxmppidlememory.moc"
@@ -0,0 +1,3 @@
+include(../benchmarks.pri)
+TARGET = tst_qxmppmedia
+SOURCES += tst_qxmppmedia.cpp
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QtEndian>
+#include <QtTest>
+#include <qmath.h>
+
+#include "QXmppJingleIq.h"
+#include "QXmppRtpChannel.h"
+#include "QXmppRtpPacket.h"
+
+#ifdef QXMPP_AUTOTEST_INTERNAL
+#include "QXmppCodec_p.h"
+#endif
+
+#if QT_VERSION < 0x050000
+Q_DECLARE_METATYPE(QList<int>)
+#endif
+
+// All the benchmarks below handle one frame of 20 ms at a time.
+static const int frameDuration = 20;
+
+// The audio channel benchmark replays a minute of audio.
+static const int channelPackets = 60 * 1000 / frameDuration;
+
+// Reports the time spent handling each frame, and how many streams a
+// single core can handle in real time at that cost.
+static void reportFrames(qint64 frames, qint64 nsecs)
+{
+    const double nsPerFrame = double(nsecs) / frames;
+    qDebug("%.0f ns per frame, %.0f streams per core",
+           nsPerFrame, frameDuration * 1000000.0 / nsPerFrame);
+#if QT_VERSION >= 0x050200
+    QTest::setBenchmarkResult(nsPerFrame, QTest::WalltimeNanoseconds);
+#else
+    QTest::setBenchmarkResult(nsPerFrame / 1000000.0, QTest::WalltimeMilliseconds);
+#endif
+}
+
+// Returns one frame of a 440 Hz tone, as 16-bit little endian samples.
+static QByteArray toneFrame(int clockrate, int channels)
+{
+    const int samples = clockrate * frameDuration / 1000;
+    QByteArray pcm(samples * channels * 2, '\0');
+    for (int i = 0; i < samples; ++i) {
+        const qint16 value = qint16(8000 * qSin(2 * M_PI * 440 * i / clockrate));
+        for (int c = 0; c < channels; ++c)
+            qToLittleEndian<qint16>(value, (uchar*)pcm.data() + 2 * (i * channels + c));
+    }
+    return pcm;
+}
+
+// Returns an RTP packet carrying 20 ms of PCMA audio.
+static QByteArray pcmaPacket(quint16 sequence, quint32 stamp)
+{
+    QXmppRtpPacket packet;
+    packet.setType(8);
+    packet.setSequence(sequence);
+    packet.setStamp(stamp);
+    packet.setSsrc(1234);
+    packet.setPayload(QByteArray(160, '\xd5'));
+    return packet.encode();
+}
+
+#ifdef QXMPP_AUTOTEST_INTERNAL
+static QXmppCodec *createCodec(const QString &name, int clockrate, int channels)
+{
+    if (name == "PCMA")
+        return new QXmppG711aCodec(clockrate);
+    else if (name == "PCMU")
+        return new QXmppG711uCodec(clockrate);
+#ifdef QXMPP_USE_SPEEX
+    else if (name == "speex")
+        return new QXmppSpeexCodec(clockrate);
+#endif
+#ifdef QXMPP_USE_OPUS
+    else if (name == "opus")
+        return new QXmppOpusCodec(clockrate, channels);
+#endif
+    Q_UNUSED(channels);
+    return 0;
+}
+
+static QByteArray encodeFrame(QXmppCodec *codec, const QByteArray &pcm)
+{
+    QByteArray encoded;
+    QDataStream input(pcm);
+    input.setByteOrder(QDataStream::LittleEndian);
+    QDataStream output(&encoded, QIODevice::WriteOnly);
+    codec->encode(input, output);
+    return encoded;
+}
+#endif
+
+class tst_QXmppMedia : public QObject
+{
+    Q_OBJECT
+
+private slots:
+#ifdef QXMPP_AUTOTEST_INTERNAL
+    void codecEncode_data();
+    void codecEncode();
+    void codecDecode_data();
+    void codecDecode();
+#endif
+    void packetEncode_data();
+    void packetEncode();
+    void packetDecode_data();
+    void packetDecode();
+    void audioChannel_data();
+    void audioChannel();
+
+private:
+#ifdef QXMPP_AUTOTEST_INTERNAL
+    void addCodecRows();
+#endif
+    void addPacketRows();
+};
+
+#ifdef QXMPP_AUTOTEST_INTERNAL
+void tst_QXmppMedia::addCodecRows()
+{
+    QTest::addColumn<QString>("name");
+    QTest::addColumn<int>("clockrate");
+    QTest::addColumn<int>("channels");
+
+    QTest::newRow("g711a") << QString("PCMA") << 8000 << 1;
+    QTest::newRow("g711u") << QString("PCMU") << 8000 << 1;
+#ifdef QXMPP_USE_SPEEX
+    QTest::newRow("speex-8k") << QString("speex") << 8000 << 1;
+    QTest::newRow("speex-16k") << QString("speex") << 16000 << 1;
+#endif
+#ifdef QXMPP_USE_OPUS
+    QTest::newRow("opus-48k-mono") << QString("opus") << 48000 << 1;
+    QTest::newRow("opus-48k-stereo") << QString("opus") << 48000 << 2;
+#endif
+}
+
+void tst_QXmppMedia::codecEncode_data()
+{
+    addCodecRows();
+}
+
+void tst_QXmppMedia::codecEncode()
+{
+    QFETCH(QString, name);
+    QFETCH(int, clockrate);
+    QFETCH(int, channels);
+
+    QScopedPointer<QXmppCodec> codec(createCodec(name, clockrate, channels));
+    QVERIFY(!codec.isNull());
+    const QByteArray pcm = toneFrame(clockrate, channels);
+    QVERIFY(!encodeFrame(codec.data(), pcm).isEmpty());
+
+    // encode frames for at least half a second
+    QByteArray encoded;
+    QElapsedTimer timer;
+    timer.start();
+    qint64 frames = 0;
+    do {
+        for (int i = 0; i < 50; ++i) {
+            encoded.resize(0);
+            QDataStream input(pcm);
+            input.setByteOrder(QDataStream::LittleEndian);
+            QDataStream output(&encoded, QIODevice::WriteOnly);
+            codec->encode(input, output);
+        }
+        frames += 50;
+    } while (timer.elapsed() < 500);
+    reportFrames(frames, timer.nsecsElapsed());
+}
+
+void tst_QXmppMedia::codecDecode_data()
+{
+    addCodecRows();
+}
+
+void tst_QXmppMedia::codecDecode()
+{
+    QFETCH(QString, name);
+    QFETCH(int, clockrate);
+    QFETCH(int, channels);
+
+    QScopedPointer<QXmppCodec> encoder(createCodec(name, clockrate, channels));
+    QScopedPointer<QXmppCodec> decoder(createCodec(name, clockrate, channels));
+    QVERIFY(!encoder.isNull());
+    QVERIFY(!decoder.isNull());
+
+    // a second of encoded audio, so that stateful codecs do not decode
+    // the same frame over and over
+    const QByteArray pcm = toneFrame(clockrate, channels);
+    QList<QByteArray> packets;
+    for (int i = 0; i < 1000 / frameDuration; ++i) {
+        packets << encodeFrame(encoder.data(), pcm);
+        QVERIFY(!packets.last().isEmpty());
+    }
+
+    // decode frames for at least half a second
+    QByteArray decoded;
+    QElapsedTimer timer;
+    timer.start();
+    qint64 frames = 0;
+    do {
+        foreach (const QByteArray &packet, packets) {
+            decoded.resize(0);
+            QDataStream input(packet);
+            QDataStream output(&decoded, QIODevice::WriteOnly);
+            output.setByteOrder(QDataStream::LittleEndian);
+            decoder->decode(input, output);
+        }
+        frames += packets.size();
+    } while (timer.elapsed() < 500);
+    QCOMPARE(decoded.size(), pcm.size());
+    reportFrames(frames, timer.nsecsElapsed());
+}
+#endif
+
+void tst_QXmppMedia::addPacketRows()
+{
+    QTest::addColumn<int>("payloadSize");
+
+    QTest::newRow("g711") << 160;
+    QTest::newRow("opus") << 120;
+    QTest::newRow("video") << 1200;
+}
+
+void tst_QXmppMedia::packetEncode_data()
+{
+    addPacketRows();
+}
+
+void tst_QXmppMedia::packetEncode()
+{
+    QFETCH(int, payloadSize);
+
+    QXmppRtpPacket packet;
+    packet.setType(96);
+    packet.setSsrc(1234);
+    packet.setPayload(QByteArray(payloadSize, 'a'));
+
+    QByteArray data;
+    QElapsedTimer timer;
+    timer.start();
+    qint64 frames = 0;
+    do {
+        for (int i = 0; i < 1000; ++i) {
+            packet.setSequence(quint16(frames + i));
+            packet.encode(&data);
+        }
+        frames += 1000;
+    } while (timer.elapsed() < 500);
+    QCOMPARE(data.size(), 12 + payloadSize);
+    reportFrames(frames, timer.nsecsElapsed());
+}
+
+void tst_QXmppMedia::packetDecode_data()
+{
+    addPacketRows();
+}
+
+void tst_QXmppMedia::packetDecode()
+{
+    QFETCH(int, payloadSize);
+
+    QXmppRtpPacket source;
+    source.setType(96);
+    source.setSsrc(1234);
+    source.setPayload(QByteArray(payloadSize, 'a'));
+    const QByteArray data = source.encode();
+
+    QXmppRtpPacket packet;
+    QElapsedTimer timer;
+    timer.start();
+    qint64 frames = 0;
+    do {
+        for (int i = 0; i < 1000; ++i)
+            packet.decode(data);
+        frames += 1000;
+    } while (timer.elapsed() < 500);
+    QCOMPARE(packet.payload().size(), payloadSize);
+    reportFrames(frames, timer.nsecsElapsed());
+}
+
+void tst_QXmppMedia::audioChannel_data()
+{
+    QTest::addColumn<QList<int> >("events");
+
+    // A minute of audio sent every 20 ms, some of which is lost, which
+    // arrives with a random delay up to the given jitter. The receiver
+    // reads a frame every 20 ms. Events are the indexes of the packets
+    // in their order of arrival, with -1 for a read.
+    const struct {
+        const char *name;
+        int lossPercent;
+        int jitter;
+    } rows[] = {
+        { "clean", 0, 0 },
+        { "jitter-60ms", 0, 60 },
+        { "loss-5%", 5, 0 },
+        { "jitter-60ms-loss-5%", 5, 60 },
+    };
+
+    for (unsigned int r = 0; r < sizeof(rows) / sizeof(rows[0]); ++r) {
+        qsrand(1);
+        QMultiMap<int, int> arrivals;
+        for (int i = 0; i < channelPackets; ++i) {
+            if (int(qrand() % 100) < rows[r].lossPercent)
+                continue;
+            arrivals.insert(i * frameDuration + qrand() % (rows[r].jitter + 1), i);
+        }
+
+        QList<int> events;
+        int nextRead = 0;
+        QMultiMap<int, int>::const_iterator it;
+        for (it = arrivals.constBegin(); it != arrivals.constEnd(); ++it) {
+            for (; nextRead <= it.key(); nextRead += frameDuration)
+                events << -1;
+            events << it.value();
+        }
+        QTest::newRow(rows[r].name) << events;
+    }
+}
+
+void tst_QXmppMedia::audioChannel()
+{
+    QFETCH(QList<int>, events);
+
+    QXmppJinglePayloadType payload;
+    payload.setId(8);
+    payload.setChannels(1);
+    payload.setName("PCMA");
+    payload.setClockrate(8000);
+
+    QList<QByteArray> packets;
+    for (int i = 0; i < channelPackets; ++i)
+        packets << pcmaPacket(i + 1, i * 160);
+
+    // replay the minute of audio for at least half a second, each time
+    // to a new channel so that sequence numbers do not wrap
+    char frame[320];
+    qint64 elapsed = 0;
+    qint64 frames = 0;
+    while (elapsed < 500000000) {
+        QXmppRtpAudioChannel channel;
+        channel.setRemotePayloadTypes(QList<QXmppJinglePayloadType>() << payload);
+
+        QElapsedTimer timer;
+        timer.start();
+        foreach (int event, events) {
+            if (event < 0) {
+                channel.read(frame, sizeof(frame));
+                ++frames;
+            } else {
+                channel.datagramReceived(packets.at(event));
+            }
+        }
+        elapsed += timer.nsecsElapsed();
+    }
+    reportFrames(frames, elapsed);
+}
+
+QTEST_MAIN(tst_QXmppMedia)
+#include "tst_qxmppmedia.moc"
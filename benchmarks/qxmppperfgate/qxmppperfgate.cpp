@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+// Runs benchmarks and compares their results with baselines, failing if a
+// result regressed. This is what "make check-perf" runs in the tests
+// directory.
+//
+// Each baseline file describes a benchmark and holds the history of its
+// results:
+//
+//     command tst_qxmppstream/tst_qxmppstream
+//     format qtest
+//     threshold 10
+//     parseStanzas/small lower 812.5 798.1 805.3
+//
+// The command is relative to the benchmarks' build directory. The format
+// is "qtest" for QTestLib benchmarks, whose results are read from their
+// XML output, or "json" for programs which write flat JSON objects given
+// --output. Each metric line gives whether lower or higher values are
+// better, followed by the recorded results, oldest first.
+//
+// The benchmark is run several times. A metric regressed if its median is
+// worse than the median of its history by more than the threshold, in
+// percent, and by more than three times the median absolute deviation of
+// either the history or the runs, so that noisy benchmarks do not fail
+// spuriously. With --record, the medians are appended to the histories.
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QRegExp>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QXmlStreamReader>
+
+#include <math.h>
+
+// number of results kept in the history of a metric
+static const int historySize = 20;
+
+// scale of the median absolute deviation to estimate a standard deviation
+static const double madScale = 1.4826;
+
+struct GateOptions
+{
+    GateOptions()
+        : runs(5)
+        , threshold(10.0)
+        , record(false)
+    {
+    }
+
+    QString buildDir;
+    QStringList baselines;
+    int runs;
+    double threshold;
+    bool record;
+};
+
+struct Metric
+{
+    Metric()
+        : lowerIsBetter(true)
+    {
+    }
+
+    QString name;
+    bool lowerIsBetter;
+    QList<double> history;
+};
+
+static double median(QList<double> values)
+{
+    if (values.isEmpty())
+        return 0.0;
+    qSort(values);
+    const int middle = values.size() / 2;
+    return (values.size() % 2) ? values.at(middle) : (values.at(middle - 1) + values.at(middle)) / 2.0;
+}
+
+static double medianDeviation(const QList<double> &values)
+{
+    const double center = median(values);
+    QList<double> deviations;
+    foreach (double value, values)
+        deviations << fabs(value - center);
+    return madScale * median(deviations);
+}
+
+// A baseline file, with the benchmark it describes.
+class Baseline
+{
+public:
+    Baseline()
+        : threshold(-1.0)
+    {
+    }
+
+    bool load(const QString &fileName)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            qWarning("Could not read %s", qPrintable(fileName));
+            return false;
+        }
+        m_fileName = fileName;
+
+        QTextStream stream(&file);
+        while (!stream.atEnd()) {
+            const QString line = stream.readLine().trimmed();
+            if (line.isEmpty() || line.startsWith('#')) {
+                if (metrics.isEmpty() && command.isEmpty())
+                    m_header << line;
+                continue;
+            }
+
+            QStringList fields = line.split(' ', QString::SkipEmptyParts);
+            const QString key = fields.takeFirst();
+            if (key == "command") {
+                command = fields;
+            } else if (key == "format") {
+                format = fields.value(0);
+            } else if (key == "threshold") {
+                threshold = fields.value(0).toDouble();
+            } else if (fields.size() >= 1 && (fields.at(0) == "lower" || fields.at(0) == "higher")) {
+                Metric metric;
+                metric.name = key;
+                metric.lowerIsBetter = fields.takeFirst() == "lower";
+                foreach (const QString &field, fields)
+                    metric.history << field.toDouble();
+                metrics << metric;
+            } else {
+                qWarning("Invalid line in %s: %s", qPrintable(fileName), qPrintable(line));
+                return false;
+            }
+        }
+
+        if (command.isEmpty() || (format != "qtest" && format != "json")) {
+            qWarning("%s needs a command and a format", qPrintable(fileName));
+            return false;
+        }
+        return true;
+    }
+
+    bool save() const
+    {
+        QFile file(m_fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            qWarning("Could not write %s", qPrintable(m_fileName));
+            return false;
+        }
+
+        QTextStream stream(&file);
+        foreach (const QString &line, m_header)
+            stream << line << "\n";
+        stream << "command " << command.join(" ") << "\n";
+        stream << "format " << format << "\n";
+        if (threshold >= 0)
+            stream << "threshold " << threshold << "\n";
+        foreach (const Metric &metric, metrics) {
+            stream << metric.name << (metric.lowerIsBetter ? " lower" : " higher");
+            foreach (double value, metric.history)
+                stream << " " << value;
+            stream << "\n";
+        }
+        return true;
+    }
+
+    Metric *metric(const QString &name)
+    {
+        for (int i = 0; i < metrics.size(); ++i) {
+            if (metrics.at(i).name == name)
+                return &metrics[i];
+        }
+        return 0;
+    }
+
+    QString name() const
+    {
+        return QFileInfo(m_fileName).completeBaseName();
+    }
+
+    QStringList command;
+    QString format;
+    double threshold;
+    QList<Metric> metrics;
+
+private:
+    QString m_fileName;
+    QStringList m_header;
+};
+
+// Reads the per-iteration results of a QTestLib XML log.
+static bool readQTestResults(QIODevice *device, QMap<QString, double> &results, QMap<QString, bool> &lowerIsBetter)
+{
+    QXmlStreamReader reader(device);
+    QString function;
+    while (!reader.atEnd()) {
+        if (reader.readNext() != QXmlStreamReader::StartElement)
+            continue;
+        if (reader.name() == QLatin1String("TestFunction")) {
+            function = reader.attributes().value("name").toString();
+        } else if (reader.name() == QLatin1String("BenchmarkResult")) {
+            const QXmlStreamAttributes attributes = reader.attributes();
+            const QString tag = attributes.value("tag").toString();
+            const QString unit = attributes.value("metric").toString();
+            const double iterations = qMax(1.0, attributes.value("iterations").toString().toDouble());
+            const QString name = tag.isEmpty() ? function : function + "/" + tag;
+            results.insert(name, attributes.value("value").toString().toDouble() / iterations);
+            lowerIsBetter.insert(name, !unit.contains("PerSecond"));
+        }
+    }
+    return !reader.hasError();
+}
+
+// Reads the numbers of a flat JSON object.
+static bool readJsonResults(QIODevice *device, QMap<QString, double> &results, QMap<QString, bool> &lowerIsBetter)
+{
+    const QString json = QString::fromUtf8(device->readAll());
+    QRegExp rx("\"([^\"]+)\"\\s*:\\s*(-?[0-9][0-9.eE+-]*)\\s*[,}\\n]");
+    int pos = 0;
+    while ((pos = rx.indexIn(json, pos)) >= 0) {
+        const QString name = rx.cap(1);
+        results.insert(name, rx.cap(2).toDouble());
+        lowerIsBetter.insert(name, !name.contains("per-second") && !name.contains("mb-per"));
+        pos += rx.matchedLength() - 1;
+    }
+    return !results.isEmpty();
+}
+
+// Runs the benchmark once, and reads its results.
+static bool runBenchmark(const GateOptions &options, const Baseline &baseline, QMap<QString, double> &results, QMap<QString, bool> &lowerIsBetter)
+{
+    QTemporaryFile output;
+    if (!output.open())
+        return false;
+
+    QStringList arguments = baseline.command.mid(1);
+    if (baseline.format == "qtest")
+        arguments << "-xml" << "-o" << output.fileName();
+    else
+        arguments << "--output" << output.fileName();
+
+    const QString program = QDir(options.buildDir).absoluteFilePath(baseline.command.first());
+    QProcess process;
+    process.setWorkingDirectory(QFileInfo(program).absolutePath());
+    process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    process.start(program, arguments);
+    if (!process.waitForFinished(-1) || process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
+        qWarning("%s failed", qPrintable(program));
+        return false;
+    }
+
+    output.seek(0);
+    if (baseline.format == "qtest")
+        return readQTestResults(&output, results, lowerIsBetter);
+    return readJsonResults(&output, results, lowerIsBetter);
+}
+
+// Runs the benchmark of a baseline and compares its results. Returns false
+// if a metric regressed or the benchmark failed.
+static bool checkBaseline(const GateOptions &options, Baseline &baseline, QTextStream &report)
+{
+    if (baseline.metrics.isEmpty() && !options.record) {
+        report << baseline.name() << ": no results recorded, run with --record" << endl;
+        return true;
+    }
+
+    QMap<QString, QList<double> > runs;
+    QMap<QString, bool> lowerIsBetter;
+    for (int i = 0; i < options.runs; ++i) {
+        QMap<QString, double> results;
+        if (!runBenchmark(options, baseline, results, lowerIsBetter)) {
+            report << baseline.name() << ": FAILED to run" << endl;
+            return false;
+        }
+        for (QMap<QString, double>::const_iterator it = results.constBegin(); it != results.constEnd(); ++it)
+            runs[it.key()] << it.value();
+    }
+
+    const double threshold = baseline.threshold >= 0 ? baseline.threshold : options.threshold;
+    bool ok = true;
+    for (QMap<QString, QList<double> >::const_iterator it = runs.constBegin(); it != runs.constEnd(); ++it) {
+        const double current = median(it.value());
+        Metric *metric = baseline.metric(it.key());
+        if (!metric) {
+            // only metrics listed in the baseline are gated
+            if (!options.record)
+                continue;
+            Metric added;
+            added.name = it.key();
+            added.lowerIsBetter = lowerIsBetter.value(it.key(), true);
+            baseline.metrics << added;
+            metric = &baseline.metrics.last();
+        }
+
+        if (!metric->history.isEmpty()) {
+            const double reference = median(metric->history);
+            const double noise = 3.0 * qMax(medianDeviation(metric->history), medianDeviation(it.value()));
+            const double worse = metric->lowerIsBetter ? current - reference : reference - current;
+            const double change = reference ? 100.0 * worse / fabs(reference) : 0.0;
+            const bool regressed = change > threshold && worse > noise;
+            report << baseline.name() << ": " << metric->name << " " << current
+                   << " (baseline " << reference << ", " << QString::number(change, 'f', 1) << "% worse)";
+            if (regressed) {
+                report << " REGRESSION";
+                ok = false;
+            }
+            report << endl;
+        } else {
+            report << baseline.name() << ": " << metric->name << " " << current << " (no baseline)" << endl;
+        }
+
+        if (options.record) {
+            metric->history << current;
+            while (metric->history.size() > historySize)
+                metric->history.removeFirst();
+        }
+    }
+
+    if (options.record && !baseline.save())
+        return false;
+    return ok;
+}
+
+static void usage()
+{
+    QTextStream(stderr) <<
+        "Usage: qxmppperfgate [options] <baseline>...\n"
+        "\n"
+        "  --build-dir <dir>         build directory of the benchmarks (default: .)\n"
+        "  --runs <count>            number of runs of each benchmark (default: 5)\n"
+        "  --threshold <percent>     default regression threshold (default: 10)\n"
+        "  --record                  append the results to the baselines\n";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    GateOptions options;
+    options.buildDir = QDir::currentPath();
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        const QString arg = args.at(i);
+        const QString value = (i + 1 < args.size()) ? args.at(i + 1) : QString();
+        bool ok = true;
+        if (arg == "--record") {
+            options.record = true;
+            continue;
+        } else if (arg == "--build-dir") {
+            options.buildDir = value;
+        } else if (arg == "--runs") {
+            options.runs = value.toInt(&ok);
+            ok = ok && options.runs > 0;
+        } else if (arg == "--threshold") {
+            options.threshold = value.toDouble(&ok);
+        } else if (arg.startsWith("--")) {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        } else {
+            options.baselines << arg;
+            continue;
+        }
+        if (!ok) {
+            usage();
+            return 1;
+        }
+        ++i;
+    }
+    if (options.baselines.isEmpty()) {
+        usage();
+        return 1;
+    }
+
+    QTextStream report(stdout);
+    bool ok = true;
+    foreach (const QString &fileName, options.baselines) {
+        Baseline baseline;
+        if (!baseline.load(fileName) || !checkBaseline(options, baseline, report))
+            ok = false;
+    }
+    if (!ok)
+        report << "Performance regressions were found" << endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+QT -= gui
+
+TARGET = qxmppperfgate
+SOURCES += qxmppperfgate.cpp
+
+# do not install the tool
+target.CONFIG += no_default_install
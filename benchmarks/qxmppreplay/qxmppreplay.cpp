@@ -0,0 +1,684 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+// Replays the client traffic captured by QXmppServer::setTrafficCaptureFile()
+// against a local QXmppServer, and reports the throughput and the latency
+// of IQ requests:
+//
+//     make benchmark CAPTURE=morning.capture
+//
+// Each captured session is replayed on its own connection, at the pace it
+// was captured divided by --speed, or as fast as possible. With --copies,
+// the sessions are replayed several times in parallel, the users of each
+// copy being renamed so that the copies do not conflict. The server accepts
+// any password.
+//
+// Sessions which authenticated with another mechanism than PLAIN, or which
+// used stream compression when it is not supported, are skipped. STARTTLS
+// is removed from the replayed data, as the data was captured decrypted.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRegExp>
+#include <QSet>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+
+#include <ctype.h>
+
+#include "QXmppPasswordChecker.h"
+#include "QXmppServer.h"
+#include "QXmppServerMuc.h"
+
+struct ReplayOptions
+{
+    ReplayOptions()
+        : speed(1.0)
+        , copies(1)
+        , serverThreads(0)
+        , port(15222)
+    {
+    }
+
+    QString capture;
+    QString domain;
+    QString muc;
+    double speed;
+    int copies;
+    int serverThreads;
+    quint16 port;
+    QString output;
+};
+
+// Data received by a session, at a time in microseconds since the start
+// of the capture.
+struct ReplayChunk
+{
+    ReplayChunk()
+        : time(0), restarts(0)
+    {
+    }
+
+    qint64 time;
+    QByteArray data;
+    // number of stream restarts the server must have acknowledged
+    // before the chunk is sent
+    int restarts;
+};
+
+struct CapturedSession
+{
+    CapturedSession()
+        : openTime(0), closeTime(-1)
+    {
+    }
+
+    qint64 openTime;
+    qint64 closeTime;
+    QList<ReplayChunk> chunks;
+    QByteArray user;
+};
+
+// Accepts any password, so that the captured credentials are not needed.
+class ReplayPasswordChecker : public QXmppPasswordChecker
+{
+public:
+    QXmppPasswordReply *checkPassword(const QXmppPasswordRequest &request)
+    {
+        Q_UNUSED(request);
+        QXmppPasswordReply *reply = new QXmppPasswordReply;
+        reply->finishLater();
+        return reply;
+    }
+};
+
+// Returns the start tags of the elements with the given name.
+static QList<QByteArray> startTags(const QByteArray &data, const QByteArray &name)
+{
+    QList<QByteArray> tags;
+    const QByteArray open = '<' + name;
+    int pos = 0;
+    while ((pos = data.indexOf(open, pos)) >= 0) {
+        const int next = pos + open.size();
+        if (next < data.size() && (data.at(next) == ' ' || data.at(next) == '>' || data.at(next) == '/')) {
+            const int end = data.indexOf('>', next);
+            if (end < 0)
+                break;
+            tags << data.mid(pos, end + 1 - pos);
+            pos = end + 1;
+        } else {
+            pos = next;
+        }
+    }
+    return tags;
+}
+
+static QByteArray attribute(const QByteArray &tag, const QByteArray &name)
+{
+    QRegExp rx(QString("\\s%1=['\"]([^'\"]*)['\"]").arg(QString::fromLatin1(name)));
+    if (rx.indexIn(QString::fromUtf8(tag)) < 0)
+        return QByteArray();
+    return rx.cap(1).toUtf8();
+}
+
+static int stanzaCount(const QByteArray &data)
+{
+    return startTags(data, "message").size() +
+           startTags(data, "presence").size() +
+           startTags(data, "iq").size();
+}
+
+// Replays one captured session on a connection.
+class ReplaySession : public QObject
+{
+    Q_OBJECT
+
+public:
+    ReplaySession(const CapturedSession &session, const ReplayOptions &options, const QElapsedTimer &clock)
+        : m_session(session)
+        , m_options(options)
+        , m_clock(clock)
+        , m_next(0)
+        , m_restarts(0)
+        , m_connected(false)
+        , m_finished(false)
+        , m_stanzasSent(0)
+        , m_stanzasReceived(0)
+        , m_bytesSent(0)
+        , m_maximumLag(0)
+    {
+        m_timer.setSingleShot(true);
+        connect(&m_timer, SIGNAL(timeout()), this, SLOT(_q_sendNext()));
+        connect(&m_socket, SIGNAL(connected()), this, SLOT(_q_connected()));
+        connect(&m_socket, SIGNAL(readyRead()), this, SLOT(_q_readyRead()));
+        connect(&m_socket, SIGNAL(disconnected()), this, SLOT(_q_disconnected()));
+        connect(&m_socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(_q_disconnected()));
+    }
+
+    qint64 bytesSent() const { return m_bytesSent; }
+    qint64 stanzasSent() const { return m_stanzasSent; }
+    qint64 stanzasReceived() const { return m_stanzasReceived; }
+    qint64 maximumLag() const { return m_maximumLag; }
+    int pendingIqs() const { return m_pendingIqs.size(); }
+    const QVector<qint64> &latencies() const { return m_latencies; }
+
+signals:
+    void finished();
+
+public slots:
+    void start()
+    {
+        QTimer::singleShot(delay(m_session.openTime), this, SLOT(_q_connect()));
+    }
+
+private slots:
+    void _q_connect()
+    {
+        m_socket.connectToHost(QHostAddress(QHostAddress::LocalHost), m_options.port);
+    }
+
+    void _q_connected()
+    {
+        m_connected = true;
+        scheduleNext();
+    }
+
+    void _q_disconnected()
+    {
+        m_timer.stop();
+        finish();
+    }
+
+    void _q_readyRead()
+    {
+        const qint64 now = m_clock.nsecsElapsed() / 1000;
+        m_received += m_socket.readAll();
+
+        // only parse up to the last complete tag
+        const int end = m_received.lastIndexOf('>') + 1;
+        const QByteArray data = m_received.left(end);
+        m_received.remove(0, end);
+
+        m_restarts += data.count("<success") + data.count("<compressed");
+        m_stanzasReceived += stanzaCount(data);
+        foreach (const QByteArray &tag, startTags(data, "iq")) {
+            const QByteArray type = attribute(tag, "type");
+            if (type != "result" && type != "error")
+                continue;
+            QHash<QByteArray, qint64>::iterator it = m_pendingIqs.find(attribute(tag, "id"));
+            if (it != m_pendingIqs.end()) {
+                m_latencies << now - it.value();
+                m_pendingIqs.erase(it);
+            }
+        }
+
+        if (!m_timer.isActive())
+            scheduleNext();
+    }
+
+    void _q_sendNext()
+    {
+        const qint64 now = m_clock.nsecsElapsed() / 1000;
+        if (m_next >= m_session.chunks.size()) {
+            m_socket.disconnectFromHost();
+            return;
+        }
+
+        const ReplayChunk &chunk = m_session.chunks.at(m_next++);
+        if (m_options.speed > 0)
+            m_maximumLag = qMax(m_maximumLag, now - scheduledTime(chunk.time));
+        m_socket.write(chunk.data);
+        m_bytesSent += chunk.data.size();
+        m_stanzasSent += stanzaCount(chunk.data);
+        foreach (const QByteArray &tag, startTags(chunk.data, "iq")) {
+            const QByteArray type = attribute(tag, "type");
+            if (type == "get" || type == "set")
+                m_pendingIqs.insert(attribute(tag, "id"), now);
+        }
+        scheduleNext();
+    }
+
+private:
+    // Returns the time at which an event captured at \a time is due, in
+    // microseconds on the replay clock.
+    qint64 scheduledTime(qint64 time) const
+    {
+        return m_options.speed > 0 ? qint64(time / m_options.speed) : 0;
+    }
+
+    int delay(qint64 time) const
+    {
+        const qint64 due = scheduledTime(time) - m_clock.nsecsElapsed() / 1000;
+        return due > 0 ? int(due / 1000) : 0;
+    }
+
+    void scheduleNext()
+    {
+        if (!m_connected || m_finished || m_timer.isActive())
+            return;
+
+        if (m_next < m_session.chunks.size()) {
+            // wait until the server has acknowledged the stream restarts
+            const ReplayChunk &chunk = m_session.chunks.at(m_next);
+            if (chunk.restarts > m_restarts)
+                return;
+            m_timer.start(delay(chunk.time));
+        } else {
+            // disconnect when the session was closed, leaving time for
+            // the responses to the last requests
+            const int closeDelay = m_session.closeTime >= 0 ? delay(m_session.closeTime) : 0;
+            m_timer.start(qMax(closeDelay, m_pendingIqs.isEmpty() ? 0 : 1000));
+        }
+    }
+
+    void finish()
+    {
+        if (m_finished)
+            return;
+        m_finished = true;
+        emit finished();
+    }
+
+    CapturedSession m_session;
+    ReplayOptions m_options;
+    const QElapsedTimer &m_clock;
+    QTcpSocket m_socket;
+    QTimer m_timer;
+    int m_next;
+    int m_restarts;
+    bool m_connected;
+    bool m_finished;
+    QByteArray m_received;
+    QHash<QByteArray, qint64> m_pendingIqs;
+    QVector<qint64> m_latencies;
+    qint64 m_stanzasSent;
+    qint64 m_stanzasReceived;
+    qint64 m_bytesSent;
+    qint64 m_maximumLag;
+};
+
+// Reads the capture, and prepares its sessions for replay.
+class ReplayCapture
+{
+public:
+    ReplayCapture()
+        : skipped(0)
+    {
+    }
+
+    bool load(const QString &fileName)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qWarning("Could not read %s", qPrintable(fileName));
+            return false;
+        }
+
+        QMap<int, CapturedSession> captured;
+        while (!file.atEnd()) {
+            const QByteArray line = file.readLine().trimmed();
+            if (line.isEmpty() || line.startsWith('#'))
+                continue;
+            const QList<QByteArray> fields = line.split(' ');
+            if (fields.size() < 3) {
+                qWarning("Invalid capture line: %s", line.constData());
+                return false;
+            }
+            const qint64 time = fields.at(0).toLongLong();
+            CapturedSession &session = captured[fields.at(1).toInt()];
+            if (fields.at(2) == "open") {
+                session.openTime = time;
+            } else if (fields.at(2) == "close") {
+                session.closeTime = time;
+            } else if (fields.at(2) == "data" && fields.size() > 3) {
+                ReplayChunk chunk;
+                chunk.time = time;
+                chunk.data = QByteArray::fromBase64(fields.at(3));
+                session.chunks << chunk;
+            }
+        }
+
+        foreach (CapturedSession session, captured) {
+            if (prepare(session)) {
+                sessions << session;
+                if (!session.user.isEmpty())
+                    users << session.user;
+            } else {
+                skipped++;
+            }
+        }
+        return true;
+    }
+
+    // Returns the sessions renamed for the given \a copy.
+    QList<CapturedSession> copy(int copy) const
+    {
+        if (!copy)
+            return sessions;
+
+        QList<CapturedSession> copies;
+        foreach (CapturedSession session, sessions) {
+            for (int i = 0; i < session.chunks.size(); ++i)
+                session.chunks[i].data = rename(session.chunks.at(i).data, copy);
+            copies << session;
+        }
+        return copies;
+    }
+
+    QString domain;
+    QList<CapturedSession> sessions;
+    QSet<QByteArray> users;
+    int skipped;
+
+private:
+    bool prepare(CapturedSession &session)
+    {
+        QRegExp authRx("<auth[^>]*>([^<]*)</auth>");
+        QRegExp tlsRx("<starttls[^>]*(/>|>\\s*</starttls>)");
+        QRegExp headerRx("(<\\?xml[^>]*\\?>)?\\s*<stream:stream[^>]*>");
+
+        bool removeHeader = false;
+        int streams = 0;
+        for (int i = 0; i < session.chunks.size(); ++i) {
+            ReplayChunk &chunk = session.chunks[i];
+            QString text = QString::fromUtf8(chunk.data);
+
+            if (text.contains("<auth")) {
+                if (!text.contains("mechanism='PLAIN'") && !text.contains("mechanism=\"PLAIN\""))
+                    return false;
+                if (authRx.indexIn(text) >= 0) {
+                    const QList<QByteArray> parts = QByteArray::fromBase64(authRx.cap(1).toLatin1()).split('\0');
+                    if (parts.size() > 1)
+                        session.user = parts.at(1);
+                }
+            }
+            if (text.contains("<compress") && !QXmppStream::isCompressionSupported())
+                return false;
+
+            // TLS is not replayed, nor the stream it restarts
+            if (tlsRx.indexIn(text) >= 0) {
+                text.remove(tlsRx);
+                removeHeader = true;
+            } else if (removeHeader && headerRx.indexIn(text) >= 0) {
+                text.remove(headerRx.pos(0), headerRx.matchedLength());
+                removeHeader = false;
+            }
+
+            if (text.contains("<stream:stream")) {
+                if (domain.isEmpty()) {
+                    QRegExp toRx("\\sto=['\"]([^'\"]*)['\"]");
+                    if (toRx.indexIn(text) >= 0)
+                        domain = toRx.cap(1);
+                }
+                chunk.restarts = streams++;
+            } else {
+                chunk.restarts = qMax(0, streams - 1);
+            }
+            chunk.data = text.toUtf8();
+        }
+
+        // drop the chunks which were emptied
+        for (int i = session.chunks.size() - 1; i >= 0; --i) {
+            if (session.chunks.at(i).data.trimmed().isEmpty())
+                session.chunks.removeAt(i);
+        }
+        return !session.chunks.isEmpty();
+    }
+
+    // Renames the users of the capture in \a data, so that each copy of
+    // the sessions has its own users.
+    QByteArray rename(const QByteArray &data, int copy) const
+    {
+        const QByteArray suffix = '.' + QByteArray::number(copy);
+
+        // credentials
+        QString text = QString::fromUtf8(data);
+        QRegExp authRx("<auth([^>]*)>([^<]*)</auth>");
+        if (authRx.indexIn(text) >= 0) {
+            const QList<QByteArray> parts = QByteArray::fromBase64(authRx.cap(2).toLatin1()).split('\0');
+            if (parts.size() == 3 && users.contains(parts.at(1))) {
+                const QByteArray payload = QByteArray(1, '\0') + parts.at(1) + suffix + '\0' + parts.at(2);
+                text.replace(authRx.pos(0), authRx.matchedLength(), QString("<auth%1>%2</auth>").arg(
+                    authRx.cap(1), QString::fromLatin1(payload.toBase64())));
+            }
+        }
+
+        // addresses
+        QByteArray renamed = text.toUtf8();
+        foreach (const QByteArray &user, users) {
+            const QByteArray jid = user + '@' + domain.toUtf8();
+            int pos = 0;
+            while ((pos = renamed.indexOf(jid, pos)) >= 0) {
+                const char before = pos > 0 ? renamed.at(pos - 1) : ' ';
+                if (!isalnum(before) && before != '.' && before != '_' && before != '-') {
+                    renamed.insert(pos + user.size(), suffix);
+                    pos += suffix.size();
+                }
+                pos += jid.size();
+            }
+        }
+        return renamed;
+    }
+};
+
+// Starts the server and the sessions, and reports the results.
+class ReplayController : public QObject
+{
+    Q_OBJECT
+
+public:
+    ReplayController(const ReplayOptions &options)
+        : m_options(options)
+        , m_running(0)
+    {
+    }
+
+    ~ReplayController()
+    {
+        qDeleteAll(m_sessions);
+    }
+
+    bool start()
+    {
+        if (!m_capture.load(m_options.capture))
+            return false;
+        if (m_capture.sessions.isEmpty()) {
+            qWarning("No session can be replayed from %s", qPrintable(m_options.capture));
+            return false;
+        }
+        if (m_capture.skipped)
+            qWarning("Skipped %i sessions which cannot be replayed", m_capture.skipped);
+
+        const QString domain = m_options.domain.isEmpty() ? m_capture.domain : m_options.domain;
+        m_server.setDomain(domain.isEmpty() ? QString("localhost") : domain);
+        m_server.setPasswordChecker(&m_passwordChecker);
+        m_server.setWorkerThreadCount(m_options.serverThreads);
+        m_server.setStreamCompressionEnabled(QXmppStream::isCompressionSupported());
+        if (!m_options.muc.isEmpty()) {
+            QXmppServerMuc *muc = new QXmppServerMuc;
+            muc->setJid(m_options.muc);
+            m_server.addExtension(muc);
+        }
+        if (!m_server.listenForClients(QHostAddress::LocalHost, m_options.port)) {
+            qWarning("Could not listen on port %i", m_options.port);
+            return false;
+        }
+
+        m_clock.start();
+        for (int copy = 0; copy < m_options.copies; ++copy) {
+            foreach (const CapturedSession &captured, m_capture.copy(copy)) {
+                ReplaySession *session = new ReplaySession(captured, m_options, m_clock);
+                connect(session, SIGNAL(finished()), this, SLOT(_q_sessionFinished()));
+                m_sessions << session;
+                session->start();
+            }
+        }
+        m_running = m_sessions.size();
+        qDebug("Replaying %i sessions", m_running);
+        return true;
+    }
+
+private slots:
+    void _q_sessionFinished()
+    {
+        if (--m_running > 0)
+            return;
+
+        const double elapsed = m_clock.nsecsElapsed() / 1000000000.0;
+        qint64 bytesSent = 0;
+        qint64 stanzasSent = 0;
+        qint64 stanzasReceived = 0;
+        qint64 maximumLag = 0;
+        int unanswered = 0;
+        QVector<qint64> latencies;
+        foreach (ReplaySession *session, m_sessions) {
+            bytesSent += session->bytesSent();
+            stanzasSent += session->stanzasSent();
+            stanzasReceived += session->stanzasReceived();
+            maximumLag = qMax(maximumLag, session->maximumLag());
+            unanswered += session->pendingIqs();
+            latencies += session->latencies();
+        }
+        qSort(latencies);
+
+        QString json;
+        QTextStream stream(&json);
+        stream << "{\n";
+        stream << "  \"sessions\": " << m_sessions.size() << ",\n";
+        stream << "  \"skipped-sessions\": " << m_capture.skipped << ",\n";
+        stream << "  \"copies\": " << m_options.copies << ",\n";
+        stream << "  \"speed\": " << m_options.speed << ",\n";
+        stream << "  \"duration\": " << elapsed << ",\n";
+        stream << "  \"stanzas-sent\": " << stanzasSent << ",\n";
+        stream << "  \"stanzas-received\": " << stanzasReceived << ",\n";
+        stream << "  \"stanzas-per-second\": " << stanzasSent / elapsed << ",\n";
+        stream << "  \"bytes-per-second\": " << bytesSent / elapsed << ",\n";
+        stream << "  \"iq-latency-p50-us\": " << percentile(latencies, 0.5) << ",\n";
+        stream << "  \"iq-latency-p99-us\": " << percentile(latencies, 0.99) << ",\n";
+        stream << "  \"iq-latency-p999-us\": " << percentile(latencies, 0.999) << ",\n";
+        stream << "  \"unanswered-iqs\": " << unanswered << ",\n";
+        stream << "  \"maximum-schedule-lag-us\": " << maximumLag << "\n";
+        stream << "}\n";
+        stream.flush();
+
+        if (m_options.output.isEmpty()) {
+            QTextStream(stdout) << json;
+        } else {
+            QFile file(m_options.output);
+            if (!file.open(QIODevice::WriteOnly)) {
+                qWarning("Could not write %s", qPrintable(m_options.output));
+                QCoreApplication::exit(1);
+                return;
+            }
+            file.write(json.toUtf8());
+        }
+        QCoreApplication::exit(0);
+    }
+
+private:
+    static qint64 percentile(const QVector<qint64> &sorted, double fraction)
+    {
+        if (sorted.isEmpty())
+            return 0;
+        return sorted.at(qMin(sorted.size() - 1, int(sorted.size() * fraction)));
+    }
+
+    ReplayOptions m_options;
+    ReplayCapture m_capture;
+    QXmppServer m_server;
+    ReplayPasswordChecker m_passwordChecker;
+    QList<ReplaySession*> m_sessions;
+    QElapsedTimer m_clock;
+    int m_running;
+};
+
+static void usage()
+{
+    QTextStream(stderr) <<
+        "Usage: qxmppreplay --capture <file> [options]\n"
+        "\n"
+        "  --capture <file>          traffic captured by QXmppServer\n"
+        "  --speed <factor>|max      replay speed (default: 1)\n"
+        "  --copies <count>          number of copies of the sessions replayed in parallel (default: 1)\n"
+        "  --domain <domain>         domain of the server (default: from the capture)\n"
+        "  --muc <jid>               serve multi-user chat rooms at this JID\n"
+        "  --server-threads <count>  number of server worker threads (default: 0)\n"
+        "  --port <port>             port on which the server listens (default: 15222)\n"
+        "  --output <file>           write the JSON results to a file instead of stdout\n";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    ReplayOptions options;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        const QString arg = args.at(i);
+        const QString value = (i + 1 < args.size()) ? args.at(i + 1) : QString();
+        bool ok = true;
+        if (arg == "--capture") {
+            options.capture = value;
+        } else if (arg == "--speed") {
+            options.speed = (value == "max") ? 0.0 : value.toDouble(&ok);
+            ok = ok && options.speed >= 0;
+        } else if (arg == "--copies") {
+            options.copies = value.toInt(&ok);
+        } else if (arg == "--domain") {
+            options.domain = value;
+        } else if (arg == "--muc") {
+            options.muc = value;
+        } else if (arg == "--server-threads") {
+            options.serverThreads = value.toInt(&ok);
+        } else if (arg == "--port") {
+            options.port = value.toUShort(&ok);
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+        if (!ok || options.copies < 1) {
+            usage();
+            return 1;
+        }
+        ++i;
+    }
+    if (options.capture.isEmpty() || options.capture.startsWith("--")) {
+        usage();
+        return 1;
+    }
+
+    ReplayController controller(options);
+    if (!controller.start())
+        return 1;
+    return app.exec();
+}
+
+#include "qxmppreplay.moc"
@@ -0,0 +1,5 @@
+BENCHMARK_ARGS = --capture $(CAPTURE) --output $(TARGET).json
+include(../benchmarks.pri)
+CONFIG += console
+TARGET = qxmppreplay
+SOURCES += qxmppreplay.cpp
@@ -0,0 +1,512 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+// Load generator for QXmppServer.
+//
+// The server and the simulated clients run in the same process, so the
+// reported CPU time and memory cover both. Each client needs two file
+// descriptors, so raise the limit (ulimit -n) for large runs.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+
+#include "QXmppServer.h"
+#include "processusage.h"
+#include "util.h"
+
+static const QByteArray streamHeader("<?xml version='1.0'?><stream:stream to='localhost' version='1.0'"
+                                     " xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>");
+
+struct LoadOptions
+{
+    LoadOptions()
+        : clients(1000)
+        , threads(4)
+        , serverThreads(0)
+        , duration(10)
+        , rate(1.0)
+        , messages(80)
+        , presences(10)
+        , iqs(10)
+        , port(15222)
+    {
+    }
+
+    int clients;
+    int threads;
+    int serverThreads;
+    int duration;
+    double rate;
+    int messages;
+    int presences;
+    int iqs;
+    quint16 port;
+    QString output;
+};
+
+// A simulated client, which is a raw XMPP stream.
+struct LoadClient
+{
+    enum State
+    {
+        Connecting,
+        Authenticating,
+        Restarting,
+        Binding,
+        Bound
+    };
+
+    LoadClient()
+        : socket(0), state(Connecting)
+    {
+    }
+
+    QTcpSocket *socket;
+    State state;
+    QByteArray user;
+    QByteArray buffer;
+};
+
+// Drives a share of the clients from its own thread.
+class LoadWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadWorker(const LoadOptions &options, int first, int step, const QElapsedTimer &clock)
+        : m_options(options)
+        , m_clock(clock)
+        , m_boundCount(0)
+        , m_sentCount(0)
+        , m_credit(0)
+        , m_timer(0)
+        , m_seed(1)
+    {
+        for (int i = first; i < options.clients; i += step) {
+            LoadClient *client = new LoadClient;
+            client->user = "user" + QByteArray::number(i);
+            m_clients << client;
+        }
+        m_seed = first + 1;
+    }
+
+    ~LoadWorker()
+    {
+        qDeleteAll(m_clients);
+    }
+
+    int clientCount() const { return m_clients.size(); }
+    qint64 sentCount() const { return m_sentCount; }
+    const QVector<qint64> &latencies() const { return m_latencies; }
+
+signals:
+    void clientsBound(int count);
+
+public slots:
+    void connectClients()
+    {
+        foreach (LoadClient *client, m_clients) {
+            client->socket = new QTcpSocket(this);
+            m_sockets.insert(client->socket, client);
+            connect(client->socket, SIGNAL(connected()), this, SLOT(_q_connected()));
+            connect(client->socket, SIGNAL(readyRead()), this, SLOT(_q_readyRead()));
+            client->socket->connectToHost(QHostAddress(QHostAddress::LocalHost), m_options.port);
+        }
+    }
+
+    void startLoad()
+    {
+        qsrand(m_seed);
+        m_timer = new QTimer(this);
+        m_timer->setInterval(10);
+        connect(m_timer, SIGNAL(timeout()), this, SLOT(_q_sendLoad()));
+        m_timer->start();
+    }
+
+    void stopLoad()
+    {
+        if (m_timer)
+            m_timer->stop();
+    }
+
+    void disconnectClients()
+    {
+        foreach (LoadClient *client, m_clients) {
+            delete client->socket;
+            client->socket = 0;
+        }
+        m_sockets.clear();
+    }
+
+private slots:
+    void _q_connected()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+        if (socket)
+            socket->write(streamHeader);
+    }
+
+    void _q_readyRead()
+    {
+        LoadClient *client = m_sockets.value(sender());
+        if (!client)
+            return;
+        client->buffer += client->socket->readAll();
+
+        switch (client->state) {
+        case LoadClient::Connecting:
+            if (client->buffer.contains("</stream:features>")) {
+                client->buffer.clear();
+                client->socket->write("<auth xmlns='urn:ietf:params:xml:ns:xmpp-sasl' mechanism='PLAIN'>" +
+                    (QByteArray(1, '\0') + client->user + QByteArray("\0testpwd", 8)).toBase64() + "</auth>");
+                client->state = LoadClient::Authenticating;
+            }
+            break;
+        case LoadClient::Authenticating:
+            if (client->buffer.contains("<success")) {
+                client->buffer.clear();
+                client->socket->write(streamHeader);
+                client->state = LoadClient::Restarting;
+            }
+            break;
+        case LoadClient::Restarting:
+            if (client->buffer.contains("</stream:features>")) {
+                client->buffer.clear();
+                client->socket->write("<iq type='set' id='bind'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+                                      "<resource>load</resource></bind></iq>");
+                client->state = LoadClient::Binding;
+            }
+            break;
+        case LoadClient::Binding:
+            if (client->buffer.contains("</iq>")) {
+                client->buffer.clear();
+                client->state = LoadClient::Bound;
+                emit clientsBound(++m_boundCount);
+            }
+            break;
+        case LoadClient::Bound:
+            readLatencies(client);
+            break;
+        }
+    }
+
+    void _q_sendLoad()
+    {
+        // send the stanzas due since the last tick
+        m_credit += m_options.rate * m_clients.size() * m_timer->interval() / 1000.0;
+        const int total = m_options.messages + m_options.presences + m_options.iqs;
+        while (m_credit >= 1.0 && total > 0) {
+            m_credit -= 1.0;
+            LoadClient *client = m_clients.at(qrand() % m_clients.size());
+            const QByteArray to = "user" + QByteArray::number(qrand() % m_options.clients) + "@localhost/load";
+            const QByteArray id = "L" + QByteArray::number(m_clock.nsecsElapsed() / 1000);
+            const int kind = qrand() % total;
+            if (kind < m_options.messages) {
+                client->socket->write("<message to='" + to + "' type='chat' id='" + id + "'>"
+                                      "<body>Hello, this is a benchmark message.</body></message>");
+            } else if (kind < m_options.messages + m_options.presences) {
+                client->socket->write("<presence to='" + to + "' id='" + id + "'><status>Busy</status></presence>");
+            } else {
+                client->socket->write("<iq to='" + to + "' type='get' id='" + id + "'>"
+                                      "<ping xmlns='urn:xmpp:ping'/></iq>");
+            }
+            m_sentCount++;
+        }
+    }
+
+private:
+    // Records the delivery latency of the stanzas whose id carries the time
+    // they were sent.
+    void readLatencies(LoadClient *client)
+    {
+        const QByteArray &data = client->buffer;
+        const qint64 now = m_clock.nsecsElapsed() / 1000;
+        int pos = 0;
+        int keep = qMax(0, data.size() - 5);
+        while ((pos = data.indexOf("id=", pos)) >= 0) {
+            if (pos + 5 > data.size()) {
+                keep = pos;
+                break;
+            }
+            const char quote = data.at(pos + 3);
+            if ((quote != '\'' && quote != '"') || data.at(pos + 4) != 'L') {
+                pos += 3;
+                continue;
+            }
+            const int end = data.indexOf(quote, pos + 5);
+            if (end < 0) {
+                keep = pos;
+                break;
+            }
+            bool ok = false;
+            const qint64 sent = data.mid(pos + 5, end - pos - 5).toLongLong(&ok);
+            if (ok)
+                m_latencies << now - sent;
+            pos = end + 1;
+            keep = pos;
+        }
+        client->buffer = data.mid(keep);
+    }
+
+    LoadOptions m_options;
+    QElapsedTimer m_clock;
+    QList<LoadClient*> m_clients;
+    QHash<QObject*, LoadClient*> m_sockets;
+    int m_boundCount;
+    qint64 m_sentCount;
+    double m_credit;
+    QTimer *m_timer;
+    uint m_seed;
+    QVector<qint64> m_latencies;
+};
+
+// Starts the server and the workers, and reports the results.
+class LoadController : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadController(const LoadOptions &options)
+        : m_options(options)
+        , m_boundCount(0)
+        , m_cpuTime(0)
+    {
+        m_clock.start();
+    }
+
+    ~LoadController()
+    {
+        foreach (QThread *thread, m_threads) {
+            thread->quit();
+            thread->wait();
+        }
+        qDeleteAll(m_workers);
+        qDeleteAll(m_threads);
+    }
+
+    bool start()
+    {
+        for (int i = 0; i < m_options.clients; ++i)
+            m_passwordChecker.addCredentials("user" + QString::number(i), "testpwd");
+
+        m_server.setDomain("localhost");
+        m_server.setPasswordChecker(&m_passwordChecker);
+        m_server.setWorkerThreadCount(m_options.serverThreads);
+        if (!m_server.listenForClients(QHostAddress::LocalHost, m_options.port)) {
+            qWarning("Could not listen on port %i", m_options.port);
+            return false;
+        }
+
+        const int threadCount = qBound(1, m_options.threads, m_options.clients);
+        for (int i = 0; i < threadCount; ++i) {
+            QThread *thread = new QThread;
+            LoadWorker *worker = new LoadWorker(m_options, i, threadCount, m_clock);
+            worker->moveToThread(thread);
+            connect(worker, SIGNAL(clientsBound(int)), this, SLOT(_q_clientsBound()));
+            thread->start();
+            m_threads << thread;
+            m_workers << worker;
+            QMetaObject::invokeMethod(worker, "connectClients");
+        }
+
+        QTimer::singleShot(120000, this, SLOT(_q_connectTimeout()));
+        return true;
+    }
+
+private slots:
+    void _q_clientsBound()
+    {
+        if (++m_boundCount < m_options.clients)
+            return;
+
+        qDebug("%i clients connected in %.1f s", m_boundCount, m_clock.elapsed() / 1000.0);
+        m_cpuTime = cpuTime();
+        m_loadClock.start();
+        foreach (LoadWorker *worker, m_workers)
+            QMetaObject::invokeMethod(worker, "startLoad");
+        QTimer::singleShot(m_options.duration * 1000, this, SLOT(_q_stopLoad()));
+    }
+
+    void _q_connectTimeout()
+    {
+        if (m_boundCount < m_options.clients) {
+            qWarning("Only %i of %i clients connected", m_boundCount, m_options.clients);
+            QCoreApplication::exit(1);
+        }
+    }
+
+    void _q_stopLoad()
+    {
+        foreach (LoadWorker *worker, m_workers)
+            QMetaObject::invokeMethod(worker, "stopLoad");
+
+        // leave time for the stanzas in flight to be delivered
+        QTimer::singleShot(1000, this, SLOT(_q_report()));
+    }
+
+    void _q_report()
+    {
+        const double elapsed = m_loadClock.elapsed() / 1000.0;
+        const double cpu = (cpuTime() - m_cpuTime) / 1000000.0;
+
+        foreach (LoadWorker *worker, m_workers)
+            QMetaObject::invokeMethod(worker, "disconnectClients", Qt::BlockingQueuedConnection);
+        foreach (QThread *thread, m_threads) {
+            thread->quit();
+            thread->wait();
+        }
+
+        qint64 sent = 0;
+        QVector<qint64> latencies;
+        foreach (LoadWorker *worker, m_workers) {
+            sent += worker->sentCount();
+            latencies += worker->latencies();
+        }
+        qSort(latencies);
+
+        QString json;
+        QTextStream stream(&json);
+        stream << "{\n";
+        stream << "  \"clients\": " << m_options.clients << ",\n";
+        stream << "  \"client-threads\": " << m_options.threads << ",\n";
+        stream << "  \"server-threads\": " << m_options.serverThreads << ",\n";
+        stream << "  \"duration\": " << m_options.duration << ",\n";
+        stream << "  \"mix\": [" << m_options.messages << ", " << m_options.presences << ", " << m_options.iqs << "],\n";
+        stream << "  \"sent\": " << sent << ",\n";
+        stream << "  \"delivered\": " << latencies.size() << ",\n";
+        stream << "  \"stanzas-per-second\": " << latencies.size() / elapsed << ",\n";
+        stream << "  \"latency-p50-us\": " << percentile(latencies, 0.5) << ",\n";
+        stream << "  \"latency-p99-us\": " << percentile(latencies, 0.99) << ",\n";
+        stream << "  \"latency-p999-us\": " << percentile(latencies, 0.999) << ",\n";
+        stream << "  \"cpu-seconds\": " << cpu << ",\n";
+        stream << "  \"cpu-percent\": " << 100.0 * cpu / elapsed << ",\n";
+        stream << "  \"rss-bytes\": " << residentSize() << "\n";
+        stream << "}\n";
+        stream.flush();
+
+        if (m_options.output.isEmpty()) {
+            QTextStream(stdout) << json;
+        } else {
+            QFile file(m_options.output);
+            if (!file.open(QIODevice::WriteOnly)) {
+                qWarning("Could not write %s", qPrintable(m_options.output));
+                QCoreApplication::exit(1);
+                return;
+            }
+            file.write(json.toUtf8());
+        }
+        QCoreApplication::exit(0);
+    }
+
+private:
+    static qint64 percentile(const QVector<qint64> &sorted, double fraction)
+    {
+        if (sorted.isEmpty())
+            return 0;
+        return sorted.at(qMin(sorted.size() - 1, int(sorted.size() * fraction)));
+    }
+
+    LoadOptions m_options;
+    QXmppServer m_server;
+    TestPasswordChecker m_passwordChecker;
+    QList<QThread*> m_threads;
+    QList<LoadWorker*> m_workers;
+    QElapsedTimer m_clock;
+    QElapsedTimer m_loadClock;
+    int m_boundCount;
+    qint64 m_cpuTime;
+};
+
+static void usage()
+{
+    QTextStream(stderr) <<
+        "Usage: qxmppserverload [options]\n"
+        "\n"
+        "  --clients <count>         number of simulated clients (default: 1000)\n"
+        "  --threads <count>         number of client threads (default: 4)\n"
+        "  --server-threads <count>  number of server worker threads (default: 0)\n"
+        "  --duration <secs>         duration of the load (default: 10)\n"
+        "  --rate <stanzas>          stanzas per second sent by each client (default: 1)\n"
+        "  --mix <m>,<p>,<i>         weights of messages, presences and IQs (default: 80,10,10)\n"
+        "  --port <port>             port on which the server listens (default: 15222)\n"
+        "  --output <file>           write the JSON results to a file instead of stdout\n";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    LoadOptions options;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        const QString arg = args.at(i);
+        const QString value = (i + 1 < args.size()) ? args.at(i + 1) : QString();
+        bool ok = true;
+        if (arg == "--clients") {
+            options.clients = value.toInt(&ok);
+        } else if (arg == "--threads") {
+            options.threads = value.toInt(&ok);
+        } else if (arg == "--server-threads") {
+            options.serverThreads = value.toInt(&ok);
+        } else if (arg == "--duration") {
+            options.duration = value.toInt(&ok);
+        } else if (arg == "--rate") {
+            options.rate = value.toDouble(&ok);
+        } else if (arg == "--mix") {
+            const QStringList weights = value.split(',');
+            ok = weights.size() == 3;
+            if (ok) {
+                options.messages = weights.at(0).toInt();
+                options.presences = weights.at(1).toInt();
+                options.iqs = weights.at(2).toInt();
+            }
+        } else if (arg == "--port") {
+            options.port = value.toUShort(&ok);
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+        if (!ok || options.clients < 1) {
+            usage();
+            return 1;
+        }
+        ++i;
+    }
+
+    LoadController controller(options);
+    if (!controller.start())
+        return 1;
+    return app.exec();
+}
+
+#include "qxmppserverload.moc"
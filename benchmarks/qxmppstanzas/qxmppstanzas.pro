@@ -0,0 +1,3 @@
+include(../benchmarks.pri)
+TARGET = tst_qxmppstanzas
+SOURCES += tst_qxmppstanzas.cpp
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+
+#include "QXmppDataForm.h"
+#include "QXmppJingleIq.h"
+#include "QXmppMessage.h"
+#include "QXmppPresence.h"
+#include "QXmppRosterIq.h"
+#include "QXmppVCardIq.h"
+#include "util.h"
+
+enum PacketType
+{
+    DataFormPacket,
+    JinglePacket,
+    MessagePacket,
+    PresencePacket,
+    RosterPacket,
+    VCardPacket
+};
+Q_DECLARE_METATYPE(PacketType)
+
+template <class T>
+static void benchmarkParse(const QByteArray &xml)
+{
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+    const QDomElement element = doc.documentElement();
+
+    QBENCHMARK {
+        T packet;
+        packet.parse(element);
+    }
+}
+
+template <class T>
+static void benchmarkSerialize(const QByteArray &xml)
+{
+    T packet;
+    parsePacket(packet, xml);
+
+    QByteArray data;
+    data.reserve(2 * xml.size());
+    QBENCHMARK {
+        data.resize(0);
+        QXmlStreamWriter writer(&data);
+        packet.toXml(&writer);
+    }
+}
+
+static QByteArray dataFormXml()
+{
+    QByteArray xml("<x xmlns=\"jabber:x:data\" type=\"form\">"
+                   "<title>Bot Configuration</title>"
+                   "<instructions>Fill out this form to configure your new bot!</instructions>");
+    for (int i = 0; i < 20; ++i) {
+        const QByteArray n = QByteArray::number(i);
+        xml += "<field type=\"list-single\" label=\"Option " + n + "\" var=\"option" + n + "\">"
+               "<value>b</value>"
+               "<option label=\"A\"><value>a</value></option>"
+               "<option label=\"B\"><value>b</value></option>"
+               "<option label=\"C\"><value>c</value></option>"
+               "</field>";
+    }
+    xml += "</x>";
+    return xml;
+}
+
+static QByteArray jingleXml()
+{
+    return QByteArray(
+        "<iq id=\"zid615d9\" to=\"juliet@capulet.lit/balcony\" from=\"romeo@montague.lit/orchard\" type=\"set\">"
+        "<jingle xmlns=\"urn:xmpp:jingle:1\" action=\"session-initiate\" initiator=\"romeo@montague.lit/orchard\" sid=\"a73sjjvkla37jfea\">"
+        "<content creator=\"initiator\" name=\"voice\">"
+        "<description xmlns=\"urn:xmpp:jingle:apps:rtp:1\" media=\"audio\">"
+        "<payload-type id=\"96\" name=\"speex\" clockrate=\"16000\"/>"
+        "<payload-type id=\"97\" name=\"speex\" clockrate=\"8000\"/>"
+        "<payload-type id=\"18\" name=\"G729\"/>"
+        "<payload-type id=\"0\" name=\"PCMU\"/>"
+        "<payload-type id=\"103\" name=\"L16\" channels=\"2\" clockrate=\"16000\"/>"
+        "<payload-type id=\"98\" name=\"x-ISAC\" clockrate=\"8000\"/>"
+        "</description>"
+        "<transport xmlns=\"urn:xmpp:jingle:transports:ice-udp:1\" ufrag=\"8hhy\" pwd=\"asd88fgpdd777uzjYhagZg\">"
+        "<candidate component=\"1\" foundation=\"1\" generation=\"0\" id=\"el0747fg11\" ip=\"10.0.1.1\""
+        " network=\"1\" port=\"8998\" priority=\"2130706431\" protocol=\"udp\" type=\"host\"/>"
+        "<candidate component=\"1\" foundation=\"2\" generation=\"0\" id=\"y3s2b30v3r\" ip=\"192.0.2.3\""
+        " network=\"1\" port=\"45664\" priority=\"1694498815\" protocol=\"udp\" type=\"srflx\"/>"
+        "</transport>"
+        "</content>"
+        "</jingle>"
+        "</iq>");
+}
+
+static QByteArray messageXml()
+{
+    return QByteArray(
+        "<message id=\"richard2-4.1.247\" to=\"kingrichard@royalty.england.lit/throne\""
+        " from=\"northumberland@shakespeare.lit/westminster\" type=\"chat\">"
+        "<body>My lord, dispatch; read o'er these articles.</body>"
+        "<active xmlns=\"http://jabber.org/protocol/chatstates\"/>"
+        "<request xmlns=\"urn:xmpp:receipts\"/>"
+        "</message>");
+}
+
+static QByteArray presenceXml()
+{
+    return QByteArray(
+        "<presence to=\"juliet@capulet.com/balcony\" from=\"romeo@montague.net/orchard\">"
+        "<show>away</show>"
+        "<status>In the orchard</status>"
+        "<priority>5</priority>"
+        "<c xmlns=\"http://jabber.org/protocol/caps\" hash=\"sha-1\" node=\"http://code.google.com/p/exodus\""
+        " ver=\"QgayPKawpkPSDYmwT/WM94uAlu0=\"/>"
+        "</presence>");
+}
+
+static QByteArray rosterXml(int count)
+{
+    QByteArray xml("<iq id=\"roster1\" to=\"juliet@example.com/balcony\" type=\"result\">"
+                   "<query xmlns=\"jabber:iq:roster\" ver=\"ver14\">");
+    for (int i = 0; i < count; ++i) {
+        const QByteArray n = QByteArray::number(i);
+        xml += "<item jid=\"contact" + n + "@example.net\" name=\"Contact " + n + "\" subscription=\"both\">"
+               "<group>Friends</group>"
+               "</item>";
+    }
+    xml += "</query></iq>";
+    return xml;
+}
+
+static QByteArray vCardXml()
+{
+    // a 16 KiB photo, which is typical for an avatar
+    QByteArray photo(16384, '\0');
+    for (int i = 0; i < photo.size(); ++i)
+        photo[i] = char(i * 7919);
+
+    return QByteArray(
+        "<iq id=\"vcard1\" type=\"result\">"
+        "<vCard xmlns=\"vcard-temp\">"
+        "<BDAY>1983-09-14</BDAY>"
+        "<EMAIL><INTERNET/><USERID>foo.bar@example.com</USERID></EMAIL>"
+        "<FN>Foo Bar!</FN>"
+        "<NICKNAME>FooBar</NICKNAME>"
+        "<N><GIVEN>Foo</GIVEN><FAMILY>Wiz</FAMILY><MIDDLE>Baz</MIDDLE></N>"
+        "<PHOTO><TYPE>image/png</TYPE><BINVAL>") + photo.toBase64() + QByteArray("</BINVAL></PHOTO>"
+        "</vCard>"
+        "</iq>");
+}
+
+class tst_QXmppStanzas : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parse_data();
+    void parse();
+    void serialize_data();
+    void serialize();
+
+private:
+    void addRows();
+};
+
+void tst_QXmppStanzas::addRows()
+{
+    QTest::addColumn<PacketType>("type");
+    QTest::addColumn<QByteArray>("xml");
+
+    QTest::newRow("dataform") << DataFormPacket << dataFormXml();
+    QTest::newRow("jingle") << JinglePacket << jingleXml();
+    QTest::newRow("message") << MessagePacket << messageXml();
+    QTest::newRow("presence") << PresencePacket << presenceXml();
+    QTest::newRow("roster-1k") << RosterPacket << rosterXml(1000);
+    QTest::newRow("roster-10k") << RosterPacket << rosterXml(10000);
+    QTest::newRow("vcard-photo") << VCardPacket << vCardXml();
+}
+
+void tst_QXmppStanzas::parse_data()
+{
+    addRows();
+}
+
+void tst_QXmppStanzas::parse()
+{
+    QFETCH(PacketType, type);
+    QFETCH(QByteArray, xml);
+
+    switch (type) {
+    case DataFormPacket:
+        benchmarkParse<QXmppDataForm>(xml);
+        break;
+    case JinglePacket:
+        benchmarkParse<QXmppJingleIq>(xml);
+        break;
+    case MessagePacket:
+        benchmarkParse<QXmppMessage>(xml);
+        break;
+    case PresencePacket:
+        benchmarkParse<QXmppPresence>(xml);
+        break;
+    case RosterPacket:
+        benchmarkParse<QXmppRosterIq>(xml);
+        break;
+    case VCardPacket:
+        benchmarkParse<QXmppVCardIq>(xml);
+        break;
+    }
+}
+
+void tst_QXmppStanzas::serialize_data()
+{
+    addRows();
+}
+
+void tst_QXmppStanzas::serialize()
+{
+    QFETCH(PacketType, type);
+    QFETCH(QByteArray, xml);
+
+    switch (type) {
+    case DataFormPacket:
+        benchmarkSerialize<QXmppDataForm>(xml);
+        break;
+    case JinglePacket:
+        benchmarkSerialize<QXmppJingleIq>(xml);
+        break;
+    case MessagePacket:
+        benchmarkSerialize<QXmppMessage>(xml);
+        break;
+    case PresencePacket:
+        benchmarkSerialize<QXmppPresence>(xml);
+        break;
+    case RosterPacket:
+        benchmarkSerialize<QXmppRosterIq>(xml);
+        break;
+    case VCardPacket:
+        benchmarkSerialize<QXmppVCardIq>(xml);
+        break;
+    }
+}
+
+QTEST_MAIN(tst_QXmppStanzas)
+#include "tst_qxmppstanzas.moc"
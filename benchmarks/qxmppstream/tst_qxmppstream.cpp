@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QElapsedTimer>
+#include <QIODevice>
+#include <QObject>
+#include <QtTest>
+#include <cstdlib>
+#include <new>
+
+#include "QXmppRawStanza.h"
+#include "QXmppStream.h"
+
+#if QT_VERSION < 0x050000
+Q_DECLARE_METATYPE(QList<QByteArray>)
+#endif
+
+// Counts the allocations made with operator new, which is how QObject and
+// QDomNode instances are allocated. Qt's containers use malloc() and are
+// not counted.
+static qint64 allocationCount = 0;
+
+void *operator new(size_t size)
+{
+    ++allocationCount;
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    ++allocationCount;
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) throw()
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) throw()
+{
+    free(ptr);
+}
+
+// A sequential device whose incoming data is fed by the benchmark.
+class MemoryDevice : public QIODevice
+{
+public:
+    MemoryDevice()
+    {
+        open(QIODevice::ReadWrite);
+    }
+
+    bool isSequential() const
+    {
+        return true;
+    }
+
+    qint64 bytesAvailable() const
+    {
+        return m_data.size() + QIODevice::bytesAvailable();
+    }
+
+    void feed(const QByteArray &data)
+    {
+        m_data += data;
+        emit readyRead();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize)
+    {
+        const qint64 size = qMin(maxSize, qint64(m_data.size()));
+        memcpy(data, m_data.constData(), size);
+        m_data.remove(0, size);
+        return size;
+    }
+
+    qint64 writeData(const char *data, qint64 maxSize)
+    {
+        Q_UNUSED(data);
+        return maxSize;
+    }
+
+private:
+    QByteArray m_data;
+};
+
+class TestStream : public QXmppStream
+{
+public:
+    TestStream(MemoryDevice *device, bool raw)
+        : QXmppStream(0)
+        , stanzaCount(0)
+    {
+        if (raw)
+            setRawStanzaNames(QStringList() << "iq" << "message" << "presence");
+        setDevice(device);
+    }
+
+    qint64 stanzaCount;
+
+protected:
+    void handleRawStanza(const QXmppRawStanza &stanza)
+    {
+        Q_UNUSED(stanza);
+        ++stanzaCount;
+    }
+
+    void handleStanza(const QDomElement &element)
+    {
+        Q_UNUSED(element);
+        ++stanzaCount;
+    }
+
+    void handleStream(const QDomElement &element)
+    {
+        Q_UNUSED(element);
+    }
+};
+
+static const QByteArray streamStart(
+    "<?xml version='1.0'?>"
+    "<stream:stream from='example.com' id='abc' version='1.0'"
+    " xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>");
+
+// Splits \a data into fragments of 1 to \a maximum bytes.
+static QList<QByteArray> fragment(const QByteArray &data, int maximum)
+{
+    QList<QByteArray> fragments;
+    qsrand(1);
+    for (int pos = 0; pos < data.size(); ) {
+        const int size = 1 + qrand() % maximum;
+        fragments << data.mid(pos, size);
+        pos += size;
+    }
+    return fragments;
+}
+
+class tst_QXmppStream : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void throughput_data();
+    void throughput();
+    void allocations_data();
+    void allocations();
+
+private:
+    void addRows();
+};
+
+void tst_QXmppStream::addRows()
+{
+    QTest::addColumn<QList<QByteArray> >("reads");
+    QTest::addColumn<int>("stanzas");
+    QTest::addColumn<bool>("raw");
+
+    // a 64 KiB stanza in small random fragments
+    const QByteArray large = "<message to='foo@example.com' type='chat'><body>" +
+        QByteArray(65536, 'a') + "</body></message>";
+    QTest::newRow("large-fragmented") << fragment(large, 64) << 1 << false;
+    QTest::newRow("large-fragmented-raw") << fragment(large, 64) << 1 << true;
+
+    // many tiny stanzas in a single read
+    QByteArray tiny;
+    for (int i = 0; i < 1000; ++i)
+        tiny += "<iq type='result' id='p" + QByteArray::number(i) + "'/>";
+    QTest::newRow("tiny-batched") << (QList<QByteArray>() << tiny) << 1000 << false;
+    QTest::newRow("tiny-batched-raw") << (QList<QByteArray>() << tiny) << 1000 << true;
+
+    // whitespace keepalives between stanzas
+    QList<QByteArray> keepalives;
+    for (int i = 0; i < 100; ++i)
+        keepalives << " " << "<presence/>" << "\n";
+    QTest::newRow("whitespace") << keepalives << 100 << false;
+
+    // deeply nested extensions
+    QByteArray nested = "<message to='foo@example.com'>";
+    for (int i = 0; i < 200; ++i)
+        nested += "<x xmlns='urn:example:" + QByteArray::number(i) + "' a='b'>";
+    nested += "payload";
+    for (int i = 0; i < 200; ++i)
+        nested += "</x>";
+    nested += "</message>";
+    QTest::newRow("nested") << fragment(nested, 512) << 1 << false;
+    QTest::newRow("nested-raw") << fragment(nested, 512) << 1 << true;
+}
+
+void tst_QXmppStream::throughput_data()
+{
+    addRows();
+}
+
+void tst_QXmppStream::throughput()
+{
+    QFETCH(QList<QByteArray>, reads);
+    QFETCH(int, stanzas);
+    QFETCH(bool, raw);
+
+    qint64 size = 0;
+    foreach (const QByteArray &data, reads)
+        size += data.size();
+
+    MemoryDevice device;
+    TestStream stream(&device, raw);
+    device.feed(streamStart);
+
+    // repeat the input for at least half a second
+    QElapsedTimer timer;
+    timer.start();
+    qint64 parsed = 0;
+    do {
+        foreach (const QByteArray &data, reads)
+            device.feed(data);
+        parsed += size;
+    } while (timer.elapsed() < 500);
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    QCOMPARE(stream.stanzaCount, stanzas * (parsed / size));
+    QTest::setBenchmarkResult(parsed * 1000000000.0 / elapsed, QTest::BytesPerSecond);
+}
+
+void tst_QXmppStream::allocations_data()
+{
+    addRows();
+}
+
+void tst_QXmppStream::allocations()
+{
+    QFETCH(QList<QByteArray>, reads);
+    QFETCH(int, stanzas);
+    QFETCH(bool, raw);
+
+    MemoryDevice device;
+    TestStream stream(&device, raw);
+    device.feed(streamStart);
+
+    // warm up, then count
+    foreach (const QByteArray &data, reads)
+        device.feed(data);
+    const qint64 before = allocationCount;
+    const int rounds = 10;
+    for (int i = 0; i < rounds; ++i) {
+        foreach (const QByteArray &data, reads)
+            device.feed(data);
+    }
+    const qint64 count = allocationCount - before;
+
+    QCOMPARE(stream.stanzaCount, qint64(stanzas) * (rounds + 1));
+    QTest::setBenchmarkResult(double(count) / (stanzas * rounds), QTest::Events);
+}
+
+QTEST_MAIN(tst_QXmppStream)
+#include "tst_qxmppstream.moc"
@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+// File transfer benchmark for QXmppTransferManager.
+//
+// The server, the sender and the receiver run in the same process and
+// thread, so the reported CPU time and memory cover all three. The file
+// is generated on the fly and the received data is discarded, so the
+// memory is that used by the transfer itself.
+//
+// The round-trip time is added to the XMPP streams between the clients
+// and the server, which carry in-band bytestreams and the negotiation of
+// SOCKS5 bytestreams. SOCKS5 data connections are not delayed.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+
+#include "QXmppClient.h"
+#include "QXmppServer.h"
+#include "QXmppServerProxy65.h"
+#include "QXmppTransferManager.h"
+#include "processusage.h"
+#include "util.h"
+
+static const qint64 megabyte = 1000000;
+
+struct TransferOptions
+{
+    TransferOptions()
+        : method("socks")
+        , size(100)
+        , rtt(0)
+        , ibbBlockSize(4096)
+        , ibbWindowSize(4)
+        , port(15222)
+    {
+    }
+
+    QString method;
+    qint64 size;
+    int rtt;
+    int ibbBlockSize;
+    int ibbWindowSize;
+    quint16 port;
+    QString output;
+};
+
+// A file of the given size whose content is generated as it is read.
+class PatternDevice : public QIODevice
+{
+public:
+    PatternDevice(qint64 size)
+        : m_size(size)
+    {
+        m_pattern.resize(65536 + 251);
+        for (int i = 0; i < m_pattern.size(); ++i)
+            m_pattern[i] = char(i % 251);
+        open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    qint64 size() const
+    {
+        return m_size;
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize)
+    {
+        const qint64 length = qMin(maxSize, m_size - pos());
+        for (qint64 done = 0; done < length; ) {
+            const qint64 chunk = qMin(length - done, qint64(65536));
+            memcpy(data + done, m_pattern.constData() + (pos() + done) % 251, chunk);
+            done += chunk;
+        }
+        return length;
+    }
+
+    qint64 writeData(const char *data, qint64 maxSize)
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(maxSize);
+        return -1;
+    }
+
+private:
+    QByteArray m_pattern;
+    qint64 m_size;
+};
+
+// A device which discards the data written to it, only counting it.
+class CountingDevice : public QIODevice
+{
+public:
+    CountingDevice()
+        : m_count(0)
+    {
+        open(QIODevice::WriteOnly);
+    }
+
+    qint64 count() const
+    {
+        return m_count;
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize)
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(maxSize);
+        return -1;
+    }
+
+    qint64 writeData(const char *data, qint64 maxSize)
+    {
+        Q_UNUSED(data);
+        m_count += maxSize;
+        return maxSize;
+    }
+
+private:
+    qint64 m_count;
+};
+
+// One direction of a relayed connection, delaying the data by a fixed time.
+class DelayPipe : public QObject
+{
+    Q_OBJECT
+
+public:
+    DelayPipe(QTcpSocket *from, QTcpSocket *to, int delay, QObject *parent)
+        : QObject(parent)
+        , m_from(from)
+        , m_to(to)
+        , m_delay(delay)
+    {
+        m_timer = new QTimer(this);
+        m_timer->setSingleShot(true);
+        connect(m_timer, SIGNAL(timeout()), this, SLOT(_q_flush()));
+        connect(m_from, SIGNAL(readyRead()), this, SLOT(_q_readyRead()));
+        m_clock.start();
+    }
+
+private slots:
+    void _q_readyRead()
+    {
+        const QByteArray data = m_from->readAll();
+        if (!m_delay) {
+            m_to->write(data);
+            return;
+        }
+        m_queue << qMakePair(m_clock.elapsed() + m_delay, data);
+        if (!m_timer->isActive())
+            m_timer->start(m_delay);
+    }
+
+    void _q_flush()
+    {
+        while (!m_queue.isEmpty() && m_queue.first().first <= m_clock.elapsed())
+            m_to->write(m_queue.takeFirst().second);
+        if (!m_queue.isEmpty())
+            m_timer->start(qMax(qint64(0), m_queue.first().first - m_clock.elapsed()));
+    }
+
+private:
+    QTcpSocket *m_from;
+    QTcpSocket *m_to;
+    int m_delay;
+    QList<QPair<qint64, QByteArray> > m_queue;
+    QElapsedTimer m_clock;
+    QTimer *m_timer;
+};
+
+// A TCP relay which adds a round-trip time to the connections it forwards.
+class DelayRelay : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    DelayRelay(quint16 targetPort, int rtt, QObject *parent = 0)
+        : QTcpServer(parent)
+        , m_targetPort(targetPort)
+        , m_rtt(rtt)
+    {
+        connect(this, SIGNAL(newConnection()), this, SLOT(_q_newConnection()));
+    }
+
+private slots:
+    void _q_newConnection()
+    {
+        while (QTcpSocket *incoming = nextPendingConnection()) {
+            QTcpSocket *outgoing = new QTcpSocket(incoming);
+            new DelayPipe(incoming, outgoing, m_rtt / 2, incoming);
+            new DelayPipe(outgoing, incoming, m_rtt - m_rtt / 2, incoming);
+            connect(incoming, SIGNAL(disconnected()), outgoing, SLOT(disconnectFromHost()));
+            connect(outgoing, SIGNAL(disconnected()), incoming, SLOT(disconnectFromHost()));
+            connect(incoming, SIGNAL(disconnected()), incoming, SLOT(deleteLater()));
+            outgoing->connectToHost(QHostAddress(QHostAddress::LocalHost), m_targetPort);
+        }
+    }
+
+private:
+    quint16 m_targetPort;
+    int m_rtt;
+};
+
+class TransferController : public QObject
+{
+    Q_OBJECT
+
+public:
+    TransferController(const TransferOptions &options)
+        : m_options(options)
+        , m_relay(0)
+        , m_device(0)
+        , m_receiverJob(0)
+        , m_connectedCount(0)
+        , m_cpuTime(0)
+    {
+        m_passwordChecker.addCredentials("sender", "testpwd");
+        m_passwordChecker.addCredentials("receiver", "testpwd");
+    }
+
+    bool start()
+    {
+        const QHostAddress host(QHostAddress::LocalHost);
+        m_server.setDomain("localhost");
+        m_server.setPasswordChecker(&m_passwordChecker);
+
+        QXmppTransferJob::Methods methods = QXmppTransferJob::SocksMethod;
+        if (m_options.method == "inband") {
+            methods = QXmppTransferJob::InBandMethod;
+        } else if (m_options.method == "proxy") {
+            QXmppServerProxy65 *proxy = new QXmppServerProxy65;
+            proxy->setHost(host.toString());
+            proxy->setPort(m_options.port + 2);
+            m_server.addExtension(proxy);
+        }
+
+        if (!m_server.listenForClients(host, m_options.port)) {
+            qWarning("Could not listen on port %i", m_options.port);
+            return false;
+        }
+
+        // clients connect through a relay to add the round-trip time
+        quint16 clientPort = m_options.port;
+        if (m_options.rtt > 0) {
+            m_relay = new DelayRelay(m_options.port, m_options.rtt, this);
+            if (!m_relay->listen(host, m_options.port + 1)) {
+                qWarning("Could not listen on port %i", m_options.port + 1);
+                return false;
+            }
+            clientPort = m_options.port + 1;
+        }
+
+        QXmppTransferManager *senderManager = new QXmppTransferManager;
+        senderManager->setSupportedMethods(methods);
+        senderManager->setIbbBlockSize(m_options.ibbBlockSize);
+        senderManager->setIbbWindowSize(m_options.ibbWindowSize);
+        if (m_options.method == "proxy") {
+            senderManager->setProxy("proxy.localhost");
+            senderManager->setProxyOnly(true);
+        }
+        m_sender.addExtension(senderManager);
+
+        m_receiverManager = new QXmppTransferManager;
+        m_receiverManager->setSupportedMethods(methods);
+        connect(m_receiverManager, SIGNAL(fileReceived(QXmppTransferJob*)),
+                this, SLOT(_q_fileReceived(QXmppTransferJob*)));
+        m_receiver.addExtension(m_receiverManager);
+
+        connect(&m_sender, SIGNAL(connected()), this, SLOT(_q_connected()));
+        connect(&m_receiver, SIGNAL(connected()), this, SLOT(_q_connected()));
+
+        QXmppConfiguration config;
+        config.setDomain("localhost");
+        config.setHost(host.toString());
+        config.setPort(clientPort);
+        config.setPassword("testpwd");
+        config.setUser("sender");
+        m_sender.connectToServer(config);
+        config.setUser("receiver");
+        m_receiver.connectToServer(config);
+        return true;
+    }
+
+private slots:
+    void _q_connected()
+    {
+        if (++m_connectedCount < 2)
+            return;
+
+        QXmppTransferManager *senderManager = m_sender.findExtension<QXmppTransferManager>();
+        PatternDevice *device = new PatternDevice(m_options.size * megabyte);
+
+        QXmppTransferFileInfo fileInfo;
+        fileInfo.setName("benchmark.bin");
+        fileInfo.setSize(device->size());
+
+        m_cpuTime = cpuTime();
+        m_clock.start();
+        QXmppTransferJob *job = senderManager->sendFile("receiver@localhost/QXmpp", device, fileInfo);
+        if (!job) {
+            qWarning("Could not start the transfer");
+            QCoreApplication::exit(1);
+        }
+    }
+
+    void _q_fileReceived(QXmppTransferJob *job)
+    {
+        m_receiverJob = job;
+        m_device = new CountingDevice;
+        m_device->setParent(this);
+        connect(job, SIGNAL(finished()), this, SLOT(_q_report()));
+        job->accept(m_device);
+    }
+
+    void _q_report()
+    {
+        const double elapsed = m_clock.elapsed() / 1000.0;
+        const double cpu = (cpuTime() - m_cpuTime) / 1000000.0;
+        const double megabytes = double(m_device->count()) / megabyte;
+
+        QString json;
+        QTextStream stream(&json);
+        stream << "{\n";
+        stream << "  \"method\": \"" << m_options.method << "\",\n";
+        stream << "  \"size-bytes\": " << m_options.size * megabyte << ",\n";
+        stream << "  \"received-bytes\": " << m_device->count() << ",\n";
+        stream << "  \"error\": " << int(m_receiverJob->error()) << ",\n";
+        stream << "  \"rtt-ms\": " << m_options.rtt << ",\n";
+        stream << "  \"ibb-block-size\": " << m_options.ibbBlockSize << ",\n";
+        stream << "  \"ibb-window-size\": " << m_options.ibbWindowSize << ",\n";
+        stream << "  \"seconds\": " << elapsed << ",\n";
+        stream << "  \"mb-per-second\": " << megabytes / elapsed << ",\n";
+        stream << "  \"cpu-seconds\": " << cpu << ",\n";
+        stream << "  \"cpu-ms-per-mb\": " << (megabytes > 0 ? 1000.0 * cpu / megabytes : 0.0) << ",\n";
+        stream << "  \"peak-rss-bytes\": " << peakResidentSize() << "\n";
+        stream << "}\n";
+        stream.flush();
+
+        if (m_options.output.isEmpty()) {
+            QTextStream(stdout) << json;
+        } else {
+            QFile file(m_options.output);
+            if (!file.open(QIODevice::WriteOnly)) {
+                qWarning("Could not write %s", qPrintable(m_options.output));
+                QCoreApplication::exit(1);
+                return;
+            }
+            file.write(json.toUtf8());
+        }
+
+        const bool ok = m_receiverJob->error() == QXmppTransferJob::NoError &&
+                        m_device->count() == m_options.size * megabyte;
+        QCoreApplication::exit(ok ? 0 : 1);
+    }
+
+private:
+    TransferOptions m_options;
+    QXmppServer m_server;
+    TestPasswordChecker m_passwordChecker;
+    DelayRelay *m_relay;
+    QXmppClient m_sender;
+    QXmppClient m_receiver;
+    QXmppTransferManager *m_receiverManager;
+    CountingDevice *m_device;
+    QXmppTransferJob *m_receiverJob;
+    int m_connectedCount;
+    QElapsedTimer m_clock;
+    qint64 m_cpuTime;
+};
+
+static void usage()
+{
+    QTextStream(stderr) <<
+        "Usage: qxmpptransferload [options]\n"
+        "\n"
+        "  --method <method>         socks, inband or proxy (default: socks)\n"
+        "  --size <MB>               size of the file in megabytes (default: 100)\n"
+        "  --rtt <ms>                round-trip time added to the XMPP streams (default: 0)\n"
+        "  --ibb-block-size <bytes>  size of in-band bytestream blocks (default: 4096)\n"
+        "  --ibb-window <count>      in-band bytestream blocks in flight (default: 4)\n"
+        "  --port <port>             first of the three ports used (default: 15222)\n"
+        "  --output <file>           write the JSON results to a file instead of stdout\n";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    TransferOptions options;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        const QString arg = args.at(i);
+        const QString value = (i + 1 < args.size()) ? args.at(i + 1) : QString();
+        bool ok = true;
+        if (arg == "--method") {
+            options.method = value;
+            ok = (value == "socks" || value == "inband" || value == "proxy");
+        } else if (arg == "--size") {
+            options.size = value.toLongLong(&ok);
+        } else if (arg == "--rtt") {
+            options.rtt = value.toInt(&ok);
+        } else if (arg == "--ibb-block-size") {
+            options.ibbBlockSize = value.toInt(&ok);
+        } else if (arg == "--ibb-window") {
+            options.ibbWindowSize = value.toInt(&ok);
+        } else if (arg == "--port") {
+            options.port = value.toUShort(&ok);
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+        if (!ok || options.size < 1) {
+            usage();
+            return 1;
+        }
+        ++i;
+    }
+
+    TransferController controller(options);
+    if (!controller.start())
+        return 1;
+    return app.exec();
+}
+
+#include "qxmpptransferload.moc"
@@ -33,6 +33,18 @@ android {
     QXMPP_INTERNAL_LIBS = -ldnsapi -lws2_32
 }
 
+!isEmpty(QXMPP_USE_ASYNC_DNS) {
+    DEFINES += QXMPP_USE_ASYNC_DNS
+}
+
+!isEmpty(QXMPP_MEMORY_STATS) {
+    DEFINES += QXMPP_MEMORY_STATS
+}
+
+!isEmpty(QXMPP_USE_SDT) {
+    DEFINES += QXMPP_USE_SDT
+}
+
 !isEmpty(QXMPP_USE_OPUS) {
     DEFINES += QXMPP_USE_OPUS
     QXMPP_INTERNAL_LIBS += -lopus
@@ -53,6 +65,11 @@ android {
     QXMPP_INTERNAL_LIBS += -lvpx
 }
 
+!isEmpty(QXMPP_USE_ZLIB) {
+    DEFINES += QXMPP_USE_ZLIB
+    QXMPP_INTERNAL_LIBS += -lz
+}
+
 # Libraries for apps which use QXmpp
 QXMPP_LIBS = -l$${QXMPP_LIBRARY_NAME}
 contains(QXMPP_LIBRARY_TYPE,staticlib) {
@@ -10,6 +10,9 @@ isEmpty(QXMPP_NO_TESTS) {
 isEmpty(QXMPP_NO_EXAMPLES) {
     SUBDIRS += examples
 }
+!isEmpty(QXMPP_BENCHMARKS) {
+    SUBDIRS += benchmarks
+}
 
 !isEmpty(QXMPP_USE_DOXYGEN) {
     docs.commands = cd doc/ && $(MAKE) docs
@@ -0,0 +1,464 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <cstring>
+
+#include "QXmppBase64_p.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QXMPP_BASE64_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define QXMPP_BASE64_NEON
+#include <arm_neon.h>
+#endif
+
+static const char encodeTable[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// value of each character in the base64 alphabet, -1 for other characters
+static const signed char decodeTable[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+#if defined(QXMPP_BASE64_SSE2)
+// Maps 6-bit values to their base64 characters.
+static inline __m128i sse2Characters(__m128i values)
+{
+    __m128i shift = _mm_set1_epi8('A');
+    shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(25)), _mm_set1_epi8('a' - 26 - 'A')));
+    shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(51)), _mm_set1_epi8('0' - 52 - 'a' + 26)));
+    shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(61)), _mm_set1_epi8('+' - 62 - '0' + 52)));
+    shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(62)), _mm_set1_epi8('/' - 63 - '+' + 62)));
+    return _mm_add_epi8(values, shift);
+}
+
+// Returns a mask of the characters between \a first and \a last.
+static inline __m128i sse2Range(__m128i input, char first, char last)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8(first - 1)),
+                         _mm_cmplt_epi8(input, _mm_set1_epi8(last + 1)));
+}
+#elif defined(QXMPP_BASE64_NEON)
+// Maps 6-bit values to their base64 characters.
+static inline uint8x16_t neonCharacters(uint8x16_t values)
+{
+    uint8x16_t shift = vdupq_n_u8('A');
+    shift = vaddq_u8(shift, vandq_u8(vcgtq_u8(values, vdupq_n_u8(25)), vdupq_n_u8('a' - 26 - 'A')));
+    shift = vaddq_u8(shift, vandq_u8(vcgtq_u8(values, vdupq_n_u8(51)), vdupq_n_u8(uint8_t('0' - 52 - 'a' + 26))));
+    shift = vaddq_u8(shift, vandq_u8(vcgtq_u8(values, vdupq_n_u8(61)), vdupq_n_u8(uint8_t('+' - 62 - '0' + 52))));
+    shift = vaddq_u8(shift, vandq_u8(vcgtq_u8(values, vdupq_n_u8(62)), vdupq_n_u8('/' - 63 - '+' + 62)));
+    return vaddq_u8(values, shift);
+}
+
+// Maps base64 characters to their 6-bit values, and clears \a valid for
+// the other characters.
+static inline uint8x16_t neonValues(uint8x16_t input, uint8x16_t &valid)
+{
+    const uint8x16_t upper = vandq_u8(vcgeq_u8(input, vdupq_n_u8('A')), vcleq_u8(input, vdupq_n_u8('Z')));
+    const uint8x16_t lower = vandq_u8(vcgeq_u8(input, vdupq_n_u8('a')), vcleq_u8(input, vdupq_n_u8('z')));
+    const uint8x16_t digit = vandq_u8(vcgeq_u8(input, vdupq_n_u8('0')), vcleq_u8(input, vdupq_n_u8('9')));
+    const uint8x16_t plus = vceqq_u8(input, vdupq_n_u8('+'));
+    const uint8x16_t slash = vceqq_u8(input, vdupq_n_u8('/'));
+    valid = vandq_u8(valid, vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(vorrq_u8(digit, plus), slash)));
+
+    uint8x16_t shift = vandq_u8(upper, vdupq_n_u8(uint8_t(-'A')));
+    shift = vorrq_u8(shift, vandq_u8(lower, vdupq_n_u8(uint8_t(26 - 'a'))));
+    shift = vorrq_u8(shift, vandq_u8(digit, vdupq_n_u8(52 - '0')));
+    shift = vorrq_u8(shift, vandq_u8(plus, vdupq_n_u8(62 - '+')));
+    shift = vorrq_u8(shift, vandq_u8(slash, vdupq_n_u8(63 - '/')));
+    return vaddq_u8(input, shift);
+}
+#endif
+
+// Encodes the whole groups of three bytes of \a input, and returns the
+// number of bytes encoded.
+static int encodeGroups(const uchar *input, int size, char *output)
+{
+    int i = 0;
+#if defined(QXMPP_BASE64_SSE2)
+    for (; i + 12 <= size; i += 12) {
+        const uchar *in = input + i;
+        const __m128i groups = _mm_setr_epi32(
+            (in[0] << 16) | (in[1] << 8) | in[2],
+            (in[3] << 16) | (in[4] << 8) | in[5],
+            (in[6] << 16) | (in[7] << 8) | in[8],
+            (in[9] << 16) | (in[10] << 8) | in[11]);
+
+        // spread each group's four 6-bit values over its four bytes
+        __m128i values = _mm_and_si128(_mm_srli_epi32(groups, 18), _mm_set1_epi32(0x3f));
+        values = _mm_or_si128(values, _mm_and_si128(_mm_srli_epi32(groups, 4), _mm_set1_epi32(0x3f00)));
+        values = _mm_or_si128(values, _mm_and_si128(_mm_slli_epi32(groups, 10), _mm_set1_epi32(0x3f0000)));
+        values = _mm_or_si128(values, _mm_and_si128(_mm_slli_epi32(groups, 24), _mm_set1_epi32(0x3f000000)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i / 3 * 4), sse2Characters(values));
+    }
+#elif defined(QXMPP_BASE64_NEON)
+    for (; i + 48 <= size; i += 48) {
+        const uint8x16x3_t in = vld3q_u8(input + i);
+        uint8x16x4_t out;
+        out.val[0] = neonCharacters(vshrq_n_u8(in.val[0], 2));
+        out.val[1] = neonCharacters(vorrq_u8(vshlq_n_u8(vandq_u8(in.val[0], vdupq_n_u8(0x03)), 4), vshrq_n_u8(in.val[1], 4)));
+        out.val[2] = neonCharacters(vorrq_u8(vshlq_n_u8(vandq_u8(in.val[1], vdupq_n_u8(0x0f)), 2), vshrq_n_u8(in.val[2], 6)));
+        out.val[3] = neonCharacters(vandq_u8(in.val[2], vdupq_n_u8(0x3f)));
+        vst4q_u8(reinterpret_cast<uint8_t*>(output + i / 3 * 4), out);
+    }
+#endif
+    for (; i + 3 <= size; i += 3) {
+        const quint32 group = (input[i] << 16) | (input[i + 1] << 8) | input[i + 2];
+        char *out = output + i / 3 * 4;
+        out[0] = encodeTable[group >> 18];
+        out[1] = encodeTable[(group >> 12) & 0x3f];
+        out[2] = encodeTable[(group >> 6) & 0x3f];
+        out[3] = encodeTable[group & 0x3f];
+    }
+    return i;
+}
+
+// Decodes the leading blocks of four base64 characters of \a input, up to
+// the first block holding any other character, and returns the number of
+// characters decoded.
+static int decodeGroups(const uchar *input, int size, uchar *output)
+{
+    int i = 0;
+#if defined(QXMPP_BASE64_SSE2)
+    for (; i + 16 <= size; i += 16) {
+        const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        const __m128i upper = sse2Range(in, 'A', 'Z');
+        const __m128i lower = sse2Range(in, 'a', 'z');
+        const __m128i digit = sse2Range(in, '0', '9');
+        const __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+        const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+        const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+        if (_mm_movemask_epi8(valid) != 0xffff)
+            break;
+
+        __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+        shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+        shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+        shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+        shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+        const __m128i values = _mm_add_epi8(in, shift);
+
+        // merge the values two by two, then into one 24-bit group per lane
+        const __m128i pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(values, _mm_set1_epi16(0x00ff)), 6),
+                                           _mm_srli_epi16(values, 8));
+        quint32 groups[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(groups), _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000)));
+
+        uchar *out = output + i / 4 * 3;
+        for (int j = 0; j < 4; ++j, out += 3) {
+            out[0] = groups[j] >> 16;
+            out[1] = groups[j] >> 8;
+            out[2] = groups[j];
+        }
+    }
+#elif defined(QXMPP_BASE64_NEON)
+    for (; i + 64 <= size; i += 64) {
+        const uint8x16x4_t in = vld4q_u8(input + i);
+        uint8x16_t valid = vdupq_n_u8(0xff);
+        const uint8x16_t a = neonValues(in.val[0], valid);
+        const uint8x16_t b = neonValues(in.val[1], valid);
+        const uint8x16_t c = neonValues(in.val[2], valid);
+        const uint8x16_t d = neonValues(in.val[3], valid);
+        const uint8x8_t folded = vand_u8(vget_low_u8(valid), vget_high_u8(valid));
+        if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) != ~quint64(0))
+            break;
+
+        uint8x16x3_t out;
+        out.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        out.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+        out.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+        vst3q_u8(output + i / 4 * 3, out);
+    }
+#endif
+    for (; i + 4 <= size; i += 4) {
+        const int a = decodeTable[input[i]];
+        const int b = decodeTable[input[i + 1]];
+        const int c = decodeTable[input[i + 2]];
+        const int d = decodeTable[input[i + 3]];
+        if ((a | b | c | d) < 0)
+            break;
+
+        uchar *out = output + i / 4 * 3;
+        out[0] = (a << 2) | (b >> 4);
+        out[1] = (b << 4) | (c >> 2);
+        out[2] = (c << 6) | d;
+    }
+    return i;
+}
+
+QXmppBase64Encoder::QXmppBase64Encoder()
+    : m_pendingSize(0)
+{
+}
+
+/// Encodes \a size bytes of \a data into \a output, and returns the number
+/// of characters written.
+///
+/// Up to two bytes are kept until the next call or finish(), so that the
+/// chunks need not be multiples of three bytes.
+///
+/// \param data
+/// \param size
+/// \param output
+
+int QXmppBase64Encoder::encode(const char *data, int size, char *output)
+{
+    const uchar *input = reinterpret_cast<const uchar*>(data);
+    char *out = output;
+
+    // complete the group started by the previous chunk
+    while (m_pendingSize && size > 0) {
+        m_pending[m_pendingSize++] = *input++;
+        --size;
+        if (m_pendingSize == 3) {
+            out += encodeGroups(m_pending, 3, out) / 3 * 4;
+            m_pendingSize = 0;
+        }
+    }
+    if (m_pendingSize)
+        return out - output;
+
+    const int encoded = encodeGroups(input, size, out);
+    out += encoded / 3 * 4;
+
+    for (int i = encoded; i < size; ++i)
+        m_pending[m_pendingSize++] = input[i];
+    return out - output;
+}
+
+/// Writes the characters for the bytes kept from the previous chunks,
+/// padded to a whole group, into \a output and returns the number of
+/// characters written.
+///
+/// \param output
+
+int QXmppBase64Encoder::finish(char *output)
+{
+    if (!m_pendingSize)
+        return 0;
+
+    const quint32 group = (m_pending[0] << 16) | (m_pendingSize > 1 ? m_pending[1] << 8 : 0);
+    output[0] = encodeTable[group >> 18];
+    output[1] = encodeTable[(group >> 12) & 0x3f];
+    output[2] = m_pendingSize > 1 ? encodeTable[(group >> 6) & 0x3f] : '=';
+    output[3] = '=';
+    m_pendingSize = 0;
+    return 4;
+}
+
+/// Encodes \a data and appends the characters to \a output.
+///
+/// \param data
+/// \param output
+
+void QXmppBase64Encoder::encode(const QByteArray &data, QByteArray &output)
+{
+    const int start = output.size();
+    output.resize(start + encodedSize(data.size()));
+    output.resize(start + encode(data.constData(), data.size(), output.data() + start));
+}
+
+/// Appends the characters for the bytes kept from the previous chunks to
+/// \a output.
+///
+/// \param output
+
+void QXmppBase64Encoder::finish(QByteArray &output)
+{
+    char tail[4];
+    output.append(tail, finish(tail));
+}
+
+/// Discards the bytes kept from the previous chunks.
+
+void QXmppBase64Encoder::reset()
+{
+    m_pendingSize = 0;
+}
+
+/// Returns the size of the base64 encoding of \a size bytes, which is also
+/// the most encode() writes for a chunk of \a size bytes.
+///
+/// \param size
+
+int QXmppBase64Encoder::encodedSize(int size)
+{
+    return (size + 2) / 3 * 4;
+}
+
+QXmppBase64Decoder::QXmppBase64Decoder()
+    : m_buffer(0)
+    , m_bits(0)
+{
+}
+
+/// Decodes \a size characters of \a data into \a output, and returns the
+/// number of bytes written.
+///
+/// The bits of an incomplete byte are kept until the next call, so that
+/// the chunks need not be multiples of four characters.
+///
+/// \param data
+/// \param size
+/// \param output
+
+int QXmppBase64Decoder::decode(const char *data, int size, char *output)
+{
+    const uchar *input = reinterpret_cast<const uchar*>(data);
+    uchar *out = reinterpret_cast<uchar*>(output);
+
+    int i = 0;
+    while (i < size) {
+        // decode whole blocks while no bits are pending
+        if (!m_bits) {
+            const int decoded = decodeGroups(input + i, size - i, out);
+            out += decoded / 4 * 3;
+            i += decoded;
+            if (i == size)
+                break;
+        }
+
+        // then go on one character at a time, up to the next block
+        const int value = decodeTable[input[i++]];
+        if (value < 0)
+            continue;
+        m_buffer = (m_buffer << 6) | value;
+        m_bits += 6;
+        if (m_bits >= 8) {
+            m_bits -= 8;
+            *out++ = m_buffer >> m_bits;
+            m_buffer &= (1 << m_bits) - 1;
+        }
+    }
+    return out - reinterpret_cast<uchar*>(output);
+}
+
+/// Decodes \a data and appends the bytes to \a output.
+///
+/// \param data
+/// \param output
+
+void QXmppBase64Decoder::decode(const QByteArray &data, QByteArray &output)
+{
+    const int start = output.size();
+    output.resize(start + maximumDecodedSize(data.size()));
+    output.resize(start + decode(data.constData(), data.size(), output.data() + start));
+}
+
+/// Decodes \a data and appends the bytes to \a output.
+///
+/// This spares converting the text of an XML element to Latin-1 first.
+///
+/// \param data
+/// \param output
+
+void QXmppBase64Decoder::decode(const QString &data, QByteArray &output)
+{
+    const int start = output.size();
+    output.resize(start + maximumDecodedSize(data.size()));
+    char *out = output.data() + start;
+
+    // narrow the characters in small chunks, those outside Latin-1 are
+    // not part of the alphabet and are skipped like any invalid character
+    char chunk[512];
+    const ushort *input = data.utf16();
+    for (int i = 0; i < data.size(); i += int(sizeof(chunk))) {
+        const int size = qMin(int(sizeof(chunk)), data.size() - i);
+        for (int j = 0; j < size; ++j)
+            chunk[j] = input[i + j] < 0x100 ? char(input[i + j]) : char(0xff);
+        out += decode(chunk, size, out);
+    }
+    output.resize(out - output.constData());
+}
+
+/// Discards the bits kept from the previous chunks.
+
+void QXmppBase64Decoder::reset()
+{
+    m_buffer = 0;
+    m_bits = 0;
+}
+
+/// Returns the most decode() writes for a chunk of \a size characters.
+///
+/// \param size
+
+int QXmppBase64Decoder::maximumDecodedSize(int size)
+{
+    return size / 4 * 3 + 3;
+}
+
+/// Returns the base64 encoding of \a data.
+///
+/// \param data
+
+QByteArray QXmppBase64::encode(const QByteArray &data)
+{
+    QByteArray output;
+    QXmppBase64Encoder encoder;
+    encoder.encode(data, output);
+    encoder.finish(output);
+    return output;
+}
+
+/// Decodes the base64 encoded \a data.
+///
+/// \param data
+
+QByteArray QXmppBase64::decode(const QByteArray &data)
+{
+    QByteArray output;
+    QXmppBase64Decoder decoder;
+    decoder.decode(data, output);
+    return output;
+}
+
+/// Decodes the base64 encoded \a data.
+///
+/// \param data
+
+QByteArray QXmppBase64::decode(const QString &data)
+{
+    QByteArray output;
+    QXmppBase64Decoder decoder;
+    decoder.decode(data, output);
+    return output;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPBASE64_P_H
+#define QXMPPBASE64_P_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the classes which carry base64 encoded data, such as QXmppIbbDataIq,
+// QXmppVCardIq, QXmppRpcInvokeIq and the SASL classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppBase64Encoder class encodes data to base64, as defined by
+/// RFC 4648, in one or more chunks which need not be multiples of three
+/// bytes.
+///
+/// The data is written into a buffer provided by the caller, which must
+/// hold at least encodedSize() bytes for a chunk. Whole blocks are encoded
+/// using SSE2 or NEON instructions when they are available.
+
+class QXMPP_AUTOTEST_EXPORT QXmppBase64Encoder
+{
+public:
+    QXmppBase64Encoder();
+
+    int encode(const char *data, int size, char *output);
+    int finish(char *output);
+    void encode(const QByteArray &data, QByteArray &output);
+    void finish(QByteArray &output);
+    void reset();
+
+    static int encodedSize(int size);
+
+private:
+    uchar m_pending[3];
+    int m_pendingSize;
+};
+
+/// \internal
+///
+/// The QXmppBase64Decoder class decodes base64 data in one or more chunks,
+/// which need not be multiples of four characters.
+///
+/// Like QByteArray::fromBase64(), characters which are not part of the
+/// base64 alphabet, such as whitespace and padding, are skipped. The data
+/// is written into a buffer provided by the caller, which must hold at
+/// least maximumDecodedSize() bytes for a chunk. Whole blocks are decoded
+/// using SSE2 or NEON instructions when they are available.
+
+class QXMPP_AUTOTEST_EXPORT QXmppBase64Decoder
+{
+public:
+    QXmppBase64Decoder();
+
+    int decode(const char *data, int size, char *output);
+    void decode(const QByteArray &data, QByteArray &output);
+    void decode(const QString &data, QByteArray &output);
+    void reset();
+
+    static int maximumDecodedSize(int size);
+
+private:
+    quint32 m_buffer;
+    int m_bits;
+};
+
+/// \internal
+///
+/// The QXmppBase64 class encodes and decodes whole base64 payloads, as a
+/// replacement for QByteArray::toBase64() and QByteArray::fromBase64().
+
+class QXMPP_AUTOTEST_EXPORT QXmppBase64
+{
+public:
+    static QByteArray encode(const QByteArray &data);
+    static QByteArray decode(const QByteArray &data);
+    static QByteArray decode(const QString &data);
+};
+
+#endif
@@ -26,7 +26,7 @@
 #include "QXmppBookmarkSet.h"
 #include "QXmppUtils.h"
 
-static const char *ns_bookmarks = "storage:bookmarks";
+static const QLatin1String ns_bookmarks("storage:bookmarks");
 
 /// Constructs a new conference room bookmark.
 ///
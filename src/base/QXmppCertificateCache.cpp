@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QCryptographicHash>
+
+#include "QXmppCertificateCache_p.h"
+
+// The number of certificates kept for a domain, which may be served by
+// several hosts with their own certificates.
+static const int maximumDomainEntries = 4;
+
+Q_GLOBAL_STATIC(QXmppCertificateCache, certificateCache)
+
+/// Constructs an empty cache.
+
+QXmppCertificateCache::QXmppCertificateCache()
+{
+}
+
+/// Returns true if a certificate which has not expired is cached for
+/// \a domain.
+
+bool QXmppCertificateCache::contains(const QString &domain) const
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    QMutexLocker locker(&m_mutex);
+    foreach (const Entry &entry, m_entries.value(domain)) {
+        if (entry.expiry > now)
+            return true;
+    }
+    return false;
+}
+
+/// Returns true if \a certificate is cached for \a domain and has not
+/// expired.
+
+bool QXmppCertificateCache::isVerified(const QString &domain, const QSslCertificate &certificate) const
+{
+    if (certificate.isNull())
+        return false;
+
+    const QByteArray digest = fingerprint(certificate);
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    QMutexLocker locker(&m_mutex);
+    foreach (const Entry &entry, m_entries.value(domain)) {
+        if (entry.fingerprint == digest)
+            return entry.expiry > now;
+    }
+    return false;
+}
+
+/// Caches a \a certificate which was verified for \a domain, for at most
+/// \a maximumAge seconds.
+///
+/// Returns false if the certificate is not currently valid, in which case
+/// it is not cached.
+
+bool QXmppCertificateCache::insert(const QString &domain, const QSslCertificate &certificate, int maximumAge)
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    if (certificate.isNull() || maximumAge <= 0 ||
+        certificate.effectiveDate() > now || certificate.expiryDate() <= now)
+        return false;
+
+    Entry entry;
+    entry.fingerprint = fingerprint(certificate);
+    entry.expiry = qMin(certificate.expiryDate().toUTC(), now.addSecs(maximumAge));
+
+    QMutexLocker locker(&m_mutex);
+    QList<Entry> &entries = m_entries[domain];
+    for (int i = entries.size() - 1; i >= 0; --i) {
+        if (entries[i].fingerprint == entry.fingerprint || entries[i].expiry <= now)
+            entries.removeAt(i);
+    }
+
+    // replace the entry which expires first
+    if (entries.size() >= maximumDomainEntries) {
+        int first = 0;
+        for (int i = 1; i < entries.size(); ++i) {
+            if (entries[i].expiry < entries[first].expiry)
+                first = i;
+        }
+        entries.removeAt(first);
+    }
+    entries << entry;
+    return true;
+}
+
+/// Forgets the certificates cached for \a domain.
+
+void QXmppCertificateCache::remove(const QString &domain)
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.remove(domain);
+}
+
+/// Returns the number of cached certificates.
+
+int QXmppCertificateCache::size() const
+{
+    QMutexLocker locker(&m_mutex);
+    int count = 0;
+    foreach (const QList<Entry> &entries, m_entries)
+        count += entries.size();
+    return count;
+}
+
+/// Returns the cache shared by all the streams of the process.
+
+QXmppCertificateCache *QXmppCertificateCache::instance()
+{
+    return certificateCache();
+}
+
+QByteArray QXmppCertificateCache::fingerprint(const QSslCertificate &certificate)
+{
+#if QT_VERSION >= 0x050000
+    return certificate.digest(QCryptographicHash::Sha256);
+#else
+    return certificate.digest(QCryptographicHash::Sha1);
+#endif
+}
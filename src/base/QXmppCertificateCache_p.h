@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPCERTIFICATECACHE_P_H
+#define QXMPPCERTIFICATECACHE_P_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSslCertificate>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppOutgoingClient and QXmppOutgoingServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppCertificateCache class remembers the certificates which passed
+/// chain verification for a peer domain, by fingerprint.
+///
+/// A stream whose peer domain has a verified certificate can skip building
+/// and checking the certificate chain during the TLS handshake, provided it
+/// checks that the peer presented one of the cached certificates once the
+/// handshake is done.
+///
+/// An entry expires with its certificate, or after the maximum age it was
+/// inserted with, whichever comes first. The cache is shared by the streams
+/// of all threads.
+
+class QXMPP_AUTOTEST_EXPORT QXmppCertificateCache
+{
+public:
+    QXmppCertificateCache();
+
+    bool contains(const QString &domain) const;
+    bool isVerified(const QString &domain, const QSslCertificate &certificate) const;
+    bool insert(const QString &domain, const QSslCertificate &certificate, int maximumAge);
+    void remove(const QString &domain);
+    int size() const;
+
+    static QXmppCertificateCache *instance();
+
+private:
+    struct Entry
+    {
+        QByteArray fingerprint;
+        QDateTime expiry;
+    };
+
+    static QByteArray fingerprint(const QSslCertificate &certificate);
+
+    mutable QMutex m_mutex;
+    QHash<QString, QList<Entry> > m_entries;
+};
+
+#endif
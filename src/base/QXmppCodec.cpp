@@ -29,13 +29,24 @@
 #include <QDebug>
 #include <QSize>
 #include <QThread>
+#include <QVarLengthArray>
+#include <QtEndian>
 
 #include "QXmppCodec_p.h"
+#include "QXmppMediaRing.h"
 #include "QXmppRtpChannel.h"
 #include "QXmppRtpPacket.h"
 
 #include <cstring>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QXMPP_VIDEO_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define QXMPP_VIDEO_NEON
+#include <arm_neon.h>
+#endif
+
 #ifdef QXMPP_USE_SPEEX
 #include <speex/speex.h>
 #endif
@@ -257,18 +268,893 @@ static qint16 ulaw2linear(quint8 u_val)
    return ((u_val & SIGN_BIT) ? (BIAS - t) : (t - BIAS));
 }
 
+// Lookup tables for G.711, the encoding tables are indexed by the bits of
+// a sample which the conversion uses.
+class QXmppG711Tables
+{
+public:
+    QXmppG711Tables()
+    {
+        for (int i = 0; i < 256; ++i) {
+            alawDecode[i] = alaw2linear(i);
+            ulawDecode[i] = ulaw2linear(i);
+        }
+        for (int i = 0; i < 8192; ++i)
+            alawEncode[i] = linear2alaw(qint16(i << 3));
+        for (int i = 0; i < 16384; ++i)
+            ulawEncode[i] = linear2ulaw(qint16(i << 2));
+    }
+
+    qint16 alawDecode[256];
+    qint16 ulawDecode[256];
+    quint8 alawEncode[8192];
+    quint8 ulawEncode[16384];
+};
+
+Q_GLOBAL_STATIC(QXmppG711Tables, g711Tables)
+
+typedef void (*G711Encoder)(const qint16 *input, quint8 *output, int samples);
+typedef void (*G711Decoder)(const quint8 *input, qint16 *output, int samples);
+
+// Encodes the samples remaining in a stream with a G.711 block encoder.
+static qint64 g711EncodeStream(QDataStream &input, QDataStream &output, G711Encoder encoder)
+{
+    const QByteArray data = input.device()->readAll();
+    const int samples = data.size() / 2;
+    const uchar *src = reinterpret_cast<const uchar*>(data.constData());
+
+    QVarLengthArray<qint16, 1024> pcm(samples);
+    if (input.byteOrder() == QDataStream::LittleEndian) {
+        for (int i = 0; i < samples; ++i)
+            pcm[i] = qFromLittleEndian<qint16>(src + 2 * i);
+    } else {
+        for (int i = 0; i < samples; ++i)
+            pcm[i] = qFromBigEndian<qint16>(src + 2 * i);
+    }
+
+    QVarLengthArray<quint8, 1024> g711(samples);
+    encoder(pcm.constData(), g711.data(), samples);
+    output.writeRawData(reinterpret_cast<const char*>(g711.constData()), samples);
+    return samples;
+}
+
+// Decodes the data remaining in a stream with a G.711 block decoder.
+static qint64 g711DecodeStream(QDataStream &input, QDataStream &output, G711Decoder decoder)
+{
+    const QByteArray data = input.device()->readAll();
+    const int samples = data.size();
+
+    QVarLengthArray<qint16, 1024> pcm(samples);
+    decoder(reinterpret_cast<const quint8*>(data.constData()), pcm.data(), samples);
+
+    QVarLengthArray<uchar, 2048> bytes(2 * samples);
+    if (output.byteOrder() == QDataStream::LittleEndian) {
+        for (int i = 0; i < samples; ++i)
+            qToLittleEndian<qint16>(pcm[i], bytes.data() + 2 * i);
+    } else {
+        for (int i = 0; i < samples; ++i)
+            qToBigEndian<qint16>(pcm[i], bytes.data() + 2 * i);
+    }
+    output.writeRawData(reinterpret_cast<const char*>(bytes.constData()), 2 * samples);
+    return samples;
+}
+
 QXmppCodec::~QXmppCodec()
 {
 }
 
+/// Writes up to \a samples samples to the output stream to replace audio
+/// which was lost, and returns the number of samples written.
+///
+/// The default implementation writes nothing, in which case the lost
+/// audio is replaced by silence.
+
+qint64 QXmppCodec::conceal(QDataStream &output, qint64 samples)
+{
+    Q_UNUSED(output);
+    Q_UNUSED(samples);
+    return 0;
+}
+
+/// Writes up to \a samples samples to the output stream to replace audio
+/// which was lost just before the encoded packet read from the input stream,
+/// and returns the number of samples written.
+///
+/// Codecs which carry redundant data (FEC) can use it to rebuild the lost
+/// audio. The default implementation calls conceal().
+
+qint64 QXmppCodec::recover(QDataStream &input, QDataStream &output, qint64 samples)
+{
+    Q_UNUSED(input);
+    return conceal(output, samples);
+}
+
+/// Resets the codec's state, so that it can be used for another stream.
+///
+/// The default implementation does nothing, which is suitable for
+/// stateless codecs.
+
+void QXmppCodec::reset()
+{
+}
+
+/// Returns the number of samples in a frame of the codec, or 0 if the
+/// codec can encode any number of samples.
+///
+/// The number of samples passed to encodeFrame() should be a multiple
+/// of the frame size.
+
+int QXmppCodec::frameSamples() const
+{
+    return 0;
+}
+
+/// Encodes \a samples native-endian 16-bit samples from \a input and
+/// writes the encoded data to \a output, which can hold \a maxSize bytes.
+///
+/// Returns the number of bytes written, 0 if the samples are silence
+/// which need not be transmitted, or -1 if an error occurred.
+///
+/// The default implementation goes through encode(), subclasses should
+/// reimplement it to encode the samples in place.
+
+int QXmppCodec::encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize)
+{
+    QByteArray pcm(2 * samples, Qt::Uninitialized);
+    for (int i = 0; i < samples; ++i)
+        qToLittleEndian<qint16>(input[i], reinterpret_cast<uchar*>(pcm.data()) + 2 * i);
+
+    QByteArray encoded;
+    QDataStream inputStream(pcm);
+    inputStream.setByteOrder(QDataStream::LittleEndian);
+    QDataStream outputStream(&encoded, QIODevice::WriteOnly);
+    encode(inputStream, outputStream);
+    if (encoded.size() > maxSize)
+        return -1;
+    memcpy(output, encoded.constData(), encoded.size());
+    return encoded.size();
+}
+
+/// Sets the target \a bitrate of the encoder, in bits per second.
+///
+/// Returns false if the codec's bitrate cannot be changed.
+
+bool QXmppCodec::setBitrate(int bitrate)
+{
+    Q_UNUSED(bitrate);
+    return false;
+}
+
+/// Sets the computational \a complexity of the encoder, from 0 to 10.
+/// A lower complexity uses less CPU at the cost of quality.
+///
+/// Returns false if the codec's complexity cannot be changed.
+
+bool QXmppCodec::setComplexity(int complexity)
+{
+    Q_UNUSED(complexity);
+    return false;
+}
+
+/// Enables or disables in-band forward error correction.
+///
+/// Returns false if the codec does not support it.
+
+bool QXmppCodec::setForwardErrorCorrection(bool enabled)
+{
+    Q_UNUSED(enabled);
+    return false;
+}
+
+/// Sets the expected packet loss \a percentage, which the encoder
+/// uses to tune its error resilience.
+///
+/// Returns false if the codec does not support it.
+
+bool QXmppCodec::setPacketLossPercentage(int percentage)
+{
+    Q_UNUSED(percentage);
+    return false;
+}
+
+/// Constructs a pool which keeps up to \a capacity frame buffers.
+
+QXmppVideoFramePool::QXmppVideoFramePool(int capacity)
+    : m_capacity(capacity)
+    , m_ring(0)
+{
+}
+
+/// Returns a frame with the given geometry, reusing a released buffer
+/// if one is available.
+
+QXmppVideoFrame QXmppVideoFramePool::frame(int bytes, const QSize &size, int bytesPerLine, QXmppVideoFrame::PixelFormat format)
+{
+    // decode into the next slot of the ring, unless a previous frame
+    // still holds the reservation
+    if (m_ring && !m_ring->reservation()) {
+        uchar *slot = m_ring->reserve(bytes);
+        if (slot) {
+            QXmppVideoFrame frame;
+            frame.m_bytesPerLine = bytesPerLine;
+            frame.m_data = QByteArray::fromRawData(reinterpret_cast<const char*>(slot), bytes);
+            frame.m_height = size.height();
+            frame.m_mappedBytes = bytes;
+            frame.m_pixelFormat = format;
+            frame.m_width = size.width();
+            return frame;
+        }
+    }
+
+    for (int i = 0; i < m_frames.size(); ++i) {
+        QXmppVideoFrame &pooled = m_frames[i];
+        // the pool holds the only reference to this buffer
+        if (pooled.m_data.isDetached()) {
+            if (pooled.m_data.size() != bytes)
+                pooled.m_data.resize(bytes);
+            pooled.m_bytesPerLine = bytesPerLine;
+            pooled.m_height = size.height();
+            pooled.m_mappedBytes = bytes;
+            pooled.m_pixelFormat = format;
+            pooled.m_width = size.width();
+            return pooled;
+        }
+    }
+
+    QXmppVideoFrame frame(bytes, size, bytesPerLine, format);
+    if (m_frames.size() < m_capacity)
+        m_frames << frame;
+    return frame;
+}
+
+/// Returns a writable pointer to the data of a \a frame returned by frame().
+///
+/// Unlike QXmppVideoFrame::bits(), this does not detach the frame from the
+/// pool's copy of the buffer.
+
+uchar *QXmppVideoFramePool::bits(const QXmppVideoFrame &frame)
+{
+    return reinterpret_cast<uchar*>(const_cast<char*>(frame.m_data.constData()));
+}
+
+/// Sets the \a ring into which frames are decoded.
+///
+/// The frames returned by frame() then point into a reserved slot of the
+/// ring, until the caller publishes them.
+
+void QXmppVideoFramePool::setRing(QXmppMediaRing *ring)
+{
+    m_ring = ring;
+}
+
+QXmppVideoPacketBuffer::QXmppVideoPacketBuffer()
+    : m_size(0),
+    m_count(0)
+{
+}
+
+/// Removes all the packets, keeping the memory for the next frame.
+
+void QXmppVideoPacketBuffer::clear()
+{
+    m_size = 0;
+    m_count = 0;
+}
+
+/// Adds a packet and returns a pointer to its payload, which is preceded
+/// by headerRoom bytes for the RTP header.
+///
+/// The pointer is only valid until the next packet is added.
+///
+/// \param payloadSize
+
+uchar *QXmppVideoPacketBuffer::addPacket(int payloadSize)
+{
+    const int offset = m_size;
+    m_size += headerRoom + payloadSize;
+    if (m_size > m_data.size())
+        m_data.resize(qMax(m_size, 2 * m_data.size()));
+
+    if (m_count == m_offsets.size())
+        m_offsets.append(offset);
+    else
+        m_offsets[m_count] = offset;
+    m_count++;
+
+    return reinterpret_cast<uchar*>(m_data.data()) + offset + headerRoom;
+}
+
+/// Returns the number of packets.
+
+int QXmppVideoPacketBuffer::count() const
+{
+    return m_count;
+}
+
+/// Returns a pointer to the packet at \a index, starting with the room
+/// reserved for its RTP header.
+
+uchar *QXmppVideoPacketBuffer::packet(int index)
+{
+    return reinterpret_cast<uchar*>(m_data.data()) + m_offsets[index];
+}
+
+/// Returns the size of the packet at \a index, including the room reserved
+/// for its RTP header.
+
+int QXmppVideoPacketBuffer::packetSize(int index) const
+{
+    const int end = (index + 1 < m_count) ? m_offsets[index + 1] : m_size;
+    return end - m_offsets[index];
+}
+
+/// Returns a copy of the payload of the packet at \a index.
+
+QByteArray QXmppVideoPacketBuffer::payload(int index) const
+{
+    return m_data.mid(m_offsets[index] + headerRoom, packetSize(index) - headerRoom);
+}
+
+QXmppVideoFragmentBuffer::QXmppVideoFragmentBuffer()
+    : m_size(0)
+{
+}
+
+/// Removes the fragments, keeping the memory for the next frame.
+
+void QXmppVideoFragmentBuffer::clear()
+{
+    m_size = 0;
+}
+
+/// Appends a fragment.
+///
+/// \param data
+/// \param size
+
+void QXmppVideoFragmentBuffer::append(const uchar *data, int size)
+{
+    if (m_size + size > m_data.size())
+        m_data.resize(qMax(m_size + size, 2 * m_data.size()));
+    memcpy(m_data.data() + m_size, data, size);
+    m_size += size;
+}
+
+/// Returns the reassembled data.
+
+const uchar *QXmppVideoFragmentBuffer::data() const
+{
+    return reinterpret_cast<const uchar*>(m_data.constData());
+}
+
+/// Returns the size of the reassembled data.
+
+int QXmppVideoFragmentBuffer::size() const
+{
+    return m_size;
+}
+
+/// Returns true if no fragment was appended since the buffer was cleared.
+
+bool QXmppVideoFragmentBuffer::isEmpty() const
+{
+    return m_size == 0;
+}
+
+// Video conversion kernels. The loops over packed YUV rows handle 16 pixels
+// at a time with SIMD instructions when available, the remaining pixels
+// being handled by the scalar code.
+
+static bool isPackedYuv(QXmppVideoFrame::PixelFormat format)
+{
+    return format == QXmppVideoFrame::Format_YUYV || format == QXmppVideoFrame::Format_UYVY;
+}
+
+static bool isRgb(QXmppVideoFrame::PixelFormat format)
+{
+    return format == QXmppVideoFrame::Format_RGB32 || format == QXmppVideoFrame::Format_RGB24;
+}
+
+// Extracts the luma of a packed YUV row.
+static void packedLumaRow(const uchar *input, uchar *y, int width, bool uyvy)
+{
+    int x = 0;
+#if defined(QXMPP_VIDEO_SSE2)
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    for (; x + 16 <= width; x += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * x + 16));
+        if (uyvy) {
+            a = _mm_srli_epi16(a, 8);
+            b = _mm_srli_epi16(b, 8);
+        } else {
+            a = _mm_and_si128(a, mask);
+            b = _mm_and_si128(b, mask);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y + x), _mm_packus_epi16(a, b));
+    }
+#elif defined(QXMPP_VIDEO_NEON)
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x2_t pixels = vld2q_u8(input + 2 * x);
+        vst1q_u8(y + x, uyvy ? pixels.val[1] : pixels.val[0]);
+    }
+#endif
+    input += uyvy ? 1 : 0;
+    for (; x < width; ++x)
+        y[x] = input[2 * x];
+}
+
+// Extracts the chroma of two packed YUV rows, averaging them. Both rows
+// may be the same.
+static void packedChromaRow(const uchar *input0, const uchar *input1, uchar *u, uchar *v, int width, bool uyvy)
+{
+    int x = 0;
+#if defined(QXMPP_VIDEO_SSE2)
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    for (; x + 16 <= width; x += 16) {
+        __m128i a = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input0 + 2 * x)),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(input1 + 2 * x)));
+        __m128i b = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input0 + 2 * x + 16)),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(input1 + 2 * x + 16)));
+        if (uyvy) {
+            a = _mm_and_si128(a, mask);
+            b = _mm_and_si128(b, mask);
+        } else {
+            a = _mm_srli_epi16(a, 8);
+            b = _mm_srli_epi16(b, 8);
+        }
+        // U and V alternate
+        const __m128i uv = _mm_packus_epi16(a, b);
+        const __m128i zero = _mm_setzero_si128();
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), _mm_packus_epi16(_mm_and_si128(uv, mask), zero));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero));
+    }
+#elif defined(QXMPP_VIDEO_NEON)
+    for (; x + 16 <= width; x += 16) {
+        const uint8x8x4_t a = vld4_u8(input0 + 2 * x);
+        const uint8x8x4_t b = vld4_u8(input1 + 2 * x);
+        const int uIndex = uyvy ? 0 : 1;
+        const int vIndex = uyvy ? 2 : 3;
+        vst1_u8(u + x / 2, vrhadd_u8(a.val[uIndex], b.val[uIndex]));
+        vst1_u8(v + x / 2, vrhadd_u8(a.val[vIndex], b.val[vIndex]));
+    }
+#endif
+    const int offset = uyvy ? 0 : 1;
+    for (; x + 1 < width; x += 2) {
+        const int i = 2 * x + offset;
+        u[x / 2] = (input0[i] + input1[i] + 1) >> 1;
+        v[x / 2] = (input0[i + 2] + input1[i + 2] + 1) >> 1;
+    }
+}
+
+// Interleaves a row of planar YUV 4:2:2 into a packed YUV row.
+static void packRow(const uchar *y, const uchar *u, const uchar *v, uchar *output, int width, bool uyvy)
+{
+    int x = 0;
+#if defined(QXMPP_VIDEO_SSE2)
+    for (; x + 16 <= width; x += 16) {
+        const __m128i luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        const __m128i uv = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2)),
+                                             _mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2)));
+        __m128i *out = reinterpret_cast<__m128i*>(output + 2 * x);
+        if (uyvy) {
+            _mm_storeu_si128(out, _mm_unpacklo_epi8(uv, luma));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(uv, luma));
+        } else {
+            _mm_storeu_si128(out, _mm_unpacklo_epi8(luma, uv));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(luma, uv));
+        }
+    }
+#elif defined(QXMPP_VIDEO_NEON)
+    for (; x + 16 <= width; x += 16) {
+        const uint8x8x2_t luma = vld2_u8(y + x);
+        uint8x8x4_t pixels;
+        if (uyvy) {
+            pixels.val[0] = vld1_u8(u + x / 2);
+            pixels.val[1] = luma.val[0];
+            pixels.val[2] = vld1_u8(v + x / 2);
+            pixels.val[3] = luma.val[1];
+        } else {
+            pixels.val[0] = luma.val[0];
+            pixels.val[1] = vld1_u8(u + x / 2);
+            pixels.val[2] = luma.val[1];
+            pixels.val[3] = vld1_u8(v + x / 2);
+        }
+        vst4_u8(output + 2 * x, pixels);
+    }
+#endif
+    for (; x + 1 < width; x += 2) {
+        uchar *out = output + 2 * x;
+        if (uyvy) {
+            out[0] = u[x / 2];
+            out[1] = y[x];
+            out[2] = v[x / 2];
+            out[3] = y[x + 1];
+        } else {
+            out[0] = y[x];
+            out[1] = u[x / 2];
+            out[2] = y[x + 1];
+            out[3] = v[x / 2];
+        }
+    }
+}
+
+// Converts a YUYV row to UYVY or the other way round.
+static void swapRow(const uchar *input, uchar *output, int width)
+{
+    int i = 0;
+    const int bytes = 2 * width;
+#if defined(QXMPP_VIDEO_SSE2)
+    for (; i + 16 <= bytes; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8)));
+    }
+#elif defined(QXMPP_VIDEO_NEON)
+    for (; i + 16 <= bytes; i += 16)
+        vst1q_u8(output + i, vrev16q_u8(vld1q_u8(input + i)));
+#endif
+    for (; i + 1 < bytes; i += 2) {
+        const uchar first = input[i];
+        output[i] = input[i + 1];
+        output[i + 1] = first;
+    }
+}
+
+static inline uchar clampPixel(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline void readRgb(const uchar *row, int x, bool rgb32, int &r, int &g, int &b)
+{
+    if (rgb32) {
+        const quint32 pixel = reinterpret_cast<const quint32*>(row)[x];
+        r = (pixel >> 16) & 0xff;
+        g = (pixel >> 8) & 0xff;
+        b = pixel & 0xff;
+    } else {
+        r = row[3 * x];
+        g = row[3 * x + 1];
+        b = row[3 * x + 2];
+    }
+}
+
+static inline void writeRgb(uchar *row, int x, bool rgb32, int r, int g, int b)
+{
+    if (rgb32) {
+        reinterpret_cast<quint32*>(row)[x] = 0xff000000 | (r << 16) | (g << 8) | b;
+    } else {
+        row[3 * x] = r;
+        row[3 * x + 1] = g;
+        row[3 * x + 2] = b;
+    }
+}
+
+// ITU-R BT.601, studio swing
+static inline uchar rgbToY(int r, int g, int b)
+{
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline uchar rgbToU(int r, int g, int b)
+{
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline uchar rgbToV(int r, int g, int b)
+{
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static inline void yuvToRgb(int y, int u, int v, int &r, int &g, int &b)
+{
+    const int c = 298 * (y - 16);
+    const int d = u - 128;
+    const int e = v - 128;
+    r = clampPixel((c + 409 * e + 128) >> 8);
+    g = clampPixel((c - 100 * d - 208 * e + 128) >> 8);
+    b = clampPixel((c + 516 * d + 128) >> 8);
+}
+
+// Scales a plane with bilinear interpolation, in 16.16 fixed point.
+static void scalePlane(const uchar *input, int inputStride, int inputWidth, int inputHeight,
+                       uchar *output, int outputStride, int outputWidth, int outputHeight)
+{
+    if (inputWidth <= 0 || inputHeight <= 0 || outputWidth <= 0 || outputHeight <= 0)
+        return;
+
+    const qint64 xStep = (qint64(inputWidth) << 16) / outputWidth;
+    const qint64 yStep = (qint64(inputHeight) << 16) / outputHeight;
+    QVarLengthArray<int, 1024> xIndex(outputWidth);
+    QVarLengthArray<int, 1024> xWeight(outputWidth);
+    for (int x = 0; x < outputWidth; ++x) {
+        // sample at the centre of the output pixel
+        const qint64 position = qMax(qint64(0), (x * xStep) + (xStep >> 1) - 0x8000);
+        xIndex[x] = qMin(int(position >> 16), inputWidth - 1);
+        xWeight[x] = xIndex[x] < inputWidth - 1 ? int(position & 0xffff) >> 8 : 0;
+    }
+
+    for (int y = 0; y < outputHeight; ++y) {
+        const qint64 position = qMax(qint64(0), (y * yStep) + (yStep >> 1) - 0x8000);
+        const int row = qMin(int(position >> 16), inputHeight - 1);
+        const int yWeight = row < inputHeight - 1 ? int(position & 0xffff) >> 8 : 0;
+        const uchar *row0 = input + row * inputStride;
+        const uchar *row1 = yWeight ? row0 + inputStride : row0;
+        uchar *out = output + y * outputStride;
+        for (int x = 0; x < outputWidth; ++x) {
+            const int i = xIndex[x];
+            const int j = xWeight[x] ? i + 1 : i;
+            const int top = row0[i] * (256 - xWeight[x]) + row0[j] * xWeight[x];
+            const int bottom = row1[i] * (256 - xWeight[x]) + row1[j] * xWeight[x];
+            out[x] = (top * (256 - yWeight) + bottom * yWeight + 32768) >> 16;
+        }
+    }
+}
+
+// Returns the planes of a YUV 4:2:0 frame.
+static void yuv420pPlanes(const QXmppVideoFrame &frame, const uchar *planes[3], int strides[3])
+{
+    strides[0] = frame.bytesPerLine();
+    strides[1] = strides[2] = frame.bytesPerLine() / 2;
+    planes[0] = frame.bits();
+    planes[1] = planes[0] + strides[0] * frame.height();
+    planes[2] = planes[1] + strides[1] * ((frame.height() + 1) / 2);
+}
+
+static QXmppVideoFrame allocateFrame(QXmppVideoFrame::PixelFormat format, const QSize &size)
+{
+    const int width = size.width();
+    const int height = size.height();
+    switch (format) {
+    case QXmppVideoFrame::Format_RGB32:
+        return QXmppVideoFrame(4 * width * height, size, 4 * width, format);
+    case QXmppVideoFrame::Format_RGB24:
+        return QXmppVideoFrame(3 * width * height, size, 3 * width, format);
+    case QXmppVideoFrame::Format_YUYV:
+    case QXmppVideoFrame::Format_UYVY: {
+        const int stride = 2 * (width + (width & 1));
+        return QXmppVideoFrame(stride * height, size, stride, format);
+    }
+    case QXmppVideoFrame::Format_YUV420P: {
+        const int stride = width + (width & 1);
+        return QXmppVideoFrame(stride * height + stride * ((height + 1) / 2), size, stride, format);
+    }
+    default:
+        return QXmppVideoFrame();
+    }
+}
+
+// Converts a YUV 4:2:0 frame to packed YUV or RGB.
+static void fromYuv420p(const QXmppVideoFrame &frame, QXmppVideoFrame &output)
+{
+    const uchar *planes[3];
+    int strides[3];
+    yuv420pPlanes(frame, planes, strides);
+
+    const int width = frame.width();
+    const int height = frame.height();
+    const QXmppVideoFrame::PixelFormat format = output.pixelFormat();
+    uchar *row = output.bits();
+    for (int y = 0; y < height; ++y) {
+        const uchar *yRow = planes[0] + y * strides[0];
+        const uchar *uRow = planes[1] + (y / 2) * strides[1];
+        const uchar *vRow = planes[2] + (y / 2) * strides[2];
+        if (isPackedYuv(format)) {
+            packRow(yRow, uRow, vRow, row, width, format == QXmppVideoFrame::Format_UYVY);
+        } else {
+            const bool rgb32 = format == QXmppVideoFrame::Format_RGB32;
+            int r, g, b;
+            for (int x = 0; x < width; ++x) {
+                yuvToRgb(yRow[x], uRow[x / 2], vRow[x / 2], r, g, b);
+                writeRgb(row, x, rgb32, r, g, b);
+            }
+        }
+        row += output.bytesPerLine();
+    }
+}
+
+/// Returns true if frames using the given pixel \a format can be
+/// converted.
+
+bool QXmppVideoConverter::isSupported(QXmppVideoFrame::PixelFormat format)
+{
+    return isRgb(format) || isPackedYuv(format) || format == QXmppVideoFrame::Format_YUV420P;
+}
+
+/// Converts a \a frame to the given pixel \a format and \a size.
+///
+/// If \a size is not valid, the frame's size is kept. The frame is returned
+/// unchanged if it already has the requested format and size, and an
+/// invalid frame is returned if either format is not supported.
+
+QXmppVideoFrame QXmppVideoConverter::convert(const QXmppVideoFrame &frame, QXmppVideoFrame::PixelFormat format, const QSize &size)
+{
+    if (!frame.isValid() || !isSupported(frame.pixelFormat()) || !isSupported(format))
+        return QXmppVideoFrame();
+
+    const QSize outputSize = size.isValid() ? size : frame.size();
+    const QXmppVideoFrame::PixelFormat inputFormat = frame.pixelFormat();
+    if (inputFormat == format && outputSize == frame.size())
+        return frame;
+
+    // frames are scaled as YUV 4:2:0
+    if (outputSize != frame.size()) {
+        const QXmppVideoFrame input = convert(frame, QXmppVideoFrame::Format_YUV420P);
+        QXmppVideoFrame output = allocateFrame(QXmppVideoFrame::Format_YUV420P, outputSize);
+        const uchar *inputPlanes[3];
+        int inputStrides[3];
+        yuv420pPlanes(input, inputPlanes, inputStrides);
+        const uchar *outputPlanes[3];
+        int outputStrides[3];
+        yuv420pPlanes(output, outputPlanes, outputStrides);
+        for (int i = 0; i < 3; ++i) {
+            const int shift = i ? 1 : 0;
+            scalePlane(inputPlanes[i], inputStrides[i],
+                       (input.width() + shift) >> shift, (input.height() + shift) >> shift,
+                       const_cast<uchar*>(outputPlanes[i]), outputStrides[i],
+                       (outputSize.width() + shift) >> shift, (outputSize.height() + shift) >> shift);
+        }
+        return convert(output, format);
+    }
+
+    QXmppVideoFrame output = allocateFrame(format, outputSize);
+    const int width = frame.width();
+    const int height = frame.height();
+    if (format == QXmppVideoFrame::Format_YUV420P) {
+        const uchar *planes[3];
+        int strides[3];
+        yuv420pPlanes(output, planes, strides);
+        uchar *const outputPlanes[3] = {
+            const_cast<uchar*>(planes[0]),
+            const_cast<uchar*>(planes[1]),
+            const_cast<uchar*>(planes[2])
+        };
+        toYuv420p(frame, outputPlanes, strides);
+    } else if (inputFormat == QXmppVideoFrame::Format_YUV420P) {
+        fromYuv420p(frame, output);
+    } else if (isPackedYuv(inputFormat) && isPackedYuv(format)) {
+        for (int y = 0; y < height; ++y)
+            swapRow(frame.bits() + y * frame.bytesPerLine(), output.bits() + y * output.bytesPerLine(), width);
+    } else if (isRgb(inputFormat) && isRgb(format)) {
+        const bool inputRgb32 = inputFormat == QXmppVideoFrame::Format_RGB32;
+        const bool outputRgb32 = format == QXmppVideoFrame::Format_RGB32;
+        for (int y = 0; y < height; ++y) {
+            const uchar *inputRow = frame.bits() + y * frame.bytesPerLine();
+            uchar *outputRow = output.bits() + y * output.bytesPerLine();
+            int r, g, b;
+            for (int x = 0; x < width; ++x) {
+                readRgb(inputRow, x, inputRgb32, r, g, b);
+                writeRgb(outputRow, x, outputRgb32, r, g, b);
+            }
+        }
+    } else {
+        // between packed YUV and RGB
+        fromYuv420p(convert(frame, QXmppVideoFrame::Format_YUV420P), output);
+    }
+    return output;
+}
+
+/// Converts a \a frame to YUV 4:2:0, writing it to the given \a planes,
+/// and returns false if its pixel format is not supported.
+///
+/// The chroma of each pair of lines is averaged.
+
+bool QXmppVideoConverter::toYuv420p(const QXmppVideoFrame &frame, uchar *const planes[3], const int strides[3])
+{
+    const int width = frame.width();
+    const int height = frame.height();
+    const QXmppVideoFrame::PixelFormat format = frame.pixelFormat();
+    if (format == QXmppVideoFrame::Format_YUV420P) {
+        const uchar *inputPlanes[3];
+        int inputStrides[3];
+        yuv420pPlanes(frame, inputPlanes, inputStrides);
+        for (int i = 0; i < 3; ++i) {
+            const int shift = i ? 1 : 0;
+            const int planeWidth = (width + shift) >> shift;
+            const int planeHeight = (height + shift) >> shift;
+            for (int y = 0; y < planeHeight; ++y)
+                memcpy(planes[i] + y * strides[i], inputPlanes[i] + y * inputStrides[i], planeWidth);
+        }
+    } else if (isPackedYuv(format)) {
+        const bool uyvy = format == QXmppVideoFrame::Format_UYVY;
+        const int stride = frame.bytesPerLine();
+        for (int y = 0; y < height; y += 2) {
+            const uchar *row0 = frame.bits() + y * stride;
+            const uchar *row1 = (y + 1 < height) ? row0 + stride : row0;
+            packedLumaRow(row0, planes[0] + y * strides[0], width, uyvy);
+            if (row1 != row0)
+                packedLumaRow(row1, planes[0] + (y + 1) * strides[0], width, uyvy);
+            packedChromaRow(row0, row1, planes[1] + (y / 2) * strides[1], planes[2] + (y / 2) * strides[2], width, uyvy);
+        }
+    } else if (isRgb(format)) {
+        const bool rgb32 = format == QXmppVideoFrame::Format_RGB32;
+        const int stride = frame.bytesPerLine();
+        for (int y = 0; y < height; y += 2) {
+            const uchar *row0 = frame.bits() + y * stride;
+            const uchar *row1 = (y + 1 < height) ? row0 + stride : row0;
+            uchar *y0 = planes[0] + y * strides[0];
+            uchar *y1 = (y + 1 < height) ? y0 + strides[0] : 0;
+            uchar *u = planes[1] + (y / 2) * strides[1];
+            uchar *v = planes[2] + (y / 2) * strides[2];
+            for (int x = 0; x < width; x += 2) {
+                const int next = (x + 1 < width) ? x + 1 : x;
+                int r[4], g[4], b[4];
+                readRgb(row0, x, rgb32, r[0], g[0], b[0]);
+                readRgb(row0, next, rgb32, r[1], g[1], b[1]);
+                readRgb(row1, x, rgb32, r[2], g[2], b[2]);
+                readRgb(row1, next, rgb32, r[3], g[3], b[3]);
+                y0[x] = rgbToY(r[0], g[0], b[0]);
+                if (next != x)
+                    y0[next] = rgbToY(r[1], g[1], b[1]);
+                if (y1) {
+                    y1[x] = rgbToY(r[2], g[2], b[2]);
+                    if (next != x)
+                        y1[next] = rgbToY(r[3], g[3], b[3]);
+                }
+
+                // the chroma of the 2x2 block
+                const int red = (r[0] + r[1] + r[2] + r[3] + 2) >> 2;
+                const int green = (g[0] + g[1] + g[2] + g[3] + 2) >> 2;
+                const int blue = (b[0] + b[1] + b[2] + b[3] + 2) >> 2;
+                u[x / 2] = rgbToU(red, green, blue);
+                v[x / 2] = rgbToV(red, green, blue);
+            }
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// Packs planar YUV 4:2:2 \a planes into an \a output buffer using the
+/// given packed YUV \a format.
+
+void QXmppVideoConverter::packYuv422p(const uchar *const planes[3], const int strides[3], int width, int height, QXmppVideoFrame::PixelFormat format, uchar *output, int stride)
+{
+    const bool uyvy = format == QXmppVideoFrame::Format_UYVY;
+    for (int y = 0; y < height; ++y) {
+        packRow(planes[0] + y * strides[0], planes[1] + y * strides[1], planes[2] + y * strides[2],
+                output + y * stride, width, uyvy);
+    }
+}
+
+/// Unpacks an \a input buffer using the given packed YUV \a format into
+/// planar YUV 4:2:2 \a planes.
+
+void QXmppVideoConverter::unpackYuv422p(const uchar *input, int stride, int width, int height, QXmppVideoFrame::PixelFormat format, uchar *const planes[3], const int strides[3])
+{
+    const bool uyvy = format == QXmppVideoFrame::Format_UYVY;
+    for (int y = 0; y < height; ++y) {
+        const uchar *row = input + y * stride;
+        packedLumaRow(row, planes[0] + y * strides[0], width, uyvy);
+        packedChromaRow(row, row, planes[1] + y * strides[1], planes[2] + y * strides[2], width, uyvy);
+    }
+}
+
 QXmppVideoDecoder::~QXmppVideoDecoder()
 {
 }
 
+void QXmppVideoDecoder::setFrameRing(QXmppMediaRing *ring)
+{
+    Q_UNUSED(ring);
+}
+
 QXmppVideoEncoder::~QXmppVideoEncoder()
 {
 }
 
+/// Sets the target \a bitrate of the video stream, in bits per second.
+///
+/// This can be called while encoding to adapt to the available bandwidth.
+/// The default implementation does nothing and returns false.
+
+bool QXmppVideoEncoder::setBitrate(int bitrate)
+{
+    Q_UNUSED(bitrate);
+    return false;
+}
+
 QXmppG711aCodec::QXmppG711aCodec(int clockrate)
 {
     m_frequency = clockrate;
@@ -276,30 +1162,42 @@ QXmppG711aCodec::QXmppG711aCodec(int clockrate)
 
 qint64 QXmppG711aCodec::encode(QDataStream &input, QDataStream &output)
 {
-    qint64 samples = 0;
-    qint16 pcm;
-    while (!input.atEnd())
-    {
-        input >> pcm;
-        output << linear2alaw(pcm);
-        ++samples;
-    }
-    return samples;
+    return g711EncodeStream(input, output, &QXmppG711aCodec::encode);
 }
 
 qint64 QXmppG711aCodec::decode(QDataStream &input, QDataStream &output)
 {
-    qint64 samples = 0;
-    quint8 g711;
-    while (!input.atEnd())
-    {
-        input >> g711;
-        output << alaw2linear(g711);
-        ++samples;
-    }
+    return g711DecodeStream(input, output, &QXmppG711aCodec::decode);
+}
+
+int QXmppG711aCodec::encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize)
+{
+    if (samples > maxSize)
+        return -1;
+    encode(input, output, samples);
     return samples;
 }
 
+/// Encodes \a samples native-endian 16-bit samples from \a input to
+/// \a output, which must hold \a samples bytes.
+
+void QXmppG711aCodec::encode(const qint16 *input, quint8 *output, int samples)
+{
+    const quint8 *table = g711Tables()->alawEncode;
+    for (int i = 0; i < samples; ++i)
+        output[i] = table[(input[i] >> 3) & 0x1fff];
+}
+
+/// Decodes \a samples bytes from \a input to native-endian 16-bit samples
+/// in \a output, which must hold \a samples samples.
+
+void QXmppG711aCodec::decode(const quint8 *input, qint16 *output, int samples)
+{
+    const qint16 *table = g711Tables()->alawDecode;
+    for (int i = 0; i < samples; ++i)
+        output[i] = table[input[i]];
+}
+
 QXmppG711uCodec::QXmppG711uCodec(int clockrate)
 {
     m_frequency = clockrate;
@@ -307,32 +1205,48 @@ QXmppG711uCodec::QXmppG711uCodec(int clockrate)
 
 qint64 QXmppG711uCodec::encode(QDataStream &input, QDataStream &output)
 {
-    qint64 samples = 0;
-    qint16 pcm;
-    while (!input.atEnd())
-    {
-        input >> pcm;
-        output << linear2ulaw(pcm);
-        ++samples;
-    }
-    return samples;
+    return g711EncodeStream(input, output, &QXmppG711uCodec::encode);
 }
 
 qint64 QXmppG711uCodec::decode(QDataStream &input, QDataStream &output)
 {
-    qint64 samples = 0;
-    quint8 g711;
-    while (!input.atEnd())
-    {
-        input >> g711;
-        output << ulaw2linear(g711);
-        ++samples;
-    }
+    return g711DecodeStream(input, output, &QXmppG711uCodec::decode);
+}
+
+int QXmppG711uCodec::encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize)
+{
+    if (samples > maxSize)
+        return -1;
+    encode(input, output, samples);
     return samples;
 }
 
+/// Encodes \a samples native-endian 16-bit samples from \a input to
+/// \a output, which must hold \a samples bytes.
+
+void QXmppG711uCodec::encode(const qint16 *input, quint8 *output, int samples)
+{
+    const quint8 *table = g711Tables()->ulawEncode;
+    for (int i = 0; i < samples; ++i)
+        output[i] = table[(input[i] >> 2) & 0x3fff];
+}
+
+/// Decodes \a samples bytes from \a input to native-endian 16-bit samples
+/// in \a output, which must hold \a samples samples.
+
+void QXmppG711uCodec::decode(const quint8 *input, qint16 *output, int samples)
+{
+    const qint16 *table = g711Tables()->ulawDecode;
+    for (int i = 0; i < samples; ++i)
+        output[i] = table[input[i]];
+}
+
 #ifdef QXMPP_USE_SPEEX
+// Size of the encoded packet buffer, enough for several frames in any mode.
+static const int SPEEX_MAX_PACKET = 2000;
+
 QXmppSpeexCodec::QXmppSpeexCodec(int clockrate)
+    : dtx(false)
 {
     const SpeexMode *mode = &speex_nb_mode;
     if (clockrate == 32000)
@@ -356,61 +1270,158 @@ QXmppSpeexCodec::QXmppSpeexCodec(int clockrate)
 
     // get frame size in samples
     speex_encoder_ctl(encoder_state, SPEEX_GET_FRAME_SIZE, &frame_samples);
+
+    // silent periods are not transmitted
+    setDiscontinuousTransmission(true);
+
+    // allocate the scratch buffers once, so that encoding and decoding
+    // a frame does not allocate memory
+    pcm_buffer.resize(frame_samples * 2);
+    speex_buffer.resize(SPEEX_MAX_PACKET);
 }
 
 QXmppSpeexCodec::~QXmppSpeexCodec()
 {
+    speex_bits_destroy(encoder_bits);
+    speex_encoder_destroy(encoder_state);
+    speex_bits_destroy(decoder_bits);
+    speex_decoder_destroy(decoder_state);
     delete encoder_bits;
     delete decoder_bits;
 }
 
+void QXmppSpeexCodec::reset()
+{
+    speex_bits_reset(encoder_bits);
+    speex_encoder_ctl(encoder_state, SPEEX_RESET_STATE, 0);
+    speex_bits_reset(decoder_bits);
+    speex_decoder_ctl(decoder_state, SPEEX_RESET_STATE, 0);
+}
+
+/// Returns true if voice activity detection and discontinuous transmission
+/// are enabled, in which case silent frames are not transmitted.
+
+bool QXmppSpeexCodec::discontinuousTransmission() const
+{
+    return dtx;
+}
+
+/// Enables or disables voice activity detection and discontinuous
+/// transmission.
+///
+/// \param enabled
+
+void QXmppSpeexCodec::setDiscontinuousTransmission(bool enabled)
+{
+    int value = enabled ? 1 : 0;
+    speex_encoder_ctl(encoder_state, SPEEX_SET_VAD, &value);
+    speex_encoder_ctl(encoder_state, SPEEX_SET_DTX, &value);
+    dtx = enabled;
+}
+
+int QXmppSpeexCodec::frameSamples() const
+{
+    return frame_samples;
+}
+
+int QXmppSpeexCodec::encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize)
+{
+    if (samples <= 0 || samples % frame_samples)
+        return -1;
+
+    // the encoder may overwrite its input, so the frames are copied to the
+    // scratch buffer, and packed in the same packet
+    bool transmit = false;
+    speex_bits_reset(encoder_bits);
+    for (int i = 0; i < samples; i += frame_samples) {
+        memcpy(pcm_buffer.data(), input + i, frame_samples * 2);
+        if (speex_encode_int(encoder_state, reinterpret_cast<spx_int16_t*>(pcm_buffer.data()), encoder_bits))
+            transmit = true;
+    }
+    if (!transmit)
+        return 0;
+    if (samples > frame_samples)
+        speex_bits_insert_terminator(encoder_bits);
+
+    if (speex_bits_nbytes(encoder_bits) > maxSize)
+        return -1;
+    return speex_bits_write(encoder_bits, reinterpret_cast<char*>(output), maxSize);
+}
+
 qint64 QXmppSpeexCodec::encode(QDataStream &input, QDataStream &output)
 {
-    QByteArray pcm_buffer(frame_samples * 2, 0);
-    const int length = input.readRawData(pcm_buffer.data(), pcm_buffer.size());
-    if (length != pcm_buffer.size())
+    QByteArray frame(frame_samples * 2, Qt::Uninitialized);
+    const int length = input.readRawData(frame.data(), frame.size());
+    if (length != frame.size())
     {
         qWarning() << "Read only read" << length << "bytes";
         return 0;
     }
-    speex_bits_reset(encoder_bits);
-    speex_encode_int(encoder_state, (short*)pcm_buffer.data(), encoder_bits);
-    QByteArray speex_buffer(speex_bits_nbytes(encoder_bits), 0);
-    speex_bits_write(encoder_bits, speex_buffer.data(), speex_buffer.size());
-    output.writeRawData(speex_buffer.data(), speex_buffer.size());
+
+    const int size = encodeFrame(reinterpret_cast<const qint16*>(frame.constData()), frame_samples,
+                                 reinterpret_cast<uchar*>(speex_buffer.data()), speex_buffer.size());
+    if (size < 0)
+        return 0;
+    output.writeRawData(speex_buffer.constData(), size);
     return frame_samples;
 }
 
 qint64 QXmppSpeexCodec::decode(QDataStream &input, QDataStream &output)
 {
     const int length = input.device()->bytesAvailable();
-    QByteArray speex_buffer(length, 0);
-    input.readRawData(speex_buffer.data(), speex_buffer.size());
-    speex_bits_read_from(decoder_bits, speex_buffer.data(), speex_buffer.size());
-    QByteArray pcm_buffer(frame_samples * 2, 0);
-    speex_decode_int(decoder_state, decoder_bits, (short*)pcm_buffer.data());
-    output.writeRawData(pcm_buffer.data(), pcm_buffer.size());
-    return frame_samples;
+    if (length > speex_buffer.size())
+        speex_buffer.resize(length);
+    input.readRawData(speex_buffer.data(), length);
+    speex_bits_read_from(decoder_bits, speex_buffer.data(), length);
+
+    // a packet may carry several frames, the smallest of which is 5 bits
+    qint64 samples = 0;
+    while (speex_bits_remaining(decoder_bits) >= 5) {
+        if (speex_decode_int(decoder_state, decoder_bits, reinterpret_cast<spx_int16_t*>(pcm_buffer.data())) < 0)
+            break;
+        output.writeRawData(pcm_buffer.constData(), frame_samples * 2);
+        samples += frame_samples;
+    }
+    return samples;
+}
+
+qint64 QXmppSpeexCodec::conceal(QDataStream &output, qint64 samples)
+{
+    // the decoder extrapolates a frame when it is given no data
+    qint64 written = 0;
+    while (written < samples) {
+        speex_decode_int(decoder_state, 0, reinterpret_cast<spx_int16_t*>(pcm_buffer.data()));
+        output.writeRawData(pcm_buffer.constData(), frame_samples * 2);
+        written += frame_samples;
+    }
+    return written;
 }
 
 #endif
 
 #ifdef QXMPP_USE_OPUS
+// Size of the encoded packet buffer, as recommended by the Opus documentation.
+static const int OPUS_MAX_PACKET = 4000;
+
 QXmppOpusCodec::QXmppOpusCodec(int clockrate, int channels):
     sampleRate(clockrate),
-    nChannels(channels)
+    nChannels(channels),
+    encoderBitrate(OPUS_AUTO),
+    encoderComplexity(10),
+    encoderFec(true),
+    encoderLossPercentage(20),
+    sampleHead(0),
+    sampleTail(0)
 {
     int error;
     encoder = opus_encoder_create(clockrate, channels, OPUS_APPLICATION_VOIP, &error);
 
     if (encoder || error == OPUS_OK) {
-        // Add some options for error correction.
-        opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(1));
-        opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(20));
         opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
 #ifdef OPUS_SET_PREDICTION_DISABLED
         opus_encoder_ctl(encoder, OPUS_SET_PREDICTION_DISABLED(1));
 #endif
+        setEncoderDefaults();
     }
     else
         qCritical() << "Opus encoder initialization error:" << opus_strerror(error);
@@ -435,6 +1446,12 @@ QXmppOpusCodec::QXmppOpusCodec(int clockrate, int channels):
 
     // Maxmimum number of samples for the audio buffer.
     nSamples = validFrameSize.last();
+
+    // Allocate the scratch buffers once, so that encoding and decoding
+    // a frame does not allocate memory.
+    sampleBuffer.resize(2 * nSamples * nChannels * 2);
+    opusBuffer.resize(OPUS_MAX_PACKET);
+    pcmBuffer.resize(nSamples * nChannels * 2);
 }
 
 QXmppOpusCodec::~QXmppOpusCodec()
@@ -450,64 +1467,83 @@ QXmppOpusCodec::~QXmppOpusCodec()
     }
 }
 
+void QXmppOpusCodec::reset()
+{
+    if (encoder) {
+        opus_encoder_ctl(encoder, OPUS_RESET_STATE);
+        setEncoderDefaults();
+    }
+    if (decoder)
+        opus_decoder_ctl(decoder, OPUS_RESET_STATE);
+    sampleHead = 0;
+    sampleTail = 0;
+}
+
 qint64 QXmppOpusCodec::encode(QDataStream &input, QDataStream &output)
 {
-    // Read an audio frame.
-    QByteArray pcm_buffer(input.device()->bytesAvailable(), 0);
-    int length = input.readRawData(pcm_buffer.data(), pcm_buffer.size());
+    // Move the samples which were left over by the previous frame to the
+    // start of the sample buffer.
+    const int pending = sampleTail - sampleHead;
+    if (sampleHead > 0) {
+        if (pending > 0)
+            memmove(sampleBuffer.data(), sampleBuffer.constData() + sampleHead, pending);
+        sampleHead = 0;
+        sampleTail = pending;
+    }
 
-    // and append it to the sample buffer.
-    sampleBuffer.append(pcm_buffer.left(length));
+    // Append the audio frame to the sample buffer.
+    const int available = input.device()->bytesAvailable();
+    if (sampleTail + available > sampleBuffer.size())
+        sampleBuffer.resize(sampleTail + available);
+    const int read = input.readRawData(sampleBuffer.data() + sampleTail, available);
+    if (read > 0)
+        sampleTail += read;
 
     // Get the maximum number of samples to encode. It must be a number
     // accepted by the Opus encoder
-    int samples = readWindow(sampleBuffer.size());
+    int samples = readWindow(sampleTail - sampleHead);
 
     if (samples < 1)
         return 0;
 
-    // The encoded stream is supposed to be smaller than the raw stream, so
-    QByteArray opus_buffer(sampleBuffer.size(), 0);
-
-    length = opus_encode(encoder,
-                         (opus_int16 *) sampleBuffer.constData(),
-                         samples,
-                         (uchar *) opus_buffer.data(),
-                         opus_buffer.size());
-
-    if (length < 1)
-        qWarning() << "Opus encoding error:" << opus_strerror(length);
-    else
-        // Write the encoded stream to the output.
-        output.writeRawData(opus_buffer.constData(), length);
+    const int length = opus_encode(encoder,
+                                   (const opus_int16 *) (sampleBuffer.constData() + sampleHead),
+                                   samples,
+                                   (uchar *) opusBuffer.data(),
+                                   opusBuffer.size());
 
     // Remove the frame from the sample buffer.
-    sampleBuffer.remove(0, samples * nChannels * 2);
+    sampleHead += samples * nChannels * 2;
 
-    if (length < 1)
+    if (length < 1) {
+        qWarning() << "Opus encoding error:" << opus_strerror(length);
         return 0;
+    }
+
+    // With DTX enabled, packets of 2 bytes or less carry no audio and
+    // need not be transmitted.
+    if (length > 2)
+        output.writeRawData(opusBuffer.constData(), length);
 
     return samples;
 }
 
 qint64 QXmppOpusCodec::decode(QDataStream &input, QDataStream &output)
 {
-    QByteArray opus_buffer(input.device()->bytesAvailable(), 0);
-    int length = input.readRawData(opus_buffer.data(), opus_buffer.size());
+    const int available = input.device()->bytesAvailable();
+    if (available > opusBuffer.size())
+        opusBuffer.resize(available);
+    int length = input.readRawData(opusBuffer.data(), available);
 
     if (length < 1)
         return 0;
 
-    // Audio frame is nSamples at maximum, so
-    QByteArray pcm_buffer(nSamples * nChannels * 2, 0);
-
-    // The last argumment must be 1 to enable FEC, but I don't why it results
-    // in a SIGSEV.
+    // Audio frame is nSamples at maximum.
     int samples = opus_decode(decoder,
-                              (uchar *) opus_buffer.constData(),
+                              (const uchar *) opusBuffer.constData(),
                               length,
-                              (opus_int16 *) pcm_buffer.data(),
-                              pcm_buffer.size(),
+                              (opus_int16 *) pcmBuffer.data(),
+                              nSamples,
                               0);
 
     if (samples < 1) {
@@ -517,11 +1553,167 @@ qint64 QXmppOpusCodec::decode(QDataStream &input, QDataStream &output)
     }
 
     // Write the audio frame to the output.
-    output.writeRawData(pcm_buffer.constData(), samples * nChannels * 2);
+    output.writeRawData(pcmBuffer.constData(), samples * nChannels * 2);
 
     return samples;
 }
 
+qint64 QXmppOpusCodec::conceal(QDataStream &output, qint64 samples)
+{
+    // The decoder extrapolates the missing audio when it is given no data,
+    // in multiples of 2.5 ms.
+    const int unit = validFrameSize.first();
+    qint64 written = 0;
+    while (written < samples) {
+        const int frameSize = qMin(qint64(nSamples), ((samples - written + unit - 1) / unit) * unit);
+        const int decoded = opus_decode(decoder,
+                                        0,
+                                        0,
+                                        (opus_int16 *) pcmBuffer.data(),
+                                        frameSize,
+                                        0);
+        if (decoded < 1)
+            break;
+        output.writeRawData(pcmBuffer.constData(), decoded * nChannels * 2);
+        written += decoded;
+    }
+    return written;
+}
+
+qint64 QXmppOpusCodec::recover(QDataStream &input, QDataStream &output, qint64 samples)
+{
+    const int available = input.device()->bytesAvailable();
+    if (available > opusBuffer.size())
+        opusBuffer.resize(available);
+    const int length = input.readRawData(opusBuffer.data(), available);
+    if (length < 1)
+        return conceal(output, samples);
+
+    // The packet's in-band FEC data describes the frame which precedes it,
+    // so only the last frame of the loss can be rebuilt.
+    const int unit = validFrameSize.first();
+    const int fecSamples = opus_packet_get_nb_samples((const uchar *) opusBuffer.constData(), length, sampleRate);
+    if (fecSamples < 1 || fecSamples > nSamples || fecSamples > samples || (samples - fecSamples) % unit)
+        return conceal(output, samples);
+
+    qint64 written = 0;
+    if (samples > fecSamples) {
+        written = conceal(output, samples - fecSamples);
+        if (written != samples - fecSamples)
+            return written;
+    }
+
+    // The frame size must match the duration of the lost frame, otherwise
+    // the decoder writes past the end of the buffer.
+    const int decoded = opus_decode(decoder,
+                                    (const uchar *) opusBuffer.constData(),
+                                    length,
+                                    (opus_int16 *) pcmBuffer.data(),
+                                    fecSamples,
+                                    1);
+    if (decoded < 1) {
+        qWarning() << "Opus FEC decoding error:" << opus_strerror(decoded);
+        return written;
+    }
+    output.writeRawData(pcmBuffer.constData(), decoded * nChannels * 2);
+    return written + decoded;
+}
+
+int QXmppOpusCodec::frameSamples() const
+{
+    // frames last a multiple of 2.5 ms
+    return validFrameSize.first() * nChannels;
+}
+
+int QXmppOpusCodec::encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize)
+{
+    // only the durations supported by Opus are encoded in place
+    const int frameSize = samples / nChannels;
+    if (!encoder || !validFrameSize.contains(frameSize) || sampleTail > sampleHead)
+        return QXmppCodec::encodeFrame(input, samples, output, maxSize);
+
+    const int length = opus_encode(encoder, input, frameSize, output, maxSize);
+    if (length < 1) {
+        qWarning() << "Opus encoding error:" << opus_strerror(length);
+        return -1;
+    }
+
+    // With DTX enabled, packets of 2 bytes or less carry no audio and
+    // need not be transmitted.
+    return length > 2 ? length : 0;
+}
+
+/// Returns the target bitrate of the encoder in bits per second, or
+/// OPUS_AUTO if the encoder chooses it.
+
+int QXmppOpusCodec::bitrate() const
+{
+    return encoderBitrate;
+}
+
+bool QXmppOpusCodec::setBitrate(int bitrate)
+{
+    if (!encoder || opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate)) != OPUS_OK)
+        return false;
+    encoderBitrate = bitrate;
+    return true;
+}
+
+/// Returns the computational complexity of the encoder, from 0 to 10.
+
+int QXmppOpusCodec::complexity() const
+{
+    return encoderComplexity;
+}
+
+bool QXmppOpusCodec::setComplexity(int complexity)
+{
+    if (!encoder || opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(complexity)) != OPUS_OK)
+        return false;
+    encoderComplexity = complexity;
+    return true;
+}
+
+/// Returns true if in-band forward error correction is enabled.
+
+bool QXmppOpusCodec::forwardErrorCorrection() const
+{
+    return encoderFec;
+}
+
+bool QXmppOpusCodec::setForwardErrorCorrection(bool enabled)
+{
+    if (!encoder || opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(enabled ? 1 : 0)) != OPUS_OK)
+        return false;
+    encoderFec = enabled;
+    return true;
+}
+
+/// Returns the expected packet loss percentage.
+
+int QXmppOpusCodec::packetLossPercentage() const
+{
+    return encoderLossPercentage;
+}
+
+bool QXmppOpusCodec::setPacketLossPercentage(int percentage)
+{
+    if (!encoder || opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(percentage)) != OPUS_OK)
+        return false;
+    encoderLossPercentage = percentage;
+    return true;
+}
+
+/// Restores the encoder controls which channels adapt at runtime.
+
+void QXmppOpusCodec::setEncoderDefaults()
+{
+    setBitrate(OPUS_AUTO);
+    setComplexity(10);
+    setForwardErrorCorrection(true);
+    setPacketLossPercentage(20);
+}
+
 int QXmppOpusCodec::readWindow(int bufferSize)
 {
     // WARNING: We are expecting 2 bytes signed samples, but this is wrong since
@@ -545,24 +1737,25 @@ int QXmppOpusCodec::readWindow(int bufferSize)
 class QXmppTheoraDecoderPrivate
 {
 public:
-    bool decodeFrame(const QByteArray &buffer, QXmppVideoFrame *frame);
+    bool decodeFrame(const uchar *data, int size, QXmppVideoFrame *frame);
 
     th_comment comment;
     th_info info;
     th_setup_info *setup_info;
     th_dec_ctx *ctx;
 
-    QByteArray packetBuffer;
+    QXmppVideoFragmentBuffer packetBuffer;
+    QXmppVideoFramePool framePool;
 };
 
-bool QXmppTheoraDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFrame *frame)
+bool QXmppTheoraDecoderPrivate::decodeFrame(const uchar *data, int size, QXmppVideoFrame *frame)
 {
     if (!ctx)
         return false;
 
     ogg_packet packet;
-    packet.packet = (unsigned char*) buffer.data();
-    packet.bytes = buffer.size();
+    packet.packet = const_cast<uchar*>(data);
+    packet.bytes = size;
     packet.b_o_s = 1;
     packet.e_o_s = 0;
     packet.granulepos = -1;
@@ -584,12 +1777,12 @@ bool QXmppTheoraDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideo
                             + ycbcr_buffer[1].stride * ycbcr_buffer[1].height
                             + ycbcr_buffer[2].stride * ycbcr_buffer[2].height;
 
-            *frame = QXmppVideoFrame(bytes,
+            *frame = framePool.frame(bytes,
                 QSize(ycbcr_buffer[0].width, ycbcr_buffer[0].height),
                 ycbcr_buffer[0].stride,
                 QXmppVideoFrame::Format_YUV420P);
         }
-        uchar *output = frame->bits();
+        uchar *output = QXmppVideoFramePool::bits(*frame);
         for (int i = 0; i < 3; ++i) {
             const int length = ycbcr_buffer[i].stride * ycbcr_buffer[i].height;
             memcpy(output, ycbcr_buffer[i].data, length);
@@ -600,35 +1793,26 @@ bool QXmppTheoraDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideo
         if (!frame->isValid()) {
             const int bytes = ycbcr_buffer[0].width * ycbcr_buffer[0].height * 2;
 
-            *frame = QXmppVideoFrame(bytes,
+            *frame = framePool.frame(bytes,
                 QSize(ycbcr_buffer[0].width, ycbcr_buffer[0].height),
                 ycbcr_buffer[0].width * 2,
                 QXmppVideoFrame::Format_YUYV);
         }
 
         // YUV 4:2:2 packing
-        const int width = ycbcr_buffer[0].width;
-        const int height = ycbcr_buffer[0].height;
-        const int y_stride = ycbcr_buffer[0].stride;
-        const int c_stride = ycbcr_buffer[1].stride;
-        const uchar *y_row = ycbcr_buffer[0].data;
-        const uchar *cb_row = ycbcr_buffer[1].data;
-        const uchar *cr_row = ycbcr_buffer[2].data;
-        uchar *output = frame->bits();
-        for (int y = 0; y < height; ++y) {
-            const uchar *y_ptr = y_row;
-            const uchar *cb_ptr = cb_row;
-            const uchar *cr_ptr = cr_row;
-            for (int x = 0; x < width; x += 2) {
-                *(output++) = *(y_ptr++);
-                *(output++) = *(cb_ptr++);
-                *(output++) = *(y_ptr++);
-                *(output++) = *(cr_ptr++);
-            }
-            y_row += y_stride;
-            cb_row += c_stride;
-            cr_row += c_stride;
-        }
+        const uchar *const planes[3] = {
+            ycbcr_buffer[0].data,
+            ycbcr_buffer[1].data,
+            ycbcr_buffer[2].data
+        };
+        const int strides[3] = {
+            ycbcr_buffer[0].stride,
+            ycbcr_buffer[1].stride,
+            ycbcr_buffer[2].stride
+        };
+        QXmppVideoConverter::packYuv422p(planes, strides,
+            ycbcr_buffer[0].width, ycbcr_buffer[0].height,
+            QXmppVideoFrame::Format_YUYV, QXmppVideoFramePool::bits(*frame), frame->bytesPerLine());
         return true;
     } else {
         qWarning("Theora decoder received an unsupported frame format");
@@ -676,9 +1860,13 @@ QList<QXmppVideoFrame> QXmppTheoraDecoder::handlePacket(const QXmppRtpPacket &pa
     QList<QXmppVideoFrame> frames;
 
     // theora deframing: draft-ietf-avt-rtp-theora-00
-    QDataStream stream(packet.payload());
-    quint32 theora_header;
-    stream >> theora_header;
+    const uchar *payload = reinterpret_cast<const uchar*>(packet.payloadData());
+    int remaining = packet.payloadSize();
+    if (remaining < 4)
+        return frames;
+    const quint32 theora_header = qFromBigEndian<quint32>(payload);
+    payload += 4;
+    remaining -= 4;
 
     quint32 theora_ident = (theora_header >> 8) & 0xffffff;
     Q_UNUSED(theora_ident);
@@ -692,49 +1880,49 @@ QList<QXmppVideoFrame> QXmppTheoraDecoder::handlePacket(const QXmppRtpPacket &pa
     if (theora_type != 0)
         return frames;
 
-    QXmppVideoFrame frame;
     quint16 packetLength;
 
     if (theora_frag == NoFragment) {
-        // unfragmented packet(s)
+        // unfragmented packet(s), decoded from the RTP payload
         for (int i = 0; i < theora_packets; ++i) {
-            stream >> packetLength;
-            if (packetLength > stream.device()->bytesAvailable()) {
+            if (remaining < 2)
+                return frames;
+            packetLength = qFromBigEndian<quint16>(payload);
+            payload += 2;
+            remaining -= 2;
+            if (packetLength > remaining) {
                 qWarning("Theora unfragmented packet has an invalid length");
                 return frames;
             }
 
-            d->packetBuffer.resize(packetLength);
-            stream.readRawData(d->packetBuffer.data(), packetLength);
-            if (d->decodeFrame(d->packetBuffer, &frame))
+            QXmppVideoFrame frame;
+            if (d->decodeFrame(payload, packetLength, &frame))
                 frames << frame;
-            d->packetBuffer.resize(0);
+            payload += packetLength;
+            remaining -= packetLength;
         }
     } else {
         // fragments
-        stream >> packetLength;
-        if (packetLength > stream.device()->bytesAvailable()) {
+        if (remaining < 2)
+            return frames;
+        packetLength = qFromBigEndian<quint16>(payload);
+        payload += 2;
+        remaining -= 2;
+        if (packetLength > remaining) {
             qWarning("Theora packet has an invalid length");
             return frames;
         }
 
-        int pos;
-        if (theora_frag == StartFragment) {
-            // start fragment
-            pos = 0;
-            d->packetBuffer.resize(packetLength);
-        } else {
-            // continuation or end fragment
-            pos = d->packetBuffer.size();
-            d->packetBuffer.resize(pos + packetLength);
-        }
-        stream.readRawData(d->packetBuffer.data() + pos, packetLength);
+        if (theora_frag == StartFragment)
+            d->packetBuffer.clear();
+        d->packetBuffer.append(payload, packetLength);
 
         if (theora_frag == EndFragment) {
             // end fragment
-            if (d->decodeFrame(d->packetBuffer, &frame))
+            QXmppVideoFrame frame;
+            if (d->decodeFrame(d->packetBuffer.data(), d->packetBuffer.size(), &frame))
                 frames << frame;
-            d->packetBuffer.resize(0);
+            d->packetBuffer.clear();
         }
     }
     return frames;
@@ -850,10 +2038,15 @@ bool QXmppTheoraDecoder::setParameters(const QMap<QString, QString> &parameters)
     return true;
 }
 
+void QXmppTheoraDecoder::setFrameRing(QXmppMediaRing *ring)
+{
+    d->framePool.setRing(ring);
+}
+
 class QXmppTheoraEncoderPrivate
 {
 public:
-    void writeFragment(QDataStream &stream, FragmentType frag_type, quint8 theora_packets, const char *data, quint16 length);
+    void writeFragment(QXmppVideoPacketBuffer *packets, FragmentType frag_type, quint8 theora_packets, const char *data, quint16 length);
 
     th_comment comment;
     th_info info;
@@ -866,16 +2059,18 @@ public:
     QByteArray ident;
 };
 
-void QXmppTheoraEncoderPrivate::writeFragment(QDataStream &stream, FragmentType frag_type, quint8 theora_packets, const char *data, quint16 length)
+void QXmppTheoraEncoderPrivate::writeFragment(QXmppVideoPacketBuffer *packets, FragmentType frag_type, quint8 theora_packets, const char *data, quint16 length)
 {
     // theora framing: draft-ietf-avt-rtp-theora-00
     const quint8 theora_type = 0; // raw data
-    stream.writeRawData(ident.constData(), ident.size());
-    stream << quint8(((frag_type << 6) & 0xc0) |
-                     ((theora_type << 4) & 0x30) |
-                     (theora_packets & 0x0f));
-    stream << quint16(length);
-    stream.writeRawData(data, length);
+    uchar *payload = packets->addPacket(ident.size() + 3 + length);
+    memcpy(payload, ident.constData(), ident.size());
+    payload += ident.size();
+    payload[0] = quint8(((frag_type << 6) & 0xc0) |
+                        ((theora_type << 4) & 0x30) |
+                        (theora_packets & 0x0f));
+    qToBigEndian<quint16>(length, payload + 1);
+    memcpy(payload + 3, data, length);
 }
 
 QXmppTheoraEncoder::QXmppTheoraEncoder()
@@ -899,11 +2094,23 @@ QXmppTheoraEncoder::~QXmppTheoraEncoder()
     delete d;
 }
 
+bool QXmppTheoraEncoder::setBitrate(int bitrate)
+{
+#ifdef TH_ENCCTL_SET_BITRATE
+    if (!d->ctx)
+        return false;
+    long rate = bitrate;
+    return th_encode_ctl(d->ctx, TH_ENCCTL_SET_BITRATE, &rate, sizeof(rate)) == 0;
+#else
+    Q_UNUSED(bitrate);
+    return false;
+#endif
+}
+
 bool QXmppTheoraEncoder::setFormat(const QXmppVideoFormat &format)
 {
     const QXmppVideoFrame::PixelFormat pixelFormat = format.pixelFormat();
-    if ((pixelFormat != QXmppVideoFrame::Format_YUV420P) &&
-        (pixelFormat != QXmppVideoFrame::Format_YUYV)) {
+    if (!QXmppVideoConverter::isSupported(pixelFormat)) {
         qWarning("Theora encoder does not support the given format");
         return false;
     }
@@ -923,7 +2130,8 @@ bool QXmppTheoraEncoder::setFormat(const QXmppVideoFormat &format)
     d->info.fps_numerator = format.frameRate();
     d->info.fps_denominator = 1;
 
-    if (pixelFormat == QXmppVideoFrame::Format_YUV420P) {
+    if (pixelFormat != QXmppVideoFrame::Format_YUYV &&
+        pixelFormat != QXmppVideoFrame::Format_UYVY) {
         d->info.pixel_fmt = TH_PF_420;
         d->ycbcr_buffer[0].width = d->info.frame_width;
         d->ycbcr_buffer[0].height = d->info.frame_height;
@@ -931,7 +2139,19 @@ bool QXmppTheoraEncoder::setFormat(const QXmppVideoFormat &format)
         d->ycbcr_buffer[1].height = d->ycbcr_buffer[0].height / 2;
         d->ycbcr_buffer[2].width = d->ycbcr_buffer[1].width;
         d->ycbcr_buffer[2].height = d->ycbcr_buffer[1].height;
-    } else if (pixelFormat == QXmppVideoFrame::Format_YUYV) {
+
+        // RGB frames are converted to a buffer
+        d->buffer.clear();
+        if (pixelFormat != QXmppVideoFrame::Format_YUV420P) {
+            d->buffer.resize(d->info.frame_width * d->info.frame_height * 3 / 2);
+            d->ycbcr_buffer[0].stride = d->info.frame_width;
+            d->ycbcr_buffer[0].data = (uchar*) d->buffer.data();
+            d->ycbcr_buffer[1].stride = d->ycbcr_buffer[0].stride / 2;
+            d->ycbcr_buffer[1].data = d->ycbcr_buffer[0].data + d->ycbcr_buffer[0].stride * d->ycbcr_buffer[0].height;
+            d->ycbcr_buffer[2].stride = d->ycbcr_buffer[1].stride;
+            d->ycbcr_buffer[2].data = d->ycbcr_buffer[1].data + d->ycbcr_buffer[1].stride * d->ycbcr_buffer[1].height;
+        }
+    } else {
         d->info.pixel_fmt = TH_PF_422;
         d->buffer.resize(d->info.frame_width * d->info.frame_height * 2);
         d->ycbcr_buffer[0].width = d->info.frame_width;
@@ -1005,15 +2225,30 @@ bool QXmppTheoraEncoder::setFormat(const QXmppVideoFormat &format)
     return true;
 }
 
-QList<QByteArray> QXmppTheoraEncoder::handleFrame(const QXmppVideoFrame &frame)
+void QXmppTheoraEncoder::handleFrame(const QXmppVideoFrame &frame, QXmppVideoPacketBuffer *packets)
 {
-    QList<QByteArray> packets;
     const int PACKET_MAX = 1388;
 
     if (!d->ctx)
-        return packets;
+        return;
 
-    if (d->info.pixel_fmt == TH_PF_420) {
+    if (d->info.pixel_fmt == TH_PF_420 && frame.pixelFormat() != QXmppVideoFrame::Format_YUV420P) {
+        if (d->buffer.isEmpty()) {
+            qWarning("Theora encoder received an unexpected frame format");
+            return;
+        }
+        uchar *const planes[3] = {
+            d->ycbcr_buffer[0].data,
+            d->ycbcr_buffer[1].data,
+            d->ycbcr_buffer[2].data
+        };
+        const int strides[3] = {
+            d->ycbcr_buffer[0].stride,
+            d->ycbcr_buffer[1].stride,
+            d->ycbcr_buffer[2].stride
+        };
+        QXmppVideoConverter::toYuv420p(frame, planes, strides);
+    } else if (d->info.pixel_fmt == TH_PF_420) {
         d->ycbcr_buffer[0].stride = frame.bytesPerLine();
         d->ycbcr_buffer[0].data = (unsigned char*) frame.bits();
         d->ycbcr_buffer[1].stride = d->ycbcr_buffer[0].stride / 2;
@@ -1022,65 +2257,50 @@ QList<QByteArray> QXmppTheoraEncoder::handleFrame(const QXmppVideoFrame &frame)
         d->ycbcr_buffer[2].data = d->ycbcr_buffer[1].data + d->ycbcr_buffer[1].stride * d->ycbcr_buffer[1].height;
     } else if (d->info.pixel_fmt == TH_PF_422) {
         // YUV 4:2:2 unpacking
-        const int width = frame.width();
-        const int height = frame.height();
-        const int stride = frame.bytesPerLine();
-        const uchar *row = frame.bits();
-        uchar *y_out = d->ycbcr_buffer[0].data;
-        uchar *cb_out = d->ycbcr_buffer[1].data;
-        uchar *cr_out = d->ycbcr_buffer[2].data;
-        for (int y = 0; y < height; ++y) {
-            const uchar *ptr = row;
-            for (int x = 0; x < width; x += 2) {
-                *(y_out++) = *(ptr++);
-                *(cb_out++) = *(ptr++);
-                *(y_out++) = *(ptr++);
-                *(cr_out++) = *(ptr++);
-            }
-            row += stride;
-        }
+        uchar *const planes[3] = {
+            d->ycbcr_buffer[0].data,
+            d->ycbcr_buffer[1].data,
+            d->ycbcr_buffer[2].data
+        };
+        const int strides[3] = {
+            d->ycbcr_buffer[0].stride,
+            d->ycbcr_buffer[1].stride,
+            d->ycbcr_buffer[2].stride
+        };
+        QXmppVideoConverter::unpackYuv422p(frame.bits(), frame.bytesPerLine(),
+            frame.width(), frame.height(), frame.pixelFormat(), planes, strides);
     } else {
         qWarning("Theora encoder received an unsupported frame format");
-        return packets;
+        return;
     }
 
     if (th_encode_ycbcr_in(d->ctx, d->ycbcr_buffer) != 0) {
         qWarning("Theora encoder could not handle frame");
-        return packets;
+        return;
     }
 
-    QByteArray payload;
     ogg_packet packet;
     while (th_encode_packetout(d->ctx, 0, &packet) > 0) {
 #ifdef QXMPP_DEBUG_THEORA
         qDebug("Theora encoded packet %d bytes", packet.bytes);
 #endif
-        QDataStream stream(&payload, QIODevice::WriteOnly);
         const char *data = (const char*) packet.packet;
         int size = packet.bytes;
         if (size <= PACKET_MAX) {
             // no fragmentation
-            stream.device()->reset();
-            payload.resize(0);
-            d->writeFragment(stream, NoFragment, 1, data, size);
-            packets << payload;
-       } else {
+            d->writeFragment(packets, NoFragment, 1, data, size);
+        } else {
             // fragmentation
             FragmentType frag_type = StartFragment;
             while (size) {
                 const int length = qMin(PACKET_MAX, size);
-                stream.device()->reset();
-                payload.resize(0);
-                d->writeFragment(stream, frag_type, 0, data, length);
+                d->writeFragment(packets, frag_type, 0, data, length);
                 data += length;
                 size -= length;
                 frag_type = (size > PACKET_MAX) ? MiddleFragment : EndFragment;
-                packets << payload;
             }
         }
     }
-
-    return packets;
 }
 
 QMap<QString, QString> QXmppTheoraEncoder::parameters() const
@@ -1097,22 +2317,33 @@ QMap<QString, QString> QXmppTheoraEncoder::parameters() const
 
 #ifdef QXMPP_USE_VPX
 
+// Returns the number of threads to use for VPX encoding or decoding.
+static int vpxThreadCount(int threads)
+{
+    if (threads > 0)
+        return threads;
+
+    // Leave one core for capture, rendering and the event loop.
+    return qMax(1, QThread::idealThreadCount() - 1);
+}
+
 class QXmppVpxDecoderPrivate
 {
 public:
-    bool decodeFrame(const QByteArray &buffer, QXmppVideoFrame *frame);
+    bool decodeFrame(const uchar *data, int size, QXmppVideoFrame *frame);
 
     vpx_codec_ctx_t codec;
-    QByteArray packetBuffer;
+    QXmppVideoFragmentBuffer packetBuffer;
+    QXmppVideoFramePool framePool;
 };
 
-bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFrame *frame)
+bool QXmppVpxDecoderPrivate::decodeFrame(const uchar *data, int size, QXmppVideoFrame *frame)
 {
     // With the VPX_DL_REALTIME option, tries to decode the frame as quick as
     // possible, if not possible discard it.
     if (vpx_codec_decode(&codec,
-                         (const uint8_t*)buffer.constData(),
-                         buffer.size(),
+                         data,
+                         size,
                          NULL,
                          VPX_DL_REALTIME) != VPX_CODEC_OK) {
         qWarning("Vpx packet could not be decoded: %s", vpx_codec_error_detail(&codec));
@@ -1126,12 +2357,12 @@ bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFra
             if (!frame->isValid()) {
                 const int bytes = img->d_w * img->d_h * 3 / 2;
 
-                *frame = QXmppVideoFrame(bytes,
+                *frame = framePool.frame(bytes,
                     QSize(img->d_w, img->d_h),
                     img->d_w,
                     QXmppVideoFrame::Format_YUV420P);
             }
-            uchar *output = frame->bits();
+            uchar *output = QXmppVideoFramePool::bits(*frame);
 
             for (int i = 0; i < 3; ++i) {
                 uchar *input = img->planes[i];
@@ -1150,18 +2381,22 @@ bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFra
     return true;
 }
 
-QXmppVpxDecoder::QXmppVpxDecoder()
+QXmppVpxDecoder::QXmppVpxDecoder(int threads)
 {
     d = new QXmppVpxDecoderPrivate;
     vpx_codec_flags_t flags = 0;
 
+    vpx_codec_dec_cfg_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.threads = vpxThreadCount(threads);
+
     // Enable FEC if codec support it.
     if (vpx_codec_get_caps(vpx_codec_vp8_dx()) & VPX_CODEC_CAP_ERROR_CONCEALMENT)
         flags |= VPX_CODEC_USE_ERROR_CONCEALMENT;
 
     if (vpx_codec_dec_init(&d->codec,
                            vpx_codec_vp8_dx(),
-                           NULL,
+                           &cfg,
                            flags) != VPX_CODEC_OK) {
         qWarning("Vpx decoder could not be initialised");
     }
@@ -1185,12 +2420,12 @@ QXmppVideoFormat QXmppVpxDecoder::format() const
 QList<QXmppVideoFrame> QXmppVpxDecoder::handlePacket(const QXmppRtpPacket &packet)
 {
     QList<QXmppVideoFrame> frames;
-    const QByteArray payload = packet.payload();
+    const uchar *payload = reinterpret_cast<const uchar*>(packet.payloadData());
+    if (packet.payloadSize() < 2)
+        return frames;
 
     // vp8 deframing: http://tools.ietf.org/html/draft-westin-payload-vp8-00
-    QDataStream stream(payload);
-    quint8 vpx_header;
-    stream >> vpx_header;
+    const quint8 vpx_header = payload[0];
 
     const bool have_id = (vpx_header & 0x10) != 0;
     const quint8 frag_type = (vpx_header & 0x6) >> 1;
@@ -1199,7 +2434,7 @@ QList<QXmppVideoFrame> QXmppVpxDecoder::handlePacket(const QXmppRtpPacket &packe
         return frames;
     }
 
-    const int packetLength = payload.size() - 1;
+    const int packetLength = packet.payloadSize() - 1;
 #ifdef QXMPP_DEBUG_VPX
     qDebug("Vpx fragment FI: %d, size %d", frag_type, packetLength);
 #endif
@@ -1219,34 +2454,33 @@ QList<QXmppVideoFrame> QXmppVpxDecoder::handlePacket(const QXmppRtpPacket &packe
         // unfragmented packet
         if ((payload[1] & 0x1) == 0 // is key frame
             || packet.sequence() == sequence) {
-            if (d->decodeFrame(payload.mid(1), &frame))
+            if (d->decodeFrame(payload + 1, packetLength, &frame))
                 frames << frame;
 
             sequence = packet.sequence() + 1;
         }
 
-        d->packetBuffer.resize(0);
+        d->packetBuffer.clear();
     } else {
         // fragments
         if (frag_type == StartFragment) {
             // start fragment
             if ((payload[1] & 0x1) == 0 // is key frame
                 || packet.sequence() == sequence) {
-                d->packetBuffer = payload.mid(1);
+                d->packetBuffer.clear();
+                d->packetBuffer.append(payload + 1, packetLength);
                 sequence = packet.sequence() + 1;
             }
         } else {
             // continuation or end fragment
             if (packet.sequence() == sequence) {
-                const int packetPos = d->packetBuffer.size();
-                d->packetBuffer.resize(packetPos + packetLength);
-                stream.readRawData(d->packetBuffer.data() + packetPos, packetLength);
+                d->packetBuffer.append(payload + 1, packetLength);
 
                 if (frag_type == EndFragment) {
                     // end fragment
-                    if (d->decodeFrame(d->packetBuffer, &frame)) {
+                    if (d->decodeFrame(d->packetBuffer.data(), d->packetBuffer.size(), &frame)) {
                         frames << frame;
-                        d->packetBuffer.resize(0);
+                        d->packetBuffer.clear();
                     }
                 }
 
@@ -1264,29 +2498,36 @@ bool QXmppVpxDecoder::setParameters(const QMap<QString, QString> &parameters)
     return true;
 }
 
+void QXmppVpxDecoder::setFrameRing(QXmppMediaRing *ring)
+{
+    d->framePool.setRing(ring);
+}
+
 class QXmppVpxEncoderPrivate
 {
 public:
-    void writeFragment(QDataStream &stream, FragmentType frag_type, const char *data, quint16 length);
+    void writeFragment(QXmppVideoPacketBuffer *packets, FragmentType frag_type, const char *data, quint16 length);
 
     vpx_codec_ctx_t codec;
     vpx_codec_enc_cfg_t cfg;
     vpx_image_t *imageBuffer;
     int frameCount;
+    int tokenPartitions;
 };
 
-void QXmppVpxEncoderPrivate::writeFragment(QDataStream &stream, FragmentType frag_type, const char *data, quint16 length)
+void QXmppVpxEncoderPrivate::writeFragment(QXmppVideoPacketBuffer *packets, FragmentType frag_type, const char *data, quint16 length)
 {
     // vp8 framing: http://tools.ietf.org/html/draft-westin-payload-vp8-00
 #ifdef QXMPP_DEBUG_VPX
     qDebug("Vpx encoder writing packet frag: %i, size: %u", frag_type, length);
 #endif
-    stream << quint8(((frag_type << 1) & 0x6) |
-                      (frag_type == NoFragment || frag_type == StartFragment));
-    stream.writeRawData(data, length);
+    uchar *payload = packets->addPacket(1 + length);
+    payload[0] = quint8(((frag_type << 1) & 0x6) |
+                        (frag_type == NoFragment || frag_type == StartFragment));
+    memcpy(payload + 1, data, length);
 }
 
-QXmppVpxEncoder::QXmppVpxEncoder(uint clockrate)
+QXmppVpxEncoder::QXmppVpxEncoder(uint clockrate, int threads)
 {
     d = new QXmppVpxEncoderPrivate;
     d->frameCount = 0;
@@ -1294,10 +2535,13 @@ QXmppVpxEncoder::QXmppVpxEncoder(uint clockrate)
     vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &d->cfg, 0);
 
     // Set the encoding threads number to use
-    int nThreads = QThread::idealThreadCount();
+    d->cfg.g_threads = vpxThreadCount(threads);
 
-    if (nThreads > 0)
-        d->cfg.g_threads = nThreads - 1;
+    // Split the residual data into one token partition per thread (up to
+    // eight), so that the decoder can also process them in parallel.
+    d->tokenPartitions = 0;
+    while (d->tokenPartitions < 3 && (2 << d->tokenPartitions) <= int(d->cfg.g_threads))
+        d->tokenPartitions++;
 
     // Make stream error resiliant
     d->cfg.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT
@@ -1312,6 +2556,9 @@ QXmppVpxEncoder::QXmppVpxEncoder(uint clockrate)
 
     // Here, clockrate is synonym of bitrate.
     d->cfg.rc_target_bitrate = clockrate / 1000;
+
+    // Let the rate control drop frames when the bitrate is lowered.
+    d->cfg.rc_dropframe_thresh = 30;
 }
 
 QXmppVpxEncoder::~QXmppVpxEncoder()
@@ -1322,10 +2569,18 @@ QXmppVpxEncoder::~QXmppVpxEncoder()
     delete d;
 }
 
+bool QXmppVpxEncoder::setBitrate(int bitrate)
+{
+    d->cfg.rc_target_bitrate = qMax(1, bitrate / 1000);
+    if (!d->imageBuffer)
+        return true;
+    return vpx_codec_enc_config_set(&d->codec, &d->cfg) == VPX_CODEC_OK;
+}
+
 bool QXmppVpxEncoder::setFormat(const QXmppVideoFormat &format)
 {
     const QXmppVideoFrame::PixelFormat pixelFormat = format.pixelFormat();
-    if (pixelFormat != QXmppVideoFrame::Format_YUYV) {
+    if (!QXmppVideoConverter::isSupported(pixelFormat)) {
         qWarning("Vpx encoder does not support the given format");
         return false;
     }
@@ -1335,68 +2590,42 @@ bool QXmppVpxEncoder::setFormat(const QXmppVideoFormat &format)
         qWarning("Vpx encoder could not be initialised");
         return false;
     }
+    if (d->tokenPartitions &&
+        vpx_codec_control(&d->codec, VP8E_SET_TOKEN_PARTITIONS, d->tokenPartitions) != VPX_CODEC_OK) {
+        qWarning("Vpx encoder could not set token partitions: %s", vpx_codec_error_detail(&d->codec));
+    }
 
     d->imageBuffer = vpx_img_alloc(NULL, VPX_IMG_FMT_I420,
             format.frameSize().width(), format.frameSize().height(), 1);
     return true;
 }
 
-QList<QByteArray> QXmppVpxEncoder::handleFrame(const QXmppVideoFrame &frame)
+void QXmppVpxEncoder::handleFrame(const QXmppVideoFrame &frame, QXmppVideoPacketBuffer *packets)
 {
     const int PACKET_MAX = 1388;
-    QList<QByteArray> packets;
 
     // try to encode frame
-    if (frame.pixelFormat() == QXmppVideoFrame::Format_YUYV) {
-        // YUYV -> YUV420P
-        const int width = frame.width();
-        const int height = frame.height();
-        const int stride = frame.bytesPerLine();
-        const uchar *row = frame.bits();
-        uchar *y_row = d->imageBuffer->planes[VPX_PLANE_Y];
-        uchar *cb_row = d->imageBuffer->planes[VPX_PLANE_U];
-        uchar *cr_row = d->imageBuffer->planes[VPX_PLANE_V];
-        for (int y = 0; y < height; y += 2) {
-            // odd row
-            const uchar *ptr = row;
-            uchar *y_out = y_row;
-            uchar *cb_out = cb_row;
-            uchar *cr_out = cr_row;
-            for (int x = 0; x < width; x += 2) {
-                *(y_out++) = *(ptr++);
-                *(cb_out++) = *(ptr++);
-                *(y_out++) = *(ptr++);
-                *(cr_out++) = *(ptr++);
-            }
-            row += stride;
-            y_row += d->imageBuffer->stride[VPX_PLANE_Y];
-            cb_row += d->imageBuffer->stride[VPX_PLANE_U];
-            cr_row += d->imageBuffer->stride[VPX_PLANE_V];
-
-            // even row
-            ptr = row;
-            y_out = y_row;
-            for (int x = 0; x < width; x += 2) {
-                *(y_out++) = *(ptr++);
-                ptr++;
-                *(y_out++) = *(ptr++);
-                ptr++;
-            }
-            row += stride;
-            y_row += d->imageBuffer->stride[VPX_PLANE_Y];
-        }
-    } else {
+    uchar *const planes[3] = {
+        d->imageBuffer->planes[VPX_PLANE_Y],
+        d->imageBuffer->planes[VPX_PLANE_U],
+        d->imageBuffer->planes[VPX_PLANE_V]
+    };
+    const int strides[3] = {
+        d->imageBuffer->stride[VPX_PLANE_Y],
+        d->imageBuffer->stride[VPX_PLANE_U],
+        d->imageBuffer->stride[VPX_PLANE_V]
+    };
+    if (!QXmppVideoConverter::toYuv420p(frame, planes, strides)) {
         qWarning("Vpx encoder does not support the given format");
-        return packets;
+        return;
     }
 
     if (vpx_codec_encode(&d->codec, d->imageBuffer, d->frameCount, 1,  0, VPX_DL_REALTIME) != VPX_CODEC_OK) {
         qWarning("Vpx encoder could not handle frame: %s", vpx_codec_error_detail(&d->codec));
-        return packets;
+        return;
     }
 
     // extract data
-    QByteArray payload;
     vpx_codec_iter_t iter = NULL;
     const vpx_codec_cx_pkt_t *pkt;
     while ((pkt = vpx_codec_get_cx_data(&d->codec, &iter))) {
@@ -1404,34 +2633,25 @@ QList<QByteArray> QXmppVpxEncoder::handleFrame(const QXmppVideoFrame &frame)
 #ifdef QXMPP_DEBUG_VPX
             qDebug("Vpx encoded packet %lu bytes", pkt->data.frame.sz);
 #endif
-            QDataStream stream(&payload, QIODevice::WriteOnly);
             const char *data = (const char*) pkt->data.frame.buf;
             int size = pkt->data.frame.sz;
             if (size <= PACKET_MAX) {
                 // no fragmentation
-                stream.device()->reset();
-                payload.resize(0);
-                d->writeFragment(stream, NoFragment, data, size);
-                packets << payload;
-           } else {
+                d->writeFragment(packets, NoFragment, data, size);
+            } else {
                 // fragmentation
                 FragmentType frag_type = StartFragment;
                 while (size) {
                     const int length = qMin(PACKET_MAX, size);
-                    stream.device()->reset();
-                    payload.resize(0);
-                    d->writeFragment(stream, frag_type, data, length);
+                    d->writeFragment(packets, frag_type, data, length);
                     data += length;
                     size -= length;
                     frag_type = (size > PACKET_MAX) ? MiddleFragment : EndFragment;
-                    packets << payload;
                 }
             }
         }
     }
     d->frameCount++;
-
-    return packets;
 }
 
 QMap<QString, QString> QXmppVpxEncoder::parameters() const
@@ -25,12 +25,14 @@
 #define QXMPPCODEC_H
 
 #include <QMap>
+#include <QVector>
 
 #include "QXmppGlobal.h"
+#include "QXmppRtpChannel.h"
+
+class QXmppMediaRing;
 
 class QXmppRtpPacket;
-class QXmppVideoFormat;
-class QXmppVideoFrame;
 
 /// \brief The QXmppCodec class is the base class for audio codecs capable of
 /// encoding and decoding audio samples.
@@ -49,19 +51,36 @@ public:
     /// Reads encoded data from the input stream, decodes it and writes the
     /// decoded samples to the output stream.
     virtual qint64 decode(QDataStream &input, QDataStream &output) = 0;
+
+    virtual qint64 conceal(QDataStream &output, qint64 samples);
+    virtual qint64 recover(QDataStream &input, QDataStream &output, qint64 samples);
+    virtual void reset();
+
+    virtual int frameSamples() const;
+    virtual int encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize);
+
+    // encoder controls
+    virtual bool setBitrate(int bitrate);
+    virtual bool setComplexity(int complexity);
+    virtual bool setForwardErrorCorrection(bool enabled);
+    virtual bool setPacketLossPercentage(int percentage);
 };
 
 /// \internal
 ///
 /// The QXmppG711aCodec class represent a G.711 a-law PCM codec.
 
-class QXmppG711aCodec : public QXmppCodec
+class QXMPP_AUTOTEST_EXPORT QXmppG711aCodec : public QXmppCodec
 {
 public:
     QXmppG711aCodec(int clockrate);
 
     qint64 encode(QDataStream &input, QDataStream &output);
     qint64 decode(QDataStream &input, QDataStream &output);
+    int encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize);
+
+    static void encode(const qint16 *input, quint8 *output, int samples);
+    static void decode(const quint8 *input, qint16 *output, int samples);
 
 private:
     int m_frequency;
@@ -71,13 +90,17 @@ private:
 ///
 /// The QXmppG711uCodec class represent a G.711 u-law PCM codec.
 
-class QXmppG711uCodec : public QXmppCodec
+class QXMPP_AUTOTEST_EXPORT QXmppG711uCodec : public QXmppCodec
 {
 public:
     QXmppG711uCodec(int clockrate);
 
     qint64 encode(QDataStream &input, QDataStream &output);
     qint64 decode(QDataStream &input, QDataStream &output);
+    int encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize);
+
+    static void encode(const qint16 *input, quint8 *output, int samples);
+    static void decode(const quint8 *input, qint16 *output, int samples);
 
 private:
     int m_frequency;
@@ -98,6 +121,14 @@ public:
 
     qint64 encode(QDataStream &input, QDataStream &output);
     qint64 decode(QDataStream &input, QDataStream &output);
+    qint64 conceal(QDataStream &output, qint64 samples);
+    void reset();
+
+    int frameSamples() const;
+    int encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize);
+
+    bool discontinuousTransmission() const;
+    void setDiscontinuousTransmission(bool enabled);
 
 private:
     SpeexBits *encoder_bits;
@@ -105,6 +136,11 @@ private:
     SpeexBits *decoder_bits;
     void *decoder_state;
     int frame_samples;
+    bool dtx;
+
+    // scratch buffers, allocated once
+    QByteArray pcm_buffer;
+    QByteArray speex_buffer;
 };
 #endif
 
@@ -124,20 +160,153 @@ public:
 
     qint64 encode(QDataStream &input, QDataStream &output);
     qint64 decode(QDataStream &input, QDataStream &output);
+    qint64 conceal(QDataStream &output, qint64 samples);
+    qint64 recover(QDataStream &input, QDataStream &output, qint64 samples);
+    void reset();
+
+    int frameSamples() const;
+    int encodeFrame(const qint16 *input, int samples, uchar *output, int maxSize);
+
+    int bitrate() const;
+    bool setBitrate(int bitrate);
+    int complexity() const;
+    bool setComplexity(int complexity);
+    bool forwardErrorCorrection() const;
+    bool setForwardErrorCorrection(bool enabled);
+    int packetLossPercentage() const;
+    bool setPacketLossPercentage(int percentage);
 
 private:
+    void setEncoderDefaults();
+
     OpusEncoder *encoder;
     OpusDecoder *decoder;
     int sampleRate;
     int nChannels;
     QList<float> validFrameSize;
     int nSamples;
+
+    // encoder controls, restored by reset() as the codec may be reused
+    int encoderBitrate;
+    int encoderComplexity;
+    bool encoderFec;
+    int encoderLossPercentage;
+
+    // scratch buffers, allocated once
     QByteArray sampleBuffer;
+    int sampleHead;
+    int sampleTail;
+    QByteArray opusBuffer;
+    QByteArray pcmBuffer;
 
     int readWindow(int bufferSize);
 };
 #endif
 
+/// \internal
+///
+/// The QXmppVideoFramePool class recycles the buffers of decoded video
+/// frames, so that a decoder does not allocate a new buffer for every frame.
+///
+/// A buffer is handed out again once every copy of the frame which used it
+/// has been released.
+///
+/// When a media ring is set, frames are decoded straight into a slot of the
+/// ring, and the caller publishes them.
+
+class QXMPP_AUTOTEST_EXPORT QXmppVideoFramePool
+{
+public:
+    QXmppVideoFramePool(int capacity = 4);
+
+    QXmppVideoFrame frame(int bytes, const QSize &size, int bytesPerLine, QXmppVideoFrame::PixelFormat format);
+    static uchar *bits(const QXmppVideoFrame &frame);
+
+    void setRing(QXmppMediaRing *ring);
+
+private:
+    QList<QXmppVideoFrame> m_frames;
+    int m_capacity;
+    QXmppMediaRing *m_ring;
+};
+
+/// \internal
+///
+/// The QXmppVideoPacketBuffer class holds the RTP packets of an encoded
+/// video frame back to back, in a buffer which is reused for every frame.
+///
+/// Room for the RTP fixed header is reserved before each payload, so that
+/// the header can be written in place once the payload is complete.
+
+class QXMPP_AUTOTEST_EXPORT QXmppVideoPacketBuffer
+{
+public:
+    /// Number of bytes reserved for the RTP header before each payload.
+    static const int headerRoom = 12;
+
+    QXmppVideoPacketBuffer();
+
+    void clear();
+    uchar *addPacket(int payloadSize);
+
+    int count() const;
+    uchar *packet(int index);
+    int packetSize(int index) const;
+    QByteArray payload(int index) const;
+
+private:
+    QByteArray m_data;
+    int m_size;
+    QVector<int> m_offsets;
+    int m_count;
+};
+
+/// \internal
+///
+/// The QXmppVideoFragmentBuffer class reassembles the fragments of an
+/// encoded video frame, in a buffer which is reused for every frame.
+
+class QXMPP_AUTOTEST_EXPORT QXmppVideoFragmentBuffer
+{
+public:
+    QXmppVideoFragmentBuffer();
+
+    void clear();
+    void append(const uchar *data, int size);
+
+    const uchar *data() const;
+    int size() const;
+    bool isEmpty() const;
+
+private:
+    QByteArray m_data;
+    int m_size;
+};
+
+/// \internal
+///
+/// The QXmppVideoConverter class converts video frames between the pixel
+/// formats supported by QXmppVideoFrame, and optionally scales them.
+///
+/// The packed YUV formats are converted with SSE2 or NEON kernels when the
+/// target supports them. RGB frames are converted using the ITU-R BT.601
+/// coefficients, with 8-bit fixed point arithmetic. Scaling is bilinear,
+/// and is performed on YUV 4:2:0 planes.
+///
+/// A YUV 4:2:0 frame holds its Y plane followed by its U and V planes,
+/// whose lines are half of bytesPerLine().
+
+class QXMPP_AUTOTEST_EXPORT QXmppVideoConverter
+{
+public:
+    static bool isSupported(QXmppVideoFrame::PixelFormat format);
+    static QXmppVideoFrame convert(const QXmppVideoFrame &frame, QXmppVideoFrame::PixelFormat format, const QSize &size = QSize());
+
+    static bool toYuv420p(const QXmppVideoFrame &frame, uchar *const planes[3], const int strides[3]);
+    static void packYuv422p(const uchar *const planes[3], const int strides[3], int width, int height, QXmppVideoFrame::PixelFormat format, uchar *output, int stride);
+    static void unpackYuv422p(const uchar *input, int stride, int width, int height, QXmppVideoFrame::PixelFormat format, uchar *const planes[3], const int strides[3]);
+};
+
 /// \brief The QXmppVideoDecoder class is the base class for video decoders.
 ///
 
@@ -154,6 +323,10 @@ public:
 
     /// Sets the video stream's \a parameters.
     virtual bool setParameters(const QMap<QString, QString> &parameters) = 0;
+
+    /// Sets the \a ring into which frames are decoded, if the decoder
+    /// supports it.
+    virtual void setFrameRing(QXmppMediaRing *ring);
 };
 
 /// \brief The QXmppVideoEncoder class is the base class for video encoders.
@@ -167,11 +340,13 @@ public:
     /// Sets the \a format of the video stream.
     virtual bool setFormat(const QXmppVideoFormat &format) = 0;
 
-    /// Handles a video \a frame and returns a list of RTP packet payloads.
-    virtual QList<QByteArray> handleFrame(const QXmppVideoFrame &frame) = 0;
+    /// Handles a video \a frame and appends its RTP packets to \a packets.
+    virtual void handleFrame(const QXmppVideoFrame &frame, QXmppVideoPacketBuffer *packets) = 0;
 
     /// Returns the video stream's parameters.
     virtual QMap<QString, QString> parameters() const = 0;
+
+    virtual bool setBitrate(int bitrate);
 };
 
 #ifdef QXMPP_USE_THEORA
@@ -187,6 +362,7 @@ public:
     QXmppVideoFormat format() const;
     QList<QXmppVideoFrame> handlePacket(const QXmppRtpPacket &packet);
     bool setParameters(const QMap<QString, QString> &parameters);
+    void setFrameRing(QXmppMediaRing *ring);
 
 private:
     QXmppTheoraDecoderPrivate *d;
@@ -198,8 +374,9 @@ public:
     QXmppTheoraEncoder();
     ~QXmppTheoraEncoder();
 
+    bool setBitrate(int bitrate);
     bool setFormat(const QXmppVideoFormat &format);
-    QList<QByteArray> handleFrame(const QXmppVideoFrame &frame);
+    void handleFrame(const QXmppVideoFrame &frame, QXmppVideoPacketBuffer *packets);
     QMap<QString, QString> parameters() const;
 
 private:
@@ -214,12 +391,13 @@ class QXmppVpxEncoderPrivate;
 class QXMPP_AUTOTEST_EXPORT QXmppVpxDecoder : public QXmppVideoDecoder
 {
 public:
-    QXmppVpxDecoder();
+    QXmppVpxDecoder(int threads = 0);
     ~QXmppVpxDecoder();
 
     QXmppVideoFormat format() const;
     QList<QXmppVideoFrame> handlePacket(const QXmppRtpPacket &packet);
     bool setParameters(const QMap<QString, QString> &parameters);
+    void setFrameRing(QXmppMediaRing *ring);
 
 private:
     QXmppVpxDecoderPrivate *d;
@@ -228,11 +406,12 @@ private:
 class QXMPP_AUTOTEST_EXPORT QXmppVpxEncoder : public QXmppVideoEncoder
 {
 public:
-    QXmppVpxEncoder(uint clockrate=0);
+    QXmppVpxEncoder(uint clockrate=0, int threads=0);
     ~QXmppVpxEncoder();
 
+    bool setBitrate(int bitrate);
     bool setFormat(const QXmppVideoFormat &format);
-    QList<QByteArray> handleFrame(const QXmppVideoFrame &frame);
+    void handleFrame(const QXmppVideoFrame &frame, QXmppVideoPacketBuffer *packets);
     QMap<QString, QString> parameters() const;
 
 private:
@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QDomElement>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+#include "QXmppCompactStanza.h"
+#include "QXmppConstants.h"
+#include "QXmppStanza.h"
+#include "QXmppUtils.h"
+
+static const quint8 compactStanzaVersion = 1;
+
+class QXmppCompactStanzaPrivate : public QSharedData
+{
+public:
+    // An element or a text node. The nodes are stored in document order,
+    // each element being followed by the nodes it contains.
+    struct Node
+    {
+        // the element's name or the text, as an index in the string pool
+        qint32 name;
+        // the element's namespace, or -1 for a text node
+        qint32 ns;
+        // the element's attributes, as pairs of indexes in the string pool
+        qint32 firstAttribute;
+        qint32 attributeCount;
+        // the number of nodes in the subtree starting at this node
+        qint32 size;
+    };
+
+    int addString(const QString &str);
+    void addElement(const QDomElement &element);
+    void addText(const QString &text);
+    bool readElement(QXmlStreamReader &reader);
+    bool isValid() const;
+    QDomElement createElement(QDomDocument &doc, int index) const;
+    int writeNode(QXmlStreamWriter *writer, int index, int parentNs) const;
+
+    QStringList strings;
+    QVector<Node> nodes;
+    QVector<qint32> attributes;
+
+    // positions of the pooled strings, only used while building
+    QHash<QString, int> stringIndexes;
+};
+
+int QXmppCompactStanzaPrivate::addString(const QString &str)
+{
+    QHash<QString, int>::const_iterator it = stringIndexes.constFind(str);
+    if (it != stringIndexes.constEnd())
+        return it.value();
+
+    const int index = strings.size();
+    strings << str;
+    stringIndexes.insert(str, index);
+    return index;
+}
+
+void QXmppCompactStanzaPrivate::addElement(const QDomElement &element)
+{
+    const int index = nodes.size();
+    Node node;
+    node.name = addString(element.tagName());
+    node.ns = addString(element.namespaceURI());
+    node.firstAttribute = attributes.size() / 2;
+    node.attributeCount = 0;
+    node.size = 1;
+
+    const QDomNamedNodeMap attrs = element.attributes();
+    for (int i = 0; i < attrs.size(); ++i) {
+        const QDomAttr attr = attrs.item(i).toAttr();
+        attributes << addString(attr.name()) << addString(attr.value());
+        node.attributeCount++;
+    }
+    nodes << node;
+
+    for (QDomNode child = element.firstChild(); !child.isNull(); child = child.nextSibling()) {
+        if (child.isElement())
+            addElement(child.toElement());
+        else if (child.isText())
+            addText(child.toText().data());
+    }
+    nodes[index].size = nodes.size() - index;
+}
+
+void QXmppCompactStanzaPrivate::addText(const QString &text)
+{
+    Node node;
+    node.name = addString(text);
+    node.ns = -1;
+    node.firstAttribute = 0;
+    node.attributeCount = 0;
+    node.size = 1;
+    nodes << node;
+}
+
+/// Reads the element starting at the current position of \a reader.
+
+bool QXmppCompactStanzaPrivate::readElement(QXmlStreamReader &reader)
+{
+    QVector<int> open;
+    while (!reader.atEnd()) {
+        switch (reader.readNext()) {
+        case QXmlStreamReader::StartElement: {
+            Node node;
+            node.name = addString(reader.name().toString());
+            node.ns = addString(reader.namespaceUri().toString());
+            node.firstAttribute = attributes.size() / 2;
+            node.attributeCount = 0;
+            node.size = 1;
+            foreach (const QXmlStreamAttribute &attr, reader.attributes()) {
+                attributes << addString(attr.qualifiedName().toString()) << addString(attr.value().toString());
+                node.attributeCount++;
+            }
+            open << nodes.size();
+            nodes << node;
+            break;
+        }
+        case QXmlStreamReader::EndElement: {
+            const int index = open.last();
+            open.pop_back();
+            nodes[index].size = nodes.size() - index;
+            if (open.isEmpty())
+                return true;
+            break;
+        }
+        case QXmlStreamReader::Characters:
+            if (!open.isEmpty())
+                addText(reader.text().toString());
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+/// Checks that the string indexes and subtree sizes are consistent,
+/// for data received from another process.
+
+bool QXmppCompactStanzaPrivate::isValid() const
+{
+    const int count = nodes.size();
+    if (!count || nodes.at(0).ns < 0 || nodes.at(0).size != count ||
+        attributes.size() % 2)
+        return false;
+
+    foreach (qint32 attribute, attributes) {
+        if (attribute < 0 || attribute >= strings.size())
+            return false;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const Node &node = nodes.at(i);
+        if (node.name < 0 || node.name >= strings.size() ||
+            node.ns < -1 || node.ns >= strings.size() ||
+            node.size < 1 || node.size > count - i ||
+            node.firstAttribute < 0 || node.attributeCount < 0 ||
+            node.attributeCount > attributes.size() / 2 - node.firstAttribute)
+            return false;
+
+        if (node.ns < 0) {
+            if (node.size != 1)
+                return false;
+            continue;
+        }
+
+        // the children must exactly fill the element's subtree
+        int child = i + 1;
+        while (child < i + node.size)
+            child += nodes.at(child).size;
+        if (child != i + node.size)
+            return false;
+    }
+    return true;
+}
+
+QDomElement QXmppCompactStanzaPrivate::createElement(QDomDocument &doc, int index) const
+{
+    const Node &node = nodes.at(index);
+    const QString ns = strings.at(node.ns);
+    QDomElement element = ns.isEmpty() ? doc.createElement(strings.at(node.name))
+                                       : doc.createElementNS(ns, strings.at(node.name));
+    for (int i = node.firstAttribute; i < node.firstAttribute + node.attributeCount; ++i)
+        element.setAttribute(strings.at(attributes.at(2 * i)), strings.at(attributes.at(2 * i + 1)));
+
+    int child = index + 1;
+    while (child < index + node.size) {
+        const Node &childNode = nodes.at(child);
+        if (childNode.ns < 0)
+            element.appendChild(doc.createTextNode(strings.at(childNode.name)));
+        else
+            element.appendChild(createElement(doc, child));
+        child += childNode.size;
+    }
+    return element;
+}
+
+/// Writes the node at \a index and returns the index of the node
+/// following its subtree.
+
+int QXmppCompactStanzaPrivate::writeNode(QXmlStreamWriter *writer, int index, int parentNs) const
+{
+    const Node &node = nodes.at(index);
+    if (node.ns < 0) {
+        writer->writeCharacters(strings.at(node.name));
+        return index + 1;
+    }
+
+    writer->writeStartElement(strings.at(node.name));
+    if (node.ns != parentNs && !strings.at(node.ns).isEmpty())
+        writer->writeAttribute("xmlns", strings.at(node.ns));
+    for (int i = node.firstAttribute; i < node.firstAttribute + node.attributeCount; ++i)
+        writer->writeAttribute(strings.at(attributes.at(2 * i)), strings.at(attributes.at(2 * i + 1)));
+
+    int child = index + 1;
+    while (child < index + node.size)
+        child = writeNode(writer, child, node.ns);
+    writer->writeEndElement();
+    return child;
+}
+
+/// Constructs a null QXmppCompactStanza.
+
+QXmppCompactStanza::QXmppCompactStanza()
+    : d(new QXmppCompactStanzaPrivate)
+{
+}
+
+/// Constructs a QXmppCompactStanza holding a copy of \a element.
+
+QXmppCompactStanza::QXmppCompactStanza(const QDomElement &element)
+    : d(new QXmppCompactStanzaPrivate)
+{
+    if (element.isNull())
+        return;
+
+    d->addElement(element);
+    d->stringIndexes.clear();
+}
+
+/// Constructs a QXmppCompactStanza holding \a stanza.
+///
+/// The stanza is serialized and the result read back without building
+/// a DOM tree.
+
+QXmppCompactStanza::QXmppCompactStanza(const QXmppStanza &stanza)
+    : d(new QXmppCompactStanzaPrivate)
+{
+    QXmlStreamReader reader(helperToXmlData(stanza));
+    if (!d->readElement(reader)) {
+        d->strings.clear();
+        d->nodes.clear();
+        d->attributes.clear();
+    }
+    d->stringIndexes.clear();
+}
+
+/// Constructs a copy of \a other.
+
+QXmppCompactStanza::QXmppCompactStanza(const QXmppCompactStanza &other)
+    : d(other.d)
+{
+}
+
+/// Destroys the QXmppCompactStanza.
+
+QXmppCompactStanza::~QXmppCompactStanza()
+{
+}
+
+/// Assigns \a other to this QXmppCompactStanza.
+
+QXmppCompactStanza& QXmppCompactStanza::operator=(const QXmppCompactStanza &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/// Returns true if the QXmppCompactStanza holds no element.
+
+bool QXmppCompactStanza::isNull() const
+{
+    return d->nodes.isEmpty();
+}
+
+/// Returns the name of the top-level element.
+
+QString QXmppCompactStanza::tagName() const
+{
+    return d->nodes.isEmpty() ? QString() : d->strings.at(d->nodes.at(0).name);
+}
+
+/// Returns the namespace of the top-level element.
+
+QString QXmppCompactStanza::namespaceURI() const
+{
+    return d->nodes.isEmpty() ? QString() : d->strings.at(d->nodes.at(0).ns);
+}
+
+/// Returns the value of the top-level element's attribute called \a name,
+/// or an empty string if it has no such attribute.
+
+QString QXmppCompactStanza::attribute(const QString &name) const
+{
+    if (d->nodes.isEmpty())
+        return QString();
+
+    const QXmppCompactStanzaPrivate::Node &node = d->nodes.at(0);
+    for (int i = node.firstAttribute; i < node.firstAttribute + node.attributeCount; ++i) {
+        if (d->strings.at(d->attributes.at(2 * i)) == name)
+            return d->strings.at(d->attributes.at(2 * i + 1));
+    }
+    return QString();
+}
+
+/// Builds a DOM tree for the stanza, in a new document.
+
+QDomElement QXmppCompactStanza::toElement() const
+{
+    if (d->nodes.isEmpty())
+        return QDomElement();
+
+    QDomDocument doc;
+    QDomElement element = d->createElement(doc, 0);
+    doc.appendChild(element);
+    return element;
+}
+
+/// Writes the stanza as XML.
+///
+/// The jabber:client and jabber:server namespaces of the top-level element
+/// are left out, as they are implied by the stream the stanza is sent on.
+
+void QXmppCompactStanza::toXml(QXmlStreamWriter *writer) const
+{
+    if (d->nodes.isEmpty())
+        return;
+
+    const QString ns = d->strings.at(d->nodes.at(0).ns);
+    const bool omitNamespace = (ns == ns_client || ns == ns_server);
+    d->writeNode(writer, 0, omitNamespace ? d->nodes.at(0).ns : -1);
+}
+
+/// Returns the stanza in a binary form, which can be read back using
+/// fromByteArray().
+
+QByteArray QXmppCompactStanza::toByteArray() const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream << compactStanzaVersion << d->strings << qint32(d->nodes.size());
+    foreach (const QXmppCompactStanzaPrivate::Node &node, d->nodes)
+        stream << node.name << node.ns << node.firstAttribute << node.attributeCount << node.size;
+    stream << d->attributes;
+    return data;
+}
+
+/// Reads a stanza from the binary form returned by toByteArray().
+///
+/// Returns a null QXmppCompactStanza if the data is invalid.
+
+QXmppCompactStanza QXmppCompactStanza::fromByteArray(const QByteArray &data)
+{
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_4_5);
+
+    quint8 version = 0;
+    qint32 count = 0;
+    QXmppCompactStanza stanza;
+    stream >> version;
+    if (version != compactStanzaVersion)
+        return QXmppCompactStanza();
+
+    stream >> stanza.d->strings >> count;
+    if (stream.status() != QDataStream::Ok || count < 0 || count > data.size())
+        return QXmppCompactStanza();
+
+    stanza.d->nodes.resize(count);
+    for (int i = 0; i < count; ++i) {
+        QXmppCompactStanzaPrivate::Node &node = stanza.d->nodes[i];
+        stream >> node.name >> node.ns >> node.firstAttribute >> node.attributeCount >> node.size;
+    }
+    stream >> stanza.d->attributes;
+
+    if (stream.status() != QDataStream::Ok || !stanza.d->isValid())
+        return QXmppCompactStanza();
+    return stanza;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPCOMPACTSTANZA_H
+#define QXMPPCOMPACTSTANZA_H
+
+#include <QByteArray>
+#include <QMetaType>
+#include <QSharedDataPointer>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+class QDomElement;
+class QXmlStreamWriter;
+class QXmppCompactStanzaPrivate;
+class QXmppStanza;
+
+/// \brief The QXmppCompactStanza class holds a stanza in a compact form
+/// suited to passing it between components of the same process.
+///
+/// The stanza's elements and text are stored in a flat table referring
+/// to a pool of strings, in which each name, namespace and value appears
+/// once. Unlike a QDomElement, a QXmppCompactStanza can be passed safely
+/// to another thread, and unlike XML text it does not need to be parsed
+/// again on arrival. toByteArray() and fromByteArray() convert it to a
+/// binary form for links between processes.
+///
+/// \ingroup Stanzas
+
+class QXMPP_EXPORT QXmppCompactStanza
+{
+public:
+    QXmppCompactStanza();
+    explicit QXmppCompactStanza(const QDomElement &element);
+    explicit QXmppCompactStanza(const QXmppStanza &stanza);
+    QXmppCompactStanza(const QXmppCompactStanza &other);
+    ~QXmppCompactStanza();
+
+    QXmppCompactStanza& operator=(const QXmppCompactStanza &other);
+
+    bool isNull() const;
+
+    QString tagName() const;
+    QString namespaceURI() const;
+    QString attribute(const QString &name) const;
+
+    QDomElement toElement() const;
+    void toXml(QXmlStreamWriter *writer) const;
+
+    QByteArray toByteArray() const;
+    static QXmppCompactStanza fromByteArray(const QByteArray &data);
+
+private:
+    QSharedDataPointer<QXmppCompactStanzaPrivate> d;
+};
+
+Q_DECLARE_METATYPE(QXmppCompactStanza)
+
+#endif
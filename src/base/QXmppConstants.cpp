@@ -24,117 +24,139 @@
 
 #include "QXmppConstants.h"
 
-const char* ns_stream = "http://etherx.jabber.org/streams";
-const char* ns_client = "jabber:client";
-const char* ns_server = "jabber:server";
-const char* ns_roster = "jabber:iq:roster";
-const char* ns_tls = "urn:ietf:params:xml:ns:xmpp-tls";
-const char* ns_sasl = "urn:ietf:params:xml:ns:xmpp-sasl";
-const char* ns_bind = "urn:ietf:params:xml:ns:xmpp-bind";
-const char* ns_session = "urn:ietf:params:xml:ns:xmpp-session";
-const char* ns_stanza = "urn:ietf:params:xml:ns:xmpp-stanzas";
+const QLatin1String ns_stream("http://etherx.jabber.org/streams");
+const QLatin1String ns_client("jabber:client");
+const QLatin1String ns_server("jabber:server");
+const QLatin1String ns_roster("jabber:iq:roster");
+const QLatin1String ns_tls("urn:ietf:params:xml:ns:xmpp-tls");
+const QLatin1String ns_sasl("urn:ietf:params:xml:ns:xmpp-sasl");
+const QLatin1String ns_bind("urn:ietf:params:xml:ns:xmpp-bind");
+const QLatin1String ns_session("urn:ietf:params:xml:ns:xmpp-session");
+const QLatin1String ns_stanza("urn:ietf:params:xml:ns:xmpp-stanzas");
+// RFC 7395: XMPP Subprotocol for WebSocket
+const QLatin1String ns_framing("urn:ietf:params:xml:ns:xmpp-framing");
 // XEP-0009: Jabber-RPC
-const char* ns_rpc = "jabber:iq:rpc";
+const QLatin1String ns_rpc("jabber:iq:rpc");
 // XEP-0012: Last Activity
-const char* ns_last_activity = "jabber:iq:last";
+const QLatin1String ns_last_activity("jabber:iq:last");
 // XEP-0020: Feature Negotiation
-const char* ns_feature_negotiation = "http://jabber.org/protocol/feature-neg";
+const QLatin1String ns_feature_negotiation("http://jabber.org/protocol/feature-neg");
 // XEP-0030: Service Discovery
-const char* ns_disco_info = "http://jabber.org/protocol/disco#info";
-const char* ns_disco_items = "http://jabber.org/protocol/disco#items";
+const QLatin1String ns_disco_info("http://jabber.org/protocol/disco#info");
+const QLatin1String ns_disco_items("http://jabber.org/protocol/disco#items");
 // XEP-0033: Extended Stanza Addressing
-const char* ns_extended_addressing = "http://jabber.org/protocol/address";
+const QLatin1String ns_extended_addressing("http://jabber.org/protocol/address");
 // XEP-0045: Multi-User Chat
-const char* ns_muc = "http://jabber.org/protocol/muc";
-const char* ns_muc_admin = "http://jabber.org/protocol/muc#admin";
-const char* ns_muc_owner = "http://jabber.org/protocol/muc#owner";
-const char* ns_muc_user = "http://jabber.org/protocol/muc#user";
+const QLatin1String ns_muc("http://jabber.org/protocol/muc");
+const QLatin1String ns_muc_admin("http://jabber.org/protocol/muc#admin");
+const QLatin1String ns_muc_owner("http://jabber.org/protocol/muc#owner");
+const QLatin1String ns_muc_user("http://jabber.org/protocol/muc#user");
 // XEP-0047: In-Band Bytestreams
-const char* ns_ibb = "http://jabber.org/protocol/ibb";
+const QLatin1String ns_ibb("http://jabber.org/protocol/ibb");
 // XEP-0049: Private XML Storage
-const char* ns_private = "jabber:iq:private";
+const QLatin1String ns_private("jabber:iq:private");
 // XEP-0054: vcard-temp
-const char* ns_vcard = "vcard-temp";
+const QLatin1String ns_vcard("vcard-temp");
 // XEP-0059: Result Set Management
-const char* ns_rsm = "http://jabber.org/protocol/rsm";
+const QLatin1String ns_rsm("http://jabber.org/protocol/rsm");
 // XEP-0065: SOCKS5 Bytestreams
-const char* ns_bytestreams = "http://jabber.org/protocol/bytestreams";
+const QLatin1String ns_bytestreams("http://jabber.org/protocol/bytestreams");
 // XEP-0071: XHTML-IM
-const char *ns_xhtml_im = "http://jabber.org/protocol/xhtml-im";
+const QLatin1String ns_xhtml_im("http://jabber.org/protocol/xhtml-im");
 // XEP-0077: In-Band Registration
-const char* ns_register = "jabber:iq:register";
+const QLatin1String ns_register("jabber:iq:register");
 // XEP-0078: Non-SASL Authentication
-const char* ns_auth = "jabber:iq:auth";
-const char* ns_authFeature = "http://jabber.org/features/iq-auth";
+const QLatin1String ns_auth("jabber:iq:auth");
+const QLatin1String ns_authFeature("http://jabber.org/features/iq-auth");
 // XEP-0085: Chat State Notifications
-const char* ns_chat_states = "http://jabber.org/protocol/chatstates";
+const QLatin1String ns_chat_states("http://jabber.org/protocol/chatstates");
 // XEP-0091: Legacy Delayed Delivery
-const char* ns_legacy_delayed_delivery = "jabber:x:delay";
+const QLatin1String ns_legacy_delayed_delivery("jabber:x:delay");
 // XEP-0092: Software Version
-const char* ns_version = "jabber:iq:version";
-const char* ns_data = "jabber:x:data";
+const QLatin1String ns_version("jabber:iq:version");
+const QLatin1String ns_data("jabber:x:data");
 // XEP-0095: Stream Initiation
-const char* ns_stream_initiation = "http://jabber.org/protocol/si";
-const char* ns_stream_initiation_file_transfer = "http://jabber.org/protocol/si/profile/file-transfer";
+const QLatin1String ns_stream_initiation("http://jabber.org/protocol/si");
+const QLatin1String ns_stream_initiation_file_transfer("http://jabber.org/protocol/si/profile/file-transfer");
 // XEP-0108: User Activity
-const char* ns_activity = "http://jabber.org/protocol/activity";
+const QLatin1String ns_activity("http://jabber.org/protocol/activity");
 // XEP-0115: Entity Capabilities
-const char* ns_capabilities = "http://jabber.org/protocol/caps";
+const QLatin1String ns_capabilities("http://jabber.org/protocol/caps");
+// XEP-0124: Bidirectional-streams Over Synchronous HTTP
+const QLatin1String ns_httpbind("http://jabber.org/protocol/httpbind");
 // XEP-0136: Message Archiving
-const char* ns_archive = "urn:xmpp:archive";
+const QLatin1String ns_archive("urn:xmpp:archive");
 // XEP-0138: Stream Compression
-const char* ns_compress = "http://jabber.org/protocol/compress";
-const char* ns_compressFeature = "http://jabber.org/features/compress";
+const QLatin1String ns_compress("http://jabber.org/protocol/compress");
+const QLatin1String ns_compressFeature("http://jabber.org/features/compress");
 // XEP-0145: Annotations
-const char* ns_rosternotes = "storage:rosternotes";
+const QLatin1String ns_rosternotes("storage:rosternotes");
 // XEP-0152: Reachability Addresses
-const char* ns_reach = "urn:xmpp:reach:0";
-const char* ns_reach_notify = "urn:xmpp:reach:0+notify";
+const QLatin1String ns_reach("urn:xmpp:reach:0");
+const QLatin1String ns_reach_notify("urn:xmpp:reach:0+notify");
 // XEP-0153: vCard-Based Avatars
-const char* ns_vcard_update = "vcard-temp:x:update";
+const QLatin1String ns_vcard_update("vcard-temp:x:update");
 // XEP-0158: CAPTCHA Forms
-const char* ns_captcha = "urn:xmpp:captcha";
+const QLatin1String ns_captcha("urn:xmpp:captcha");
 // XEP-0163: Personal Eventing Protocol
-const char* ns_personal_eventing_protocol = "http://jabber.org/protocol/pubsub#event";
+const QLatin1String ns_personal_eventing_protocol("http://jabber.org/protocol/pubsub#event");
 // XEP-0166: Jingle
-const char* ns_jingle = "urn:xmpp:jingle:1";
-const char* ns_jingle_raw_udp = "urn:xmpp:jingle:transports:raw-udp:1";
-const char* ns_jingle_ice_udp = "urn:xmpp:jingle:transports:ice-udp:1";
-const char* ns_jingle_rtp = "urn:xmpp:jingle:apps:rtp:1";
-const char* ns_jingle_rtp_audio = "urn:xmpp:jingle:apps:rtp:audio";
-const char* ns_jingle_rtp_video = "urn:xmpp:jingle:apps:rtp:video";
+const QLatin1String ns_jingle("urn:xmpp:jingle:1");
+const QLatin1String ns_jingle_raw_udp("urn:xmpp:jingle:transports:raw-udp:1");
+const QLatin1String ns_jingle_ice_udp("urn:xmpp:jingle:transports:ice-udp:1");
+const QLatin1String ns_jingle_rtp("urn:xmpp:jingle:apps:rtp:1");
+const QLatin1String ns_jingle_rtp_audio("urn:xmpp:jingle:apps:rtp:audio");
+const QLatin1String ns_jingle_rtp_video("urn:xmpp:jingle:apps:rtp:video");
 // XEP-0184: Message Receipts
-const char* ns_message_receipts = "urn:xmpp:receipts";
+const QLatin1String ns_message_receipts("urn:xmpp:receipts");
 // XEP-0196: User Gaming
-const char* ns_user_gaming = "urn:xmpp:gaming:0";
-const char* ns_user_gaming_notify = "urn:xmpp:gaming:0+notify";
+const QLatin1String ns_user_gaming("urn:xmpp:gaming:0");
+const QLatin1String ns_user_gaming_notify("urn:xmpp:gaming:0+notify");
 // XEP-0198: Stream Management
-const char* ns_stream_management = "urn:xmpp:sm:3";
+const QLatin1String ns_stream_management("urn:xmpp:sm:3");
 // XEP-0199: XMPP Ping
-const char* ns_ping = "urn:xmpp:ping";
+const QLatin1String ns_ping("urn:xmpp:ping");
 // XEP-0202: Entity Time
-const char* ns_entity_time = "urn:xmpp:time";
+const QLatin1String ns_entity_time("urn:xmpp:time");
 // XEP-0203: Delayed Delivery
-const char* ns_delayed_delivery = "urn:xmpp:delay";
+const QLatin1String ns_delayed_delivery("urn:xmpp:delay");
+// XEP-0206: XMPP Over BOSH
+const QLatin1String ns_xbosh("urn:xmpp:xbosh");
+// XEP-0215: External Service Discovery
+const QLatin1String ns_extdisco("urn:xmpp:extdisco:1");
 // XEP-0220: Server Dialback
-const char* ns_server_dialback = "jabber:server:dialback";
+const QLatin1String ns_server_dialback("jabber:server:dialback");
 // XEP-0221: Data Forms Media Element
-const char* ns_media_element = "urn:xmpp:media-element";
+const QLatin1String ns_media_element("urn:xmpp:media-element");
 // XEP-0224: Attention
-const char* ns_attention = "urn:xmpp:attention:0";
+const QLatin1String ns_attention("urn:xmpp:attention:0");
 // XEP-0231: Bits of Binary
-const char* ns_bob = "urn:xmpp:bob";
+const QLatin1String ns_bob("urn:xmpp:bob");
+// XEP-0234: Jingle File Transfer
+const QLatin1String ns_jingle_file_transfer("urn:xmpp:jingle:apps:file-transfer:4");
+// XEP-0237: Roster Versioning
+const QLatin1String ns_rosterver("urn:xmpp:features:rosterver");
 // XEP-0249: Direct MUC Invitations
-const char* ns_conference = "jabber:x:conference";
+const QLatin1String ns_conference("jabber:x:conference");
 // XEP-0297: Message Forwarding
-const char* ns_stanza_forwarding = "urn:xmpp:forward:0";
+const QLatin1String ns_stanza_forwarding("urn:xmpp:forward:0");
+// XEP-0300: Use of Cryptographic Hash Functions in XMPP
+const QLatin1String ns_hashes("urn:xmpp:hashes:2");
 // XEP-0313: Message Archieve Management
-const char* ns_simple_archive = "urn:xmpp:mam:tmp";
+const QLatin1String ns_simple_archive("urn:xmpp:mam:tmp");
 // XEP-0333: Chat Markers
-const char* ns_chat_markers = "urn:xmpp:chat-markers:0";
+const QLatin1String ns_chat_markers("urn:xmpp:chat-markers:0");
 // XEP-0308: Last Message Correction
-const char* ns_replace_message = "urn:xmpp:message-correct:0";
+const QLatin1String ns_replace_message("urn:xmpp:message-correct:0");
 // XEP-0280: Message Carbons
-const char* ns_message_carbons = "urn:xmpp:carbons:2";
+const QLatin1String ns_message_carbons("urn:xmpp:carbons:2");
 // XEP-0334: Message Processing Hints
-const char* ns_message_processing_hints = "urn:xmpp:hints";
+const QLatin1String ns_message_processing_hints("urn:xmpp:hints");
+// XEP-0352: Client State Indication
+const QLatin1String ns_csi("urn:xmpp:csi:0");
+// XEP-0402: PEP Native Bookmarks
+const QLatin1String ns_bookmarks2("urn:xmpp:bookmarks:1");
+// Reconnection delay suggested in a stream error
+const QLatin1String ns_reconnect("urn:qxmpp:reconnect:0");
+// Login token issued for fast reconnection
+const QLatin1String ns_login_token("urn:qxmpp:token:0");
@@ -25,119 +25,146 @@
 #ifndef QXMPPCONSTANTS_H
 #define QXMPPCONSTANTS_H
 
-extern const char* ns_stream;
-extern const char* ns_client;
-extern const char* ns_server;
-extern const char* ns_roster;
-extern const char* ns_tls;
-extern const char* ns_sasl;
-extern const char* ns_bind;
-extern const char* ns_session;
-extern const char* ns_stanza;
+#include <QString>
+
+// The namespaces are QLatin1String constants so that comparing them to a
+// QString does not convert them first.
+
+extern const QLatin1String ns_stream;
+extern const QLatin1String ns_client;
+extern const QLatin1String ns_server;
+extern const QLatin1String ns_roster;
+extern const QLatin1String ns_tls;
+extern const QLatin1String ns_sasl;
+extern const QLatin1String ns_bind;
+extern const QLatin1String ns_session;
+extern const QLatin1String ns_stanza;
+// RFC 7395: XMPP Subprotocol for WebSocket
+extern const QLatin1String ns_framing;
 // XEP-0009: Jabber-RPC
-extern const char* ns_rpc;
+extern const QLatin1String ns_rpc;
 // XEP-0012: Last Activity
-extern const char* ns_last_activity;
+extern const QLatin1String ns_last_activity;
 // XEP-0020: Feature Negotiation
-extern const char* ns_feature_negotiation;
+extern const QLatin1String ns_feature_negotiation;
 // XEP-0030: Service Discovery
-extern const char* ns_disco_info;
-extern const char* ns_disco_items;
+extern const QLatin1String ns_disco_info;
+extern const QLatin1String ns_disco_items;
 // XEP-0033: Extended Stanza Addressing
-extern const char* ns_extended_addressing;
+extern const QLatin1String ns_extended_addressing;
 // XEP-0045: Multi-User Chat
-extern const char* ns_muc;
-extern const char* ns_muc_admin;
-extern const char* ns_muc_owner;
-extern const char* ns_muc_user;
+extern const QLatin1String ns_muc;
+extern const QLatin1String ns_muc_admin;
+extern const QLatin1String ns_muc_owner;
+extern const QLatin1String ns_muc_user;
 // XEP-0047: In-Band Bytestreams
-extern const char* ns_ibb;
+extern const QLatin1String ns_ibb;
 // XEP-0049: Private XML Storage
-extern const char* ns_private;
+extern const QLatin1String ns_private;
 // XEP-0054: vcard-temp
-extern const char* ns_vcard;
+extern const QLatin1String ns_vcard;
 // XEP-0059: Result Set Management
-extern const char* ns_rsm;
+extern const QLatin1String ns_rsm;
 // XEP-0065: SOCKS5 Bytestreams
-extern const char* ns_bytestreams;
+extern const QLatin1String ns_bytestreams;
 // XEP-0071: XHTML-IM
-extern const char *ns_xhtml_im;
+extern const QLatin1String ns_xhtml_im;
 // XEP-0077: In-Band Registration
-extern const char* ns_register;
+extern const QLatin1String ns_register;
 // XEP-0078: Non-SASL Authentication
-extern const char* ns_auth;
-extern const char* ns_authFeature;
+extern const QLatin1String ns_auth;
+extern const QLatin1String ns_authFeature;
 // XEP-0085: Chat State Notifications
-extern const char* ns_chat_states;
+extern const QLatin1String ns_chat_states;
 // XEP-0091: Legacy Delayed Delivery
-extern const char* ns_legacy_delayed_delivery;
+extern const QLatin1String ns_legacy_delayed_delivery;
 // XEP-0092: Software Version
-extern const char* ns_version;
-extern const char* ns_data;
+extern const QLatin1String ns_version;
+extern const QLatin1String ns_data;
 // XEP-0095: Stream Initiation
-extern const char* ns_stream_initiation;
-extern const char* ns_stream_initiation_file_transfer;
+extern const QLatin1String ns_stream_initiation;
+extern const QLatin1String ns_stream_initiation_file_transfer;
 // XEP-0108: User Activity
-extern const char* ns_activity;
+extern const QLatin1String ns_activity;
 // XEP-0115: Entity Capabilities
-extern const char* ns_capabilities;
+extern const QLatin1String ns_capabilities;
+// XEP-0124: Bidirectional-streams Over Synchronous HTTP
+extern const QLatin1String ns_httpbind;
 // XEP-0136: Message Archiving
-extern const char* ns_archive;
+extern const QLatin1String ns_archive;
 // XEP-0138: Stream Compression
-extern const char* ns_compress;
-extern const char* ns_compressFeature;
+extern const QLatin1String ns_compress;
+extern const QLatin1String ns_compressFeature;
 // XEP-0145: Annotations
-extern const char* ns_rosternotes;
+extern const QLatin1String ns_rosternotes;
 // XEP-0152: Reachability Addresses
-extern const char* ns_reach;
-extern const char* ns_reach_notify;
+extern const QLatin1String ns_reach;
+extern const QLatin1String ns_reach_notify;
 // XEP-0153: vCard-Based Avatars
-extern const char* ns_vcard_update;
+extern const QLatin1String ns_vcard_update;
 // XEP-0158: CAPTCHA Forms
-extern const char* ns_captcha;
+extern const QLatin1String ns_captcha;
 // XEP-0163: Personal Eventing Protocol
-extern const char* ns_personal_eventing_protocol;
+extern const QLatin1String ns_personal_eventing_protocol;
 // XEP-0166: Jingle
-extern const char* ns_jingle;
-extern const char* ns_jingle_ice_udp;
-extern const char* ns_jingle_raw_udp;
-extern const char* ns_jingle_rtp;
-extern const char* ns_jingle_rtp_audio;
-extern const char* ns_jingle_rtp_video;
+extern const QLatin1String ns_jingle;
+extern const QLatin1String ns_jingle_ice_udp;
+extern const QLatin1String ns_jingle_raw_udp;
+extern const QLatin1String ns_jingle_rtp;
+extern const QLatin1String ns_jingle_rtp_audio;
+extern const QLatin1String ns_jingle_rtp_video;
 // XEP-0184: Message Receipts
-extern const char* ns_message_receipts;
+extern const QLatin1String ns_message_receipts;
 // XEP-0196: User Gaming
-extern const char* ns_user_gaming;
-extern const char* ns_user_gaming_notify;
+extern const QLatin1String ns_user_gaming;
+extern const QLatin1String ns_user_gaming_notify;
 // XEP-0198: Stream Management
-extern const char* ns_stream_management;
+extern const QLatin1String ns_stream_management;
 // XEP-0199: XMPP Ping
-extern const char* ns_ping;
+extern const QLatin1String ns_ping;
 // XEP-0202: Entity Time
-extern const char* ns_entity_time;
+extern const QLatin1String ns_entity_time;
 // XEP-0203: Delayed Delivery
-extern const char* ns_delayed_delivery;
+extern const QLatin1String ns_delayed_delivery;
+// XEP-0206: XMPP Over BOSH
+extern const QLatin1String ns_xbosh;
+// XEP-0215: External Service Discovery
+extern const QLatin1String ns_extdisco;
 // XEP-0220: Server Dialback
-extern const char* ns_server_dialback;
+extern const QLatin1String ns_server_dialback;
 // XEP-0221: Data Forms Media Element
-extern const char* ns_media_element;
+extern const QLatin1String ns_media_element;
 // XEP-0224: Attention
-extern const char* ns_attention;
+extern const QLatin1String ns_attention;
 // XEP-0231: Bits of Binary
-extern const char* ns_bob;
+extern const QLatin1String ns_bob;
+// XEP-0234: Jingle File Transfer
+extern const QLatin1String ns_jingle_file_transfer;
+// XEP-0237: Roster Versioning
+extern const QLatin1String ns_rosterver;
 // XEP-0249: Direct MUC Invitations
-extern const char* ns_conference;
+extern const QLatin1String ns_conference;
 // XEP-0296: Message Forwarding
-extern const char* ns_stanza_forwarding;
+extern const QLatin1String ns_stanza_forwarding;
+// XEP-0300: Use of Cryptographic Hash Functions in XMPP
+extern const QLatin1String ns_hashes;
 // XEP-0313: Message Archieve Management
-extern const char* ns_simple_archive;
+extern const QLatin1String ns_simple_archive;
 // XEP-0333: Char Markers
-extern const char* ns_chat_markers;
+extern const QLatin1String ns_chat_markers;
 // XEP-0308: Last Message Correction
-extern const char* ns_replace_message;
+extern const QLatin1String ns_replace_message;
 // XEP-0280: Message Carbons
-extern const char* ns_message_carbons;
+extern const QLatin1String ns_message_carbons;
 // XEP-0334: Message Processing Hints:
-extern const char * ns_message_processing_hints;
+extern const QLatin1String ns_message_processing_hints;
+// XEP-0352: Client State Indication
+extern const QLatin1String ns_csi;
+// XEP-0402: PEP Native Bookmarks
+extern const QLatin1String ns_bookmarks2;
+// Reconnection delay suggested in a stream error
+extern const QLatin1String ns_reconnect;
+// Login token issued for fast reconnection
+extern const QLatin1String ns_login_token;
 
 #endif // QXMPPCONSTANTS_H
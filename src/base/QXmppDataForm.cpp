@@ -23,6 +23,7 @@
 
 #include <QDebug>
 #include <QDomElement>
+#include <QHash>
 #include <QSize>
 #include <QStringList>
 
@@ -138,22 +139,70 @@ class QXmppDataFormFieldPrivate : public QSharedData
 public:
     QXmppDataFormFieldPrivate();
 
+    void parseMedia() const;
+    void parseOptions() const;
+
     QString description;
     QString key;
     QString label;
-    QXmppDataForm::Media media;
-    QList<QPair<QString, QString> > options;
+    mutable QXmppDataForm::Media media;
+    mutable QList<QPair<QString, QString> > options;
     bool required;
     QXmppDataForm::Field::Type type;
     QVariant value;
+
+    // the element the field was parsed from, its media and options are
+    // only decoded from it when they are accessed
+    QDomElement source;
+    mutable bool mediaParsed;
+    mutable bool optionsParsed;
 };
 
 QXmppDataFormFieldPrivate::QXmppDataFormFieldPrivate()
     : required(false)
     , type(QXmppDataForm::Field::TextSingleField)
+    , mediaParsed(true)
+    , optionsParsed(true)
 {
 }
 
+void QXmppDataFormFieldPrivate::parseMedia() const
+{
+    if (mediaParsed)
+        return;
+    mediaParsed = true;
+
+    QDomElement mediaElement = source.firstChildElement("media");
+    if (!mediaElement.isNull()) {
+        media.setHeight(mediaElement.attribute("height", "-1").toInt());
+        media.setWidth(mediaElement.attribute("width", "-1").toInt());
+
+        QList<QPair<QString, QString> > uris;
+        QDomElement uriElement = mediaElement.firstChildElement("uri");
+        while (!uriElement.isNull()) {
+            uris.append(QPair<QString, QString>(uriElement.attribute("type"),
+                uriElement.text()));
+            uriElement = uriElement.nextSiblingElement("uri");
+        }
+        media.setUris(uris);
+    }
+}
+
+void QXmppDataFormFieldPrivate::parseOptions() const
+{
+    if (optionsParsed)
+        return;
+    optionsParsed = true;
+
+    QDomElement optionElement = source.firstChildElement("option");
+    while (!optionElement.isNull())
+    {
+        options.append(QPair<QString, QString>(optionElement.attribute("label"),
+            optionElement.firstChildElement("value").text()));
+        optionElement = optionElement.nextSiblingElement("option");
+    }
+}
+
 /// Constructs a QXmppDataForm::Field of the specified \a type.
 
 QXmppDataForm::Field::Field(QXmppDataForm::Field::Type type)
@@ -235,6 +284,7 @@ void QXmppDataForm::Field::setLabel(const QString &label)
 
 QXmppDataForm::Media QXmppDataForm::Field::media() const
 {
+    d->parseMedia();
     return d->media;
 }
 
@@ -243,12 +293,14 @@ QXmppDataForm::Media QXmppDataForm::Field::media() const
 void QXmppDataForm::Field::setMedia(const QXmppDataForm::Media &media)
 {
     d->media = media;
+    d->mediaParsed = true;
 }
 
 /// Returns the field's options.
 
 QList<QPair<QString, QString> > QXmppDataForm::Field::options() const
 {
+    d->parseOptions();
     return d->options;
 }
 
@@ -259,6 +311,7 @@ QList<QPair<QString, QString> > QXmppDataForm::Field::options() const
 void QXmppDataForm::Field::setOptions(const QList<QPair<QString, QString> > &options)
 {
     d->options = options;
+    d->optionsParsed = true;
 }
 
 /// Returns true if the field is required, false otherwise.
@@ -314,10 +367,16 @@ class QXmppDataFormPrivate : public QSharedData
 public:
     QXmppDataFormPrivate();
 
+    int fieldIndex(const QString &key) const;
+
     QString instructions;
     QList<QXmppDataForm::Field> fields;
     QString title;
     QXmppDataForm::Type type;
+
+    // position of the first field for each key, built on first lookup;
+    // fields() hands out a reference so entries are checked before use
+    mutable QHash<QString, int> fieldIndexes;
 };
 
 QXmppDataFormPrivate::QXmppDataFormPrivate()
@@ -325,6 +384,25 @@ QXmppDataFormPrivate::QXmppDataFormPrivate()
 {
 }
 
+int QXmppDataFormPrivate::fieldIndex(const QString &key) const
+{
+    QHash<QString, int>::const_iterator it = fieldIndexes.constFind(key);
+    if (it != fieldIndexes.constEnd() && it.value() < fields.size() &&
+        fields.at(it.value()).key() == key)
+        return it.value();
+
+    // the fields changed since the index was built, or the key is missing
+    fieldIndexes.clear();
+    int index = -1;
+    for (int i = fields.size() - 1; i >= 0; --i) {
+        const QString fieldKey = fields.at(i).key();
+        fieldIndexes.insert(fieldKey, i);
+        if (fieldKey == key)
+            index = i;
+    }
+    return index;
+}
+
 /// Constructs a QXmppDataForm of the specified \a type.
 
 QXmppDataForm::QXmppDataForm(QXmppDataForm::Type type)
@@ -375,6 +453,27 @@ QList<QXmppDataForm::Field> &QXmppDataForm::fields()
 void QXmppDataForm::setFields(const QList<QXmppDataForm::Field> &fields)
 {
     d->fields = fields;
+    d->fieldIndexes.clear();
+}
+
+/// Returns the first field with the given \a key, or a default-constructed
+/// field if the form has no such field.
+///
+/// Fields are looked up by key in a hash which is built on first use.
+
+QXmppDataForm::Field QXmppDataForm::field(const QString &key) const
+{
+    const int index = d->fieldIndex(key);
+    return index < 0 ? QXmppDataForm::Field() : d->fields.at(index);
+}
+
+/// Returns the value of the form's FORM_TYPE field, or an empty string
+/// if it does not have one.
+
+QString QXmppDataForm::formType() const
+{
+    const int index = d->fieldIndex(QLatin1String("FORM_TYPE"));
+    return index < 0 ? QString() : d->fields.at(index).value().toString();
 }
 
 /// Returns the form's instructions.
@@ -505,38 +604,11 @@ void QXmppDataForm::parse(const QDomElement &element)
             field.setValue(fieldElement.firstChildElement("value").text());
         }
 
-        /* field media */
-        QDomElement mediaElement = fieldElement.firstChildElement("media");
-        if (!mediaElement.isNull()) {
-            Media media;
-            media.setHeight(mediaElement.attribute("height", "-1").toInt());
-            media.setWidth(mediaElement.attribute("width", "-1").toInt());
-
-            QList<QPair<QString, QString> > uris;
-            QDomElement uriElement = mediaElement.firstChildElement("uri");
-            while (!uriElement.isNull()) {
-                uris.append(QPair<QString, QString>(uriElement.attribute("type"),
-                    uriElement.text()));
-                uriElement = uriElement.nextSiblingElement("uri");
-            }
-            media.setUris(uris);
-            field.setMedia(media);
-        }
-
-        /* field options */
-        if (type == QXmppDataForm::Field::ListMultiField ||
-            type == QXmppDataForm::Field::ListSingleField)
-        {
-            QList<QPair<QString, QString> > options;
-            QDomElement optionElement = fieldElement.firstChildElement("option");
-            while (!optionElement.isNull())
-            {
-                options.append(QPair<QString, QString>(optionElement.attribute("label"),
-                    optionElement.firstChildElement("value").text()));
-                optionElement = optionElement.nextSiblingElement("option");
-            }
-            field.setOptions(options);
-        }
+        /* field media and options are decoded on access */
+        field.d->source = fieldElement;
+        field.d->mediaParsed = false;
+        field.d->optionsParsed = type != QXmppDataForm::Field::ListMultiField &&
+                                 type != QXmppDataForm::Field::ListSingleField;
 
         /* other properties */
         field.setDescription(fieldElement.firstChildElement("description").text());
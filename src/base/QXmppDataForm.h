@@ -121,6 +121,7 @@ public:
         void setValue(const QVariant &value);
 
     private:
+        friend class QXmppDataForm;
         QSharedDataPointer<QXmppDataFormFieldPrivate> d;
     };
 
@@ -152,6 +153,9 @@ public:
     QList<Field> &fields();
     void setFields(const QList<QXmppDataForm::Field> &fields);
 
+    Field field(const QString &key) const;
+    QString formType() const;
+
     QString title() const;
     void setTitle(const QString &title);
 
@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QTimer>
+#include <QtEndian>
+
+#include "QXmppDatagramStream_p.h"
+
+// packet types, in a range which RFC 7983 leaves unassigned
+static const quint8 dataPacket = 0xe0;
+static const quint8 ackPacket = 0xe1;
+
+// the size of the data packet header
+static const int dataHeaderSize = 9;
+// the size of the acknowledgement header, before the selective blocks
+static const int ackHeaderSize = 18;
+// the largest number of ranges acknowledged selectively
+static const int maximumAckBlocks = 8;
+
+// the largest payload, which keeps packets below the usual path MTU even
+// when they are relayed through a TURN server
+static const int maximumPayloadSize = 1150;
+// the amount of data buffered for the reader, which bounds the window
+static const qint64 maximumReceiveBuffer = 4 * 1048576;
+
+// congestion windows in bytes
+static const qint64 initialWindow = 4 * maximumPayloadSize;
+static const qint64 minimumWindow = 2 * maximumPayloadSize;
+
+// retransmission timeouts in milliseconds, see RFC 6298
+static const qint64 initialRetransmitTimeout = 1000;
+static const qint64 minimumRetransmitTimeout = 200;
+static const qint64 maximumRetransmitTimeout = 60000;
+
+// the number of packets sent after a packet and acknowledged before the
+// packet is considered lost
+static const qint32 reorderingThreshold = 3;
+
+// the delay before a single packet is acknowledged, in milliseconds
+static const int ackDelay = 10;
+
+// the number of one minute delay minimums which make up the base delay,
+// and the number of samples filtered for the current delay, see RFC 6817
+static const int baseHistory = 10;
+static const int currentFilter = 4;
+
+/// Constructs a new datagram stream.
+///
+/// \param parent
+
+QXmppDatagramStream::QXmppDatagramStream(QObject *parent)
+    : QIODevice(parent)
+    , m_pendingOffset(0)
+    , m_pendingSize(0)
+    , m_unackedSize(0)
+    , m_flightSize(0)
+    , m_sendSequence(0)
+    , m_sendOrder(0)
+    , m_ackedOrder(0)
+    , m_recoverySequence(0)
+    , m_recovering(false)
+    , m_congestionWindow(initialWindow)
+    , m_slowStartThreshold(maximumReceiveBuffer)
+    , m_peerWindow(maximumReceiveBuffer)
+    , m_targetDelay(100000)
+    , m_baseDelayMinute(0)
+    , m_smoothedRtt(0)
+    , m_rttVariance(0)
+    , m_retransmitTimeout(initialRetransmitTimeout)
+    , m_pacingBudget(0)
+    , m_pacingTime(0)
+    , m_receivedOffset(0)
+    , m_receivedSize(0)
+    , m_outOfOrderSize(0)
+    , m_receiveSequence(0)
+    , m_echoStamp(0)
+    , m_echoDelay(0)
+    , m_unacknowledged(0)
+    , m_advertisedWindow(maximumReceiveBuffer)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_clock.start();
+
+    m_pacingTimer = new QTimer(this);
+    m_pacingTimer->setSingleShot(true);
+    check = connect(m_pacingTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_sendData()));
+    Q_ASSERT(check);
+
+    m_retransmitTimer = new QTimer(this);
+    m_retransmitTimer->setSingleShot(true);
+    check = connect(m_retransmitTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_retransmitTimeout()));
+    Q_ASSERT(check);
+
+    m_ackTimer = new QTimer(this);
+    m_ackTimer->setInterval(ackDelay);
+    m_ackTimer->setSingleShot(true);
+    check = connect(m_ackTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_sendAck()));
+    Q_ASSERT(check);
+}
+
+/// Destroys the datagram stream.
+
+QXmppDatagramStream::~QXmppDatagramStream()
+{
+}
+
+qint64 QXmppDatagramStream::bytesAvailable() const
+{
+    return m_receivedSize + QIODevice::bytesAvailable();
+}
+
+/// Returns the number of bytes which were written but not acknowledged
+/// by the peer yet.
+
+qint64 QXmppDatagramStream::bytesToWrite() const
+{
+    return m_pendingSize + m_unackedSize;
+}
+
+/// Closes the stream. Data which was not acknowledged is dropped.
+
+void QXmppDatagramStream::close()
+{
+    m_pacingTimer->stop();
+    m_retransmitTimer->stop();
+    m_ackTimer->stop();
+    QIODevice::close();
+}
+
+bool QXmppDatagramStream::isSequential() const
+{
+    return true;
+}
+
+/// Returns the congestion window in bytes.
+
+qint64 QXmppDatagramStream::congestionWindow() const
+{
+    return m_congestionWindow;
+}
+
+/// Returns the smoothed round-trip time in milliseconds, or -1 if it is
+/// not known yet.
+
+int QXmppDatagramStream::roundTripTime() const
+{
+    return m_smoothedRtt ? int(m_smoothedRtt / 1000) : -1;
+}
+
+/// Returns the queuing delay in milliseconds which the sender aims for.
+
+int QXmppDatagramStream::targetDelay() const
+{
+    return m_targetDelay / 1000;
+}
+
+/// Sets the queuing delay in milliseconds which the sender aims for.
+///
+/// The congestion window grows while the delay measured by the receiver
+/// stays below the target, and shrinks when it exceeds it. The default is
+/// 100 ms as recommended by RFC 6817.
+///
+/// \param msecs
+
+void QXmppDatagramStream::setTargetDelay(int msecs)
+{
+    m_targetDelay = qMax(1, msecs) * 1000;
+}
+
+/// Returns true if the \a datagram belongs to a datagram stream.
+
+bool QXmppDatagramStream::isDatagramStreamPacket(const QByteArray &datagram)
+{
+    return !datagram.isEmpty() && (quint8(datagram.at(0)) & 0xf0) == 0xe0;
+}
+
+/// Handles a \a datagram received from the peer.
+
+void QXmppDatagramStream::datagramReceived(const QByteArray &datagram)
+{
+    if (!isOpen() || datagram.isEmpty())
+        return;
+
+    const quint8 type = datagram.at(0);
+    if (type == dataPacket && datagram.size() >= dataHeaderSize)
+        handleData(datagram);
+    else if (type == ackPacket && datagram.size() >= ackHeaderSize)
+        handleAck(datagram);
+}
+
+qint64 QXmppDatagramStream::readData(char *data, qint64 maxSize)
+{
+    qint64 copied = 0;
+    while (copied < maxSize && !m_received.isEmpty()) {
+        const QByteArray &chunk = m_received.first();
+        const qint64 length = qMin(maxSize - copied, qint64(chunk.size() - m_receivedOffset));
+        memcpy(data + copied, chunk.constData() + m_receivedOffset, length);
+        copied += length;
+        m_receivedOffset += length;
+        if (m_receivedOffset >= chunk.size()) {
+            m_received.removeFirst();
+            m_receivedOffset = 0;
+        }
+    }
+    m_receivedSize -= copied;
+
+    // tell the sender when a window which was closing opens again
+    if (copied > 0 &&
+        m_advertisedWindow < maximumReceiveBuffer / 2 &&
+        receiveWindow() >= maximumReceiveBuffer / 2)
+        _q_sendAck();
+
+    return copied;
+}
+
+qint64 QXmppDatagramStream::writeData(const char *data, qint64 size)
+{
+    if (size <= 0)
+        return 0;
+
+    m_pending << QByteArray(data, int(size));
+    m_pendingSize += size;
+    _q_sendData();
+    return size;
+}
+
+void QXmppDatagramStream::_q_retransmitTimeout()
+{
+    if (m_segments.isEmpty())
+        return;
+
+    // everything which is in flight is presumed lost
+    QMap<quint32, Segment>::iterator it;
+    for (it = m_segments.begin(); it != m_segments.end(); ++it) {
+        if (!it->lost) {
+            it->lost = true;
+            m_retransmissions << it.key();
+        }
+    }
+    qSort(m_retransmissions);
+    m_flightSize = 0;
+
+    m_slowStartThreshold = qMax(minimumWindow, m_congestionWindow / 2);
+    m_congestionWindow = minimumWindow;
+    m_recovering = true;
+    m_recoverySequence = m_sendSequence;
+    m_retransmitTimeout = qMin(2 * m_retransmitTimeout, maximumRetransmitTimeout);
+
+    _q_sendData();
+}
+
+void QXmppDatagramStream::_q_sendAck()
+{
+    m_ackTimer->stop();
+    m_unacknowledged = 0;
+    m_advertisedWindow = receiveWindow();
+
+    // acknowledge the most recent ranges received out of order
+    QList<QPair<quint32, quint32> > blocks;
+    QMap<quint32, QByteArray>::const_iterator it = m_outOfOrder.constBegin();
+    while (it != m_outOfOrder.constEnd()) {
+        const quint32 start = it.key();
+        quint32 stop = start + 1;
+        ++it;
+        while (it != m_outOfOrder.constEnd() && it.key() == stop) {
+            ++stop;
+            ++it;
+        }
+        blocks << qMakePair(start, stop);
+    }
+    while (blocks.size() > maximumAckBlocks)
+        blocks.removeFirst();
+
+    QByteArray packet;
+    packet.resize(ackHeaderSize + 8 * blocks.size());
+    uchar *ptr = reinterpret_cast<uchar*>(packet.data());
+    ptr[0] = ackPacket;
+    qToBigEndian(m_receiveSequence, ptr + 1);
+    qToBigEndian(m_echoStamp, ptr + 5);
+    qToBigEndian(m_echoDelay, ptr + 9);
+    qToBigEndian(quint32(m_advertisedWindow), ptr + 13);
+    ptr[17] = quint8(blocks.size());
+    for (int i = 0; i < blocks.size(); ++i) {
+        qToBigEndian(blocks[i].first, ptr + ackHeaderSize + 8 * i);
+        qToBigEndian(blocks[i].second, ptr + ackHeaderSize + 8 * i + 4);
+    }
+    emit sendDatagram(packet);
+}
+
+void QXmppDatagramStream::_q_sendData()
+{
+    if (!isOpen())
+        return;
+
+    // refill the pacing budget, so that a window is spread over a
+    // round-trip time instead of being sent in a burst
+    const quint32 time = now();
+    if (m_smoothedRtt > 0) {
+        const double rate = 1.25 * m_congestionWindow / m_smoothedRtt;
+        m_pacingBudget += rate * quint32(time - m_pacingTime);
+        m_pacingBudget = qMin(m_pacingBudget, qMax(4.0 * (maximumPayloadSize + dataHeaderSize), 2000 * rate));
+    } else {
+        m_pacingBudget = m_congestionWindow;
+    }
+    m_pacingTime = time;
+
+    const qint64 window = qMin(m_congestionWindow, m_peerWindow);
+    forever {
+        // skip the retransmissions which were acknowledged meanwhile
+        while (!m_retransmissions.isEmpty() && !m_segments.contains(m_retransmissions.first()))
+            m_retransmissions.removeFirst();
+
+        int size;
+        if (!m_retransmissions.isEmpty())
+            size = m_segments.value(m_retransmissions.first()).payload.size();
+        else if (m_pendingSize > 0)
+            size = int(qMin(m_pendingSize, qint64(maximumPayloadSize)));
+        else
+            break;
+
+        // a single packet may always be in flight, which probes a
+        // closed receive window
+        if (m_flightSize > 0 && m_flightSize + size > window)
+            break;
+
+        if (m_pacingBudget < size + dataHeaderSize) {
+            if (!m_pacingTimer->isActive())
+                m_pacingTimer->start(1);
+            break;
+        }
+        m_pacingBudget -= size + dataHeaderSize;
+
+        if (!m_retransmissions.isEmpty()) {
+            const quint32 sequence = m_retransmissions.takeFirst();
+            QMap<quint32, Segment>::iterator it = m_segments.find(sequence);
+            it->lost = false;
+            sendSegment(sequence, *it);
+            continue;
+        }
+
+        // take the payload from the pending data, without copying it if
+        // it was written in a block of the right size
+        Segment segment;
+        segment.lost = false;
+        segment.order = 0;
+        if (!m_pendingOffset && m_pending.first().size() == size) {
+            segment.payload = m_pending.takeFirst();
+        } else {
+            segment.payload.reserve(size);
+            while (segment.payload.size() < size) {
+                const QByteArray &chunk = m_pending.first();
+                const int length = qMin(size - segment.payload.size(), chunk.size() - m_pendingOffset);
+                segment.payload.append(chunk.constData() + m_pendingOffset, length);
+                m_pendingOffset += length;
+                if (m_pendingOffset >= chunk.size()) {
+                    m_pending.removeFirst();
+                    m_pendingOffset = 0;
+                }
+            }
+        }
+        m_pendingSize -= size;
+        m_unackedSize += size;
+
+        const quint32 sequence = m_sendSequence++;
+        QMap<quint32, Segment>::iterator it = m_segments.insert(sequence, segment);
+        sendSegment(sequence, *it);
+    }
+}
+
+void QXmppDatagramStream::handleAck(const QByteArray &datagram)
+{
+    const uchar *ptr = reinterpret_cast<const uchar*>(datagram.constData());
+    const quint32 cumulative = qFromBigEndian<quint32>(ptr + 1);
+    const quint32 echoStamp = qFromBigEndian<quint32>(ptr + 5);
+    const quint32 delay = qFromBigEndian<quint32>(ptr + 9);
+    const quint32 window = qFromBigEndian<quint32>(ptr + 13);
+    const int blockCount = ptr[17];
+    if (datagram.size() < ackHeaderSize + 8 * blockCount)
+        return;
+
+    // ignore acknowledgements for data which was never sent
+    if (qint32(m_sendSequence - cumulative) < 0)
+        return;
+    m_peerWindow = window;
+
+    // drop the segments which were acknowledged, cumulatively or selectively
+    const qint64 flightBefore = m_flightSize;
+    qint64 acked = 0;
+    quint32 highest = cumulative - 1;
+    QMap<quint32, Segment>::iterator it = m_segments.begin();
+    for (int i = -1; i < blockCount; ++i) {
+        quint32 stop = cumulative;
+        if (i >= 0) {
+            it = m_segments.lowerBound(qFromBigEndian<quint32>(ptr + ackHeaderSize + 8 * i));
+            stop = qFromBigEndian<quint32>(ptr + ackHeaderSize + 8 * i + 4);
+            if (qint32(stop - m_sendSequence) > 0)
+                continue;
+            if (qint32(stop - 1 - highest) > 0)
+                highest = stop - 1;
+        }
+        while (it != m_segments.end() && qint32(it.key() - stop) < 0) {
+            const int size = it->payload.size();
+            if (!it->lost)
+                m_flightSize -= size;
+            m_unackedSize -= size;
+            acked += size;
+            if (qint32(it->order - m_ackedOrder) > 0)
+                m_ackedOrder = it->order;
+            it = m_segments.erase(it);
+        }
+    }
+    if (!acked) {
+        _q_sendData();
+        return;
+    }
+
+    // packets which were sent well before a packet which arrived are lost
+    bool lossEvent = false;
+    for (it = m_segments.begin(); it != m_segments.end() && qint32(it.key() - highest) < 0; ++it) {
+        if (!it->lost && qint32(m_ackedOrder - it->order) >= reorderingThreshold) {
+            it->lost = true;
+            m_flightSize -= it->payload.size();
+            m_retransmissions << it.key();
+            if (!m_recovering || qint32(it.key() - m_recoverySequence) >= 0)
+                lossEvent = true;
+        }
+    }
+
+    // round-trip time, see RFC 6298
+    const qint64 rtt = quint32(now() - echoStamp);
+    if (!m_smoothedRtt) {
+        m_smoothedRtt = qMax(rtt, Q_INT64_C(1));
+        m_rttVariance = rtt / 2;
+    } else {
+        m_rttVariance = (3 * m_rttVariance + qAbs(m_smoothedRtt - rtt)) / 4;
+        m_smoothedRtt = qMax((7 * m_smoothedRtt + rtt) / 8, Q_INT64_C(1));
+    }
+    m_retransmitTimeout = qBound(minimumRetransmitTimeout,
+                                 (m_smoothedRtt + 4 * m_rttVariance) / 1000,
+                                 maximumRetransmitTimeout);
+
+    // congestion control, see RFC 6817
+    updateDelay(delay);
+    if (lossEvent) {
+        m_recovering = true;
+        m_recoverySequence = m_sendSequence;
+        m_congestionWindow = qMax(minimumWindow, m_congestionWindow / 2);
+        m_slowStartThreshold = m_congestionWindow;
+    } else {
+        if (m_recovering && qint32(cumulative - m_recoverySequence) >= 0)
+            m_recovering = false;
+
+        // grow quickly until the queuing delay builds up, then let the
+        // delay steer the window towards the target
+        const qint64 queuing = queuingDelay();
+        if (m_congestionWindow < m_slowStartThreshold && queuing < m_targetDelay / 2) {
+            m_congestionWindow += acked;
+        } else {
+            m_slowStartThreshold = qMin(m_slowStartThreshold, m_congestionWindow);
+            const double offTarget = double(qint64(m_targetDelay) - queuing) / m_targetDelay;
+            m_congestionWindow += qint64(offTarget * acked * maximumPayloadSize / m_congestionWindow);
+        }
+
+        // a stream which does not use its window does not grow it
+        m_congestionWindow = qBound(minimumWindow, m_congestionWindow, 2 * flightBefore + maximumPayloadSize);
+    }
+
+    if (m_segments.isEmpty())
+        m_retransmitTimer->stop();
+    else
+        m_retransmitTimer->start(m_retransmitTimeout);
+
+    emit bytesWritten(acked);
+    _q_sendData();
+}
+
+void QXmppDatagramStream::handleData(const QByteArray &datagram)
+{
+    const uchar *ptr = reinterpret_cast<const uchar*>(datagram.constData());
+    const quint32 sequence = qFromBigEndian<quint32>(ptr + 1);
+    const quint32 stamp = qFromBigEndian<quint32>(ptr + 5);
+    const int size = datagram.size() - dataHeaderSize;
+
+    // the one-way delay includes the offset between the clocks, which
+    // the sender cancels out by comparing it to the base delay
+    m_echoStamp = stamp;
+    m_echoDelay = now() - stamp;
+
+    bool immediate = true;
+    bool delivered = false;
+    const qint32 offset = qint32(sequence - m_receiveSequence);
+    if (offset < 0) {
+        // a retransmission of data which was already received
+    } else if (m_receivedSize + m_outOfOrderSize + size > maximumReceiveBuffer) {
+        // no room left, the sender will try again
+    } else if (offset == 0) {
+        m_received << datagram.mid(dataHeaderSize);
+        m_receivedSize += size;
+        m_receiveSequence++;
+
+        // deliver the packets which were waiting for this one
+        QMap<quint32, QByteArray>::iterator it = m_outOfOrder.find(m_receiveSequence);
+        while (it != m_outOfOrder.end() && it.key() == m_receiveSequence) {
+            m_received << it.value();
+            m_receivedSize += it.value().size();
+            m_outOfOrderSize -= it.value().size();
+            it = m_outOfOrder.erase(it);
+            m_receiveSequence++;
+        }
+        immediate = !m_outOfOrder.isEmpty();
+        delivered = true;
+    } else if (!m_outOfOrder.contains(sequence)) {
+        m_outOfOrder.insert(sequence, datagram.mid(dataHeaderSize));
+        m_outOfOrderSize += size;
+    }
+
+    // acknowledge every other packet, and gaps at once
+    if (immediate || ++m_unacknowledged >= 2)
+        _q_sendAck();
+    else if (!m_ackTimer->isActive())
+        m_ackTimer->start();
+
+    if (delivered)
+        emit readyRead();
+}
+
+quint32 QXmppDatagramStream::now() const
+{
+    return quint32(m_clock.nsecsElapsed() / 1000);
+}
+
+// Returns the current queuing delay in microseconds, i.e. how much the
+// recent one-way delays exceed the lowest one.
+
+qint64 QXmppDatagramStream::queuingDelay() const
+{
+    if (m_baseDelays.isEmpty() || m_currentDelays.isEmpty())
+        return 0;
+
+    quint32 base = m_baseDelays.first();
+    foreach (quint32 delay, m_baseDelays) {
+        if (qint32(delay - base) < 0)
+            base = delay;
+    }
+    quint32 current = m_currentDelays.first();
+    foreach (quint32 delay, m_currentDelays) {
+        if (qint32(delay - current) < 0)
+            current = delay;
+    }
+    return qMax(qint32(current - base), 0);
+}
+
+qint64 QXmppDatagramStream::receiveWindow() const
+{
+    return qMax(Q_INT64_C(0), maximumReceiveBuffer - m_receivedSize - m_outOfOrderSize);
+}
+
+void QXmppDatagramStream::sendSegment(quint32 sequence, Segment &segment)
+{
+    QByteArray packet;
+    packet.resize(dataHeaderSize + segment.payload.size());
+    uchar *ptr = reinterpret_cast<uchar*>(packet.data());
+    ptr[0] = dataPacket;
+    qToBigEndian(sequence, ptr + 1);
+    qToBigEndian(now(), ptr + 5);
+    memcpy(ptr + dataHeaderSize, segment.payload.constData(), segment.payload.size());
+
+    segment.order = m_sendOrder++;
+    m_flightSize += segment.payload.size();
+    if (!m_retransmitTimer->isActive())
+        m_retransmitTimer->start(m_retransmitTimeout);
+
+    emit sendDatagram(packet);
+}
+
+// Records a one-way delay sample, keeping the lowest delay of each of the
+// last minutes and the last few samples.
+
+void QXmppDatagramStream::updateDelay(quint32 delay)
+{
+    const quint32 minute = quint32(m_clock.elapsed() / 60000);
+    if (m_baseDelays.isEmpty() || minute != m_baseDelayMinute) {
+        m_baseDelayMinute = minute;
+        m_baseDelays << delay;
+        if (m_baseDelays.size() > baseHistory)
+            m_baseDelays.removeFirst();
+    } else if (qint32(delay - m_baseDelays.last()) < 0) {
+        m_baseDelays.last() = delay;
+    }
+
+    m_currentDelays << delay;
+    if (m_currentDelays.size() > currentFilter)
+        m_currentDelays.removeFirst();
+}
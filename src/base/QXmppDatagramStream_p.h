@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPDATAGRAMSTREAM_P_H
+#define QXMPPDATAGRAMSTREAM_P_H
+
+#include <QElapsedTimer>
+#include <QIODevice>
+#include <QList>
+#include <QMap>
+
+#include "QXmppGlobal.h"
+
+class QTimer;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppTransferManager class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppDatagramStream class provides a reliable byte stream on top of
+/// an unreliable datagram transport such as an ICE component.
+///
+/// Data is split into numbered packets. The receiver acknowledges them
+/// cumulatively and selectively, reporting the one-way delay it measured.
+/// The sender retransmits lost packets and adjusts its congestion window
+/// as described by RFC 6817 (LEDBAT), so that transfers use the available
+/// bandwidth without filling the queues of the path. Packets are paced
+/// over the round-trip time instead of being sent in bursts.
+///
+/// The first byte of each packet lies in the 224-239 range, which RFC 7983
+/// leaves unused by STUN, DTLS and RTP.
+
+class QXMPP_AUTOTEST_EXPORT QXmppDatagramStream : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    QXmppDatagramStream(QObject *parent = 0);
+    ~QXmppDatagramStream();
+
+    qint64 bytesAvailable() const;
+    qint64 bytesToWrite() const;
+    void close();
+    bool isSequential() const;
+
+    qint64 congestionWindow() const;
+    int roundTripTime() const;
+
+    int targetDelay() const;
+    void setTargetDelay(int msecs);
+
+    static bool isDatagramStreamPacket(const QByteArray &datagram);
+
+signals:
+    /// This signal is emitted when a datagram needs to be sent.
+    void sendDatagram(const QByteArray &datagram);
+
+public slots:
+    void datagramReceived(const QByteArray &datagram);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 size);
+
+private slots:
+    void _q_retransmitTimeout();
+    void _q_sendAck();
+    void _q_sendData();
+
+private:
+    struct Segment
+    {
+        QByteArray payload;
+        quint32 order;
+        bool lost;
+    };
+
+    quint32 now() const;
+    void handleAck(const QByteArray &datagram);
+    void handleData(const QByteArray &datagram);
+    void sendSegment(quint32 sequence, Segment &segment);
+    qint64 queuingDelay() const;
+    qint64 receiveWindow() const;
+    void updateDelay(quint32 delay);
+
+    QElapsedTimer m_clock;
+
+    // sender
+    QList<QByteArray> m_pending;
+    int m_pendingOffset;
+    qint64 m_pendingSize;
+    QMap<quint32, Segment> m_segments;
+    QList<quint32> m_retransmissions;
+    qint64 m_unackedSize;
+    qint64 m_flightSize;
+    quint32 m_sendSequence;
+    quint32 m_sendOrder;
+    quint32 m_ackedOrder;
+    quint32 m_recoverySequence;
+    bool m_recovering;
+
+    qint64 m_congestionWindow;
+    qint64 m_slowStartThreshold;
+    qint64 m_peerWindow;
+    quint32 m_targetDelay;
+    QList<quint32> m_baseDelays;
+    quint32 m_baseDelayMinute;
+    QList<quint32> m_currentDelays;
+
+    qint64 m_smoothedRtt;
+    qint64 m_rttVariance;
+    qint64 m_retransmitTimeout;
+    double m_pacingBudget;
+    quint32 m_pacingTime;
+    QTimer *m_pacingTimer;
+    QTimer *m_retransmitTimer;
+
+    // receiver
+    QList<QByteArray> m_received;
+    int m_receivedOffset;
+    qint64 m_receivedSize;
+    QMap<quint32, QByteArray> m_outOfOrder;
+    qint64 m_outOfOrderSize;
+    quint32 m_receiveSequence;
+    quint32 m_echoStamp;
+    quint32 m_echoDelay;
+    int m_unacknowledged;
+    qint64 m_advertisedWindow;
+    QTimer *m_ackTimer;
+};
+
+#endif
@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QFile>
+#include <QStringList>
+#include <QThreadStorage>
+#include <QTimer>
+#include <QUdpSocket>
+#include <QUrl>
+
+#include "QXmppDnsQuery_p.h"
+
+// header flags
+static const quint16 DNS_RESPONSE = 0x8000;
+static const quint16 DNS_TRUNCATED = 0x0200;
+static const quint16 DNS_RECURSION_DESIRED = 0x0100;
+
+// response codes
+static const quint16 DNS_SERVER_FAILURE = 2;
+static const quint16 DNS_NAME_ERROR = 3;
+static const quint16 DNS_REFUSED = 5;
+
+static const quint16 DNS_TYPE_SRV = 33;
+static const quint16 DNS_CLASS_IN = 1;
+
+static const int DNS_HEADER_SIZE = 12;
+
+namespace
+{
+    // The resolver configuration of the system, as in resolv.conf(5).
+    class QXmppDnsConfig
+    {
+    public:
+        QXmppDnsConfig();
+
+        QList<QHostAddress> nameServers;
+        int attempts;
+        int timeout;
+    };
+}
+
+QXmppDnsConfig::QXmppDnsConfig()
+    : attempts(2)
+    , timeout(5000)
+{
+    QFile file(QLatin1String("/etc/resolv.conf"));
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        while (!file.atEnd()) {
+            const QList<QByteArray> fields = file.readLine().simplified().split(' ');
+            if (fields.size() < 2)
+                continue;
+
+            if (fields.at(0) == "nameserver") {
+                QHostAddress address;
+                if (nameServers.size() < 3 && address.setAddress(QString::fromLatin1(fields.at(1))))
+                    nameServers << address;
+            } else if (fields.at(0) == "options") {
+                for (int i = 1; i < fields.size(); ++i) {
+                    const QByteArray option = fields.at(i);
+                    if (option.startsWith("attempts:"))
+                        attempts = qBound(1, option.mid(9).toInt(), 5);
+                    else if (option.startsWith("timeout:"))
+                        timeout = qBound(1, option.mid(8).toInt(), 30) * 1000;
+                }
+            }
+        }
+    }
+
+    // like the system resolver, default to the local host
+    if (nameServers.isEmpty())
+        nameServers << QHostAddress(QHostAddress::LocalHost);
+}
+
+// The configuration is read once per thread, so that queries never
+// contend for a lock.
+Q_GLOBAL_STATIC(QThreadStorage<QXmppDnsConfig*>, dnsConfigStorage)
+
+static const QXmppDnsConfig *systemConfig()
+{
+    QThreadStorage<QXmppDnsConfig*> *storage = dnsConfigStorage();
+    if (!storage->hasLocalData())
+        storage->setLocalData(new QXmppDnsConfig);
+    return storage->localData();
+}
+
+static quint16 readUInt16(const QByteArray &data, int offset)
+{
+    return (quint16(quint8(data.at(offset))) << 8) | quint8(data.at(offset + 1));
+}
+
+static quint32 readUInt32(const QByteArray &data, int offset)
+{
+    return (quint32(readUInt16(data, offset)) << 16) | readUInt16(data, offset + 2);
+}
+
+// Reads a possibly compressed domain name at the given offset, and moves
+// the offset past it.
+
+static bool readName(const QByteArray &data, int *offset, QString *name)
+{
+    QByteArray ace;
+    int pos = *offset;
+    int end = -1;
+    int jumps = 0;
+
+    forever {
+        if (pos >= data.size())
+            return false;
+
+        const quint8 length = data.at(pos);
+        if ((length & 0xc0) == 0xc0) {
+            // a pointer to a name found earlier in the message
+            if (pos + 1 >= data.size() || ++jumps > 16)
+                return false;
+            if (end < 0)
+                end = pos + 2;
+            pos = ((length & 0x3f) << 8) | quint8(data.at(pos + 1));
+        } else if (length & 0xc0) {
+            return false;
+        } else if (!length) {
+            if (end < 0)
+                end = pos + 1;
+            break;
+        } else {
+            if (pos + 1 + length > data.size())
+                return false;
+            if (!ace.isEmpty())
+                ace += '.';
+            ace += data.mid(pos + 1, length);
+            pos += 1 + length;
+        }
+    }
+
+    *name = QUrl::fromAce(ace);
+    *offset = end;
+    return true;
+}
+
+class QXmppDnsQueryPrivate
+{
+public:
+    QXmppDnsQueryPrivate(QXmppDnsQuery *qq);
+    QByteArray encodeQuery() const;
+    void finish(QDnsLookup::Error error, const QString &errorString);
+    bool handleReply(const QByteArray &reply);
+    void sendQuery();
+
+    QList<QHostAddress> nameServers;
+    quint16 nameServerPort;
+    int attempts;
+    int timeout;
+
+    QDnsLookup::Error error;
+    QString errorString;
+    bool isFinished;
+    QString name;
+    QList<QXmppSrvRecord> records;
+
+    QByteArray query;
+    quint16 queryId;
+    bool running;
+    int sentCount;
+    QUdpSocket *socket;
+    QTimer *timer;
+
+private:
+    QXmppDnsQuery *q;
+};
+
+QXmppDnsQueryPrivate::QXmppDnsQueryPrivate(QXmppDnsQuery *qq)
+    : nameServerPort(53)
+    , attempts(systemConfig()->attempts)
+    , timeout(systemConfig()->timeout)
+    , error(QDnsLookup::NoError)
+    , isFinished(false)
+    , queryId(0)
+    , running(false)
+    , sentCount(0)
+    , socket(0)
+    , timer(0)
+    , q(qq)
+{
+}
+
+// Returns the query for the name's SRV records, or an empty array if the
+// name is invalid.
+
+QByteArray QXmppDnsQueryPrivate::encodeQuery() const
+{
+    const QByteArray ace = QUrl::toAce(name);
+    if (ace.isEmpty() || ace.size() > 254)
+        return QByteArray();
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << queryId;
+    stream << DNS_RECURSION_DESIRED;
+    stream << quint16(1) << quint16(0) << quint16(0) << quint16(0);
+
+    const QList<QByteArray> labels = ace.split('.');
+    for (int i = 0; i < labels.size(); ++i) {
+        const QByteArray label = labels.at(i);
+        // only the last label may be empty, for a trailing dot
+        if (label.isEmpty() && i < labels.size() - 1)
+            return QByteArray();
+        if (label.size() > 63)
+            return QByteArray();
+        if (!label.isEmpty()) {
+            stream << quint8(label.size());
+            stream.writeRawData(label.constData(), label.size());
+        }
+    }
+    stream << quint8(0);
+    stream << DNS_TYPE_SRV << DNS_CLASS_IN;
+    return data;
+}
+
+void QXmppDnsQueryPrivate::finish(QDnsLookup::Error error, const QString &errorString)
+{
+    timer->stop();
+    running = false;
+    this->error = error;
+    this->errorString = errorString;
+    if (error != QDnsLookup::NoError)
+        records.clear();
+    isFinished = true;
+    emit q->finished();
+}
+
+// Handles a reply, and returns true if it was the reply to the query.
+
+bool QXmppDnsQueryPrivate::handleReply(const QByteArray &reply)
+{
+    if (reply.size() < query.size())
+        return false;
+
+    // check this is the answer to our question
+    const quint16 flags = readUInt16(reply, 2);
+    if (readUInt16(reply, 0) != queryId ||
+        !(flags & DNS_RESPONSE) ||
+        readUInt16(reply, 4) != 1 ||
+        reply.mid(DNS_HEADER_SIZE, query.size() - DNS_HEADER_SIZE).toLower() != query.mid(DNS_HEADER_SIZE).toLower())
+        return false;
+
+    switch (flags & 0xf) {
+    case 0:
+        break;
+    case DNS_SERVER_FAILURE:
+        finish(QDnsLookup::ServerFailureError, QLatin1String("Server failure"));
+        return true;
+    case DNS_NAME_ERROR:
+        finish(QDnsLookup::NotFoundError, QLatin1String("Non existent domain"));
+        return true;
+    case DNS_REFUSED:
+        finish(QDnsLookup::ServerRefusedError, QLatin1String("Server refused to answer"));
+        return true;
+    default:
+        finish(QDnsLookup::InvalidReplyError, QLatin1String("Invalid reply received"));
+        return true;
+    }
+
+    // a truncated reply holds the answers which fit, use those
+    const bool truncated = (flags & DNS_TRUNCATED);
+    const int answerCount = readUInt16(reply, 6);
+    int offset = query.size();
+    records.clear();
+    for (int i = 0; i < answerCount; ++i) {
+        QString recordName;
+        if (!readName(reply, &offset, &recordName) || offset + 10 > reply.size()) {
+            if (truncated)
+                break;
+            finish(QDnsLookup::InvalidReplyError, QLatin1String("Could not expand domain name"));
+            return true;
+        }
+
+        const quint16 type = readUInt16(reply, offset);
+        const quint16 recordClass = readUInt16(reply, offset + 2);
+        const quint32 ttl = readUInt32(reply, offset + 4);
+        const int dataSize = readUInt16(reply, offset + 8);
+        offset += 10;
+        if (offset + dataSize > reply.size()) {
+            if (truncated)
+                break;
+            finish(QDnsLookup::InvalidReplyError, QLatin1String("Invalid reply received"));
+            return true;
+        }
+
+        // other records, such as the CNAMEs which were followed, are skipped
+        if (type == DNS_TYPE_SRV && recordClass == DNS_CLASS_IN) {
+            QString target;
+            int targetOffset = offset + 6;
+            if (dataSize < 7 || !readName(reply, &targetOffset, &target) ||
+                targetOffset > offset + dataSize) {
+                finish(QDnsLookup::InvalidReplyError, QLatin1String("Invalid service record"));
+                return true;
+            }
+
+            QXmppSrvRecord record;
+            record.setPriority(readUInt16(reply, offset));
+            record.setWeight(readUInt16(reply, offset + 2));
+            record.setPort(readUInt16(reply, offset + 4));
+            record.setTarget(target);
+            record.setTimeToLive(ttl);
+            records << record;
+        }
+        offset += dataSize;
+    }
+
+    finish(QDnsLookup::NoError, QString());
+    return true;
+}
+
+// Sends the query to the next name server.
+
+void QXmppDnsQueryPrivate::sendQuery()
+{
+    const QHostAddress server = nameServers.at(sentCount % nameServers.size());
+    sentCount++;
+    socket->writeDatagram(query, server, nameServerPort);
+    timer->start(timeout);
+}
+
+/// Constructs a new DNS query.
+///
+/// \param parent
+
+QXmppDnsQuery::QXmppDnsQuery(QObject *parent)
+    : QObject(parent)
+    , d(new QXmppDnsQueryPrivate(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->timer = new QTimer(this);
+    d->timer->setSingleShot(true);
+    check = connect(d->timer, SIGNAL(timeout()),
+                    this, SLOT(_q_timeout()));
+    Q_ASSERT(check);
+}
+
+QXmppDnsQuery::~QXmppDnsQuery()
+{
+    delete d;
+}
+
+/// Returns the type of error that occurred if the query failed,
+/// or QDnsLookup::NoError.
+
+QDnsLookup::Error QXmppDnsQuery::error() const
+{
+    return d->error;
+}
+
+/// Returns a human-readable description of the error if the query failed.
+
+QString QXmppDnsQuery::errorString() const
+{
+    return d->errorString;
+}
+
+/// Returns true if the query has finished.
+
+bool QXmppDnsQuery::isFinished() const
+{
+    return d->isFinished;
+}
+
+/// Returns the name which is looked up.
+
+QString QXmppDnsQuery::name() const
+{
+    return d->name;
+}
+
+/// Returns the SRV records which were received.
+
+QList<QXmppSrvRecord> QXmppDnsQuery::serviceRecords() const
+{
+    return d->records;
+}
+
+/// Returns the name servers the query is sent to.
+
+QList<QHostAddress> QXmppDnsQuery::nameServers() const
+{
+    return d->nameServers.isEmpty() ? systemConfig()->nameServers : d->nameServers;
+}
+
+/// Returns the port of the name servers.
+
+quint16 QXmppDnsQuery::nameServerPort() const
+{
+    return d->nameServerPort;
+}
+
+/// Sets the name servers the query is sent to, instead of those of the
+/// system.
+///
+/// \param servers
+/// \param port
+
+void QXmppDnsQuery::setNameServers(const QList<QHostAddress> &servers, quint16 port)
+{
+    d->nameServers = servers;
+    d->nameServerPort = port;
+}
+
+/// Returns the number of times the query is sent to each name server.
+
+int QXmppDnsQuery::attempts() const
+{
+    return d->attempts;
+}
+
+/// Sets the number of times the query is sent to each name server.
+///
+/// \param attempts
+
+void QXmppDnsQuery::setAttempts(int attempts)
+{
+    d->attempts = qMax(1, attempts);
+}
+
+/// Returns the time in milliseconds to wait for an answer before sending
+/// the query again.
+
+int QXmppDnsQuery::timeout() const
+{
+    return d->timeout;
+}
+
+/// Sets the time in milliseconds to wait for an answer before sending
+/// the query again.
+///
+/// \param msecs
+
+void QXmppDnsQuery::setTimeout(int msecs)
+{
+    d->timeout = msecs;
+}
+
+/// Aborts the query. If a query was running, finished() is emitted with
+/// the QDnsLookup::OperationCancelledError error.
+
+void QXmppDnsQuery::abort()
+{
+    if (d->running)
+        d->finish(QDnsLookup::OperationCancelledError, QLatin1String("Operation cancelled"));
+}
+
+/// Looks up the SRV records for the given \a name, replacing any query in
+/// progress. The finished() signal is emitted once the result is known.
+///
+/// \param name
+
+void QXmppDnsQuery::lookup(const QString &name)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->timer->stop();
+    d->name = name;
+    d->error = QDnsLookup::NoError;
+    d->errorString.clear();
+    d->records.clear();
+    d->isFinished = false;
+    d->running = true;
+    d->sentCount = 0;
+
+    // use a new socket, and so a new source port, for each query
+    if (d->socket) {
+        d->socket->disconnect(this);
+        d->socket->deleteLater();
+    }
+    d->socket = new QUdpSocket(this);
+    check = connect(d->socket, SIGNAL(readyRead()),
+                    this, SLOT(_q_readyRead()));
+    Q_ASSERT(check);
+
+    d->queryId = qrand() & 0xffff;
+    d->query = d->encodeQuery();
+    if (d->query.isEmpty()) {
+        // report the error from the event loop, like other errors
+        d->timer->start(0);
+        return;
+    }
+
+    if (d->nameServers.isEmpty())
+        d->nameServers = systemConfig()->nameServers;
+    d->sendQuery();
+}
+
+void QXmppDnsQuery::_q_readyRead()
+{
+    while (d->socket->hasPendingDatagrams()) {
+        QByteArray datagram;
+        datagram.resize(d->socket->pendingDatagramSize());
+        QHostAddress remoteHost;
+        quint16 remotePort;
+        const qint64 size = d->socket->readDatagram(datagram.data(), datagram.size(), &remoteHost, &remotePort);
+        if (size < 0 || !d->running)
+            continue;
+        datagram.resize(size);
+
+        // only accept replies from the name servers
+        if (remotePort != d->nameServerPort || !d->nameServers.contains(remoteHost))
+            continue;
+        if (d->handleReply(datagram))
+            return;
+    }
+}
+
+void QXmppDnsQuery::_q_timeout()
+{
+    if (!d->running)
+        return;
+
+    if (d->query.isEmpty())
+        d->finish(QDnsLookup::InvalidRequestError, QLatin1String("Invalid domain name"));
+    else if (d->sentCount >= d->attempts * d->nameServers.size())
+        d->finish(QDnsLookup::ResolverError, QLatin1String("Timed out"));
+    else
+        d->sendQuery();
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPDNSQUERY_P_H
+#define QXMPPDNSQUERY_P_H
+
+#include <QHostAddress>
+#include <QList>
+#include <QObject>
+
+#include "QXmppSrvLookup_p.h"
+
+class QXmppDnsQueryPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppSrvLookup class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppDnsQuery class sends a DNS query for SRV records over UDP.
+///
+/// Unlike QDnsLookup, which blocks a thread of a pool for each query, the
+/// query is driven by the event loop of the thread the object lives in, so
+/// any number of queries can run in parallel. If no answer is received
+/// within timeout() milliseconds, the query is sent to the next name
+/// server, up to attempts() times per name server.
+///
+/// The name servers and options are read from /etc/resolv.conf, once per
+/// thread, unless they are set with setNameServers().
+
+class QXMPP_AUTOTEST_EXPORT QXmppDnsQuery : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppDnsQuery(QObject *parent = 0);
+    ~QXmppDnsQuery();
+
+    QDnsLookup::Error error() const;
+    QString errorString() const;
+    bool isFinished() const;
+    QString name() const;
+    QList<QXmppSrvRecord> serviceRecords() const;
+
+    QList<QHostAddress> nameServers() const;
+    quint16 nameServerPort() const;
+    void setNameServers(const QList<QHostAddress> &servers, quint16 port = 53);
+
+    int attempts() const;
+    void setAttempts(int attempts);
+
+    int timeout() const;
+    void setTimeout(int msecs);
+
+signals:
+    /// This signal is emitted when the query has finished.
+    void finished();
+
+public slots:
+    void abort();
+    void lookup(const QString &name);
+
+private slots:
+    void _q_readyRead();
+    void _q_timeout();
+
+private:
+    QXmppDnsQueryPrivate * const d;
+};
+
+#endif
@@ -25,7 +25,54 @@
 #include "QXmppUtils.h"
 
 #include <QDomElement>
-#include <QTextStream>
+
+/// Returns the attributes of a DOM element as a QXmppElement sees them,
+/// including its namespace if it differs from its parent's.
+
+static QMap<QString, QString> domAttributes(const QDomElement &element)
+{
+    QMap<QString, QString> attributes;
+    const QString xmlns = element.namespaceURI();
+    if (!xmlns.isEmpty() && xmlns != element.parentNode().namespaceURI())
+        attributes.insert("xmlns", xmlns);
+    const QDomNamedNodeMap attrs = element.attributes();
+    for (int i = 0; i < attrs.size(); i++)
+    {
+        const QDomAttr attr = attrs.item(i).toAttr();
+        attributes.insert(attr.name(), attr.value());
+    }
+    return attributes;
+}
+
+static void writeAttributes(QXmlStreamWriter *writer, const QMap<QString, QString> &attributes)
+{
+    QMap<QString, QString>::const_iterator xmlns = attributes.constFind("xmlns");
+    if (xmlns != attributes.constEnd())
+        writer->writeAttribute("xmlns", xmlns.value());
+    for (QMap<QString, QString>::const_iterator it = attributes.constBegin(); it != attributes.constEnd(); ++it)
+        if (it.key() != "xmlns")
+            helperToXmlAddAttribute(writer, it.key(), it.value());
+}
+
+/// Writes a DOM element the same way QXmppElement::toXml() writes the
+/// element built from it.
+
+static void writeDomElement(QXmlStreamWriter *writer, const QDomElement &element)
+{
+    writer->writeStartElement(element.tagName());
+    writeAttributes(writer, domAttributes(element));
+
+    QString value;
+    for (QDomNode node = element.firstChild(); !node.isNull(); node = node.nextSibling())
+        if (node.isText())
+            value += node.toText().data();
+    if (!value.isEmpty())
+        writer->writeCharacters(value);
+
+    for (QDomElement child = element.firstChildElement(); !child.isNull(); child = child.nextSiblingElement())
+        writeDomElement(writer, child);
+    writer->writeEndElement();
+}
 
 class QXmppElementPrivate
 {
@@ -34,6 +81,8 @@ public:
     QXmppElementPrivate(const QDomElement &element);
     ~QXmppElementPrivate();
 
+    void materialize();
+
     QAtomicInt counter;
 
     QXmppElementPrivate *parent;
@@ -42,34 +91,40 @@ public:
     QString name;
     QString value;
 
-    QByteArray serializedSource;
+    // the element this one was parsed from, the attributes and children
+    // are only built from it when they are accessed
+    QDomElement source;
+    bool materialized;
 };
 
 QXmppElementPrivate::QXmppElementPrivate()
-    : counter(1), parent(NULL)
+    : counter(1), parent(NULL), materialized(true)
 {
 }
 
 QXmppElementPrivate::QXmppElementPrivate(const QDomElement &element)
-    : counter(1), parent(NULL)
+    : counter(1), parent(NULL), materialized(true)
 {
     if (element.isNull())
         return;
 
+    // most extensions are only forwarded, so the tree is only built
+    // when the element is accessed
     name = element.tagName();
-    QString xmlns = element.namespaceURI();
-    QString parentns = element.parentNode().namespaceURI();
-    if (!xmlns.isEmpty() && xmlns != parentns)
-        attributes.insert("xmlns", xmlns);
-    QDomNamedNodeMap attrs = element.attributes();
-    for (int i = 0; i < attrs.size(); i++)
-    {
-        QDomAttr attr = attrs.item(i).toAttr();
-        attributes.insert(attr.name(), attr.value());
-    }
+    source = element;
+    materialized = false;
+}
+
+/// Builds the attributes and children from the source element.
+
+void QXmppElementPrivate::materialize()
+{
+    if (materialized)
+        return;
+    materialized = true;
 
-    QDomNode childNode = element.firstChild();
-    while (!childNode.isNull())
+    attributes = domAttributes(source);
+    for (QDomNode childNode = source.firstChild(); !childNode.isNull(); childNode = childNode.nextSibling())
     {
         if (childNode.isElement())
         {
@@ -79,11 +134,7 @@ QXmppElementPrivate::QXmppElementPrivate(const QDomElement &element)
         } else if (childNode.isText()) {
             value += childNode.toText().data();
         }
-        childNode = childNode.nextSibling();
     }
-
-    QTextStream stream(&serializedSource);
-    element.save(stream, 0);
 }
 
 QXmppElementPrivate::~QXmppElementPrivate()
@@ -107,7 +158,7 @@ QXmppElement::QXmppElement(const QXmppElement &other)
 QXmppElement::QXmppElement(QXmppElementPrivate *other)
 {
     other->counter.ref();
-    d = new QXmppElementPrivate(*other);
+    d = other;
 }
 
 QXmppElement::QXmppElement(const QDomElement &element)
@@ -135,31 +186,27 @@ QXmppElement &QXmppElement::operator=(const QXmppElement &other)
 
 QDomElement QXmppElement::sourceDomElement() const
 {
-    if (d->serializedSource.isEmpty())
-        return QDomElement();
-
-    QDomDocument doc;
-    if (!doc.setContent(d->serializedSource, true))
-    {
-        qWarning("[QXmpp] QXmppElement::sourceDomElement(): cannot parse source element");
+    if (d->source.isNull())
         return QDomElement();
-    }
 
-    return doc.documentElement();
+    return d->source.cloneNode(true).toElement();
 }
 
 QStringList QXmppElement::attributeNames() const
 {
+    d->materialize();
     return d->attributes.keys();
 }
 
 QString QXmppElement::attribute(const QString &name) const
 {
+    d->materialize();
     return d->attributes.value(name);
 }
 
 void QXmppElement::setAttribute(const QString &name, const QString &value)
 {
+    d->materialize();
     d->attributes.insert(name, value);
 }
 
@@ -168,6 +215,8 @@ void QXmppElement::appendChild(const QXmppElement &child)
     if (child.d->parent == d)
         return;
 
+    d->materialize();
+
     if (child.d->parent)
         child.d->parent->children.removeAll(child.d);
     else
@@ -178,6 +227,7 @@ void QXmppElement::appendChild(const QXmppElement &child)
 
 QXmppElement QXmppElement::firstChildElement(const QString &name) const
 {
+    d->materialize();
     foreach (QXmppElementPrivate *child_d, d->children)
         if (name.isEmpty() || child_d->name == name)
             return QXmppElement(child_d);
@@ -217,16 +267,19 @@ QString QXmppElement::tagName() const
 
 void QXmppElement::setTagName(const QString &tagName)
 {
+    d->materialize();
     d->name = tagName;
 }
 
 QString QXmppElement::value() const
 {
+    d->materialize();
     return d->value;
 }
 
 void QXmppElement::setValue(const QString &value)
 {
+    d->materialize();
     d->value = value;
 }
 
@@ -235,12 +288,14 @@ void QXmppElement::toXml(QXmlStreamWriter *writer) const
     if (isNull())
         return;
 
+    // an element which was never accessed is written from its source
+    if (!d->materialized) {
+        writeDomElement(writer, d->source);
+        return;
+    }
+
     writer->writeStartElement(d->name);
-    if (d->attributes.contains("xmlns"))
-        writer->writeAttribute("xmlns", d->attributes.value("xmlns"));
-    foreach (const QString &attr, d->attributes.keys())
-        if (attr != "xmlns")
-            helperToXmlAddAttribute(writer, attr, d->attributes.value(attr));
+    writeAttributes(writer, d->attributes);
     if (!d->value.isEmpty())
         writer->writeCharacters(d->value);
     foreach (const QXmppElement &child, d->children)
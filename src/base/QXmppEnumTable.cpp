@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppEnumTable_p.h"
+
+/// Constructs a table from an array of \a count names, the name of each
+/// value being at its index in the array.
+///
+/// \param names
+/// \param count
+
+QXmppEnumTable::QXmppEnumTable(const char * const *names, int count)
+    : m_names(count)
+{
+    m_values.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        m_names[i] = QString::fromLatin1(names[i]);
+        m_values.insert(m_names[i], i);
+    }
+}
+
+/// Returns the number of values in the table.
+
+int QXmppEnumTable::count() const
+{
+    return m_names.size();
+}
+
+/// Returns the value whose name is \a name, or \a defaultValue if there is
+/// no such value.
+///
+/// \param name
+/// \param defaultValue
+
+int QXmppEnumTable::fromString(const QString &name, int defaultValue) const
+{
+    QHash<QString, int>::const_iterator it = m_values.constFind(name);
+    return it != m_values.constEnd() ? it.value() : defaultValue;
+}
+
+/// Returns the name of \a value, or an empty string if it is out of range.
+///
+/// The names are shared with the table, so no memory is allocated.
+///
+/// \param value
+
+QString QXmppEnumTable::toString(int value) const
+{
+    if (value < 0 || value >= m_names.size())
+        return QString();
+    return m_names.at(value);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPENUMTABLE_P_H
+#define QXMPPENUMTABLE_P_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStanza, QXmppIq, QXmppMessage and QXmppPresence classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppEnumTable class converts between the values of a protocol
+/// enum and their string representations in constant time.
+///
+/// It is built once from an array of names indexed by the enum values,
+/// usually with Q_GLOBAL_STATIC_WITH_ARGS.
+
+class QXMPP_AUTOTEST_EXPORT QXmppEnumTable
+{
+public:
+    QXmppEnumTable(const char * const *names, int count);
+
+    int count() const;
+    int fromString(const QString &name, int defaultValue = -1) const;
+    QString toString(int value) const;
+
+private:
+    QVector<QString> m_names;
+    QHash<QString, int> m_values;
+};
+
+#endif
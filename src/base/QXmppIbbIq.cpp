@@ -25,8 +25,10 @@
 #include <QDomElement>
 #include <QXmlStreamWriter>
 
+#include "QXmppBase64_p.h"
 #include "QXmppConstants.h"
 #include "QXmppIbbIq.h"
+#include "QXmppUtils.h"
 
 QXmppIbbOpenIq::QXmppIbbOpenIq() : QXmppIq(QXmppIq::Set), m_block_size(1024)
 {
@@ -53,6 +55,16 @@ void QXmppIbbOpenIq::setSid( const QString &sid )
     m_sid = sid;
 }
 
+QString QXmppIbbOpenIq::stanza() const
+{
+    return m_stanza;
+}
+
+void QXmppIbbOpenIq::setStanza(const QString &stanza)
+{
+    m_stanza = stanza;
+}
+
 /// \cond
 bool QXmppIbbOpenIq::isIbbOpenIq(const QDomElement &element)
 {
@@ -65,6 +77,7 @@ void QXmppIbbOpenIq::parseElementFromChild(const QDomElement &element)
     QDomElement openElement = element.firstChildElement("open");
     m_sid = openElement.attribute( "sid" );
     m_block_size = openElement.attribute( "block-size" ).toLong();
+    m_stanza = openElement.attribute("stanza");
 }
 
 void QXmppIbbOpenIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -73,6 +86,7 @@ void QXmppIbbOpenIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     writer->writeAttribute( "xmlns",ns_ibb);
     writer->writeAttribute( "sid",m_sid);
     writer->writeAttribute( "block-size",QString::number(m_block_size) );
+    helperToXmlAddAttribute(writer, "stanza", m_stanza);
     writer->writeEndElement();
 }
 /// \endcond
@@ -160,7 +174,7 @@ void QXmppIbbDataIq::parseElementFromChild(const QDomElement &element)
     QDomElement dataElement = element.firstChildElement("data");
     m_sid = dataElement.attribute( "sid" );
     m_seq = dataElement.attribute( "seq" ).toLong();
-    m_payload = QByteArray::fromBase64( dataElement.text().toLatin1() );
+    m_payload = QXmppBase64::decode(dataElement.text());
 }
 
 void QXmppIbbDataIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -169,7 +183,7 @@ void QXmppIbbDataIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     writer->writeAttribute( "xmlns",ns_ibb);
     writer->writeAttribute( "sid",m_sid);
     writer->writeAttribute( "seq",QString::number(m_seq) );
-    writer->writeCharacters( m_payload.toBase64() );
+    writer->writeCharacters(QXmppBase64::encode(m_payload));
     writer->writeEndElement();
 }
 /// \endcond
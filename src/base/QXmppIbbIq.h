@@ -38,6 +38,9 @@ public:
     QString sid() const;
     void setSid( const QString &sid );
 
+    QString stanza() const;
+    void setStanza(const QString &stanza);
+
     static bool isIbbOpenIq(const QDomElement &element);
 
 protected:
@@ -49,6 +52,7 @@ protected:
 private:
     long m_block_size;
     QString m_sid;
+    QString m_stanza;
 };
 
 class QXmppIbbCloseIq: public QXmppIq
@@ -24,6 +24,7 @@
 
 #include "QXmppUtils.h"
 #include "QXmppIq.h"
+#include "QXmppEnumTable_p.h"
 
 #include <QDomElement>
 #include <QXmlStreamWriter>
@@ -35,6 +36,9 @@ static const char* iq_types[] = {
     "result"
 };
 
+Q_GLOBAL_STATIC_WITH_ARGS(QXmppEnumTable, iqTypes,
+    (iq_types, int(sizeof(iq_types) / sizeof(iq_types[0]))))
+
 class QXmppIqPrivate : public QSharedData
 {
 public:
@@ -96,13 +100,7 @@ void QXmppIq::parse(const QDomElement &element)
 {
     QXmppStanza::parse(element);
 
-    const QString type = element.attribute("type");
-    for (int i = Error; i <= Result; i++) {
-        if (type == iq_types[i]) {
-            d->type = static_cast<Type>(i);
-            break;
-        }
-    }
+    d->type = static_cast<Type>(iqTypes()->fromString(element.attribute("type"), d->type));
 
     parseElementFromChild(element);
 }
@@ -126,7 +124,7 @@ void QXmppIq::toXml( QXmlStreamWriter *xmlWriter ) const
     helperToXmlAddAttribute(xmlWriter, "id", id());
     helperToXmlAddAttribute(xmlWriter, "to", to());
     helperToXmlAddAttribute(xmlWriter, "from", from());
-    helperToXmlAddAttribute(xmlWriter, "type", iq_types[d->type]);
+    helperToXmlAddAttribute(xmlWriter, "type", iqTypes()->toString(d->type));
     toXmlElementFromChild(xmlWriter);
     error().toXml(xmlWriter);
     xmlWriter->writeEndElement();
@@ -56,6 +56,16 @@ public:
     ~QXmppIq();
 
     QXmppIq& operator=(const QXmppIq &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QXmppIq(QXmppIq &&other)
+        : QXmppStanza(static_cast<QXmppStanza&&>(other)) { d.swap(other.d); }
+    QXmppIq& operator=(QXmppIq &&other)
+    {
+        QXmppStanza::operator=(static_cast<QXmppStanza&&>(other));
+        d.swap(other.d);
+        return *this;
+    }
+#endif
 
     QXmppIq::Type type() const;
     void setType(QXmppIq::Type);
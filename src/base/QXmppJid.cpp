@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppJid.h"
+
+class QXmppJidPrivate : public QSharedData
+{
+public:
+    QXmppJidPrivate();
+
+    QString jid;
+    QString bareJid;
+    uint bareJidHash;
+
+    // position of the '@' separating the user from the domain, or -1
+    int userEnd;
+    // position of the '/' separating the domain from the resource, or -1
+    int domainEnd;
+};
+
+QXmppJidPrivate::QXmppJidPrivate()
+    : bareJidHash(qHash(QString())),
+    userEnd(-1),
+    domainEnd(-1)
+{
+}
+
+/// Constructs a null JID.
+
+QXmppJid::QXmppJid()
+    : d(new QXmppJidPrivate)
+{
+}
+
+/// Constructs a JID by parsing \a jid.
+
+QXmppJid::QXmppJid(const QString &jid)
+    : d(new QXmppJidPrivate)
+{
+    d->jid = jid;
+
+    // the resource starts at the first '/' and may contain '@'
+    d->domainEnd = jid.indexOf(QLatin1Char('/'));
+    const int bareSize = d->domainEnd < 0 ? jid.size() : d->domainEnd;
+    const QChar *data = jid.constData();
+    for (int i = 0; i < bareSize; ++i) {
+        if (data[i] == QLatin1Char('@')) {
+            d->userEnd = i;
+            break;
+        }
+    }
+
+    d->bareJid = d->domainEnd < 0 ? jid : jid.left(d->domainEnd);
+    d->bareJidHash = qHash(d->bareJid);
+}
+
+/// Constructs a copy of \a other.
+
+QXmppJid::QXmppJid(const QXmppJid &other)
+    : d(other.d)
+{
+}
+
+/// Destroys the JID.
+
+QXmppJid::~QXmppJid()
+{
+}
+
+/// Assigns \a other to this JID.
+
+QXmppJid& QXmppJid::operator=(const QXmppJid &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/// Returns true if the JID is empty.
+
+bool QXmppJid::isNull() const
+{
+    return d->jid.isEmpty();
+}
+
+/// Returns true if the JID has no resource.
+
+bool QXmppJid::isBare() const
+{
+    return d->domainEnd < 0;
+}
+
+/// Returns the bare JID, i.e. the JID without its resource.
+
+QString QXmppJid::bareJid() const
+{
+    return d->bareJid;
+}
+
+/// Returns the hash of the bare JID, as computed by qHash().
+
+uint QXmppJid::bareJidHash() const
+{
+    return d->bareJidHash;
+}
+
+/// Returns the user, i.e. the part of the JID preceding the '@'.
+
+QString QXmppJid::user() const
+{
+    return d->userEnd < 0 ? QString() : d->jid.left(d->userEnd);
+}
+
+/// Returns the domain of the JID.
+
+QString QXmppJid::domain() const
+{
+    if (d->userEnd < 0)
+        return d->bareJid;
+    return d->bareJid.mid(d->userEnd + 1);
+}
+
+/// Returns the resource, i.e. the part of the JID following the '/'.
+
+QString QXmppJid::resource() const
+{
+    return d->domainEnd < 0 ? QString() : d->jid.mid(d->domainEnd + 1);
+}
+
+/// Returns the full JID as a string.
+
+QString QXmppJid::toString() const
+{
+    return d->jid;
+}
+
+/// Returns true if this JID is equal to \a other.
+
+bool QXmppJid::operator==(const QXmppJid &other) const
+{
+    return d == other.d || d->jid == other.d->jid;
+}
+
+/// Returns true if this JID is different from \a other.
+
+bool QXmppJid::operator!=(const QXmppJid &other) const
+{
+    return !(*this == other);
+}
+
+/// Returns the hash value for \a jid.
+
+uint qHash(const QXmppJid &jid)
+{
+    if (jid.isBare())
+        return jid.bareJidHash();
+    return qHash(jid.toString());
+}
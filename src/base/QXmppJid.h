@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPJID_H
+#define QXMPPJID_H
+
+#include <QHash>
+#include <QMetaType>
+#include <QSharedDataPointer>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+class QXmppJidPrivate;
+
+/// \brief The QXmppJid class holds a Jabber ID split into its components.
+///
+/// The JID is parsed once when it is constructed, after which its user,
+/// domain, resource and bare JID can be retrieved without searching the
+/// string again. The bare JID and its hash are kept, so that a QXmppJid
+/// can be used to look up tables keyed by bare JID.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppJid
+{
+public:
+    QXmppJid();
+    QXmppJid(const QString &jid);
+    QXmppJid(const QXmppJid &other);
+    ~QXmppJid();
+
+    QXmppJid& operator=(const QXmppJid &other);
+
+    bool isNull() const;
+    bool isBare() const;
+
+    QString bareJid() const;
+    uint bareJidHash() const;
+
+    QString user() const;
+    QString domain() const;
+    QString resource() const;
+
+    QString toString() const;
+
+    bool operator==(const QXmppJid &other) const;
+    bool operator!=(const QXmppJid &other) const;
+
+private:
+    QSharedDataPointer<QXmppJidPrivate> d;
+};
+
+QXMPP_EXPORT uint qHash(const QXmppJid &jid);
+
+Q_DECLARE_METATYPE(QXmppJid)
+
+#endif
@@ -27,13 +27,14 @@
 #include <QRegExp>
 
 #include "QXmppConstants.h"
+#include "QXmppElement.h"
 #include "QXmppJingleIq.h"
 #include "QXmppUtils.h"
 
 static const int RTP_COMPONENT = 1;
 
-static const char* ns_jingle_rtp_info = "urn:xmpp:jingle:apps:rtp:info:1";
-static const char* ns_jingle_dtls = "urn:xmpp:jingle:apps:dtls:0";
+static const QLatin1String ns_jingle_rtp_info("urn:xmpp:jingle:apps:rtp:info:1");
+static const QLatin1String ns_jingle_dtls("urn:xmpp:jingle:apps:dtls:0");
 
 static const char* jingle_actions[] = {
     "content-accept",
@@ -158,6 +159,7 @@ public:
     QString descriptionMedia;
     quint32 descriptionSsrc;
     QString descriptionType;
+    QXmppElement descriptionFile;
     QString transportType;
     QString transportUser;
     QString transportPassword;
@@ -167,6 +169,7 @@ public:
     QString transportFingerprintSetup;
 
     QList<QXmppJinglePayloadType> payloadTypes;
+    QList<QXmppJingleRtpCryptoElement> cryptoElements;
     QList<QXmppJingleCandidate> transportCandidates;
 };
 
@@ -272,6 +275,45 @@ void QXmppJingleIq::Content::setPayloadTypes(const QList<QXmppJinglePayloadType>
     d->payloadTypes = payloadTypes;
 }
 
+/// Returns the SRTP crypto attributes offered or accepted for the content.
+///
+/// This is used for SDP Security Descriptions as defined in XEP-0167.
+
+QList<QXmppJingleRtpCryptoElement> QXmppJingleIq::Content::cryptoElements() const
+{
+    return d->cryptoElements;
+}
+
+/// Sets the SRTP crypto attributes offered or accepted for the content.
+///
+/// This is used for SDP Security Descriptions as defined in XEP-0167.
+
+void QXmppJingleIq::Content::setCryptoElements(const QList<QXmppJingleRtpCryptoElement> &elements)
+{
+    d->cryptoElements = elements;
+}
+
+/// Returns the "file" element describing the file offered or requested
+/// for the content.
+///
+/// This is used for XEP-0234: Jingle File Transfer.
+
+QXmppElement QXmppJingleIq::Content::descriptionFile() const
+{
+    return d->descriptionFile;
+}
+
+/// Sets the "file" element describing the file offered or requested
+/// for the content.
+///
+/// This is used for XEP-0234: Jingle File Transfer.
+
+void QXmppJingleIq::Content::setDescriptionFile(const QXmppElement &file)
+{
+    d->descriptionType = file.isNull() ? QString() : ns_jingle_file_transfer;
+    d->descriptionFile = file;
+}
+
 void QXmppJingleIq::Content::addTransportCandidate(const QXmppJingleCandidate &candidate)
 {
     d->transportType = ns_jingle_ice_udp;
@@ -384,6 +426,17 @@ void QXmppJingleIq::Content::parse(const QDomElement &element)
         d->payloadTypes << payload;
         child = child.nextSiblingElement("payload-type");
     }
+    child = descriptionElement.firstChildElement("encryption").firstChildElement("crypto");
+    while (!child.isNull()) {
+        QXmppJingleRtpCryptoElement crypto;
+        crypto.parse(child);
+        d->cryptoElements << crypto;
+        child = child.nextSiblingElement("crypto");
+    }
+
+    // XEP-0234
+    if (d->descriptionType == ns_jingle_file_transfer)
+        d->descriptionFile = QXmppElement(descriptionElement.firstChildElement("file"));
 
     // transport
     QDomElement transportElement = element.firstChildElement("transport");
@@ -428,6 +481,14 @@ void QXmppJingleIq::Content::toXml(QXmlStreamWriter *writer) const
             writer->writeAttribute("ssrc", QString::number(d->descriptionSsrc));
         foreach (const QXmppJinglePayloadType &payload, d->payloadTypes)
             payload.toXml(writer);
+        if (!d->cryptoElements.isEmpty()) {
+            writer->writeStartElement("encryption");
+            foreach (const QXmppJingleRtpCryptoElement &crypto, d->cryptoElements)
+                crypto.toXml(writer);
+            writer->writeEndElement();
+        }
+        if (!d->descriptionFile.isNull())
+            d->descriptionFile.toXml(writer);
         writer->writeEndElement();
     }
 
@@ -474,6 +535,18 @@ bool QXmppJingleIq::Content::parseSdp(const QString &sdp)
                     return false;
                 }
                 addTransportCandidate(candidate);
+            } else if (attrName == "crypto") {
+                const QStringList bits = attrValue.split(' ');
+                if (bits.size() < 3) {
+                    qWarning() << "Could not parse crypto" << line;
+                    return false;
+                }
+                QXmppJingleRtpCryptoElement crypto;
+                crypto.setTag(bits[0].toInt());
+                crypto.setCryptoSuite(bits[1]);
+                crypto.setKeyParams(bits[2]);
+                crypto.setSessionParams(bits.mid(3).join(" "));
+                d->cryptoElements << crypto;
             } else if (attrName == "fingerprint") {
                 const QStringList bits = attrValue.split(' ');
                 if (bits.size() > 1) {
@@ -614,6 +687,12 @@ QString QXmppJingleIq::Content::toSdp() const
     sdp << QString("m=%1 %2 RTP/AVP%3").arg(d->descriptionMedia, QString::number(localRtpPort), payloads);
     sdp << QString("c=%1").arg(addressToSdp(localRtpAddress));
     sdp += attrs;
+    foreach (const QXmppJingleRtpCryptoElement &crypto, d->cryptoElements) {
+        QString attr = QString("a=crypto:%1 %2 %3").arg(QString::number(crypto.tag()), crypto.cryptoSuite(), crypto.keyParams());
+        if (!crypto.sessionParams().isEmpty())
+            attr += " " + crypto.sessionParams();
+        sdp << attr;
+    }
 
     // transport
     foreach (const QXmppJingleCandidate &candidate, d->transportCandidates)
@@ -698,13 +777,17 @@ class QXmppJingleIqPrivate : public QSharedData
 {
 public:
     QXmppJingleIqPrivate();
+    void parseContents() const;
 
     QXmppJingleIq::Action action;
     QString initiator;
     QString responder;
     QString sid;
 
-    QList<QXmppJingleIq::Content> contents;
+    // the "jingle" element the contents were received in, they are only
+    // parsed when they are accessed
+    mutable QDomElement contentSource;
+    mutable QList<QXmppJingleIq::Content> contents;
     QXmppJingleIq::Reason reason;
     bool ringing;
 };
@@ -714,6 +797,23 @@ QXmppJingleIqPrivate::QXmppJingleIqPrivate()
 {
 }
 
+/// Parses the contents which were received, if they were not parsed yet.
+
+void QXmppJingleIqPrivate::parseContents() const
+{
+    if (contentSource.isNull())
+        return;
+
+    QDomElement contentElement = contentSource.firstChildElement("content");
+    while (!contentElement.isNull()) {
+        QXmppJingleIq::Content content;
+        content.parse(contentElement);
+        contents << content;
+        contentElement = contentElement.nextSiblingElement("content");
+    }
+    contentSource = QDomElement();
+}
+
 /// Constructs a QXmppJingleIq.
 
 QXmppJingleIq::QXmppJingleIq()
@@ -765,13 +865,20 @@ void QXmppJingleIq::setAction(QXmppJingleIq::Action action)
 
 void QXmppJingleIq::addContent(const QXmppJingleIq::Content &content)
 {
+    d->parseContents();
     d->contents << content;
 }
 
 /// Returns the IQ's content elements.
+///
+/// The content elements of a received IQ, including their descriptions
+/// and transports, are only parsed when this method is first called. An
+/// IQ which is forwarded without its contents being accessed writes the
+/// content elements it received as they are.
 
 QList<QXmppJingleIq::Content> QXmppJingleIq::contents() const
 {
+    d->parseContents();
     return d->contents;
 }
 
@@ -779,6 +886,7 @@ QList<QXmppJingleIq::Content> QXmppJingleIq::contents() const
 
 void QXmppJingleIq::setContents(const QList<QXmppJingleIq::Content> &contents)
 {
+    d->contentSource = QDomElement();
     d->contents = contents;
 }
 
@@ -881,15 +989,13 @@ void QXmppJingleIq::parseElementFromChild(const QDomElement &element)
     d->responder = jingleElement.attribute("responder");
     d->sid = jingleElement.attribute("sid");
 
-    // content
+    // content, which is parsed on access
     d->contents.clear();
-    QDomElement contentElement = jingleElement.firstChildElement("content");
-    while (!contentElement.isNull()) {
-        QXmppJingleIq::Content content;
-        content.parse(contentElement);
-        addContent(content);
-        contentElement = contentElement.nextSiblingElement("content");
-    }
+    if (!jingleElement.firstChildElement("content").isNull())
+        d->contentSource = jingleElement;
+    else
+        d->contentSource = QDomElement();
+
     QDomElement reasonElement = jingleElement.firstChildElement("reason");
     d->reason.parse(reasonElement);
 
@@ -906,8 +1012,17 @@ void QXmppJingleIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     helperToXmlAddAttribute(writer, "initiator", d->initiator);
     helperToXmlAddAttribute(writer, "responder", d->responder);
     helperToXmlAddAttribute(writer, "sid", d->sid);
-    foreach (const QXmppJingleIq::Content &content, d->contents)
-        content.toXml(writer);
+    if (!d->contentSource.isNull()) {
+        // the contents were not accessed, write them as they were received
+        QDomElement contentElement = d->contentSource.firstChildElement("content");
+        while (!contentElement.isNull()) {
+            QXmppElement(contentElement).toXml(writer);
+            contentElement = contentElement.nextSiblingElement("content");
+        }
+    } else {
+        foreach (const QXmppJingleIq::Content &content, d->contents)
+            content.toXml(writer);
+    }
     d->reason.toXml(writer);
 
     // ringing
@@ -1452,3 +1567,132 @@ bool QXmppJinglePayloadType::operator==(const QXmppJinglePayloadType &other) con
                other.d->clockrate == d->clockrate &&
                other.d->name.toLower() == d->name.toLower();
 }
+
+class QXmppJingleRtpCryptoElementPrivate : public QSharedData
+{
+public:
+    QXmppJingleRtpCryptoElementPrivate();
+
+    QString cryptoSuite;
+    QString keyParams;
+    QString sessionParams;
+    int tag;
+};
+
+QXmppJingleRtpCryptoElementPrivate::QXmppJingleRtpCryptoElementPrivate()
+    : tag(0)
+{
+}
+
+QXmppJingleRtpCryptoElement::QXmppJingleRtpCryptoElement()
+    : d(new QXmppJingleRtpCryptoElementPrivate())
+{
+}
+
+/// Constructs a copy of other.
+///
+/// \param other
+
+QXmppJingleRtpCryptoElement::QXmppJingleRtpCryptoElement(const QXmppJingleRtpCryptoElement &other)
+    : d(other.d)
+{
+}
+
+QXmppJingleRtpCryptoElement::~QXmppJingleRtpCryptoElement()
+{
+}
+
+/// Returns the crypto suite, for instance "AES_CM_128_HMAC_SHA1_80".
+
+QString QXmppJingleRtpCryptoElement::cryptoSuite() const
+{
+    return d->cryptoSuite;
+}
+
+/// Sets the crypto suite, for instance "AES_CM_128_HMAC_SHA1_80".
+///
+/// \param suite
+
+void QXmppJingleRtpCryptoElement::setCryptoSuite(const QString &suite)
+{
+    d->cryptoSuite = suite;
+}
+
+/// Returns the key parameters, for instance "inline:" followed by the
+/// base64-encoded master key and salt.
+
+QString QXmppJingleRtpCryptoElement::keyParams() const
+{
+    return d->keyParams;
+}
+
+/// Sets the key parameters.
+///
+/// \param params
+
+void QXmppJingleRtpCryptoElement::setKeyParams(const QString &params)
+{
+    d->keyParams = params;
+}
+
+/// Returns the session parameters.
+
+QString QXmppJingleRtpCryptoElement::sessionParams() const
+{
+    return d->sessionParams;
+}
+
+/// Sets the session parameters.
+///
+/// \param params
+
+void QXmppJingleRtpCryptoElement::setSessionParams(const QString &params)
+{
+    d->sessionParams = params;
+}
+
+/// Returns the tag which identifies the crypto attribute in an offer.
+
+int QXmppJingleRtpCryptoElement::tag() const
+{
+    return d->tag;
+}
+
+/// Sets the tag which identifies the crypto attribute in an offer.
+///
+/// \param tag
+
+void QXmppJingleRtpCryptoElement::setTag(int tag)
+{
+    d->tag = tag;
+}
+
+/// \cond
+void QXmppJingleRtpCryptoElement::parse(const QDomElement &element)
+{
+    d->cryptoSuite = element.attribute("crypto-suite");
+    d->keyParams = element.attribute("key-params");
+    d->sessionParams = element.attribute("session-params");
+    d->tag = element.attribute("tag").toInt();
+}
+
+void QXmppJingleRtpCryptoElement::toXml(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement("crypto");
+    helperToXmlAddAttribute(writer, "crypto-suite", d->cryptoSuite);
+    helperToXmlAddAttribute(writer, "key-params", d->keyParams);
+    helperToXmlAddAttribute(writer, "session-params", d->sessionParams);
+    helperToXmlAddAttribute(writer, "tag", QString::number(d->tag));
+    writer->writeEndElement();
+}
+/// \endcond
+
+/// Assigns the other crypto attribute to this one.
+///
+/// \param other
+
+QXmppJingleRtpCryptoElement& QXmppJingleRtpCryptoElement::operator=(const QXmppJingleRtpCryptoElement& other)
+{
+    d = other.d;
+    return *this;
+}
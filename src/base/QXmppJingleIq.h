@@ -32,6 +32,7 @@ class QXmppJingleCandidatePrivate;
 class QXmppJingleIqContentPrivate;
 class QXmppJingleIqPrivate;
 class QXmppJinglePayloadTypePrivate;
+class QXmppJingleRtpCryptoElementPrivate;
 
 /// \brief The QXmppJinglePayloadType class represents a payload type
 /// as specified by XEP-0167: Jingle RTP Sessions and RFC 5245.
@@ -77,6 +78,40 @@ private:
     QSharedDataPointer<QXmppJinglePayloadTypePrivate> d;
 };
 
+/// \brief The QXmppJingleRtpCryptoElement class represents an SRTP crypto
+/// attribute as specified by XEP-0167: Jingle RTP Sessions and RFC 4568.
+///
+
+class QXMPP_EXPORT QXmppJingleRtpCryptoElement
+{
+public:
+    QXmppJingleRtpCryptoElement();
+    QXmppJingleRtpCryptoElement(const QXmppJingleRtpCryptoElement &other);
+    ~QXmppJingleRtpCryptoElement();
+
+    QString cryptoSuite() const;
+    void setCryptoSuite(const QString &suite);
+
+    QString keyParams() const;
+    void setKeyParams(const QString &params);
+
+    QString sessionParams() const;
+    void setSessionParams(const QString &params);
+
+    int tag() const;
+    void setTag(int tag);
+
+    /// \cond
+    void parse(const QDomElement &element);
+    void toXml(QXmlStreamWriter *writer) const;
+    /// \endcond
+
+    QXmppJingleRtpCryptoElement& operator=(const QXmppJingleRtpCryptoElement &other);
+
+private:
+    QSharedDataPointer<QXmppJingleRtpCryptoElementPrivate> d;
+};
+
 /// \brief The QXmppJingleCandidate class represents a transport candidate
 /// as specified by XEP-0176: Jingle ICE-UDP Transport Method.
 ///
@@ -207,6 +242,13 @@ public:
         QList<QXmppJinglePayloadType> payloadTypes() const;
         void setPayloadTypes(const QList<QXmppJinglePayloadType> &payloadTypes);
 
+        QList<QXmppJingleRtpCryptoElement> cryptoElements() const;
+        void setCryptoElements(const QList<QXmppJingleRtpCryptoElement> &elements);
+
+        // XEP-0234: Jingle File Transfer
+        QXmppElement descriptionFile() const;
+        void setDescriptionFile(const QXmppElement &file);
+
         void addTransportCandidate(const QXmppJingleCandidate &candidate);
         QList<QXmppJingleCandidate> transportCandidates() const;
         void setTransportCandidates(const QList<QXmppJingleCandidate> &candidates);
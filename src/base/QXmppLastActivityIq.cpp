@@ -76,7 +76,8 @@ void QXmppLastActivityIq::toXmlElementFromChild(QXmlStreamWriter* writer) const
 {
     writer->writeStartElement("query");
     writer->writeAttribute("xmlns", ns_last_activity);
-    if (d->seconds)
+    // the idle time is required in responses, even if it is zero
+    if (d->seconds || type() == QXmppIq::Result)
         writer->writeAttribute("seconds", QString::number(d->seconds));
     if (!d->status.isNull())
         writer->writeCharacters(d->status);
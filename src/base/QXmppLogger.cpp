@@ -27,10 +27,14 @@
 #include <QChildEvent>
 #include <QDateTime>
 #include <QFile>
+#include <QList>
 #include <QMetaType>
-#include <QTextStream>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
 
 #include "QXmppLogger.h"
+#include "QXmppMetrics.h"
 
 QXmppLogger* QXmppLogger::m_logger = 0;
 
@@ -103,22 +107,249 @@ void QXmppLoggable::childEvent(QChildEvent *event)
 }
 /// \endcond
 
+/// Returns true if log messages of the given \a type are handled by anyone.
+///
+/// This can be used to avoid formatting messages which would be discarded,
+/// for instance because no QXmppLogger is attached or because the logger's
+/// messageTypes() exclude them.
+///
+/// \param type
+
+bool QXmppLoggable::isLogging(QXmppLogger::MessageType type) const
+{
+    // follow the relays up to the top-level loggable
+    const QXmppLoggable *loggable = this;
+    int count;
+    for (;;) {
+        count = loggable->receivers(SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
+        if (!count)
+            return false;
+
+        QXmppLoggable *logParent = qobject_cast<QXmppLoggable*>(loggable->parent());
+        if (!logParent)
+            break;
+        else if (count > 1)
+            return true;
+        loggable = logParent;
+    }
+
+    // if the messages only go to a logger, check its settings
+    QXmppLogger *logger = qobject_cast<QXmppLogger*>(loggable->property("logger").value<QObject*>());
+    if (!logger || count > 1)
+        return true;
+    return logger->loggingType() != QXmppLogger::NoLogging &&
+           logger->messageTypes().testFlag(type);
+}
+
+// Writes log lines to a file or to the standard output, either directly or
+// in batches from a separate thread so that the logging thread never waits
+// for the disk.
+
+class QXmppLogWriter : public QThread
+{
+public:
+    QXmppLogWriter();
+    ~QXmppLogWriter();
+
+    void close();
+    bool enqueue(const QByteArray &line);
+    void flush();
+    void startWriting();
+    void stopWriting();
+    void write(const QList<QByteArray> &lines);
+
+    // settings, only changed while the thread is stopped
+    QXmppLogger::LoggingType loggingType;
+    QString filePath;
+    int bufferSize;
+    qint64 maximumFileSize;
+    int rotationInterval;
+
+protected:
+    void run();
+
+private:
+    void closeFile();
+    void openFile();
+
+    QMutex mutex;
+    QWaitCondition queueChanged;
+    QWaitCondition queueWritten;
+    QList<QByteArray> queue;
+    bool reopenRequested;
+    bool stopping;
+    bool writing;
+
+    // only used by the thread which writes
+    QFile *file;
+    QDateTime fileOpened;
+};
+
+QXmppLogWriter::QXmppLogWriter()
+    : loggingType(QXmppLogger::NoLogging)
+    , filePath("QXmppClientLog.log")
+    , bufferSize(0)
+    , maximumFileSize(0)
+    , rotationInterval(0)
+    , reopenRequested(false)
+    , stopping(false)
+    , writing(false)
+    , file(0)
+{
+}
+
+QXmppLogWriter::~QXmppLogWriter()
+{
+    stopWriting();
+    closeFile();
+}
+
+// Closes the file, it is opened again for the next message.
+
+void QXmppLogWriter::close()
+{
+    if (isRunning()) {
+        QMutexLocker locker(&mutex);
+        reopenRequested = true;
+        queueChanged.wakeOne();
+    } else {
+        closeFile();
+    }
+}
+
+// Queues a line for the thread, returns false if the buffer is full.
+
+bool QXmppLogWriter::enqueue(const QByteArray &line)
+{
+    QMutexLocker locker(&mutex);
+    if (queue.size() >= bufferSize)
+        return false;
+    queue << line;
+    if (queue.size() == 1)
+        queueChanged.wakeOne();
+    return true;
+}
+
+// Waits for the queued lines to be written.
+
+void QXmppLogWriter::flush()
+{
+    QMutexLocker locker(&mutex);
+    while (isRunning() && (!queue.isEmpty() || writing))
+        queueWritten.wait(&mutex);
+}
+
+void QXmppLogWriter::startWriting()
+{
+    if (isRunning())
+        return;
+    stopping = false;
+    start(QThread::LowPriority);
+}
+
+// Stops the thread once it has written the queued lines.
+
+void QXmppLogWriter::stopWriting()
+{
+    if (!isRunning())
+        return;
+
+    mutex.lock();
+    stopping = true;
+    queueChanged.wakeOne();
+    mutex.unlock();
+    wait();
+}
+
+void QXmppLogWriter::run()
+{
+    QMutexLocker locker(&mutex);
+    for (;;) {
+        while (queue.isEmpty() && !reopenRequested && !stopping)
+            queueChanged.wait(&mutex);
+        if (queue.isEmpty() && !reopenRequested)
+            break;
+
+        // write the lines which were queued meanwhile in one go
+        const QList<QByteArray> lines = queue;
+        const bool reopen = reopenRequested;
+        queue.clear();
+        reopenRequested = false;
+        writing = true;
+        locker.unlock();
+
+        if (reopen)
+            closeFile();
+        write(lines);
+
+        locker.relock();
+        writing = false;
+        queueWritten.wakeAll();
+    }
+    locker.unlock();
+    closeFile();
+}
+
+void QXmppLogWriter::write(const QList<QByteArray> &lines)
+{
+    if (lines.isEmpty())
+        return;
+
+    if (loggingType == QXmppLogger::StdoutLogging) {
+        foreach (const QByteArray &line, lines)
+            std::cout.write(line.constData(), line.size());
+        std::cout.flush();
+        return;
+    }
+
+    QByteArray data;
+    foreach (const QByteArray &line, lines)
+        data += line;
+
+    if (!file)
+        openFile();
+
+    // rotate the file, keeping the previous one with a ".1" suffix
+    if ((maximumFileSize > 0 && file->size() > 0 && file->size() + data.size() > maximumFileSize) ||
+        (rotationInterval > 0 && fileOpened.secsTo(QDateTime::currentDateTime()) >= rotationInterval)) {
+        closeFile();
+        QFile::remove(filePath + ".1");
+        QFile::rename(filePath, filePath + ".1");
+        openFile();
+    }
+
+    file->write(data);
+    file->flush();
+}
+
+void QXmppLogWriter::closeFile()
+{
+    if (file) {
+        delete file;
+        file = 0;
+    }
+}
+
+void QXmppLogWriter::openFile()
+{
+    file = new QFile(filePath);
+    file->open(QIODevice::WriteOnly | QIODevice::Append);
+    fileOpened = QDateTime::currentDateTime();
+}
+
 class QXmppLoggerPrivate
 {
 public:
     QXmppLoggerPrivate();
 
-    QXmppLogger::LoggingType loggingType;
-    QFile *logFile;
-    QString logFilePath;
     QXmppLogger::MessageTypes messageTypes;
+    qint64 droppedMessages;
+    QXmppLogWriter writer;
 };
 
 QXmppLoggerPrivate::QXmppLoggerPrivate()
-    : loggingType(QXmppLogger::NoLogging)
-    , logFile(0)
-    , logFilePath("QXmppClientLog.log")
-    , messageTypes(QXmppLogger::AnyMessage)
+    : messageTypes(QXmppLogger::AnyMessage)
+    , droppedMessages(0)
 {
 }
 
@@ -155,7 +386,7 @@ QXmppLogger* QXmppLogger::getLogger()
 
 QXmppLogger::LoggingType QXmppLogger::loggingType()
 {
-    return d->loggingType;
+    return d->writer.loggingType;
 }
 
 /// Sets the handler for logging messages.
@@ -164,8 +395,9 @@ QXmppLogger::LoggingType QXmppLogger::loggingType()
 
 void QXmppLogger::setLoggingType(QXmppLogger::LoggingType type)
 {
-    if (d->loggingType != type) {
-        d->loggingType = type;
+    if (d->writer.loggingType != type) {
+        d->writer.stopWriting();
+        d->writer.loggingType = type;
         reopen();
     }
 }
@@ -187,6 +419,85 @@ void QXmppLogger::setMessageTypes(QXmppLogger::MessageTypes types)
     d->messageTypes = types;
 }
 
+/// Returns the maximum number of messages waiting to be written.
+///
+
+int QXmppLogger::bufferSize() const
+{
+    return d->writer.bufferSize;
+}
+
+/// Sets the maximum number of messages waiting to be written.
+///
+/// When non-zero, messages logged to a file or to the standard output are
+/// written in batches by a separate thread, so that logging does not wait
+/// for the disk. If the thread falls behind by more than \a size messages,
+/// new messages are dropped and counted in droppedMessages().
+///
+/// The default value is 0, meaning messages are written as they are logged.
+///
+/// \param size
+
+void QXmppLogger::setBufferSize(int size)
+{
+    d->writer.stopWriting();
+    d->writer.bufferSize = size;
+}
+
+/// Returns the size in bytes from which the log file is rotated.
+///
+
+qint64 QXmppLogger::maximumFileSize() const
+{
+    return d->writer.maximumFileSize;
+}
+
+/// Sets the size in bytes from which the log file is rotated.
+///
+/// When writing would make the log file exceed \a size, it is renamed with
+/// a ".1" suffix, replacing any previous one, and a new file is started.
+///
+/// The default value is 0, meaning the file is not rotated by size.
+///
+/// \param size
+
+void QXmppLogger::setMaximumFileSize(qint64 size)
+{
+    d->writer.stopWriting();
+    d->writer.maximumFileSize = size;
+}
+
+/// Returns the interval in seconds after which the log file is rotated.
+///
+
+int QXmppLogger::rotationInterval() const
+{
+    return d->writer.rotationInterval;
+}
+
+/// Sets the interval in seconds after which the log file is rotated,
+/// counted from the time it was opened.
+///
+/// The default value is 0, meaning the file is not rotated by time.
+///
+/// \param seconds
+
+void QXmppLogger::setRotationInterval(int seconds)
+{
+    d->writer.stopWriting();
+    d->writer.rotationInterval = seconds;
+}
+
+/// Returns the number of messages which were dropped because the buffer
+/// was full.
+///
+/// \sa setBufferSize()
+
+qint64 QXmppLogger::droppedMessages() const
+{
+    return d->droppedMessages;
+}
+
 /// Add a logging message.
 ///
 /// \param type
@@ -198,18 +509,21 @@ void QXmppLogger::log(QXmppLogger::MessageType type, const QString& text)
     if (!d->messageTypes.testFlag(type))
         return;
 
-    switch(d->loggingType)
+    switch(d->writer.loggingType)
     {
     case QXmppLogger::FileLogging:
-        if (!d->logFile) {
-            d->logFile = new QFile(d->logFilePath);
-            d->logFile->open(QIODevice::WriteOnly | QIODevice::Append);
-        }
-        QTextStream(d->logFile) << formatted(type, text) << "\n";
-        break;
     case QXmppLogger::StdoutLogging:
-        std::cout << qPrintable(formatted(type, text)) << std::endl;
+    {
+        const QByteArray line = QString(formatted(type, text) + "\n").toLocal8Bit();
+        if (d->writer.bufferSize > 0) {
+            d->writer.startWriting();
+            if (!d->writer.enqueue(line))
+                d->droppedMessages++;
+        } else {
+            d->writer.write(QList<QByteArray>() << line);
+        }
         break;
+    }
     case QXmppLogger::SignalLogging:
         emit message(type, text);
         break;
@@ -220,22 +534,20 @@ void QXmppLogger::log(QXmppLogger::MessageType type, const QString& text)
 
 /// Sets the given \a gauge to \a value.
 ///
-/// NOTE: the base implementation does nothing.
+/// NOTE: the base implementation records the value in QXmppMetrics.
 
 void QXmppLogger::setGauge(const QString &gauge, double value)
 {
-    Q_UNUSED(gauge);
-    Q_UNUSED(value);
+    QXmppMetrics::setGauge(QXmppMetrics::gauge(gauge), value);
 }
 
 /// Updates the given \a counter by \a amount.
 ///
-/// NOTE: the base implementation does nothing.
+/// NOTE: the base implementation records the value in QXmppMetrics.
 
 void QXmppLogger::updateCounter(const QString &counter, qint64 amount)
 {
-    Q_UNUSED(counter);
-    Q_UNUSED(amount);
+    QXmppMetrics::updateCounter(QXmppMetrics::counter(counter), amount);
 }
 
 /// Returns the path to which logging messages should be written.
@@ -244,7 +556,7 @@ void QXmppLogger::updateCounter(const QString &counter, qint64 amount)
 
 QString QXmppLogger::logFilePath()
 {
-    return d->logFilePath;
+    return d->writer.filePath;
 }
 
 /// Sets the path to which logging messages should be written.
@@ -255,8 +567,9 @@ QString QXmppLogger::logFilePath()
 
 void QXmppLogger::setLogFilePath(const QString &path)
 {
-    if (d->logFilePath != path) {
-        d->logFilePath = path;
+    if (d->writer.filePath != path) {
+        d->writer.stopWriting();
+        d->writer.filePath = path;
         reopen();
     }
 }
@@ -266,9 +579,15 @@ void QXmppLogger::setLogFilePath(const QString &path)
 
 void QXmppLogger::reopen()
 {
-    if (d->logFile) {
-        delete d->logFile;
-        d->logFile = 0;
-    }
+    d->writer.close();
+}
+
+/// Waits for the messages which are buffered to be written.
+///
+/// \sa setBufferSize()
+
+void QXmppLogger::flush()
+{
+    d->writer.flush();
 }
 
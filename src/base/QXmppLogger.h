@@ -36,6 +36,20 @@
 #define qxmpp_loggable_trace(x) (x)
 #endif
 
+// These macros log a message from a QXmppLoggable, only building the
+// message if it will be handled. Debugging messages can be left out at
+// compile time by defining QXMPP_NO_DEBUG_OUTPUT.
+#define qxmpp_loggable_log(type, function, x) do { if (isLogging(type)) function(x); } while (0)
+#ifdef QXMPP_NO_DEBUG_OUTPUT
+#define qxmpp_debug(x) do { } while (0)
+#else
+#define qxmpp_debug(x) qxmpp_loggable_log(QXmppLogger::DebugMessage, debug, x)
+#endif
+#define qxmpp_info(x) qxmpp_loggable_log(QXmppLogger::InformationMessage, info, x)
+#define qxmpp_warning(x) qxmpp_loggable_log(QXmppLogger::WarningMessage, warning, x)
+#define qxmpp_log_received(x) qxmpp_loggable_log(QXmppLogger::ReceivedMessage, logReceived, x)
+#define qxmpp_log_sent(x) qxmpp_loggable_log(QXmppLogger::SentMessage, logSent, x)
+
 class QXmppLoggerPrivate;
 
 /// \brief The QXmppLogger class represents a sink for logging messages.
@@ -50,6 +64,9 @@ class QXMPP_EXPORT QXmppLogger : public QObject
     Q_PROPERTY(QString logFilePath READ logFilePath WRITE setLogFilePath)
     Q_PROPERTY(LoggingType loggingType READ loggingType WRITE setLoggingType)
     Q_PROPERTY(MessageTypes messageTypes READ messageTypes WRITE setMessageTypes)
+    Q_PROPERTY(int bufferSize READ bufferSize WRITE setBufferSize)
+    Q_PROPERTY(qint64 maximumFileSize READ maximumFileSize WRITE setMaximumFileSize)
+    Q_PROPERTY(int rotationInterval READ rotationInterval WRITE setRotationInterval)
 
 public:
     /// This enum describes how log message are handled.
@@ -88,12 +105,24 @@ public:
     QXmppLogger::MessageTypes messageTypes();
     void setMessageTypes(QXmppLogger::MessageTypes types);
 
+    int bufferSize() const;
+    void setBufferSize(int size);
+
+    qint64 maximumFileSize() const;
+    void setMaximumFileSize(qint64 size);
+
+    int rotationInterval() const;
+    void setRotationInterval(int seconds);
+
+    qint64 droppedMessages() const;
+
 public slots:
     virtual void setGauge(const QString &gauge, double value);
     virtual void updateCounter(const QString &counter, qint64 amount);
 
     void log(QXmppLogger::MessageType type, const QString& text);
     void reopen();
+    void flush();
 
 signals:
     /// This signal is emitted whenever a log message is received.
@@ -120,6 +149,12 @@ protected:
     virtual void childEvent(QChildEvent *event);
     /// \endcond
 
+    bool isLogging(QXmppLogger::MessageType type) const;
+
+    // NOTE: to avoid building messages which are discarded, use the
+    // qxmpp_debug(), qxmpp_info(), qxmpp_warning(), qxmpp_log_received()
+    // and qxmpp_log_sent() macros instead of the methods below.
+
     /// Logs a debugging message.
     ///
     /// \param message
@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QAtomicInt>
+#include <QSharedMemory>
+
+#include "QXmppMediaRing.h"
+
+// "QXMR", followed by the layout version
+static const quint32 ringMagic = 0x514d5201;
+
+// the alignment of the slots' data
+static const int ringAlignment = 64;
+
+static int alignSize(int size)
+{
+    return (size + ringAlignment - 1) & ~(ringAlignment - 1);
+}
+
+// The ring is made of a header, followed by the slot descriptors, followed
+// by the slots' data. Only plain types and atomic integers are used, as the
+// memory may be mapped by processes built against another version of Qt.
+
+struct QXmppMediaRingHeader
+{
+    quint32 magic;
+    qint32 slotCount;
+    qint32 slotSize;
+    QBasicAtomicInt published;
+    QBasicAtomicInt dropped;
+};
+
+struct QXmppMediaRingSlot
+{
+    // the number of consumers holding the slot, or -1 while it is written
+    QBasicAtomicInt references;
+    QBasicAtomicInt sequence;
+    qint32 type;
+    qint32 size;
+    qint64 timestamp;
+    qint32 clockrate;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    qint32 pixelFormat;
+};
+
+class QXmppMediaRingPrivate
+{
+public:
+    QXmppMediaRingPrivate();
+    bool map(char *memory);
+    QXmppMediaRingSlot *slot(int index) const;
+    uchar *slotData(int index) const;
+
+    QString key;
+    QSharedMemory *shared;
+    QByteArray local;
+
+    QXmppMediaRingHeader *header;
+    char *memory;
+    int slotCount;
+    int slotSize;
+
+    // producer state
+    quint32 writeSequence;
+    int reservedSlot;
+
+    // consumer state
+    quint32 readSequence;
+};
+
+QXmppMediaRingPrivate::QXmppMediaRingPrivate()
+    : shared(0)
+    , header(0)
+    , memory(0)
+    , slotCount(0)
+    , slotSize(0)
+    , writeSequence(0)
+    , reservedSlot(-1)
+    , readSequence(0)
+{
+}
+
+bool QXmppMediaRingPrivate::map(char *data)
+{
+    QXmppMediaRingHeader *ringHeader = reinterpret_cast<QXmppMediaRingHeader*>(data);
+    if (ringHeader->magic != ringMagic || ringHeader->slotCount <= 0 || ringHeader->slotSize <= 0)
+        return false;
+
+    header = ringHeader;
+    memory = data;
+    slotCount = header->slotCount;
+    slotSize = header->slotSize;
+    writeSequence = quint32(header->published.fetchAndAddOrdered(0));
+    readSequence = writeSequence;
+    reservedSlot = -1;
+    return true;
+}
+
+QXmppMediaRingSlot *QXmppMediaRingPrivate::slot(int index) const
+{
+    return reinterpret_cast<QXmppMediaRingSlot*>(memory + alignSize(sizeof(QXmppMediaRingHeader))) + index;
+}
+
+uchar *QXmppMediaRingPrivate::slotData(int index) const
+{
+    const int offset = alignSize(sizeof(QXmppMediaRingHeader))
+                     + alignSize(slotCount * sizeof(QXmppMediaRingSlot))
+                     + index * slotSize;
+    return reinterpret_cast<uchar*>(memory + offset);
+}
+
+QXmppMediaRing::Frame::Frame()
+    : type(AudioMedia)
+    , sequence(0)
+    , timestamp(0)
+    , size(0)
+    , clockrate(0)
+    , width(0)
+    , height(0)
+    , bytesPerLine(0)
+    , pixelFormat(0)
+    , data(0)
+    , slot(-1)
+{
+}
+
+/// Constructs an invalid ring, call create() or attach() to use it.
+
+QXmppMediaRing::QXmppMediaRing()
+    : d(new QXmppMediaRingPrivate)
+{
+}
+
+/// Destroys the ring, detaching it from the shared memory.
+
+QXmppMediaRing::~QXmppMediaRing()
+{
+    detach();
+    delete d;
+}
+
+/// Creates a ring of \a slotCount slots holding up to \a slotSize bytes.
+///
+/// If \a key is empty the ring lives in private memory and can only be
+/// used within the process, otherwise it is created in shared memory and
+/// other processes can attach() to it.
+///
+/// \param key
+/// \param slotCount
+/// \param slotSize
+
+bool QXmppMediaRing::create(const QString &key, int slotCount, int slotSize)
+{
+    detach();
+    if (slotCount <= 0 || slotSize <= 0)
+        return false;
+
+    slotSize = alignSize(slotSize);
+    const int size = alignSize(sizeof(QXmppMediaRingHeader))
+                   + alignSize(slotCount * sizeof(QXmppMediaRingSlot))
+                   + slotCount * slotSize;
+
+    char *data = 0;
+    if (key.isEmpty()) {
+        d->local.resize(size + ringAlignment);
+        data = d->local.data();
+        data += (ringAlignment - (quintptr(data) & (ringAlignment - 1))) & (ringAlignment - 1);
+    } else {
+        d->shared = new QSharedMemory(key);
+        if (!d->shared->create(size)) {
+            delete d->shared;
+            d->shared = 0;
+            return false;
+        }
+        data = static_cast<char*>(d->shared->data());
+    }
+
+    // the magic is written last, so that consumers do not attach to a
+    // partially initialized ring
+    memset(data, 0, size);
+    QXmppMediaRingHeader *header = reinterpret_cast<QXmppMediaRingHeader*>(data);
+    header->slotCount = slotCount;
+    header->slotSize = slotSize;
+    header->published.fetchAndStoreOrdered(0);
+    header->magic = ringMagic;
+
+    d->key = key;
+    return d->map(data);
+}
+
+/// Attaches to the ring created in shared memory with the given \a key.
+///
+/// Only the frames published after attaching are returned by acquire().
+///
+/// \param key
+
+bool QXmppMediaRing::attach(const QString &key)
+{
+    detach();
+
+    d->shared = new QSharedMemory(key);
+    if (!d->shared->attach() ||
+        d->shared->size() < int(sizeof(QXmppMediaRingHeader)) ||
+        !d->map(static_cast<char*>(d->shared->data()))) {
+        detach();
+        return false;
+    }
+    d->key = key;
+    return true;
+}
+
+/// Detaches from the ring.
+///
+/// The shared memory is destroyed once the last process detaches from it.
+
+void QXmppMediaRing::detach()
+{
+    if (d->shared) {
+        d->shared->detach();
+        delete d->shared;
+        d->shared = 0;
+    }
+    d->local.clear();
+    d->header = 0;
+    d->memory = 0;
+    d->slotCount = 0;
+    d->slotSize = 0;
+    d->key.clear();
+}
+
+/// Returns true if the ring was created or attached.
+
+bool QXmppMediaRing::isValid() const
+{
+    return d->header != 0;
+}
+
+/// Returns the key of the shared memory, or an empty string for a private ring.
+
+QString QXmppMediaRing::key() const
+{
+    return d->key;
+}
+
+/// Returns the number of slots of the ring.
+
+int QXmppMediaRing::slotCount() const
+{
+    return d->slotCount;
+}
+
+/// Returns the size of the slots of the ring, in bytes.
+
+int QXmppMediaRing::slotSize() const
+{
+    return d->slotSize;
+}
+
+/// Returns the number of frames the producer dropped, either because they
+/// were too large or because their slot was still held by a consumer.
+
+quint32 QXmppMediaRing::droppedFrames() const
+{
+    return d->header ? quint32(d->header->dropped.fetchAndAddOrdered(0)) : 0;
+}
+
+/// Reserves the next slot for a frame of \a size bytes, and returns a
+/// pointer to its data so that the frame can be written in place.
+///
+/// The frame becomes visible to the consumers once publish() is called.
+/// Returns 0 and counts a dropped frame if no slot is available.
+///
+/// \param size
+
+uchar *QXmppMediaRing::reserve(int size)
+{
+    if (!d->header)
+        return 0;
+    if (size > d->slotSize) {
+        d->header->dropped.fetchAndAddOrdered(1);
+        return 0;
+    }
+
+    // a slot which was reserved but not published is reused
+    if (d->reservedSlot >= 0)
+        return d->slotData(d->reservedSlot);
+
+    const int index = (d->writeSequence + 1) % d->slotCount;
+    if (!d->slot(index)->references.testAndSetOrdered(0, -1)) {
+        d->header->dropped.fetchAndAddOrdered(1);
+        return 0;
+    }
+    d->reservedSlot = index;
+    return d->slotData(index);
+}
+
+/// Returns the data of the slot reserved by reserve() which was not
+/// published yet, or 0 if there is none.
+
+uchar *QXmppMediaRing::reservation() const
+{
+    return d->reservedSlot >= 0 ? d->slotData(d->reservedSlot) : 0;
+}
+
+/// Publishes the frame written to the slot returned by reserve(), using
+/// the description from \a frame.
+///
+/// \param frame
+
+bool QXmppMediaRing::publish(const Frame &frame)
+{
+    if (!d->header || d->reservedSlot < 0 || frame.size > d->slotSize)
+        return false;
+
+    const quint32 sequence = d->writeSequence + 1;
+    QXmppMediaRingSlot *slot = d->slot(d->reservedSlot);
+    slot->type = frame.type;
+    slot->size = frame.size;
+    slot->timestamp = frame.timestamp;
+    slot->clockrate = frame.clockrate;
+    slot->width = frame.width;
+    slot->height = frame.height;
+    slot->bytesPerLine = frame.bytesPerLine;
+    slot->pixelFormat = frame.pixelFormat;
+    slot->sequence.fetchAndStoreOrdered(int(sequence));
+    slot->references.fetchAndStoreOrdered(0);
+
+    d->header->published.fetchAndStoreOrdered(int(sequence));
+    d->writeSequence = sequence;
+    d->reservedSlot = -1;
+    return true;
+}
+
+/// Copies \a frame.size bytes from \a data to the next slot and publishes
+/// the frame.
+///
+/// \param frame
+/// \param data
+
+bool QXmppMediaRing::write(const Frame &frame, const uchar *data)
+{
+    uchar *slotData = reserve(frame.size);
+    if (!slotData)
+        return false;
+    memcpy(slotData, data, frame.size);
+    return publish(frame);
+}
+
+/// Takes a reference to the next published frame and describes it in
+/// \a frame, returning false if there is no new frame.
+///
+/// The frame's data stays valid until it is given back with release().
+///
+/// \param frame
+
+bool QXmppMediaRing::acquire(Frame *frame)
+{
+    if (!d->header)
+        return false;
+
+    const quint32 published = quint32(d->header->published.fetchAndAddOrdered(0));
+    quint32 wanted = d->readSequence + 1;
+
+    // skip the frames which were overwritten
+    if (published - d->readSequence > quint32(d->slotCount))
+        wanted = published - d->slotCount + 1;
+
+    for ( ; published - wanted < 0x80000000u; ++wanted) {
+        const int index = wanted % d->slotCount;
+        QXmppMediaRingSlot *slot = d->slot(index);
+
+        // take a reference, unless the slot is being written
+        int references;
+        do {
+            references = slot->references.fetchAndAddOrdered(0);
+        } while (references >= 0 && !slot->references.testAndSetOrdered(references, references + 1));
+        if (references < 0)
+            continue;
+
+        if (quint32(slot->sequence.fetchAndAddOrdered(0)) != wanted) {
+            slot->references.fetchAndAddOrdered(-1);
+            continue;
+        }
+
+        frame->type = static_cast<MediaType>(slot->type);
+        frame->sequence = wanted;
+        frame->timestamp = slot->timestamp;
+        frame->size = slot->size;
+        frame->clockrate = slot->clockrate;
+        frame->width = slot->width;
+        frame->height = slot->height;
+        frame->bytesPerLine = slot->bytesPerLine;
+        frame->pixelFormat = slot->pixelFormat;
+        frame->data = d->slotData(index);
+        frame->slot = index;
+        d->readSequence = wanted;
+        return true;
+    }
+    d->readSequence = published;
+    return false;
+}
+
+/// Gives back a \a frame returned by acquire(), so that its slot can be
+/// reused by the producer.
+///
+/// \param frame
+
+void QXmppMediaRing::release(const Frame &frame)
+{
+    if (d->header && frame.slot >= 0 && frame.slot < d->slotCount)
+        d->slot(frame.slot)->references.fetchAndAddOrdered(-1);
+}
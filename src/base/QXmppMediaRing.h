@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPMEDIARING_H
+#define QXMPPMEDIARING_H
+
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+class QXmppMediaRingPrivate;
+
+/// \brief The QXmppMediaRing class exchanges decoded audio and video frames
+/// through a ring of fixed-size slots, which may live in shared memory.
+///
+/// A single producer, usually an RTP channel, writes frames to the ring.
+/// Consumers in the same process or in other processes attached to the
+/// same key read them in place: acquire() returns a descriptor pointing
+/// into the slot, which is not overwritten until release() is called.
+///
+/// The ring is lock-free. When the next slot is still referenced by a
+/// consumer the producer drops the frame, and a consumer which falls
+/// behind by more than the number of slots skips to the oldest frame.
+///
+/// \note THIS API IS NOT FINALIZED YET
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppMediaRing
+{
+public:
+    /// This enum describes the media carried by a frame.
+    enum MediaType {
+        AudioMedia = 1, ///< 16-bit little endian audio samples.
+        VideoMedia = 2  ///< A video frame.
+    };
+
+    /// \brief The Frame class describes a frame held by a slot of the ring.
+    struct Frame {
+        Frame();
+
+        MediaType type;         ///< The media of the frame.
+        quint32 sequence;       ///< The sequence number of the frame.
+        qint64 timestamp;       ///< The RTP timestamp of the frame.
+        int size;               ///< The size of the frame data, in bytes.
+        int clockrate;          ///< The clockrate of an audio frame.
+        int width;              ///< The width of a video frame.
+        int height;             ///< The height of a video frame.
+        int bytesPerLine;       ///< The bytes per line of a video frame.
+        int pixelFormat;        ///< The QXmppVideoFrame::PixelFormat of a video frame.
+        const uchar *data;      ///< The frame data, only valid until it is released.
+        int slot;               ///< The slot holding the frame.
+    };
+
+    QXmppMediaRing();
+    ~QXmppMediaRing();
+
+    bool create(const QString &key, int slotCount, int slotSize);
+    bool attach(const QString &key);
+    void detach();
+
+    bool isValid() const;
+    QString key() const;
+    int slotCount() const;
+    int slotSize() const;
+    quint32 droppedFrames() const;
+
+    // producer
+    uchar *reserve(int size);
+    uchar *reservation() const;
+    bool publish(const Frame &frame);
+    bool write(const Frame &frame, const uchar *data);
+
+    // consumers
+    bool acquire(Frame *frame);
+    void release(const Frame &frame);
+
+private:
+    Q_DISABLE_COPY(QXmppMediaRing)
+    QXmppMediaRingPrivate * const d;
+};
+
+#endif
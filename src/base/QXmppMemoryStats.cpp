@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppMemoryStats_p.h"
+#include "QXmppMetrics.h"
+
+static const char *categoryNames[] = {
+    "stream-buffers",
+    "client-state",
+    "stanza-parsing",
+    "stream-management",
+    "routing-table"
+};
+
+class QXmppMemoryStatsCounters
+{
+public:
+    QXmppMemoryStatsCounters()
+    {
+        for (int i = 0; i < QXmppMemoryStats::CategoryCount; ++i) {
+            const QString prefix = QString("memory.%1.").arg(QLatin1String(categoryNames[i]));
+            bytes[i] = QXmppMetrics::counter(prefix + "bytes");
+            allocations[i] = QXmppMetrics::counter(prefix + "allocations");
+        }
+    }
+
+    int bytes[QXmppMemoryStats::CategoryCount];
+    int allocations[QXmppMemoryStats::CategoryCount];
+};
+
+Q_GLOBAL_STATIC(QXmppMemoryStatsCounters, memoryCounters)
+
+/// Records that an object of the given \a category, which last reported
+/// \a tracked bytes, now holds \a bytes. \a tracked is updated.
+
+void QXmppMemoryStats::resize(Category category, qint64 &tracked, qint64 bytes)
+{
+    if (bytes == tracked)
+        return;
+
+    QXmppMemoryStatsCounters *counters = memoryCounters();
+    if (!counters)
+        return;
+
+    QXmppMetrics::updateCounter(counters->bytes[category], bytes - tracked);
+    if (bytes > tracked)
+        QXmppMetrics::updateCounter(counters->allocations[category]);
+    tracked = bytes;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPMEMORYSTATS_P_H
+#define QXMPPMEMORYSTATS_P_H
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream and QXmppServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppMemoryStats class accounts for the memory held by each
+/// subsystem of the library, when it is built with QXMPP_MEMORY_STATS.
+///
+/// Each instrumented object keeps the number of bytes it last reported,
+/// and calls resize() when its footprint changes. The totals are kept in
+/// the "memory.<category>.bytes" counters of QXmppMetrics, and the
+/// number of times a footprint grew in the "memory.<category>.allocations"
+/// counters, so that they appear in QXmppServer::statistics().
+///
+/// The sizes are estimates: they include the capacity of the buffers and
+/// the size of the objects, not the overhead of the memory allocator.
+
+class QXMPP_AUTOTEST_EXPORT QXmppMemoryStats
+{
+public:
+    enum Category
+    {
+        StreamBuffers = 0,  ///< Read, write and parser buffers of streams.
+        ClientState,        ///< Server-side state of incoming clients.
+        StanzaParsing,      ///< Stanzas being parsed, raw data and DOM trees.
+        StreamManagement,   ///< Unacknowledged stanzas kept for XEP-0198.
+        RoutingTable,       ///< Entries of the server's routing table.
+        CategoryCount
+    };
+
+    static void resize(Category category, qint64 &tracked, qint64 bytes);
+};
+
+#endif
@@ -26,9 +26,12 @@
 #include <QTextStream>
 #include <QXmlStreamWriter>
 #include <QPair>
+#include <QSet>
 
 #include "QXmppConstants.h"
+#include "QXmppEnumTable_p.h"
 #include "QXmppMessage.h"
+#include "QXmppStringPool_p.h"
 #include "QXmppUtils.h"
 
 static const char* chat_states[] = {
@@ -48,6 +51,9 @@ static const char* message_types[] = {
     "headline"
 };
 
+Q_GLOBAL_STATIC_WITH_ARGS(QXmppEnumTable, messageTypes,
+    (message_types, int(sizeof(message_types) / sizeof(message_types[0]))))
+
 static const char* marker_types[] = {
     "",
     "received",
@@ -62,7 +68,7 @@ static const char* hint_types[] = {
     "allow-permanent-storage"
 };
 
-static const char *ns_xhtml = "http://www.w3.org/1999/xhtml";
+static const QLatin1String ns_xhtml("http://www.w3.org/1999/xhtml");
 
 enum StampType
 {
@@ -70,26 +76,19 @@ enum StampType
     DelayedDelivery         // XEP-0203: Delayed Delivery
 };
 
-class QXmppMessagePrivate : public QSharedData
+// Fields which most messages do not use, they are only allocated
+// when one of them is set.
+class QXmppMessageExtras : public QSharedData
 {
 public:
-    QXmppMessage::Type type;
+    QXmppMessageExtras();
+
     QDateTime stamp;
     StampType stampType;
-    QXmppMessage::State state;
-
-    bool attentionRequested;
-    QString body;
-    QString subject;
-    QString thread;
 
     // XEP-0071: XHTML-IM
     QString xhtml;
 
-    // Request message receipt as per XEP-0184.
-    QString receiptId;
-    bool receiptRequested;
-
     // XEP-0297: Stanza Forwarding
     QSharedPointer<QXmppMessage> forwarded;
 
@@ -98,6 +97,7 @@ public:
 
     // XEP-0280: Message Carbons
     QSharedPointer<QXmppMessage> carbonMessage;
+    QXmppMessage::CarbonDirection carbonDirection;
 
     // XEP-0249: Direct MUC Invitations
     QString mucInvitationJid;
@@ -105,9 +105,6 @@ public:
     QString mucInvitationReason;
     bool mucInvitationDirect;
 
-    // XEP-0334: Message Processing Hints
-    QList<QXmppMessage::Hint> hints;
-
     // XEP-0333: Chat Markers
     bool markable;
     QXmppMessage::Marker marker;
@@ -119,6 +116,59 @@ public:
     QString replaceId;
 };
 
+QXmppMessageExtras::QXmppMessageExtras()
+    : stampType(DelayedDelivery)
+    , carbonDirection(QXmppMessage::NoCarbon)
+    , mucInvitationDirect(true)
+    , markable(false)
+    , marker(QXmppMessage::NoMarker)
+    , replace(false)
+{
+}
+
+Q_GLOBAL_STATIC(QXmppMessageExtras, defaultMessageExtras)
+
+class QXmppMessagePrivate : public QSharedData
+{
+public:
+    const QXmppMessageExtras &extras() const;
+    QXmppMessageExtras &extras();
+
+    QXmppMessage::Type type;
+    QXmppMessage::State state;
+
+    bool attentionRequested;
+    QString body;
+    QString subject;
+    QString thread;
+
+    // Request message receipt as per XEP-0184.
+    QString receiptId;
+    bool receiptRequested;
+
+    // XEP-0334: Message Processing Hints
+    QList<QXmppMessage::Hint> hints;
+
+    QSharedDataPointer<QXmppMessageExtras> extraData;
+};
+
+/// Returns the message's less common fields for reading.
+
+const QXmppMessageExtras &QXmppMessagePrivate::extras() const
+{
+    return extraData ? *extraData.constData() : *defaultMessageExtras();
+}
+
+/// Returns the message's less common fields for writing, allocating
+/// them if needed.
+
+QXmppMessageExtras &QXmppMessagePrivate::extras()
+{
+    if (!extraData)
+        extraData = new QXmppMessageExtras;
+    return *extraData;
+}
+
 /// Constructs a QXmppMessage.
 ///
 /// \param from
@@ -132,19 +182,11 @@ QXmppMessage::QXmppMessage(const QString& from, const QString& to, const
     , d(new QXmppMessagePrivate)
 {
     d->type = Chat;
-    d->stampType = DelayedDelivery;
     d->state = None;
     d->attentionRequested = false;
     d->body = body;
     d->thread = thread;
     d->receiptRequested = false;
-
-    d->markable = false;
-    d->marker = NoMarker;
-
-    d->replace = false;
-
-    d->mucInvitationDirect = true;
 }
 
 /// Constructs a copy of \a other.
@@ -245,7 +287,7 @@ void QXmppMessage::setReceiptId(const QString &id)
 
 QString QXmppMessage::mucInvitationJid() const
 {
-    return d->mucInvitationJid;
+    return d->extras().mucInvitationJid;
 }
 
 /// Sets the JID for a multi-user chat direct invitation as defined
@@ -253,7 +295,7 @@ QString QXmppMessage::mucInvitationJid() const
 
 void QXmppMessage::setMucInvitationJid(const QString &jid)
 {
-    d->mucInvitationJid = jid;
+    d->extras().mucInvitationJid = jid;
 }
 
 /// Returns the password for a multi-user chat direct invitation as defined
@@ -261,7 +303,7 @@ void QXmppMessage::setMucInvitationJid(const QString &jid)
 
 QString QXmppMessage::mucInvitationPassword() const
 {
-    return d->mucInvitationPassword;
+    return d->extras().mucInvitationPassword;
 }
 
 /// Sets the \a password for a multi-user chat direct invitation as defined
@@ -269,7 +311,7 @@ QString QXmppMessage::mucInvitationPassword() const
 
 void QXmppMessage::setMucInvitationPassword(const QString &password)
 {
-    d->mucInvitationPassword = password;
+    d->extras().mucInvitationPassword = password;
 }
 
 /// Returns the reason for a multi-user chat direct invitation as defined
@@ -277,7 +319,7 @@ void QXmppMessage::setMucInvitationPassword(const QString &password)
 
 QString QXmppMessage::mucInvitationReason() const
 {
-    return d->mucInvitationReason;
+    return d->extras().mucInvitationReason;
 }
 
 /// Sets the \a reason for a multi-user chat direct invitation as defined
@@ -285,12 +327,12 @@ QString QXmppMessage::mucInvitationReason() const
 
 void QXmppMessage::setMucInvitationReason(const QString &reason)
 {
-    d->mucInvitationReason = reason;
+    d->extras().mucInvitationReason = reason;
 }
 
 void QXmppMessage::setMucInvitationDirect(bool value)
 {
-    d->mucInvitationDirect = value;
+    d->extras().mucInvitationDirect = value;
 }
 
 /// Returns the message's type.
@@ -314,7 +356,7 @@ void QXmppMessage::setType(QXmppMessage::Type type)
 
 QDateTime QXmppMessage::stamp() const
 {
-    return d->stamp;
+    return d->extras().stamp;
 }
 
 /// Sets the message's timestamp.
@@ -323,7 +365,7 @@ QDateTime QXmppMessage::stamp() const
 
 void QXmppMessage::setStamp(const QDateTime &stamp)
 {
-    d->stamp = stamp;
+    d->extras().stamp = stamp;
 }
 
 /// Returns the message's chat state.
@@ -381,7 +423,7 @@ void QXmppMessage::setThread(const QString& thread)
 
 QString QXmppMessage::xhtml() const
 {
-    return d->xhtml;
+    return d->extras().xhtml;
 }
 
 /// Sets the message's XHTML body as defined by
@@ -389,67 +431,73 @@ QString QXmppMessage::xhtml() const
 
 void QXmppMessage::setXhtml(const QString &xhtml)
 {
-    d->xhtml = xhtml;
+    d->extras().xhtml = xhtml;
 }
 
 namespace
 {
-    static QList<QPair<QString, QString> > knownMessageSubelems()
+    // Sub-elements which QXmppMessage::parse() handles itself, keyed by
+    // tag name and namespace. An empty namespace matches any namespace.
+    class QXmppKnownMessageSubelems : public QSet<QPair<QString, QString> >
     {
-        QList<QPair<QString, QString> > result;
-        result << qMakePair(QString("body"), QString())
-               << qMakePair(QString("subject"), QString())
-               << qMakePair(QString("thread"), QString())
-               << qMakePair(QString("html"), QString())
-               << qMakePair(QString("received"), QString(ns_message_receipts))
-               << qMakePair(QString("request"), QString())
-               << qMakePair(QString("delay"), QString())
-               << qMakePair(QString("attention"), QString())
-               << qMakePair(QString("addresses"), QString());
-        for (int i = QXmppMessage::Active; i <= QXmppMessage::Paused; i++)
-            result << qMakePair(QString(chat_states[i]), QString());
-        return result;
-    }
+    public:
+        QXmppKnownMessageSubelems()
+        {
+            *this << qMakePair(QString("body"), QString())
+                  << qMakePair(QString("subject"), QString())
+                  << qMakePair(QString("thread"), QString())
+                  << qMakePair(QString("html"), QString())
+                  << qMakePair(QString("received"), QString(ns_message_receipts))
+                  << qMakePair(QString("request"), QString())
+                  << qMakePair(QString("delay"), QString())
+                  << qMakePair(QString("attention"), QString())
+                  << qMakePair(QString("addresses"), QString());
+            for (int i = QXmppMessage::Active; i <= QXmppMessage::Paused; i++)
+                *this << qMakePair(QString(chat_states[i]), QString());
+        }
+    };
 }
 
+Q_GLOBAL_STATIC(QXmppKnownMessageSubelems, knownMessageSubelems)
+
 bool QXmppMessage::hasForwarded() const
 {
-    return !d->forwarded.isNull();
+    return !d->extras().forwarded.isNull();
 }
 
 QXmppMessage QXmppMessage::forwarded() const
 {
-    if (d->forwarded.isNull()) {
+    if (d->extras().forwarded.isNull()) {
         return QXmppMessage(); // default constructed
     }
     
-    return *(d->forwarded);
+    return *(d->extras().forwarded);
 }
 
 void QXmppMessage::setForwarded(const QXmppMessage& forwarded)
 {
     // make a new shared pointer
-    d->forwarded = QSharedPointer<QXmppMessage>(new QXmppMessage(forwarded));
+    d->extras().forwarded = QSharedPointer<QXmppMessage>(new QXmppMessage(forwarded));
 }
 
 bool QXmppMessage::hasMaMMessage() const
 {
-    return !d->mamMessage.isNull();
+    return !d->extras().mamMessage.isNull();
 }
 
 QXmppMessage QXmppMessage::mamMessage() const
 {
-    if (d->mamMessage.isNull()) {
+    if (d->extras().mamMessage.isNull()) {
         return QXmppMessage(); // default constructed
     }
 
-    return *(d->mamMessage);
+    return *(d->extras().mamMessage);
 }
 
 void QXmppMessage::setMaMMessage(const QXmppMessage& message)
 {
     // make a new shared pointer
-    d->mamMessage = QSharedPointer<QXmppMessage>(new QXmppMessage(message));
+    d->extras().mamMessage = QSharedPointer<QXmppMessage>(new QXmppMessage(message));
 }
 
 /// Returns true if a message is markable, as defined
@@ -457,7 +505,7 @@ void QXmppMessage::setMaMMessage(const QXmppMessage& message)
 
 bool QXmppMessage::isMarkable() const
 {
-    return d->markable;
+    return d->extras().markable;
 }
 
 /// Sets if the message is markable, as defined
@@ -465,7 +513,7 @@ bool QXmppMessage::isMarkable() const
 
 void QXmppMessage::setMarkable(const bool markable)
 {
-    d->markable = markable;
+    d->extras().markable = markable;
 }
 
 /// Returns the message's marker id, as defined
@@ -473,7 +521,7 @@ void QXmppMessage::setMarkable(const bool markable)
 
 QString QXmppMessage::markedId() const
 {
-    return d->markedId;
+    return d->extras().markedId;
 }
 
 /// Sets the message's marker id, as defined
@@ -481,7 +529,7 @@ QString QXmppMessage::markedId() const
 
 void QXmppMessage::setMarkerId(const QString &markerId)
 {
-    d->markedId = markerId;
+    d->extras().markedId = markerId;
 }
 
 /// Returns the message's marker thread, as defined
@@ -489,7 +537,7 @@ void QXmppMessage::setMarkerId(const QString &markerId)
 
 QString QXmppMessage::markedThread() const
 {
-    return d->markedThread;
+    return d->extras().markedThread;
 }
 
 /// Sets the message's marked thread, as defined
@@ -497,7 +545,7 @@ QString QXmppMessage::markedThread() const
 
 void QXmppMessage::setMarkedThread(const QString &markedThread)
 {
-    d->markedThread = markedThread;
+    d->extras().markedThread = markedThread;
 }
 
 /// Returns the message's marker, as defined
@@ -505,7 +553,7 @@ void QXmppMessage::setMarkedThread(const QString &markedThread)
 
 QXmppMessage::Marker QXmppMessage::marker() const
 {
-    return d->marker;
+    return d->extras().marker;
 }
 
 /// Sets the message's marker, as defined
@@ -513,7 +561,7 @@ QXmppMessage::Marker QXmppMessage::marker() const
 
 void QXmppMessage::setMarker(const Marker marker)
 {
-    d->marker = marker;
+    d->extras().marker = marker;
 }
 
 
@@ -525,25 +573,25 @@ void QXmppMessage::setMarker(const Marker marker,
                              const QString& id,
                              const QString& thread)
 {
-    d->marker = marker;
-    d->markedId = id;
-    d->markedThread = thread;
+    d->extras().marker = marker;
+    d->extras().markedId = id;
+    d->extras().markedThread = thread;
 }
 
 bool QXmppMessage::isReplace() const
 {
-    return d->replace;
+    return d->extras().replace;
 }
 
 QString QXmppMessage::replaceId() const
 {
-    return d->replaceId;
+    return d->extras().replaceId;
 }
 
 void QXmppMessage::setReplace(const QString& replaceId)
 {
-    d->replace   = true;
-    d->replaceId = replaceId;
+    d->extras().replace   = true;
+    d->extras().replaceId = replaceId;
 }
 
 /// \cond
@@ -551,17 +599,10 @@ void QXmppMessage::parse(const QDomElement &element)
 {
     QXmppStanza::parse(element);
 
-    const QString type = element.attribute("type");
-    d->type = Normal;
-    for (int i = Error; i <= Headline; i++) {
-        if (type == message_types[i]) {
-            d->type = static_cast<Type>(i);
-            break;
-        }
-    }
+    d->type = static_cast<Type>(messageTypes()->fromString(element.attribute("type"), Normal));
 
     d->body = element.firstChildElement("body").text();
-    d->subject = element.firstChildElement("subject").text();
+    d->subject = QXmppStringPool::shared(element.firstChildElement("subject").text());
     d->thread = element.firstChildElement("thread").text();
 
     // chat states
@@ -581,13 +622,13 @@ void QXmppMessage::parse(const QDomElement &element)
     if (!htmlElement.isNull() && htmlElement.namespaceURI() == ns_xhtml_im) {
         QDomElement bodyElement = htmlElement.firstChildElement("body");
         if (!bodyElement.isNull() && bodyElement.namespaceURI() == ns_xhtml) {
-            QTextStream stream(&d->xhtml, QIODevice::WriteOnly);
+            QTextStream stream(&d->extras().xhtml, QIODevice::WriteOnly);
             bodyElement.save(stream, 0);
 
-            d->xhtml = d->xhtml.mid(d->xhtml.indexOf('>') + 1);
-            d->xhtml.replace(" xmlns=\"http://www.w3.org/1999/xhtml\"", "");
-            d->xhtml.replace("</body>", "");
-            d->xhtml = d->xhtml.trimmed();
+            d->extras().xhtml = d->extras().xhtml.mid(d->extras().xhtml.indexOf('>') + 1);
+            d->extras().xhtml.replace(" xmlns=\"http://www.w3.org/1999/xhtml\"", "");
+            d->extras().xhtml.replace("</body>", "");
+            d->extras().xhtml = d->extras().xhtml.trimmed();
         }
     }
 
@@ -609,8 +650,8 @@ void QXmppMessage::parse(const QDomElement &element)
     if (!delayElement.isNull() && delayElement.namespaceURI() == ns_delayed_delivery)
     {
         const QString str = delayElement.attribute("stamp");
-        d->stamp = QXmppUtils::datetimeFromString(str);
-        d->stampType = DelayedDelivery;
+        d->extras().stamp = QXmppUtils::datetimeFromString(str);
+        d->extras().stampType = DelayedDelivery;
     }
 
     // XEP-0313: Extract forwarded message from mam packet
@@ -631,7 +672,9 @@ void QXmppMessage::parse(const QDomElement &element)
       QDomElement forwardedElement = carbonElement.firstChildElement("forwarded");
       if (!forwardedElement.isNull() && forwardedElement.namespaceURI() == ns_stanza_forwarding)
       {
-        setMessagecarbon(parseForward(forwardedElement));
+        QXmppMessage carbon = parseForward(forwardedElement);
+        carbon.setCarbonDirection(ReceivedCarbon);
+        setMessagecarbon(carbon);
       }
     }
 
@@ -641,7 +684,9 @@ void QXmppMessage::parse(const QDomElement &element)
       QDomElement forwardedElement = carbonElement.firstChildElement("forwarded");
       if (!forwardedElement.isNull() && forwardedElement.namespaceURI() == ns_stanza_forwarding)
       {
-        setMessagecarbon(parseForward(forwardedElement));
+        QXmppMessage carbon = parseForward(forwardedElement);
+        carbon.setCarbonDirection(SentCarbon);
+        setMessagecarbon(carbon);
       }
     }
 
@@ -672,7 +717,7 @@ void QXmppMessage::parse(const QDomElement &element)
     QDomElement markableElement = element.firstChildElement("markable");
     if (!markableElement.isNull())
     {
-        d->markable = true;
+        d->extras().markable = true;
     }
     // check for all the marker types
     QDomElement chatStateElement;
@@ -692,9 +737,9 @@ void QXmppMessage::parse(const QDomElement &element)
     {
         if (chatStateElement.namespaceURI() == ns_chat_markers)
         {
-            d->marker = marker;
-            d->markedId = chatStateElement.attribute("id", QString());
-            d->markedThread = chatStateElement.attribute("thread", QString());
+            d->extras().marker = marker;
+            d->extras().markedId = chatStateElement.attribute("id", QString());
+            d->extras().markedThread = chatStateElement.attribute("thread", QString());
         }
     }
 
@@ -704,12 +749,12 @@ void QXmppMessage::parse(const QDomElement &element)
     {
         if(replaceElement.namespaceURI() == ns_replace_message)
         {
-            d->replace = true;
-            d->replaceId = replaceElement.attribute("id", QString());
+            d->extras().replace = true;
+            d->extras().replaceId = replaceElement.attribute("id", QString());
         }
     }
 
-    const QList<QPair<QString, QString> > &knownElems = knownMessageSubelems();
+    const QSet<QPair<QString, QString> > &knownElems = *knownMessageSubelems();
 
     QXmppElementList extensions;
     QDomElement xElement = element.firstChildElement();
@@ -720,19 +765,19 @@ void QXmppMessage::parse(const QDomElement &element)
             if (xElement.namespaceURI() == ns_legacy_delayed_delivery)
             {
                 // if XEP-0203 exists, XEP-0091 has no need to parse because XEP-0091 is no more standard protocol)
-                if (d->stamp.isNull())
+                if (d.constData()->extras().stamp.isNull())
                 {
                     // XEP-0091: Legacy Delayed Delivery
                     const QString str = xElement.attribute("stamp");
-                    d->stamp = QDateTime::fromString(str, "yyyyMMddThh:mm:ss");
-                    d->stamp.setTimeSpec(Qt::UTC);
-                    d->stampType = LegacyDelayedDelivery;
+                    d->extras().stamp = QDateTime::fromString(str, "yyyyMMddThh:mm:ss");
+                    d->extras().stamp.setTimeSpec(Qt::UTC);
+                    d->extras().stampType = LegacyDelayedDelivery;
                 }
             } else if (xElement.namespaceURI() == ns_conference) {
                 // XEP-0249: Direct MUC Invitations
-                d->mucInvitationJid = xElement.attribute("jid");
-                d->mucInvitationPassword = xElement.attribute("password");
-                d->mucInvitationReason = xElement.attribute("reason");
+                d->extras().mucInvitationJid = xElement.attribute("jid");
+                d->extras().mucInvitationPassword = xElement.attribute("password");
+                d->extras().mucInvitationReason = xElement.attribute("reason");
             }
             else {
                 extensions << QXmppElement(xElement);
@@ -760,8 +805,8 @@ QXmppMessage QXmppMessage::parseForward(QDomElement &element)
         QDomElement delayElement = element.firstChildElement("delay");
         if (!delayElement.isNull() && delayElement.namespaceURI() == ns_delayed_delivery) {
             const QString str = delayElement.attribute("stamp");
-            fwd.d->stamp = QXmppUtils::datetimeFromString(str);
-            fwd.d->stampType = DelayedDelivery;
+            fwd.d->extras().stamp = QXmppUtils::datetimeFromString(str);
+            fwd.d->extras().stampType = DelayedDelivery;
         }
 
         result = fwd;
@@ -776,7 +821,7 @@ void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
     helperToXmlAddAttribute(xmlWriter, "id", id());
     helperToXmlAddAttribute(xmlWriter, "to", to());
     helperToXmlAddAttribute(xmlWriter, "from", from());
-    helperToXmlAddAttribute(xmlWriter, "type", message_types[d->type]);
+    helperToXmlAddAttribute(xmlWriter, "type", messageTypes()->toString(d->type));
     if (!d->subject.isEmpty())
         helperToXmlAddTextElement(xmlWriter, "subject", d->subject);
     if (!d->body.isEmpty())
@@ -794,22 +839,22 @@ void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
     }
 
     // XEP-0071: XHTML-IM
-    if (!d->xhtml.isEmpty()) {
+    if (!d->extras().xhtml.isEmpty()) {
         xmlWriter->writeStartElement("html");
         xmlWriter->writeAttribute("xmlns", ns_xhtml_im);
         xmlWriter->writeStartElement("body");
         xmlWriter->writeAttribute("xmlns", ns_xhtml);
         xmlWriter->writeCharacters("");
-        xmlWriter->device()->write(d->xhtml.toUtf8());
+        xmlWriter->device()->write(d->extras().xhtml.toUtf8());
         xmlWriter->writeEndElement();
         xmlWriter->writeEndElement();
     }
 
     // time stamp
-    if (d->stamp.isValid())
+    if (d->extras().stamp.isValid())
     {
-        QDateTime utcStamp = d->stamp.toUTC();
-        if (d->stampType == DelayedDelivery)
+        QDateTime utcStamp = d->extras().stamp.toUTC();
+        if (d->extras().stampType == DelayedDelivery)
         {
             // XEP-0203: Delayed Delivery
             xmlWriter->writeStartElement("delay");
@@ -846,24 +891,24 @@ void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
     }
 
     // XEP-0249: Direct MUC Invitations
-    if (!d->mucInvitationJid.isEmpty()) {
-        if (d->mucInvitationDirect) {
+    if (!d->extras().mucInvitationJid.isEmpty()) {
+        if (d->extras().mucInvitationDirect) {
             xmlWriter->writeStartElement("x");
             xmlWriter->writeAttribute("xmlns", ns_conference);
-            xmlWriter->writeAttribute("jid", d->mucInvitationJid);
-            if (!d->mucInvitationPassword.isEmpty())
-                xmlWriter->writeAttribute("password", d->mucInvitationPassword);
-            if (!d->mucInvitationReason.isEmpty())
-                xmlWriter->writeAttribute("reason", d->mucInvitationReason);
+            xmlWriter->writeAttribute("jid", d->extras().mucInvitationJid);
+            if (!d->extras().mucInvitationPassword.isEmpty())
+                xmlWriter->writeAttribute("password", d->extras().mucInvitationPassword);
+            if (!d->extras().mucInvitationReason.isEmpty())
+                xmlWriter->writeAttribute("reason", d->extras().mucInvitationReason);
             xmlWriter->writeEndElement();
         } else {
             xmlWriter->writeStartElement("x");
             xmlWriter->writeAttribute("xmlns", ns_muc_user);
 
             xmlWriter->writeStartElement("invite");
-            xmlWriter->writeAttribute("to", d->mucInvitationJid);
+            xmlWriter->writeAttribute("to", d->extras().mucInvitationJid);
 
-            helperToXmlAddTextElement(xmlWriter, "reason", d->mucInvitationReason);
+            helperToXmlAddTextElement(xmlWriter, "reason", d->extras().mucInvitationReason);
 
             xmlWriter->writeEndElement();
 
@@ -880,30 +925,30 @@ void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
     }
 
     // XEP-0333: Chat Markers
-    if (d->markable) {
+    if (d->extras().markable) {
         xmlWriter->writeStartElement("markable");
         xmlWriter->writeAttribute("xmlns", ns_chat_markers);
         xmlWriter->writeEndElement();
     }
-    if (d->marker != NoMarker) {
-        xmlWriter->writeStartElement(marker_types[d->marker]);
+    if (d->extras().marker != NoMarker) {
+        xmlWriter->writeStartElement(marker_types[d->extras().marker]);
         xmlWriter->writeAttribute("xmlns", ns_chat_markers);
-        xmlWriter->writeAttribute("id", d->markedId);
-        if (!d->markedThread.isNull() && !d->markedThread.isEmpty()) {
-            xmlWriter->writeAttribute("thread", d->markedThread);
+        xmlWriter->writeAttribute("id", d->extras().markedId);
+        if (!d->extras().markedThread.isNull() && !d->extras().markedThread.isEmpty()) {
+            xmlWriter->writeAttribute("thread", d->extras().markedThread);
         }
         xmlWriter->writeEndElement();
     }
 
     // XEP-0308: Last Message Correction
-    if(d->replace) {
+    if(d->extras().replace) {
         if(d->body.isEmpty())
         {
             //Add the an empty body elemnt
             xmlWriter->writeEmptyElement("body");
         }
         xmlWriter->writeStartElement("replace");
-        xmlWriter->writeAttribute("id",d->replaceId);
+        xmlWriter->writeAttribute("id",d->extras().replaceId);
         xmlWriter->writeAttribute("xmlns",ns_replace_message);
         xmlWriter->writeEndElement();
     }
@@ -923,23 +968,44 @@ QXmppStanza::StanzaType QXmppMessage::getStanzaType() const
 
 bool QXmppMessage::hasMessageCarbon() const
 {
-    return !d->carbonMessage.isNull();
+    return !d->extras().carbonMessage.isNull();
 }
 
 QXmppMessage QXmppMessage::carbonMessage() const
 {
-    if (d->carbonMessage.isNull()) {
+    if (d->extras().carbonMessage.isNull()) {
         return QXmppMessage(); // default constructed
     }
 
-    return *(d->carbonMessage);
+    return *(d->extras().carbonMessage);
 
 }
 
 void QXmppMessage::setMessagecarbon(const QXmppMessage& message)
 {
     // make a new shared pointer
-    d->carbonMessage = QSharedPointer<QXmppMessage>(new QXmppMessage(message));
+    d->extras().carbonMessage = QSharedPointer<QXmppMessage>(new QXmppMessage(message));
+}
+
+/// Returns whether the message is a copy delivered by XEP-0280: Message
+/// Carbons, and in which direction it went.
+///
+/// This is set on the carbonMessage() of a carbon, and on the messages
+/// which QXmppClient unwraps from carbons.
+
+QXmppMessage::CarbonDirection QXmppMessage::carbonDirection() const
+{
+    return d->extras().carbonDirection;
+}
+
+/// Sets whether the message is a copy delivered by XEP-0280: Message
+/// Carbons, and in which direction it went.
+///
+/// \param direction
+
+void QXmppMessage::setCarbonDirection(CarbonDirection direction)
+{
+    d->extras().carbonDirection = direction;
 }
 
 bool QXmppMessage::hasHint(const Hint& hint)
@@ -69,6 +69,14 @@ public:
         Acknowledged
     };
 
+    /// This enum describes whether a message is a copy delivered by
+    /// XEP-0280: Message Carbons, and in which direction it went.
+    enum CarbonDirection {
+        NoCarbon = 0,   ///< The message is not a carbon copy.
+        ReceivedCarbon, ///< The message was received by another resource.
+        SentCarbon      ///< The message was sent by another resource.
+    };
+
     enum Hint {
         NoPermanentStorage = 0,
         NoStorage,
@@ -83,6 +91,16 @@ public:
     ~QXmppMessage();
 
     QXmppMessage& operator=(const QXmppMessage &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QXmppMessage(QXmppMessage &&other)
+        : QXmppStanza(static_cast<QXmppStanza&&>(other)) { d.swap(other.d); }
+    QXmppMessage& operator=(QXmppMessage &&other)
+    {
+        QXmppStanza::operator=(static_cast<QXmppStanza&&>(other));
+        d.swap(other.d);
+        return *this;
+    }
+#endif
 
     QString body() const;
     void setBody(const QString&);
@@ -140,6 +158,9 @@ public:
     QXmppMessage carbonMessage() const;
     void setMessagecarbon(const QXmppMessage& message);
 
+    CarbonDirection carbonDirection() const;
+    void setCarbonDirection(CarbonDirection direction);
+
     // XEP-0334: Message Processing Hints
     bool hasHint(const Hint& hint);
     void addHint(const Hint& hint);
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadStorage>
+#include <QVector>
+
+#include "QXmppMetrics.h"
+
+// Histograms have exact buckets for values below 8, then 8 buckets for each
+// power of two, so the values they report are within 12.5% of the actual.
+static const int histogramSubBuckets = 8;
+static const int histogramSubBucketBits = 3;
+static const int histogramBucketCount = histogramSubBuckets + (63 - histogramSubBucketBits) * histogramSubBuckets;
+
+static int histogramBucket(qint64 value)
+{
+    if (value < histogramSubBuckets)
+        return qMax(qint64(0), value);
+
+    int exponent = 0;
+    for (quint64 v = value; v > 1; v >>= 1)
+        ++exponent;
+    const int shift = exponent - histogramSubBucketBits;
+    return histogramSubBuckets + shift * histogramSubBuckets + int((value >> shift) & (histogramSubBuckets - 1));
+}
+
+// Returns the highest value which falls in the given bucket.
+
+static qint64 histogramBucketMaximum(int bucket)
+{
+    if (bucket < histogramSubBuckets)
+        return bucket;
+
+    const int shift = (bucket - histogramSubBuckets) / histogramSubBuckets;
+    const qint64 lower = qint64(histogramSubBuckets + (bucket - histogramSubBuckets) % histogramSubBuckets) << shift;
+    return lower + (qint64(1) << shift) - 1;
+}
+
+class QXmppMetricsHistogram
+{
+public:
+    QXmppMetricsHistogram()
+        : count(0)
+        , sum(0)
+        , maximum(0)
+    {
+    }
+
+    void add(const QXmppMetricsHistogram &other)
+    {
+        if (!other.count)
+            return;
+        if (buckets.isEmpty())
+            buckets.fill(0, histogramBucketCount);
+        for (int i = 0; i < histogramBucketCount; ++i)
+            buckets[i] += other.buckets.at(i);
+        count += other.count;
+        sum += other.sum;
+        maximum = qMax(maximum, other.maximum);
+    }
+
+    void record(qint64 value)
+    {
+        if (buckets.isEmpty())
+            buckets.fill(0, histogramBucketCount);
+        buckets[histogramBucket(value)]++;
+        count++;
+        sum += value;
+        maximum = qMax(maximum, value);
+    }
+
+    // Returns the value below which the given fraction of the values fall.
+    qint64 percentile(double fraction) const
+    {
+        const qint64 rank = qMax(qint64(1), qint64(fraction * count + 0.5));
+        qint64 seen = 0;
+        for (int i = 0; i < buckets.size(); ++i) {
+            seen += buckets.at(i);
+            if (seen >= rank)
+                return qMin(histogramBucketMaximum(i), maximum);
+        }
+        return maximum;
+    }
+
+    QVector<qint64> buckets;
+    qint64 count;
+    qint64 sum;
+    qint64 maximum;
+};
+
+// The metrics recorded by one thread. The mutex is only contended while a
+// snapshot is being taken.
+
+class QXmppMetricsThreadData
+{
+public:
+    ~QXmppMetricsThreadData();
+    void addTo(QXmppMetricsThreadData &total) const;
+
+    QMutex mutex;
+    QVector<qint64> counters;
+    QVector<QXmppMetricsHistogram> histograms;
+};
+
+class QXmppMetricsRegistry
+{
+public:
+    int id(QStringList &names, QHash<QString, int> &ids, const QString &name)
+    {
+        QMutexLocker locker(&mutex);
+        QHash<QString, int>::const_iterator it = ids.constFind(name);
+        if (it != ids.constEnd())
+            return it.value();
+        names << name;
+        ids.insert(name, names.size() - 1);
+        return names.size() - 1;
+    }
+
+    QMutex mutex;
+    QStringList counterNames;
+    QHash<QString, int> counterIds;
+    QStringList gaugeNames;
+    QHash<QString, int> gaugeIds;
+    QVector<double> gauges;
+    QStringList histogramNames;
+    QHash<QString, int> histogramIds;
+
+    // the threads which are running, and the metrics of those which ended
+    QList<QXmppMetricsThreadData*> threads;
+    QXmppMetricsThreadData ended;
+};
+
+Q_GLOBAL_STATIC(QXmppMetricsRegistry, metricsRegistry)
+Q_GLOBAL_STATIC(QThreadStorage<QXmppMetricsThreadData*>, metricsThreadStorage)
+
+QXmppMetricsThreadData::~QXmppMetricsThreadData()
+{
+    // keep the metrics of the thread once it ends
+    QXmppMetricsRegistry *registry = metricsRegistry();
+    if (!registry || this == &registry->ended)
+        return;
+
+    QMutexLocker locker(&registry->mutex);
+    registry->threads.removeAll(this);
+    addTo(registry->ended);
+}
+
+void QXmppMetricsThreadData::addTo(QXmppMetricsThreadData &total) const
+{
+    QMutexLocker locker(const_cast<QMutex*>(&mutex));
+    if (total.counters.size() < counters.size())
+        total.counters.resize(counters.size());
+    for (int i = 0; i < counters.size(); ++i)
+        total.counters[i] += counters.at(i);
+
+    if (total.histograms.size() < histograms.size())
+        total.histograms.resize(histograms.size());
+    for (int i = 0; i < histograms.size(); ++i)
+        total.histograms[i].add(histograms.at(i));
+}
+
+static QXmppMetricsThreadData *localData()
+{
+    QThreadStorage<QXmppMetricsThreadData*> *storage = metricsThreadStorage();
+    QXmppMetricsRegistry *registry = metricsRegistry();
+    if (!storage || !registry)
+        return 0;
+
+    if (!storage->hasLocalData()) {
+        QXmppMetricsThreadData *data = new QXmppMetricsThreadData;
+        QMutexLocker locker(&registry->mutex);
+        registry->threads << data;
+        storage->setLocalData(data);
+    }
+    return storage->localData();
+}
+
+/// Returns the handle of the counter with the given \a name, registering
+/// it if needed.
+///
+/// \param name
+
+int QXmppMetrics::counter(const QString &name)
+{
+    QXmppMetricsRegistry *registry = metricsRegistry();
+    return registry ? registry->id(registry->counterNames, registry->counterIds, name) : -1;
+}
+
+/// Returns the handle of the gauge with the given \a name, registering
+/// it if needed.
+///
+/// \param name
+
+int QXmppMetrics::gauge(const QString &name)
+{
+    QXmppMetricsRegistry *registry = metricsRegistry();
+    return registry ? registry->id(registry->gaugeNames, registry->gaugeIds, name) : -1;
+}
+
+/// Returns the handle of the histogram with the given \a name, registering
+/// it if needed.
+///
+/// \param name
+
+int QXmppMetrics::histogram(const QString &name)
+{
+    QXmppMetricsRegistry *registry = metricsRegistry();
+    return registry ? registry->id(registry->histogramNames, registry->histogramIds, name) : -1;
+}
+
+/// Adds \a amount to the given \a counter.
+///
+/// \param counter a handle returned by counter()
+/// \param amount
+
+void QXmppMetrics::updateCounter(int counter, qint64 amount)
+{
+    QXmppMetricsThreadData *data = localData();
+    if (!data || counter < 0)
+        return;
+
+    QMutexLocker locker(&data->mutex);
+    if (counter >= data->counters.size())
+        data->counters.resize(counter + 1);
+    data->counters[counter] += amount;
+}
+
+/// Sets the given \a gauge to \a value.
+///
+/// \param gauge a handle returned by gauge()
+/// \param value
+
+void QXmppMetrics::setGauge(int gauge, double value)
+{
+    QXmppMetricsRegistry *registry = metricsRegistry();
+    if (!registry || gauge < 0)
+        return;
+
+    QMutexLocker locker(&registry->mutex);
+    if (gauge >= registry->gauges.size())
+        registry->gauges.resize(gauge + 1);
+    registry->gauges[gauge] = value;
+}
+
+/// Records a \a value, for instance a latency, in the given \a histogram.
+///
+/// \param histogram a handle returned by histogram()
+/// \param value
+
+void QXmppMetrics::recordValue(int histogram, qint64 value)
+{
+    QXmppMetricsThreadData *data = localData();
+    if (!data || histogram < 0)
+        return;
+
+    QMutexLocker locker(&data->mutex);
+    if (histogram >= data->histograms.size())
+        data->histograms.resize(histogram + 1);
+    data->histograms[histogram].record(value);
+}
+
+/// Returns the current value of all the metrics, added up over all threads.
+///
+/// Counters and gauges are reported under their name. For each histogram
+/// which recorded values, the entries "<name>.count", "<name>.mean",
+/// "<name>.p50", "<name>.p90", "<name>.p99" and "<name>.max" are reported.
+
+QVariantMap QXmppMetrics::snapshot()
+{
+    QVariantMap values;
+    QXmppMetricsRegistry *registry = metricsRegistry();
+    if (!registry)
+        return values;
+
+    QXmppMetricsThreadData total;
+    QMutexLocker locker(&registry->mutex);
+    registry->ended.addTo(total);
+    foreach (const QXmppMetricsThreadData *data, registry->threads)
+        data->addTo(total);
+
+    for (int i = 0; i < registry->counterNames.size(); ++i)
+        values.insert(registry->counterNames.at(i), i < total.counters.size() ? total.counters.at(i) : qint64(0));
+    for (int i = 0; i < registry->gaugeNames.size(); ++i)
+        values.insert(registry->gaugeNames.at(i), i < registry->gauges.size() ? registry->gauges.at(i) : 0.0);
+    for (int i = 0; i < registry->histogramNames.size() && i < total.histograms.size(); ++i) {
+        const QXmppMetricsHistogram &histogram = total.histograms.at(i);
+        if (!histogram.count)
+            continue;
+        const QString name = registry->histogramNames.at(i);
+        values.insert(name + ".count", histogram.count);
+        values.insert(name + ".mean", double(histogram.sum) / histogram.count);
+        values.insert(name + ".p50", histogram.percentile(0.50));
+        values.insert(name + ".p90", histogram.percentile(0.90));
+        values.insert(name + ".p99", histogram.percentile(0.99));
+        values.insert(name + ".max", histogram.maximum);
+    }
+    return values;
+}
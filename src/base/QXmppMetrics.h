@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPMETRICS_H
+#define QXMPPMETRICS_H
+
+#include <QString>
+#include <QVariantMap>
+
+#include "QXmppGlobal.h"
+
+/// \brief The QXmppMetrics class is a registry of the counters, gauges and
+/// histograms of the process.
+///
+/// Metrics are registered once by name, which returns an integer handle.
+/// Updating a metric through its handle does not look up its name, and
+/// counters and histograms are kept per thread so that threads do not
+/// contend with each other. They are only added up when a snapshot() is
+/// taken.
+///
+/// The base implementations of QXmppLogger::setGauge() and
+/// QXmppLogger::updateCounter() record the values they receive here.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppMetrics
+{
+public:
+    static int counter(const QString &name);
+    static int gauge(const QString &name);
+    static int histogram(const QString &name);
+
+    static void updateCounter(int counter, qint64 amount = 1);
+    static void setGauge(int gauge, double value);
+    static void recordValue(int histogram, qint64 value);
+
+    static QVariantMap snapshot();
+};
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+
+#include "QXmppOutputScheduler_p.h"
+
+// The bytes a class of weight 1 may send in each round.
+static const qint64 quantum = 4096;
+
+static const char ns_ibb[] = "http://jabber.org/protocol/ibb";
+
+QXmppOutputScheduler::QXmppOutputScheduler()
+    : m_current(IqClass)
+    , m_credited(false)
+    , m_count(0)
+    , m_size(0)
+    , m_coalescePresences(false)
+{
+    static const int defaultWeights[ClassCount] = { 0, 8, 4, 2, 1, 1 };
+    for (int i = 0; i < ClassCount; ++i) {
+        m_weights[i] = defaultWeights[i];
+        m_deficits[i] = 0;
+    }
+}
+
+/// Returns the share of the link given to a class, relative to the other
+/// classes. The weight of the control class is ignored.
+
+int QXmppOutputScheduler::weight(Class cls) const
+{
+    return m_weights[cls];
+}
+
+/// Sets the share of the link given to a class.
+///
+/// The default weights are 8 for IQs, 4 for chat messages, 2 for
+/// groupchat messages and 1 for presences and bulk data.
+///
+/// \param cls
+/// \param weight
+
+void QXmppOutputScheduler::setWeight(Class cls, int weight)
+{
+    if (cls != ControlClass && cls < ClassCount)
+        m_weights[cls] = qMax(1, weight);
+}
+
+/// Returns true if a queued presence is replaced by a newer one from the
+/// same sender to the same recipient.
+
+bool QXmppOutputScheduler::presenceCoalescingEnabled() const
+{
+    return m_coalescePresences;
+}
+
+/// Sets whether a queued presence is replaced by a newer one from the
+/// same sender to the same recipient.
+///
+/// \param enabled
+
+void QXmppOutputScheduler::setPresenceCoalescingEnabled(bool enabled)
+{
+    m_coalescePresences = enabled;
+}
+
+/// Returns true if no data is queued.
+
+bool QXmppOutputScheduler::isEmpty() const
+{
+    return !m_count;
+}
+
+/// Returns the number of queued elements.
+
+int QXmppOutputScheduler::count() const
+{
+    return m_count;
+}
+
+/// Returns the amount of queued data in bytes.
+
+qint64 QXmppOutputScheduler::size() const
+{
+    return m_size;
+}
+
+/// Drops all the queued data.
+
+void QXmppOutputScheduler::clear()
+{
+    for (int i = 0; i < ClassCount; ++i) {
+        m_queues[i].clear();
+        m_deficits[i] = 0;
+    }
+    m_presences.clear();
+    m_current = IqClass;
+    m_credited = false;
+    m_count = 0;
+    m_size = 0;
+}
+
+/// Queues a serialized top-level element.
+///
+/// Returns true if the element replaced a queued presence.
+///
+/// \param data
+
+bool QXmppOutputScheduler::enqueue(const QByteArray &data)
+{
+    const Class cls = classify(data);
+
+    Item item;
+    if (cls == PresenceClass && m_coalescePresences) {
+        const QByteArray type = startTagAttribute(data, "type");
+        if (type.isEmpty() || type == "unavailable") {
+            item.key = startTagAttribute(data, "from") + '\0' + startTagAttribute(data, "to");
+
+            QHash<QByteArray, QLinkedList<Item>::iterator>::iterator it = m_presences.find(item.key);
+            if (it != m_presences.end()) {
+                m_size += data.size() - it.value()->data.size();
+                it.value()->data = data;
+                return true;
+            }
+        }
+    }
+
+    item.data = data;
+    m_queues[cls].append(item);
+    if (!item.key.isEmpty())
+        m_presences.insert(item.key, --m_queues[cls].end());
+    m_count++;
+    m_size += data.size();
+    return false;
+}
+
+/// Removes and returns the element which should be written next, or an
+/// empty QByteArray if no data is queued.
+
+QByteArray QXmppOutputScheduler::dequeue()
+{
+    if (!m_count)
+        return QByteArray();
+    if (!m_queues[ControlClass].isEmpty())
+        return take(ControlClass);
+
+    // deficit round robin over the other classes
+    forever {
+        QLinkedList<Item> &queue = m_queues[m_current];
+        if (!queue.isEmpty()) {
+            if (!m_credited) {
+                m_deficits[m_current] += m_weights[m_current] * quantum;
+                m_credited = true;
+            }
+            const qint64 size = queue.first().data.size();
+            if (size <= m_deficits[m_current]) {
+                m_deficits[m_current] -= size;
+                return take(m_current);
+            }
+        } else {
+            // an idle class does not save up credit
+            m_deficits[m_current] = 0;
+        }
+
+        m_current = (m_current + 1 < ClassCount) ? m_current + 1 : IqClass;
+        m_credited = false;
+    }
+}
+
+QByteArray QXmppOutputScheduler::take(int cls)
+{
+    const Item item = m_queues[cls].takeFirst();
+    if (!item.key.isEmpty())
+        m_presences.remove(item.key);
+    m_count--;
+    m_size -= item.data.size();
+    return item.data;
+}
+
+/// Returns the class of a serialized top-level element.
+///
+/// \param data
+
+QXmppOutputScheduler::Class QXmppOutputScheduler::classify(const QByteArray &data)
+{
+    if (data.startsWith("<presence"))
+        return PresenceClass;
+
+    const bool isIq = data.startsWith("<iq");
+    const bool isMessage = !isIq && data.startsWith("<message");
+    if (!isIq && !isMessage)
+        return ControlClass;
+
+    // XEP-0047: In-Band Bytestreams
+    if (data.contains(ns_ibb))
+        return BulkClass;
+
+    if (isIq)
+        return IqClass;
+    return startTagAttribute(data, "type") == "groupchat" ? GroupChatClass : ChatClass;
+}
+
+/// Returns the value of an attribute of the start tag of a serialized
+/// stanza, without parsing it.
+///
+/// \param data
+/// \param name
+
+QByteArray QXmppOutputScheduler::startTagAttribute(const QByteArray &data, const QByteArray &name)
+{
+    const int end = data.indexOf('>');
+    const QByteArray needle = ' ' + name + '=';
+    const int pos = data.indexOf(needle);
+    if (pos < 0 || pos + needle.size() >= end)
+        return QByteArray();
+
+    const int start = pos + needle.size() + 1;
+    const int close = data.indexOf(data.at(start - 1), start);
+    if (close < 0 || close > end)
+        return QByteArray();
+    return data.mid(start, close - start);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+
+#ifndef QXMPPOUTPUTSCHEDULER_P_H
+#define QXMPPOUTPUTSCHEDULER_P_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QLinkedList>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppOutputScheduler class holds the outgoing data of a stream
+/// which cannot be written yet, sorted into priority classes.
+///
+/// Control data, such as stream errors, always comes first. The other
+/// classes share the link by deficit round robin: each round, a class
+/// may send weight() times 4096 bytes, so that bulk data keeps flowing
+/// while IQs and messages overtake it. Within a class, data keeps its
+/// order.
+///
+/// With presence coalescing, an available or unavailable presence
+/// replaces the one of the same sender to the same recipient which is
+/// still queued.
+
+class QXMPP_AUTOTEST_EXPORT QXmppOutputScheduler
+{
+public:
+    enum Class
+    {
+        ControlClass = 0,
+        IqClass,
+        ChatClass,
+        GroupChatClass,
+        PresenceClass,
+        BulkClass,
+        ClassCount
+    };
+
+    QXmppOutputScheduler();
+
+    int weight(Class cls) const;
+    void setWeight(Class cls, int weight);
+
+    bool presenceCoalescingEnabled() const;
+    void setPresenceCoalescingEnabled(bool enabled);
+
+    bool isEmpty() const;
+    int count() const;
+    qint64 size() const;
+    void clear();
+
+    bool enqueue(const QByteArray &data);
+    QByteArray dequeue();
+
+    static Class classify(const QByteArray &data);
+    static QByteArray startTagAttribute(const QByteArray &data, const QByteArray &name);
+
+private:
+    struct Item
+    {
+        QByteArray key;
+        QByteArray data;
+    };
+
+    QByteArray take(int cls);
+
+    QLinkedList<Item> m_queues[ClassCount];
+    int m_weights[ClassCount];
+    qint64 m_deficits[ClassCount];
+    int m_current;
+    bool m_credited;
+    int m_count;
+    qint64 m_size;
+
+    bool m_coalescePresences;
+    QHash<QByteArray, QLinkedList<Item>::iterator> m_presences;
+};
+
+#endif
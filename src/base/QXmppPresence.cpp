@@ -28,6 +28,8 @@
 #include <QDomElement>
 #include <QXmlStreamWriter>
 #include "QXmppConstants.h"
+#include "QXmppEnumTable_p.h"
+#include "QXmppStringPool_p.h"
 
 static const char* presence_types[] = {
     "error",
@@ -49,6 +51,11 @@ static const char* presence_shows[] = {
     "invisible"
 };
 
+Q_GLOBAL_STATIC_WITH_ARGS(QXmppEnumTable, presenceTypes,
+    (presence_types, int(sizeof(presence_types) / sizeof(presence_types[0]))))
+Q_GLOBAL_STATIC_WITH_ARGS(QXmppEnumTable, presenceShows,
+    (presence_shows, int(sizeof(presence_shows) / sizeof(presence_shows[0]))))
+
 class QXmppPresencePrivate : public QSharedData
 {
 public:
@@ -192,21 +199,10 @@ void QXmppPresence::parse(const QDomElement &element)
 {
     QXmppStanza::parse(element);
 
-    const QString type = element.attribute("type");
-    for (int i = Error; i <= Probe; i++) {
-        if (type == presence_types[i]) {
-            d->type = static_cast<Type>(i);
-            break;
-        }
-    }
-    const QString show = element.firstChildElement("show").text();
-    for (int i = Online; i <= Invisible; i++) {
-        if (show == presence_shows[i]) {
-            d->availableStatusType = static_cast<AvailableStatusType>(i);
-            break;
-        }
-    }
-    d->statusText = element.firstChildElement("status").text();
+    d->type = static_cast<Type>(presenceTypes()->fromString(element.attribute("type"), d->type));
+    d->availableStatusType = static_cast<AvailableStatusType>(presenceShows()->fromString(
+        element.firstChildElement("show").text(), d->availableStatusType));
+    d->statusText = QXmppStringPool::shared(element.firstChildElement("status").text());
     d->priority = element.firstChildElement("priority").text().toInt();
 
     QXmppElementList extensions;
@@ -251,10 +247,12 @@ void QXmppPresence::parse(const QDomElement &element)
         // XEP-0115: Entity Capabilities
         else if(xElement.tagName() == "c" && xElement.namespaceURI() == ns_capabilities)
         {
-            d->capabilityNode = xElement.attribute("node");
-            d->capabilityVer = QByteArray::fromBase64(xElement.attribute("ver").toLatin1());
-            d->capabilityHash = xElement.attribute("hash");
-            d->capabilityExt = xElement.attribute("ext").split(" ", QString::SkipEmptyParts);
+            d->capabilityNode = QXmppStringPool::shared(xElement.attribute("node"));
+            d->capabilityVer = QXmppStringPool::shared(QByteArray::fromBase64(xElement.attribute("ver").toLatin1()));
+            d->capabilityHash = QXmppStringPool::shared(xElement.attribute("hash"));
+            d->capabilityExt.clear();
+            foreach (const QString &ext, xElement.attribute("ext").split(" ", QString::SkipEmptyParts))
+                d->capabilityExt << QXmppStringPool::shared(ext);
         }
         else if (xElement.tagName() == "addresses")
         {
@@ -288,9 +286,9 @@ void QXmppPresence::toXml(QXmlStreamWriter *xmlWriter) const
     helperToXmlAddAttribute(xmlWriter,"id", id());
     helperToXmlAddAttribute(xmlWriter,"to", to());
     helperToXmlAddAttribute(xmlWriter,"from", from());
-    helperToXmlAddAttribute(xmlWriter,"type", presence_types[d->type]);
+    helperToXmlAddAttribute(xmlWriter,"type", presenceTypes()->toString(d->type));
 
-    const QString show = presence_shows[d->availableStatusType];
+    const QString show = presenceShows()->toString(d->availableStatusType);
     if (!show.isEmpty())
         helperToXmlAddTextElement(xmlWriter, "show", show);
     if (!d->statusText.isEmpty())
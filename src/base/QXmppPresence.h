@@ -78,6 +78,16 @@ public:
     ~QXmppPresence();
 
     QXmppPresence& operator=(const QXmppPresence &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QXmppPresence(QXmppPresence &&other)
+        : QXmppStanza(static_cast<QXmppStanza&&>(other)) { d.swap(other.d); }
+    QXmppPresence& operator=(QXmppPresence &&other)
+    {
+        QXmppStanza::operator=(static_cast<QXmppStanza&&>(other));
+        d.swap(other.d);
+        return *this;
+    }
+#endif
 
     AvailableStatusType availableStatusType() const;
     void setAvailableStatusType(AvailableStatusType type);
@@ -27,7 +27,7 @@
 #include "QXmppPubSubIq.h"
 #include "QXmppUtils.h"
 
-static const char *ns_pubsub = "http://jabber.org/protocol/pubsub";
+static const QLatin1String ns_pubsub("http://jabber.org/protocol/pubsub");
 
 static const char *pubsub_queries[] = {
     "affiliations",
@@ -159,6 +159,24 @@ void QXmppPubSubIq::setSubscriptionId(const QString &subscriptionId)
     m_subscriptionId = subscriptionId;
 }
 
+/// Returns the options which a publish request sets on the node, if it
+/// does not exist yet, or requires the node to have.
+
+QXmppDataForm QXmppPubSubIq::publishOptions() const
+{
+    return m_publishOptions;
+}
+
+/// Sets the options which a publish request sets on the node, if it does
+/// not exist yet, or requires the node to have.
+///
+/// \param options
+
+void QXmppPubSubIq::setPublishOptions(const QXmppDataForm &options)
+{
+    m_publishOptions = options;
+}
+
 /// Returns the IQ's items.
 ///
 
@@ -225,6 +243,12 @@ void QXmppPubSubIq::parseElementFromChild(const QDomElement &element)
     default:
         break;
     }
+
+    // publish options
+    const QDomElement optionsElement = pubSubElement.firstChildElement("publish-options");
+    m_publishOptions = QXmppDataForm();
+    if (m_queryType == QXmppPubSubIq::PublishQuery && !optionsElement.isNull())
+        m_publishOptions.parse(optionsElement.firstChildElement("x"));
 }
 
 void QXmppPubSubIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -254,6 +278,13 @@ void QXmppPubSubIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
         break;
     }
     writer->writeEndElement();
+
+    // write publish options
+    if (m_queryType == QXmppPubSubIq::PublishQuery && !m_publishOptions.isNull()) {
+        writer->writeStartElement("publish-options");
+        m_publishOptions.toXml(writer);
+        writer->writeEndElement();
+    }
     writer->writeEndElement();
 }
 /// \endcond
@@ -24,6 +24,7 @@
 #ifndef QXMPPPUBSUBIQ_H
 #define QXMPPPUBSUBIQ_H
 
+#include "QXmppDataForm.h"
 #include "QXmppIq.h"
 
 /// \brief The QXmppPubSubItem class represents a publish-subscribe item
@@ -86,6 +87,9 @@ public:
     QString subscriptionId() const;
     void setSubscriptionId(const QString &id);
 
+    QXmppDataForm publishOptions() const;
+    void setPublishOptions(const QXmppDataForm &options);
+
     /// \cond
     static bool isPubSubIq(const QDomElement &element);
     /// \endcond
@@ -103,6 +107,7 @@ private:
     QList<QXmppPubSubItem> m_items;
     QString m_subscriptionId;
     QString m_subscriptionType;
+    QXmppDataForm m_publishOptions;
 };
 
 #endif
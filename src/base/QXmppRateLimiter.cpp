@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QElapsedTimer>
+#include <QMutex>
+
+#include "QXmppRateLimiter.h"
+
+class QXmppRateLimiterPrivate
+{
+public:
+    QXmppRateLimiterPrivate();
+    void refill();
+    int delay() const;
+
+    mutable QMutex mutex;
+    QElapsedTimer timer;
+    qint64 lastRefill;
+
+    qint64 bytesPerSecond;
+    int stanzasPerSecond;
+    double byteTokens;
+    double stanzaTokens;
+};
+
+QXmppRateLimiterPrivate::QXmppRateLimiterPrivate()
+    : lastRefill(0)
+    , bytesPerSecond(0)
+    , stanzasPerSecond(0)
+    , byteTokens(0)
+    , stanzaTokens(0)
+{
+    timer.start();
+}
+
+/// Adds the tokens earned since the last refill, up to one second worth.
+
+void QXmppRateLimiterPrivate::refill()
+{
+    const qint64 now = timer.elapsed();
+    const double elapsed = (now - lastRefill) / 1000.0;
+    lastRefill = now;
+
+    if (bytesPerSecond > 0)
+        byteTokens = qMin(byteTokens + elapsed * bytesPerSecond, double(bytesPerSecond));
+    if (stanzasPerSecond > 0)
+        stanzaTokens = qMin(stanzaTokens + elapsed * stanzasPerSecond, double(stanzasPerSecond));
+}
+
+/// Returns the time in milliseconds until both buckets are out of debt.
+
+int QXmppRateLimiterPrivate::delay() const
+{
+    double seconds = 0;
+    if (bytesPerSecond > 0 && byteTokens < 0)
+        seconds = qMax(seconds, -byteTokens / bytesPerSecond);
+    if (stanzasPerSecond > 0 && stanzaTokens < 0)
+        seconds = qMax(seconds, -stanzaTokens / stanzasPerSecond);
+    return seconds > 0 ? qMax(1, int(seconds * 1000 + 0.5)) : 0;
+}
+
+/// Constructs a new rate limiter.
+///
+/// A rate of 0 means that the corresponding quantity is not limited.
+///
+/// \param bytesPerSecond
+/// \param stanzasPerSecond
+
+QXmppRateLimiter::QXmppRateLimiter(qint64 bytesPerSecond, int stanzasPerSecond)
+    : d(new QXmppRateLimiterPrivate)
+{
+    setRates(bytesPerSecond, stanzasPerSecond);
+}
+
+QXmppRateLimiter::~QXmppRateLimiter()
+{
+    delete d;
+}
+
+/// Returns the maximum rate of incoming data in bytes per second.
+
+qint64 QXmppRateLimiter::bytesPerSecond() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->bytesPerSecond;
+}
+
+/// Returns the maximum rate of incoming stanzas per second.
+
+int QXmppRateLimiter::stanzasPerSecond() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->stanzasPerSecond;
+}
+
+/// Sets the maximum rates of incoming data in bytes per second and of
+/// incoming stanzas per second. A rate of 0 disables the corresponding
+/// limit.
+///
+/// The buckets start full, so changing the rates never delays data which
+/// was already accepted.
+///
+/// \param bytesPerSecond
+/// \param stanzasPerSecond
+
+void QXmppRateLimiter::setRates(qint64 bytesPerSecond, int stanzasPerSecond)
+{
+    QMutexLocker locker(&d->mutex);
+    d->bytesPerSecond = qMax(qint64(0), bytesPerSecond);
+    d->stanzasPerSecond = qMax(0, stanzasPerSecond);
+    d->byteTokens = d->bytesPerSecond;
+    d->stanzaTokens = d->stanzasPerSecond;
+    d->lastRefill = d->timer.elapsed();
+}
+
+/// Takes \a bytes and \a stanzas from the buckets.
+///
+/// Returns 0 if the data is within the limits, otherwise the time in
+/// milliseconds to wait before accepting more data.
+///
+/// \param bytes
+/// \param stanzas
+
+int QXmppRateLimiter::consume(qint64 bytes, int stanzas)
+{
+    QMutexLocker locker(&d->mutex);
+    if (!d->bytesPerSecond && !d->stanzasPerSecond)
+        return 0;
+
+    d->refill();
+    if (d->bytesPerSecond > 0)
+        d->byteTokens -= bytes;
+    if (d->stanzasPerSecond > 0)
+        d->stanzaTokens -= stanzas;
+    return d->delay();
+}
+
+/// Returns the time in milliseconds to wait before accepting more data,
+/// or 0 if data is accepted.
+
+int QXmppRateLimiter::delay() const
+{
+    QMutexLocker locker(&d->mutex);
+    if (!d->bytesPerSecond && !d->stanzasPerSecond)
+        return 0;
+
+    d->refill();
+    return d->delay();
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPRATELIMITER_H
+#define QXMPPRATELIMITER_H
+
+#include "QXmppGlobal.h"
+
+class QXmppRateLimiterPrivate;
+
+/// \brief The QXmppRateLimiter class limits the rate of incoming data with
+/// a token bucket, both in bytes and in stanzas per second.
+///
+/// Each bucket holds up to one second worth of tokens, which allows short
+/// bursts. Consuming more tokens than are available puts the bucket in
+/// debt, and consume() returns how long to wait until it is refilled.
+///
+/// A limiter may be shared by several streams, for instance all the
+/// streams of a user, and its methods may be called from any thread.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppRateLimiter
+{
+public:
+    QXmppRateLimiter(qint64 bytesPerSecond = 0, int stanzasPerSecond = 0);
+    ~QXmppRateLimiter();
+
+    qint64 bytesPerSecond() const;
+    int stanzasPerSecond() const;
+    void setRates(qint64 bytesPerSecond, int stanzasPerSecond);
+
+    int consume(qint64 bytes, int stanzas);
+    int delay() const;
+
+private:
+    Q_DISABLE_COPY(QXmppRateLimiter)
+    QXmppRateLimiterPrivate * const d;
+};
+
+#endif
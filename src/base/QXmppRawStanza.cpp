@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <cstring>
+
+#include <QDomDocument>
+
+#include "QXmppRawStanza.h"
+#include "QXmppRawStanza_p.h"
+#include "QXmppStanza.h"
+#include "QXmppUtils.h"
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static QByteArray escapeAttribute(const QString &value)
+{
+    QByteArray escaped = value.toUtf8();
+    escaped.replace('&', "&amp;");
+    escaped.replace('<', "&lt;");
+    escaped.replace('>', "&gt;");
+    escaped.replace('\'', "&apos;");
+    escaped.replace('"', "&quot;");
+    return escaped;
+}
+
+/// Looks for the attribute called \a name in the start tag of \a data.
+///
+/// Returns the position of the attribute's value and stores the position
+/// of its closing quote in \a valueEnd. If the attribute is not present,
+/// returns -1 and stores the position at which it can be inserted in
+/// \a valueEnd, or -1 if the start tag is malformed.
+
+static int findAttribute(const QByteArray &data, const QByteArray &name, int *valueEnd)
+{
+    const int size = data.size();
+    *valueEnd = -1;
+
+    // skip the element's name
+    int i = 1;
+    while (i < size && !isSpace(data[i]) && data[i] != '/' && data[i] != '>')
+        ++i;
+
+    // look for the attribute
+    for (;;) {
+        while (i < size && isSpace(data[i]))
+            ++i;
+        if (i >= size || data[i] == '/' || data[i] == '>')
+            break;
+
+        const int nameStart = i;
+        while (i < size && data[i] != '=' && !isSpace(data[i]))
+            ++i;
+        const bool matches = (i - nameStart == name.size() &&
+                              !memcmp(data.constData() + nameStart, name.constData(), name.size()));
+
+        while (i < size && data[i] != '\'' && data[i] != '"')
+            ++i;
+        if (i >= size)
+            return -1;
+        const char quote = data[i];
+        const int valueStart = ++i;
+        while (i < size && data[i] != quote)
+            ++i;
+        if (i >= size)
+            return -1;
+
+        if (matches) {
+            *valueEnd = i;
+            return valueStart;
+        }
+        ++i;
+    }
+    *valueEnd = i;
+    return -1;
+}
+
+static QString unescapeAttribute(const QByteArray &value)
+{
+    QString unescaped = QString::fromUtf8(value);
+    unescaped.replace(QLatin1String("&lt;"), QLatin1String("<"));
+    unescaped.replace(QLatin1String("&gt;"), QLatin1String(">"));
+    unescaped.replace(QLatin1String("&apos;"), QLatin1String("'"));
+    unescaped.replace(QLatin1String("&quot;"), QLatin1String("\""));
+    unescaped.replace(QLatin1String("&amp;"), QLatin1String("&"));
+    return unescaped;
+}
+
+/// Constructs a null raw stanza.
+
+QXmppRawStanza::QXmppRawStanza()
+    : d(new QXmppRawStanzaPrivate)
+{
+}
+
+/// Constructs a raw stanza by serializing \a stanza.
+///
+/// This allows a stanza to be sent to several recipients while only
+/// serializing it once, setAttribute() being used to rewrite its "to"
+/// attribute for each of them.
+
+QXmppRawStanza::QXmppRawStanza(const QXmppStanza &stanza)
+    : d(new QXmppRawStanzaPrivate)
+{
+    d->data = helperToXmlData(stanza);
+    if (d->data.isEmpty())
+        return;
+
+    int nameEnd = 1;
+    while (nameEnd < d->data.size() && !isSpace(d->data[nameEnd]) &&
+           d->data[nameEnd] != '/' && d->data[nameEnd] != '>')
+        ++nameEnd;
+    d->tagName = QString::fromUtf8(d->data.constData() + 1, nameEnd - 1);
+    d->from = stanza.from();
+    d->id = stanza.id();
+    d->to = stanza.to();
+
+    int valueEnd;
+    const int valueStart = findAttribute(d->data, "type", &valueEnd);
+    if (valueStart >= 0)
+        d->type = unescapeAttribute(d->data.mid(valueStart, valueEnd - valueStart));
+}
+
+/// Constructs a copy of \a other.
+
+QXmppRawStanza::QXmppRawStanza(const QXmppRawStanza &other)
+    : d(other.d)
+{
+}
+
+/// Destroys the raw stanza.
+
+QXmppRawStanza::~QXmppRawStanza()
+{
+}
+
+/// Assigns \a other to this raw stanza.
+
+QXmppRawStanza& QXmppRawStanza::operator=(const QXmppRawStanza &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/// Returns true if the raw stanza holds no data.
+
+bool QXmppRawStanza::isNull() const
+{
+    return d->data.isEmpty();
+}
+
+/// Returns the element's bytes, exactly as they were received unless they
+/// were modified using setAttribute().
+
+QByteArray QXmppRawStanza::data() const
+{
+    return d->data;
+}
+
+/// Returns the element as a QDomElement.
+///
+/// If no DOM tree was built while the stream was parsed, it is built
+/// from data() the first time this method is called.
+
+QDomElement QXmppRawStanza::element() const
+{
+    if (d->element.isNull() && !d->data.isEmpty()) {
+        // the namespaces declared on the stream's root element are needed
+        // to parse the element on its own
+        QDomDocument document;
+        if (document.setContent("<root" + d->context + ">" + d->data + "</root>", true))
+            d->element = document.documentElement().firstChildElement();
+        d->document = document;
+    }
+    return d->element;
+}
+
+/// Returns the element's tag name, without any namespace prefix.
+
+QString QXmppRawStanza::tagName() const
+{
+    return d->tagName;
+}
+
+/// Returns the element's namespace URI.
+
+QString QXmppRawStanza::namespaceURI() const
+{
+    return d->namespaceUri;
+}
+
+/// Returns the element's "from" attribute.
+
+QString QXmppRawStanza::from() const
+{
+    return d->from;
+}
+
+/// Returns the element's "id" attribute.
+
+QString QXmppRawStanza::id() const
+{
+    return d->id;
+}
+
+/// Returns the element's "to" attribute.
+
+QString QXmppRawStanza::to() const
+{
+    return d->to;
+}
+
+/// Returns the element's "type" attribute.
+
+QString QXmppRawStanza::type() const
+{
+    return d->type;
+}
+
+/// Sets the attribute called \a name of the element's start tag to \a value,
+/// adding the attribute if it is not already present.
+///
+/// Only the start tag is rewritten, the rest of data() is left untouched.
+
+void QXmppRawStanza::setAttribute(const QString &name, const QString &value)
+{
+    if (d->data.isEmpty())
+        return;
+
+    QByteArray &data = d->data;
+    const QByteArray attributeName = name.toUtf8();
+    const QByteArray attributeValue = escapeAttribute(value);
+
+    int valueEnd;
+    const int valueStart = findAttribute(data, attributeName, &valueEnd);
+    if (valueStart >= 0)
+        data.replace(valueStart, valueEnd - valueStart, attributeValue);
+    else if (valueEnd >= 0)
+        data.insert(valueEnd, " " + attributeName + "='" + attributeValue + "'");
+    else
+        return;
+
+    if (name == QLatin1String("from"))
+        d->from = value;
+    else if (name == QLatin1String("id"))
+        d->id = value;
+    else if (name == QLatin1String("to"))
+        d->to = value;
+    else if (name == QLatin1String("type"))
+        d->type = value;
+
+    // the DOM tree will be rebuilt from the new data if needed
+    d->document = QDomDocument();
+    d->element = QDomElement();
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPRAWSTANZA_H
+#define QXMPPRAWSTANZA_H
+
+#include <QByteArray>
+#include <QMetaType>
+#include <QSharedDataPointer>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+class QDomElement;
+class QXmppRawStanzaPrivate;
+class QXmppStanza;
+class QXmppStreamParser;
+
+/// \brief The QXmppRawStanza class holds a top-level element as it was
+/// received on an XMPP stream.
+///
+/// In addition to the element's original bytes, it provides the element's
+/// name, namespace and most commonly used attributes, which are extracted
+/// while the stream is parsed. This allows stanzas which only need to be
+/// forwarded to be handled without building a DOM tree, while element()
+/// remains available for code which needs one.
+///
+/// \ingroup Stanzas
+
+class QXMPP_EXPORT QXmppRawStanza
+{
+public:
+    QXmppRawStanza();
+    explicit QXmppRawStanza(const QXmppStanza &stanza);
+    QXmppRawStanza(const QXmppRawStanza &other);
+    ~QXmppRawStanza();
+
+    QXmppRawStanza& operator=(const QXmppRawStanza &other);
+
+    bool isNull() const;
+
+    QByteArray data() const;
+    QDomElement element() const;
+
+    QString tagName() const;
+    QString namespaceURI() const;
+
+    QString from() const;
+    QString id() const;
+    QString to() const;
+    QString type() const;
+
+    void setAttribute(const QString &name, const QString &value);
+
+private:
+    QSharedDataPointer<QXmppRawStanzaPrivate> d;
+    friend class QXmppStreamParser;
+};
+
+Q_DECLARE_METATYPE(QXmppRawStanza)
+
+#endif
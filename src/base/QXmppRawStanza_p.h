@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPRAWSTANZA_P_H
+#define QXMPPRAWSTANZA_P_H
+
+#include <QDomDocument>
+#include <QDomElement>
+#include <QSharedData>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppRawStanza and QXmppStreamParser classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+class QXmppRawStanzaPrivate : public QSharedData
+{
+public:
+    QByteArray data;
+
+    // namespace declarations in scope for the element
+    QByteArray context;
+
+    QString tagName;
+    QString namespaceUri;
+    QString from;
+    QString id;
+    QString to;
+    QString type;
+
+    // DOM tree, built on demand
+    mutable QDomDocument document;
+    mutable QDomElement element;
+};
+
+#endif
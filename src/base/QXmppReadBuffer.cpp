@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QByteArray>
+#include <QThreadStorage>
+
+#include "QXmppReadBuffer_p.h"
+
+Q_GLOBAL_STATIC(QThreadStorage<QByteArray*>, readBufferStorage)
+
+/// Returns the read buffer of the current thread, which holds Size bytes.
+
+char *QXmppReadBuffer::data()
+{
+    QThreadStorage<QByteArray*> *storage = readBufferStorage();
+    if (!storage->hasLocalData())
+        storage->setLocalData(new QByteArray(Size, '\0'));
+    return storage->localData()->data();
+}
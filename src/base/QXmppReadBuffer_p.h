@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPREADBUFFER_P_H
+#define QXMPPREADBUFFER_P_H
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream and QXmppTransferManager classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppReadBuffer class gives access to a buffer which the sockets of
+/// a thread read into, instead of allocating a new buffer for each read.
+///
+/// The buffer is only valid until the caller returns to the event loop,
+/// and must not be kept across calls which may read from other sockets.
+/// Idle connections thus hold no read buffer at all.
+
+class QXMPP_AUTOTEST_EXPORT QXmppReadBuffer
+{
+public:
+    enum { Size = 65536 };
+
+    static char *data();
+};
+
+#endif
@@ -28,6 +28,7 @@
 #include <QDateTime>
 #include <QStringList>
 
+#include "QXmppBase64_p.h"
 #include "QXmppConstants.h"
 #include "QXmppRpcIq.h"
 #include "QXmppUtils.h"
@@ -87,7 +88,7 @@ void QXmppRpcMarshaller::marshall(QXmlStreamWriter *writer, const QVariant &valu
         }
         case QVariant::ByteArray:
         {
-            writer->writeTextElement("base64", value.toByteArray().toBase64() );
+            writer->writeTextElement("base64", QXmppBase64::encode(value.toByteArray()) );
             break;
         }
         default:
@@ -175,10 +176,7 @@ QVariant QXmppRpcMarshaller::demarshall(const QDomElement &elem, QStringList &er
     }
     else if( typeName == "base64" )
     {
-        QVariant returnVariant;
-        QByteArray dest;
-        QByteArray src = typeData.text().toLatin1();
-        return QVariant(QByteArray::fromBase64(src));
+        return QVariant(QXmppBase64::decode(typeData.text()));
     }
 
     errors << QString( "Cannot handle type %1").arg(typeName);
@@ -395,6 +395,16 @@ void QXmppRtcpReceiverReport::setFractionLost(quint8 fractionLost)
     d->fractionLost = fractionLost;
 }
 
+quint32 QXmppRtcpReceiverReport::highestSequence() const
+{
+    return d->highestSequence;
+}
+
+void QXmppRtcpReceiverReport::setHighestSequence(quint32 sequence)
+{
+    d->highestSequence = sequence;
+}
+
 quint32 QXmppRtcpReceiverReport::jitter() const
 {
     return d->jitter;
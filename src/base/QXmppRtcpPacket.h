@@ -100,6 +100,9 @@ public:
     quint8 fractionLost() const;
     void setFractionLost(quint8 fractionLost);
 
+    quint32 highestSequence() const;
+    void setHighestSequence(quint32 sequence);
+
     quint32 jitter() const;
     void setJitter(quint32 jitter);
 
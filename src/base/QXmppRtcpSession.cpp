@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QDateTime>
+
+#include "QXmppRtcpSession_p.h"
+#include "QXmppRtpPacket.h"
+#include "QXmppUtils.h"
+
+// offset between the NTP and UNIX epochs, in seconds
+static const quint64 ntpEpochOffset = Q_UINT64_C(2208988800);
+
+// the maximum interval between reports, in seconds
+static const double rtcpMaximumInterval = 5.0;
+
+// the size of the IP and UDP headers, in bytes
+static const int udpOverhead = 28;
+
+QXmppRtcpSession::QXmppRtcpSession()
+    : m_bandwidth(64000)
+    , m_averageSize(100)
+    , m_initial(true)
+    , m_incomingValid(false)
+    , m_incomingSsrc(0)
+    , m_incomingClockrate(0)
+    , m_incomingMaxSequence(0)
+    , m_incomingCycles(0)
+    , m_incomingBaseSequence(0)
+    , m_incomingReceived(0)
+    , m_incomingExpectedPrior(0)
+    , m_incomingReceivedPrior(0)
+    , m_incomingFractionLost(0)
+    , m_incomingJitter(0)
+    , m_incomingTransit(0)
+    , m_incomingTransitValid(false)
+    , m_incomingReportStamp(0)
+    , m_incomingReportTime(0)
+    , m_outgoingPackets(0)
+    , m_outgoingOctets(0)
+    , m_outgoingStamp(0)
+    , m_remoteReportValid(false)
+    , m_roundTripTime(-1)
+{
+    // a random canonical name, as recommended by RFC 7022
+    m_cname = QString::fromLatin1(QXmppUtils::generateRandomBytes(12).toBase64());
+    m_clock.start();
+}
+
+/// Returns the session bandwidth in bits per second, which determines the
+/// interval between reports.
+
+int QXmppRtcpSession::bandwidth() const
+{
+    return m_bandwidth;
+}
+
+/// Sets the session bandwidth in bits per second.
+///
+/// \param bandwidth
+
+void QXmppRtcpSession::setBandwidth(int bandwidth)
+{
+    m_bandwidth = qMax(1000, bandwidth);
+}
+
+/// Returns the canonical name sent in the source descriptions.
+
+QString QXmppRtcpSession::cname() const
+{
+    return m_cname;
+}
+
+/// Updates the reception statistics with an incoming \a packet.
+///
+/// \param packet
+/// \param clockrate The clockrate of the packet's payload type.
+
+void QXmppRtcpSession::packetReceived(const QXmppRtpPacket &packet, quint32 clockrate)
+{
+    const quint16 sequence = packet.sequence();
+    const quint16 delta = sequence - m_incomingMaxSequence;
+    if (!m_incomingValid || packet.ssrc() != m_incomingSsrc || (delta >= 3000 && delta <= 65436)) {
+        // new source or a large jump in the sequence numbers
+        m_incomingValid = true;
+        m_incomingSsrc = packet.ssrc();
+        m_incomingMaxSequence = sequence;
+        m_incomingCycles = 0;
+        m_incomingBaseSequence = sequence;
+        m_incomingReceived = 0;
+        m_incomingExpectedPrior = 0;
+        m_incomingReceivedPrior = 0;
+        m_incomingFractionLost = 0;
+        m_incomingJitter = 0;
+        m_incomingTransitValid = false;
+    } else if (delta < 3000) {
+        // in order, possibly with a gap
+        if (sequence < m_incomingMaxSequence)
+            m_incomingCycles += 65536;
+        m_incomingMaxSequence = sequence;
+    }
+    m_incomingReceived++;
+
+    // interarrival jitter
+    if (clockrate != m_incomingClockrate) {
+        m_incomingClockrate = clockrate;
+        m_incomingTransitValid = false;
+    }
+    const quint32 arrival = quint32(m_clock.elapsed() * clockrate / 1000);
+    const quint32 transit = arrival - packet.stamp();
+    if (m_incomingTransitValid) {
+        const qint32 difference = qint32(transit - m_incomingTransit);
+        m_incomingJitter += (qAbs(double(difference)) - m_incomingJitter) / 16.0;
+    }
+    m_incomingTransit = transit;
+    m_incomingTransitValid = true;
+}
+
+/// Updates the transmission statistics with an outgoing packet.
+///
+/// \param stamp The RTP timestamp of the packet.
+/// \param payloadSize The size of the packet's payload, in bytes.
+
+void QXmppRtcpSession::packetSent(quint32 stamp, int payloadSize)
+{
+    m_outgoingPackets++;
+    m_outgoingOctets += payloadSize;
+    m_outgoingStamp = stamp;
+}
+
+/// Returns a compound RTCP packet made of a sender or receiver report and
+/// a source description, which starts a new reporting interval.
+///
+/// \param localSsrc The SSRC of the outgoing stream.
+/// \param goodbye Whether to append a goodbye packet.
+
+QByteArray QXmppRtcpSession::generateReport(quint32 localSsrc, bool goodbye)
+{
+    QByteArray datagram;
+    QDataStream stream(&datagram, QIODevice::WriteOnly);
+
+    QXmppRtcpPacket report;
+    report.setSsrc(localSsrc);
+    if (m_outgoingPackets) {
+        QXmppRtcpSenderInfo info;
+        info.setNtpStamp(ntpTime());
+        info.setRtpStamp(m_outgoingStamp);
+        info.setPacketCount(m_outgoingPackets);
+        info.setOctetCount(m_outgoingOctets);
+        report.setType(QXmppRtcpPacket::SenderReport);
+        report.setSenderInfo(info);
+    } else {
+        report.setType(QXmppRtcpPacket::ReceiverReport);
+    }
+    if (m_incomingValid)
+        report.setReceiverReports(QList<QXmppRtcpReceiverReport>() << receptionReport());
+    report.write(stream);
+
+    QXmppRtcpSourceDescription description;
+    description.setSsrc(localSsrc);
+    description.setCname(m_cname);
+    QXmppRtcpPacket sdes;
+    sdes.setType(QXmppRtcpPacket::SourceDescription);
+    sdes.setSourceDescriptions(QList<QXmppRtcpSourceDescription>() << description);
+    sdes.write(stream);
+
+    if (goodbye) {
+        QXmppRtcpPacket bye;
+        bye.setType(QXmppRtcpPacket::Goodbye);
+        bye.setGoodbyeSsrcs(QList<quint32>() << localSsrc);
+        bye.write(stream);
+    }
+
+    m_initial = false;
+    updateAverageSize(datagram.size());
+    return datagram;
+}
+
+/// Processes an incoming compound RTCP packet, and returns true if it
+/// contained a reception report about the outgoing stream.
+///
+/// \param datagram
+/// \param localSsrc The SSRC of the outgoing stream.
+
+bool QXmppRtcpSession::handleReport(const QByteArray &datagram, quint32 localSsrc)
+{
+    bool reported = false;
+    updateAverageSize(datagram.size());
+
+    QDataStream stream(datagram);
+    QXmppRtcpPacket packet;
+    while (!stream.atEnd() && packet.read(stream)) {
+        if (packet.type() == QXmppRtcpPacket::SenderReport) {
+            m_incomingReportStamp = quint32(packet.senderInfo().ntpStamp() >> 16);
+            m_incomingReportTime = qMax(qint64(1), m_clock.elapsed());
+        }
+        if (packet.type() == QXmppRtcpPacket::SenderReport ||
+            packet.type() == QXmppRtcpPacket::ReceiverReport) {
+            foreach (const QXmppRtcpReceiverReport &report, packet.receiverReports()) {
+                if (report.ssrc() != localSsrc)
+                    continue;
+
+                // round-trip time, in 1/65536 seconds, which may be slightly
+                // negative due to the granularity of the clocks
+                if (report.lsr()) {
+                    const quint32 now = quint32(ntpTime() >> 16);
+                    const qint32 delay = qint32(now - report.lsr() - report.dlsr());
+                    if (delay > -65536)
+                        m_roundTripTime = int((qint64(qMax(0, delay)) * 1000) >> 16);
+                }
+                m_remoteReport = report;
+                m_remoteReportValid = true;
+                reported = true;
+            }
+        } else if (packet.type() == QXmppRtcpPacket::Goodbye) {
+            if (packet.goodbyeSsrcs().contains(m_incomingSsrc))
+                m_incomingValid = false;
+        }
+    }
+    return reported;
+}
+
+/// Returns the delay until the next report in milliseconds, as described
+/// by RFC 3550 section 6.3.
+///
+/// RTCP is given 5% of the session bandwidth, and the minimum interval
+/// is reduced to 360 / kbps seconds, so that reports are frequent enough
+/// for congestion control.
+
+int QXmppRtcpSession::reportInterval()
+{
+    const double rtcpBandwidth = 0.05 * m_bandwidth / 8.0;
+    double minimum = qMin(rtcpMaximumInterval, 360.0 / (m_bandwidth / 1000.0));
+    if (m_initial)
+        minimum /= 2;
+
+    // there are two members in the session
+    double interval = qMax(minimum, 2 * m_averageSize / rtcpBandwidth);
+
+    // randomize the interval and compensate for timer reconsideration
+    interval *= (0.5 + QXmppUtils::generateRandomInteger(1001) / 1000.0) / 1.21828;
+    return qMax(1, qRound(interval * 1000));
+}
+
+/// Returns the statistics of the channel.
+
+QXmppRtpStatistics QXmppRtcpSession::statistics() const
+{
+    QXmppRtpStatistics stats;
+    stats.m_packetsSent = m_outgoingPackets;
+    stats.m_octetsSent = m_outgoingOctets;
+    stats.m_roundTripTime = m_roundTripTime;
+    if (m_incomingValid) {
+        const quint32 expected = m_incomingCycles + m_incomingMaxSequence - m_incomingBaseSequence + 1;
+        stats.m_packetsReceived = m_incomingReceived;
+        stats.m_packetsLost = int(qint64(expected) - qint64(m_incomingReceived));
+        stats.m_fractionLost = m_incomingFractionLost / 256.0;
+        if (m_incomingClockrate)
+            stats.m_jitter = m_incomingJitter * 1000.0 / m_incomingClockrate;
+    }
+    if (m_remoteReportValid) {
+        stats.m_remoteFractionLost = m_remoteReport.fractionLost() / 256.0;
+        stats.m_remotePacketsLost = m_remoteReport.totalLost();
+    }
+    return stats;
+}
+
+/// Returns the current time in NTP format.
+
+quint64 QXmppRtcpSession::ntpTime()
+{
+    const qint64 msecs = QDateTime::currentMSecsSinceEpoch();
+    return ((quint64(msecs / 1000) + ntpEpochOffset) << 32) |
+           ((quint64(msecs % 1000) << 32) / 1000);
+}
+
+QXmppRtcpReceiverReport QXmppRtcpSession::receptionReport()
+{
+    const quint32 extendedMax = m_incomingCycles + m_incomingMaxSequence;
+    const quint32 expected = extendedMax - m_incomingBaseSequence + 1;
+    const qint64 lost = qint64(expected) - qint64(m_incomingReceived);
+
+    const quint32 expectedInterval = expected - m_incomingExpectedPrior;
+    const quint32 receivedInterval = m_incomingReceived - m_incomingReceivedPrior;
+    const qint64 lostInterval = qint64(expectedInterval) - qint64(receivedInterval);
+    m_incomingExpectedPrior = expected;
+    m_incomingReceivedPrior = m_incomingReceived;
+    m_incomingFractionLost = 0;
+    if (expectedInterval && lostInterval > 0)
+        m_incomingFractionLost = quint8(qMin(qint64(255), (lostInterval << 8) / expectedInterval));
+
+    QXmppRtcpReceiverReport report;
+    report.setSsrc(m_incomingSsrc);
+    report.setHighestSequence(extendedMax);
+    report.setTotalLost(quint32(qBound(qint64(0), lost, qint64(0x7fffff))));
+    report.setFractionLost(m_incomingFractionLost);
+    report.setJitter(quint32(m_incomingJitter));
+    if (m_incomingReportTime) {
+        report.setLsr(m_incomingReportStamp);
+        report.setDlsr(quint32(((m_clock.elapsed() - m_incomingReportTime) << 16) / 1000));
+    }
+    return report;
+}
+
+void QXmppRtcpSession::updateAverageSize(int size)
+{
+    m_averageSize += (size + udpOverhead - m_averageSize) / 16.0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPRTCPSESSION_P_H
+#define QXMPPRTCPSESSION_P_H
+
+#include <QElapsedTimer>
+#include <QString>
+
+#include "QXmppRtcpPacket.h"
+#include "QXmppRtpChannel.h"
+
+class QXmppRtpPacket;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppRtpAudioChannel and QXmppRtpVideoChannel classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppRtcpSession class maintains the statistics of an RTP channel
+/// as described by RFC 3550, and generates and processes its RTCP reports.
+
+class QXMPP_AUTOTEST_EXPORT QXmppRtcpSession
+{
+public:
+    QXmppRtcpSession();
+
+    int bandwidth() const;
+    void setBandwidth(int bandwidth);
+
+    QString cname() const;
+
+    void packetReceived(const QXmppRtpPacket &packet, quint32 clockrate);
+    void packetSent(quint32 stamp, int payloadSize);
+
+    QByteArray generateReport(quint32 localSsrc, bool goodbye = false);
+    bool handleReport(const QByteArray &datagram, quint32 localSsrc);
+    int reportInterval();
+
+    QXmppRtpStatistics statistics() const;
+
+    static quint64 ntpTime();
+
+private:
+    QXmppRtcpReceiverReport receptionReport();
+    void updateAverageSize(int size);
+
+    int m_bandwidth;
+    QString m_cname;
+    QElapsedTimer m_clock;
+    double m_averageSize;
+    bool m_initial;
+
+    // reception statistics, see RFC 3550 appendix A.1
+    bool m_incomingValid;
+    quint32 m_incomingSsrc;
+    quint32 m_incomingClockrate;
+    quint16 m_incomingMaxSequence;
+    quint32 m_incomingCycles;
+    quint32 m_incomingBaseSequence;
+    quint32 m_incomingReceived;
+    quint32 m_incomingExpectedPrior;
+    quint32 m_incomingReceivedPrior;
+    quint8 m_incomingFractionLost;
+    double m_incomingJitter;
+    quint32 m_incomingTransit;
+    bool m_incomingTransitValid;
+
+    // middle 32 bits of the NTP time of the last sender report and the
+    // time at which it was received
+    quint32 m_incomingReportStamp;
+    qint64 m_incomingReportTime;
+
+    // transmission statistics
+    quint32 m_outgoingPackets;
+    quint32 m_outgoingOctets;
+    quint32 m_outgoingStamp;
+
+    // the last reception report about the outgoing stream
+    QXmppRtcpReceiverReport m_remoteReport;
+    bool m_remoteReportValid;
+    int m_roundTripTime;
+};
+
+#endif
@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QBasicTimer>
+#include <QElapsedTimer>
+#include <QTimerEvent>
+#include <QVector>
+#include <QtEndian>
+
+#include "QXmppJingleIq.h"
+#include "QXmppRtpAudioMixer.h"
+#include "QXmppRtpChannel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QXMPP_MIXER_SSE2
+#include <emmintrin.h>
+#endif
+
+// duration of a mixed chunk, in milliseconds
+static const int mixerPtime = 20;
+
+// number of chunks a speaker stays active after falling silent
+static const int mixerHangover = 10;
+
+// maximum number of chunks mixed at once to catch up
+static const int mixerMaximumBurst = 3;
+
+// Adds \a count little-endian 16-bit samples to the accumulator.
+static void mixAccumulate(qint32 *acc, const char *input, int count)
+{
+    int i = 0;
+#ifdef QXMPP_MIXER_SSE2
+    for (; i + 8 <= count; i += 8) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * i));
+        __m128i *a = reinterpret_cast<__m128i*>(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)));
+    }
+#endif
+    for (; i < count; ++i)
+        acc[i] += qFromLittleEndian<qint16>(reinterpret_cast<const uchar*>(input + 2 * i));
+}
+
+// Writes the accumulated samples minus those of \a self (if any) to the
+// output, saturating them to 16 bits.
+static void mixWrite(char *output, const qint32 *acc, const char *self, int count)
+{
+    int i = 0;
+#ifdef QXMPP_MIXER_SSE2
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i + 4));
+        if (self) {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(self + 2 * i));
+            lo = _mm_sub_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+            hi = _mm_sub_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < count; ++i) {
+        qint32 value = acc[i];
+        if (self)
+            value -= qFromLittleEndian<qint16>(reinterpret_cast<const uchar*>(self + 2 * i));
+        qToLittleEndian<qint16>(qint16(qBound(-32768, value, 32767)), reinterpret_cast<uchar*>(output + 2 * i));
+    }
+}
+
+class QXmppRtpAudioMixerParticipant
+{
+public:
+    QXmppRtpAudioMixerParticipant(QXmppRtpAudioChannel *channel = 0)
+        : channel(channel),
+        active(false),
+        hangover(0),
+        level(0),
+        mixed(false),
+        rateWarned(false)
+    {
+    }
+
+    QXmppRtpAudioChannel *channel;
+    QByteArray input;
+    bool active;
+    int hangover;
+    int level;
+    bool mixed;
+    bool rateWarned;
+};
+
+class QXmppRtpAudioMixerPrivate
+{
+public:
+    QXmppRtpAudioMixerPrivate();
+    void reschedule(QXmppRtpAudioMixer *q);
+
+    QList<QXmppRtpAudioMixerParticipant> participants;
+    quint32 clockrate;
+    int maximumSpeakers;
+    int speechThreshold;
+
+    // scratch buffers, reused for every chunk
+    QVector<qint32> accumulator;
+    QByteArray output;
+    QByteArray sharedOutput;
+
+    QElapsedTimer clock;
+    qint64 start;
+    qint64 chunks;
+    QBasicTimer timer;
+};
+
+QXmppRtpAudioMixerPrivate::QXmppRtpAudioMixerPrivate()
+    : clockrate(8000),
+    maximumSpeakers(3),
+    speechThreshold(300),
+    start(0),
+    chunks(0)
+{
+}
+
+void QXmppRtpAudioMixerPrivate::reschedule(QXmppRtpAudioMixer *q)
+{
+    if (participants.isEmpty()) {
+        clock.invalidate();
+        timer.stop();
+        return;
+    }
+    if (!clock.isValid()) {
+        clock.start();
+        start = 0;
+        chunks = 0;
+    }
+
+    const qint64 due = start + chunks * mixerPtime;
+    const int delay = qBound(qint64(0), due - clock.elapsed(), qint64(mixerPtime));
+#if QT_VERSION >= 0x050000
+    timer.start(delay, Qt::PreciseTimer, q);
+#else
+    timer.start(delay, q);
+#endif
+}
+
+/// Constructs a new audio mixer with the given \a parent.
+
+QXmppRtpAudioMixer::QXmppRtpAudioMixer(QObject *parent)
+    : QXmppLoggable(parent)
+{
+    d = new QXmppRtpAudioMixerPrivate;
+}
+
+/// Destroys the audio mixer. The channels are not deleted.
+
+QXmppRtpAudioMixer::~QXmppRtpAudioMixer()
+{
+    delete d;
+}
+
+/// Adds an audio \a channel to the conference.
+///
+/// The mixer does not take ownership of the channel, which is removed
+/// automatically when it is destroyed.
+
+void QXmppRtpAudioMixer::addChannel(QXmppRtpAudioChannel *channel)
+{
+    if (!channel || channels().contains(channel))
+        return;
+
+    bool check;
+    Q_UNUSED(check);
+
+    check = connect(channel, SIGNAL(destroyed(QObject*)),
+                    this, SLOT(_q_channelDestroyed(QObject*)));
+    Q_ASSERT(check);
+
+    d->participants << QXmppRtpAudioMixerParticipant(channel);
+    d->reschedule(this);
+}
+
+/// Removes an audio \a channel from the conference.
+
+void QXmppRtpAudioMixer::removeChannel(QXmppRtpAudioChannel *channel)
+{
+    for (int i = 0; i < d->participants.size(); ++i) {
+        if (d->participants[i].channel == channel) {
+            const bool wasActive = d->participants[i].mixed;
+            disconnect(channel, SIGNAL(destroyed(QObject*)),
+                       this, SLOT(_q_channelDestroyed(QObject*)));
+            d->participants.removeAt(i);
+            d->reschedule(this);
+            if (wasActive)
+                emit activeChannelsChanged();
+            return;
+        }
+    }
+}
+
+/// Returns the channels in the conference.
+
+QList<QXmppRtpAudioChannel*> QXmppRtpAudioMixer::channels() const
+{
+    QList<QXmppRtpAudioChannel*> channels;
+    foreach (const QXmppRtpAudioMixerParticipant &participant, d->participants)
+        channels << participant.channel;
+    return channels;
+}
+
+/// Returns the channels whose audio is currently being mixed.
+
+QList<QXmppRtpAudioChannel*> QXmppRtpAudioMixer::activeChannels() const
+{
+    QList<QXmppRtpAudioChannel*> channels;
+    foreach (const QXmppRtpAudioMixerParticipant &participant, d->participants) {
+        if (participant.mixed)
+            channels << participant.channel;
+    }
+    return channels;
+}
+
+/// Returns the clock rate of the mixed audio, in Hz.
+
+quint32 QXmppRtpAudioMixer::clockrate() const
+{
+    return d->clockrate;
+}
+
+/// Sets the clock rate of the mixed audio, in Hz.
+///
+/// Channels whose payload type uses a different clock rate are neither
+/// mixed nor fed. The default is 8000 Hz.
+
+void QXmppRtpAudioMixer::setClockrate(quint32 clockrate)
+{
+    d->clockrate = clockrate;
+}
+
+/// Returns the maximum number of participants which are mixed at once.
+
+int QXmppRtpAudioMixer::maximumSpeakers() const
+{
+    return d->maximumSpeakers;
+}
+
+/// Sets the maximum number of participants which are mixed at once.
+///
+/// When more participants are speaking, only the loudest ones are mixed.
+/// The default is 3.
+
+void QXmppRtpAudioMixer::setMaximumSpeakers(int speakers)
+{
+    d->maximumSpeakers = qMax(1, speakers);
+}
+
+/// Returns the mean amplitude above which a participant is considered
+/// to be speaking.
+
+int QXmppRtpAudioMixer::speechThreshold() const
+{
+    return d->speechThreshold;
+}
+
+/// Sets the mean amplitude above which a participant is considered to be
+/// speaking, out of 32767.
+///
+/// Participants stay active for 200 ms after their level drops below the
+/// threshold. The default is 300.
+
+void QXmppRtpAudioMixer::setSpeechThreshold(int threshold)
+{
+    d->speechThreshold = qMax(0, threshold);
+}
+
+/// Mixes 20 ms of audio.
+///
+/// This is called automatically by the mixer's timer, you only need to
+/// call it if you drive the mixer yourself.
+
+void QXmppRtpAudioMixer::mix()
+{
+    const int count = d->clockrate * mixerPtime / 1000;
+    const int bytes = count * 2;
+    if (count <= 0)
+        return;
+
+    // read the audio of each participant and detect speech
+    QList<int> speakers;
+    for (int i = 0; i < d->participants.size(); ++i) {
+        QXmppRtpAudioMixerParticipant &participant = d->participants[i];
+        participant.level = 0;
+        if (!(participant.channel->openMode() & QIODevice::ReadOnly))
+            continue;
+        if (participant.channel->payloadType().clockrate() != d->clockrate) {
+            if (!participant.rateWarned) {
+                warning(QString("Audio mixer cannot mix channel with clock rate %1, expected %2")
+                        .arg(QString::number(participant.channel->payloadType().clockrate()),
+                             QString::number(d->clockrate)));
+                participant.rateWarned = true;
+            }
+            continue;
+        }
+
+        if (participant.input.size() != bytes)
+            participant.input.resize(bytes);
+        if (participant.channel->read(participant.input.data(), bytes) != bytes)
+            continue;
+
+        qint64 sum = 0;
+        const uchar *ptr = reinterpret_cast<const uchar*>(participant.input.constData());
+        for (int j = 0; j < count; ++j)
+            sum += qAbs(int(qFromLittleEndian<qint16>(ptr + 2 * j)));
+        participant.level = int(sum / count);
+
+        if (participant.level >= d->speechThreshold)
+            participant.hangover = mixerHangover;
+        else if (participant.hangover > 0)
+            participant.hangover--;
+        participant.active = participant.hangover > 0;
+
+        if (participant.active) {
+            // keep the speakers sorted by decreasing level
+            int pos = 0;
+            while (pos < speakers.size() && d->participants[speakers[pos]].level >= participant.level)
+                ++pos;
+            speakers.insert(pos, i);
+        }
+    }
+    while (speakers.size() > d->maximumSpeakers)
+        speakers.removeLast();
+
+    // sum the speakers' audio
+    d->accumulator.fill(0, count);
+    bool changed = false;
+    for (int i = 0; i < d->participants.size(); ++i) {
+        QXmppRtpAudioMixerParticipant &participant = d->participants[i];
+        const bool mixed = speakers.contains(i);
+        if (mixed != participant.mixed) {
+            participant.mixed = mixed;
+            changed = true;
+        }
+        if (mixed)
+            mixAccumulate(d->accumulator.data(), participant.input.constData(), count);
+    }
+
+    // send each participant the mix minus its own audio. Participants which
+    // are not mixed all receive the same audio, which is computed once.
+    d->sharedOutput.clear();
+    if (d->output.size() != bytes)
+        d->output.resize(bytes);
+    for (int i = 0; i < d->participants.size(); ++i) {
+        QXmppRtpAudioMixerParticipant &participant = d->participants[i];
+        if (!(participant.channel->openMode() & QIODevice::WriteOnly) ||
+            participant.channel->payloadType().clockrate() != d->clockrate)
+            continue;
+
+        if (participant.mixed) {
+            mixWrite(d->output.data(), d->accumulator.constData(), participant.input.constData(), count);
+            participant.channel->write(d->output.constData(), bytes);
+        } else {
+            if (d->sharedOutput.isEmpty()) {
+                d->sharedOutput.resize(bytes);
+                mixWrite(d->sharedOutput.data(), d->accumulator.constData(), 0, count);
+            }
+            participant.channel->write(d->sharedOutput.constData(), bytes);
+        }
+    }
+
+    if (changed)
+        emit activeChannelsChanged();
+}
+
+/// \cond
+void QXmppRtpAudioMixer::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() != d->timer.timerId()) {
+        QXmppLoggable::timerEvent(event);
+        return;
+    }
+
+    // the mixing times are derived from the number of chunks mixed since
+    // the clock started, so timer inaccuracy does not accumulate
+    const qint64 now = d->clock.elapsed();
+    int mixed = 0;
+    while (!d->participants.isEmpty() && d->start + d->chunks * mixerPtime <= now) {
+        if (mixed == mixerMaximumBurst) {
+            // we are too far behind, restart the clock
+            d->start = now;
+            d->chunks = 0;
+            break;
+        }
+        mix();
+        d->chunks++;
+        ++mixed;
+    }
+    d->reschedule(this);
+}
+/// \endcond
+
+void QXmppRtpAudioMixer::_q_channelDestroyed(QObject *object)
+{
+    for (int i = 0; i < d->participants.size(); ++i) {
+        if (d->participants[i].channel == object) {
+            const bool wasActive = d->participants[i].mixed;
+            d->participants.removeAt(i);
+            d->reschedule(this);
+            if (wasActive)
+                emit activeChannelsChanged();
+            return;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPRTPAUDIOMIXER_H
+#define QXMPPRTPAUDIOMIXER_H
+
+#include "QXmppLogger.h"
+
+class QXmppRtpAudioChannel;
+class QXmppRtpAudioMixerPrivate;
+
+/// \brief The QXmppRtpAudioMixer class mixes the audio of several RTP
+/// audio channels, for instance to host an audio conference.
+///
+/// Every 20 ms, the mixer reads the decoded audio of each channel once and
+/// writes back to each channel the mix of the other participants who are
+/// speaking. The channels then encode the mix with their own codec.
+///
+/// All the channels must use the clock rate given by clockrate().
+///
+/// \note THIS API IS NOT FINALIZED YET
+
+class QXMPP_EXPORT QXmppRtpAudioMixer : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppRtpAudioMixer(QObject *parent = 0);
+    ~QXmppRtpAudioMixer();
+
+    void addChannel(QXmppRtpAudioChannel *channel);
+    void removeChannel(QXmppRtpAudioChannel *channel);
+    QList<QXmppRtpAudioChannel*> channels() const;
+    QList<QXmppRtpAudioChannel*> activeChannels() const;
+
+    quint32 clockrate() const;
+    void setClockrate(quint32 clockrate);
+
+    int maximumSpeakers() const;
+    void setMaximumSpeakers(int speakers);
+
+    int speechThreshold() const;
+    void setSpeechThreshold(int threshold);
+
+signals:
+    /// This signal is emitted when the list of speaking channels changes.
+    void activeChannelsChanged();
+
+public slots:
+    void mix();
+
+protected:
+    /// \cond
+    void timerEvent(QTimerEvent *event);
+    /// \endcond
+
+private slots:
+    void _q_channelDestroyed(QObject *object);
+
+private:
+    QXmppRtpAudioMixerPrivate *d;
+};
+
+#endif
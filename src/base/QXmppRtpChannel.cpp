@@ -23,14 +23,28 @@
 
 #include <cmath>
 
+#include <QAtomicInt>
+#include <QBasicTimer>
 #include <QDataStream>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QMetaType>
+#include <QMutex>
+#include <QThread>
+#include <QThreadStorage>
 #include <QTimer>
+#include <QTimerEvent>
+#include <QVarLengthArray>
+#include <QtEndian>
 
 #include "QXmppCodec_p.h"
 #include "QXmppJingleIq.h"
+#include "QXmppMediaRing.h"
+#include "QXmppRtcpPacket.h"
+#include "QXmppRtcpSession_p.h"
 #include "QXmppRtpChannel.h"
 #include "QXmppRtpPacket.h"
+#include "QXmppSrtp_p.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846264338327950288
@@ -108,6 +122,113 @@ void QXmppRtpChannel::setLocalSsrc(quint32 ssrc)
     m_outgoingSsrc = ssrc;
 }
 
+/// Returns the SRTP crypto attributes to offer or answer.
+///
+/// Before a remote crypto attribute was accepted, one attribute with a new
+/// master key is returned for each supported crypto suite. Afterwards
+/// only the attribute for the negotiated suite is returned, with the tag
+/// of the remote attribute.
+
+QList<QXmppJingleRtpCryptoElement> QXmppRtpChannel::localCryptoElements()
+{
+    if (m_localCryptoElements.isEmpty()) {
+        const QXmppSrtpSession::CryptoSuite suites[] = {
+            QXmppSrtpSession::AES_CM_128_HMAC_SHA1_80,
+            QXmppSrtpSession::AES_CM_128_HMAC_SHA1_32
+        };
+        for (int i = 0; i < 2; ++i) {
+            QXmppJingleRtpCryptoElement crypto;
+            crypto.setTag(i + 1);
+            crypto.setCryptoSuite(QXmppSrtpSession::cryptoSuiteToString(suites[i]));
+            crypto.setKeyParams("inline:" + QXmppSrtpSession::generateKeyMaterial().toBase64());
+            m_localCryptoElements << crypto;
+        }
+    }
+    return m_localCryptoElements;
+}
+
+// Extracts the master key and salt from the "inline:" key parameters.
+static bool parseKeyParams(const QString &params, QByteArray *masterKey, QByteArray *masterSalt)
+{
+    if (!params.startsWith("inline:"))
+        return false;
+
+    // strip the lifetime and MKI
+    const QByteArray keySalt = QByteArray::fromBase64(params.mid(7).section('|', 0, 0).toLatin1());
+    if (keySalt.size() != QXmppSrtpSession::masterKeyLength + QXmppSrtpSession::masterSaltLength)
+        return false;
+
+    *masterKey = keySalt.left(QXmppSrtpSession::masterKeyLength);
+    *masterSalt = keySalt.mid(QXmppSrtpSession::masterKeyLength);
+    return true;
+}
+
+/// Sets the remote party's SRTP crypto attribute, which enables SRTP for
+/// the channel.
+///
+/// Returns false if the crypto suite or key parameters are not supported,
+/// in which case the channel is left unchanged.
+///
+/// \param crypto
+
+bool QXmppRtpChannel::setRemoteCryptoElement(const QXmppJingleRtpCryptoElement &crypto)
+{
+    QXmppSrtpSession::CryptoSuite suite;
+    QByteArray remoteKey, remoteSalt;
+    if (!crypto.sessionParams().isEmpty() ||
+        !QXmppSrtpSession::cryptoSuiteFromString(crypto.cryptoSuite(), &suite) ||
+        !parseKeyParams(crypto.keyParams(), &remoteKey, &remoteSalt))
+        return false;
+
+    QXmppJingleRtpCryptoElement local;
+    foreach (const QXmppJingleRtpCryptoElement &candidate, localCryptoElements()) {
+        if (candidate.cryptoSuite() == crypto.cryptoSuite()) {
+            local = candidate;
+            break;
+        }
+    }
+    QByteArray localKey, localSalt;
+    if (!parseKeyParams(local.keyParams(), &localKey, &localSalt))
+        return false;
+
+    // an answer carries the tag of the offered attribute
+    local.setTag(crypto.tag());
+    m_localCryptoElements = QList<QXmppJingleRtpCryptoElement>() << local;
+
+    m_outgoingSrtp = QSharedPointer<QXmppSrtpSession>(new QXmppSrtpSession(suite, localKey, localSalt));
+    m_incomingSrtp = QSharedPointer<QXmppSrtpSession>(new QXmppSrtpSession(suite, remoteKey, remoteSalt));
+    return true;
+}
+
+/// Returns true if the channel's packets are protected with SRTP.
+
+bool QXmppRtpChannel::isEncrypted() const
+{
+    return !m_outgoingSrtp.isNull();
+}
+
+/// \cond
+bool QXmppRtpChannel::protectRtp(QByteArray *packet)
+{
+    return m_outgoingSrtp.isNull() || m_outgoingSrtp->protectRtp(packet);
+}
+
+bool QXmppRtpChannel::unprotectRtp(QByteArray *packet)
+{
+    return m_incomingSrtp.isNull() || m_incomingSrtp->unprotectRtp(packet);
+}
+
+bool QXmppRtpChannel::protectRtcp(QByteArray *packet)
+{
+    return m_outgoingSrtp.isNull() || m_outgoingSrtp->protectRtcp(packet);
+}
+
+bool QXmppRtpChannel::unprotectRtcp(QByteArray *packet)
+{
+    return m_incomingSrtp.isNull() || m_incomingSrtp->unprotectRtcp(packet);
+}
+/// \endcond
+
 
 enum CodecId {
     G711u = 0,
@@ -121,6 +242,9 @@ enum CodecId {
     G729 = 18
 };
 
+// volume of the telephone events we send, in -dBm0
+static const quint8 telephoneEventVolume = 10;
+
 struct ToneInfo
 {
     QXmppRtpAudioChannel::Tone tone;
@@ -152,27 +276,319 @@ static QPair<int, int> toneFreqs(QXmppRtpAudioChannel::Tone tone)
     return qMakePair(0, 0);
 }
 
-QByteArray renderTone(QXmppRtpAudioChannel::Tone tone, int clockrate, quint32 clockTick, qint64 samples)
+// Renders \a samples of a DTMF \a tone starting at \a clockTick to \a output,
+// as 16-bit little endian samples.
+//
+// Each frequency is produced by a recursive oscillator,
+// s[n] = 2 cos(w) s[n-1] - s[n-2], which is seeded from the tone's phase at
+// the first sample, so only a few sines are computed for each chunk.
+static void renderTone(QXmppRtpAudioChannel::Tone tone, int clockrate, quint32 clockTick, qint64 samples, char *output)
 {
-    QPair<int,int> tf = toneFreqs(tone);
-    const float clockMult = 2.0 * M_PI / float(clockrate);
-    QByteArray chunk;
-    chunk.reserve(samples * SAMPLE_BYTES);
-    QDataStream output(&chunk, QIODevice::WriteOnly);
-    output.setByteOrder(QDataStream::LittleEndian);
-    for (quint32 i = 0; i < samples; ++i) {
-        quint16 val = 16383.0 * (std::sin(clockMult * clockTick * tf.first) + std::sin(clockMult * clockTick * tf.second));
-        output << val;
-        clockTick++;
+    const QPair<int, int> tf = toneFreqs(tone);
+    const int freqs[2] = { tf.first, tf.second };
+    double coeff[2], prev1[2], prev2[2];
+    for (int k = 0; k < 2; ++k) {
+        // the phase is reduced exactly, as the clock tick grows without bound
+        const double w = 2.0 * M_PI * freqs[k] / clockrate;
+        const double phase = 2.0 * M_PI * ((qint64(clockTick) * freqs[k]) % clockrate) / clockrate;
+        coeff[k] = 2.0 * std::cos(w);
+        prev1[k] = std::sin(phase - w);
+        prev2[k] = std::sin(phase - 2.0 * w);
+    }
+
+    uchar *out = reinterpret_cast<uchar*>(output);
+    for (qint64 i = 0; i < samples; ++i) {
+        const double low = coeff[0] * prev1[0] - prev2[0];
+        const double high = coeff[1] * prev1[1] - prev2[1];
+        prev2[0] = prev1[0];
+        prev1[0] = low;
+        prev2[1] = prev1[1];
+        prev1[1] = high;
+        qToLittleEndian<qint16>(qint16(16383.0 * (low + high)), out);
+        out += SAMPLE_BYTES;
+    }
+}
+
+/// The payload types supported by audio channels, which are the same for
+/// every channel so they are only built once.
+
+class QXmppRtpAudioPayloadTypes
+{
+public:
+    QXmppRtpAudioPayloadTypes();
+
+    QList<QXmppJinglePayloadType> payloadTypes;
+};
+
+QXmppRtpAudioPayloadTypes::QXmppRtpAudioPayloadTypes()
+{
+    QXmppJinglePayloadType payload;
+
+#ifdef QXMPP_USE_OPUS
+    payload.setId(100); // NOTE: I don't know if this Id is ok for Opus.
+    payload.setChannels(1);
+    payload.setName("opus");
+    payload.setClockrate(8000);
+    payloadTypes << payload;
+#endif
+
+#ifdef QXMPP_USE_SPEEX
+    payload.setId(96);
+    payload.setChannels(1);
+    payload.setName("speex");
+    payload.setClockrate(8000);
+    payloadTypes << payload;
+#endif
+
+    payload.setId(G711u);
+    payload.setChannels(1);
+    payload.setName("PCMU");
+    payload.setClockrate(8000);
+    payloadTypes << payload;
+
+    payload.setId(G711a);
+    payload.setChannels(1);
+    payload.setName("PCMA");
+    payload.setClockrate(8000);
+    payloadTypes << payload;
+
+    QMap<QString, QString> parameters;
+    parameters.insert("events", "0-15");
+    payload.setId(101);
+    payload.setChannels(1);
+    payload.setName("telephone-event");
+    payload.setClockrate(8000);
+    payload.setParameters(parameters);
+    payloadTypes << payload;
+}
+
+Q_GLOBAL_STATIC(QXmppRtpAudioPayloadTypes, audioPayloadTypes)
+
+/// \internal
+///
+/// The QXmppRtpCodecPool class keeps the codecs which channels no longer
+/// use, so that setting up a call does not create codecs whose
+/// initialisation is expensive, such as Speex and Opus.
+///
+/// Codecs are reset when they are released, and shared by all threads.
+
+class QXmppRtpCodecPool
+{
+public:
+    ~QXmppRtpCodecPool();
+
+    QXmppCodec *acquire(const QXmppJinglePayloadType &payloadType);
+    void release(QXmppCodec *codec);
+
+private:
+    static QXmppCodec *create(const QXmppJinglePayloadType &payloadType);
+    static QString key(const QXmppJinglePayloadType &payloadType);
+
+    QMutex mutex;
+    // the key of each codec which is in use
+    QHash<QXmppCodec*, QString> usedCodecs;
+    QHash<QString, QList<QXmppCodec*> > idleCodecs;
+};
+
+Q_GLOBAL_STATIC(QXmppRtpCodecPool, codecPool)
+
+// maximum number of idle codecs kept for each payload type
+static const int codecPoolCapacity = 32;
+
+QXmppRtpCodecPool::~QXmppRtpCodecPool()
+{
+    foreach (const QList<QXmppCodec*> &codecs, idleCodecs)
+        qDeleteAll(codecs);
+}
+
+/// Returns a codec for the given payload type, or 0 if it is not supported.
+
+QXmppCodec *QXmppRtpCodecPool::acquire(const QXmppJinglePayloadType &payloadType)
+{
+    const QString codecKey = key(payloadType);
+
+    QMutexLocker locker(&mutex);
+    QXmppCodec *codec = 0;
+    QHash<QString, QList<QXmppCodec*> >::iterator it = idleCodecs.find(codecKey);
+    if (it != idleCodecs.end() && !it.value().isEmpty())
+        codec = it.value().takeLast();
+    locker.unlock();
+
+    if (!codec)
+        codec = create(payloadType);
+    if (codec) {
+        locker.relock();
+        usedCodecs.insert(codec, codecKey);
+    }
+    return codec;
+}
+
+/// Gives back a codec which was returned by acquire().
+
+void QXmppRtpCodecPool::release(QXmppCodec *codec)
+{
+    if (!codec)
+        return;
+    codec->reset();
+
+    QMutexLocker locker(&mutex);
+    const QString codecKey = usedCodecs.take(codec);
+    if (!codecKey.isEmpty()) {
+        QList<QXmppCodec*> &idle = idleCodecs[codecKey];
+        if (idle.size() < codecPoolCapacity) {
+            idle << codec;
+            return;
+        }
+    }
+    locker.unlock();
+    delete codec;
+}
+
+QXmppCodec *QXmppRtpCodecPool::create(const QXmppJinglePayloadType &payloadType)
+{
+    if (payloadType.id() == G711u)
+        return new QXmppG711uCodec(payloadType.clockrate());
+    else if (payloadType.id() == G711a)
+        return new QXmppG711aCodec(payloadType.clockrate());
+#ifdef QXMPP_USE_SPEEX
+    else if (payloadType.name().toLower() == "speex")
+        return new QXmppSpeexCodec(payloadType.clockrate());
+#endif
+#ifdef QXMPP_USE_OPUS
+    else if (payloadType.name().toLower() == "opus")
+        return new QXmppOpusCodec(payloadType.clockrate(), payloadType.channels());
+#endif
+    return 0;
+}
+
+/// Returns the key under which codecs for the given payload type are
+/// kept, static payload types being identified by their number.
+
+QString QXmppRtpCodecPool::key(const QXmppJinglePayloadType &payloadType)
+{
+    const QString name = (payloadType.id() < 96) ? QString::number(payloadType.id()) : payloadType.name().toLower();
+    return QString("%1/%2/%3").arg(name, QString::number(payloadType.clockrate()), QString::number(payloadType.channels()));
+}
+
+/// Returns a codec from the pool, or 0 if the pool was destroyed.
+
+static QXmppCodec *acquireCodec(const QXmppJinglePayloadType &payloadType)
+{
+    QXmppRtpCodecPool *pool = codecPool();
+    return pool ? pool->acquire(payloadType) : 0;
+}
+
+/// Gives a codec back to the pool, or deletes it if the pool was destroyed.
+
+static void releaseCodec(QXmppCodec *codec)
+{
+    QXmppRtpCodecPool *pool = codecPool();
+    if (pool)
+        pool->release(codec);
+    else
+        delete codec;
+}
+
+/// \internal
+///
+/// The QXmppRtpEncoderLoad class measures the CPU time which the audio
+/// channels of the process spend encoding, as a fraction of one core, and
+/// holds the budget they share.
+
+class QXmppRtpEncoderLoad
+{
+public:
+    QXmppRtpEncoderLoad();
+
+    void addBusyTime(qint64 usecs);
+    double load();
+
+    double budget();
+    void setBudget(double budget);
+
+private:
+    QMutex mutex;
+    // microseconds spent encoding in the current window
+    QAtomicInt busy;
+    QElapsedTimer window;
+    double lastLoad;
+    double cpuBudget;
+};
+
+Q_GLOBAL_STATIC(QXmppRtpEncoderLoad, encoderLoad)
+
+// the load is measured over windows of one second
+static const qint64 encoderLoadWindow = 1000000;
+
+QXmppRtpEncoderLoad::QXmppRtpEncoderLoad()
+    : busy(0)
+    , lastLoad(0)
+    , cpuBudget(0)
+{
+    window.start();
+}
+
+/// Accounts for \a usecs microseconds spent encoding.
+
+void QXmppRtpEncoderLoad::addBusyTime(qint64 usecs)
+{
+    if (usecs > 0)
+        busy.fetchAndAddOrdered(int(usecs));
+}
+
+/// Returns the load measured over the last complete window.
+
+double QXmppRtpEncoderLoad::load()
+{
+    QMutexLocker locker(&mutex);
+    const qint64 elapsed = window.nsecsElapsed() / 1000;
+    if (elapsed >= encoderLoadWindow) {
+        lastLoad = double(busy.fetchAndStoreOrdered(0)) / elapsed;
+        window.restart();
     }
-    return chunk;
+    return lastLoad;
 }
 
+double QXmppRtpEncoderLoad::budget()
+{
+    QMutexLocker locker(&mutex);
+    return cpuBudget;
+}
+
+void QXmppRtpEncoderLoad::setBudget(double budget)
+{
+    QMutexLocker locker(&mutex);
+    cpuBudget = qMax(0.0, budget);
+}
+
+// limits of the encoder controls adapted by audio channels
+static const int minimumAudioBitrate = 6000;
+static const int maximumComplexity = 10;
+
+class QXmppRtpScheduler;
+
 class QXmppRtpAudioChannelPrivate
 {
 public:
-    QXmppRtpAudioChannelPrivate();
-    QXmppCodec *codecForPayloadType(const QXmppJinglePayloadType &payloadType);
+    QXmppRtpAudioChannelPrivate(QXmppRtpAudioChannel *qq);
+
+    void adaptBitrate();
+    void adaptComplexity();
+    void incomingDrop(qint64 size);
+    void incomingPrepend(qint64 size);
+    qint64 incomingRead(char *data, qint64 maxSize);
+    void tapWrite(const QByteArray &block);
+    void incomingReserve(qint64 size);
+    void incomingWrite(qint64 offset, const QByteArray &data);
+    qint64 outgoingDue() const;
+    void outgoingSend();
+    void updateJitter(quint32 stamp);
+
+    QXmppRtpAudioChannel *q;
+
+    // protects the buffers, as the application may read and write audio
+    // from a different thread than the one processing packets
+    mutable QMutex mutex;
 
     // signals
     bool signalsEmitted;
@@ -182,7 +598,12 @@ public:
     QHostAddress remoteHost;
     quint16 remotePort;
 
+    // ring buffer of decoded samples, its capacity is a power of two
     QByteArray incomingBuffer;
+    // index in incomingBuffer of the head of the incoming buffer
+    qint64 incomingHead;
+    // number of bytes in the incoming buffer
+    qint64 incomingSize;
     bool incomingBuffering;
     QMap<int, QXmppCodec*> incomingCodecs;
     int incomingMinimum;
@@ -190,112 +611,435 @@ public:
     // position of the head of the incoming buffer, in bytes
     qint64 incomingPos;
     quint16 incomingSequence;
+    // the stamp which follows the last decoded packet
+    quint32 incomingNextStamp;
+    bool incomingNextStampValid;
+
+    // interarrival jitter as defined by RFC 3550, in samples
+    QElapsedTimer incomingClock;
+    double incomingJitter;
+    quint32 incomingTransit;
+    bool incomingTransitValid;
 
     QByteArray outgoingBuffer;
+    // read offset in outgoingBuffer, the data before it was already sent
+    int outgoingHead;
     quint16 outgoingChunk;
+    // reused buffers for encoding outgoing payloads and packets
+    QByteArray outgoingPayload;
+    QByteArray outgoingDatagram;
     QXmppCodec *outgoingCodec;
     bool outgoingMarker;
     bool outgoingPayloadNumbered;
     quint16 outgoingSequence;
     quint32 outgoingStamp;
-    QTimer *outgoingTimer;
+    // pacing of outgoing packets against the RTP clock
+    bool outgoingRequested;
+    QXmppRtpScheduler *outgoingScheduler;
+    qint64 outgoingStart;
+    qint64 outgoingTicks;
     QList<ToneInfo> outgoingTones;
     QXmppJinglePayloadType outgoingTonesType;
 
+    // the stamp of the last telephone event received
+    QXmppJinglePayloadType incomingTonesType;
+    quint32 incomingToneStamp;
+    bool incomingToneValid;
+
     QXmppJinglePayloadType payloadType;
+
+    // RTCP reports and statistics
+    QXmppRtcpSession rtcp;
+    QTimer *reportTimer;
+
+    // the ring exposing the decoded audio, if any
+    QXmppMediaRing *ring;
+
+    // encoder controls, 0 when the codec does not support them
+    int bitrate;
+    int maximumBitrate;
+    int complexity;
+
+    // readers sharing the decoded audio
+    QList<QXmppRtpAudioTap*> taps;
 };
 
-QXmppRtpAudioChannelPrivate::QXmppRtpAudioChannelPrivate()
-    : signalsEmitted(false)
+QXmppRtpAudioChannelPrivate::QXmppRtpAudioChannelPrivate(QXmppRtpAudioChannel *qq)
+    : q(qq)
+    , mutex(QMutex::Recursive)
+    , signalsEmitted(false)
     , writtenSinceLastEmit(0)
+    , incomingHead(0)
+    , incomingSize(0)
     , incomingBuffering(true)
     , incomingMinimum(0)
     , incomingMaximum(0)
     , incomingPos(0)
     , incomingSequence(0)
+    , incomingNextStamp(0)
+    , incomingNextStampValid(false)
+    , incomingJitter(0)
+    , incomingTransit(0)
+    , incomingTransitValid(false)
+    , outgoingHead(0)
     , outgoingCodec(0)
     , outgoingMarker(true)
     , outgoingPayloadNumbered(false)
     , outgoingSequence(1)
     , outgoingStamp(0)
-    , outgoingTimer(0)
+    , outgoingRequested(false)
+    , outgoingScheduler(0)
+    , outgoingStart(0)
+    , outgoingTicks(0)
+    , incomingToneStamp(0)
+    , incomingToneValid(false)
+    , reportTimer(0)
+    , ring(0)
+    , bitrate(0)
+    , maximumBitrate(40000)
+    , complexity(0)
 {
     qRegisterMetaType<QXmppRtpAudioChannel::Tone>("QXmppRtpAudioChannel::Tone");
 }
 
-/// Returns the audio codec for the given payload type.
+/// Adapts the encoder's bitrate and error resilience to the last
+/// reception report from the remote party.
 ///
+/// The expected loss is set to the reported loss, with forward error
+/// correction enabled whenever packets are lost. The bitrate follows the
+/// loss-based controller used for video.
 
-QXmppCodec *QXmppRtpAudioChannelPrivate::codecForPayloadType(const QXmppJinglePayloadType &payloadType)
+void QXmppRtpAudioChannelPrivate::adaptBitrate()
 {
-    if (payloadType.id() == G711u)
-        return new QXmppG711uCodec(payloadType.clockrate());
-    else if (payloadType.id() == G711a)
-        return new QXmppG711aCodec(payloadType.clockrate());
-#ifdef QXMPP_USE_SPEEX
-    else if (payloadType.name().toLower() == "speex")
-        return new QXmppSpeexCodec(payloadType.clockrate());
-#endif
-#ifdef QXMPP_USE_OPUS
-    else if (payloadType.name().toLower() == "opus")
-        return new QXmppOpusCodec(payloadType.clockrate(), payloadType.channels());
+    if (!outgoingCodec)
+        return;
+
+    const double loss = rtcp.statistics().remoteFractionLost();
+    const int percentage = qBound(0, int(std::ceil(loss * 100)), 30);
+    outgoingCodec->setPacketLossPercentage(percentage);
+    outgoingCodec->setForwardErrorCorrection(percentage > 0);
+
+    if (!bitrate)
+        return;
+    int newBitrate = bitrate;
+    if (loss > 0.10)
+        newBitrate = qRound(bitrate * (1.0 - 0.5 * loss));
+    else if (loss < 0.02)
+        newBitrate = qRound(bitrate * 1.08);
+    newBitrate = qBound(minimumAudioBitrate, newBitrate, maximumBitrate);
+    if (newBitrate != bitrate && outgoingCodec->setBitrate(newBitrate))
+        bitrate = newBitrate;
+}
+
+/// Adapts the encoder's complexity to the CPU budget of the process.
+///
+/// When the audio channels spend more than the budget encoding, each of
+/// them lowers its complexity by two steps, and raises it by one step once
+/// the load falls below three quarters of the budget.
+
+void QXmppRtpAudioChannelPrivate::adaptComplexity()
+{
+    QXmppRtpEncoderLoad *encoder = encoderLoad();
+    if (!outgoingCodec || !complexity || !encoder)
+        return;
+
+    const double budget = encoder->budget();
+    int newComplexity = maximumComplexity;
+    if (budget > 0) {
+        const double load = encoder->load();
+        newComplexity = complexity;
+        if (load > budget)
+            newComplexity -= 2;
+        else if (load < 0.75 * budget)
+            newComplexity += 1;
+        newComplexity = qBound(1, newComplexity, maximumComplexity);
+    }
+    if (newComplexity != complexity && outgoingCodec->setComplexity(newComplexity))
+        complexity = newComplexity;
+}
+
+/// Removes \a size bytes from the head of the incoming buffer.
+
+void QXmppRtpAudioChannelPrivate::incomingDrop(qint64 size)
+{
+    size = qMin(size, incomingSize);
+    if (size <= 0)
+        return;
+    incomingHead = (incomingHead + size) & (incomingBuffer.size() - 1);
+    incomingSize -= size;
+}
+
+/// Inserts \a size bytes of silence at the head of the incoming buffer.
+
+void QXmppRtpAudioChannelPrivate::incomingPrepend(qint64 size)
+{
+    incomingReserve(incomingSize + size);
+    const qint64 capacity = incomingBuffer.size();
+    incomingHead = (incomingHead - size + capacity) & (capacity - 1);
+    incomingSize += size;
+
+    char *buffer = incomingBuffer.data();
+    const qint64 first = qMin(size, capacity - incomingHead);
+    memset(buffer + incomingHead, 0, first);
+    memset(buffer, 0, size - first);
+}
+
+/// Hands a decoded \a block to the taps, which share it.
+
+void QXmppRtpAudioChannelPrivate::tapWrite(const QByteArray &block)
+{
+    if (block.isEmpty())
+        return;
+    foreach (QXmppRtpAudioTap *tap, taps)
+        tap->append(block);
+}
+
+/// Reads up to \a maxSize bytes from the head of the incoming buffer.
+
+qint64 QXmppRtpAudioChannelPrivate::incomingRead(char *data, qint64 maxSize)
+{
+    const qint64 size = qMin(maxSize, incomingSize);
+    if (size <= 0)
+        return 0;
+
+    const char *buffer = incomingBuffer.constData();
+    const qint64 first = qMin(size, qint64(incomingBuffer.size()) - incomingHead);
+    memcpy(data, buffer + incomingHead, first);
+    memcpy(data + first, buffer, size - first);
+    incomingDrop(size);
+    return size;
+}
+
+/// Makes sure the incoming buffer can hold \a size bytes.
+
+void QXmppRtpAudioChannelPrivate::incomingReserve(qint64 size)
+{
+    qint64 capacity = incomingBuffer.size();
+    if (size <= capacity)
+        return;
+
+    qint64 newCapacity = qMax(capacity, qint64(4096));
+    while (newCapacity < size)
+        newCapacity *= 2;
+
+    // move the data to the start of the new buffer
+    QByteArray buffer(newCapacity, 0);
+    if (incomingSize > 0) {
+        const qint64 first = qMin(incomingSize, capacity - incomingHead);
+        memcpy(buffer.data(), incomingBuffer.constData() + incomingHead, first);
+        memcpy(buffer.data() + first, incomingBuffer.constData(), incomingSize - first);
+    }
+    incomingBuffer = buffer;
+    incomingHead = 0;
+}
+
+/// Writes \a data at \a offset bytes from the head of the incoming buffer,
+/// filling any gap before it with silence.
+
+void QXmppRtpAudioChannelPrivate::incomingWrite(qint64 offset, const QByteArray &data)
+{
+    const qint64 end = offset + data.size();
+    incomingReserve(end);
+
+    const qint64 capacity = incomingBuffer.size();
+    char *buffer = incomingBuffer.data();
+
+    // clear the gap between the current end and the new data
+    for (qint64 pos = incomingSize; pos < offset; ) {
+        const qint64 index = (incomingHead + pos) & (capacity - 1);
+        const qint64 length = qMin(offset - pos, capacity - index);
+        memset(buffer + index, 0, length);
+        pos += length;
+    }
+
+    for (qint64 pos = offset; pos < end; ) {
+        const qint64 index = (incomingHead + pos) & (capacity - 1);
+        const qint64 length = qMin(end - pos, capacity - index);
+        memcpy(buffer + index, data.constData() + (pos - offset), length);
+        pos += length;
+    }
+
+    incomingSize = qMax(incomingSize, end);
+}
+
+/// Updates the interarrival jitter estimate with a packet's \a stamp, and
+/// adapts the amount of buffered audio to it.
+///
+/// The target delay is one packet plus four times the jitter, and starts
+/// at five packets until the jitter has been measured.
+
+void QXmppRtpAudioChannelPrivate::updateJitter(quint32 stamp)
+{
+    const int clockrate = payloadType.clockrate();
+    if (clockrate <= 0 || !outgoingChunk)
+        return;
+
+    if (!incomingClock.isValid())
+        incomingClock.start();
+
+    const quint32 arrival = quint32(incomingClock.elapsed() * clockrate / 1000);
+    const quint32 transit = arrival - stamp;
+    if (incomingTransitValid) {
+        const qint32 delta = qint32(transit - incomingTransit);
+        incomingJitter += (qAbs(double(delta)) - incomingJitter) / 16.0;
+    }
+    incomingTransit = transit;
+    incomingTransitValid = true;
+
+    const qint64 chunk = outgoingChunk;
+    qint64 target = chunk + qint64(4 * incomingJitter) * SAMPLE_BYTES;
+    target = qBound(2 * chunk, target, 25 * chunk);
+    target -= target % SAMPLE_BYTES;
+    incomingMinimum = target;
+    incomingMaximum = 2 * target + chunk;
+}
+
+/// Returns the time at which the next outgoing packet is due, in
+/// milliseconds on the scheduler's clock.
+
+qint64 QXmppRtpAudioChannelPrivate::outgoingDue() const
+{
+    return outgoingStart + outgoingTicks * 1000 / qMax(1u, payloadType.clockrate());
+}
+
+/// Sends the next outgoing packet and advances the outgoing clock by the
+/// duration of the packet.
+
+void QXmppRtpAudioChannelPrivate::outgoingSend()
+{
+    const quint32 stamp = outgoingStamp;
+    q->writeDatagram();
+    outgoingTicks += quint32(outgoingStamp - stamp);
+}
+
+/// \internal
+///
+/// The QXmppRtpScheduler class paces the outgoing packets of all the RTP
+/// audio channels living in a thread using a single precise timer.
+///
+/// The send time of each packet is derived from the RTP timestamps the
+/// channel has sent since it started, so timer inaccuracy does not
+/// accumulate into drift.
+
+class QXmppRtpScheduler : public QObject
+{
+public:
+    static QXmppRtpScheduler *instance();
+
+    void addChannel(QXmppRtpAudioChannelPrivate *channel);
+    void removeChannel(QXmppRtpAudioChannelPrivate *channel);
+
+protected:
+    void timerEvent(QTimerEvent *event);
+
+private:
+    void reschedule();
+
+    QList<QXmppRtpAudioChannelPrivate*> m_channels;
+    QElapsedTimer m_clock;
+    QBasicTimer m_timer;
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<QXmppRtpScheduler*>, rtpSchedulerStorage)
+
+// maximum number of packets a channel sends at once to catch up
+static const int rtpMaximumBurst = 3;
+
+/// Returns the scheduler for the current thread.
+
+QXmppRtpScheduler *QXmppRtpScheduler::instance()
+{
+    QThreadStorage<QXmppRtpScheduler*> *storage = rtpSchedulerStorage();
+    if (!storage->hasLocalData())
+        storage->setLocalData(new QXmppRtpScheduler);
+    return storage->localData();
+}
+
+/// Starts sending the packets of the given \a channel.
+
+void QXmppRtpScheduler::addChannel(QXmppRtpAudioChannelPrivate *channel)
+{
+    if (!m_clock.isValid())
+        m_clock.start();
+    channel->outgoingStart = m_clock.elapsed();
+    channel->outgoingTicks = 0;
+    m_channels << channel;
+    reschedule();
+}
+
+/// Stops sending the packets of the given \a channel.
+
+void QXmppRtpScheduler::removeChannel(QXmppRtpAudioChannelPrivate *channel)
+{
+    m_channels.removeAll(channel);
+    reschedule();
+}
+
+void QXmppRtpScheduler::reschedule()
+{
+    if (m_channels.isEmpty()) {
+        m_timer.stop();
+        return;
+    }
+
+    qint64 due = m_channels.first()->outgoingDue();
+    foreach (QXmppRtpAudioChannelPrivate *channel, m_channels)
+        due = qMin(due, channel->outgoingDue());
+
+    const int delay = qBound(qint64(0), due - m_clock.elapsed(), qint64(1000));
+#if QT_VERSION >= 0x050000
+    m_timer.start(delay, Qt::PreciseTimer, this);
+#else
+    m_timer.start(delay, this);
 #endif
-    return 0;
+}
+
+void QXmppRtpScheduler::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() != m_timer.timerId()) {
+        QObject::timerEvent(event);
+        return;
+    }
+
+    // channels may be removed while we send packets
+    const qint64 now = m_clock.elapsed();
+    const QList<QXmppRtpAudioChannelPrivate*> channels = m_channels;
+    foreach (QXmppRtpAudioChannelPrivate *channel, channels) {
+        int sent = 0;
+        while (m_channels.contains(channel) && channel->outgoingDue() <= now) {
+            if (sent == rtpMaximumBurst) {
+                // we are too far behind, restart the clock instead of
+                // sending a burst of packets
+                channel->outgoingStart = now;
+                channel->outgoingTicks = 0;
+                break;
+            }
+            channel->outgoingSend();
+            ++sent;
+        }
+    }
+    reschedule();
 }
 
 /// Constructs a new RTP audio channel with the given \a parent.
 
 QXmppRtpAudioChannel::QXmppRtpAudioChannel(QObject *parent)
     : QIODevice(parent)
-    , d(new QXmppRtpAudioChannelPrivate())
+    , d(new QXmppRtpAudioChannelPrivate(this))
 {
     QXmppLoggable *logParent = qobject_cast<QXmppLoggable*>(parent);
     if (logParent) {
         connect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
                 logParent, SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
+        connect(this, SIGNAL(setGauge(QString,double)),
+                logParent, SIGNAL(setGauge(QString,double)));
     }
-    d->outgoingTimer = new QTimer(this);
-    connect(d->outgoingTimer, SIGNAL(timeout()), this, SLOT(writeDatagram()));
+    d->reportTimer = new QTimer(this);
+    d->reportTimer->setSingleShot(true);
+    connect(d->reportTimer, SIGNAL(timeout()), this, SLOT(sendReport()));
 
     // set supported codecs
-    QXmppJinglePayloadType payload;
-
-#ifdef QXMPP_USE_OPUS
-    payload.setId(100); // NOTE: I don't know if this Id is ok for Opus.
-    payload.setChannels(1);
-    payload.setName("opus");
-    payload.setClockrate(8000);
-    m_outgoingPayloadTypes << payload;
-#endif
-
-#ifdef QXMPP_USE_SPEEX
-    payload.setId(96);
-    payload.setChannels(1);
-    payload.setName("speex");
-    payload.setClockrate(8000);
-    m_outgoingPayloadTypes << payload;
-#endif
-
-    payload.setId(G711u);
-    payload.setChannels(1);
-    payload.setName("PCMU");
-    payload.setClockrate(8000);
-    m_outgoingPayloadTypes << payload;
-
-    payload.setId(G711a);
-    payload.setChannels(1);
-    payload.setName("PCMA");
-    payload.setClockrate(8000);
-    m_outgoingPayloadTypes << payload;
-
-    QMap<QString, QString> parameters;
-    parameters.insert("events", "0-15");
-    payload.setId(101);
-    payload.setChannels(1);
-    payload.setName("telephone-event");
-    payload.setClockrate(8000);
-    payload.setParameters(parameters);
-    m_outgoingPayloadTypes << payload;
+    m_outgoingPayloadTypes = audioPayloadTypes()->payloadTypes;
 }
 
 /// Destroys an RTP audio channel.
@@ -303,10 +1047,15 @@ QXmppRtpAudioChannel::QXmppRtpAudioChannel(QObject *parent)
 
 QXmppRtpAudioChannel::~QXmppRtpAudioChannel()
 {
+    const QList<QXmppRtpAudioTap*> taps = d->taps;
+    d->taps.clear();
+    qDeleteAll(taps);
+
+    if (d->outgoingScheduler)
+        d->outgoingScheduler->removeChannel(d);
     foreach (QXmppCodec *codec, d->incomingCodecs)
-        delete codec;
-    if (d->outgoingCodec)
-        delete d->outgoingCodec;
+        releaseCodec(codec);
+    releaseCodec(d->outgoingCodec);
     delete d;
 }
 
@@ -314,14 +1063,28 @@ QXmppRtpAudioChannel::~QXmppRtpAudioChannel()
 
 qint64 QXmppRtpAudioChannel::bytesAvailable() const
 {
-    return QIODevice::bytesAvailable() + d->incomingBuffer.size();
+    QMutexLocker locker(&d->mutex);
+    return QIODevice::bytesAvailable() + d->incomingSize;
 }
 
 /// Closes the RTP audio channel.
 
 void QXmppRtpAudioChannel::close()
 {
-    d->outgoingTimer->stop();
+    QMutexLocker locker(&d->mutex);
+    if (d->outgoingScheduler) {
+        d->outgoingScheduler->removeChannel(d);
+        d->outgoingScheduler = 0;
+    }
+    d->outgoingRequested = false;
+
+    // say goodbye to the remote party
+    if (d->reportTimer->isActive()) {
+        d->reportTimer->stop();
+        QByteArray datagram = d->rtcp.generateReport(localSsrc(), true);
+        if (protectRtcp(&datagram))
+            emit sendRtcpDatagram(datagram);
+    }
     QIODevice::close();
 }
 
@@ -331,8 +1094,9 @@ void QXmppRtpAudioChannel::close()
 
 void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
 {
+    QByteArray datagram(ba);
     QXmppRtpPacket packet;
-    if (!packet.decode(ba))
+    if (!unprotectRtp(&datagram) || !packet.decode(datagram))
         return;
 
 #ifdef QXMPP_DEBUG_RTP
@@ -346,15 +1110,40 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
                 .arg(QString::number(packet.sequence()))
                 .arg(QString::number(d->incomingSequence)));
 #endif
+    QMutexLocker locker(&d->mutex);
     d->incomingSequence = packet.sequence();
 
+    const quint8 packetType = packet.type();
+    int clockrate = 0;
+    foreach (const QXmppJinglePayloadType &payload, m_incomingPayloadTypes) {
+        if (payload.id() == packetType) {
+            clockrate = payload.clockrate();
+            d->rtcp.packetReceived(packet, clockrate);
+            break;
+        }
+    }
+
+    // RFC 4733 telephone events are not audio
+    if (d->incomingTonesType.id() && packetType == d->incomingTonesType.id()) {
+        const uchar *payload = reinterpret_cast<const uchar*>(packet.payloadData());
+        if (packet.payloadSize() < 4 || payload[0] > Tone_D)
+            return;
+
+        // the packets of an event share its stamp
+        if (!d->incomingToneValid || packet.stamp() != d->incomingToneStamp) {
+            d->incomingToneStamp = packet.stamp();
+            d->incomingToneValid = true;
+            emit toneReceived(static_cast<QXmppRtpAudioChannel::Tone>(payload[0]));
+        }
+        return;
+    }
+
     // get or create codec
     QXmppCodec *codec = 0;
-    const quint8 packetType = packet.type();
     if (!d->incomingCodecs.contains(packetType)) {
         foreach (const QXmppJinglePayloadType &payload, m_incomingPayloadTypes) {
             if (packetType == payload.id()) {
-                codec = d->codecForPayloadType(payload);
+                codec = acquireCodec(payload);
                 break;
             }
         }
@@ -368,9 +1157,11 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
     if (!codec)
         return;
 
+    d->updateJitter(packet.stamp());
+
     // determine packet's position in the buffer (in bytes)
     qint64 packetOffset = 0;
-    if (!d->incomingBuffer.isEmpty()) {
+    if (d->incomingSize > 0) {
         packetOffset = packet.stamp() * SAMPLE_BYTES - d->incomingPos;
         if (packetOffset < 0) {
 #ifdef QXMPP_DEBUG_RTP_BUFFER
@@ -384,21 +1175,52 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
         d->incomingPos = packet.stamp() * SAMPLE_BYTES + (d->incomingPos % SAMPLE_BYTES);
     }
 
-    // allocate space for new packet
-    // FIXME: this is wrong, we want the decoded data size!
-    const qint64 packetLength = packet.payload().size();
-    if (packetOffset + packetLength > d->incomingBuffer.size())
-        d->incomingBuffer += QByteArray(packetOffset + packetLength - d->incomingBuffer.size(), 0);
-    QDataStream input(packet.payload());
-    QDataStream output(&d->incomingBuffer, QIODevice::WriteOnly);
-    output.device()->seek(packetOffset);
+    const QByteArray payload = QByteArray::fromRawData(packet.payloadData(), packet.payloadSize());
+
+    // if packets were lost, let the codec recover or conceal the loss
+    if (d->incomingNextStampValid) {
+        const qint32 lostSamples = qint32(packet.stamp() - d->incomingNextStamp);
+        const qint64 lostOffset = packetOffset - lostSamples * SAMPLE_BYTES;
+        if (lostSamples > 0 && lostOffset >= 0 && lostSamples * SAMPLE_BYTES <= d->incomingMaximum) {
+            QByteArray concealed;
+            QDataStream input(payload);
+            QDataStream output(&concealed, QIODevice::WriteOnly);
+            output.setByteOrder(QDataStream::LittleEndian);
+            codec->recover(input, output, lostSamples);
+            const QByteArray block = concealed.left(lostSamples * SAMPLE_BYTES);
+            d->incomingWrite(lostOffset, block);
+            d->tapWrite(block);
+        }
+    }
+
+    // decode packet
+    QByteArray decoded;
+    QDataStream input(payload);
+    QDataStream output(&decoded, QIODevice::WriteOnly);
     output.setByteOrder(QDataStream::LittleEndian);
     codec->decode(input, output);
+    d->incomingWrite(packetOffset, decoded);
+    d->tapWrite(decoded);
+
+    if (d->ring && !decoded.isEmpty()) {
+        QXmppMediaRing::Frame frame;
+        frame.type = QXmppMediaRing::AudioMedia;
+        frame.timestamp = packet.stamp();
+        frame.size = decoded.size();
+        frame.clockrate = clockrate;
+        d->ring->write(frame, reinterpret_cast<const uchar*>(decoded.constData()));
+    }
+
+    const quint32 nextStamp = packet.stamp() + decoded.size() / SAMPLE_BYTES;
+    if (!d->incomingNextStampValid || qint32(nextStamp - d->incomingNextStamp) > 0) {
+        d->incomingNextStamp = nextStamp;
+        d->incomingNextStampValid = true;
+    }
 
     // check whether we are running late
-    if (d->incomingBuffer.size() > d->incomingMaximum)
+    if (d->incomingSize > d->incomingMaximum)
     {
-        qint64 droppedSize = d->incomingBuffer.size() - d->incomingMinimum;
+        qint64 droppedSize = d->incomingSize - d->incomingMinimum;
         const int remainder = droppedSize % SAMPLE_BYTES;
         if (remainder)
             droppedSize -= remainder;
@@ -406,11 +1228,11 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
         warning(QString("Incoming RTP buffer is too full, dropping %1 bytes")
                 .arg(QString::number(droppedSize)));
 #endif
-        d->incomingBuffer.remove(0, droppedSize);
+        d->incomingDrop(droppedSize);
         d->incomingPos += droppedSize;
     }
     // check whether we have filled the initial buffer
-    if (d->incomingBuffer.size() >= d->incomingMinimum)
+    if (d->incomingSize >= d->incomingMinimum)
         d->incomingBuffering = false;
     if (!d->incomingBuffering)
         emit readyRead();
@@ -418,9 +1240,13 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
 
 void QXmppRtpAudioChannel::emitSignals()
 {
-    emit bytesWritten(d->writtenSinceLastEmit);
+    QMutexLocker locker(&d->mutex);
+    const qint64 written = d->writtenSinceLastEmit;
     d->writtenSinceLastEmit = 0;
     d->signalsEmitted = false;
+    locker.unlock();
+
+    emit bytesWritten(written);
 }
 
 /// Returns true, as the RTP channel is a sequential device.
@@ -431,6 +1257,174 @@ bool QXmppRtpAudioChannel::isSequential() const
     return true;
 }
 
+/// Returns the RTP statistics of the channel.
+
+QXmppRtpStatistics QXmppRtpAudioChannel::statistics() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->rtcp.statistics();
+}
+
+/// Returns the target bitrate of the encoder in bits per second, or 0 if
+/// the codec's bitrate is fixed.
+///
+/// The bitrate is adapted to the losses reported by the remote party.
+
+int QXmppRtpAudioChannel::bitrate() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->bitrate;
+}
+
+/// Returns the maximum bitrate of the encoder, in bits per second.
+
+int QXmppRtpAudioChannel::maximumBitrate() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->maximumBitrate;
+}
+
+/// Sets the maximum bitrate of the encoder, in bits per second.
+///
+/// The default is 40 kbit/s, it only applies to codecs with an adjustable
+/// bitrate such as Opus.
+///
+/// \param bitrate
+
+void QXmppRtpAudioChannel::setMaximumBitrate(int bitrate)
+{
+    QMutexLocker locker(&d->mutex);
+    d->maximumBitrate = qMax(minimumAudioBitrate, bitrate);
+    if (d->outgoingCodec && d->bitrate > d->maximumBitrate &&
+        d->outgoingCodec->setBitrate(d->maximumBitrate))
+        d->bitrate = d->maximumBitrate;
+}
+
+/// Returns the computational complexity of the encoder, from 1 to 10, or
+/// 0 if the codec's complexity is fixed.
+
+int QXmppRtpAudioChannel::complexity() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->complexity;
+}
+
+/// Returns the CPU budget shared by the audio encoders of the process, as
+/// a fraction of one core, or 0 if it is unlimited.
+
+double QXmppRtpAudioChannel::encoderCpuBudget()
+{
+    QXmppRtpEncoderLoad *load = encoderLoad();
+    return load ? load->budget() : 0;
+}
+
+/// Sets the CPU budget shared by the audio encoders of the process, as a
+/// fraction of one core.
+///
+/// When the time spent encoding exceeds the budget, the channels lower
+/// the complexity of their encoders rather than fall behind. The default
+/// is 0, which means the budget is unlimited.
+///
+/// \param budget
+
+void QXmppRtpAudioChannel::setEncoderCpuBudget(double budget)
+{
+    QXmppRtpEncoderLoad *load = encoderLoad();
+    if (load)
+        load->setBudget(budget);
+}
+
+/// Returns the CPU time the audio encoders of the process spent encoding
+/// over the last second, as a fraction of one core.
+
+double QXmppRtpAudioChannel::encoderCpuLoad()
+{
+    QXmppRtpEncoderLoad *load = encoderLoad();
+    return load ? load->load() : 0;
+}
+
+/// Creates a tap which reads the decoded audio independently from the
+/// channel, for instance to record or monitor a call.
+///
+/// The channel keeps ownership of the tap, delete it to stop receiving
+/// audio.
+
+QXmppRtpAudioTap *QXmppRtpAudioChannel::createTap()
+{
+    QXmppRtpAudioTap *tap = new QXmppRtpAudioTap(this);
+    QMutexLocker locker(&d->mutex);
+    d->taps << tap;
+    return tap;
+}
+
+/// Returns the ring exposing the decoded audio, or 0 if there is none.
+
+QXmppMediaRing *QXmppRtpAudioChannel::mediaRing() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->ring;
+}
+
+/// Sets the \a ring to which the decoded audio is published, so that it
+/// can be consumed in place, possibly by another process.
+///
+/// Each decoded packet is written as a frame of 16-bit samples, stamped with
+/// its RTP timestamp. The audio can still be read from the channel.
+///
+/// The channel does not take ownership of the ring.
+///
+/// \param ring
+
+void QXmppRtpAudioChannel::setMediaRing(QXmppMediaRing *ring)
+{
+    QMutexLocker locker(&d->mutex);
+    d->ring = ring;
+}
+
+/// Processes an incoming RTCP packet.
+///
+/// \param ba
+
+void QXmppRtpAudioChannel::rtcpDatagramReceived(const QByteArray &ba)
+{
+    QByteArray datagram(ba);
+    if (!unprotectRtcp(&datagram))
+        return;
+
+    QMutexLocker locker(&d->mutex);
+    if (d->rtcp.handleReport(datagram, localSsrc())) {
+        d->adaptBitrate();
+        updateStatistics();
+    }
+}
+
+void QXmppRtpAudioChannel::sendReport()
+{
+    QMutexLocker locker(&d->mutex);
+
+    QByteArray datagram = d->rtcp.generateReport(localSsrc());
+    if (protectRtcp(&datagram))
+        emit sendRtcpDatagram(datagram);
+    d->adaptComplexity();
+    updateStatistics();
+
+    d->reportTimer->start(d->rtcp.reportInterval());
+}
+
+void QXmppRtpAudioChannel::updateStatistics()
+{
+    const QXmppRtpStatistics stats = d->rtcp.statistics();
+    emit setGauge("rtp.audio.fraction-lost", stats.fractionLost());
+    emit setGauge("rtp.audio.jitter", stats.jitter());
+    if (stats.roundTripTime() >= 0)
+        emit setGauge("rtp.audio.round-trip-time", stats.roundTripTime());
+    if (d->bitrate)
+        emit setGauge("rtp.audio.bitrate", d->bitrate);
+    if (d->complexity)
+        emit setGauge("rtp.audio.complexity", d->complexity);
+    emit statisticsChanged();
+}
+
 /// Returns the mode in which the channel has been opened.
 
 QIODevice::OpenMode QXmppRtpAudioChannel::openMode() const
@@ -445,12 +1439,15 @@ QIODevice::OpenMode QXmppRtpAudioChannel::openMode() const
 
 QXmppJinglePayloadType QXmppRtpAudioChannel::payloadType() const
 {
+    QMutexLocker locker(&d->mutex);
     return d->payloadType;
 }
 
 /// \cond
 qint64 QXmppRtpAudioChannel::readData(char * data, qint64 maxSize)
 {
+    QMutexLocker locker(&d->mutex);
+
     // if we are filling the buffer, return empty samples
     if (d->incomingBuffering)
     {
@@ -460,27 +1457,31 @@ qint64 QXmppRtpAudioChannel::readData(char * data, qint64 maxSize)
         return maxSize;
     }
 
-    qint64 readSize = qMin(maxSize, qint64(d->incomingBuffer.size()));
-    memcpy(data, d->incomingBuffer.constData(), readSize);
-    d->incomingBuffer.remove(0, readSize);
+    qint64 readSize = d->incomingRead(data, maxSize);
     if (readSize < maxSize)
     {
 #ifdef QXMPP_DEBUG_RTP
         debug(QString("QXmppRtpAudioChannel::readData missing %1 bytes").arg(QString::number(maxSize - readSize)));
 #endif
         memset(data + readSize, 0, maxSize - readSize);
+
+        // we ran out of data, refill the buffer to the current target
+        // delay before playing again
+        d->incomingBuffering = true;
     }
 
     // add local DTMF echo
     if (!d->outgoingTones.isEmpty()) {
         const int headOffset = d->incomingPos % SAMPLE_BYTES;
         const int samples = (headOffset + maxSize + SAMPLE_BYTES - 1) / SAMPLE_BYTES;
-        const QByteArray chunk = renderTone(
-            d->outgoingTones[0].tone,
-            d->payloadType.clockrate(),
-            d->incomingPos / SAMPLE_BYTES - d->outgoingTones[0].incomingStart,
-            samples);
-        memcpy(data, chunk.constData() + headOffset, maxSize);
+        const quint32 clockTick = d->incomingPos / SAMPLE_BYTES - d->outgoingTones[0].incomingStart;
+        if (!headOffset && !(maxSize % SAMPLE_BYTES)) {
+            renderTone(d->outgoingTones[0].tone, d->payloadType.clockrate(), clockTick, samples, data);
+        } else {
+            QVarLengthArray<char, 4096> chunk(samples * SAMPLE_BYTES);
+            renderTone(d->outgoingTones[0].tone, d->payloadType.clockrate(), clockTick, samples, chunk.data());
+            memcpy(data, chunk.constData() + headOffset, maxSize);
+        }
     }
 
     d->incomingPos += maxSize;
@@ -489,17 +1490,26 @@ qint64 QXmppRtpAudioChannel::readData(char * data, qint64 maxSize)
 
 void QXmppRtpAudioChannel::payloadTypesChanged()
 {
-    // delete incoming codecs
+    QMutexLocker locker(&d->mutex);
+
+    // release incoming codecs
     foreach (QXmppCodec *codec, d->incomingCodecs)
-        delete codec;
+        releaseCodec(codec);
     d->incomingCodecs.clear();
 
-    // delete outgoing codec
-    if (d->outgoingCodec) {
-        delete d->outgoingCodec;
-        d->outgoingCodec = 0;
+    // check for incoming telephony events
+    d->incomingTonesType = QXmppJinglePayloadType();
+    foreach (const QXmppJinglePayloadType &incomingType, m_incomingPayloadTypes) {
+        if (incomingType.name() == "telephone-event") {
+            d->incomingTonesType = incomingType;
+            break;
+        }
     }
 
+    // release outgoing codec
+    releaseCodec(d->outgoingCodec);
+    d->outgoingCodec = 0;
+
     // create outgoing codec
     foreach (const QXmppJinglePayloadType &outgoingType, m_outgoingPayloadTypes) {
         // check for telephony events
@@ -507,7 +1517,7 @@ void QXmppRtpAudioChannel::payloadTypesChanged()
             d->outgoingTonesType = outgoingType;
         }
         else if (!d->outgoingCodec) {
-            QXmppCodec *codec = d->codecForPayloadType(outgoingType);
+            QXmppCodec *codec = acquireCodec(outgoingType);
             if (codec) {
                 d->payloadType = outgoingType;
                 d->outgoingCodec = codec;
@@ -515,12 +1525,42 @@ void QXmppRtpAudioChannel::payloadTypesChanged()
         }
     }
 
-    // size in bytes of an decoded packet
-    d->outgoingChunk = SAMPLE_BYTES * d->payloadType.ptime() * d->payloadType.clockrate() / 1000;
-    d->outgoingTimer->setInterval(d->payloadType.ptime());
+    // start adaptive codecs at the highest bitrate the remote party accepts
+    d->bitrate = 0;
+    d->complexity = 0;
+    if (d->outgoingCodec) {
+        int bitrate = d->maximumBitrate;
+        const int remoteMaximum = d->payloadType.parameters().value("maxaveragebitrate").toInt();
+        if (remoteMaximum > 0)
+            bitrate = qBound(minimumAudioBitrate, remoteMaximum, bitrate);
+        if (d->outgoingCodec->setBitrate(bitrate))
+            d->bitrate = bitrate;
+        if (d->outgoingCodec->setComplexity(maximumComplexity))
+            d->complexity = maximumComplexity;
+        d->adaptComplexity();
+    }
 
+    // size in bytes of an decoded packet, which holds whole codec frames
+    int chunkSamples = d->payloadType.ptime() * d->payloadType.clockrate() / 1000;
+    const int frameSamples = d->outgoingCodec ? d->outgoingCodec->frameSamples() : 0;
+    if (frameSamples > 0)
+        chunkSamples = qMax(1, (chunkSamples + frameSamples / 2) / frameSamples) * frameSamples;
+    d->outgoingChunk = SAMPLE_BYTES * chunkSamples;
+
+    // the encoded payload is never larger than the samples, except for
+    // codecs with a large minimum packet size
+    d->outgoingPayload.resize(qMax(4000, int(d->outgoingChunk)));
+
+    // until the jitter is measured, buffer five packets
+    d->incomingJitter = d->outgoingChunk / SAMPLE_BYTES;
+    d->incomingTransitValid = false;
+    d->incomingNextStampValid = false;
     d->incomingMinimum = d->outgoingChunk * 5;
-    d->incomingMaximum = d->outgoingChunk * 15;
+    d->incomingMaximum = d->outgoingChunk * 11;
+
+    // send reception reports
+    if (!d->reportTimer->isActive())
+        d->reportTimer->start(d->rtcp.reportInterval());
 
     open(QIODevice::ReadWrite | QIODevice::Unbuffered);
 }
@@ -530,6 +1570,7 @@ void QXmppRtpAudioChannel::payloadTypesChanged()
 
 qint64 QXmppRtpAudioChannel::pos() const
 {
+    QMutexLocker locker(&d->mutex);
     return d->incomingPos;
 }
 
@@ -542,21 +1583,27 @@ qint64 QXmppRtpAudioChannel::pos() const
 
 bool QXmppRtpAudioChannel::seek(qint64 pos)
 {
+    QMutexLocker locker(&d->mutex);
     qint64 delta = pos - d->incomingPos;
     if (delta < 0)
-        d->incomingBuffer.prepend(QByteArray(-delta, 0));
+        d->incomingPrepend(-delta);
     else
-        d->incomingBuffer.remove(0, delta);
+        d->incomingDrop(delta);
     d->incomingPos = pos;
     return true;
 }
 
 /// Starts sending the specified DTMF tone.
 ///
+/// If the remote party accepts the "telephone-event" payload type, the
+/// tone is signalled as RFC 4733 telephone events instead of being
+/// rendered in the audio stream.
+///
 /// \param tone
 
 void QXmppRtpAudioChannel::startTone(QXmppRtpAudioChannel::Tone tone)
 {
+    QMutexLocker locker(&d->mutex);
     ToneInfo info;
     info.tone = tone;
     info.incomingStart = d->incomingPos / SAMPLE_BYTES;
@@ -571,6 +1618,7 @@ void QXmppRtpAudioChannel::startTone(QXmppRtpAudioChannel::Tone tone)
 
 void QXmppRtpAudioChannel::stopTone(QXmppRtpAudioChannel::Tone tone)
 {
+    QMutexLocker locker(&d->mutex);
     for (int i = 0; i < d->outgoingTones.size(); ++i) {
         if (d->outgoingTones[i].tone == tone) {
             d->outgoingTones[i].finished = true;
@@ -582,66 +1630,97 @@ void QXmppRtpAudioChannel::stopTone(QXmppRtpAudioChannel::Tone tone)
 /// \cond
 qint64 QXmppRtpAudioChannel::writeData(const char * data, qint64 maxSize)
 {
+    QMutexLocker locker(&d->mutex);
     if (!d->outgoingCodec) {
         warning("QXmppRtpAudioChannel::writeData before codec was set");
         return -1;
     }
 
-    d->outgoingBuffer += QByteArray::fromRawData(data, maxSize);
+    // discard the data which was already sent
+    if (d->outgoingHead) {
+        d->outgoingBuffer.remove(0, d->outgoingHead);
+        d->outgoingHead = 0;
+    }
+    d->outgoingBuffer.append(data, maxSize);
 
-    // start sending audio chunks
-    if (!d->outgoingTimer->isActive())
-        d->outgoingTimer->start();
+    // start sending audio chunks from the channel's thread
+    if (!d->outgoingRequested) {
+        d->outgoingRequested = true;
+        if (QThread::currentThread() == thread())
+            scheduleDatagrams();
+        else
+            QMetaObject::invokeMethod(this, "scheduleDatagrams", Qt::QueuedConnection);
+    }
 
     return maxSize;
 }
 /// \endcond
 
+void QXmppRtpAudioChannel::scheduleDatagrams()
+{
+    QMutexLocker locker(&d->mutex);
+    if (!d->outgoingRequested || d->outgoingScheduler)
+        return;
+
+    d->outgoingScheduler = QXmppRtpScheduler::instance();
+    d->outgoingScheduler->addChannel(d);
+}
+
 void QXmppRtpAudioChannel::writeDatagram()
 {
+    QMutexLocker locker(&d->mutex);
+
     // read audio chunk
     QByteArray chunk;
-    if (d->outgoingBuffer.size() < d->outgoingChunk) {
+    if (d->outgoingBuffer.size() - d->outgoingHead < d->outgoingChunk) {
 #ifdef QXMPP_DEBUG_RTP_BUFFER
         warning("Outgoing RTP buffer is starved");
 #endif
         chunk = QByteArray(d->outgoingChunk, 0);
     } else {
-        chunk = d->outgoingBuffer.left(d->outgoingChunk);
-        d->outgoingBuffer.remove(0, d->outgoingChunk);
+        chunk = QByteArray::fromRawData(d->outgoingBuffer.constData() + d->outgoingHead, d->outgoingChunk);
+        d->outgoingHead += d->outgoingChunk;
     }
 
     bool sendAudio = true;
     if (!d->outgoingTones.isEmpty()) {
-        const quint32 packetTicks = (d->payloadType.clockrate() * d->payloadType.ptime()) / 1000;
+        const quint32 packetTicks = d->outgoingChunk / SAMPLE_BYTES;
         const ToneInfo info = d->outgoingTones[0];
 
         if (d->outgoingTonesType.id()) {
-            // send RFC 2833 DTMF
+            // send RFC 4733 telephone events, no audio is rendered
             QXmppRtpPacket packet;
             packet.setMarker(info.outgoingStart == d->outgoingStamp);
             packet.setType(d->outgoingTonesType.id());
-            packet.setSequence(d->outgoingSequence);
             packet.setStamp(info.outgoingStart);
             packet.setSsrc(localSsrc());
 
-            QByteArray payload;
-            QDataStream output(&payload, QIODevice::WriteOnly);
-            output << quint8(info.tone);
-            output << quint8(info.finished ? 0x80 : 0x00);
-            output << quint16(d->outgoingStamp + packetTicks - info.outgoingStart);
-            packet.setPayload(payload);
+            const quint16 duration = d->outgoingStamp + packetTicks - info.outgoingStart;
+            char payload[4];
+            payload[0] = info.tone;
+            payload[1] = (info.finished ? 0x80 : 0x00) | telephoneEventVolume;
+            qToBigEndian<quint16>(duration, reinterpret_cast<uchar*>(payload + 2));
+            packet.setPayload(QByteArray::fromRawData(payload, sizeof(payload)));
+
+            // the end of an event is sent three times, in case of loss
+            const int count = info.finished ? 3 : 1;
+            for (int i = 0; i < count; ++i) {
+                packet.setSequence(d->outgoingSequence++);
 #ifdef QXMPP_DEBUG_RTP
-            logSent(packet.toString());
+                logSent(packet.toString());
 #endif
-            emit sendDatagram(packet.encode());
-            d->outgoingSequence++;
+                packet.encode(&d->outgoingDatagram);
+                if (protectRtp(&d->outgoingDatagram))
+                    emit sendDatagram(d->outgoingDatagram);
+                d->rtcp.packetSent(d->outgoingStamp, sizeof(payload));
+            }
             d->outgoingStamp += packetTicks;
 
             sendAudio = false;
         } else {
             // generate in-band DTMF
-            chunk = renderTone(info.tone, d->payloadType.clockrate(), d->outgoingStamp - info.outgoingStart, packetTicks);
+            chunk = QByteArray(packetTicks * SAMPLE_BYTES, Qt::Uninitialized);
+            renderTone(info.tone, d->payloadType.clockrate(), d->outgoingStamp - info.outgoingStart, packetTicks, chunk.data());
         }
 
         // if the tone is finished, remove it
@@ -664,20 +1743,44 @@ void QXmppRtpAudioChannel::writeDatagram()
         packet.setStamp(d->outgoingStamp);
         packet.setSsrc(localSsrc());
 
-        // encode audio chunk
-        QDataStream input(chunk);
-        input.setByteOrder(QDataStream::LittleEndian);
-        QByteArray payload;
-        QDataStream output(&payload, QIODevice::WriteOnly);
-        const qint64 packetTicks = d->outgoingCodec->encode(input, output);
-        packet.setPayload(payload);
+        // encode the audio chunk in place, its samples are little endian
+        const int packetTicks = chunk.size() / SAMPLE_BYTES;
+        const qint16 *samples = reinterpret_cast<const qint16*>(chunk.constData());
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        QVarLengthArray<qint16, 1024> swapped(packetTicks);
+        for (int i = 0; i < packetTicks; ++i)
+            swapped[i] = qFromLittleEndian<qint16>(reinterpret_cast<const uchar*>(chunk.constData()) + 2 * i);
+        samples = swapped.constData();
+#endif
+        QElapsedTimer encodeTimer;
+        encodeTimer.start();
+        const int length = d->outgoingCodec->encodeFrame(samples, packetTicks,
+            reinterpret_cast<uchar*>(d->outgoingPayload.data()), d->outgoingPayload.size());
+        QXmppRtpEncoderLoad *load = encoderLoad();
+        if (load)
+            load->addBusyTime(encodeTimer.nsecsElapsed() / 1000);
+        if (length < 0) {
+            warning("Could not encode outgoing RTP packet");
+            d->outgoingStamp += packetTicks;
+        } else if (!length) {
+            // the codec detected silence (DTX), skip the packet and mark
+            // the start of the next talkspurt
+            d->outgoingMarker = true;
+            d->outgoingStamp += packetTicks;
+        } else {
+            const QByteArray payload = QByteArray::fromRawData(d->outgoingPayload.constData(), length);
+            packet.setPayload(payload);
 
 #ifdef QXMPP_DEBUG_RTP
-        logSent(packet.toString());
+            logSent(packet.toString());
 #endif
-        emit sendDatagram(packet.encode());
-        d->outgoingSequence++;
-        d->outgoingStamp += packetTicks;
+            packet.encode(&d->outgoingDatagram);
+            if (protectRtp(&d->outgoingDatagram))
+                emit sendDatagram(d->outgoingDatagram);
+            d->rtcp.packetSent(d->outgoingStamp, payload.size());
+            d->outgoingSequence++;
+            d->outgoingStamp += packetTicks;
+        }
     }
 
     // queue signals
@@ -781,27 +1884,211 @@ int QXmppVideoFrame::width() const
     return m_width;
 }
 
+// maximum number of decoded blocks queued by a tap which is not read
+static const int tapCapacity = 50;
+
+class QXmppRtpAudioTapPrivate
+{
+public:
+    QXmppRtpAudioTapPrivate(QXmppRtpAudioChannel *channel);
+
+    QXmppRtpAudioChannel *channel;
+
+    // protects the blocks, as taps may be read from another thread
+    mutable QMutex mutex;
+    QList<QByteArray> blocks;
+    // read offset in the first block
+    int offset;
+    // number of bytes which were not read
+    qint64 size;
+};
+
+QXmppRtpAudioTapPrivate::QXmppRtpAudioTapPrivate(QXmppRtpAudioChannel *qchannel)
+    : channel(qchannel)
+    , offset(0)
+    , size(0)
+{
+}
+
+QXmppRtpAudioTap::QXmppRtpAudioTap(QXmppRtpAudioChannel *channel)
+    : QIODevice(channel)
+    , d(new QXmppRtpAudioTapPrivate(channel))
+{
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+/// Destroys the tap, which stops receiving audio from its channel.
+
+QXmppRtpAudioTap::~QXmppRtpAudioTap()
+{
+    QMutexLocker locker(&d->channel->d->mutex);
+    d->channel->d->taps.removeAll(this);
+    locker.unlock();
+
+    delete d;
+}
+
+/// Queues a decoded \a block, dropping the oldest blocks if the tap is
+/// not read.
+
+void QXmppRtpAudioTap::append(const QByteArray &block)
+{
+    QMutexLocker locker(&d->mutex);
+    d->blocks << block;
+    d->size += block.size();
+    while (d->blocks.size() > tapCapacity) {
+        d->size -= d->blocks.takeFirst().size() - d->offset;
+        d->offset = 0;
+    }
+    locker.unlock();
+
+    emit readyRead();
+}
+
+/// Returns the number of bytes that are available for reading.
+
+qint64 QXmppRtpAudioTap::bytesAvailable() const
+{
+    QMutexLocker locker(&d->mutex);
+    return QIODevice::bytesAvailable() + d->size;
+}
+
+/// Returns true, as the tap is a sequential device.
+
+bool QXmppRtpAudioTap::isSequential() const
+{
+    return true;
+}
+
+/// Reads the next decoded block, or the remainder of a block which was
+/// partially read, without copying it.
+///
+/// Returns an empty array if there is nothing to read.
+
+QByteArray QXmppRtpAudioTap::readBlock()
+{
+    QMutexLocker locker(&d->mutex);
+    if (d->blocks.isEmpty())
+        return QByteArray();
+
+    QByteArray block = d->blocks.takeFirst();
+    if (d->offset) {
+        block = block.mid(d->offset);
+        d->offset = 0;
+    }
+    d->size -= block.size();
+    return block;
+}
+
+/// \cond
+qint64 QXmppRtpAudioTap::readData(char *data, qint64 maxSize)
+{
+    QMutexLocker locker(&d->mutex);
+    qint64 read = 0;
+    while (read < maxSize && !d->blocks.isEmpty()) {
+        const QByteArray &block = d->blocks.first();
+        const int length = int(qMin(maxSize - read, qint64(block.size() - d->offset)));
+        memcpy(data + read, block.constData() + d->offset, length);
+        read += length;
+        d->offset += length;
+        if (d->offset == block.size()) {
+            d->blocks.removeFirst();
+            d->offset = 0;
+        }
+    }
+    d->size -= read;
+    return read;
+}
+
+qint64 QXmppRtpAudioTap::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+/// \endcond
+
 class QXmppRtpVideoChannelPrivate
 {
 public:
     QXmppRtpVideoChannelPrivate();
+    void adaptBitrate();
+
+    // protects the codecs and frames, as the application may read and
+    // write frames from a different thread than the one processing packets
+    mutable QMutex mutex;
+
     QMap<int, QXmppVideoDecoder*> decoders;
     QXmppVideoEncoder *encoder;
     QList<QXmppVideoFrame> frames;
+    QXmppMediaRing *ring;
 
     // local
     QXmppVideoFormat outgoingFormat;
+    // reused buffers for the encoded frame and outgoing packets
+    QXmppVideoPacketBuffer outgoingFragments;
+    QByteArray outgoingDatagram;
     quint8 outgoingId;
     quint16 outgoingSequence;
     quint32 outgoingStamp;
+
+    // RTCP reports and statistics
+    QXmppRtcpSession rtcp;
+    QTimer *reportTimer;
+
+    // congestion control
+    int bitrate;
+    int maximumBitrate;
+    int minimumRoundTripTime;
 };
 
 QXmppRtpVideoChannelPrivate::QXmppRtpVideoChannelPrivate()
-    : encoder(0),
+    : mutex(QMutex::Recursive),
+    encoder(0),
+    ring(0),
     outgoingId(0),
     outgoingSequence(1),
-    outgoingStamp(0)
+    outgoingStamp(0),
+    reportTimer(0),
+    bitrate(256000),
+    maximumBitrate(256000),
+    minimumRoundTripTime(-1)
+{
+    rtcp.setBandwidth(bitrate);
+}
+
+/// Adapts the encoder's bitrate to the last reception report from the
+/// remote party.
+///
+/// The loss-based controller of draft-ietf-rmcat-gcc is used: the bitrate
+/// is reduced in proportion to losses above 10%, and increased by 8% when
+/// losses are below 2% and the round-trip time is not growing.
+
+void QXmppRtpVideoChannelPrivate::adaptBitrate()
 {
+    const QXmppRtpStatistics stats = rtcp.statistics();
+    const int roundTripTime = stats.roundTripTime();
+    if (roundTripTime >= 0 && (minimumRoundTripTime < 0 || roundTripTime < minimumRoundTripTime))
+        minimumRoundTripTime = roundTripTime;
+
+    const double loss = stats.remoteFractionLost();
+    const bool delayed = roundTripTime >= 0 &&
+                         roundTripTime > 2 * minimumRoundTripTime + 100;
+    const int minimumBitrate = qMax(16000, maximumBitrate / 8);
+
+    int newBitrate = bitrate;
+    if (loss > 0.10)
+        newBitrate = qRound(bitrate * (1.0 - 0.5 * loss));
+    else if (loss < 0.02 && !delayed)
+        newBitrate = qRound(bitrate * 1.08);
+    newBitrate = qBound(minimumBitrate, newBitrate, maximumBitrate);
+
+    if (newBitrate != bitrate) {
+        bitrate = newBitrate;
+        rtcp.setBandwidth(bitrate);
+        if (encoder)
+            encoder->setBitrate(bitrate);
+    }
 }
 
 /// Constructs a new RTP video channel with the given \a parent.
@@ -810,6 +2097,10 @@ QXmppRtpVideoChannel::QXmppRtpVideoChannel(QObject *parent)
     : QXmppLoggable(parent)
 {
     d = new QXmppRtpVideoChannelPrivate;
+    d->reportTimer = new QTimer(this);
+    d->reportTimer->setSingleShot(true);
+    connect(d->reportTimer, SIGNAL(timeout()), this, SLOT(sendReport()));
+
     d->outgoingFormat.setFrameRate(15.0);
     d->outgoingFormat.setFrameSize(QSize(320, 240));
     d->outgoingFormat.setPixelFormat(QXmppVideoFrame::Format_YUYV);
@@ -852,10 +2143,137 @@ QXmppRtpVideoChannel::~QXmppRtpVideoChannel()
     delete d;
 }
 
-/// Closes the RTP video channel.
+/// Returns the current target bitrate of the encoder, in bits per second.
+///
+/// The bitrate is adapted to the loss and round-trip time reported by the
+/// remote party through RTCP.
+
+int QXmppRtpVideoChannel::bitrate() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->bitrate;
+}
+
+/// Returns the maximum bitrate of the encoder, in bits per second.
+
+int QXmppRtpVideoChannel::maximumBitrate() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->maximumBitrate;
+}
+
+/// Sets the maximum bitrate of the encoder, in bits per second.
+///
+/// The default is 256 kbit/s.
+///
+/// \param bitrate
+
+void QXmppRtpVideoChannel::setMaximumBitrate(int bitrate)
+{
+    QMutexLocker locker(&d->mutex);
+    d->maximumBitrate = qMax(16000, bitrate);
+    if (d->bitrate > d->maximumBitrate) {
+        d->bitrate = d->maximumBitrate;
+        d->rtcp.setBandwidth(d->bitrate);
+        if (d->encoder)
+            d->encoder->setBitrate(d->bitrate);
+    }
+}
+
+/// Returns the round-trip time to the remote party in milliseconds, as
+/// measured using RTCP, or -1 if it is not known yet.
+
+int QXmppRtpVideoChannel::roundTripTime() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->rtcp.statistics().roundTripTime();
+}
+
+/// Returns the RTP statistics of the channel.
+
+QXmppRtpStatistics QXmppRtpVideoChannel::statistics() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->rtcp.statistics();
+}
+
+/// Returns the ring exposing the decoded frames, or 0 if there is none.
+
+QXmppMediaRing *QXmppRtpVideoChannel::mediaRing() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->ring;
+}
+
+/// Sets the \a ring to which the decoded frames are published, so that
+/// they can be consumed in place, possibly by another process.
+///
+/// The decoders write frames straight into the slots of the ring, and
+/// readFrames() no longer returns them.
+///
+/// The channel does not take ownership of the ring.
+///
+/// \param ring
+
+void QXmppRtpVideoChannel::setMediaRing(QXmppMediaRing *ring)
+{
+    QMutexLocker locker(&d->mutex);
+    d->ring = ring;
+    foreach (QXmppVideoDecoder *decoder, d->decoders)
+        decoder->setFrameRing(ring);
+}
+
+/// Closes the RTP video channel, and sends a goodbye to the remote party.
 
 void QXmppRtpVideoChannel::close()
 {
+    QMutexLocker locker(&d->mutex);
+    if (!d->reportTimer->isActive())
+        return;
+    d->reportTimer->stop();
+
+    QByteArray datagram = d->rtcp.generateReport(localSsrc(), true);
+    if (protectRtcp(&datagram))
+        emit sendRtcpDatagram(datagram);
+}
+
+/// Processes an incoming RTCP packet.
+///
+/// \param ba
+
+void QXmppRtpVideoChannel::rtcpDatagramReceived(const QByteArray &ba)
+{
+    QByteArray datagram(ba);
+    if (!unprotectRtcp(&datagram))
+        return;
+
+    QMutexLocker locker(&d->mutex);
+    if (d->rtcp.handleReport(datagram, localSsrc())) {
+        d->adaptBitrate();
+        updateStatistics();
+    }
+}
+
+void QXmppRtpVideoChannel::sendReport()
+{
+    QMutexLocker locker(&d->mutex);
+
+    QByteArray datagram = d->rtcp.generateReport(localSsrc());
+    if (protectRtcp(&datagram))
+        emit sendRtcpDatagram(datagram);
+    updateStatistics();
+
+    d->reportTimer->start(d->rtcp.reportInterval());
+}
+
+void QXmppRtpVideoChannel::updateStatistics()
+{
+    const QXmppRtpStatistics stats = d->rtcp.statistics();
+    emit setGauge("rtp.video.fraction-lost", stats.fractionLost());
+    emit setGauge("rtp.video.jitter", stats.jitter());
+    if (stats.roundTripTime() >= 0)
+        emit setGauge("rtp.video.round-trip-time", stats.roundTripTime());
+    emit statisticsChanged();
 }
 
 /// Processes an incoming RTP video packet.
@@ -864,25 +2282,55 @@ void QXmppRtpVideoChannel::close()
 
 void QXmppRtpVideoChannel::datagramReceived(const QByteArray &ba)
 {
+    QByteArray datagram(ba);
     QXmppRtpPacket packet;
-    if (!packet.decode(ba))
+    if (!unprotectRtp(&datagram) || !packet.decode(datagram))
         return;
 
 #ifdef QXMPP_DEBUG_RTP
     logReceived(packet.toString());
 #endif
 
+    QMutexLocker locker(&d->mutex);
+    foreach (const QXmppJinglePayloadType &payload, m_incomingPayloadTypes) {
+        if (payload.id() == packet.type()) {
+            d->rtcp.packetReceived(packet, payload.clockrate());
+            break;
+        }
+    }
+
     // get codec
     QXmppVideoDecoder *decoder = d->decoders.value(packet.type());
     if (!decoder)
         return;
-    d->frames << decoder->handlePacket(packet);
+    const QList<QXmppVideoFrame> frames = decoder->handlePacket(packet);
+    if (!d->ring) {
+        d->frames << frames;
+        return;
+    }
+
+    // publish the frames, the first one was decoded in place
+    foreach (const QXmppVideoFrame &decoded, frames) {
+        QXmppMediaRing::Frame frame;
+        frame.type = QXmppMediaRing::VideoMedia;
+        frame.timestamp = packet.stamp();
+        frame.size = decoded.mappedBytes();
+        frame.width = decoded.width();
+        frame.height = decoded.height();
+        frame.bytesPerLine = decoded.bytesPerLine();
+        frame.pixelFormat = decoded.pixelFormat();
+        if (d->ring->reservation() == decoded.bits())
+            d->ring->publish(frame);
+        else
+            d->ring->write(frame, decoded.bits());
+    }
 }
 
 /// Returns the video format used by the encoder.
 
 QXmppVideoFormat QXmppRtpVideoChannel::decoderFormat() const
 {
+    QMutexLocker locker(&d->mutex);
     if (d->decoders.isEmpty())
         return QXmppVideoFormat();
     const int key = d->decoders.keys().first();
@@ -893,6 +2341,7 @@ QXmppVideoFormat QXmppRtpVideoChannel::decoderFormat() const
 
 QXmppVideoFormat QXmppRtpVideoChannel::encoderFormat() const
 {
+    QMutexLocker locker(&d->mutex);
     return d->outgoingFormat;
 }
 
@@ -900,6 +2349,7 @@ QXmppVideoFormat QXmppRtpVideoChannel::encoderFormat() const
 
 void QXmppRtpVideoChannel::setEncoderFormat(const QXmppVideoFormat &format)
 {
+    QMutexLocker locker(&d->mutex);
     if (d->encoder && !d->encoder->setFormat(format))
         return;
     d->outgoingFormat = format;
@@ -909,6 +2359,7 @@ void QXmppRtpVideoChannel::setEncoderFormat(const QXmppVideoFormat &format)
 
 QIODevice::OpenMode QXmppRtpVideoChannel::openMode() const
 {
+    QMutexLocker locker(&d->mutex);
     QIODevice::OpenMode mode = QIODevice::NotOpen;
     if (!d->decoders.isEmpty())
         mode |= QIODevice::ReadOnly;
@@ -920,6 +2371,8 @@ QIODevice::OpenMode QXmppRtpVideoChannel::openMode() const
 /// \cond
 void QXmppRtpVideoChannel::payloadTypesChanged()
 {
+    QMutexLocker locker(&d->mutex);
+
     // refresh decoders
     foreach (QXmppVideoDecoder *decoder, d->decoders)
         delete decoder;
@@ -938,6 +2391,7 @@ void QXmppRtpVideoChannel::payloadTypesChanged()
 #endif
         if (decoder) {
             decoder->setParameters(payload.parameters());
+            decoder->setFrameRing(d->ring);
             d->decoders.insert(payload.id(), decoder);
         }
     }
@@ -962,11 +2416,17 @@ void QXmppRtpVideoChannel::payloadTypesChanged()
 #endif
         if (encoder) {
             encoder->setFormat(d->outgoingFormat);
+            if (d->bitrate < d->maximumBitrate)
+                encoder->setBitrate(d->bitrate);
             d->encoder = encoder;
             d->outgoingId = payload.id();
             break;
         }
     }
+
+    // send reception reports
+    if (!d->reportTimer->isActive())
+        d->reportTimer->start(d->rtcp.reportInterval());
 }
 /// \endcond
 
@@ -974,6 +2434,7 @@ void QXmppRtpVideoChannel::payloadTypesChanged()
 
 QList<QXmppVideoFrame> QXmppRtpVideoChannel::readFrames()
 {
+    QMutexLocker locker(&d->mutex);
     const QList<QXmppVideoFrame> frames = d->frames;
     d->frames.clear();
     return frames;
@@ -983,23 +2444,35 @@ QList<QXmppVideoFrame> QXmppRtpVideoChannel::readFrames()
 
 void QXmppRtpVideoChannel::writeFrame(const QXmppVideoFrame &frame)
 {
+    QMutexLocker locker(&d->mutex);
     if (!d->encoder) {
         warning("QXmppRtpVideoChannel::writeFrame before codec was set");
         return;
     }
 
-    QXmppRtpPacket packet;
-    packet.setMarker(false);
-    packet.setType(d->outgoingId);
-    packet.setSsrc(localSsrc());
-    foreach (const QByteArray &payload, d->encoder->handleFrame(frame)) {
-        packet.setSequence(d->outgoingSequence++);
-        packet.setStamp(d->outgoingStamp);
-        packet.setPayload(payload);
+    d->outgoingFragments.clear();
+    d->encoder->handleFrame(frame, &d->outgoingFragments);
+    for (int i = 0; i < d->outgoingFragments.count(); ++i) {
+        // write the RTP header in the room reserved by the encoder
+        uchar *data = d->outgoingFragments.packet(i);
+        const int size = d->outgoingFragments.packetSize(i);
+        data[0] = 0x80;
+        data[1] = d->outgoingId & 0x7f;
+        qToBigEndian<quint16>(d->outgoingSequence++, data + 2);
+        qToBigEndian<quint32>(d->outgoingStamp, data + 4);
+        qToBigEndian<quint32>(localSsrc(), data + 8);
+
+        // the datagram buffer is reused, and may grow for the SRTP tag
+        d->outgoingDatagram.resize(size);
+        memcpy(d->outgoingDatagram.data(), data, size);
 #ifdef QXMPP_DEBUG_RTP
-        logSent(packet.toString());
+        QXmppRtpPacket packet;
+        if (packet.decode(d->outgoingDatagram))
+            logSent(packet.toString());
 #endif
-        emit sendDatagram(packet.encode());
+        if (protectRtp(&d->outgoingDatagram))
+            emit sendDatagram(d->outgoingDatagram);
+        d->rtcp.packetSent(d->outgoingStamp, size - QXmppVideoPacketBuffer::headerRoom);
     }
     d->outgoingStamp += 1;
 }
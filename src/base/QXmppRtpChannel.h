@@ -25,6 +25,7 @@
 #define QXMPPRTPCHANNEL_H
 
 #include <QIODevice>
+#include <QSharedPointer>
 #include <QSize>
 
 #include "QXmppJingleIq.h"
@@ -32,8 +33,95 @@
 
 class QXmppCodec;
 class QXmppJinglePayloadType;
+class QXmppMediaRing;
+class QXmppRtcpSession;
 class QXmppRtpAudioChannelPrivate;
+class QXmppRtpAudioTap;
+class QXmppRtpAudioTapPrivate;
 class QXmppRtpVideoChannelPrivate;
+class QXmppSrtpSession;
+
+/// \brief The QXmppRtpStatistics class holds the statistics of an RTP
+/// channel, as defined by RFC 3550.
+///
+/// The reception statistics describe the incoming stream, the remote
+/// statistics are those reported by the remote party about the outgoing
+/// stream.
+///
+/// \note THIS API IS NOT FINALIZED YET
+
+class QXMPP_EXPORT QXmppRtpStatistics
+{
+public:
+    QXmppRtpStatistics()
+        : m_fractionLost(0), m_jitter(0), m_packetsLost(0), m_packetsReceived(0)
+        , m_octetsSent(0), m_packetsSent(0), m_remoteFractionLost(0)
+        , m_remotePacketsLost(0), m_roundTripTime(-1)
+    {
+    }
+
+    /// Returns the fraction of incoming packets lost during the last
+    /// reporting interval, between 0 and 1.
+    double fractionLost() const {
+        return m_fractionLost;
+    }
+
+    /// Returns the interarrival jitter of the incoming stream, in milliseconds.
+    double jitter() const {
+        return m_jitter;
+    }
+
+    /// Returns the cumulative number of incoming packets lost.
+    int packetsLost() const {
+        return m_packetsLost;
+    }
+
+    /// Returns the number of incoming packets received.
+    quint32 packetsReceived() const {
+        return m_packetsReceived;
+    }
+
+    /// Returns the number of payload octets sent.
+    quint32 octetsSent() const {
+        return m_octetsSent;
+    }
+
+    /// Returns the number of packets sent.
+    quint32 packetsSent() const {
+        return m_packetsSent;
+    }
+
+    /// Returns the fraction of outgoing packets lost during the last
+    /// reporting interval, as reported by the remote party.
+    double remoteFractionLost() const {
+        return m_remoteFractionLost;
+    }
+
+    /// Returns the cumulative number of outgoing packets lost, as reported
+    /// by the remote party.
+    quint32 remotePacketsLost() const {
+        return m_remotePacketsLost;
+    }
+
+    /// Returns the round-trip time to the remote party in milliseconds,
+    /// or -1 if it is not known yet.
+    int roundTripTime() const {
+        return m_roundTripTime;
+    }
+
+private:
+    friend class QXmppRtcpSession;
+
+    double m_fractionLost;
+    double m_jitter;
+    int m_packetsLost;
+    quint32 m_packetsReceived;
+    quint32 m_octetsSent;
+    quint32 m_packetsSent;
+    double m_remoteFractionLost;
+    quint32 m_remotePacketsLost;
+    int m_roundTripTime;
+};
 
 class QXMPP_EXPORT QXmppRtpChannel
 {
@@ -46,16 +134,28 @@ public:
     /// Returns the mode in which the channel has been opened.
     virtual QIODevice::OpenMode openMode() const = 0;
 
+    /// Returns the RTP statistics of the channel.
+    virtual QXmppRtpStatistics statistics() const = 0;
+
     QList<QXmppJinglePayloadType> localPayloadTypes();
     void setRemotePayloadTypes(const QList<QXmppJinglePayloadType> &remotePayloadTypes);
 
     quint32 localSsrc() const;
     void setLocalSsrc(quint32 ssrc);
 
+    QList<QXmppJingleRtpCryptoElement> localCryptoElements();
+    bool setRemoteCryptoElement(const QXmppJingleRtpCryptoElement &crypto);
+    bool isEncrypted() const;
+
 protected:
     /// \cond
     virtual void payloadTypesChanged() = 0;
 
+    bool protectRtp(QByteArray *packet);
+    bool unprotectRtp(QByteArray *packet);
+    bool protectRtcp(QByteArray *packet);
+    bool unprotectRtcp(QByteArray *packet);
+
     QList<QXmppJinglePayloadType> m_incomingPayloadTypes;
     QList<QXmppJinglePayloadType> m_outgoingPayloadTypes;
     bool m_outgoingPayloadNumbered;
@@ -63,6 +163,9 @@ protected:
 
 private:
     quint32 m_outgoingSsrc;
+    QList<QXmppJingleRtpCryptoElement> m_localCryptoElements;
+    QSharedPointer<QXmppSrtpSession> m_incomingSrtp;
+    QSharedPointer<QXmppSrtpSession> m_outgoingSrtp;
 };
 
 /// \brief The QXmppRtpAudioChannel class represents an RTP audio channel to a remote party.
@@ -108,16 +211,46 @@ public:
     QXmppJinglePayloadType payloadType() const;
     qint64 pos() const;
     bool seek(qint64 pos);
+    QXmppRtpStatistics statistics() const;
+
+    // encoder control
+    int bitrate() const;
+    int maximumBitrate() const;
+    void setMaximumBitrate(int bitrate);
+    int complexity() const;
+    static double encoderCpuBudget();
+    static void setEncoderCpuBudget(double budget);
+    static double encoderCpuLoad();
+
+    QXmppMediaRing *mediaRing() const;
+    void setMediaRing(QXmppMediaRing *ring);
+
+    QXmppRtpAudioTap *createTap();
 
 signals:
     /// \brief This signal is emitted when a datagram needs to be sent.
     void sendDatagram(const QByteArray &ba);
 
+    /// \brief This signal is emitted when an RTCP datagram needs to be sent.
+    void sendRtcpDatagram(const QByteArray &ba);
+
     /// \brief This signal is emitted to send logging messages.
     void logMessage(QXmppLogger::MessageType type, const QString &msg);
 
+    /// \brief This signal is emitted to set a gauge.
+    void setGauge(const QString &gauge, double value);
+
+    /// \brief This signal is emitted when the statistics of the channel
+    /// have been updated by an RTCP report.
+    void statisticsChanged();
+
+    /// \brief This signal is emitted when the remote party sends a DTMF
+    /// tone as an RFC 4733 telephone event.
+    void toneReceived(QXmppRtpAudioChannel::Tone tone);
+
 public slots:
     void datagramReceived(const QByteArray &ba);
+    void rtcpDatagramReceived(const QByteArray &ba);
     void startTone(QXmppRtpAudioChannel::Tone tone);
     void stopTone(QXmppRtpAudioChannel::Tone tone);
 
@@ -150,13 +283,56 @@ protected:
 
 private slots:
     void emitSignals();
+    void scheduleDatagrams();
+    void sendReport();
     void writeDatagram();
 
 private:
+    void updateStatistics();
+
     friend class QXmppRtpAudioChannelPrivate;
+    friend class QXmppRtpAudioTap;
     QXmppRtpAudioChannelPrivate * d;
 };
 
+/// \brief The QXmppRtpAudioTap class reads the audio decoded by an RTP
+/// audio channel, independently from the channel and its other taps.
+///
+/// Each packet is decoded once by the channel, and the decoded block is
+/// shared by all the taps without being copied. Every tap keeps its own
+/// read position, and a tap which is not read drops its oldest blocks.
+///
+/// Blocks are delivered in the order in which packets were decoded, the
+/// audio lost in transit being concealed by the codec.
+///
+/// \note THIS API IS NOT FINALIZED YET
+
+class QXMPP_EXPORT QXmppRtpAudioTap : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    ~QXmppRtpAudioTap();
+
+    qint64 bytesAvailable() const;
+    bool isSequential() const;
+    QByteArray readBlock();
+
+protected:
+    /// \cond
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+    /// \endcond
+
+private:
+    QXmppRtpAudioTap(QXmppRtpAudioChannel *channel);
+    void append(const QByteArray &block);
+
+    friend class QXmppRtpAudioChannel;
+    friend class QXmppRtpAudioChannelPrivate;
+    QXmppRtpAudioTapPrivate * const d;
+};
+
 /// \brief The QXmppVideoFrame class provides a representation of a frame of video data.
 ///
 /// \note THIS API IS NOT FINALIZED YET
@@ -198,6 +374,8 @@ public:
     int width() const;
 
 private:
+    friend class QXmppVideoFramePool;
+
     int m_bytesPerLine;
     QByteArray m_data;
     int m_height;
@@ -262,10 +440,19 @@ public:
 
     void close();
     QIODevice::OpenMode openMode() const;
+    QXmppRtpStatistics statistics() const;
+
+    // congestion control
+    int bitrate() const;
+    int maximumBitrate() const;
+    void setMaximumBitrate(int bitrate);
+    int roundTripTime() const;
 
     // incoming stream
     QXmppVideoFormat decoderFormat() const;
     QList<QXmppVideoFrame> readFrames();
+    QXmppMediaRing *mediaRing() const;
+    void setMediaRing(QXmppMediaRing *ring);
 
     // outgoing stream
     QXmppVideoFormat encoderFormat() const;
@@ -276,15 +463,28 @@ signals:
     /// \brief This signal is emitted when a datagram needs to be sent.
     void sendDatagram(const QByteArray &ba);
 
+    /// \brief This signal is emitted when an RTCP datagram needs to be sent.
+    void sendRtcpDatagram(const QByteArray &ba);
+
+    /// \brief This signal is emitted when the statistics of the channel
+    /// have been updated by an RTCP report.
+    void statisticsChanged();
+
 public slots:
     void datagramReceived(const QByteArray &ba);
+    void rtcpDatagramReceived(const QByteArray &ba);
 
 protected:
     /// \cond
     void payloadTypesChanged();
     /// \endcond
 
+private slots:
+    void sendReport();
+
 private:
+    void updateStatistics();
+
     friend class QXmppRtpVideoChannelPrivate;
     QXmppRtpVideoChannelPrivate * d;
 };
@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <cstring>
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QtEndian>
+
+#include "QXmppRtcpPacket.h"
+#include "QXmppRtpForwarder.h"
+#include "QXmppRtpPacket.h"
+#include "QXmppStun.h"
+
+// RTCP feedback packet types (RFC 4585)
+static const quint8 rtcpTransportFeedback = 205;
+static const quint8 rtcpPayloadFeedback = 206;
+
+// timestamp clock of forwarded streams, in ticks per millisecond
+static const quint32 rtpVideoTicks = 90;
+
+class QXmppRtpForwardedStream
+{
+public:
+    QXmppRtpForwardedStream()
+        : sender(0),
+        inSsrc(0),
+        outSsrc(0),
+        seqOffset(0),
+        stampOffset(0),
+        lastSeq(0),
+        lastStamp(0),
+        lastTime(0),
+        valid(false),
+        resync(false)
+    {
+    }
+
+    QXmppIceConnection *sender;
+    quint32 inSsrc;
+    quint32 outSsrc;
+    quint16 seqOffset;
+    quint32 stampOffset;
+    quint16 lastSeq;
+    quint32 lastStamp;
+    qint64 lastTime;
+    bool valid;
+    bool resync;
+};
+
+class QXmppRtpForwardedParticipant
+{
+public:
+    QXmppRtpForwardedParticipant()
+        : connection(0),
+        rtp(0),
+        rtcp(0)
+    {
+    }
+
+    QXmppIceConnection *connection;
+    QXmppIceComponent *rtp;
+    QXmppIceComponent *rtcp;
+    QList<QXmppIceConnection*> blocked;
+    QList<QXmppRtpForwardedStream> streams;
+};
+
+class QXmppRtpForwarderPrivate
+{
+public:
+    QXmppRtpForwarderPrivate();
+
+    QXmppRtpForwardedParticipant *participant(QXmppIceConnection *connection);
+    QXmppRtpForwardedStream *stream(QXmppRtpForwardedParticipant *receiver, QXmppIceConnection *sender, quint32 ssrc);
+    QXmppIceConnection *selectedSender(QXmppRtpForwardedParticipant *receiver) const;
+    void requestKeyFrame(QXmppIceConnection *sender, quint32 ssrc);
+
+    QList<QXmppRtpForwardedParticipant> participants;
+    QXmppIceConnection *activeSpeaker;
+    QXmppIceConnection *previousSpeaker;
+    QXmppRtpForwarder::Mode mode;
+    quint32 localSsrc;
+    QElapsedTimer clock;
+
+    // scratch buffer for rewritten packets
+    QByteArray outgoing;
+};
+
+QXmppRtpForwarderPrivate::QXmppRtpForwarderPrivate()
+    : activeSpeaker(0),
+    previousSpeaker(0),
+    mode(QXmppRtpForwarder::ForwardAll),
+    localSsrc(qrand())
+{
+    clock.start();
+}
+
+QXmppRtpForwardedParticipant *QXmppRtpForwarderPrivate::participant(QXmppIceConnection *connection)
+{
+    for (int i = 0; i < participants.size(); ++i) {
+        if (participants[i].connection == connection)
+            return &participants[i];
+    }
+    return 0;
+}
+
+/// Returns the sender whose stream the given \a receiver gets in
+/// active speaker mode.
+
+QXmppIceConnection *QXmppRtpForwarderPrivate::selectedSender(QXmppRtpForwardedParticipant *receiver) const
+{
+    // the active speaker sees the previous speaker
+    if (receiver->connection == activeSpeaker)
+        return previousSpeaker;
+    return activeSpeaker;
+}
+
+/// Returns the stream used to forward packets from \a sender with the given
+/// \a ssrc to the \a receiver, creating it if needed.
+
+QXmppRtpForwardedStream *QXmppRtpForwarderPrivate::stream(QXmppRtpForwardedParticipant *receiver, QXmppIceConnection *sender, quint32 ssrc)
+{
+    if (mode == QXmppRtpForwarder::ForwardActiveSpeaker) {
+        // a single stream, which switches between senders
+        if (receiver->streams.isEmpty()) {
+            QXmppRtpForwardedStream stream;
+            stream.outSsrc = qrand();
+            receiver->streams << stream;
+        }
+        QXmppRtpForwardedStream *stream = &receiver->streams[0];
+        if (stream->sender != sender || stream->inSsrc != ssrc) {
+            stream->sender = sender;
+            stream->inSsrc = ssrc;
+            stream->resync = true;
+        }
+        return stream;
+    }
+
+    for (int i = 0; i < receiver->streams.size(); ++i) {
+        QXmppRtpForwardedStream *stream = &receiver->streams[i];
+        if (stream->sender == sender && stream->inSsrc == ssrc)
+            return stream;
+    }
+
+    // keep the sender's SSRC unless it collides with another stream
+    QXmppRtpForwardedStream stream;
+    stream.sender = sender;
+    stream.inSsrc = ssrc;
+    stream.outSsrc = ssrc;
+    bool collides = true;
+    while (collides) {
+        collides = false;
+        foreach (const QXmppRtpForwardedStream &other, receiver->streams) {
+            if (other.outSsrc == stream.outSsrc) {
+                stream.outSsrc = qrand();
+                collides = true;
+                break;
+            }
+        }
+    }
+    receiver->streams << stream;
+    return &receiver->streams.last();
+}
+
+/// Asks the \a sender of the stream with the given \a ssrc for a key frame,
+/// using an RTCP picture loss indication (RFC 4585).
+
+void QXmppRtpForwarderPrivate::requestKeyFrame(QXmppIceConnection *sender, quint32 ssrc)
+{
+    QXmppRtpForwardedParticipant *participant = this->participant(sender);
+    if (!participant || !participant->rtcp)
+        return;
+
+    QByteArray pli(12, '\0');
+    uchar *ptr = reinterpret_cast<uchar*>(pli.data());
+    ptr[0] = 0x81;
+    ptr[1] = rtcpPayloadFeedback;
+    qToBigEndian<quint16>(2, ptr + 2);
+    qToBigEndian<quint32>(localSsrc, ptr + 4);
+    qToBigEndian<quint32>(ssrc, ptr + 8);
+    participant->rtcp->sendDatagram(pli);
+}
+
+/// Constructs a new RTP forwarder with the given \a parent.
+
+QXmppRtpForwarder::QXmppRtpForwarder(QObject *parent)
+    : QXmppLoggable(parent)
+{
+    d = new QXmppRtpForwarderPrivate;
+}
+
+/// Destroys the RTP forwarder. The connections are not deleted.
+
+QXmppRtpForwarder::~QXmppRtpForwarder()
+{
+    delete d;
+}
+
+/// Adds the ICE \a connection of a participant to the conference.
+///
+/// The forwarder does not take ownership of the connection, which is
+/// removed automatically when it is destroyed.
+
+void QXmppRtpForwarder::addConnection(QXmppIceConnection *connection)
+{
+    if (!connection || d->participant(connection))
+        return;
+
+    QXmppRtpForwardedParticipant participant;
+    participant.connection = connection;
+    participant.rtp = connection->component(1);
+    participant.rtcp = connection->component(2);
+    if (!participant.rtp) {
+        warning("RTP forwarder cannot use a connection without an RTP component");
+        return;
+    }
+
+    bool check;
+    Q_UNUSED(check);
+
+    check = connect(connection, SIGNAL(destroyed(QObject*)),
+                    this, SLOT(_q_connectionDestroyed(QObject*)));
+    Q_ASSERT(check);
+
+    check = connect(participant.rtp, SIGNAL(datagramReceived(QByteArray)),
+                    this, SLOT(_q_rtpReceived(QByteArray)));
+    Q_ASSERT(check);
+
+    if (participant.rtcp) {
+        check = connect(participant.rtcp, SIGNAL(datagramReceived(QByteArray)),
+                        this, SLOT(_q_rtcpReceived(QByteArray)));
+        Q_ASSERT(check);
+    }
+
+    d->participants << participant;
+}
+
+/// Removes the ICE \a connection of a participant from the conference.
+
+void QXmppRtpForwarder::removeConnection(QXmppIceConnection *connection)
+{
+    QXmppRtpForwardedParticipant *participant = d->participant(connection);
+    if (!participant)
+        return;
+
+    disconnect(connection, SIGNAL(destroyed(QObject*)),
+               this, SLOT(_q_connectionDestroyed(QObject*)));
+    disconnect(participant->rtp, SIGNAL(datagramReceived(QByteArray)),
+               this, SLOT(_q_rtpReceived(QByteArray)));
+    if (participant->rtcp)
+        disconnect(participant->rtcp, SIGNAL(datagramReceived(QByteArray)),
+                   this, SLOT(_q_rtcpReceived(QByteArray)));
+    _q_connectionDestroyed(connection);
+}
+
+/// Returns the connections of the participants.
+
+QList<QXmppIceConnection*> QXmppRtpForwarder::connections() const
+{
+    QList<QXmppIceConnection*> connections;
+    foreach (const QXmppRtpForwardedParticipant &participant, d->participants)
+        connections << participant.connection;
+    return connections;
+}
+
+/// Returns the participant whose streams are forwarded in active
+/// speaker mode.
+
+QXmppIceConnection *QXmppRtpForwarder::activeSpeaker() const
+{
+    return d->activeSpeaker;
+}
+
+/// Sets the participant whose streams are forwarded in active speaker mode.
+///
+/// The active speaker itself receives the streams of the previous active
+/// speaker.
+
+void QXmppRtpForwarder::setActiveSpeaker(QXmppIceConnection *connection)
+{
+    if (connection == d->activeSpeaker)
+        return;
+
+    d->previousSpeaker = d->activeSpeaker;
+    d->activeSpeaker = connection;
+}
+
+/// Returns true if the streams of \a sender are forwarded to \a receiver.
+
+bool QXmppRtpForwarder::isForwarding(QXmppIceConnection *receiver, QXmppIceConnection *sender) const
+{
+    if (receiver == sender)
+        return false;
+    QXmppRtpForwardedParticipant *participant = d->participant(receiver);
+    return participant && !participant->blocked.contains(sender);
+}
+
+/// Sets whether the streams of \a sender are forwarded to \a receiver,
+/// for instance because the receiver only displays some participants.
+///
+/// By default, all streams are forwarded.
+
+void QXmppRtpForwarder::setForwarding(QXmppIceConnection *receiver, QXmppIceConnection *sender, bool forward)
+{
+    QXmppRtpForwardedParticipant *participant = d->participant(receiver);
+    if (!participant || forward == !participant->blocked.contains(sender))
+        return;
+
+    if (forward) {
+        participant->blocked.removeAll(sender);
+
+        // hide the gap in the sender's streams
+        for (int i = 0; i < participant->streams.size(); ++i) {
+            if (participant->streams[i].sender == sender)
+                participant->streams[i].resync = true;
+        }
+    } else {
+        participant->blocked << sender;
+    }
+}
+
+/// Returns which streams are forwarded.
+
+QXmppRtpForwarder::Mode QXmppRtpForwarder::mode() const
+{
+    return d->mode;
+}
+
+/// Sets which streams are forwarded.
+///
+/// The default is ForwardAll.
+
+void QXmppRtpForwarder::setMode(QXmppRtpForwarder::Mode mode)
+{
+    if (mode == d->mode)
+        return;
+
+    d->mode = mode;
+    for (int i = 0; i < d->participants.size(); ++i)
+        d->participants[i].streams.clear();
+}
+
+void QXmppRtpForwarder::_q_connectionDestroyed(QObject *object)
+{
+    if (d->activeSpeaker == object)
+        d->activeSpeaker = 0;
+    if (d->previousSpeaker == object)
+        d->previousSpeaker = 0;
+
+    for (int i = d->participants.size() - 1; i >= 0; --i) {
+        QXmppRtpForwardedParticipant &participant = d->participants[i];
+        if (participant.connection == object) {
+            d->participants.removeAt(i);
+            continue;
+        }
+        for (int j = participant.streams.size() - 1; j >= 0; --j) {
+            if (participant.streams[j].sender == object) {
+                if (d->mode == ForwardActiveSpeaker)
+                    participant.streams[j].sender = 0;
+                else
+                    participant.streams.removeAt(j);
+            }
+        }
+        participant.blocked.removeAll(static_cast<QXmppIceConnection*>(object));
+    }
+}
+
+void QXmppRtpForwarder::_q_rtcpReceived(const QByteArray &datagram)
+{
+    QXmppRtpForwardedParticipant *receiver = 0;
+    for (int i = 0; i < d->participants.size(); ++i) {
+        if (d->participants[i].rtcp == sender()) {
+            receiver = &d->participants[i];
+            break;
+        }
+    }
+    if (!receiver)
+        return;
+
+    // Map the reports and feedback about the streams we forwarded to the
+    // receiver back to the streams of the senders. Sender reports and
+    // source descriptions are not relayed.
+    QMap<QXmppIceConnection*, QList<QXmppRtcpReceiverReport> > reports;
+    QMap<QXmppIceConnection*, QByteArray> feedback;
+    quint32 receiverSsrc = 0;
+
+    QDataStream stream(datagram);
+    QXmppRtcpPacket packet;
+    qint64 start = 0;
+    while (!stream.atEnd() && packet.read(stream)) {
+        const qint64 end = stream.device()->pos();
+        if (packet.type() == QXmppRtcpPacket::ReceiverReport ||
+            packet.type() == QXmppRtcpPacket::SenderReport) {
+            receiverSsrc = packet.ssrc();
+            foreach (QXmppRtcpReceiverReport report, packet.receiverReports()) {
+                foreach (const QXmppRtpForwardedStream &forwarded, receiver->streams) {
+                    if (forwarded.outSsrc == report.ssrc() && forwarded.sender) {
+                        report.setSsrc(forwarded.inSsrc);
+                        report.setHighestSequence((report.highestSequence() & 0xffff0000) |
+                                                  quint16(report.highestSequence() - forwarded.seqOffset));
+                        reports[forwarded.sender] << report;
+                        break;
+                    }
+                }
+            }
+        } else if ((packet.type() == rtcpTransportFeedback ||
+                    packet.type() == rtcpPayloadFeedback) && end - start >= 12) {
+            QByteArray raw = datagram.mid(start, end - start);
+            uchar *ptr = reinterpret_cast<uchar*>(raw.data());
+            const quint32 mediaSsrc = qFromBigEndian<quint32>(ptr + 8);
+            foreach (const QXmppRtpForwardedStream &forwarded, receiver->streams) {
+                if (forwarded.outSsrc == mediaSsrc && forwarded.sender) {
+                    qToBigEndian<quint32>(forwarded.inSsrc, ptr + 8);
+                    feedback[forwarded.sender] += raw;
+                    break;
+                }
+            }
+        }
+        start = end;
+    }
+
+    QList<QXmppIceConnection*> senders = reports.keys();
+    foreach (QXmppIceConnection *connection, feedback.keys()) {
+        if (!senders.contains(connection))
+            senders << connection;
+    }
+    foreach (QXmppIceConnection *connection, senders) {
+        QXmppRtpForwardedParticipant *participant = d->participant(connection);
+        if (!participant || !participant->rtcp)
+            continue;
+
+        // a compound RTCP packet must start with a report
+        QXmppRtcpPacket report;
+        report.setType(QXmppRtcpPacket::ReceiverReport);
+        report.setSsrc(receiverSsrc);
+        report.setReceiverReports(reports.value(connection));
+        participant->rtcp->sendDatagram(report.encode() + feedback.value(connection));
+    }
+}
+
+void QXmppRtpForwarder::_q_rtpReceived(const QByteArray &datagram)
+{
+    QXmppRtpForwardedParticipant *source = 0;
+    for (int i = 0; i < d->participants.size(); ++i) {
+        if (d->participants[i].rtp == sender()) {
+            source = &d->participants[i];
+            break;
+        }
+    }
+    if (!source)
+        return;
+
+    QXmppRtpPacket packet;
+    if (!packet.decode(datagram))
+        return;
+
+    QXmppIceConnection *connection = source->connection;
+    const qint64 now = d->clock.elapsed();
+    bool keyFrame = false;
+    for (int i = 0; i < d->participants.size(); ++i) {
+        QXmppRtpForwardedParticipant *receiver = &d->participants[i];
+        if (receiver->connection == connection ||
+            receiver->blocked.contains(connection) ||
+            (d->mode == ForwardActiveSpeaker && d->selectedSender(receiver) != connection))
+            continue;
+
+        QXmppRtpForwardedStream *stream = d->stream(receiver, connection, packet.ssrc());
+
+        // a receiver which starts getting the stream needs a key frame
+        if (!stream->valid || stream->resync)
+            keyFrame = true;
+
+        if (!stream->valid) {
+            stream->seqOffset = 0;
+            stream->stampOffset = 0;
+            stream->valid = true;
+            stream->resync = false;
+            stream->lastSeq = quint16(packet.sequence() - 1);
+            stream->lastStamp = packet.stamp();
+        } else if (stream->resync) {
+            // continue the stream as if the new packets followed the last
+            // forwarded ones
+            const quint32 elapsed = quint32(qMax(qint64(1), now - stream->lastTime)) * rtpVideoTicks;
+            stream->seqOffset = quint16(stream->lastSeq + 1 - packet.sequence());
+            stream->stampOffset = stream->lastStamp + elapsed - packet.stamp();
+            stream->resync = false;
+        }
+
+        const quint16 seq = quint16(packet.sequence() + stream->seqOffset);
+        const quint32 stamp = packet.stamp() + stream->stampOffset;
+        if (qint16(seq - stream->lastSeq) > 0) {
+            stream->lastSeq = seq;
+            stream->lastStamp = stamp;
+            stream->lastTime = now;
+        }
+
+        if (stream->outSsrc == packet.ssrc() && !stream->seqOffset && !stream->stampOffset) {
+            // nothing to rewrite, share the received datagram
+            receiver->rtp->sendDatagram(datagram);
+        } else {
+            // rewrite the header into a reusable buffer
+            d->outgoing.resize(datagram.size());
+            memcpy(d->outgoing.data(), datagram.constData(), datagram.size());
+            uchar *ptr = reinterpret_cast<uchar*>(d->outgoing.data());
+            qToBigEndian<quint16>(seq, ptr + 2);
+            qToBigEndian<quint32>(stamp, ptr + 4);
+            qToBigEndian<quint32>(stream->outSsrc, ptr + 8);
+            receiver->rtp->sendDatagram(d->outgoing);
+        }
+    }
+
+    if (keyFrame)
+        d->requestKeyFrame(connection, packet.ssrc());
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPRTPFORWARDER_H
+#define QXMPPRTPFORWARDER_H
+
+#include "QXmppLogger.h"
+
+class QXmppIceConnection;
+class QXmppRtpForwarderPrivate;
+
+/// \brief The QXmppRtpForwarder class relays RTP streams between the
+/// participants of a conference without decoding them, acting as a
+/// selective forwarding unit (SFU).
+///
+/// Each participant is represented by the QXmppIceConnection of its
+/// session. Packets received on component 1 (RTP) are forwarded to the
+/// other participants, with their SSRC, sequence number and timestamp
+/// rewritten so that every receiver sees continuous streams. Feedback
+/// received on component 2 (RTCP) is mapped back and relayed to the
+/// participant which sent the stream.
+///
+/// Use one forwarder per media type, for instance one forwarding all the
+/// audio streams and one forwarding the active speaker's video.
+///
+/// \note THIS API IS NOT FINALIZED YET
+
+class QXMPP_EXPORT QXmppRtpForwarder : public QXmppLoggable
+{
+    Q_OBJECT
+    Q_ENUMS(Mode)
+
+public:
+    /// This enum describes which streams are forwarded.
+    enum Mode {
+        ForwardAll = 0,         ///< Every participant receives the streams of all the others.
+        ForwardActiveSpeaker    ///< Every participant receives a single stream
+                                ///< carrying the active speaker.
+    };
+
+    QXmppRtpForwarder(QObject *parent = 0);
+    ~QXmppRtpForwarder();
+
+    void addConnection(QXmppIceConnection *connection);
+    void removeConnection(QXmppIceConnection *connection);
+    QList<QXmppIceConnection*> connections() const;
+
+    QXmppIceConnection *activeSpeaker() const;
+    void setActiveSpeaker(QXmppIceConnection *connection);
+
+    bool isForwarding(QXmppIceConnection *receiver, QXmppIceConnection *sender) const;
+    void setForwarding(QXmppIceConnection *receiver, QXmppIceConnection *sender, bool forward);
+
+    Mode mode() const;
+    void setMode(Mode mode);
+
+private slots:
+    void _q_connectionDestroyed(QObject *object);
+    void _q_rtcpReceived(const QByteArray &datagram);
+    void _q_rtpReceived(const QByteArray &datagram);
+
+private:
+    QXmppRtpForwarderPrivate *d;
+};
+
+#endif
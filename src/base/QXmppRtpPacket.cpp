@@ -21,13 +21,23 @@
  *
  */
 
-#include <QDataStream>
+
+#include <cstring>
+
 #include <QSharedData>
+#include <QtEndian>
 
 #include "QXmppRtpPacket.h"
 
 #define RTP_VERSION 2
 
+static QByteArray bufferView(const QByteArray &buffer, int offset, int size)
+{
+    if (!offset && size == buffer.size())
+        return buffer;
+    return buffer.mid(offset, size);
+}
+
 class QXmppRtpPacketPrivate : public QSharedData
 {
 public:
@@ -45,8 +55,24 @@ public:
     quint16 sequence;
     /// Timestamp.
     quint32 stamp;
-    /// Raw payload data.
-    QByteArray payload;
+
+    /// Whether a header extension is present.
+    bool extension;
+    /// Header extension profile.
+    quint16 extensionProfile;
+    /// Buffer holding the header extension.
+    QByteArray extensionBuffer;
+    /// Offset of the header extension in extensionBuffer.
+    int extensionOffset;
+    /// Size of the header extension.
+    int extensionSize;
+
+    /// Buffer holding the payload, usually the whole datagram.
+    QByteArray payloadBuffer;
+    /// Offset of the payload in payloadBuffer.
+    int payloadOffset;
+    /// Size of the payload.
+    int payloadSize;
 };
 
 QXmppRtpPacketPrivate::QXmppRtpPacketPrivate()
@@ -55,6 +81,12 @@ QXmppRtpPacketPrivate::QXmppRtpPacketPrivate()
     , ssrc(0)
     , sequence(0)
     , stamp(0)
+    , extension(false)
+    , extensionProfile(0)
+    , extensionOffset(0)
+    , extensionSize(0)
+    , payloadOffset(0)
+    , payloadSize(0)
 {
 }
 
@@ -90,38 +122,70 @@ QXmppRtpPacket& QXmppRtpPacket::operator=(const QXmppRtpPacket& other)
 
 /// Parses an RTP packet.
 ///
+/// The payload and header extension are not copied, the packet keeps a
+/// reference to \a ba instead.
+///
 /// \param ba
 
 bool QXmppRtpPacket::decode(const QByteArray &ba)
 {
-    if (ba.isEmpty())
+    const int size = ba.size();
+    const uchar *ptr = reinterpret_cast<const uchar*>(ba.constData());
+    if (size < 12 || (ptr[0] >> 6) != RTP_VERSION)
         return false;
 
     // fixed header
-    quint8 tmp;
-    QDataStream stream(ba);
-    stream >> tmp;
-    const quint8 cc = (tmp >> 1) & 0xf;
-    const int hlen = 12 + 4 * cc;
-    if ((tmp >> 6) != RTP_VERSION || ba.size() < hlen)
+    const int cc = ptr[0] & 0x0f;
+    int hlen = 12 + 4 * cc;
+    if (size < hlen)
         return false;
-    stream >> tmp;
-    d->marker = (tmp >> 7);
-    d->type = tmp & 0x7f;
-    stream >> d->sequence;
-    stream >> d->stamp;
-    stream >> d->ssrc;
 
-    // contributing source IDs
-    d->csrc.clear();
-    quint32 src;
-    for (int i = 0; i < cc; ++i) {
-        stream >> src;
-        d->csrc << src;
+    // header extension
+    const bool extension = (ptr[0] & 0x10) != 0;
+    quint16 extensionProfile = 0;
+    int extensionOffset = 0;
+    int extensionSize = 0;
+    if (extension) {
+        if (size < hlen + 4)
+            return false;
+        extensionProfile = qFromBigEndian<quint16>(ptr + hlen);
+        extensionSize = 4 * qFromBigEndian<quint16>(ptr + hlen + 2);
+        extensionOffset = hlen + 4;
+        hlen = extensionOffset + extensionSize;
+        if (size < hlen)
+            return false;
+    }
+
+    // padding
+    int payloadSize = size - hlen;
+    if (ptr[0] & 0x20) {
+        const int padding = ptr[size - 1];
+        if (!padding || padding > payloadSize)
+            return false;
+        payloadSize -= padding;
     }
 
-    // retrieve payload
-    d->payload = ba.right(ba.size() - hlen);
+    d->marker = (ptr[1] >> 7);
+    d->type = ptr[1] & 0x7f;
+    d->sequence = qFromBigEndian<quint16>(ptr + 2);
+    d->stamp = qFromBigEndian<quint32>(ptr + 4);
+    d->ssrc = qFromBigEndian<quint32>(ptr + 8);
+
+    // contributing source IDs
+    d->csrc.clear();
+    for (int i = 0; i < cc; ++i)
+        d->csrc << qFromBigEndian<quint32>(ptr + 12 + 4 * i);
+
+    // keep references to the header extension and payload
+    d->extension = extension;
+    d->extensionProfile = extensionProfile;
+    d->extensionBuffer = extension ? ba : QByteArray();
+    d->extensionOffset = extensionOffset;
+    d->extensionSize = extensionSize;
+
+    d->payloadBuffer = ba;
+    d->payloadOffset = hlen;
+    d->payloadSize = payloadSize;
     return true;
 }
 
@@ -129,25 +193,52 @@ bool QXmppRtpPacket::decode(const QByteArray &ba)
 
 QByteArray QXmppRtpPacket::encode() const
 {
+    QByteArray ba;
+    encode(&ba);
+    return ba;
+}
+
+/// Encodes an RTP packet into \a ba, which is resized to fit the packet.
+///
+/// If \a ba is not shared and has enough capacity, no memory is allocated,
+/// so the same buffer can be reused for consecutive packets.
+///
+/// \param ba
+
+void QXmppRtpPacket::encode(QByteArray *ba) const
+{
+    Q_ASSERT(ba);
     Q_ASSERT(d->csrc.size() < 16);
 
+    const int cc = d->csrc.size() & 0xf;
+    const int hlen = 12 + 4 * cc;
+    const int extensionPadded = (d->extensionSize + 3) & ~3;
+    const int extensionLength = d->extension ? 4 + extensionPadded : 0;
+    ba->resize(hlen + extensionLength + d->payloadSize);
+
     // fixed header
-    QByteArray ba;
-    ba.resize(d->payload.size() + 12 + 4 * d->csrc.size());
-    QDataStream stream(&ba, QIODevice::WriteOnly);
-    stream << quint8((RTP_VERSION << 6) |
-                     ((d->csrc.size() & 0xf) << 1));
-    stream << quint8((d->type & 0x7f) | (d->marker << 7));
-    stream << d->sequence;
-    stream << d->stamp;
-    stream << d->ssrc;
+    uchar *ptr = reinterpret_cast<uchar*>(ba->data());
+    ptr[0] = (RTP_VERSION << 6) | (d->extension ? 0x10 : 0) | cc;
+    ptr[1] = (d->type & 0x7f) | (d->marker ? 0x80 : 0);
+    qToBigEndian(d->sequence, ptr + 2);
+    qToBigEndian(d->stamp, ptr + 4);
+    qToBigEndian(d->ssrc, ptr + 8);
 
     // contributing source ids
-    foreach (const quint32 &src, d->csrc)
-        stream << src;
+    for (int i = 0; i < cc; ++i)
+        qToBigEndian(d->csrc.at(i), ptr + 12 + 4 * i);
+    ptr += hlen;
+
+    // header extension
+    if (d->extension) {
+        qToBigEndian(d->extensionProfile, ptr);
+        qToBigEndian(quint16(extensionPadded / 4), ptr + 2);
+        memcpy(ptr + 4, extensionData(), d->extensionSize);
+        memset(ptr + 4 + d->extensionSize, 0, extensionPadded - d->extensionSize);
+        ptr += extensionLength;
+    }
 
-    stream.writeRawData(d->payload.constData(), d->payload.size());
-    return ba;
+    memcpy(ptr, payloadData(), d->payloadSize);
 }
 
 QList<quint32> QXmppRtpPacket::csrc() const
@@ -160,6 +251,72 @@ void QXmppRtpPacket::setCsrc(const QList<quint32> &csrc)
     d->csrc = csrc;
 }
 
+/// Returns the header extension data, without its profile and length.
+
+QByteArray QXmppRtpPacket::extension() const
+{
+    return bufferView(d->extensionBuffer, d->extensionOffset, d->extensionSize);
+}
+
+/// Returns a pointer to the header extension data.
+///
+/// The pointer remains valid as long as the packet is not modified.
+
+const char *QXmppRtpPacket::extensionData() const
+{
+    return d->extensionBuffer.constData() + d->extensionOffset;
+}
+
+/// Returns the size of the header extension data in bytes.
+
+int QXmppRtpPacket::extensionSize() const
+{
+    return d->extensionSize;
+}
+
+/// Returns the profile-defined identifier of the header extension.
+
+quint16 QXmppRtpPacket::extensionProfile() const
+{
+    return d->extensionProfile;
+}
+
+/// Returns true if the packet has a header extension.
+
+bool QXmppRtpPacket::hasExtension() const
+{
+    return d->extension;
+}
+
+/// Sets the header extension.
+///
+/// When encoding, the extension data is padded with zeros to a multiple
+/// of 4 bytes.
+///
+/// \param profile
+/// \param extension
+
+void QXmppRtpPacket::setExtension(quint16 profile, const QByteArray &extension)
+{
+    Q_ASSERT(extension.size() <= 4 * 0xffff);
+    d->extension = true;
+    d->extensionProfile = profile;
+    d->extensionBuffer = extension;
+    d->extensionOffset = 0;
+    d->extensionSize = extension.size();
+}
+
+/// Removes the header extension.
+
+void QXmppRtpPacket::clearExtension()
+{
+    d->extension = false;
+    d->extensionProfile = 0;
+    d->extensionBuffer = QByteArray();
+    d->extensionOffset = 0;
+    d->extensionSize = 0;
+}
+
 bool QXmppRtpPacket::marker() const
 {
     return d->marker;
@@ -170,14 +327,37 @@ void QXmppRtpPacket::setMarker(bool marker)
     d->marker = marker;
 }
 
+/// Returns the payload.
+///
+/// For a decoded packet this copies the payload out of the datagram, use
+/// payloadData() and payloadSize() to avoid the copy.
+
 QByteArray QXmppRtpPacket::payload() const
 {
-    return d->payload;
+    return bufferView(d->payloadBuffer, d->payloadOffset, d->payloadSize);
+}
+
+/// Returns a pointer to the payload.
+///
+/// The pointer remains valid as long as the packet is not modified.
+
+const char *QXmppRtpPacket::payloadData() const
+{
+    return d->payloadBuffer.constData() + d->payloadOffset;
+}
+
+/// Returns the size of the payload in bytes.
+
+int QXmppRtpPacket::payloadSize() const
+{
+    return d->payloadSize;
 }
 
 void QXmppRtpPacket::setPayload(const QByteArray &payload)
 {
-    d->payload = payload;
+    d->payloadBuffer = payload;
+    d->payloadOffset = 0;
+    d->payloadSize = payload.size();
 }
 
 quint32 QXmppRtpPacket::ssrc() const
@@ -229,5 +409,5 @@ QString QXmppRtpPacket::toString() const
         QString::number(d->stamp),
         QString::number(d->marker),
         QString::number(d->type),
-        QString::number(d->payload.size()));
+        QString::number(d->payloadSize));
 }
@@ -33,6 +33,10 @@ class QXmppRtpPacketPrivate;
 /// \internal
 ///
 /// The QXmppRtpPacket class represents an RTP packet.
+///
+/// Decoding a packet does not copy its payload or header extension, they
+/// are kept as views into the received datagram which can be accessed
+/// with payloadData() and extensionData().
 
 class QXMPP_EXPORT QXmppRtpPacket
 {
@@ -45,15 +49,26 @@ public:
 
     bool decode(const QByteArray &ba);
     QByteArray encode() const;
+    void encode(QByteArray *ba) const;
     QString toString() const;
 
     QList<quint32> csrc() const;
     void setCsrc(const QList<quint32> &csrc);
 
+    QByteArray extension() const;
+    const char *extensionData() const;
+    int extensionSize() const;
+    quint16 extensionProfile() const;
+    bool hasExtension() const;
+    void setExtension(quint16 profile, const QByteArray &extension);
+    void clearExtension();
+
     bool marker() const;
     void setMarker(bool marker);
 
     QByteArray payload() const;
+    const char *payloadData() const;
+    int payloadSize() const;
     void setPayload(const QByteArray &payload);
 
     quint16 sequence() const;
@@ -26,6 +26,9 @@
 
 #include <QCryptographicHash>
 #include <QDomElement>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
 #include <QStringList>
 #if QT_VERSION >= 0x050000
 #include <QUrlQuery>
@@ -33,10 +36,11 @@
 #include <QUrl>
 #endif
 
+#include "QXmppBase64_p.h"
 #include "QXmppSasl_p.h"
 #include "QXmppUtils.h"
 
-const char *ns_xmpp_sasl = "urn:ietf:params:xml:ns:xmpp-sasl";
+static const QLatin1String ns_xmpp_sasl("urn:ietf:params:xml:ns:xmpp-sasl");
 
 static QByteArray forcedNonce;
 
@@ -58,11 +62,70 @@ static QByteArray generateNonce()
     if (!forcedNonce.isEmpty())
         return forcedNonce;
 
-    QByteArray nonce = QXmppUtils::generateRandomBytes(32);
+    QByteArray nonce = QXmppUtils::generateSecureRandomBytes(32);
 
     // The random data can the '=' char is not valid as it is a delimiter,
     // so to be safe, base64 the nonce
-    return nonce.toBase64();
+    return QXmppBase64::encode(nonce);
+}
+
+// Escape a username for use in a SCRAM message, see RFC 5802, section 5.1.
+
+static QByteArray scramEscape(const QByteArray &ba)
+{
+    QByteArray escaped(ba);
+    escaped.replace('=', "=3D");
+    escaped.replace(',', "=2C");
+    return escaped;
+}
+
+static QByteArray scramUnescape(const QByteArray &ba)
+{
+    QByteArray unescaped(ba);
+    unescaped.replace("=2C", ",");
+    unescaped.replace("=3D", "=");
+    return unescaped;
+}
+
+// Deriving the SCRAM keys from a password is deliberately expensive, so the
+// keys are kept for each combination of credentials, salt and iteration
+// count. Entries are indexed by a keyed digest of these parameters, so the
+// cache never holds the password itself.
+
+class QXmppSaslScramCache
+{
+public:
+    QXmppSaslScramCache()
+        : secret(QXmppUtils::generateSecureRandomBytes(32))
+    {
+    }
+
+    QMutex mutex;
+    QHash<QByteArray, QPair<QByteArray, QByteArray> > entries;
+    QList<QByteArray> order;
+    const QByteArray secret;
+};
+
+Q_GLOBAL_STATIC(QXmppSaslScramCache, scramCache)
+
+static const int scramCacheLimit = 256;
+static const int scramServerIterations = 4096;
+// Deriving keys with more iterations than this would let a rogue server
+// tie up the client's CPU, so such challenges are refused.
+static const int scramMaximumIterations = 100000;
+
+// Returns a salt which is stable for the lifetime of the process, so that
+// the keys for a given user can be served from the cache.
+
+static QByteArray scramServerSalt(const QByteArray &username)
+{
+    return QXmppSaslScram::hmac(QCryptographicHash::Sha1, scramCache()->secret, "salt:" + username).left(16);
+}
+
+static void scramXor(QByteArray &a, const QByteArray &b)
+{
+    for (int i = 0; i < a.size(); ++i)
+        a[i] = char(a.at(i) ^ b.at(i));
 }
 
 QXmppSaslAuth::QXmppSaslAuth(const QString &mechanism, const QByteArray &value)
@@ -94,7 +157,7 @@ void QXmppSaslAuth::setValue(const QByteArray &value)
 void QXmppSaslAuth::parse(const QDomElement &element)
 {
     m_mechanism = element.attribute("mechanism");
-    m_value = QByteArray::fromBase64(element.text().toLatin1());
+    m_value = QXmppBase64::decode(element.text());
 }
 
 void QXmppSaslAuth::toXml(QXmlStreamWriter *writer) const
@@ -103,7 +166,7 @@ void QXmppSaslAuth::toXml(QXmlStreamWriter *writer) const
     writer->writeAttribute("xmlns", ns_xmpp_sasl);
     writer->writeAttribute("mechanism", m_mechanism);
     if (!m_value.isEmpty())
-        writer->writeCharacters(m_value.toBase64());
+        writer->writeCharacters(QXmppBase64::encode(m_value));
     writer->writeEndElement();
 }
 
@@ -124,7 +187,7 @@ void QXmppSaslChallenge::setValue(const QByteArray &value)
 
 void QXmppSaslChallenge::parse(const QDomElement &element)
 {
-    m_value = QByteArray::fromBase64(element.text().toLatin1());
+    m_value = QXmppBase64::decode(element.text());
 }
 
 void QXmppSaslChallenge::toXml(QXmlStreamWriter *writer) const
@@ -132,7 +195,7 @@ void QXmppSaslChallenge::toXml(QXmlStreamWriter *writer) const
     writer->writeStartElement("challenge");
     writer->writeAttribute("xmlns", ns_xmpp_sasl);
     if (!m_value.isEmpty())
-        writer->writeCharacters(m_value.toBase64());
+        writer->writeCharacters(QXmppBase64::encode(m_value));
     writer->writeEndElement();
 }
 
@@ -182,7 +245,7 @@ void QXmppSaslResponse::setValue(const QByteArray &value)
 
 void QXmppSaslResponse::parse(const QDomElement &element)
 {
-    m_value = QByteArray::fromBase64(element.text().toLatin1());
+    m_value = QXmppBase64::decode(element.text());
 }
 
 void QXmppSaslResponse::toXml(QXmlStreamWriter *writer) const
@@ -190,23 +253,36 @@ void QXmppSaslResponse::toXml(QXmlStreamWriter *writer) const
     writer->writeStartElement("response");
     writer->writeAttribute("xmlns", ns_xmpp_sasl);
     if (!m_value.isEmpty())
-        writer->writeCharacters(m_value.toBase64());
+        writer->writeCharacters(QXmppBase64::encode(m_value));
     writer->writeEndElement();
 }
 
-QXmppSaslSuccess::QXmppSaslSuccess()
+QXmppSaslSuccess::QXmppSaslSuccess(const QByteArray &value)
+    : m_value(value)
+{
+}
+
+QByteArray QXmppSaslSuccess::value() const
 {
+    return m_value;
+}
+
+void QXmppSaslSuccess::setValue(const QByteArray &value)
+{
+    m_value = value;
 }
 
 void QXmppSaslSuccess::parse(const QDomElement &element)
 {
-    Q_UNUSED(element);
+    m_value = QXmppBase64::decode(element.text());
 }
 
 void QXmppSaslSuccess::toXml(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("success");
     writer->writeAttribute("xmlns", ns_xmpp_sasl);
+    if (!m_value.isEmpty())
+        writer->writeCharacters(QXmppBase64::encode(m_value));
     writer->writeEndElement();
 }
 
@@ -234,7 +310,13 @@ QXmppSaslClient::~QXmppSaslClient()
 
 QStringList QXmppSaslClient::availableMechanisms()
 {
-    return QStringList() << "PLAIN" << "DIGEST-MD5" << "ANONYMOUS" << "X-FACEBOOK-PLATFORM" << "X-MESSENGER-OAUTH2" << "X-OAUTH2";
+    QStringList mechanisms;
+#if QT_VERSION >= 0x050000
+    mechanisms << "SCRAM-SHA-256";
+#endif
+    mechanisms << "SCRAM-SHA-1";
+    mechanisms << "PLAIN" << "DIGEST-MD5" << "ANONYMOUS" << "X-FACEBOOK-PLATFORM" << "X-MESSENGER-OAUTH2" << "X-OAUTH2" << "X-QXMPP-TOKEN";
+    return mechanisms;
 }
 
 /// Creates an SASL client for the given mechanism.
@@ -253,6 +335,14 @@ QXmppSaslClient* QXmppSaslClient::create(const QString &mechanism, QObject *pare
         return new QXmppSaslClientWindowsLive(parent);
     } else if (mechanism == "X-OAUTH2") {
         return new QXmppSaslClientGoogle(parent);
+    } else if (mechanism == "X-QXMPP-TOKEN") {
+        return new QXmppSaslClientToken(parent);
+    } else if (mechanism == "SCRAM-SHA-1") {
+        return new QXmppSaslClientScram(QCryptographicHash::Sha1, parent);
+#if QT_VERSION >= 0x050000
+    } else if (mechanism == "SCRAM-SHA-256") {
+        return new QXmppSaslClientScram(QCryptographicHash::Sha256, parent);
+#endif
     } else {
         return 0;
     }
@@ -523,6 +613,109 @@ bool QXmppSaslClientPlain::respond(const QByteArray &challenge, QByteArray &resp
     }
 }
 
+QXmppSaslClientScram::QXmppSaslClientScram(QCryptographicHash::Algorithm algorithm, QObject *parent)
+    : QXmppSaslClient(parent)
+    , m_algorithm(algorithm)
+    , m_step(0)
+{
+    m_nonce = generateNonce();
+}
+
+QString QXmppSaslClientScram::mechanism() const
+{
+    return m_algorithm == QCryptographicHash::Sha1 ? "SCRAM-SHA-1" : "SCRAM-SHA-256";
+}
+
+/// Returns true once the server's final message has been received and its
+/// signature matched, i.e. the server proved it knows the credentials.
+
+bool QXmppSaslClientScram::isServerVerified() const
+{
+    return m_step == 3;
+}
+
+bool QXmppSaslClientScram::respond(const QByteArray &challenge, QByteArray &response)
+{
+    if (m_step == 0) {
+        // we do not support channel binding
+        m_clientFirstBare = "n=" + scramEscape(username().toUtf8()) + ",r=" + m_nonce;
+        response = "n,," + m_clientFirstBare;
+        m_step++;
+        return true;
+    } else if (m_step == 1) {
+        const QMap<char, QByteArray> input = QXmppSaslScram::parseMessage(challenge);
+        const QByteArray nonce = input.value('r');
+        const QByteArray salt = QXmppBase64::decode(input.value('s'));
+        const int iterations = input.value('i').toInt();
+        if (!nonce.startsWith(m_nonce) || nonce.size() == m_nonce.size() || salt.isEmpty() || iterations < 1) {
+            warning("QXmppSaslClientScram : Invalid input on step 1");
+            return false;
+        }
+        if (iterations > scramMaximumIterations) {
+            warning(QString("QXmppSaslClientScram : Refusing iteration count %1 on step 1").arg(iterations));
+            return false;
+        }
+
+        QByteArray clientKey;
+        QXmppSaslScram::keys(m_algorithm, username().toUtf8(), password().toUtf8(), salt, iterations, clientKey, m_serverKey);
+
+        // build response
+        const QByteArray clientFinal = "c=biws,r=" + nonce;
+        m_authMessage = m_clientFirstBare + ',' + challenge + ',' + clientFinal;
+
+        const QByteArray storedKey = QCryptographicHash::hash(clientKey, m_algorithm);
+        QByteArray proof = QXmppSaslScram::hmac(m_algorithm, storedKey, m_authMessage);
+        scramXor(proof, clientKey);
+
+        response = clientFinal + ",p=" + QXmppBase64::encode(proof);
+        m_step++;
+        return true;
+    } else if (m_step == 2) {
+        const QMap<char, QByteArray> input = QXmppSaslScram::parseMessage(challenge);
+        if (input.contains('e')) {
+            warning(QString("QXmppSaslClientScram : Server reported error '%1'").arg(QString::fromUtf8(input.value('e'))));
+            return false;
+        }
+
+        // check the server's signature
+        if (QXmppBase64::decode(input.value('v')) != QXmppSaslScram::hmac(m_algorithm, m_serverKey, m_authMessage)) {
+            warning("QXmppSaslClientScram : Invalid challenge on step 2");
+            return false;
+        }
+
+        response = QByteArray();
+        m_step++;
+        return true;
+    } else {
+        warning("QXmppSaslClientScram : Invalid step");
+        return false;
+    }
+}
+
+QXmppSaslClientToken::QXmppSaslClientToken(QObject *parent)
+    : QXmppSaslClient(parent)
+    , m_step(0)
+{
+}
+
+QString QXmppSaslClientToken::mechanism() const
+{
+    return "X-QXMPP-TOKEN";
+}
+
+bool QXmppSaslClientToken::respond(const QByteArray &challenge, QByteArray &response)
+{
+    Q_UNUSED(challenge);
+    if (m_step == 0) {
+        response = QString(username() + '\0' + password()).toUtf8();
+        m_step++;
+        return true;
+    } else {
+        warning("QXmppSaslClientToken : Invalid step");
+        return false;
+    }
+}
+
 QXmppSaslClientWindowsLive::QXmppSaslClientWindowsLive(QObject *parent)
     : QXmppSaslClient(parent)
     , m_step(0)
@@ -539,7 +732,7 @@ bool QXmppSaslClientWindowsLive::respond(const QByteArray &challenge, QByteArray
     Q_UNUSED(challenge);
     if (m_step == 0) {
         // send initial response
-        response = QByteArray::fromBase64(password().toLatin1());
+        response = QXmppBase64::decode(password());
         m_step++;
         return true;
     } else {
@@ -578,6 +771,14 @@ QXmppSaslServer* QXmppSaslServer::create(const QString &mechanism, QObject *pare
         return new QXmppSaslServerDigestMd5(parent);
     } else if (mechanism == "ANONYMOUS") {
         return new QXmppSaslServerAnonymous(parent);
+    } else if (mechanism == "X-QXMPP-TOKEN") {
+        return new QXmppSaslServerToken(parent);
+    } else if (mechanism == "SCRAM-SHA-1") {
+        return new QXmppSaslServerScram(QCryptographicHash::Sha1, parent);
+#if QT_VERSION >= 0x050000
+    } else if (mechanism == "SCRAM-SHA-256") {
+        return new QXmppSaslServerScram(QCryptographicHash::Sha256, parent);
+#endif
     } else {
         return 0;
     }
@@ -732,6 +933,85 @@ QXmppSaslServer::Response QXmppSaslServerDigestMd5::respond(const QByteArray &re
     }
 }
 
+QXmppSaslServerScram::QXmppSaslServerScram(QCryptographicHash::Algorithm algorithm, QObject *parent)
+    : QXmppSaslServer(parent)
+    , m_algorithm(algorithm)
+    , m_iterations(scramServerIterations)
+    , m_step(0)
+{
+}
+
+QString QXmppSaslServerScram::mechanism() const
+{
+    return m_algorithm == QCryptographicHash::Sha1 ? "SCRAM-SHA-1" : "SCRAM-SHA-256";
+}
+
+QXmppSaslServer::Response QXmppSaslServerScram::respond(const QByteArray &request, QByteArray &response)
+{
+    if (m_step == 0) {
+        // we do not support channel binding
+        const int pos = request.indexOf(',', 2);
+        if (!(request.startsWith("n,") || request.startsWith("y,")) || pos < 0) {
+            warning("QXmppSaslServerScram : Invalid gs2 header");
+            return Failed;
+        }
+
+        const QByteArray clientFirstBare = request.mid(pos + 1);
+        const QMap<char, QByteArray> input = QXmppSaslScram::parseMessage(clientFirstBare);
+        if (!input.contains('n') || input.value('r').isEmpty()) {
+            warning("QXmppSaslServerScram : Invalid input on step 0");
+            return Failed;
+        }
+
+        setUsername(QString::fromUtf8(scramUnescape(input.value('n'))));
+        if (password().isEmpty())
+            return InputNeeded;
+
+        m_gs2Header = request.left(pos + 1);
+        m_clientFirstBare = clientFirstBare;
+        m_nonce = input.value('r') + generateNonce();
+        m_salt = scramServerSalt(username().toUtf8());
+        m_serverFirst = "r=" + m_nonce + ",s=" + QXmppBase64::encode(m_salt) + ",i=" + QByteArray::number(m_iterations);
+
+        m_step++;
+        response = m_serverFirst;
+        return Challenge;
+    } else if (m_step == 1) {
+        const QMap<char, QByteArray> input = QXmppSaslScram::parseMessage(request);
+        const int proofPos = request.lastIndexOf(",p=");
+        if (QXmppBase64::decode(input.value('c')) != m_gs2Header || input.value('r') != m_nonce || proofPos < 0) {
+            warning("QXmppSaslServerScram : Invalid input on step 1");
+            return Failed;
+        }
+
+        QByteArray clientKey;
+        QByteArray serverKey;
+        QXmppSaslScram::keys(m_algorithm, username().toUtf8(), password().toUtf8(), m_salt, m_iterations, clientKey, serverKey);
+
+        // recover the client key from the proof and check it
+        const QByteArray authMessage = m_clientFirstBare + ',' + m_serverFirst + ',' + request.left(proofPos);
+        const QByteArray storedKey = QCryptographicHash::hash(clientKey, m_algorithm);
+        QByteArray proof = QXmppBase64::decode(input.value('p'));
+        const QByteArray signature = QXmppSaslScram::hmac(m_algorithm, storedKey, authMessage);
+        if (proof.size() != signature.size())
+            return Failed;
+        scramXor(proof, signature);
+        if (QCryptographicHash::hash(proof, m_algorithm) != storedKey)
+            return Failed;
+
+        m_step++;
+        response = "v=" + QXmppBase64::encode(QXmppSaslScram::hmac(m_algorithm, serverKey, authMessage));
+        return Challenge;
+    } else if (m_step == 2) {
+        m_step++;
+        response = QByteArray();
+        return Succeeded;
+    } else {
+        warning("QXmppSaslServerScram : Invalid step");
+        return Failed;
+    }
+}
+
 QXmppSaslServerPlain::QXmppSaslServerPlain(QObject *parent)
     : QXmppSaslServer(parent)
     , m_step(0)
@@ -768,6 +1048,37 @@ QXmppSaslServer::Response QXmppSaslServerPlain::respond(const QByteArray &reques
     }
 }
 
+QXmppSaslServerToken::QXmppSaslServerToken(QObject *parent)
+    : QXmppSaslServer(parent)
+    , m_step(0)
+{
+}
+
+QString QXmppSaslServerToken::mechanism() const
+{
+    return "X-QXMPP-TOKEN";
+}
+
+QXmppSaslServer::Response QXmppSaslServerToken::respond(const QByteArray &request, QByteArray &response)
+{
+    if (m_step == 0) {
+        QList<QByteArray> auth = request.split('\0');
+        if (auth.size() != 2) {
+            warning("QXmppSaslServerToken : Invalid input");
+            return Failed;
+        }
+        setUsername(QString::fromUtf8(auth[0]));
+        setPassword(QString::fromUtf8(auth[1]));
+
+        m_step++;
+        response = QByteArray();
+        return InputNeeded;
+    } else {
+        warning("QXmppSaslServerToken : Invalid step");
+        return Failed;
+    }
+}
+
 void QXmppSaslDigestMd5::setNonce(const QByteArray &nonce)
 {
     forcedNonce = nonce;
@@ -848,3 +1159,98 @@ QByteArray QXmppSaslDigestMd5::serializeMessage(const QMap<QByteArray, QByteArra
     }
     return ba;
 }
+
+/// Returns the number of entries in the SCRAM key cache.
+
+int QXmppSaslScram::cacheSize()
+{
+    QXmppSaslScramCache *cache = scramCache();
+    QMutexLocker locker(&cache->mutex);
+    return cache->entries.size();
+}
+
+/// Removes all entries from the SCRAM key cache.
+
+void QXmppSaslScram::clearCache()
+{
+    QXmppSaslScramCache *cache = scramCache();
+    QMutexLocker locker(&cache->mutex);
+    cache->entries.clear();
+    cache->order.clear();
+}
+
+/// Calculates the HMAC of \a text using the given \a key.
+
+QByteArray QXmppSaslScram::hmac(QCryptographicHash::Algorithm algorithm, const QByteArray &key, const QByteArray &text)
+{
+    // both SHA-1 and SHA-256 use 64-byte blocks
+    const int blockSize = 64;
+
+    QByteArray paddedKey = key.size() > blockSize ? QCryptographicHash::hash(key, algorithm) : key;
+    paddedKey.append(QByteArray(blockSize - paddedKey.size(), '\0'));
+
+    QByteArray innerPad(blockSize, char(0x36));
+    QByteArray outerPad(blockSize, char(0x5c));
+    scramXor(innerPad, paddedKey);
+    scramXor(outerPad, paddedKey);
+
+    return QCryptographicHash::hash(outerPad + QCryptographicHash::hash(innerPad + text, algorithm), algorithm);
+}
+
+/// Calculates the salted password, i.e. PBKDF2 using HMAC as the
+/// pseudo-random function, see RFC 5802, section 2.2.
+
+QByteArray QXmppSaslScram::saltedPassword(QCryptographicHash::Algorithm algorithm, const QByteArray &password, const QByteArray &salt, int iterations)
+{
+    QByteArray block = hmac(algorithm, password, salt + QByteArray("\0\0\0\1", 4));
+    QByteArray result = block;
+    for (int i = 1; i < iterations; ++i) {
+        block = hmac(algorithm, password, block);
+        scramXor(result, block);
+    }
+    return result;
+}
+
+/// Returns the client and server keys for the given credentials, salt and
+/// iteration count.
+///
+/// The keys are only derived if they are not already in the cache.
+
+void QXmppSaslScram::keys(QCryptographicHash::Algorithm algorithm, const QByteArray &username, const QByteArray &password, const QByteArray &salt, int iterations, QByteArray &clientKey, QByteArray &serverKey)
+{
+    QXmppSaslScramCache *cache = scramCache();
+    const QByteArray id = hmac(QCryptographicHash::Sha1, cache->secret,
+        QByteArray::number(int(algorithm)) + '\0' + username + '\0' + password + '\0' + salt + '\0' + QByteArray::number(iterations));
+
+    QMutexLocker locker(&cache->mutex);
+    QHash<QByteArray, QPair<QByteArray, QByteArray> >::const_iterator it = cache->entries.constFind(id);
+    if (it != cache->entries.constEnd()) {
+        clientKey = it.value().first;
+        serverKey = it.value().second;
+        return;
+    }
+
+    // derive the keys without holding the lock
+    locker.unlock();
+    const QByteArray salted = saltedPassword(algorithm, password, salt, iterations);
+    clientKey = hmac(algorithm, salted, "Client Key");
+    serverKey = hmac(algorithm, salted, "Server Key");
+
+    locker.relock();
+    if (!cache->entries.contains(id)) {
+        if (cache->order.size() >= scramCacheLimit)
+            cache->entries.remove(cache->order.takeFirst());
+        cache->entries.insert(id, qMakePair(clientKey, serverKey));
+        cache->order << id;
+    }
+}
+
+QMap<char, QByteArray> QXmppSaslScram::parseMessage(const QByteArray &ba)
+{
+    QMap<char, QByteArray> map;
+    foreach (const QByteArray &attribute, ba.split(',')) {
+        if (attribute.size() >= 2 && attribute.at(1) == '=')
+            map[attribute.at(0)] = attribute.mid(2);
+    }
+    return map;
+}
@@ -26,6 +26,7 @@
 #define QXMPPSASL_P_H
 
 #include <QByteArray>
+#include <QCryptographicHash>
 #include <QMap>
 
 #include "QXmppGlobal.h"
@@ -120,6 +121,20 @@ public:
     static QByteArray serializeMessage(const QMap<QByteArray, QByteArray> &map);
 };
 
+class QXMPP_AUTOTEST_EXPORT QXmppSaslScram
+{
+public:
+    static int cacheSize();
+    static void clearCache();
+
+    static QByteArray hmac(QCryptographicHash::Algorithm algorithm, const QByteArray &key, const QByteArray &text);
+    static QByteArray saltedPassword(QCryptographicHash::Algorithm algorithm, const QByteArray &password, const QByteArray &salt, int iterations);
+    static void keys(QCryptographicHash::Algorithm algorithm, const QByteArray &username, const QByteArray &password, const QByteArray &salt, int iterations, QByteArray &clientKey, QByteArray &serverKey);
+
+    // message parsing
+    static QMap<char, QByteArray> parseMessage(const QByteArray &ba);
+};
+
 class QXMPP_AUTOTEST_EXPORT QXmppSaslAuth : public QXmppStanza
 {
 public:
@@ -195,12 +210,18 @@ private:
 class QXMPP_AUTOTEST_EXPORT QXmppSaslSuccess : public QXmppStanza
 {
 public:
-    QXmppSaslSuccess();
+    QXmppSaslSuccess(const QByteArray &value = QByteArray());
+
+    QByteArray value() const;
+    void setValue(const QByteArray &value);
 
     /// \cond
     void parse(const QDomElement &element);
     void toXml(QXmlStreamWriter *writer) const;
     /// \endcond
+
+private:
+    QByteArray m_value;
 };
 
 class QXmppSaslClientAnonymous : public QXmppSaslClient
@@ -262,6 +283,34 @@ private:
     int m_step;
 };
 
+class QXmppSaslClientScram : public QXmppSaslClient
+{
+public:
+    QXmppSaslClientScram(QCryptographicHash::Algorithm algorithm, QObject *parent = 0);
+    QString mechanism() const;
+    bool respond(const QByteArray &challenge, QByteArray &response);
+    bool isServerVerified() const;
+
+private:
+    QCryptographicHash::Algorithm m_algorithm;
+    QByteArray m_authMessage;
+    QByteArray m_clientFirstBare;
+    QByteArray m_nonce;
+    QByteArray m_serverKey;
+    int m_step;
+};
+
+class QXmppSaslClientToken : public QXmppSaslClient
+{
+public:
+    QXmppSaslClientToken(QObject *parent = 0);
+    QString mechanism() const;
+    bool respond(const QByteArray &challenge, QByteArray &response);
+
+private:
+    int m_step;
+};
+
 class QXmppSaslClientWindowsLive : public QXmppSaslClient
 {
 public:
@@ -313,6 +362,25 @@ private:
     int m_step;
 };
 
+class QXmppSaslServerScram : public QXmppSaslServer
+{
+public:
+    QXmppSaslServerScram(QCryptographicHash::Algorithm algorithm, QObject *parent = 0);
+    QString mechanism() const;
+
+    Response respond(const QByteArray &challenge, QByteArray &response);
+
+private:
+    QCryptographicHash::Algorithm m_algorithm;
+    QByteArray m_clientFirstBare;
+    QByteArray m_gs2Header;
+    QByteArray m_nonce;
+    QByteArray m_salt;
+    QByteArray m_serverFirst;
+    int m_iterations;
+    int m_step;
+};
+
 class QXmppSaslServerPlain : public QXmppSaslServer
 {
 public:
@@ -325,4 +393,16 @@ private:
     int m_step;
 };
 
+class QXmppSaslServerToken : public QXmppSaslServer
+{
+public:
+    QXmppSaslServerToken(QObject *parent = 0);
+    QString mechanism() const;
+
+    Response respond(const QByteArray &challenge, QByteArray &response);
+
+private:
+    int m_step;
+};
+
 #endif
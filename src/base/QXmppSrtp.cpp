@@ -0,0 +1,562 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <cstring>
+
+#include "QXmppSrtp_p.h"
+#include "QXmppUtils.h"
+
+#if defined(__AES__) && (defined(__SSE2__) || defined(_M_X64))
+#define QXMPP_AES_NI
+#include <wmmintrin.h>
+#elif defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)
+#define QXMPP_AES_ARMV8
+#include <arm_neon.h>
+#endif
+
+// SRTCP packets always carry an 80-bit tag, see RFC 4568
+static const int rtcpTagLength = 10;
+
+// RFC 3711 key derivation labels
+static const quint8 rtpEncryptionLabel = 0x00;
+static const quint8 rtcpEncryptionLabel = 0x03;
+
+static inline quint32 loadBigEndian(const uchar *data)
+{
+    return (quint32(data[0]) << 24) | (quint32(data[1]) << 16) | (quint32(data[2]) << 8) | data[3];
+}
+
+static inline void storeBigEndian(quint32 value, uchar *data)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static inline quint8 rotateLeft(quint8 value, int bits)
+{
+    return quint8((value << bits) | (value >> (8 - bits)));
+}
+
+static inline quint32 rotateRight(quint32 value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+// The AES S-box and the tables which combine SubBytes and MixColumns for
+// each row of the state, built from the multiplicative inverses in GF(2^8).
+class QXmppAesTables
+{
+public:
+    QXmppAesTables()
+    {
+        quint8 p = 1;
+        quint8 q = 1;
+        do {
+            // multiply p by 3 and divide q by 3
+            p = p ^ quint8(p << 1) ^ ((p & 0x80) ? 0x1b : 0);
+            q ^= q << 1;
+            q ^= q << 2;
+            q ^= q << 4;
+            if (q & 0x80)
+                q ^= 0x09;
+
+            sbox[p] = q ^ rotateLeft(q, 1) ^ rotateLeft(q, 2) ^ rotateLeft(q, 3) ^ rotateLeft(q, 4) ^ 0x63;
+        } while (p != 1);
+        sbox[0] = 0x63;
+
+        for (int i = 0; i < 256; ++i) {
+            const quint32 s = sbox[i];
+            const quint32 s2 = quint8((s << 1) ^ ((s & 0x80) ? 0x1b : 0));
+            encode[0][i] = (s2 << 24) | (s << 16) | (s << 8) | (s2 ^ s);
+            encode[1][i] = rotateRight(encode[0][i], 8);
+            encode[2][i] = rotateRight(encode[0][i], 16);
+            encode[3][i] = rotateRight(encode[0][i], 24);
+        }
+    }
+
+    quint8 sbox[256];
+    quint32 encode[4][256];
+};
+
+Q_GLOBAL_STATIC(QXmppAesTables, aesTables)
+
+// Compares two authentication tags in a time which does not depend on
+// their contents.
+static bool tagsEqual(const char *a, const char *b, int length)
+{
+    char diff = 0;
+    for (int i = 0; i < length; ++i)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+// Returns the length of an RTP header including its CSRC list and
+// extension, or -1 if the packet is malformed.
+static int rtpHeaderLength(const QByteArray &packet)
+{
+    const uchar *data = reinterpret_cast<const uchar*>(packet.constData());
+    if (packet.size() < 12 || (data[0] >> 6) != 2)
+        return -1;
+
+    int length = 12 + 4 * (data[0] & 0x0f);
+    if (data[0] & 0x10) {
+        if (packet.size() < length + 4)
+            return -1;
+        length += 4 + 4 * ((data[length + 2] << 8) | data[length + 3]);
+    }
+    return length <= packet.size() ? length : -1;
+}
+
+static bool replayAccept(bool valid, quint64 highest, quint64 window, quint64 index)
+{
+    if (!valid || index > highest)
+        return true;
+    const quint64 delta = highest - index;
+    return delta < 64 && !(window & (Q_UINT64_C(1) << delta));
+}
+
+static void replayUpdate(bool *valid, quint64 *highest, quint64 *window, quint64 index)
+{
+    if (!*valid) {
+        *valid = true;
+        *highest = index;
+        *window = 1;
+    } else if (index > *highest) {
+        const quint64 delta = index - *highest;
+        *window = delta < 64 ? ((*window << delta) | 1) : 1;
+        *highest = index;
+    } else {
+        *window |= Q_UINT64_C(1) << (*highest - index);
+    }
+}
+
+QXmppAesCipher::QXmppAesCipher()
+{
+    memset(m_roundKeys, 0, sizeof(m_roundKeys));
+}
+
+/// Sets the 128-bit encryption key, and expands it into the round keys.
+///
+/// \param key
+
+void QXmppAesCipher::setKey(const QByteArray &key)
+{
+    Q_ASSERT(key.size() == 16);
+
+    const quint8 *sbox = aesTables()->sbox;
+    quint32 words[44];
+    for (int i = 0; i < 4; ++i)
+        words[i] = loadBigEndian(reinterpret_cast<const uchar*>(key.constData()) + 4 * i);
+
+    quint8 rcon = 1;
+    for (int i = 4; i < 44; ++i) {
+        quint32 temp = words[i - 1];
+        if (i % 4 == 0) {
+            temp = (quint32(sbox[(temp >> 16) & 0xff]) << 24) |
+                   (quint32(sbox[(temp >> 8) & 0xff]) << 16) |
+                   (quint32(sbox[temp & 0xff]) << 8) |
+                   quint32(sbox[temp >> 24]);
+            temp ^= quint32(rcon) << 24;
+            rcon = quint8((rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0));
+        }
+        words[i] = words[i - 4] ^ temp;
+    }
+
+    for (int i = 0; i < 44; ++i)
+        storeBigEndian(words[i], m_roundKeys + 4 * i);
+}
+
+/// Encrypts a single 16-byte block.
+///
+/// \param input
+/// \param output
+
+void QXmppAesCipher::encryptBlock(const uchar *input, uchar *output) const
+{
+#if defined(QXMPP_AES_NI)
+    const __m128i *roundKeys = reinterpret_cast<const __m128i*>(m_roundKeys);
+    __m128i state = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input)), _mm_loadu_si128(roundKeys));
+    for (int round = 1; round < 10; ++round)
+        state = _mm_aesenc_si128(state, _mm_loadu_si128(roundKeys + round));
+    state = _mm_aesenclast_si128(state, _mm_loadu_si128(roundKeys + 10));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output), state);
+#elif defined(QXMPP_AES_ARMV8)
+    // AESE adds the round key before substituting, so the last key is
+    // added separately
+    uint8x16_t state = vld1q_u8(input);
+    for (int round = 0; round < 9; ++round)
+        state = vaesmcq_u8(vaeseq_u8(state, vld1q_u8(m_roundKeys + 16 * round)));
+    state = vaeseq_u8(state, vld1q_u8(m_roundKeys + 144));
+    state = veorq_u8(state, vld1q_u8(m_roundKeys + 160));
+    vst1q_u8(output, state);
+#else
+    const QXmppAesTables *tables = aesTables();
+    const quint32 *te0 = tables->encode[0];
+    const quint32 *te1 = tables->encode[1];
+    const quint32 *te2 = tables->encode[2];
+    const quint32 *te3 = tables->encode[3];
+    const uchar *roundKey = m_roundKeys;
+
+    quint32 s0 = loadBigEndian(input) ^ loadBigEndian(roundKey);
+    quint32 s1 = loadBigEndian(input + 4) ^ loadBigEndian(roundKey + 4);
+    quint32 s2 = loadBigEndian(input + 8) ^ loadBigEndian(roundKey + 8);
+    quint32 s3 = loadBigEndian(input + 12) ^ loadBigEndian(roundKey + 12);
+    for (int round = 1; round < 10; ++round) {
+        roundKey += 16;
+        const quint32 t0 = te0[s0 >> 24] ^ te1[(s1 >> 16) & 0xff] ^ te2[(s2 >> 8) & 0xff] ^ te3[s3 & 0xff] ^ loadBigEndian(roundKey);
+        const quint32 t1 = te0[s1 >> 24] ^ te1[(s2 >> 16) & 0xff] ^ te2[(s3 >> 8) & 0xff] ^ te3[s0 & 0xff] ^ loadBigEndian(roundKey + 4);
+        const quint32 t2 = te0[s2 >> 24] ^ te1[(s3 >> 16) & 0xff] ^ te2[(s0 >> 8) & 0xff] ^ te3[s1 & 0xff] ^ loadBigEndian(roundKey + 8);
+        const quint32 t3 = te0[s3 >> 24] ^ te1[(s0 >> 16) & 0xff] ^ te2[(s1 >> 8) & 0xff] ^ te3[s2 & 0xff] ^ loadBigEndian(roundKey + 12);
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // the last round has no MixColumns
+    const quint8 *sbox = tables->sbox;
+    roundKey += 16;
+    const quint32 states[4] = { s0, s1, s2, s3 };
+    for (int i = 0; i < 4; ++i) {
+        const quint32 word = (quint32(sbox[states[i] >> 24]) << 24) |
+                             (quint32(sbox[(states[(i + 1) % 4] >> 16) & 0xff]) << 16) |
+                             (quint32(sbox[(states[(i + 2) % 4] >> 8) & 0xff]) << 8) |
+                             quint32(sbox[states[(i + 3) % 4] & 0xff]);
+        storeBigEndian(word ^ loadBigEndian(roundKey + 4 * i), output + 4 * i);
+    }
+#endif
+}
+
+/// Encrypts or decrypts data in place using AES in counter mode.
+///
+/// \param iv the initial 16-byte counter block
+/// \param data
+/// \param length
+
+void QXmppAesCipher::encryptCounter(const uchar *iv, uchar *data, int length) const
+{
+    uchar counter[16];
+    uchar keystream[16];
+    memcpy(counter, iv, sizeof(counter));
+    while (length > 0) {
+        encryptBlock(counter, keystream);
+        const int count = qMin(length, 16);
+        for (int i = 0; i < count; ++i)
+            data[i] ^= keystream[i];
+        data += count;
+        length -= count;
+
+        for (int i = 15; i >= 0 && !++counter[i]; --i) {}
+    }
+}
+
+void QXmppSrtpSession::Keys::derive(const QByteArray &masterKey, const QByteArray &masterSalt, quint8 label)
+{
+    cipher.setKey(deriveKey(masterKey, masterSalt, label, 16));
+    salt = deriveKey(masterKey, masterSalt, label + 2, masterSaltLength);
+
+    // the HMAC pads are only computed once
+    const QByteArray authKey = deriveKey(masterKey, masterSalt, label + 1, 20);
+    innerPad = QByteArray(64, 0x36);
+    outerPad = QByteArray(64, 0x5c);
+    for (int i = 0; i < authKey.size(); ++i) {
+        innerPad[i] = innerPad[i] ^ authKey[i];
+        outerPad[i] = outerPad[i] ^ authKey[i];
+    }
+}
+
+QByteArray QXmppSrtpSession::Keys::authenticate(const char *data, int size, const char *extra, int extraSize) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(innerPad);
+    hash.addData(data, size);
+    if (extraSize)
+        hash.addData(extra, extraSize);
+    const QByteArray inner = hash.result();
+
+    hash.reset();
+    hash.addData(outerPad);
+    hash.addData(inner);
+    return hash.result();
+}
+
+void QXmppSrtpSession::Keys::initializationVector(uchar *iv, quint32 ssrc, quint64 index) const
+{
+    memcpy(iv, salt.constData(), masterSaltLength);
+    iv[14] = 0;
+    iv[15] = 0;
+    for (int i = 0; i < 4; ++i)
+        iv[4 + i] ^= quint8(ssrc >> (24 - 8 * i));
+    for (int i = 0; i < 6; ++i)
+        iv[8 + i] ^= quint8(index >> (40 - 8 * i));
+}
+
+QXmppSrtpSession::Stream::Stream()
+    : rtpValid(false),
+    rtpIndex(0),
+    rtpWindow(0),
+    rtcpValid(false),
+    rtcpIndex(0),
+    rtcpWindow(0)
+{
+}
+
+// Estimates the 48-bit packet index from the sequence number, following
+// RFC 3711 Appendix A.
+static quint64 estimateIndex(bool valid, quint64 highest, quint16 sequence)
+{
+    if (!valid)
+        return sequence;
+
+    const quint32 roc = quint32(highest >> 16);
+    const int last = int(highest & 0xffff);
+    quint32 guess = roc;
+    if (last < 32768) {
+        if (int(sequence) - last > 32768 && roc > 0)
+            guess = roc - 1;
+    } else if (last - 32768 > int(sequence)) {
+        guess = roc + 1;
+    }
+    return (quint64(guess) << 16) | sequence;
+}
+
+/// Constructs an SRTP session from the master key and salt.
+///
+/// \param suite
+/// \param masterKey
+/// \param masterSalt
+
+QXmppSrtpSession::QXmppSrtpSession(CryptoSuite suite, const QByteArray &masterKey, const QByteArray &masterSalt)
+    : m_suite(suite),
+    m_rtpTagLength(suite == AES_CM_128_HMAC_SHA1_32 ? 4 : 10)
+{
+    m_rtpKeys.derive(masterKey, masterSalt, rtpEncryptionLabel);
+    m_rtcpKeys.derive(masterKey, masterSalt, rtcpEncryptionLabel);
+}
+
+/// Returns the session's crypto suite.
+
+QXmppSrtpSession::CryptoSuite QXmppSrtpSession::cryptoSuite() const
+{
+    return m_suite;
+}
+
+/// Encrypts an RTP packet in place and appends its authentication tag.
+///
+/// \param packet
+
+bool QXmppSrtpSession::protectRtp(QByteArray *packet)
+{
+    const int headerLength = rtpHeaderLength(*packet);
+    if (headerLength < 0)
+        return false;
+
+    uchar *data = reinterpret_cast<uchar*>(packet->data());
+    const quint16 sequence = (data[2] << 8) | data[3];
+    const quint32 ssrc = loadBigEndian(data + 8);
+    Stream &stream = m_streams[ssrc];
+    const quint64 index = estimateIndex(stream.rtpValid, stream.rtpIndex, sequence);
+    if (!stream.rtpValid || index > stream.rtpIndex) {
+        stream.rtpValid = true;
+        stream.rtpIndex = index;
+    }
+
+    uchar iv[16];
+    m_rtpKeys.initializationVector(iv, ssrc, index);
+    m_rtpKeys.cipher.encryptCounter(iv, data + headerLength, packet->size() - headerLength);
+
+    uchar roc[4];
+    storeBigEndian(quint32(index >> 16), roc);
+    const QByteArray tag = m_rtpKeys.authenticate(packet->constData(), packet->size(), reinterpret_cast<const char*>(roc), sizeof(roc));
+    packet->append(tag.constData(), m_rtpTagLength);
+    return true;
+}
+
+/// Checks the authentication tag of an SRTP packet, then decrypts it in
+/// place.
+///
+/// Returns false if the packet is malformed, forged or replayed.
+///
+/// \param packet
+
+bool QXmppSrtpSession::unprotectRtp(QByteArray *packet)
+{
+    const int headerLength = rtpHeaderLength(*packet);
+    if (headerLength < 0 || packet->size() < headerLength + m_rtpTagLength)
+        return false;
+
+    const int size = packet->size() - m_rtpTagLength;
+    const uchar *constData = reinterpret_cast<const uchar*>(packet->constData());
+    const quint16 sequence = (constData[2] << 8) | constData[3];
+    const quint32 ssrc = loadBigEndian(constData + 8);
+
+    // the state is only stored once the packet is authenticated
+    Stream stream = m_streams.value(ssrc);
+    const quint64 index = estimateIndex(stream.rtpValid, stream.rtpIndex, sequence);
+    if (!replayAccept(stream.rtpValid, stream.rtpIndex, stream.rtpWindow, index))
+        return false;
+
+    uchar roc[4];
+    storeBigEndian(quint32(index >> 16), roc);
+    const QByteArray tag = m_rtpKeys.authenticate(packet->constData(), size, reinterpret_cast<const char*>(roc), sizeof(roc));
+    if (!tagsEqual(tag.constData(), packet->constData() + size, m_rtpTagLength))
+        return false;
+
+    packet->resize(size);
+    uchar iv[16];
+    m_rtpKeys.initializationVector(iv, ssrc, index);
+    m_rtpKeys.cipher.encryptCounter(iv, reinterpret_cast<uchar*>(packet->data()) + headerLength, size - headerLength);
+
+    replayUpdate(&stream.rtpValid, &stream.rtpIndex, &stream.rtpWindow, index);
+    m_streams.insert(ssrc, stream);
+    return true;
+}
+
+/// Encrypts an RTCP packet in place and appends its index and
+/// authentication tag.
+///
+/// \param packet
+
+bool QXmppSrtpSession::protectRtcp(QByteArray *packet)
+{
+    if (packet->size() < 8)
+        return false;
+
+    uchar *data = reinterpret_cast<uchar*>(packet->data());
+    const quint32 ssrc = loadBigEndian(data + 4);
+    Stream &stream = m_streams[ssrc];
+    const quint32 index = quint32(stream.rtcpIndex);
+    stream.rtcpIndex = (index + 1) & 0x7fffffff;
+
+    uchar iv[16];
+    m_rtcpKeys.initializationVector(iv, ssrc, index);
+    m_rtcpKeys.cipher.encryptCounter(iv, data + 8, packet->size() - 8);
+
+    // the E flag marks the packet as encrypted
+    uchar trailer[4];
+    storeBigEndian(0x80000000 | index, trailer);
+    packet->append(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+
+    const QByteArray tag = m_rtcpKeys.authenticate(packet->constData(), packet->size(), 0, 0);
+    packet->append(tag.constData(), rtcpTagLength);
+    return true;
+}
+
+/// Checks the authentication tag of an SRTCP packet, then decrypts it in
+/// place.
+///
+/// Returns false if the packet is malformed, forged or replayed.
+///
+/// \param packet
+
+bool QXmppSrtpSession::unprotectRtcp(QByteArray *packet)
+{
+    if (packet->size() < 8 + 4 + rtcpTagLength)
+        return false;
+
+    const int size = packet->size() - rtcpTagLength;
+    const uchar *constData = reinterpret_cast<const uchar*>(packet->constData());
+    const quint32 trailer = loadBigEndian(constData + size - 4);
+    const quint32 index = trailer & 0x7fffffff;
+    const quint32 ssrc = loadBigEndian(constData + 4);
+
+    Stream stream = m_streams.value(ssrc);
+    if (!replayAccept(stream.rtcpValid, stream.rtcpIndex, stream.rtcpWindow, index))
+        return false;
+
+    const QByteArray tag = m_rtcpKeys.authenticate(packet->constData(), size, 0, 0);
+    if (!tagsEqual(tag.constData(), packet->constData() + size, rtcpTagLength))
+        return false;
+
+    packet->resize(size - 4);
+    if (trailer & 0x80000000) {
+        uchar iv[16];
+        m_rtcpKeys.initializationVector(iv, ssrc, index);
+        m_rtcpKeys.cipher.encryptCounter(iv, reinterpret_cast<uchar*>(packet->data()) + 8, size - 12);
+    }
+
+    replayUpdate(&stream.rtcpValid, &stream.rtcpIndex, &stream.rtcpWindow, index);
+    m_streams.insert(ssrc, stream);
+    return true;
+}
+
+/// Parses a crypto suite name as used in SDP and Jingle.
+///
+/// \param str
+/// \param suite
+
+bool QXmppSrtpSession::cryptoSuiteFromString(const QString &str, CryptoSuite *suite)
+{
+    if (str == QLatin1String("AES_CM_128_HMAC_SHA1_80"))
+        *suite = AES_CM_128_HMAC_SHA1_80;
+    else if (str == QLatin1String("AES_CM_128_HMAC_SHA1_32"))
+        *suite = AES_CM_128_HMAC_SHA1_32;
+    else
+        return false;
+    return true;
+}
+
+/// Returns the name of a crypto suite as used in SDP and Jingle.
+///
+/// \param suite
+
+QString QXmppSrtpSession::cryptoSuiteToString(CryptoSuite suite)
+{
+    if (suite == AES_CM_128_HMAC_SHA1_32)
+        return QLatin1String("AES_CM_128_HMAC_SHA1_32");
+    else
+        return QLatin1String("AES_CM_128_HMAC_SHA1_80");
+}
+
+/// Returns a new random master key followed by a master salt.
+
+QByteArray QXmppSrtpSession::generateKeyMaterial()
+{
+    return QXmppUtils::generateSecureRandomBytes(masterKeyLength + masterSaltLength);
+}
+
+/// Derives a session key from the master key and salt, with a key
+/// derivation rate of zero.
+///
+/// \param masterKey
+/// \param masterSalt
+/// \param label
+/// \param length
+
+QByteArray QXmppSrtpSession::deriveKey(const QByteArray &masterKey, const QByteArray &masterSalt, quint8 label, int length)
+{
+    QXmppAesCipher cipher;
+    cipher.setKey(masterKey);
+
+    uchar iv[16];
+    memset(iv, 0, sizeof(iv));
+    memcpy(iv, masterSalt.constData(), qMin(masterSalt.size(), masterSaltLength));
+    iv[7] ^= label;
+
+    QByteArray key(length, '\0');
+    cipher.encryptCounter(iv, reinterpret_cast<uchar*>(key.data()), length);
+    return key;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPSRTP_P_H
+#define QXMPPSRTP_P_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QHash>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppRtpAudioChannel and QXmppRtpVideoChannel classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppAesCipher class encrypts with AES-128, using the AES-NI or
+/// ARMv8 cryptography instructions when the compiler targets them.
+
+class QXMPP_AUTOTEST_EXPORT QXmppAesCipher
+{
+public:
+    QXmppAesCipher();
+
+    void setKey(const QByteArray &key);
+    void encryptBlock(const uchar *input, uchar *output) const;
+    void encryptCounter(const uchar *iv, uchar *data, int length) const;
+
+private:
+    uchar m_roundKeys[176];
+};
+
+/// \internal
+///
+/// The QXmppSrtpSession class protects or unprotects the RTP and RTCP
+/// packets sent in one direction, as defined by RFC 3711: The Secure
+/// Real-time Transport Protocol (SRTP).
+///
+/// Packets are encrypted with AES in counter mode and authenticated with
+/// HMAC-SHA1, in place.
+
+class QXMPP_AUTOTEST_EXPORT QXmppSrtpSession
+{
+public:
+    /// This enum describes an SRTP crypto suite.
+    enum CryptoSuite {
+        AES_CM_128_HMAC_SHA1_80 = 0,
+        AES_CM_128_HMAC_SHA1_32
+    };
+
+    /// Length of the master key, in bytes.
+    static const int masterKeyLength = 16;
+
+    /// Length of the master salt, in bytes.
+    static const int masterSaltLength = 14;
+
+    QXmppSrtpSession(CryptoSuite suite, const QByteArray &masterKey, const QByteArray &masterSalt);
+
+    CryptoSuite cryptoSuite() const;
+
+    bool protectRtp(QByteArray *packet);
+    bool unprotectRtp(QByteArray *packet);
+    bool protectRtcp(QByteArray *packet);
+    bool unprotectRtcp(QByteArray *packet);
+
+    static bool cryptoSuiteFromString(const QString &str, CryptoSuite *suite);
+    static QString cryptoSuiteToString(CryptoSuite suite);
+    static QByteArray generateKeyMaterial();
+    static QByteArray deriveKey(const QByteArray &masterKey, const QByteArray &masterSalt, quint8 label, int length);
+
+private:
+    class Keys
+    {
+    public:
+        void derive(const QByteArray &masterKey, const QByteArray &masterSalt, quint8 label);
+        QByteArray authenticate(const char *data, int size, const char *extra, int extraSize) const;
+        void initializationVector(uchar *iv, quint32 ssrc, quint64 index) const;
+
+        QXmppAesCipher cipher;
+        QByteArray salt;
+        QByteArray innerPad;
+        QByteArray outerPad;
+    };
+
+    class Stream
+    {
+    public:
+        Stream();
+
+        bool rtpValid;
+        quint64 rtpIndex;
+        quint64 rtpWindow;
+        bool rtcpValid;
+        quint64 rtcpIndex;
+        quint64 rtcpWindow;
+    };
+
+    CryptoSuite m_suite;
+    int m_rtpTagLength;
+    Keys m_rtpKeys;
+    Keys m_rtcpKeys;
+    QHash<quint32, Stream> m_streams;
+};
+
+#endif
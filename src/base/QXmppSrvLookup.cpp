@@ -0,0 +1,600 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtAlgorithms>
+
+#include "QXmppMetrics.h"
+#include "QXmppSrvLookup_p.h"
+#ifdef QXMPP_USE_ASYNC_DNS
+#include "QXmppDnsQuery_p.h"
+#endif
+
+static int negativeTtl = 60;
+
+static const int queryCounter = QXmppMetrics::counter("srv-lookup.query");
+static const int cacheHitCounter = QXmppMetrics::counter("srv-lookup.cache-hit");
+static const int coalescedCounter = QXmppMetrics::counter("srv-lookup.coalesced");
+
+namespace
+{
+    // The result of the last query for a name, and the lookups waiting
+    // for the query in progress.
+    class QXmppSrvCacheEntry
+    {
+    public:
+        QXmppSrvCacheEntry()
+            : error(QDnsLookup::NoError)
+            , querier(0)
+        {
+        }
+
+        QDnsLookup::Error error;
+        QString errorString;
+        QList<QXmppSrvRecord> records;
+        // invalid until a query finished
+        QDateTime expiry;
+
+        QXmppSrvLookup *querier;
+        QList<QXmppSrvLookup*> waiters;
+    };
+
+    class QXmppSrvCache
+    {
+    public:
+        QMutex mutex;
+        QHash<QString, QXmppSrvCacheEntry> entries;
+    };
+
+    bool serviceRecordLessThan(const QXmppSrvRecord &r1, const QXmppSrvRecord &r2)
+    {
+        return r1.priority() < r2.priority();
+    }
+}
+
+Q_GLOBAL_STATIC(QXmppSrvCache, srvCache)
+
+// Orders the records by priority, and the records of equal priority by a
+// weighted random selection as described by RFC 2782, so that the streams
+// using a cached result still spread over the servers.
+
+static void sortServiceRecords(QList<QXmppSrvRecord> &records)
+{
+    qStableSort(records.begin(), records.end(), serviceRecordLessThan);
+
+    QList<QXmppSrvRecord> sorted;
+    int i = 0;
+    while (i < records.size()) {
+        QList<QXmppSrvRecord> slice;
+        int totalWeight = 0;
+        int j = i;
+        while (j < records.size() && records.at(j).priority() == records.at(i).priority()) {
+            slice << records.at(j);
+            totalWeight += records.at(j).weight();
+            ++j;
+        }
+
+        while (!slice.isEmpty()) {
+            int pick = 0;
+            if (totalWeight > 0) {
+                const int threshold = qrand() % (totalWeight + 1);
+                int sum = 0;
+                for (pick = 0; pick < slice.size() - 1; ++pick) {
+                    sum += slice.at(pick).weight();
+                    if (sum >= threshold)
+                        break;
+                }
+            }
+            totalWeight -= slice.at(pick).weight();
+            sorted << slice.takeAt(pick);
+        }
+        i = j;
+    }
+    records = sorted;
+}
+
+// Returns the lowest TTL of the \a records, which must not be empty.
+
+static quint32 lowestTimeToLive(const QList<QXmppSrvRecord> &records)
+{
+    quint32 ttl = records.first().timeToLive();
+    foreach (const QXmppSrvRecord &record, records)
+        ttl = qMin(ttl, record.timeToLive());
+    return ttl;
+}
+
+/// Constructs an empty SRV record.
+
+QXmppSrvRecord::QXmppSrvRecord()
+    : m_port(0)
+    , m_priority(0)
+    , m_weight(0)
+    , m_timeToLive(0)
+{
+}
+
+/// Returns the host name of the server.
+
+QString QXmppSrvRecord::target() const
+{
+    return m_target;
+}
+
+/// Sets the host name of the server.
+///
+/// \param target
+
+void QXmppSrvRecord::setTarget(const QString &target)
+{
+    m_target = target;
+}
+
+/// Returns the port of the service.
+
+quint16 QXmppSrvRecord::port() const
+{
+    return m_port;
+}
+
+/// Sets the port of the service.
+///
+/// \param port
+
+void QXmppSrvRecord::setPort(quint16 port)
+{
+    m_port = port;
+}
+
+/// Returns the priority of the record, lower values are preferred.
+
+quint16 QXmppSrvRecord::priority() const
+{
+    return m_priority;
+}
+
+/// Sets the priority of the record.
+///
+/// \param priority
+
+void QXmppSrvRecord::setPriority(quint16 priority)
+{
+    m_priority = priority;
+}
+
+/// Returns the weight of the record among records of equal priority.
+
+quint16 QXmppSrvRecord::weight() const
+{
+    return m_weight;
+}
+
+/// Sets the weight of the record.
+///
+/// \param weight
+
+void QXmppSrvRecord::setWeight(quint16 weight)
+{
+    m_weight = weight;
+}
+
+/// Returns the number of seconds for which the record may be cached.
+
+quint32 QXmppSrvRecord::timeToLive() const
+{
+    return m_timeToLive;
+}
+
+/// Sets the number of seconds for which the record may be cached.
+///
+/// \param timeToLive
+
+void QXmppSrvRecord::setTimeToLive(quint32 timeToLive)
+{
+    m_timeToLive = timeToLive;
+}
+
+class QXmppSrvLookupPrivate
+{
+public:
+    enum State
+    {
+        Idle,
+        // sending the DNS query
+        Querying,
+        // waiting for another lookup's query
+        Waiting,
+        // delivering a result taken from the cache
+        Delivering
+    };
+
+    QXmppSrvLookupPrivate(QXmppSrvLookup *qq);
+    void copyResult(const QXmppSrvCacheEntry &entry);
+    void detach(QXmppSrvCache *cache);
+    void startQuery(QXmppSrvCacheEntry &entry);
+    bool update(QXmppSrvCache *cache);
+
+#ifdef QXMPP_USE_ASYNC_DNS
+    QXmppDnsQuery *dns;
+#else
+    QDnsLookup *dns;
+#endif
+    QDnsLookup::Error error;
+    QString errorString;
+    bool isFinished;
+    QString name;
+    QList<QXmppSrvRecord> records;
+    State state;
+
+private:
+    QXmppSrvLookup *q;
+};
+
+QXmppSrvLookupPrivate::QXmppSrvLookupPrivate(QXmppSrvLookup *qq)
+    : dns(0)
+    , error(QDnsLookup::NoError)
+    , isFinished(false)
+    , state(Idle)
+    , q(qq)
+{
+}
+
+void QXmppSrvLookupPrivate::copyResult(const QXmppSrvCacheEntry &entry)
+{
+    error = entry.error;
+    errorString = entry.errorString;
+    records = entry.records;
+    sortServiceRecords(records);
+}
+
+// Stops taking part in the lookup of the current name, handing the query
+// over to a waiting lookup if needed. The cache must be locked.
+
+void QXmppSrvLookupPrivate::detach(QXmppSrvCache *cache)
+{
+    QHash<QString, QXmppSrvCacheEntry>::iterator it = cache->entries.find(name);
+    if (it != cache->entries.end()) {
+        it->waiters.removeAll(q);
+        if (it->querier == q) {
+            it->querier = 0;
+            if (!it->waiters.isEmpty()) {
+                it->querier = it->waiters.takeFirst();
+                QMetaObject::invokeMethod(it->querier, "_q_cacheUpdated", Qt::QueuedConnection);
+            } else if (!it->expiry.isValid()) {
+                cache->entries.erase(it);
+            }
+        }
+    }
+
+    if (state == Querying) {
+        state = Idle;
+        dns->abort();
+    }
+    state = Idle;
+}
+
+// Sends the DNS query for the current name. The cache must be locked.
+
+void QXmppSrvLookupPrivate::startQuery(QXmppSrvCacheEntry &entry)
+{
+    QXmppMetrics::updateCounter(queryCounter);
+    entry.querier = q;
+    state = Querying;
+#ifdef QXMPP_USE_ASYNC_DNS
+    dns->lookup(name);
+#else
+    dns->setName(name);
+    dns->setType(QDnsLookup::SRV);
+    dns->lookup();
+#endif
+}
+
+// Checks the cache entry of a waiting lookup, and returns true if it holds
+// the result. The cache must be locked.
+
+bool QXmppSrvLookupPrivate::update(QXmppSrvCache *cache)
+{
+    QXmppSrvCacheEntry &entry = cache->entries[name];
+    if (entry.querier == q) {
+        // the query was handed over to us
+        startQuery(entry);
+        return false;
+    } else if (entry.querier) {
+        // another query was started meanwhile
+        if (!entry.waiters.contains(q))
+            entry.waiters << q;
+        return false;
+    } else if (entry.expiry.isValid()) {
+        copyResult(entry);
+        state = Idle;
+        return true;
+    } else {
+        // the entry was cleared
+        startQuery(entry);
+        return false;
+    }
+}
+
+/// Constructs a new SRV lookup.
+///
+/// \param parent
+
+QXmppSrvLookup::QXmppSrvLookup(QObject *parent)
+    : QObject(parent)
+    , d(new QXmppSrvLookupPrivate(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+#ifdef QXMPP_USE_ASYNC_DNS
+    d->dns = new QXmppDnsQuery(this);
+#else
+    d->dns = new QDnsLookup(this);
+#endif
+    check = connect(d->dns, SIGNAL(finished()),
+                    this, SLOT(_q_dnsLookupFinished()));
+    Q_ASSERT(check);
+}
+
+QXmppSrvLookup::~QXmppSrvLookup()
+{
+    QXmppSrvCache *cache = srvCache();
+    if (cache && d->state != QXmppSrvLookupPrivate::Idle) {
+        QMutexLocker locker(&cache->mutex);
+        d->detach(cache);
+    }
+    delete d;
+}
+
+/// Returns the type of error that occurred if the lookup failed,
+/// or QDnsLookup::NoError.
+
+QDnsLookup::Error QXmppSrvLookup::error() const
+{
+    return d->error;
+}
+
+/// Returns a human-readable description of the error if the lookup failed.
+
+QString QXmppSrvLookup::errorString() const
+{
+    return d->errorString;
+}
+
+/// Returns true if the lookup has finished.
+
+bool QXmppSrvLookup::isFinished() const
+{
+    return d->isFinished;
+}
+
+/// Returns the name which is looked up.
+
+QString QXmppSrvLookup::name() const
+{
+    return d->name;
+}
+
+/// Returns the SRV records which were found, ordered by priority and by a
+/// weighted random selection among the records of equal priority.
+
+QList<QXmppSrvRecord> QXmppSrvLookup::serviceRecords() const
+{
+    return d->records;
+}
+
+/// Aborts the lookup. If a lookup was running, finished() is emitted with
+/// the QDnsLookup::OperationCancelledError error.
+
+void QXmppSrvLookup::abort()
+{
+    if (d->state == QXmppSrvLookupPrivate::Idle)
+        return;
+
+    QXmppSrvCache *cache = srvCache();
+    if (cache) {
+        QMutexLocker locker(&cache->mutex);
+        d->detach(cache);
+    }
+    d->state = QXmppSrvLookupPrivate::Idle;
+    d->error = QDnsLookup::OperationCancelledError;
+    d->errorString = QLatin1String("Operation cancelled");
+    d->records.clear();
+    d->isFinished = true;
+    emit finished();
+}
+
+/// Looks up the SRV records for the given \a name, replacing any lookup in
+/// progress. The finished() signal is emitted once the result is known.
+///
+/// \param name
+
+void QXmppSrvLookup::lookup(const QString &name)
+{
+    QXmppSrvCache *cache = srvCache();
+    if (!cache)
+        return;
+
+    QMutexLocker locker(&cache->mutex);
+    d->detach(cache);
+    d->name = name;
+    d->error = QDnsLookup::NoError;
+    d->errorString.clear();
+    d->records.clear();
+    d->isFinished = false;
+
+    QXmppSrvCacheEntry &entry = cache->entries[name];
+    if (entry.querier) {
+        QXmppMetrics::updateCounter(coalescedCounter);
+        entry.waiters << this;
+        d->state = QXmppSrvLookupPrivate::Waiting;
+    } else if (entry.expiry.isValid() && entry.expiry > QDateTime::currentDateTimeUtc()) {
+        QXmppMetrics::updateCounter(cacheHitCounter);
+        d->copyResult(entry);
+        d->state = QXmppSrvLookupPrivate::Delivering;
+        QMetaObject::invokeMethod(this, "_q_cacheUpdated", Qt::QueuedConnection);
+    } else {
+        d->startQuery(entry);
+    }
+}
+
+/// Removes all the results from the cache. Queries in progress are not
+/// affected.
+
+void QXmppSrvLookup::clearCache()
+{
+    QXmppSrvCache *cache = srvCache();
+    if (!cache)
+        return;
+
+    QMutexLocker locker(&cache->mutex);
+    QHash<QString, QXmppSrvCacheEntry>::iterator it = cache->entries.begin();
+    while (it != cache->entries.end()) {
+        if (it->querier) {
+            it->records.clear();
+            it->expiry = QDateTime();
+            ++it;
+        } else {
+            it = cache->entries.erase(it);
+        }
+    }
+}
+
+/// Stores the \a records in the cache as the result of a lookup for
+/// \a name, for the lowest TTL of the records, so that the servers of a
+/// domain can be pinned without asking DNS.
+///
+/// A query for the name which is in progress replaces them when it
+/// finishes.
+///
+/// \param name
+/// \param records
+
+void QXmppSrvLookup::insertCache(const QString &name, const QList<QXmppSrvRecord> &records)
+{
+    QXmppSrvCache *cache = srvCache();
+    if (!cache || records.isEmpty())
+        return;
+
+    QMutexLocker locker(&cache->mutex);
+    QXmppSrvCacheEntry &entry = cache->entries[name];
+    entry.error = QDnsLookup::NoError;
+    entry.errorString.clear();
+    entry.records = records;
+    entry.expiry = QDateTime::currentDateTimeUtc().addSecs(lowestTimeToLive(records));
+}
+
+/// Returns the number of seconds for which failed lookups are cached.
+///
+/// The default value is 60 seconds.
+
+int QXmppSrvLookup::negativeTimeToLive()
+{
+    return negativeTtl;
+}
+
+/// Sets the number of seconds for which failed lookups are cached.
+///
+/// \param secs
+
+void QXmppSrvLookup::setNegativeTimeToLive(int secs)
+{
+    negativeTtl = secs;
+}
+
+void QXmppSrvLookup::_q_cacheUpdated()
+{
+    if (d->state == QXmppSrvLookupPrivate::Delivering) {
+        d->state = QXmppSrvLookupPrivate::Idle;
+    } else if (d->state == QXmppSrvLookupPrivate::Waiting) {
+        QXmppSrvCache *cache = srvCache();
+        if (!cache)
+            return;
+
+        QMutexLocker locker(&cache->mutex);
+        if (!d->update(cache))
+            return;
+    } else {
+        return;
+    }
+
+    d->isFinished = true;
+    emit finished();
+}
+
+void QXmppSrvLookup::_q_dnsLookupFinished()
+{
+    // the query was cancelled
+    if (d->state != QXmppSrvLookupPrivate::Querying)
+        return;
+
+    QXmppSrvCache *cache = srvCache();
+    if (!cache)
+        return;
+
+    QMutexLocker locker(&cache->mutex);
+    QXmppSrvCacheEntry &entry = cache->entries[d->name];
+    entry.querier = 0;
+    entry.error = d->dns->error();
+    entry.errorString = d->dns->errorString();
+#ifdef QXMPP_USE_ASYNC_DNS
+    entry.records = d->dns->serviceRecords();
+#else
+    entry.records.clear();
+    foreach (const QDnsServiceRecord &dnsRecord, d->dns->serviceRecords()) {
+        QXmppSrvRecord record;
+        record.setTarget(dnsRecord.target());
+        record.setPort(dnsRecord.port());
+        record.setPriority(dnsRecord.priority());
+        record.setWeight(dnsRecord.weight());
+        record.setTimeToLive(dnsRecord.timeToLive());
+        entry.records << record;
+    }
+#endif
+
+    // results are kept for the lowest TTL of their records, failures for
+    // the negative TTL, except when the query itself was invalid
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    if (entry.error == QDnsLookup::NoError && !entry.records.isEmpty()) {
+        entry.expiry = now.addSecs(lowestTimeToLive(entry.records));
+    } else if (entry.error == QDnsLookup::InvalidRequestError ||
+               entry.error == QDnsLookup::OperationCancelledError) {
+        entry.expiry = now;
+    } else {
+        entry.expiry = now.addSecs(negativeTtl);
+    }
+
+    foreach (QXmppSrvLookup *waiter, entry.waiters)
+        QMetaObject::invokeMethod(waiter, "_q_cacheUpdated", Qt::QueuedConnection);
+    entry.waiters.clear();
+
+    d->copyResult(entry);
+    d->state = QXmppSrvLookupPrivate::Idle;
+    d->isFinished = true;
+    locker.unlock();
+
+    emit finished();
+}
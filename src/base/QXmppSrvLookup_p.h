@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSRVLOOKUP_P_H
+#define QXMPPSRVLOOKUP_P_H
+
+#include <QList>
+#include <QObject>
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
+#include <QDnsLookup>
+#else
+#include "qdnslookup.h"
+#endif
+
+#include "QXmppGlobal.h"
+
+class QXmppSrvLookupPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppOutgoingClient and QXmppOutgoingServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppSrvRecord class represents a DNS SRV record.
+
+class QXMPP_AUTOTEST_EXPORT QXmppSrvRecord
+{
+public:
+    QXmppSrvRecord();
+
+    QString target() const;
+    void setTarget(const QString &target);
+
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    quint16 priority() const;
+    void setPriority(quint16 priority);
+
+    quint16 weight() const;
+    void setWeight(quint16 weight);
+
+    quint32 timeToLive() const;
+    void setTimeToLive(quint32 timeToLive);
+
+private:
+    QString m_target;
+    quint16 m_port;
+    quint16 m_priority;
+    quint16 m_weight;
+    quint32 m_timeToLive;
+};
+
+/// \internal
+///
+/// The QXmppSrvLookup class looks up SRV records through a cache which is
+/// shared by the whole process.
+///
+/// Results are kept for the lowest TTL of their records. Failed lookups
+/// are kept for negativeTimeToLive() seconds, so that a storm of streams
+/// to an unreachable domain does not cause a storm of DNS queries. While a
+/// name is being looked up, other lookups of the same name wait for its
+/// result instead of sending their own query.
+///
+/// The interface follows QDnsLookup's, and results are always delivered
+/// asynchronously through the finished() signal. If QXmpp is built with
+/// QXMPP_USE_ASYNC_DNS, the queries are sent by QXmppDnsQuery instead of
+/// QDnsLookup.
+
+class QXMPP_AUTOTEST_EXPORT QXmppSrvLookup : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppSrvLookup(QObject *parent = 0);
+    ~QXmppSrvLookup();
+
+    QDnsLookup::Error error() const;
+    QString errorString() const;
+    bool isFinished() const;
+    QString name() const;
+    QList<QXmppSrvRecord> serviceRecords() const;
+
+    static void clearCache();
+    static void insertCache(const QString &name, const QList<QXmppSrvRecord> &records);
+    static int negativeTimeToLive();
+    static void setNegativeTimeToLive(int secs);
+
+signals:
+    /// This signal is emitted when the lookup has finished.
+    void finished();
+
+public slots:
+    void abort();
+    void lookup(const QString &name);
+
+private slots:
+    void _q_cacheUpdated();
+    void _q_dnsLookupFinished();
+
+private:
+    QXmppSrvLookupPrivate * const d;
+    friend class QXmppSrvLookupPrivate;
+};
+
+#endif
@@ -27,11 +27,50 @@
 #include "QXmppStanza.h"
 #include "QXmppUtils.h"
 #include "QXmppConstants.h"
+#include "QXmppEnumTable_p.h"
+#include "QXmppStringPool_p.h"
 
 #include <QDomElement>
 #include <QUuid>
 #include <QXmlStreamWriter>
 
+static const char* error_types[] = {
+    "cancel",
+    "continue",
+    "modify",
+    "auth",
+    "wait"
+};
+
+static const char* error_conditions[] = {
+    "bad-request",
+    "conflict",
+    "feature-not-implemented",
+    "forbidden",
+    "gone",
+    "internal-server-error",
+    "item-not-found",
+    "jid-malformed",
+    "not-acceptable",
+    "not-allowed",
+    "not-authorized",
+    "payment-required",
+    "recipient-unavailable",
+    "redirect",
+    "registration-required",
+    "remote-server-not-found",
+    "remote-server-timeout",
+    "resource-constraint",
+    "service-unavailable",
+    "subscription-required",
+    "undefined-condition",
+    "unexpected-request"
+};
+
+Q_GLOBAL_STATIC_WITH_ARGS(QXmppEnumTable, errorTypes,
+    (error_types, int(sizeof(error_types) / sizeof(error_types[0]))))
+Q_GLOBAL_STATIC_WITH_ARGS(QXmppEnumTable, errorConditions,
+    (error_conditions, int(sizeof(error_conditions) / sizeof(error_conditions[0]))))
 
 
 class QXmppExtendedAddressPrivate : public QSharedData
@@ -227,140 +266,22 @@ void QXmppStanza::Error::setType(QXmppStanza::Error::Type type)
 /// \cond
 QString QXmppStanza::Error::getTypeStr() const
 {
-    switch(m_type)
-    {
-    case Cancel:
-        return "cancel";
-    case Continue:
-        return "continue";
-    case Modify:
-        return "modify";
-    case Auth:
-        return "auth";
-    case Wait:
-        return "wait";
-    default:
-        return "";
-    }
+    return errorTypes()->toString(m_type);
 }
 
 QString QXmppStanza::Error::getConditionStr() const
 {
-    switch(m_condition)
-    {
-    case BadRequest:
-        return "bad-request";
-    case Conflict:
-        return "conflict";
-    case FeatureNotImplemented:
-        return "feature-not-implemented";
-    case Forbidden:
-        return "forbidden";
-    case Gone:
-        return "gone";
-    case InternalServerError:
-        return "internal-server-error";
-    case ItemNotFound:
-        return "item-not-found";
-    case JidMalformed:
-        return "jid-malformed";
-    case NotAcceptable:
-        return "not-acceptable";
-    case NotAllowed:
-        return "not-allowed";
-    case NotAuthorized:
-        return "not-authorized";
-    case PaymentRequired:
-        return "payment-required";
-    case RecipientUnavailable:
-        return "recipient-unavailable";
-    case Redirect:
-        return "redirect";
-    case RegistrationRequired:
-        return "registration-required";
-    case RemoteServerNotFound:
-        return "remote-server-not-found";
-    case RemoteServerTimeout:
-        return "remote-server-timeout";
-    case ResourceConstraint:
-        return "resource-constraint";
-    case ServiceUnavailable:
-        return "service-unavailable";
-    case SubscriptionRequired:
-        return "subscription-required";
-    case UndefinedCondition:
-        return "undefined-condition";
-    case UnexpectedRequest:
-        return "unexpected-request";
-    default:
-        return "";
-    }
+    return errorConditions()->toString(m_condition);
 }
 
 void QXmppStanza::Error::setTypeFromStr(const QString& type)
 {
-    if(type == "cancel")
-        setType(Cancel);
-    else if(type == "continue")
-        setType(Continue);
-    else if(type == "modify")
-        setType(Modify);
-    else if(type == "auth")
-        setType(Auth);
-    else if(type == "wait")
-        setType(Wait);
-    else
-        setType(static_cast<QXmppStanza::Error::Type>(-1));
+    setType(static_cast<QXmppStanza::Error::Type>(errorTypes()->fromString(type)));
 }
 
 void QXmppStanza::Error::setConditionFromStr(const QString& type)
 {
-    if(type == "bad-request")
-        setCondition(BadRequest);
-    else if(type == "conflict")
-        setCondition(Conflict);
-    else if(type == "feature-not-implemented")
-        setCondition(FeatureNotImplemented);
-    else if(type == "forbidden")
-        setCondition(Forbidden);
-    else if(type == "gone")
-        setCondition(Gone);
-    else if(type == "internal-server-error")
-        setCondition(InternalServerError);
-    else if(type == "item-not-found")
-        setCondition(ItemNotFound);
-    else if(type == "jid-malformed")
-        setCondition(JidMalformed);
-    else if(type == "not-acceptable")
-        setCondition(NotAcceptable);
-    else if(type == "not-allowed")
-        setCondition(NotAllowed);
-    else if(type == "not-authorized")
-        setCondition(NotAuthorized);
-    else if(type == "payment-required")
-        setCondition(PaymentRequired);
-    else if(type == "recipient-unavailable")
-        setCondition(RecipientUnavailable);
-    else if(type == "redirect")
-        setCondition(Redirect);
-    else if(type == "registration-required")
-        setCondition(RegistrationRequired);
-    else if(type == "remote-server-not-found")
-        setCondition(RemoteServerNotFound);
-    else if(type == "remote-server-timeout")
-        setCondition(RemoteServerTimeout);
-    else if(type == "resource-constraint")
-        setCondition(ResourceConstraint);
-    else if(type == "service-unavailable")
-        setCondition(ServiceUnavailable);
-    else if(type == "subscription-required")
-        setCondition(SubscriptionRequired);
-    else if(type == "undefined-condition")
-        setCondition(UndefinedCondition);
-    else if(type == "unexpected-request")
-        setCondition(UnexpectedRequest);
-    else
-        setCondition(static_cast<QXmppStanza::Error::Condition>(-1));
+    setCondition(static_cast<QXmppStanza::Error::Condition>(errorConditions()->fromString(type)));
 }
 
 void QXmppStanza::Error::parse(const QDomElement &errorElement)
@@ -579,6 +500,35 @@ void QXmppStanza::setExtendedAddresses(const QList<QXmppExtendedAddress> &addres
     d->extendedAddresses = addresses;
 }
 
+/// Returns true if parsed stanzas share the values they have in common.
+///
+/// \sa setStringPoolEnabled()
+
+bool QXmppStanza::isStringPoolEnabled()
+{
+    QXmppStringPool *pool = QXmppStringPool::instance();
+    return pool && pool->isEnabled();
+}
+
+/// Sets whether parsed stanzas share the values they have in common.
+///
+/// When enabled, values which are repeated across many stanzas, such as
+/// the recipient, the language, status messages and entity capabilities,
+/// are kept in a pool so that the stanzas held in memory, for instance
+/// the presences of a large roster, share a single copy of each. The
+/// pool is bounded, values which do not fit are not shared.
+///
+/// The pool is disabled by default.
+///
+/// \param enabled
+
+void QXmppStanza::setStringPoolEnabled(bool enabled)
+{
+    QXmppStringPool *pool = QXmppStringPool::instance();
+    if (pool)
+        pool->setEnabled(enabled);
+}
+
 /// \cond
 void QXmppStanza::generateAndSetNextId()
 {
@@ -589,9 +539,9 @@ void QXmppStanza::generateAndSetNextId()
 void QXmppStanza::parse(const QDomElement &element)
 {
     d->from = element.attribute("from");
-    d->to = element.attribute("to");
+    d->to = QXmppStringPool::shared(element.attribute("to"));
     d->id = element.attribute("id");
-    d->lang = element.attribute("lang");
+    d->lang = QXmppStringPool::shared(element.attribute("lang"));
 
     QDomElement errorElement = element.firstChildElement("error");
     if(!errorElement.isNull())
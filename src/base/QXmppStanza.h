@@ -174,6 +174,15 @@ public:
     virtual ~QXmppStanza();
 
     QXmppStanza& operator=(const QXmppStanza &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    // a moved-from stanza may only be assigned to or destroyed
+    QXmppStanza(QXmppStanza &&other) { d.swap(other.d); }
+    QXmppStanza& operator=(QXmppStanza &&other)
+    {
+        d.swap(other.d);
+        return *this;
+    }
+#endif
 
     QString to() const;
     void setTo(const QString&);
@@ -196,6 +205,9 @@ public:
     QList<QXmppExtendedAddress> extendedAddresses() const;
     void setExtendedAddresses(const QList<QXmppExtendedAddress> &extendedAddresses);
 
+    static bool isStringPoolEnabled();
+    static void setStringPoolEnabled(bool enabled);
+
     /// \cond
     virtual void parse(const QDomElement &element);
     virtual void toXml(QXmlStreamWriter *writer) const = 0;
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include "QXmppStanzaPipeline_p.h"
+
+Q_GLOBAL_STATIC(QThreadPool, stanzaParserPool)
+
+/// \internal
+///
+/// The QXmppStanzaPipelineState class holds the stanzas of a pipeline
+/// which are being parsed or wait to be read.
+///
+/// It is shared with the jobs in the worker threads, so that it outlives
+/// the pipeline if the stream goes away while they run.
+
+class QXmppStanzaPipelineState
+{
+public:
+    QXmppStanzaPipelineState()
+        : receiver(0)
+        , generation(0)
+        , nextSubmitted(0)
+        , nextRead(0)
+        , notifyPending(false)
+    {
+    }
+
+    QMutex mutex;
+    // the pipeline to notify, or 0 once it is destroyed
+    QObject *receiver;
+    // incremented by clear(), so that the stanzas which were being
+    // parsed are dropped
+    int generation;
+    quint64 nextSubmitted;
+    quint64 nextRead;
+    bool notifyPending;
+    // stanzas which were parsed, by sequence number, and whether they
+    // are well-formed
+    QMap<quint64, QPair<QXmppRawStanza, bool> > stanzas;
+
+    void insert(int stanzaGeneration, quint64 sequence, const QXmppRawStanza &stanza, bool wellFormed);
+};
+
+/// Adds a stanza which is ready to be read, and notifies the pipeline if
+/// it is the next one in order.
+///
+/// The stanza is dropped if the pipeline was cleared since it was
+/// submitted.
+
+void QXmppStanzaPipelineState::insert(int stanzaGeneration, quint64 sequence, const QXmppRawStanza &stanza, bool wellFormed)
+{
+    QMutexLocker locker(&mutex);
+    if (stanzaGeneration != generation)
+        return;
+
+    stanzas.insert(sequence, qMakePair(stanza, wellFormed));
+    if (sequence == nextRead && !notifyPending && receiver) {
+        notifyPending = true;
+        QMetaObject::invokeMethod(receiver, "_q_stanzaReady", Qt::QueuedConnection);
+    }
+}
+
+/// \internal
+///
+/// The QXmppStanzaParserJob class builds the DOM tree of one stanza in a
+/// worker thread.
+
+class QXmppStanzaParserJob : public QRunnable
+{
+public:
+    QXmppStanzaParserJob(const QSharedPointer<QXmppStanzaPipelineState> &state, int generation, quint64 sequence, const QXmppRawStanza &stanza)
+        : m_state(state)
+        , m_generation(generation)
+        , m_sequence(sequence)
+        , m_stanza(stanza)
+    {
+    }
+
+    void run()
+    {
+        // the DOM tree is kept by the stanza
+        const bool wellFormed = !m_stanza.element().isNull();
+        m_state->insert(m_generation, m_sequence, m_stanza, wellFormed);
+    }
+
+private:
+    QSharedPointer<QXmppStanzaPipelineState> m_state;
+    int m_generation;
+    quint64 m_sequence;
+    QXmppRawStanza m_stanza;
+};
+
+/// Constructs an empty pipeline.
+///
+/// \param parent
+
+QXmppStanzaPipeline::QXmppStanzaPipeline(QObject *parent)
+    : QObject(parent)
+    , d(new QXmppStanzaPipelineState)
+{
+    d->receiver = this;
+}
+
+/// Destroys the pipeline, the stanzas which are being parsed are dropped.
+
+QXmppStanzaPipeline::~QXmppStanzaPipeline()
+{
+    QMutexLocker locker(&d->mutex);
+    d->receiver = 0;
+    d->stanzas.clear();
+}
+
+/// Drops the stanzas which were submitted and not read yet, for instance
+/// when the stream is restarted.
+
+void QXmppStanzaPipeline::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->generation++;
+    d->stanzas.clear();
+    d->nextRead = d->nextSubmitted;
+}
+
+/// Returns the number of stanzas which were submitted and not read yet.
+
+int QXmppStanzaPipeline::size() const
+{
+    QMutexLocker locker(&d->mutex);
+    return int(d->nextSubmitted - d->nextRead);
+}
+
+/// Submits a \a stanza, whose DOM tree is built in a worker thread if
+/// \a parse is true.
+///
+/// \param stanza
+/// \param parse
+
+void QXmppStanzaPipeline::submit(const QXmppRawStanza &stanza, bool parse)
+{
+    d->mutex.lock();
+    const int generation = d->generation;
+    const quint64 sequence = d->nextSubmitted++;
+    d->mutex.unlock();
+
+    if (parse)
+        stanzaParserPool()->start(new QXmppStanzaParserJob(d, generation, sequence, stanza));
+    else
+        d->insert(generation, sequence, stanza, true);
+}
+
+/// Reads the next stanza in the order they were submitted, returning
+/// false if it is not ready yet.
+///
+/// \param stanza the stanza, whose DOM tree is built if it was submitted for parsing
+/// \param wellFormed set to false if the stanza could not be parsed
+
+bool QXmppStanzaPipeline::readNext(QXmppRawStanza *stanza, bool *wellFormed)
+{
+    QMutexLocker locker(&d->mutex);
+    QMap<quint64, QPair<QXmppRawStanza, bool> >::iterator it = d->stanzas.find(d->nextRead);
+    if (it == d->stanzas.end())
+        return false;
+
+    *stanza = it.value().first;
+    *wellFormed = it.value().second;
+    d->stanzas.erase(it);
+    d->nextRead++;
+    return true;
+}
+
+/// Returns the maximum number of worker threads which build DOM trees.
+
+int QXmppStanzaPipeline::maximumThreadCount()
+{
+    return stanzaParserPool()->maxThreadCount();
+}
+
+/// Sets the maximum number of worker threads which build DOM trees, for
+/// all the pipelines.
+///
+/// The default is the number of CPU cores.
+///
+/// \param count
+
+void QXmppStanzaPipeline::setMaximumThreadCount(int count)
+{
+    stanzaParserPool()->setMaxThreadCount(count);
+}
+
+void QXmppStanzaPipeline::_q_stanzaReady()
+{
+    d->mutex.lock();
+    d->notifyPending = false;
+    d->mutex.unlock();
+
+    emit readyRead();
+}
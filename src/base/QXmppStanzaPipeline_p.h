@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPSTANZAPIPELINE_P_H
+#define QXMPPSTANZAPIPELINE_P_H
+
+#include <QObject>
+#include <QSharedPointer>
+
+#include "QXmppRawStanza.h"
+
+class QXmppStanzaPipelineState;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppStanzaPipeline class builds the DOM trees of the stanzas
+/// received on a stream in a pool of worker threads, and returns the
+/// stanzas in the order they were submitted.
+///
+/// The worker threads are shared by all the pipelines of the process.
+/// Stanzas are only read back in the thread the pipeline lives in, and
+/// readyRead() is emitted when the next stanza in order is available.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStanzaPipeline : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppStanzaPipeline(QObject *parent = 0);
+    ~QXmppStanzaPipeline();
+
+    void clear();
+    int size() const;
+
+    void submit(const QXmppRawStanza &stanza, bool parse);
+    bool readNext(QXmppRawStanza *stanza, bool *wellFormed);
+
+    static int maximumThreadCount();
+    static void setMaximumThreadCount(int count);
+
+signals:
+    /// This signal is emitted when the next stanza can be read.
+    void readyRead();
+
+private slots:
+    void _q_stanzaReady();
+
+private:
+    Q_DISABLE_COPY(QXmppStanzaPipeline)
+    QSharedPointer<QXmppStanzaPipelineState> d;
+};
+
+#endif
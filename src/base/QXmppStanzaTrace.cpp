@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QStringList>
+#include <QThreadStorage>
+
+#include "QXmppMetrics.h"
+#include "QXmppStanzaTrace_p.h"
+
+static bool traceEnabled = false;
+
+namespace
+{
+    class QXmppStanzaTraceClock
+    {
+    public:
+        QXmppStanzaTraceClock()
+        {
+            timer.start();
+        }
+
+        QElapsedTimer timer;
+    };
+}
+
+Q_GLOBAL_STATIC(QXmppStanzaTraceClock, traceClock)
+
+// The trace of the stanza being handled by a thread, and the handles of
+// the histograms it used.
+
+class QXmppStanzaTraceData
+{
+public:
+    QXmppStanzaTraceData()
+        : active(false)
+    {
+    }
+
+    bool active;
+    QXmppStanzaTrace trace;
+    QHash<QString, int> histograms;
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<QXmppStanzaTraceData*>, traceStorage)
+
+static QXmppStanzaTraceData *traceData()
+{
+    QThreadStorage<QXmppStanzaTraceData*> *storage = traceStorage();
+    if (!storage)
+        return 0;
+    if (!storage->hasLocalData())
+        storage->setLocalData(new QXmppStanzaTraceData);
+    return storage->localData();
+}
+
+QXmppStanzaTrace::QXmppStanzaTrace()
+    : m_startTime(0)
+    , m_sampled(false)
+{
+}
+
+/// Returns the current time in microseconds, from a monotonic clock
+/// shared by all threads.
+
+qint64 QXmppStanzaTrace::now()
+{
+    QXmppStanzaTraceClock *clock = traceClock();
+    return clock ? clock->timer.nsecsElapsed() / 1000 : 0;
+}
+
+/// Returns true if any stream or server traces stanzas, i.e. if it is
+/// worth looking for a current() trace.
+
+bool QXmppStanzaTrace::isEnabled()
+{
+    return traceEnabled;
+}
+
+/// Signals that stanzas are being traced.
+
+void QXmppStanzaTrace::setEnabled()
+{
+    traceEnabled = true;
+    now();
+}
+
+/// Returns the trace of the stanza being handled by the current thread,
+/// or 0 if there is none.
+
+QXmppStanzaTrace *QXmppStanzaTrace::current()
+{
+    if (!traceEnabled)
+        return 0;
+    QXmppStanzaTraceData *data = traceData();
+    return (data && data->active) ? &data->trace : 0;
+}
+
+/// Starts tracing a stanza received at \a startTime in the current thread.
+///
+/// \param startTime the time returned by now() when the stanza was read
+/// \param sampled whether the phases should be returned by finish()
+
+QXmppStanzaTrace *QXmppStanzaTrace::start(qint64 startTime, bool sampled)
+{
+    QXmppStanzaTraceData *data = traceData();
+    if (!data)
+        return 0;
+    data->active = true;
+    data->trace.m_startTime = startTime;
+    data->trace.m_sampled = sampled;
+    data->trace.m_phases.clear();
+    return &data->trace;
+}
+
+/// Stops tracing the current thread's stanza.
+///
+/// If the trace was sampled, returns a description of its phases.
+
+QString QXmppStanzaTrace::finish()
+{
+    QXmppStanzaTraceData *data = traceData();
+    if (!data || !data->active)
+        return QString();
+
+    data->trace.mark("total");
+    data->active = false;
+    if (!data->trace.m_sampled)
+        return QString();
+
+    QStringList phases;
+    for (int i = 0; i < data->trace.m_phases.size(); ++i) {
+        const QPair<QString, qint64> &phase = data->trace.m_phases.at(i);
+        phases << QString("%1 %2us").arg(phase.first, QString::number(phase.second));
+    }
+    return QString("Stanza trace: %1").arg(phases.join(", "));
+}
+
+/// Records the \a duration of a \a phase, for instance the time spent in
+/// an extension.
+
+void QXmppStanzaTrace::addDuration(const QString &phase, qint64 duration)
+{
+    record(phase, duration);
+}
+
+/// Records that a \a phase was reached, measured from the stanza's
+/// arrival.
+
+void QXmppStanzaTrace::mark(const QString &phase)
+{
+    record(phase, now() - m_startTime);
+}
+
+void QXmppStanzaTrace::record(const QString &phase, qint64 value)
+{
+    if (m_sampled)
+        m_phases << qMakePair(phase, value);
+
+    QXmppStanzaTraceData *data = traceData();
+    if (!data)
+        return;
+    QHash<QString, int>::const_iterator it = data->histograms.constFind(phase);
+    if (it == data->histograms.constEnd())
+        it = data->histograms.insert(phase, QXmppMetrics::histogram("stanza-trace." + phase));
+    QXmppMetrics::recordValue(it.value(), value);
+}
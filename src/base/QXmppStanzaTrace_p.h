@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSTANZATRACE_P_H
+#define QXMPPSTANZATRACE_P_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream and QXmppServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppStanzaTrace class records the time spent in each phase of the
+/// handling of a received stanza, from the socket read to the writes of
+/// the data it caused to be sent.
+///
+/// A trace is attached to the thread handling the stanza between start()
+/// and finish(), so that the code called meanwhile can find it with
+/// current(). The times are recorded in microseconds in the
+/// "stanza-trace.<phase>" histograms of QXmppMetrics.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStanzaTrace
+{
+public:
+    static qint64 now();
+    static bool isEnabled();
+    static void setEnabled();
+
+    static QXmppStanzaTrace *current();
+    static QXmppStanzaTrace *start(qint64 startTime, bool sampled);
+    static QString finish();
+
+    void addDuration(const QString &phase, qint64 duration);
+    void mark(const QString &phase);
+
+private:
+    QXmppStanzaTrace();
+    void record(const QString &phase, qint64 value);
+
+    qint64 m_startTime;
+    bool m_sampled;
+    QList<QPair<QString, qint64> > m_phases;
+    friend class QXmppStanzaTraceData;
+};
+
+#endif
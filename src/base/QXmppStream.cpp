@@ -25,37 +25,373 @@
 
 #include "QXmppConstants.h"
 #include "QXmppLogger.h"
+#include "QXmppMemoryStats_p.h"
+#include "QXmppMetrics.h"
+#include "QXmppOutputScheduler_p.h"
+#include "QXmppRawStanza.h"
+#include "QXmppRateLimiter.h"
+#include "QXmppReadBuffer_p.h"
 #include "QXmppStanza.h"
+#include "QXmppStanzaPipeline_p.h"
+#include "QXmppStanzaTrace_p.h"
 #include "QXmppStream.h"
+#include "QXmppStreamCompressor_p.h"
+#include "QXmppStreamParser_p.h"
+#include "QXmppTracepoints_p.h"
+#include "QXmppTrafficCapture_p.h"
 #include "QXmppUtils.h"
 
+#include <QAtomicInt>
 #include <QBuffer>
 #include <QDomDocument>
+#include <QElapsedTimer>
 #include <QHostAddress>
-#include <QRegExp>
+#include <QLocalSocket>
+#include <QMutex>
 #include <QSslSocket>
 #include <QStringList>
 #include <QTime>
+#include <QTimer>
 #include <QXmlStreamWriter>
 
 static bool randomSeeded = false;
 static const QByteArray streamRootElementEnd = "</stream:stream>";
+static const int corkDelayHistogram = QXmppMetrics::histogram("stream.cork-delay");
+
+// The types of stanzas counted by QXmppStream::statistics().
+static const char *stanzaTypeNames[] = { "message", "presence", "iq", "other" };
+static const int stanzaTypeCount = sizeof(stanzaTypeNames) / sizeof(stanzaTypeNames[0]);
+
+static int stanzaType(const QString &tagName)
+{
+    for (int i = 0; i < stanzaTypeCount - 1; ++i)
+        if (tagName == QLatin1String(stanzaTypeNames[i]))
+            return i;
+    return stanzaTypeCount - 1;
+}
+
+static int stanzaType(const QByteArray &data)
+{
+    if (data.startsWith("<message"))
+        return 0;
+    else if (data.startsWith("<presence"))
+        return 1;
+    else if (data.startsWith("<iq"))
+        return 2;
+    return stanzaTypeCount - 1;
+}
+
+// Takes the given amounts from all the \a limiters, and returns the time
+// to wait before accepting more data.
+static int consumeTokens(const QList<QSharedPointer<QXmppRateLimiter> > &limiters, qint64 bytes, int stanzas)
+{
+    int delay = 0;
+    foreach (const QSharedPointer<QXmppRateLimiter> &limiter, limiters)
+        delay = qMax(delay, limiter->consume(bytes, stanzas));
+    return delay;
+}
+
+// Disconnects the signals of the device which previously carried the
+// stream, so that the stream can be moved to another device.
+
+static void detachDevice(QIODevice *device, QXmppStream *stream)
+{
+    if (!device)
+        return;
+
+    QObject::disconnect(device, SIGNAL(bytesWritten(qint64)),
+                        stream, SLOT(_q_socketBytesWritten()));
+    QObject::disconnect(device, SIGNAL(readyRead()),
+                        stream, SLOT(_q_socketReadyRead()));
+    if (device->metaObject()->indexOfSignal("connected()") >= 0)
+        QObject::disconnect(device, SIGNAL(connected()),
+                            stream, SLOT(_q_socketConnected()));
+
+    if (QSslSocket *socket = qobject_cast<QSslSocket*>(device)) {
+        QObject::disconnect(socket, SIGNAL(encryptedBytesWritten(qint64)),
+                            stream, SLOT(_q_socketBytesWritten()));
+        QObject::disconnect(socket, SIGNAL(encrypted()),
+                            stream, SLOT(_q_socketEncrypted()));
+        QObject::disconnect(socket, SIGNAL(modeChanged(QSslSocket::SslMode)),
+                            stream, SLOT(_q_socketModeChanged()));
+        QObject::disconnect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                            stream, SLOT(_q_socketError(QAbstractSocket::SocketError)));
+    }
+}
+
+// the number of stanzas handed to the worker threads which have not been
+// handled yet, past which the stream stops parsing
+static const int maximumPipelinedStanzas = 1024;
+
+static bool isWhitespace(const QByteArray &data)
+{
+    const char *ptr = data.constData();
+    const char *end = ptr + data.size();
+    for (; ptr < end; ++ptr) {
+        if (*ptr != ' ' && *ptr != '\t' && *ptr != '\r' && *ptr != '\n')
+            return false;
+    }
+    return true;
+}
 
 class QXmppStreamPrivate
 {
 public:
-    QXmppStreamPrivate();
+    QXmppStreamPrivate(QXmppStream *qq);
+
+    bool isDeviceConnected() const;
+    qint64 deviceBacklog() const;
+    void addProcessingTime(qint64 nsecs);
+    bool writeData(const QByteArray &data);
+    void writeBufferedData();
+    void writeScheduledData(bool all);
+    void updateCompressionStats(qint64 uncompressed, qint64 compressed);
+    void updateMemoryStats();
 
     QByteArray dataBuffer;
-    QSslSocket* socket;
+    QIODevice *device;
+    QSslSocket *socket;
+
+    // outgoing data posted from other threads
+    QMutex postedMutex;
+    QList<QByteArray> postedData;
+    QThread *targetThread;
+
+    // outgoing data held back while the stream is corked
+    QByteArray writeBuffer;
+    int corkLevel;
+
+    // stanza tracing, and the time since which data is held back
+    int traceInterval;
+    int traceCount;
+    qint64 corkedTime;
+
+    // incoming data limits
+    qint64 maximumBufferSize;
+    bool readingPaused;
+
+    // rate limiters, which the server may change from another thread
+    mutable QMutex rateLimitersMutex;
+    QList<QSharedPointer<QXmppRateLimiter> > rateLimiters;
+    bool rateLimited;
+    qint64 rateLimitPauses;
+
+    // XEP-0138: Stream Compression
+    QXmppStreamCompressor *compressor;
+
+    // capture of the received data
+    QSharedPointer<QXmppTrafficCapture> capture;
+    int captureSession;
+
+    // output queue limits
+    qint64 outputLowWatermark;
+    qint64 outputHighWatermark;
+    QXmppStream::OutputQueuePolicy outputQueuePolicy;
+    // read by the server's thread while the stream's thread updates it
+    QAtomicInt outputQueueFull;
+
+    // outgoing data which waits for the device's backlog to shrink
+    QXmppOutputScheduler scheduler;
+    qint64 schedulingWindow;
 
     // incoming stream state
-    QByteArray streamStart;
+    QXmppStreamParser parser;
+    bool streamOpened;
+    bool streamClosed;
+
+    // stanzas whose DOM tree is built by worker threads, whether the
+    // stream ended after them and whether parsing waits for them
+    QXmppStanzaPipeline *pipeline;
+    bool pipelineEnded;
+    bool pipelineFull;
+
+    // traffic and resource accounting, which statistics() may read from
+    // another thread
+    mutable QMutex statisticsMutex;
+    QElapsedTimer connectionTimer;
+    QElapsedTimer tlsTimer;
+    qint64 tlsHandshakeTime;
+    qint64 bytesReceived;
+    qint64 bytesSent;
+    qint64 stanzasReceived[stanzaTypeCount];
+    qint64 stanzasSent[stanzaTypeCount];
+    qint64 parseTime;
+    qint64 inputBufferSize;
+    qint64 lastOutputQueueSize;
+
+    // the time spent handling received data in nanoseconds, which the
+    // server reads from its own thread to balance its workers
+#if QT_VERSION >= 0x050300
+    QAtomicInteger<qint64> processingTime;
+#else
+    qint64 processingTime;
+#endif
+
+#ifdef QXMPP_MEMORY_STATS
+    qint64 memoryBytes;
+#endif
+
+private:
+    QXmppStream *q;
 };
 
-QXmppStreamPrivate::QXmppStreamPrivate()
-    : socket(0)
+QXmppStreamPrivate::QXmppStreamPrivate(QXmppStream *qq)
+    : device(0)
+    , socket(0)
+    , targetThread(0)
+    , corkLevel(0)
+    , traceInterval(0)
+    , traceCount(0)
+    , corkedTime(0)
+    , maximumBufferSize(0)
+    , readingPaused(false)
+    , rateLimited(false)
+    , rateLimitPauses(0)
+    , compressor(0)
+    , captureSession(0)
+    , outputLowWatermark(0)
+    , outputHighWatermark(0)
+    , outputQueuePolicy(QXmppStream::StallPolicy)
+    , outputQueueFull(0)
+    , schedulingWindow(0)
+    , streamOpened(false)
+    , streamClosed(false)
+    , pipeline(0)
+    , pipelineEnded(false)
+    , pipelineFull(false)
+    , tlsHandshakeTime(-1)
+    , bytesReceived(0)
+    , bytesSent(0)
+    , parseTime(0)
+    , inputBufferSize(0)
+    , lastOutputQueueSize(0)
+    , processingTime(0)
+#ifdef QXMPP_MEMORY_STATS
+    , memoryBytes(0)
+#endif
+    , q(qq)
 {
+    for (int i = 0; i < stanzaTypeCount; ++i) {
+        stanzasReceived[i] = 0;
+        stanzasSent[i] = 0;
+    }
+}
+
+bool QXmppStreamPrivate::isDeviceConnected() const
+{
+    if (socket)
+        return socket->state() == QAbstractSocket::ConnectedState;
+    return device && device->isOpen();
+}
+
+// Returns the amount of outgoing data which was handed to the device or
+// is held back by cork(), but has not been written to the network yet.
+
+qint64 QXmppStreamPrivate::deviceBacklog() const
+{
+    qint64 size = writeBuffer.size();
+    if (device)
+        size += device->bytesToWrite();
+    if (socket)
+        size += socket->encryptedBytesToWrite();
+    return size;
+}
+
+void QXmppStreamPrivate::addProcessingTime(qint64 nsecs)
+{
+#if QT_VERSION >= 0x050300
+    processingTime.fetchAndAddRelaxed(nsecs);
+#else
+    QMutexLocker locker(&statisticsMutex);
+    processingTime += nsecs;
+#endif
+}
+
+bool QXmppStreamPrivate::writeData(const QByteArray &data)
+{
+    if (!isDeviceConnected())
+        return false;
+
+    const QByteArray *output = &data;
+    QByteArray compressed;
+    if (compressor) {
+        if (!compressor->compress(data, compressed))
+            return false;
+        updateCompressionStats(data.size(), compressed.size());
+        output = &compressed;
+    }
+
+    const qint64 written = device->write(*output);
+    QXMPP_TRACEPOINT2(stream__write, q, written);
+    if (written > 0) {
+        QMutexLocker locker(&statisticsMutex);
+        bytesSent += written;
+    }
+    return written == output->size();
+}
+
+void QXmppStreamPrivate::writeBufferedData()
+{
+    static const int maximumRecycledSize = 65536;
+
+    if (writeBuffer.isEmpty())
+        return;
+    writeData(writeBuffer);
+
+    if (corkedTime) {
+        QXmppMetrics::recordValue(corkDelayHistogram, QXmppStanzaTrace::now() - corkedTime);
+        corkedTime = 0;
+    }
+    if (QXmppStanzaTrace *trace = QXmppStanzaTrace::current())
+        trace->mark("write");
+
+    // the device copies the data, so keep the buffer's memory for the
+    // next batch unless an unusually large batch was written
+    if (writeBuffer.capacity() > maximumRecycledSize) {
+        writeBuffer.clear();
+    } else {
+        writeBuffer.reserve(writeBuffer.capacity());
+        writeBuffer.resize(0);
+    }
+    updateMemoryStats();
+}
+
+// Hands the scheduled data to the device until its backlog reaches the
+// scheduling window, or all of it if \a all is true.
+
+void QXmppStreamPrivate::writeScheduledData(bool all)
+{
+    if (scheduler.isEmpty())
+        return;
+
+    while (!scheduler.isEmpty() && (all || deviceBacklog() < schedulingWindow)) {
+        const QByteArray data = scheduler.dequeue();
+        if (corkLevel > 0 && !all)
+            writeBuffer.append(data);
+        else
+            writeData(data);
+    }
+    updateMemoryStats();
+}
+
+void QXmppStreamPrivate::updateMemoryStats()
+{
+#ifdef QXMPP_MEMORY_STATS
+    // the buffers owned by the stream, not those of the device
+    const qint64 bytes = sizeof(QXmppStream) + sizeof(QXmppStreamPrivate)
+        + dataBuffer.capacity() + writeBuffer.capacity() + parser.bufferSize()
+        + scheduler.size();
+    QXmppMemoryStats::resize(QXmppMemoryStats::StreamBuffers, memoryBytes, bytes);
+#endif
+}
+
+void QXmppStreamPrivate::updateCompressionStats(qint64 uncompressed, qint64 compressed)
+{
+    emit q->updateCounter("stream.compression.uncompressed-bytes", uncompressed);
+    emit q->updateCounter("stream.compression.compressed-bytes", compressed);
+    if (compressor->compressedBytes() > 0)
+        emit q->setGauge("stream.compression.ratio",
+            double(compressor->uncompressedBytes()) / double(compressor->compressedBytes()));
 }
 
 /// Constructs a base XMPP stream.
@@ -64,7 +400,7 @@ QXmppStreamPrivate::QXmppStreamPrivate()
 
 QXmppStream::QXmppStream(QObject *parent)
     : QXmppLoggable(parent),
-    d(new QXmppStreamPrivate)
+    d(new QXmppStreamPrivate(this))
 {
     // Make sure the random number generator is seeded
     if (!randomSeeded)
@@ -72,28 +408,552 @@ QXmppStream::QXmppStream(QObject *parent)
         qsrand(QTime(0,0,0).msecsTo(QTime::currentTime()) ^ reinterpret_cast<quintptr>(this));
         randomSeeded = true;
     }
+    d->updateMemoryStats();
 }
 
 /// Destroys a base XMPP stream.
 
 QXmppStream::~QXmppStream()
 {
+#ifdef QXMPP_MEMORY_STATS
+    QXmppMemoryStats::resize(QXmppMemoryStats::StreamBuffers, d->memoryBytes, 0);
+#endif
+    if (d->capture)
+        d->capture->closeSession(d->captureSession);
+    delete d->compressor;
     delete d;
 }
 
+/// Holds back outgoing data until uncork() is called, so that the data
+/// for several stanzas can be written to the socket at once.
+///
+/// Calls to cork() and uncork() can be nested.
+
+void QXmppStream::cork()
+{
+    d->corkLevel++;
+}
+
+/// Writes the outgoing data held back since the matching cork() call,
+/// unless the stream is still corked by an outer cork() call.
+
+void QXmppStream::uncork()
+{
+    if (d->corkLevel <= 0)
+        return;
+    if (!--d->corkLevel)
+        d->writeBufferedData();
+}
+
+/// Returns true if outgoing data is currently being held back.
+
+bool QXmppStream::isCorked() const
+{
+    return d->corkLevel > 0;
+}
+
+/// Writes any outgoing data which is being held back and flushes the
+/// socket, even if the stream is corked.
+///
+/// This is needed before changing the transport, for instance when
+/// starting TLS encryption.
+
+void QXmppStream::flush()
+{
+    d->writeBufferedData();
+    d->writeScheduledData(true);
+    if (d->socket)
+        d->socket->flush();
+    else if (QLocalSocket *localSocket = qobject_cast<QLocalSocket*>(d->device))
+        localSocket->flush();
+}
+
+/// Queues \a data to be sent from the stream's own thread.
+///
+/// This method is thread-safe. The data posted until the stream's thread
+/// returns to its event loop is handled as a single batch by
+/// handlePostedData(), which by default calls sendData().
+
+void QXmppStream::postData(const QByteArray &data)
+{
+    d->postedMutex.lock();
+    const bool wasEmpty = d->postedData.isEmpty();
+    d->postedData.append(data);
+    d->postedMutex.unlock();
+
+    // only the first data of a batch needs to wake up the stream
+    if (wasEmpty)
+        QMetaObject::invokeMethod(this, "_q_processPostedData", Qt::QueuedConnection);
+}
+
+/// Moves the stream to the given \a thread once its current thread is
+/// done with the data it received so far.
+///
+/// This method is thread-safe. The stream must not have a parent. The data
+/// posted with postData() before the move is handled in the new thread, in
+/// the order it was posted, and so are the timers and the socket.
+
+void QXmppStream::postMoveToThread(QThread *thread)
+{
+    d->postedMutex.lock();
+    d->targetThread = thread;
+    d->postedMutex.unlock();
+
+    QMetaObject::invokeMethod(this, "_q_moveToTargetThread", Qt::QueuedConnection);
+}
+
+/// Returns the maximum size in bytes of a top-level element received on
+/// the stream, or 0 if there is no limit.
+
+int QXmppStream::maximumStanzaSize() const
+{
+    return d->parser.maximumElementSize();
+}
+
+/// Sets the maximum size in bytes of a top-level element received on
+/// the stream. If a larger element is received, the stream is closed
+/// with a policy-violation stream error.
+///
+/// Set \a size to 0 to disable the limit, which is the default.
+
+void QXmppStream::setMaximumStanzaSize(int size)
+{
+    d->parser.setMaximumElementSize(size);
+}
+
+/// Returns the maximum amount of received data in bytes which is buffered
+/// while waiting to be processed, or 0 if there is no limit.
+
+qint64 QXmppStream::maximumBufferSize() const
+{
+    return d->maximumBufferSize;
+}
+
+/// Sets the maximum amount of received data in bytes which is buffered
+/// while waiting to be processed.
+///
+/// Once the buffer is full, no more data is read from the network until
+/// the buffered data has been processed, for instance after reading
+/// was paused with pauseReading(). Set \a size to 0 to disable the
+/// limit, which is the default.
+
+void QXmppStream::setMaximumBufferSize(qint64 size)
+{
+    d->maximumBufferSize = size;
+    if (d->socket)
+        d->socket->setReadBufferSize(size);
+    else if (QLocalSocket *localSocket = qobject_cast<QLocalSocket*>(d->device))
+        localSocket->setReadBufferSize(size);
+}
+
+/// Returns the time in microseconds spent handling received data,
+/// including parsing, as reported in the "processing-time" statistic.
+///
+/// Unlike statistics(), it is cheap to call from another thread than the
+/// stream's.
+
+qint64 QXmppStream::processingTime() const
+{
+#if QT_VERSION >= 0x050300
+    return d->processingTime.load() / 1000;
+#else
+    QMutexLocker locker(&d->statisticsMutex);
+    return d->processingTime / 1000;
+#endif
+}
+
+/// Returns the traffic and resource usage of the stream.
+///
+/// The statistics are cheap to maintain, so they are always kept. This
+/// method is thread-safe, so they can be read while the stream runs in
+/// another thread. The returned map contains:
+///
+///  - "age": the time in seconds since the stream was connected,
+///  - "bytes-received" and "bytes-sent": the amount of data exchanged
+///    with the peer, after compression and before encryption,
+///  - "stanzas-received": the number of top-level elements received, also
+///    counted by type in "stanzas-received.message",
+///    "stanzas-received.presence", "stanzas-received.iq" and
+///    "stanzas-received.other",
+///  - "stanzas-sent": the number of calls to sendData(), counted by the
+///    type of their first element in the same way,
+///  - "parse-time": the time in microseconds spent parsing received data,
+///  - "processing-time": the time in microseconds spent handling received
+///    data, including parsing,
+///  - "input-buffer-bytes": the received data waiting to be read,
+///  - "output-queue-bytes": the outputQueueSize(),
+///  - "rate-limit-pauses": the number of times reading stopped because a
+///    rate limiter was empty,
+///  - "tls-handshake-time": the duration of the TLS handshake in
+///    milliseconds, if the stream is encrypted.
+
+QVariantMap QXmppStream::statistics() const
+{
+    QMutexLocker locker(&d->statisticsMutex);
+
+    QVariantMap stats;
+    stats["age"] = d->connectionTimer.isValid() ? d->connectionTimer.elapsed() / 1000 : qint64(0);
+    stats["bytes-received"] = d->bytesReceived;
+    stats["bytes-sent"] = d->bytesSent;
+
+    qint64 received = 0;
+    qint64 sent = 0;
+    for (int i = 0; i < stanzaTypeCount; ++i) {
+        stats[QString("stanzas-received.%1").arg(QLatin1String(stanzaTypeNames[i]))] = d->stanzasReceived[i];
+        stats[QString("stanzas-sent.%1").arg(QLatin1String(stanzaTypeNames[i]))] = d->stanzasSent[i];
+        received += d->stanzasReceived[i];
+        sent += d->stanzasSent[i];
+    }
+    stats["stanzas-received"] = received;
+    stats["stanzas-sent"] = sent;
+
+    stats["parse-time"] = d->parseTime / 1000;
+#if QT_VERSION >= 0x050300
+    stats["processing-time"] = d->processingTime.load() / 1000;
+#else
+    stats["processing-time"] = d->processingTime / 1000;
+#endif
+    stats["input-buffer-bytes"] = d->inputBufferSize;
+    stats["output-queue-bytes"] = d->lastOutputQueueSize;
+    stats["rate-limit-pauses"] = d->rateLimitPauses;
+    if (d->tlsHandshakeTime >= 0)
+        stats["tls-handshake-time"] = d->tlsHandshakeTime;
+    return stats;
+}
+
+/// Returns the interval at which the traces of received stanzas are
+/// logged, or 0 if stanzas are not traced.
+
+int QXmppStream::stanzaTraceInterval() const
+{
+    return d->traceInterval;
+}
+
+/// Sets the interval at which the traces of received stanzas are logged.
+///
+/// When non-zero, the time taken by each phase of the handling of every
+/// received stanza is recorded in the "stanza-trace.<phase>" histograms of
+/// QXmppMetrics, in microseconds since the stanza was read from the socket:
+///
+///  - "parse" when the stanza was parsed,
+///  - "enqueue" and "write" when data it caused to be sent was passed to
+///    sendData() and written to a socket, if that happened before it was
+///    handled,
+///  - "total" when it was handled.
+///
+/// The time data is held back by cork() is recorded in the
+/// "stream.cork-delay" histogram. Every \a interval stanzas, the phases
+/// of a stanza are also logged as a debugging message.
+///
+/// Set \a interval to 0 to disable tracing, which is the default.
+///
+/// \param interval
+
+void QXmppStream::setStanzaTraceInterval(int interval)
+{
+    d->traceInterval = interval;
+    d->traceCount = 0;
+    if (interval > 0)
+        QXmppStanzaTrace::setEnabled();
+}
+
+/// \cond
+/// Records the data received by the stream to \a capture, as it is read
+/// from the device.
+
+void QXmppStream::setTrafficCapture(const QSharedPointer<QXmppTrafficCapture> &capture)
+{
+    if (d->capture)
+        d->capture->closeSession(d->captureSession);
+    d->capture = capture;
+    d->captureSession = capture ? capture->openSession() : 0;
+}
+/// \endcond
+
+/// Returns true if processing of incoming data is paused.
+
+bool QXmppStream::isReadingPaused() const
+{
+    return d->readingPaused;
+}
+
+/// Stops processing incoming data until resumeReading() is called.
+///
+/// Incoming data is left in the socket's buffer, whose size is limited
+/// by maximumBufferSize().
+
+void QXmppStream::pauseReading()
+{
+    d->readingPaused = true;
+}
+
+/// Resumes processing of incoming data after a call to pauseReading().
+
+void QXmppStream::resumeReading()
+{
+    if (!d->readingPaused)
+        return;
+    d->readingPaused = false;
+
+    // process the data which was received or parsed in the meantime
+    if (d->pipeline)
+        QMetaObject::invokeMethod(this, "_q_pipelineReadyRead", Qt::QueuedConnection);
+    if (d->device)
+        QMetaObject::invokeMethod(this, "_q_socketReadyRead", Qt::QueuedConnection);
+}
+
+/// Returns true if processing of incoming data is suspended because one
+/// of the stream's rate limiters is empty.
+
+bool QXmppStream::isRateLimited() const
+{
+    return d->rateLimited;
+}
+
+/// Adds a \a limiter for the incoming data of the stream.
+///
+/// Every byte and stanza received is taken from all the limiters of the
+/// stream. Once one of them is empty, the stream stops reading from its
+/// socket until the limiter is refilled, which lets TCP flow control slow
+/// the peer down.
+///
+/// This method may be called from any thread.
+///
+/// \param limiter
+
+void QXmppStream::addRateLimiter(const QSharedPointer<QXmppRateLimiter> &limiter)
+{
+    QMutexLocker locker(&d->rateLimitersMutex);
+    if (limiter && !d->rateLimiters.contains(limiter))
+        d->rateLimiters << limiter;
+}
+
+/// Removes a \a limiter which was added with addRateLimiter().
+///
+/// This method may be called from any thread.
+///
+/// \param limiter
+
+void QXmppStream::removeRateLimiter(const QSharedPointer<QXmppRateLimiter> &limiter)
+{
+    QMutexLocker locker(&d->rateLimitersMutex);
+    d->rateLimiters.removeAll(limiter);
+}
+
+/// Returns the amount of outgoing data in bytes which has not been
+/// written to the network yet.
+
+qint64 QXmppStream::outputQueueSize() const
+{
+    return d->deviceBacklog() + d->scheduler.size();
+}
+
+/// Returns true if the output queue has reached its high watermark and
+/// has not fallen back to its low watermark since.
+///
+/// It is safe to call this from another thread than the stream's.
+
+bool QXmppStream::isOutputQueueFull() const
+{
+#if QT_VERSION >= 0x050000
+    return d->outputQueueFull.loadAcquire() != 0;
+#else
+    return int(d->outputQueueFull) != 0;
+#endif
+}
+
+/// Returns the output queue's low watermark in bytes.
+
+qint64 QXmppStream::outputLowWatermark() const
+{
+    return d->outputLowWatermark;
+}
+
+/// Returns the output queue's high watermark in bytes, or 0 if the
+/// output queue is not limited.
+
+qint64 QXmppStream::outputHighWatermark() const
+{
+    return d->outputHighWatermark;
+}
+
+/// Sets the output queue's \a low and \a high watermarks in bytes.
+///
+/// When outputQueueSize() reaches the high watermark, the
+/// outputHighWatermarkReached() signal is emitted and the
+/// outputQueuePolicy() applies until the queue falls back to the low
+/// watermark, at which point outputLowWatermarkReached() is emitted.
+/// Set \a high to 0 to disable the limit, which is the default.
+
+void QXmppStream::setOutputWatermarks(qint64 low, qint64 high)
+{
+    d->outputLowWatermark = qMin(low, high);
+    d->outputHighWatermark = high;
+}
+
+/// Returns what happens to outgoing data once the output queue has
+/// reached its high watermark.
+
+QXmppStream::OutputQueuePolicy QXmppStream::outputQueuePolicy() const
+{
+    return d->outputQueuePolicy;
+}
+
+/// Sets what happens to outgoing data once the output queue has reached
+/// its high watermark.
+///
+/// \param policy
+
+void QXmppStream::setOutputQueuePolicy(QXmppStream::OutputQueuePolicy policy)
+{
+    d->outputQueuePolicy = policy;
+}
+
+/// Returns the amount of outgoing data in bytes past which stanzas are
+/// scheduled by priority, or 0 if they are written in order.
+
+qint64 QXmppStream::outputSchedulingWindow() const
+{
+    return d->schedulingWindow;
+}
+
+/// Sets the amount of outgoing data in bytes past which stanzas are
+/// scheduled by priority.
+///
+/// Once the data waiting to be written to the network reaches the
+/// \a window, further data is held back and sorted into classes: control
+/// data, IQs, chat messages, groupchat messages, presences and XEP-0047
+/// In-Band Bytestreams data. As the backlog shrinks, control data goes
+/// first and the other classes share the link in the proportions 8, 4,
+/// 2, 1 and 1, so that an IQ result does not wait behind a flood of
+/// groupchat messages or bulk data, while the link stays busy.
+///
+/// Stanzas of different classes may then reach the peer in a different
+/// order than they were sent, so this must not be used with XEP-0198:
+/// Stream Management. Set \a window to 0 to write all data in order,
+/// which is the default.
+
+void QXmppStream::setOutputSchedulingWindow(qint64 window)
+{
+    d->schedulingWindow = qMax(qint64(0), window);
+    d->writeScheduledData(!d->schedulingWindow);
+}
+
+/// Returns true if a presence held back by the output scheduler is
+/// replaced by a newer one from the same sender to the same recipient.
+
+bool QXmppStream::isOutputPresenceCoalescingEnabled() const
+{
+    return d->scheduler.presenceCoalescingEnabled();
+}
+
+/// Sets whether a presence held back by the output scheduler is replaced
+/// by a newer one from the same sender to the same recipient, which only
+/// applies to available and unavailable presences.
+///
+/// The number of presences replaced is reported by the
+/// "stream.output-scheduler.coalesced" counter.
+///
+/// \param enabled
+
+void QXmppStream::setOutputPresenceCoalescingEnabled(bool enabled)
+{
+    d->scheduler.setPresenceCoalescingEnabled(enabled);
+}
+
+/// Returns true if the DOM trees of the incoming stanzas are built by
+/// worker threads.
+
+bool QXmppStream::isPipelinedParsingEnabled() const
+{
+    return d->pipeline != 0;
+}
+
+/// Sets whether the DOM trees of the incoming stanzas are built by worker
+/// threads, which lifts the limit a single CPU core puts on the number of
+/// stanzas a busy stream can receive.
+///
+/// The stream's thread then only delimits the stanzas, by scanning their
+/// bytes for the nesting of tags, and hands them over to a pool of worker
+/// threads shared by all the streams. The parsed stanzas are passed to
+/// handleRawStanza() in the order they were received, and a stanza which
+/// is not well-formed closes the stream. The stanzas named by
+/// setRawStanzaNames() are not parsed, and stanza traces are not recorded.
+///
+/// This must be set before the stream is connected. The default is false.
+///
+/// \param enabled
+
+void QXmppStream::setPipelinedParsingEnabled(bool enabled)
+{
+    if (enabled == (d->pipeline != 0))
+        return;
+
+    if (enabled) {
+        d->pipeline = new QXmppStanzaPipeline(this);
+        bool check = connect(d->pipeline, SIGNAL(readyRead()),
+                             this, SLOT(_q_pipelineReadyRead()));
+        Q_ASSERT(check);
+        Q_UNUSED(check);
+    } else {
+        delete d->pipeline;
+        d->pipeline = 0;
+    }
+    d->parser.setFramingOnly(enabled);
+}
+
+/// Returns true if XEP-0138: Stream Compression is active on the stream.
+
+bool QXmppStream::isCompressed() const
+{
+    return d->compressor != 0;
+}
+
+/// Returns true if QXmpp was built with support for XEP-0138: Stream
+/// Compression using zlib.
+
+bool QXmppStream::isCompressionSupported()
+{
+    return QXmppStreamCompressor::isSupported();
+}
+
+/// Starts compressing all data sent and received on the stream, once
+/// stream compression has been negotiated.
+///
+/// Any pending outgoing data is written uncompressed first. Subclasses
+/// then need to restart the stream using handleStart().
+///
+/// Returns false if compression is not supported or already active.
+
+bool QXmppStream::startCompression()
+{
+    if (d->compressor || !QXmppStreamCompressor::isSupported())
+        return false;
+
+    flush();
+    d->compressor = new QXmppStreamCompressor;
+    debug("Stream compression started");
+    return true;
+}
+
 /// Disconnects from the remote host.
 ///
 
 void QXmppStream::disconnectFromHost(const bool sendCloseStream)
 {
-    if (d->socket) {
-        if (d->socket->state() == QAbstractSocket::ConnectedState) {
+    if (d->device) {
+        if (d->isDeviceConnected()) {
+            // the stream end must come after the scheduled data
+            flush();
             sendData(streamRootElementEnd);
-            d->socket->flush();
+            flush();
         }
         // FIXME: according to RFC 6120 section 4.4, we should wait for
         // the incoming stream to end before closing the socket
-        d->socket->disconnectFromHost();
+        if (d->socket)
+            d->socket->disconnectFromHost();
+        else
+            d->device->close();
     }
 }
 
@@ -105,7 +965,45 @@ void QXmppStream::disconnectFromHost(const bool sendCloseStream)
 void QXmppStream::handleStart()
 {
     d->dataBuffer.clear();
-    d->streamStart.clear();
+    d->parser.clear();
+    d->streamOpened = false;
+    d->streamClosed = false;
+
+    // the stanzas of the previous stream are dropped
+    if (d->pipeline)
+        d->pipeline->clear();
+    d->pipelineEnded = false;
+    d->pipelineFull = false;
+}
+
+/// Handles an incoming XMPP stanza, in its original form.
+///
+/// The default implementation calls handleStanza() with the stanza's
+/// DOM element.
+///
+/// \param stanza
+
+void QXmppStream::handleRawStanza(const QXmppRawStanza &stanza)
+{
+    handleStanza(stanza.element());
+}
+
+/// Handles outgoing \a data which was queued using postData().
+///
+/// The default implementation calls sendData().
+
+void QXmppStream::handlePostedData(const QByteArray &data)
+{
+    sendData(data);
+}
+
+/// Sets the tag \a names of the incoming top-level elements for which
+/// no DOM tree should be built until one is requested, which is useful
+/// for stanzas which are usually forwarded by handleRawStanza().
+
+void QXmppStream::setRawStanzaNames(const QStringList &names)
+{
+    d->parser.setRawStanzaNames(names);
 }
 
 /// Returns true if the stream is connected.
@@ -113,8 +1011,7 @@ void QXmppStream::handleStart()
 
 bool QXmppStream::isConnected() const
 {
-    return d->socket &&
-           d->socket->state() == QAbstractSocket::ConnectedState;
+    return d->isDeviceConnected();
 }
 
 /// Sends raw data to the peer.
@@ -123,10 +1020,70 @@ bool QXmppStream::isConnected() const
 
 bool QXmppStream::sendData(const QByteArray &data)
 {
-    logSent(QString::fromUtf8(data));
-    if (!d->socket || d->socket->state() != QAbstractSocket::ConnectedState)
+    if (!d->isDeviceConnected()) {
+        if (isLogging(QXmppLogger::SentMessage))
+            logSent(QString::fromUtf8(data));
         return false;
-    return d->socket->write(data) == data.size();
+    }
+
+    // shed presence stanzas while the peer is not keeping up
+    if (isOutputQueueFull() &&
+        d->outputQueuePolicy == DropPresencePolicy &&
+        data.startsWith("<presence")) {
+        updateCounter("stream.output-queue.dropped");
+        return false;
+    }
+
+    if (isLogging(QXmppLogger::SentMessage))
+        logSent(QString::fromUtf8(data));
+
+    QXMPP_TRACEPOINT3(stream__send, this, data.constData(), data.size());
+    QXmppStanzaTrace *trace = QXmppStanzaTrace::current();
+    if (trace)
+        trace->mark("enqueue");
+
+    bool written;
+    if (d->schedulingWindow > 0 &&
+        (!d->scheduler.isEmpty() || d->deviceBacklog() >= d->schedulingWindow)) {
+        if (d->scheduler.enqueue(data))
+            updateCounter("stream.output-scheduler.coalesced");
+        d->updateMemoryStats();
+        written = true;
+    } else if (d->corkLevel > 0) {
+        if (d->traceInterval > 0 && d->writeBuffer.isEmpty())
+            d->corkedTime = QXmppStanzaTrace::now();
+        d->writeBuffer.append(data);
+        d->updateMemoryStats();
+        written = true;
+    } else {
+        written = d->writeData(data);
+        if (trace)
+            trace->mark("write");
+    }
+
+    const qint64 queueSize = outputQueueSize();
+    d->statisticsMutex.lock();
+    d->stanzasSent[stanzaType(data)]++;
+    d->lastOutputQueueSize = queueSize;
+    d->statisticsMutex.unlock();
+
+    // check the output queue's high watermark
+    if (d->outputHighWatermark > 0 &&
+        queueSize >= d->outputHighWatermark &&
+        d->outputQueueFull.testAndSetOrdered(0, 1)) {
+        warning(QString("Output queue reached %1 bytes").arg(QString::number(d->outputHighWatermark)));
+        emit outputHighWatermarkReached();
+
+        if (d->outputQueuePolicy == DisconnectPolicy) {
+            d->writeBuffer.clear();
+            d->scheduler.clear();
+            if (d->socket)
+                d->socket->abort();
+            else if (d->device)
+                d->device->close();
+        }
+    }
+    return written;
 }
 
 /// Sends an XMPP packet to the peer.
@@ -136,15 +1093,73 @@ bool QXmppStream::sendData(const QByteArray &data)
 bool QXmppStream::sendPacket(const QXmppStanza &packet)
 {
     // prepare packet
-    QByteArray data;
-    QXmlStreamWriter xmlStream(&data);
-    packet.toXml(&xmlStream);
+    const QByteArray data = helperToXmlData(packet);
 
     // send packet
     return sendData(data);
 }
 
-/// Returns the QSslSocket used for this stream.
+/// Returns the device used to transport this stream.
+///
+
+QIODevice *QXmppStream::device() const
+{
+    return d->device;
+}
+
+/// Sets the device used to transport this stream.
+///
+/// Any sequential QIODevice can be used, for instance a QLocalSocket or
+/// one end of an in-process pipe. A device other than a QSslSocket is
+/// considered connected while it is open, and does not support STARTTLS.
+///
+/// If the device has a connected() signal, handleStart() is called when
+/// it is emitted. The stream stops listening to the previous device.
+///
+/// \param device
+
+void QXmppStream::setDevice(QIODevice *device)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (device != d->device)
+        detachDevice(d->device, this);
+    d->device = device;
+    d->socket = qobject_cast<QSslSocket*>(device);
+    if (!d->device)
+        return;
+
+    d->statisticsMutex.lock();
+    d->connectionTimer.start();
+    d->statisticsMutex.unlock();
+
+    if (d->socket) {
+        setSocket(d->socket);
+        return;
+    }
+
+    if (QLocalSocket *localSocket = qobject_cast<QLocalSocket*>(device))
+        localSocket->setReadBufferSize(d->maximumBufferSize);
+
+    // device events
+    check = connect(device, SIGNAL(bytesWritten(qint64)),
+                    this, SLOT(_q_socketBytesWritten()));
+    Q_ASSERT(check);
+
+    if (device->metaObject()->indexOfSignal("connected()") >= 0) {
+        check = connect(device, SIGNAL(connected()),
+                        this, SLOT(_q_socketConnected()));
+        Q_ASSERT(check);
+    }
+
+    check = connect(device, SIGNAL(readyRead()),
+                    this, SLOT(_q_socketReadyRead()));
+    Q_ASSERT(check);
+}
+
+/// Returns the QSslSocket used for this stream, or 0 if the stream is
+/// transported by another kind of device.
 ///
 
 QSslSocket *QXmppStream::socket() const
@@ -160,13 +1175,32 @@ void QXmppStream::setSocket(QSslSocket *socket)
     bool check;
     Q_UNUSED(check);
 
+    if (socket != d->device)
+        detachDevice(d->device, this);
+    d->device = socket;
     d->socket = socket;
     if (!d->socket)
         return;
 
     socket->setSocketOption(QAbstractSocket::LowDelayOption, QVariant(1));
+    socket->setReadBufferSize(d->maximumBufferSize);
+
+    // the socket may already be performing the TLS handshake
+    d->statisticsMutex.lock();
+    d->connectionTimer.start();
+    if (socket->mode() != QSslSocket::UnencryptedMode && !socket->isEncrypted())
+        d->tlsTimer.start();
+    d->statisticsMutex.unlock();
 
     // socket events
+    check = connect(socket, SIGNAL(bytesWritten(qint64)),
+                    this, SLOT(_q_socketBytesWritten()));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(encryptedBytesWritten(qint64)),
+                    this, SLOT(_q_socketBytesWritten()));
+    Q_ASSERT(check);
+
     check = connect(socket, SIGNAL(connected()),
                     this, SLOT(_q_socketConnected()));
     Q_ASSERT(check);
@@ -175,6 +1209,10 @@ void QXmppStream::setSocket(QSslSocket *socket)
                     this, SLOT(_q_socketEncrypted()));
     Q_ASSERT(check);
 
+    check = connect(socket, SIGNAL(modeChanged(QSslSocket::SslMode)),
+                    this, SLOT(_q_socketModeChanged()));
+    Q_ASSERT(check);
+
     check = connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
                     this, SLOT(_q_socketError(QAbstractSocket::SocketError)));
     Q_ASSERT(check);
@@ -184,84 +1222,331 @@ void QXmppStream::setSocket(QSslSocket *socket)
     Q_ASSERT(check);
 }
 
+void QXmppStream::_q_moveToTargetThread()
+{
+    d->postedMutex.lock();
+    QThread *thread = d->targetThread;
+    d->targetThread = 0;
+    d->postedMutex.unlock();
+
+    // the events posted to the stream follow it
+    if (thread && thread != this->thread())
+        moveToThread(thread);
+}
+
+void QXmppStream::_q_pipelineReadyRead()
+{
+    QElapsedTimer processingTimer;
+    processingTimer.start();
+
+    // handle the stanzas which were parsed, in order, writing the
+    // responses to all of them at once
+    QXmppRawStanza stanza;
+    bool wellFormed;
+    cork();
+    while (d->pipeline && !d->readingPaused && d->pipeline->readNext(&stanza, &wellFormed)) {
+        if (!wellFormed) {
+            warning("Received invalid XML");
+            d->pipeline->clear();
+            d->pipelineEnded = false;
+            disconnectFromHost();
+            break;
+        }
+        QXMPP_TRACEPOINT3(stream__stanza__start, this, stanza.data().constData(), stanza.data().size());
+        handleRawStanza(stanza);
+        QXMPP_TRACEPOINT1(stream__stanza__done, this);
+    }
+    uncork();
+
+    if (d->pipeline && d->pipelineEnded && !d->pipeline->size()) {
+        d->pipelineEnded = false;
+        disconnectFromHost();
+    }
+
+    // parse the rest of the received data
+    if (d->pipelineFull && (!d->pipeline || d->pipeline->size() <= maximumPipelinedStanzas / 2)) {
+        d->pipelineFull = false;
+        QMetaObject::invokeMethod(this, "_q_socketReadyRead", Qt::QueuedConnection);
+    }
+
+    d->addProcessingTime(processingTimer.nsecsElapsed());
+}
+
+void QXmppStream::_q_processPostedData()
+{
+    d->postedMutex.lock();
+    const QList<QByteArray> batch = d->postedData;
+    d->postedData.clear();
+    d->postedMutex.unlock();
+
+    cork();
+    foreach (const QByteArray &data, batch)
+        handlePostedData(data);
+    uncork();
+}
+
+void QXmppStream::_q_socketBytesWritten()
+{
+    d->writeScheduledData(false);
+
+    const qint64 queueSize = outputQueueSize();
+    d->statisticsMutex.lock();
+    d->lastOutputQueueSize = queueSize;
+    d->statisticsMutex.unlock();
+
+    if (queueSize <= d->outputLowWatermark &&
+        d->outputQueueFull.testAndSetOrdered(1, 0)) {
+        emit outputLowWatermarkReached();
+    }
+}
+
 void QXmppStream::_q_socketConnected()
 {
-    info(QString("Socket connected to %1 %2").arg(
-        d->socket->peerAddress().toString(),
-        QString::number(d->socket->peerPort())));
+    // compression only lasts as long as the connection
+    delete d->compressor;
+    d->compressor = 0;
+    d->scheduler.clear();
+
+    d->statisticsMutex.lock();
+    d->connectionTimer.start();
+    d->statisticsMutex.unlock();
+
+    if (d->socket)
+        info(QString("Socket connected to %1 %2").arg(
+            d->socket->peerAddress().toString(),
+            QString::number(d->socket->peerPort())));
+    else
+        info("Device connected");
     handleStart();
 }
 
 void QXmppStream::_q_socketEncrypted()
 {
+    d->statisticsMutex.lock();
+    if (d->tlsTimer.isValid()) {
+        d->tlsHandshakeTime = d->tlsTimer.elapsed();
+        d->tlsTimer.invalidate();
+    }
+    d->statisticsMutex.unlock();
+
     debug("Socket encrypted");
     handleStart();
 }
 
+void QXmppStream::_q_socketModeChanged()
+{
+    // the TLS handshake starts
+    if (d->socket && d->socket->mode() != QSslSocket::UnencryptedMode) {
+        QMutexLocker locker(&d->statisticsMutex);
+        d->tlsTimer.start();
+    }
+}
+
 void QXmppStream::_q_socketError(QAbstractSocket::SocketError socketError)
 {
     Q_UNUSED(socketError);
     warning(QString("Socket error: " + socket()->errorString()));
 }
 
-void QXmppStream::_q_socketReadyRead()
+void QXmppStream::_q_rateLimitExpired()
 {
-    d->dataBuffer.append(d->socket->readAll());
+    d->rateLimitersMutex.lock();
+    const QList<QSharedPointer<QXmppRateLimiter> > limiters = d->rateLimiters;
+    d->rateLimitersMutex.unlock();
 
-    // handle whitespace pings
-    if (!d->dataBuffer.isEmpty() && d->dataBuffer.trimmed().isEmpty()) {
-        d->dataBuffer.clear();
-        handleStanza(QDomElement());
+    int delay = 0;
+    foreach (const QSharedPointer<QXmppRateLimiter> &limiter, limiters)
+        delay = qMax(delay, limiter->delay());
+    if (delay > 0) {
+        QTimer::singleShot(delay, this, SLOT(_q_rateLimitExpired()));
+        return;
     }
 
-    // FIXME : maybe these QRegExps could be static?
-    QRegExp startStreamRegex("^(<\\?xml.*\\?>)?\\s*<stream:stream.*>");
-    startStreamRegex.setMinimal(true);
-    QRegExp endStreamRegex("</stream:stream>$");
-    endStreamRegex.setMinimal(true);
+    d->rateLimited = false;
+    _q_socketReadyRead();
+}
 
-    // check whether we need to add stream start / end elements
-    //
-    // NOTE: as we may only have partial XML content, do not alter the stream's
-    // state until we have a valid XML document!
-    QByteArray completeXml = d->dataBuffer;
-    const QString strData = QString::fromUtf8(d->dataBuffer);
-    bool streamStart = false;
-    if (d->streamStart.isEmpty() && strData.contains(startStreamRegex))
-        streamStart = true;
-    else
-        completeXml.prepend(d->streamStart);
-    bool streamEnd = false;
-    if (strData.contains(endStreamRegex))
-        streamEnd = true;
-    else
-        completeXml.append(streamRootElementEnd);
+void QXmppStream::_q_socketReadyRead()
+{
+    if (d->readingPaused || d->rateLimited || d->pipelineFull || !d->device)
+        return;
+
+    QElapsedTimer processingTimer;
+    processingTimer.start();
+    const qint64 readTime = d->traceInterval > 0 ? QXmppStanzaTrace::now() : 0;
+
+    // read into the thread's read buffer, which the data below refers to
+    // without copying it until the parser has taken it
+    char *buffer = QXmppReadBuffer::data();
+    const qint64 length = d->device->read(buffer, QXmppReadBuffer::Size);
+    QByteArray data = QByteArray::fromRawData(buffer, int(qMax(length, qint64(0))));
+    QXMPP_TRACEPOINT2(stream__read, this, length);
+    if (d->capture)
+        d->capture->record(d->captureSession, data);
+
+    d->statisticsMutex.lock();
+    d->bytesReceived += data.size();
+    d->statisticsMutex.unlock();
 
-    // check whether we have a valid XML document
-    QDomDocument doc;
-    if (!doc.setContent(completeXml, true))
+    // ignore anything received after the end of the incoming stream
+    if (d->streamClosed) {
+        while (d->device->read(buffer, QXmppReadBuffer::Size) > 0)
+            ;
         return;
+    }
 
-    // remove data from buffer
-    logReceived(strData);
-    d->dataBuffer.clear();
+    d->rateLimitersMutex.lock();
+    const QList<QSharedPointer<QXmppRateLimiter> > limiters = d->rateLimiters;
+    d->rateLimitersMutex.unlock();
+    int rateLimitDelay = 0;
+    if (!limiters.isEmpty() && !data.isEmpty())
+        rateLimitDelay = consumeTokens(limiters, data.size(), 0);
+
+    if (d->compressor && !data.isEmpty()) {
+        // a small input must not inflate to more than the parser accepts
+        int maximumSize = 0;
+        if (d->parser.maximumElementSize() > 0)
+            maximumSize = d->parser.maximumElementSize() + int(d->parser.bufferSize());
 
-    // process stream start
-    if (streamStart) {
-        d->streamStart = startStreamRegex.cap(0).toUtf8();
-        handleStream(doc.documentElement());
+        QByteArray decompressed;
+        if (!d->compressor->decompress(data, decompressed, maximumSize)) {
+            warning("Received invalid compressed data");
+            disconnectFromHost();
+            return;
+        }
+        if (maximumSize > 0 && decompressed.size() > maximumSize) {
+            warning(QString("Received compressed data larger than %1 bytes").arg(maximumSize));
+            sendData("<stream:error><policy-violation xmlns='urn:ietf:params:xml:ns:xmpp-streams'/></stream:error>");
+            disconnectFromHost();
+            return;
+        }
+        d->updateCompressionStats(decompressed.size(), data.size());
+        data = decompressed;
     }
 
-    // process stanzas
-    QDomElement nodeRecv = doc.documentElement().firstChildElement();
-    while (!nodeRecv.isNull()) {
-        handleStanza(nodeRecv);
-        nodeRecv = nodeRecv.nextSiblingElement();
+    // the raw data is only converted to a QString if it is logged,
+    // and whitespace pings are never logged
+    QElapsedTimer parseTimer;
+    qint64 parseTime = 0;
+    if (!data.isEmpty()) {
+        if ((!d->streamOpened || !isWhitespace(data)) && isLogging(QXmppLogger::ReceivedMessage))
+            d->dataBuffer.append(data);
+        parseTimer.start();
+        d->parser.addData(data);
+        parseTime += parseTimer.nsecsElapsed();
     }
+    qint64 stanzasReceived[stanzaTypeCount];
+    for (int i = 0; i < stanzaTypeCount; ++i)
+        stanzasReceived[i] = 0;
 
-    // process stream end
-    if (streamEnd)
-        disconnectFromHost();
-}
+    // process all the complete elements received so far, writing
+    // the responses to all of them at once
+    //
+    // NOTE: handleStart() may be invoked while we handle an element,
+    // in which case the parser is reset and we stop here. Reading may
+    // also be paused, in which case the remaining elements are handled
+    // by resumeReading(), or rate limited, in which case they are handled
+    // once the rate limiters are refilled.
+    cork();
+    bool done = false;
+    while (!done && !d->readingPaused && !rateLimitDelay && !d->pipelineFull) {
+        parseTimer.start();
+        const QXmppStreamParser::Token token = d->parser.readNext();
+        parseTime += parseTimer.nsecsElapsed();
+        if (token == QXmppStreamParser::NoToken)
+            break;
+
+        // log the data received so far
+        if (!d->dataBuffer.isEmpty()) {
+            logReceived(QString::fromUtf8(d->dataBuffer));
+            d->dataBuffer.clear();
+        }
+
+        switch (token) {
+        case QXmppStreamParser::StreamStartToken:
+            d->streamOpened = true;
+            handleStream(d->parser.element());
+            break;
+        case QXmppStreamParser::StanzaToken: {
+            const QXmppRawStanza stanza = d->parser.rawStanza();
+            stanzasReceived[stanzaType(stanza.tagName())]++;
+            if (d->pipeline) {
+                d->pipeline->submit(stanza, !d->parser.rawStanzaNames().contains(stanza.tagName()));
+                d->pipelineFull = d->pipeline->size() >= maximumPipelinedStanzas;
+            } else if (d->traceInterval > 0) {
+                const bool sampled = ++d->traceCount >= d->traceInterval;
+                if (sampled)
+                    d->traceCount = 0;
+                QXmppStanzaTrace *trace = QXmppStanzaTrace::start(readTime, sampled);
+                if (trace)
+                    trace->mark("parse");
+                QXMPP_TRACEPOINT3(stream__stanza__start, this, stanza.data().constData(), stanza.data().size());
+                handleRawStanza(stanza);
+                QXMPP_TRACEPOINT1(stream__stanza__done, this);
+                const QString summary = QXmppStanzaTrace::finish();
+                if (!summary.isEmpty())
+                    debug(summary);
+            } else {
+                QXMPP_TRACEPOINT3(stream__stanza__start, this, stanza.data().constData(), stanza.data().size());
+                handleRawStanza(stanza);
+                QXMPP_TRACEPOINT1(stream__stanza__done, this);
+            }
+            if (!limiters.isEmpty())
+                rateLimitDelay = consumeTokens(limiters, 0, 1);
+            break;
+        }
+        case QXmppStreamParser::WhitespaceToken:
+            // whitespace ping
+            handleStanza(QDomElement());
+            break;
+        case QXmppStreamParser::StreamEndToken:
+            d->streamClosed = true;
+            // the stanzas received before the end are handled first
+            if (d->pipeline && d->pipeline->size() > 0)
+                d->pipelineEnded = true;
+            else
+                disconnectFromHost();
+            done = true;
+            break;
+        case QXmppStreamParser::ErrorToken:
+            if (d->parser.error() == QXmppStreamParser::ElementTooLargeError) {
+                warning(QString("Received an element larger than %1 bytes").arg(d->parser.maximumElementSize()));
+                sendData("<stream:error><policy-violation xmlns='urn:ietf:params:xml:ns:xmpp-streams'/></stream:error>");
+            } else {
+                warning(QString("Received invalid XML: %1").arg(d->parser.errorString()));
+            }
+            disconnectFromHost();
+            done = true;
+            break;
+        default:
+            done = true;
+            break;
+        }
+    }
+    uncork();
+
+    // stop reading from the socket until the limiters are refilled
+    if (rateLimitDelay > 0 && !d->streamClosed) {
+        d->rateLimited = true;
+        QTimer::singleShot(rateLimitDelay, this, SLOT(_q_rateLimitExpired()));
+        updateCounter("stream.rate-limit-pauses");
+    }
+
+    // come back for the rest of the received data once the other
+    // connections had their turn
+    const qint64 inputBufferSize = d->device ? d->device->bytesAvailable() : 0;
+    if (inputBufferSize > 0 && !d->readingPaused && !d->rateLimited && !d->streamClosed && !d->pipelineFull)
+        QMetaObject::invokeMethod(this, "_q_socketReadyRead", Qt::QueuedConnection);
 
+    QMutexLocker locker(&d->statisticsMutex);
+    if (d->rateLimited)
+        d->rateLimitPauses++;
+    for (int i = 0; i < stanzaTypeCount; ++i)
+        d->stanzasReceived[i] += stanzasReceived[i];
+    d->parseTime += parseTime;
+    d->inputBufferSize = inputBufferSize;
+    locker.unlock();
+    d->addProcessingTime(processingTimer.nsecsElapsed());
 
+    d->updateMemoryStats();
+}
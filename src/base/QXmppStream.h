@@ -28,12 +28,20 @@
 
 #include <QAbstractSocket>
 #include <QObject>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVariantMap>
 #include "QXmppLogger.h"
 
 class QDomElement;
+class QIODevice;
+class QXmppRateLimiter;
 class QSslSocket;
+class QThread;
+class QXmppRawStanza;
 class QXmppStanza;
 class QXmppStreamPrivate;
+class QXmppTrafficCapture;
 
 /// \brief The QXmppStream class is the base class for all XMPP streams.
 ///
@@ -43,12 +51,72 @@ class QXMPP_EXPORT QXmppStream : public QXmppLoggable
     Q_OBJECT
 
 public:
+    /// This enum describes what happens to outgoing data once the output
+    /// queue has reached its high watermark.
+    enum OutputQueuePolicy
+    {
+        StallPolicy = 0,        ///< Keep queuing data, the sender is expected to wait for outputLowWatermarkReached().
+        DropPresencePolicy,     ///< Drop outgoing presence stanzas, keep queuing other data.
+        DisconnectPolicy        ///< Close the stream.
+    };
+
     QXmppStream(QObject *parent);
     ~QXmppStream();
 
     virtual bool isConnected() const;
     virtual bool sendPacket(const QXmppStanza&);
 
+    bool isCorked() const;
+    void flush();
+
+    void postData(const QByteArray &data);
+    void postMoveToThread(QThread *thread);
+
+    bool isCompressed() const;
+    static bool isCompressionSupported();
+
+    int maximumStanzaSize() const;
+    void setMaximumStanzaSize(int size);
+
+    qint64 maximumBufferSize() const;
+    void setMaximumBufferSize(qint64 size);
+
+    int stanzaTraceInterval() const;
+    void setStanzaTraceInterval(int interval);
+
+    bool isReadingPaused() const;
+    void pauseReading();
+    void resumeReading();
+
+    bool isRateLimited() const;
+    void addRateLimiter(const QSharedPointer<QXmppRateLimiter> &limiter);
+    void removeRateLimiter(const QSharedPointer<QXmppRateLimiter> &limiter);
+
+    qint64 outputQueueSize() const;
+    bool isOutputQueueFull() const;
+    qint64 outputLowWatermark() const;
+    qint64 outputHighWatermark() const;
+    void setOutputWatermarks(qint64 low, qint64 high);
+
+    OutputQueuePolicy outputQueuePolicy() const;
+    void setOutputQueuePolicy(OutputQueuePolicy policy);
+
+    qint64 outputSchedulingWindow() const;
+    void setOutputSchedulingWindow(qint64 window);
+
+    bool isOutputPresenceCoalescingEnabled() const;
+    void setOutputPresenceCoalescingEnabled(bool enabled);
+
+    bool isPipelinedParsingEnabled() const;
+    void setPipelinedParsingEnabled(bool enabled);
+
+    qint64 processingTime() const;
+    QVariantMap statistics() const;
+
+    /// \cond
+    void setTrafficCapture(const QSharedPointer<QXmppTrafficCapture> &capture);
+    /// \endcond
+
 signals:
     /// This signal is emitted when the stream is connected.
     void connected();
@@ -56,13 +124,29 @@ signals:
     /// This signal is emitted when the stream is disconnected.
     void disconnected();
 
+    /// This signal is emitted when the amount of outgoing data waiting to
+    /// be written reaches outputHighWatermark().
+    void outputHighWatermarkReached();
+
+    /// This signal is emitted when the amount of outgoing data waiting to
+    /// be written falls back to outputLowWatermark() after the high
+    /// watermark was reached.
+    void outputLowWatermarkReached();
+
 protected:
-    // Access to underlying socket
+    // Access to underlying transport
+    QIODevice *device() const;
+    void setDevice(QIODevice *device);
     QSslSocket *socket() const;
     void setSocket(QSslSocket *socket);
 
+    void setRawStanzaNames(const QStringList &names);
+    bool startCompression();
+
     // Overridable methods
     virtual void handleStart();
+    virtual void handleRawStanza(const QXmppRawStanza &stanza);
+    virtual void handlePostedData(const QByteArray &data);
 
     /// Handles an incoming XMPP stanza.
     ///
@@ -75,16 +159,25 @@ protected:
     virtual void handleStream(const QDomElement &element) = 0;
 
 public slots:
+    void cork();
+    void uncork();
     virtual void disconnectFromHost(const bool sendCloseStream = true);
     virtual bool sendData(const QByteArray&);
 
 private slots:
+    void _q_moveToTargetThread();
+    void _q_pipelineReadyRead();
+    void _q_processPostedData();
+    void _q_rateLimitExpired();
+    void _q_socketBytesWritten();
     void _q_socketConnected();
     void _q_socketEncrypted();
     void _q_socketError(QAbstractSocket::SocketError error);
+    void _q_socketModeChanged();
     void _q_socketReadyRead();
 
 private:
+    friend class QXmppStreamPrivate;
     QXmppStreamPrivate * const d;
 };
 
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifdef QXMPP_USE_ZLIB
+#include <string.h>
+#include <zlib.h>
+#endif
+
+#include "QXmppStreamCompressor_p.h"
+
+#ifdef QXMPP_USE_ZLIB
+static const int chunkSize = 16384;
+#endif
+
+class QXmppStreamCompressorPrivate
+{
+public:
+    QXmppStreamCompressorPrivate();
+
+#ifdef QXMPP_USE_ZLIB
+    z_stream deflateStream;
+    z_stream inflateStream;
+#endif
+    bool valid;
+
+    // totals for both directions
+    qint64 compressedBytes;
+    qint64 uncompressedBytes;
+};
+
+QXmppStreamCompressorPrivate::QXmppStreamCompressorPrivate()
+    : valid(false)
+    , compressedBytes(0)
+    , uncompressedBytes(0)
+{
+}
+
+/// Constructs a new compressor with fresh deflate and inflate contexts.
+///
+/// \param format The format of the compressed data.
+
+QXmppStreamCompressor::QXmppStreamCompressor(Format format)
+    : d(new QXmppStreamCompressorPrivate)
+{
+#ifdef QXMPP_USE_ZLIB
+    // negative window bits select the raw deflate format
+    const int windowBits = (format == RawDeflateFormat) ? -MAX_WBITS : MAX_WBITS;
+    memset(&d->deflateStream, 0, sizeof(d->deflateStream));
+    memset(&d->inflateStream, 0, sizeof(d->inflateStream));
+    d->valid = deflateInit2(&d->deflateStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                            windowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK &&
+               inflateInit2(&d->inflateStream, windowBits) == Z_OK;
+#else
+    Q_UNUSED(format);
+#endif
+}
+
+/// Destroys the compressor.
+
+QXmppStreamCompressor::~QXmppStreamCompressor()
+{
+#ifdef QXMPP_USE_ZLIB
+    deflateEnd(&d->deflateStream);
+    inflateEnd(&d->inflateStream);
+#endif
+    delete d;
+}
+
+/// Returns true if QXmpp was built with zlib support.
+
+bool QXmppStreamCompressor::isSupported()
+{
+#ifdef QXMPP_USE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// Compresses \a input and appends the result to \a output.
+///
+/// The data is sync flushed, so that the peer can decompress all of it
+/// as soon as it is received.
+
+bool QXmppStreamCompressor::compress(const QByteArray &input, QByteArray &output)
+{
+#ifdef QXMPP_USE_ZLIB
+    if (!d->valid)
+        return false;
+
+    const int start = output.size();
+    z_stream *strm = &d->deflateStream;
+    strm->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.constData()));
+    strm->avail_in = input.size();
+    do {
+        const int size = output.size();
+        output.resize(size + chunkSize);
+        strm->next_out = reinterpret_cast<Bytef*>(output.data() + size);
+        strm->avail_out = chunkSize;
+        if (deflate(strm, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+            d->valid = false;
+            output.resize(start);
+            return false;
+        }
+        output.resize(size + chunkSize - strm->avail_out);
+    } while (strm->avail_out == 0);
+
+    d->uncompressedBytes += input.size();
+    d->compressedBytes += output.size() - start;
+    return true;
+#else
+    Q_UNUSED(input);
+    Q_UNUSED(output);
+    return false;
+#endif
+}
+
+/// Decompresses \a input and appends the result to \a output.
+///
+/// If \a maximumSize is positive, inflating stops as soon as more than
+/// \a maximumSize bytes were appended, so that a small input can not
+/// expand without bound. The caller detects this by comparing the size
+/// of the output, and the compressor can not be used any further.
+///
+/// Returns false if the input is not a valid zlib stream.
+
+bool QXmppStreamCompressor::decompress(const QByteArray &input, QByteArray &output, int maximumSize)
+{
+#ifdef QXMPP_USE_ZLIB
+    if (!d->valid)
+        return false;
+
+    const int start = output.size();
+    z_stream *strm = &d->inflateStream;
+    strm->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.constData()));
+    strm->avail_in = input.size();
+    do {
+        const int size = output.size();
+        output.resize(size + chunkSize);
+        strm->next_out = reinterpret_cast<Bytef*>(output.data() + size);
+        strm->avail_out = chunkSize;
+        const int ret = inflate(strm, Z_SYNC_FLUSH);
+        output.resize(size + chunkSize - strm->avail_out);
+        if (ret == Z_STREAM_END || (ret == Z_BUF_ERROR && strm->avail_out > 0)) {
+            break;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            d->valid = false;
+            output.resize(start);
+            return false;
+        } else if (maximumSize > 0 && output.size() - start > maximumSize) {
+            // the rest of the input is dropped, so the stream can not resume
+            d->valid = false;
+            break;
+        }
+    } while (strm->avail_in > 0 || strm->avail_out == 0);
+
+    d->compressedBytes += input.size();
+    d->uncompressedBytes += output.size() - start;
+    return true;
+#else
+    Q_UNUSED(input);
+    Q_UNUSED(output);
+    Q_UNUSED(maximumSize);
+    return false;
+#endif
+}
+
+/// Returns the total number of compressed bytes sent and received.
+
+qint64 QXmppStreamCompressor::compressedBytes() const
+{
+    return d->compressedBytes;
+}
+
+/// Returns the total number of uncompressed bytes sent and received.
+
+qint64 QXmppStreamCompressor::uncompressedBytes() const
+{
+    return d->uncompressedBytes;
+}
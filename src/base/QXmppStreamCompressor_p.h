@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSTREAMCOMPRESSOR_P_H
+#define QXMPPSTREAMCOMPRESSOR_P_H
+
+#include <QByteArray>
+
+#include "QXmppGlobal.h"
+
+class QXmppStreamCompressorPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppStreamCompressor class implements XEP-0138: Stream Compression
+/// using zlib.
+///
+/// A single deflate and inflate context is kept for the lifetime of the
+/// stream, and each block of outgoing data is terminated by a sync flush
+/// so that the peer can process it immediately.
+///
+/// The raw deflate format, without zlib header and checksum, is used by
+/// the WebSocket permessage-deflate extension.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStreamCompressor
+{
+public:
+    /// This enum describes the format of the compressed data.
+    enum Format
+    {
+        ZlibFormat = 0,     ///< zlib stream, as defined by RFC 1950.
+        RawDeflateFormat    ///< Raw deflate stream, as defined by RFC 1951.
+    };
+
+    explicit QXmppStreamCompressor(Format format = ZlibFormat);
+    ~QXmppStreamCompressor();
+
+    static bool isSupported();
+
+    bool compress(const QByteArray &input, QByteArray &output);
+    bool decompress(const QByteArray &input, QByteArray &output, int maximumSize = 0);
+
+    qint64 compressedBytes() const;
+    qint64 uncompressedBytes() const;
+
+private:
+    Q_DISABLE_COPY(QXmppStreamCompressor)
+    QXmppStreamCompressorPrivate * const d;
+};
+
+#endif
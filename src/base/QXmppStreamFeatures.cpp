@@ -29,8 +29,12 @@
 QXmppStreamFeatures::QXmppStreamFeatures()
     : m_bindMode(Disabled),
     m_sessionMode(Disabled),
+    m_sessionOptional(false),
     m_nonSaslAuthMode(Disabled),
-    m_tlsMode(Disabled)
+    m_tlsMode(Disabled),
+    m_streamManagementMode(Disabled),
+    m_rosterVersioningMode(Disabled),
+    m_clientStateIndicationMode(Disabled)
 {
 }
 
@@ -54,6 +58,16 @@ void QXmppStreamFeatures::setSessionMode(Mode mode)
     m_sessionMode = mode;
 }
 
+bool QXmppStreamFeatures::sessionOptional() const
+{
+    return m_sessionOptional;
+}
+
+void QXmppStreamFeatures::setSessionOptional(bool optional)
+{
+    m_sessionOptional = optional;
+}
+
 QXmppStreamFeatures::Mode QXmppStreamFeatures::nonSaslAuthMode() const
 {
     return m_nonSaslAuthMode;
@@ -104,6 +118,26 @@ void QXmppStreamFeatures::setStreamManagementMode(Mode mode)
     m_streamManagementMode = mode;
 }
 
+QXmppStreamFeatures::Mode QXmppStreamFeatures::rosterVersioningMode() const
+{
+    return m_rosterVersioningMode;
+}
+
+void QXmppStreamFeatures::setRosterVersioningMode(Mode mode)
+{
+    m_rosterVersioningMode = mode;
+}
+
+QXmppStreamFeatures::Mode QXmppStreamFeatures::clientStateIndicationMode() const
+{
+    return m_clientStateIndicationMode;
+}
+
+void QXmppStreamFeatures::setClientStateIndicationMode(Mode mode)
+{
+    m_clientStateIndicationMode = mode;
+}
+
 /// \cond
 bool QXmppStreamFeatures::isStreamFeatures(const QDomElement &element)
 {
@@ -111,7 +145,7 @@ bool QXmppStreamFeatures::isStreamFeatures(const QDomElement &element)
            element.tagName() == "features";
 }
 
-static QXmppStreamFeatures::Mode readFeature(const QDomElement &element, const char *tagName, const char *tagNs)
+static QXmppStreamFeatures::Mode readFeature(const QDomElement &element, const char *tagName, const QLatin1String &tagNs)
 {
     QDomElement subElement = element.firstChildElement(tagName);
     while (!subElement.isNull()) {
@@ -132,9 +166,13 @@ void QXmppStreamFeatures::parse(const QDomElement &element)
 {
     m_bindMode = readFeature(element, "bind", ns_bind);
     m_sessionMode = readFeature(element, "session", ns_session);
+    m_sessionOptional = m_sessionMode != Disabled &&
+        !element.firstChildElement("session").firstChildElement("optional").isNull();
     m_nonSaslAuthMode = readFeature(element, "auth", ns_authFeature);
     m_tlsMode = readFeature(element, "starttls", ns_tls);
     m_streamManagementMode = readFeature(element, "sm", ns_stream_management);
+    m_rosterVersioningMode = readFeature(element, "ver", ns_rosterver);
+    m_clientStateIndicationMode = readFeature(element, "csi", ns_csi);
 
     // parse advertised compression methods
     QDomElement compression = element.firstChildElement("compression");
@@ -160,7 +198,7 @@ void QXmppStreamFeatures::parse(const QDomElement &element)
     }
 }
 
-static void writeFeature(QXmlStreamWriter *writer, const char *tagName, const char *tagNs, QXmppStreamFeatures::Mode mode)
+static void writeFeature(QXmlStreamWriter *writer, const char *tagName, const QLatin1String &tagNs, QXmppStreamFeatures::Mode mode, bool optional = false)
 {
     if (mode != QXmppStreamFeatures::Disabled)
     {
@@ -168,6 +206,8 @@ static void writeFeature(QXmlStreamWriter *writer, const char *tagName, const ch
         writer->writeAttribute("xmlns", tagNs);
         if (mode == QXmppStreamFeatures::Required)
             writer->writeEmptyElement("required");
+        else if (optional)
+            writer->writeEmptyElement("optional");
         writer->writeEndElement();
     }
 }
@@ -176,7 +216,7 @@ void QXmppStreamFeatures::toXml(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("stream:features");
     writeFeature(writer, "bind", ns_bind, m_bindMode);
-    writeFeature(writer, "session", ns_session, m_sessionMode);
+    writeFeature(writer, "session", ns_session, m_sessionMode, m_sessionOptional);
     writeFeature(writer, "auth", ns_authFeature, m_nonSaslAuthMode);
     writeFeature(writer, "starttls", ns_tls, m_tlsMode);
 
@@ -198,6 +238,8 @@ void QXmppStreamFeatures::toXml(QXmlStreamWriter *writer) const
         writer->writeEndElement();
     }
     writeFeature(writer, "sm", ns_stream_management, m_streamManagementMode);
+    writeFeature(writer, "ver", ns_rosterver, m_rosterVersioningMode);
+    writeFeature(writer, "csi", ns_csi, m_clientStateIndicationMode);
 
     writer->writeEndElement();
 }
@@ -44,6 +44,9 @@ public:
     Mode sessionMode() const;
     void setSessionMode(Mode mode);
 
+    bool sessionOptional() const;
+    void setSessionOptional(bool optional);
+
     Mode nonSaslAuthMode() const;
     void setNonSaslAuthMode(Mode mode);
 
@@ -59,6 +62,12 @@ public:
     Mode streamManagementMode() const;
     void setStreamManagementMode(Mode mode);
 
+    Mode rosterVersioningMode() const;
+    void setRosterVersioningMode(Mode mode);
+
+    Mode clientStateIndicationMode() const;
+    void setClientStateIndicationMode(Mode mode);
+
     /// \cond
     void parse(const QDomElement &element);
     void toXml(QXmlStreamWriter *writer) const;
@@ -69,9 +78,12 @@ public:
 private:
     Mode m_bindMode;
     Mode m_sessionMode;
+    bool m_sessionOptional;
     Mode m_nonSaslAuthMode;
     Mode m_tlsMode;
     Mode m_streamManagementMode;
+    Mode m_rosterVersioningMode;
+    Mode m_clientStateIndicationMode;
     QStringList m_authMechanisms;
     QStringList m_compressionMethods;
 };
@@ -2,14 +2,46 @@
 
 #include "QXmppConfiguration.h"
 #include <QDomElement>
+#include <QTime>
+#include <QVector>
 #include <qxmlstream.h>
 #include "QXmppConstants.h"
+#include "QXmppMemoryStats_p.h"
+#include "QXmppMetrics.h"
+#include "QXmppTracepoints_p.h"
+#include "QXmppUtils.h"
 
+// upper bounds of the ack latency histogram's buckets in milliseconds
+static const int ackLatencyBucketBounds[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+static const int ackLatencyBucketCount = sizeof(ackLatencyBucketBounds) / sizeof(ackLatencyBucketBounds[0]);
+static const int ackLatencyHistogram = QXmppMetrics::histogram("stream-management.ack-latency");
+
+// time after which a pending ack request no longer holds back new requests
+static const int minimumStaleRequestTime = 5000;
+
+class QXmppStreamManagementEntry
+{
+public:
+    QXmppStreamManagementEntry() : type(QXmppStanza::Unkown) {}
+
+    QByteArray data;
+    QXmppStanza::StanzaType type;
+    QXmppMessage message;
+    QXmppIq iq;
+    QXmppPresence presence;
+};
 
 class QXmppStreamManagementPrivate
 {
 public:
     QXmppStreamManagementPrivate();
+    ~QXmppStreamManagementPrivate();
+
+    QXmppStreamManagementEntry &at(int i) { return outboundBuffer[(outboundHead + i) & (outboundBuffer.size() - 1)]; }
+    void clearOutbound();
+    QXmppStreamManagementEntry takeFirst();
+    void push(const QXmppStanza &stanza, const QByteArray &data);
+    void updateMemoryStats();
     QXmppConfiguration::StreamManagementMode streamManagementMode;
     bool outboundEnabled;
     bool inboundEnabled;
@@ -20,8 +52,43 @@ public:
     int  inboundCounter;
     int  lastHandleStanzaSent;
     bool resumming;
-    QMap <int, QXmppStanza*> outboundBuffer;
 
+    // Unacknowledged stanzas, kept in a ring buffer whose size is a power
+    // of two. The first entry has the sequence number
+    // outboundCounter - outboundCount + 1.
+    QVector<QXmppStreamManagementEntry> outboundBuffer;
+    int outboundHead;
+    int outboundCount;
+    qint64 outboundBytes;
+
+    // ack request policy
+    int ackStanzas;
+    int ackBytes;
+    int ackInterval;
+    bool ackAdaptive;
+
+    // data sent since the last ack request
+    int stanzasSinceRequest;
+    qint64 bytesSinceRequest;
+
+    // pending ack request
+    bool requestPending;
+    int requestSequence;
+    QTime requestTime;
+
+    // ack latency
+    int smoothedLatency;
+    QVector<int> latencyHistogram;
+
+    // empty stanzas assigned to released entries, so that they do not
+    // hold on to the stanzas' data
+    const QXmppMessage emptyMessage;
+    const QXmppIq emptyIq;
+    const QXmppPresence emptyPresence;
+
+#ifdef QXMPP_MEMORY_STATS
+    qint64 memoryBytes;
+#endif
 };
 
 QXmppStreamManagementPrivate::QXmppStreamManagementPrivate()
@@ -31,8 +98,101 @@ QXmppStreamManagementPrivate::QXmppStreamManagementPrivate()
     , resumeEnabled(false)
     , outboundCounter(0)
     , inboundCounter(0)
+    , lastHandleStanzaSent(0)
+    , resumming(false)
+    , outboundHead(0)
+    , outboundCount(0)
+    , outboundBytes(0)
+    , ackStanzas(10)
+    , ackBytes(0)
+    , ackInterval(0)
+    , ackAdaptive(false)
+    , stanzasSinceRequest(0)
+    , bytesSinceRequest(0)
+    , requestPending(false)
+    , requestSequence(0)
+    , smoothedLatency(-1)
+    , latencyHistogram(ackLatencyBucketCount + 1)
+#ifdef QXMPP_MEMORY_STATS
+    , memoryBytes(0)
+#endif
+{
+
+}
+
+QXmppStreamManagementPrivate::~QXmppStreamManagementPrivate()
+{
+#ifdef QXMPP_MEMORY_STATS
+    QXmppMemoryStats::resize(QXmppMemoryStats::StreamManagement, memoryBytes, 0);
+#endif
+}
+
+void QXmppStreamManagementPrivate::clearOutbound()
+{
+    outboundBuffer.clear();
+    outboundHead = 0;
+    outboundCount = 0;
+    outboundBytes = 0;
+    updateMemoryStats();
+}
+
+void QXmppStreamManagementPrivate::push(const QXmppStanza &stanza, const QByteArray &data)
+{
+    // grow the ring buffer, keeping the entries in order
+    if (outboundCount == outboundBuffer.size()) {
+        QVector<QXmppStreamManagementEntry> buffer(qMax(16, 2 * outboundBuffer.size()));
+        for (int i = 0; i < outboundCount; ++i)
+            buffer[i] = at(i);
+        outboundBuffer = buffer;
+        outboundHead = 0;
+    }
+
+    QXmppStreamManagementEntry &entry = at(outboundCount++);
+    entry.data = data;
+    outboundBytes += data.size();
+    entry.type = stanza.getStanzaType();
+    switch (entry.type) {
+    case QXmppStanza::Message:
+        entry.message = static_cast<const QXmppMessage&>(stanza);
+        break;
+    case QXmppStanza::Iq:
+        entry.iq = static_cast<const QXmppIq&>(stanza);
+        break;
+    case QXmppStanza::Presence:
+        entry.presence = static_cast<const QXmppPresence&>(stanza);
+        break;
+    default:
+        break;
+    }
+    updateMemoryStats();
+}
+
+QXmppStreamManagementEntry QXmppStreamManagementPrivate::takeFirst()
 {
+    QXmppStreamManagementEntry &entry = at(0);
+    const QXmppStreamManagementEntry taken = entry;
+
+    entry.data.clear();
+    entry.type = QXmppStanza::Unkown;
+    entry.message = emptyMessage;
+    entry.iq = emptyIq;
+    entry.presence = emptyPresence;
+
+    outboundHead = (outboundHead + 1) & (outboundBuffer.size() - 1);
+    outboundCount--;
+    outboundBytes -= taken.data.size();
+    updateMemoryStats();
+    return taken;
+}
 
+void QXmppStreamManagementPrivate::updateMemoryStats()
+{
+#ifdef QXMPP_MEMORY_STATS
+    // the parsed copies of the stanzas are not accounted for
+    const qint64 bytes = outboundBuffer.capacity() * qint64(sizeof(QXmppStreamManagementEntry))
+        + outboundBytes;
+    QXmppMemoryStats::resize(QXmppMemoryStats::StreamManagement, memoryBytes, bytes);
+#endif
 }
 
 QXmppStreamManagement::QXmppStreamManagement(QObject *parent)
@@ -41,10 +201,18 @@ QXmppStreamManagement::QXmppStreamManagement(QObject *parent)
 {
 }
 
+QXmppStreamManagement::~QXmppStreamManagement()
+{
+    delete d;
+}
+
 void QXmppStreamManagement::enableSent()
 {
     d->outboundEnabled = true;
     d->outboundCounter = 0;
+    d->stanzasSinceRequest = 0;
+    d->bytesSinceRequest = 0;
+    d->requestPending = false;
 }
 
 void QXmppStreamManagement::enabledReceived(const QDomElement &element)
@@ -68,86 +236,147 @@ void QXmppStreamManagement::disable()
     d->inboundEnabled = false;
     d->outboundCounter = 0;
     d->outboundEnabled = false;
-    d->outboundBuffer.clear();
+    d->clearOutbound();
     d->resumeEnabled = false;
     d->resumeId.clear();
     d->resumeLocation.clear();
     d->resumming = false;
     d->lastHandleStanzaSent = 0;
+    d->stanzasSinceRequest = 0;
+    d->bytesSinceRequest = 0;
+    d->requestPending = false;
 }
 
 void QXmppStreamManagement::stanzaSent(const QXmppStanza &stanza)
+{
+    stanzaSent(stanza, helperToXmlData(stanza));
+}
+
+/// Records an outgoing stanza which was serialized as \a data.
+///
+/// The data is kept until the stanza is acknowledged, so that it can be
+/// resent without serializing the stanza again.
+
+void QXmppStreamManagement::stanzaSent(const QXmppStanza &stanza, const QByteArray &data)
 {
     d->outboundCounter++;
-    debug(QString("SM STANZA SENT outbound counter:%1").arg(QString::number(d->outboundCounter)));
-    switch(stanza.getStanzaType())
-    {
+    qxmpp_debug(QString("SM STANZA SENT outbound counter:%1").arg(QString::number(d->outboundCounter)));
+
+    // every stanza takes an entry, so that sequence numbers can be derived
+    // from the position in the buffer
+    d->push(stanza, data);
+    d->stanzasSinceRequest++;
+    d->bytesSinceRequest += data.size();
+}
+
+void QXmppStreamManagement::ackReceived(const QDomElement &element)
+{
+    const QString h = element.attribute("h");
+    qxmpp_debug(QString("SM ACK RECV h=%1 outbound count=%2").arg(h).arg(QString::number(d->outboundCounter)));
+    const int handled = h.toInt();
+
+    // the oldest unacknowledged stanza comes first
+    int sequence = d->outboundCounter - d->outboundCount + 1;
+    const int firstSequence = sequence;
+    while (d->outboundCount > 0 && sequence <= handled) {
+        const QXmppStreamManagementEntry entry = d->takeFirst();
+        acknowledge(entry, true);
+        qxmpp_debug(QString("SM h:%1 removed from the buffer").arg(sequence));
+        sequence++;
+    }
+    QXMPP_TRACEPOINT4(sm__ack, this, handled, sequence - firstSequence, d->outboundCount);
+
+    // measure the latency of our request
+    if (d->requestPending && handled >= d->requestSequence) {
+        const int latency = d->requestTime.elapsed();
+        d->requestPending = false;
+        if (d->smoothedLatency < 0)
+            d->smoothedLatency = latency;
+        else
+            d->smoothedLatency = (7 * d->smoothedLatency + latency) / 8;
+
+        int bucket = 0;
+        while (bucket < ackLatencyBucketCount && latency > ackLatencyBucketBounds[bucket])
+            ++bucket;
+        d->latencyHistogram[bucket]++;
+        QXmppMetrics::recordValue(ackLatencyHistogram, latency);
+        if (bucket < ackLatencyBucketCount)
+            updateCounter(QString("stream-management.ack-latency.%1").arg(ackLatencyBucketBounds[bucket]));
+        else
+            updateCounter("stream-management.ack-latency.inf");
+    }
+
+    emit setGauge("stream-management.unacked-count", d->outboundCount);
+    emit setGauge("stream-management.unacked-bytes", d->outboundBytes);
+}
+
+/// Sets the policy used to decide when to request acknowledgements.
+///
+/// \param stanzas the number of stanzas after which a request is due, or 0
+/// \param bytes the amount of data after which a request is due, or 0
+/// \param interval the interval in milliseconds after which unacknowledged
+/// stanzas cause a request, or 0
+/// \param adaptive whether to hold back requests while one is pending and
+/// stretch the interval to the measured latency
+
+void QXmppStreamManagement::setAckPolicy(int stanzas, int bytes, int interval, bool adaptive)
+{
+    d->ackStanzas = stanzas;
+    d->ackBytes = bytes;
+    d->ackInterval = interval;
+    d->ackAdaptive = adaptive;
+}
+
+/// Returns true if an acknowledgement should be requested.
+///
+/// \param intervalElapsed whether ackRequestInterval() has elapsed since
+/// the last request
+
+bool QXmppStreamManagement::isAckRequestDue(bool intervalElapsed) const
+{
+    if (!d->outboundCount)
+        return false;
+
+    if (d->ackAdaptive && d->requestPending &&
+        d->requestTime.elapsed() < qMax(4 * d->smoothedLatency, minimumStaleRequestTime))
+        return false;
+
+    return intervalElapsed ||
+           (d->ackStanzas > 0 && d->stanzasSinceRequest >= d->ackStanzas) ||
+           (d->ackBytes > 0 && d->bytesSinceRequest >= d->ackBytes);
+}
+
+/// Returns the interval in milliseconds after which unacknowledged stanzas
+/// cause a request, or 0 if timed requests are disabled.
+
+int QXmppStreamManagement::ackRequestInterval() const
+{
+    if (d->ackInterval <= 0)
+        return 0;
+    else if (d->ackAdaptive && d->smoothedLatency >= 0)
+        return qMax(d->ackInterval, 2 * d->smoothedLatency);
+    else
+        return d->ackInterval;
+}
+
+/// \cond
+void QXmppStreamManagement::acknowledge(const QXmppStreamManagementEntry &entry, bool ack)
+{
+    switch (entry.type) {
     case QXmppStanza::Message:
-    {
-        QXmppMessage *message = new QXmppMessage(static_cast<QXmppMessage const &>(stanza));
-        d->outboundBuffer.insert(d->outboundCounter, message);
+        emit messageAcknowledged(entry.message, ack);
         break;
-    }
     case QXmppStanza::Iq:
-    {
-        QXmppIq *iq = new QXmppIq(static_cast<QXmppIq const &>(stanza));
-        d->outboundBuffer.insert(d->outboundCounter, iq);
+        emit iqAcknowledged(entry.iq, ack);
         break;
-    }
     case QXmppStanza::Presence:
-    {
-        QXmppPresence *presence = new QXmppPresence(static_cast<QXmppPresence const &>(stanza));
-        d->outboundBuffer.insert(d->outboundCounter, presence);
+        emit presenceAcknowledged(entry.presence, ack);
         break;
-    }
     default:
         break;
     }
 }
-
-void QXmppStreamManagement::ackReceived(const QDomElement &element)
-{
-    const QString h = element.attribute("h");
-    debug(QString("SM ACK RECV h=%1 outbound count=%2").arg(h).arg(QString::number(d->outboundCounter)));
-    int handled = h.toInt();
-
-    QMapIterator <int, QXmppStanza*> i(d->outboundBuffer);
-    const QXmppStanza *stanza = NULL;
-    while (i.hasNext()) {
-        i.next();
-        if(i.key()<= handled)
-        {
-            stanza = i.value();
-            switch (stanza->getStanzaType())
-            {
-                case QXmppStanza::Message:
-                {
-                    QXmppMessage message(static_cast<QXmppMessage const &> (*stanza));
-                    emit messageAcknowledged(message, true);
-                    break;
-                }
-                case QXmppStanza::Iq:
-                {
-                    QXmppIq iq(static_cast<QXmppIq const &> (*stanza));
-                    emit iqAcknowledged(iq, true);
-                    break;
-                }
-                case QXmppStanza::Presence:
-                {
-                    QXmppPresence presence(static_cast<QXmppPresence const &>(*stanza));
-                    emit presenceAcknowledged(presence, true);
-                    break;
-                }
-                default:
-                    break;
-           }
-
-           d->outboundBuffer.remove(i.key());
-           delete stanza;
-           debug(QString("SM h:%1 removed from the buffer").arg(i.key()));
-       }
-    }
-}
+/// \endcond
 
 void QXmppStreamManagement::resumeSent()
 {
@@ -174,6 +403,25 @@ void QXmppStreamManagement::failedReceived(const QDomElement &element, QXmppStan
     d->resumming = false;
 }
 
+/// Handles a failed attempt to resume the session.
+///
+/// The session can no longer be resumed, and the stanzas which were not
+/// acknowledged are reported as such and dropped.
+
+void QXmppStreamManagement::resumeFailed()
+{
+    d->resumming = false;
+    d->resumeEnabled = false;
+    d->resumeId.clear();
+    d->resumeLocation.clear();
+
+    while (d->outboundCount > 0) {
+        const QXmppStreamManagementEntry entry = d->takeFirst();
+        acknowledge(entry, false);
+    }
+    d->clearOutbound();
+}
+
 void QXmppStreamManagement::stanzaHandled()
 {
     d->inboundCounter++;
@@ -201,6 +449,14 @@ void QXmppStreamManagement::ackToXml(QXmlStreamWriter *xmlStream)
 
 void QXmppStreamManagement::requestToXml(QXmlStreamWriter *xmlStream)
 {
+    d->stanzasSinceRequest = 0;
+    d->bytesSinceRequest = 0;
+    if (!d->requestPending) {
+        d->requestPending = true;
+        d->requestSequence = d->outboundCounter;
+        d->requestTime.start();
+    }
+
     xmlStream->writeStartElement("r");
     xmlStream->writeAttribute("xmlns",ns_stream_management);
     xmlStream->writeEndElement();
@@ -260,9 +516,82 @@ QString QXmppStreamManagement::resumeLocation() const
     return d->resumeLocation;
 }
 
+/// Returns the unacknowledged stanzas.
+///
+/// The returned pointers are only valid until the buffer is modified.
+
 QList<QXmppStanza*> QXmppStreamManagement::outBoundBuffer() const
 {
-   return d->outboundBuffer.values();
+    QList<QXmppStanza*> stanzas;
+    for (int i = 0; i < d->outboundCount; ++i) {
+        QXmppStreamManagementEntry &entry = d->at(i);
+        switch (entry.type) {
+        case QXmppStanza::Message:
+            stanzas << &entry.message;
+            break;
+        case QXmppStanza::Iq:
+            stanzas << &entry.iq;
+            break;
+        case QXmppStanza::Presence:
+            stanzas << &entry.presence;
+            break;
+        default:
+            break;
+        }
+    }
+    return stanzas;
+}
+
+/// Returns the number of unacknowledged stanzas.
+
+int QXmppStreamManagement::unacknowledgedCount() const
+{
+    return d->outboundCount;
+}
+
+/// Returns the size in bytes of the unacknowledged stanzas.
+
+qint64 QXmppStreamManagement::unacknowledgedBytes() const
+{
+    return d->outboundBytes;
+}
+
+/// Returns the smoothed latency of acknowledgement requests in
+/// milliseconds, or -1 if no request was answered yet.
+
+int QXmppStreamManagement::ackLatency() const
+{
+    return d->smoothedLatency;
+}
+
+/// Returns the number of answered acknowledgement requests per latency
+/// bucket. The last bucket counts requests slower than the last bound
+/// returned by ackLatencyBuckets().
+
+QList<int> QXmppStreamManagement::ackLatencyHistogram() const
+{
+    return d->latencyHistogram.toList();
+}
+
+/// Returns the upper bounds in milliseconds of the ack latency
+/// histogram's buckets.
+
+QList<int> QXmppStreamManagement::ackLatencyBuckets()
+{
+    QList<int> buckets;
+    for (int i = 0; i < ackLatencyBucketCount; ++i)
+        buckets << ackLatencyBucketBounds[i];
+    return buckets;
+}
+
+/// Returns the serialized data of the unacknowledged stanzas, oldest first.
+
+QList<QByteArray> QXmppStreamManagement::outboundData() const
+{
+    QList<QByteArray> data;
+    for (int i = 0; i < d->outboundCount; ++i)
+        data << d->at(i).data;
+    return data;
 }
 
 void QXmppStreamManagement::socketDisconnected()
@@ -270,41 +599,12 @@ void QXmppStreamManagement::socketDisconnected()
     // If resume is enabled the buffer is not emptied until the resume is attempted
     if(!d->resumeEnabled)
     {
-        QMapIterator <int, QXmppStanza*> i(d->outboundBuffer);
-        const QXmppStanza *stanza = NULL;
-        while (i.hasNext()) {
-            i.next();
-            stanza = i.value();
-            switch (stanza->getStanzaType())
-            {
-                case QXmppStanza::Message:
-                {
-                    QXmppMessage message(static_cast<QXmppMessage const &> (*stanza));
-                    emit messageAcknowledged(message, false);
-                    break;
-                }
-                case QXmppStanza::Iq:
-                {
-                    QXmppIq iq(static_cast<QXmppIq const &> (*stanza));
-                    emit iqAcknowledged(iq, false);
-                    break;
-                }
-                case QXmppStanza::Presence:
-                {
-                    QXmppPresence presence(static_cast<QXmppPresence const &>(*stanza));
-                    emit presenceAcknowledged(presence, false);
-                    break;
-                }
-                default:
-                    break;
-            }
-            d->outboundBuffer.remove(i.key());
-            delete stanza;
-            debug(QString("SM h:%1 removed from the buffer").arg(i.key()));
+        while (d->outboundCount > 0) {
+            const QXmppStreamManagementEntry entry = d->takeFirst();
+            acknowledge(entry, false);
         }
+        d->clearOutbound();
     }else{
         d->resumming = true;
     }
-
-
 }
@@ -34,6 +34,7 @@
 #include "QXmppStanza.h"
 #include "QList"
 
+class QXmppStreamManagementEntry;
 class QXmppStreamManagementPrivate;
 
 
@@ -46,6 +47,7 @@ class QXMPP_EXPORT QXmppStreamManagement : public QXmppLoggable
     Q_OBJECT
 public:
     QXmppStreamManagement(QObject* parent = 0);
+    ~QXmppStreamManagement();
 
     void enableSent();
     void enabledReceived(const QDomElement &element);
@@ -53,14 +55,20 @@ public:
     void disable();
 
     void stanzaSent(const QXmppStanza& stanza);
+    void stanzaSent(const QXmppStanza &stanza, const QByteArray &data);
     void ackReceived(const QDomElement &element);
 
     void resumeSent();
     void resumedReceived();
     void failedReceived(const QDomElement &element, QXmppStanza::Error::Condition &condition);
+    void resumeFailed();
 
     void stanzaHandled();
 
+    void setAckPolicy(int stanzas, int bytes, int interval, bool adaptive);
+    bool isAckRequestDue(bool intervalElapsed = false) const;
+    int ackRequestInterval() const;
+
     void enableToXml(QXmlStreamWriter *xmlStream, const bool resume);
     void ackToXml(QXmlStreamWriter *xmlStream);
     void requestToXml(QXmlStreamWriter *xmlStream);
@@ -79,6 +87,13 @@ public:
     QString resumeLocation() const;
 
     QList<QXmppStanza *> outBoundBuffer() const;
+    QList<QByteArray> outboundData() const;
+
+    int unacknowledgedCount() const;
+    qint64 unacknowledgedBytes() const;
+    int ackLatency() const;
+    QList<int> ackLatencyHistogram() const;
+    static QList<int> ackLatencyBuckets();
 
     void socketDisconnected();
 
@@ -93,6 +108,8 @@ signals:
     void iqAcknowledged(const QXmppIq&, const bool);
 
 private:
+    void acknowledge(const QXmppStreamManagementEntry &entry, bool ack);
+
     QXmppStreamManagementPrivate * const d;
 
 };
@@ -0,0 +1,696 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomDocument>
+#include <QHash>
+#include <QVector>
+#include <QXmlStreamReader>
+
+#ifdef QXMPP_MEMORY_STATS
+// estimated size of a DOM element, with its name and attribute nodes
+static const int estimatedElementSize = 128;
+#endif
+
+#include "QXmppMemoryStats_p.h"
+#include "QXmppRawStanza_p.h"
+#include "QXmppStreamParser_p.h"
+#include "QXmppStreamSplitter_p.h"
+
+class QXmppStreamParserPrivate
+{
+public:
+    // states of the raw byte scanner
+    enum ScanState
+    {
+        TextState,
+        TagOpenState,
+        StartTagState,
+        AttributeValueState,
+        EndTagState,
+        MarkupOpenState,
+        MarkupState,
+        CommentState,
+        CDataState,
+        ProcessingInstructionState
+    };
+
+    QXmppStreamParserPrivate();
+    QDomElement createElement();
+    QString intern(const QStringRef &ref);
+    QXmppStreamParser::Token readFramed();
+    void scan(const QByteArray &data);
+
+    QXmlStreamReader reader;
+
+    // names and namespaces seen on the stream, so that the strings
+    // of a stanza's DOM tree are shared instead of allocated
+    QVector<QString> strings;
+
+    // element being built and last completed element
+    QDomDocument document;
+    QDomElement current;
+    QDomElement element;
+    QXmppRawStanza rawStanza;
+    QXmppStreamParser::Token token;
+
+    // top-level elements for which no DOM tree is built
+    QStringList rawStanzaNames;
+    bool rawOnly;
+
+    // namespace declarations of the stream's root element, and the
+    // namespaces they declare by attribute name
+    QByteArray context;
+    QHash<QByteArray, QString> contextNamespaces;
+
+    // top-level elements are only framed by the byte scanner, which also
+    // reports whitespace and the end of the stream
+    bool framingOnly;
+    bool scanEnded;
+
+    int depth;
+    bool failed;
+    QXmppStreamParser::Error error;
+    int maximumElementSize;
+
+    // the raw byte scanner runs ahead of the reader and collects
+    // the bytes of each complete top-level element
+    QByteArray scanBuffer;
+    QList<QByteArray> scanQueue;
+    ScanState scanState;
+    int scanDepth;
+    int scanSize;
+    int scanMatch;
+    char scanQuote;
+    bool scanRecording;
+    bool scanSlash;
+
+#ifdef QXMPP_MEMORY_STATS
+    // elements of the stanza being parsed, and the memory accounted
+    // for the last stanza
+    int elementCount;
+    qint64 memoryBytes;
+#endif
+};
+
+QXmppStreamParserPrivate::QXmppStreamParserPrivate()
+    : token(QXmppStreamParser::NoToken)
+    , rawOnly(false)
+    , framingOnly(false)
+    , scanEnded(false)
+    , depth(0)
+    , failed(false)
+    , error(QXmppStreamParser::NoError)
+    , maximumElementSize(0)
+    , scanState(TextState)
+    , scanDepth(0)
+    , scanSize(0)
+    , scanMatch(0)
+    , scanQuote(0)
+    , scanRecording(false)
+    , scanSlash(false)
+#ifdef QXMPP_MEMORY_STATS
+    , elementCount(0)
+    , memoryBytes(0)
+#endif
+{
+}
+
+/// Creates a DOM element for the reader's current start element.
+
+QDomElement QXmppStreamParserPrivate::createElement()
+{
+    QDomElement element = document.createElementNS(
+        intern(reader.namespaceUri()),
+        intern(reader.name()));
+
+    foreach (const QXmlStreamAttribute &attr, reader.attributes()) {
+        if (attr.namespaceUri().isEmpty())
+            element.setAttribute(intern(attr.name()), attr.value().toString());
+        else
+            element.setAttributeNS(intern(attr.namespaceUri()),
+                                   intern(attr.qualifiedName()),
+                                   attr.value().toString());
+    }
+#ifdef QXMPP_MEMORY_STATS
+    elementCount++;
+#endif
+    return element;
+}
+
+/// Returns a string equal to \a ref, sharing the data of a previously
+/// returned string where possible.
+///
+/// Only a limited number of strings are remembered, so that a peer
+/// cannot make the table grow without bounds.
+
+QString QXmppStreamParserPrivate::intern(const QStringRef &ref)
+{
+    static const int maximumStrings = 128;
+
+    const int count = strings.size();
+    const QString *data = strings.constData();
+    for (int i = 0; i < count; ++i) {
+        if (data[i] == ref)
+            return data[i];
+    }
+
+    const QString string = ref.toString();
+    if (count < maximumStrings)
+        strings.append(string);
+    return string;
+}
+
+// Returns an attribute value as returned by QXmppStreamSplitter::attribute(),
+// with the predefined entities replaced.
+
+static QString unescapedValue(const QByteArray &value)
+{
+    if (!value.contains('&'))
+        return QString::fromUtf8(value);
+
+    QString text = QString::fromUtf8(value);
+    text.replace(QLatin1String("&lt;"), QLatin1String("<"));
+    text.replace(QLatin1String("&gt;"), QLatin1String(">"));
+    text.replace(QLatin1String("&quot;"), QLatin1String("\""));
+    text.replace(QLatin1String("&apos;"), QLatin1String("'"));
+    text.replace(QLatin1String("&amp;"), QLatin1String("&"));
+    return text;
+}
+
+/// Returns the next token found by the byte scanner once the stream's
+/// root element was read, for framingOnly mode.
+///
+/// The raw stanza's name and attributes are read from its start tag.
+
+QXmppStreamParser::Token QXmppStreamParserPrivate::readFramed()
+{
+    if (scanQueue.isEmpty()) {
+        if (!scanEnded)
+            return QXmppStreamParser::NoToken;
+        scanEnded = false;
+        depth = 0;
+        element = QDomElement();
+        token = QXmppStreamParser::StreamEndToken;
+        return token;
+    }
+
+    const QByteArray data = scanQueue.takeFirst();
+    if (data.isEmpty()) {
+        token = QXmppStreamParser::WhitespaceToken;
+        return token;
+    }
+
+    const QByteArray tag = data.left(QXmppStreamSplitter::markupEnd(data, 0));
+    const QByteArray name = QXmppStreamSplitter::tagName(tag);
+    const int colon = name.indexOf(':');
+    const QByteArray namespaceAttribute = colon < 0 ? QByteArray("xmlns") : "xmlns:" + name.left(colon);
+    const QString localName = QString::fromUtf8(name.mid(colon + 1));
+
+    rawStanza = QXmppRawStanza();
+    QXmppRawStanzaPrivate *raw = rawStanza.d.data();
+    raw->data = data;
+    raw->context = context;
+    raw->tagName = intern(QStringRef(&localName));
+    raw->namespaceUri = contextNamespaces.value(namespaceAttribute);
+    foreach (const QXmppStreamSplitter::Attribute &attribute, QXmppStreamSplitter::attributes(tag)) {
+        const QByteArray value = attribute.second.mid(1, attribute.second.size() - 2);
+        if (attribute.first == "from")
+            raw->from = unescapedValue(value);
+        else if (attribute.first == "id")
+            raw->id = unescapedValue(value);
+        else if (attribute.first == "to")
+            raw->to = unescapedValue(value);
+        else if (attribute.first == "type")
+            raw->type = unescapedValue(value);
+        else if (attribute.first == namespaceAttribute) {
+            const QString uri = unescapedValue(value);
+            raw->namespaceUri = intern(QStringRef(&uri));
+        }
+    }
+#ifdef QXMPP_MEMORY_STATS
+    QXmppMemoryStats::resize(QXmppMemoryStats::StanzaParsing, memoryBytes, raw->data.capacity());
+#endif
+    token = QXmppStreamParser::StanzaToken;
+    return token;
+}
+
+/// Scans raw \a data to find the byte range of each top-level element.
+///
+/// This only tracks the nesting of tags, checking that the data is
+/// well-formed is left to the reader.
+
+void QXmppStreamParserPrivate::scan(const QByteArray &data)
+{
+    if (error != QXmppStreamParser::NoError)
+        return;
+
+    const char *ptr = data.constData();
+    const int size = data.size();
+    int start = 0;
+
+    for (int i = 0; i < size; ++i) {
+        const char c = ptr[i];
+        bool completed = false;
+        bool discarded = false;
+
+        // enforce the size limit for the stream's root element and
+        // for top-level elements
+        if (scanDepth == 0 || scanRecording) {
+            if (maximumElementSize > 0 && ++scanSize > maximumElementSize) {
+                error = QXmppStreamParser::ElementTooLargeError;
+                scanBuffer.clear();
+                scanRecording = false;
+                return;
+            }
+        }
+
+        switch (scanState) {
+        case TextState:
+            if (c == '<') {
+                scanState = TagOpenState;
+                if (scanDepth == 1) {
+                    scanRecording = true;
+                    start = i;
+                }
+            } else if (framingOnly && scanDepth == 1 &&
+                       (scanQueue.isEmpty() || !scanQueue.last().isEmpty())) {
+                // whitespace between top-level elements
+                scanQueue << QByteArray();
+            }
+            break;
+        case TagOpenState:
+            if (c == '/') {
+                scanState = EndTagState;
+            } else if (c == '?') {
+                scanState = ProcessingInstructionState;
+                scanMatch = 0;
+            } else if (c == '!') {
+                scanState = MarkupOpenState;
+            } else {
+                scanState = StartTagState;
+                scanSlash = false;
+            }
+            break;
+        case StartTagState:
+            if (c == '\'' || c == '"') {
+                scanQuote = c;
+                scanState = AttributeValueState;
+            } else if (c == '>') {
+                scanState = TextState;
+                if (!scanSlash && !scanDepth++)
+                    scanSize = 0;
+                else if (scanDepth == 1)
+                    completed = true;
+            }
+            scanSlash = (c == '/');
+            break;
+        case AttributeValueState:
+            if (c == scanQuote)
+                scanState = StartTagState;
+            break;
+        case EndTagState:
+            if (c == '>') {
+                scanState = TextState;
+                scanDepth--;
+                if (scanDepth == 1) {
+                    completed = true;
+                } else if (scanDepth == 0) {
+                    discarded = true;
+                    scanEnded = framingOnly;
+                }
+            }
+            break;
+        case MarkupOpenState:
+            scanMatch = 0;
+            if (c == '-')
+                scanState = CommentState;
+            else if (c == '[')
+                scanState = CDataState;
+            else
+                scanState = MarkupState;
+            break;
+        case MarkupState:
+            if (c == '>') {
+                scanState = TextState;
+                discarded = (scanDepth == 1);
+            }
+            break;
+        case CommentState:
+            if (c == '>' && scanMatch >= 2) {
+                scanState = TextState;
+                discarded = (scanDepth == 1);
+            }
+            scanMatch = (c == '-') ? scanMatch + 1 : 0;
+            break;
+        case CDataState:
+            if (c == '>' && scanMatch >= 2)
+                scanState = TextState;
+            scanMatch = (c == ']') ? scanMatch + 1 : 0;
+            break;
+        case ProcessingInstructionState:
+            if (c == '>' && scanMatch >= 1) {
+                scanState = TextState;
+                discarded = (scanDepth == 1);
+            }
+            scanMatch = (c == '?') ? scanMatch + 1 : 0;
+            break;
+        }
+
+        if (completed) {
+            scanBuffer.append(ptr + start, i + 1 - start);
+            scanQueue << scanBuffer;
+        }
+        if (completed || discarded) {
+            scanBuffer.clear();
+            scanRecording = false;
+            scanSize = 0;
+        }
+    }
+
+    if (scanRecording)
+        scanBuffer.append(ptr + start, size - start);
+}
+
+/// Constructs a new stream parser.
+
+QXmppStreamParser::QXmppStreamParser()
+    : d(new QXmppStreamParserPrivate)
+{
+}
+
+/// Destroys the stream parser.
+
+QXmppStreamParser::~QXmppStreamParser()
+{
+#ifdef QXMPP_MEMORY_STATS
+    QXmppMemoryStats::resize(QXmppMemoryStats::StanzaParsing, d->memoryBytes, 0);
+#endif
+    delete d;
+}
+
+/// Adds more \a data for the parser to read.
+
+void QXmppStreamParser::addData(const QByteArray &data)
+{
+    d->scan(data);
+
+    // in framingOnly mode, the reader only reads the stream's root element
+    if (!d->framingOnly || d->depth == 0)
+        d->reader.addData(data);
+}
+
+/// Resets the parser's state, for instance when a new stream is started.
+
+void QXmppStreamParser::clear()
+{
+    d->reader.clear();
+    d->document = QDomDocument();
+    d->current = QDomElement();
+    d->element = QDomElement();
+    d->rawStanza = QXmppRawStanza();
+    d->token = NoToken;
+    d->rawOnly = false;
+    d->context.clear();
+    d->contextNamespaces.clear();
+    d->scanEnded = false;
+    d->depth = 0;
+    d->failed = false;
+    d->error = NoError;
+
+    d->scanBuffer.clear();
+    d->scanQueue.clear();
+    d->scanState = QXmppStreamParserPrivate::TextState;
+    d->scanDepth = 0;
+    d->scanSize = 0;
+    d->scanMatch = 0;
+    d->scanRecording = false;
+    d->scanSlash = false;
+
+#ifdef QXMPP_MEMORY_STATS
+    d->elementCount = 0;
+    QXmppMemoryStats::resize(QXmppMemoryStats::StanzaParsing, d->memoryBytes, 0);
+#endif
+}
+
+/// Returns the number of bytes held by the parser's buffers, the bytes of
+/// the elements which have been received but not read yet.
+
+qint64 QXmppStreamParser::bufferSize() const
+{
+    qint64 size = d->scanBuffer.capacity();
+    foreach (const QByteArray &data, d->scanQueue)
+        size += data.size();
+    return size;
+}
+
+/// Returns the current element depth, the stream's root element
+/// being at depth 1.
+
+int QXmppStreamParser::depth() const
+{
+    return d->depth;
+}
+
+/// Returns the element for the last StreamStartToken or StanzaToken.
+///
+/// For a StreamStartToken, the element has no children.
+
+QDomElement QXmppStreamParser::element() const
+{
+    if (d->token == StanzaToken)
+        return d->rawStanza.element();
+    return d->element;
+}
+
+/// Returns a description of the last error.
+
+QString QXmppStreamParser::errorString() const
+{
+    if (d->error == ElementTooLargeError)
+        return QLatin1String("Element exceeds the maximum size");
+    return d->reader.errorString();
+}
+
+/// Returns the type of the last error.
+
+QXmppStreamParser::Error QXmppStreamParser::error() const
+{
+    return d->error;
+}
+
+/// Returns the maximum size in bytes of the stream's root element start
+/// tag and of each top-level element, or 0 if there is no limit.
+
+int QXmppStreamParser::maximumElementSize() const
+{
+    return d->maximumElementSize;
+}
+
+/// Sets the maximum size in bytes of the stream's root element start
+/// tag and of each top-level element.
+///
+/// If an element exceeds this size, readNext() returns ErrorToken and
+/// error() returns ElementTooLargeError. Set \a size to 0 to disable
+/// the limit, which is the default.
+
+void QXmppStreamParser::setMaximumElementSize(int size)
+{
+    d->maximumElementSize = size;
+}
+
+/// Returns the raw stanza for the last StanzaToken.
+
+QXmppRawStanza QXmppStreamParser::rawStanza() const
+{
+    if (d->token == StanzaToken)
+        return d->rawStanza;
+    return QXmppRawStanza();
+}
+
+/// Returns true if the top-level elements are only framed, without being
+/// read by an XML reader.
+
+bool QXmppStreamParser::isFramingOnly() const
+{
+    return d->framingOnly;
+}
+
+/// Sets whether the top-level elements are only framed, without being
+/// read by an XML reader.
+///
+/// The stream's root element is still read as usual. The top-level
+/// elements are then delimited by a scan of their bytes, which only tracks
+/// the nesting of tags, and their name and attributes are read from their
+/// start tag. No DOM tree is built, and checking that the elements are
+/// well-formed is left to QXmppRawStanza::element(), which returns a null
+/// element if they are not.
+///
+/// This makes the parser much cheaper, so that building the DOM trees can
+/// be moved to other threads. The mode should be set before any data is
+/// added.
+///
+/// \param framingOnly
+
+void QXmppStreamParser::setFramingOnly(bool framingOnly)
+{
+    d->framingOnly = framingOnly;
+}
+
+/// Returns the tag names of the top-level elements for which no DOM tree
+/// is built while parsing.
+
+QStringList QXmppStreamParser::rawStanzaNames() const
+{
+    return d->rawStanzaNames;
+}
+
+/// Sets the tag names of the top-level elements for which no DOM tree
+/// is built while parsing.
+///
+/// The DOM tree for such elements is only built if element() is called.
+///
+/// \param names
+
+void QXmppStreamParser::setRawStanzaNames(const QStringList &names)
+{
+    d->rawStanzaNames = names;
+}
+
+/// Reads the next token from the data received so far.
+///
+/// If NoToken is returned, more data needs to be added with addData().
+
+QXmppStreamParser::Token QXmppStreamParser::readNext()
+{
+    if (d->error == ElementTooLargeError)
+        d->failed = true;
+    d->token = d->failed ? ErrorToken : NoToken;
+    if (d->failed)
+        return d->token;
+    if (d->framingOnly && d->depth > 0)
+        return d->readFramed();
+
+    for (;;) {
+        switch (d->reader.readNext()) {
+        case QXmlStreamReader::StartElement:
+            if (d->depth == 0) {
+                // stream root element
+                d->context.clear();
+                foreach (const QXmlStreamNamespaceDeclaration &ns, d->reader.namespaceDeclarations()) {
+                    QByteArray uri = ns.namespaceUri().toString().toUtf8();
+                    uri.replace('&', "&amp;");
+                    uri.replace('\'', "&apos;");
+                    const QByteArray name = ns.prefix().isEmpty() ? QByteArray("xmlns") : "xmlns:" + ns.prefix().toString().toUtf8();
+                    d->context += " " + name + "='" + uri + "'";
+                    d->contextNamespaces.insert(name, ns.namespaceUri().toString());
+                }
+
+                d->document = QDomDocument();
+                d->element = d->createElement();
+                d->depth++;
+                d->token = StreamStartToken;
+                return d->token;
+            } else if (d->depth == 1) {
+                // top-level element
+                const QXmlStreamAttributes attributes = d->reader.attributes();
+                d->rawStanza = QXmppRawStanza();
+#ifdef QXMPP_MEMORY_STATS
+                d->elementCount = 0;
+                QXmppMemoryStats::resize(QXmppMemoryStats::StanzaParsing, d->memoryBytes, 0);
+#endif
+                QXmppRawStanzaPrivate *raw = d->rawStanza.d.data();
+                raw->context = d->context;
+                raw->tagName = d->intern(d->reader.name());
+                raw->namespaceUri = d->intern(d->reader.namespaceUri());
+                raw->from = attributes.value(QLatin1String("from")).toString();
+                raw->id = attributes.value(QLatin1String("id")).toString();
+                raw->to = attributes.value(QLatin1String("to")).toString();
+                raw->type = attributes.value(QLatin1String("type")).toString();
+
+                d->rawOnly = d->rawStanzaNames.contains(raw->tagName);
+                if (!d->rawOnly) {
+                    d->document = QDomDocument();
+                    d->current = d->createElement();
+                    d->document.appendChild(d->current);
+                }
+            } else if (!d->rawOnly) {
+                QDomElement child = d->createElement();
+                d->current.appendChild(child);
+                d->current = child;
+            }
+            d->depth++;
+            break;
+
+        case QXmlStreamReader::EndElement:
+            d->depth--;
+            if (d->depth == 0) {
+                d->element = QDomElement();
+                d->token = StreamEndToken;
+                return d->token;
+            } else if (d->depth == 1) {
+                QXmppRawStanzaPrivate *raw = d->rawStanza.d.data();
+                Q_ASSERT(!d->scanQueue.isEmpty());
+                if (!d->scanQueue.isEmpty())
+                    raw->data = d->scanQueue.takeFirst();
+                if (!d->rawOnly) {
+                    // the document is kept alive by the raw stanza
+                    raw->document = d->document;
+                    raw->element = d->current;
+                }
+                d->current = QDomElement();
+#ifdef QXMPP_MEMORY_STATS
+                QXmppMemoryStats::resize(QXmppMemoryStats::StanzaParsing, d->memoryBytes,
+                                         raw->data.capacity() + qint64(d->elementCount) * estimatedElementSize);
+#endif
+                d->token = StanzaToken;
+                return d->token;
+            } else if (!d->rawOnly) {
+                d->current = d->current.parentNode().toElement();
+            }
+            break;
+
+        case QXmlStreamReader::Characters:
+            if (d->depth > 1) {
+                if (!d->rawOnly && !d->reader.isWhitespace())
+                    d->current.appendChild(d->document.createTextNode(d->reader.text().toString()));
+            } else if (d->depth == 1 && d->reader.isWhitespace()) {
+                d->token = WhitespaceToken;
+                return d->token;
+            }
+            break;
+
+        case QXmlStreamReader::Invalid:
+            if (d->reader.error() == QXmlStreamReader::NoError ||
+                d->reader.error() == QXmlStreamReader::PrematureEndOfDocumentError)
+                return NoToken;
+            d->failed = true;
+            d->error = NotWellFormedError;
+            d->token = ErrorToken;
+            return d->token;
+
+        default:
+            // document start / end, comments, processing instructions
+            break;
+        }
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSTREAMPARSER_P_H
+#define QXMPPSTREAMPARSER_P_H
+
+#include <QByteArray>
+#include <QDomElement>
+#include <QStringList>
+
+#include "QXmppRawStanza.h"
+
+class QXmppStreamParserPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppStreamParser class is an incremental parser for XMPP streams.
+///
+/// Data is fed to the parser as it arrives using addData(), and readNext()
+/// returns each top-level element of the stream as soon as its end tag has
+/// been received. The parser keeps its state across calls, so each byte of
+/// input is only parsed once.
+///
+/// The original bytes of each top-level element are available through
+/// rawStanza(). For the element names given to setRawStanzaNames(), no DOM
+/// tree is built while parsing. In framingOnly mode, the top-level elements
+/// are only delimited, see setFramingOnly().
+
+class QXMPP_AUTOTEST_EXPORT QXmppStreamParser
+{
+public:
+    /// This enum describes the tokens returned by readNext().
+    enum Token
+    {
+        NoToken = 0,        ///< More data is needed.
+        StreamStartToken,   ///< The stream's root element was opened.
+        StanzaToken,        ///< A top-level element was completed.
+        WhitespaceToken,    ///< Whitespace was received between stanzas.
+        StreamEndToken,     ///< The stream's root element was closed.
+        ErrorToken          ///< The stream is not well-formed or too large.
+    };
+
+    /// This enum describes the errors reported by error().
+    enum Error
+    {
+        NoError = 0,            ///< No error occurred.
+        NotWellFormedError,     ///< The stream is not well-formed XML.
+        ElementTooLargeError    ///< An element exceeds maximumElementSize().
+    };
+
+    QXmppStreamParser();
+    ~QXmppStreamParser();
+
+    void addData(const QByteArray &data);
+    void clear();
+
+    qint64 bufferSize() const;
+    int depth() const;
+    QDomElement element() const;
+    Error error() const;
+    QString errorString() const;
+    QXmppRawStanza rawStanza() const;
+
+    bool isFramingOnly() const;
+    void setFramingOnly(bool framingOnly);
+
+    QStringList rawStanzaNames() const;
+    void setRawStanzaNames(const QStringList &names);
+
+    int maximumElementSize() const;
+    void setMaximumElementSize(int size);
+
+    Token readNext();
+
+private:
+    Q_DISABLE_COPY(QXmppStreamParser)
+    QXmppStreamParserPrivate * const d;
+};
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <ctype.h>
+
+#include "QXmppConstants.h"
+#include "QXmppStreamSplitter_p.h"
+
+static bool isNameEnd(char c)
+{
+    return isspace(uchar(c)) || c == '/' || c == '>' || c == '=';
+}
+
+class QXmppStreamSplitterPrivate
+{
+public:
+    QXmppStreamSplitterPrivate();
+    QByteArray topLevelTag(const QByteArray &tag, const QByteArray &name) const;
+
+    // data which was not split yet
+    QByteArray buffer;
+    int position;
+
+    // the top-level element being split, and the last token's data
+    QByteArray element;
+    QByteArray data;
+
+    QByteArray streamNamespace;
+    int depth;
+};
+
+QXmppStreamSplitterPrivate::QXmppStreamSplitterPrivate()
+    : position(0)
+    , streamNamespace(ns_client.latin1())
+    , depth(0)
+{
+}
+
+// Returns the start tag of a top-level element, declaring the namespaces
+// which it would otherwise inherit from the stream header.
+
+QByteArray QXmppStreamSplitterPrivate::topLevelTag(const QByteArray &tag, const QByteArray &name) const
+{
+    QByteArray declaration;
+    if (name.startsWith("stream:")) {
+        if (!tag.contains(" xmlns:stream="))
+            declaration = " xmlns:stream='" + QByteArray(ns_stream.latin1()) + "'";
+    } else if (!name.contains(':') && !tag.contains(" xmlns=")) {
+        declaration = " xmlns='" + streamNamespace + "'";
+    }
+    if (declaration.isEmpty())
+        return tag;
+
+    QByteArray result = tag;
+    result.insert(1 + name.size(), declaration);
+    return result;
+}
+
+/// Constructs a new stream splitter.
+
+QXmppStreamSplitter::QXmppStreamSplitter()
+    : d(new QXmppStreamSplitterPrivate)
+{
+}
+
+/// Destroys the stream splitter.
+
+QXmppStreamSplitter::~QXmppStreamSplitter()
+{
+    delete d;
+}
+
+/// Adds data written to the stream.
+///
+/// \param data
+/// \param size
+
+void QXmppStreamSplitter::addData(const char *data, int size)
+{
+    d->buffer.append(data, size);
+}
+
+/// Discards the buffered data and resets the splitter's state.
+
+void QXmppStreamSplitter::clear()
+{
+    d->buffer.clear();
+    d->position = 0;
+    d->element.clear();
+    d->data.clear();
+    d->streamNamespace = QByteArray(ns_client.latin1());
+    d->depth = 0;
+}
+
+/// Returns the number of bytes which were added but not returned yet.
+
+int QXmppStreamSplitter::bufferSize() const
+{
+    return d->buffer.size() - d->position + d->element.size();
+}
+
+/// Returns the stream header's start tag for a StreamStartToken, or the
+/// element for an ElementToken.
+
+QByteArray QXmppStreamSplitter::data() const
+{
+    return d->data;
+}
+
+/// Returns the next token, or NoToken if more data is needed.
+
+QXmppStreamSplitter::Token QXmppStreamSplitter::readNext()
+{
+    d->data.clear();
+
+    const int size = d->buffer.size();
+    while (d->position < size) {
+        const char *buffer = d->buffer.constData();
+        const int pos = d->position;
+        if (buffer[pos] != '<') {
+            // whitespace between top-level elements is dropped
+            int next = d->buffer.indexOf('<', pos);
+            if (next < 0)
+                next = size;
+            if (d->depth > 1)
+                d->element.append(buffer + pos, next - pos);
+            d->position = next;
+            continue;
+        }
+
+        const int end = markupEnd(d->buffer, pos);
+        if (end < 0)
+            break;
+        const QByteArray markup = d->buffer.mid(pos, end - pos);
+        d->position = end;
+
+        if (markup[1] == '?' || markup[1] == '!') {
+            // XML declaration, comments and CDATA sections
+            if (d->depth > 1)
+                d->element += markup;
+        } else if (markup[1] == '/') {
+            if (d->depth <= 1) {
+                d->depth = 0;
+                return StreamEndToken;
+            }
+            d->element += markup;
+            if (--d->depth == 1) {
+                d->data = d->element;
+                d->element.clear();
+                return ElementToken;
+            }
+        } else {
+            const QByteArray name = tagName(markup);
+            const bool empty = markup.endsWith("/>");
+            if (d->depth <= 1 && name == "stream:stream") {
+                // the stream may be restarted
+                const QByteArray streamNamespace = attribute(markup, "xmlns");
+                if (!streamNamespace.isEmpty())
+                    d->streamNamespace = streamNamespace;
+                d->depth = 1;
+                d->data = markup;
+                return StreamStartToken;
+            } else if (d->depth <= 1) {
+                d->element = d->topLevelTag(markup, name);
+                if (empty) {
+                    d->depth = 1;
+                    d->data = d->element;
+                    d->element.clear();
+                    return ElementToken;
+                }
+                d->depth = 2;
+            } else {
+                d->element += markup;
+                if (!empty)
+                    ++d->depth;
+            }
+        }
+    }
+
+    // release the data which was split
+    d->buffer.remove(0, d->position);
+    d->position = 0;
+    return NoToken;
+}
+
+/// Returns the value of a start tag's attribute, without its quotes but
+/// still escaped, or an empty array if the attribute is not present.
+///
+/// \param tag
+/// \param name
+
+QByteArray QXmppStreamSplitter::attribute(const QByteArray &tag, const QByteArray &name)
+{
+    foreach (const Attribute &attribute, attributes(tag)) {
+        if (attribute.first == name)
+            return attribute.second.mid(1, attribute.second.size() - 2);
+    }
+    return QByteArray();
+}
+
+/// Returns the attributes of a start tag, with their values still quoted
+/// and escaped.
+///
+/// \param tag
+
+QList<QXmppStreamSplitter::Attribute> QXmppStreamSplitter::attributes(const QByteArray &tag)
+{
+    QList<Attribute> attributes;
+    const int size = tag.size();
+    int pos = 1;
+    while (pos < size && !isNameEnd(tag[pos]))
+        ++pos;
+    for (;;) {
+        while (pos < size && isspace(uchar(tag[pos])))
+            ++pos;
+        const int nameStart = pos;
+        while (pos < size && !isNameEnd(tag[pos]))
+            ++pos;
+        if (pos == nameStart)
+            break;
+        const QByteArray name = tag.mid(nameStart, pos - nameStart);
+        while (pos < size && isspace(uchar(tag[pos])))
+            ++pos;
+        if (pos >= size || tag[pos] != '=')
+            break;
+        ++pos;
+        while (pos < size && isspace(uchar(tag[pos])))
+            ++pos;
+        if (pos >= size || (tag[pos] != '\'' && tag[pos] != '"'))
+            break;
+        const int valueEnd = tag.indexOf(tag[pos], pos + 1);
+        if (valueEnd < 0)
+            break;
+        attributes << qMakePair(name, tag.mid(pos, valueEnd + 1 - pos));
+        pos = valueEnd + 1;
+    }
+    return attributes;
+}
+
+/// Returns the name of a start tag, including its prefix.
+///
+/// \param tag
+
+QByteArray QXmppStreamSplitter::tagName(const QByteArray &tag)
+{
+    int pos = 1;
+    while (pos < tag.size() && !isNameEnd(tag[pos]))
+        ++pos;
+    return tag.mid(1, pos - 1);
+}
+
+/// Returns the position following the markup which starts at \a pos, or
+/// -1 if the markup is incomplete.
+///
+/// \param data
+/// \param pos
+
+int QXmppStreamSplitter::markupEnd(const QByteArray &data, int pos)
+{
+    const char *markup = data.constData() + pos;
+    const int available = data.size() - pos;
+    if (available < 2)
+        return -1;
+
+    // processing instructions, comments and CDATA sections
+    const char *terminator = 0;
+    int skip = 0;
+    if (markup[1] == '?') {
+        terminator = "?>";
+        skip = 2;
+    } else if (markup[1] == '!') {
+        if (available < 9)
+            return -1;
+        if (!qstrncmp(markup, "<!--", 4)) {
+            terminator = "-->";
+            skip = 4;
+        } else if (!qstrncmp(markup, "<![CDATA[", 9)) {
+            terminator = "]]>";
+            skip = 9;
+        }
+    }
+    if (terminator) {
+        const int end = data.indexOf(terminator, pos + skip);
+        return end < 0 ? -1 : end + qstrlen(terminator);
+    }
+
+    // tags, where '>' may appear in attribute values
+    char quote = 0;
+    for (int i = pos + 1; i < data.size(); ++i) {
+        const char c = data.at(i);
+        if (quote) {
+            if (c == quote)
+                quote = 0;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '>') {
+            return i + 1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPSTREAMSPLITTER_P_H
+#define QXMPPSTREAMSPLITTER_P_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+
+#include "QXmppGlobal.h"
+
+class QXmppStreamSplitterPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmpp transports which do not carry the XMPP stream as is.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppStreamSplitter class splits an outgoing XMPP stream into its
+/// header, its top-level elements and its footer, without parsing it.
+///
+/// It is used by transports such as WebSocket and BOSH, which send each
+/// top-level element on its own. As the elements no longer inherit the
+/// namespaces declared by the stream header, these namespaces are declared
+/// on each element's start tag. Whitespace between top-level elements is
+/// dropped.
+///
+/// The stream is expected to be well-formed, as it is written by QXmpp
+/// itself.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStreamSplitter
+{
+public:
+    /// This enum describes the tokens returned by readNext().
+    enum Token
+    {
+        NoToken = 0,        ///< More data is needed.
+        StreamStartToken,   ///< The stream header was written.
+        ElementToken,       ///< A top-level element was completed.
+        StreamEndToken      ///< The stream footer was written.
+    };
+
+    typedef QPair<QByteArray, QByteArray> Attribute;
+
+    QXmppStreamSplitter();
+    ~QXmppStreamSplitter();
+
+    void addData(const char *data, int size);
+    void clear();
+
+    int bufferSize() const;
+    QByteArray data() const;
+    Token readNext();
+
+    static QByteArray attribute(const QByteArray &tag, const QByteArray &name);
+    static QList<Attribute> attributes(const QByteArray &tag);
+    static int markupEnd(const QByteArray &data, int pos);
+    static QByteArray tagName(const QByteArray &tag);
+
+private:
+    Q_DISABLE_COPY(QXmppStreamSplitter)
+    QXmppStreamSplitterPrivate * const d;
+};
+
+#endif
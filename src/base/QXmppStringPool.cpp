@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include "QXmppStringPool_p.h"
+
+Q_GLOBAL_STATIC(QXmppStringPool, stringPool)
+
+QXmppStringPool::QXmppStringPool()
+    : m_enabled(0)
+    , m_capacity(8192)
+{
+}
+
+/// Returns true if values are interned.
+
+bool QXmppStringPool::isEnabled() const
+{
+    return m_enabled.fetchAndAddOrdered(0) != 0;
+}
+
+/// Sets whether values are interned.
+///
+/// Disabling the pool does not release the values it holds, see clear().
+///
+/// \param enabled
+
+void QXmppStringPool::setEnabled(bool enabled)
+{
+    m_enabled.fetchAndStoreOrdered(enabled ? 1 : 0);
+}
+
+/// Returns the maximum number of values the pool holds.
+
+int QXmppStringPool::capacity() const
+{
+    QReadLocker locker(&m_lock);
+    return m_capacity;
+}
+
+/// Sets the maximum number of values the pool holds.
+///
+/// \param capacity
+
+void QXmppStringPool::setCapacity(int capacity)
+{
+    QWriteLocker locker(&m_lock);
+    m_capacity = qMax(0, capacity);
+}
+
+/// Returns the number of values in the pool.
+
+int QXmppStringPool::size() const
+{
+    QReadLocker locker(&m_lock);
+    return m_strings.size() + m_bytes.size();
+}
+
+/// Releases the values in the pool. Stanzas which hold them keep their
+/// copy.
+
+void QXmppStringPool::clear()
+{
+    QWriteLocker locker(&m_lock);
+    m_strings.clear();
+    m_bytes.clear();
+}
+
+/// Returns the pooled copy of \a value, or \a value itself if the pool is
+/// disabled or full.
+
+QString QXmppStringPool::intern(const QString &value)
+{
+    if (value.isEmpty() || !isEnabled())
+        return value;
+
+    {
+        QReadLocker locker(&m_lock);
+        QSet<QString>::const_iterator it = m_strings.constFind(value);
+        if (it != m_strings.constEnd())
+            return *it;
+    }
+
+    QWriteLocker locker(&m_lock);
+    QSet<QString>::const_iterator it = m_strings.constFind(value);
+    if (it != m_strings.constEnd())
+        return *it;
+    if (m_strings.size() + m_bytes.size() < m_capacity)
+        m_strings.insert(value);
+    return value;
+}
+
+/// Returns the pooled copy of \a value, or \a value itself if the pool is
+/// disabled or full.
+
+QByteArray QXmppStringPool::intern(const QByteArray &value)
+{
+    if (value.isEmpty() || !isEnabled())
+        return value;
+
+    {
+        QReadLocker locker(&m_lock);
+        QSet<QByteArray>::const_iterator it = m_bytes.constFind(value);
+        if (it != m_bytes.constEnd())
+            return *it;
+    }
+
+    QWriteLocker locker(&m_lock);
+    QSet<QByteArray>::const_iterator it = m_bytes.constFind(value);
+    if (it != m_bytes.constEnd())
+        return *it;
+    if (m_strings.size() + m_bytes.size() < m_capacity)
+        m_bytes.insert(value);
+    return value;
+}
+
+/// Returns the pool used when parsing stanzas.
+
+QXmppStringPool *QXmppStringPool::instance()
+{
+    return stringPool();
+}
+
+/// Interns \a value in the pool used when parsing stanzas.
+
+QString QXmppStringPool::shared(const QString &value)
+{
+    QXmppStringPool *pool = stringPool();
+    return pool ? pool->intern(value) : value;
+}
+
+/// Interns \a value in the pool used when parsing stanzas.
+
+QByteArray QXmppStringPool::shared(const QByteArray &value)
+{
+    QXmppStringPool *pool = stringPool();
+    return pool ? pool->intern(value) : value;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPSTRINGPOOL_P_H
+#define QXMPPSTRINGPOOL_P_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStanza classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppStringPool class interns the values which many stanzas carry
+/// verbatim, such as entity capabilities or status messages, so that the
+/// stanzas kept in memory share a single copy of each.
+///
+/// The pool is disabled by default, in which case values are returned as
+/// they are. Once it holds capacity() values, new values are no longer
+/// pooled, so that high-cardinality values cannot make it grow without
+/// bounds.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStringPool
+{
+public:
+    QXmppStringPool();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    int capacity() const;
+    void setCapacity(int capacity);
+
+    int size() const;
+    void clear();
+
+    QString intern(const QString &value);
+    QByteArray intern(const QByteArray &value);
+
+    static QXmppStringPool *instance();
+    static QString shared(const QString &value);
+    static QByteArray shared(const QByteArray &value);
+
+private:
+    mutable QAtomicInt m_enabled;
+    int m_capacity;
+    mutable QReadWriteLock m_lock;
+    QSet<QString> m_strings;
+    QSet<QByteArray> m_bytes;
+};
+
+#endif
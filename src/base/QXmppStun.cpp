@@ -21,22 +21,37 @@
  *
  */
 
-#define QXMPP_DEBUG_STUN
-
 #include <QCryptographicHash>
 #include <QDataStream>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QHostInfo>
 #include <QNetworkInterface>
 #include <QUdpSocket>
 #include <QTimer>
+#include <QtEndian>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
 
 #include "QXmppStun_p.h"
+#include "QXmppTracepoints_p.h"
 #include "QXmppUtils.h"
 
 #define STUN_ID_SIZE 12
 #define STUN_RTO_INTERVAL 500
 #define STUN_RTO_MAX      7
 
+// consent freshness, see RFC 7675
+#define CONSENT_INTERVAL  5000
+
+// batched reception of UDP datagrams
+#define UDP_BATCH_SIZE    16
+#define UDP_SLOT_SIZE     4096
+
 static const quint32 STUN_MAGIC = 0x2112A442;
 static const quint16 STUN_HEADER = 20;
 static const quint8 STUN_IPV4 = 0x01;
@@ -763,10 +778,12 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             quint32 fingerprint;
             stream >> fingerprint;
 
-            // check CRC32
-            QByteArray copy = buffer.left(STUN_HEADER + done);
-            setBodyLength(copy, done + 8);
-            const quint32 expected = QXmppUtils::generateCrc32(copy) ^ 0x5354554eL;
+            // check CRC32, over a header whose length ends at the fingerprint
+            QByteArray header = buffer.left(STUN_HEADER);
+            setBodyLength(header, done + 8);
+            quint32 expected = QXmppUtils::generateCrc32(header);
+            expected = QXmppUtils::updateCrc32(expected, QByteArray::fromRawData(buffer.constData() + STUN_HEADER, done));
+            expected ^= 0x5354554eL;
             if (fingerprint != expected)
             {
                 *errors << QLatin1String("Bad fingerprint");
@@ -813,7 +830,10 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
 
 QByteArray QXmppStunMessage::encode(const QByteArray &key, bool addFingerprint) const
 {
+    // connectivity checks and TURN requests fit in this size, which
+    // avoids growing the buffer attribute by attribute
     QByteArray buffer;
+    buffer.reserve(256 + m_data.size());
     QDataStream stream(&buffer, QIODevice::WriteOnly);
 
     // encode STUN header
@@ -997,19 +1017,16 @@ quint16 QXmppStunMessage::peekType(const QByteArray &buffer, quint32 &cookie, QB
     if (buffer.size() < STUN_HEADER)
         return 0;
 
-    // parse STUN header
-    QDataStream stream(buffer);
-    quint16 type;
-    quint16 length;
-    stream >> type;
-    stream >> length;
-    stream >> cookie;
-
-    if (length != buffer.size() - STUN_HEADER)
+    // parse STUN header in place, the two most significant bits
+    // of a STUN message are always zero
+    const uchar *data = reinterpret_cast<const uchar*>(buffer.constData());
+    const quint16 type = qFromBigEndian<quint16>(data);
+    const quint16 length = qFromBigEndian<quint16>(data + 2);
+    if ((type & 0xC000) || length != buffer.size() - STUN_HEADER)
         return 0;
 
-    id.resize(STUN_ID_SIZE);
-    stream.readRawData(id.data(), id.size());
+    cookie = qFromBigEndian<quint32>(data + 4);
+    id = QByteArray(buffer.constData() + 8, STUN_ID_SIZE);
     return type;
 }
 
@@ -1179,6 +1196,7 @@ QXmppTurnAllocation::QXmppTurnAllocation(QObject *parent)
     m_relayedPort(0),
     m_turnPort(0),
     m_channelNumber(0x4000),
+    m_lastChannel(0),
     m_lifetime(600),
     m_state(UnconnectedState)
 {
@@ -1248,6 +1266,7 @@ void QXmppTurnAllocation::disconnectFromHost()
 
     // clear channels and any outstanding transactions
     m_channels.clear();
+    m_lastChannel = 0;
     foreach (QXmppStunTransaction *transaction, m_transactions)
         delete transaction;
     m_transactions.clear();
@@ -1303,13 +1322,18 @@ void QXmppTurnAllocation::handleDatagram(const QByteArray &buffer, const QHostAd
 {
     // demultiplex channel data
     if (buffer.size() >= 4 && (buffer[0] & 0xc0) == 0x40) {
-        QDataStream stream(buffer);
-        quint16 channel, length;
-        stream >> channel;
-        stream >> length;
-        if (m_state == ConnectedState && m_channels.contains(channel) && length <= buffer.size() - 4) {
-            emit datagramReceived(buffer.mid(4, length), m_channels[channel].first,
-                m_channels[channel].second);
+        const uchar *data = reinterpret_cast<const uchar*>(buffer.constData());
+        const quint16 channel = qFromBigEndian<quint16>(data);
+        const quint16 length = qFromBigEndian<quint16>(data + 2);
+        if (m_state != ConnectedState || length > buffer.size() - 4)
+            return;
+
+        QMap<quint16, Address>::const_iterator it = m_channels.constFind(channel);
+        if (it != m_channels.constEnd()) {
+            // unwrap into a reused buffer
+            m_channelBuffer.resize(length);
+            memcpy(m_channelBuffer.data(), data + 4, length);
+            emit datagramReceived(m_channelBuffer, it.value().first, it.value().second);
         }
         return;
     }
@@ -1323,12 +1347,10 @@ void QXmppTurnAllocation::handleDatagram(const QByteArray &buffer, const QHostAd
         return;
     }
 
-#ifdef QXMPP_DEBUG_STUN
-    logReceived(QString("TURN packet from %1 port %2\n%3").arg(
+    qxmpp_log_received(QString("TURN packet from %1 port %2\n%3").arg(
             remoteHost.toString(),
             QString::number(remotePort),
             message.toString()));
-#endif
 
     // find transaction
     foreach (QXmppStunTransaction *transaction, m_transactions) {
@@ -1501,7 +1523,10 @@ void QXmppTurnAllocation::transactionFinished()
                 QString::number(reply.errorCode), reply.errorPhrase));
 
             // remove channel
-            m_channels.remove(transaction->request().channelNumber());
+            const quint16 channel = transaction->request().channelNumber();
+            m_channels.remove(channel);
+            if (channel == m_lastChannel)
+                m_lastChannel = 0;
             if (m_channels.isEmpty())
                 m_channelTimer->stop();
             return;
@@ -1533,8 +1558,17 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
     if (m_state != ConnectedState)
         return -1;
 
+    // media is usually sent to a single peer, remember its channel
+    // to avoid searching the channels for every packet
     const Address addr = qMakePair(host, port);
-    quint16 channel = m_channels.key(addr);
+    quint16 channel = m_lastChannel;
+    if (!channel || m_lastAddress != addr) {
+        channel = m_channels.key(addr);
+        if (channel) {
+            m_lastAddress = addr;
+            m_lastChannel = channel;
+        }
+    }
 
     if (!channel) {
         channel = m_channelNumber++;
@@ -1557,14 +1591,15 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
             m_channelTimer->start();
     }
 
-    // send data
-    QByteArray channelData;
-    channelData.reserve(4 + data.size());
-    QDataStream stream(&channelData, QIODevice::WriteOnly);
-    stream << channel;
-    stream << quint16(data.size());
-    stream.writeRawData(data.data(), data.size());
-    if (socket->writeDatagram(channelData, m_turnHost, m_turnPort) == channelData.size())
+    // frame the data in place, in a reused buffer
+    if (data.size() > 0xffff)
+        return -1;
+    m_channelData.resize(4 + data.size());
+    uchar *frame = reinterpret_cast<uchar*>(m_channelData.data());
+    qToBigEndian(channel, frame);
+    qToBigEndian(quint16(data.size()), frame + 2);
+    memcpy(frame + 4, data.constData(), data.size());
+    if (socket->writeDatagram(m_channelData, m_turnHost, m_turnPort) == m_channelData.size())
         return data.size();
     else
         return -1;
@@ -1573,12 +1608,10 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
 void QXmppTurnAllocation::writeStun(const QXmppStunMessage &message)
 {
     socket->writeDatagram(message.encode(m_key), m_turnHost, m_turnPort);
-#ifdef QXMPP_DEBUG_STUN
-    logSent(QString("TURN packet to %1 port %2\n%3").arg(
+    qxmpp_log_sent(QString("TURN packet to %1 port %2\n%3").arg(
             m_turnHost.toString(),
             QString::number(m_turnPort),
             message.toString()));
-#endif
 }
 
 QXmppUdpTransport::QXmppUdpTransport(QUdpSocket *socket, QObject *parent)
@@ -1629,13 +1662,87 @@ void QXmppUdpTransport::readyRead()
     QByteArray buffer;
     QHostAddress remoteHost;
     quint16 remotePort;
+#ifdef Q_OS_LINUX
+    // read the first datagram through QUdpSocket so that it re-enables
+    // its read notifier, then drain the socket in batches
+    if (m_socket->hasPendingDatagrams()) {
+        const qint64 size = m_socket->pendingDatagramSize();
+        buffer.resize(size);
+        m_socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort);
+        emit datagramReceived(buffer, remoteHost, remotePort);
+        readBatches(buffer);
+    }
+#else
     while (m_socket->hasPendingDatagrams()) {
         const qint64 size = m_socket->pendingDatagramSize();
         buffer.resize(size);
         m_socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort);
         emit datagramReceived(buffer, remoteHost, remotePort);
     }
+#endif
+}
+
+#ifdef Q_OS_LINUX
+/// Reads the pending datagrams using recvmmsg(), which receives up to
+/// UDP_BATCH_SIZE datagrams per system call into a reusable pool.
+
+void QXmppUdpTransport::readBatches(QByteArray &buffer)
+{
+    const int fd = m_socket->socketDescriptor();
+    if (fd < 0)
+        return;
+
+    if (m_pool.isEmpty())
+        m_pool.resize(UDP_BATCH_SIZE * UDP_SLOT_SIZE);
+
+    struct mmsghdr msgs[UDP_BATCH_SIZE];
+    struct iovec iovecs[UDP_BATCH_SIZE];
+    struct sockaddr_storage addrs[UDP_BATCH_SIZE];
+    QHostAddress remoteHost;
+
+    forever {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < UDP_BATCH_SIZE; ++i) {
+            iovecs[i].iov_base = m_pool.data() + i * UDP_SLOT_SIZE;
+            iovecs[i].iov_len = UDP_SLOT_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+
+        const int count = ::recvmmsg(fd, msgs, UDP_BATCH_SIZE, MSG_DONTWAIT, 0);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        for (int i = 0; i < count && m_socket->isOpen(); ++i) {
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                warning(QString("Discarding truncated datagram of more than %1 bytes").arg(UDP_SLOT_SIZE));
+                continue;
+            }
+
+            quint16 remotePort = 0;
+            const struct sockaddr *addr = reinterpret_cast<const struct sockaddr*>(&addrs[i]);
+            remoteHost.setAddress(addr);
+            if (addr->sa_family == AF_INET)
+                remotePort = ntohs(reinterpret_cast<const struct sockaddr_in*>(addr)->sin_port);
+            else if (addr->sa_family == AF_INET6)
+                remotePort = ntohs(reinterpret_cast<const struct sockaddr_in6*>(addr)->sin6_port);
+
+            buffer.resize(msgs[i].msg_len);
+            memcpy(buffer.data(), iovecs[i].iov_base, msgs[i].msg_len);
+            emit datagramReceived(buffer, remoteHost, remotePort);
+        }
+
+        // the socket is drained or was closed by a receiver
+        if (count < UDP_BATCH_SIZE || !m_socket->isOpen())
+            return;
+    }
 }
+#endif
 
 qint64 QXmppUdpTransport::writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port)
 {
@@ -1709,7 +1816,7 @@ CandidatePair::State CandidatePair::state() const
 void CandidatePair::setState(CandidatePair::State state)
 {
     m_state = state;
-    info(QString("ICE pair changed to state %1 %2").arg(QLatin1String(pair_states[state]), toString()));
+    qxmpp_info(QString("ICE pair changed to state %1 %2").arg(QLatin1String(pair_states[state]), toString()));
 }
 
 QString CandidatePair::toString() const
@@ -1730,22 +1837,32 @@ class QXmppIcePrivate
 public:
     QXmppIcePrivate();
 
+    int checkInterval;
+    int consentTimeout;
     bool iceControlling;
     QString localUser;
     QString localPassword;
     QString remoteUser;
     QString remotePassword;
+
+    // the passwords as MESSAGE-INTEGRITY keys
+    QByteArray localKey;
+    QByteArray remoteKey;
+
     QHostAddress stunHost;
     quint16 stunPort;
     QByteArray tieBreaker;
 };
 
 QXmppIcePrivate::QXmppIcePrivate()
-    : iceControlling(false)
+    : checkInterval(20)
+    , consentTimeout(30000)
+    , iceControlling(false)
     , stunPort(0)
 {
     localUser = QXmppUtils::generateStanzaHash(4);
     localPassword = QXmppUtils::generateStanzaHash(22);
+    localKey = localPassword.toUtf8();
     tieBreaker = QXmppUtils::generateRandomBytes(8);
 }
 
@@ -1753,10 +1870,14 @@ class QXmppIceComponentPrivate
 {
 public:
     QXmppIceComponentPrivate(int component, QXmppIcePrivate *config, QXmppIceComponent *qq);
+    bool addPair(QXmppIceTransport *transport, const QXmppJingleCandidate &remote);
     bool addRemoteCandidate(const QXmppJingleCandidate &candidate);
     CandidatePair* findPair(QXmppStunTransaction *transaction);
     void performCheck(CandidatePair *pair, bool nominate);
-    void setSockets(QList<QUdpSocket*> sockets);
+    void releaseDrainPair();
+    void restart();
+    void scheduleConsentCheck();
+    void setTransports(const QList<QXmppIceTransport*> &newTransports);
     void setTurnServer(const QHostAddress &host, quint16 port);
     void setTurnUser(const QString &user);
     void setTurnPassword(const QString &password);
@@ -1778,6 +1899,20 @@ public:
     QList<QXmppIceTransport*> transports;
     QTimer *timer;
 
+    // pending connectivity checks, by transaction and by request ID
+    QHash<QXmppStunTransaction*, CandidatePair*> transactionPairs;
+    QHash<QByteArray, CandidatePair*> requestPairs;
+
+    // the highest priority pair which passed a connectivity check
+    CandidatePair *validPair;
+
+    // the pair used before an ICE restart, until a new pair is nominated
+    CandidatePair *drainPair;
+
+    // consent freshness of the active pair
+    QTimer *consentTimer;
+    QElapsedTimer consentTime;
+
     // STUN server
     QMap<QXmppStunTransaction*, QXmppIceTransport*> stunTransactions;
 
@@ -1797,12 +1932,43 @@ QXmppIceComponentPrivate::QXmppIceComponentPrivate(int component_, QXmppIcePriva
     , gatheringState(QXmppIceConnection::NewGatheringState)
     , peerReflexivePriority(0)
     , timer(0)
+    , validPair(0)
+    , drainPair(0)
+    , consentTimer(0)
     , turnAllocation(0)
     , turnConfigured(false)
     , q(qq)
 {
 }
 
+/// Pairs the given local transport with a remote candidate, unless the
+/// addresses are incompatible or the pair already exists.
+///
+/// The caller is responsible for sorting the pairs afterwards.
+
+bool QXmppIceComponentPrivate::addPair(QXmppIceTransport *transport, const QXmppJingleCandidate &remote)
+{
+    // only pair compatible addresses
+    const QXmppJingleCandidate local = transport->localCandidate(component);
+    if (!isCompatibleAddress(local.host(), remote.host()))
+        return false;
+
+    foreach (CandidatePair *pair, pairs)
+        if (pair->transport == transport &&
+            pair->remote.host() == remote.host() &&
+            pair->remote.port() == remote.port())
+            return false;
+
+    CandidatePair *pair = new CandidatePair(component, config->iceControlling, q);
+    pair->remote = remote;
+    pair->transport = transport;
+    pairs << pair;
+
+    if (!fallbackPair && local.type() == QXmppJingleCandidate::HostType)
+        fallbackPair = pair;
+    return true;
+}
+
 bool QXmppIceComponentPrivate::addRemoteCandidate(const QXmppJingleCandidate &candidate)
 {
     if (candidate.component() != component ||
@@ -1819,20 +1985,8 @@ bool QXmppIceComponentPrivate::addRemoteCandidate(const QXmppJingleCandidate &ca
             return false;
     remoteCandidates << candidate;
 
-    foreach (QXmppIceTransport *transport, transports) {
-        // only pair compatible addresses
-        const QXmppJingleCandidate local = transport->localCandidate(component);
-        if (!isCompatibleAddress(local.host(), candidate.host()))
-            continue;
-
-        CandidatePair *pair = new CandidatePair(component, config->iceControlling, q);
-        pair->remote = candidate;
-        pair->transport = transport;
-        pairs << pair;
-
-        if (!fallbackPair && local.type() == QXmppJingleCandidate::HostType)
-            fallbackPair = pair;
-    }
+    foreach (QXmppIceTransport *transport, transports)
+        addPair(transport, candidate);
 
     qSort(pairs.begin(), pairs.end(), candidatePairPtrLessThan);
 
@@ -1841,11 +1995,7 @@ bool QXmppIceComponentPrivate::addRemoteCandidate(const QXmppJingleCandidate &ca
 
 CandidatePair* QXmppIceComponentPrivate::findPair(QXmppStunTransaction *transaction)
 {
-    foreach (CandidatePair *pair, pairs) {
-        if (pair->transaction == transaction)
-            return pair;
-    }
-    return 0;
+    return transactionPairs.value(transaction);
 }
 
 void QXmppIceComponentPrivate::performCheck(CandidatePair *pair, bool nominate)
@@ -1864,9 +2014,74 @@ void QXmppIceComponentPrivate::performCheck(CandidatePair *pair, bool nominate)
     pair->nominating = nominate;
     pair->setState(CandidatePair::InProgressState);
     pair->transaction = new QXmppStunTransaction(message, q);
+    transactionPairs.insert(pair->transaction, pair);
+    requestPairs.insert(message.id(), pair);
 }
 
-void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket*> sockets)
+/// Releases the pair which was kept across an ICE restart, along with
+/// its transport.
+
+void QXmppIceComponentPrivate::releaseDrainPair()
+{
+    if (!drainPair)
+        return;
+
+    QXmppIceTransport *transport = drainPair->transport;
+    if (transport != turnAllocation && !transports.contains(transport)) {
+        // we may be called from one of the transport's signals
+        transport->disconnectFromHost();
+        transport->deleteLater();
+    }
+    delete drainPair;
+    drainPair = 0;
+}
+
+/// Prepares the component for an ICE restart.
+///
+/// The pair currently carrying media is kept until a new pair is
+/// nominated, all other pairs and the remote candidates are discarded.
+
+void QXmppIceComponentPrivate::restart()
+{
+    CandidatePair *current = activePair ? activePair : validPair;
+    if (current) {
+        releaseDrainPair();
+
+        pairs.removeAll(current);
+        if (current->transport != turnAllocation)
+            transports.removeAll(current->transport);
+        if (current->transaction) {
+            transactionPairs.remove(current->transaction);
+            requestPairs.remove(current->transaction->request().id());
+            delete current->transaction;
+            current->transaction = 0;
+        }
+        drainPair = current;
+    }
+
+    foreach (CandidatePair *pair, pairs)
+        delete pair;
+    pairs.clear();
+    transactionPairs.clear();
+    requestPairs.clear();
+    activePair = 0;
+    fallbackPair = 0;
+    validPair = 0;
+    consentTimer->stop();
+    remoteCandidates.clear();
+    timer->stop();
+}
+
+/// Schedules the next consent freshness check, at a randomised interval
+/// of 0.8 to 1.2 times the base interval.
+
+void QXmppIceComponentPrivate::scheduleConsentCheck()
+{
+    const int interval = qMin(CONSENT_INTERVAL, config->consentTimeout / 3);
+    consentTimer->start(interval * 4 / 5 + qrand() % qMax(1, interval * 2 / 5));
+}
+
+void QXmppIceComponentPrivate::setTransports(const QList<QXmppIceTransport*> &newTransports)
 {
     bool check;
     Q_UNUSED(check);
@@ -1876,16 +2091,21 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket*> sockets)
     foreach (CandidatePair *pair, pairs)
         delete pair;
     pairs.clear();
-    foreach (QXmppIceTransport *transport, transports)
-        if (transport != turnAllocation)
+    transactionPairs.clear();
+    requestPairs.clear();
+    fallbackPair = 0;
+    validPair = 0;
+    foreach (QXmppIceTransport *transport, transports) {
+        if (transport != turnAllocation) {
+            transport->disconnectFromHost();
             delete transport;
+        }
+    }
     transports.clear();
 
     // store candidates
-    foreach (QUdpSocket *socket, sockets) {
-        socket->setParent(q);
-
-        QXmppUdpTransport *transport = new QXmppUdpTransport(socket, q);
+    foreach (QXmppIceTransport *transport, newTransports) {
+        transport->setParent(q);
         check = QObject::connect(transport, SIGNAL(datagramReceived(QByteArray,QHostAddress,quint16)),
                                  q, SLOT(handleDatagram(QByteArray,QHostAddress,quint16)));
         Q_ASSERT(check);
@@ -1913,10 +2133,14 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket*> sockets)
         }
     }
 
-    // connect to TURN server
+    // connect to TURN server, an allocation which survived an ICE restart
+    // keeps its relayed candidate
     if (turnConfigured) {
         transports << turnAllocation;
-        turnAllocation->connectToHost();
+        if (turnAllocation->state() == QXmppTurnAllocation::ConnectedState)
+            localCandidates << turnAllocation->localCandidate(component);
+        else
+            turnAllocation->connectToHost();
     }
 
     q->updateGatheringState();
@@ -1940,15 +2164,14 @@ void QXmppIceComponentPrivate::setTurnPassword(const QString &password)
 
 void QXmppIceComponentPrivate::writeStun(const QXmppStunMessage &message, QXmppIceTransport *transport, const QHostAddress &address, quint16 port)
 {
-    const QString messagePassword = (message.type() & 0xFF00) ? config->localPassword : config->remotePassword;
-    const QByteArray data = message.encode(messagePassword.toUtf8());
+    const QByteArray &messageKey = (message.type() & 0xFF00) ? config->localKey : config->remoteKey;
+    const QByteArray data = message.encode(messageKey);
     transport->writeDatagram(data, address, port);
-#ifdef QXMPP_DEBUG_STUN
-    q->logSent(QString("STUN packet to %1 port %2\n%3").arg(
-               address.toString(),
-               QString::number(port),
-               message.toString()));
-#endif
+    if (q->isLogging(QXmppLogger::SentMessage))
+        q->logSent(QString("STUN packet to %1 port %2\n%3").arg(
+                   address.toString(),
+                   QString::number(port),
+                   message.toString()));
 }
 
 /// Constructs a new QXmppIceComponent.
@@ -1969,6 +2192,12 @@ QXmppIceComponent::QXmppIceComponent(int component, QXmppIcePrivate *config, QOb
                     this, SLOT(checkCandidates()));
     Q_ASSERT(check);
 
+    d->consentTimer = new QTimer(this);
+    d->consentTimer->setSingleShot(true);
+    check = connect(d->consentTimer, SIGNAL(timeout()),
+                    this, SLOT(checkConsent()));
+    Q_ASSERT(check);
+
     d->turnAllocation = new QXmppTurnAllocation(this);
     check = connect(d->turnAllocation, SIGNAL(connected()),
                     this, SLOT(turnConnected()));
@@ -1996,6 +2225,7 @@ QXmppIceComponent::~QXmppIceComponent()
 {
     foreach (CandidatePair *pair, d->pairs)
         delete pair;
+    delete d->drainPair;
     delete d;
 }
 
@@ -2015,12 +2245,35 @@ void QXmppIceComponent::checkCandidates()
 
     foreach (CandidatePair *pair, d->pairs) {
         if (pair->state() == CandidatePair::WaitingState) {
+            // when controlling, every check carries USE-CANDIDATE
+            // (aggressive nomination)
             d->performCheck(pair, d->config->iceControlling);
             break;
         }
     }
 }
 
+/// Checks the remote party still consents to receive media on the active
+/// pair, as described in RFC 7675.
+
+void QXmppIceComponent::checkConsent()
+{
+    CandidatePair *pair = d->activePair;
+    if (!pair)
+        return;
+
+    if (d->consentTime.elapsed() > d->config->consentTimeout) {
+        warning(QString("ICE consent expired for %1").arg(pair->toString()));
+        close();
+        emit disconnected();
+        return;
+    }
+
+    // a pending check is already being retransmitted
+    if (!pair->transaction)
+        d->performCheck(pair, false);
+    d->scheduleConsentCheck();
+}
 /// Stops ICE connectivity checks and closes the underlying sockets.
 
 void QXmppIceComponent::close()
@@ -2029,7 +2282,10 @@ void QXmppIceComponent::close()
         transport->disconnectFromHost();
     d->turnAllocation->disconnectFromHost();
     d->timer->stop();
+    d->consentTimer->stop();
     d->activePair = 0;
+    d->validPair = 0;
+    d->releaseDrainPair();
 }
 
 /// Starts ICE connectivity checks.
@@ -2040,7 +2296,7 @@ void QXmppIceComponent::connectToHost()
         return;
 
     checkCandidates();
-    d->timer->start();
+    d->timer->start(d->config->checkInterval);
 }
 
 /// Returns true if ICE negotiation completed, false otherwise.
@@ -2059,6 +2315,19 @@ QList<QXmppJingleCandidate> QXmppIceComponent::localCandidates() const
 
 void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
 {
+    if (buffer.isEmpty())
+        return;
+
+    // demultiplex on the first byte as described in RFC 7983, media is
+    // by far the most frequent case so handle it first
+    const quint8 firstByte = buffer.at(0);
+    if (firstByte >= 128 && firstByte <= 191) {
+        QXMPP_TRACEPOINT3(ice__datagram__received, this, buffer.size(), 1);
+        handleMedia(buffer, remoteHost, remotePort);
+        return;
+    }
+    QXMPP_TRACEPOINT3(ice__datagram__received, this, buffer.size(), 0);
+
     QXmppIceTransport *transport = qobject_cast<QXmppIceTransport*>(sender());
     if (!transport)
         return;
@@ -2067,52 +2336,50 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
     quint32 messageCookie;
     QByteArray messageId;
     quint16 messageType = QXmppStunMessage::peekType(buffer, messageCookie, messageId);
-    if (!messageType || messageCookie != STUN_MAGIC)
-    {
-        // use this as an opportunity to flag a potential pair
-        foreach (CandidatePair *pair, d->pairs) {
-            if (pair->remote.host() == remoteHost &&
-                pair->remote.port() == remotePort) {
-                d->fallbackPair = pair;
-                break;
-            }
-        }
-        emit datagramReceived(buffer);
+    if (!messageType || messageCookie != STUN_MAGIC) {
+        handleMedia(buffer, remoteHost, remotePort);
         return;
     }
 
-    // check if it's STUN
+    // a transport kept across an ICE restart only carries media
+    if (d->drainPair && d->drainPair->transport == transport && !d->transports.contains(transport))
+        return;
+
+    // responses are only decoded if they match a pending transaction
     QXmppStunTransaction *stunTransaction = 0;
-    foreach (QXmppStunTransaction *t, d->stunTransactions.keys()) {
-        if (t->request().id() == messageId &&
-            d->stunTransactions.value(t) == transport) {
-            stunTransaction = t;
-            break;
+    const bool isResponse = (messageType & 0x0100);
+    if (isResponse) {
+        QMap<QXmppStunTransaction*, QXmppIceTransport*>::const_iterator it;
+        for (it = d->stunTransactions.constBegin(); it != d->stunTransactions.constEnd(); ++it) {
+            if (it.value() == transport && it.key()->request().id() == messageId) {
+                stunTransaction = it.key();
+                break;
+            }
         }
+        if (!stunTransaction && !d->requestPairs.contains(messageId))
+            return;
     }
 
     // determine password to use
-    QString messagePassword;
+    QByteArray messageKey;
     if (!stunTransaction) {
-        messagePassword = (messageType & 0xFF00) ? d->config->remotePassword : d->config->localPassword;
-        if (messagePassword.isEmpty())
+        messageKey = isResponse ? d->config->remoteKey : d->config->localKey;
+        if (messageKey.isEmpty())
             return;
     }
 
     // parse STUN message
     QXmppStunMessage message;
     QStringList errors;
-    if (!message.decode(buffer, messagePassword.toUtf8(), &errors)) {
+    if (!message.decode(buffer, messageKey, &errors)) {
         foreach (const QString &error, errors)
             warning(error);
         return;
     }
-#ifdef QXMPP_DEBUG_STUN
-    logReceived(QString("STUN packet from %1 port %2\n%3").arg(
+    qxmpp_log_received(QString("STUN packet from %1 port %2\n%3").arg(
             remoteHost.toString(),
             QString::number(remotePort),
             message.toString()));
-#endif
 
     // we only want binding requests and responses
     if (message.messageMethod() != QXmppStunMessage::Binding)
@@ -2209,12 +2476,7 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
             || message.messageClass() == QXmppStunMessage::Error) {
 
         // find the pair for this transaction
-        foreach (CandidatePair *ptr, d->pairs) {
-            if (ptr->transaction && ptr->transaction->request().id() == message.id()) {
-                pair = ptr;
-                break;
-            }
-        }
+        pair = d->requestPairs.value(message.id());
         if (!pair)
             return;
 
@@ -2240,10 +2502,32 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
                 pair->toString(), QString::number(pair->priority())));
             const bool wasConnected = (d->activePair != 0);
             d->activePair = pair;
-            if (!wasConnected)
+            if (!wasConnected) {
+                d->releaseDrainPair();
+                d->consentTime.start();
+                d->scheduleConsentCheck();
                 emit connected();
+            }
+        }
+    }
+}
+
+void QXmppIceComponent::handleMedia(const QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
+{
+    // until a pair is nominated, use this as an opportunity
+    // to flag a potential pair
+    if (!d->activePair && !(d->fallbackPair &&
+                            d->fallbackPair->remote.port() == remotePort &&
+                            d->fallbackPair->remote.host() == remoteHost)) {
+        foreach (CandidatePair *pair, d->pairs) {
+            if (pair->remote.port() == remotePort &&
+                pair->remote.host() == remoteHost) {
+                d->fallbackPair = pair;
+                break;
+            }
         }
     }
+    emit datagramReceived(buffer);
 }
 
 void QXmppIceComponent::transactionFinished()
@@ -2267,12 +2551,23 @@ void QXmppIceComponent::transactionFinished()
                 // outgoing media can flow
                 pair->nominated = true;
             }
+
+            // send early media on the best validated pair until a pair
+            // is nominated
+            if (!d->validPair || pair->priority() > d->validPair->priority())
+                d->validPair = pair;
+
+            // the remote party still consents to receive media
+            if (pair == d->activePair)
+                d->consentTime.restart();
         } else {
-            debug(QString("ICE forward check failed %1 (error %2)").arg(
+            qxmpp_debug(QString("ICE forward check failed %1 (error %2)").arg(
                 pair->toString(),
                 transaction->response().errorPhrase));
             pair->setState(CandidatePair::FailedState);
         }
+        d->transactionPairs.remove(transaction);
+        d->requestPairs.remove(transaction->request().id());
         pair->transaction = 0;
         return;
     }
@@ -2305,7 +2600,7 @@ void QXmppIceComponent::transactionFinished()
             }
 
             // add the new local candidate
-            debug(QString("Adding server-reflexive candidate %1 port %2").arg(reflexiveHost.toString(), QString::number(reflexivePort)));
+            qxmpp_debug(QString("Adding server-reflexive candidate %1 port %2").arg(reflexiveHost.toString(), QString::number(reflexivePort)));
             QXmppJingleCandidate candidate;
             candidate.setComponent(d->component);
             candidate.setHost(reflexiveHost);
@@ -2323,7 +2618,7 @@ void QXmppIceComponent::transactionFinished()
 
             emit localCandidatesChanged();
         } else {
-            debug(QString("STUN test failed (error %1)").arg(
+            qxmpp_debug(QString("STUN test failed (error %1)").arg(
                 transaction->response().errorPhrase));
         }
         d->stunTransactions.remove(transaction);
@@ -2337,11 +2632,19 @@ void QXmppIceComponent::turnConnected()
     const QXmppJingleCandidate candidate = d->turnAllocation->localCandidate(d->component);
 
     // add the new local candidate
-    debug(QString("Adding relayed candidate %1 port %2").arg(
+    qxmpp_debug(QString("Adding relayed candidate %1 port %2").arg(
         candidate.host().toString(),
         QString::number(candidate.port())));
     d->localCandidates << candidate;
 
+    // pair the relayed candidate with the remote candidates which
+    // were received before the allocation succeeded
+    bool added = false;
+    foreach (const QXmppJingleCandidate &remote, d->remoteCandidates)
+        added |= d->addPair(d->turnAllocation, remote);
+    if (added)
+        qSort(d->pairs.begin(), d->pairs.end(), candidatePairPtrLessThan);
+
     emit localCandidatesChanged();
     updateGatheringState();
 }
@@ -2453,9 +2756,14 @@ QList<QUdpSocket*> QXmppIceComponent::reservePorts(const QList<QHostAddress> &ad
 
 qint64 QXmppIceComponent::sendDatagram(const QByteArray &datagram)
 {
-    CandidatePair *pair = d->activePair ? d->activePair : d->fallbackPair;
+    CandidatePair *pair = d->activePair;
+    if (!pair)
+        pair = d->validPair;
+    if (!pair)
+        pair = d->drainPair ? d->drainPair : d->fallbackPair;
     if (!pair)
         return -1;
+    QXMPP_TRACEPOINT2(ice__datagram__sent, this, datagram.size());
     return pair->transport->writeDatagram(datagram, pair->remote.host(), pair->remote.port());
 }
 
@@ -2491,12 +2799,10 @@ void QXmppIceComponent::writeStun(const QXmppStunMessage &message)
     QXmppIceTransport *transport = d->stunTransactions.value(transaction);
     if (transport) {
         transport->writeDatagram(message.encode(), d->config->stunHost, d->config->stunPort);
-#ifdef QXMPP_DEBUG_STUN
-        logSent(QString("STUN packet to %1 port %2\n%3").arg(
+        qxmpp_log_sent(QString("STUN packet to %1 port %2\n%3").arg(
                    d->config->stunHost.toString(),
                    QString::number(d->config->stunPort),
                    message.toString()));
-#endif
         return;
     }
 }
@@ -2585,6 +2891,10 @@ void QXmppIceConnection::addComponent(int component)
                     this, SLOT(slotConnected()));
     Q_ASSERT(check);
 
+    check = connect(socket, SIGNAL(disconnected()),
+                    this, SIGNAL(disconnected()));
+    Q_ASSERT(check);
+
     check = connect(socket, SIGNAL(gatheringStateChanged()),
                     this, SLOT(slotGatheringStateChanged()));
     Q_ASSERT(check);
@@ -2618,17 +2928,42 @@ bool QXmppIceConnection::bind(const QList<QHostAddress> &addresses)
     if (sockets.isEmpty() && !addresses.isEmpty())
         return false;
 
-    // assign sockets
+    QList<QXmppIceTransport*> transports;
+    foreach (QUdpSocket *socket, sockets) {
+        QXmppUdpTransport *transport = new QXmppUdpTransport(socket);
+        socket->setParent(transport);
+        transports << transport;
+    }
+    return bind(transports);
+}
+
+/// \cond
+/// Binds the components to the given \a transports instead of UDP sockets,
+/// for instance to run ICE over a simulated network.
+///
+/// The transports are split evenly between the components, in increasing
+/// order of component ID, and the components take ownership of them.
+
+bool QXmppIceConnection::bind(const QList<QXmppIceTransport*> &transports)
+{
+    if (d->components.isEmpty())
+        return transports.isEmpty();
+    if (transports.size() % d->components.size())
+        return false;
+
+    // assign transports
+    const int count = transports.size() / d->components.size();
     QList<int> keys = d->components.keys();
     qSort(keys);
     int s = 0;
     foreach (int k, keys) {
-        d->components[k]->d->setSockets(sockets.mid(s, addresses.size()));
-        s += addresses.size();
+        d->components[k]->d->setTransports(transports.mid(s, count));
+        s += count;
     }
 
     return true;
 }
+/// \endcond
 
 /// Closes the ICE connection.
 
@@ -2652,6 +2987,50 @@ void QXmppIceConnection::connectToHost()
 }
 
 
+/// Restarts ICE negotiation, for instance after a change of network.
+///
+/// New local credentials are generated and the local sockets are bound to
+/// the given \a addresses. Media keeps flowing on the previously selected
+/// pair until a new pair is nominated.
+///
+/// The remote party must be sent the new credentials and candidates, and
+/// its own new credentials and candidates must be set before calling
+/// connectToHost() again.
+///
+/// \param addresses The addresses on which to listen.
+
+bool QXmppIceConnection::restart(const QList<QHostAddress> &addresses)
+{
+    restartCredentials();
+    return bind(addresses);
+}
+
+/// \cond
+/// Restarts ICE negotiation using the given \a transports, see bind().
+
+bool QXmppIceConnection::restart(const QList<QXmppIceTransport*> &transports)
+{
+    restartCredentials();
+    return bind(transports);
+}
+/// \endcond
+
+void QXmppIceConnection::restartCredentials()
+{
+    info(QString("ICE restart"));
+    d->connectTimer->stop();
+
+    d->localUser = QXmppUtils::generateStanzaHash(4);
+    d->localPassword = QXmppUtils::generateStanzaHash(22);
+    d->localKey = d->localPassword.toUtf8();
+    d->remoteUser.clear();
+    d->remotePassword.clear();
+    d->remoteKey.clear();
+
+    foreach (QXmppIceComponent *socket, d->components.values())
+        socket->d->restart();
+}
+
 /// Returns true if ICE negotiation completed, false otherwise.
 
 bool QXmppIceConnection::isConnected() const
@@ -2680,6 +3059,50 @@ void QXmppIceConnection::setIceControlling(bool controlling)
     d->iceControlling = controlling;
 }
 
+/// Returns the interval between two connectivity checks, in milliseconds.
+
+int QXmppIceConnection::checkInterval() const
+{
+    return d->checkInterval;
+}
+
+/// Sets the interval between two connectivity checks (Ta), in milliseconds.
+///
+/// Lower values make connections faster to establish, at the cost of
+/// sending more packets at once. The default is 20 ms.
+///
+/// \note This must be called prior to calling connectToHost().
+///
+/// \param interval
+
+void QXmppIceConnection::setCheckInterval(int interval)
+{
+    d->checkInterval = qMax(1, interval);
+}
+
+/// Returns the time after which consent to send media is considered lost
+/// if the remote party stops answering checks, in milliseconds.
+
+int QXmppIceConnection::consentTimeout() const
+{
+    return d->consentTimeout;
+}
+
+/// Sets the time after which consent to send media is considered lost
+/// if the remote party stops answering checks, in milliseconds.
+///
+/// Once connected, the selected pair is checked every 5 seconds, or more
+/// often for timeouts shorter than 15 seconds. When consent is lost,
+/// disconnected() is emitted. The default is 30 seconds as recommended by
+/// RFC 7675.
+///
+/// \param timeout
+
+void QXmppIceConnection::setConsentTimeout(int timeout)
+{
+    d->consentTimeout = qMax(1, timeout);
+}
+
 /// Returns the list of local HOST CANDIDATES candidates by iterating
 /// over the available network interfaces.
 
@@ -2721,6 +3144,7 @@ void QXmppIceConnection::setRemoteUser(const QString &user)
 void QXmppIceConnection::setRemotePassword(const QString &password)
 {
     d->remotePassword = password;
+    d->remoteKey = password.toUtf8();
 }
 
 /// Sets the STUN server to use to determine server-reflexive addresses
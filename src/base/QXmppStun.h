@@ -36,6 +36,7 @@ class QTimer;
 class QXmppIceComponentPrivate;
 class QXmppIceConnectionPrivate;
 class QXmppIcePrivate;
+class QXmppIceTransport;
 
 /// \internal
 ///
@@ -183,6 +184,7 @@ public slots:
 
 private slots:
     void checkCandidates();
+    void checkConsent();
     void handleDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port);
     void turnConnected();
     void transactionFinished();
@@ -193,6 +195,9 @@ signals:
     /// \brief This signal is emitted once ICE negotiation succeeds.
     void connected();
 
+    /// \brief This signal is emitted when consent to send media is lost.
+    void disconnected();
+
     /// \brief This signal is emitted when a data packet is received.
     void datagramReceived(const QByteArray &datagram);
 
@@ -204,6 +209,7 @@ signals:
 
 private:
     QXmppIceComponent(int component, QXmppIcePrivate *config, QObject *parent=0);
+    void handleMedia(const QByteArray &datagram, const QHostAddress &host, quint16 port);
 
     QXmppIceComponentPrivate *d;
     friend class QXmppIceComponentPrivate;
@@ -259,6 +265,12 @@ public:
     void addComponent(int component);
     void setIceControlling(bool controlling);
 
+    int checkInterval() const;
+    void setCheckInterval(int interval);
+
+    int consentTimeout() const;
+    void setConsentTimeout(int timeout);
+
     QList<QXmppJingleCandidate> localCandidates() const;
     QString localUser() const;
     QString localPassword() const;
@@ -273,15 +285,22 @@ public:
     void setTurnPassword(const QString &password);
 
     bool bind(const QList<QHostAddress> &addresses);
+    bool restart(const QList<QHostAddress> &addresses);
     bool isConnected() const;
 
+    /// \cond
+    bool bind(const QList<QXmppIceTransport*> &transports);
+    bool restart(const QList<QXmppIceTransport*> &transports);
+    /// \endcond
+
     GatheringState gatheringState() const;
 
 signals:
     /// \brief This signal is emitted once ICE negotiation succeeds.
     void connected();
 
-    /// \brief This signal is emitted when ICE negotiation fails.
+    /// \brief This signal is emitted when ICE negotiation fails, or when
+    /// consent to send media is lost.
     void disconnected();
 
     /// \brief This signal is emitted when the gathering state of local candidates changes.
@@ -300,6 +319,8 @@ private slots:
     void slotTimeout();
 
 private:
+    void restartCredentials();
+
     QXmppIceConnectionPrivate *d;
 };
 
@@ -160,6 +160,10 @@ private:
     typedef QPair<QHostAddress, quint16> Address;
     quint16 m_channelNumber;
     QMap<quint16, Address> m_channels;
+    Address m_lastAddress;
+    quint16 m_lastChannel;
+    QByteArray m_channelBuffer;
+    QByteArray m_channelData;
 
     // state
     quint32 m_lifetime;
@@ -193,7 +197,12 @@ private slots:
     void readyRead();
 
 private:
+#ifdef Q_OS_LINUX
+    void readBatches(QByteArray &buffer);
+#endif
+
     QUdpSocket *m_socket;
+    QByteArray m_pool;
 };
 
 #endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppTask.h"
+
+class QXmppTaskPrivate
+{
+public:
+    QXmppTaskPrivate();
+
+    bool autoDelete;
+    bool running;
+    bool resumePending;
+    int resumePoint;
+};
+
+QXmppTaskPrivate::QXmppTaskPrivate()
+    : autoDelete(true)
+    , running(false)
+    , resumePending(false)
+    , resumePoint(0)
+{
+}
+
+/// Constructs a new task.
+
+QXmppTask::QXmppTask()
+    : d(new QXmppTaskPrivate)
+{
+}
+
+/// Destroys the task.
+
+QXmppTask::~QXmppTask()
+{
+    delete d;
+}
+
+/// Returns true if the task is deleted once it is finished.
+///
+/// The default value is true.
+
+bool QXmppTask::autoDelete() const
+{
+    return d->autoDelete;
+}
+
+/// Sets whether the task is deleted once it is finished.
+///
+/// \param autoDelete
+
+void QXmppTask::setAutoDelete(bool autoDelete)
+{
+    d->autoDelete = autoDelete;
+}
+
+/// Returns true if the task reached QXMPP_TASK_END or QXMPP_TASK_RETURN.
+
+bool QXmppTask::isFinished() const
+{
+    return d->resumePoint < 0;
+}
+
+/// Starts the task, which runs until it awaits an operation or finishes.
+
+void QXmppTask::start()
+{
+    if (d->resumePoint == 0)
+        resume();
+}
+
+/// Resumes the task after the operation it awaits completed.
+///
+/// If the operation completes while the task is starting it, the task
+/// resumes once it is suspended, rather than recursively.
+
+void QXmppTask::resume()
+{
+    if (d->resumePoint < 0)
+        return;
+    if (d->running) {
+        d->resumePending = true;
+        return;
+    }
+
+    d->running = true;
+    do {
+        d->resumePending = false;
+        run();
+    } while (d->resumePending && d->resumePoint >= 0);
+    d->running = false;
+
+    if (d->resumePoint < 0 && d->autoDelete)
+        delete this;
+}
+
+/// \cond
+int QXmppTask::resumePoint() const
+{
+    return d->resumePoint;
+}
+
+void QXmppTask::setResumePoint(int point)
+{
+    d->resumePoint = point;
+}
+/// \endcond
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPTASK_H
+#define QXMPPTASK_H
+
+#include "QXmppGlobal.h"
+
+class QXmppTaskPrivate;
+
+/// \brief The QXmppTask class runs a multi-step asynchronous operation as a
+/// stackless coroutine.
+///
+/// Reimplement run() and write the steps of the operation in sequence
+/// between QXMPP_TASK_BEGIN and QXMPP_TASK_END. QXMPP_TASK_AWAIT() starts
+/// waiting for an operation which resumes the task once it completes, such
+/// as a QXmppIqRequest or a QXmppPasswordReply, and run() picks up where
+/// it left off:
+///
+/// \code
+/// class VersionTask : public QXmppTask
+/// {
+/// public:
+///     VersionTask(QXmppClient *client) : m_client(client), m_request(0) {}
+///
+/// protected:
+///     void run()
+///     {
+///         QXMPP_TASK_BEGIN
+///         m_iq.setTo("example.com");
+///         m_request = m_client->sendIq(m_iq);
+///         QXMPP_TASK_AWAIT(m_request->setTask(this));
+///         if (m_request->state() == QXmppIqRequest::ResultState)
+///             m_iq.parse(m_request->response());
+///         m_request->deleteLater();
+///         QXMPP_TASK_END
+///     }
+///
+/// private:
+///     QXmppClient *m_client;
+///     QXmppIqRequest *m_request;
+///     QXmppVersionIq m_iq;
+/// };
+/// \endcode
+///
+/// The whole operation is held by the task object, rather than by a chain
+/// of slots and intermediate objects. As run() returns at each
+/// QXMPP_TASK_AWAIT(), the state which must survive a step has to be kept
+/// in members of the task: local variables do not survive, and the ones
+/// with initializers must be enclosed in a block.
+///
+/// The task is resumed from the event loop by the completion of the
+/// operation it awaits, in the thread of that operation. If the operation
+/// completed already, the task resumes as soon as it is suspended.
+///
+/// A task must not be destroyed while it awaits an operation.
+
+class QXMPP_EXPORT QXmppTask
+{
+public:
+    QXmppTask();
+    virtual ~QXmppTask();
+
+    bool autoDelete() const;
+    void setAutoDelete(bool autoDelete);
+
+    bool isFinished() const;
+
+    void start();
+    void resume();
+
+protected:
+    /// Runs the task's steps, between QXMPP_TASK_BEGIN and QXMPP_TASK_END.
+    virtual void run() = 0;
+
+    /// \cond
+    int resumePoint() const;
+    void setResumePoint(int point);
+    /// \endcond
+
+private:
+    Q_DISABLE_COPY(QXmppTask)
+    QXmppTaskPrivate * const d;
+};
+
+/// Starts the steps of a task, in QXmppTask::run().
+#define QXMPP_TASK_BEGIN \
+    switch (resumePoint()) { case 0:
+
+/// Suspends the task after starting an \a operation which resumes it once
+/// it completes.
+#define QXMPP_TASK_AWAIT(operation) \
+    do { setResumePoint(__LINE__); operation; return; case __LINE__:; } while (0)
+
+/// Finishes the task early.
+#define QXMPP_TASK_RETURN \
+    do { setResumePoint(-1); return; } while (0)
+
+/// Ends the steps of a task, in QXmppTask::run().
+#define QXMPP_TASK_END \
+    } setResumePoint(-1);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppTimerWheel_p.h"
+
+/// Constructs a wheel of \a slotCount slots, each covering \a resolution
+/// milliseconds.
+
+QXmppTimerWheel::QXmppTimerWheel(int resolution, int slotCount)
+    : m_resolution(qMax(1, resolution))
+    , m_tick(-1)
+    , m_slots(qMax(1, slotCount))
+{
+}
+
+/// Returns the duration of a tick, in milliseconds.
+
+int QXmppTimerWheel::resolution() const
+{
+    return m_resolution;
+}
+
+/// Returns the number of keys which have not expired.
+
+int QXmppTimerWheel::count() const
+{
+    return m_ticks.size();
+}
+
+/// Returns true if the \a key has a pending deadline.
+
+bool QXmppTimerWheel::contains(const QString &key) const
+{
+    return m_ticks.contains(key);
+}
+
+/// Sets the \a deadline of the \a key, in milliseconds, replacing any
+/// previous deadline.
+
+void QXmppTimerWheel::insert(const QString &key, qint64 deadline)
+{
+    remove(key);
+
+    // a deadline which already passed expires on the next tick
+    qint64 tick = (deadline + m_resolution - 1) / m_resolution;
+    if (tick <= m_tick)
+        tick = m_tick + 1;
+
+    m_slots[tick % m_slots.size()].insert(key);
+    m_ticks.insert(key, tick);
+}
+
+/// Removes the deadline of the \a key, returning false if it had none.
+
+bool QXmppTimerWheel::remove(const QString &key)
+{
+    QHash<QString, qint64>::iterator it = m_ticks.find(key);
+    if (it == m_ticks.end())
+        return false;
+    m_slots[it.value() % m_slots.size()].remove(key);
+    m_ticks.erase(it);
+    return true;
+}
+
+/// Removes and returns the keys whose deadline is \a now or earlier.
+
+QStringList QXmppTimerWheel::expire(qint64 now)
+{
+    QStringList expired;
+    const qint64 nowTick = now / m_resolution;
+    if (nowTick <= m_tick)
+        return expired;
+
+    // each slot is visited at most once, its keys may be due in later turns
+    const qint64 first = qMax(m_tick + 1, nowTick - m_slots.size() + 1);
+    for (qint64 tick = first; tick <= nowTick; ++tick) {
+        QSet<QString> &slot = m_slots[tick % m_slots.size()];
+        QSet<QString>::iterator it = slot.begin();
+        while (it != slot.end()) {
+            if (m_ticks.value(*it) <= nowTick) {
+                expired << *it;
+                m_ticks.remove(*it);
+                it = slot.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    m_tick = nowTick;
+    return expired;
+}
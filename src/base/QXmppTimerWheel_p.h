@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPTIMERWHEEL_P_H
+#define QXMPPTIMERWHEEL_P_H
+
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppClient class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppTimerWheel class keeps deadlines for many keys, so that a
+/// single timer can expire all of them.
+///
+/// Deadlines are hashed into a ring of slots by their tick, so inserting
+/// or removing a key takes constant time, and expiring only visits the
+/// slots of the ticks which elapsed. Deadlines are rounded up to the
+/// resolution of the wheel, and keys never expire early.
+
+class QXMPP_AUTOTEST_EXPORT QXmppTimerWheel
+{
+public:
+    QXmppTimerWheel(int resolution = 100, int slotCount = 512);
+
+    int resolution() const;
+    int count() const;
+    bool contains(const QString &key) const;
+
+    void insert(const QString &key, qint64 deadline);
+    bool remove(const QString &key);
+    QStringList expire(qint64 now);
+
+private:
+    int m_resolution;
+    // the last tick which was expired
+    qint64 m_tick;
+    QVector<QSet<QString> > m_slots;
+    QHash<QString, qint64> m_ticks;
+};
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPTRACEPOINTS_P_H
+#define QXMPPTRACEPOINTS_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream and QXmppServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+// Static tracepoints for profiling live processes.
+//
+// When QXmpp is built with QXMPP_USE_SDT, each tracepoint is a USDT probe
+// of the "qxmpp" provider, which perf, bpftrace, SystemTap and LTTng can
+// attach to, for instance:
+//
+//   bpftrace -e 'usdt:libqxmpp.so:qxmpp:stream__send { @[arg2] = count(); }'
+//
+// An unattached probe compiles to a single nop, but its arguments are
+// still evaluated, so they must be cheap to compute: pointers, sizes and
+// integers rather than strings which need to be converted.
+//
+// Without QXMPP_USE_SDT, the tracepoints compile to nothing.
+//
+// The probes are:
+//
+//   stream__read(stream, bytes)
+//   stream__stanza__start(stream, data, size)
+//   stream__stanza__done(stream)
+//   stream__send(stream, data, size)
+//   stream__write(stream, bytes)
+//   client__dispatch__start(extensionClassName)
+//   client__dispatch__done(extensionClassName, handled)
+//   server__route(data, size)
+//   server__dispatch__start(extensionClassName)
+//   server__dispatch__done(extensionClassName, handled)
+//   sasl__step(stream, step, result)         step 0 is auth, 1 is response
+//   sasl__check(stream)
+//   sasl__reply(stream, error)
+//   sm__ack(streamManagement, h, acknowledged, unacknowledged)
+//   ice__datagram__received(component, size, media)
+//   ice__datagram__sent(component, size)
+
+#ifdef QXMPP_USE_SDT
+#include <sys/sdt.h>
+
+#define QXMPP_TRACEPOINT(probe) \
+    DTRACE_PROBE(qxmpp, probe)
+#define QXMPP_TRACEPOINT1(probe, a1) \
+    DTRACE_PROBE1(qxmpp, probe, a1)
+#define QXMPP_TRACEPOINT2(probe, a1, a2) \
+    DTRACE_PROBE2(qxmpp, probe, a1, a2)
+#define QXMPP_TRACEPOINT3(probe, a1, a2, a3) \
+    DTRACE_PROBE3(qxmpp, probe, a1, a2, a3)
+#define QXMPP_TRACEPOINT4(probe, a1, a2, a3, a4) \
+    DTRACE_PROBE4(qxmpp, probe, a1, a2, a3, a4)
+#else
+// the arguments are referenced so that the variables computed for a
+// tracepoint do not trigger warnings, but they are never evaluated
+#define QXMPP_TRACEPOINT(probe) \
+    do {} while (0)
+#define QXMPP_TRACEPOINT1(probe, a1) \
+    do { if (false) { (void)(a1); } } while (0)
+#define QXMPP_TRACEPOINT2(probe, a1, a2) \
+    do { if (false) { (void)(a1); (void)(a2); } } while (0)
+#define QXMPP_TRACEPOINT3(probe, a1, a2, a3) \
+    do { if (false) { (void)(a1); (void)(a2); (void)(a3); } } while (0)
+#define QXMPP_TRACEPOINT4(probe, a1, a2, a3, a4) \
+    do { if (false) { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } } while (0)
+#endif
+
+#endif
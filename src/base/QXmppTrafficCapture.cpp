@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppTrafficCapture_p.h"
+
+/// Constructs a capture, which records nothing until it is opened.
+
+QXmppTrafficCapture::QXmppTrafficCapture()
+    : m_lastSession(0)
+{
+}
+
+/// Destroys the capture, flushing and closing its file.
+
+QXmppTrafficCapture::~QXmppTrafficCapture()
+{
+    m_file.close();
+}
+
+/// Opens the file to which the data is recorded, truncating it.
+///
+/// Returns true if the file could be opened.
+
+bool QXmppTrafficCapture::open(const QString &fileName)
+{
+    QMutexLocker locker(&m_mutex);
+    m_file.close();
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    m_file.write("# qxmpp-capture 1\n");
+    m_timer.start();
+    m_lastSession = 0;
+    return true;
+}
+
+/// Returns the name of the file to which the data is recorded.
+
+QString QXmppTrafficCapture::fileName() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_file.fileName();
+}
+
+/// Starts recording a new stream, and returns its session number.
+
+int QXmppTrafficCapture::openSession()
+{
+    QMutexLocker locker(&m_mutex);
+    const int session = ++m_lastSession;
+    write(session, "open", QByteArray());
+    return session;
+}
+
+/// Records the end of a \a session.
+
+void QXmppTrafficCapture::closeSession(int session)
+{
+    QMutexLocker locker(&m_mutex);
+    write(session, "close", QByteArray());
+    m_file.flush();
+}
+
+/// Records the \a data received by a \a session.
+
+void QXmppTrafficCapture::record(int session, const QByteArray &data)
+{
+    if (data.isEmpty())
+        return;
+    QMutexLocker locker(&m_mutex);
+    write(session, "data", data);
+}
+
+void QXmppTrafficCapture::write(int session, const char *event, const QByteArray &data)
+{
+    if (!m_file.isOpen())
+        return;
+
+    QByteArray line = QByteArray::number(m_timer.nsecsElapsed() / 1000) + ' ' +
+                      QByteArray::number(session) + ' ' + event;
+    if (!data.isEmpty())
+        line += ' ' + data.toBase64();
+    line += '\n';
+    m_file.write(line);
+}
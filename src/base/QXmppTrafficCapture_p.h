@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPTRAFFICCAPTURE_P_H
+#define QXMPPTRAFFICCAPTURE_P_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream and QXmppServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppTrafficCapture class records the raw data received by streams
+/// to a file, so that it can be replayed later.
+///
+/// The file is made of lines, each of which holds the time in microseconds
+/// since the capture was opened, the stream's session number, an event and
+/// its data:
+///
+/// \code
+/// # qxmpp-capture 1
+/// 1520 1 open
+/// 1710 1 data PD94bWwgdmVyc2lvbj0nMS4wJz8+
+/// 93012 1 close
+/// \endcode
+///
+/// The data is encoded in base64. Streams in several threads can share a
+/// capture.
+
+class QXMPP_AUTOTEST_EXPORT QXmppTrafficCapture
+{
+public:
+    QXmppTrafficCapture();
+    ~QXmppTrafficCapture();
+
+    bool open(const QString &fileName);
+    QString fileName() const;
+
+    int openSession();
+    void closeSession(int session);
+    void record(int session, const QByteArray &data);
+
+private:
+    void write(int session, const char *event, const QByteArray &data);
+
+    mutable QMutex m_mutex;
+    QFile m_file;
+    QElapsedTimer m_timer;
+    int m_lastSession;
+};
+
+#endif
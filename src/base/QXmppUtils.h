@@ -39,6 +39,7 @@ class QDateTime;
 class QDomElement;
 class QString;
 class QStringList;
+class QXmppStanza;
 
 /// \brief The QXmppUtils class contains static utility functions.
 ///
@@ -57,10 +58,12 @@ public:
     static QString jidToBareJid(const QString& jid);
 
     static quint32 generateCrc32(const QByteArray &input);
+    static quint32 updateCrc32(quint32 crc, const QByteArray &input);
     static QByteArray generateHmacMd5(const QByteArray &key, const QByteArray &text);
     static QByteArray generateHmacSha1(const QByteArray &key, const QByteArray &text);
     static int generateRandomInteger(int N);
     static QByteArray generateRandomBytes(int length);
+    static QByteArray generateSecureRandomBytes(int length);
     static QString generateStanzaHash(int length=32);
 };
 
@@ -68,5 +71,8 @@ void helperToXmlAddAttribute(QXmlStreamWriter* stream, const QString& name,
                              const QString& value);
 void helperToXmlAddTextElement(QXmlStreamWriter* stream, const QString& name,
                            const QString& value);
+void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement& element,
+                              const QStringList &omitNamespaces);
+QByteArray helperToXmlData(const QXmppStanza &stanza);
 
 #endif // QXMPPUTILS_H
@@ -25,6 +25,7 @@
 #include <QBuffer>
 #include <QXmlStreamWriter>
 
+#include "QXmppBase64_p.h"
 #include "QXmppVCardIq.h"
 #include "QXmppUtils.h"
 #include "QXmppConstants.h"
@@ -637,6 +638,8 @@ public:
 
     // not as 64 base
     QByteArray photo;
+    // as received, decoded on demand; only one of photo and photoBase64 is set
+    QByteArray photoBase64;
     QString photoType;
 
     QList<QXmppVCardAddress> addresses;
@@ -876,9 +879,14 @@ void QXmppVCardIq::setUrl(const QString& url)
 /// QImageReader imageReader(&buffer);
 /// QImage myImage = imageReader.read();
 /// \endcode
+///
+/// For a parsed vCard, the photo is kept in its base64 encoded form and
+/// decoded by each call to this method.
 
 QByteArray QXmppVCardIq::photo() const
 {
+    if (!d->photoBase64.isEmpty())
+        return QXmppBase64::decode(d->photoBase64);
     return d->photo;
 }
 
@@ -887,6 +895,7 @@ QByteArray QXmppVCardIq::photo() const
 void QXmppVCardIq::setPhoto(const QByteArray& photo)
 {
     d->photo = photo;
+    d->photoBase64.clear();
 }
 
 /// Returns the photo's MIME type.
@@ -979,9 +988,8 @@ void QXmppVCardIq::parseElementFromChild(const QDomElement& nodeRecv)
     d->middleName = nameElement.firstChildElement("MIDDLE").text();
     d->url = cardElement.firstChildElement("URL").text();
     QDomElement photoElement = cardElement.firstChildElement("PHOTO");
-    QByteArray base64data = photoElement.
-                            firstChildElement("BINVAL").text().toLatin1();
-    d->photo = QByteArray::fromBase64(base64data);
+    d->photo.clear();
+    d->photoBase64 = photoElement.firstChildElement("BINVAL").text().toLatin1();
     d->photoType = photoElement.firstChildElement("TYPE").text();
 
     QDomElement child = cardElement.firstChildElement();
@@ -1037,14 +1045,14 @@ void QXmppVCardIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
 
     foreach (const QXmppVCardPhone &phone, d->phones)
         phone.toXml(writer);
-    if(!photo().isEmpty())
+    if(!d->photo.isEmpty() || !d->photoBase64.isEmpty())
     {
         writer->writeStartElement("PHOTO");
         QString photoType = d->photoType;
         if (photoType.isEmpty())
-            photoType = getImageType(d->photo);
+            photoType = getImageType(photo());
         helperToXmlAddTextElement(writer, "TYPE", photoType);
-        helperToXmlAddTextElement(writer, "BINVAL", d->photo.toBase64());
+        helperToXmlAddTextElement(writer, "BINVAL", d->photoBase64.isEmpty() ? QXmppBase64::encode(d->photo) : d->photoBase64);
         writer->writeEndElement();
     }
     if (!d->url.isEmpty())
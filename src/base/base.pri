@@ -1,112 +1,170 @@
-# Header files
-INSTALL_HEADERS += \
-    base/QXmppArchiveIq.h \
-    base/QXmppBindIq.h \
-    base/QXmppBookmarkSet.h \
-    base/QXmppByteStreamIq.h \
-    base/QXmppConstants.h \
-    base/QXmppDataForm.h \
-    base/QXmppDiscoveryIq.h \
-    base/QXmppElement.h \
-    base/QXmppEntityTimeIq.h \
-    base/QXmppGlobal.h \
-    base/QXmppIbbIq.h \
-    base/QXmppIq.h \
-    base/QXmppJingleIq.h \
-    base/QXmppLastActivityIq.h \
-    base/QXmppLogger.h \
-    base/QXmppMessage.h \
-    base/QXmppMucIq.h \
-    base/QXmppNonSASLAuth.h \
-    base/QXmppPingIq.h \
-    base/QXmppPresence.h \
-    base/QXmppPubSubIq.h \
-    base/QXmppRegisterIq.h \
-    base/QXmppResultSet.h \
-    base/QXmppRosterIq.h \
-    base/QXmppRpcIq.h \
-    base/QXmppRtcpPacket.h \
-    base/QXmppRtpChannel.h \
-    base/QXmppRtpPacket.h \
-    base/QXmppSessionIq.h \
-    base/QXmppSimpleArchiveIq.h \
-    base/QXmppSocks.h \
-    base/QXmppStanza.h \
-    base/QXmppStream.h \
-    base/QXmppStreamFeatures.h \
-    base/QXmppStun.h \
-    base/QXmppUtils.h \
-    base/QXmppVCardIq.h \
-    base/QXmppVersionIq.h \
-    base/QXmppGaming.h \
-    base/QXmppMessageCarbonsIq.h \
-    base/QXmppReachAddress.h \
-    base/QXmppSimpleArchivePreferenceIq.h \
-    base/QXmppStreamManagement.h
-
-HEADERS += \
-    base/QXmppCodec_p.h \
-    base/QXmppSasl_p.h \
-    base/QXmppStreamInitiationIq_p.h \
-    base/QXmppStun_p.h
-
-# Source files
-SOURCES += \
-    base/QXmppArchiveIq.cpp \
-    base/QXmppBindIq.cpp \
-    base/QXmppBookmarkSet.cpp \
-    base/QXmppByteStreamIq.cpp \
-    base/QXmppCodec.cpp \
-    base/QXmppConstants.cpp \
-    base/QXmppDataForm.cpp \
-    base/QXmppDiscoveryIq.cpp \
-    base/QXmppElement.cpp \
-    base/QXmppEntityTimeIq.cpp \
-    base/QXmppGlobal.cpp \
-    base/QXmppIbbIq.cpp \
-    base/QXmppIq.cpp \
-    base/QXmppJingleIq.cpp \
-    base/QXmppLastActivityIq.cpp \
-    base/QXmppLogger.cpp \
-    base/QXmppMessage.cpp \
-    base/QXmppMucIq.cpp \
-    base/QXmppNonSASLAuth.cpp \
-    base/QXmppPingIq.cpp \
-    base/QXmppPresence.cpp \
-    base/QXmppPubSubIq.cpp \
-    base/QXmppRegisterIq.cpp \
-    base/QXmppResultSet.cpp \
-    base/QXmppRosterIq.cpp \
-    base/QXmppRpcIq.cpp \
-    base/QXmppRtcpPacket.cpp \
-    base/QXmppRtpChannel.cpp \
-    base/QXmppRtpPacket.cpp \
-    base/QXmppSasl.cpp \
-    base/QXmppSessionIq.cpp \
-    base/QXmppSimpleArchiveIq.cpp \
-    base/QXmppSocks.cpp \
-    base/QXmppStanza.cpp \
-    base/QXmppStream.cpp \
-    base/QXmppStreamFeatures.cpp \
-    base/QXmppStreamInitiationIq.cpp \
-    base/QXmppStun.cpp \
-    base/QXmppUtils.cpp \
-    base/QXmppVCardIq.cpp \
-    base/QXmppVersionIq.cpp \
-    base/QXmppSimpleArchivePreferenceIq.cpp \
-    base/QXmppMessageCarbonsIq.cpp \
-    base/QXmppReachAddress.cpp \
-    base/QXmppStreamManagement.cpp \
-    base/QXmppGaming.cpp
-
-# DNS
-qt_version = $$QT_MAJOR_VERSION
-contains(qt_version, 4) {
-    INSTALL_HEADERS += base/qdnslookup.h base/qdnslookup_p.h
-    SOURCES += base/qdnslookup.cpp
-    android:SOURCES += base/qdnslookup_stub.cpp
-    else:symbian:SOURCES += base/qdnslookup_symbian.cpp
-    else:unix:SOURCES += base/qdnslookup_unix.cpp
-    else:win32:SOURCES += base/qdnslookup_win.cpp
-    else:SOURCES += base/qdnslookup_stub.cpp
-}
+# Header files
+INSTALL_HEADERS += \
+    base/QXmppArchiveIq.h \
+    base/QXmppBindIq.h \
+    base/QXmppBookmarkSet.h \
+    base/QXmppByteStreamIq.h \
+    base/QXmppCompactStanza.h \
+    base/QXmppConstants.h \
+    base/QXmppDataForm.h \
+    base/QXmppDiscoveryIq.h \
+    base/QXmppElement.h \
+    base/QXmppEntityTimeIq.h \
+    base/QXmppGlobal.h \
+    base/QXmppIbbIq.h \
+    base/QXmppIq.h \
+    base/QXmppJid.h \
+    base/QXmppJingleIq.h \
+    base/QXmppLastActivityIq.h \
+    base/QXmppLogger.h \
+    base/QXmppMediaRing.h \
+    base/QXmppMessage.h \
+    base/QXmppMetrics.h \
+    base/QXmppMucIq.h \
+    base/QXmppNonSASLAuth.h \
+    base/QXmppPingIq.h \
+    base/QXmppPresence.h \
+    base/QXmppPubSubIq.h \
+    base/QXmppRawStanza.h \
+    base/QXmppRateLimiter.h \
+    base/QXmppRegisterIq.h \
+    base/QXmppResultSet.h \
+    base/QXmppRosterIq.h \
+    base/QXmppRpcIq.h \
+    base/QXmppRtcpPacket.h \
+    base/QXmppRtpAudioMixer.h \
+    base/QXmppRtpForwarder.h \
+    base/QXmppRtpChannel.h \
+    base/QXmppRtpPacket.h \
+    base/QXmppSessionIq.h \
+    base/QXmppSimpleArchiveIq.h \
+    base/QXmppSocks.h \
+    base/QXmppStanza.h \
+    base/QXmppStream.h \
+    base/QXmppStreamFeatures.h \
+    base/QXmppStun.h \
+    base/QXmppTask.h \
+    base/QXmppUtils.h \
+    base/QXmppVCardIq.h \
+    base/QXmppVersionIq.h \
+    base/QXmppGaming.h \
+    base/QXmppMessageCarbonsIq.h \
+    base/QXmppReachAddress.h \
+    base/QXmppSimpleArchivePreferenceIq.h \
+    base/QXmppStreamManagement.h
+
+HEADERS += \
+    base/QXmppBase64_p.h \
+    base/QXmppCertificateCache_p.h \
+    base/QXmppCodec_p.h \
+    base/QXmppDatagramStream_p.h \
+    base/QXmppDnsQuery_p.h \
+    base/QXmppEnumTable_p.h \
+    base/QXmppMemoryStats_p.h \
+    base/QXmppOutputScheduler_p.h \
+    base/QXmppRawStanza_p.h \
+    base/QXmppReadBuffer_p.h \
+    base/QXmppRtcpSession_p.h \
+    base/QXmppSasl_p.h \
+    base/QXmppSrtp_p.h \
+    base/QXmppSrvLookup_p.h \
+    base/QXmppStanzaPipeline_p.h \
+    base/QXmppStanzaTrace_p.h \
+    base/QXmppStreamCompressor_p.h \
+    base/QXmppStreamInitiationIq_p.h \
+    base/QXmppStreamParser_p.h \
+    base/QXmppStreamSplitter_p.h \
+    base/QXmppStringPool_p.h \
+    base/QXmppStun_p.h \
+    base/QXmppTimerWheel_p.h \
+    base/QXmppTracepoints_p.h \
+    base/QXmppTrafficCapture_p.h
+
+# Source files
+SOURCES += \
+    base/QXmppArchiveIq.cpp \
+    base/QXmppBase64.cpp \
+    base/QXmppBindIq.cpp \
+    base/QXmppBookmarkSet.cpp \
+    base/QXmppByteStreamIq.cpp \
+    base/QXmppCertificateCache.cpp \
+    base/QXmppCodec.cpp \
+    base/QXmppCompactStanza.cpp \
+    base/QXmppConstants.cpp \
+    base/QXmppDataForm.cpp \
+    base/QXmppDatagramStream.cpp \
+    base/QXmppDiscoveryIq.cpp \
+    base/QXmppDnsQuery.cpp \
+    base/QXmppElement.cpp \
+    base/QXmppEntityTimeIq.cpp \
+    base/QXmppEnumTable.cpp \
+    base/QXmppGlobal.cpp \
+    base/QXmppIbbIq.cpp \
+    base/QXmppIq.cpp \
+    base/QXmppJid.cpp \
+    base/QXmppJingleIq.cpp \
+    base/QXmppLastActivityIq.cpp \
+    base/QXmppLogger.cpp \
+    base/QXmppMediaRing.cpp \
+    base/QXmppMemoryStats.cpp \
+    base/QXmppMessage.cpp \
+    base/QXmppMetrics.cpp \
+    base/QXmppMucIq.cpp \
+    base/QXmppNonSASLAuth.cpp \
+    base/QXmppOutputScheduler.cpp \
+    base/QXmppPingIq.cpp \
+    base/QXmppPresence.cpp \
+    base/QXmppPubSubIq.cpp \
+    base/QXmppRawStanza.cpp \
+    base/QXmppRateLimiter.cpp \
+    base/QXmppReadBuffer.cpp \
+    base/QXmppRegisterIq.cpp \
+    base/QXmppResultSet.cpp \
+    base/QXmppRosterIq.cpp \
+    base/QXmppRpcIq.cpp \
+    base/QXmppRtcpPacket.cpp \
+    base/QXmppRtcpSession.cpp \
+    base/QXmppRtpAudioMixer.cpp \
+    base/QXmppRtpForwarder.cpp \
+    base/QXmppRtpChannel.cpp \
+    base/QXmppRtpPacket.cpp \
+    base/QXmppSasl.cpp \
+    base/QXmppSessionIq.cpp \
+    base/QXmppSimpleArchiveIq.cpp \
+    base/QXmppSocks.cpp \
+    base/QXmppSrtp.cpp \
+    base/QXmppSrvLookup.cpp \
+    base/QXmppStanza.cpp \
+    base/QXmppStanzaPipeline.cpp \
+    base/QXmppStanzaTrace.cpp \
+    base/QXmppStream.cpp \
+    base/QXmppStreamCompressor.cpp \
+    base/QXmppStreamFeatures.cpp \
+    base/QXmppStreamInitiationIq.cpp \
+    base/QXmppStreamParser.cpp \
+    base/QXmppStreamSplitter.cpp \
+    base/QXmppStringPool.cpp \
+    base/QXmppStun.cpp \
+    base/QXmppTask.cpp \
+    base/QXmppTimerWheel.cpp \
+    base/QXmppTrafficCapture.cpp \
+    base/QXmppUtils.cpp \
+    base/QXmppVCardIq.cpp \
+    base/QXmppVersionIq.cpp \
+    base/QXmppSimpleArchivePreferenceIq.cpp \
+    base/QXmppMessageCarbonsIq.cpp \
+    base/QXmppReachAddress.cpp \
+    base/QXmppStreamManagement.cpp \
+    base/QXmppGaming.cpp
+
+# DNS
+qt_version = $$QT_MAJOR_VERSION
+contains(qt_version, 4) {
+    INSTALL_HEADERS += base/qdnslookup.h base/qdnslookup_p.h
+    SOURCES += base/qdnslookup.cpp
+    android:SOURCES += base/qdnslookup_stub.cpp
+    else:symbian:SOURCES += base/qdnslookup_symbian.cpp
+    else:unix:SOURCES += base/qdnslookup_unix.cpp
+    else:win32:SOURCES += base/qdnslookup_win.cpp
+    else:SOURCES += base/qdnslookup_stub.cpp
+}
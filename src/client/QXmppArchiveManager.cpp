@@ -22,12 +22,344 @@
  */
 
 #include <QDomElement>
+#include <QMap>
+#include <QPointer>
+#include <QTimer>
 
 #include "QXmppArchiveIq.h"
 #include "QXmppArchiveManager.h"
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
 
+class QXmppArchiveJobPrivate
+{
+public:
+    QXmppArchiveJobPrivate();
+
+    struct Page
+    {
+        QList<QXmppArchiveChat> chats;
+        QXmppArchiveChat chat;
+    };
+
+    QXmppArchiveManager *manager;
+    QXmppArchiveJob::Type type;
+    QString jid;
+    QDateTime start;
+    QDateTime end;
+    int pageSize;
+    int windowSize;
+
+    // total number of results, or -1 if the server did not report it
+    int count;
+    int received;
+
+    // indexes of the next page to request and to deliver
+    int nextIndex;
+    int deliverIndex;
+
+    // cursor used when pages are requested one after the other
+    QString after;
+    bool more;
+
+    bool finished;
+    bool paused;
+    QXmppArchiveJob::Error error;
+    QXmppStanza::Error stanzaError;
+
+    // page index of each request in flight
+    QHash<QString, int> requests;
+    // pages received but not yet delivered
+    QMap<int, Page> pages;
+};
+
+QXmppArchiveJobPrivate::QXmppArchiveJobPrivate()
+    : manager(0)
+    , type(QXmppArchiveJob::ListType)
+    , pageSize(0)
+    , windowSize(0)
+    , count(-1)
+    , received(0)
+    , nextIndex(0)
+    , deliverIndex(0)
+    , more(true)
+    , finished(false)
+    , paused(false)
+    , error(QXmppArchiveJob::NoError)
+{
+}
+
+class QXmppArchiveManagerPrivate
+{
+public:
+    // job waiting for each request in flight
+    QHash<QString, QPointer<QXmppArchiveJob> > jobs;
+};
+
+/// \cond
+QXmppArchiveJob::QXmppArchiveJob(Type type, const QString &jid, int pageSize, int windowSize, QXmppArchiveManager *manager)
+    : QXmppLoggable(manager)
+    , d(new QXmppArchiveJobPrivate)
+{
+    d->manager = manager;
+    d->type = type;
+    d->jid = jid;
+    d->pageSize = qMax(1, pageSize);
+    d->windowSize = qMax(1, windowSize);
+}
+/// \endcond
+
+QXmppArchiveJob::~QXmppArchiveJob()
+{
+    delete d;
+}
+
+/// Aborts the job.
+
+void QXmppArchiveJob::abort()
+{
+    terminate(AbortError);
+}
+
+/// Returns the total number of results as reported by the server,
+/// or -1 if it is not known.
+
+int QXmppArchiveJob::count() const
+{
+    return d->count;
+}
+
+/// Returns the last error that was encountered.
+
+QXmppArchiveJob::Error QXmppArchiveJob::error() const
+{
+    return d->error;
+}
+
+/// Returns true if the job has finished.
+
+bool QXmppArchiveJob::isFinished() const
+{
+    return d->finished;
+}
+
+/// Returns true if the job is paused.
+
+bool QXmppArchiveJob::isPaused() const
+{
+    return d->paused;
+}
+
+/// Returns the JID of the conversations being retrieved.
+
+QString QXmppArchiveJob::jid() const
+{
+    return d->jid;
+}
+
+/// Returns the maximum number of results requested in each page.
+
+int QXmppArchiveJob::pageSize() const
+{
+    return d->pageSize;
+}
+
+/// Pauses the job.
+///
+/// No further pages are requested or delivered until resume() is called.
+/// Requests which are already in flight are buffered as they arrive.
+
+void QXmppArchiveJob::pause()
+{
+    d->paused = true;
+}
+
+/// Returns the number of results which have been delivered so far.
+
+int QXmppArchiveJob::received() const
+{
+    return d->received;
+}
+
+/// Resumes a paused job.
+
+void QXmppArchiveJob::resume()
+{
+    if (!d->paused)
+        return;
+
+    d->paused = false;
+    deliver();
+}
+
+/// Returns the error returned by the server if error() is ProtocolError.
+
+QXmppStanza::Error QXmppArchiveJob::stanzaError() const
+{
+    return d->stanzaError;
+}
+
+/// Returns the job's type.
+
+QXmppArchiveJob::Type QXmppArchiveJob::type() const
+{
+    return d->type;
+}
+
+/// Returns the maximum number of pages which are requested or buffered
+/// at any given time.
+
+int QXmppArchiveJob::windowSize() const
+{
+    return d->windowSize;
+}
+
+void QXmppArchiveJob::deliver()
+{
+    while (!d->finished && !d->paused && d->pages.contains(d->deliverIndex)) {
+        const QXmppArchiveJobPrivate::Page page = d->pages.take(d->deliverIndex);
+        d->deliverIndex += d->pageSize;
+        if (d->type == ListType) {
+            d->received += page.chats.size();
+            emit chatsReceived(page.chats);
+        } else {
+            d->received += page.chat.messages().size();
+            emit messagesReceived(page.chat);
+        }
+    }
+
+    request();
+
+    // check whether we are done
+    if (!d->finished && d->requests.isEmpty() && d->pages.isEmpty()) {
+        if (d->count >= 0 ? d->nextIndex >= d->count : !d->more)
+            terminate(NoError);
+    }
+}
+
+void QXmppArchiveJob::handleFailure(const QString &id, Error error, const QXmppStanza::Error &stanzaError)
+{
+    if (!d->requests.remove(id))
+        return;
+
+    d->stanzaError = stanzaError;
+    terminate(error);
+}
+
+void QXmppArchiveJob::handleReply(const QString &id, const QXmppArchiveChatIq *chatIq, const QXmppArchiveListIq *listIq)
+{
+    if (!d->requests.contains(id))
+        return;
+    const int index = d->requests.take(id);
+
+    QXmppArchiveJobPrivate::Page page;
+    QXmppResultSetReply rsm;
+    int size;
+    if (listIq) {
+        page.chats = listIq->chats();
+        rsm = listIq->resultSetReply();
+        size = page.chats.size();
+    } else {
+        page.chat = chatIq->chat();
+        rsm = chatIq->resultSetReply();
+        size = page.chat.messages().size();
+    }
+
+    // once the total is known, pages are requested by index
+    if (d->count < 0 && rsm.count() >= 0)
+        d->count = rsm.count();
+    d->after = rsm.last();
+    d->more = size >= d->pageSize && !d->after.isEmpty();
+
+    d->pages.insert(index, page);
+    deliver();
+}
+
+void QXmppArchiveJob::request()
+{
+    while (!d->finished && !d->paused &&
+           d->requests.size() + d->pages.size() < d->windowSize) {
+
+        QXmppResultSetQuery rsm;
+        rsm.setMax(d->pageSize);
+        if (d->count < 0) {
+            // without a total, we can only follow the cursor
+            if (!d->requests.isEmpty() || !d->more)
+                break;
+            if (!d->after.isEmpty())
+                rsm.setAfter(d->after);
+        } else {
+            if (d->nextIndex >= d->count)
+                break;
+            rsm.setIndex(d->nextIndex);
+        }
+
+        QString id;
+        bool sent;
+        if (d->type == ListType) {
+            QXmppArchiveListIq packet;
+            packet.setResultSetQuery(rsm);
+            packet.setWith(d->jid);
+            packet.setStart(d->start);
+            packet.setEnd(d->end);
+            id = packet.id();
+            sent = d->manager->client()->sendPacket(packet);
+        } else {
+            QXmppArchiveRetrieveIq packet;
+            packet.setResultSetQuery(rsm);
+            packet.setStart(d->start);
+            packet.setWith(d->jid);
+            id = packet.id();
+            sent = d->manager->client()->sendPacket(packet);
+        }
+        if (!sent) {
+            terminate(ConnectionError);
+            return;
+        }
+
+        d->requests.insert(id, d->nextIndex);
+        d->manager->d->jobs.insert(id, this);
+        d->nextIndex += d->pageSize;
+    }
+}
+
+void QXmppArchiveJob::terminate(Error error)
+{
+    if (d->finished)
+        return;
+
+    d->error = error;
+    d->finished = true;
+
+    // forget about requests in flight
+    foreach (const QString &id, d->requests.keys())
+        d->manager->d->jobs.remove(id);
+    d->requests.clear();
+    d->pages.clear();
+
+    // emit signals later
+    QTimer::singleShot(0, this, SLOT(_q_finished()));
+}
+
+void QXmppArchiveJob::_q_finished()
+{
+    emit finished();
+}
+
+/// Constructs a new QXmppArchiveManager.
+
+QXmppArchiveManager::QXmppArchiveManager()
+    : d(new QXmppArchiveManagerPrivate)
+{
+}
+
+/// Destroys a QXmppArchiveManager.
+
+QXmppArchiveManager::~QXmppArchiveManager()
+{
+    delete d;
+}
+
 /// \cond
 QStringList QXmppArchiveManager::discoveryFeatures() const
 {
@@ -45,6 +377,11 @@ bool QXmppArchiveManager::handleStanza(const QDomElement &element)
     {
         QXmppArchiveChatIq archiveIq;
         archiveIq.parse(element);
+        QPointer<QXmppArchiveJob> job = d->jobs.take(archiveIq.id());
+        if (job) {
+            job->handleReply(archiveIq.id(), &archiveIq, 0);
+            return true;
+        }
         emit archiveChatReceived(archiveIq.chat(), archiveIq.resultSetReply());
         return true;
     }
@@ -52,6 +389,11 @@ bool QXmppArchiveManager::handleStanza(const QDomElement &element)
     {
         QXmppArchiveListIq archiveIq;
         archiveIq.parse(element);
+        QPointer<QXmppArchiveJob> job = d->jobs.take(archiveIq.id());
+        if (job) {
+            job->handleReply(archiveIq.id(), 0, &archiveIq);
+            return true;
+        }
         emit archiveListReceived(archiveIq.chats(), archiveIq.resultSetReply());
         return true;
     }
@@ -65,8 +407,86 @@ bool QXmppArchiveManager::handleStanza(const QDomElement &element)
 
     return false;
 }
+
+void QXmppArchiveManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(sessionEnded()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(iqReceived(QXmppIq)),
+                    this, SLOT(_q_iqReceived(QXmppIq)));
+    Q_ASSERT(check);
+}
 /// \endcond
 
+void QXmppArchiveManager::_q_disconnected()
+{
+    const QList<QPointer<QXmppArchiveJob> > jobs = d->jobs.values();
+    d->jobs.clear();
+    foreach (const QPointer<QXmppArchiveJob> &job, jobs) {
+        if (job)
+            job->terminate(QXmppArchiveJob::ConnectionError);
+    }
+}
+
+void QXmppArchiveManager::_q_iqReceived(const QXmppIq &iq)
+{
+    // errors carry no archive payload and are not handled by handleStanza()
+    if (iq.type() != QXmppIq::Error)
+        return;
+
+    QPointer<QXmppArchiveJob> job = d->jobs.take(iq.id());
+    if (job)
+        job->handleFailure(iq.id(), QXmppArchiveJob::ProtocolError, iq.error());
+}
+
+/// Lists all the collections matching the given criteria, one page at a time.
+///
+/// The collections are delivered by the returned job's chatsReceived()
+/// signal.
+///
+/// \param jid JID you want conversations with.
+/// \param start Optional start time.
+/// \param end Optional end time.
+/// \param pageSize Maximum number of collections in each page.
+/// \param windowSize Maximum number of pages requested at once.
+
+QXmppArchiveJob *QXmppArchiveManager::listAllCollections(const QString &jid, const QDateTime &start, const QDateTime &end,
+                                                         int pageSize, int windowSize)
+{
+    QXmppArchiveJob *job = new QXmppArchiveJob(QXmppArchiveJob::ListType, jid, pageSize, windowSize, this);
+    job->d->start = start;
+    job->d->end = end;
+    job->request();
+    return job;
+}
+
+/// Retrieves all the messages of the specified collection, one page at
+/// a time.
+///
+/// The messages are delivered by the returned job's messagesReceived()
+/// signal.
+///
+/// \param jid The JID of the collection
+/// \param start The start time of the collection.
+/// \param pageSize Maximum number of messages in each page.
+/// \param windowSize Maximum number of pages requested at once.
+
+QXmppArchiveJob *QXmppArchiveManager::retrieveFullCollection(const QString &jid, const QDateTime &start,
+                                                             int pageSize, int windowSize)
+{
+    QXmppArchiveJob *job = new QXmppArchiveJob(QXmppArchiveJob::RetrieveType, jid, pageSize, windowSize, this);
+    job->d->start = start;
+    job->request();
+    return job;
+}
+
 /// Retrieves the list of available collections. Once the results are
 /// received, the archiveListReceived() signal will be emitted.
 ///
@@ -28,12 +28,104 @@
 
 #include "QXmppClientExtension.h"
 #include "QXmppResultSet.h"
+#include "QXmppStanza.h"
 
 class QXmppArchiveChat;
 class QXmppArchiveChatIq;
+class QXmppArchiveJobPrivate;
 class QXmppArchiveListIq;
+class QXmppArchiveManager;
+class QXmppArchiveManagerPrivate;
 class QXmppArchivePrefIq;
 
+/// \brief The QXmppArchiveJob class represents a paged retrieval of
+/// message archives.
+///
+/// Jobs are created by QXmppArchiveManager::listAllCollections() and
+/// QXmppArchiveManager::retrieveFullCollection(). Once the first page has
+/// been received and the server has reported the total number of results,
+/// the job keeps several page requests in flight using the Result Set
+/// Management index. If the server does not report the number of results,
+/// pages are requested one after the other.
+///
+/// Pages are always delivered in order. If you cannot keep up with the
+/// results, call pause(): no further pages are requested or delivered until
+/// you call resume().
+///
+/// The job is owned by the manager, call deleteLater() once you are done
+/// with it.
+
+class QXMPP_EXPORT QXmppArchiveJob : public QXmppLoggable
+{
+    Q_OBJECT
+    Q_ENUMS(Error Type)
+    Q_PROPERTY(QString jid READ jid CONSTANT)
+    Q_PROPERTY(Type type READ type CONSTANT)
+    Q_PROPERTY(int count READ count)
+    Q_PROPERTY(int received READ received)
+
+public:
+    /// This enum is used to describe the type of error encountered by a job.
+    enum Error
+    {
+        NoError = 0,        ///< No error occurred.
+        AbortError,         ///< The job was aborted.
+        ConnectionError,    ///< The connection to the server was lost.
+        ProtocolError       ///< The server returned an error, see stanzaError().
+    };
+
+    /// This enum is used to describe the type of a job.
+    enum Type
+    {
+        ListType,           ///< The job lists collections.
+        RetrieveType        ///< The job retrieves the messages of a collection.
+    };
+
+    ~QXmppArchiveJob();
+
+    int count() const;
+    Error error() const;
+    bool isFinished() const;
+    bool isPaused() const;
+    QString jid() const;
+    int pageSize() const;
+    int received() const;
+    QXmppStanza::Error stanzaError() const;
+    Type type() const;
+    int windowSize() const;
+
+signals:
+    /// This signal is emitted with each page of collections of a ListType job.
+    void chatsReceived(const QList<QXmppArchiveChat> &chats);
+
+    /// This signal is emitted with each page of messages of a RetrieveType
+    /// job. The \a chat holds the messages of the page.
+    void messagesReceived(const QXmppArchiveChat &chat);
+
+    /// This signal is emitted once the job has finished, either because all
+    /// the results were received or because an error occurred.
+    void finished();
+
+public slots:
+    void abort();
+    void pause();
+    void resume();
+
+private slots:
+    void _q_finished();
+
+private:
+    QXmppArchiveJob(Type type, const QString &jid, int pageSize, int windowSize, QXmppArchiveManager *manager);
+    void handleReply(const QString &id, const QXmppArchiveChatIq *chatIq, const QXmppArchiveListIq *listIq);
+    void handleFailure(const QString &id, Error error, const QXmppStanza::Error &stanzaError = QXmppStanza::Error());
+    void deliver();
+    void request();
+    void terminate(Error error);
+
+    QXmppArchiveJobPrivate *const d;
+    friend class QXmppArchiveManager;
+};
+
 /// \brief The QXmppArchiveManager class makes it possible to access message
 /// archives as defined by XEP-0136: Message Archiving.
 ///
@@ -55,6 +147,14 @@ class QXMPP_EXPORT QXmppArchiveManager : public QXmppClientExtension
     Q_OBJECT
 
 public:
+    QXmppArchiveManager();
+    ~QXmppArchiveManager();
+
+    QXmppArchiveJob *listAllCollections(const QString &jid, const QDateTime &start = QDateTime(), const QDateTime &end = QDateTime(),
+                                        int pageSize = 100, int windowSize = 4);
+    QXmppArchiveJob *retrieveFullCollection(const QString &jid, const QDateTime &start,
+                                            int pageSize = 100, int windowSize = 4);
+
     void listCollections(const QString &jid, const QDateTime &start = QDateTime(), const QDateTime &end = QDateTime(),
                          const QXmppResultSetQuery &rsm = QXmppResultSetQuery());
     void listCollections(const QString &jid, const QDateTime &start, const QDateTime &end, int max);
@@ -75,6 +175,19 @@ signals:
     /// This signal is emitted when archive chat is received
     /// after calling retrieveCollection()
     void archiveChatReceived(const QXmppArchiveChat&, const QXmppResultSetReply &rsm = QXmppResultSetReply());
+
+protected:
+    /// \cond
+    void setClient(QXmppClient *client);
+    /// \endcond
+
+private slots:
+    void _q_disconnected();
+    void _q_iqReceived(const QXmppIq &iq);
+
+private:
+    QXmppArchiveManagerPrivate *d;
+    friend class QXmppArchiveJob;
 };
 
 #endif
@@ -22,12 +22,16 @@
  */
 
 #include <QDomElement>
+#include <QHash>
+#include <QSet>
 
 #include "QXmppBookmarkManager.h"
 #include "QXmppBookmarkSet.h"
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
+#include "QXmppDiscoveryIq.h"
 #include "QXmppIq.h"
+#include "QXmppPubSubIq.h"
 #include "QXmppUtils.h"
 
 // The QXmppPrivateStorageIq class represents an XML private storage IQ
@@ -82,21 +86,132 @@ void QXmppPrivateStorageIq::toXmlElementFromChild(QXmlStreamWriter *writer) cons
     writer->writeEndElement();
 }
 
+static bool sameConference(const QXmppBookmarkConference &a, const QXmppBookmarkConference &b)
+{
+    return a.jid() == b.jid() &&
+           a.name() == b.name() &&
+           a.nickName() == b.nickName() &&
+           a.autoJoin() == b.autoJoin();
+}
+
+// XEP-0402: PEP Native Bookmarks
+
+static QXmppBookmarkConference pepConference(const QString &jid, const QDomElement &element)
+{
+    QXmppBookmarkConference conference;
+    conference.setJid(jid);
+    conference.setName(element.attribute("name"));
+    conference.setAutoJoin(element.attribute("autojoin") == "true" || element.attribute("autojoin") == "1");
+    conference.setNickName(element.firstChildElement("nick").text());
+    return conference;
+}
+
+static QXmppPubSubItem pepItem(const QXmppBookmarkConference &conference)
+{
+    QXmppElement conferenceElement;
+    conferenceElement.setTagName("conference");
+    conferenceElement.setAttribute("xmlns", ns_bookmarks2);
+    if (conference.autoJoin())
+        conferenceElement.setAttribute("autojoin", "true");
+    if (!conference.name().isEmpty())
+        conferenceElement.setAttribute("name", conference.name());
+    if (!conference.nickName().isEmpty()) {
+        QXmppElement nickElement;
+        nickElement.setTagName("nick");
+        nickElement.setValue(conference.nickName());
+        conferenceElement.appendChild(nickElement);
+    }
+
+    QXmppPubSubItem item;
+    item.setId(conference.jid());
+    item.setContents(conferenceElement);
+    return item;
+}
+
+static QXmppDataForm pepPublishOptions()
+{
+    QList<QXmppDataForm::Field> fields;
+    QXmppDataForm::Field field(QXmppDataForm::Field::HiddenField);
+    field.setKey("FORM_TYPE");
+    field.setValue("http://jabber.org/protocol/pubsub#publish-options");
+    fields << field;
+
+    // the bookmarks are private, and each room is an item
+    const char *options[][2] = {
+        {"pubsub#persist_items", "true"},
+        {"pubsub#max_items", "max"},
+        {"pubsub#send_last_published_item", "never"},
+        {"pubsub#access_model", "whitelist"},
+    };
+    for (unsigned int i = 0; i < sizeof(options) / sizeof(options[0]); ++i) {
+        QXmppDataForm::Field option;
+        option.setKey(options[i][0]);
+        option.setValue(QString(options[i][1]));
+        fields << option;
+    }
+
+    QXmppDataForm form(QXmppDataForm::Submit);
+    form.setFields(fields);
+    return form;
+}
+
 class QXmppBookmarkManagerPrivate
 {
 public:
+    QXmppBookmarkManagerPrivate();
+
+    void removeConference(const QString &jid);
+    void replaceConference(const QXmppBookmarkConference &conference);
+
     QXmppBookmarkSet bookmarks;
     QXmppBookmarkSet pendingBookmarks;
     QString pendingId;
     bool bookmarksReceived;
+
+    // XEP-0402: PEP Native Bookmarks
+    bool pepEnabled;
+    QString pepIdsId;
+    QString pepItemsId;
+    // publications and retractions waiting for their result, by IQ id
+    QHash<QString, QXmppBookmarkConference> pepPublications;
+    QHash<QString, QString> pepRetractions;
 };
 
+QXmppBookmarkManagerPrivate::QXmppBookmarkManagerPrivate()
+    : bookmarksReceived(false)
+    , pepEnabled(false)
+{
+}
+
+void QXmppBookmarkManagerPrivate::removeConference(const QString &jid)
+{
+    QList<QXmppBookmarkConference> conferences = bookmarks.conferences();
+    for (int i = conferences.size() - 1; i >= 0; --i) {
+        if (conferences[i].jid() == jid)
+            conferences.removeAt(i);
+    }
+    bookmarks.setConferences(conferences);
+}
+
+void QXmppBookmarkManagerPrivate::replaceConference(const QXmppBookmarkConference &conference)
+{
+    QList<QXmppBookmarkConference> conferences = bookmarks.conferences();
+    for (int i = 0; i < conferences.size(); ++i) {
+        if (conferences[i].jid() == conference.jid()) {
+            conferences[i] = conference;
+            bookmarks.setConferences(conferences);
+            return;
+        }
+    }
+    conferences << conference;
+    bookmarks.setConferences(conferences);
+}
+
 /// Constructs a new bookmark manager.
 ///
 QXmppBookmarkManager::QXmppBookmarkManager()
     : d(new QXmppBookmarkManagerPrivate)
 {
-    d->bookmarksReceived = false;
 }
 
 /// Destroys a bookmark manager.
@@ -127,10 +242,40 @@ QXmppBookmarkSet QXmppBookmarkManager::bookmarks() const
 
 /// Stores the bookmarks on the server.
 ///
+/// If PEP storage is enabled, only the conferences which were added or
+/// changed are published, and those which were removed are retracted.
+///
 /// \param bookmarks
 
 bool QXmppBookmarkManager::setBookmarks(const QXmppBookmarkSet &bookmarks)
 {
+    if (d->pepEnabled) {
+        bool sent = true;
+        foreach (const QXmppBookmarkConference &current, d->bookmarks.conferences()) {
+            bool kept = false;
+            foreach (const QXmppBookmarkConference &conference, bookmarks.conferences()) {
+                if (conference.jid() == current.jid()) {
+                    kept = true;
+                    break;
+                }
+            }
+            if (!kept)
+                sent = removeBookmark(current.jid()) && sent;
+        }
+        foreach (const QXmppBookmarkConference &conference, bookmarks.conferences()) {
+            bool known = false;
+            foreach (const QXmppBookmarkConference &current, d->bookmarks.conferences()) {
+                if (sameConference(conference, current)) {
+                    known = true;
+                    break;
+                }
+            }
+            if (!known)
+                sent = addBookmark(conference) && sent;
+        }
+        return sent;
+    }
+
     QXmppPrivateStorageIq iq;
     iq.setType(QXmppIq::Set);
     iq.setBookmarks(bookmarks);
@@ -142,7 +287,115 @@ bool QXmppBookmarkManager::setBookmarks(const QXmppBookmarkSet &bookmarks)
     return true;
 }
 
+/// Adds a conference bookmark, or replaces the bookmark for the same room.
+///
+/// If PEP storage is enabled, only this bookmark is sent to the server.
+///
+/// \param conference
+
+bool QXmppBookmarkManager::addBookmark(const QXmppBookmarkConference &conference)
+{
+    if (!d->pepEnabled) {
+        const QXmppBookmarkSet current = d->bookmarks;
+        d->replaceConference(conference);
+        const QXmppBookmarkSet bookmarks = d->bookmarks;
+        d->bookmarks = current;
+        return setBookmarks(bookmarks);
+    }
+
+    QXmppPubSubIq iq;
+    iq.setType(QXmppIq::Set);
+    iq.setQueryType(QXmppPubSubIq::PublishQuery);
+    iq.setQueryNode(ns_bookmarks2);
+    iq.setItems(QList<QXmppPubSubItem>() << pepItem(conference));
+    iq.setPublishOptions(pepPublishOptions());
+    if (!client()->sendPacket(iq))
+        return false;
+
+    d->pepPublications.insert(iq.id(), conference);
+    return true;
+}
+
+/// Removes the conference bookmark for the given room.
+///
+/// If PEP storage is enabled, only the removal of this bookmark is sent to
+/// the server.
+///
+/// \param jid
+
+bool QXmppBookmarkManager::removeBookmark(const QString &jid)
+{
+    if (!d->pepEnabled) {
+        const QXmppBookmarkSet current = d->bookmarks;
+        d->removeConference(jid);
+        const QXmppBookmarkSet bookmarks = d->bookmarks;
+        d->bookmarks = current;
+        return setBookmarks(bookmarks);
+    }
+
+    QXmppPubSubItem item;
+    item.setId(jid);
+
+    QXmppPubSubIq iq;
+    iq.setType(QXmppIq::Set);
+    iq.setQueryType(QXmppPubSubIq::RetractQuery);
+    iq.setQueryNode(ns_bookmarks2);
+    iq.setItems(QList<QXmppPubSubItem>() << item);
+    if (!client()->sendPacket(iq))
+        return false;
+
+    d->pepRetractions.insert(iq.id(), jid);
+    return true;
+}
+
+/// Returns true if the bookmarks are stored as XEP-0402: PEP Native
+/// Bookmarks rather than in XEP-0049: Private XML Storage.
+
+bool QXmppBookmarkManager::isPepEnabled() const
+{
+    return d->pepEnabled;
+}
+
+/// Sets whether the bookmarks are stored as XEP-0402: PEP Native Bookmarks
+/// rather than in XEP-0049: Private XML Storage, which is the default.
+///
+/// PEP bookmarks only hold conferences. Check that the server advertises
+/// the "urn:xmpp:bookmarks:1#compat" feature on the account before
+/// enabling them, so that clients which use private storage see the same
+/// bookmarks.
+///
+/// \param enabled
+
+void QXmppBookmarkManager::setPepEnabled(bool enabled)
+{
+    d->pepEnabled = enabled;
+}
+
+/// Sets the bookmarks known from a previous session, for instance loaded
+/// from disk, before connecting.
+///
+/// If PEP storage is enabled, the server is asked for the IDs of its
+/// bookmarks when the client connects: the cached bookmarks which are no
+/// longer on the server are dropped, and only the missing ones are
+/// downloaded. Bookmarks which were changed by another client while this
+/// one was offline are not detected, as their IDs are the rooms' JIDs.
+///
+/// \param bookmarks
+
+void QXmppBookmarkManager::setCachedBookmarks(const QXmppBookmarkSet &bookmarks)
+{
+    d->bookmarks = bookmarks;
+}
+
 /// \cond
+QStringList QXmppBookmarkManager::discoveryFeatures() const
+{
+    // receive the changes made by our other resources
+    if (d->pepEnabled)
+        return QStringList() << QString(ns_bookmarks2) + "+notify";
+    return QStringList();
+}
+
 void QXmppBookmarkManager::setClient(QXmppClient *client)
 {
     bool check;
@@ -154,7 +407,7 @@ void QXmppBookmarkManager::setClient(QXmppClient *client)
                     this, SLOT(slotConnected()));
     Q_ASSERT(check);
 
-    check = connect(client, SIGNAL(disconnected()),
+    check = connect(client, SIGNAL(sessionEnded()),
                     this, SLOT(slotDisconnected()));
     Q_ASSERT(check);
 }
@@ -163,6 +416,7 @@ bool QXmppBookmarkManager::handleStanza(const QDomElement &stanza)
 {
     if (stanza.tagName() == "iq")
     {
+        const QString id = stanza.attribute("id");
         if (QXmppPrivateStorageIq::isPrivateStorageIq(stanza))
         {
             QXmppPrivateStorageIq iq;
@@ -176,7 +430,7 @@ bool QXmppBookmarkManager::handleStanza(const QDomElement &stanza)
             }
             return true;
         }
-        else if (!d->pendingId.isEmpty() && stanza.attribute("id") == d->pendingId)
+        else if (!d->pendingId.isEmpty() && id == d->pendingId)
         {
             QXmppIq iq;
             iq.parse(stanza);
@@ -188,6 +442,110 @@ bool QXmppBookmarkManager::handleStanza(const QDomElement &stanza)
             d->pendingId = QString();
             return true;
         }
+        else if (!d->pepIdsId.isEmpty() && id == d->pepIdsId)
+        {
+            // the IDs of the bookmarks on the server, a missing node
+            // meaning there are none
+            QXmppDiscoveryIq iq;
+            iq.parse(stanza);
+            QSet<QString> ids;
+            if (iq.type() == QXmppIq::Result) {
+                foreach (const QXmppDiscoveryIq::Item &item, iq.items())
+                    ids << item.name();
+            }
+            d->pepIdsId = QString();
+
+            // drop the bookmarks which were removed, and fetch the new ones
+            QList<QXmppPubSubItem> missing;
+            QList<QXmppBookmarkConference> conferences;
+            foreach (const QXmppBookmarkConference &conference, d->bookmarks.conferences()) {
+                if (ids.remove(conference.jid()))
+                    conferences << conference;
+            }
+            d->bookmarks.setConferences(conferences);
+            foreach (const QString &itemId, ids) {
+                QXmppPubSubItem item;
+                item.setId(itemId);
+                missing << item;
+            }
+
+            if (!missing.isEmpty()) {
+                QXmppPubSubIq request;
+                request.setType(QXmppIq::Get);
+                request.setQueryType(QXmppPubSubIq::ItemsQuery);
+                request.setQueryNode(ns_bookmarks2);
+                request.setItems(missing);
+                if (client()->sendPacket(request)) {
+                    d->pepItemsId = request.id();
+                    return true;
+                }
+            }
+            d->bookmarksReceived = true;
+            emit bookmarksReceived(d->bookmarks);
+            return true;
+        }
+        else if (!d->pepItemsId.isEmpty() && id == d->pepItemsId)
+        {
+            QXmppPubSubIq iq;
+            iq.parse(stanza);
+            if (iq.type() == QXmppIq::Result) {
+                foreach (const QXmppPubSubItem &item, iq.items()) {
+                    const QDomElement element = item.contents().sourceDomElement();
+                    if (element.tagName() == "conference" && element.namespaceURI() == ns_bookmarks2)
+                        d->replaceConference(pepConference(item.id(), element));
+                }
+            }
+            d->pepItemsId = QString();
+            d->bookmarksReceived = true;
+            emit bookmarksReceived(d->bookmarks);
+            return true;
+        }
+        else if (d->pepPublications.contains(id))
+        {
+            const QXmppBookmarkConference conference = d->pepPublications.take(id);
+            if (stanza.attribute("type") == "result") {
+                d->replaceConference(conference);
+                emit bookmarksReceived(d->bookmarks);
+            }
+            return true;
+        }
+        else if (d->pepRetractions.contains(id))
+        {
+            const QString jid = d->pepRetractions.take(id);
+            if (stanza.attribute("type") == "result") {
+                d->removeConference(jid);
+                emit bookmarksReceived(d->bookmarks);
+            }
+            return true;
+        }
+    }
+    else if (d->pepEnabled && stanza.tagName() == "message")
+    {
+        // changes made by our other resources
+        const QDomElement itemsElement = stanza.firstChildElement("event").firstChildElement("items");
+        if (itemsElement.namespaceURI() != ns_personal_eventing_protocol ||
+            itemsElement.attribute("node") != ns_bookmarks2)
+            return false;
+
+        const QString from = stanza.attribute("from");
+        if (!from.isEmpty() && from != client()->configuration().jidBare())
+            return false;
+
+        QDomElement childElement = itemsElement.firstChildElement();
+        while (!childElement.isNull()) {
+            const QString itemId = childElement.attribute("id");
+            if (childElement.tagName() == "item") {
+                const QDomElement conferenceElement = childElement.firstChildElement("conference");
+                if (conferenceElement.namespaceURI() == ns_bookmarks2)
+                    d->replaceConference(pepConference(itemId, conferenceElement));
+            } else if (childElement.tagName() == "retract") {
+                d->removeConference(itemId);
+            }
+            childElement = childElement.nextSiblingElement();
+        }
+        if (d->bookmarksReceived)
+            emit bookmarksReceived(d->bookmarks);
+        return true;
     }
     return false;
 }
@@ -195,6 +553,18 @@ bool QXmppBookmarkManager::handleStanza(const QDomElement &stanza)
 
 void QXmppBookmarkManager::slotConnected()
 {
+    if (d->pepEnabled) {
+        // list the IDs of the bookmarks, to only fetch the ones we miss
+        QXmppDiscoveryIq iq;
+        iq.setType(QXmppIq::Get);
+        iq.setQueryType(QXmppDiscoveryIq::ItemsQuery);
+        iq.setTo(client()->configuration().jidBare());
+        iq.setQueryNode(ns_bookmarks2);
+        if (client()->sendPacket(iq))
+            d->pepIdsId = iq.id();
+        return;
+    }
+
     QXmppPrivateStorageIq iq;
     iq.setType(QXmppIq::Get);
     client()->sendPacket(iq);
@@ -202,7 +572,12 @@ void QXmppBookmarkManager::slotConnected()
 
 void QXmppBookmarkManager::slotDisconnected()
 {
-    d->bookmarks = QXmppBookmarkSet();
+    // PEP bookmarks are kept as a cache for the next session
+    if (!d->pepEnabled)
+        d->bookmarks = QXmppBookmarkSet();
     d->bookmarksReceived = false;
+    d->pepIdsId = QString();
+    d->pepItemsId = QString();
+    d->pepPublications.clear();
+    d->pepRetractions.clear();
 }
-
@@ -28,12 +28,21 @@
 
 #include "QXmppClientExtension.h"
 
+class QXmppBookmarkConference;
 class QXmppBookmarkManagerPrivate;
 class QXmppBookmarkSet;
 
 /// \brief The QXmppBookmarkManager class allows you to store and retrieve
 /// bookmarks as defined by XEP-0048: Bookmarks.
 ///
+/// By default the whole set of bookmarks is stored in XEP-0049: Private
+/// XML Storage. When PEP storage is enabled with setPepEnabled(), conference
+/// bookmarks are instead stored as one item per room, as defined by
+/// XEP-0402: PEP Native Bookmarks, so that changing a bookmark only sends
+/// that bookmark. The bookmarks from the previous session are kept, and
+/// can be provided with setCachedBookmarks(), so that only the bookmarks
+/// which are not known are downloaded when the client connects.
+///
 
 class QXMPP_EXPORT QXmppBookmarkManager : public QXmppClientExtension
 {
@@ -47,7 +56,15 @@ public:
     QXmppBookmarkSet bookmarks() const;
     bool setBookmarks(const QXmppBookmarkSet &bookmarks);
 
+    bool addBookmark(const QXmppBookmarkConference &conference);
+    bool removeBookmark(const QString &jid);
+
+    bool isPepEnabled() const;
+    void setPepEnabled(bool enabled);
+    void setCachedBookmarks(const QXmppBookmarkSet &bookmarks);
+
     /// \cond
+    QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &stanza);
     /// \endcond
 
@@ -0,0 +1,805 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <string.h>
+
+#include <QHash>
+#include <QMap>
+#include <QNetworkProxy>
+#include <QSslConfiguration>
+#include <QSslSocket>
+#include <QUrl>
+
+#include "QXmppBoshClient_p.h"
+#include "QXmppConstants.h"
+#include "QXmppStreamSplitter_p.h"
+
+// the largest response headers and body which are accepted
+static const int maximumHeaderSize = 8192;
+static const int maximumBodySize = 1048576;
+
+// the number of times a request is sent again when its connection is lost
+static const int maximumRetries = 3;
+
+// the session parameters which are asked for: one request is held so that
+// the connection manager can send data at any time, and the others are
+// used to send data right away
+static const int requestedHold = 1;
+static const int requestedWait = 60;
+
+// A body to send, in the order it was written.
+struct QXmppBoshBody
+{
+    QXmppBoshBody()
+        : restart(false), terminate(false)
+    {
+    }
+
+    QByteArray attributes;
+    QByteArray payload;
+    bool restart;
+    bool terminate;
+};
+
+struct QXmppBoshClientConnection
+{
+    QXmppBoshClientConnection()
+        : rid(-1), ready(false)
+    {
+    }
+
+    QByteArray buffer;
+    // the request the connection carries, or -1
+    qint64 rid;
+    bool ready;
+};
+
+class QXmppBoshClientPrivate
+{
+public:
+    QXmppBoshClientPrivate(QXmppBoshClient *qq);
+
+    void abort(QAbstractSocket::SocketError error, const QString &errorString);
+    void assignRequests();
+    void closeConnections();
+    QSslSocket *createConnection();
+    void deliverResponses();
+    void finish();
+    void handleResponse(qint64 rid, const QByteArray &body);
+    bool readResponse(QSslSocket *socket);
+    QByteArray request(const QXmppBoshBody &body, qint64 rid) const;
+    void sendRequests();
+    QByteArray streamHeader() const;
+
+    QUrl url;
+    QString domain;
+    QNetworkProxy proxy;
+    QSslConfiguration sslConfiguration;
+    bool ignoreSslErrors;
+    int maximumConnections;
+
+    QAbstractSocket::SocketState state;
+    QAbstractSocket::SocketError socketError;
+
+    // session parameters given by the connection manager
+    QString sid;
+    QByteArray authId;
+    QByteArray from;
+    int requests;
+
+    // identifiers of the session creation request, of the next request
+    // to send and of the next response to deliver
+    qint64 firstRid;
+    qint64 nextRid;
+    qint64 nextResponseRid;
+
+    // the HTTP connections, the requests which were not answered yet, the
+    // requests which wait for a connection, and the responses which arrived
+    // before those of the previous requests
+    QHash<QSslSocket*, QXmppBoshClientConnection> connections;
+    QMap<qint64, QByteArray> sentRequests;
+    QMap<qint64, int> retries;
+    QList<qint64> queuedRequests;
+    QMap<qint64, QByteArray> responses;
+
+    // the outgoing stream
+    QXmppStreamSplitter splitter;
+    QByteArray streamLang;
+    QByteArray streamVersion;
+    QList<QXmppBoshBody> bodies;
+    bool terminateSent;
+    bool flushScheduled;
+
+    // the incoming stream, and how the connection manager ended the session
+    QByteArray readBuffer;
+    bool terminated;
+    QByteArray condition;
+
+private:
+    QXmppBoshClient *q;
+};
+
+QXmppBoshClientPrivate::QXmppBoshClientPrivate(QXmppBoshClient *qq)
+    : ignoreSslErrors(false)
+    , maximumConnections(3)
+    , state(QAbstractSocket::UnconnectedState)
+    , socketError(QAbstractSocket::UnknownSocketError)
+    , requests(1)
+    , firstRid(-1)
+    , nextRid(0)
+    , nextResponseRid(0)
+    , terminateSent(false)
+    , flushScheduled(false)
+    , terminated(false)
+    , q(qq)
+{
+}
+
+// Ends the session after an error.
+
+void QXmppBoshClientPrivate::abort(QAbstractSocket::SocketError error, const QString &errorString)
+{
+    if (state == QAbstractSocket::UnconnectedState)
+        return;
+
+    const bool wasConnected = (state == QAbstractSocket::ConnectedState);
+    socketError = error;
+    q->setErrorString(errorString);
+    closeConnections();
+    state = QAbstractSocket::UnconnectedState;
+    q->QIODevice::close();
+
+    emit q->error(error);
+    if (wasConnected)
+        emit q->disconnected();
+}
+
+// Sends the requests which wait for a connection on the idle connections,
+// and opens more connections if needed.
+
+void QXmppBoshClientPrivate::assignRequests()
+{
+    int connecting = 0;
+    QHash<QSslSocket*, QXmppBoshClientConnection>::iterator it;
+    for (it = connections.begin(); it != connections.end() && !queuedRequests.isEmpty(); ++it) {
+        if (!it->ready) {
+            ++connecting;
+        } else if (it->rid < 0) {
+            it->rid = queuedRequests.takeFirst();
+            it.key()->write(sentRequests.value(it->rid));
+        }
+    }
+
+    while (connecting < queuedRequests.size() && connections.size() < maximumConnections) {
+        createConnection();
+        ++connecting;
+    }
+}
+
+void QXmppBoshClientPrivate::closeConnections()
+{
+    foreach (QSslSocket *socket, connections.keys()) {
+        // let the data which was written go out
+        QObject::disconnect(socket, 0, q, 0);
+        bool check;
+        Q_UNUSED(check);
+        check = QObject::connect(socket, SIGNAL(disconnected()),
+                                 socket, SLOT(deleteLater()));
+        Q_ASSERT(check);
+        socket->disconnectFromHost();
+        if (socket->state() == QAbstractSocket::UnconnectedState)
+            socket->deleteLater();
+    }
+    connections.clear();
+    sentRequests.clear();
+    retries.clear();
+    queuedRequests.clear();
+    responses.clear();
+    bodies.clear();
+}
+
+QSslSocket *QXmppBoshClientPrivate::createConnection()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    const bool secure = (url.scheme() == QLatin1String("https"));
+    QSslSocket *socket = new QSslSocket(q);
+    socket->setProxy(proxy);
+    socket->setReadBufferSize(maximumHeaderSize + maximumBodySize);
+    if (secure) {
+        socket->setSslConfiguration(sslConfiguration);
+#if (QT_VERSION >= QT_VERSION_CHECK(4, 8, 0))
+        socket->setPeerVerifyName(url.host());
+#endif
+        check = QObject::connect(socket, SIGNAL(encrypted()),
+                                 q, SLOT(_q_socketReady()));
+        Q_ASSERT(check);
+
+        check = QObject::connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
+                                 q, SLOT(_q_socketSslErrors(QList<QSslError>)));
+        Q_ASSERT(check);
+    } else {
+        check = QObject::connect(socket, SIGNAL(connected()),
+                                 q, SLOT(_q_socketReady()));
+        Q_ASSERT(check);
+    }
+
+    check = QObject::connect(socket, SIGNAL(disconnected()),
+                             q, SLOT(_q_socketDisconnected()));
+    Q_ASSERT(check);
+
+    check = QObject::connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                             q, SLOT(_q_socketError(QAbstractSocket::SocketError)));
+    Q_ASSERT(check);
+
+    check = QObject::connect(socket, SIGNAL(readyRead()),
+                             q, SLOT(_q_socketReadyRead()));
+    Q_ASSERT(check);
+
+    connections.insert(socket, QXmppBoshClientConnection());
+    if (secure)
+        socket->connectToHostEncrypted(url.host(), url.port(443));
+    else
+        socket->connectToHost(url.host(), url.port(80));
+    return socket;
+}
+
+// Hands the responses over to the stream, in the order of the requests.
+
+void QXmppBoshClientPrivate::deliverResponses()
+{
+    const int readSize = readBuffer.size();
+    while (state == QAbstractSocket::ConnectedState && !terminated && responses.contains(nextResponseRid)) {
+        const qint64 rid = nextResponseRid++;
+        handleResponse(rid, responses.take(rid));
+    }
+
+    // the stream may hold an error which explains the termination
+    if (readBuffer.size() > readSize)
+        emit q->readyRead();
+    if (terminated) {
+        if (condition.isEmpty())
+            finish();
+        else
+            abort(QAbstractSocket::RemoteHostClosedError,
+                  QString("BOSH session terminated: %1").arg(QString::fromUtf8(condition)));
+    }
+}
+
+// Ends the session.
+
+void QXmppBoshClientPrivate::finish()
+{
+    if (state == QAbstractSocket::UnconnectedState)
+        return;
+
+    const bool wasConnected = (state == QAbstractSocket::ConnectedState);
+    closeConnections();
+    state = QAbstractSocket::UnconnectedState;
+    q->QIODevice::close();
+
+    if (wasConnected)
+        emit q->disconnected();
+}
+
+void QXmppBoshClientPrivate::handleResponse(qint64 rid, const QByteArray &body)
+{
+    const QByteArray data = body.trimmed();
+    const int tagEnd = data.startsWith('<') ? QXmppStreamSplitter::markupEnd(data, 0) : -1;
+    if (tagEnd < 0 || QXmppStreamSplitter::tagName(data) != "body") {
+        abort(QAbstractSocket::UnknownSocketError, QLatin1String("Invalid BOSH response"));
+        return;
+    }
+    const QByteArray tag = data.left(tagEnd);
+
+    if (rid == firstRid) {
+        sid = QString::fromUtf8(QXmppStreamSplitter::attribute(tag, "sid"));
+        if (sid.isEmpty()) {
+            abort(QAbstractSocket::UnknownSocketError, QLatin1String("BOSH session was not created"));
+            return;
+        }
+        bool ok = false;
+        const int count = QXmppStreamSplitter::attribute(tag, "requests").toInt(&ok);
+        requests = ok ? qMax(1, count) : requestedHold + 1;
+        authId = QXmppStreamSplitter::attribute(tag, "authid");
+        from = QXmppStreamSplitter::attribute(tag, "from");
+        readBuffer += streamHeader();
+    }
+
+    if (!tag.endsWith("/>")) {
+        const int payloadEnd = data.lastIndexOf("</");
+        if (payloadEnd > tagEnd)
+            readBuffer += data.mid(tagEnd, payloadEnd - tagEnd);
+    }
+
+    if (QXmppStreamSplitter::attribute(tag, "type") == "terminate") {
+        readBuffer += "</stream:stream>";
+        terminated = true;
+        condition = QXmppStreamSplitter::attribute(tag, "condition");
+    }
+}
+
+// Reads the response to the request which the connection carries, and
+// returns true if there may be more data to read.
+
+bool QXmppBoshClientPrivate::readResponse(QSslSocket *socket)
+{
+    QHash<QSslSocket*, QXmppBoshClientConnection>::iterator it = connections.find(socket);
+    QByteArray &buffer = it->buffer;
+    const int headerEnd = buffer.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        if (buffer.size() > maximumHeaderSize)
+            abort(QAbstractSocket::UnknownSocketError, QLatin1String("BOSH response headers are too large"));
+        return false;
+    }
+
+    const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+    const QList<QByteArray> status = lines.first().simplified().split(' ');
+    bool close = status.size() >= 2 && status[0] == "HTTP/1.0";
+    int contentLength = -1;
+    for (int i = 1; i < lines.size(); ++i) {
+        const int colon = lines[i].indexOf(':');
+        if (colon <= 0)
+            continue;
+        const QByteArray name = lines[i].left(colon).trimmed().toLower();
+        const QByteArray value = lines[i].mid(colon + 1).trimmed().toLower();
+        if (name == "content-length")
+            contentLength = value.toInt();
+        else if (name == "connection")
+            close = (value == "close");
+    }
+    if (contentLength < 0 || contentLength > maximumBodySize || it->rid < 0) {
+        abort(QAbstractSocket::UnknownSocketError, QLatin1String("Invalid BOSH response"));
+        return false;
+    }
+    if (buffer.size() < headerEnd + 4 + contentLength)
+        return false;
+
+    if (status.size() < 2 || status[1] != "200") {
+        // the connection manager does not know the session
+        abort(QAbstractSocket::UnknownSocketError,
+              QString("BOSH request failed: %1").arg(QString::fromUtf8(lines.first().trimmed())));
+        return false;
+    }
+
+    const qint64 rid = it->rid;
+    responses.insert(rid, buffer.mid(headerEnd + 4, contentLength));
+    sentRequests.remove(rid);
+    retries.remove(rid);
+    buffer.remove(0, headerEnd + 4 + contentLength);
+    it->rid = -1;
+    if (close) {
+        it->ready = false;
+        socket->disconnectFromHost();
+        return false;
+    }
+    return !buffer.isEmpty();
+}
+
+QByteArray QXmppBoshClientPrivate::request(const QXmppBoshBody &body, qint64 rid) const
+{
+    QByteArray data = "<body xmlns='" + QByteArray(ns_httpbind.latin1()) + "'"
+                      " rid='" + QByteArray::number(rid) + "'";
+    if (!sid.isEmpty())
+        data += " sid='" + sid.toUtf8() + "'";
+    data += body.attributes;
+    if (body.terminate)
+        data += " type='terminate'";
+    if (body.payload.isEmpty())
+        data += "/>";
+    else
+        data += ">" + body.payload + "</body>";
+
+    QByteArray path = url.encodedPath();
+    if (path.isEmpty())
+        path = "/";
+    if (url.hasQuery())
+        path += "?" + url.encodedQuery();
+    QByteArray host = url.host().toUtf8();
+    if (url.port() > 0)
+        host += ":" + QByteArray::number(url.port());
+
+    return "POST " + path + " HTTP/1.1\r\n"
+           "Host: " + host + "\r\n"
+           "Content-Type: text/xml; charset=utf-8\r\n"
+           "Content-Length: " + QByteArray::number(data.size()) + "\r\n"
+           "\r\n" + data;
+}
+
+// Sends the bodies which were written, as long as the connection manager
+// allows more requests, and makes sure that one request is always held.
+
+void QXmppBoshClientPrivate::sendRequests()
+{
+    if (state != QAbstractSocket::ConnectedState || terminateSent)
+        return;
+
+    // nothing can be sent before the session is created
+    if (sid.isEmpty() && firstRid >= 0)
+        return;
+
+    while (sentRequests.size() < requests) {
+        QXmppBoshBody body;
+        if (!bodies.isEmpty())
+            body = bodies.takeFirst();
+        else if (!sentRequests.isEmpty() || sid.isEmpty())
+            break;
+
+        const qint64 rid = nextRid++;
+        if (sid.isEmpty())
+            firstRid = rid;
+        sentRequests.insert(rid, request(body, rid));
+        queuedRequests << rid;
+        if (body.terminate) {
+            terminateSent = true;
+            break;
+        }
+        if (sid.isEmpty())
+            break;
+    }
+    assignRequests();
+}
+
+// Returns the stream header for the session creation or restart responses.
+
+QByteArray QXmppBoshClientPrivate::streamHeader() const
+{
+    QByteArray header = "<stream:stream xmlns='" + QByteArray(ns_client.latin1()) + "'"
+                        " xmlns:stream='" + QByteArray(ns_stream.latin1()) + "'"
+                        " id='" + (authId.isEmpty() ? sid.toUtf8() : authId) + "'"
+                        " version='1.0'";
+    if (!from.isEmpty())
+        header += " from='" + from + "'";
+    return header + ">";
+}
+
+/// Constructs a new BOSH client.
+///
+/// \param parent
+
+QXmppBoshClient::QXmppBoshClient(QObject *parent)
+    : QIODevice(parent)
+    , d(new QXmppBoshClientPrivate(this))
+{
+}
+
+/// Destroys the BOSH client.
+
+QXmppBoshClient::~QXmppBoshClient()
+{
+    delete d;
+}
+
+/// Connects to the BOSH connection manager at \a url, to open a session
+/// with the XMPP server of \a domain.
+///
+/// The connected() signal is emitted once the first HTTP connection is
+/// established, the session is created when the stream header is written.
+///
+/// \param url
+/// \param domain
+
+void QXmppBoshClient::connectToUrl(const QUrl &url, const QString &domain)
+{
+    d->finish();
+
+    d->url = url;
+    d->domain = domain;
+    d->socketError = QAbstractSocket::UnknownSocketError;
+    d->sid.clear();
+    d->authId.clear();
+    d->from.clear();
+    d->requests = 1;
+    d->firstRid = -1;
+    d->terminateSent = false;
+    d->splitter.clear();
+    d->readBuffer.clear();
+    d->terminated = false;
+    d->condition.clear();
+
+    // the request identifiers start at a random value, and must not wrap
+    d->nextRid = ((qint64(qrand()) << 20) ^ qrand()) & Q_INT64_C(0x1fffffffffff);
+    d->nextResponseRid = d->nextRid;
+
+    d->state = QAbstractSocket::ConnectingState;
+    d->createConnection();
+}
+
+/// Returns the type of the last error.
+
+QAbstractSocket::SocketError QXmppBoshClient::error() const
+{
+    return d->socketError;
+}
+
+/// Returns the session identifier, or an empty string if the session was
+/// not created yet.
+
+QString QXmppBoshClient::sid() const
+{
+    return d->sid;
+}
+
+/// Returns the state of the session.
+
+QAbstractSocket::SocketState QXmppBoshClient::state() const
+{
+    return d->state;
+}
+
+/// Returns the number of HTTP connections which are open or being opened.
+
+int QXmppBoshClient::connectionCount() const
+{
+    return d->connections.size();
+}
+
+/// Returns the largest number of HTTP connections which are opened.
+
+int QXmppBoshClient::maximumConnections() const
+{
+    return d->maximumConnections;
+}
+
+/// Sets the largest number of HTTP connections which are opened.
+///
+/// The default value of 3 lets the client send as many requests as the
+/// connection manager usually allows, and send a request again while a
+/// lost connection is replaced.
+///
+/// \param connections
+
+void QXmppBoshClient::setMaximumConnections(int connections)
+{
+    d->maximumConnections = qMax(1, connections);
+}
+
+/// Sets whether SSL errors are ignored on the HTTPS connections.
+///
+/// \param ignore
+
+void QXmppBoshClient::setIgnoreSslErrors(bool ignore)
+{
+    d->ignoreSslErrors = ignore;
+}
+
+/// Sets the network proxy used for the HTTP connections.
+///
+/// \param proxy
+
+void QXmppBoshClient::setProxy(const QNetworkProxy &proxy)
+{
+    d->proxy = proxy;
+}
+
+/// Sets the SSL configuration used for the HTTPS connections.
+///
+/// \param configuration
+
+void QXmppBoshClient::setSslConfiguration(const QSslConfiguration &configuration)
+{
+    d->sslConfiguration = configuration;
+}
+
+/// Returns the number of bytes of the XMPP stream which can be read.
+
+qint64 QXmppBoshClient::bytesAvailable() const
+{
+    return d->readBuffer.size() + QIODevice::bytesAvailable();
+}
+
+/// Returns the number of bytes which were written but not sent yet.
+
+qint64 QXmppBoshClient::bytesToWrite() const
+{
+    qint64 size = d->splitter.bufferSize();
+    foreach (const QXmppBoshBody &body, d->bodies)
+        size += body.payload.size();
+    return size;
+}
+
+/// Ends the session.
+
+void QXmppBoshClient::close()
+{
+    if (d->state == QAbstractSocket::ConnectedState && !d->sid.isEmpty() && !d->terminateSent) {
+        // the remaining data goes into a termination request, which may
+        // exceed the number of requests the connection manager allows
+        QXmppBoshBody body;
+        body.terminate = true;
+        foreach (const QXmppBoshBody &pending, d->bodies) {
+            if (!pending.restart)
+                body.payload += pending.payload;
+        }
+        const QByteArray request = d->request(body, d->nextRid++);
+        d->terminateSent = true;
+
+        QSslSocket *socket = 0;
+        QHash<QSslSocket*, QXmppBoshClientConnection>::iterator it;
+        for (it = d->connections.begin(); it != d->connections.end(); ++it) {
+            if (it->ready && it->rid < 0) {
+                socket = it.key();
+                break;
+            }
+        }
+        if (!socket)
+            socket = d->createConnection();
+        socket->write(request);
+    }
+    d->finish();
+}
+
+/// Returns true, as the XMPP stream is sequential.
+
+bool QXmppBoshClient::isSequential() const
+{
+    return true;
+}
+
+qint64 QXmppBoshClient::readData(char *data, qint64 maxSize)
+{
+    const int size = int(qMin(maxSize, qint64(d->readBuffer.size())));
+    memcpy(data, d->readBuffer.constData(), size);
+    d->readBuffer.remove(0, size);
+    return size;
+}
+
+qint64 QXmppBoshClient::writeData(const char *data, qint64 size)
+{
+    if (d->state != QAbstractSocket::ConnectedState || d->terminateSent)
+        return -1;
+
+    d->splitter.addData(data, int(size));
+    QXmppStreamSplitter::Token token;
+    while ((token = d->splitter.readNext()) != QXmppStreamSplitter::NoToken) {
+        if (token == QXmppStreamSplitter::StreamStartToken) {
+            // BOSH has no stream header, its attributes go into the session
+            // creation request, or into a restart request
+            const QByteArray header = d->splitter.data();
+            d->streamLang = QXmppStreamSplitter::attribute(header, "xml:lang");
+            d->streamVersion = QXmppStreamSplitter::attribute(header, "version");
+
+            QXmppBoshBody body;
+            body.attributes = " to='" + d->domain.toUtf8() + "'";
+            if (!d->streamLang.isEmpty())
+                body.attributes += " xml:lang='" + d->streamLang + "'";
+            if (d->sid.isEmpty() && d->firstRid < 0) {
+                body.attributes += " xmlns:xmpp='" + QByteArray(ns_xbosh.latin1()) + "'"
+                                   " content='text/xml; charset=utf-8'"
+                                   " hold='" + QByteArray::number(requestedHold) + "'"
+                                   " wait='" + QByteArray::number(requestedWait) + "'"
+                                   " ver='1.11'";
+                if (!d->streamVersion.isEmpty())
+                    body.attributes += " xmpp:version='" + d->streamVersion + "'";
+            } else {
+                body.attributes += " xmlns:xmpp='" + QByteArray(ns_xbosh.latin1()) + "'"
+                                   " xmpp:restart='true'";
+                body.restart = true;
+
+                // the data which was not read yet belongs to the new stream,
+                // as the stream is only restarted once the server is silent
+                d->readBuffer += d->streamHeader();
+            }
+            d->bodies << body;
+        } else if (token == QXmppStreamSplitter::ElementToken) {
+            if (d->bodies.isEmpty() || d->bodies.last().restart || d->bodies.last().terminate)
+                d->bodies << QXmppBoshBody();
+            d->bodies.last().payload += d->splitter.data();
+        } else {
+            if (d->bodies.isEmpty() || d->bodies.last().restart)
+                d->bodies << QXmppBoshBody();
+            d->bodies.last().terminate = true;
+        }
+    }
+
+    // batch the data written in this iteration of the event loop
+    if (!d->flushScheduled) {
+        d->flushScheduled = true;
+        QMetaObject::invokeMethod(this, "_q_flush", Qt::QueuedConnection);
+    }
+    return size;
+}
+
+void QXmppBoshClient::_q_flush()
+{
+    d->flushScheduled = false;
+    d->sendRequests();
+}
+
+void QXmppBoshClient::_q_socketDisconnected()
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    QHash<QSslSocket*, QXmppBoshClientConnection>::iterator it = d->connections.find(socket);
+    if (it == d->connections.end())
+        return;
+
+    const qint64 rid = it->rid;
+    d->connections.erase(it);
+    socket->deleteLater();
+
+    if (rid >= 0 && d->sentRequests.contains(rid)) {
+        // send the request again, the connection manager answers it once
+        if (++d->retries[rid] > maximumRetries) {
+            d->abort(QAbstractSocket::RemoteHostClosedError, socket->errorString());
+            return;
+        }
+        d->queuedRequests.insert(qLowerBound(d->queuedRequests.begin(), d->queuedRequests.end(), rid), rid);
+    }
+    d->assignRequests();
+}
+
+void QXmppBoshClient::_q_socketError(QAbstractSocket::SocketError socketError)
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    QHash<QSslSocket*, QXmppBoshClientConnection>::iterator it = d->connections.find(socket);
+    if (it == d->connections.end())
+        return;
+
+    // a lost connection is replaced, but the connection manager must be
+    // reachable
+    if (!it->ready)
+        d->abort(socketError, socket->errorString());
+}
+
+void QXmppBoshClient::_q_socketReady()
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    QHash<QSslSocket*, QXmppBoshClientConnection>::iterator it = d->connections.find(socket);
+    if (it == d->connections.end())
+        return;
+
+    it->ready = true;
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, QVariant(1));
+
+    if (d->state == QAbstractSocket::ConnectingState) {
+        d->state = QAbstractSocket::ConnectedState;
+        open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+        emit connected();
+    }
+    d->assignRequests();
+}
+
+void QXmppBoshClient::_q_socketReadyRead()
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    if (!d->connections.contains(socket))
+        return;
+
+    d->connections[socket].buffer += socket->readAll();
+    while (d->connections.contains(socket) && d->readResponse(socket))
+        ;
+
+    d->deliverResponses();
+    d->sendRequests();
+}
+
+void QXmppBoshClient::_q_socketSslErrors(const QList<QSslError> &errors)
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    emit sslErrors(errors);
+    if (socket && d->ignoreSslErrors)
+        socket->ignoreSslErrors();
+}
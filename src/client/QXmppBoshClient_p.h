@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPBOSHCLIENT_P_H
+#define QXMPPBOSHCLIENT_P_H
+
+#include <QAbstractSocket>
+#include <QIODevice>
+#include <QList>
+#include <QSslError>
+
+#include "QXmppGlobal.h"
+
+class QNetworkProxy;
+class QSslConfiguration;
+class QUrl;
+class QXmppBoshClientPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppOutgoingClient class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppBoshClient class carries an XMPP stream over HTTP, as defined
+/// by XEP-0124: Bidirectional-streams Over Synchronous HTTP and XEP-0206:
+/// XMPP Over BOSH.
+///
+/// The stream written to the device is split into its top-level elements,
+/// which are sent in the body of HTTP requests, and the payloads of the
+/// responses are read from the device as a classic XMPP stream.
+///
+/// The requests are sent over a pool of persistent HTTP connections, one
+/// request at a time on each connection. One request is always held by
+/// the connection manager so that it can send data at any time, and as
+/// many requests as the connection manager allows are used to send data
+/// without waiting for the held request to be answered.
+
+class QXMPP_AUTOTEST_EXPORT QXmppBoshClient : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    QXmppBoshClient(QObject *parent = 0);
+    ~QXmppBoshClient();
+
+    void connectToUrl(const QUrl &url, const QString &domain);
+    QAbstractSocket::SocketError error() const;
+    QString sid() const;
+    QAbstractSocket::SocketState state() const;
+
+    int connectionCount() const;
+    int maximumConnections() const;
+    void setMaximumConnections(int connections);
+
+    void setIgnoreSslErrors(bool ignore);
+    void setProxy(const QNetworkProxy &proxy);
+    void setSslConfiguration(const QSslConfiguration &configuration);
+
+    qint64 bytesAvailable() const;
+    qint64 bytesToWrite() const;
+    void close();
+    bool isSequential() const;
+
+signals:
+    /// This signal is emitted when the first HTTP connection is established.
+    void connected();
+
+    /// This signal is emitted when the session ends.
+    void disconnected();
+
+    /// This signal is emitted when the session fails.
+    void error(QAbstractSocket::SocketError socketError);
+
+    /// This signal is emitted when an HTTP connection has SSL errors.
+    void sslErrors(const QList<QSslError> &errors);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 size);
+
+private slots:
+    void _q_flush();
+    void _q_socketDisconnected();
+    void _q_socketError(QAbstractSocket::SocketError socketError);
+    void _q_socketReady();
+    void _q_socketReadyRead();
+    void _q_socketSslErrors(const QList<QSslError> &errors);
+
+private:
+    QXmppBoshClientPrivate * const d;
+    friend class QXmppBoshClientPrivate;
+};
+
+#endif
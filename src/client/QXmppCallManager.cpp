@@ -21,7 +21,12 @@
  *
  */
 
+#include <QCoreApplication>
 #include <QDomElement>
+#include <QEvent>
+#include <QSemaphore>
+#include <QSet>
+#include <QThread>
 #include <QTimer>
 
 #include "QXmppCallManager.h"
@@ -43,23 +48,54 @@ class QXmppCallPrivate
 public:
     class Stream {
     public:
+        typedef void (Stream::*Task)();
+
+        Stream();
+        void run(Task task);
+
+        // tasks which access the channel and connection
+        void applyDescription();
+        void applyTransport();
+        void close();
+        void destroy();
+        void readLocalContent();
+        void readState();
+        void restartTransport();
+
         QXmppRtpChannel *channel;
+        QObject *channelObject;
         QXmppIceConnection *connection;
         QString creator;
         QString media;
         QString name;
+
+        // the object executing tasks in the media thread, if any
+        QObject *executor;
+
+        // data exchanged with tasks
+        QXmppJingleIq::Content content;
+        bool connected;
+        QIODevice::OpenMode mode;
+
+        // the IDs of the local candidates sent to the remote party
+        QSet<QString> sentCandidates;
+
+        // ICE restart
+        QString remoteUser;
+        bool restarting;
     };
 
     QXmppCallPrivate(QXmppCall *qq);
     Stream *createStream(const QString &media);
     Stream *findStreamByMedia(const QString &media);
     Stream *findStreamByName(const QString &name);
-    QXmppJingleIq::Content localContent(QXmppCallPrivate::Stream *stream) const;
+    QXmppJingleIq::Content localContent(QXmppCallPrivate::Stream *stream, bool newCandidatesOnly = false) const;
 
     void handleAck(const QXmppIq &iq);
     bool handleDescription(QXmppCallPrivate::Stream *stream, const QXmppJingleIq::Content &content);
     void handleRequest(const QXmppJingleIq &iq);
     bool handleTransport(QXmppCallPrivate::Stream *stream, const QXmppJingleIq::Content &content);
+    void restartTransport(QXmppCallPrivate::Stream *stream);
     void setState(QXmppCall::State state);
     bool sendAck(const QXmppJingleIq &iq);
     bool sendInvite();
@@ -90,8 +126,12 @@ public:
     QXmppCallManagerPrivate(QXmppCallManager *qq);
     QXmppCall *findCall(const QString &sid) const;
     QXmppCall *findCall(const QString &sid, QXmppCall::Direction direction) const;
+    QObject *mediaExecutor();
 
     QList<QXmppCall*> calls;
+    bool mediaThreadEnabled;
+    QThread *mediaThread;
+    QObject *mediaThreadExecutor;
     QHostAddress stunHost;
     quint16 stunPort;
     QHostAddress turnHost;
@@ -103,6 +143,158 @@ private:
     QXmppCallManager *q;
 };
 
+/// \internal
+///
+/// The QXmppCallTaskEvent class carries a task to be run in the thread of a
+/// stream's channel and connection.
+
+class QXmppCallTaskEvent : public QEvent
+{
+public:
+    QXmppCallTaskEvent(QXmppCallPrivate::Stream *stream, QXmppCallPrivate::Stream::Task task, QSemaphore *done)
+        : QEvent(eventType())
+        , m_done(done)
+        , m_stream(stream)
+        , m_task(task)
+    {
+    }
+
+    // the task is either run or discarded, in both cases the caller resumes
+    ~QXmppCallTaskEvent()
+    {
+        m_done->release();
+    }
+
+    void run()
+    {
+        (m_stream->*m_task)();
+    }
+
+    static QEvent::Type eventType()
+    {
+        static const QEvent::Type type = QEvent::Type(QEvent::registerEventType());
+        return type;
+    }
+
+private:
+    QSemaphore *m_done;
+    QXmppCallPrivate::Stream *m_stream;
+    QXmppCallPrivate::Stream::Task m_task;
+};
+
+/// \internal
+///
+/// The QXmppCallMediaExecutor class runs tasks in the media thread.
+
+class QXmppCallMediaExecutor : public QObject
+{
+public:
+    bool event(QEvent *event)
+    {
+        if (event->type() == QXmppCallTaskEvent::eventType()) {
+            static_cast<QXmppCallTaskEvent*>(event)->run();
+            return true;
+        }
+        return QObject::event(event);
+    }
+};
+
+QXmppCallPrivate::Stream::Stream()
+    : channel(0),
+    channelObject(0),
+    connection(0),
+    executor(0),
+    connected(false),
+    mode(QIODevice::NotOpen),
+    restarting(false)
+{
+}
+
+/// Runs the given \a task in the thread of the stream's channel and
+/// connection, and waits for it to complete.
+
+void QXmppCallPrivate::Stream::run(Task task)
+{
+    if (!executor || executor->thread() == QThread::currentThread()) {
+        (this->*task)();
+        return;
+    }
+
+    QSemaphore done;
+    QCoreApplication::postEvent(executor, new QXmppCallTaskEvent(this, task, &done));
+    done.acquire();
+}
+
+void QXmppCallPrivate::Stream::applyDescription()
+{
+    channel->setRemotePayloadTypes(content.payloadTypes());
+    mode = channel->openMode();
+
+    // SDES: use the first crypto attribute we support
+    foreach (const QXmppJingleRtpCryptoElement &crypto, content.cryptoElements()) {
+        if (channel->setRemoteCryptoElement(crypto))
+            break;
+    }
+}
+
+void QXmppCallPrivate::Stream::applyTransport()
+{
+    // a transport-info may only carry candidates
+    if (!content.transportUser().isEmpty())
+        connection->setRemoteUser(content.transportUser());
+    if (!content.transportPassword().isEmpty())
+        connection->setRemotePassword(content.transportPassword());
+    foreach (const QXmppJingleCandidate &candidate, content.transportCandidates())
+        connection->addRemoteCandidate(candidate);
+
+    // perform ICE negotiation
+    if (!content.transportCandidates().isEmpty())
+        connection->connectToHost();
+}
+
+void QXmppCallPrivate::Stream::close()
+{
+    channel->close();
+    connection->close();
+}
+
+void QXmppCallPrivate::Stream::destroy()
+{
+    // do not notify the call, which is being destroyed
+    channelObject->disconnect();
+    connection->disconnect();
+
+    delete channelObject;
+    delete connection;
+    channel = 0;
+    channelObject = 0;
+    connection = 0;
+}
+
+void QXmppCallPrivate::Stream::readLocalContent()
+{
+    // description
+    content.setDescriptionSsrc(channel->localSsrc());
+    content.setPayloadTypes(channel->localPayloadTypes());
+    content.setCryptoElements(channel->localCryptoElements());
+
+    // transport
+    content.setTransportUser(connection->localUser());
+    content.setTransportPassword(connection->localPassword());
+    content.setTransportCandidates(connection->localCandidates());
+}
+
+void QXmppCallPrivate::Stream::readState()
+{
+    connected = connection->isConnected();
+    mode = channel->openMode();
+}
+
+void QXmppCallPrivate::Stream::restartTransport()
+{
+    connection->restart(QXmppIceComponent::discoverAddresses());
+}
+
 QXmppCallPrivate::QXmppCallPrivate(QXmppCall *qq)
     : manager(0),
     state(QXmppCall::ConnectingState),
@@ -149,8 +341,9 @@ void QXmppCallPrivate::handleAck(const QXmppIq &ack)
 
 bool QXmppCallPrivate::handleDescription(QXmppCallPrivate::Stream *stream, const QXmppJingleIq::Content &content)
 {
-    stream->channel->setRemotePayloadTypes(content.payloadTypes());
-    if (!(stream->channel->openMode() & QIODevice::ReadWrite)) {
+    stream->content = content;
+    stream->run(&Stream::applyDescription);
+    if (!(stream->mode & QIODevice::ReadWrite)) {
         q->warning(QString("Remote party %1 did not provide any known %2 payloads for call %3").arg(jid, stream->media, sid));
         return false;
     }
@@ -160,14 +353,34 @@ bool QXmppCallPrivate::handleDescription(QXmppCallPrivate::Stream *stream, const
 
 bool QXmppCallPrivate::handleTransport(QXmppCallPrivate::Stream *stream, const QXmppJingleIq::Content &content)
 {
-    stream->connection->setRemoteUser(content.transportUser());
-    stream->connection->setRemotePassword(content.transportPassword());
-    foreach (const QXmppJingleCandidate &candidate, content.transportCandidates())
-        stream->connection->addRemoteCandidate(candidate);
+    // new credentials mean the remote party restarted ICE, unless they
+    // answer our own restart
+    const QString remoteUser = content.transportUser();
+    bool answerRestart = false;
+    if (!remoteUser.isEmpty()) {
+        if (!stream->remoteUser.isEmpty() && remoteUser != stream->remoteUser) {
+            if (!stream->restarting) {
+                q->info(QString("Remote party %1 restarted ICE for %2 in call %3").arg(jid, stream->name, sid));
+                restartTransport(stream);
+                answerRestart = true;
+            }
+            stream->restarting = false;
+        }
+        stream->remoteUser = remoteUser;
+    }
 
-    // perform ICE negotiation
-    if (!content.transportCandidates().isEmpty())
-        stream->connection->connectToHost();
+    stream->content = content;
+    stream->run(&Stream::applyTransport);
+
+    if (answerRestart) {
+        QXmppJingleIq iq;
+        iq.setTo(jid);
+        iq.setType(QXmppIq::Set);
+        iq.setAction(QXmppJingleIq::TransportInfo);
+        iq.setSid(sid);
+        iq.addContent(localContent(stream));
+        sendRequest(iq);
+    }
     return true;
 }
 
@@ -256,6 +469,7 @@ void QXmppCallPrivate::handleRequest(const QXmppJingleIq &iq)
             iq.setSid(q->sid());
             iq.reason().setType(QXmppJingleIq::Reason::FailedApplication);
             sendRequest(iq);
+            stream->run(&Stream::destroy);
             delete stream;
             return;
         }
@@ -295,14 +509,18 @@ QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(const QString &media)
     Stream *stream = new Stream;
     stream->media = media;
 
+    // media objects which run in a media thread cannot have a parent
+    stream->executor = manager->d->mediaExecutor();
+    QObject *parent = stream->executor ? 0 : q;
+
     // RTP channel
     QObject *channelObject = 0;
     if (media == AUDIO_MEDIA) {
-        QXmppRtpAudioChannel *audioChannel = new QXmppRtpAudioChannel(q);
+        QXmppRtpAudioChannel *audioChannel = new QXmppRtpAudioChannel(parent);
         stream->channel = audioChannel;
         channelObject = audioChannel;
     } else if (media == VIDEO_MEDIA) {
-        QXmppRtpVideoChannel *videoChannel = new QXmppRtpVideoChannel(q);
+        QXmppRtpVideoChannel *videoChannel = new QXmppRtpVideoChannel(parent);
         stream->channel = videoChannel;
         channelObject = videoChannel;
     } else {
@@ -310,9 +528,10 @@ QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(const QString &media)
         delete stream;
         return 0;
     }
+    stream->channelObject = channelObject;
 
     // ICE connection
-    stream->connection = new QXmppIceConnection(q);
+    stream->connection = new QXmppIceConnection(parent);
     stream->connection->setIceControlling(direction == QXmppCall::OutgoingDirection);
     stream->connection->setStunServer(manager->d->stunHost, manager->d->stunPort);
     stream->connection->setTurnServer(manager->d->turnHost, manager->d->turnPort);
@@ -350,27 +569,62 @@ QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(const QString &media)
                         rtpComponent, SLOT(sendDatagram(QByteArray)));
         Q_ASSERT(check);
     }
+
+    // RTCP reports carry the statistics, and drive the video bitrate
+    if (channelObject) {
+        QXmppIceComponent *rtcpComponent = stream->connection->component(RTCP_COMPONENT);
+
+        check = QObject::connect(rtcpComponent, SIGNAL(datagramReceived(QByteArray)),
+                        channelObject, SLOT(rtcpDatagramReceived(QByteArray)));
+        Q_ASSERT(check);
+
+        check = QObject::connect(channelObject, SIGNAL(sendRtcpDatagram(QByteArray)),
+                        rtcpComponent, SLOT(sendDatagram(QByteArray)));
+        Q_ASSERT(check);
+    }
+
+    // move the media objects to the media thread
+    if (stream->executor) {
+        check = QObject::connect(channelObject, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+                                 q, SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
+        Q_ASSERT(check);
+
+        check = QObject::connect(channelObject, SIGNAL(setGauge(QString,double)),
+                                 q, SIGNAL(setGauge(QString,double)));
+        Q_ASSERT(check);
+
+        check = QObject::connect(stream->connection, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+                                 q, SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
+        Q_ASSERT(check);
+
+        channelObject->moveToThread(stream->executor->thread());
+        stream->connection->moveToThread(stream->executor->thread());
+    }
     return stream;
 }
 
-QXmppJingleIq::Content QXmppCallPrivate::localContent(QXmppCallPrivate::Stream *stream) const
+QXmppJingleIq::Content QXmppCallPrivate::localContent(QXmppCallPrivate::Stream *stream, bool newCandidatesOnly) const
 {
     QXmppJingleIq::Content content;
     content.setCreator(stream->creator);
     content.setName(stream->name);
     content.setSenders("both");
-
-    // description
     content.setDescriptionMedia(stream->media);
-    content.setDescriptionSsrc(stream->channel->localSsrc());
-    content.setPayloadTypes(stream->channel->localPayloadTypes());
-
-    // transport
-    content.setTransportUser(stream->connection->localUser());
-    content.setTransportPassword(stream->connection->localPassword());
-    content.setTransportCandidates(stream->connection->localCandidates());
 
-    return content;
+    // description and transport
+    stream->content = content;
+    stream->run(&Stream::readLocalContent);
+
+    // remember which candidates were sent, so that only the new ones
+    // are trickled in a transport-info
+    QList<QXmppJingleCandidate> candidates;
+    foreach (const QXmppJingleCandidate &candidate, stream->content.transportCandidates()) {
+        if (!newCandidatesOnly || !stream->sentCandidates.contains(candidate.id()))
+            candidates << candidate;
+        stream->sentCandidates.insert(candidate.id());
+    }
+    stream->content.setTransportCandidates(candidates);
+    return stream->content;
 }
 
 /// Sends an acknowledgement for a Jingle IQ.
@@ -424,6 +678,15 @@ void QXmppCallPrivate::setState(QXmppCall::State newState)
     }
 }
 
+/// Restarts ICE for the given \a stream, the caller is responsible for
+/// sending the new local credentials and candidates.
+
+void QXmppCallPrivate::restartTransport(QXmppCallPrivate::Stream *stream)
+{
+    stream->sentCandidates.clear();
+    stream->run(&Stream::restartTransport);
+}
+
 /// Request graceful call termination
 
 void QXmppCallPrivate::terminate(QXmppJingleIq::Reason::Type reasonType)
@@ -464,8 +727,10 @@ QXmppCall::QXmppCall(const QString &jid, QXmppCall::Direction direction, QXmppCa
 
 QXmppCall::~QXmppCall()
 {
-    foreach (QXmppCallPrivate::Stream *stream, d->streams)
+    foreach (QXmppCallPrivate::Stream *stream, d->streams) {
+        stream->run(&QXmppCallPrivate::Stream::destroy);
         delete stream;
+    }
     delete d;
 }
 
@@ -541,10 +806,8 @@ QIODevice::OpenMode QXmppCall::videoMode() const
 void QXmppCall::terminated()
 {
     // close streams
-    foreach (QXmppCallPrivate::Stream *stream, d->streams) {
-        stream->channel->close();
-        stream->connection->close();
-    }
+    foreach (QXmppCallPrivate::Stream *stream, d->streams)
+        stream->run(&QXmppCallPrivate::Stream::close);
 
     // update state
     d->setState(QXmppCall::FinishedState);
@@ -566,8 +829,36 @@ void QXmppCall::hangup()
     d->terminate(QXmppJingleIq::Reason::None);
 }
 
+/// Restarts ICE negotiation for all the call's streams without
+/// terminating the call, for instance after a change of network.
+///
+/// Media keeps flowing on the current network path until the new
+/// negotiation completes.
+
+void QXmppCall::restartIce()
+{
+    if (d->state != QXmppCall::ActiveState)
+        return;
+
+    foreach (QXmppCallPrivate::Stream *stream, d->streams) {
+        d->restartTransport(stream);
+        stream->restarting = true;
+
+        QXmppJingleIq iq;
+        iq.setTo(d->jid);
+        iq.setType(QXmppIq::Set);
+        iq.setAction(QXmppJingleIq::TransportInfo);
+        iq.setSid(d->sid);
+        iq.addContent(d->localContent(stream));
+        d->sendRequest(iq);
+    }
+}
+
 /// Sends a transport-info to inform the remote party of new local candidates.
 ///
+/// Candidates are sent as soon as they are gathered (trickle ICE): the
+/// session is initiated with the host candidates, and server-reflexive and
+/// relayed candidates follow once the STUN and TURN servers have answered.
 
 void QXmppCall::localCandidatesChanged()
 {
@@ -588,7 +879,11 @@ void QXmppCall::localCandidatesChanged()
     iq.setType(QXmppIq::Set);
     iq.setAction(QXmppJingleIq::TransportInfo);
     iq.setSid(d->sid);
-    iq.addContent(d->localContent(stream));
+
+    const QXmppJingleIq::Content content = d->localContent(stream, true);
+    if (content.transportCandidates().isEmpty())
+        return;
+    iq.addContent(content);
     d->sendRequest(iq);
 }
 
@@ -608,8 +903,10 @@ void QXmppCall::updateOpenMode()
     // determine audio mode
     mode = QIODevice::NotOpen;
     stream = d->findStreamByMedia(AUDIO_MEDIA);
-    if (d->state == QXmppCall::ActiveState && stream && stream->connection->isConnected())
-        mode = stream->channel->openMode() & QIODevice::ReadWrite;
+    if (stream)
+        stream->run(&QXmppCallPrivate::Stream::readState);
+    if (d->state == QXmppCall::ActiveState && stream && stream->connected)
+        mode = stream->mode & QIODevice::ReadWrite;
     if (mode != d->audioMode) {
         d->audioMode = mode;
         emit audioModeChanged(mode);
@@ -618,10 +915,12 @@ void QXmppCall::updateOpenMode()
     // determine video mode
     mode = QIODevice::NotOpen;
     stream = d->findStreamByMedia(VIDEO_MEDIA);
-    if (d->state == QXmppCall::ActiveState && stream && stream->connection->isConnected()) {
-        mode |= (stream->channel->openMode() & QIODevice::ReadOnly);
+    if (stream)
+        stream->run(&QXmppCallPrivate::Stream::readState);
+    if (d->state == QXmppCall::ActiveState && stream && stream->connected) {
+        mode |= (stream->mode & QIODevice::ReadOnly);
         if (d->sendVideo)
-            mode |= (stream->channel->openMode() & QIODevice::WriteOnly);
+            mode |= (stream->mode & QIODevice::WriteOnly);
     }
     if (mode != d->videoMode) {
         d->videoMode = mode;
@@ -692,12 +991,35 @@ void QXmppCall::stopVideo()
 }
 
 QXmppCallManagerPrivate::QXmppCallManagerPrivate(QXmppCallManager *qq)
-    : stunPort(0),
+    : mediaThreadEnabled(false),
+    mediaThread(0),
+    mediaThreadExecutor(0),
+    stunPort(0),
     turnPort(0),
     q(qq)
 {
 }
 
+/// Returns the object which runs tasks in the media thread, starting the
+/// thread if needed, or 0 if media runs in the manager's thread.
+
+QObject *QXmppCallManagerPrivate::mediaExecutor()
+{
+    if (!mediaThreadEnabled)
+        return 0;
+
+    if (!mediaThread) {
+        qRegisterMetaType<QXmppLogger::MessageType>("QXmppLogger::MessageType");
+        QXmppCallTaskEvent::eventType();
+
+        mediaThread = new QThread;
+        mediaThreadExecutor = new QXmppCallMediaExecutor;
+        mediaThreadExecutor->moveToThread(mediaThread);
+        mediaThread->start(QThread::TimeCriticalPriority);
+    }
+    return mediaThreadExecutor;
+}
+
 QXmppCall *QXmppCallManagerPrivate::findCall(const QString &sid) const
 {
     foreach (QXmppCall *call, calls)
@@ -727,9 +1049,46 @@ QXmppCallManager::QXmppCallManager()
 
 QXmppCallManager::~QXmppCallManager()
 {
+    if (d->mediaThread) {
+        // destroy the calls while their media thread is running
+        foreach (QXmppCall *call, d->calls)
+            delete call;
+
+        d->mediaThread->quit();
+        d->mediaThread->wait();
+        delete d->mediaThreadExecutor;
+        delete d->mediaThread;
+    }
     delete d;
 }
 
+/// Returns true if the media of new calls is processed in a dedicated
+/// thread.
+
+bool QXmppCallManager::isMediaThreadEnabled() const
+{
+    return d->mediaThreadEnabled;
+}
+
+/// Sets whether the media of new calls should be processed in a dedicated
+/// thread, so that the event loop of the manager's thread does not delay
+/// audio or video packets.
+///
+/// When enabled, the ICE connections and the RTP channels of the calls
+/// created afterwards live in a media thread shared by all calls of this
+/// manager. The channels returned by QXmppCall::audioChannel() and
+/// QXmppCall::videoChannel() can still be read from and written to in your
+/// own thread, but their signals are delivered through queued connections.
+///
+/// The default is false.
+///
+/// \param enabled
+
+void QXmppCallManager::setMediaThreadEnabled(bool enabled)
+{
+    d->mediaThreadEnabled = enabled;
+}
+
 /// \cond
 QStringList QXmppCallManager::discoveryFeatures() const
 {
@@ -750,6 +1109,17 @@ bool QXmppCallManager::handleStanza(const QDomElement &element)
         {
             QXmppJingleIq jingleIq;
             jingleIq.parse(element);
+
+            // leave sessions which are not calls, such as file transfers,
+            // to other extensions
+            if (jingleIq.action() == QXmppJingleIq::SessionInitiate) {
+                if (jingleIq.contents().isEmpty() ||
+                    jingleIq.contents().first().descriptionMedia().isEmpty())
+                    return false;
+            } else if (!d->findCall(jingleIq.sid())) {
+                return false;
+            }
+
             _q_jingleIqReceived(jingleIq);
             return true;
         }
@@ -119,6 +119,7 @@ signals:
 public slots:
     void accept();
     void hangup();
+    void restartIce();
     void startVideo();
     void stopVideo();
 
@@ -164,6 +165,8 @@ class QXMPP_EXPORT QXmppCallManager : public QXmppClientExtension
 public:
     QXmppCallManager();
     ~QXmppCallManager();
+    bool isMediaThreadEnabled() const;
+    void setMediaThreadEnabled(bool enabled);
     void setStunServer(const QHostAddress &host, quint16 port = 3478);
     void setTurnServer(const QHostAddress &host, quint16 port = 3478);
     void setTurnUser(const QString &user);
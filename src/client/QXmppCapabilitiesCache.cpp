@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QDomDocument>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QXmlStreamWriter>
+
+#include "QXmppCapabilitiesCache.h"
+
+// "QXCC", followed by the file format version
+static const quint32 capabilitiesCacheMagic = 0x51584343;
+static const quint32 capabilitiesCacheFormat = 1;
+
+class QXmppCapabilitiesCachePrivate
+{
+public:
+    static QString key(const QString &node, const QByteArray &ver, const QString &hash);
+
+    mutable QMutex mutex;
+    QHash<QString, QXmppDiscoveryIq> entries;
+};
+
+QString QXmppCapabilitiesCachePrivate::key(const QString &node, const QByteArray &ver, const QString &hash)
+{
+    return hash + QLatin1Char(' ') + node + QLatin1Char('#') + QString::fromLatin1(ver.toBase64());
+}
+
+/// Constructs an empty capabilities cache.
+
+QXmppCapabilitiesCache::QXmppCapabilitiesCache()
+    : d(new QXmppCapabilitiesCachePrivate)
+{
+}
+
+/// Destroys the capabilities cache.
+
+QXmppCapabilitiesCache::~QXmppCapabilitiesCache()
+{
+    delete d;
+}
+
+/// Returns true if the cache holds the information for the given
+/// capabilities.
+///
+/// \param node
+/// \param ver
+/// \param hash
+
+bool QXmppCapabilitiesCache::contains(const QString &node, const QByteArray &ver, const QString &hash) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->entries.contains(d->key(node, ver, hash));
+}
+
+/// Returns the cached information for the given capabilities, or an
+/// empty QXmppDiscoveryIq if they are not cached.
+///
+/// \param node
+/// \param ver
+/// \param hash
+
+QXmppDiscoveryIq QXmppCapabilitiesCache::info(const QString &node, const QByteArray &ver, const QString &hash) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->entries.value(d->key(node, ver, hash));
+}
+
+/// Stores the information for the given capabilities.
+///
+/// The information is only stored if the verification string computed
+/// from it matches \a ver, so a peer cannot poison the cache for other
+/// entities. As only SHA-1 verification strings can be computed, other
+/// hashes are rejected.
+///
+/// Returns true if the information was stored.
+///
+/// \param node
+/// \param ver
+/// \param hash
+/// \param info
+
+bool QXmppCapabilitiesCache::insert(const QString &node, const QByteArray &ver, const QString &hash, const QXmppDiscoveryIq &info)
+{
+    if (hash != QLatin1String("sha-1") || info.verificationString() != ver)
+        return false;
+
+    QXmppDiscoveryIq entry;
+    entry.setType(QXmppIq::Result);
+    entry.setQueryType(QXmppDiscoveryIq::InfoQuery);
+    entry.setQueryNode(node + QLatin1Char('#') + QString::fromLatin1(ver.toBase64()));
+    entry.setFeatures(info.features());
+    entry.setIdentities(info.identities());
+    entry.setForm(info.form());
+
+    QMutexLocker locker(&d->mutex);
+    d->entries.insert(d->key(node, ver, hash), entry);
+    return true;
+}
+
+/// Adds the entries stored in the given file to the cache.
+///
+/// Returns true if the file could be read.
+///
+/// \param path
+
+bool QXmppCapabilitiesCache::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint32 magic, format, count;
+    stream >> magic >> format >> count;
+    if (stream.status() != QDataStream::Ok ||
+        magic != capabilitiesCacheMagic ||
+        format != capabilitiesCacheFormat)
+        return false;
+
+    QHash<QString, QXmppDiscoveryIq> entries;
+    for (quint32 i = 0; i < count; ++i) {
+        QString node, hash;
+        QByteArray ver, xml;
+        stream >> node >> ver >> hash >> xml;
+        if (stream.status() != QDataStream::Ok)
+            return false;
+
+        QDomDocument doc;
+        if (!doc.setContent(xml, true))
+            return false;
+        QXmppDiscoveryIq info;
+        info.parse(doc.documentElement());
+        entries.insert(d->key(node, ver, hash), info);
+    }
+
+    QMutexLocker locker(&d->mutex);
+    d->entries.unite(entries);
+    return true;
+}
+
+/// Writes the entries of the cache to the given file.
+///
+/// Returns true if the file could be written.
+///
+/// \param path
+
+bool QXmppCapabilitiesCache::save(const QString &path) const
+{
+    QHash<QString, QXmppDiscoveryIq> entries;
+    {
+        QMutexLocker locker(&d->mutex);
+        entries = d->entries;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << capabilitiesCacheMagic << capabilitiesCacheFormat << quint32(entries.size());
+
+    QHash<QString, QXmppDiscoveryIq>::const_iterator it;
+    for (it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        // the key is "hash node#ver"
+        const QString hash = it.key().section(QLatin1Char(' '), 0, 0);
+        const QString queryNode = it.value().queryNode();
+        const int separator = queryNode.lastIndexOf(QLatin1Char('#'));
+        const QString node = queryNode.left(separator);
+        const QByteArray ver = QByteArray::fromBase64(queryNode.mid(separator + 1).toLatin1());
+
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QXmlStreamWriter writer(&buffer);
+        it.value().toXml(&writer);
+
+        stream << node << ver << hash << buffer.data();
+    }
+    return stream.status() == QDataStream::Ok;
+}
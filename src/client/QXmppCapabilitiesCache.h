@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPCAPABILITIESCACHE_H
+#define QXMPPCAPABILITIESCACHE_H
+
+#include "QXmppDiscoveryIq.h"
+
+class QXmppCapabilitiesCachePrivate;
+
+/// \brief The QXmppCapabilitiesCache class stores the service discovery
+/// information of remote entities, keyed by their XEP-0115: Entity
+/// Capabilities node, verification string and hash.
+///
+/// Entities announcing the same capabilities share a single entry, which
+/// spares a disco#info request per contact. A cache can be shared by
+/// several clients, including clients living in different threads, and
+/// saved to disk with save() so it survives restarts.
+///
+/// \ingroup Managers
+
+class QXMPP_EXPORT QXmppCapabilitiesCache
+{
+public:
+    QXmppCapabilitiesCache();
+    ~QXmppCapabilitiesCache();
+
+    bool contains(const QString &node, const QByteArray &ver, const QString &hash) const;
+    QXmppDiscoveryIq info(const QString &node, const QByteArray &ver, const QString &hash) const;
+    bool insert(const QString &node, const QByteArray &ver, const QString &hash, const QXmppDiscoveryIq &info);
+
+    bool load(const QString &path);
+    bool save(const QString &path) const;
+
+private:
+    Q_DISABLE_COPY(QXmppCapabilitiesCache)
+    QXmppCapabilitiesCachePrivate * const d;
+};
+
+#endif
@@ -21,15 +21,23 @@
  *
  */
 
+#include <QElapsedTimer>
+#include <QHash>
 #include <QSslSocket>
 #include <QTimer>
 
+#include "QXmppBoshClient_p.h"
 #include "QXmppClient.h"
 #include "QXmppClientExtension.h"
 #include "QXmppConstants.h"
+#include "QXmppIqRequest.h"
 #include "QXmppLogger.h"
 #include "QXmppOutgoingClient.h"
 #include "QXmppMessage.h"
+#include "QXmppRawStanza.h"
+#include "QXmppStanzaTrace_p.h"
+#include "QXmppTimerWheel_p.h"
+#include "QXmppTracepoints_p.h"
 #include "QXmppUtils.h"
 
 #include "QXmppRosterManager.h"
@@ -40,6 +48,34 @@
 #include "QXmppDiscoveryIq.h"
 #include "QXmppPEPManager.h"
 
+/// A stanza held back until a session is established.
+
+class QXmppClientQueuedStanza
+{
+public:
+    QXmppClientQueuedStanza() : type(QXmppStanza::Unkown), time(0) {}
+    const QXmppStanza &stanza() const;
+
+    QByteArray data;
+    QXmppStanza::StanzaType type;
+    qint64 time;
+    QXmppMessage message;
+    QXmppIq iq;
+    QXmppPresence presence;
+};
+
+const QXmppStanza &QXmppClientQueuedStanza::stanza() const
+{
+    switch (type) {
+    case QXmppStanza::Message:
+        return message;
+    case QXmppStanza::Iq:
+        return iq;
+    default:
+        return presence;
+    }
+}
+
 class QXmppClientPrivate
 {
 public:
@@ -47,16 +83,52 @@ public:
 
     QXmppPresence clientPresence;                   ///< Current presence of the client
     QList<QXmppClientExtension*> extensions;
+
+    // extensions interested in each stanza tag name, in order
+    typedef QPair<QXmppClientExtension*, QXmppClientExtension::StanzaFilter> StanzaHandler;
+    QHash<QString, QList<StanzaHandler> > stanzaHandlers;
+    QList<StanzaHandler> defaultStanzaHandlers;
     QXmppLogger *logger;
     QXmppOutgoingClient *stream;                    ///< Pointer to the XMPP stream
 
+    // whether the session was interrupted but may be resumed
+    bool sessionSuspended;
+
+    // XEP-0352: Client State Indication
+    bool active;
+
+    // stanzas held back until a session is established
+    QList<QXmppClientQueuedStanza> sendQueue;
+    int sendQueueSize;
+    QHash<int, int> sendQueueExpiry;
+    QElapsedTimer sendQueueClock;
+
     // reconnection
     bool receivedConflict;
     int reconnectionTries;
     QTimer *reconnectionTimer;
 
+    // IQ requests awaiting a response, by ID
+    QHash<QString, QXmppIqRequest*> iqRequests;
+    QXmppTimerWheel iqRequestTimeouts;
+    QElapsedTimer iqRequestClock;
+    QTimer *iqRequestTimer;
+
+    void init(QXmppClient::DefaultExtensions defaultExtensions);
+    QXmppClientExtension *createDefaultExtension(QXmppClient::DefaultExtension extension);
+    template<typename T>
+    T *defaultExtension(QXmppClient::DefaultExtension extension);
+
     void addProperCapability(QXmppPresence& presence);
-    int getNextReconnectTime() const;
+    void cancelIqRequests();
+    bool handleIqResponse(const QDomElement &element);
+    int expireSendQueue();
+    int flushSendQueue();
+    int nextReconnectionDelay();
+    bool send(const QXmppStanza &stanza, const QByteArray &data);
+    void scheduleReconnection();
+    void sendClientState();
+    void updateStanzaHandlers();
 
 private:
     QXmppClient *q;
@@ -66,11 +138,147 @@ QXmppClientPrivate::QXmppClientPrivate(QXmppClient *qq)
     : clientPresence(QXmppPresence::Available)
     , logger(0)
     , stream(0)
+    , sessionSuspended(false)
+    , active(true)
+    , sendQueueSize(0)
     , receivedConflict(false)
     , reconnectionTries(0)
     , reconnectionTimer(0)
+    , iqRequestTimer(0)
     , q(qq)
 {
+    sendQueueExpiry[QXmppStanza::Iq] = 30000;
+    sendQueueExpiry[QXmppStanza::Presence] = 30000;
+    sendQueueClock.start();
+    iqRequestClock.start();
+}
+
+/// Finishes the pending IQ requests, as their responses will never be
+/// received once the session ended.
+
+void QXmppClientPrivate::cancelIqRequests()
+{
+    const QList<QXmppIqRequest*> requests = iqRequests.values();
+    iqRequests.clear();
+    foreach (QXmppIqRequest *request, requests) {
+        iqRequestTimeouts.remove(request->id());
+        request->finish(QXmppIqRequest::CancelledState);
+    }
+    iqRequestTimer->stop();
+}
+
+/// Finishes the request to which \a element is the response, and returns
+/// true if there was such a request.
+
+bool QXmppClientPrivate::handleIqResponse(const QDomElement &element)
+{
+    const QString type = element.attribute("type");
+    if (type != QLatin1String("result") && type != QLatin1String("error"))
+        return false;
+
+    const QString id = element.attribute("id");
+    QHash<QString, QXmppIqRequest*>::iterator it = iqRequests.find(id);
+    if (it == iqRequests.end())
+        return false;
+
+    // the response must come from the entity the request was sent to,
+    // which is our own server or account if it was not addressed
+    QXmppIqRequest *request = it.value();
+    const QString from = element.attribute("from");
+    const QString to = request->to();
+    if (from != to && (!to.isEmpty() ||
+        (from != stream->configuration().jid() &&
+         from != stream->configuration().jidBare() &&
+         from != stream->configuration().domain())))
+        return false;
+
+    iqRequests.erase(it);
+    iqRequestTimeouts.remove(id);
+    if (iqRequests.isEmpty())
+        iqRequestTimer->stop();
+    request->finish(type == QLatin1String("result") ? QXmppIqRequest::ResultState : QXmppIqRequest::ErrorState, element);
+    return true;
+}
+
+/// Removes the queued stanzas which have expired, and returns their number.
+
+int QXmppClientPrivate::expireSendQueue()
+{
+    const qint64 now = sendQueueClock.elapsed();
+    int expired = 0;
+    QList<QXmppClientQueuedStanza>::iterator it = sendQueue.begin();
+    while (it != sendQueue.end()) {
+        const int expiry = sendQueueExpiry.value(it->type);
+        if (expiry > 0 && now - it->time > expiry) {
+            it = sendQueue.erase(it);
+            expired++;
+        } else {
+            ++it;
+        }
+    }
+    return expired;
+}
+
+/// Sends the queued stanzas which have not expired in a single write, and
+/// returns the number of expired stanzas.
+
+int QXmppClientPrivate::flushSendQueue()
+{
+    const int expired = expireSendQueue();
+    if (sendQueue.isEmpty())
+        return expired;
+
+    stream->cork();
+    while (!sendQueue.isEmpty() && stream->isConnected()) {
+        const QXmppClientQueuedStanza entry = sendQueue.takeFirst();
+        stream->sendPacket(entry.stanza(), entry.data);
+    }
+    stream->uncork();
+    return expired;
+}
+
+/// Sends \a stanza, which was serialized as \a data, or queues it if no
+/// session is established and the send queue is enabled.
+
+bool QXmppClientPrivate::send(const QXmppStanza &stanza, const QByteArray &data)
+{
+    if (stream->isConnected() || sendQueueSize <= 0)
+        return stream->sendPacket(stanza, data);
+
+    if (sendQueue.size() >= sendQueueSize) {
+        expireSendQueue();
+        if (sendQueue.size() >= sendQueueSize)
+            return false;
+    }
+
+    QXmppClientQueuedStanza entry;
+    entry.data = data;
+    entry.type = stanza.getStanzaType();
+    entry.time = sendQueueClock.elapsed();
+    switch (entry.type) {
+    case QXmppStanza::Message:
+        entry.message = static_cast<const QXmppMessage&>(stanza);
+        break;
+    case QXmppStanza::Iq:
+        entry.iq = static_cast<const QXmppIq&>(stanza);
+        break;
+    case QXmppStanza::Presence:
+        entry.presence = static_cast<const QXmppPresence&>(stanza);
+        break;
+    default:
+        return false;
+    }
+    sendQueue << entry;
+    return true;
+}
+
+/// Tells the server whether the client is active, as defined by
+/// XEP-0352: Client State Indication.
+
+void QXmppClientPrivate::sendClientState()
+{
+    if (stream->isClientStateIndicationSupported())
+        stream->sendData(QString("<%1 xmlns='%2'/>").arg(active ? "active" : "inactive", ns_csi).toUtf8());
 }
 
 void QXmppClientPrivate::addProperCapability(QXmppPresence& presence)
@@ -79,114 +287,249 @@ void QXmppClientPrivate::addProperCapability(QXmppPresence& presence)
     if(ext) {
         presence.setCapabilityHash("sha-1");
         presence.setCapabilityNode(ext->clientCapabilitiesNode());
-        presence.setCapabilityVer(ext->capabilities().verificationString());
+        presence.setCapabilityVer(ext->capabilitiesVerificationString());
     }
 }
 
-int QXmppClientPrivate::getNextReconnectTime() const
+/// Rebuilds the index of the extensions interested in each stanza.
+
+void QXmppClientPrivate::updateStanzaHandlers()
 {
-    if (reconnectionTries < 5)
-        return 10 * 1000;
-    else if (reconnectionTries < 10)
-        return 20 * 1000;
-    else if (reconnectionTries < 15)
-        return 40 * 1000;
-    else
-        return 60 * 1000;
+    stanzaHandlers.clear();
+    defaultStanzaHandlers.clear();
+
+    QList<QList<QXmppClientExtension::StanzaFilter> > filters;
+    foreach (QXmppClientExtension *extension, extensions) {
+        filters << extension->stanzaFilters();
+        foreach (const QXmppClientExtension::StanzaFilter &filter, filters.last())
+            stanzaHandlers[filter.tagName()];
+    }
+
+    for (int i = 0; i < extensions.size(); ++i) {
+        QXmppClientExtension *extension = extensions[i];
+        if (filters[i].isEmpty()) {
+            // the extension is offered all stanzas
+            const StanzaHandler handler(extension, QXmppClientExtension::StanzaFilter());
+            defaultStanzaHandlers << handler;
+            QHash<QString, QList<StanzaHandler> >::iterator it;
+            for (it = stanzaHandlers.begin(); it != stanzaHandlers.end(); ++it)
+                it.value() << handler;
+        } else {
+            foreach (const QXmppClientExtension::StanzaFilter &filter, filters[i]) {
+                if (filter.tagName().isEmpty()) {
+                    QHash<QString, QList<StanzaHandler> >::iterator it;
+                    for (it = stanzaHandlers.begin(); it != stanzaHandlers.end(); ++it)
+                        it.value() << StanzaHandler(extension, filter);
+                    defaultStanzaHandlers << StanzaHandler(extension, filter);
+                } else {
+                    stanzaHandlers[filter.tagName()] << StanzaHandler(extension, filter);
+                }
+            }
+        }
+    }
 }
 
-/// Creates a QXmppClient object.
-/// \param parent is passed to the QObject's constructor.
-/// The default value is 0.
+/// Returns the delay in milliseconds before the next reconnection attempt.
+///
+/// The delay is drawn at random from a window which doubles after each
+/// attempt, so that clients which lost their connection at the same time
+/// do not come back at the same time. A delay suggested by the server is
+/// added to it.
 
-QXmppClient::QXmppClient(QObject *parent)
-    : QXmppLoggable(parent),
-    d(new QXmppClientPrivate(this))
+int QXmppClientPrivate::nextReconnectionDelay()
+{
+    const QXmppConfiguration &config = stream->configuration();
+    const qint64 maximum = qMax(config.reconnectionInitialDelay(), config.reconnectionMaximumDelay());
+    qint64 window = qMax(0, config.reconnectionInitialDelay());
+    for (int i = 0; i < reconnectionTries && window < maximum; ++i)
+        window *= 2;
+    window = qMin(window, maximum);
+    reconnectionTries++;
+
+    int delay = int(window * qrand() / RAND_MAX);
+    const int hint = stream->reconnectionHint();
+    if (hint > 0)
+        delay += hint;
+    return delay;
+}
+
+/// Schedules a reconnection attempt, unless one is already scheduled.
+
+void QXmppClientPrivate::scheduleReconnection()
+{
+    if (!reconnectionTimer->isActive())
+        reconnectionTimer->start(nextReconnectionDelay());
+}
+
+/// Sets up the stream and the given default extensions.
+
+void QXmppClientPrivate::init(QXmppClient::DefaultExtensions defaultExtensions)
 {
     bool check;
     Q_UNUSED(check);
 
-    d->stream = new QXmppOutgoingClient(this);
-    d->addProperCapability(d->clientPresence);
+    stream = new QXmppOutgoingClient(q);
+    addProperCapability(clientPresence);
 
-    check = connect(d->stream, SIGNAL(elementReceived(QDomElement,bool&)),
-                    this, SLOT(_q_elementReceived(QDomElement,bool&)));
+    check = QObject::connect(stream, SIGNAL(elementReceived(QDomElement,bool&)),
+                             q, SLOT(_q_elementReceived(QDomElement,bool&)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(messageReceived(QXmppMessage)),
-                    this, SIGNAL(messageReceived(QXmppMessage)));
+    check = QObject::connect(stream, SIGNAL(messageReceived(QXmppMessage)),
+                             q, SIGNAL(messageReceived(QXmppMessage)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(presenceReceived(QXmppPresence)),
-                    this, SIGNAL(presenceReceived(QXmppPresence)));
+    check = QObject::connect(stream, SIGNAL(presenceReceived(QXmppPresence)),
+                             q, SIGNAL(presenceReceived(QXmppPresence)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(iqReceived(QXmppIq)),
-                    this, SIGNAL(iqReceived(QXmppIq)));
+    check = QObject::connect(stream, SIGNAL(iqReceived(QXmppIq)),
+                             q, SIGNAL(iqReceived(QXmppIq)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(sslErrors(QList<QSslError>)),
-                    this, SIGNAL(sslErrors(QList<QSslError>)));
+    check = QObject::connect(stream, SIGNAL(sslErrors(QList<QSslError>)),
+                             q, SIGNAL(sslErrors(QList<QSslError>)));
     Q_ASSERT(check);
 
-    check = connect(d->stream->socket(), SIGNAL(stateChanged(QAbstractSocket::SocketState)),
-                    this, SLOT(_q_socketStateChanged(QAbstractSocket::SocketState)));
+    check = QObject::connect(stream->socket(), SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+                             q, SLOT(_q_socketStateChanged(QAbstractSocket::SocketState)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(connected()),
-                    this, SLOT(_q_streamConnected()));
+    check = QObject::connect(stream, SIGNAL(connected()),
+                             q, SLOT(_q_streamConnected()));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(disconnected()),
-                    this, SLOT(_q_streamDisconnected()));
+    check = QObject::connect(stream, SIGNAL(disconnected()),
+                             q, SLOT(_q_streamDisconnected()));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(error(QXmppClient::Error)),
-                    this, SLOT(_q_streamError(QXmppClient::Error)));
+    check = QObject::connect(stream, SIGNAL(error(QXmppClient::Error)),
+                             q, SLOT(_q_streamError(QXmppClient::Error)));
     Q_ASSERT(check);
 
     // XEP-0198: Stream Management
-    check = connect(d->stream, SIGNAL(messageAcknowledged(QXmppMessage,bool)),
-                    this, SIGNAL(messageAcknowledged(QXmppMessage,bool)));
+    check = QObject::connect(stream, SIGNAL(messageAcknowledged(QXmppMessage,bool)),
+                             q, SIGNAL(messageAcknowledged(QXmppMessage,bool)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(iqAcknowledged(QXmppIq,bool)),
-                    this, SIGNAL(iqAcknowledged(QXmppIq,bool)));
+    check = QObject::connect(stream, SIGNAL(iqAcknowledged(QXmppIq,bool)),
+                             q, SIGNAL(iqAcknowledged(QXmppIq,bool)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(presenceAcknowledged(QXmppPresence,bool)),
-                    this, SIGNAL(presenceAcknowledged(QXmppPresence,bool)));
+    check = QObject::connect(stream, SIGNAL(presenceAcknowledged(QXmppPresence,bool)),
+                             q, SIGNAL(presenceAcknowledged(QXmppPresence,bool)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(streamManagementError(QXmppStanza::Error::Condition)),
-                    this, SIGNAL(streamManagementError(QXmppStanza::Error::Condition)));
+    check = QObject::connect(stream, SIGNAL(streamManagementError(QXmppStanza::Error::Condition)),
+                             q, SIGNAL(streamManagementError(QXmppStanza::Error::Condition)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(streamManagementEnabled(bool)),
-                    this, SIGNAL(streamManagementEnabled(bool)));
+    check = QObject::connect(stream, SIGNAL(streamManagementEnabled(bool)),
+                             q, SIGNAL(streamManagementEnabled(bool)));
     Q_ASSERT(check);
 
-    check = connect(d->stream, SIGNAL(streamManagementResumed(bool)),
-                    this, SIGNAL(streamManagementResumed(bool)));
+    check = QObject::connect(stream, SIGNAL(streamManagementResumed(bool)),
+                             q, SLOT(_q_streamManagementResumed(bool)));
     Q_ASSERT(check);
 
+    check = QObject::connect(stream, SIGNAL(loginTokenChanged(QString)),
+                             q, SIGNAL(loginTokenChanged(QString)));
+    Q_ASSERT(check);
 
     // reconnection
-    d->reconnectionTimer = new QTimer(this);
-    d->reconnectionTimer->setSingleShot(true);
-    connect(d->reconnectionTimer, SIGNAL(timeout()),
-            this, SLOT(_q_reconnect()));
+    reconnectionTimer = new QTimer(q);
+    reconnectionTimer->setSingleShot(true);
+    check = QObject::connect(reconnectionTimer, SIGNAL(timeout()),
+                             q, SLOT(_q_reconnect()));
+    Q_ASSERT(check);
+
+    // IQ request timeouts
+    iqRequestTimer = new QTimer(q);
+    iqRequestTimer->setInterval(iqRequestTimeouts.resolution());
+    check = QObject::connect(iqRequestTimer, SIGNAL(timeout()),
+                             q, SLOT(_q_iqRequestTimeout()));
     Q_ASSERT(check);
 
     // logging
-    setLogger(QXmppLogger::getLogger());
+    q->setLogger(QXmppLogger::getLogger());
+
+    // default extensions, in the order they are offered stanzas
+    const QXmppClient::DefaultExtension order[] = {
+        QXmppClient::RosterExtension,
+        QXmppClient::VCardExtension,
+        QXmppClient::VersionExtension,
+        QXmppClient::EntityTimeExtension,
+        QXmppClient::DiscoveryExtension,
+        QXmppClient::PEPExtension
+    };
+    for (unsigned int i = 0; i < sizeof(order) / sizeof(order[0]); ++i) {
+        if (defaultExtensions & order[i])
+            q->addExtension(createDefaultExtension(order[i]));
+    }
+}
+
+/// Creates the manager for the given default extension.
+
+QXmppClientExtension *QXmppClientPrivate::createDefaultExtension(QXmppClient::DefaultExtension extension)
+{
+    switch (extension) {
+    case QXmppClient::RosterExtension:
+        return new QXmppRosterManager(q);
+    case QXmppClient::VCardExtension:
+        return new QXmppVCardManager;
+    case QXmppClient::VersionExtension:
+        return new QXmppVersionManager;
+    case QXmppClient::EntityTimeExtension:
+        return new QXmppEntityTimeManager;
+    case QXmppClient::DiscoveryExtension:
+        return new QXmppDiscoveryManager;
+    case QXmppClient::PEPExtension:
+        return new QXmppPEPManager(true, true);
+    default:
+        return 0;
+    }
+}
+
+/// Returns the given default extension, creating it if the client does
+/// not have it yet.
+
+template<typename T>
+T *QXmppClientPrivate::defaultExtension(QXmppClient::DefaultExtension extension)
+{
+    T *manager = q->findExtension<T>();
+    if (!manager) {
+        manager = static_cast<T*>(createDefaultExtension(extension));
+        q->addExtension(manager);
+    }
+    return manager;
+}
+
+/// Creates a QXmppClient object.
+/// \param parent is passed to the QObject's constructor.
+/// The default value is 0.
+
+QXmppClient::QXmppClient(QObject *parent)
+    : QXmppLoggable(parent),
+    d(new QXmppClientPrivate(this))
+{
+    d->init(AllExtensions);
+}
+
+/// Creates a QXmppClient object with only the given default extensions.
+///
+/// The managers which are left out are created the first time they are
+/// requested through rosterManager(), vCardManager(), versionManager() or
+/// pepManager(). A manager created while the client is connected only
+/// sees the stanzas received from then on.
+///
+/// \param extensions the managers to create right away.
+/// \param parent is passed to the QObject's constructor.
 
-    addExtension(new QXmppRosterManager(this));
-    addExtension(new QXmppVCardManager);
-    addExtension(new QXmppVersionManager);
-    addExtension(new QXmppEntityTimeManager());
-    addExtension(new QXmppDiscoveryManager());
-    addExtension(new QXmppPEPManager(true, true));
+QXmppClient::QXmppClient(DefaultExtensions extensions, QObject *parent)
+    : QXmppLoggable(parent),
+    d(new QXmppClientPrivate(this))
+{
+    d->init(extensions);
 }
 
 /// Destructor, destroys the QXmppClient object.
@@ -194,6 +537,11 @@ QXmppClient::QXmppClient(QObject *parent)
 
 QXmppClient::~QXmppClient()
 {
+    // pending requests are children of the client, which is going away
+    const QList<QXmppIqRequest*> requests = d->iqRequests.values();
+    d->iqRequests.clear();
+    qDeleteAll(requests);
+
     delete d;
 }
 
@@ -222,6 +570,7 @@ bool QXmppClient::insertExtension(int index, QXmppClientExtension *extension)
     extension->setParent(this);
     extension->setClient(this);
     d->extensions.insert(index, extension);
+    d->updateStanzaHandlers();
     return true;
 }
 
@@ -235,6 +584,7 @@ bool QXmppClient::removeExtension(QXmppClientExtension* extension)
     if (d->extensions.contains(extension))
     {
         d->extensions.removeAll(extension);
+        d->updateStanzaHandlers();
         delete extension;
         return true;
     } else {
@@ -296,7 +646,11 @@ void QXmppClient::connectToServer(const QString &jid, const QString &password)
 /// QXmppMessage, QXmppPresence, QXmppIq, QXmppBind, QXmppRosterIq, QXmppSession
 /// and QXmppVCard.
 ///
-/// \return Returns true if the packet was sent, false otherwise.
+/// If the send queue is enabled, see setSendQueueSize(), a stanza which is
+/// sent while no session is established is queued and sent once the client
+/// connects or resumes its session.
+///
+/// \return Returns true if the packet was sent or queued, false otherwise.
 ///
 /// Following code snippet illustrates how to send a message using this function:
 /// \code
@@ -309,7 +663,102 @@ void QXmppClient::connectToServer(const QString &jid, const QString &password)
 
 bool QXmppClient::sendPacket(const QXmppStanza& packet)
 {
-    return d->stream->sendPacket(packet);
+    if (d->stream->isConnected() || d->sendQueueSize <= 0)
+        return d->stream->sendPacket(packet);
+
+    // serialize the packet once, it is kept until it can be sent
+    return d->send(packet, helperToXmlData(packet));
+}
+
+/// Sends \a stanza, using \a data as its already serialized form.
+///
+/// This allows a stanza which is sent often, for instance a response which
+/// only differs by its "id" and "to" attributes, to be serialized once and
+/// sent as a QXmppRawStanza whose attributes are rewritten. The stanza is
+/// only used for stream management and for the acknowledgement signals.
+///
+/// \return Returns true if the packet was sent or queued, false otherwise.
+
+bool QXmppClient::sendPacket(const QXmppStanza &stanza, const QByteArray &data)
+{
+    return d->send(stanza, data);
+}
+
+/// Sends an \a iq request, and returns a QXmppIqRequest which tracks its
+/// response.
+///
+/// The request finishes with the result or error IQ carrying the same ID,
+/// sent by the entity the request was addressed to. If no response is
+/// received within \a timeout milliseconds, or if the request could not
+/// be sent, it finishes with QXmppIqRequest::TimeoutState. Responses to
+/// requests sent this way are not dispatched to the extensions nor
+/// emitted by iqReceived().
+///
+/// Pending requests are kept in a table indexed by their ID and share a
+/// single timer, so many requests can be pipelined cheaply.
+///
+/// \param iq
+/// \param timeout
+
+QXmppIqRequest *QXmppClient::sendIq(const QXmppIq &iq, int timeout)
+{
+    // an ID which is already tracked would be ambiguous
+    if (iq.id().isEmpty() || d->iqRequests.contains(iq.id())) {
+        warning(QString("Cannot track IQ request with ID '%1'").arg(iq.id()));
+        QXmppIqRequest *request = new QXmppIqRequest(this, QString(), iq.to());
+        QMetaObject::invokeMethod(request, "cancel", Qt::QueuedConnection);
+        return request;
+    }
+
+    QXmppIqRequest *request = new QXmppIqRequest(this, iq.id(), iq.to());
+
+    d->iqRequests.insert(iq.id(), request);
+    d->iqRequestTimeouts.insert(iq.id(), d->iqRequestClock.elapsed() + timeout);
+    if (!d->iqRequestTimer->isActive())
+        d->iqRequestTimer->start();
+
+    // if the request cannot be sent, it times out on the next tick
+    if (!sendPacket(iq))
+        d->iqRequestTimeouts.insert(iq.id(), 0);
+    return request;
+}
+
+/// Holds back outgoing data until uncork() is called, so that several
+/// stanzas are written to the socket at once.
+///
+/// Calls to cork() and uncork() can be nested.
+
+void QXmppClient::cork()
+{
+    d->stream->cork();
+}
+
+/// Writes the outgoing data held back since the matching cork() call,
+/// unless the client is still corked by an outer cork() call.
+
+void QXmppClient::uncork()
+{
+    d->stream->uncork();
+}
+
+void QXmppClient::removeIqRequest(const QString &id)
+{
+    if (d->iqRequests.remove(id)) {
+        d->iqRequestTimeouts.remove(id);
+        if (d->iqRequests.isEmpty())
+            d->iqRequestTimer->stop();
+    }
+}
+
+void QXmppClient::_q_iqRequestTimeout()
+{
+    foreach (const QString &id, d->iqRequestTimeouts.expire(d->iqRequestClock.elapsed())) {
+        QXmppIqRequest *request = d->iqRequests.take(id);
+        if (request)
+            request->finish(QXmppIqRequest::TimeoutState);
+    }
+    if (d->iqRequests.isEmpty())
+        d->iqRequestTimer->stop();
 }
 
 /// Disconnects the client and the current presence of client changes to
@@ -330,6 +779,13 @@ void QXmppClient::disconnectFromServer()
         sendPacket(d->clientPresence);
 
     d->stream->disconnectFromHost();
+
+    // if we were waiting to resume the session, give up
+    if (d->sessionSuspended) {
+        d->sessionSuspended = false;
+        d->cancelIqRequests();
+        emit sessionEnded();
+    }
 }
 
 /// Returns true if the client has authenticated with the XMPP server.
@@ -347,6 +803,14 @@ bool QXmppClient::isConnected() const
     return d->stream->isConnected();
 }
 
+/// Returns true if the current session can be resumed after the connection
+/// is lost, using XEP-0198: Stream Management.
+
+bool QXmppClient::isSessionResumable() const
+{
+    return d->stream->isSessionResumable();
+}
+
 /// Returns the reference to QXmppRosterManager object of the client.
 /// \return Reference to the roster object of the connected client. Use this to
 /// get the list of friends in the roster and their presence information.
@@ -354,7 +818,7 @@ bool QXmppClient::isConnected() const
 
 QXmppRosterManager& QXmppClient::rosterManager()
 {
-    return *findExtension<QXmppRosterManager>();
+    return *d->defaultExtension<QXmppRosterManager>(QXmppClient::RosterExtension);
 }
 
 /// Utility function to send message to all the resources associated with the
@@ -367,12 +831,20 @@ QXmppRosterManager& QXmppClient::rosterManager()
 
 void QXmppClient::sendMessage(const QString& bareJid, const QString& message)
 {
-    QStringList resources = rosterManager().getResources(bareJid);
+    // a client without a roster only knows the bare JID
+    QXmppRosterManager *roster = findExtension<QXmppRosterManager>();
+    const QStringList resources = roster ? roster->getResources(bareJid) : QStringList();
     if(!resources.isEmpty())
     {
+        // serialize the message once and only rewrite its recipient
+        QXmppMessage packet("", bareJid + "/" + resources.first(), message);
+        QXmppRawStanza raw(packet);
         for(int i = 0; i < resources.size(); ++i)
         {
-            sendPacket(QXmppMessage("", bareJid + "/" + resources.at(i), message));
+            const QString jid = bareJid + "/" + resources.at(i);
+            packet.setTo(jid);
+            raw.setAttribute("to", jid);
+            d->send(packet, raw.data());
         }
     }
     else
@@ -387,8 +859,12 @@ QXmppClient::State QXmppClient::state() const
 {
     if (d->stream->isConnected())
         return QXmppClient::ConnectedState;
-    else if (d->stream->socket()->state() != QAbstractSocket::UnconnectedState &&
-             d->stream->socket()->state() != QAbstractSocket::ClosingState)
+
+    // the stream may be carried by BOSH instead of the socket
+    QXmppBoshClient *bosh = d->stream->boshClient();
+    const QAbstractSocket::SocketState socketState = bosh ? bosh->state() : d->stream->socket()->state();
+    if (socketState != QAbstractSocket::UnconnectedState &&
+        socketState != QAbstractSocket::ClosingState)
         return QXmppClient::ConnectingState;
     else
         return QXmppClient::DisconnectedState;
@@ -438,11 +914,46 @@ void QXmppClient::setClientPresence(const QXmppPresence& presence)
         connectToServer(d->stream->configuration(), presence);
 }
 
+/// Returns true if the client is in the foreground, which is the default.
+
+bool QXmppClient::isActive() const
+{
+    return d->active;
+}
+
+/// Sets whether the client is in the foreground, for instance when the
+/// application of a mobile device is sent to the background.
+///
+/// If the server supports XEP-0352: Client State Indication, it is told
+/// about the change so that it can hold back the traffic which is not
+/// urgent, such as presence updates, while the client is inactive. The
+/// state is sent again whenever the client connects.
+///
+/// While the client is inactive, QXmppRosterManager and QXmppPEPManager
+/// also hold back the presence updates and personal events they receive,
+/// only keeping the last one from each sender, and deliver them when the
+/// client becomes active again.
+///
+/// \param active
+
+void QXmppClient::setActive(bool active)
+{
+    if (active == d->active)
+        return;
+
+    d->active = active;
+    if (d->stream->isConnected())
+        d->sendClientState();
+    emit activeChanged(active);
+}
+
 /// Returns the socket error if error() is QXmppClient::SocketError.
 ///
 
 QAbstractSocket::SocketError QXmppClient::socketError()
 {
+    if (QXmppBoshClient *bosh = d->stream->boshClient())
+        return bosh->error();
     return d->stream->socket()->error();
 }
 
@@ -451,6 +962,8 @@ QAbstractSocket::SocketError QXmppClient::socketError()
 
 QString QXmppClient::socketErrorString() const
 {
+    if (QXmppBoshClient *bosh = d->stream->boshClient())
+        return bosh->errorString();
     return d->stream->socket()->errorString();
 }
 
@@ -468,7 +981,7 @@ QXmppStanza::Error::Condition QXmppClient::xmppStreamError()
 
 QXmppVCardManager& QXmppClient::vCardManager()
 {
-    return *findExtension<QXmppVCardManager>();
+    return *d->defaultExtension<QXmppVCardManager>(QXmppClient::VCardExtension);
 }
 
 /// Returns the reference to QXmppVersionManager, implementation of XEP-0092.
@@ -477,7 +990,7 @@ QXmppVCardManager& QXmppClient::vCardManager()
 
 QXmppVersionManager& QXmppClient::versionManager()
 {
-    return *findExtension<QXmppVersionManager>();
+    return *d->defaultExtension<QXmppVersionManager>(QXmppClient::VersionExtension);
 }
 
 /// Returns the reference to QXmppPEPManager, implementation of XEP-0163.
@@ -485,7 +998,7 @@ QXmppVersionManager& QXmppClient::versionManager()
 ///
 QXmppPEPManager &QXmppClient::pepManager()
 {
-    return *findExtension<QXmppPEPManager>();
+    return *d->defaultExtension<QXmppPEPManager>(QXmppClient::PEPExtension);
 }
 
 /// Sends a stream management request XEP-0198: Stream Management
@@ -496,6 +1009,23 @@ void QXmppClient::sendRequestStreamManagement()
     d->stream->sendStreamManagementRequest();
 }
 
+/// Returns the message carried by a XEP-0280: Message Carbons copy.
+
+static QDomElement carbonPayload(const QDomElement &element)
+{
+    QDomElement carbon = element.firstChildElement();
+    while (!carbon.isNull()) {
+        if (carbon.namespaceURI() == ns_message_carbons &&
+            (carbon.tagName() == QLatin1String("received") || carbon.tagName() == QLatin1String("sent"))) {
+            const QDomElement forwarded = carbon.firstChildElement("forwarded");
+            if (forwarded.namespaceURI() == ns_stanza_forwarding)
+                return forwarded.firstChildElement("message");
+        }
+        carbon = carbon.nextSiblingElement();
+    }
+    return QDomElement();
+}
+
 /// Give extensions a chance to handle incoming stanzas.
 ///
 /// \param element
@@ -503,14 +1033,65 @@ void QXmppClient::sendRequestStreamManagement()
 
 void QXmppClient::_q_elementReceived(const QDomElement &element, bool &handled)
 {
-    foreach (QXmppClientExtension *extension, d->extensions)
+    // responses to tracked requests are not dispatched
+    if (!d->iqRequests.isEmpty() && element.tagName() == QLatin1String("iq") &&
+        d->handleIqResponse(element)) {
+        handled = true;
+        return;
+    }
+
+    QHash<QString, QList<QXmppClientPrivate::StanzaHandler> >::const_iterator it = d->stanzaHandlers.constFind(element.tagName());
+    const QList<QXmppClientPrivate::StanzaHandler> &handlers = (it != d->stanzaHandlers.constEnd()) ? it.value() : d->defaultStanzaHandlers;
+
+    // messages are parsed once and shared by all extensions
+    const bool isMessage = element.tagName() == "message" && element.namespaceURI() == ns_client;
+    QXmppMessage message;
+    QDomElement stanza = element;
+    if (isMessage) {
+        message.parse(element);
+
+        // XEP-0280: carbons are handled as the message they carry, which
+        // was already parsed along with them, and must come from our own
+        // account
+        if (message.hasMessageCarbon()) {
+            const QString from = element.attribute("from");
+            const QDomElement payload = carbonPayload(element);
+            if (!from.isEmpty() && from != d->stream->configuration().jidBare()) {
+                warning(QString("Ignoring message carbon from %1").arg(from));
+                handled = true;
+                return;
+            } else if (!payload.isNull()) {
+                stanza = payload;
+                message = message.carbonMessage();
+            }
+        }
+    }
+
+    // an extension with several matching filters is only called once
+    QXmppStanzaTrace *trace = QXmppStanzaTrace::current();
+    QXmppClientExtension *last = 0;
+    foreach (const QXmppClientPrivate::StanzaHandler &handler, handlers)
     {
-        if (extension->handleStanza(element))
+        if (handler.first == last || !handler.second.matches(stanza))
+            continue;
+        last = handler.first;
+        const qint64 dispatchTime = trace ? QXmppStanzaTrace::now() : 0;
+        QXMPP_TRACEPOINT1(client__dispatch__start, handler.first->metaObject()->className());
+        const bool extensionHandled = isMessage ? handler.first->handleMessage(stanza, message) : handler.first->handleStanza(stanza);
+        QXMPP_TRACEPOINT2(client__dispatch__done, handler.first->metaObject()->className(), extensionHandled);
+        if (trace)
+            trace->addDuration(QString("dispatch.") + handler.first->metaObject()->className(), QXmppStanzaTrace::now() - dispatchTime);
+        if (extensionHandled)
         {
             handled = true;
             return;
         }
     }
+
+    if (isMessage) {
+        emit messageReceived(message);
+        handled = true;
+    }
 }
 
 void QXmppClient::_q_reconnect()
@@ -531,6 +1112,13 @@ void QXmppClient::_q_socketStateChanged(QAbstractSocket::SocketState socketState
 
 void QXmppClient::_q_streamConnected()
 {
+    // a new session replaces the interrupted one
+    if (d->sessionSuspended) {
+        d->sessionSuspended = false;
+        d->cancelIqRequests();
+        emit sessionEnded();
+    }
+
     d->receivedConflict = false;
     d->reconnectionTries = 0;
 
@@ -539,8 +1127,18 @@ void QXmppClient::_q_streamConnected()
     emit stateChanged(QXmppClient::ConnectedState);
 
     // send initial presence
-    if (d->stream->isAuthenticated())
+    if (d->stream->isAuthenticated()) {
+        if (!d->active)
+            d->sendClientState();
         sendPacket(d->clientPresence);
+    }
+
+    // send the stanzas which were queued while disconnected
+    const int expired = d->flushSendQueue();
+    if (expired) {
+        warning(QString("Dropped %1 queued stanzas which expired").arg(expired));
+        updateCounter("client.send-queue.expired", expired);
+    }
 }
 
 void QXmppClient::_q_streamDisconnected()
@@ -548,6 +1146,14 @@ void QXmppClient::_q_streamDisconnected()
     // notify managers
     emit disconnected();
     emit stateChanged(QXmppClient::DisconnectedState);
+
+    if (d->stream->isSessionResumable()) {
+        d->sessionSuspended = true;
+    } else {
+        d->sessionSuspended = false;
+        d->cancelIqRequests();
+        emit sessionEnded();
+    }
 }
 
 void QXmppClient::_q_streamError(QXmppClient::Error err)
@@ -557,12 +1163,12 @@ void QXmppClient::_q_streamError(QXmppClient::Error err)
             // if we receive a resource conflict, inhibit reconnection
             if (d->stream->xmppStreamError() == QXmppStanza::Error::Conflict)
                 d->receivedConflict = true;
-        } else if (err == QXmppClient::SocketError && !d->receivedConflict) {
-            // schedule reconnect
-            d->reconnectionTimer->start(d->getNextReconnectTime());
-        } else if (err == QXmppClient::KeepAliveError) {
-            // if we got a keepalive error, reconnect in one second
-            d->reconnectionTimer->start(1000);
+            // if the server told us when to come back, do so
+            else if (d->stream->reconnectionHint() >= 0)
+                d->scheduleReconnection();
+        } else if ((err == QXmppClient::SocketError && !d->receivedConflict) ||
+                   err == QXmppClient::KeepAliveError) {
+            d->scheduleReconnection();
         }
     }
 
@@ -570,18 +1176,115 @@ void QXmppClient::_q_streamError(QXmppClient::Error err)
     emit error(err);
 }
 
-void QXmppClient::_q_streamManagementResumed(bool resumed)
+void QXmppClient::_q_streamManagementResumed(bool success)
 {
-    if(resumed)
+    const bool suspended = d->sessionSuspended;
+    d->sessionSuspended = false;
+
+    if(success)
     {
         d->receivedConflict = false;
         d->reconnectionTries = 0;
 
+        // the client state is not part of the resumed session
+        if (!d->active)
+            d->sendClientState();
+
+        // send the stanzas which were queued while disconnected
+        const int expired = d->flushSendQueue();
+        if (expired) {
+            warning(QString("Dropped %1 queued stanzas which expired").arg(expired));
+            updateCounter("client.send-queue.expired", expired);
+        }
+
         // notify managers
+        emit streamManagementResumed(true);
+        emit resumed();
         emit stateChanged(QXmppClient::ConnectedState);
+    } else {
+        if (suspended) {
+            d->cancelIqRequests();
+            emit sessionEnded();
+        }
+        emit streamManagementResumed(false);
     }
 }
 
+/// Returns the interval at which the traces of received stanzas are
+/// logged, or 0 if stanzas are not traced.
+
+int QXmppClient::stanzaTraceInterval() const
+{
+    return d->stream->stanzaTraceInterval();
+}
+
+/// Sets the interval at which the traces of received stanzas are logged.
+///
+/// When non-zero, the time taken by each phase of the handling of every
+/// received stanza is recorded in QXmppMetrics. In addition to the phases
+/// recorded by the stream, the time spent in each extension is recorded
+/// as "dispatch.<className>", which shows how the client's CPU time is
+/// split across its extensions.
+///
+/// \param interval
+///
+/// \sa QXmppStream::setStanzaTraceInterval()
+
+void QXmppClient::setStanzaTraceInterval(int interval)
+{
+    d->stream->setStanzaTraceInterval(interval);
+}
+
+/// Returns the maximum number of stanzas which are queued while no session
+/// is established, or 0 if the send queue is disabled.
+
+int QXmppClient::sendQueueSize() const
+{
+    return d->sendQueueSize;
+}
+
+/// Sets the maximum number of stanzas which are queued while no session
+/// is established, including while the connection is being set up.
+///
+/// Queued stanzas are serialized when they are queued, and sent in a
+/// single write once the client connects or resumes its session. When the
+/// queue is full, sendPacket() returns false. The default value of 0
+/// disables the queue, so that stanzas sent while disconnected are
+/// dropped.
+///
+/// \param size
+
+void QXmppClient::setSendQueueSize(int size)
+{
+    d->sendQueueSize = size;
+    while (d->sendQueue.size() > qMax(size, 0))
+        d->sendQueue.removeLast();
+}
+
+/// Returns the time in milliseconds after which a queued stanza of the
+/// given \a type is dropped instead of being sent, or 0 if it never
+/// expires.
+
+int QXmppClient::sendQueueExpiry(QXmppStanza::StanzaType type) const
+{
+    return d->sendQueueExpiry.value(type);
+}
+
+/// Sets the time in milliseconds after which a queued stanza of the given
+/// \a type is dropped instead of being sent, or 0 if it never expires.
+///
+/// By default, messages never expire, while iqs and presences expire after
+/// 30 seconds: the sender of an iq has usually given up on its result by
+/// then, and the client presence is sent again when the client connects.
+///
+/// \param type
+/// \param msecs
+
+void QXmppClient::setSendQueueExpiry(QXmppStanza::StanzaType type, int msecs)
+{
+    d->sendQueueExpiry[type] = msecs;
+}
+
 /// Returns the QXmppLogger associated with the current QXmppClient.
 
 QXmppLogger *QXmppClient::logger() const
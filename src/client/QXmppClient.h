@@ -38,6 +38,7 @@ class QXmppClientPrivate;
 class QXmppPresence;
 class QXmppMessage;
 class QXmppIq;
+class QXmppIqRequest;
 class QXmppStream;
 
 // managers
@@ -75,6 +76,12 @@ class QXmppPEPManager;
 /// - QXmppVersionManager
 /// - QXmppDiscoveryManager
 /// - QXmppEntityTimeManager
+/// - QXmppPEPManager
+///
+/// Applications running many clients can create them with only some of
+/// these managers, see DefaultExtension. The managers returned by
+/// rosterManager(), vCardManager(), versionManager() and pepManager() are
+/// then created the first time they are requested.
 ///
 /// \ingroup Core
 
@@ -104,7 +111,22 @@ public:
         ConnectedState      ///< Connected to the server.
     };
 
+    /// This enumeration describes the managers a client is created with.
+    enum DefaultExtension
+    {
+        NoExtensions = 0x00,        ///< No manager.
+        RosterExtension = 0x01,     ///< QXmppRosterManager
+        VCardExtension = 0x02,      ///< QXmppVCardManager
+        VersionExtension = 0x04,    ///< QXmppVersionManager
+        EntityTimeExtension = 0x08, ///< QXmppEntityTimeManager
+        DiscoveryExtension = 0x10,  ///< QXmppDiscoveryManager
+        PEPExtension = 0x20,        ///< QXmppPEPManager
+        AllExtensions = 0x3f        ///< All of the above.
+    };
+    Q_DECLARE_FLAGS(DefaultExtensions, DefaultExtension)
+
     QXmppClient(QObject *parent = 0);
+    QXmppClient(DefaultExtensions extensions, QObject *parent = 0);
     ~QXmppClient();
 
     bool addExtension(QXmppClientExtension* extension);
@@ -140,14 +162,26 @@ public:
 
     bool isAuthenticated() const;
     bool isConnected() const;
+    bool isSessionResumable() const;
 
     QXmppPresence clientPresence() const;
     void setClientPresence(const QXmppPresence &presence);
 
+    bool isActive() const;
+    void setActive(bool active);
+
     QXmppConfiguration &configuration();
     QXmppLogger *logger() const;
     void setLogger(QXmppLogger *logger);
 
+    int stanzaTraceInterval() const;
+    void setStanzaTraceInterval(int interval);
+
+    int sendQueueSize() const;
+    void setSendQueueSize(int size);
+    int sendQueueExpiry(QXmppStanza::StanzaType type) const;
+    void setSendQueueExpiry(QXmppStanza::StanzaType type, int msecs);
+
     QAbstractSocket::SocketError socketError();
     QString socketErrorString() const;
     State state() const;
@@ -158,8 +192,14 @@ public:
     QXmppVersionManager& versionManager();
     QXmppPEPManager& pepManager();
 
+    bool sendPacket(const QXmppStanza &stanza, const QByteArray &data);
     void sendRequestStreamManagement();
 
+    QXmppIqRequest *sendIq(const QXmppIq &iq, int timeout = 30000);
+
+    void cork();
+    void uncork();
+
 signals:
 
     /// This signal is emitted when the client connects successfully to the XMPP
@@ -185,8 +225,28 @@ signals:
 
     /// This signal is emitted when the XMPP connection disconnects.
     ///
+    /// If the session can be resumed using XEP-0198: Stream Management, the
+    /// session's state such as the roster and presences remains valid until
+    /// sessionEnded() is emitted.
     void disconnected();
 
+    /// This signal is emitted when a session which was interrupted has been
+    /// resumed using XEP-0198: Stream Management.
+    ///
+    /// Unlike connected(), no roster or presence bootstrapping is required:
+    /// the state of the previous session is still valid, and the stanzas
+    /// which were not acknowledged have been resent.
+    void resumed();
+
+    /// This signal is emitted when the state of a session is lost, either
+    /// because the connection was closed without the possibility to resume
+    /// the session, or because resuming it failed.
+    ///
+    /// Extensions which keep per-session state should discard it when this
+    /// signal is emitted rather than on disconnected(), as the state
+    /// survives a disconnection if the session is resumed.
+    void sessionEnded();
+
     /// This signal is emitted when the XMPP connection encounters any error.
     /// The QXmppClient::Error parameter specifies the type of error occurred.
     /// It could be due to TCP socket or the xml stream or the stanza.
@@ -202,10 +262,18 @@ signals:
     /// This signal is emitted when the logger changes.
     void loggerChanged(QXmppLogger *logger);
 
+    /// This signal is emitted when the client switches between the
+    /// foreground and the background, see setActive().
+    void activeChanged(bool active);
+
     /// Notifies that an XMPP message stanza is received. The QXmppMessage
     /// parameter contains the details of the message sent to this client.
     /// In other words whenever someone sends you a message this signal is
     /// emitted.
+    ///
+    /// Copies from XEP-0280: Message Carbons are delivered as the message
+    /// they carry, whose QXmppMessage::carbonDirection() tells whether it
+    /// was received or sent by another resource.
     void messageReceived(const QXmppMessage &message);
 
     /// Notifies that an XMPP presence stanza is received. The QXmppPresence
@@ -252,6 +320,12 @@ signals:
     /// This signal is emitted when the session has been resumed
     void streamManagementResumed(bool resumed);
 
+    /// This signal is emitted when the server issues a new login \a token,
+    /// which the application can store and pass to
+    /// QXmppConfiguration::setLoginToken() to reconnect faster. An empty
+    /// \a token means the previous one was rejected.
+    void loginTokenChanged(const QString &token);
+
 public slots:
     void connectToServer(const QXmppConfiguration&,
                          const QXmppPresence& initialPresence =
@@ -269,10 +343,16 @@ private slots:
     void _q_streamConnected();
     void _q_streamDisconnected();
     void _q_streamError(QXmppClient::Error error);
-    void _q_streamManagementResumed(bool resumed);
+    void _q_streamManagementResumed(bool success);
+    void _q_iqRequestTimeout();
 
 private:
+    void removeIqRequest(const QString &id);
+
+    friend class QXmppIqRequest;
     QXmppClientPrivate * const d;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(QXmppClient::DefaultExtensions)
+
 #endif // QXMPPCLIENT_H
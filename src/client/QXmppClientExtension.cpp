@@ -21,10 +21,62 @@
  *
  */
 
+#include <QDomElement>
 #include <QStringList>
 
 #include "QXmppClientExtension.h"
 
+/// Constructs a stanza filter.
+///
+/// \param tagName The stanza's tag name, for instance "iq".
+/// \param childNamespace The namespace of a child element, for instance "jabber:iq:roster".
+/// \param childTagName The tag name of a child element, for instance "query".
+
+QXmppClientExtension::StanzaFilter::StanzaFilter(const QString &tagName, const QString &childNamespace, const QString &childTagName)
+    : m_tagName(tagName)
+    , m_childNamespace(childNamespace)
+    , m_childTagName(childTagName)
+{
+}
+
+/// Returns the tag name of the stanzas, or an empty string for any stanza.
+
+QString QXmppClientExtension::StanzaFilter::tagName() const
+{
+    return m_tagName;
+}
+
+/// Returns the namespace of the child element the stanzas must have, if any.
+
+QString QXmppClientExtension::StanzaFilter::childNamespace() const
+{
+    return m_childNamespace;
+}
+
+/// Returns the tag name of the child element the stanzas must have, if any.
+
+QString QXmppClientExtension::StanzaFilter::childTagName() const
+{
+    return m_childTagName;
+}
+
+/// Returns true if the given \a stanza matches the filter.
+
+bool QXmppClientExtension::StanzaFilter::matches(const QDomElement &stanza) const
+{
+    if (!m_tagName.isEmpty() && stanza.tagName() != m_tagName)
+        return false;
+    if (m_childNamespace.isEmpty() && m_childTagName.isEmpty())
+        return true;
+
+    for (QDomElement child = stanza.firstChildElement(); !child.isNull(); child = child.nextSiblingElement()) {
+        if ((m_childNamespace.isEmpty() || child.namespaceURI() == m_childNamespace) &&
+            (m_childTagName.isEmpty() || child.tagName() == m_childTagName))
+            return true;
+    }
+    return false;
+}
+
 class QXmppClientExtensionPrivate
 {
 public:
@@ -64,6 +116,40 @@ QList<QXmppDiscoveryIq::Identity> QXmppClientExtension::discoveryIdentities() co
     return QList<QXmppDiscoveryIq::Identity>();
 }
 
+/// Returns the incoming stanzas which handleStanza() should be called for.
+///
+/// The client only offers an extension the stanzas which match one of
+/// its filters, which saves extensions from inspecting stanzas they do
+/// not handle. The filters are read when the extension is added to the
+/// client.
+///
+/// The default implementation returns an empty list, in which case
+/// handleStanza() is called for all stanzas.
+
+QList<QXmppClientExtension::StanzaFilter> QXmppClientExtension::stanzaFilters() const
+{
+    return QList<StanzaFilter>();
+}
+
+/// Processes an incoming message stanza.
+///
+/// The client parses each incoming message once and passes the result to
+/// every interested extension, so extensions which only need the parsed
+/// message can reimplement this method instead of parsing \a stanza
+/// themselves.
+///
+/// The return value has the same meaning as for handleStanza(), which the
+/// default implementation calls.
+///
+/// \param stanza
+/// \param message
+
+bool QXmppClientExtension::handleMessage(const QDomElement &stanza, const QXmppMessage &message)
+{
+    Q_UNUSED(message);
+    return handleStanza(stanza);
+}
+
 /// Returns the client which loaded this extension.
 ///
 
@@ -32,6 +32,7 @@ class QStringList;
 
 class QXmppClient;
 class QXmppClientExtensionPrivate;
+class QXmppMessage;
 class QXmppStream;
 
 /// \brief The QXmppClientExtension class is the base class for QXmppClient
@@ -49,11 +50,38 @@ class QXMPP_EXPORT QXmppClientExtension : public QXmppLoggable
     Q_OBJECT
 
 public:
+    /// \brief The StanzaFilter class describes incoming stanzas which an
+    /// extension handles.
+    ///
+    /// A stanza matches if its tag name is tagName() and, if a child
+    /// namespace or tag name is set, it has a child element with that
+    /// namespace and tag name. An empty tag name matches any stanza.
+
+    class QXMPP_EXPORT StanzaFilter
+    {
+    public:
+        StanzaFilter(const QString &tagName = QString(),
+                     const QString &childNamespace = QString(),
+                     const QString &childTagName = QString());
+
+        QString tagName() const;
+        QString childNamespace() const;
+        QString childTagName() const;
+
+        bool matches(const QDomElement &stanza) const;
+
+    private:
+        QString m_tagName;
+        QString m_childNamespace;
+        QString m_childTagName;
+    };
+
     QXmppClientExtension();
     virtual ~QXmppClientExtension();
 
     virtual QStringList discoveryFeatures() const;
     virtual QList<QXmppDiscoveryIq::Identity> discoveryIdentities() const;
+    virtual QList<StanzaFilter> stanzaFilters() const;
 
     /// \brief You need to implement this method to process incoming XMPP
     /// stanzas.
@@ -62,6 +90,7 @@ public:
     /// processing should occur, or false to let other extensions process
     /// the stanza.
     virtual bool handleStanza(const QDomElement &stanza) = 0;
+    virtual bool handleMessage(const QDomElement &stanza, const QXmppMessage &message);
 
 protected:
     QXmppClient *client();
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QFileInfo>
+#include <QSslCertificate>
+#include <QThread>
+
+#include "QXmppClient.h"
+#include "QXmppClientPool.h"
+#include "QXmppClientPool_p.h"
+#include "QXmppConfiguration.h"
+
+void QXmppClientPoolWorker::deleteObject(QObject *object)
+{
+    delete object;
+}
+
+class QXmppClientPoolPrivate
+{
+public:
+    QXmppClientPoolPrivate(QXmppClientPool *qq);
+    void deleteClient(QXmppClient *client);
+
+    QList<QSslCertificate> caCertificates;
+    QList<QXmppClient*> clients;
+    QList<QThread*> threads;
+    QList<QXmppClientPoolWorker*> workers;
+    int nextThread;
+
+private:
+    QXmppClientPool *q;
+};
+
+QXmppClientPoolPrivate::QXmppClientPoolPrivate(QXmppClientPool *qq)
+    : nextThread(0)
+    , q(qq)
+{
+}
+
+void QXmppClientPoolPrivate::deleteClient(QXmppClient *client)
+{
+    // a client must be destroyed from the thread it lives in
+    if (client->thread() == q->thread()) {
+        delete client;
+        return;
+    }
+    foreach (QXmppClientPoolWorker *worker, workers) {
+        if (worker->thread() == client->thread()) {
+            QMetaObject::invokeMethod(worker, "deleteObject", Qt::BlockingQueuedConnection,
+                                      Q_ARG(QObject*, client));
+            return;
+        }
+    }
+}
+
+/// Constructs a new client pool.
+///
+/// \param parent
+
+QXmppClientPool::QXmppClientPool(QObject *parent)
+    : QXmppLoggable(parent)
+    , d(new QXmppClientPoolPrivate(this))
+{
+    qRegisterMetaType<QXmppConfiguration>("QXmppConfiguration");
+}
+
+/// Destroys the pool, along with all its clients.
+
+QXmppClientPool::~QXmppClientPool()
+{
+    foreach (QXmppClient *client, d->clients)
+        d->deleteClient(client);
+
+    foreach (QThread *thread, d->threads) {
+        thread->quit();
+        thread->wait();
+    }
+    qDeleteAll(d->workers);
+    qDeleteAll(d->threads);
+    delete d;
+}
+
+/// Reads the CA certificates used to verify servers from the given path,
+/// so that they are only parsed once for all the clients of the pool.
+///
+/// \param path
+
+void QXmppClientPool::addCaCertificates(const QString &path)
+{
+    if (path.isEmpty()) {
+        d->caCertificates = QList<QSslCertificate>();
+    } else if (QFileInfo(path).isReadable()) {
+        d->caCertificates = QSslCertificate::fromPath(path);
+    } else {
+        warning(QString("SSL CA certificates are not readable %1").arg(path));
+        d->caCertificates = QList<QSslCertificate>();
+    }
+}
+
+/// Returns the CA certificates shared by the clients of the pool.
+
+QList<QSslCertificate> QXmppClientPool::caCertificates() const
+{
+    return d->caCertificates;
+}
+
+/// Sets the CA certificates shared by the clients of the pool.
+///
+/// They are used by connectToServer() for configurations which do not
+/// specify their own CA certificates.
+///
+/// \param certificates
+
+void QXmppClientPool::setCaCertificates(const QList<QSslCertificate> &certificates)
+{
+    d->caCertificates = certificates;
+}
+
+/// Returns the number of worker threads the clients are spread across.
+///
+/// A value of 0, the default, means the clients live in the pool's thread.
+
+int QXmppClientPool::threadCount() const
+{
+    return d->threads.size();
+}
+
+/// Sets the number of worker threads the clients are spread across.
+///
+/// This must be called before any client is added.
+///
+/// \param count
+
+void QXmppClientPool::setThreadCount(int count)
+{
+    if (!d->clients.isEmpty()) {
+        warning("Cannot change the thread count of a client pool which has clients");
+        return;
+    }
+
+    count = qMax(0, count);
+    while (d->threads.size() > count) {
+        QThread *thread = d->threads.takeLast();
+        thread->quit();
+        thread->wait();
+        delete d->workers.takeLast();
+        delete thread;
+    }
+    while (d->threads.size() < count) {
+        QThread *thread = new QThread;
+        QXmppClientPoolWorker *worker = new QXmppClientPoolWorker;
+        worker->moveToThread(thread);
+        thread->start();
+        d->threads << thread;
+        d->workers << worker;
+    }
+    d->nextThread = 0;
+}
+
+/// Adds the given client to the pool, which takes ownership of it.
+///
+/// The client must not have a parent. If the pool has worker threads, the
+/// client is moved to one of them, so it should be fully configured,
+/// including its extensions, before being added.
+///
+/// \param client
+
+void QXmppClientPool::addClient(QXmppClient *client)
+{
+    if (!client || d->clients.contains(client))
+        return;
+    if (client->parent()) {
+        warning("Cannot add a client which has a parent to a client pool");
+        return;
+    }
+
+    if (!d->threads.isEmpty()) {
+        client->moveToThread(d->threads.at(d->nextThread));
+        d->nextThread = (d->nextThread + 1) % d->threads.size();
+    }
+    d->clients << client;
+}
+
+/// Returns the clients of the pool.
+
+QList<QXmppClient*> QXmppClientPool::clients() const
+{
+    return d->clients;
+}
+
+/// Removes the given client from the pool and destroys it.
+///
+/// \param client
+
+void QXmppClientPool::removeClient(QXmppClient *client)
+{
+    if (d->clients.removeAll(client))
+        d->deleteClient(client);
+}
+
+/// Connects the given client of the pool to its server.
+///
+/// If \a config does not specify any CA certificates, the pool's are used.
+///
+/// \param client
+/// \param config
+
+void QXmppClientPool::connectToServer(QXmppClient *client, const QXmppConfiguration &config)
+{
+    if (!d->clients.contains(client))
+        return;
+
+    QXmppConfiguration clientConfig = config;
+    if (clientConfig.caCertificates().isEmpty() && !d->caCertificates.isEmpty())
+        clientConfig.setCaCertificates(d->caCertificates);
+
+    QMetaObject::invokeMethod(client, "connectToServer", Qt::QueuedConnection,
+                              Q_ARG(QXmppConfiguration, clientConfig));
+}
+
+/// Disconnects all the clients of the pool from their servers.
+
+void QXmppClientPool::disconnectFromServer()
+{
+    foreach (QXmppClient *client, d->clients)
+        QMetaObject::invokeMethod(client, "disconnectFromServer", Qt::QueuedConnection);
+}
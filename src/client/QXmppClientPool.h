@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPCLIENTPOOL_H
+#define QXMPPCLIENTPOOL_H
+
+#include <QList>
+
+#include "QXmppLogger.h"
+
+class QSslCertificate;
+class QXmppClient;
+class QXmppClientPoolPrivate;
+class QXmppConfiguration;
+
+/// \brief The QXmppClientPool class hosts a large number of client accounts
+/// in a single process.
+///
+/// Clients are created and configured as usual, then handed over to the
+/// pool using addClient(). The pool spreads them across its worker threads
+/// and shares the data which is the same for every account, such as the
+/// CA certificates used to verify servers.
+///
+/// Once a client has been added to a pool, it lives in a worker thread:
+/// you should only interact with it using queued signal and slot
+/// connections, or through the pool's methods.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppClientPool : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppClientPool(QObject *parent = 0);
+    ~QXmppClientPool();
+
+    void addCaCertificates(const QString &path);
+    QList<QSslCertificate> caCertificates() const;
+    void setCaCertificates(const QList<QSslCertificate> &certificates);
+
+    int threadCount() const;
+    void setThreadCount(int count);
+
+    void addClient(QXmppClient *client);
+    QList<QXmppClient*> clients() const;
+    void removeClient(QXmppClient *client);
+
+public slots:
+    void connectToServer(QXmppClient *client, const QXmppConfiguration &config);
+    void disconnectFromServer();
+
+private:
+    QXmppClientPoolPrivate *d;
+};
+
+#endif
@@ -23,6 +23,7 @@
 
 #include <QNetworkProxy>
 #include <QSslSocket>
+#include <QUrl>
 
 #include "QXmppConfiguration.h"
 #include "QXmppUtils.h"
@@ -49,6 +50,9 @@ public:
     // Windows Live
     QString windowsLiveAccessToken;
 
+    // token issued by the server to log in again without the password
+    QString loginToken;
+
     // default is false
     bool autoAcceptSubscriptions;
     // default is true
@@ -61,18 +65,36 @@ public:
     int keepAliveTimeout;
     // will keep reconnecting if disconnected, default is true
     bool autoReconnectionEnabled;
+    // bounds in milliseconds of the window from which reconnection
+    // delays are drawn, which doubles after each failed attempt
+    int reconnectionInitialDelay;
+    int reconnectionMaximumDelay;
     // which authentication systems to use (if any)
     bool useSASLAuthentication;
     bool useNonSASLAuthentication;
     // default is true
     bool ignoreSslErrors;
+    bool directTlsEnabled;
+    bool tlsSessionResumptionEnabled;
+    // time in seconds for which verified server certificates are cached
+    int certificateCacheTimeout;
+    // delay in milliseconds between parallel connection attempts,
+    // if zero servers are tried one after the other
+    int connectionAttemptDelay;
 
     QXmppConfiguration::StreamSecurityMode streamSecurityMode;
     QXmppConfiguration::NonSASLAuthMechanism nonSASLAuthMechanism;
     QXmppConfiguration::StreamManagementMode streamManagementMode;
+    int streamManagementAckStanzas;
+    int streamManagementAckBytes;
+    int streamManagementAckInterval;
+    bool streamManagementAdaptiveAck;
     QString saslAuthMechanism;
+    bool streamCompressionEnabled;
+    bool pipelinedNegotiation;
 
     QNetworkProxy networkProxy;
+    QUrl boshUrl;
 
     QList<QSslCertificate> caCertificates;
 };
@@ -86,13 +108,25 @@ QXmppConfigurationPrivate::QXmppConfigurationPrivate()
     , keepAliveInterval(60)
     , keepAliveTimeout(20)
     , autoReconnectionEnabled(true)
+    , reconnectionInitialDelay(10000)
+    , reconnectionMaximumDelay(300000)
     , useSASLAuthentication(true)
     , useNonSASLAuthentication(true)
     , ignoreSslErrors(true)
+    , directTlsEnabled(false)
+    , tlsSessionResumptionEnabled(false)
+    , certificateCacheTimeout(0)
+    , connectionAttemptDelay(0)
     , streamSecurityMode(QXmppConfiguration::TLSEnabled)
     , nonSASLAuthMechanism(QXmppConfiguration::NonSASLDigest)
     , saslAuthMechanism("DIGEST-MD5")
     , streamManagementMode(QXmppConfiguration::SMDisabled)
+    , streamManagementAckStanzas(10)
+    , streamManagementAckBytes(0)
+    , streamManagementAckInterval(0)
+    , streamManagementAdaptiveAck(false)
+    , streamCompressionEnabled(false)
+    , pipelinedNegotiation(false)
 {
 }
 
@@ -374,6 +408,28 @@ void QXmppConfiguration::setWindowsLiveAccessToken(const QString& accessToken)
     d->windowsLiveAccessToken = accessToken;
 }
 
+/// Returns the token used for X-QXMPP-TOKEN authentication.
+
+QString QXmppConfiguration::loginToken() const
+{
+    return d->loginToken;
+}
+
+/// Sets the token used for X-QXMPP-TOKEN authentication.
+///
+/// The server issues a token after a successful login, and a new one each
+/// time the token is used. Logging in with the token spares the server a
+/// password check, which makes reconnections cheaper. Store the token
+/// when QXmppClient::loginTokenChanged() is emitted and set it before
+/// connecting again.
+///
+/// \param token
+
+void QXmppConfiguration::setLoginToken(const QString &token)
+{
+    d->loginToken = token;
+}
+
 /// Returns the auto-accept-subscriptions-request configuration.
 ///
 /// \return boolean value
@@ -418,6 +474,52 @@ void QXmppConfiguration::setAutoReconnectionEnabled(bool value)
     d->autoReconnectionEnabled = value;
 }
 
+/// Returns the window in milliseconds from which the delay before the
+/// first reconnection attempt is drawn.
+///
+/// Default value: 10000
+
+int QXmppConfiguration::reconnectionInitialDelay() const
+{
+    return d->reconnectionInitialDelay;
+}
+
+/// Sets the window in milliseconds from which the delay before the first
+/// reconnection attempt is drawn.
+///
+/// Each reconnection delay is drawn at random between zero and the window,
+/// which doubles after each failed attempt up to
+/// reconnectionMaximumDelay(). Drawing the whole delay at random spreads
+/// the reconnections of many clients which lost their connection at the
+/// same time, for instance when a server restarts.
+///
+/// \param msecs
+
+void QXmppConfiguration::setReconnectionInitialDelay(int msecs)
+{
+    d->reconnectionInitialDelay = msecs;
+}
+
+/// Returns the maximum window in milliseconds from which reconnection
+/// delays are drawn.
+///
+/// Default value: 300000
+
+int QXmppConfiguration::reconnectionMaximumDelay() const
+{
+    return d->reconnectionMaximumDelay;
+}
+
+/// Sets the maximum window in milliseconds from which reconnection delays
+/// are drawn.
+///
+/// \param msecs
+
+void QXmppConfiguration::setReconnectionMaximumDelay(int msecs)
+{
+    d->reconnectionMaximumDelay = msecs;
+}
+
 /// Returns whether SSL errors (such as certificate validation errors)
 /// are to be ignored when connecting to the XMPP server.
 
@@ -434,6 +536,105 @@ void QXmppConfiguration::setIgnoreSslErrors(bool value)
     d->ignoreSslErrors = value;
 }
 
+/// Returns whether servers advertised for XEP-0368: Direct TLS are used.
+///
+/// Default value: false
+
+bool QXmppConfiguration::directTlsEnabled() const
+{
+    return d->directTlsEnabled;
+}
+
+/// Sets whether servers advertised for XEP-0368: Direct TLS are used.
+///
+/// When enabled, the client looks up both the _xmpps-client and the
+/// _xmpp-client SRV records of the domain and tries the servers in order of
+/// priority, preferring direct TLS at equal priority. Connecting with TLS
+/// right away saves the round trips of STARTTLS. This has no effect when
+/// an explicit host is set.
+///
+/// \param enabled
+
+void QXmppConfiguration::setDirectTlsEnabled(bool enabled)
+{
+    d->directTlsEnabled = enabled;
+}
+
+/// Returns whether TLS sessions are resumed when reconnecting to a server.
+///
+/// Default value: false
+
+bool QXmppConfiguration::tlsSessionResumptionEnabled() const
+{
+    return d->tlsSessionResumptionEnabled;
+}
+
+/// Sets whether TLS sessions are resumed when reconnecting to a server,
+/// which avoids a full TLS handshake.
+///
+/// The session tickets are shared by all the clients of the process, per
+/// server host and port. This requires Qt 5.4 or later.
+///
+/// \param enabled
+
+void QXmppConfiguration::setTlsSessionResumptionEnabled(bool enabled)
+{
+    d->tlsSessionResumptionEnabled = enabled;
+}
+
+/// Returns the time in seconds for which the server certificates which
+/// passed verification are remembered, or 0 if they are not.
+///
+/// Default value: 0
+
+int QXmppConfiguration::certificateCacheTimeout() const
+{
+    return d->certificateCacheTimeout;
+}
+
+/// Sets the time in seconds for which the server certificates which passed
+/// verification are remembered, so that the next connections to the same
+/// domain skip the verification of the certificate chain.
+///
+/// The certificates are shared by all the clients of the process, by
+/// domain and fingerprint, and are forgotten when they expire. If the
+/// server presents a certificate which is not cached, the connection is
+/// closed unless SSL errors are ignored, and the next connection verifies
+/// the certificate.
+///
+/// \param secs
+
+void QXmppConfiguration::setCertificateCacheTimeout(int secs)
+{
+    d->certificateCacheTimeout = qMax(0, secs);
+}
+
+/// Returns the delay in milliseconds between parallel connection attempts.
+///
+/// Default value: 0, i.e. servers are tried one after the other
+
+int QXmppConfiguration::connectionAttemptDelay() const
+{
+    return d->connectionAttemptDelay;
+}
+
+/// Sets the delay in milliseconds between parallel connection attempts.
+///
+/// When non-zero, the client races connection attempts to the addresses of
+/// the best servers, alternating between IPv6 and IPv4, starting a new
+/// attempt each time the delay elapses or an attempt fails, and keeps the
+/// server which answers first. This avoids waiting for a TCP timeout when a
+/// server or an address family is unreachable. RFC 8305 recommends 250 ms.
+///
+/// Parallel attempts are not made through a proxy.
+///
+/// \param msecs
+
+void QXmppConfiguration::setConnectionAttemptDelay(int msecs)
+{
+    d->connectionAttemptDelay = msecs;
+}
+
 /// Returns whether to make use of SASL authentication.
 
 bool QXmppConfiguration::useSASLAuthentication() const
@@ -522,6 +723,143 @@ void QXmppConfiguration::setStreamManagementMode(QXmppConfiguration::StreamManag
     d->streamManagementMode = sm;
 }
 
+/// Returns the number of stanzas after which an acknowledgement is
+/// requested when using XEP-0198: Stream Management.
+///
+/// Default value: 10
+
+int QXmppConfiguration::streamManagementAckStanzas() const
+{
+    return d->streamManagementAckStanzas;
+}
+
+/// Sets the number of stanzas after which an acknowledgement is
+/// requested when using XEP-0198: Stream Management.
+///
+/// A value of 0 disables requests based on the number of stanzas.
+///
+/// \param count
+
+void QXmppConfiguration::setStreamManagementAckStanzas(int count)
+{
+    d->streamManagementAckStanzas = count;
+}
+
+/// Returns the number of bytes after which an acknowledgement is
+/// requested when using XEP-0198: Stream Management.
+///
+/// Default value: 0 (disabled)
+
+int QXmppConfiguration::streamManagementAckBytes() const
+{
+    return d->streamManagementAckBytes;
+}
+
+/// Sets the number of bytes after which an acknowledgement is
+/// requested when using XEP-0198: Stream Management.
+///
+/// A value of 0 disables requests based on the amount of data.
+///
+/// \param bytes
+
+void QXmppConfiguration::setStreamManagementAckBytes(int bytes)
+{
+    d->streamManagementAckBytes = bytes;
+}
+
+/// Returns the interval in milliseconds after which an acknowledgement is
+/// requested for unacknowledged stanzas when using XEP-0198: Stream
+/// Management.
+///
+/// Default value: 0 (disabled)
+
+int QXmppConfiguration::streamManagementAckInterval() const
+{
+    return d->streamManagementAckInterval;
+}
+
+/// Sets the interval in milliseconds after which an acknowledgement is
+/// requested for unacknowledged stanzas when using XEP-0198: Stream
+/// Management.
+///
+/// A value of 0 disables timed requests.
+///
+/// \param msecs
+
+void QXmppConfiguration::setStreamManagementAckInterval(int msecs)
+{
+    d->streamManagementAckInterval = msecs;
+}
+
+/// Returns whether acknowledgement requests adapt to the measured
+/// acknowledgement latency when using XEP-0198: Stream Management.
+///
+/// Default value: false
+
+bool QXmppConfiguration::streamManagementAdaptiveAck() const
+{
+    return d->streamManagementAdaptiveAck;
+}
+
+/// Sets whether acknowledgement requests adapt to the measured
+/// acknowledgement latency when using XEP-0198: Stream Management.
+///
+/// If enabled, no request is sent while another one is waiting for an
+/// answer, and the interval between timed requests is stretched to at least
+/// twice the measured latency. This saves bandwidth on slow links.
+///
+/// \param adaptive
+
+void QXmppConfiguration::setStreamManagementAdaptiveAck(bool adaptive)
+{
+    d->streamManagementAdaptiveAck = adaptive;
+}
+
+/// Returns whether XEP-0138: Stream Compression is used when the server
+/// offers it.
+///
+/// Default value: false
+
+bool QXmppConfiguration::streamCompressionEnabled() const
+{
+    return d->streamCompressionEnabled;
+}
+
+/// Sets whether XEP-0138: Stream Compression is used when the server
+/// offers it. This requires QXmpp to be built with zlib support.
+///
+/// \param enabled
+
+void QXmppConfiguration::setStreamCompressionEnabled(bool enabled)
+{
+    d->streamCompressionEnabled = enabled;
+}
+
+/// Returns whether the steps of the stream negotiation which do not depend
+/// on each other's result are pipelined.
+///
+/// Default value: false
+
+bool QXmppConfiguration::pipelinedNegotiation() const
+{
+    return d->pipelinedNegotiation;
+}
+
+/// Sets whether the steps of the stream negotiation which do not depend on
+/// each other's result are pipelined, to save round trips when logging in.
+///
+/// When enabled, the resource binding request is sent along with the stream
+/// restart which follows SASL authentication, the session is requested
+/// without waiting for the binding result, and session establishment is
+/// skipped when the server marks it as optional.
+///
+/// \param enabled
+
+void QXmppConfiguration::setPipelinedNegotiation(bool enabled)
+{
+    d->pipelinedNegotiation = enabled;
+}
+
 /// Returns the preferred SASL authentication mechanism.
 ///
 /// Default value: "DIGEST-MD5"
@@ -533,7 +871,8 @@ QString QXmppConfiguration::saslAuthMechanism() const
 
 /// Sets the preferred SASL authentication \a mechanism.
 ///
-/// Valid values: "PLAIN", "DIGEST-MD5", "ANONYMOUS", "X-FACEBOOK-PLATFORM"
+/// Valid values: "SCRAM-SHA-256" (Qt 5 only), "SCRAM-SHA-1", "PLAIN",
+/// "DIGEST-MD5", "ANONYMOUS", "X-FACEBOOK-PLATFORM"
 
 void QXmppConfiguration::setSaslAuthMechanism(const QString &mechanism)
 {
@@ -562,6 +901,31 @@ QNetworkProxy QXmppConfiguration::networkProxy() const
     return d->networkProxy;
 }
 
+/// Returns the URL of the BOSH connection manager to connect through.
+///
+/// Default value: an empty URL, the client connects to the server directly.
+
+QUrl QXmppConfiguration::boshUrl() const
+{
+    return d->boshUrl;
+}
+
+/// Sets the URL of the BOSH connection manager to connect through, as
+/// defined by XEP-0124: Bidirectional-streams Over Synchronous HTTP and
+/// XEP-0206: XMPP Over BOSH, for instance "https://example.com/http-bind".
+///
+/// BOSH lets clients which can only make HTTP requests, for instance
+/// behind a web proxy, connect to the server. The host, port and SRV
+/// records are not used when a URL is set, and STARTTLS is not negotiated:
+/// use an https URL to encrypt the connection.
+///
+/// \param url
+
+void QXmppConfiguration::setBoshUrl(const QUrl &url)
+{
+    d->boshUrl = url;
+}
+
 /// Specifies the interval in seconds at which keep alive (ping) packets
 /// will be sent to the server.
 ///
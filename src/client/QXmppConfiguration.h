@@ -25,6 +25,7 @@
 #ifndef QXMPPCONFIGURATION_H
 #define QXMPPCONFIGURATION_H
 
+#include <QMetaType>
 #include <QString>
 #include <QSharedDataPointer>
 
@@ -32,6 +33,7 @@
 
 class QNetworkProxy;
 class QSslCertificate;
+class QUrl;
 class QXmppConfigurationPrivate;
 
 /// \brief The QXmppConfiguration class holds configuration options.
@@ -121,12 +123,21 @@ public:
     QString windowsLiveAccessToken() const;
     void setWindowsLiveAccessToken(const QString &accessToken);
 
+    QString loginToken() const;
+    void setLoginToken(const QString &token);
+
     bool autoAcceptSubscriptions() const;
     void setAutoAcceptSubscriptions(bool);
 
     bool autoReconnectionEnabled() const;
     void setAutoReconnectionEnabled(bool);
 
+    int reconnectionInitialDelay() const;
+    void setReconnectionInitialDelay(int msecs);
+
+    int reconnectionMaximumDelay() const;
+    void setReconnectionMaximumDelay(int msecs);
+
     bool useSASLAuthentication() const;
     void setUseSASLAuthentication(bool);
 
@@ -136,6 +147,18 @@ public:
     bool ignoreSslErrors() const;
     void setIgnoreSslErrors(bool);
 
+    bool directTlsEnabled() const;
+    void setDirectTlsEnabled(bool enabled);
+
+    bool tlsSessionResumptionEnabled() const;
+    void setTlsSessionResumptionEnabled(bool enabled);
+
+    int certificateCacheTimeout() const;
+    void setCertificateCacheTimeout(int secs);
+
+    int connectionAttemptDelay() const;
+    void setConnectionAttemptDelay(int msecs);
+
     QXmppConfiguration::StreamSecurityMode streamSecurityMode() const;
     void setStreamSecurityMode(QXmppConfiguration::StreamSecurityMode mode);
 
@@ -145,12 +168,33 @@ public:
     QXmppConfiguration::StreamManagementMode streamManagementMode() const;
     void setStreamManagementMode(QXmppConfiguration::StreamManagementMode);
 
+    int streamManagementAckStanzas() const;
+    void setStreamManagementAckStanzas(int count);
+
+    int streamManagementAckBytes() const;
+    void setStreamManagementAckBytes(int bytes);
+
+    int streamManagementAckInterval() const;
+    void setStreamManagementAckInterval(int msecs);
+
+    bool streamManagementAdaptiveAck() const;
+    void setStreamManagementAdaptiveAck(bool adaptive);
+
+    bool streamCompressionEnabled() const;
+    void setStreamCompressionEnabled(bool enabled);
+
+    bool pipelinedNegotiation() const;
+    void setPipelinedNegotiation(bool enabled);
+
     QString saslAuthMechanism() const;
     void setSaslAuthMechanism(const QString &mechanism);
 
     QNetworkProxy networkProxy() const;
     void setNetworkProxy(const QNetworkProxy& proxy);
 
+    QUrl boshUrl() const;
+    void setBoshUrl(const QUrl &url);
+
     int keepAliveInterval() const;
     void setKeepAliveInterval(int secs);
 
@@ -164,4 +208,6 @@ private:
     QSharedDataPointer<QXmppConfigurationPrivate> d;
 };
 
+Q_DECLARE_METATYPE(QXmppConfiguration)
+
 #endif // QXMPPCONFIGURATION_H
@@ -25,24 +25,112 @@
 
 #include <QDomElement>
 #include <QCoreApplication>
+#include <QHash>
+#include <QSet>
 
+#include "QXmppCapabilitiesCache.h"
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
 #include "QXmppDataForm.h"
 #include "QXmppDiscoveryIq.h"
+#include "QXmppPresence.h"
 #include "QXmppStream.h"
 #include "QXmppGlobal.h"
 
+// XEP-0115: the capabilities announced by a remote entity
+struct QXmppPeerCapabilities
+{
+    QString node;
+    QByteArray ver;
+    QString hash;
+
+    QString queryNode() const
+    {
+        return node + QLatin1Char('#') + QString::fromLatin1(ver.toBase64());
+    }
+};
+
 class QXmppDiscoveryManagerPrivate
 {
 public:
+    QXmppDiscoveryManagerPrivate()
+        : capabilitiesCache(0)
+    {
+    }
+
     QString clientCapabilitiesNode;
     QString clientCategory;
     QString clientType;
     QString clientName;
     QXmppDataForm clientInfoForm;
+
+    QXmppDiscoveryIq buildCapabilities(const QList<QXmppClientExtension*> &extensions) const;
+
+    // XEP-0115: cached capabilities and the extensions they cover
+    QXmppDiscoveryIq capabilitiesIq;
+    QByteArray capabilitiesVer;
+    QList<QXmppClientExtension*> capabilitiesExtensions;
+
+    // XEP-0115: capabilities of remote entities
+    QXmppCapabilitiesCache *capabilitiesCache;
+    QHash<QString, QXmppPeerCapabilities> peerCapabilities;
+    QHash<QString, QXmppPeerCapabilities> capabilitiesRequests;
+    QSet<QString> pendingCapabilities;
 };
 
+QXmppDiscoveryIq QXmppDiscoveryManagerPrivate::buildCapabilities(const QList<QXmppClientExtension*> &extensions) const
+{
+    QXmppDiscoveryIq iq;
+    iq.setType(QXmppIq::Result);
+    iq.setQueryType(QXmppDiscoveryIq::InfoQuery);
+
+    // features
+    QStringList features;
+    features
+        << ns_data              // XEP-0004: Data Forms
+        << ns_rsm               // XEP-0059: Result Set Management
+        << ns_xhtml_im          // XEP-0071: XHTML-IM
+        << ns_chat_states       // XEP-0085: Chat State Notifications
+        << ns_capabilities      // XEP-0115: Entity Capabilities
+        << ns_ping              // XEP-0199: XMPP Ping
+        << ns_attention         // XEP-0224: Attention
+        << ns_chat_markers;     // XEP-0333: Chat Markers
+
+    foreach(QXmppClientExtension* extension, extensions)
+    {
+        if(extension)
+            features << extension->discoveryFeatures();
+    }
+
+    // several extensions may implement the same protocol
+    features.removeDuplicates();
+
+    iq.setFeatures(features);
+
+    // identities
+    QList<QXmppDiscoveryIq::Identity> identities;
+
+    QXmppDiscoveryIq::Identity identity;
+    identity.setCategory(clientCategory);
+    identity.setType(clientType);
+    identity.setName(clientName);
+    identities << identity;
+
+    foreach(QXmppClientExtension* extension, extensions)
+    {
+        if(extension)
+            identities << extension->discoveryIdentities();
+    }
+
+    iq.setIdentities(identities);
+
+    // extended information
+    if (!clientInfoForm.isNull())
+        iq.setForm(clientInfoForm);
+
+    return iq;
+}
+
 QXmppDiscoveryManager::QXmppDiscoveryManager()
     : d(new QXmppDiscoveryManagerPrivate)
 {
@@ -99,55 +187,29 @@ QString QXmppDiscoveryManager::requestItems(const QString& jid, const QString& n
 }
 
 /// Returns the client's full capabilities.
+///
+/// The capabilities are computed again only if the client's identity or
+/// extensions changed since the last call, or after invalidateCapabilities().
 
 QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
 {
-    QXmppDiscoveryIq iq;
-    iq.setType(QXmppIq::Result);
-    iq.setQueryType(QXmppDiscoveryIq::InfoQuery);
-
-    // features
-    QStringList features;
-    features
-        << ns_data              // XEP-0004: Data Forms
-        << ns_rsm               // XEP-0059: Result Set Management
-        << ns_xhtml_im          // XEP-0071: XHTML-IM
-        << ns_chat_states       // XEP-0085: Chat State Notifications
-        << ns_capabilities      // XEP-0115: Entity Capabilities
-        << ns_ping              // XEP-0199: XMPP Ping
-        << ns_attention         // XEP-0224: Attention
-        << ns_chat_markers;     // XEP-0333: Chat Markers
-
-    foreach(QXmppClientExtension* extension, client()->extensions())
-    {
-        if(extension)
-            features << extension->discoveryFeatures();
-    }
-
-    iq.setFeatures(features);
-
-    // identities
-    QList<QXmppDiscoveryIq::Identity> identities;
-
-    QXmppDiscoveryIq::Identity identity;
-    identity.setCategory(clientCategory());
-    identity.setType(clientType());
-    identity.setName(clientName());
-    identities << identity;
-
-    foreach(QXmppClientExtension* extension, client()->extensions())
-    {
-        if(extension)
-            identities << extension->discoveryIdentities();
+    const QList<QXmppClientExtension*> extensions = client()->extensions();
+    if (d->capabilitiesVer.isEmpty() || d->capabilitiesExtensions != extensions) {
+        d->capabilitiesIq = d->buildCapabilities(extensions);
+        d->capabilitiesVer = d->capabilitiesIq.verificationString();
+        d->capabilitiesExtensions = extensions;
     }
+    return d->capabilitiesIq;
+}
 
-    iq.setIdentities(identities);
-
-    // extended information
-    if (!d->clientInfoForm.isNull())
-        iq.setForm(d->clientInfoForm);
+/// Discards the cached capabilities of the local client.
+///
+/// You only need to call this if the features or identities reported by
+/// an extension changed after it was added to the client.
 
-    return iq;
+void QXmppDiscoveryManager::invalidateCapabilities()
+{
+    d->capabilitiesVer.clear();
 }
 
 /// Sets the capabilities node of the local XMPP client.
@@ -169,6 +231,7 @@ void QXmppDiscoveryManager::setClientCapabilitiesNode(const QString &node)
 void QXmppDiscoveryManager::setClientCategory(const QString& category)
 {
     d->clientCategory = category;
+    d->capabilitiesVer.clear();
 }
 
 /// Sets the type of the local XMPP client.
@@ -181,6 +244,7 @@ void QXmppDiscoveryManager::setClientCategory(const QString& category)
 void QXmppDiscoveryManager::setClientType(const QString& type)
 {
     d->clientType = type;
+    d->capabilitiesVer.clear();
 }
 
 /// Sets the name of the local XMPP client.
@@ -190,6 +254,7 @@ void QXmppDiscoveryManager::setClientType(const QString& type)
 void QXmppDiscoveryManager::setClientName(const QString& name)
 {
     d->clientName = name;
+    d->capabilitiesVer.clear();
 }
 
 /// Returns the capabilities node of the local XMPP client.
@@ -242,14 +307,67 @@ QXmppDataForm QXmppDiscoveryManager::clientInfoForm() const
 void QXmppDiscoveryManager::setClientInfoForm(const QXmppDataForm &form)
 {
     d->clientInfoForm = form;
+    d->capabilitiesVer.clear();
+}
+
+/// Returns the cache used to store the capabilities of remote entities.
+
+QXmppCapabilitiesCache *QXmppDiscoveryManager::capabilitiesCache() const
+{
+    return d->capabilitiesCache;
+}
+
+/// Sets the cache used to store the capabilities of remote entities, as
+/// announced in their presence by XEP-0115: Entity Capabilities.
+///
+/// When a cache is set, the manager requests the information for each
+/// set of capabilities it has not seen before, once, and stores the
+/// result. You can then read a contact's features using cachedInfo()
+/// without querying it. The cache can be shared by several clients and
+/// is not owned by the manager.
+///
+/// \param cache
+
+void QXmppDiscoveryManager::setCapabilitiesCache(QXmppCapabilitiesCache *cache)
+{
+    d->capabilitiesCache = cache;
+}
+
+/// Returns the cached service discovery information for the given JID,
+/// based on the capabilities announced in its last presence.
+///
+/// If no information is cached, an empty QXmppDiscoveryIq is returned.
+///
+/// \param jid
+
+QXmppDiscoveryIq QXmppDiscoveryManager::cachedInfo(const QString &jid) const
+{
+    QHash<QString, QXmppPeerCapabilities>::const_iterator it = d->peerCapabilities.constFind(jid);
+    if (!d->capabilitiesCache || it == d->peerCapabilities.constEnd())
+        return QXmppDiscoveryIq();
+    return d->capabilitiesCache->info(it->node, it->ver, it->hash);
 }
 
 /// \cond
+QByteArray QXmppDiscoveryManager::capabilitiesVerificationString()
+{
+    capabilities();
+    return d->capabilitiesVer;
+}
+
 QStringList QXmppDiscoveryManager::discoveryFeatures() const
 {
     return QStringList() << ns_disco_info;
 }
 
+QList<QXmppClientExtension::StanzaFilter> QXmppDiscoveryManager::stanzaFilters() const
+{
+    QList<StanzaFilter> filters;
+    filters << StanzaFilter("iq", ns_disco_info, "query");
+    filters << StanzaFilter("iq", ns_disco_items, "query");
+    return filters;
+}
+
 bool QXmppDiscoveryManager::handleStanza(const QDomElement &element)
 {
     if (element.tagName() == "iq" && QXmppDiscoveryIq::isDiscoveryIq(element))
@@ -277,6 +395,16 @@ bool QXmppDiscoveryManager::handleStanza(const QDomElement &element)
 
         case QXmppIq::Result:
         case QXmppIq::Error:
+            // store the information for capabilities we asked about
+            if (d->capabilitiesRequests.contains(receivedIq.id())) {
+                const QXmppPeerCapabilities caps = d->capabilitiesRequests.take(receivedIq.id());
+                d->pendingCapabilities.remove(caps.hash + QLatin1Char(' ') + caps.queryNode());
+                if (receivedIq.type() == QXmppIq::Result && d->capabilitiesCache &&
+                    !d->capabilitiesCache->insert(caps.node, caps.ver, caps.hash, receivedIq)) {
+                    warning(QString("Capabilities of %1 do not match their verification string").arg(receivedIq.from()));
+                }
+            }
+
             // handle all replies
             if (receivedIq.queryType() == QXmppDiscoveryIq::InfoQuery) {
                 emit infoReceived(receivedIq);
@@ -292,4 +420,73 @@ bool QXmppDiscoveryManager::handleStanza(const QDomElement &element)
     }
     return false;
 }
+
+void QXmppDiscoveryManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(sessionEnded()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(iqReceived(QXmppIq)),
+                    this, SLOT(_q_iqReceived(QXmppIq)));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(presenceReceived(QXmppPresence)),
+                    this, SLOT(_q_presenceReceived(QXmppPresence)));
+    Q_ASSERT(check);
+}
 /// \endcond
+
+void QXmppDiscoveryManager::_q_disconnected()
+{
+    d->peerCapabilities.clear();
+    d->capabilitiesRequests.clear();
+    d->pendingCapabilities.clear();
+}
+
+void QXmppDiscoveryManager::_q_iqReceived(const QXmppIq &iq)
+{
+    // errors which carry no query are not handled by handleStanza()
+    if (iq.type() == QXmppIq::Error && d->capabilitiesRequests.contains(iq.id())) {
+        const QXmppPeerCapabilities caps = d->capabilitiesRequests.take(iq.id());
+        d->pendingCapabilities.remove(caps.hash + QLatin1Char(' ') + caps.queryNode());
+    }
+}
+
+void QXmppDiscoveryManager::_q_presenceReceived(const QXmppPresence &presence)
+{
+    const QString jid = presence.from();
+    if (jid.isEmpty())
+        return;
+
+    if (presence.type() != QXmppPresence::Available ||
+        presence.capabilityNode().isEmpty() ||
+        presence.capabilityVer().isEmpty()) {
+        d->peerCapabilities.remove(jid);
+        return;
+    }
+
+    QXmppPeerCapabilities caps;
+    caps.node = presence.capabilityNode();
+    caps.ver = presence.capabilityVer();
+    caps.hash = presence.capabilityHash();
+    d->peerCapabilities.insert(jid, caps);
+
+    // request unknown capabilities once, whoever announces them
+    const QString key = caps.hash + QLatin1Char(' ') + caps.queryNode();
+    if (!d->capabilitiesCache ||
+        d->pendingCapabilities.contains(key) ||
+        d->capabilitiesCache->contains(caps.node, caps.ver, caps.hash))
+        return;
+
+    const QString id = requestInfo(jid, caps.queryNode());
+    if (!id.isEmpty()) {
+        d->pendingCapabilities.insert(key);
+        d->capabilitiesRequests.insert(id, caps);
+    }
+}
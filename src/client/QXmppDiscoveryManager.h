@@ -26,8 +26,11 @@
 
 #include "QXmppClientExtension.h"
 
+class QXmppCapabilitiesCache;
 class QXmppDataForm;
 class QXmppDiscoveryIq;
+class QXmppIq;
+class QXmppPresence;
 class QXmppDiscoveryManagerPrivate;
 
 /// \brief The QXmppDiscoveryManager class makes it possible to discover information
@@ -44,6 +47,7 @@ public:
     ~QXmppDiscoveryManager();
 
     QXmppDiscoveryIq capabilities();
+    void invalidateCapabilities();
 
     QString requestInfo(const QString& jid, const QString& node = QString());
     QString requestItems(const QString& jid, const QString& node = QString());
@@ -64,9 +68,15 @@ public:
     QXmppDataForm clientInfoForm() const;
     void setClientInfoForm(const QXmppDataForm &form);
 
+    QXmppCapabilitiesCache *capabilitiesCache() const;
+    void setCapabilitiesCache(QXmppCapabilitiesCache *cache);
+    QXmppDiscoveryIq cachedInfo(const QString &jid) const;
+
     /// \cond
+    QByteArray capabilitiesVerificationString();
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
+    QList<StanzaFilter> stanzaFilters() const;
     /// \endcond
 
 signals:
@@ -76,6 +86,16 @@ signals:
     /// This signal is emitted when an items response is received.
     void itemsReceived(const QXmppDiscoveryIq&);
 
+protected:
+    /// \cond
+    void setClient(QXmppClient *client);
+    /// \endcond
+
+private slots:
+    void _q_disconnected();
+    void _q_iqReceived(const QXmppIq &iq);
+    void _q_presenceReceived(const QXmppPresence &presence);
+
 private:
     QXmppDiscoveryManagerPrivate *d;
 };
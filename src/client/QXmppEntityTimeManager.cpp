@@ -30,8 +30,59 @@
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
 #include "QXmppEntityTimeIq.h"
+#include "QXmppQueryLimiter_p.h"
+#include "QXmppRawStanza.h"
 #include "QXmppUtils.h"
 
+class QXmppEntityTimeManagerPrivate
+{
+public:
+    QXmppEntityTimeManagerPrivate();
+    QXmppRawStanza response();
+
+    QXmppQueryLimiter limiter;
+    QXmppRawStanza cachedResponse;
+    uint cachedTime;
+};
+
+QXmppEntityTimeManagerPrivate::QXmppEntityTimeManagerPrivate()
+    : cachedTime(0)
+{
+}
+
+/// Returns the serialized response to time queries, which is rebuilt when
+/// the current second changes.
+
+QXmppRawStanza QXmppEntityTimeManagerPrivate::response()
+{
+    QDateTime currentTime = QDateTime::currentDateTime();
+    QDateTime utc = currentTime.toUTC();
+    const uint time = utc.toTime_t();
+    if (cachedResponse.isNull() || time != cachedTime) {
+        // the response is valid for the whole second
+        QXmppEntityTimeIq responseIq;
+        responseIq.setType(QXmppIq::Result);
+        responseIq.setUtc(utc.addMSecs(-utc.time().msec()));
+
+        currentTime.setTimeSpec(Qt::UTC);
+        responseIq.setTzo(utc.secsTo(currentTime));
+
+        cachedResponse = QXmppRawStanza(responseIq);
+        cachedTime = time;
+    }
+    return cachedResponse;
+}
+
+QXmppEntityTimeManager::QXmppEntityTimeManager()
+    : d(new QXmppEntityTimeManagerPrivate)
+{
+}
+
+QXmppEntityTimeManager::~QXmppEntityTimeManager()
+{
+    delete d;
+}
+
 /// Request the time from an XMPP entity.
 ///
 /// \param jid
@@ -47,12 +98,39 @@ QString QXmppEntityTimeManager::requestTime(const QString& jid)
         return QString();
 }
 
+/// Returns the maximum number of time queries answered for each requester
+/// per minute, 0 meaning there is no limit.
+
+int QXmppEntityTimeManager::queryLimit() const
+{
+    return d->limiter.limit();
+}
+
+/// Sets the maximum number of time queries answered for each requester
+/// per minute. The queries beyond this limit are ignored.
+///
+/// The default value of 0 means there is no limit.
+///
+/// \param queries
+
+void QXmppEntityTimeManager::setQueryLimit(int queries)
+{
+    d->limiter.setLimit(queries);
+}
+
 /// \cond
 QStringList QXmppEntityTimeManager::discoveryFeatures() const
 {
     return QStringList() << ns_entity_time;
 }
 
+QList<QXmppClientExtension::StanzaFilter> QXmppEntityTimeManager::stanzaFilters() const
+{
+    QList<StanzaFilter> filters;
+    filters << StanzaFilter("iq", ns_entity_time, "time");
+    return filters;
+}
+
 bool QXmppEntityTimeManager::handleStanza(const QDomElement &element)
 {
     if(element.tagName() == "iq" && QXmppEntityTimeIq::isEntityTimeIq(element))
@@ -60,22 +138,18 @@ bool QXmppEntityTimeManager::handleStanza(const QDomElement &element)
         QXmppEntityTimeIq entityTime;
         entityTime.parse(element);
 
-        if(entityTime.type() == QXmppIq::Get)
+        if(entityTime.type() == QXmppIq::Get && d->limiter.accept(entityTime.from()))
         {
-            // respond to query
-            QXmppEntityTimeIq responseIq;
-            responseIq.setType(QXmppIq::Result);
+            // respond to query, only the recipient differs between responses
+            QXmppIq responseIq(QXmppIq::Result);
             responseIq.setId(entityTime.id());
             responseIq.setTo(entityTime.from());
 
-            QDateTime currentTime = QDateTime::currentDateTime();
-            QDateTime utc = currentTime.toUTC();
-            responseIq.setUtc(utc);
-
-            currentTime.setTimeSpec(Qt::UTC);
-            responseIq.setTzo(utc.secsTo(currentTime));
-
-            client()->sendPacket(responseIq);
+            QXmppRawStanza response = d->response();
+            response.setAttribute("id", entityTime.id());
+            if (!entityTime.from().isEmpty())
+                response.setAttribute("to", entityTime.from());
+            client()->sendPacket(responseIq, response.data());
         }
 
         emit timeReceived(entityTime);
@@ -28,10 +28,16 @@
 #include "QXmppClientExtension.h"
 
 class QXmppEntityTimeIq;
+class QXmppEntityTimeManagerPrivate;
 
 /// \brief The QXmppEntityTimeManager class provided the functionality to get
 /// the local time of an entity as defined by XEP-0202: Entity Time.
 ///
+/// The response to time queries is serialized at most once per second, and
+/// only its "id" and "to" attributes are rewritten for each query. The
+/// number of queries answered for each requester can be limited with
+/// setQueryLimit().
+///
 /// \ingroup Managers
 
 class QXMPP_EXPORT QXmppEntityTimeManager : public QXmppClientExtension
@@ -39,16 +45,26 @@ class QXMPP_EXPORT QXmppEntityTimeManager : public QXmppClientExtension
     Q_OBJECT
 
 public:
+    QXmppEntityTimeManager();
+    ~QXmppEntityTimeManager();
+
     QString requestTime(const QString& jid);
 
+    int queryLimit() const;
+    void setQueryLimit(int queries);
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
+    QList<StanzaFilter> stanzaFilters() const;
     /// \endcond
 
 signals:
     /// \brief This signal is emitted when a time response is received.
     void timeReceived(const QXmppEntityTimeIq&);
+
+private:
+    QXmppEntityTimeManagerPrivate * const d;
 };
 
 #endif // QXMPPENTITYTIMEMANAGER_H
@@ -21,14 +21,101 @@
  *
  */
 
+
 #include "QXmppInvokable.h"
 
 #include <QVariant>
 #include <QMetaMethod>
+#include <QReadWriteLock>
+#include <QSet>
 #include <QStringList>
 
 #include <qdebug.h>
 
+/// \cond
+class QXmppInvokableMethod
+{
+public:
+    int index;
+    int returnType;
+    QList<int> parameterTypes;
+};
+
+class QXmppInvokableClass
+{
+public:
+    QXmppInvokableClass(const QMetaObject *metaObject);
+
+    QHash<QByteArray, QXmppInvokableMethod> methods;
+    QStringList slotNames;
+    QSet<QString> slotSet;
+};
+/// \endcond
+
+QXmppInvokableClass::QXmppInvokableClass(const QMetaObject *metaObject)
+{
+    const int methodCount = metaObject->methodCount();
+    for (int idx = 0; idx < methodCount; ++idx) {
+        const QMetaMethod metaMethod = metaObject->method(idx);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
+        const QByteArray signature = metaMethod.methodSignature();
+#else
+        const QByteArray signature = metaMethod.signature();
+#endif
+        const QByteArray name = signature.left(signature.indexOf('('));
+
+        QXmppInvokableMethod method;
+        method.index = idx;
+        const QByteArray typeName = metaMethod.typeName();
+        method.returnType = typeName.isEmpty() ? int(QMetaType::Void) : QMetaType::type(typeName.constData());
+        foreach (const QByteArray &parameterType, metaMethod.parameterTypes())
+            method.parameterTypes << QMetaType::type(parameterType.constData());
+        methods.insert(name, method);
+
+        if (metaMethod.methodType() == QMetaMethod::Slot) {
+            slotNames << QString::fromLatin1(name);
+            slotSet << QString::fromLatin1(name);
+        }
+    }
+}
+
+// The method tables are shared by all instances of a class.
+class QXmppInvokableCache
+{
+public:
+    ~QXmppInvokableCache();
+    const QXmppInvokableClass *get(const QMetaObject *metaObject);
+
+private:
+    QReadWriteLock m_lock;
+    QHash<const QMetaObject*, QXmppInvokableClass*> m_classes;
+};
+
+QXmppInvokableCache::~QXmppInvokableCache()
+{
+    qDeleteAll(m_classes);
+}
+
+const QXmppInvokableClass *QXmppInvokableCache::get(const QMetaObject *metaObject)
+{
+    {
+        QReadLocker locker(&m_lock);
+        const QXmppInvokableClass *cls = m_classes.value(metaObject);
+        if (cls)
+            return cls;
+    }
+
+    QWriteLocker locker(&m_lock);
+    QXmppInvokableClass *cls = m_classes.value(metaObject);
+    if (!cls) {
+        cls = new QXmppInvokableClass(metaObject);
+        m_classes.insert(metaObject, cls);
+    }
+    return cls;
+}
+
+Q_GLOBAL_STATIC(QXmppInvokableCache, invokableCache)
+
 /// Constructs a QXmppInvokable with the specified \a parent.
 ///
 /// \param parent
@@ -46,56 +133,38 @@ QXmppInvokable::~QXmppInvokable()
 
 QVariant QXmppInvokable::dispatch( const QByteArray & method, const QList< QVariant > & args )
 {
-    buildMethodHash();
-
-    if( !m_methodHash.contains(method))
+    const QXmppInvokableClass *cls = invokableClass();
+    QHash<QByteArray, QXmppInvokableMethod>::const_iterator it = cls->methods.constFind(method);
+    if (it == cls->methods.constEnd())
         return QVariant();
 
-    int idx = m_methodHash[method];
-    if( paramTypes( args) != metaObject()->method(idx).parameterTypes ())
+    // check the arguments
+    const QXmppInvokableMethod &info = it.value();
+    if (args.size() != info.parameterTypes.size() || args.size() > 10)
         return QVariant();
 
-    const char *typeName = metaObject()->method(idx).typeName();
-    int resultType = QMetaType::type(typeName);
+    void *argv[11];
+    for (int i = 0; i < args.size(); ++i) {
+        if (args[i].userType() != info.parameterTypes[i])
+            return QVariant();
+        argv[i + 1] = const_cast<void*>(args[i].constData());
+    }
 
 #if QT_VERSION >= 0x050000
-    void *result = QMetaType::create(resultType, 0);
+    void *result = QMetaType::create(info.returnType, 0);
 #else
-    void *result = QMetaType::construct(resultType, 0);
+    void *result = QMetaType::construct(info.returnType, 0);
 #endif
+    argv[0] = result;
 
-    QGenericReturnArgument ret( typeName, result );
-    QList<QGenericArgument> genericArgs;
-    QList<QVariant>::ConstIterator iter = args.begin();
-    while( iter != args.end())
-    {
-        const void *data = iter->data();
-        const char *name = iter->typeName();
-        genericArgs << QGenericArgument(name,data);
-        ++iter;
-    }
+    qt_metacall(QMetaObject::InvokeMetaMethod, info.index, argv);
 
-    if( QMetaObject::invokeMethod ( this, method.constData(), ret,
-                                    genericArgs.value(0, QGenericArgument() ),
-                                    genericArgs.value(1, QGenericArgument() ),
-                                    genericArgs.value(2, QGenericArgument() ),
-                                    genericArgs.value(3, QGenericArgument() ),
-                                    genericArgs.value(4, QGenericArgument() ),
-                                    genericArgs.value(5, QGenericArgument() ),
-                                    genericArgs.value(6, QGenericArgument() ),
-                                    genericArgs.value(7, QGenericArgument() ),
-                                    genericArgs.value(8, QGenericArgument() ),
-                                    genericArgs.value(9, QGenericArgument() )) )
-    {
-        QVariant returnValue( resultType, result);
-        QMetaType::destroy(resultType, result);
-        return returnValue;
-    }
-    else
-    {
-        qDebug("No such method '%s'", method.constData() );
+    if (!result)
         return QVariant();
-    }
+
+    QVariant returnValue(info.returnType, result);
+    QMetaType::destroy(info.returnType, result);
+    return returnValue;
 }
 
 QList< QByteArray > QXmppInvokable::paramTypes( const QList< QVariant > & params )
@@ -106,41 +175,17 @@ QList< QByteArray > QXmppInvokable::paramTypes( const QList< QVariant > & params
     return types;
 }
 
-void QXmppInvokable::buildMethodHash( )
+bool QXmppInvokable::hasInterface(const QString &method) const
 {
-    QWriteLocker locker(&m_lock);
-    if( m_methodHash.size() > 0 )
-        return;
+    return invokableClass()->slotSet.contains(method);
+}
 
-    int methodCount = metaObject()->methodCount ();
-    for( int idx = 0; idx < methodCount; ++idx)
-    {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
-        QByteArray signature = metaObject()->method(idx).methodSignature();
-#else
-        QByteArray signature = metaObject()->method(idx).signature();
-#endif
-        m_methodHash[signature.left(signature.indexOf('('))] = idx;
-//         qDebug() << metaObject()->method(idx).parameterTypes();
-    }
+const QXmppInvokableClass *QXmppInvokable::invokableClass() const
+{
+    return invokableCache()->get(metaObject());
 }
 
 QStringList QXmppInvokable::interfaces( ) const
 {
-    QStringList results;
-    int methodCount = metaObject()->methodCount ();
-    for( int idx = 0; idx < methodCount; ++idx)
-    {
-        if( metaObject()->method(idx).methodType() == QMetaMethod::Slot )
-        {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
-            QByteArray signature = metaObject()->method(idx).methodSignature();
-#else
-            QByteArray signature = metaObject()->method(idx).signature();
-#endif
-            results << signature.left(signature.indexOf('('));
-        }
-    }
-    return results;
+    return invokableClass()->slotNames;
 }
-
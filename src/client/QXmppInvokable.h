@@ -32,6 +32,8 @@
 
 #include "QXmppGlobal.h"
 
+class QXmppInvokableClass;
+
 /**
 This is the base class for all objects that will be invokable via RPC.  All public slots of objects derived from this class will be exposed to the RPC interface.  As a note for all methods, they can only understand types that QVariant knows about.
 
@@ -70,9 +72,10 @@ public slots:
         QStringList interfaces() const;
 
 private:
-        void buildMethodHash();
-        QHash<QByteArray,int> m_methodHash;
-        QReadWriteLock m_lock;
+        bool hasInterface(const QString &method) const;
+        const QXmppInvokableClass *invokableClass() const;
+
+        friend class QXmppRpcManager;
 };
 
 
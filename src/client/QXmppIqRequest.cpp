@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppClient.h"
+#include "QXmppIqRequest.h"
+#include "QXmppTask.h"
+
+class QXmppIqRequestPrivate
+{
+public:
+    QXmppIqRequestPrivate();
+
+    QXmppClient *client;
+    QString id;
+    QString to;
+    QXmppIqRequest::State state;
+    QDomElement response;
+    QXmppTask *task;
+};
+
+QXmppIqRequestPrivate::QXmppIqRequestPrivate()
+    : client(0)
+    , state(QXmppIqRequest::PendingState)
+    , task(0)
+{
+}
+
+QXmppIqRequest::QXmppIqRequest(QXmppClient *client, const QString &id, const QString &to)
+    : QObject(client)
+    , d(new QXmppIqRequestPrivate)
+{
+    d->client = client;
+    d->id = id;
+    d->to = to;
+}
+
+/// Destroys the request, cancelling it if it is still pending.
+
+QXmppIqRequest::~QXmppIqRequest()
+{
+    if (d->state == PendingState && d->client)
+        d->client->removeIqRequest(d->id);
+    delete d;
+}
+
+/// Returns the ID of the request, which the response carries.
+
+QString QXmppIqRequest::id() const
+{
+    return d->id;
+}
+
+/// Returns the state of the request.
+
+QXmppIqRequest::State QXmppIqRequest::state() const
+{
+    return d->state;
+}
+
+/// Returns true if the request is no longer pending.
+
+bool QXmppIqRequest::isFinished() const
+{
+    return d->state != PendingState;
+}
+
+/// Returns the result or error IQ which was received in response to the
+/// request, or a null element if there is none.
+
+QDomElement QXmppIqRequest::response() const
+{
+    return d->response;
+}
+
+/// Returns the error which was received in response to the request.
+
+QXmppStanza::Error QXmppIqRequest::error() const
+{
+    QXmppStanza::Error error;
+    QDomElement errorElement = d->response.firstChildElement("error");
+    if (!errorElement.isNull())
+        error.parse(errorElement);
+    return error;
+}
+
+/// Sets the \a task to resume once the request is finished, after the
+/// finished() signal is emitted.
+///
+/// If the request is already finished, the task is resumed right away.
+///
+/// \param task
+
+void QXmppIqRequest::setTask(QXmppTask *task)
+{
+    if (task && d->state != PendingState) {
+        d->task = 0;
+        task->resume();
+        return;
+    }
+    d->task = task;
+}
+
+/// Cancels the request, a response received afterwards is ignored.
+
+void QXmppIqRequest::cancel()
+{
+    if (d->state != PendingState)
+        return;
+    if (d->client)
+        d->client->removeIqRequest(d->id);
+    finish(CancelledState);
+}
+
+void QXmppIqRequest::finish(State state, const QDomElement &response)
+{
+    if (d->state != PendingState)
+        return;
+    d->state = state;
+    d->response = response;
+
+    // the request may be deleted by a receiver of finished()
+    QXmppTask *task = d->task;
+    d->task = 0;
+    emit finished();
+    if (task)
+        task->resume();
+}
+
+QString QXmppIqRequest::to() const
+{
+    return d->to;
+}
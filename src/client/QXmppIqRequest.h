@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPIQREQUEST_H
+#define QXMPPIQREQUEST_H
+
+#include <QDomElement>
+#include <QObject>
+
+#include "QXmppStanza.h"
+
+class QXmppClient;
+class QXmppIqRequestPrivate;
+class QXmppTask;
+
+/// \brief The QXmppIqRequest class tracks an IQ request sent with
+/// QXmppClient::sendIq(), until its response is received.
+///
+/// The finished() signal is emitted once, when the result or error
+/// response is received, when the request times out, or when it is
+/// cancelled. The response can then be parsed into the matching QXmppIq
+/// subclass:
+///
+/// \code
+/// QXmppIqRequest *request = client->sendIq(iq);
+/// connect(request, SIGNAL(finished()), this, SLOT(versionReceived()));
+/// ...
+/// void MyClass::versionReceived()
+/// {
+///     QXmppIqRequest *request = qobject_cast<QXmppIqRequest*>(sender());
+///     if (request->state() == QXmppIqRequest::ResultState) {
+///         QXmppVersionIq version;
+///         version.parse(request->response());
+///     }
+///     request->deleteLater();
+/// }
+/// \endcode
+///
+/// A QXmppTask can also await the request with setTask().
+///
+/// Requests are children of the client, delete them once they are
+/// finished.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppIqRequest : public QObject
+{
+    Q_OBJECT
+    Q_ENUMS(State)
+
+public:
+    /// This enum describes the state of a request.
+    enum State {
+        PendingState,   ///< No response was received yet.
+        ResultState,    ///< A result was received.
+        ErrorState,     ///< An error was received.
+        TimeoutState,   ///< No response was received in time.
+        CancelledState  ///< The request was cancelled, or the session ended.
+    };
+
+    ~QXmppIqRequest();
+
+    QString id() const;
+    State state() const;
+    bool isFinished() const;
+
+    QDomElement response() const;
+    QXmppStanza::Error error() const;
+
+    void setTask(QXmppTask *task);
+
+signals:
+    /// This signal is emitted when the request is finished.
+    void finished();
+
+public slots:
+    void cancel();
+
+private:
+    QXmppIqRequest(QXmppClient *client, const QString &id, const QString &to);
+    void finish(State state, const QDomElement &response = QDomElement());
+    QString to() const;
+
+    friend class QXmppClient;
+    friend class QXmppClientPrivate;
+    QXmppIqRequestPrivate * const d;
+};
+
+#endif
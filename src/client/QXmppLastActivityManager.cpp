@@ -4,13 +4,27 @@
 #include "QXmppConstants.h"
 #include "QXmppLastActivityIq.h"
 #include "QXmppLastActivityManager.h"
+#include "QXmppQueryLimiter_p.h"
+#include "QXmppRawStanza.h"
+
+class QXmppLastActivityManagerPrivate
+{
+public:
+    QXmppQueryLimiter limiter;
+    QXmppRawStanza response;
+};
 
 QXmppLastActivityManager::QXmppLastActivityManager()
+    : d(new QXmppLastActivityManagerPrivate)
 {
+    QXmppLastActivityIq responseIq;
+    responseIq.setType(QXmppIq::Result);
+    d->response = QXmppRawStanza(responseIq);
 }
 
 QXmppLastActivityManager::~QXmppLastActivityManager()
 {
+    delete d;
 }
 
 QString QXmppLastActivityManager::requestLastActivity(const QString& to)
@@ -31,12 +45,39 @@ QStringList QXmppLastActivityManager::requestLastActivityList(const QStringList&
     return ids;
 }
 
+/// Returns the maximum number of last activity queries answered for each
+/// requester per minute, 0 meaning there is no limit.
+
+int QXmppLastActivityManager::queryLimit() const
+{
+    return d->limiter.limit();
+}
+
+/// Sets the maximum number of last activity queries answered for each
+/// requester per minute. The queries beyond this limit are ignored.
+///
+/// The default value of 0 means there is no limit.
+///
+/// \param queries
+
+void QXmppLastActivityManager::setQueryLimit(int queries)
+{
+    d->limiter.setLimit(queries);
+}
+
 QStringList QXmppLastActivityManager::discoveryFeatures() const
 {
     // XEP-0012: Last Activity
     return QStringList() << ns_last_activity;
 }
 
+QList<QXmppClientExtension::StanzaFilter> QXmppLastActivityManager::stanzaFilters() const
+{
+    QList<StanzaFilter> filters;
+    filters << StanzaFilter("iq", ns_last_activity, "query");
+    return filters;
+}
+
 bool QXmppLastActivityManager::handleStanza(const QDomElement& element)
 {
     if (element.tagName() == "iq" && QXmppLastActivityIq::isLastActivityIq(element))
@@ -45,8 +86,19 @@ bool QXmppLastActivityManager::handleStanza(const QDomElement& element)
         lastActivityIq.parse(element);
 
         if (lastActivityIq.type() == QXmppIq::Get) {
-            // respond to query
-            client()->sendPacket(lastActivityIq);
+            if (!d->limiter.accept(lastActivityIq.from()))
+                return true;
+
+            // respond to query, only the recipient differs between responses
+            QXmppIq responseIq(QXmppIq::Result);
+            responseIq.setId(lastActivityIq.id());
+            responseIq.setTo(lastActivityIq.from());
+
+            QXmppRawStanza response = d->response;
+            response.setAttribute("id", lastActivityIq.id());
+            if (!lastActivityIq.from().isEmpty())
+                response.setAttribute("to", lastActivityIq.from());
+            client()->sendPacket(responseIq, response.data());
         } else if (lastActivityIq.type() == QXmppIq::Result) {
             // emit response
             emit lastActivityReceived(lastActivityIq);
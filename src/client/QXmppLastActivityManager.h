@@ -8,9 +8,15 @@
 /// It is an  implementation of XEP-0012: Last Activity.
 /// http://xmpp.org/extensions/xep-0012.html
 ///
+/// Queries are answered with an idle time of zero, using a response which
+/// is serialized once and whose "id" and "to" attributes are rewritten for
+/// each query. The number of queries answered for each requester can be
+/// limited with setQueryLimit().
+///
 /// \ingroup Managers
 
 class QXmppLastActivityIq;
+class QXmppLastActivityManagerPrivate;
 
 class QXMPP_EXPORT QXmppLastActivityManager : public QXmppClientExtension
 {
@@ -23,14 +29,21 @@ public:
     QString requestLastActivity(const QString& to = "");
     QStringList requestLastActivityList(const QStringList& list);
 
+    int queryLimit() const;
+    void setQueryLimit(int queries);
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement& element);
+    QList<StanzaFilter> stanzaFilters() const;
     /// \endcond
 
 signals:
     /// \brief This signal is emitted when a last activity response is received.
     void lastActivityReceived(const QXmppLastActivityIq&);
+
+private:
+    QXmppLastActivityManagerPrivate * const d;
 };
 
 
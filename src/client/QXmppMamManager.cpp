@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDomElement>
+
+#include "QXmppClient.h"
+#include "QXmppConstants.h"
+#include "QXmppMamManager.h"
+#include "QXmppMessage.h"
+#include "QXmppSimpleArchiveIq.h"
+#include "QXmppUtils.h"
+
+QXmppMamStore::~QXmppMamStore()
+{
+}
+
+class QXmppMamManagerPrivate
+{
+public:
+    // a query, which may span several pages
+    struct Query
+    {
+        QString jid;
+        QDateTime start;
+        QDateTime end;
+        int pages;
+    };
+
+    // a page of a query, the ID of its IQ is also its query ID
+    struct Page
+    {
+        QString queryId;
+        int messages;
+        bool nextRequested;
+    };
+
+    QXmppMamManagerPrivate(QXmppMamManager *qq);
+    void finishQuery(const QString &queryId, bool success);
+    bool requestPage(const QString &queryId, const QString &after);
+    QString startQuery(const QString &jid, const QDateTime &start, const QDateTime &end, const QString &after);
+
+    int pageSize;
+    QXmppMamStore *store;
+    QHash<QString, Query> queries;
+    QHash<QString, Page> pages;
+
+private:
+    QXmppMamManager *q;
+};
+
+QXmppMamManagerPrivate::QXmppMamManagerPrivate(QXmppMamManager *qq)
+    : pageSize(50)
+    , store(0)
+    , q(qq)
+{
+}
+
+void QXmppMamManagerPrivate::finishQuery(const QString &queryId, bool success)
+{
+    const Query query = queries.take(queryId);
+
+    // ignore the pages of the query which are still in flight
+    QHash<QString, Page>::iterator it = pages.begin();
+    while (it != pages.end()) {
+        if (it.value().queryId == queryId)
+            it = pages.erase(it);
+        else
+            ++it;
+    }
+
+    emit q->queryFinished(queryId, query.jid, success);
+}
+
+/// Asks for the page of the query which follows the message with the
+/// given archive ID.
+
+bool QXmppMamManagerPrivate::requestPage(const QString &queryId, const QString &after)
+{
+    Query &query = queries[queryId];
+
+    QXmppResultSetQuery rsm;
+    rsm.setMax(pageSize);
+    rsm.setAfter(after);
+
+    QXmppSimpleArchiveQueryIq packet;
+    packet.setWith(query.jid);
+    packet.setStart(query.start);
+    packet.setEnd(query.end);
+    packet.setResultSetQuery(rsm);
+
+    // the first page uses the ID of the query
+    const QString pageId = query.pages ? QString("%1-%2").arg(queryId, QString::number(query.pages)) : queryId;
+    packet.setId(pageId);
+    packet.setQueryId(pageId);
+    query.pages++;
+
+    Page page;
+    page.queryId = queryId;
+    page.messages = 0;
+    page.nextRequested = false;
+    pages.insert(pageId, page);
+
+    return q->client()->sendPacket(packet);
+}
+
+QString QXmppMamManagerPrivate::startQuery(const QString &jid, const QDateTime &start, const QDateTime &end, const QString &after)
+{
+    if (!q->client())
+        return QString();
+
+    Query query;
+    query.jid = jid;
+    query.start = start;
+    query.end = end;
+    query.pages = 0;
+
+    const QString queryId = QXmppUtils::generateStanzaHash();
+    queries.insert(queryId, query);
+    if (!requestPage(queryId, after)) {
+        queries.remove(queryId);
+        pages.remove(queryId);
+        return QString();
+    }
+    return queryId;
+}
+
+/// Constructs a message archive manager.
+
+QXmppMamManager::QXmppMamManager()
+    : d(new QXmppMamManagerPrivate(this))
+{
+}
+
+QXmppMamManager::~QXmppMamManager()
+{
+    delete d;
+}
+
+/// Returns the maximum number of messages which are requested at once.
+
+int QXmppMamManager::pageSize() const
+{
+    return d->pageSize;
+}
+
+/// Sets the maximum number of messages which are requested at once.
+///
+/// Larger pages need fewer round trips, smaller pages let the server
+/// interleave the archive with live traffic.
+///
+/// \param size
+
+void QXmppMamManager::setPageSize(int size)
+{
+    d->pageSize = qMax(1, size);
+}
+
+/// Returns the store in which retrieved messages are kept, if any.
+
+QXmppMamStore *QXmppMamManager::store() const
+{
+    return d->store;
+}
+
+/// Sets the store in which retrieved messages are kept.
+///
+/// The manager does not take ownership of the store.
+///
+/// \param store
+
+void QXmppMamManager::setStore(QXmppMamStore *store)
+{
+    d->store = store;
+}
+
+/// Retrieves the archived messages of a conversation.
+///
+/// The messages are delivered by messageReceived() as they arrive, then
+/// queryFinished() is emitted.
+///
+/// \param jid The JID of the conversation, or an empty string for the
+/// whole archive.
+/// \param start The start time of messages to retrieve.
+/// \param end The end time of messages to retrieve.
+///
+/// \return the ID of the query, or an empty string if it could not be sent
+
+QString QXmppMamManager::retrieveMessages(const QString &jid, const QDateTime &start, const QDateTime &end)
+{
+    return d->startQuery(jid, start, end, QString());
+}
+
+/// Retrieves the messages of a conversation which were archived since the
+/// last message kept in the store(), or all of them if there is no store
+/// or the store has no messages for the conversation.
+///
+/// As the store is updated as messages arrive, calling this method again
+/// after reconnecting only retrieves the messages which were missed.
+///
+/// \param jid The JID of the conversation, or an empty string for the
+/// whole archive.
+///
+/// \return the ID of the query, or an empty string if it could not be sent
+
+QString QXmppMamManager::catchUp(const QString &jid)
+{
+    const QString after = d->store ? d->store->lastStanzaId(jid) : QString();
+    return d->startQuery(jid, QDateTime(), QDateTime(), after);
+}
+
+/// \cond
+QStringList QXmppMamManager::discoveryFeatures() const
+{
+    // XEP-0313: Message Archive Management
+    return QStringList() << ns_simple_archive;
+}
+
+QList<QXmppClientExtension::StanzaFilter> QXmppMamManager::stanzaFilters() const
+{
+    // the result of a query may be an empty IQ
+    QList<StanzaFilter> filters;
+    filters << StanzaFilter("message", ns_simple_archive, "result");
+    filters << StanzaFilter("iq");
+    return filters;
+}
+
+bool QXmppMamManager::handleStanza(const QDomElement &element)
+{
+    if (element.tagName() == QLatin1String("message")) {
+        const QDomElement resultElement = element.firstChildElement("result");
+        QHash<QString, QXmppMamManagerPrivate::Page>::iterator it = d->pages.find(resultElement.attribute("queryid"));
+        if (resultElement.namespaceURI() != ns_simple_archive || it == d->pages.end())
+            return false;
+
+        QXmppMessage message;
+        message.parse(element);
+
+        const QString queryId = it.value().queryId;
+        const QString jid = d->queries.value(queryId).jid;
+        const QString stanzaId = resultElement.attribute("id");
+
+        // ask for the next page as soon as this one is full
+        if (++it.value().messages >= d->pageSize && !it.value().nextRequested && !stanzaId.isEmpty()) {
+            it.value().nextRequested = true;
+            d->requestPage(queryId, stanzaId);
+        }
+
+        if (d->store)
+            d->store->storeMessage(jid, stanzaId, message.mamMessage());
+        emit messageReceived(queryId, jid, stanzaId, message.mamMessage());
+        return true;
+    }
+
+    const QString type = element.attribute("type");
+    if (type != QLatin1String("result") && type != QLatin1String("error"))
+        return false;
+
+    QHash<QString, QXmppMamManagerPrivate::Page>::iterator it = d->pages.find(element.attribute("id"));
+    if (it == d->pages.end())
+        return false;
+
+    const QXmppMamManagerPrivate::Page page = it.value();
+    d->pages.erase(it);
+    if (type == QLatin1String("error"))
+        d->finishQuery(page.queryId, false);
+    else if (!page.nextRequested)
+        d->finishQuery(page.queryId, true);
+    return true;
+}
+
+void QXmppMamManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(sessionEnded()),
+                    this, SLOT(_q_sessionEnded()));
+    Q_ASSERT(check);
+}
+/// \endcond
+
+void QXmppMamManager::_q_sessionEnded()
+{
+    // the replies to the queries will never arrive
+    foreach (const QString &queryId, d->queries.keys())
+        d->finishQuery(queryId, false);
+}
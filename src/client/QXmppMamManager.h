@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPMAMMANAGER_H
+#define QXMPPMAMMANAGER_H
+
+#include <QDateTime>
+
+#include "QXmppClientExtension.h"
+
+class QXmppMamManagerPrivate;
+class QXmppMessage;
+
+/// \brief The QXmppMamStore class is the base class for local storage of
+/// archived messages, as used by QXmppMamManager.
+///
+/// The store remembers the archive ID of the last message retrieved for each
+/// conversation, so that QXmppMamManager::catchUp() only needs to ask the
+/// server for the messages archived since then.
+///
+/// \ingroup Managers
+
+class QXMPP_EXPORT QXmppMamStore
+{
+public:
+    virtual ~QXmppMamStore();
+
+    /// Returns the archive ID of the last message stored for the given
+    /// conversation, or an empty string if there is none.
+    ///
+    /// \param jid the JID of the conversation, or an empty string for the
+    /// whole archive
+    virtual QString lastStanzaId(const QString &jid) = 0;
+
+    /// Stores a message retrieved from the archive.
+    ///
+    /// Messages are stored in the order in which they were archived.
+    ///
+    /// \param jid the JID of the conversation, or an empty string for the
+    /// whole archive
+    /// \param stanzaId the archive ID of the message
+    /// \param message the archived message
+    virtual void storeMessage(const QString &jid, const QString &stanzaId, const QXmppMessage &message) = 0;
+};
+
+/// \brief The QXmppMamManager class retrieves message archives as defined
+/// by XEP-0313: Message Archive Management.
+///
+/// Unlike QXmppSimpleArchiveManager, archived messages are delivered one by
+/// one by messageReceived() as they arrive, rather than gathered for each
+/// page. The manager pages forward through the archive on its own: as soon
+/// as the last message of a full page arrives, it asks for the next page, so
+/// the server is already sending it while the current one is processed.
+///
+/// Several queries, for instance one per conversation, can run in parallel.
+///
+/// \code
+/// QXmppMamManager *manager = new QXmppMamManager;
+/// client->addExtension(manager);
+/// \endcode
+///
+/// \ingroup Managers
+
+class QXMPP_EXPORT QXmppMamManager : public QXmppClientExtension
+{
+    Q_OBJECT
+
+public:
+    QXmppMamManager();
+    ~QXmppMamManager();
+
+    int pageSize() const;
+    void setPageSize(int size);
+
+    QXmppMamStore *store() const;
+    void setStore(QXmppMamStore *store);
+
+    QString retrieveMessages(const QString &jid = QString(),
+                             const QDateTime &start = QDateTime(),
+                             const QDateTime &end = QDateTime());
+    QString catchUp(const QString &jid = QString());
+
+    /// \cond
+    QStringList discoveryFeatures() const;
+    bool handleStanza(const QDomElement &element);
+    QList<StanzaFilter> stanzaFilters() const;
+    /// \endcond
+
+signals:
+    /// This signal is emitted for each message retrieved from the archive.
+    ///
+    /// \param queryId the ID of the query, as returned by retrieveMessages()
+    /// or catchUp()
+    /// \param jid the JID of the conversation
+    /// \param stanzaId the archive ID of the message
+    /// \param message the archived message
+    void messageReceived(const QString &queryId, const QString &jid, const QString &stanzaId, const QXmppMessage &message);
+
+    /// This signal is emitted when a query is finished, either because all
+    /// the matching messages have been retrieved or because of an error.
+    void queryFinished(const QString &queryId, const QString &jid, bool success);
+
+protected:
+    /// \cond
+    void setClient(QXmppClient *client);
+    /// \endcond
+
+private slots:
+    void _q_sessionEnded();
+
+private:
+    QXmppMamManagerPrivate * const d;
+    friend class QXmppMamManagerPrivate;
+};
+
+#endif
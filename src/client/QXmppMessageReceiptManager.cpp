@@ -25,17 +25,105 @@
 #include "QXmppMessageReceiptManager.h"
 
 #include <QDomElement>
+#include <QTimer>
 
 #include "QXmppConstants.h"
 #include "QXmppMessage.h"
 #include "QXmppClient.h"
+#include "QXmppUtils.h"
+
+class QXmppMessageReceiptManagerPrivate
+{
+public:
+    QXmppMessageReceiptManagerPrivate();
+
+    QXmppMessage::Marker marker;
+    QTimer *markerTimer;
+
+    // the last markable message of each conversation, in the order the
+    // conversations were first seen
+    QHash<QString, QXmppMessage> pendingMarkers;
+    QStringList pendingOrder;
+};
+
+QXmppMessageReceiptManagerPrivate::QXmppMessageReceiptManagerPrivate()
+    : marker(QXmppMessage::Received)
+    , markerTimer(0)
+{
+}
 
 /// Constructs a QXmppMessageReceiptManager to handle incoming and outgoing
 /// message delivery receipts.
 
 QXmppMessageReceiptManager::QXmppMessageReceiptManager()
     : QXmppClientExtension()
+    , d(new QXmppMessageReceiptManagerPrivate)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->markerTimer = new QTimer(this);
+    d->markerTimer->setInterval(0);
+    d->markerTimer->setSingleShot(true);
+    check = connect(d->markerTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_sendMarkers()));
+    Q_ASSERT(check);
+}
+
+QXmppMessageReceiptManager::~QXmppMessageReceiptManager()
+{
+    delete d;
+}
+
+/// Returns the interval in milliseconds during which the acknowledgements
+/// of markable messages are coalesced, or 0 if each message is answered
+/// with its own receipt.
+
+int QXmppMessageReceiptManager::coalescingInterval() const
+{
+    return d->markerTimer->interval();
+}
+
+/// Sets the interval in milliseconds during which the acknowledgements of
+/// markable messages are coalesced.
+///
+/// When the first markable message of a batch is received, the manager
+/// waits for this interval, then sends one coalescedMarker() for the last
+/// message of each conversation instead of a receipt for each message.
+/// Messages which are not markable are still answered with receipts, as
+/// their senders may not understand markers.
+///
+/// Set to 0 to answer each message with its own receipt, which is the
+/// default.
+///
+/// \param msecs
+
+void QXmppMessageReceiptManager::setCoalescingInterval(int msecs)
+{
+    d->markerTimer->setInterval(qMax(0, msecs));
+    if (!msecs)
+        _q_sendMarkers();
+}
+
+/// Returns the marker which acknowledges coalesced messages.
+
+QXmppMessage::Marker QXmppMessageReceiptManager::coalescedMarker() const
 {
+    return d->marker;
+}
+
+/// Sets the marker which acknowledges coalesced messages.
+///
+/// The default is QXmppMessage::Received, which means the messages were
+/// delivered. Use QXmppMessage::Displayed if the application only gets
+/// to run when the conversation is on screen.
+///
+/// \param marker
+
+void QXmppMessageReceiptManager::setCoalescedMarker(QXmppMessage::Marker marker)
+{
+    if (marker != QXmppMessage::NoMarker)
+        d->marker = marker;
 }
 
 /// \cond
@@ -44,24 +132,56 @@ QStringList QXmppMessageReceiptManager::discoveryFeatures() const
     return QStringList(ns_message_receipts);
 }
 
+QList<QXmppClientExtension::StanzaFilter> QXmppMessageReceiptManager::stanzaFilters() const
+{
+    return QList<StanzaFilter>() << StanzaFilter("message");
+}
+
 bool QXmppMessageReceiptManager::handleStanza(const QDomElement &stanza)
 {
-    if (stanza.tagName() != "message")
-        return false;
+    // messages are received through handleMessage()
+    Q_UNUSED(stanza);
+    return false;
+}
 
-    QXmppMessage message;
-    message.parse(stanza);
+bool QXmppMessageReceiptManager::handleMessage(const QDomElement &stanza, const QXmppMessage &message)
+{
+    Q_UNUSED(stanza);
 
-    // Handle receipts and cancel any further processing.
+    // Handle receipts and cancel any further processing, the receipts
+    // our other resources sent are not for us.
     if (!message.receiptId().isEmpty()) {
-        emit messageDelivered(message.from(), message.receiptId());
+        if (message.carbonDirection() != QXmppMessage::SentCarbon)
+            emit messageDelivered(message.from(), message.receiptId());
         return true;
     }
 
+    // XEP-0333: Chat Markers
+    if (message.marker() != QXmppMessage::NoMarker) {
+        if (message.carbonDirection() != QXmppMessage::SentCarbon)
+            emit markerReceived(message.from(), message.markedId(), message.marker());
+        return false;
+    }
+
+    // Messages which another resource received are not acknowledged.
+    if (message.carbonDirection() != QXmppMessage::NoCarbon
+        || message.from().isEmpty()
+        || message.id().isEmpty())
+        return false;
+
+    // Acknowledge markable messages of the same conversation at once.
+    if (d->markerTimer->interval() > 0 && message.isMarkable()) {
+        const QString bareJid = QXmppUtils::jidToBareJid(message.from());
+        if (!d->pendingMarkers.contains(bareJid))
+            d->pendingOrder << bareJid;
+        d->pendingMarkers.insert(bareJid, message);
+        if (!d->markerTimer->isActive())
+            d->markerTimer->start();
+        return false;
+    }
+
     // If requested, send a receipt.
-    if (message.isReceiptRequested()
-        && !message.from().isEmpty()
-        && !message.id().isEmpty()) {
+    if (message.isReceiptRequested()) {
         QXmppMessage receipt;
         receipt.setTo(message.from());
         receipt.setReceiptId(message.id());
@@ -71,4 +191,42 @@ bool QXmppMessageReceiptManager::handleStanza(const QDomElement &stanza)
     // Continue processing.
     return false;
 }
+
+void QXmppMessageReceiptManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(sessionEnded()),
+                    this, SLOT(_q_sessionEnded()));
+    Q_ASSERT(check);
+}
 /// \endcond
+
+void QXmppMessageReceiptManager::_q_sendMarkers()
+{
+    d->markerTimer->stop();
+
+    const QStringList order = d->pendingOrder;
+    const QHash<QString, QXmppMessage> pending = d->pendingMarkers;
+    d->pendingOrder.clear();
+    d->pendingMarkers.clear();
+
+    foreach (const QString &bareJid, order) {
+        const QXmppMessage message = pending.value(bareJid);
+        QXmppMessage marker;
+        marker.setTo(message.from());
+        marker.setMarker(d->marker, message.id(), message.thread());
+        client()->sendPacket(marker);
+    }
+}
+
+void QXmppMessageReceiptManager::_q_sessionEnded()
+{
+    // the senders will send the messages again
+    d->markerTimer->stop();
+    d->pendingOrder.clear();
+    d->pendingMarkers.clear();
+}
@@ -26,11 +26,20 @@
 #define QXMPPMESSAGERECEIPTMANAGER_H
 
 #include "QXmppClientExtension.h"
+#include "QXmppMessage.h"
+
+class QXmppMessageReceiptManagerPrivate;
 
 /// \brief The QXmppMessageReceiptManager class makes it possible to
 /// send and receive message delivery receipts as defined in
 /// XEP-0184: Message Delivery Receipts.
 ///
+/// By default, each message which requests a receipt is answered right
+/// away. If you set a coalescing interval, markable messages are instead
+/// acknowledged by a single XEP-0333: Chat Markers marker per conversation,
+/// which covers all the messages received during the interval. This saves
+/// one stanza per message when catching up with offline messages.
+///
 /// \ingroup Managers
 
 class QXMPP_EXPORT QXmppMessageReceiptManager : public QXmppClientExtension
@@ -38,10 +47,19 @@ class QXMPP_EXPORT QXmppMessageReceiptManager : public QXmppClientExtension
     Q_OBJECT
 public:
     QXmppMessageReceiptManager();
+    ~QXmppMessageReceiptManager();
+
+    int coalescingInterval() const;
+    void setCoalescingInterval(int msecs);
+
+    QXmppMessage::Marker coalescedMarker() const;
+    void setCoalescedMarker(QXmppMessage::Marker marker);
 
     /// \cond
     virtual QStringList discoveryFeatures() const;
     virtual bool handleStanza(const QDomElement &stanza);
+    virtual bool handleMessage(const QDomElement &stanza, const QXmppMessage &message);
+    virtual QList<StanzaFilter> stanzaFilters() const;
     /// \endcond
 
 signals:
@@ -49,6 +67,23 @@ signals:
     /// given id is received. The id could be previously obtained by
     /// calling QXmppMessage::id().
     void messageDelivered(const QString &jid, const QString &id);
+
+    /// This signal is emitted when a XEP-0333: Chat Markers marker is
+    /// received, which applies to the message with the given id and to
+    /// all the messages sent to \a jid before it.
+    void markerReceived(const QString &jid, const QString &id, QXmppMessage::Marker marker);
+
+protected:
+    /// \cond
+    void setClient(QXmppClient *client);
+    /// \endcond
+
+private slots:
+    void _q_sendMarkers();
+    void _q_sessionEnded();
+
+private:
+    QXmppMessageReceiptManagerPrivate * const d;
 };
 
 #endif // QXMPPMESSAGERECEIPTMANAGER_H
@@ -23,31 +23,55 @@
 
 #include <QDomElement>
 #include <QMap>
+#include <QPointer>
+#include <QTimer>
 
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
+#include "QXmppDiscoveryIq.h"
 #include "QXmppDiscoveryManager.h"
+#include "QXmppIqRequest.h"
 #include "QXmppMessage.h"
 #include "QXmppMucIq.h"
 #include "QXmppMucManager.h"
 #include "QXmppUtils.h"
 
+// maximum number of room information requests in flight for the rooms
+// joined by QXmppMucManager::joinRooms()
+static const int maxRoomInfoRequests = 8;
+
 class QXmppMucManagerPrivate
 {
 public:
+    QXmppMucManagerPrivate(QXmppMucManager *qq);
+    void requestRoomInfo();
+
+    QXmppClient *client;
     QMap<QString, QXmppMucRoom*> rooms;
+    QXmppDiscoveryManager *discoManager;
+
+    // room information requests for rooms joined in bulk
+    QStringList roomInfoQueue;
+    QHash<QXmppIqRequest*, QString> roomInfoRequests;
+
+private:
+    QXmppMucManager *q;
 };
 
 class QXmppMucRoomPrivate
 {
 public:
     QString ownJid() const { return jid + "/" + nickName; }
+    void queueAdded(const QString &jid);
+    void queueChanged(const QString &jid);
+    void queueRemoved(const QString &jid);
+
     QXmppClient *client;
     QXmppDiscoveryManager *discoManager;
     QXmppMucRoom::Actions allowedActions;
     QString jid;
     QString name;
-    QMap<QString, QXmppPresence> participants;
+    QHash<QString, QXmppPresence> participants;
     QString password;
     QMap<QString, QXmppMucItem> permissions;
     QSet<QString> permissionsQueue;
@@ -56,13 +80,86 @@ public:
 
     QString historyType;
     QString historyValue;
+
+    // the room was joined by QXmppMucManager::joinRooms(), which catches
+    // up from lastMessageTime and defers the room information request
+    bool joinedInBulk;
+    QDateTime lastMessageTime;
+
+    // coalesced participant updates
+    bool coalesceUpdates;
+    QSet<QString> pendingAdded;
+    QSet<QString> pendingChanged;
+    QSet<QString> pendingRemoved;
+    QTimer *updateTimer;
 };
 
+void QXmppMucRoomPrivate::queueAdded(const QString &jid)
+{
+    // a participant which left and came back within the same batch
+    // is reported as changed
+    if (pendingRemoved.remove(jid))
+        pendingChanged.insert(jid);
+    else
+        pendingAdded.insert(jid);
+}
+
+void QXmppMucRoomPrivate::queueChanged(const QString &jid)
+{
+    if (!pendingAdded.contains(jid))
+        pendingChanged.insert(jid);
+}
+
+void QXmppMucRoomPrivate::queueRemoved(const QString &jid)
+{
+    // a participant which came and left within the same batch
+    // is not reported at all
+    if (!pendingAdded.remove(jid)) {
+        pendingChanged.remove(jid);
+        pendingRemoved.insert(jid);
+    }
+}
+
+QXmppMucManagerPrivate::QXmppMucManagerPrivate(QXmppMucManager *qq)
+    : client(0)
+    , discoManager(0)
+    , q(qq)
+{
+}
+
+/// Sends the queued room information requests, keeping at most
+/// maxRoomInfoRequests of them in flight so they do not compete with
+/// the joins for the link.
+
+void QXmppMucManagerPrivate::requestRoomInfo()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (!client->isConnected()) {
+        roomInfoQueue.clear();
+        return;
+    }
+
+    while (!roomInfoQueue.isEmpty() && roomInfoRequests.size() < maxRoomInfoRequests) {
+        QXmppDiscoveryIq iq;
+        iq.setType(QXmppIq::Get);
+        iq.setQueryType(QXmppDiscoveryIq::InfoQuery);
+        iq.setTo(roomInfoQueue.takeFirst());
+
+        QXmppIqRequest *request = client->sendIq(iq);
+        roomInfoRequests.insert(request, iq.to());
+        check = QObject::connect(request, SIGNAL(finished()),
+                                 q, SLOT(_q_roomInfoFinished()));
+        Q_ASSERT(check);
+    }
+}
+
 /// Constructs a new QXmppMucManager.
 
 QXmppMucManager::QXmppMucManager()
 {
-    d = new QXmppMucManagerPrivate;
+    d = new QXmppMucManagerPrivate(this);
 }
 
 /// Destroys a QXmppMucManager.
@@ -80,6 +177,15 @@ QXmppMucRoom *QXmppMucManager::addRoom(const QString &roomJid)
 {
     QXmppMucRoom *room = d->rooms.value(roomJid);
     if (!room) {
+        // the discovery manager may have been added after this manager
+        if (!d->discoManager) {
+            d->discoManager = client()->findExtension<QXmppDiscoveryManager>();
+            if (d->discoManager) {
+                connect(d->discoManager, SIGNAL(infoReceived(QXmppDiscoveryIq)),
+                    this, SLOT(_q_discoveryInfoReceived(QXmppDiscoveryIq)));
+            }
+        }
+
         room = new QXmppMucRoom(client(), roomJid, this);
         d->rooms.insert(roomJid, room);
         connect(room, SIGNAL(destroyed(QObject*)),
@@ -98,6 +204,47 @@ QList<QXmppMucRoom*> QXmppMucManager::rooms() const
     return d->rooms.values();
 }
 
+/// Adds the given chat rooms to the set of managed rooms and joins them
+/// using the given nickname, unless another nickname was already set for
+/// a room.
+///
+/// This is meant for joining many rooms at once, typically at login:
+///
+///  - the joins are sent in a single write;
+///  - unless a history configuration was set with
+///    QXmppMucRoom::setHistoryConfig(), no history is requested for a room
+///    which has no QXmppMucRoom::lastMessageTime(), and only the messages
+///    sent since that time are requested otherwise;
+///  - the rooms have QXmppMucRoom::coalesceUpdates() enabled, so each
+///    room's occupant list is reported by a single
+///    QXmppMucRoom::participantsUpdated() signal;
+///  - the information about the rooms, which provides their names, is
+///    requested once they are joined, a few rooms at a time.
+///
+/// \param roomJids
+/// \param nickName
+///
+/// \return the rooms for which a join request was sent
+
+QList<QXmppMucRoom*> QXmppMucManager::joinRooms(const QStringList &roomJids, const QString &nickName)
+{
+    QList<QXmppMucRoom*> joining;
+
+    client()->cork();
+    foreach (const QString &roomJid, roomJids) {
+        QXmppMucRoom *room = addRoom(roomJid);
+        if (room->nickName().isEmpty())
+            room->setNickName(nickName);
+        room->setCoalesceUpdates(true);
+        room->d->joinedInBulk = true;
+        if (room->join())
+            joining << room;
+    }
+    client()->uncork();
+
+    return joining;
+}
+
 /// \cond
 QStringList QXmppMucManager::discoveryFeatures() const
 {
@@ -155,23 +302,66 @@ void QXmppMucManager::setClient(QXmppClient* client)
     Q_UNUSED(check);
 
     QXmppClientExtension::setClient(client);
+    d->client = client;
 
+    // stanzas are dispatched to their room, rather than offered to every
+    // room, which matters once hundreds of rooms are joined
     check = connect(client, SIGNAL(messageReceived(QXmppMessage)),
                     this, SLOT(_q_messageReceived(QXmppMessage)));
     Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(presenceReceived(QXmppPresence)),
+                    this, SLOT(_q_presenceReceived(QXmppPresence)));
+    Q_ASSERT(check);
 }
 /// \endcond
 
-void QXmppMucManager::_q_messageReceived(const QXmppMessage &msg)
+void QXmppMucManager::_q_discoveryInfoReceived(const QXmppDiscoveryIq &iq)
 {
-    if (msg.type() != QXmppMessage::Normal)
-        return;
+    QXmppMucRoom *room = d->rooms.value(iq.from());
+    if (room)
+        room->_q_discoveryInfoReceived(iq);
+}
 
+void QXmppMucManager::_q_messageReceived(const QXmppMessage &msg)
+{
     // process room invitations
     const QString roomJid = msg.mucInvitationJid();
-    if (!roomJid.isEmpty() && (!d->rooms.contains(roomJid) || !d->rooms.value(roomJid)->isJoined())) {
+    if (msg.type() == QXmppMessage::Normal && !roomJid.isEmpty() &&
+        (!d->rooms.contains(roomJid) || !d->rooms.value(roomJid)->isJoined())) {
         emit invitationReceived(roomJid, msg.from(), msg.mucInvitationReason());
     }
+
+    QXmppMucRoom *room = d->rooms.value(QXmppUtils::jidToBareJid(msg.from()));
+    if (room)
+        room->_q_messageReceived(msg);
+}
+
+void QXmppMucManager::_q_presenceReceived(const QXmppPresence &presence)
+{
+    const QString jid = presence.from();
+
+    // our own presence is reflected in every room we joined
+    if (jid == client()->configuration().jid()) {
+        client()->cork();
+        foreach (QXmppMucRoom *room, d->rooms)
+            room->_q_presenceReceived(presence);
+        client()->uncork();
+        return;
+    }
+
+    QPointer<QXmppMucRoom> room = d->rooms.value(QXmppUtils::jidToBareJid(jid));
+    if (!room)
+        return;
+
+    const bool wasJoined = room->isJoined();
+    room->_q_presenceReceived(presence);
+
+    // the room may have been deleted by a slot
+    if (room && !wasJoined && room->isJoined() && room->d->joinedInBulk) {
+        d->roomInfoQueue << room->jid();
+        d->requestRoomInfo();
+    }
 }
 
 void QXmppMucManager::_q_roomDestroyed(QObject *object)
@@ -180,6 +370,24 @@ void QXmppMucManager::_q_roomDestroyed(QObject *object)
     d->rooms.remove(key);
 }
 
+void QXmppMucManager::_q_roomInfoFinished()
+{
+    QXmppIqRequest *request = qobject_cast<QXmppIqRequest*>(sender());
+    if (!request || !d->roomInfoRequests.contains(request))
+        return;
+
+    const QString roomJid = d->roomInfoRequests.take(request);
+    QXmppMucRoom *room = d->rooms.value(roomJid);
+    if (room && request->state() == QXmppIqRequest::ResultState) {
+        QXmppDiscoveryIq iq;
+        iq.parse(request->response());
+        room->_q_discoveryInfoReceived(iq);
+    }
+    request->deleteLater();
+
+    d->requestRoomInfo();
+}
+
 /// Constructs a new QXmppMucRoom.
 ///
 /// \param parent
@@ -195,24 +403,23 @@ QXmppMucRoom::QXmppMucRoom(QXmppClient *client, const QString &jid, QObject *par
     d->client = client;
     d->discoManager = client->findExtension<QXmppDiscoveryManager>();
     d->jid = jid;
-
-    check = connect(d->client, SIGNAL(disconnected()),
-                    this, SLOT(_q_disconnected()));
+    d->joinedInBulk = false;
+    d->coalesceUpdates = false;
+
+    d->updateTimer = new QTimer(this);
+    d->updateTimer->setInterval(0);
+    d->updateTimer->setSingleShot(true);
+    check = connect(d->updateTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_flushUpdates()));
     Q_ASSERT(check);
 
-    check = connect(d->client, SIGNAL(messageReceived(QXmppMessage)),
-                    this, SLOT(_q_messageReceived(QXmppMessage)));
+    // the room's occupants survive a disconnection if the session is resumed
+    check = connect(d->client, SIGNAL(sessionEnded()),
+                    this, SLOT(_q_disconnected()));
     Q_ASSERT(check);
 
-    check = connect(d->client, SIGNAL(presenceReceived(QXmppPresence)),
-                    this, SLOT(_q_presenceReceived(QXmppPresence)));
-    Q_ASSERT(check);
-
-    if (d->discoManager) {
-        check = connect(d->discoManager, SIGNAL(infoReceived(QXmppDiscoveryIq)),
-                        this, SLOT(_q_discoveryInfoReceived(QXmppDiscoveryIq)));
-        Q_ASSERT(check);
-    }
+    // messages, presences and discovery information are dispatched to
+    // the room by QXmppMucManager
 
     // convenience signals for properties
     check = connect(this, SIGNAL(joined()), this, SIGNAL(isJoinedChanged()));
@@ -242,6 +449,39 @@ QXmppMucRoom::Actions QXmppMucRoom::allowedActions() const
 ///
 /// \return true if the request was sent, false otherwise
 
+/// Returns true if participant updates are coalesced.
+///
+/// \sa setCoalesceUpdates()
+
+bool QXmppMucRoom::coalesceUpdates() const
+{
+    return d->coalesceUpdates;
+}
+
+/// Sets whether participant updates should be coalesced.
+///
+/// By default every presence received from the room causes the
+/// participantAdded(), participantChanged() or participantRemoved()
+/// signal to be emitted. For busy rooms you can instead enable coalescing:
+/// the per-participant signals (including participantPermissions()) are
+/// then no longer emitted, and the changes are collected and reported by a
+/// single participantsUpdated() signal once control returns to the event
+/// loop. While joining the room, the changes are reported when the
+/// occupant list is complete, right before participantsReceived().
+///
+/// \param coalesce
+
+void QXmppMucRoom::setCoalesceUpdates(bool coalesce)
+{
+    if (coalesce == d->coalesceUpdates)
+        return;
+
+    // report any changes collected so far
+    if (!coalesce)
+        _q_flushUpdates();
+    d->coalesceUpdates = coalesce;
+}
+
 bool QXmppMucRoom::ban(const QString &jid, const QString &reason)
 {
     if (!QXmppUtils::jidToResource(jid).isEmpty()) {
@@ -292,7 +532,12 @@ bool QXmppMucRoom::join()
     packet.setMucPassword(d->password);
     packet.setMucSupported(true);
 
-    packet.setMucHistory(d->historyType, d->historyValue);
+    if (!d->historyType.isEmpty())
+        packet.setMucHistory(d->historyType, d->historyValue);
+    else if (d->joinedInBulk && d->lastMessageTime.isValid())
+        packet.setMucHistory("since", QXmppUtils::datetimeToString(d->lastMessageTime));
+    else if (d->joinedInBulk)
+        packet.setMucHistory("maxstanzas", "0");
 
     return d->client->sendPacket(packet);
 }
@@ -343,6 +588,33 @@ QString QXmppMucRoom::name() const
     return d->name;
 }
 
+/// Returns the time of the last message received from the room.
+///
+/// This is the time at which the message was sent for delayed messages,
+/// such as the room history, and the time at which it was received
+/// otherwise.
+///
+/// \sa QXmppMucManager::joinRooms()
+
+QDateTime QXmppMucRoom::lastMessageTime() const
+{
+    return d->lastMessageTime;
+}
+
+/// Sets the time of the last message received from the room.
+///
+/// Set it to the time of the last message you stored locally before
+/// joining the room with QXmppMucManager::joinRooms(), so only the messages
+/// sent since then are requested. Messages sent during that second may be
+/// received again.
+///
+/// \param time
+
+void QXmppMucRoom::setLastMessageTime(const QDateTime &time)
+{
+    d->lastMessageTime = time.toUTC();
+}
+
 /// Returns your own nickname.
 
 QString QXmppMucRoom::nickName() const
@@ -421,8 +693,9 @@ void QXmppMucRoom::setNickName(const QString &nickName)
 
 QString QXmppMucRoom::participantFullJid(const QString &jid) const
 {
-    if (d->participants.contains(jid))
-        return d->participants.value(jid).mucItem().jid();
+    QHash<QString, QXmppPresence>::const_iterator it = d->participants.constFind(jid);
+    if (it != d->participants.constEnd())
+        return it.value().mucItem().jid();
     else
         return QString();
 }
@@ -433,8 +706,9 @@ QString QXmppMucRoom::participantFullJid(const QString &jid) const
 
 QXmppPresence QXmppMucRoom::participantPresence(const QString &jid) const
 {
-    if (d->participants.contains(jid))
-        return d->participants.value(jid);
+    QHash<QString, QXmppPresence>::const_iterator it = d->participants.constFind(jid);
+    if (it != d->participants.constEnd())
+        return it.value();
 
     QXmppPresence presence;
     presence.setFrom(jid);
@@ -442,9 +716,22 @@ QXmppPresence QXmppMucRoom::participantPresence(const QString &jid) const
     return presence;
 }
 
+/// Returns the presences of all participants, keyed by Occupant JID.
+///
+/// The returned hash is implicitly shared with the room's occupant table,
+/// so no copy is made unless either of them is modified.
+
+QHash<QString, QXmppPresence> QXmppMucRoom::participantPresences() const
+{
+    return d->participants;
+}
+
 /// Returns the list of participant JIDs.
 ///
 /// These JIDs are Occupant JIDs of the form "room@service/nick".
+///
+/// \note This builds a new list on every call, use participantPresences()
+/// to iterate over the participants of a large room.
 
 QStringList QXmppMucRoom::participants() const
 {
@@ -590,16 +877,28 @@ bool QXmppMucRoom::setPermissions(const QList<QXmppMucItem> &permissions)
     return d->client->sendPacket(iq);
 }
 
+void QXmppMucRoom::clearParticipants()
+{
+    if (d->coalesceUpdates) {
+        foreach (const QString &jid, d->participants.keys())
+            d->queueRemoved(jid);
+        d->participants.clear();
+        _q_flushUpdates();
+    } else {
+        const QStringList removed = d->participants.keys();
+        d->participants.clear();
+        foreach (const QString &jid, removed)
+            emit participantRemoved(jid);
+        emit participantsChanged();
+    }
+}
+
 void QXmppMucRoom::_q_disconnected()
 {
     const bool wasJoined = isJoined();
 
     // clear chat room participants
-    const QStringList removed = d->participants.keys();
-    d->participants.clear();
-    foreach (const QString &jid, removed)
-        emit participantRemoved(jid);
-    emit participantsChanged();
+    clearParticipants();
 
     // update available actions
     if (d->allowedActions != NoAction) {
@@ -630,11 +929,31 @@ void QXmppMucRoom::_q_discoveryInfoReceived(const QXmppDiscoveryIq &iq)
     }
 }
 
+void QXmppMucRoom::_q_flushUpdates()
+{
+    d->updateTimer->stop();
+    if (d->pendingAdded.isEmpty() && d->pendingChanged.isEmpty() && d->pendingRemoved.isEmpty())
+        return;
+
+    const QStringList added = d->pendingAdded.toList();
+    const QStringList changed = d->pendingChanged.toList();
+    const QStringList removed = d->pendingRemoved.toList();
+    d->pendingAdded.clear();
+    d->pendingChanged.clear();
+    d->pendingRemoved.clear();
+
+    emit participantsUpdated(added, changed, removed);
+    emit participantsChanged();
+}
+
 void QXmppMucRoom::_q_messageReceived(const QXmppMessage &message)
 {
     if (QXmppUtils::jidToBareJid(message.from())!= d->jid)
         return;
 
+    d->lastMessageTime = message.stamp().isValid() ? message.stamp().toUTC()
+                                                   : QDateTime::currentDateTime().toUTC();
+
     // handle message subject
     const QString subject = message.subject();
     if (!subject.isEmpty()) {
@@ -660,11 +979,23 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
         return;
 
     if (presence.type() == QXmppPresence::Available) {
-        const bool added = !d->participants.contains(jid);
-        d->participants.insert(jid, presence);
+        // the room may have assigned us a different nickname
+        if (!isJoined() && presence.mucStatusCodes().contains(110) && jid != d->ownJid()) {
+            d->nickName = QXmppUtils::jidToResource(jid);
+            emit nickNameChanged(d->nickName);
+        }
+
+        QHash<QString, QXmppPresence>::iterator it = d->participants.find(jid);
+        const bool added = (it == d->participants.end());
+        if (added)
+            d->participants.insert(jid, presence);
+        else
+            it.value() = presence;
+
+        const bool self = (jid == d->ownJid());
 
         // refresh allowed actions
-        if (jid == d->ownJid()) {
+        if (self) {
 
             QXmppMucItem mucItem = presence.mucItem();
             Actions newActions = NoAction;
@@ -689,38 +1020,65 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
             }
         }
 
-        if (added) {
+        if (d->coalesceUpdates) {
+            if (added)
+                d->queueAdded(jid);
+            else
+                d->queueChanged(jid);
+        } else if (added) {
             emit participantAdded(jid);
             emit participantPermissions(jid, presence.mucItem());
-            emit participantsChanged();
-            if (jid == d->ownJid()) {
-                // request room information
-                if (d->discoManager)
-                    d->discoManager->requestInfo(d->jid);
-
-                emit joined();
-            }
         } else {
             emit participantPermissions(jid, presence.mucItem());
             emit participantChanged(jid);
         }
+
+        if (added && self) {
+            // our own presence comes last, the occupant list is complete
+            if (d->coalesceUpdates)
+                _q_flushUpdates();
+            else
+                emit participantsChanged();
+            emit participantsReceived();
+
+            // request room information, which QXmppMucManager defers for
+            // rooms joined in bulk
+            if (d->discoManager && !d->joinedInBulk)
+                d->discoManager->requestInfo(d->jid);
+
+            emit joined();
+        } else if (isJoined()) {
+            // while joining, changes are reported once the list is complete
+            if (d->coalesceUpdates)
+                d->updateTimer->start();
+            else if (added)
+                emit participantsChanged();
+        }
     }
     else if (presence.type() == QXmppPresence::Unavailable) {
-        if (d->participants.contains(jid)) {
-            QXmppMucItem old(d->participants[jid].mucItem());
-
-            d->participants.insert(jid, presence);
+        QHash<QString, QXmppPresence>::iterator it = d->participants.find(jid);
+        if (it != d->participants.end()) {
+            QXmppMucItem old(it.value().mucItem());
+
+            if (d->coalesceUpdates) {
+                d->participants.erase(it);
+                d->queueRemoved(jid);
+                if (isJoined())
+                    d->updateTimer->start();
+            } else {
+                it.value() = presence;
+
+                emit participantRemoved(jid);
+                QXmppMucItem newMucItem(presence.mucItem());
+                if (newMucItem.jid().isEmpty()) {
+                    newMucItem.setJid(old.jid());
+                }
 
-            emit participantRemoved(jid);
-            QXmppMucItem newMucItem(presence.mucItem());
-            if (newMucItem.jid().isEmpty()) {
-                newMucItem.setJid(old.jid());
+                emit participantPermissions(jid, newMucItem);
+                d->participants.remove(jid);
+                emit participantsChanged();
             }
 
-            emit participantPermissions(jid, newMucItem);
-            d->participants.remove(jid);
-            emit participantsChanged();
-
             // check whether this was our own presence
             if (jid == d->ownJid()) {
                 const QString newNick = presence.mucItem().nick();
@@ -738,11 +1096,7 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
                 }
 
                 // clear chat room participants
-                const QStringList removed = d->participants.keys();
-                d->participants.clear();
-                foreach (const QString &jid, removed)
-                    emit participantRemoved(jid);
-                emit participantsChanged();
+                clearParticipants();
 
                 // update available actions
                 if (d->allowedActions != NoAction) {
@@ -24,6 +24,9 @@
 #ifndef QXMPPMUCMANAGER_H
 #define QXMPPMUCMANAGER_H
 
+#include <QDateTime>
+#include <QHash>
+
 #include "QXmppClientExtension.h"
 #include "QXmppMucIq.h"
 #include "QXmppPresence.h"
@@ -54,6 +57,14 @@ class QXmppMucRoomPrivate;
 /// room->join();
 /// \endcode
 ///
+/// If you join many rooms at login, use joinRooms() instead, which sends
+/// all the joins in a single write and keeps the room history you already
+/// have from being sent again:
+///
+/// \code
+/// manager->joinRooms(roomJids, "mynick");
+/// \endcode
+///
 /// \ingroup Managers
 
 class QXMPP_EXPORT QXmppMucManager : public QXmppClientExtension
@@ -68,6 +79,8 @@ public:
     QXmppMucRoom *addRoom(const QString &roomJid);
     QList<QXmppMucRoom*> rooms() const;
 
+    QList<QXmppMucRoom*> joinRooms(const QStringList &roomJids, const QString &nickName);
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
@@ -86,8 +99,11 @@ protected:
     /// \endcond
 
 private slots:
+    void _q_discoveryInfoReceived(const QXmppDiscoveryIq &iq);
     void _q_messageReceived(const QXmppMessage &message);
+    void _q_presenceReceived(const QXmppPresence &presence);
     void _q_roomDestroyed(QObject *object);
+    void _q_roomInfoFinished();
 
 private:
     QXmppMucManagerPrivate *d;
@@ -103,6 +119,7 @@ class QXMPP_EXPORT QXmppMucRoom : public QObject
     Q_OBJECT
     Q_FLAGS(Action Actions)
     Q_PROPERTY(QXmppMucRoom::Actions allowedActions READ allowedActions NOTIFY allowedActionsChanged)
+    Q_PROPERTY(bool coalesceUpdates READ coalesceUpdates WRITE setCoalesceUpdates)
     Q_PROPERTY(bool isJoined READ isJoined NOTIFY isJoinedChanged)
     Q_PROPERTY(QString jid READ jid CONSTANT)
     Q_PROPERTY(QString name READ name NOTIFY nameChanged)
@@ -126,6 +143,10 @@ public:
     ~QXmppMucRoom();
 
     Actions allowedActions() const;
+
+    bool coalesceUpdates() const;
+    void setCoalesceUpdates(bool coalesce);
+
     bool isJoined() const;
     QString jid() const;
     QString name() const;
@@ -133,8 +154,12 @@ public:
     QString nickName() const;
     void setNickName(const QString &nickName);
 
+    QDateTime lastMessageTime() const;
+    void setLastMessageTime(const QDateTime &time);
+
     Q_INVOKABLE QString participantFullJid(const QString &jid) const;
     QXmppPresence participantPresence(const QString &jid) const;
+    QHash<QString, QXmppPresence> participantPresences() const;
     QStringList participants() const;
 
     QString password() const;
@@ -194,6 +219,21 @@ signals:
     void participantsChanged();
     /// \endcond
 
+    /// This signal is emitted once the initial list of participants has been
+    /// received, that is when the room sends back your own presence, right
+    /// before joined() is emitted.
+    void participantsReceived();
+
+    /// This signal is emitted instead of the per-participant signals when
+    /// updates are coalesced.
+    ///
+    /// \param added the Occupant JIDs of participants who joined the room
+    /// \param changed the Occupant JIDs of participants whose presence changed
+    /// \param removed the Occupant JIDs of participants who left the room
+    ///
+    /// \sa setCoalesceUpdates()
+    void participantsUpdated(const QStringList &added, const QStringList &changed, const QStringList &removed);
+
     /// This signal is emitted when the room's permissions are received.
     void permissionsReceived(const QList<QXmppMucItem> &permissions);
 
@@ -217,11 +257,13 @@ public slots:
 private slots:
     void _q_disconnected();
     void _q_discoveryInfoReceived(const QXmppDiscoveryIq &iq);
+    void _q_flushUpdates();
     void _q_messageReceived(const QXmppMessage &message);
     void _q_presenceReceived(const QXmppPresence &presence);
 
 private:
     QXmppMucRoom(QXmppClient *client, const QString &jid, QObject *parent);
+    void clearParticipants();
     QXmppMucRoomPrivate *d;
     friend class QXmppMucManager;
 };
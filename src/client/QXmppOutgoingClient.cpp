@@ -23,19 +23,20 @@
  */
 
 #include <QCryptographicHash>
+#include <QHostInfo>
 #include <QNetworkProxy>
+#include <QSslConfiguration>
 #include <QSslSocket>
 #include <QUrl>
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
-#include <QDnsLookup>
-#else
-#include "qdnslookup.h"
-#endif
 
+#include "QXmppBase64_p.h"
+#include "QXmppBoshClient_p.h"
+#include "QXmppCertificateCache_p.h"
 #include "QXmppConfiguration.h"
 #include "QXmppConstants.h"
 #include "QXmppIq.h"
 #include "QXmppLogger.h"
+#include "QXmppSrvLookup_p.h"
 #include "QXmppMessage.h"
 #include "QXmppPresence.h"
 #include "QXmppOutgoingClient.h"
@@ -52,27 +53,115 @@
 #include <QBuffer>
 #include <QCoreApplication>
 #include <QDomDocument>
+#include <QHash>
+#include <QMutex>
 #include <QStringList>
 #include <QRegExp>
+#include <QTime>
 #include <QHostAddress>
 #include <QXmlStreamWriter>
 #include <QTimer>
 
 #include <QXmppStreamManagement.h>
 
+namespace
+{
+    // A server to connect to, as given by an SRV record.
+    struct QXmppSrvTarget
+    {
+        QString host;
+        quint16 port;
+        quint16 priority;
+        bool directTls;
+    };
+
+    // Orders targets by priority, preferring direct TLS at equal priority
+    // as it saves the STARTTLS round trips.
+    bool srvTargetLessThan(const QXmppSrvTarget &t1, const QXmppSrvTarget &t2)
+    {
+        if (t1.priority != t2.priority)
+            return t1.priority < t2.priority;
+        return t1.directTls && !t2.directTls;
+    }
+
+    // An address to race a connection attempt to.
+    struct QXmppRaceAttempt
+    {
+        QHostAddress address;
+        quint16 port;
+        bool directTls;
+        // index of the server in the race, lower is preferred
+        int index;
+    };
+
+    // The number of servers whose addresses are raced.
+    const int raceTargetCount = 3;
+
+    // TLS session tickets, shared by all the client streams of the process
+    // so that reconnections can resume the TLS session, by host and port.
+    class QXmppTlsSessionCache
+    {
+    public:
+        QMutex mutex;
+        QHash<QString, QByteArray> tickets;
+    };
+}
+
+Q_GLOBAL_STATIC(QXmppTlsSessionCache, tlsSessionCache)
+
 class QXmppOutgoingClientPrivate
 {
 public:
     QXmppOutgoingClientPrivate(QXmppOutgoingClient *q);
-    void connectToHost(const QString &host, quint16 port);
+    void connectToBosh();
+    void connectToHost(const QString &host, quint16 port, bool directTls = false);
+    void connectToNextTarget();
+    void lookup(QXmppSrvLookup *lookup, const QString &name);
+    void lookupFinished(QXmppSrvLookup *lookup);
+    void connectToLookupTargets();
+    void startRace();
+    bool startRaceProbe();
+    void checkRaceFinished();
+    void stopRace();
+    bool canPipelineBind() const;
+    bool isBosh() const;
+    void sendSession();
+    bool startSasl();
+    void traceNegotiation(const QString &phase);
 
     // This object provides the configuration
     // required for connecting to the XMPP server.
     QXmppConfiguration config;
     QXmppStanza::Error::Condition xmppStreamError;
 
+    // the TCP socket, and the BOSH client which carries the stream instead
+    // when a BOSH URL is configured
+    QSslSocket *socket;
+    QXmppBoshClient *bosh;
+
     // DNS
-    QDnsLookup dns;
+    QXmppSrvLookup *dns;
+    QXmppSrvLookup *directTlsDns;
+    int pendingLookups;
+    QList<QXmppSrvTarget> lookupTargets;
+    // servers to try if the current connection attempt fails
+    QList<QXmppSrvTarget> targets;
+
+    // parallel connection attempts
+    bool racing;
+    QList<QXmppSrvTarget> raceTargets;
+    QMap<int, int> raceLookups;
+    QList<QXmppRaceAttempt> raceQueue;
+    QHash<QTcpSocket*, QXmppRaceAttempt> raceProbes;
+    QTimer *raceTimer;
+
+    // key of the TLS session cache entry for the current connection
+    QString tlsSessionKey;
+
+    // whether the handshake skipped certificate verification thanks to
+    // the certificate cache, and whether it reported errors
+    bool certificateCached;
+    bool sslErrorsSeen;
 
     // Stream
     QString streamId;
@@ -83,20 +172,39 @@ public:
     QString redirectHost;
     quint16 redirectPort;
 
+    // reconnection delay in milliseconds suggested by the server, or -1
+    int reconnectionHint;
+
     // Session
     QString bindId;
     QString sessionId;
     bool sessionAvailable;
     bool sessionStarted;
 
+    // time since the connection was requested, for negotiation traces
+    QTime negotiationTime;
+
     // Authentication
     bool isAuthenticated;
     QString nonSASLAuthId;
     QXmppSaslClient *saslClient;
+    QStringList saslMechanisms;
+
+    // login token for fast reconnection
+    bool loginTokenOffered;
+    QString loginTokenId;
 
     // XEP-0198: Stream Management
     QXmppConfiguration::StreamManagementMode streamManagementMode;
     QXmppStreamManagement *streamManagement;
+    QTimer *ackTimer;
+
+    // XEP-0352: Client State Indication
+    bool csiSupported;
+
+    // XEP-0138: Stream Compression
+    bool compressionFailed;
+    QDomElement compressionFeatures;
 
     // Timers
     QTimer *pingTimer;
@@ -109,22 +217,85 @@ private:
 };
 
 QXmppOutgoingClientPrivate::QXmppOutgoingClientPrivate(QXmppOutgoingClient *qq)
-    : redirectPort(0)
+    : socket(0)
+    , bosh(0)
+    , dns(0)
+    , directTlsDns(0)
+    , pendingLookups(0)
+    , racing(false)
+    , raceTimer(0)
+    , certificateCached(false)
+    , sslErrorsSeen(false)
+    , redirectPort(0)
+    , reconnectionHint(-1)
     , sessionAvailable(false)
     , sessionStarted(false)
     , isAuthenticated(false)
     , saslClient(0)
+    , loginTokenOffered(false)
     , streamManagementMode(QXmppConfiguration::SMDisabled)
     , streamManagement(0)
+    , ackTimer(0)
+    , csiSupported(false)
+    , compressionFailed(false)
     , pingTimer(0)
     , timeoutTimer(0)
     , q(qq)
 {
 }
 
-void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port)
+// Connects through the BOSH connection manager given by the configuration.
+
+void QXmppOutgoingClientPrivate::connectToBosh()
 {
-    q->info(QString("Connecting to %1:%2").arg(host, QString::number(port)));
+    bool check;
+    Q_UNUSED(check);
+
+    const QUrl url = config.boshUrl();
+    q->info(QString("Connecting to %1").arg(url.toString()));
+
+    if (url.scheme() != QLatin1String("https") &&
+        config.streamSecurityMode() == QXmppConfiguration::TLSRequired) {
+        q->warning("Not connecting as TLS is required, but the BOSH URL does not use https");
+        return;
+    }
+
+    if (!bosh) {
+        bosh = new QXmppBoshClient(q);
+
+        check = QObject::connect(bosh, SIGNAL(disconnected()),
+                                 q, SLOT(_q_socketDisconnected()));
+        Q_ASSERT(check);
+
+        check = QObject::connect(bosh, SIGNAL(error(QAbstractSocket::SocketError)),
+                                 q, SLOT(socketError(QAbstractSocket::SocketError)));
+        Q_ASSERT(check);
+
+        check = QObject::connect(bosh, SIGNAL(sslErrors(QList<QSslError>)),
+                                 q, SLOT(socketSslErrors(QList<QSslError>)));
+        Q_ASSERT(check);
+    }
+
+    QSslConfiguration sslConfiguration = QSslConfiguration::defaultConfiguration();
+    if (!config.caCertificates().isEmpty())
+        sslConfiguration.setCaCertificates(config.caCertificates());
+    bosh->setSslConfiguration(sslConfiguration);
+    bosh->setProxy(config.networkProxy());
+    bosh->setIgnoreSslErrors(config.ignoreSslErrors());
+
+    if (q->device() != bosh)
+        q->setDevice(bosh);
+    bosh->connectToUrl(url, config.domain());
+}
+
+void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port, bool directTls)
+{
+    q->info(QString("Connecting to %1:%2%3").arg(host, QString::number(port),
+        directTls ? QLatin1String(" using direct TLS") : QLatin1String("")));
+
+    // the stream may have been carried by BOSH
+    if (q->device() != socket)
+        q->setSocket(socket);
 
     // override CA certificates if requested
     if (!config.caCertificates().isEmpty())
@@ -138,9 +309,55 @@ void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port
     q->socket()->setPeerVerifyName(config.domain());
 #endif
 
+    // a certificate which was recently verified for the domain only needs
+    // to be compared once the handshake is done
+    certificateCached = config.certificateCacheTimeout() > 0 &&
+        QXmppCertificateCache::instance()->contains(config.domain());
+    sslErrorsSeen = false;
+    q->socket()->setPeerVerifyMode(certificateCached ? QSslSocket::VerifyNone : QSslSocket::AutoVerifyPeer);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 13, 0))
+    QSslConfiguration ocspConfiguration = q->socket()->sslConfiguration();
+    ocspConfiguration.setOcspStaplingEnabled(!certificateCached && config.certificateCacheTimeout() > 0);
+    q->socket()->setSslConfiguration(ocspConfiguration);
+#endif
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 4, 0))
+    // offer the session ticket we got from this server, if any
+    QSslConfiguration sslConfiguration = q->socket()->sslConfiguration();
+    tlsSessionKey.clear();
+    sslConfiguration.setSessionTicket(QByteArray());
+    if (config.tlsSessionResumptionEnabled()) {
+        tlsSessionKey = QString("%1:%2").arg(host, QString::number(port));
+        sslConfiguration.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+
+        QByteArray ticket;
+        QXmppTlsSessionCache *cache = tlsSessionCache();
+        if (cache) {
+            QMutexLocker locker(&cache->mutex);
+            ticket = cache->tickets.value(tlsSessionKey);
+        }
+        if (!ticket.isEmpty()) {
+            sslConfiguration.setSessionTicket(ticket);
+            emit q->updateCounter("outgoing-client.tls-session.hit");
+        } else {
+            emit q->updateCounter("outgoing-client.tls-session.miss");
+        }
+    } else {
+        sslConfiguration.setSslOption(QSsl::SslOptionDisableSessionPersistence, true);
+    }
+    q->socket()->setSslConfiguration(sslConfiguration);
+#endif
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 3, 0))
+    // XEP-0368: Direct TLS, the server may multiplex protocols on its port
+    QSslConfiguration alpnConfiguration = q->socket()->sslConfiguration();
+    alpnConfiguration.setAllowedNextProtocols(directTls ? QList<QByteArray>() << "xmpp-client" : QList<QByteArray>());
+    q->socket()->setSslConfiguration(alpnConfiguration);
+#endif
+
     // connect to host
     const QXmppConfiguration::StreamSecurityMode localSecurity = q->configuration().streamSecurityMode();
-    if (localSecurity == QXmppConfiguration::LegacySSL) {
+    if (localSecurity == QXmppConfiguration::LegacySSL || directTls) {
         if (!q->socket()->supportsSsl()) {
             q->warning("Not connecting as legacy SSL was requested, but SSL support is not available");
             return;
@@ -151,6 +368,268 @@ void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port
     }
 }
 
+// Connects to the next server given by the SRV lookups.
+
+void QXmppOutgoingClientPrivate::connectToNextTarget()
+{
+    if (targets.isEmpty())
+        return;
+    const QXmppSrvTarget target = targets.takeFirst();
+    connectToHost(target.host, target.port, target.directTls);
+}
+
+// Looks up the SRV records for \a name, the result may come from the
+// cache shared by all the streams of the process.
+
+void QXmppOutgoingClientPrivate::lookup(QXmppSrvLookup *lookup, const QString &name)
+{
+    q->debug(QString("Looking up %1").arg(name));
+    pendingLookups++;
+    lookup->lookup(name);
+}
+
+void QXmppOutgoingClientPrivate::lookupFinished(QXmppSrvLookup *lookup)
+{
+    if (lookup->error() != QDnsLookup::NoError) {
+        q->warning(QString("Lookup for %1 failed: %2").arg(lookup->name(), lookup->errorString()));
+        return;
+    }
+
+    foreach (const QXmppSrvRecord &record, lookup->serviceRecords()) {
+        // a target of "." means the service is not available
+        if (record.target().isEmpty() || record.target() == QLatin1String("."))
+            continue;
+
+        QXmppSrvTarget target;
+        target.host = record.target();
+        target.port = record.port();
+        target.priority = record.priority();
+        target.directTls = (lookup == directTlsDns);
+        lookupTargets << target;
+    }
+}
+
+// Connects to the servers found by the SRV lookups, in order of preference.
+
+void QXmppOutgoingClientPrivate::connectToLookupTargets()
+{
+    targets = lookupTargets;
+    lookupTargets.clear();
+    qStableSort(targets.begin(), targets.end(), srvTargetLessThan);
+
+    if (targets.isEmpty()) {
+        // as a fallback, use domain as the host name
+        q->warning(QString("No server found for domain %1, connecting to it directly").arg(config.domain()));
+        QXmppSrvTarget target;
+        target.host = config.domain();
+        target.port = config.port();
+        target.priority = 0;
+        target.directTls = false;
+        targets << target;
+    }
+
+    const QNetworkProxy::ProxyType proxyType = config.networkProxy().type();
+    if (config.connectionAttemptDelay() > 0 &&
+        (proxyType == QNetworkProxy::NoProxy || proxyType == QNetworkProxy::DefaultProxy))
+        startRace();
+    connectToNextTarget();
+}
+
+// Races connection attempts to the addresses of the best servers, while the
+// socket connects to the first one. The socket is not replaced if another
+// address wins: it is reconnected to that address, which the race proved
+// to be reachable.
+
+void QXmppOutgoingClientPrivate::startRace()
+{
+    racing = true;
+    raceTargets = targets.mid(0, raceTargetCount);
+    for (int i = 0; i < raceTargets.size(); ++i) {
+        const int id = QHostInfo::lookupHost(raceTargets.at(i).host, q, SLOT(_q_raceHostFound(QHostInfo)));
+        raceLookups.insert(id, i);
+    }
+    raceTimer->start(config.connectionAttemptDelay());
+}
+
+// Starts the next connection attempt of the race, returns false if there
+// is none left to start.
+
+bool QXmppOutgoingClientPrivate::startRaceProbe()
+{
+    if (raceQueue.isEmpty())
+        return false;
+
+    bool check;
+    Q_UNUSED(check);
+
+    const QXmppRaceAttempt attempt = raceQueue.takeFirst();
+    QTcpSocket *probe = new QTcpSocket(q);
+    probe->setProxy(QNetworkProxy::NoProxy);
+    check = QObject::connect(probe, SIGNAL(connected()),
+                             q, SLOT(_q_raceProbeConnected()));
+    Q_ASSERT(check);
+    check = QObject::connect(probe, SIGNAL(error(QAbstractSocket::SocketError)),
+                             q, SLOT(_q_raceProbeError()));
+    Q_ASSERT(check);
+    raceProbes.insert(probe, attempt);
+
+    q->debug(QString("Racing connection to %1:%2").arg(attempt.address.toString(), QString::number(attempt.port)));
+    raceTimer->start(config.connectionAttemptDelay());
+    probe->connectToHost(attempt.address, attempt.port);
+    return true;
+}
+
+// Ends the race once every address has failed, and lets the socket go on
+// with the remaining servers if it failed too.
+
+void QXmppOutgoingClientPrivate::checkRaceFinished()
+{
+    if (!racing || !raceLookups.isEmpty() || !raceQueue.isEmpty() || !raceProbes.isEmpty())
+        return;
+
+    stopRace();
+    if (q->socket()->state() == QAbstractSocket::UnconnectedState) {
+        if (!targets.isEmpty())
+            connectToNextTarget();
+        else
+            emit q->error(QXmppClient::SocketError);
+    }
+}
+
+void QXmppOutgoingClientPrivate::stopRace()
+{
+    if (!racing)
+        return;
+    racing = false;
+    raceTimer->stop();
+
+    foreach (int id, raceLookups.keys())
+        QHostInfo::abortHostLookup(id);
+    raceLookups.clear();
+    raceQueue.clear();
+    raceTargets.clear();
+
+    foreach (QTcpSocket *probe, raceProbes.keys()) {
+        probe->disconnect(q);
+        probe->abort();
+        probe->deleteLater();
+    }
+    raceProbes.clear();
+}
+
+/// Returns true if resource binding can be requested along with the stream
+/// restart which follows SASL authentication, i.e. the stream features which
+/// are about to be received cannot lead to a different step.
+
+bool QXmppOutgoingClientPrivate::canPipelineBind() const
+{
+    return config.pipelinedNegotiation() &&
+           !streamManagement->isResumeEnabled() &&
+           !(config.streamCompressionEnabled() && !isBosh() && q->isCompressionSupported() && !q->isCompressed());
+}
+
+/// Returns true if the stream is carried by BOSH, which rules out STARTTLS
+/// and stream compression.
+
+bool QXmppOutgoingClientPrivate::isBosh() const
+{
+    return bosh && q->device() == bosh;
+}
+
+void QXmppOutgoingClientPrivate::sendSession()
+{
+    QXmppSessionIq session;
+    session.setType(QXmppIq::Set);
+    session.setTo(q->configuration().domain());
+    sessionId = session.id();
+    q->sendPacket(session);
+}
+
+// Selects a SASL mechanism among those offered by the server and sends the
+// initial authentication request. Returns false if authentication cannot
+// be started.
+
+bool QXmppOutgoingClientPrivate::startSasl()
+{
+    // supported and preferred SASL auth mechanisms
+    QStringList supportedMechanisms = QXmppSaslClient::availableMechanisms();
+    const QString preferredMechanism = config.saslAuthMechanism();
+    if (config.facebookAppId().isEmpty() || config.facebookAccessToken().isEmpty())
+        supportedMechanisms.removeAll("X-FACEBOOK-PLATFORM");
+    if (config.windowsLiveAccessToken().isEmpty())
+        supportedMechanisms.removeAll("X-MESSENGER-OAUTH2");
+    if (config.googleAccessToken().isEmpty())
+        supportedMechanisms.removeAll("X-OAUTH2");
+    if (config.loginToken().isEmpty())
+        supportedMechanisms.removeAll("X-QXMPP-TOKEN");
+
+    // determine SASL Authentication mechanism to use, a login token
+    // spares the server from checking the password
+    QStringList commonMechanisms;
+    QString usedMechanism;
+    foreach (const QString &mechanism, saslMechanisms) {
+        if (supportedMechanisms.contains(mechanism))
+            commonMechanisms << mechanism;
+    }
+    if (commonMechanisms.isEmpty()) {
+        q->warning("No supported SASL Authentication mechanism available");
+        return false;
+    } else if (commonMechanisms.contains("X-QXMPP-TOKEN")) {
+        usedMechanism = "X-QXMPP-TOKEN";
+    } else if (!commonMechanisms.contains(preferredMechanism)) {
+        q->info(QString("Desired SASL Auth mechanism '%1' is not available, selecting first available one").arg(preferredMechanism));
+        usedMechanism = commonMechanisms.first();
+    } else {
+        usedMechanism = preferredMechanism;
+    }
+
+    saslClient = QXmppSaslClient::create(usedMechanism, q);
+    if (!saslClient) {
+        q->warning("SASL mechanism negotiation failed");
+        return false;
+    }
+    q->info(QString("SASL mechanism '%1' selected").arg(saslClient->mechanism()));
+    saslClient->setHost(config.domain());
+    saslClient->setServiceType("xmpp");
+    if (saslClient->mechanism() == "X-FACEBOOK-PLATFORM") {
+        saslClient->setUsername(config.facebookAppId());
+        saslClient->setPassword(config.facebookAccessToken());
+    } else if (saslClient->mechanism() == "X-MESSENGER-OAUTH2") {
+        saslClient->setPassword(config.windowsLiveAccessToken());
+    } else if (saslClient->mechanism() == "X-OAUTH2") {
+        saslClient->setUsername(config.user());
+        saslClient->setPassword(config.googleAccessToken());
+    } else if (saslClient->mechanism() == "X-QXMPP-TOKEN") {
+        saslClient->setUsername(config.user());
+        saslClient->setPassword(config.loginToken());
+    } else {
+        saslClient->setUsername(config.user());
+        saslClient->setPassword(config.password());
+    }
+
+    // send SASL auth request
+    QByteArray response;
+    if (!saslClient->respond(QByteArray(), response)) {
+        q->warning("SASL initial response failed");
+        return false;
+    }
+    q->sendPacket(QXmppSaslAuth(saslClient->mechanism(), response));
+    return true;
+}
+
+// Logs the time elapsed since the connection was requested when a phase of
+// the stream negotiation is reached.
+
+void QXmppOutgoingClientPrivate::traceNegotiation(const QString &phase)
+{
+    if (negotiationTime.isNull())
+        return;
+
+    const int elapsed = negotiationTime.elapsed();
+    q->debug(QString("Negotiation phase '%1' reached after %2 ms").arg(phase, QString::number(elapsed)));
+    emit q->setGauge("outgoing-client.negotiation." + phase, elapsed);
+}
+
 /// Constructs an outgoing client stream.
 ///
 /// \param parent
@@ -164,12 +643,17 @@ QXmppOutgoingClient::QXmppOutgoingClient(QObject *parent)
 
     // initialise socket
     QSslSocket *socket = new QSslSocket(this);
+    d->socket = socket;
     setSocket(socket);
 
     check = connect(socket, SIGNAL(disconnected()),
                     this, SLOT(_q_socketDisconnected()));
     Q_ASSERT(check);
 
+    check = connect(socket, SIGNAL(encrypted()),
+                    this, SLOT(_q_socketEncrypted()));
+    Q_ASSERT(check);
+
     check = connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
                     this, SLOT(socketSslErrors(QList<QSslError>)));
     Q_ASSERT(check);
@@ -178,8 +662,21 @@ QXmppOutgoingClient::QXmppOutgoingClient(QObject *parent)
                     this, SLOT(socketError(QAbstractSocket::SocketError)));
     Q_ASSERT(check);
 
+    // parallel connection attempts
+    d->raceTimer = new QTimer(this);
+    d->raceTimer->setSingleShot(true);
+    check = connect(d->raceTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_raceTimeout()));
+    Q_ASSERT(check);
+
     // DNS lookups
-    check = connect(&d->dns, SIGNAL(finished()),
+    d->dns = new QXmppSrvLookup(this);
+    check = connect(d->dns, SIGNAL(finished()),
+                    this, SLOT(_q_dnsLookupFinished()));
+    Q_ASSERT(check);
+
+    d->directTlsDns = new QXmppSrvLookup(this);
+    check = connect(d->directTlsDns, SIGNAL(finished()),
                     this, SLOT(_q_dnsLookupFinished()));
     Q_ASSERT(check);
 
@@ -195,10 +692,21 @@ QXmppOutgoingClient::QXmppOutgoingClient(QObject *parent)
                     this, SLOT(pingTimeout()));
     Q_ASSERT(check);
 
+    // XEP-0198: Stream Management
+    d->ackTimer = new QTimer(this);
+    d->ackTimer->setSingleShot(true);
+    check = connect(d->ackTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_ackTimeout()));
+    Q_ASSERT(check);
+
     check = connect(this, SIGNAL(connected()),
                     this, SLOT(pingStart()));
     Q_ASSERT(check);
 
+    check = connect(this, SIGNAL(connected()),
+                    this, SLOT(_q_requestLoginToken()));
+    Q_ASSERT(check);
+
     check = connect(this, SIGNAL(disconnected()),
                     this, SLOT(pingStop()));
     Q_ASSERT(check);
@@ -234,26 +742,75 @@ QXmppConfiguration& QXmppOutgoingClient::configuration()
     return d->config;
 }
 
+/// Returns the TCP socket of the stream.
+///
+/// When the stream is carried by BOSH, the socket is not connected.
+
+QSslSocket *QXmppOutgoingClient::socket() const
+{
+    return d->socket;
+}
+
+/// \cond
+QXmppBoshClient *QXmppOutgoingClient::boshClient() const
+{
+    return d->isBosh() ? d->bosh : 0;
+}
+/// \endcond
+
 /// Attempts to connect to the XMPP server.
 
 void QXmppOutgoingClient::connectToHost()
 {
+    d->negotiationTime.start();
+    d->reconnectionHint = -1;
+    d->redirectHost = QString();
+    d->redirectPort = 0;
+    d->loginTokenOffered = false;
+    d->loginTokenId.clear();
+
+    // cancel any previous attempt
+    d->stopRace();
+    d->dns->abort();
+    d->directTlsDns->abort();
+    d->pendingLookups = 0;
+    d->lookupTargets.clear();
+    d->targets.clear();
+
+    // XEP-0206: XMPP Over BOSH
+    if (d->config.boshUrl().isValid()) {
+        d->connectToBosh();
+        return;
+    }
+
     // if an explicit host was provided, connect to it
     if (!d->config.host().isEmpty() && d->config.port()) {
-        d->connectToHost(d->config.host(), d->config.port());
+        QXmppSrvTarget target;
+        target.host = d->config.host();
+        target.port = d->config.port();
+        target.priority = 0;
+        target.directTls = false;
+        d->lookupTargets << target;
+        d->connectToLookupTargets();
         return;
     }
 
-    // otherwise, lookup server
+    // otherwise, lookup servers, both for STARTTLS and for XEP-0368: Direct TLS
     const QString domain = configuration().domain();
-    debug(QString("Looking up server for domain %1").arg(domain));
-    d->dns.setName("_xmpp-client._tcp." + domain);
-    d->dns.setType(QDnsLookup::SRV);
-    d->dns.lookup();
+    d->lookup(d->dns, "_xmpp-client._tcp." + domain);
+    if (d->config.directTlsEnabled() &&
+        d->config.streamSecurityMode() != QXmppConfiguration::TLSDisabled &&
+        socket()->supportsSsl())
+        d->lookup(d->directTlsDns, "_xmpps-client._tcp." + domain);
+
+    if (!d->pendingLookups)
+        d->connectToLookupTargets();
 }
 
 void QXmppOutgoingClient::disconnectFromHost(const bool sendCloseStream)
 {
+    d->stopRace();
+
     if(sendCloseStream)
     {
         d->streamManagement->disable();
@@ -268,18 +825,16 @@ void QXmppOutgoingClient::disconnectFromHost(const bool sendCloseStream)
 
 void QXmppOutgoingClient::_q_dnsLookupFinished()
 {
-    if (d->dns.error() == QDnsLookup::NoError &&
-        !d->dns.serviceRecords().isEmpty()) {
-        // take the first returned record
-        d->connectToHost(
-            d->dns.serviceRecords().first().target(),
-            d->dns.serviceRecords().first().port());
-    } else {
-        // as a fallback, use domain as the host name
-        warning(QString("Lookup for domain %1 failed: %2")
-                .arg(d->dns.name(), d->dns.errorString()));
-        d->connectToHost(d->config.domain(), d->config.port());
-    }
+    QXmppSrvLookup *lookup = qobject_cast<QXmppSrvLookup*>(sender());
+    if (!lookup || lookup->error() == QDnsLookup::OperationCancelledError)
+        return;
+
+    d->lookupFinished(lookup);
+    if (--d->pendingLookups > 0)
+        return;
+
+    d->traceNegotiation("dns");
+    d->connectToLookupTargets();
 }
 
 /// Returns true if authentication has succeeded.
@@ -296,27 +851,103 @@ bool QXmppOutgoingClient::isConnected() const
     return QXmppStream::isConnected() && d->sessionStarted;
 }
 
+/// Returns true if the session can be resumed after the connection is lost,
+/// using XEP-0198: Stream Management.
+
+bool QXmppOutgoingClient::isSessionResumable() const
+{
+    return d->streamManagement->isResumeEnabled();
+}
+
+/// Returns true if the server supports XEP-0352: Client State Indication.
+
+bool QXmppOutgoingClient::isClientStateIndicationSupported() const
+{
+    return d->csiSupported;
+}
+
 void QXmppOutgoingClient::_q_socketDisconnected()
 {
     debug("Socket disconnected");
     d->isAuthenticated = false;
     d->iqIds.clear();
+    d->ackTimer->stop();
     // Notify the stream management that the socket is in a disconect status
     if(d->streamManagement->isEnabled())
     {
         d->streamManagement->socketDisconnected();
     }
     if (!d->redirectHost.isEmpty() && d->redirectPort > 0) {
-        d->connectToHost(d->redirectHost, d->redirectPort);
-        d->redirectHost = QString();
-        d->redirectPort = 0;
+        // a server which sheds its clients may ask them to stagger their
+        // reconnections
+        if (d->reconnectionHint > 0)
+            QTimer::singleShot(d->reconnectionHint, this, SLOT(_q_connectToRedirectHost()));
+        else
+            _q_connectToRedirectHost();
+    } else if (!d->targets.isEmpty()) {
+        // the stream could not be opened, try the next server
+        d->connectToNextTarget();
     } else {
         emit disconnected();
     }
 }
 
+void QXmppOutgoingClient::_q_connectToRedirectHost()
+{
+    if (d->redirectHost.isEmpty() || !d->redirectPort)
+        return;
+
+    d->reconnectionHint = -1;
+    d->connectToHost(d->redirectHost, d->redirectPort);
+    d->redirectHost = QString();
+    d->redirectPort = 0;
+}
+
+void QXmppOutgoingClient::_q_socketEncrypted()
+{
+    // compare the certificate with the cached one, or remember it
+    if (configuration().certificateCacheTimeout() > 0) {
+        const QString domain = configuration().domain();
+        const QSslCertificate certificate = socket()->peerCertificate();
+        QXmppCertificateCache *cache = QXmppCertificateCache::instance();
+        if (d->certificateCached) {
+            if (cache->isVerified(domain, certificate)) {
+                emit updateCounter("outgoing-client.certificate-cache.hit");
+            } else {
+                // the certificate changed, the next connection verifies it
+                warning(QString("Certificate of %1 was not verified as it changed").arg(domain));
+                cache->remove(domain);
+                emit updateCounter("outgoing-client.certificate-cache.miss");
+                if (!configuration().ignoreSslErrors()) {
+                    disconnectFromHost();
+                    return;
+                }
+            }
+        } else {
+            if (!d->sslErrorsSeen)
+                cache->insert(domain, certificate, configuration().certificateCacheTimeout());
+            emit updateCounter("outgoing-client.certificate-cache.miss");
+        }
+    }
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 4, 0))
+    // keep the session ticket for the next connection
+    if (d->tlsSessionKey.isEmpty())
+        return;
+
+    const QByteArray ticket = socket()->sslConfiguration().sessionTicket();
+    QXmppTlsSessionCache *cache = tlsSessionCache();
+    if (cache && !ticket.isEmpty()) {
+        QMutexLocker locker(&cache->mutex);
+        cache->tickets.insert(d->tlsSessionKey, ticket);
+    }
+#endif
+}
+
 void QXmppOutgoingClient::socketSslErrors(const QList<QSslError> &errors)
 {
+    d->sslErrorsSeen = true;
+
     // log errors
     warning("SSL errors");
     for(int i = 0; i< errors.count(); ++i)
@@ -333,12 +964,115 @@ void QXmppOutgoingClient::socketSslErrors(const QList<QSslError> &errors)
 void QXmppOutgoingClient::socketError(QAbstractSocket::SocketError socketError)
 {
     Q_UNUSED(socketError);
+
+    // while racing, the outcome is decided by the other attempts
+    if (d->racing)
+        return;
+
+    // if other servers are available, try the next one once the socket is
+    // closed instead of reporting the error
+    if (!d->targets.isEmpty()) {
+        if (socket()->state() == QAbstractSocket::UnconnectedState)
+            QTimer::singleShot(0, this, SLOT(_q_connectToNextTarget()));
+        return;
+    }
+
     emit error(QXmppClient::SocketError);
 }
 
+void QXmppOutgoingClient::_q_connectToNextTarget()
+{
+    d->connectToNextTarget();
+}
+
+void QXmppOutgoingClient::_q_raceHostFound(const QHostInfo &info)
+{
+    if (!d->raceLookups.contains(info.lookupId()))
+        return;
+    const int index = d->raceLookups.take(info.lookupId());
+    const QXmppSrvTarget target = d->raceTargets.at(index);
+
+    // alternate between address families, starting with IPv6
+    QList<QHostAddress> ipv6Addresses, ipv4Addresses;
+    foreach (const QHostAddress &address, info.addresses()) {
+        if (address.protocol() == QAbstractSocket::IPv6Protocol)
+            ipv6Addresses << address;
+        else
+            ipv4Addresses << address;
+    }
+
+    // queue the attempts after those of the preferred servers
+    int pos = 0;
+    while (pos < d->raceQueue.size() && d->raceQueue.at(pos).index <= index)
+        ++pos;
+    while (!ipv6Addresses.isEmpty() || !ipv4Addresses.isEmpty()) {
+        for (int family = 0; family < 2; ++family) {
+            QList<QHostAddress> &addresses = family ? ipv4Addresses : ipv6Addresses;
+            if (addresses.isEmpty())
+                continue;
+
+            QXmppRaceAttempt attempt;
+            attempt.address = addresses.takeFirst();
+            attempt.port = target.port;
+            attempt.directTls = target.directTls;
+            attempt.index = index;
+            d->raceQueue.insert(pos++, attempt);
+        }
+    }
+
+    // if the delay has already elapsed, start an attempt right away
+    if (!d->raceTimer->isActive())
+        d->startRaceProbe();
+    d->checkRaceFinished();
+}
+
+void QXmppOutgoingClient::_q_raceProbeConnected()
+{
+    QTcpSocket *probe = qobject_cast<QTcpSocket*>(sender());
+    if (!probe || !d->raceProbes.contains(probe))
+        return;
+
+    // another address answered before the socket, switch to it
+    const QXmppRaceAttempt attempt = d->raceProbes.value(probe);
+    info(QString("Connection race won by %1:%2").arg(attempt.address.toString(), QString::number(attempt.port)));
+    emit updateCounter("outgoing-client.connect.race-won");
+    d->stopRace();
+    d->targets.clear();
+    socket()->abort();
+    d->connectToHost(attempt.address.toString(), attempt.port, attempt.directTls);
+}
+
+void QXmppOutgoingClient::_q_raceProbeError()
+{
+    QTcpSocket *probe = qobject_cast<QTcpSocket*>(sender());
+    if (!probe || !d->raceProbes.contains(probe))
+        return;
+
+    d->raceProbes.remove(probe);
+    probe->disconnect(this);
+    probe->deleteLater();
+
+    // do not wait for the delay to try the next address
+    if (!d->startRaceProbe())
+        d->checkRaceFinished();
+}
+
+void QXmppOutgoingClient::_q_raceTimeout()
+{
+    if (!d->startRaceProbe())
+        d->checkRaceFinished();
+}
+
 /// \cond
 void QXmppOutgoingClient::handleStart()
 {
+    // the socket connected first, the race is over
+    d->stopRace();
+
+    // with direct TLS, wait for the handshake to open the stream
+    if (!d->isBosh() && socket()->mode() == QSslSocket::SslClientMode && !socket()->isEncrypted())
+        return;
+
     QXmppStream::handleStart();
 
     // reset stream information
@@ -357,6 +1091,11 @@ void QXmppOutgoingClient::handleStart()
     d->sessionId.clear();
     d->sessionAvailable = false;
     d->sessionStarted = false;
+    d->csiSupported = false;
+
+    // reset compression negotiation
+    d->compressionFailed = false;
+    d->compressionFeatures = QDomElement();
 
     // start stream
     QByteArray data = "<?xml version='1.0'?><stream:stream to='";
@@ -367,6 +1106,11 @@ void QXmppOutgoingClient::handleStart()
 
 void QXmppOutgoingClient::handleStream(const QDomElement &streamElement)
 {
+    d->traceNegotiation("stream");
+
+    // the server answered, stop looking for another one
+    d->targets.clear();
+
     if(d->streamId.isEmpty())
         d->streamId = streamElement.attribute("id");
     if (d->streamFrom.isEmpty())
@@ -385,7 +1129,18 @@ void QXmppOutgoingClient::handleStream(const QDomElement &streamElement)
 
 bool QXmppOutgoingClient::sendPacket(const QXmppStanza &stanza)
 {
-    if(QXmppStream::sendPacket(stanza))
+    // serialize the packet once, stream management keeps the data
+    return sendPacket(stanza, helperToXmlData(stanza));
+}
+
+/// Sends \a stanza, using \a data as its already serialized form.
+///
+/// This avoids serializing a stanza again when it is sent to several
+/// recipients.
+
+bool QXmppOutgoingClient::sendPacket(const QXmppStanza &stanza, const QByteArray &data)
+{
+    if(sendData(data))
     {
         if( (stanza.getStanzaType() == QXmppStanza::Iq) && isConnected())
         {
@@ -398,9 +1153,14 @@ bool QXmppOutgoingClient::sendPacket(const QXmppStanza &stanza)
 
         if(d->streamManagement->isOutboundEnabled())
         {
-            d->streamManagement->stanzaSent(stanza);
-            if(d->streamManagement->outboundCounter() % 10 == 0) //every 10 packets a request is sent
+            d->streamManagement->stanzaSent(stanza, data);
+            if (d->streamManagement->isAckRequestDue())
                 sendStreamManagementRequest();
+
+            // request an acknowledgement later if none arrives
+            const int interval = d->streamManagement->ackRequestInterval();
+            if (interval > 0 && !d->ackTimer->isActive())
+                d->ackTimer->start(interval);
         }
         return true;
     }
@@ -435,6 +1195,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
     {
         QXmppStreamFeatures features;
         features.parse(nodeRecv);
+        d->csiSupported = features.clientStateIndicationMode() != QXmppStreamFeatures::Disabled;
 
         // in case that the configuration and the server supports stream management, it gets enabled now
         if(features.streamManagementMode() == QXmppStreamFeatures::Enabled)
@@ -450,7 +1211,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             }
         }
 
-        if (!socket()->isEncrypted())
+        if (!d->isBosh() && !socket()->isEncrypted())
         {
             // determine TLS mode to use
             const QXmppConfiguration::StreamSecurityMode localSecurity = configuration().streamSecurityMode();
@@ -486,72 +1247,33 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         const bool saslAvailable = !features.authMechanisms().isEmpty();
         if (saslAvailable && configuration().useSASLAuthentication())
         {
-            // supported and preferred SASL auth mechanisms
-            QStringList supportedMechanisms = QXmppSaslClient::availableMechanisms();
-            const QString preferredMechanism = configuration().saslAuthMechanism();
-            if (configuration().facebookAppId().isEmpty() || configuration().facebookAccessToken().isEmpty())
-                supportedMechanisms.removeAll("X-FACEBOOK-PLATFORM");
-            if (configuration().windowsLiveAccessToken().isEmpty())
-                supportedMechanisms.removeAll("X-MESSENGER-OAUTH2");
-            if (configuration().googleAccessToken().isEmpty())
-                supportedMechanisms.removeAll("X-OAUTH2");
-
-            // determine SASL Authentication mechanism to use
-            QStringList commonMechanisms;
-            QString usedMechanism;
-            foreach (const QString &mechanism, features.authMechanisms()) {
-                if (supportedMechanisms.contains(mechanism))
-                    commonMechanisms << mechanism;
-            }
-            if (commonMechanisms.isEmpty()) {
-                warning("No supported SASL Authentication mechanism available");
-                disconnectFromHost();
-                return;
-            } else if (!commonMechanisms.contains(preferredMechanism)) {
-                info(QString("Desired SASL Auth mechanism '%1' is not available, selecting first available one").arg(preferredMechanism));
-                usedMechanism = commonMechanisms.first();
-            } else {
-                usedMechanism = preferredMechanism;
-            }
-
-            d->saslClient = QXmppSaslClient::create(usedMechanism, this);
-            if (!d->saslClient) {
-                warning("SASL mechanism negotiation failed");
-                disconnectFromHost();
-                return;
-            }
-            info(QString("SASL mechanism '%1' selected").arg(d->saslClient->mechanism()));
-            d->saslClient->setHost(d->config.domain());
-            d->saslClient->setServiceType("xmpp");
-            if (d->saslClient->mechanism() == "X-FACEBOOK-PLATFORM") {
-                d->saslClient->setUsername(configuration().facebookAppId());
-                d->saslClient->setPassword(configuration().facebookAccessToken());
-            } else if (d->saslClient->mechanism() == "X-MESSENGER-OAUTH2") {
-                d->saslClient->setPassword(configuration().windowsLiveAccessToken());
-            } else if (d->saslClient->mechanism() == "X-OAUTH2") {
-                d->saslClient->setUsername(configuration().user());
-                d->saslClient->setPassword(configuration().googleAccessToken());
-            } else {
-                d->saslClient->setUsername(configuration().user());
-                d->saslClient->setPassword(configuration().password());
-            }
-
-            // send SASL auth request
-            QByteArray response;
-            if (!d->saslClient->respond(QByteArray(), response)) {
-                warning("SASL initial response failed");
+            d->saslMechanisms = features.authMechanisms();
+            d->loginTokenOffered = d->saslMechanisms.contains("X-QXMPP-TOKEN");
+            if (!d->startSasl())
                 disconnectFromHost();
-                return;
-            }
-            sendPacket(QXmppSaslAuth(d->saslClient->mechanism(), response));
             return;
         } else if(nonSaslAvailable && configuration().useNonSASLAuthentication()) {
             sendNonSASLAuthQuery();
             return;
         }
 
-        // store whether session is available
-        d->sessionAvailable = (features.sessionMode() != QXmppStreamFeatures::Disabled);
+        // enable compression if it is supported by both parties
+        if (configuration().streamCompressionEnabled() &&
+            !d->isBosh() &&
+            isCompressionSupported() &&
+            !isCompressed() &&
+            !d->compressionFailed &&
+            features.compressionMethods().contains("zlib"))
+        {
+            d->compressionFeatures = nodeRecv;
+            sendData("<compress xmlns='http://jabber.org/protocol/compress'><method>zlib</method></compress>");
+            return;
+        }
+
+        // store whether session is available, when pipelining we skip it
+        // if the server says it is optional
+        d->sessionAvailable = (features.sessionMode() != QXmppStreamFeatures::Disabled) &&
+            !(d->config.pipelinedNegotiation() && features.sessionOptional());
 
         // check whether bind is available
         if (features.bindMode() != QXmppStreamFeatures::Disabled)
@@ -561,8 +1283,13 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 sendStreamManagementResume();
                 return;
             }else{
-                if(!bindResource())
+                // the bind request may already have been pipelined
+                if(d->bindId.isEmpty() && !bindResource())
                     warning("Problem binding the resource");
+
+                // the session does not depend on the bind result
+                if (d->config.pipelinedNegotiation() && d->sessionAvailable)
+                    d->sendSession();
                 return;
             }
 
@@ -572,23 +1299,30 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         if (d->sessionAvailable)
         {
             // start session if it is available
-            QXmppSessionIq session;
-            session.setType(QXmppIq::Set);
-            session.setTo(configuration().domain());
-            d->sessionId = session.id();
-            sendPacket(session);
+            d->sendSession();
         } else {
             // otherwise we are done
             enableStreamManagement();
+            d->traceNegotiation("connected");
             emit connected();
         }
     }
     else if(ns == ns_stream && nodeRecv.tagName() == "error")
     {
-        // handle redirects
-        QRegExp redirectRegex("([^:]+)(:[0-9]+)?");
-        if (redirectRegex.exactMatch(nodeRecv.firstChildElement("see-other-host").text())) {
-            d->redirectHost = redirectRegex.cap(0);
+        // the server may tell us when to come back, for instance when it
+        // is shutting down
+        const QDomElement reconnectElement = nodeRecv.firstChildElement("reconnect");
+        const bool hasReconnect = reconnectElement.namespaceURI() == ns_reconnect;
+        if (hasReconnect)
+            d->reconnectionHint = qMax(0, reconnectElement.attribute("delay").toInt()) * 1000;
+
+        // handle redirects, the host is connected to directly rather than
+        // looked up as a domain, IPv6 addresses are enclosed in brackets
+        QRegExp redirectRegex("(\\[[^\\]]+\\]|[^:\\[\\]]+)(:[0-9]+)?");
+        if (redirectRegex.exactMatch(nodeRecv.firstChildElement("see-other-host").text().trimmed())) {
+            d->redirectHost = redirectRegex.cap(1);
+            if (d->redirectHost.startsWith(QLatin1Char('[')))
+                d->redirectHost = d->redirectHost.mid(1, d->redirectHost.size() - 2);
             if (!redirectRegex.cap(2).isEmpty())
                 d->redirectPort = redirectRegex.cap(2).mid(1).toUShort();
             else
@@ -597,12 +1331,30 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             return;
         }
 
+        if (hasReconnect)
+            disconnectFromHost();
+
         if (!nodeRecv.firstChildElement("conflict").isNull())
             d->xmppStreamError = QXmppStanza::Error::Conflict;
         else
             d->xmppStreamError = QXmppStanza::Error::UndefinedCondition;
         emit error(QXmppClient::XmppStreamError);
     }
+    else if(ns == ns_compress)
+    {
+        if(nodeRecv.tagName() == "compressed")
+        {
+            startCompression();
+            handleStart();
+        }
+        else if(nodeRecv.tagName() == "failure")
+        {
+            // carry on without compression
+            warning("Stream compression failed");
+            d->compressionFailed = true;
+            handleStanza(d->compressionFeatures);
+        }
+    }
     else if(ns == ns_tls)
     {
         if(nodeRecv.tagName() == "proceed")
@@ -620,10 +1372,45 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         }
         if(nodeRecv.tagName() == "success")
         {
+            // SCRAM servers may send their final message along with the success,
+            // but either way the server must have proved it knows the credentials
+            const QByteArray data = QXmppBase64::decode(nodeRecv.text());
+            if (d->saslClient->mechanism().startsWith("SCRAM-")) {
+                QXmppSaslClientScram *scram = static_cast<QXmppSaslClientScram*>(d->saslClient);
+                QByteArray response;
+                if (!data.isEmpty() && !scram->respond(data, response)) {
+                    warning("Could not verify the server's SASL signature");
+                    disconnectFromHost();
+                    return;
+                }
+                if (!scram->isServerVerified()) {
+                    warning("Server did not send its SASL signature");
+                    disconnectFromHost();
+                    return;
+                }
+            }
+
+            // a login token is rotated each time it is used
+            if (d->saslClient->mechanism() == "X-QXMPP-TOKEN") {
+                d->loginTokenOffered = false;
+                if (!data.isEmpty()) {
+                    d->config.setLoginToken(QString::fromUtf8(data));
+                    emit loginTokenChanged(d->config.loginToken());
+                }
+            }
+
             debug("Authenticated");
             d->isAuthenticated = true;
+            d->traceNegotiation("authenticated");
 
             handleStart();
+
+            // request resource binding along with the stream restart
+            if (d->canPipelineBind()) {
+                debug("Pipelining resource binding");
+                if (!bindResource())
+                    warning("Problem binding the resource");
+            }
         }
         else if(nodeRecv.tagName() == "challenge")
         {
@@ -643,6 +1430,20 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             QXmppSaslFailure failure;
             failure.parse(nodeRecv);
 
+            // fall back to the password if the login token was rejected
+            if (d->saslClient->mechanism() == "X-QXMPP-TOKEN") {
+                info("Login token rejected, falling back to other mechanisms");
+                d->config.setLoginToken(QString());
+                emit loginTokenChanged(QString());
+
+                delete d->saslClient;
+                d->saslClient = 0;
+                d->saslMechanisms.removeAll("X-QXMPP-TOKEN");
+                if (!d->startSasl())
+                    disconnectFromHost();
+                return;
+            }
+
             // RFC3920 defines the error condition as "not-authorized", but
             // some broken servers use "bad-auth" instead. We tolerate this
             // by remapping the error to "not-authorized".
@@ -667,14 +1468,28 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             if(type.isEmpty())
                 warning("QXmppStream: iq type can't be empty");
 
-            if(id == d->sessionId)
+            if (!d->loginTokenId.isEmpty() && id == d->loginTokenId)
+            {
+                d->loginTokenId.clear();
+                const QDomElement tokenElement = nodeRecv.firstChildElement("token");
+                if (type == "result" && !tokenElement.text().isEmpty()) {
+                    d->config.setLoginToken(tokenElement.text());
+                    emit loginTokenChanged(tokenElement.text());
+                } else {
+                    warning("Could not obtain a login token");
+                }
+                d->streamManagement->stanzaHandled();
+            }
+            else if(id == d->sessionId)
             {
                 QXmppSessionIq session;
                 session.parse(nodeRecv);
+                d->traceNegotiation("session");
 
                 // xmpp connection made
                 d->sessionStarted = true;
                 enableStreamManagement();
+                d->traceNegotiation("connected");
                 emit connected();
             }
             else if(QXmppBindIq::isBindIq(nodeRecv) && id == d->bindId)
@@ -683,8 +1498,17 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 bind.parse(nodeRecv);
 
                 // bind result
-                if (bind.type() == QXmppIq::Result)
+                if (bind.type() == QXmppIq::Error)
+                {
+                    warning("Resource binding failed");
+
+                    // ignore the result of a pipelined session request
+                    d->sessionId.clear();
+                }
+                else if (bind.type() == QXmppIq::Result)
                 {
+                    d->traceNegotiation("bind");
+
                     if (!bind.jid().isEmpty())
                     {
                         QRegExp jidRegex("^([^@/]+)@([^@/]+)/(.+)$");
@@ -700,16 +1524,15 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
 
                     if (d->sessionAvailable)
                     {
-                        // start session if it is available
-                        QXmppSessionIq session;
-                        session.setType(QXmppIq::Set);
-                        session.setTo(configuration().domain());
-                        d->sessionId = session.id();
-                        sendPacket(session);
+                        // start session if it is available, unless it
+                        // was pipelined with the bind request
+                        if (d->sessionId.isEmpty())
+                            d->sendSession();
                     } else {
                         // otherwise we are done
                         d->sessionStarted = true;
                         enableStreamManagement();
+                        d->traceNegotiation("connected");
                         emit connected();
                     }
                 }
@@ -726,6 +1549,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 // xmpp connection made
                 d->sessionStarted = true;
                 enableStreamManagement();
+                d->traceNegotiation("connected");
                 emit connected();
             }
             else if(QXmppNonSASLAuthIq::isNonSASLAuthIq(nodeRecv))
@@ -816,6 +1640,25 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
 }
 /// \endcond
 
+// Requests a login token after authenticating by other means, so that the
+// next connection can skip the password check.
+
+void QXmppOutgoingClient::_q_requestLoginToken()
+{
+    if (!d->loginTokenOffered)
+        return;
+    d->loginTokenOffered = false;
+
+    QXmppElement token;
+    token.setTagName("token");
+    token.setAttribute("xmlns", ns_login_token);
+
+    QXmppIq iq(QXmppIq::Get);
+    iq.setExtensions(QXmppElementList() << token);
+    d->loginTokenId = iq.id();
+    sendPacket(iq);
+}
+
 void QXmppOutgoingClient::pingStart()
 {
     const int interval = configuration().keepAliveInterval();
@@ -891,6 +1734,10 @@ void QXmppOutgoingClient::enableStreamManagement()
     else if(d->streamManagementMode == QXmppConfiguration::SMEnabled)
         sendStreamManagementEnable(false);
 
+    d->streamManagement->setAckPolicy(d->config.streamManagementAckStanzas(),
+                                      d->config.streamManagementAckBytes(),
+                                      d->config.streamManagementAckInterval(),
+                                      d->config.streamManagementAdaptiveAck());
     d->streamManagement->enableSent();
 }
 
@@ -925,6 +1772,20 @@ void QXmppOutgoingClient::sendStreamManagementResume()
     sendData(data);
 }
 
+void QXmppOutgoingClient::_q_ackTimeout()
+{
+    if (!d->streamManagement->isOutboundEnabled() ||
+        !d->streamManagement->unacknowledgedCount())
+        return;
+
+    if (d->streamManagement->isAckRequestDue(true))
+        sendStreamManagementRequest();
+
+    const int interval = d->streamManagement->ackRequestInterval();
+    if (interval > 0)
+        d->ackTimer->start(interval);
+}
+
 void QXmppOutgoingClient::sendStreamManagementRequest()
 {
     if(d->streamManagement->isEnabled() && !d->streamManagement->isResumming())
@@ -1014,16 +1875,20 @@ void QXmppOutgoingClient::handleStreamManagement(const QDomElement &element)
             {
                 if(element.hasAttribute("h"))
                 {
-                    foreach(const QXmppStanza *stanza, d->streamManagement->outBoundBuffer() )
-                    {
-                        sendPacket(*stanza);
-                    }
+                    // drop the stanzas the server handled, and resend the
+                    // others as they were serialized, they keep their
+                    // sequence numbers
+                    d->streamManagement->ackReceived(element);
+                    foreach(const QByteArray &data, d->streamManagement->outboundData())
+                        sendData(data);
                     d->streamManagement->resumedReceived();
                     d->sessionStarted = true;
+                    d->traceNegotiation("resumed");
                     emit streamManagementResumed(true);
                 }
             }else{
                 warning("Resume IDs did not match");
+                d->streamManagement->resumeFailed();
 
                 if(!bindResource())
                     warning("Problem binding the resource");
@@ -1039,6 +1904,7 @@ void QXmppOutgoingClient::handleStreamManagement(const QDomElement &element)
         if(d->streamManagement->isResumming()){
             //bind resource
             warning("Stream Management Resume failed");
+            d->streamManagement->resumeFailed();
 
             if(!bindResource())
                 warning("Problem binding the resource");
@@ -1060,3 +1926,15 @@ QXmppStanza::Error::Condition QXmppOutgoingClient::xmppStreamError()
     return d->xmppStreamError;
 }
 
+/// Returns the delay in milliseconds before reconnecting which the server
+/// suggested in the last stream error, or -1 if it did not suggest any.
+///
+/// The server suggests a delay with a \c{<reconnect xmlns="urn:qxmpp:reconnect:0" delay="60"/>}
+/// application-specific condition, where the delay is in seconds. The hint
+/// is cleared when connectToHost() is called.
+
+int QXmppOutgoingClient::reconnectionHint() const
+{
+    return d->reconnectionHint;
+}
+
@@ -31,8 +31,10 @@
 #include "QXmppStream.h"
 
 class QDomElement;
+class QHostInfo;
 class QSslError;
 
+class QXmppBoshClient;
 class QXmppConfiguration;
 class QXmppPresence;
 class QXmppIq;
@@ -58,11 +60,18 @@ public:
     void disconnectFromHost(const bool sendCloseStream = true);
     bool isAuthenticated() const;
     bool isConnected() const;
+    bool isSessionResumable() const;
+    bool isClientStateIndicationSupported() const;
     bool sendPacket(const QXmppStanza &stanza);
+    bool sendPacket(const QXmppStanza &stanza, const QByteArray &data);
     void sendStreamManagementRequest();
 
-    QSslSocket *socket() const { return QXmppStream::socket(); };
+    QSslSocket *socket() const;
+    /// \cond
+    QXmppBoshClient *boshClient() const;
+    /// \endcond
     QXmppStanza::Error::Condition xmppStreamError();
+    int reconnectionHint() const;
 
     QXmppConfiguration& configuration();
 
@@ -102,6 +111,10 @@ signals:
     /// This signal is emitted when the session has been resumed
     void streamManagementResumed(bool resumed);
 
+    /// This signal is emitted when the server issues a new login \a token,
+    /// or with an empty \a token when the previous one was rejected.
+    void loginTokenChanged(const QString &token);
+
 
 
 protected:
@@ -113,8 +126,16 @@ protected:
     /// \endcond
 
 private slots:
+    void _q_connectToRedirectHost();
     void _q_dnsLookupFinished();
     void _q_socketDisconnected();
+    void _q_socketEncrypted();
+    void _q_connectToNextTarget();
+    void _q_raceHostFound(const QHostInfo &info);
+    void _q_raceProbeConnected();
+    void _q_raceProbeError();
+    void _q_raceTimeout();
+    void _q_requestLoginToken();
     void socketError(QAbstractSocket::SocketError);
     void socketSslErrors(const QList<QSslError>&);
 
@@ -123,6 +144,8 @@ private slots:
     void pingSend();
     void pingTimeout();
 
+    void _q_ackTimeout();
+
 private:
     void sendNonSASLAuth(bool plaintext);
     void sendNonSASLAuthQuery();
@@ -3,13 +3,42 @@
 
 
 #include <QDomElement>
+#include <QTextStream>
 
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
+#include "QXmppDiscoveryManager.h"
 #include "QXmppReachAddress.h"
 #include "QXmppMessage.h"
 #include "QXmppPubSubIq.h"
 
+// Returns the key under which the last item of a sender's node is kept.
+
+static QString lastItemKey(const QString &jid, const QString &node)
+{
+    return jid + QLatin1Char(' ') + node;
+}
+
+// Serializes an element, to compare items which carry the same ID.
+
+static QString elementXml(const QDomElement &element)
+{
+    QString xml;
+    QTextStream stream(&xml);
+    element.save(stream, 0);
+    return xml;
+}
+
+// Makes the client compute its capabilities again, as the notifications
+// it asks for depend on the signals which are connected.
+
+static void invalidateCapabilities(QXmppClient *client)
+{
+    QXmppDiscoveryManager *discoManager = client ? client->findExtension<QXmppDiscoveryManager>() : 0;
+    if (discoManager)
+        discoManager->invalidateCapabilities();
+}
+
 QXmppPEPManager::QXmppPEPManager()
     : QXmppClientExtension()
     , m_reachActive(false)
@@ -44,18 +73,69 @@ void QXmppPEPManager::sendGaming(const QXmppGaming &gaming)
     client()->sendPacket(iq);
 }
 
+/// Returns the ID of the last item received from \a jid for the given PEP
+/// \a node, or an empty string if none was received.
+///
+/// The last items are kept across sessions, so an item the server sends
+/// again, for instance after reconnecting, is not reported twice.
+///
+/// \param jid
+/// \param node
+
+QString QXmppPEPManager::lastItemId(const QString &jid, const QString &node) const
+{
+    return m_lastItems.value(lastItemKey(jid, node)).attribute("id");
+}
+
+/// Returns the last reachability addresses received from \a jid.
+///
+/// The addresses are read from the items received so far, no request is
+/// sent.
+///
+/// \param jid
+
+QXmppReachAddress QXmppPEPManager::reachabilityAddress(const QString &jid) const
+{
+    QXmppReachAddress reachAddress;
+    reachAddress.parse(m_lastItems.value(lastItemKey(jid, ns_reach)));
+    return reachAddress;
+}
+
+/// Returns the last gaming information received from \a jid.
+///
+/// The information is read from the items received so far, no request is
+/// sent.
+///
+/// \param jid
+
+QXmppGaming QXmppPEPManager::gaming(const QString &jid) const
+{
+    QXmppGaming gaming;
+    gaming.parse(m_lastItems.value(lastItemKey(jid, ns_user_gaming)));
+    return gaming;
+}
+
 /// \cond
 QStringList QXmppPEPManager::discoveryFeatures() const
 {
     QStringList features;
 
+    // notifications are only requested for the nodes whose signal is
+    // connected, so the server does not push events nobody reads
+
     // XEP-0152: Reachability Addresses
-    if(m_reachActive)
-        features << ns_reach << ns_reach_notify;
+    if (m_reachActive) {
+        features << ns_reach;
+        if (receivers(SIGNAL(reachabilityAddressReceived(QString,QString,QXmppReachAddress))) > 0)
+            features << ns_reach_notify;
+    }
 
     // XEP-0196: User Gaming
-    if (m_gamingActive)
-        features << ns_user_gaming << ns_user_gaming_notify;
+    if (m_gamingActive) {
+        features << ns_user_gaming;
+        if (receivers(SIGNAL(gamingReceived(QString,QString,QXmppGaming))) > 0)
+            features << ns_user_gaming_notify;
+    }
 
     return features;
 }
@@ -72,18 +152,34 @@ bool QXmppPEPManager::handleStanza(const QDomElement &stanza)
 
     if(!pepElement.isNull() && pepElement.namespaceURI() == ns_personal_eventing_protocol)
     {
-        QXmppMessage message;
-        message.parse(stanza);
-
         QDomElement itemsElement = pepElement.firstChildElement("items");
         QString nodeType = itemsElement.attribute("node");
 
+        // while the client is inactive, only keep the last event of each
+        // sender and node, and deliver it once the client is active
+        if (!isIq && client() && !client()->isActive() &&
+            (nodeType == ns_reach || nodeType == ns_user_gaming))
+        {
+            const QString key = stanza.attribute("from") + QLatin1Char(' ') + nodeType;
+            if (!m_pendingEvents.contains(key))
+                m_pendingOrder << key;
+            m_pendingEvents.insert(key, stanza);
+            return true;
+        }
+
+        QXmppMessage message;
+        message.parse(stanza);
+
         // XEP-0152: Reachability Addresses
         if(nodeType == ns_reach)
         {
             QDomElement itemElement = itemsElement.firstChildElement("item");
             if(!itemElement.isNull())
             {
+                // the same item is not reported twice
+                if (!updateLastItem(message.from(), nodeType, itemElement))
+                    return true;
+
                 QString itemId = itemElement.attribute("id");
                 QDomElement reachElement = itemElement.firstChildElement("reach");
 
@@ -103,6 +199,9 @@ bool QXmppPEPManager::handleStanza(const QDomElement &stanza)
             QDomElement itemElement = itemsElement.firstChildElement("item");
             if(!itemElement.isNull())
             {
+                if (!updateLastItem(message.from(), nodeType, itemElement))
+                    return true;
+
                 QString itemId = itemElement.attribute("id");
                 QDomElement gamingElement = itemElement.firstChildElement("game");
 
@@ -117,5 +216,84 @@ bool QXmppPEPManager::handleStanza(const QDomElement &stanza)
     }
     return false;
 }
+
+void QXmppPEPManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(activeChanged(bool)),
+                    this, SLOT(_q_activeChanged(bool)));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(sessionEnded()),
+                    this, SLOT(_q_sessionEnded()));
+    Q_ASSERT(check);
+}
+
+#if QT_VERSION < 0x050000
+void QXmppPEPManager::connectNotify(const char *signal)
+{
+    Q_UNUSED(signal);
+    invalidateCapabilities(client());
+}
+
+void QXmppPEPManager::disconnectNotify(const char *signal)
+{
+    Q_UNUSED(signal);
+    invalidateCapabilities(client());
+}
+#else
+void QXmppPEPManager::connectNotify(const QMetaMethod &signal)
+{
+    Q_UNUSED(signal);
+    invalidateCapabilities(client());
+}
+
+void QXmppPEPManager::disconnectNotify(const QMetaMethod &signal)
+{
+    Q_UNUSED(signal);
+    invalidateCapabilities(client());
+}
+#endif
 /// \endcond
 
+// Stores the last item received from \a jid for \a node, and returns false
+// if it is the same as the previous one. Items are compared by their ID,
+// and by their payload if the IDs are the same, as a node may keep
+// publishing under a fixed ID.
+
+bool QXmppPEPManager::updateLastItem(const QString &jid, const QString &node, const QDomElement &item)
+{
+    const QString key = lastItemKey(jid, node);
+    QHash<QString, QDomElement>::const_iterator it = m_lastItems.constFind(key);
+    if (it != m_lastItems.constEnd() &&
+        it.value().attribute("id") == item.attribute("id") &&
+        elementXml(it.value()) == elementXml(item))
+        return false;
+
+    m_lastItems.insert(key, item);
+    return true;
+}
+
+void QXmppPEPManager::_q_activeChanged(bool active)
+{
+    if (!active)
+        return;
+
+    // deliver the events which were held back
+    const QStringList order = m_pendingOrder;
+    const QHash<QString, QDomElement> pending = m_pendingEvents;
+    _q_sessionEnded();
+    foreach (const QString &key, order)
+        handleStanza(pending.value(key));
+}
+
+void QXmppPEPManager::_q_sessionEnded()
+{
+    m_pendingEvents.clear();
+    m_pendingOrder.clear();
+}
+
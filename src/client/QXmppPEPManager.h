@@ -1,6 +1,10 @@
 #ifndef QXMPPPEPMANAGER_H
 #define QXMPPPEPMANAGER_H
 
+#include <QDomElement>
+#include <QHash>
+#include <QStringList>
+
 #include "QXmppClientExtension.h"
 #include "QXmppReachAddress.h"
 #include "QXmppPubSubIq.h"
@@ -16,6 +20,10 @@ public:
 
     void sendGaming(const QXmppGaming& gaming);
 
+    QString lastItemId(const QString &jid, const QString &node) const;
+    QXmppReachAddress reachabilityAddress(const QString &jid) const;
+    QXmppGaming gaming(const QString &jid) const;
+
     /// \cond
     virtual QStringList discoveryFeatures() const;
     virtual bool handleStanza(const QDomElement &stanza);
@@ -25,7 +33,33 @@ signals:
     void reachabilityAddressReceived(const QString &jid, const QString &id, const QXmppReachAddress& addr);
     void gamingReceived(const QString &jid, const QString &id, const QXmppGaming& game);
 
+protected:
+    /// \cond
+    virtual void setClient(QXmppClient *client);
+#if QT_VERSION < 0x050000
+    virtual void connectNotify(const char *signal);
+    virtual void disconnectNotify(const char *signal);
+#else
+    virtual void connectNotify(const QMetaMethod &signal);
+    virtual void disconnectNotify(const QMetaMethod &signal);
+#endif
+    /// \endcond
+
+private slots:
+    void _q_activeChanged(bool active);
+    void _q_sessionEnded();
+
 private:
+    bool updateLastItem(const QString &jid, const QString &node, const QDomElement &item);
+
+    // last item received from each sender for each node
+    QHash<QString, QDomElement> m_lastItems;
+
+    // events received while the client is inactive, the last one for each
+    // sender and node, in the order they were first seen
+    QHash<QString, QDomElement> m_pendingEvents;
+    QStringList m_pendingOrder;
+
     // XEP-0152
     bool m_reachActive;
     // XEP-0196: User Gaming
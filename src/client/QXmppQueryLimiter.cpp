@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppQueryLimiter_p.h"
+#include "QXmppUtils.h"
+
+QXmppQueryLimiter::QXmppQueryLimiter()
+    : m_limit(0)
+    , m_interval(60000)
+    , m_windowStart(0)
+{
+}
+
+/// Returns the maximum number of queries accepted from a requester within
+/// an interval, 0 meaning there is no limit.
+
+int QXmppQueryLimiter::limit() const
+{
+    return m_limit;
+}
+
+/// Sets the maximum number of queries accepted from a requester within an
+/// interval, 0 meaning there is no limit.
+///
+/// \param queries
+
+void QXmppQueryLimiter::setLimit(int queries)
+{
+    m_limit = queries;
+    m_counts.clear();
+}
+
+/// Returns the interval in milliseconds over which the queries are
+/// counted. The default value is one minute.
+
+int QXmppQueryLimiter::interval() const
+{
+    return m_interval;
+}
+
+/// Sets the interval in milliseconds over which the queries are counted.
+///
+/// \param msecs
+
+void QXmppQueryLimiter::setInterval(int msecs)
+{
+    m_interval = msecs;
+}
+
+/// Counts a query from \a jid, and returns true if it should be answered.
+
+bool QXmppQueryLimiter::accept(const QString &jid)
+{
+    if (m_limit <= 0)
+        return true;
+
+    if (!m_clock.isValid())
+        m_clock.start();
+    const qint64 now = m_clock.elapsed();
+    if (now - m_windowStart >= m_interval) {
+        m_windowStart = now;
+        m_counts.clear();
+    }
+
+    // the resources of a requester share its quota
+    int &count = m_counts[QXmppUtils::jidToBareJid(jid)];
+    return ++count <= m_limit;
+}
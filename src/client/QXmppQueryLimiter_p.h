@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPQUERYLIMITER_P_H
+#define QXMPPQUERYLIMITER_P_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppEntityTimeManager, QXmppLastActivityManager and
+// QXmppVersionManager classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppQueryLimiter class limits the number of queries answered for
+/// each requester within an interval.
+///
+/// The queries are counted per bare JID in fixed windows, and the counters
+/// are all dropped when a window ends, so the memory used only depends on
+/// the number of requesters within one interval.
+
+class QXMPP_AUTOTEST_EXPORT QXmppQueryLimiter
+{
+public:
+    QXmppQueryLimiter();
+
+    int limit() const;
+    void setLimit(int queries);
+
+    int interval() const;
+    void setInterval(int msecs);
+
+    bool accept(const QString &jid);
+
+private:
+    int m_limit;
+    int m_interval;
+    qint64 m_windowStart;
+    QElapsedTimer m_clock;
+    QHash<QString, int> m_counts;
+};
+
+#endif
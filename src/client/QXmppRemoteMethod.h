@@ -24,6 +24,7 @@
 #ifndef QXMPPREMOTEMETHOD_H
 #define QXMPPREMOTEMETHOD_H
 
+#include <QMetaType>
 #include <QObject>
 #include <QVariant>
 
@@ -39,6 +40,8 @@ struct QXmppRemoteMethodResult {
     QVariant result;
 };
 
+Q_DECLARE_METATYPE(QXmppRemoteMethodResult)
+
 class QXMPP_EXPORT QXmppRemoteMethod : public QObject
 {
     Q_OBJECT
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QUrl>
+
+#include "QXmppRosterCache.h"
+
+// "QXRC", followed by the snapshot format version
+static const quint32 rosterCacheMagic = 0x51585243;
+static const quint32 rosterCacheFormat = 1;
+
+QXmppRosterCache::~QXmppRosterCache()
+{
+}
+
+class QXmppRosterFileCachePrivate
+{
+public:
+    QString fileName(const QString &jid) const;
+
+    QString directory;
+};
+
+QString QXmppRosterFileCachePrivate::fileName(const QString &jid) const
+{
+    return QDir(directory).filePath(QString::fromLatin1(QUrl::toPercentEncoding(jid)) + ".roster");
+}
+
+/// Constructs a roster cache which stores its files in the given directory.
+///
+/// \param directory
+
+QXmppRosterFileCache::QXmppRosterFileCache(const QString &directory)
+    : d(new QXmppRosterFileCachePrivate)
+{
+    d->directory = directory;
+}
+
+QXmppRosterFileCache::~QXmppRosterFileCache()
+{
+    delete d;
+}
+
+/// Returns the directory the roster files are stored in.
+
+QString QXmppRosterFileCache::directory() const
+{
+    return d->directory;
+}
+
+bool QXmppRosterFileCache::load(const QString &jid, QString &version, QHash<QString, QXmppRosterIq::Item> &entries)
+{
+    QFile file(d->fileName(jid));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint32 magic, format, count;
+    stream >> magic >> format;
+    if (magic != rosterCacheMagic || format != rosterCacheFormat)
+        return false;
+
+    QString cachedVersion;
+    stream >> cachedVersion >> count;
+
+    QHash<QString, QXmppRosterIq::Item> cachedEntries;
+    cachedEntries.reserve(count);
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString bareJid, name, subscriptionStatus;
+        qint32 type;
+        QSet<QString> groups;
+        stream >> bareJid >> name >> type >> subscriptionStatus >> groups;
+
+        QXmppRosterIq::Item item;
+        item.setBareJid(bareJid);
+        item.setName(name);
+        item.setSubscriptionType(static_cast<QXmppRosterIq::Item::SubscriptionType>(type));
+        item.setSubscriptionStatus(subscriptionStatus);
+        item.setGroups(groups);
+        cachedEntries.insert(bareJid, item);
+    }
+    if (stream.status() != QDataStream::Ok || cachedVersion.isNull())
+        return false;
+
+    version = cachedVersion;
+    entries = cachedEntries;
+    return true;
+}
+
+void QXmppRosterFileCache::store(const QString &jid, const QString &version, const QHash<QString, QXmppRosterIq::Item> &entries)
+{
+    // write to a temporary file first, so a failed write keeps the old roster
+    const QString fileName = d->fileName(jid);
+    const QString tempName = fileName + ".tmp";
+    QFile file(tempName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << rosterCacheMagic << rosterCacheFormat;
+    stream << version << quint32(entries.size());
+    foreach (const QXmppRosterIq::Item &item, entries) {
+        stream << item.bareJid() << item.name() << qint32(item.subscriptionType())
+               << item.subscriptionStatus() << item.groups();
+    }
+    file.close();
+
+    if (stream.status() != QDataStream::Ok || file.error() != QFile::NoError) {
+        QFile::remove(tempName);
+        return;
+    }
+    QFile::remove(fileName);
+    QFile::rename(tempName, fileName);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPROSTERCACHE_H
+#define QXMPPROSTERCACHE_H
+
+#include <QHash>
+
+#include "QXmppRosterIq.h"
+
+class QXmppRosterFileCachePrivate;
+
+/// \brief The QXmppRosterCache class is the base class for persistent roster
+/// storage, as used by XEP-0237: Roster Versioning.
+///
+/// If the server supports roster versioning, QXmppRosterManager loads the
+/// roster from its cache when it connects and only asks the server for the
+/// changes made since the cached version. Each time the roster changes, the
+/// manager stores the new version in the cache.
+///
+/// \ingroup Managers
+
+class QXMPP_EXPORT QXmppRosterCache
+{
+public:
+    virtual ~QXmppRosterCache();
+
+    /// Loads the cached roster of the account with the given bare JID.
+    ///
+    /// You should return false if no valid roster was cached.
+    ///
+    /// \param jid the bare JID of the account
+    /// \param version receives the version of the cached roster
+    /// \param entries receives the cached entries, keyed by bare JID
+    virtual bool load(const QString &jid, QString &version, QHash<QString, QXmppRosterIq::Item> &entries) = 0;
+
+    /// Stores the roster of the account with the given bare JID.
+    ///
+    /// \param jid the bare JID of the account
+    /// \param version the version of the roster
+    /// \param entries the roster entries, keyed by bare JID
+    virtual void store(const QString &jid, const QString &version, const QHash<QString, QXmppRosterIq::Item> &entries) = 0;
+};
+
+/// \brief The QXmppRosterFileCache class stores rosters as binary snapshots,
+/// one file per account, in a directory.
+///
+/// \ingroup Managers
+
+class QXMPP_EXPORT QXmppRosterFileCache : public QXmppRosterCache
+{
+public:
+    QXmppRosterFileCache(const QString &directory);
+    ~QXmppRosterFileCache();
+
+    QString directory() const;
+
+    bool load(const QString &jid, QString &version, QHash<QString, QXmppRosterIq::Item> &entries);
+    void store(const QString &jid, const QString &version, const QHash<QString, QXmppRosterIq::Item> &entries);
+
+private:
+    Q_DISABLE_COPY(QXmppRosterFileCache)
+    QXmppRosterFileCachePrivate * const d;
+};
+
+#endif
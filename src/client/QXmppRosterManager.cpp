@@ -23,23 +23,38 @@
  */
 
 #include <QDomElement>
+#include <QXmlStreamWriter>
 
 #include "QXmppClient.h"
+#include "QXmppConstants.h"
 #include "QXmppPresence.h"
+#include "QXmppRosterCache.h"
 #include "QXmppRosterIq.h"
 #include "QXmppRosterManager.h"
+#include "QXmppStreamFeatures.h"
+#include "QXmppStringPool_p.h"
 #include "QXmppUtils.h"
 
 class QXmppRosterManagerPrivate
 {
 public:
     QXmppRosterManagerPrivate(QXmppRosterManager *qq);
+    void clear();
+    void storeCache(const QString &jid);
 
     // map of bareJid and its rosterEntry
-    QMap<QString, QXmppRosterIq::Item> entries;
+    QHash<QString, QXmppRosterIq::Item> entries;
 
     // map of resources of the jid and map of resources and presences
-    QMap<QString, QMap<QString, QXmppPresence> > presences;
+    QHash<QString, QMap<QString, QXmppPresence> > presences;
+
+    // whether a presence which changes nothing is signalled
+    bool suppressDuplicates;
+
+    // presences received while the client is inactive, the last one for
+    // each full JID, in the order the full JIDs were first seen
+    QHash<QString, QXmppPresence> pendingPresences;
+    QStringList pendingOrder;
 
     // flag to store that the roster has been populated
     bool isRosterReceived;
@@ -47,20 +62,40 @@ public:
     // id of the initial roster request
     QString rosterReqId;
 
-    // Stream Management Resume Enabled
-    bool   isResumeEnabled;
+    // XEP-0237: Roster Versioning
+    QXmppRosterCache *cache;
+    QString version;
+    bool isVersioningSupported;
 
 private:
     QXmppRosterManager *q;
 };
 
 QXmppRosterManagerPrivate::QXmppRosterManagerPrivate(QXmppRosterManager *qq)
-    : isRosterReceived(false)
-    , isResumeEnabled(false)
+    : suppressDuplicates(false)
+    , isRosterReceived(false)
+    , cache(0)
+    , isVersioningSupported(false)
     , q(qq)
 {
 }
 
+void QXmppRosterManagerPrivate::clear()
+{
+    entries.clear();
+    presences.clear();
+    pendingPresences.clear();
+    pendingOrder.clear();
+    version = QString();
+    isRosterReceived = false;
+}
+
+void QXmppRosterManagerPrivate::storeCache(const QString &jid)
+{
+    if (cache && !version.isNull())
+        cache->store(jid, version, entries);
+}
+
 /// Constructs a roster manager.
 
 QXmppRosterManager::QXmppRosterManager(QXmppClient* client)
@@ -74,7 +109,7 @@ QXmppRosterManager::QXmppRosterManager(QXmppClient* client)
                     this, SLOT(_q_connected()));
     Q_ASSERT(check);
 
-    check = connect(client, SIGNAL(disconnected()),
+    check = connect(client, SIGNAL(sessionEnded()),
                     this, SLOT(_q_disconnected()));
     Q_ASSERT(check);
 
@@ -82,12 +117,12 @@ QXmppRosterManager::QXmppRosterManager(QXmppClient* client)
                     this, SLOT(_q_presenceReceived(QXmppPresence)));
     Q_ASSERT(check);
 
-    check = connect(client, SIGNAL(streamManagementEnabled(bool)),
-                    this, SLOT(_q_streamResumeEnabled(bool)));
+    check = connect(client, SIGNAL(activeChanged(bool)),
+                    this, SLOT(_q_activeChanged(bool)));
     Q_ASSERT(check);
 
-    check = connect(client, SIGNAL(streamManagementResumed(bool)),
-                    this, SLOT(_q_streamResumed(bool)));
+    check = connect(client, SIGNAL(iqReceived(QXmppIq)),
+                    this, SLOT(_q_iqReceived(QXmppIq)));
     Q_ASSERT(check);
 }
 
@@ -116,6 +151,19 @@ void QXmppRosterManager::_q_connected()
     QXmppRosterIq roster;
     roster.setType(QXmppIq::Get);
     roster.setFrom(client()->configuration().jid());
+
+    // XEP-0237: only ask for the changes since the cached roster
+    if (d->cache && d->isVersioningSupported) {
+        if (d->version.isNull()) {
+            QString version;
+            QHash<QString, QXmppRosterIq::Item> entries;
+            if (d->cache->load(client()->configuration().jidBare(), version, entries)) {
+                d->version = version;
+                d->entries = entries;
+            }
+        }
+        roster.setVersion(d->version.isNull() ? QLatin1String("") : d->version);
+    }
     d->rosterReqId = roster.id();
     if (client()->isAuthenticated())
         client()->sendPacket(roster);
@@ -123,20 +171,28 @@ void QXmppRosterManager::_q_connected()
 
 void QXmppRosterManager::_q_disconnected()
 {
-    // In case that resume is enabled the roster must not be cleared until the a resume is attempted
-    // where depending on the success it will be kept or cleared
-    if(!d->isResumeEnabled)
-    {
-        debug("Socket disconnected, roster kept until resume attempts");
-        d->entries.clear();
-        d->presences.clear();
-        d->isRosterReceived = false;
-    }
+    d->clear();
 }
 
 /// \cond
+QList<QXmppClientExtension::StanzaFilter> QXmppRosterManager::stanzaFilters() const
+{
+    QList<StanzaFilter> filters;
+    filters << StanzaFilter("iq", ns_roster, "query");
+    filters << StanzaFilter("features");
+    return filters;
+}
+
 bool QXmppRosterManager::handleStanza(const QDomElement &element)
 {
+    // XEP-0237: check whether the server supports roster versioning
+    if (QXmppStreamFeatures::isStreamFeatures(element)) {
+        QXmppStreamFeatures features;
+        features.parse(element);
+        d->isVersioningSupported = features.rosterVersioningMode() != QXmppStreamFeatures::Disabled;
+        return false;
+    }
+
     if (element.tagName() != "iq" || !QXmppRosterIq::isRosterIq(element))
         return false;
 
@@ -180,14 +236,30 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
                     }
                 }
             }
+
+            if (!rosterIq.version().isNull()) {
+                d->version = rosterIq.version();
+                d->storeCache(client()->configuration().jidBare());
+            }
         }
         break;
     case QXmppIq::Result:
         {
             const QList<QXmppRosterIq::Item> items = rosterIq.items();
-            foreach (const QXmppRosterIq::Item &item, items) {
-                const QString bareJid = item.bareJid();
-                d->entries.insert(bareJid, item);
+            if (isInitial) {
+                // the initial roster replaces the stored one in a single pass
+                QHash<QString, QXmppRosterIq::Item> entries;
+                entries.reserve(items.size());
+                foreach (const QXmppRosterIq::Item &item, items)
+                    entries.insert(item.bareJid(), item);
+                d->entries = entries;
+            } else {
+                foreach (const QXmppRosterIq::Item &item, items)
+                    d->entries.insert(item.bareJid(), item);
+            }
+            if (!rosterIq.version().isNull()) {
+                d->version = rosterIq.version();
+                d->storeCache(client()->configuration().jidBare());
             }
             if (isInitial)
             {
@@ -204,6 +276,49 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
 }
 /// \endcond
 
+void QXmppRosterManager::_q_activeChanged(bool active)
+{
+    if (!active)
+        return;
+
+    // deliver the presences which were held back
+    const QStringList order = d->pendingOrder;
+    const QHash<QString, QXmppPresence> pending = d->pendingPresences;
+    d->pendingOrder.clear();
+    d->pendingPresences.clear();
+    foreach (const QString &jid, order)
+        _q_presenceReceived(pending.value(jid));
+}
+
+// Serializes the extensions of a presence, to compare them.
+
+static QString extensionsXml(const QXmppPresence &presence)
+{
+    QString xml;
+    QXmlStreamWriter writer(&xml);
+    foreach (const QXmppElement &extension, presence.extensions())
+        extension.toXml(&writer);
+    return xml;
+}
+
+// Returns true if two available presences carry the same information.
+
+static bool isSamePresence(const QXmppPresence &a, const QXmppPresence &b)
+{
+    return a.type() == b.type() &&
+           a.availableStatusType() == b.availableStatusType() &&
+           a.priority() == b.priority() &&
+           a.statusText() == b.statusText() &&
+           a.capabilityHash() == b.capabilityHash() &&
+           a.capabilityNode() == b.capabilityNode() &&
+           a.capabilityVer() == b.capabilityVer() &&
+           a.capabilityExt() == b.capabilityExt() &&
+           a.vCardUpdateType() == b.vCardUpdateType() &&
+           a.photoHash() == b.photoHash() &&
+           a.extensions().size() == b.extensions().size() &&
+           extensionsXml(a) == extensionsXml(b);
+}
+
 void QXmppRosterManager::_q_presenceReceived(const QXmppPresence& presence)
 {
     const QString jid = presence.from();
@@ -213,15 +328,44 @@ void QXmppRosterManager::_q_presenceReceived(const QXmppPresence& presence)
     if (bareJid.isEmpty())
         return;
 
+    // while the client is inactive, only the last presence of each
+    // resource is kept, and it is delivered once the client is active
+    if (!client()->isActive() &&
+        (presence.type() == QXmppPresence::Available || presence.type() == QXmppPresence::Unavailable)) {
+        if (!d->pendingPresences.contains(jid))
+            d->pendingOrder << jid;
+        d->pendingPresences.insert(jid, presence);
+        return;
+    }
+
     switch(presence.type())
     {
     case QXmppPresence::Available:
-        d->presences[bareJid][resource] = presence;
-        emit presenceChanged(bareJid, resource);
+        {
+            QMap<QString, QXmppPresence> &resources = d->presences[bareJid];
+            QMap<QString, QXmppPresence>::iterator it = resources.find(resource);
+            bool duplicate = false;
+            if (it != resources.end()) {
+                duplicate = d->suppressDuplicates && isSamePresence(it.value(), presence);
+                it.value() = presence;
+            } else {
+                // resource names are often the same across contacts
+                resources.insert(QXmppStringPool::shared(resource), presence);
+            }
+            if (!duplicate)
+                emit presenceChanged(bareJid, resource);
+        }
         break;
     case QXmppPresence::Unavailable:
-        d->presences[bareJid].remove(resource);
-        emit presenceChanged(bareJid, resource);
+        {
+            QHash<QString, QMap<QString, QXmppPresence> >::iterator it = d->presences.find(bareJid);
+            if (it != d->presences.end()) {
+                it.value().remove(resource);
+                if (it.value().isEmpty())
+                    d->presences.erase(it);
+            }
+            emit presenceChanged(bareJid, resource);
+        }
         break;
     case QXmppPresence::Subscribe:
         if (client()->configuration().autoAcceptSubscriptions())
@@ -240,22 +384,16 @@ void QXmppRosterManager::_q_presenceReceived(const QXmppPresence& presence)
     }
 }
 
-void QXmppRosterManager::_q_streamResumed(bool resumed)
+void QXmppRosterManager::_q_iqReceived(const QXmppIq &iq)
 {
-    if(!resumed)
-    {
-        debug("Stream resumed failed - Roster cleared");
-        d->entries.clear();
-        d->presences.clear();
-        d->isRosterReceived = false;
+    // XEP-0237: an empty result means the cached roster is up to date
+    if (iq.type() == QXmppIq::Result && iq.id() == d->rosterReqId &&
+        !d->version.isNull() && !d->isRosterReceived) {
+        d->isRosterReceived = true;
+        emit rosterReceived();
     }
 }
 
-void QXmppRosterManager::_q_streamResumeEnabled(bool enabled)
-{
-      d->isResumeEnabled = enabled;
-}
-
 /// Refuses a subscription request.
 ///
 /// You can call this method in reply to the subscriptionRequest() signal.
@@ -364,6 +502,8 @@ bool QXmppRosterManager::unsubscribe(const QString &bareJid, const QString &reas
 
 /// Function to get all the bareJids present in the roster.
 ///
+/// The bareJids are returned in no particular order.
+///
 /// \return QStringList list of all the bareJids
 ///
 
@@ -382,10 +522,17 @@ QXmppRosterIq::Item QXmppRosterManager::getRosterEntry(
         const QString& bareJid) const
 {
     // will return blank entry if bareJid does'nt exist
-    if(d->entries.contains(bareJid))
-        return d->entries.value(bareJid);
-    else
-        return QXmppRosterIq::Item();
+    return d->entries.value(bareJid);
+}
+
+/// Returns all the roster entries, keyed by bareJid.
+///
+/// The returned hash is implicitly shared with the roster manager, so this
+/// does not copy the roster unless it changes while you hold the result.
+
+QHash<QString, QXmppRosterIq::Item> QXmppRosterManager::getRosterEntries() const
+{
+    return d->entries;
 }
 
 /// Get all the associated resources with the given bareJid.
@@ -396,10 +543,7 @@ QXmppRosterIq::Item QXmppRosterManager::getRosterEntry(
 
 QStringList QXmppRosterManager::getResources(const QString& bareJid) const
 {
-    if(d->presences.contains(bareJid))
-        return d->presences[bareJid].keys();
-    else
-        return QStringList();
+    return d->presences.value(bareJid).keys();
 }
 
 /// Get all the presences of all the resources of the given bareJid. A bareJid
@@ -413,10 +557,18 @@ QStringList QXmppRosterManager::getResources(const QString& bareJid) const
 QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
         const QString& bareJid) const
 {
-    if(d->presences.contains(bareJid))
-        return d->presences[bareJid];
-    else
-        return QMap<QString, QXmppPresence>();
+    return d->presences.value(bareJid);
+}
+
+/// Returns the presences of all the resources of all the bareJids, keyed
+/// by bareJid and then by resource.
+///
+/// As with getRosterEntries(), the result is implicitly shared and does not
+/// copy the presences.
+
+QHash<QString, QMap<QString, QXmppPresence> > QXmppRosterManager::getAllPresences() const
+{
+    return d->presences;
 }
 
 /// Get the presence of the given resource of the given bareJid.
@@ -429,16 +581,58 @@ QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
 QXmppPresence QXmppRosterManager::getPresence(const QString& bareJid,
                                        const QString& resource) const
 {
-    if(d->presences.contains(bareJid) && d->presences[bareJid].contains(resource))
-        return d->presences[bareJid][resource];
-    else
-    {
-        QXmppPresence presence;
-        presence.setType(QXmppPresence::Unavailable);
-        return presence;
+    QHash<QString, QMap<QString, QXmppPresence> >::const_iterator it = d->presences.constFind(bareJid);
+    if (it != d->presences.constEnd()) {
+        QMap<QString, QXmppPresence>::const_iterator presence = it.value().constFind(resource);
+        if (presence != it.value().constEnd())
+            return presence.value();
     }
+
+    QXmppPresence presence;
+    presence.setType(QXmppPresence::Unavailable);
+    return presence;
+}
+
+
+/// Returns the cache used to store the roster between connections, as
+/// defined by XEP-0237: Roster Versioning.
+
+QXmppRosterCache *QXmppRosterManager::cache() const
+{
+    return d->cache;
 }
 
+/// Sets the cache used to store the roster between connections, as
+/// defined by XEP-0237: Roster Versioning.
+///
+/// The roster manager does not take ownership of the cache.
+///
+/// \param cache
+
+void QXmppRosterManager::setCache(QXmppRosterCache *cache)
+{
+    d->cache = cache;
+}
+
+/// Returns true if a presence which is the same as the one already known
+/// for the resource does not emit presenceChanged().
+
+bool QXmppRosterManager::duplicatePresenceSuppressionEnabled() const
+{
+    return d->suppressDuplicates;
+}
+
+/// Sets whether a presence which is the same as the one already known for
+/// the resource emits presenceChanged().
+///
+/// The presence is stored in either case. This is disabled by default.
+///
+/// \param enabled
+
+void QXmppRosterManager::setDuplicatePresenceSuppressionEnabled(bool enabled)
+{
+    d->suppressDuplicates = enabled;
+}
 
 /// Function to check whether the roster has been received or not.
 ///
@@ -26,6 +26,7 @@
 #define QXMPPROSTERMANAGER_H
 
 #include <QObject>
+#include <QHash>
 #include <QMap>
 #include <QStringList>
 
@@ -33,6 +34,7 @@
 #include "QXmppPresence.h"
 #include "QXmppRosterIq.h"
 
+class QXmppRosterCache;
 class QXmppRosterManagerPrivate;
 
 /// \brief The QXmppRosterManager class provides access to a connected client's roster.
@@ -58,6 +60,10 @@ class QXmppRosterManagerPrivate;
 /// entries are added, changed or removed.
 ///
 /// The presenceChanged() signal is emitted whenever the presence for a roster item changes.
+/// While the client is inactive, see QXmppClient::setActive(), presence updates are
+/// held back and only the last one for each resource is applied once the client is
+/// active again. With setDuplicatePresenceSuppressionEnabled(), a presence which
+/// is the same as the one already known for the resource is not signalled.
 ///
 /// \ingroup Managers
 
@@ -69,18 +75,27 @@ public:
     QXmppRosterManager(QXmppClient* stream);
     ~QXmppRosterManager();
 
+    QXmppRosterCache *cache() const;
+    void setCache(QXmppRosterCache *cache);
+
+    bool duplicatePresenceSuppressionEnabled() const;
+    void setDuplicatePresenceSuppressionEnabled(bool enabled);
+
     bool isRosterReceived() const;
     QStringList getRosterBareJids() const;
     QXmppRosterIq::Item getRosterEntry(const QString& bareJid) const;
+    QHash<QString, QXmppRosterIq::Item> getRosterEntries() const;
 
     QStringList getResources(const QString& bareJid) const;
     QMap<QString, QXmppPresence> getAllPresencesForBareJid(
             const QString& bareJid) const;
     QXmppPresence getPresence(const QString& bareJid,
                               const QString& resource) const;
+    QHash<QString, QMap<QString, QXmppPresence> > getAllPresences() const;
 
     /// \cond
     bool handleStanza(const QDomElement &element);
+    QList<StanzaFilter> stanzaFilters() const;
     /// \endcond
 
 public slots:
@@ -125,10 +140,10 @@ signals:
 
 private slots:
     void _q_connected();
+    void _q_activeChanged(bool active);
     void _q_disconnected();
+    void _q_iqReceived(const QXmppIq&);
     void _q_presenceReceived(const QXmppPresence&);
-    void _q_streamResumed(bool resumed);
-    void _q_streamResumeEnabled(bool enabled);
 
 private:
     QXmppRosterManagerPrivate *d;
@@ -21,6 +21,9 @@
  *
  */
 
+#include <QTimer>
+#include <QVector>
+
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
 #include "QXmppInvokable.h"
@@ -28,10 +31,120 @@
 #include "QXmppRpcIq.h"
 #include "QXmppRpcManager.h"
 
+// resolution and size of the timeout wheel
+static const int wheelTickInterval = 100;
+static const int wheelSize = 512;
+
+// the de facto XML-RPC method for boxcarring several calls in one request
+static const char *multicallMethod = "system.multicall";
+
+// fault codes for calls in a multicall, from the XML-RPC fault code
+// interoperability specification
+static const int invalidRequestFault = -32600;
+static const int methodNotFoundFault = -32601;
+static const int applicationFault = -32500;
+
+// Builds the fault returned for a call in a multicall.
+static QVariant multicallFault(int code, const QString &message)
+{
+    QVariantMap fault;
+    fault.insert(QLatin1String("faultCode"), code);
+    fault.insert(QLatin1String("faultString"), message);
+    return fault;
+}
+
+class QXmppRpcManagerPrivate
+{
+public:
+    struct QueuedCall
+    {
+        QXmppRpcInvokeIq iq;
+        int timeout;
+    };
+
+    struct Multicall
+    {
+        QStringList ids;
+        int pending;
+    };
+
+    QXmppRpcManagerPrivate();
+    void schedule(const QString &id, int timeout);
+
+    bool batchingEnabled;
+    int callTimeout;
+    bool multicallEnabled;
+
+    // calls waiting to be sent
+    QList<QueuedCall> queue;
+    QTimer *queueTimer;
+
+    // calls in flight, with the tick at which they expire or -1
+    QHash<QString, qint64> calls;
+
+    // multicall requests in flight, and the request carrying each call
+    QHash<QString, Multicall> multicalls;
+    QHash<QString, QString> multicallIds;
+
+    // the timeout wheel, each slot holds the calls which expire at a tick
+    // equal to the slot modulo the wheel's size
+    QVector<QStringList> wheel;
+    qint64 currentTick;
+    QTimer *wheelTimer;
+};
+
+QXmppRpcManagerPrivate::QXmppRpcManagerPrivate()
+    : batchingEnabled(false)
+    , callTimeout(30000)
+    , multicallEnabled(false)
+    , queueTimer(0)
+    , wheel(wheelSize)
+    , currentTick(0)
+    , wheelTimer(0)
+{
+}
+
+void QXmppRpcManagerPrivate::schedule(const QString &id, int timeout)
+{
+    if (timeout <= 0) {
+        calls.insert(id, -1);
+        return;
+    }
+
+    const qint64 deadline = currentTick + (timeout + wheelTickInterval - 1) / wheelTickInterval;
+    calls.insert(id, deadline);
+    wheel[deadline % wheelSize] << id;
+    if (!wheelTimer->isActive())
+        wheelTimer->start();
+}
+
 /// Constructs a QXmppRpcManager.
 
 QXmppRpcManager::QXmppRpcManager()
+    : d(new QXmppRpcManagerPrivate)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->queueTimer = new QTimer(this);
+    d->queueTimer->setInterval(0);
+    d->queueTimer->setSingleShot(true);
+    check = connect(d->queueTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_sendQueued()));
+    Q_ASSERT(check);
+
+    d->wheelTimer = new QTimer(this);
+    d->wheelTimer->setInterval(wheelTickInterval);
+    check = connect(d->wheelTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_tick()));
+    Q_ASSERT(check);
+}
+
+/// Destroys a QXmppRpcManager.
+
+QXmppRpcManager::~QXmppRpcManager()
 {
+    delete d;
 }
 
 /// Adds a local interface which can be queried using RPC.
@@ -40,38 +153,224 @@ QXmppRpcManager::QXmppRpcManager()
 
 void QXmppRpcManager::addInvokableInterface( QXmppInvokable *interface )
 {
+    // build the interface's method table now rather than on the first call
+    interface->invokableClass();
     m_interfaces[ interface->metaObject()->className() ] = interface;
 }
 
-/// Invokes a remote interface using RPC.
+/// Returns the default timeout for remote method calls in milliseconds.
 ///
-/// \param iq
+/// The default value is 30000.
 
-void QXmppRpcManager::invokeInterfaceMethod( const QXmppRpcInvokeIq &iq )
+int QXmppRpcManager::callTimeout() const
 {
-    QXmppStanza::Error error;
+    return d->callTimeout;
+}
+
+/// Sets the default timeout for remote method calls in milliseconds.
+///
+/// A value of 0 disables the timeout.
+///
+/// \param timeout
+
+void QXmppRpcManager::setCallTimeout(int timeout)
+{
+    d->callTimeout = timeout;
+}
+
+/// Returns true if calls are batched.
+
+bool QXmppRpcManager::isBatchingEnabled() const
+{
+    return d->batchingEnabled;
+}
+
+/// Sets whether calls should be batched.
+///
+/// If batching is enabled, the calls made by invokeRemoteMethod() are queued
+/// and sent together once control returns to the event loop, so that they
+/// are written to the network at once.
+///
+/// \param enabled
+
+void QXmppRpcManager::setBatchingEnabled(bool enabled)
+{
+    d->batchingEnabled = enabled;
+    if (!enabled)
+        _q_sendQueued();
+}
+
+/// Returns the time in milliseconds during which batched calls are
+/// collected before being sent.
+///
+/// The default value is 0.
+
+int QXmppRpcManager::batchInterval() const
+{
+    return d->queueTimer->interval();
+}
+
+/// Sets the time in milliseconds during which batched calls are collected
+/// before being sent.
+///
+/// The window starts with the first queued call, so a steady flow of calls
+/// does not hold back the queue indefinitely. A value of 0 sends the calls
+/// as soon as control returns to the event loop.
+///
+/// \param interval
+
+void QXmppRpcManager::setBatchInterval(int interval)
+{
+    d->queueTimer->setInterval(qMax(0, interval));
+}
+
+/// Returns true if batched calls to the same peer are coalesced into a
+/// single "system.multicall" request.
+
+bool QXmppRpcManager::isMulticallEnabled() const
+{
+    return d->multicallEnabled;
+}
+
+/// Sets whether batched calls to the same peer should be coalesced into a
+/// single "system.multicall" request.
+///
+/// This only has an effect if batching is enabled, and requires the peers
+/// to support "system.multicall", as QXmppRpcManager does. The calls are
+/// still reported individually by remoteMethodFinished().
+///
+/// \param enabled
+
+void QXmppRpcManager::setMulticallEnabled(bool enabled)
+{
+    d->multicallEnabled = enabled;
+}
+
+/// Calls a remote method using RPC without blocking.
+///
+/// Once the call completes, the remoteMethodFinished() signal is emitted
+/// with the returned identifier. Calls which fail locally or time out are
+/// reported with an error code of -1.
+///
+/// \param jid the JID of the remote entity
+/// \param method the method name, in the form "Interface.method"
+/// \param args the method's arguments
+/// \param timeout the call's timeout in milliseconds, -1 to use
+/// callTimeout() or 0 for no timeout
+///
+/// \return the identifier of the call, or an empty string if it could
+/// not be sent
+
+QString QXmppRpcManager::invokeRemoteMethod(const QString &jid, const QString &method, const QVariantList &args, int timeout)
+{
+    QXmppRpcInvokeIq iq;
+    iq.setTo(jid);
+    iq.setMethod(method);
+    iq.setArguments(args);
+
+    if (timeout < 0)
+        timeout = d->callTimeout;
+
+    if (d->batchingEnabled) {
+        QXmppRpcManagerPrivate::QueuedCall call;
+        call.iq = iq;
+        call.timeout = timeout;
+        d->queue << call;
+        if (!d->queueTimer->isActive())
+            d->queueTimer->start();
+        return iq.id();
+    }
+
+    return sendCall(iq, timeout) ? iq.id() : QString();
+}
+
+void QXmppRpcManager::finishCall(const QString &id, const QXmppRemoteMethodResult &result)
+{
+    // a failed multicall request fails all of its pending calls
+    if (d->multicalls.contains(id)) {
+        foreach (const QString &callId, d->multicalls.value(id).ids) {
+            if (d->calls.contains(callId))
+                finishCall(callId, result);
+        }
+        return;
+    }
+
+    const QString multicallId = d->multicallIds.take(id);
+    if (!multicallId.isEmpty()) {
+        QHash<QString, QXmppRpcManagerPrivate::Multicall>::iterator it = d->multicalls.find(multicallId);
+        if (it != d->multicalls.end() && --it->pending <= 0)
+            d->multicalls.erase(it);
+    }
+
+    // the call's slot in the timeout wheel is cleaned up lazily
+    d->calls.remove(id);
+    if (d->calls.isEmpty()) {
+        d->wheelTimer->stop();
+        for (int i = 0; i < d->wheel.size(); ++i)
+            d->wheel[i].clear();
+    }
+    emit remoteMethodFinished(id, result);
+}
 
-    const QStringList methodBits = iq.method().split('.');
-    if (methodBits.size() != 2)
+void QXmppRpcManager::finishMulticall(const QString &id, const QXmppRpcResponseIq &iq)
+{
+    if (iq.faultCode() || !iq.faultString().isEmpty()) {
+        QXmppRemoteMethodResult result;
+        result.hasError = true;
+        result.code = iq.faultCode();
+        result.errorMessage = iq.faultString();
+        finishCall(id, result);
         return;
-    const QString interface = methodBits.first();
-    const QString method = methodBits.last();
-    QXmppInvokable *iface = m_interfaces.value(interface);
+    }
+
+    // each call's result is either a single value wrapped in an array
+    // or a fault structure
+    const QStringList ids = d->multicalls.value(id).ids;
+    const QVariantList values = iq.values().value(0).toList();
+    for (int i = 0; i < ids.size(); ++i) {
+        if (!d->calls.contains(ids[i]))
+            continue;
+
+        QXmppRemoteMethodResult result;
+        const QVariant value = values.value(i);
+        if (value.type() == QVariant::List) {
+            result.result = value.toList().value(0);
+        } else if (value.type() == QVariant::Map) {
+            const QVariantMap fault = value.toMap();
+            result.hasError = true;
+            result.code = fault.value(QLatin1String("faultCode")).toInt();
+            result.errorMessage = fault.value(QLatin1String("faultString")).toString();
+        } else {
+            result.hasError = true;
+            result.code = -1;
+            result.errorMessage = QLatin1String("Invalid multicall response");
+        }
+        finishCall(ids[i], result);
+    }
+}
+
+bool QXmppRpcManager::sendCall(const QXmppRpcInvokeIq &iq, int timeout)
+{
+    if (!client()->sendPacket(iq))
+        return false;
+
+    d->schedule(iq.id(), timeout);
+    return true;
+}
+
+bool QXmppRpcManager::dispatchCall(const QString &from, const QString &method, const QVariantList &args, QVariant &result, QXmppStanza::Error &error)
+{
+    const QStringList methodBits = method.split('.');
+    QXmppInvokable *iface = methodBits.size() == 2 ? m_interfaces.value(methodBits.first()) : 0;
     if (iface)
     {
-        if ( iface->isAuthorized( iq.from() ) )
+        if ( iface->isAuthorized( from ) )
         {
 
-            if ( iface->interfaces().contains(method) )
+            if ( iface->hasInterface(methodBits.last()) )
             {
-                QVariant result = iface->dispatch(method.toLatin1(),
-                                                  iq.arguments() );
-                QXmppRpcResponseIq resultIq;
-                resultIq.setId(iq.id());
-                resultIq.setTo(iq.from());
-                resultIq.setValues(QVariantList() << result);
-                client()->sendPacket( resultIq );
-                return;
+                result = iface->dispatch(methodBits.last().toLatin1(), args);
+                return true;
             }
             else
             {
@@ -90,6 +389,35 @@ void QXmppRpcManager::invokeInterfaceMethod( const QXmppRpcInvokeIq &iq )
         error.setType(QXmppStanza::Error::Cancel);
         error.setCondition(QXmppStanza::Error::ItemNotFound);
     }
+    return false;
+}
+
+/// Invokes a remote interface using RPC.
+///
+/// \param iq
+
+void QXmppRpcManager::invokeInterfaceMethod( const QXmppRpcInvokeIq &iq )
+{
+    if (iq.method() == QLatin1String(multicallMethod)) {
+        invokeMulticall(iq);
+        return;
+    }
+
+    if (iq.method().split('.').size() != 2)
+        return;
+
+    QVariant result;
+    QXmppStanza::Error error;
+    if (dispatchCall(iq.from(), iq.method(), iq.arguments(), result, error))
+    {
+        QXmppRpcResponseIq resultIq;
+        resultIq.setId(iq.id());
+        resultIq.setTo(iq.from());
+        resultIq.setValues(QVariantList() << result);
+        client()->sendPacket( resultIq );
+        return;
+    }
+
     QXmppRpcErrorIq errorIq;
     errorIq.setId(iq.id());
     errorIq.setTo(iq.from());
@@ -98,10 +426,42 @@ void QXmppRpcManager::invokeInterfaceMethod( const QXmppRpcInvokeIq &iq )
     client()->sendPacket(errorIq);
 }
 
+/// Invokes several local interfaces for a "system.multicall" request and
+/// sends back all of the results in a single response.
+///
+/// \param iq
+
+void QXmppRpcManager::invokeMulticall(const QXmppRpcInvokeIq &iq)
+{
+    QVariantList results;
+    foreach (const QVariant &request, iq.arguments().value(0).toList())
+    {
+        const QVariantMap call = request.toMap();
+        const QString method = call.value(QLatin1String("methodName")).toString();
+
+        QVariant result;
+        QXmppStanza::Error error;
+        if (method == QLatin1String(multicallMethod))
+            results << multicallFault(invalidRequestFault, QLatin1String("Recursive system.multicall forbidden"));
+        else if (dispatchCall(iq.from(), method, call.value(QLatin1String("params")).toList(), result, error))
+            results << QVariant(QVariantList() << result);
+        else if (error.condition() == QXmppStanza::Error::Forbidden)
+            results << multicallFault(applicationFault, QLatin1String("Not authorized"));
+        else
+            results << multicallFault(methodNotFoundFault, QString("Method not found: %1").arg(method));
+    }
+
+    QXmppRpcResponseIq resultIq;
+    resultIq.setId(iq.id());
+    resultIq.setTo(iq.from());
+    resultIq.setValues(QVariantList() << QVariant(results));
+    client()->sendPacket(resultIq);
+}
+
 /// Calls a remote method using RPC with the specified arguments.
 ///
 /// \note This method blocks until the response is received, and it may
-/// cause XMPP stanzas to be lost!
+/// cause XMPP stanzas to be lost! Use invokeRemoteMethod() instead.
 
 QXmppRemoteMethodResult QXmppRpcManager::callRemoteMethod( const QString &jid,
                                           const QString &interface,
@@ -166,6 +526,22 @@ bool QXmppRpcManager::handleStanza(const QDomElement &element)
     {
         QXmppRpcResponseIq rpcResponseIq;
         rpcResponseIq.parse(element);
+        if (d->multicalls.contains(rpcResponseIq.id())) {
+            finishMulticall(rpcResponseIq.id(), rpcResponseIq);
+            return true;
+        }
+        if (d->calls.contains(rpcResponseIq.id())) {
+            QXmppRemoteMethodResult result;
+            if (rpcResponseIq.faultCode() || !rpcResponseIq.faultString().isEmpty()) {
+                result.hasError = true;
+                result.code = rpcResponseIq.faultCode();
+                result.errorMessage = rpcResponseIq.faultString();
+            } else {
+                result.result = rpcResponseIq.values().value(0);
+            }
+            finishCall(rpcResponseIq.id(), result);
+            return true;
+        }
         emit rpcCallResponse(rpcResponseIq);
         return true;
     }
@@ -173,9 +549,158 @@ bool QXmppRpcManager::handleStanza(const QDomElement &element)
     {
         QXmppRpcErrorIq rpcErrorIq;
         rpcErrorIq.parse(element);
+        if (d->calls.contains(rpcErrorIq.id()) || d->multicalls.contains(rpcErrorIq.id())) {
+            QXmppRemoteMethodResult result;
+            result.hasError = true;
+            result.code = rpcErrorIq.error().type();
+            result.errorMessage = rpcErrorIq.error().text();
+            finishCall(rpcErrorIq.id(), result);
+            return true;
+        }
         emit rpcCallError(rpcErrorIq);
         return true;
     }
     return false;
 }
+
+void QXmppRpcManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(sessionEnded()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(iqReceived(QXmppIq)),
+                    this, SLOT(_q_iqReceived(QXmppIq)));
+    Q_ASSERT(check);
+}
 /// \endcond
+
+void QXmppRpcManager::_q_disconnected()
+{
+    QXmppRemoteMethodResult result;
+    result.hasError = true;
+    result.code = -1;
+    result.errorMessage = QLatin1String("Disconnected from server");
+
+    QStringList ids = d->calls.keys();
+    foreach (const QXmppRpcManagerPrivate::QueuedCall &call, d->queue)
+        ids << call.iq.id();
+    d->queue.clear();
+    d->queueTimer->stop();
+
+    foreach (const QString &id, ids)
+        finishCall(id, result);
+}
+
+void QXmppRpcManager::_q_iqReceived(const QXmppIq &iq)
+{
+    // errors which carry no query are not handled by handleStanza()
+    if (iq.type() == QXmppIq::Error &&
+        (d->calls.contains(iq.id()) || d->multicalls.contains(iq.id()))) {
+        QXmppRemoteMethodResult result;
+        result.hasError = true;
+        result.code = iq.error().type();
+        result.errorMessage = iq.error().text();
+        finishCall(iq.id(), result);
+    }
+}
+
+void QXmppRpcManager::_q_sendQueued()
+{
+    const QList<QXmppRpcManagerPrivate::QueuedCall> queue = d->queue;
+    d->queue.clear();
+    d->queueTimer->stop();
+
+    QXmppRemoteMethodResult failure;
+    failure.hasError = true;
+    failure.code = -1;
+    failure.errorMessage = QLatin1String("Could not send remote method call");
+
+    if (!d->multicallEnabled) {
+        foreach (const QXmppRpcManagerPrivate::QueuedCall &call, queue) {
+            if (!sendCall(call.iq, call.timeout))
+                emit remoteMethodFinished(call.iq.id(), failure);
+        }
+        return;
+    }
+
+    // group the calls by recipient, in the order they were made
+    QStringList peers;
+    QHash<QString, QList<QXmppRpcManagerPrivate::QueuedCall> > peerCalls;
+    foreach (const QXmppRpcManagerPrivate::QueuedCall &call, queue) {
+        if (!peerCalls.contains(call.iq.to()))
+            peers << call.iq.to();
+        peerCalls[call.iq.to()] << call;
+    }
+
+    foreach (const QString &peer, peers) {
+        const QList<QXmppRpcManagerPrivate::QueuedCall> calls = peerCalls.value(peer);
+        if (calls.size() == 1) {
+            if (!sendCall(calls.first().iq, calls.first().timeout))
+                emit remoteMethodFinished(calls.first().iq.id(), failure);
+            continue;
+        }
+
+        QVariantList requests;
+        foreach (const QXmppRpcManagerPrivate::QueuedCall &call, calls) {
+            QVariantMap request;
+            request.insert(QLatin1String("methodName"), call.iq.method());
+            request.insert(QLatin1String("params"), call.iq.arguments());
+            requests << request;
+        }
+
+        QXmppRpcInvokeIq iq;
+        iq.setTo(peer);
+        iq.setMethod(QLatin1String(multicallMethod));
+        iq.setArguments(QVariantList() << QVariant(requests));
+        if (!client()->sendPacket(iq)) {
+            foreach (const QXmppRpcManagerPrivate::QueuedCall &call, calls)
+                emit remoteMethodFinished(call.iq.id(), failure);
+            continue;
+        }
+
+        // each call keeps its own timeout
+        QXmppRpcManagerPrivate::Multicall multicall;
+        multicall.pending = calls.size();
+        foreach (const QXmppRpcManagerPrivate::QueuedCall &call, calls) {
+            multicall.ids << call.iq.id();
+            d->multicallIds.insert(call.iq.id(), iq.id());
+            d->schedule(call.iq.id(), call.timeout);
+        }
+        d->multicalls.insert(iq.id(), multicall);
+    }
+}
+
+void QXmppRpcManager::_q_tick()
+{
+    d->currentTick++;
+
+    QStringList expired;
+    QStringList &slot = d->wheel[d->currentTick % wheelSize];
+    QStringList::iterator it = slot.begin();
+    while (it != slot.end()) {
+        const qint64 deadline = d->calls.value(*it, -1);
+        if (deadline < 0) {
+            // the call already finished
+            it = slot.erase(it);
+        } else if (deadline <= d->currentTick) {
+            expired << *it;
+            it = slot.erase(it);
+        } else {
+            // the call expires on a later turn of the wheel
+            ++it;
+        }
+    }
+
+    QXmppRemoteMethodResult result;
+    result.hasError = true;
+    result.code = -1;
+    result.errorMessage = QLatin1String("Remote method call timed out");
+    foreach (const QString &id, expired)
+        finishCall(id, result);
+}
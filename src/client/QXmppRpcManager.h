@@ -33,6 +33,7 @@
 
 class QXmppRpcErrorIq;
 class QXmppRpcInvokeIq;
+class QXmppRpcManagerPrivate;
 class QXmppRpcResponseIq;
 
 /// \brief The QXmppRpcManager class make it possible to invoke remote methods
@@ -47,6 +48,13 @@ class QXmppRpcResponseIq;
 /// client->addExtension(manager);
 /// \endcode
 ///
+/// Remote methods are best called using invokeRemoteMethod(), which returns
+/// immediately. Any number of calls can be in flight at the same time, and
+/// the remoteMethodFinished() signal reports the outcome of each call.
+///
+/// With setMulticallEnabled(true), batched calls to the same peer are
+/// coalesced into a single "system.multicall" request.
+///
 /// \note THIS API IS NOT FINALIZED YET
 ///
 /// \ingroup Managers
@@ -57,8 +65,27 @@ class QXMPP_EXPORT QXmppRpcManager : public QXmppClientExtension
 
 public:
     QXmppRpcManager();
+    ~QXmppRpcManager();
 
     void addInvokableInterface( QXmppInvokable *interface );
+
+    QString invokeRemoteMethod(const QString &jid,
+                               const QString &method,
+                               const QVariantList &args = QVariantList(),
+                               int timeout = -1);
+
+    int callTimeout() const;
+    void setCallTimeout(int timeout);
+
+    bool isBatchingEnabled() const;
+    void setBatchingEnabled(bool enabled);
+
+    int batchInterval() const;
+    void setBatchInterval(int interval);
+
+    bool isMulticallEnabled() const;
+    void setMulticallEnabled(bool enabled);
+
     QXmppRemoteMethodResult callRemoteMethod( const QString &jid,
                                               const QString &interface,
                                               const QVariant &arg1 = QVariant(),
@@ -79,15 +106,39 @@ public:
     /// \endcond
 
 signals:
+    /// This signal is emitted when a call started with invokeRemoteMethod()
+    /// completes, fails or times out.
+    ///
+    /// \param id the identifier returned by invokeRemoteMethod()
+    /// \param result the result of the call
+    void remoteMethodFinished(const QString &id, const QXmppRemoteMethodResult &result);
+
     /// \cond
     void rpcCallResponse(const QXmppRpcResponseIq& result);
     void rpcCallError(const QXmppRpcErrorIq &err);
     /// \endcond
 
+protected:
+    /// \cond
+    void setClient(QXmppClient *client);
+    /// \endcond
+
+private slots:
+    void _q_disconnected();
+    void _q_iqReceived(const QXmppIq &iq);
+    void _q_sendQueued();
+    void _q_tick();
+
 private:
+    bool dispatchCall(const QString &from, const QString &method, const QVariantList &args, QVariant &result, QXmppStanza::Error &error);
+    void finishCall(const QString &id, const QXmppRemoteMethodResult &result);
+    void finishMulticall(const QString &id, const QXmppRpcResponseIq &iq);
     void invokeInterfaceMethod(const QXmppRpcInvokeIq &iq);
+    void invokeMulticall(const QXmppRpcInvokeIq &iq);
+    bool sendCall(const QXmppRpcInvokeIq &iq, int timeout);
 
     QMap<QString,QXmppInvokable*> m_interfaces;
+    QXmppRpcManagerPrivate *d;
 };
 
 #endif
@@ -47,6 +47,9 @@ class QXmppSimpleArchiveQueryIq;
 /// \note Few servers support message archiving. Check if the server in use supports
 /// this XEP.
 ///
+/// \sa QXmppMamManager, which delivers messages as they arrive and pages
+/// through the archive on its own.
+///
 /// \ingroup Managers
 
 class QXMPP_EXPORT QXmppSimpleArchiveManager : public QXmppClientExtension
@@ -22,20 +22,30 @@
  */
 
 #include <QCryptographicHash>
+#include <QDateTime>
 #include <QDomElement>
 #include <QFile>
 #include <QFileInfo>
 #include <QHash>
 #include <QHostAddress>
+#include <QMutex>
 #include <QNetworkInterface>
+#include <QSet>
+#include <QThreadPool>
 #include <QTime>
 #include <QTimer>
 #include <QUrl>
 
+#include "QXmppBase64_p.h"
 #include "QXmppByteStreamIq.h"
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
+#include "QXmppDatagramStream_p.h"
 #include "QXmppIbbIq.h"
+#include "QXmppJingleIq.h"
+#include "QXmppMessage.h"
+#include "QXmppPingIq.h"
+#include "QXmppReadBuffer_p.h"
 #include "QXmppSocks.h"
 #include "QXmppStreamInitiationIq_p.h"
 #include "QXmppStun.h"
@@ -46,6 +56,16 @@
 // time to try to connect to a SOCKS host (7 seconds)
 const int socksTimeout = 7000;
 
+// delay before trying the next SOCKS host while the previous attempts are
+// still in progress (200 ms)
+const int socksStaggerDelay = 200;
+
+// maximum number of SOCKS hosts which are tried at the same time
+const int socksParallelAttempts = 4;
+
+// the ICE component which carries Jingle file transfers
+const int jingleComponent = 1;
+
 static QString streamHash(const QString &sid, const QString &initiatorJid, const QString &targetJid)
 {
     QCryptographicHash hash(QCryptographicHash::Sha1);
@@ -54,6 +74,69 @@ static QString streamHash(const QString &sid, const QString &initiatorJid, const
     return hash.result().toHex();
 }
 
+static void addTextElement(QXmppElement &parent, const QString &name, const QString &value)
+{
+    QXmppElement element;
+    element.setTagName(name);
+    element.setValue(value);
+    parent.appendChild(element);
+}
+
+// Builds the XEP-0234 description of a file.
+
+static QXmppElement jingleFileElement(const QXmppTransferFileInfo &info)
+{
+    QXmppElement file;
+    file.setTagName("file");
+    if (info.date().isValid())
+        addTextElement(file, "date", QXmppUtils::datetimeToString(info.date()));
+    if (!info.description().isEmpty())
+        addTextElement(file, "desc", info.description());
+    if (!info.hash().isEmpty()) {
+        QXmppElement hash;
+        hash.setTagName("hash");
+        hash.setAttribute("xmlns", ns_hashes);
+        hash.setAttribute("algo", "md5");
+        hash.setValue(QString::fromLatin1(info.hash().toBase64()));
+        file.appendChild(hash);
+    }
+    if (!info.name().isEmpty())
+        addTextElement(file, "name", info.name());
+    if (info.isRangeSupported() || info.rangeOffset() > 0) {
+        QXmppElement range;
+        range.setTagName("range");
+        if (info.rangeOffset() > 0)
+            range.setAttribute("offset", QString::number(info.rangeOffset()));
+        file.appendChild(range);
+    }
+    if (info.size() > 0)
+        addTextElement(file, "size", QString::number(info.size()));
+    return file;
+}
+
+// Reads the XEP-0234 description of a file.
+
+static QXmppTransferFileInfo jingleFileInfo(const QXmppElement &file)
+{
+    QXmppTransferFileInfo info;
+    info.setDate(QXmppUtils::datetimeFromString(file.firstChildElement("date").value()));
+    info.setDescription(file.firstChildElement("desc").value());
+    info.setName(file.firstChildElement("name").value());
+    info.setSize(file.firstChildElement("size").value().toLongLong());
+
+    QXmppElement hash = file.firstChildElement("hash");
+    while (!hash.isNull()) {
+        if (hash.attribute("algo") == QLatin1String("md5"))
+            info.setHash(QByteArray::fromBase64(hash.value().toLatin1()));
+        hash = hash.nextSiblingElement("hash");
+    }
+
+    QXmppElement range = file.firstChildElement("range");
+    info.setRangeSupported(!range.isNull());
+    info.setRangeOffset(range.attribute("offset").toLongLong());
+    return info;
+}
+
 class QXmppTransferFileInfoPrivate : public QSharedData
 {
 public:
@@ -64,10 +147,14 @@ public:
     QString name;
     QString description;
     qint64 size;
+    bool rangeSupported;
+    qint64 rangeOffset;
 };
 
 QXmppTransferFileInfoPrivate::QXmppTransferFileInfoPrivate()
     : size(0)
+    , rangeSupported(false)
+    , rangeOffset(0)
 {
 }
 
@@ -135,13 +222,49 @@ void QXmppTransferFileInfo::setSize(qint64 size)
     d->size = size;
 }
 
+/// Returns whether the sender can send the file from an offset, which
+/// allows interrupted transfers to be resumed.
+
+bool QXmppTransferFileInfo::isRangeSupported() const
+{
+    return d->rangeSupported;
+}
+
+/// Sets whether the sender can send the file from an offset, which allows
+/// interrupted transfers to be resumed.
+///
+/// \param supported
+
+void QXmppTransferFileInfo::setRangeSupported(bool supported)
+{
+    d->rangeSupported = supported;
+}
+
+/// Returns the offset from which the receiver asks the file to be sent.
+
+qint64 QXmppTransferFileInfo::rangeOffset() const
+{
+    return d->rangeOffset;
+}
+
+/// Sets the offset from which the receiver asks the file to be sent.
+///
+/// \param offset
+
+void QXmppTransferFileInfo::setRangeOffset(qint64 offset)
+{
+    d->rangeOffset = offset;
+}
+
 bool QXmppTransferFileInfo::isNull() const
 {
     return d->date.isNull()
         && d->description.isEmpty()
         && d->hash.isEmpty()
         && d->name.isEmpty()
-        && d->size == 0;
+        && d->size == 0
+        && !d->rangeSupported
+        && d->rangeOffset == 0;
 }
 
 QXmppTransferFileInfo& QXmppTransferFileInfo::operator=(const QXmppTransferFileInfo &other)
@@ -164,6 +287,10 @@ void QXmppTransferFileInfo::parse(const QDomElement &element)
     d->name = element.attribute("name");
     d->size = element.attribute("size").toLongLong();
     d->description = element.firstChildElement("desc").text();
+
+    QDomElement rangeElement = element.firstChildElement("range");
+    d->rangeSupported = !rangeElement.isNull();
+    d->rangeOffset = rangeElement.attribute("offset").toLongLong();
 }
 
 void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
@@ -180,13 +307,46 @@ void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
         writer->writeAttribute("size", QString::number(d->size));
     if (!d->description.isEmpty())
         writer->writeTextElement("desc", d->description);
+    if (d->rangeSupported || d->rangeOffset > 0) {
+        writer->writeStartElement("range");
+        if (d->rangeOffset > 0)
+            writer->writeAttribute("offset", QString::number(d->rangeOffset));
+        writer->writeEndElement();
+    }
     writer->writeEndElement();
 }
 
+// The jobs of a transfer manager, indexed by the stream they carry and by
+// the requests awaiting an answer, so that each incoming stanza is matched
+// to its job without going through all of them.
+class QXmppTransferJobIndex
+{
+public:
+    static QString streamKey(QXmppTransferJob::Direction direction, const QString &jid, const QString &sid);
+
+    QHash<QString, QXmppTransferJob*> requests;
+    QHash<QString, QXmppTransferJob*> streams;
+};
+
+QString QXmppTransferJobIndex::streamKey(QXmppTransferJob::Direction direction, const QString &jid, const QString &sid)
+{
+    return QString::number(direction) + QLatin1Char('/') + sid + QLatin1Char('/') + jid;
+}
+
 class QXmppTransferJobPrivate
 {
 public:
-    QXmppTransferJobPrivate();
+    QXmppTransferJobPrivate(QXmppTransferJob *qq);
+
+    void attach(QXmppTransferJobIndex *jobIndex);
+    void detach();
+    void setRequestId(const QString &id);
+    void addIbbRequestId(const QString &id);
+    void removeIbbRequestId(const QString &id);
+    void clearIbbRequestIds();
+    QIODevice *dataStream() const;
+    QXmppJingleIq::Content localContent(bool newCandidatesOnly);
+    void stopJingle();
 
     int blockSize;
     QXmppClient *client;
@@ -204,19 +364,49 @@ public:
     QString requestId;
     QXmppTransferJob::State state;
     QTime transferStart;
+    // the offset from which the file is transferred
+    qint64 rangeOffset;
 
     // file meta-data
     QXmppTransferFileInfo fileInfo;
 
     // for in-band bytestreams
     int ibbSequence;
+    // the data IQs or, when sending in messages, the ping awaiting an answer
+    QStringList ibbRequestIds;
+    bool ibbMessages;
 
     // for socks5 bytestreams
     QTcpSocket *socksSocket;
     QXmppByteStreamIq::StreamHost socksProxy;
+
+    // for jingle sessions
+    QXmppIceConnection *iceConnection;
+    QXmppDatagramStream *datagramStream;
+    // the content offered by the remote party, until the job is accepted
+    QXmppJingleIq::Content jingleOffer;
+    // the IDs of the local candidates sent to the remote party
+    QSet<QString> jingleCandidates;
+    // whether the remote party expects the session to be terminated
+    bool jingleActive;
+
+    // the file being sent if it could be mapped, otherwise a buffer for
+    // the data read from the IO device
+    const uchar *sendMap;
+    qint64 sendMapOffset;
+    qint64 sendMapSize;
+    QByteArray sendBuffer;
+    qint64 sendChunkSize;
+
+    // the manager's index, once the job is registered
+    QXmppTransferJobIndex *index;
+
+private:
+    void unindexRequest(const QString &id);
+    QXmppTransferJob *q;
 };
 
-QXmppTransferJobPrivate::QXmppTransferJobPrivate()
+QXmppTransferJobPrivate::QXmppTransferJobPrivate(QXmppTransferJob *qq)
     : blockSize(16384),
     client(0),
     done(0),
@@ -225,14 +415,162 @@ QXmppTransferJobPrivate::QXmppTransferJobPrivate()
     iodevice(0),
     method(QXmppTransferJob::NoMethod),
     state(QXmppTransferJob::OfferState),
+    rangeOffset(0),
     ibbSequence(0),
-    socksSocket(0)
+    ibbMessages(false),
+    socksSocket(0),
+    iceConnection(0),
+    datagramStream(0),
+    jingleActive(false),
+    sendMap(0),
+    sendMapOffset(0),
+    sendMapSize(0),
+    sendChunkSize(0),
+    index(0),
+    q(qq)
+{
+}
+
+// Registers the job's stream and pending requests in the given index.
+
+void QXmppTransferJobPrivate::attach(QXmppTransferJobIndex *jobIndex)
+{
+    index = jobIndex;
+
+    // a peer reusing a stream ID keeps talking to the first job
+    const QString key = QXmppTransferJobIndex::streamKey(direction, jid, sid);
+    if (!index->streams.contains(key))
+        index->streams.insert(key, q);
+
+    if (!requestId.isEmpty())
+        index->requests.insert(requestId, q);
+    foreach (const QString &id, ibbRequestIds)
+        index->requests.insert(id, q);
+}
+
+// Removes the job from its index.
+
+void QXmppTransferJobPrivate::detach()
+{
+    if (!index)
+        return;
+
+    const QString key = QXmppTransferJobIndex::streamKey(direction, jid, sid);
+    if (index->streams.value(key) == q)
+        index->streams.remove(key);
+
+    QStringList ids = ibbRequestIds;
+    ids << requestId;
+    foreach (const QString &id, ids) {
+        if (index->requests.value(id) == q)
+            index->requests.remove(id);
+    }
+
+    index = 0;
+}
+
+// Sets the ID of the last request sent for the job.
+
+void QXmppTransferJobPrivate::setRequestId(const QString &id)
+{
+    const QString oldId = requestId;
+    requestId = id;
+    if (index && !id.isEmpty())
+        index->requests.insert(id, q);
+    unindexRequest(oldId);
+}
+
+// Adds a request to the in-band bytestream's window.
+
+void QXmppTransferJobPrivate::addIbbRequestId(const QString &id)
+{
+    ibbRequestIds << id;
+    if (index)
+        index->requests.insert(id, q);
+}
+
+// Removes an answered request from the in-band bytestream's window.
+
+void QXmppTransferJobPrivate::removeIbbRequestId(const QString &id)
+{
+    ibbRequestIds.removeAll(id);
+    unindexRequest(id);
+}
+
+// Empties the in-band bytestream's window.
+
+void QXmppTransferJobPrivate::clearIbbRequestIds()
+{
+    const QStringList oldIds = ibbRequestIds;
+    ibbRequestIds.clear();
+    foreach (const QString &id, oldIds)
+        unindexRequest(id);
+}
+
+// Returns the device which carries the file's data.
+
+QIODevice *QXmppTransferJobPrivate::dataStream() const
+{
+    if (datagramStream)
+        return datagramStream;
+    return socksSocket;
+}
+
+// Returns the content describing the Jingle session, with the local
+// transport.
+
+QXmppJingleIq::Content QXmppTransferJobPrivate::localContent(bool newCandidatesOnly)
+{
+    QXmppJingleIq::Content content;
+    content.setCreator("initiator");
+    content.setName("file");
+    content.setSenders("initiator");
+    content.setTransportUser(iceConnection->localUser());
+    content.setTransportPassword(iceConnection->localPassword());
+
+    // remember which candidates were sent, so that only the new ones
+    // are trickled in a transport-info
+    QList<QXmppJingleCandidate> candidates;
+    foreach (const QXmppJingleCandidate &candidate, iceConnection->localCandidates()) {
+        if (!newCandidatesOnly || !jingleCandidates.contains(candidate.id()))
+            candidates << candidate;
+        jingleCandidates.insert(candidate.id());
+    }
+    content.setTransportCandidates(candidates);
+    return content;
+}
+
+// Drops the Jingle session, when the remote party did not accept it.
+
+void QXmppTransferJobPrivate::stopJingle()
+{
+    jingleActive = false;
+    jingleCandidates.clear();
+    if (datagramStream) {
+        datagramStream->close();
+        datagramStream->deleteLater();
+        datagramStream = 0;
+    }
+    if (iceConnection) {
+        iceConnection->close();
+        iceConnection->deleteLater();
+        iceConnection = 0;
+    }
+}
+
+// Removes a request ID from the index once the job no longer waits for it.
+
+void QXmppTransferJobPrivate::unindexRequest(const QString &id)
 {
+    if (index && !id.isEmpty() && id != requestId &&
+        !ibbRequestIds.contains(id) &&
+        index->requests.value(id) == q)
+        index->requests.remove(id);
 }
 
 QXmppTransferJob::QXmppTransferJob(const QString &jid, QXmppTransferJob::Direction direction, QXmppClient *client, QObject *parent)
     : QXmppLoggable(parent),
-    d(new QXmppTransferJobPrivate)
+    d(new QXmppTransferJobPrivate(this))
 {
     d->client = client;
     d->direction = direction;
@@ -241,6 +579,7 @@ QXmppTransferJob::QXmppTransferJob(const QString &jid, QXmppTransferJob::Directi
 
 QXmppTransferJob::~QXmppTransferJob()
 {
+    d->detach();
     delete d;
 }
 
@@ -285,6 +624,84 @@ void QXmppTransferJob::accept(QIODevice *iodevice)
     }
 }
 
+/// Call this method if you wish to accept an incoming transfer job, and
+/// keep the part of the file which was received by an earlier transfer.
+///
+/// If the file at \a filePath is shorter than the offered file and the
+/// sender supports ranged transfers, only the rest of the file is
+/// requested. Otherwise the whole file is received again.
+///
+/// \note If the offer carries a hash, the data already received is read
+/// back to check the file once the transfer is complete.
+
+void QXmppTransferJob::resume(const QString &filePath)
+{
+    if (d->direction == IncomingDirection && d->state == OfferState && !d->iodevice)
+    {
+        QFile *file = new QFile(filePath, this);
+        if (!file->open(QIODevice::ReadWrite))
+        {
+            warning(QString("Could not write to %1").arg(filePath));
+            abort();
+            return;
+        }
+
+        setLocalFileUrl(QUrl::fromLocalFile(filePath));
+        resume(file);
+    }
+}
+
+/// Call this method if you wish to accept an incoming transfer job, and
+/// keep the data which \a output already contains.
+///
+/// If \a output is readable, random-access and shorter than the offered
+/// file, and the sender supports ranged transfers, only the rest of the
+/// file is requested and it is appended to \a output. Otherwise the file
+/// is written from the start of \a output.
+
+void QXmppTransferJob::resume(QIODevice *iodevice)
+{
+    if (d->direction == IncomingDirection && d->state == OfferState && !d->iodevice)
+    {
+        qint64 offset = 0;
+        if (iodevice->isReadable() && !iodevice->isSequential() &&
+            d->fileInfo.isRangeSupported() &&
+            iodevice->size() < d->fileInfo.size())
+        {
+            offset = iodevice->size();
+
+            // hash the data which was already received
+            if (!d->fileInfo.hash().isEmpty())
+            {
+                QByteArray buffer;
+                iodevice->seek(0);
+                while (iodevice->pos() < offset)
+                {
+                    buffer = iodevice->read(qMin(offset - iodevice->pos(), qint64(1048576)));
+                    if (buffer.isEmpty())
+                        break;
+                    d->hash.addData(buffer);
+                }
+                if (iodevice->pos() != offset)
+                {
+                    warning("Could not read the data which was already received");
+                    d->hash.reset();
+                    offset = 0;
+                }
+            }
+        }
+
+        QFile *file = qobject_cast<QFile*>(iodevice);
+        if (!offset && file)
+            file->resize(0);
+        iodevice->seek(offset);
+
+        d->done = offset;
+        d->rangeOffset = offset;
+        accept(iodevice);
+    }
+}
+
 /// Returns the job's transfer direction.
 ///
 
@@ -408,6 +825,33 @@ void QXmppTransferJob::setState(QXmppTransferJob::State state)
     }
 }
 
+void QXmppTransferJob::_q_iceDisconnected()
+{
+    if (d->state == QXmppTransferJob::FinishedState)
+        return;
+
+    warning(QString("ICE connection lost for transfer %1").arg(d->sid));
+    terminate(QXmppTransferJob::ProtocolError);
+}
+
+void QXmppTransferJob::_q_localCandidatesChanged()
+{
+    if (!d->jingleActive || !d->iceConnection)
+        return;
+
+    const QXmppJingleIq::Content content = d->localContent(true);
+    if (content.transportCandidates().isEmpty())
+        return;
+
+    QXmppJingleIq iq;
+    iq.setTo(d->jid);
+    iq.setType(QXmppIq::Set);
+    iq.setAction(QXmppJingleIq::TransportInfo);
+    iq.setSid(d->sid);
+    iq.addContent(content);
+    d->client->sendPacket(iq);
+}
+
 void QXmppTransferJob::_q_terminated()
 {
     emit stateChanged(d->state);
@@ -421,6 +865,28 @@ void QXmppTransferJob::terminate(QXmppTransferJob::Error cause)
     if (d->state == FinishedState)
         return;
 
+    // end the Jingle session
+    if (d->jingleActive) {
+        QXmppJingleIq::Reason::Type reason = QXmppJingleIq::Reason::FailedApplication;
+        if (cause == NoError)
+            reason = QXmppJingleIq::Reason::Success;
+        else if (cause == AbortError && d->direction == IncomingDirection && d->state == OfferState)
+            reason = QXmppJingleIq::Reason::Decline;
+        else if (cause == AbortError)
+            reason = QXmppJingleIq::Reason::Cancel;
+        else if (cause == ProtocolError)
+            reason = QXmppJingleIq::Reason::FailedTransport;
+
+        QXmppJingleIq iq;
+        iq.setTo(d->jid);
+        iq.setType(QXmppIq::Set);
+        iq.setAction(QXmppJingleIq::SessionTerminate);
+        iq.setSid(d->sid);
+        iq.reason().setType(reason);
+        d->client->sendPacket(iq);
+        d->jingleActive = false;
+    }
+
     // change state
     d->error = cause;
     d->state = FinishedState;
@@ -436,6 +902,12 @@ void QXmppTransferJob::terminate(QXmppTransferJob::Error cause)
         d->socksSocket->close();
     }
 
+    // close ICE connection
+    if (d->datagramStream)
+        d->datagramStream->close();
+    if (d->iceConnection)
+        d->iceConnection->close();
+
     // emit signals later
     QTimer::singleShot(0, this, SLOT(_q_terminated()));
 }
@@ -443,7 +915,6 @@ void QXmppTransferJob::terminate(QXmppTransferJob::Error cause)
 /// \cond
 QXmppTransferIncomingJob::QXmppTransferIncomingJob(const QString& jid, QXmppClient* client, QObject* parent)
     : QXmppTransferJob(jid, IncomingDirection, client, parent)
-    , m_candidateClient(0)
     , m_candidateTimer(0)
 {
 }
@@ -462,7 +933,14 @@ void QXmppTransferIncomingJob::connectToNextHost()
     bool check;
     Q_UNUSED(check);
 
+    if (d->state == QXmppTransferJob::FinishedState)
+        return;
+
     if (m_streamCandidates.isEmpty()) {
+        // wait for the attempts in progress
+        if (!m_candidates.isEmpty())
+            return;
+
         // could not connect to any stream host
         QXmppByteStreamIq response;
         response.setId(m_streamOfferId);
@@ -478,35 +956,41 @@ void QXmppTransferIncomingJob::connectToNextHost()
     }
 
     // try next host
-    m_candidateHost = m_streamCandidates.takeFirst();
+    Candidate candidate;
+    candidate.host = m_streamCandidates.takeFirst();
     info(QString("Connecting to streamhost: %1 (%2 %3)").arg(
-            m_candidateHost.jid(),
-            m_candidateHost.host(),
-            QString::number(m_candidateHost.port())));
+            candidate.host.jid(),
+            candidate.host.host(),
+            QString::number(candidate.host.port())));
 
     const QString hostName = streamHash(d->sid,
                                         d->jid,
                                         d->client->configuration().jid());
 
     // try to connect to stream host
-    m_candidateClient = new QXmppSocksClient(m_candidateHost.host(), m_candidateHost.port(), this);
-    m_candidateTimer = new QTimer(this);
+    candidate.client = new QXmppSocksClient(candidate.host.host(), candidate.host.port(), this);
+    candidate.timer = new QTimer(this);
 
-    check = connect(m_candidateClient, SIGNAL(disconnected()),
+    check = connect(candidate.client, SIGNAL(disconnected()),
                     this, SLOT(_q_candidateDisconnected()));
     Q_ASSERT(check);
 
-    check = connect(m_candidateClient, SIGNAL(ready()),
+    check = connect(candidate.client, SIGNAL(ready()),
                     this, SLOT(_q_candidateReady()));
     Q_ASSERT(check);
 
-    check = connect(m_candidateTimer, SIGNAL(timeout()),
+    check = connect(candidate.timer, SIGNAL(timeout()),
                     this, SLOT(_q_candidateDisconnected()));
     Q_ASSERT(check);
 
-    m_candidateTimer->setSingleShot(true);
-    m_candidateTimer->start(socksTimeout);
-    m_candidateClient->connectToHost(hostName, 0);
+    m_candidates << candidate;
+    candidate.timer->setSingleShot(true);
+    candidate.timer->start(socksTimeout);
+    candidate.client->connectToHost(hostName, 0);
+
+    // if this host does not answer quickly, try the next one in parallel
+    if (!m_streamCandidates.isEmpty() && m_candidates.size() < socksParallelAttempts)
+        m_candidateTimer->start();
 }
 
 void QXmppTransferIncomingJob::connectToHosts(const QXmppByteStreamIq &iq)
@@ -518,17 +1002,49 @@ void QXmppTransferIncomingJob::connectToHosts(const QXmppByteStreamIq &iq)
     m_streamOfferId = iq.id();
     m_streamOfferFrom = iq.from();
 
+    m_candidateTimer = new QTimer(this);
+    m_candidateTimer->setInterval(socksStaggerDelay);
+    m_candidateTimer->setSingleShot(true);
+    check = connect(m_candidateTimer, SIGNAL(timeout()),
+                    this, SLOT(connectToNextHost()));
+    Q_ASSERT(check);
+
     connectToNextHost();
 }
 
+int QXmppTransferIncomingJob::findCandidate(QObject *object) const
+{
+    if (!object)
+        return -1;
+    for (int i = 0; i < m_candidates.size(); ++i) {
+        if (m_candidates[i].client == object || m_candidates[i].timer == object)
+            return i;
+    }
+    return -1;
+}
+
+void QXmppTransferIncomingJob::removeCandidate(int index)
+{
+    const Candidate candidate = m_candidates.takeAt(index);
+    candidate.client->disconnect(this);
+    candidate.client->abort();
+    candidate.client->deleteLater();
+    candidate.timer->deleteLater();
+}
+
 bool QXmppTransferIncomingJob::writeData(const QByteArray &data)
 {
-    const qint64 written = d->iodevice->write(data);
+    return writeData(data.constData(), data.size());
+}
+
+bool QXmppTransferIncomingJob::writeData(const char *data, qint64 size)
+{
+    const qint64 written = d->iodevice->write(data, size);
     if (written < 0)
         return false;
     d->done += written;
     if (!d->fileInfo.hash().isEmpty())
-        d->hash.addData(data);
+        d->hash.addData(data, int(size));
     progress(d->done, d->fileInfo.size());
     return true;
 }
@@ -538,19 +1054,31 @@ void QXmppTransferIncomingJob::_q_candidateReady()
     bool check;
     Q_UNUSED(check);
 
-    if (!m_candidateClient)
+    const int index = findCandidate(sender());
+    if (index < 0)
+        return;
+    const Candidate candidate = m_candidates.takeAt(index);
+
+    // cancel the other attempts
+    m_candidateTimer->stop();
+    m_streamCandidates.clear();
+    while (!m_candidates.isEmpty())
+        removeCandidate(0);
+
+    candidate.timer->deleteLater();
+    if (d->state == QXmppTransferJob::FinishedState) {
+        candidate.client->deleteLater();
         return;
+    }
 
     info(QString("Connected to streamhost: %1 (%2 %3)").arg(
-            m_candidateHost.jid(),
-            m_candidateHost.host(),
-            QString::number(m_candidateHost.port())));
+            candidate.host.jid(),
+            candidate.host.host(),
+            QString::number(candidate.host.port())));
 
     setState(QXmppTransferJob::TransferState);
-    d->socksSocket = m_candidateClient;
-    m_candidateClient = 0;
-    m_candidateTimer->deleteLater();
-    m_candidateTimer = 0;
+    d->socksSocket = candidate.client;
+    d->socksSocket->disconnect(this);
 
     check = connect(d->socksSocket, SIGNAL(readyRead()),
                     this, SLOT(_q_receiveData()));
@@ -565,26 +1093,26 @@ void QXmppTransferIncomingJob::_q_candidateReady()
     ackIq.setTo(m_streamOfferFrom);
     ackIq.setType(QXmppIq::Result);
     ackIq.setSid(d->sid);
-    ackIq.setStreamHostUsed(m_candidateHost.jid());
+    ackIq.setStreamHostUsed(candidate.host.jid());
     d->client->sendPacket(ackIq);
 }
 
 void QXmppTransferIncomingJob::_q_candidateDisconnected()
 {
-    if (!m_candidateClient)
+    const int index = findCandidate(sender());
+    if (index < 0)
         return;
 
+    const QXmppByteStreamIq::StreamHost host = m_candidates[index].host;
     warning(QString("Failed to connect to streamhost: %1 (%2 %3)").arg(
-            m_candidateHost.jid(),
-            m_candidateHost.host(),
-            QString::number(m_candidateHost.port())));
+            host.jid(),
+            host.host(),
+            QString::number(host.port())));
 
-    m_candidateClient->deleteLater();
-    m_candidateClient = 0;
-    m_candidateTimer->deleteLater();
-    m_candidateTimer = 0;
+    removeCandidate(index);
 
     // try next host
+    m_candidateTimer->stop();
     connectToNextHost();
 }
 
@@ -596,6 +1124,25 @@ void QXmppTransferIncomingJob::_q_disconnected()
     checkData();
 }
 
+void QXmppTransferIncomingJob::_q_iceConnected()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->state != QXmppTransferJob::StartState)
+        return;
+
+    info(QString("Connected to %1 for transfer %2").arg(d->jid, d->sid));
+    setState(QXmppTransferJob::TransferState);
+
+    check = connect(d->datagramStream, SIGNAL(readyRead()),
+                    this, SLOT(_q_receiveData()));
+    Q_ASSERT(check);
+
+    // the data which arrived before the connection was confirmed
+    _q_receiveData();
+}
+
 void QXmppTransferIncomingJob::_q_receiveData()
 {
     if (d->state != QXmppTransferJob::TransferState)
@@ -604,7 +1151,12 @@ void QXmppTransferIncomingJob::_q_receiveData()
     // receive data block
     if (d->direction == QXmppTransferJob::IncomingDirection)
     {
-        writeData(d->socksSocket->readAll());
+        // write straight from the thread's read buffer to the file
+        char *buffer = QXmppReadBuffer::data();
+        qint64 length;
+        QIODevice *stream = d->dataStream();
+        while ((length = stream->read(buffer, QXmppReadBuffer::Size)) > 0)
+            writeData(buffer, length);
 
         // if we have received all the data, stop here
         if (fileSize() && d->done >= fileSize())
@@ -645,6 +1197,26 @@ void QXmppTransferOutgoingJob::connectToProxy()
     socksClient->connectToHost(hostName, 0);
 }
 
+// Skips the part of the file which the remote party already has.
+
+bool QXmppTransferOutgoingJob::seekRange(qint64 offset)
+{
+    if (offset <= 0)
+        return true;
+
+    if (!d->fileInfo.isRangeSupported() ||
+        (d->fileInfo.size() && offset > d->fileInfo.size()) ||
+        !d->iodevice->seek(offset))
+    {
+        warning(QString("Could not send file from offset %1").arg(QString::number(offset)));
+        terminate(QXmppTransferJob::ProtocolError);
+        return false;
+    }
+    d->done = offset;
+    d->rangeOffset = offset;
+    return true;
+}
+
 void QXmppTransferOutgoingJob::startSending()
 {
     bool check;
@@ -652,7 +1224,20 @@ void QXmppTransferOutgoingJob::startSending()
 
     setState(QXmppTransferJob::TransferState);
 
-    check = connect(d->socksSocket, SIGNAL(bytesWritten(qint64)),
+    // map files into memory, to send them without copying them into a
+    // buffer first
+    QFile *file = qobject_cast<QFile*>(d->iodevice);
+    if (file && !file->isSequential()) {
+        const qint64 size = file->size() - file->pos();
+        if (size > 0) {
+            d->sendMap = file->map(file->pos(), size);
+            if (d->sendMap)
+                d->sendMapSize = size;
+        }
+    }
+    d->sendChunkSize = d->blockSize;
+
+    check = connect(d->dataStream(), SIGNAL(bytesWritten(qint64)),
                     this, SLOT(_q_sendData()));
     Q_ASSERT(check);
 
@@ -674,6 +1259,15 @@ void QXmppTransferOutgoingJob::_q_disconnected()
         terminate(QXmppTransferJob::NoError);
 }
 
+void QXmppTransferOutgoingJob::_q_iceConnected()
+{
+    if (d->state != QXmppTransferJob::StartState)
+        return;
+
+    info(QString("Connected to %1 for transfer %2").arg(d->jid, d->sid));
+    startSending();
+}
+
 void QXmppTransferOutgoingJob::_q_proxyReady()
 {
     // activate stream
@@ -683,45 +1277,150 @@ void QXmppTransferOutgoingJob::_q_proxyReady()
     streamIq.setTo(d->socksProxy.jid());
     streamIq.setSid(d->sid);
     streamIq.setActivate(d->jid);
-    d->requestId = streamIq.id();
+    d->setRequestId(streamIq.id());
     d->client->sendPacket(streamIq);
 }
 
 void QXmppTransferOutgoingJob::_q_sendData()
 {
+    // the largest amount of data written to the socket at once
+    const qint64 maximumChunkSize = 1048576;
+
     if (d->state != QXmppTransferJob::TransferState)
         return;
 
-    // don't saturate the outgoing socket
-    if (d->socksSocket->bytesToWrite() > 2 * d->blockSize)
+    // don't saturate the outgoing socket, a datagram stream also counts
+    // the data in flight which was not acknowledged yet
+    QIODevice *stream = d->dataStream();
+    qint64 bytesToWrite = stream->bytesToWrite();
+    if (d->datagramStream)
+        bytesToWrite = qMax(Q_INT64_C(0), bytesToWrite - d->datagramStream->congestionWindow());
+    if (bytesToWrite > 2 * d->sendChunkSize)
         return;
 
+    // if the socket keeps up with the data, write larger chunks
+    if (!bytesToWrite && d->done > 0 && d->sendChunkSize < maximumChunkSize)
+        d->sendChunkSize = qMin(2 * d->sendChunkSize, maximumChunkSize);
+
     // check whether we have written the whole file
     if (d->fileInfo.size() && d->done >= d->fileInfo.size())
     {
-        if (!d->socksSocket->bytesToWrite())
+        if (!stream->bytesToWrite())
             terminate(QXmppTransferJob::NoError);
         return;
     }
 
-    char *buffer = new char[d->blockSize];
-    qint64 length = d->iodevice->read(buffer, d->blockSize);
+    if (d->sendMap)
+    {
+        const qint64 length = qMin(d->sendChunkSize, d->sendMapSize - d->sendMapOffset);
+        if (length > 0)
+        {
+            stream->write(reinterpret_cast<const char*>(d->sendMap + d->sendMapOffset), length);
+            d->sendMapOffset += length;
+            d->done += length;
+            emit progress(d->done, fileSize());
+        }
+        return;
+    }
+
+    if (d->sendBuffer.size() < d->sendChunkSize)
+        d->sendBuffer.resize(d->sendChunkSize);
+    qint64 length = d->iodevice->read(d->sendBuffer.data(), d->sendChunkSize);
     if (length < 0)
     {
-        delete [] buffer;
         terminate(QXmppTransferJob::FileAccessError);
         return;
     }
     if (length >= 0)
     {
-        d->socksSocket->write(buffer, length);
+        stream->write(d->sendBuffer.constData(), length);
         d->done += length;
         emit progress(d->done, fileSize());
     }
-    delete [] buffer;
 }
 /// \endcond
 
+namespace
+{
+    // File hashes, shared by all the transfer managers of the process so
+    // that a file which is sent again is not read twice.
+    class QXmppTransferHashCache
+    {
+    public:
+        struct Entry
+        {
+            qint64 size;
+            QDateTime lastModified;
+            QByteArray hash;
+        };
+
+        QMutex mutex;
+        QHash<QString, Entry> entries;
+    };
+
+    // the number of files whose hash is kept
+    const int hashCacheSize = 256;
+}
+
+Q_GLOBAL_STATIC(QXmppTransferHashCache, transferHashCache)
+
+QXmppTransferFileHasher::QXmppTransferFileHasher(const QString &filePath, const QString &sid)
+    : m_filePath(filePath)
+    , m_sid(sid)
+{
+}
+
+void QXmppTransferFileHasher::run()
+{
+    QByteArray result;
+    QFile file(m_filePath);
+    if (file.open(QIODevice::ReadOnly)) {
+        const QFileInfo info(file);
+        QCryptographicHash hash(QCryptographicHash::Md5);
+        QByteArray buffer;
+        while (!file.atEnd()) {
+            buffer = file.read(1048576);
+            if (buffer.isEmpty())
+                break;
+            hash.addData(buffer);
+        }
+        if (file.error() == QFile::NoError && file.pos() == info.size()) {
+            result = hash.result();
+
+            QXmppTransferHashCache *cache = transferHashCache();
+            if (cache) {
+                QXmppTransferHashCache::Entry entry;
+                entry.size = info.size();
+                entry.lastModified = info.lastModified();
+                entry.hash = result;
+
+                QMutexLocker locker(&cache->mutex);
+                if (cache->entries.size() >= hashCacheSize)
+                    cache->entries.clear();
+                cache->entries.insert(info.absoluteFilePath(), entry);
+            }
+        }
+    }
+    emit finished(m_sid, result);
+}
+
+// Returns the hash of a file which was hashed before, if it did not change.
+
+QByteArray QXmppTransferFileHasher::cachedHash(const QFileInfo &info)
+{
+    QXmppTransferHashCache *cache = transferHashCache();
+    if (!cache)
+        return QByteArray();
+
+    QMutexLocker locker(&cache->mutex);
+    QHash<QString, QXmppTransferHashCache::Entry>::const_iterator it = cache->entries.constFind(info.absoluteFilePath());
+    if (it != cache->entries.constEnd() &&
+        it->size == info.size() &&
+        it->lastModified == info.lastModified())
+        return it->hash;
+    return QByteArray();
+}
+
 class QXmppTransferManagerPrivate
 {
 public:
@@ -730,35 +1429,55 @@ public:
     QXmppTransferIncomingJob *getIncomingJobByRequestId(const QString &jid, const QString &id);
     QXmppTransferIncomingJob *getIncomingJobBySid(const QString &jid, const QString &sid);
     QXmppTransferOutgoingJob *getOutgoingJobByRequestId(const QString &jid, const QString &id);
+    QXmppTransferJob *getJingleJob(const QString &jid, const QString &sid);
+    void addJob(QXmppTransferJob *job);
+    void createIceConnection(QXmppTransferJob *job, bool controlling);
 
+    bool fileHashEnabled;
     int ibbBlockSize;
+    bool ibbMessagesEnabled;
+    int ibbWindowSize;
+    QXmppTransferJobIndex index;
     QList<QXmppTransferJob*> jobs;
     QString proxy;
     bool proxyOnly;
     QXmppSocksServer *socksServer;
     QXmppTransferJob::Methods supportedMethods;
 
+    // for jingle sessions
+    QHostAddress stunHost;
+    quint16 stunPort;
+    QHostAddress turnHost;
+    quint16 turnPort;
+    QString turnUser;
+    QString turnPassword;
+
 private:
     QXmppTransferJob *getJobByRequestId(QXmppTransferJob::Direction direction, const QString &jid, const QString &id);
     QXmppTransferManager *q;
 };
 
 QXmppTransferManagerPrivate::QXmppTransferManagerPrivate(QXmppTransferManager *qq)
-    : ibbBlockSize(4096)
+    : fileHashEnabled(true)
+    , ibbBlockSize(16384)
+    , ibbMessagesEnabled(false)
+    , ibbWindowSize(4)
     , proxyOnly(false)
     , socksServer(0)
     , supportedMethods(QXmppTransferJob::AnyMethod)
+    , stunPort(0)
+    , turnPort(0)
     , q(qq)
 {
 }
 
 QXmppTransferJob* QXmppTransferManagerPrivate::getJobByRequestId(QXmppTransferJob::Direction direction, const QString &jid, const QString &id)
 {
-    foreach (QXmppTransferJob *job, jobs)
-        if (job->d->direction == direction &&
-            job->d->jid == jid &&
-            job->d->requestId == id)
-            return job;
+    QXmppTransferJob *job = index.requests.value(id);
+    if (job &&
+        job->d->direction == direction &&
+        job->d->jid == jid)
+        return job;
     return 0;
 }
 
@@ -769,12 +1488,8 @@ QXmppTransferIncomingJob *QXmppTransferManagerPrivate::getIncomingJobByRequestId
 
 QXmppTransferIncomingJob* QXmppTransferManagerPrivate::getIncomingJobBySid(const QString &jid, const QString &sid)
 {
-    foreach (QXmppTransferJob *job, jobs)
-        if (job->d->direction == QXmppTransferJob::IncomingDirection &&
-            job->d->jid == jid &&
-            job->d->sid == sid)
-            return static_cast<QXmppTransferIncomingJob*>(job);
-    return 0;
+    return static_cast<QXmppTransferIncomingJob*>(index.streams.value(
+        QXmppTransferJobIndex::streamKey(QXmppTransferJob::IncomingDirection, jid, sid)));
 }
 
 QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::getOutgoingJobByRequestId(const QString &jid, const QString &id)
@@ -782,14 +1497,80 @@ QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::getOutgoingJobByRequestId
     return static_cast<QXmppTransferOutgoingJob*>(getJobByRequestId(QXmppTransferJob::OutgoingDirection, jid, id));
 }
 
-/// Constructs a QXmppTransferManager to handle incoming and outgoing
-/// file transfers.
+// Returns the job carrying the Jingle session \a sid with \a jid.
 
-QXmppTransferManager::QXmppTransferManager()
+QXmppTransferJob *QXmppTransferManagerPrivate::getJingleJob(const QString &jid, const QString &sid)
 {
-    bool check;
-    Q_UNUSED(check);
-
+    QXmppTransferJob *job = index.streams.value(
+        QXmppTransferJobIndex::streamKey(QXmppTransferJob::OutgoingDirection, jid, sid));
+    if (!job)
+        job = index.streams.value(
+            QXmppTransferJobIndex::streamKey(QXmppTransferJob::IncomingDirection, jid, sid));
+    if (job && job->d->method == QXmppTransferJob::JingleMethod)
+        return job;
+    return 0;
+}
+
+void QXmppTransferManagerPrivate::addJob(QXmppTransferJob *job)
+{
+    jobs.append(job);
+    job->d->attach(&index);
+}
+
+// Creates the ICE connection of a Jingle session, and the reliable stream
+// which carries the file over it.
+
+void QXmppTransferManagerPrivate::createIceConnection(QXmppTransferJob *job, bool controlling)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppIceConnection *connection = new QXmppIceConnection(job);
+    connection->setIceControlling(controlling);
+    connection->setStunServer(stunHost, stunPort);
+    connection->setTurnServer(turnHost, turnPort);
+    connection->setTurnUser(turnUser);
+    connection->setTurnPassword(turnPassword);
+    connection->addComponent(jingleComponent);
+    connection->bind(QXmppIceComponent::discoverAddresses());
+
+    QXmppDatagramStream *stream = new QXmppDatagramStream(job);
+    stream->open(QIODevice::ReadWrite);
+
+    QXmppIceComponent *component = connection->component(jingleComponent);
+    check = QObject::connect(component, SIGNAL(datagramReceived(QByteArray)),
+                             stream, SLOT(datagramReceived(QByteArray)));
+    Q_ASSERT(check);
+
+    check = QObject::connect(stream, SIGNAL(sendDatagram(QByteArray)),
+                             component, SLOT(sendDatagram(QByteArray)));
+    Q_ASSERT(check);
+
+    check = QObject::connect(connection, SIGNAL(connected()),
+                             job, SLOT(_q_iceConnected()));
+    Q_ASSERT(check);
+
+    check = QObject::connect(connection, SIGNAL(disconnected()),
+                             job, SLOT(_q_iceDisconnected()));
+    Q_ASSERT(check);
+
+    check = QObject::connect(connection, SIGNAL(localCandidatesChanged()),
+                             job, SLOT(_q_localCandidatesChanged()));
+    Q_ASSERT(check);
+
+    job->d->iceConnection = connection;
+    job->d->datagramStream = stream;
+    job->d->jingleActive = true;
+}
+
+/// Constructs a QXmppTransferManager to handle incoming and outgoing
+/// file transfers.
+
+QXmppTransferManager::QXmppTransferManager()
+{
+    bool check;
+    Q_UNUSED(check);
+
     d = new QXmppTransferManagerPrivate(this);
 
     // start SOCKS server
@@ -804,22 +1585,23 @@ QXmppTransferManager::QXmppTransferManager()
 
 QXmppTransferManager::~QXmppTransferManager()
 {
+    // the jobs we own outlive the index
+    foreach (QXmppTransferJob *job, d->jobs)
+        job->d->detach();
     delete d;
 }
 
 void QXmppTransferManager::byteStreamIqReceived(const QXmppByteStreamIq &iq)
 {
     // handle IQ from proxy
-    foreach (QXmppTransferJob *job, d->jobs)
+    QXmppTransferJob *job = d->index.requests.value(iq.id());
+    if (job && job->d->socksProxy.jid() == iq.from() && job->d->requestId == iq.id())
     {
-        if (job->d->socksProxy.jid() == iq.from() && job->d->requestId == iq.id())
+        if (iq.type() == QXmppIq::Result && iq.streamHosts().size() > 0)
         {
-            if (iq.type() == QXmppIq::Result && iq.streamHosts().size() > 0)
-            {
-                job->d->socksProxy = iq.streamHosts().first();
-                socksServerSendOffer(job);
-                return;
-            }
+            job->d->socksProxy = iq.streamHosts().first();
+            socksServerSendOffer(job);
+            return;
         }
     }
 
@@ -908,15 +1690,30 @@ void QXmppTransferManager::byteStreamSetReceived(const QXmppByteStreamIq &iq)
 /// \cond
 QStringList QXmppTransferManager::discoveryFeatures() const
 {
-    return QStringList()
+    QStringList features = QStringList()
         << ns_ibb               // XEP-0047: In-Band Bytestreams
         << ns_bytestreams       // XEP-0065: SOCKS5 Bytestreams
         << ns_stream_initiation // XEP-0095: Stream Initiation
         << ns_stream_initiation_file_transfer; // XEP-0096: SI File Transfer
+    if (d->supportedMethods & QXmppTransferJob::JingleMethod)
+        features
+            << ns_jingle            // XEP-0166: Jingle
+            << ns_jingle_ice_udp    // XEP-0176: Jingle ICE-UDP Transport Method
+            << ns_jingle_file_transfer; // XEP-0234: Jingle File Transfer
+    return features;
 }
 
 bool QXmppTransferManager::handleStanza(const QDomElement &element)
 {
+    // XEP-0047 In-Band Bytestreams, data sent in messages
+    if (element.tagName() == "message" && QXmppIbbDataIq::isIbbDataIq(element))
+    {
+        QXmppIbbDataIq ibbDataIq;
+        ibbDataIq.parse(element);
+        ibbDataMessageReceived(ibbDataIq);
+        return true;
+    }
+
     if (element.tagName() != "iq")
         return false;
 
@@ -958,6 +1755,14 @@ bool QXmppTransferManager::handleStanza(const QDomElement &element)
         streamInitiationIqReceived(siIq);
         return true;
     }
+    // XEP-0234: Jingle File Transfer
+    else if((d->supportedMethods & QXmppTransferJob::JingleMethod) &&
+            QXmppJingleIq::isJingleIq(element))
+    {
+        QXmppJingleIq jingleIq;
+        jingleIq.parse(element);
+        return jingleIqReceived(jingleIq);
+    }
 
     return false;
 }
@@ -1021,7 +1826,7 @@ void QXmppTransferManager::ibbDataIqReceived(const QXmppIbbDataIq &iq)
         return;
     }
 
-    if (iq.sequence() != job->d->ibbSequence)
+    if (iq.sequence() != quint16(job->d->ibbSequence))
     {
         // the packet is out of sequence
         QXmppStanza::Error error(QXmppStanza::Error::Cancel, QXmppStanza::Error::UnexpectedRequest);
@@ -1040,6 +1845,26 @@ void QXmppTransferManager::ibbDataIqReceived(const QXmppIbbDataIq &iq)
     client()->sendPacket(response);
 }
 
+void QXmppTransferManager::ibbDataMessageReceived(const QXmppIbbDataIq &data)
+{
+    QXmppTransferIncomingJob *job = d->getIncomingJobBySid(data.from(), data.sid());
+    if (!job ||
+        job->method() != QXmppTransferJob::InBandMethod ||
+        job->state() != QXmppTransferJob::TransferState)
+        return;
+
+    // messages are not acknowledged, so a lost block ends the transfer
+    if (data.sequence() != quint16(job->d->ibbSequence))
+    {
+        warning(QString("Received out of sequence IBB data from %1").arg(data.from()));
+        job->terminate(QXmppTransferJob::ProtocolError);
+        return;
+    }
+
+    job->writeData(data.payload());
+    job->d->ibbSequence++;
+}
+
 void QXmppTransferManager::ibbOpenIqReceived(const QXmppIbbOpenIq &iq)
 {
     QXmppIq response;
@@ -1088,44 +1913,337 @@ void QXmppTransferManager::ibbResponseReceived(const QXmppIq &iq)
     if (!job->d->iodevice->isOpen())
         return;
 
-    if (iq.type() == QXmppIq::Result)
+    if (job->state() == QXmppTransferJob::StartState)
     {
-        const QByteArray buffer = job->d->iodevice->read(job->d->blockSize);
-        job->setState(QXmppTransferJob::TransferState);
-        if (buffer.size())
+        // answer to the open request
+        if (iq.type() == QXmppIq::Result)
         {
-            // send next data block
+            job->setState(QXmppTransferJob::TransferState);
+            ibbSendData(job);
+        }
+        else if (iq.type() == QXmppIq::Error)
+        {
+            // retry with data in IQs, then with the block size XEP-0047
+            // recommends, in case the peer rejected our parameters
+            if (job->d->ibbMessages) {
+                job->d->ibbMessages = false;
+                ibbSendOpen(job);
+            } else if (job->d->blockSize > 4096) {
+                job->d->blockSize = 4096;
+                ibbSendOpen(job);
+            } else {
+                job->terminate(QXmppTransferJob::ProtocolError);
+            }
+        }
+        return;
+    }
+
+    job->d->removeIbbRequestId(iq.id());
+
+    // when sending in messages, the answer to the ping acknowledges the
+    // data sent before it, even if the peer does not support pings
+    const QXmppStanza::Error::Condition condition = iq.error().condition();
+    if (iq.type() == QXmppIq::Result ||
+        (job->d->ibbMessages &&
+         (condition == QXmppStanza::Error::FeatureNotImplemented ||
+          condition == QXmppStanza::Error::ServiceUnavailable)))
+    {
+        ibbSendData(job);
+    }
+    else if (iq.type() == QXmppIq::Error)
+    {
+        // close the bytestream
+        job->d->clearIbbRequestIds();
+        QXmppIbbCloseIq closeIq;
+        closeIq.setTo(job->d->jid);
+        closeIq.setSid(job->d->sid);
+        job->d->setRequestId(closeIq.id());
+        client()->sendPacket(closeIq);
+
+        job->terminate(QXmppTransferJob::ProtocolError);
+    }
+}
+
+// Requests the opening of an in-band bytestream.
+
+void QXmppTransferManager::ibbSendOpen(QXmppTransferJob *job)
+{
+    QXmppIbbOpenIq openIq;
+    openIq.setTo(job->d->jid);
+    openIq.setSid(job->d->sid);
+    openIq.setBlockSize(job->d->blockSize);
+    if (job->d->ibbMessages)
+        openIq.setStanza("message");
+    job->d->setRequestId(openIq.id());
+    client()->sendPacket(openIq);
+}
+
+// Sends data blocks until the window of unacknowledged requests is full,
+// and closes the bytestream once all the data was acknowledged.
+
+void QXmppTransferManager::ibbSendData(QXmppTransferJob *job)
+{
+    if (!job->d->ibbRequestIds.isEmpty() && job->d->ibbMessages)
+        return;
+
+    int sent = 0;
+    while (job->d->ibbRequestIds.size() < d->ibbWindowSize &&
+           (!job->d->ibbMessages || sent < d->ibbWindowSize))
+    {
+        const QByteArray buffer = job->d->iodevice->read(job->d->blockSize);
+        if (buffer.isEmpty())
+            break;
+
+        const quint16 sequence = job->d->ibbSequence++;
+        if (job->d->ibbMessages) {
+            QXmppElement dataElement;
+            dataElement.setTagName("data");
+            dataElement.setAttribute("xmlns", ns_ibb);
+            dataElement.setAttribute("seq", QString::number(sequence));
+            dataElement.setAttribute("sid", job->d->sid);
+            dataElement.setValue(QString::fromLatin1(QXmppBase64::encode(buffer)));
+
+            QXmppMessage message;
+            message.setTo(job->d->jid);
+            message.setType(QXmppMessage::Normal);
+            message.setExtensions(QXmppElementList() << dataElement);
+            client()->sendPacket(message);
+        } else {
             QXmppIbbDataIq dataIq;
             dataIq.setTo(job->d->jid);
             dataIq.setSid(job->d->sid);
-            dataIq.setSequence(job->d->ibbSequence++);
+            dataIq.setSequence(sequence);
             dataIq.setPayload(buffer);
-            job->d->requestId = dataIq.id();
+            job->d->setRequestId(dataIq.id());
+            job->d->addIbbRequestId(dataIq.id());
             client()->sendPacket(dataIq);
+        }
+        sent++;
 
-            job->d->done += buffer.size();
-            job->progress(job->d->done, job->fileSize());
-        } else {
-            // close the bytestream
-            QXmppIbbCloseIq closeIq;
-            closeIq.setTo(job->d->jid);
-            closeIq.setSid(job->d->sid);
-            job->d->requestId = closeIq.id();
-            client()->sendPacket(closeIq);
+        job->d->done += buffer.size();
+        job->progress(job->d->done, job->fileSize());
+    }
 
-            job->terminate(QXmppTransferJob::NoError);
-        }
+    if (job->d->ibbMessages && sent > 0)
+    {
+        // messages are not acknowledged, wait for a ping's answer before
+        // sending more
+        QXmppPingIq pingIq;
+        pingIq.setTo(job->d->jid);
+        job->d->setRequestId(pingIq.id());
+        job->d->addIbbRequestId(pingIq.id());
+        client()->sendPacket(pingIq);
     }
-    else if (iq.type() == QXmppIq::Error)
+    else if (!sent && job->d->ibbRequestIds.isEmpty())
     {
         // close the bytestream
         QXmppIbbCloseIq closeIq;
         closeIq.setTo(job->d->jid);
         closeIq.setSid(job->d->sid);
-        job->d->requestId = closeIq.id();
+        job->d->setRequestId(closeIq.id());
         client()->sendPacket(closeIq);
 
-        job->terminate(QXmppTransferJob::ProtocolError);
+        job->terminate(QXmppTransferJob::NoError);
+    }
+}
+
+// Handles a Jingle request, returns false if it does not belong to a file
+// transfer.
+
+bool QXmppTransferManager::jingleIqReceived(const QXmppJingleIq &iq)
+{
+    if (iq.type() != QXmppIq::Set)
+        return false;
+
+    const QXmppJingleIq::Content content = iq.contents().isEmpty() ? QXmppJingleIq::Content() : iq.contents().first();
+    if (iq.action() == QXmppJingleIq::SessionInitiate)
+    {
+        if (content.descriptionFile().isNull())
+            return false;
+        jingleOfferReceived(iq);
+        return true;
+    }
+
+    QXmppTransferJob *job = d->getJingleJob(iq.from(), iq.sid());
+    if (!job)
+        return false;
+
+    // acknowledge the request
+    QXmppIq ack;
+    ack.setId(iq.id());
+    ack.setTo(iq.from());
+    ack.setType(QXmppIq::Result);
+    client()->sendPacket(ack);
+
+    if (iq.action() == QXmppJingleIq::SessionAccept)
+    {
+        // the remote party accepted an outgoing transfer
+        if (job->direction() != QXmppTransferJob::OutgoingDirection ||
+            job->state() != QXmppTransferJob::OfferState)
+            return true;
+
+        // the remote party may only want the end of the file
+        QXmppTransferOutgoingJob *outgoingJob = static_cast<QXmppTransferOutgoingJob*>(job);
+        if (!outgoingJob->seekRange(jingleFileInfo(content.descriptionFile()).rangeOffset()))
+            return true;
+
+        QXmppIceConnection *connection = job->d->iceConnection;
+        connection->setRemoteUser(content.transportUser());
+        connection->setRemotePassword(content.transportPassword());
+        foreach (const QXmppJingleCandidate &candidate, content.transportCandidates())
+            connection->addRemoteCandidate(candidate);
+
+        job->setState(QXmppTransferJob::StartState);
+        connection->connectToHost();
+    }
+    else if (iq.action() == QXmppJingleIq::TransportInfo)
+    {
+        // candidates which arrive before the job is accepted are kept
+        // with the offer
+        foreach (const QXmppJingleCandidate &candidate, content.transportCandidates()) {
+            if (job->d->iceConnection)
+                job->d->iceConnection->addRemoteCandidate(candidate);
+            else
+                job->d->jingleOffer.addTransportCandidate(candidate);
+        }
+    }
+    else if (iq.action() == QXmppJingleIq::SessionTerminate)
+    {
+        job->d->jingleActive = false;
+        if (job->state() == QXmppTransferJob::FinishedState)
+            return true;
+
+        // the sender ends the session once all the data was acknowledged
+        if (iq.reason().type() != QXmppJingleIq::Reason::Success)
+            job->terminate(QXmppTransferJob::AbortError);
+        else if (job->direction() == QXmppTransferJob::IncomingDirection)
+            static_cast<QXmppTransferIncomingJob*>(job)->checkData();
+        else
+            job->terminate(QXmppTransferJob::NoError);
+    }
+    return true;
+}
+
+// The remote party offers a file with Jingle.
+
+void QXmppTransferManager::jingleOfferReceived(const QXmppJingleIq &iq)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppIq response;
+    response.setTo(iq.from());
+    response.setId(iq.id());
+
+    // check there is a receiver connected to the fileReceived() signal
+    if (!receivers(SIGNAL(fileReceived(QXmppTransferJob*))))
+    {
+        QXmppStanza::Error error(QXmppStanza::Error::Cancel, QXmppStanza::Error::Forbidden);
+        error.setCode(403);
+
+        response.setType(QXmppIq::Error);
+        response.setError(error);
+        client()->sendPacket(response);
+        return;
+    }
+
+    response.setType(QXmppIq::Result);
+    client()->sendPacket(response);
+
+    const QXmppJingleIq::Content content = iq.contents().first();
+    QXmppTransferIncomingJob *job = new QXmppTransferIncomingJob(iq.from(), client(), this);
+    job->d->sid = iq.sid();
+    job->d->method = QXmppTransferJob::JingleMethod;
+    job->d->fileInfo = jingleFileInfo(content.descriptionFile());
+    job->d->jingleOffer = content;
+    job->d->jingleActive = true;
+
+    // register job
+    d->addJob(job);
+    check = connect(job, SIGNAL(destroyed(QObject*)),
+                    this, SLOT(_q_jobDestroyed(QObject*)));
+    Q_ASSERT(check);
+
+    check = connect(job, SIGNAL(finished()),
+                    this, SLOT(_q_jobFinished()));
+    Q_ASSERT(check);
+
+    check = connect(job, SIGNAL(stateChanged(QXmppTransferJob::State)),
+                    this, SLOT(_q_jobStateChanged(QXmppTransferJob::State)));
+    Q_ASSERT(check);
+
+    // allow user to accept or decline the job
+    emit fileReceived(job);
+}
+
+// Accepts an incoming Jingle transfer and starts connecting to the sender.
+
+void QXmppTransferManager::jingleSendAccept(QXmppTransferJob *job)
+{
+    d->createIceConnection(job, false);
+
+    QXmppIceConnection *connection = job->d->iceConnection;
+    const QXmppJingleIq::Content offer = job->d->jingleOffer;
+    connection->setRemoteUser(offer.transportUser());
+    connection->setRemotePassword(offer.transportPassword());
+    foreach (const QXmppJingleCandidate &candidate, offer.transportCandidates())
+        connection->addRemoteCandidate(candidate);
+    job->d->jingleOffer = QXmppJingleIq::Content();
+
+    // ask for the end of the file if we already have its start
+    QXmppTransferFileInfo fileInfo = job->d->fileInfo;
+    fileInfo.setRangeOffset(job->d->rangeOffset);
+    QXmppJingleIq::Content content = job->d->localContent(false);
+    content.setDescriptionFile(jingleFileElement(fileInfo));
+
+    QXmppJingleIq iq;
+    iq.setTo(job->d->jid);
+    iq.setType(QXmppIq::Set);
+    iq.setAction(QXmppJingleIq::SessionAccept);
+    iq.setResponder(client()->configuration().jid());
+    iq.setSid(job->d->sid);
+    iq.addContent(content);
+    job->d->setRequestId(iq.id());
+    client()->sendPacket(iq);
+
+    connection->connectToHost();
+}
+
+// Offers an outgoing file to the remote party with Jingle.
+
+void QXmppTransferManager::jingleSendOffer(QXmppTransferJob *job)
+{
+    job->d->method = QXmppTransferJob::JingleMethod;
+    d->createIceConnection(job, true);
+
+    QXmppJingleIq::Content content = job->d->localContent(false);
+    content.setDescriptionFile(jingleFileElement(job->d->fileInfo));
+
+    QXmppJingleIq iq;
+    iq.setTo(job->d->jid);
+    iq.setType(QXmppIq::Set);
+    iq.setAction(QXmppJingleIq::SessionInitiate);
+    iq.setInitiator(client()->configuration().jid());
+    iq.setSid(job->d->sid);
+    iq.addContent(content);
+    job->d->setRequestId(iq.id());
+    client()->sendPacket(iq);
+}
+
+void QXmppTransferManager::_q_fileHashed(const QString &sid, const QByteArray &hash)
+{
+    foreach (QXmppTransferJob *job, d->jobs)
+    {
+        if (job->d->direction == QXmppTransferJob::OutgoingDirection &&
+            job->d->sid == sid &&
+            job->d->state == QXmppTransferJob::OfferState &&
+            job->d->requestId.isEmpty())
+        {
+            // if the file could not be read, offer it without a hash
+            job->d->fileInfo.setHash(hash);
+            sendOffer(job);
+            return;
+        }
     }
 }
 
@@ -1134,7 +2252,8 @@ void QXmppTransferManager::_q_iqReceived(const QXmppIq &iq)
     bool check;
     Q_UNUSED(check);
 
-    foreach (QXmppTransferJob *ptr, d->jobs)
+    QXmppTransferJob *ptr = d->index.requests.value(iq.id());
+    if (ptr)
     {
         // handle IQ from proxy
         if (ptr->direction() == QXmppTransferJob::OutgoingDirection && ptr->d->socksProxy.jid() == iq.from() && ptr->d->requestId == iq.id())
@@ -1161,7 +2280,7 @@ void QXmppTransferManager::_q_iqReceived(const QXmppIq &iq)
         }
 
         // handle IQ from peer
-        else if (ptr->d->jid == iq.from() && ptr->d->requestId == iq.id())
+        else if (ptr->d->jid == iq.from())
         {
             QXmppTransferJob *job = ptr;
             if (job->direction() == QXmppTransferJob::OutgoingDirection &&
@@ -1176,6 +2295,26 @@ void QXmppTransferManager::_q_iqReceived(const QXmppIq &iq)
                 byteStreamResponseReceived(iq);
                 return;
             }
+            else if (job->method() == QXmppTransferJob::JingleMethod &&
+                     job->d->requestId == iq.id() &&
+                     iq.type() == QXmppIq::Error)
+            {
+                // the remote party does not know the session
+                job->d->jingleActive = false;
+                if (job->direction() == QXmppTransferJob::OutgoingDirection &&
+                    job->state() == QXmppTransferJob::OfferState &&
+                    (d->supportedMethods & QXmppTransferJob::AnyMethod))
+                {
+                    // offer the file with stream initiation instead
+                    info(QString("Remote party %1 refused Jingle file transfer, trying stream initiation").arg(iq.from()));
+                    job->d->stopJingle();
+                    job->d->method = QXmppTransferJob::NoMethod;
+                    streamInitiationSendRequest(job);
+                } else {
+                    job->terminate(QXmppTransferJob::AbortError);
+                }
+                return;
+            }
             else if (job->direction() == QXmppTransferJob::OutgoingDirection &&
                      iq.type() == QXmppIq::Error)
             {
@@ -1206,7 +2345,7 @@ void QXmppTransferManager::_q_jobError(QXmppTransferJob::Error error)
         QXmppIbbCloseIq closeIq;
         closeIq.setTo(job->d->jid);
         closeIq.setSid(job->d->sid);
-        job->d->requestId = closeIq.id();
+        job->d->setRequestId(closeIq.id());
         client()->sendPacket(closeIq);
     }
 }
@@ -1239,6 +2378,13 @@ void QXmppTransferManager::_q_jobStateChanged(QXmppTransferJob::State state)
     // the job was refused by the local party
     if (state != QXmppTransferJob::StartState || !job->d->iodevice || !job->d->iodevice->isWritable())
     {
+        // a Jingle session is declined when the job terminates
+        if (job->method() == QXmppTransferJob::JingleMethod)
+        {
+            job->terminate(QXmppTransferJob::AbortError);
+            return;
+        }
+
         QXmppStanza::Error error(QXmppStanza::Error::Cancel, QXmppStanza::Error::Forbidden);
         error.setCode(403);
 
@@ -1258,6 +2404,13 @@ void QXmppTransferManager::_q_jobStateChanged(QXmppTransferJob::State state)
             this, SLOT(_q_jobError(QXmppTransferJob::Error)));
     Q_ASSERT(check);
 
+    if (job->method() == QXmppTransferJob::JingleMethod)
+    {
+        jingleSendAccept(job);
+        emit jobStarted(job);
+        return;
+    }
+
     QXmppDataForm form;
     form.setType(QXmppDataForm::Submit);
 
@@ -1275,6 +2428,12 @@ void QXmppTransferManager::_q_jobStateChanged(QXmppTransferJob::State state)
     response.setType(QXmppIq::Result);
     response.setProfile(QXmppStreamInitiationIq::FileTransfer);
     response.setFeatureForm(form);
+    if (job->d->rangeOffset > 0)
+    {
+        QXmppTransferFileInfo rangeInfo;
+        rangeInfo.setRangeOffset(job->d->rangeOffset);
+        response.setFileInfo(rangeInfo);
+    }
 
     client()->sendPacket(response);
 
@@ -1315,23 +2474,33 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, const QStri
         device = 0;
     }
 
-    // hash file
-    if (device && !device->isSequential())
+    // use the file's hash if it is known, otherwise offer the file once
+    // it has been hashed on a worker thread
+    bool hashFile = false;
+    if (device && d->fileHashEnabled)
     {
-        QCryptographicHash hash(QCryptographicHash::Md5);
-        QByteArray buffer;
-        while (device->bytesAvailable())
-        {
-            buffer = device->read(16384);
-            hash.addData(buffer);
-        }
-        device->reset();
-        fileInfo.setHash(hash.result());
+        fileInfo.setHash(QXmppTransferFileHasher::cachedHash(info));
+        hashFile = fileInfo.hash().isEmpty();
     }
 
     // create job
-    QXmppTransferJob *job = sendFile(jid, device, fileInfo);
+    const QString sid = QXmppUtils::generateStanzaHash();
+    QXmppTransferJob *job = startOutgoingJob(jid, device, fileInfo, sid, !hashFile);
+    if (!job)
+        return 0;
     job->setLocalFileUrl(filePath);
+
+    if (hashFile && job->state() == QXmppTransferJob::OfferState)
+    {
+        bool check;
+        Q_UNUSED(check);
+
+        QXmppTransferFileHasher *hasher = new QXmppTransferFileHasher(filePath, sid);
+        check = connect(hasher, SIGNAL(finished(QString,QByteArray)),
+                        this, SLOT(_q_fileHashed(QString,QByteArray)));
+        Q_ASSERT(check);
+        QThreadPool::globalInstance()->start(hasher);
+    }
     return job;
 }
 
@@ -1345,6 +2514,11 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, const QStri
 ///
 
 QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid)
+{
+    return startOutgoingJob(jid, device, fileInfo, sid, true);
+}
+
+QXmppTransferJob *QXmppTransferManager::startOutgoingJob(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid, bool sendRequest)
 {
     bool check;
     Q_UNUSED(check);
@@ -1360,6 +2534,8 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
     else
         job->d->sid = sid;
     job->d->fileInfo = fileInfo;
+    job->d->fileInfo.setRangeSupported(device && !device->isSequential());
+    job->d->fileInfo.setRangeOffset(0);
     job->d->iodevice = device;
     if (device)
         device->setParent(job);
@@ -1378,20 +2554,8 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
         return job;
     }
 
-    // collect supported stream methods
-    QXmppDataForm form;
-    form.setType(QXmppDataForm::Form);
-
-    QXmppDataForm::Field methodField(QXmppDataForm::Field::ListSingleField);
-    methodField.setKey("stream-method");
-    if (d->supportedMethods & QXmppTransferJob::InBandMethod)
-        methodField.setOptions(methodField.options() << qMakePair(QString(), QString::fromLatin1(ns_ibb)));
-    if (d->supportedMethods & QXmppTransferJob::SocksMethod)
-        methodField.setOptions(methodField.options() << qMakePair(QString(), QString::fromLatin1(ns_bytestreams)));
-    form.setFields(QList<QXmppDataForm::Field>() << methodField);
-
     // start job
-    d->jobs.append(job);
+    d->addJob(job);
     check = connect(job, SIGNAL(destroyed(QObject*)),
                     this, SLOT(_q_jobDestroyed(QObject*)));
     Q_ASSERT(check);
@@ -1404,20 +2568,51 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
                     this, SLOT(_q_jobFinished()));
     Q_ASSERT(check);
 
+    if (sendRequest)
+        sendOffer(job);
+
+    // notify user
+    emit jobStarted(job);
+
+    return job;
+}
+
+// Offers an outgoing file to the remote party, with Jingle if it is
+// enabled.
+
+void QXmppTransferManager::sendOffer(QXmppTransferJob *job)
+{
+    if (d->supportedMethods & QXmppTransferJob::JingleMethod)
+        jingleSendOffer(job);
+    else
+        streamInitiationSendRequest(job);
+}
+
+// Offers an outgoing file to the remote party with stream initiation.
+
+void QXmppTransferManager::streamInitiationSendRequest(QXmppTransferJob *job)
+{
+    // collect supported stream methods
+    QXmppDataForm form;
+    form.setType(QXmppDataForm::Form);
+
+    QXmppDataForm::Field methodField(QXmppDataForm::Field::ListSingleField);
+    methodField.setKey("stream-method");
+    if (d->supportedMethods & QXmppTransferJob::InBandMethod)
+        methodField.setOptions(methodField.options() << qMakePair(QString(), QString(ns_ibb)));
+    if (d->supportedMethods & QXmppTransferJob::SocksMethod)
+        methodField.setOptions(methodField.options() << qMakePair(QString(), QString(ns_bytestreams)));
+    form.setFields(QList<QXmppDataForm::Field>() << methodField);
+
     QXmppStreamInitiationIq request;
     request.setType(QXmppIq::Set);
-    request.setTo(jid);
+    request.setTo(job->d->jid);
     request.setProfile(QXmppStreamInitiationIq::FileTransfer);
     request.setFileInfo(job->d->fileInfo);
     request.setFeatureForm(form);
     request.setSiId(job->d->sid);
-    job->d->requestId = request.id();
+    job->d->setRequestId(request.id());
     client()->sendPacket(request);
-
-    // notify user
-    emit jobStarted(job);
-
-    return job;
 }
 
 void QXmppTransferManager::_q_socksServerConnected(QTcpSocket *socket, const QString &hostName, quint16 port)
@@ -1469,7 +2664,7 @@ void QXmppTransferManager::socksServerSendOffer(QXmppTransferJob *job)
     streamIq.setTo(job->d->jid);
     streamIq.setSid(job->d->sid);
     streamIq.setStreamHosts(streamHosts);
-    job->d->requestId = streamIq.id();
+    job->d->setRequestId(streamIq.id());
     client()->sendPacket(streamIq);
 }
 
@@ -1484,7 +2679,7 @@ void QXmppTransferManager::streamInitiationIqReceived(const QXmppStreamInitiatio
 // The remote party has accepted an outgoing transfer.
 void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamInitiationIq &iq)
 {
-    QXmppTransferJob *job = d->getOutgoingJobByRequestId(iq.from(), iq.id());
+    QXmppTransferOutgoingJob *job = d->getOutgoingJobByRequestId(iq.from(), iq.id());
     if (!job ||
         job->state() != QXmppTransferJob::OfferState)
         return;
@@ -1500,19 +2695,18 @@ void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamIniti
         }
     }
 
+    // the remote party may only want the end of the file
+    if (!job->seekRange(iq.fileInfo().rangeOffset()))
+        return;
+
     // remote party accepted stream initiation
     job->setState(QXmppTransferJob::StartState);
     if (job->method() == QXmppTransferJob::InBandMethod)
     {
         // lower block size for IBB
         job->d->blockSize = d->ibbBlockSize;
-
-        QXmppIbbOpenIq openIq;
-        openIq.setTo(job->d->jid);
-        openIq.setSid(job->d->sid);
-        openIq.setBlockSize(job->d->blockSize);
-        job->d->requestId = openIq.id();
-        client()->sendPacket(openIq);
+        job->d->ibbMessages = d->ibbMessagesEnabled;
+        ibbSendOpen(job);
     } else if (job->method() == QXmppTransferJob::SocksMethod) {
         if (!d->proxy.isEmpty())
         {
@@ -1523,7 +2717,7 @@ void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamIniti
             streamIq.setType(QXmppIq::Get);
             streamIq.setTo(job->d->socksProxy.jid());
             streamIq.setSid(job->d->sid);
-            job->d->requestId = streamIq.id();
+            job->d->setRequestId(streamIq.id());
             client()->sendPacket(streamIq);
         } else {
             socksServerSendOffer(job);
@@ -1610,7 +2804,7 @@ void QXmppTransferManager::streamInitiationSetReceived(const QXmppStreamInitiati
     }
 
     // register job
-    d->jobs.append(job);
+    d->addJob(job);
     check = connect(job, SIGNAL(destroyed(QObject*)),
                     this, SLOT(_q_jobDestroyed(QObject*)));
     Q_ASSERT(check);
@@ -1670,6 +2864,100 @@ void QXmppTransferManager::setProxyOnly(bool proxyOnly)
     d->proxyOnly = proxyOnly;
 }
 
+/// Returns whether the files sent with sendFile() are offered with their
+/// MD5 hash, so that the receiver can check them.
+///
+/// The default value is true.
+
+bool QXmppTransferManager::fileHashEnabled() const
+{
+    return d->fileHashEnabled;
+}
+
+/// Sets whether the files sent with sendFile() are offered with their MD5
+/// hash, so that the receiver can check them.
+///
+/// Files are hashed on a worker thread, and the offer is sent once the
+/// hash is known. The hashes are cached by path, size and modification
+/// time, so a file which is sent again is offered at once. If hashing is
+/// disabled, files are offered at once and only their size is checked.
+///
+/// \param enabled
+
+void QXmppTransferManager::setFileHashEnabled(bool enabled)
+{
+    d->fileHashEnabled = enabled;
+}
+
+/// Returns the largest block size in bytes for in-band bytestreams.
+///
+/// The default value is 16384.
+
+int QXmppTransferManager::ibbBlockSize() const
+{
+    return d->ibbBlockSize;
+}
+
+/// Sets the largest block size in bytes for in-band bytestreams.
+///
+/// Outgoing transfers ask for this block size, and fall back to 4096 bytes
+/// if the peer refuses it. Incoming transfers with larger blocks are
+/// refused.
+///
+/// \param size
+
+void QXmppTransferManager::setIbbBlockSize(int size)
+{
+    d->ibbBlockSize = qBound(1, size, 65535);
+}
+
+/// Returns whether outgoing in-band bytestreams send their data in message
+/// stanzas instead of IQs.
+///
+/// The default value is false.
+
+bool QXmppTransferManager::ibbMessagesEnabled() const
+{
+    return d->ibbMessagesEnabled;
+}
+
+/// Sets whether outgoing in-band bytestreams send their data in message
+/// stanzas instead of IQs.
+///
+/// Messages are not acknowledged, so after each window of data a ping is
+/// sent to the peer, and the next window is only sent once it is answered.
+/// If the peer refuses message stanzas, the data is sent in IQs.
+///
+/// \param enabled
+
+void QXmppTransferManager::setIbbMessagesEnabled(bool enabled)
+{
+    d->ibbMessagesEnabled = enabled;
+}
+
+/// Returns the number of data blocks an outgoing in-band bytestream sends
+/// without waiting for them to be acknowledged.
+///
+/// The default value is 4.
+
+int QXmppTransferManager::ibbWindowSize() const
+{
+    return d->ibbWindowSize;
+}
+
+/// Sets the number of data blocks an outgoing in-band bytestream sends
+/// without waiting for them to be acknowledged.
+///
+/// A larger window lets transfers use more of the bandwidth on links with
+/// a long round-trip time.
+///
+/// \param size
+
+void QXmppTransferManager::setIbbWindowSize(int size)
+{
+    d->ibbWindowSize = qMax(1, size);
+}
+
 /// Return the supported stream methods.
 ///
 /// The methods are a combination of zero or more QXmppTransferJob::Method.
@@ -1686,8 +2974,53 @@ QXmppTransferJob::Methods QXmppTransferManager::supportedMethods() const
 /// The methods argument is a combination of zero or more
 /// QXmppTransferJob::Method.
 ///
+/// \note Jingle file transfers are not enabled by default, add
+/// QXmppTransferJob::JingleMethod to enable them.
+///
 
 void QXmppTransferManager::setSupportedMethods(QXmppTransferJob::Methods methods)
 {
     d->supportedMethods = methods;
 }
+
+/// Sets the STUN server used by Jingle file transfers to determine
+/// server-reflexive addresses and ports.
+///
+/// \param host The address of the STUN server.
+/// \param port The port of the STUN server.
+
+void QXmppTransferManager::setStunServer(const QHostAddress &host, quint16 port)
+{
+    d->stunHost = host;
+    d->stunPort = port;
+}
+
+/// Sets the TURN server used by Jingle file transfers to relay packets
+/// when no direct path can be established.
+///
+/// \param host The address of the TURN server.
+/// \param port The port of the TURN server.
+
+void QXmppTransferManager::setTurnServer(const QHostAddress &host, quint16 port)
+{
+    d->turnHost = host;
+    d->turnPort = port;
+}
+
+/// Sets the \a user used for authentication with the TURN server.
+///
+/// \param user
+
+void QXmppTransferManager::setTurnUser(const QString &user)
+{
+    d->turnUser = user;
+}
+
+/// Sets the \a password used for authentication with the TURN server.
+///
+/// \param password
+
+void QXmppTransferManager::setTurnPassword(const QString &password)
+{
+    d->turnPassword = password;
+}
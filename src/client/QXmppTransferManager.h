@@ -31,12 +31,14 @@
 
 #include "QXmppClientExtension.h"
 
+class QHostAddress;
 class QTcpSocket;
 class QXmppByteStreamIq;
 class QXmppIbbCloseIq;
 class QXmppIbbDataIq;
 class QXmppIbbOpenIq;
 class QXmppIq;
+class QXmppJingleIq;
 class QXmppStreamInitiationIq;
 class QXmppTransferFileInfoPrivate;
 class QXmppTransferJobPrivate;
@@ -65,6 +67,12 @@ public:
     qint64 size() const;
     void setSize(qint64 size);
 
+    bool isRangeSupported() const;
+    void setRangeSupported(bool supported);
+
+    qint64 rangeOffset() const;
+    void setRangeOffset(qint64 offset);
+
     bool isNull() const;
     QXmppTransferFileInfo& operator=(const QXmppTransferFileInfo &other);
     bool operator==(const QXmppTransferFileInfo &other) const;
@@ -121,7 +129,9 @@ public:
         NoMethod = 0,     ///< No transfer method.
         InBandMethod = 1, ///< XEP-0047: In-Band Bytestreams
         SocksMethod = 2,  ///< XEP-0065: SOCKS5 Bytestreams
-        AnyMethod = 3     ///< Any supported transfer method.
+        AnyMethod = 3,    ///< In-band or SOCKS5 bytestreams.
+        JingleMethod = 4  ///< XEP-0234: Jingle File Transfer over
+                          ///< XEP-0176: Jingle ICE-UDP Transport Method
     };
     Q_DECLARE_FLAGS(Methods, Method)
 
@@ -183,8 +193,12 @@ public slots:
     void abort();
     void accept(const QString &filePath);
     void accept(QIODevice *output);
+    void resume(const QString &filePath);
+    void resume(QIODevice *output);
 
 private slots:
+    void _q_iceDisconnected();
+    void _q_localCandidatesChanged();
     void _q_terminated();
 
 private:
@@ -206,6 +220,15 @@ private:
 /// and XEP-0096: SI File Transfer. The actual file transfer is then performed
 /// using either XEP-0065: SOCKS5 Bytestreams or XEP-0047: In-Band Bytestreams.
 ///
+/// If QXmppTransferJob::JingleMethod is enabled, files are offered as
+/// described in XEP-0234: Jingle File Transfer first. The file is then sent
+/// over a UDP path established with ICE, which traverses most NATs without
+/// a relay. The data is carried by a reliable transport which acknowledges
+/// packets selectively, paces them, and backs off as soon as it detects
+/// queuing on the path, so that transfers do not hurt interactive traffic.
+/// If the remote party does not support Jingle file transfers, the file is
+/// offered with stream initiation.
+///
 /// To make use of this manager, you need to instantiate it and load it into
 /// the QXmppClient instance as follows:
 ///
@@ -227,6 +250,18 @@ public:
     QXmppTransferManager();
     ~QXmppTransferManager();
 
+    bool fileHashEnabled() const;
+    void setFileHashEnabled(bool enabled);
+
+    int ibbBlockSize() const;
+    void setIbbBlockSize(int size);
+
+    bool ibbMessagesEnabled() const;
+    void setIbbMessagesEnabled(bool enabled);
+
+    int ibbWindowSize() const;
+    void setIbbWindowSize(int size);
+
     QString proxy() const;
     void setProxy(const QString &proxyJid);
 
@@ -236,6 +271,11 @@ public:
     QXmppTransferJob::Methods supportedMethods() const;
     void setSupportedMethods(QXmppTransferJob::Methods methods);
 
+    void setStunServer(const QHostAddress &host, quint16 port = 3478);
+    void setTurnServer(const QHostAddress &host, quint16 port = 3478);
+    void setTurnUser(const QString &user);
+    void setTurnPassword(const QString &password);
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
@@ -266,6 +306,7 @@ protected:
     /// \endcond
 
 private slots:
+    void _q_fileHashed(const QString &sid, const QByteArray &hash);
     void _q_iqReceived(const QXmppIq&);
     void _q_jobDestroyed(QObject *object);
     void _q_jobError(QXmppTransferJob::Error error);
@@ -282,10 +323,20 @@ private:
     void byteStreamSetReceived(const QXmppByteStreamIq&);
     void ibbCloseIqReceived(const QXmppIbbCloseIq&);
     void ibbDataIqReceived(const QXmppIbbDataIq&);
+    void ibbDataMessageReceived(const QXmppIbbDataIq&);
     void ibbOpenIqReceived(const QXmppIbbOpenIq&);
     void ibbResponseReceived(const QXmppIq&);
+    void ibbSendData(QXmppTransferJob *job);
+    void ibbSendOpen(QXmppTransferJob *job);
+    bool jingleIqReceived(const QXmppJingleIq &iq);
+    void jingleOfferReceived(const QXmppJingleIq &iq);
+    void jingleSendAccept(QXmppTransferJob *job);
+    void jingleSendOffer(QXmppTransferJob *job);
+    void sendOffer(QXmppTransferJob *job);
+    QXmppTransferJob *startOutgoingJob(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid, bool sendRequest);
     void streamInitiationIqReceived(const QXmppStreamInitiationIq&);
     void streamInitiationResultReceived(const QXmppStreamInitiationIq&);
+    void streamInitiationSendRequest(QXmppTransferJob *job);
     void streamInitiationSetReceived(const QXmppStreamInitiationIq&);
     void socksServerSendOffer(QXmppTransferJob *job);
 
@@ -24,6 +24,8 @@
 #ifndef QXMPPTRANSFERMANAGER_P_H
 #define QXMPPTRANSFERMANAGER_P_H
 
+#include <QRunnable>
+
 #include "QXmppByteStreamIq.h"
 #include "QXmppTransferManager.h"
 
@@ -38,9 +40,31 @@
 // We mean it.
 //
 
+class QFileInfo;
 class QTimer;
 class QXmppSocksClient;
 
+// Computes the MD5 hash of a file on a worker thread, and stores it in a
+// cache keyed by path, size and modification time.
+
+class QXmppTransferFileHasher : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    QXmppTransferFileHasher(const QString &filePath, const QString &sid);
+    void run();
+
+    static QByteArray cachedHash(const QFileInfo &info);
+
+signals:
+    void finished(const QString &sid, const QByteArray &hash);
+
+private:
+    QString m_filePath;
+    QString m_sid;
+};
+
 class QXmppTransferIncomingJob : public QXmppTransferJob
 {
     Q_OBJECT
@@ -50,19 +74,32 @@ public:
     void checkData();
     void connectToHosts(const QXmppByteStreamIq &iq);
     bool writeData(const QByteArray &data);
+    bool writeData(const char *data, qint64 size);
 
 private slots:
     void _q_candidateDisconnected();
     void _q_candidateReady();
     void _q_disconnected();
+    void _q_iceConnected();
     void _q_receiveData();
+    void connectToNextHost();
 
 private:
-    void connectToNextHost();
+    struct Candidate
+    {
+        QXmppByteStreamIq::StreamHost host;
+        QXmppSocksClient *client;
+        QTimer *timer;
+    };
+
+    int findCandidate(QObject *object) const;
+    void removeCandidate(int index);
 
-    QXmppByteStreamIq::StreamHost m_candidateHost;
-    QXmppSocksClient *m_candidateClient;
+    // connection attempts in progress
+    QList<Candidate> m_candidates;
+    // staggers the connection attempts
     QTimer *m_candidateTimer;
+    // stream hosts which were not tried yet
     QList<QXmppByteStreamIq::StreamHost> m_streamCandidates;
     QString m_streamOfferId;
     QString m_streamOfferFrom;
@@ -75,10 +112,12 @@ class QXmppTransferOutgoingJob : public QXmppTransferJob
 public:
     QXmppTransferOutgoingJob(const QString &jid, QXmppClient *client, QObject *parent);
     void connectToProxy();
+    bool seekRange(qint64 offset);
     void startSending();
 
 private slots:
     void _q_disconnected();
+    void _q_iceConnected();
     void _q_proxyReady();
     void _q_sendData();
 };
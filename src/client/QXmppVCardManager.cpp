@@ -22,8 +22,14 @@
  */
 
 
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
+#include "QXmppPresence.h"
 #include "QXmppUtils.h"
 #include "QXmppVCardIq.h"
 #include "QXmppVCardManager.h"
@@ -31,10 +37,24 @@
 class QXmppVCardManagerPrivate
 {
 public:
+    QString avatarPath(const QByteArray &hash) const;
+
     QXmppVCardIq clientVCard;
     bool isClientVCardReceived;
+
+    // ids of the requests in progress, by JID
+    QHash<QString, QString> requests;
+
+    // XEP-0153: avatar cache and the hashes announced by contacts
+    QString avatarCacheDirectory;
+    QHash<QString, QByteArray> avatarHashes;
 };
 
+QString QXmppVCardManagerPrivate::avatarPath(const QByteArray &hash) const
+{
+    return QDir(avatarCacheDirectory).filePath(QString::fromLatin1(hash.toHex()));
+}
+
 QXmppVCardManager::QXmppVCardManager()
     : d(new QXmppVCardManagerPrivate)
 {
@@ -49,15 +69,64 @@ QXmppVCardManager::~QXmppVCardManager()
 /// This function requests the server for vCard of the specified jid.
 /// Once received the signal vCardReceived() is emitted.
 ///
+/// If a request for the same jid is already in progress, no new request
+/// is sent and the id of the pending one is returned.
+///
 /// \param jid Jid of the specific entry in the roster
 ///
 QString QXmppVCardManager::requestVCard(const QString& jid)
 {
+    const QString pendingId = d->requests.value(jid);
+    if (!pendingId.isEmpty())
+        return pendingId;
+
     QXmppVCardIq request(jid);
-    if(client()->sendPacket(request))
-        return request.id();
-    else
+    if (!client()->sendPacket(request))
         return QString();
+
+    d->requests.insert(jid, request.id());
+    return request.id();
+}
+
+/// Returns the directory in which avatars are cached.
+
+QString QXmppVCardManager::avatarCacheDirectory() const
+{
+    return d->avatarCacheDirectory;
+}
+
+/// Sets the directory in which avatars are cached, as files named after
+/// the SHA-1 hash of the image.
+///
+/// When a directory is set, the manager watches the avatar hashes which
+/// contacts announce in their presence, as defined by XEP-0153: vCard-Based
+/// Avatars. It only requests a contact's vCard if its avatar is not cached
+/// yet, and emits avatarChanged() once the avatar is available.
+///
+/// \param directory
+
+void QXmppVCardManager::setAvatarCacheDirectory(const QString &directory)
+{
+    d->avatarCacheDirectory = directory;
+}
+
+/// Returns the cached avatar of the given contact, based on the hash
+/// announced in its last presence.
+///
+/// If the avatar is not cached, an empty QByteArray is returned.
+///
+/// \param bareJid
+
+QByteArray QXmppVCardManager::avatar(const QString &bareJid) const
+{
+    const QByteArray hash = d->avatarHashes.value(bareJid);
+    if (d->avatarCacheDirectory.isEmpty() || hash.isEmpty())
+        return QByteArray();
+
+    QFile file(d->avatarPath(hash));
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
 }
 
 /// Returns the vCard of the connected client.
@@ -107,6 +176,13 @@ QStringList QXmppVCardManager::discoveryFeatures() const
     return QStringList() << ns_vcard;
 }
 
+QList<QXmppClientExtension::StanzaFilter> QXmppVCardManager::stanzaFilters() const
+{
+    QList<StanzaFilter> filters;
+    filters << StanzaFilter("iq", ns_vcard, "vCard");
+    return filters;
+}
+
 bool QXmppVCardManager::handleStanza(const QDomElement &element)
 {
     if(element.tagName() == "iq" && QXmppVCardIq::isVCard(element))
@@ -114,6 +190,11 @@ bool QXmppVCardManager::handleStanza(const QDomElement &element)
         QXmppVCardIq vCardIq;
         vCardIq.parse(element);
 
+        if (vCardIq.type() == QXmppIq::Result || vCardIq.type() == QXmppIq::Error)
+            removeRequest(vCardIq.id());
+        if (vCardIq.type() == QXmppIq::Result)
+            storeAvatar(vCardIq);
+
         if (vCardIq.from().isEmpty()) {
             d->clientVCard = vCardIq;
             d->isClientVCardReceived = true;
@@ -127,4 +208,91 @@ bool QXmppVCardManager::handleStanza(const QDomElement &element)
 
     return false;
 }
+
+void QXmppVCardManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(sessionEnded()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(iqReceived(QXmppIq)),
+                    this, SLOT(_q_iqReceived(QXmppIq)));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(presenceReceived(QXmppPresence)),
+                    this, SLOT(_q_presenceReceived(QXmppPresence)));
+    Q_ASSERT(check);
+}
 /// \endcond
+
+void QXmppVCardManager::removeRequest(const QString &id)
+{
+    QHash<QString, QString>::iterator it = d->requests.begin();
+    while (it != d->requests.end()) {
+        if (it.value() == id)
+            it = d->requests.erase(it);
+        else
+            ++it;
+    }
+}
+
+void QXmppVCardManager::storeAvatar(const QXmppVCardIq &vCard)
+{
+    if (d->avatarCacheDirectory.isEmpty())
+        return;
+
+    const QByteArray photo = vCard.photo();
+    if (photo.isEmpty())
+        return;
+
+    const QByteArray hash = QCryptographicHash::hash(photo, QCryptographicHash::Sha1);
+    const QString path = d->avatarPath(hash);
+    if (!QFile::exists(path)) {
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || file.write(photo) != photo.size()) {
+            warning(QString("Could not write avatar to %1").arg(path));
+            file.remove();
+            return;
+        }
+    }
+
+    const QString bareJid = QXmppUtils::jidToBareJid(vCard.from());
+    if (!bareJid.isEmpty() && d->avatarHashes.value(bareJid) == hash)
+        emit avatarChanged(bareJid);
+}
+
+void QXmppVCardManager::_q_disconnected()
+{
+    d->requests.clear();
+}
+
+void QXmppVCardManager::_q_iqReceived(const QXmppIq &iq)
+{
+    // errors which carry no vCard are not handled by handleStanza()
+    if (iq.type() == QXmppIq::Error)
+        removeRequest(iq.id());
+}
+
+void QXmppVCardManager::_q_presenceReceived(const QXmppPresence &presence)
+{
+    if (d->avatarCacheDirectory.isEmpty() ||
+        presence.type() != QXmppPresence::Available ||
+        presence.vCardUpdateType() != QXmppPresence::VCardUpdateValidPhoto)
+        return;
+
+    const QString bareJid = QXmppUtils::jidToBareJid(presence.from());
+    const QByteArray hash = presence.photoHash();
+    if (bareJid.isEmpty() || hash.isEmpty() || d->avatarHashes.value(bareJid) == hash)
+        return;
+
+    d->avatarHashes.insert(bareJid, hash);
+    if (QFile::exists(d->avatarPath(hash)))
+        emit avatarChanged(bareJid);
+    else
+        requestVCard(bareJid);
+}
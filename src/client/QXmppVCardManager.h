@@ -27,6 +27,8 @@
 
 #include "QXmppClientExtension.h"
 
+class QXmppIq;
+class QXmppPresence;
 class QXmppVCardIq;
 class QXmppVCardManagerPrivate;
 
@@ -69,9 +71,14 @@ public:
     QString requestClientVCard();
     bool isClientVCardReceived() const;
 
+    QString avatarCacheDirectory() const;
+    void setAvatarCacheDirectory(const QString &directory);
+    QByteArray avatar(const QString &bareJid) const;
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
+    QList<StanzaFilter> stanzaFilters() const;
     /// \endcond
 
 signals:
@@ -83,7 +90,25 @@ signals:
     /// after calling the requestClientVCard() function.
     void clientVCardReceived();
 
+    /// This signal is emitted when the cached avatar of a contact changes,
+    /// if an avatar cache directory is set. The avatar can be retrieved
+    /// using avatar().
+    void avatarChanged(const QString &bareJid);
+
+protected:
+    /// \cond
+    void setClient(QXmppClient *client);
+    /// \endcond
+
+private slots:
+    void _q_disconnected();
+    void _q_iqReceived(const QXmppIq &iq);
+    void _q_presenceReceived(const QXmppPresence &presence);
+
 private:
+    void removeRequest(const QString &id);
+    void storeAvatar(const QXmppVCardIq &vCard);
+
     QXmppVCardManagerPrivate *d;
 };
 
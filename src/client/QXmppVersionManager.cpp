@@ -27,17 +27,39 @@
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
 #include "QXmppGlobal.h"
+#include "QXmppQueryLimiter_p.h"
+#include "QXmppRawStanza.h"
 #include "QXmppVersionManager.h"
 #include "QXmppVersionIq.h"
 
 class QXmppVersionManagerPrivate
 {
 public:
+    QXmppRawStanza response();
+
     QString clientName;
     QString clientVersion;
     QString clientOs;
+
+    QXmppQueryLimiter limiter;
+    QXmppRawStanza cachedResponse;
 };
 
+/// Returns the serialized response to version queries.
+
+QXmppRawStanza QXmppVersionManagerPrivate::response()
+{
+    if (cachedResponse.isNull()) {
+        QXmppVersionIq responseIq;
+        responseIq.setType(QXmppIq::Result);
+        responseIq.setName(clientName);
+        responseIq.setVersion(clientVersion);
+        responseIq.setOs(clientOs);
+        cachedResponse = QXmppRawStanza(responseIq);
+    }
+    return cachedResponse;
+}
+
 QXmppVersionManager::QXmppVersionManager()
     : d(new QXmppVersionManagerPrivate)
 {
@@ -87,6 +109,7 @@ QString QXmppVersionManager::requestVersion(const QString& jid)
 void QXmppVersionManager::setClientName(const QString& name)
 {
     d->clientName = name;
+    d->cachedResponse = QXmppRawStanza();
 }
 
 /// Sets the local XMPP client's version.
@@ -96,6 +119,7 @@ void QXmppVersionManager::setClientName(const QString& name)
 void QXmppVersionManager::setClientVersion(const QString& version)
 {
     d->clientVersion = version;
+    d->cachedResponse = QXmppRawStanza();
 }
 
 /// Sets the local XMPP client's operating system.
@@ -105,6 +129,7 @@ void QXmppVersionManager::setClientVersion(const QString& version)
 void QXmppVersionManager::setClientOs(const QString& os)
 {
     d->clientOs = os;
+    d->cachedResponse = QXmppRawStanza();
 }
 
 /// Returns the local XMPP client's name.
@@ -137,6 +162,26 @@ QString QXmppVersionManager::clientOs() const
     return d->clientOs;
 }
 
+/// Returns the maximum number of version queries answered for each
+/// requester per minute, 0 meaning there is no limit.
+
+int QXmppVersionManager::queryLimit() const
+{
+    return d->limiter.limit();
+}
+
+/// Sets the maximum number of version queries answered for each requester
+/// per minute. The queries beyond this limit are ignored.
+///
+/// The default value of 0 means there is no limit.
+///
+/// \param queries
+
+void QXmppVersionManager::setQueryLimit(int queries)
+{
+    d->limiter.setLimit(queries);
+}
+
 /// \cond
 QStringList QXmppVersionManager::discoveryFeatures() const
 {
@@ -144,6 +189,13 @@ QStringList QXmppVersionManager::discoveryFeatures() const
     return QStringList() << ns_version;
 }
 
+QList<QXmppClientExtension::StanzaFilter> QXmppVersionManager::stanzaFilters() const
+{
+    QList<StanzaFilter> filters;
+    filters << StanzaFilter("iq", ns_version, "query");
+    return filters;
+}
+
 bool QXmppVersionManager::handleStanza(const QDomElement &element)
 {
     if (element.tagName() == "iq" && QXmppVersionIq::isVersionIq(element))
@@ -152,17 +204,19 @@ bool QXmppVersionManager::handleStanza(const QDomElement &element)
         versionIq.parse(element);
 
         if (versionIq.type() == QXmppIq::Get) {
-            // respond to query
-            QXmppVersionIq responseIq;
-            responseIq.setType(QXmppIq::Result);
+            if (!d->limiter.accept(versionIq.from()))
+                return true;
+
+            // respond to query, only the recipient differs between responses
+            QXmppIq responseIq(QXmppIq::Result);
             responseIq.setId(versionIq.id());
             responseIq.setTo(versionIq.from());
 
-            responseIq.setName(clientName());
-            responseIq.setVersion(clientVersion());
-            responseIq.setOs(clientOs());
-
-            client()->sendPacket(responseIq);
+            QXmppRawStanza response = d->response();
+            response.setAttribute("id", versionIq.id());
+            if (!versionIq.from().isEmpty())
+                response.setAttribute("to", versionIq.from());
+            client()->sendPacket(responseIq, response.data());
         } else if (versionIq.type() == QXmppIq::Result) {
             // emit response
             emit versionReceived(versionIq);
@@ -32,6 +32,10 @@ class QXmppVersionManagerPrivate;
 /// \brief The QXmppVersionManager class makes it possible to request for
 /// the software version of an entity as defined by XEP-0092: Software Version.
 ///
+/// The response to version queries is serialized once, and only its "id"
+/// and "to" attributes are rewritten for each query. The number of queries
+/// answered for each requester can be limited with setQueryLimit().
+///
 /// \ingroup Managers
 
 class QXMPP_EXPORT QXmppVersionManager : public QXmppClientExtension
@@ -52,9 +56,13 @@ public:
     QString clientVersion() const;
     QString clientOs() const;
 
+    int queryLimit() const;
+    void setQueryLimit(int queries);
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
+    QList<StanzaFilter> stanzaFilters() const;
     /// \endcond
 
 signals:
@@ -3,16 +3,21 @@ INSTALL_HEADERS += \
     client/QXmppArchiveManager.h \
     client/QXmppBookmarkManager.h \
     client/QXmppCallManager.h \
+    client/QXmppCapabilitiesCache.h \
     client/QXmppClient.h \
     client/QXmppClientExtension.h \
+    client/QXmppClientPool.h \
     client/QXmppConfiguration.h \
     client/QXmppDiscoveryManager.h \
     client/QXmppEntityTimeManager.h \
     client/QXmppInvokable.h \
+    client/QXmppIqRequest.h \
+    client/QXmppMamManager.h \
     client/QXmppMessageReceiptManager.h \
     client/QXmppMucManager.h \
     client/QXmppOutgoingClient.h \
     client/QXmppRemoteMethod.h \
+    client/QXmppRosterCache.h \
     client/QXmppRosterManager.h \
     client/QXmppRpcManager.h \
     client/QXmppSimpleArchiveManager.h \
@@ -27,16 +32,23 @@ SOURCES += \
     client/QXmppDiscoveryManager.cpp \
     client/QXmppArchiveManager.cpp \
     client/QXmppBookmarkManager.cpp \
+    client/QXmppBoshClient.cpp \
     client/QXmppCallManager.cpp \
+    client/QXmppCapabilitiesCache.cpp \
     client/QXmppClient.cpp \
     client/QXmppClientExtension.cpp \
+    client/QXmppClientPool.cpp \
     client/QXmppConfiguration.cpp \
     client/QXmppEntityTimeManager.cpp \
     client/QXmppInvokable.cpp \
+    client/QXmppIqRequest.cpp \
+    client/QXmppMamManager.cpp \
     client/QXmppMessageReceiptManager.cpp \
     client/QXmppMucManager.cpp \
     client/QXmppOutgoingClient.cpp \
+    client/QXmppQueryLimiter.cpp \
     client/QXmppRemoteMethod.cpp \
+    client/QXmppRosterCache.cpp \
     client/QXmppRosterManager.cpp \
     client/QXmppRpcManager.cpp \
     client/QXmppSimpleArchiveManager.cpp \
@@ -47,4 +59,7 @@ SOURCES += \
     client/QXmppLastActivityManager.cpp
 
 HEADERS += \
+    client/QXmppBoshClient_p.h \
+    client/QXmppClientPool_p.h \
+    client/QXmppQueryLimiter_p.h \
     client/QXmppPEPManager.h
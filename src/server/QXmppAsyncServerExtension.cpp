@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QDomElement>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include "QXmppAsyncServerExtension.h"
+#include "QXmppIq.h"
+#include "QXmppMetrics.h"
+#include "QXmppServer.h"
+#include "QXmppStanzaTrace_p.h"
+#include "QXmppUtils.h"
+
+class QXmppAsyncServerExtensionPrivate
+{
+public:
+    QXmppAsyncServerExtensionPrivate();
+
+    QThreadPool pool;
+    int maximumQueueDepth;
+    int queueDepth;
+
+    // metric names derive from the extension name, which is only known
+    // once the subclass is constructed
+    QString prefix;
+    int latencyHistogram;
+};
+
+QXmppAsyncServerExtensionPrivate::QXmppAsyncServerExtensionPrivate()
+    : maximumQueueDepth(0)
+    , queueDepth(0)
+    , latencyHistogram(-1)
+{
+}
+
+/// \internal
+///
+/// The QXmppAsyncServerJob class processes one stanza in a worker thread.
+///
+/// The job owns a copy of the stanza in its own document, so that the
+/// worker thread shares no DOM nodes with the server's thread.
+
+class QXmppAsyncServerJob : public QRunnable
+{
+public:
+    QXmppAsyncServerJob(QXmppAsyncServerExtension *extension, const QDomElement &stanza)
+        : m_extension(extension)
+        , m_claimedTime(QXmppStanzaTrace::now())
+    {
+        m_document.appendChild(m_document.importNode(stanza, true));
+    }
+
+    void run()
+    {
+        m_extension->processStanza(m_document.documentElement());
+        QXmppMetrics::recordValue(m_extension->d->latencyHistogram, QXmppStanzaTrace::now() - m_claimedTime);
+
+        // queued after the responses, so it is handled after them
+        QMetaObject::invokeMethod(m_extension, "_q_processed", Qt::QueuedConnection);
+    }
+
+private:
+    QXmppAsyncServerExtension *m_extension;
+    QDomDocument m_document;
+    qint64 m_claimedTime;
+};
+
+/// Constructs an asynchronous server extension.
+
+QXmppAsyncServerExtension::QXmppAsyncServerExtension()
+    : d(new QXmppAsyncServerExtensionPrivate)
+{
+}
+
+/// Destroys the extension.
+///
+/// As processStanza() is reimplemented by a subclass, the subclass should
+/// call waitForDone() in its destructor.
+
+QXmppAsyncServerExtension::~QXmppAsyncServerExtension()
+{
+    d->pool.waitForDone();
+    delete d;
+}
+
+/// Returns the maximum number of worker threads which process stanzas.
+
+int QXmppAsyncServerExtension::maximumThreadCount() const
+{
+    return d->pool.maxThreadCount();
+}
+
+/// Sets the maximum number of worker threads which process stanzas.
+///
+/// The default is the number of CPU cores.
+///
+/// \param count
+
+void QXmppAsyncServerExtension::setMaximumThreadCount(int count)
+{
+    d->pool.setMaxThreadCount(count);
+}
+
+/// Returns the maximum number of stanzas waiting or being processed, or
+/// 0 if there is no limit.
+
+int QXmppAsyncServerExtension::maximumQueueDepth() const
+{
+    return d->maximumQueueDepth;
+}
+
+/// Sets the maximum number of stanzas waiting or being processed.
+///
+/// Set \a depth to 0 to disable the limit, which is the default.
+
+void QXmppAsyncServerExtension::setMaximumQueueDepth(int depth)
+{
+    d->maximumQueueDepth = qMax(0, depth);
+}
+
+/// Returns the number of stanzas waiting or being processed.
+
+int QXmppAsyncServerExtension::queueDepth() const
+{
+    return d->queueDepth;
+}
+
+/// \cond
+bool QXmppAsyncServerExtension::handleStanza(const QDomElement &stanza)
+{
+    if (!claimStanza(stanza))
+        return false;
+
+    if (d->prefix.isEmpty()) {
+        const QString name = extensionName();
+        d->prefix = name.isEmpty() ? QString("async.") : name + QLatin1String(".async.");
+        d->latencyHistogram = QXmppMetrics::histogram(d->prefix + QLatin1String("latency"));
+    }
+
+    // refuse the stanza if too many are waiting
+    if (d->maximumQueueDepth > 0 && d->queueDepth >= d->maximumQueueDepth) {
+        updateCounter(d->prefix + QLatin1String("rejected"));
+
+        const QString type = stanza.attribute("type");
+        if (stanza.tagName() == QLatin1String("iq") &&
+            (type == QLatin1String("get") || type == QLatin1String("set"))) {
+            QXmppIq response(QXmppIq::Error);
+            response.setId(stanza.attribute("id"));
+            response.setFrom(stanza.attribute("to"));
+            response.setTo(stanza.attribute("from"));
+            response.setError(QXmppStanza::Error(QXmppStanza::Error::Wait,
+                QXmppStanza::Error::ResourceConstraint));
+            server()->sendPacket(response);
+        }
+        return true;
+    }
+
+    d->queueDepth++;
+    setGauge(d->prefix + QLatin1String("queue-depth"), d->queueDepth);
+    d->pool.start(new QXmppAsyncServerJob(this, stanza));
+    return true;
+}
+
+void QXmppAsyncServerExtension::stop()
+{
+    waitForDone();
+}
+/// \endcond
+
+/// Routes a response to a stanza.
+///
+/// This method is thread-safe, it is meant to be called from
+/// processStanza().
+///
+/// \param stanza
+
+void QXmppAsyncServerExtension::sendResponse(const QXmppStanza &stanza)
+{
+    // serialize the stanza in the calling thread
+    QMetaObject::invokeMethod(this, "_q_sendData", Qt::QueuedConnection,
+                              Q_ARG(QString, stanza.to()),
+                              Q_ARG(QByteArray, helperToXmlData(stanza)));
+}
+
+/// Waits for the stanzas which were claimed to be processed.
+///
+/// Their responses are routed once the server's thread returns to its
+/// event loop.
+
+void QXmppAsyncServerExtension::waitForDone()
+{
+    d->pool.waitForDone();
+}
+
+void QXmppAsyncServerExtension::_q_processed()
+{
+    d->queueDepth--;
+    setGauge(d->prefix + QLatin1String("queue-depth"), d->queueDepth);
+}
+
+void QXmppAsyncServerExtension::_q_sendData(const QString &to, const QByteArray &data)
+{
+    if (server())
+        server()->sendData(to, data);
+}
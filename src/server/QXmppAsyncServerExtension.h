@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPASYNCSERVEREXTENSION_H
+#define QXMPPASYNCSERVEREXTENSION_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppAsyncServerExtensionPrivate;
+class QXmppStanza;
+
+/// \brief The QXmppAsyncServerExtension class is the base class for server
+/// extensions which handle stanzas in a pool of worker threads, for
+/// instance to query a database.
+///
+/// Reimplement claimStanza() to tell which stanzas the extension handles.
+/// It is called from the server's thread and must return quickly. Each
+/// stanza it claims is copied and passed to processStanza(), which is
+/// called from a worker thread, so it must be thread-safe, but it may
+/// block. The responses it sends with sendResponse() are routed from the
+/// server's thread, in the order they were sent.
+///
+/// Once maximumQueueDepth() stanzas are waiting or being processed, the
+/// IQ requests the extension claims are answered with a resource-constraint
+/// error and its other stanzas are dropped.
+///
+/// The number of stanzas waiting or being processed is reported by the
+/// "<name>.async.queue-depth" gauge, the time in microseconds from
+/// claiming a stanza to the end of its processing by the
+/// "<name>.async.latency" histogram, and the stanzas refused by the
+/// "<name>.async.rejected" counter, where <name> is the extensionName().
+/// Without a name, the metrics start with "async.".
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppAsyncServerExtension : public QXmppServerExtension
+{
+    Q_OBJECT
+
+public:
+    QXmppAsyncServerExtension();
+    ~QXmppAsyncServerExtension();
+
+    int maximumThreadCount() const;
+    void setMaximumThreadCount(int count);
+
+    int maximumQueueDepth() const;
+    void setMaximumQueueDepth(int depth);
+
+    int queueDepth() const;
+
+    /// \cond
+    bool handleStanza(const QDomElement &stanza);
+    void stop();
+    /// \endcond
+
+protected:
+    /// Returns true if the extension handles the \a stanza, which is then
+    /// passed to processStanza().
+    ///
+    /// This is called from the server's thread.
+    virtual bool claimStanza(const QDomElement &stanza) = 0;
+
+    /// Processes a \a stanza which claimStanza() accepted.
+    ///
+    /// This is called from a worker thread.
+    virtual void processStanza(const QDomElement &stanza) = 0;
+
+    void sendResponse(const QXmppStanza &stanza);
+    void waitForDone();
+
+private slots:
+    void _q_processed();
+    void _q_sendData(const QString &to, const QByteArray &data);
+
+private:
+    QXmppAsyncServerExtensionPrivate * const d;
+    friend class QXmppAsyncServerJob;
+};
+
+#endif
@@ -0,0 +1,761 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <string.h>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QPointer>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include "QXmppBoshServer_p.h"
+#include "QXmppConstants.h"
+#include "QXmppStreamSplitter_p.h"
+#include "QXmppUtils.h"
+
+// the largest request headers and body which are accepted
+static const int maximumHeaderSize = 8192;
+static const int maximumBodySize = 1048576;
+
+static QByteArray httpResponse(const QByteArray &status, const QByteArray &body, const QByteArray &headers = QByteArray())
+{
+    return "HTTP/1.1 " + status + "\r\n"
+           "Content-Type: text/xml; charset=utf-8\r\n"
+           "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+           "Access-Control-Allow-Origin: *\r\n" + headers +
+           "\r\n" + body;
+}
+
+static QByteArray terminateBody(const QByteArray &condition = QByteArray())
+{
+    QByteArray body = "<body xmlns='" + QByteArray(ns_httpbind.latin1()) + "' type='terminate'";
+    if (!condition.isEmpty())
+        body += " condition='" + condition + "'";
+    return body + "/>";
+}
+
+struct QXmppBoshRequest
+{
+    QPointer<QTcpSocket> socket;
+    qint64 rid;
+    QByteArray tag;
+    QByteArray payload;
+    qint64 deadline;
+};
+
+struct QXmppBoshConnection
+{
+    QXmppBoshConnection()
+        : busy(false), closeAfterResponse(false)
+    {
+    }
+
+    QByteArray buffer;
+    bool busy;
+    bool closeAfterResponse;
+};
+
+class QXmppBoshSessionPrivate
+{
+public:
+    QXmppBoshSessionPrivate(QXmppBoshSession *qq);
+
+    void finish();
+    void handleRequest(const QXmppBoshRequest &request);
+    void processRequest(const QXmppBoshRequest &request);
+    void respond(const QXmppBoshRequest &request, const QByteArray &body);
+    void respondHeldRequests();
+    QByteArray responseBody(qint64 rid, const QByteArray &payload, bool terminate) const;
+    QByteArray streamHeader(const QByteArray &tag) const;
+
+    QPointer<QXmppBoshServer> server;
+    QString sid;
+    bool open;
+    int hold;
+    int wait;
+    int inactivity;
+
+    // request identifiers of the session creation request and of the
+    // next request to process
+    qint64 firstRid;
+    qint64 nextRid;
+
+    // the requests which are held open, in the order of their identifiers,
+    // those which arrived before their predecessors, and the responses
+    // which the client may ask for again
+    QList<QXmppBoshRequest> heldRequests;
+    QMap<qint64, QXmppBoshRequest> pendingRequests;
+    QMap<qint64, QByteArray> responses;
+
+    QByteArray domain;
+    QByteArray streamId;
+    QByteArray readBuffer;
+    QXmppStreamSplitter splitter;
+    QByteArray output;
+    bool streamEnded;
+    bool flushScheduled;
+
+    QElapsedTimer clock;
+    QTimer *timer;
+
+private:
+    QXmppBoshSession *q;
+};
+
+class QXmppBoshServerPrivate
+{
+public:
+    QXmppBoshServerPrivate(QXmppBoshServer *qq);
+    void handleBody(QTcpSocket *socket, const QByteArray &body);
+    void processRequests(QTcpSocket *socket);
+    void writeResponse(QTcpSocket *socket, const QByteArray &response);
+
+    QHash<QTcpSocket*, QXmppBoshConnection> connections;
+    QHash<QString, QXmppBoshSession*> sessions;
+    int maximumHold;
+    int maximumWait;
+    int inactivity;
+
+private:
+    QXmppBoshServer *q;
+};
+
+QXmppBoshSessionPrivate::QXmppBoshSessionPrivate(QXmppBoshSession *qq)
+    : open(true)
+    , hold(1)
+    , wait(60)
+    , inactivity(60)
+    , firstRid(0)
+    , nextRid(0)
+    , streamEnded(false)
+    , flushScheduled(false)
+    , timer(0)
+    , q(qq)
+{
+}
+
+// Ends the session, answering the requests which are still held.
+
+void QXmppBoshSessionPrivate::finish()
+{
+    if (!open)
+        return;
+
+    open = false;
+    while (!heldRequests.isEmpty()) {
+        const QXmppBoshRequest request = heldRequests.takeFirst();
+        respond(request, responseBody(request.rid, output, true));
+        output.clear();
+    }
+    timer->stop();
+    pendingRequests.clear();
+    QMetaObject::invokeMethod(q, "disconnected", Qt::QueuedConnection);
+}
+
+void QXmppBoshSessionPrivate::handleRequest(const QXmppBoshRequest &request)
+{
+    if (!open) {
+        respond(request, terminateBody());
+        return;
+    }
+
+    if (request.rid < nextRid) {
+        // the client lost the connection and sent the request again
+        for (int i = 0; i < heldRequests.size(); ++i) {
+            if (heldRequests[i].rid == request.rid) {
+                heldRequests[i].socket = request.socket;
+                return;
+            }
+        }
+        if (responses.contains(request.rid)) {
+            if (server)
+                server->d->writeResponse(request.socket, responses.value(request.rid));
+            return;
+        }
+        respond(request, terminateBody("item-not-found"));
+        finish();
+        return;
+    } else if (request.rid > nextRid + hold) {
+        // the client may only send as many requests ahead as it
+        // may keep open
+        respond(request, terminateBody("item-not-found"));
+        finish();
+        return;
+    }
+
+    const int readSize = readBuffer.size();
+    pendingRequests.insert(request.rid, request);
+    while (open && pendingRequests.contains(nextRid))
+        processRequest(pendingRequests.take(nextRid++));
+
+    // only the responses within the window can be asked for again
+    while (!responses.isEmpty() && responses.begin().key() < nextRid - hold - 1)
+        responses.erase(responses.begin());
+
+    if (readBuffer.size() > readSize)
+        emit q->readyRead();
+    if (open)
+        respondHeldRequests();
+}
+
+void QXmppBoshSessionPrivate::processRequest(const QXmppBoshRequest &request)
+{
+    if (request.rid == firstRid ||
+        QXmppStreamSplitter::attribute(request.tag, "xmpp:restart") == "true")
+        readBuffer += streamHeader(request.tag);
+    readBuffer += request.payload;
+
+    if (QXmppStreamSplitter::attribute(request.tag, "type") == "terminate") {
+        readBuffer += "</stream:stream>";
+        respond(request, terminateBody());
+        finish();
+        return;
+    }
+
+    QXmppBoshRequest held = request;
+    held.deadline = clock.elapsed() + wait * 1000;
+    held.tag.clear();
+    held.payload.clear();
+    heldRequests << held;
+}
+
+void QXmppBoshSessionPrivate::respond(const QXmppBoshRequest &request, const QByteArray &body)
+{
+    const QByteArray response = httpResponse("200 OK", body);
+    responses.insert(request.rid, response);
+    if (server)
+        server->d->writeResponse(request.socket, response);
+}
+
+// Answers the held requests for which there is data, which expired, or
+// which exceed the number of requests the session may hold.
+
+void QXmppBoshSessionPrivate::respondHeldRequests()
+{
+    for (int i = heldRequests.size() - 1; i >= 0; --i) {
+        QTcpSocket *socket = heldRequests[i].socket;
+        if (!socket || socket->state() != QAbstractSocket::ConnectedState)
+            heldRequests.removeAt(i);
+    }
+
+    const qint64 now = clock.elapsed();
+    while (!heldRequests.isEmpty()) {
+        if (output.isEmpty() && !streamEnded &&
+            heldRequests.size() <= hold &&
+            heldRequests.first().deadline > now)
+            break;
+
+        // all the pending data goes into the oldest request
+        const QXmppBoshRequest request = heldRequests.takeFirst();
+        respond(request, responseBody(request.rid, output, streamEnded));
+        output.clear();
+    }
+
+    if (streamEnded) {
+        finish();
+    } else if (!heldRequests.isEmpty()) {
+        timer->start(int(qMax(heldRequests.first().deadline - now, qint64(0))));
+    } else {
+        // the client must come back within the inactivity period
+        timer->start(inactivity * 1000);
+    }
+}
+
+QByteArray QXmppBoshSessionPrivate::responseBody(qint64 rid, const QByteArray &payload, bool terminate) const
+{
+    QByteArray body = "<body xmlns='" + QByteArray(ns_httpbind.latin1()) + "'";
+    if (rid == firstRid) {
+        body += " xmlns:xmpp='" + QByteArray(ns_xbosh.latin1()) + "'"
+                " sid='" + sid.toUtf8() + "'"
+                " wait='" + QByteArray::number(wait) + "'"
+                " requests='" + QByteArray::number(hold + 1) + "'"
+                " hold='" + QByteArray::number(hold) + "'"
+                " inactivity='" + QByteArray::number(inactivity) + "'"
+                " polling='1'"
+                " ver='1.11'"
+                " from='" + domain + "'"
+                " xmpp:version='1.0'"
+                " xmpp:restartlogic='true'";
+        if (!streamId.isEmpty())
+            body += " authid='" + streamId + "'";
+    }
+    if (terminate)
+        body += " type='terminate'";
+    if (payload.isEmpty())
+        return body + "/>";
+    return body + ">" + payload + "</body>";
+}
+
+// Returns the stream header for a session creation or restart request.
+
+QByteArray QXmppBoshSessionPrivate::streamHeader(const QByteArray &tag) const
+{
+    QByteArray header = "<stream:stream xmlns='" + QByteArray(ns_client.latin1()) + "'"
+                        " xmlns:stream='" + QByteArray(ns_stream.latin1()) + "'"
+                        " to='" + domain + "'";
+    const QByteArray lang = QXmppStreamSplitter::attribute(tag, "xml:lang");
+    if (!lang.isEmpty())
+        header += " xml:lang='" + lang + "'";
+    const QByteArray version = QXmppStreamSplitter::attribute(tag, "xmpp:version");
+    if (!version.isEmpty())
+        header += " version='" + version + "'";
+    return header + ">";
+}
+
+QXmppBoshSession::QXmppBoshSession(const QString &sid, QObject *parent)
+    : QIODevice(parent)
+    , d(new QXmppBoshSessionPrivate(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->sid = sid;
+    d->clock.start();
+
+    d->timer = new QTimer(this);
+    d->timer->setSingleShot(true);
+    check = connect(d->timer, SIGNAL(timeout()),
+                    this, SLOT(_q_timeout()));
+    Q_ASSERT(check);
+
+    open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+/// Destroys the BOSH session.
+
+QXmppBoshSession::~QXmppBoshSession()
+{
+    delete d;
+}
+
+/// Returns the number of requests the server may hold open.
+
+int QXmppBoshSession::hold() const
+{
+    return d->hold;
+}
+
+/// Returns the session identifier.
+
+QString QXmppBoshSession::sid() const
+{
+    return d->sid;
+}
+
+/// Returns the longest time in seconds for which a request is held open.
+
+int QXmppBoshSession::wait() const
+{
+    return d->wait;
+}
+
+/// Returns the number of bytes of the XMPP stream which can be read.
+
+qint64 QXmppBoshSession::bytesAvailable() const
+{
+    return d->readBuffer.size() + QIODevice::bytesAvailable();
+}
+
+/// Returns the number of bytes which were written but not sent yet.
+
+qint64 QXmppBoshSession::bytesToWrite() const
+{
+    return d->output.size() + d->splitter.bufferSize();
+}
+
+/// Ends the session.
+
+void QXmppBoshSession::close()
+{
+    d->finish();
+    QIODevice::close();
+}
+
+/// Returns true, as the XMPP stream is sequential.
+
+bool QXmppBoshSession::isSequential() const
+{
+    return true;
+}
+
+qint64 QXmppBoshSession::readData(char *data, qint64 maxSize)
+{
+    const int size = int(qMin(maxSize, qint64(d->readBuffer.size())));
+    memcpy(data, d->readBuffer.constData(), size);
+    d->readBuffer.remove(0, size);
+    return size;
+}
+
+qint64 QXmppBoshSession::writeData(const char *data, qint64 size)
+{
+    if (!d->open)
+        return -1;
+
+    d->splitter.addData(data, int(size));
+    QXmppStreamSplitter::Token token;
+    while ((token = d->splitter.readNext()) != QXmppStreamSplitter::NoToken) {
+        if (token == QXmppStreamSplitter::StreamStartToken) {
+            // BOSH has no stream header, its attributes go into the
+            // session creation response
+            const QByteArray from = QXmppStreamSplitter::attribute(d->splitter.data(), "from");
+            if (!from.isEmpty())
+                d->domain = from;
+            d->streamId = QXmppStreamSplitter::attribute(d->splitter.data(), "id");
+        } else if (token == QXmppStreamSplitter::ElementToken) {
+            d->output += d->splitter.data();
+        } else {
+            d->streamEnded = true;
+        }
+    }
+
+    // batch the data written in this iteration of the event loop
+    if (!d->flushScheduled) {
+        d->flushScheduled = true;
+        QMetaObject::invokeMethod(this, "_q_flush", Qt::QueuedConnection);
+    }
+    return size;
+}
+
+void QXmppBoshSession::_q_flush()
+{
+    d->flushScheduled = false;
+    if (d->open)
+        d->respondHeldRequests();
+}
+
+void QXmppBoshSession::_q_timeout()
+{
+    if (!d->open)
+        return;
+
+    if (d->heldRequests.isEmpty())
+        d->finish();
+    else
+        d->respondHeldRequests();
+}
+
+QXmppBoshServerPrivate::QXmppBoshServerPrivate(QXmppBoshServer *qq)
+    : maximumHold(2)
+    , maximumWait(60)
+    , inactivity(60)
+    , q(qq)
+{
+}
+
+void QXmppBoshServerPrivate::handleBody(QTcpSocket *socket, const QByteArray &body)
+{
+    const QByteArray data = body.trimmed();
+    const int tagEnd = data.startsWith('<') ? QXmppStreamSplitter::markupEnd(data, 0) : -1;
+    if (tagEnd < 0 || QXmppStreamSplitter::tagName(data) != "body") {
+        writeResponse(socket, httpResponse("400 Bad Request", QByteArray()));
+        return;
+    }
+
+    QXmppBoshRequest request;
+    request.socket = socket;
+    request.tag = data.left(tagEnd);
+    request.deadline = 0;
+    if (!request.tag.endsWith("/>")) {
+        const int payloadEnd = data.lastIndexOf("</");
+        if (payloadEnd < tagEnd) {
+            writeResponse(socket, httpResponse("400 Bad Request", QByteArray()));
+            return;
+        }
+        request.payload = data.mid(tagEnd, payloadEnd - tagEnd);
+    }
+
+    bool ok = false;
+    request.rid = QXmppStreamSplitter::attribute(request.tag, "rid").toLongLong(&ok);
+    if (!ok) {
+        writeResponse(socket, httpResponse("200 OK", terminateBody("bad-request")));
+        return;
+    }
+
+    QXmppBoshSession *session = 0;
+    const QString sid = QString::fromUtf8(QXmppStreamSplitter::attribute(request.tag, "sid"));
+    if (sid.isEmpty()) {
+        // session creation request
+        // the sid authenticates all further requests, so it must not be guessable
+        session = new QXmppBoshSession(QString::fromLatin1(QXmppUtils::generateSecureRandomBytes(16).toHex()), q);
+        QXmppBoshSessionPrivate *sd = session->d;
+        sd->server = q;
+        sd->domain = QXmppStreamSplitter::attribute(request.tag, "to");
+        sd->firstRid = request.rid;
+        sd->nextRid = request.rid;
+        sd->inactivity = inactivity;
+
+        const int hold = QXmppStreamSplitter::attribute(request.tag, "hold").toInt(&ok);
+        sd->hold = ok ? qBound(1, hold, maximumHold) : 1;
+        const int wait = QXmppStreamSplitter::attribute(request.tag, "wait").toInt(&ok);
+        sd->wait = ok ? qBound(1, wait, maximumWait) : maximumWait;
+
+        sessions.insert(session->sid(), session);
+        bool check;
+        Q_UNUSED(check);
+        check = QObject::connect(session, SIGNAL(destroyed(QObject*)),
+                                 q, SLOT(_q_sessionDestroyed(QObject*)));
+        Q_ASSERT(check);
+        emit q->newSession(session);
+    } else {
+        session = sessions.value(sid);
+        if (!session) {
+            writeResponse(socket, httpResponse("200 OK", terminateBody("item-not-found")));
+            return;
+        }
+    }
+    session->d->handleRequest(request);
+}
+
+// Reads the complete requests of a connection, one at a time as
+// responses are sent in the order of the requests.
+
+void QXmppBoshServerPrivate::processRequests(QTcpSocket *socket)
+{
+    for (;;) {
+        QHash<QTcpSocket*, QXmppBoshConnection>::iterator it = connections.find(socket);
+        if (it == connections.end() || it->busy)
+            return;
+
+        QByteArray &buffer = it->buffer;
+        const int headerEnd = buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0) {
+            if (buffer.size() > maximumHeaderSize) {
+                it->busy = true;
+                it->closeAfterResponse = true;
+                writeResponse(socket, httpResponse("431 Request Header Fields Too Large", QByteArray()));
+            }
+            return;
+        }
+
+        const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+        const QList<QByteArray> request = lines.first().simplified().split(' ');
+        bool close = request.size() == 3 && request[2] == "HTTP/1.0";
+        int contentLength = 0;
+        for (int i = 1; i < lines.size(); ++i) {
+            const int colon = lines[i].indexOf(':');
+            if (colon <= 0)
+                continue;
+            const QByteArray name = lines[i].left(colon).trimmed().toLower();
+            const QByteArray value = lines[i].mid(colon + 1).trimmed().toLower();
+            if (name == "content-length")
+                contentLength = value.toInt();
+            else if (name == "connection")
+                close = (value == "close");
+        }
+        if (contentLength < 0 || contentLength > maximumBodySize) {
+            it->busy = true;
+            it->closeAfterResponse = true;
+            writeResponse(socket, httpResponse("413 Request Entity Too Large", QByteArray()));
+            return;
+        }
+        if (buffer.size() < headerEnd + 4 + contentLength)
+            return;
+
+        const QByteArray body = buffer.mid(headerEnd + 4, contentLength);
+        buffer.remove(0, headerEnd + 4 + contentLength);
+        it->busy = true;
+        it->closeAfterResponse = close;
+
+        if (request.size() == 3 && request[0] == "POST") {
+            handleBody(socket, body);
+        } else if (request.size() == 3 && request[0] == "OPTIONS") {
+            // browsers check whether they may send cross-origin requests
+            writeResponse(socket, httpResponse("200 OK", QByteArray(),
+                "Access-Control-Allow-Methods: POST, OPTIONS\r\n"
+                "Access-Control-Allow-Headers: Content-Type\r\n"
+                "Access-Control-Max-Age: 86400\r\n"));
+        } else {
+            it->closeAfterResponse = true;
+            writeResponse(socket, httpResponse("405 Method Not Allowed", QByteArray(),
+                "Allow: POST, OPTIONS\r\n"));
+        }
+    }
+}
+
+// Writes the response to the request which the connection carries, then
+// lets the connection carry the next request.
+
+void QXmppBoshServerPrivate::writeResponse(QTcpSocket *socket, const QByteArray &response)
+{
+    QHash<QTcpSocket*, QXmppBoshConnection>::iterator it = connections.find(socket);
+    if (it == connections.end())
+        return;
+
+    socket->write(response);
+    it->busy = false;
+    if (it->closeAfterResponse)
+        socket->disconnectFromHost();
+    else if (!it->buffer.isEmpty())
+        QMetaObject::invokeMethod(q, "_q_processPendingRequests", Qt::QueuedConnection);
+}
+
+/// Constructs a new BOSH connection manager.
+///
+/// \param parent
+
+QXmppBoshServer::QXmppBoshServer(QObject *parent)
+    : QObject(parent)
+    , d(new QXmppBoshServerPrivate(this))
+{
+}
+
+/// Destroys the BOSH connection manager.
+
+QXmppBoshServer::~QXmppBoshServer()
+{
+    delete d;
+}
+
+/// Returns the largest number of requests a session may hold open.
+
+int QXmppBoshServer::maximumHold() const
+{
+    return d->maximumHold;
+}
+
+/// Sets the largest number of requests a session may hold open.
+///
+/// Clients which ask to hold more requests are granted this number.
+///
+/// \param hold
+
+void QXmppBoshServer::setMaximumHold(int hold)
+{
+    d->maximumHold = qMax(1, hold);
+}
+
+/// Returns the longest time in seconds for which a request is held open.
+
+int QXmppBoshServer::maximumWait() const
+{
+    return d->maximumWait;
+}
+
+/// Sets the longest time in seconds for which a request is held open.
+///
+/// \param seconds
+
+void QXmppBoshServer::setMaximumWait(int seconds)
+{
+    d->maximumWait = qMax(1, seconds);
+}
+
+/// Returns the time in seconds after which a session ends if the client
+/// has no request held open.
+
+int QXmppBoshServer::inactivity() const
+{
+    return d->inactivity;
+}
+
+/// Sets the time in seconds after which a session ends if the client has
+/// no request held open.
+///
+/// \param seconds
+
+void QXmppBoshServer::setInactivity(int seconds)
+{
+    d->inactivity = qMax(1, seconds);
+}
+
+/// Reads requests from the given connection, which becomes a child of the
+/// connection manager.
+///
+/// \param socket
+
+void QXmppBoshServer::addConnection(QTcpSocket *socket)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    socket->setParent(this);
+    d->connections.insert(socket, QXmppBoshConnection());
+
+    check = connect(socket, SIGNAL(disconnected()),
+                    this, SLOT(_q_socketDisconnected()));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(readyRead()),
+                    this, SLOT(_q_socketReadyRead()));
+    Q_ASSERT(check);
+
+    // the first request may have arrived already
+    if (socket->bytesAvailable())
+        QMetaObject::invokeMethod(this, "_q_processPendingRequests", Qt::QueuedConnection);
+}
+
+/// Returns the number of sessions.
+
+int QXmppBoshServer::sessionCount() const
+{
+    return d->sessions.size();
+}
+
+void QXmppBoshServer::_q_processPendingRequests()
+{
+    foreach (QTcpSocket *socket, d->connections.keys()) {
+        if (!d->connections.contains(socket))
+            continue;
+        d->connections[socket].buffer += socket->readAll();
+        d->processRequests(socket);
+    }
+}
+
+void QXmppBoshServer::_q_sessionDestroyed(QObject *object)
+{
+    QHash<QString, QXmppBoshSession*>::iterator it = d->sessions.begin();
+    while (it != d->sessions.end()) {
+        if (it.value() == object)
+            it = d->sessions.erase(it);
+        else
+            ++it;
+    }
+}
+
+void QXmppBoshServer::_q_socketDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !d->connections.contains(socket))
+        return;
+
+    d->connections.remove(socket);
+    socket->deleteLater();
+}
+
+void QXmppBoshServer::_q_socketReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !d->connections.contains(socket))
+        return;
+
+    d->connections[socket].buffer += socket->readAll();
+    if (d->connections[socket].buffer.size() > maximumHeaderSize + maximumBodySize) {
+        socket->abort();
+        return;
+    }
+    d->processRequests(socket);
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPBOSHSERVER_P_H
+#define QXMPPBOSHSERVER_P_H
+
+#include <QIODevice>
+
+#include "QXmppGlobal.h"
+
+class QTcpSocket;
+class QXmppBoshServerPrivate;
+class QXmppBoshSessionPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppBoshSession class carries an XMPP stream over a BOSH session,
+/// as defined by XEP-0124: Bidirectional-streams Over Synchronous HTTP and
+/// XEP-0206: XMPP Over BOSH.
+///
+/// The payloads of the client's requests are read from the device as a
+/// classic XMPP stream, so that a QXmppIncomingClient can use it like a
+/// socket. The top-level elements written to the device are batched into
+/// the responses to the requests which are held open.
+
+class QXMPP_AUTOTEST_EXPORT QXmppBoshSession : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    ~QXmppBoshSession();
+
+    int hold() const;
+    QString sid() const;
+    int wait() const;
+
+    qint64 bytesAvailable() const;
+    qint64 bytesToWrite() const;
+    void close();
+    bool isSequential() const;
+
+signals:
+    /// This signal is emitted when the session ends.
+    void disconnected();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 size);
+
+private slots:
+    void _q_flush();
+    void _q_timeout();
+
+private:
+    QXmppBoshSession(const QString &sid, QObject *parent = 0);
+
+    QXmppBoshSessionPrivate * const d;
+    friend class QXmppBoshServer;
+    friend class QXmppBoshServerPrivate;
+};
+
+/// \internal
+///
+/// The QXmppBoshServer class is a BOSH connection manager.
+///
+/// It reads the HTTP requests from the connections it is given, and hands
+/// them over to their session, in the order of their request identifiers.
+/// Each session may hold several requests open, as negotiated with the
+/// client, so that the client can send data at any time while the server
+/// can always answer immediately.
+
+class QXMPP_AUTOTEST_EXPORT QXmppBoshServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppBoshServer(QObject *parent = 0);
+    ~QXmppBoshServer();
+
+    int maximumHold() const;
+    void setMaximumHold(int hold);
+
+    int maximumWait() const;
+    void setMaximumWait(int seconds);
+
+    int inactivity() const;
+    void setInactivity(int seconds);
+
+    void addConnection(QTcpSocket *socket);
+    int sessionCount() const;
+
+signals:
+    /// This signal is emitted when a client creates a session.
+    void newSession(QXmppBoshSession *session);
+
+private slots:
+    void _q_processPendingRequests();
+    void _q_sessionDestroyed(QObject *object);
+    void _q_socketDisconnected();
+    void _q_socketReadyRead();
+
+private:
+    QXmppBoshServerPrivate * const d;
+    friend class QXmppBoshSessionPrivate;
+};
+
+#endif
@@ -0,0 +1,761 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QtEndian>
+
+#include "QXmppCluster_p.h"
+#include "QXmppJid.h"
+#include "QXmppUtils.h"
+
+// frames larger than this are considered a protocol error
+static const quint32 maximumFrameSize = 16 * 1024 * 1024;
+
+// time allowed for the handshake, and interval between reconnections
+static const int handshakeTimeout = 10000;
+static const int reconnectInterval = 5000;
+
+static const int nonceSize = 16;
+
+static QByteArray frameHeader(int type, int payloadSize)
+{
+    QByteArray header(5, '\0');
+    qToBigEndian<quint32>(payloadSize + 1, reinterpret_cast<uchar*>(header.data()));
+    header[4] = char(type);
+    return header;
+}
+
+static QByteArray stringPayload(const QString &value)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream << value;
+    return payload;
+}
+
+class QXmppClusterLinkPrivate
+{
+public:
+    QTcpSocket *socket;
+    QString localNode;
+    QString remoteNode;
+    QByteArray secret;
+    QByteArray localNonce;
+    QByteArray buffer;
+    bool authenticated;
+    bool closed;
+};
+
+/// Constructs a link for the node called \a localNode.
+///
+/// If \a socket is given, it is an incoming connection which was already
+/// established and the handshake starts immediately. Otherwise the link
+/// is opened by calling connectToHost().
+///
+/// \param localNode
+/// \param secret
+/// \param socket
+/// \param parent
+
+QXmppClusterLink::QXmppClusterLink(const QString &localNode, const QByteArray &secret, QTcpSocket *socket, QObject *parent)
+    : QXmppLoggable(parent)
+    , d(new QXmppClusterLinkPrivate)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->socket = socket ? socket : new QTcpSocket;
+    d->socket->setParent(this);
+    d->localNode = localNode;
+    d->secret = secret;
+    d->authenticated = false;
+    d->closed = false;
+
+    check = connect(d->socket, SIGNAL(connected()),
+                    this, SLOT(_q_socketConnected()));
+    Q_ASSERT(check);
+
+    check = connect(d->socket, SIGNAL(disconnected()),
+                    this, SLOT(_q_socketDisconnected()));
+    Q_ASSERT(check);
+
+    check = connect(d->socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                    this, SLOT(_q_socketDisconnected()));
+    Q_ASSERT(check);
+
+    check = connect(d->socket, SIGNAL(readyRead()),
+                    this, SLOT(_q_socketReadyRead()));
+    Q_ASSERT(check);
+
+    if (d->socket->state() == QAbstractSocket::ConnectedState)
+        _q_socketConnected();
+}
+
+/// Destroys the link.
+
+QXmppClusterLink::~QXmppClusterLink()
+{
+    delete d;
+}
+
+/// Returns true if the remote node proved that it knows the cluster's
+/// secret.
+
+bool QXmppClusterLink::isAuthenticated() const
+{
+    return d->authenticated;
+}
+
+/// Returns the name announced by the remote node.
+
+QString QXmppClusterLink::remoteNode() const
+{
+    return d->remoteNode;
+}
+
+/// Connects to the node listening on the given \a host and \a port.
+
+void QXmppClusterLink::connectToHost(const QString &host, quint16 port)
+{
+    d->socket->connectToHost(host, port);
+}
+
+/// Closes the link.
+
+void QXmppClusterLink::disconnectFromHost()
+{
+    if (d->socket->state() == QAbstractSocket::UnconnectedState)
+        _q_socketDisconnected();
+    else
+        d->socket->disconnectFromHost();
+}
+
+/// Announces that the local node bound a session for the full \a jid.
+
+void QXmppClusterLink::sendBind(const QString &jid)
+{
+    if (d->authenticated)
+        sendFrame(BindFrame, stringPayload(jid));
+}
+
+/// Announces that the local node unbound the session for the full \a jid.
+
+void QXmppClusterLink::sendUnbind(const QString &jid)
+{
+    if (d->authenticated)
+        sendFrame(UnbindFrame, stringPayload(jid));
+}
+
+/// Forwards the serialized stanza \a data for the recipient \a to.
+///
+/// The stanza's bytes are written to the socket as they are, behind a
+/// small header.
+
+void QXmppClusterLink::sendStanza(const QString &to, const QByteArray &data)
+{
+    if (!d->authenticated)
+        return;
+
+    // same layout as a QString followed by a QByteArray in a QDataStream
+    QByteArray head;
+    QDataStream stream(&head, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream << to << quint32(data.size());
+
+    d->socket->write(frameHeader(StanzaFrame, head.size() + data.size()));
+    d->socket->write(head);
+    d->socket->write(data);
+}
+
+void QXmppClusterLink::sendFrame(int type, const QByteArray &payload)
+{
+    d->socket->write(frameHeader(type, payload.size()));
+    d->socket->write(payload);
+}
+
+void QXmppClusterLink::handleFrame(int type, const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    stream.setVersion(QDataStream::Qt_4_5);
+
+    if (type == HelloFrame && d->remoteNode.isEmpty()) {
+        QString name;
+        QByteArray nonce;
+        stream >> name >> nonce;
+        if (stream.status() != QDataStream::Ok || name.isEmpty() ||
+            name == d->localNode || nonce.size() < nonceSize) {
+            warning("Received an invalid hello from cluster node");
+            disconnectFromHost();
+            return;
+        }
+        d->remoteNode = name;
+
+        // prove that we know the secret, the proof covers our name so it
+        // cannot be reflected back to us by a node claiming another name
+        QByteArray proof;
+        QDataStream proofStream(&proof, QIODevice::WriteOnly);
+        proofStream.setVersion(QDataStream::Qt_4_5);
+        proofStream << QXmppUtils::generateHmacSha1(d->secret, nonce + d->localNode.toUtf8());
+        sendFrame(AuthFrame, proof);
+
+    } else if (type == AuthFrame && !d->remoteNode.isEmpty() && !d->authenticated) {
+        QByteArray proof;
+        stream >> proof;
+        if (stream.status() != QDataStream::Ok ||
+            proof != QXmppUtils::generateHmacSha1(d->secret, d->localNonce + d->remoteNode.toUtf8())) {
+            warning(QString("Cluster node %1 failed to authenticate").arg(d->remoteNode));
+            disconnectFromHost();
+            return;
+        }
+        d->authenticated = true;
+        emit authenticated();
+
+    } else if (d->authenticated && (type == BindFrame || type == UnbindFrame)) {
+        QString jid;
+        stream >> jid;
+        if (stream.status() != QDataStream::Ok) {
+            warning(QString("Received an invalid session from cluster node %1").arg(d->remoteNode));
+            disconnectFromHost();
+            return;
+        }
+        if (type == BindFrame)
+            emit bindReceived(jid);
+        else
+            emit unbindReceived(jid);
+
+    } else if (d->authenticated && type == StanzaFrame) {
+        QString to;
+        QByteArray data;
+        stream >> to >> data;
+        if (stream.status() != QDataStream::Ok) {
+            warning(QString("Received an invalid stanza from cluster node %1").arg(d->remoteNode));
+            disconnectFromHost();
+            return;
+        }
+        emit stanzaReceived(to, data);
+
+    } else {
+        warning(QString("Received an unexpected frame of type %1 from cluster node").arg(type));
+        disconnectFromHost();
+    }
+}
+
+void QXmppClusterLink::_q_handshakeTimeout()
+{
+    if (!d->authenticated) {
+        warning("Cluster node did not complete the handshake in time");
+        disconnectFromHost();
+    }
+}
+
+void QXmppClusterLink::_q_socketConnected()
+{
+    d->localNonce = QXmppUtils::generateRandomBytes(nonceSize);
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream << d->localNode << d->localNonce;
+    sendFrame(HelloFrame, payload);
+
+    QTimer::singleShot(handshakeTimeout, this, SLOT(_q_handshakeTimeout()));
+}
+
+void QXmppClusterLink::_q_socketDisconnected()
+{
+    if (d->closed)
+        return;
+    d->closed = true;
+    emit disconnected();
+}
+
+void QXmppClusterLink::_q_socketReadyRead()
+{
+    d->buffer += d->socket->readAll();
+
+    int offset = 0;
+    while (d->buffer.size() - offset >= 5) {
+        const quint32 length = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(d->buffer.constData() + offset));
+        if (length < 1 || length > maximumFrameSize) {
+            warning(QString("Received a frame of invalid size %1 from cluster node").arg(length));
+            d->buffer.clear();
+            disconnectFromHost();
+            return;
+        }
+        if (quint32(d->buffer.size() - offset - 4) < length)
+            break;
+
+        const int type = quint8(d->buffer.at(offset + 4));
+        const QByteArray payload = d->buffer.mid(offset + 5, length - 1);
+        offset += 4 + length;
+        handleFrame(type, payload);
+
+        // the link may have been closed by the frame
+        if (d->closed || d->socket->state() != QAbstractSocket::ConnectedState) {
+            d->buffer.clear();
+            return;
+        }
+    }
+    d->buffer.remove(0, offset);
+}
+
+class QXmppClusterPrivate
+{
+public:
+    QXmppClusterPrivate();
+    void removeNodeSessions(const QString &node);
+
+    QString nodeName;
+    QByteArray secret;
+
+    // configured nodes, by name
+    QMap<QString, QPair<QString, quint16> > nodes;
+
+    // links which are not authenticated yet, with the name of the node
+    // they were opened to, which is empty for incoming links
+    QHash<QXmppClusterLink*, QString> pendingLinks;
+
+    QTcpServer *server;
+    QTimer *reconnectTimer;
+
+    // full JIDs of the sessions bound on this node
+    QSet<QString> localSessions;
+
+    // the links and sessions of the other nodes are read when routing,
+    // which may happen from any thread
+    mutable QReadWriteLock lock;
+    QHash<QString, QXmppClusterLink*> links;
+    // node serving each full JID, by bare JID
+    QHash<QString, QHash<QString, QString> > sessions;
+};
+
+QXmppClusterPrivate::QXmppClusterPrivate()
+    : server(0)
+    , reconnectTimer(0)
+{
+}
+
+/// Forgets the sessions bound on the given \a node.
+///
+/// The caller must hold the write lock.
+
+void QXmppClusterPrivate::removeNodeSessions(const QString &node)
+{
+    QHash<QString, QHash<QString, QString> >::iterator it = sessions.begin();
+    while (it != sessions.end()) {
+        QHash<QString, QString>::iterator jidIt = it.value().begin();
+        while (jidIt != it.value().end()) {
+            if (jidIt.value() == node)
+                jidIt = it.value().erase(jidIt);
+            else
+                ++jidIt;
+        }
+        if (it.value().isEmpty())
+            it = sessions.erase(it);
+        else
+            ++it;
+    }
+}
+
+/// Constructs a new cluster membership.
+///
+/// \param parent
+
+QXmppCluster::QXmppCluster(QObject *parent)
+    : QXmppLoggable(parent)
+    , d(new QXmppClusterPrivate)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->reconnectTimer = new QTimer(this);
+    d->reconnectTimer->setInterval(reconnectInterval);
+    check = connect(d->reconnectTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_connectNodes()));
+    Q_ASSERT(check);
+}
+
+/// Destroys the cluster membership, closing all the links.
+
+QXmppCluster::~QXmppCluster()
+{
+    close();
+    delete d;
+}
+
+/// Returns the name of this node.
+
+QString QXmppCluster::nodeName() const
+{
+    return d->nodeName;
+}
+
+/// Sets the name of this node, which must be unique within the cluster.
+///
+/// \param name
+
+void QXmppCluster::setNodeName(const QString &name)
+{
+    d->nodeName = name;
+}
+
+/// Sets the secret shared by the nodes of the cluster, which they use to
+/// authenticate each other.
+///
+/// \param secret
+
+void QXmppCluster::setSecret(const QString &secret)
+{
+    d->secret = secret.toUtf8();
+}
+
+/// Adds the node called \a name, which listens for cluster links on the
+/// given \a host and \a port.
+///
+/// Of any two nodes, the one whose name sorts first opens the link
+/// between them, and reopens it if it is lost.
+
+void QXmppCluster::addNode(const QString &name, const QString &host, quint16 port)
+{
+    if (name.isEmpty() || name == d->nodeName)
+        return;
+
+    d->nodes.insert(name, qMakePair(host, port));
+    d->reconnectTimer->start();
+    _q_connectNodes();
+}
+
+/// Returns the names of the nodes this node has a link to.
+
+QStringList QXmppCluster::connectedNodes() const
+{
+    QReadLocker locker(&d->lock);
+    return d->links.keys();
+}
+
+/// Returns the number of sessions bound on each connected node.
+
+QHash<QString, int> QXmppCluster::sessionCounts() const
+{
+    QReadLocker locker(&d->lock);
+    QHash<QString, int> counts;
+    foreach (const QString &node, d->links.keys())
+        counts.insert(node, 0);
+    foreach (const QHash<QString, QString> &nodes, d->sessions)
+        foreach (const QString &node, nodes)
+            counts[node]++;
+    return counts;
+}
+
+/// Listens for links from the other nodes on the given \a address and
+/// \a port.
+///
+/// The links are not encrypted, so they should only be used on a trusted
+/// network.
+
+bool QXmppCluster::listen(const QHostAddress &address, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->nodeName.isEmpty()) {
+        warning("No cluster node name was specified!");
+        return false;
+    }
+
+    if (!d->server) {
+        d->server = new QTcpServer(this);
+        check = connect(d->server, SIGNAL(newConnection()),
+                        this, SLOT(_q_newConnection()));
+        Q_ASSERT(check);
+    }
+
+    if (!d->server->listen(address, port)) {
+        warning(QString("Could not start listening for cluster nodes on %1 %2").arg(address.toString(), QString::number(port)));
+        return false;
+    }
+    return true;
+}
+
+/// Closes all the links and stops listening for new ones.
+
+void QXmppCluster::close()
+{
+    d->reconnectTimer->stop();
+    if (d->server)
+        d->server->close();
+
+    QList<QXmppClusterLink*> links = d->pendingLinks.keys();
+    d->pendingLinks.clear();
+    {
+        QWriteLocker locker(&d->lock);
+        links += d->links.values();
+        d->links.clear();
+        d->sessions.clear();
+    }
+
+    foreach (QXmppClusterLink *link, links) {
+        disconnect(link, 0, this, 0);
+        link->disconnectFromHost();
+        link->deleteLater();
+    }
+}
+
+/// Announces to the other nodes that the full \a jid is bound on this
+/// node.
+
+void QXmppCluster::bindSession(const QString &jid)
+{
+    if (d->localSessions.contains(jid))
+        return;
+    d->localSessions.insert(jid);
+
+    foreach (QXmppClusterLink *link, d->links)
+        link->sendBind(jid);
+}
+
+/// Announces to the other nodes that the full \a jid is no longer bound
+/// on this node.
+
+void QXmppCluster::unbindSession(const QString &jid)
+{
+    if (!d->localSessions.remove(jid))
+        return;
+
+    foreach (QXmppClusterLink *link, d->links)
+        link->sendUnbind(jid);
+}
+
+/// Forwards the serialized stanza \a data to the nodes serving the
+/// recipient \a to.
+///
+/// A stanza for a bare JID is forwarded once to each node serving one of
+/// its resources. This method is thread-safe.
+///
+/// Returns true if the stanza was forwarded to at least one node.
+
+bool QXmppCluster::route(const QXmppJid &to, const QByteArray &data)
+{
+    QReadLocker locker(&d->lock);
+
+    QHash<QString, QHash<QString, QString> >::const_iterator it = d->sessions.constFind(to.bareJid());
+    if (it == d->sessions.constEnd())
+        return false;
+
+    QSet<QString> nodes;
+    if (to.isBare()) {
+        foreach (const QString &node, it.value())
+            nodes.insert(node);
+    } else {
+        const QString node = it.value().value(to.toString());
+        if (!node.isEmpty())
+            nodes.insert(node);
+    }
+
+    bool sent = false;
+    foreach (const QString &node, nodes) {
+        QXmppClusterLink *link = d->links.value(node);
+        if (!link)
+            continue;
+        if (link->thread() == QThread::currentThread())
+            link->sendStanza(to.toString(), data);
+        else
+            QMetaObject::invokeMethod(link, "sendStanza", Q_ARG(QString, to.toString()), Q_ARG(QByteArray, data));
+        sent = true;
+    }
+    return sent;
+}
+
+/// Registers a link whose remote node authenticated, replacing any
+/// previous link to the same node.
+
+void QXmppCluster::addLink(QXmppClusterLink *link)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    const QString name = link->remoteNode();
+    const QString expected = d->pendingLinks.take(link);
+    if (!expected.isEmpty() && expected != name) {
+        warning(QString("Cluster node %1 answered as %2").arg(expected, name));
+        link->disconnectFromHost();
+        return;
+    }
+
+    QXmppClusterLink *old = 0;
+    {
+        QWriteLocker locker(&d->lock);
+        old = d->links.value(name);
+        if (old)
+            d->removeNodeSessions(name);
+        d->links.insert(name, link);
+    }
+    if (old) {
+        disconnect(old, 0, this, 0);
+        old->disconnectFromHost();
+        old->deleteLater();
+    }
+
+    check = connect(link, SIGNAL(bindReceived(QString)),
+                    this, SLOT(_q_remoteBind(QString)));
+    Q_ASSERT(check);
+
+    check = connect(link, SIGNAL(unbindReceived(QString)),
+                    this, SLOT(_q_remoteUnbind(QString)));
+    Q_ASSERT(check);
+
+    check = connect(link, SIGNAL(stanzaReceived(QString,QByteArray)),
+                    this, SIGNAL(stanzaReceived(QString,QByteArray)));
+    Q_ASSERT(check);
+
+    // send the remote node a snapshot of our sessions, later changes
+    // are sent as they happen
+    foreach (const QString &jid, d->localSessions)
+        link->sendBind(jid);
+
+    info(QString("Cluster node %1 connected").arg(name));
+    emit nodeConnected(name);
+}
+
+void QXmppCluster::_q_connectNodes()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->nodeName.isEmpty())
+        return;
+
+    QSet<QString> connecting;
+    foreach (const QString &name, d->pendingLinks)
+        connecting.insert(name);
+
+    QMap<QString, QPair<QString, quint16> >::const_iterator it;
+    for (it = d->nodes.constBegin(); it != d->nodes.constEnd(); ++it) {
+        const QString &name = it.key();
+        if (name < d->nodeName || d->links.contains(name) || connecting.contains(name))
+            continue;
+
+        QXmppClusterLink *link = new QXmppClusterLink(d->nodeName, d->secret, 0, this);
+        d->pendingLinks.insert(link, name);
+
+        check = connect(link, SIGNAL(authenticated()),
+                        this, SLOT(_q_linkAuthenticated()));
+        Q_ASSERT(check);
+
+        check = connect(link, SIGNAL(disconnected()),
+                        this, SLOT(_q_linkDisconnected()));
+        Q_ASSERT(check);
+
+        link->connectToHost(it.value().first, it.value().second);
+    }
+}
+
+void QXmppCluster::_q_linkAuthenticated()
+{
+    QXmppClusterLink *link = qobject_cast<QXmppClusterLink*>(sender());
+    if (link && d->pendingLinks.contains(link))
+        addLink(link);
+}
+
+void QXmppCluster::_q_linkDisconnected()
+{
+    QXmppClusterLink *link = qobject_cast<QXmppClusterLink*>(sender());
+    if (!link)
+        return;
+
+    d->pendingLinks.remove(link);
+
+    const QString name = link->remoteNode();
+    bool lost = false;
+    {
+        QWriteLocker locker(&d->lock);
+        if (!name.isEmpty() && d->links.value(name) == link) {
+            d->links.remove(name);
+            d->removeNodeSessions(name);
+            lost = true;
+        }
+    }
+    link->deleteLater();
+
+    if (lost) {
+        info(QString("Cluster node %1 disconnected").arg(name));
+        emit nodeDisconnected(name);
+    }
+}
+
+void QXmppCluster::_q_newConnection()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    while (d->server->hasPendingConnections()) {
+        QTcpSocket *socket = d->server->nextPendingConnection();
+        QXmppClusterLink *link = new QXmppClusterLink(d->nodeName, d->secret, socket, this);
+        d->pendingLinks.insert(link, QString());
+
+        check = connect(link, SIGNAL(authenticated()),
+                        this, SLOT(_q_linkAuthenticated()));
+        Q_ASSERT(check);
+
+        check = connect(link, SIGNAL(disconnected()),
+                        this, SLOT(_q_linkDisconnected()));
+        Q_ASSERT(check);
+    }
+}
+
+void QXmppCluster::_q_remoteBind(const QString &jid)
+{
+    QXmppClusterLink *link = qobject_cast<QXmppClusterLink*>(sender());
+    if (!link)
+        return;
+
+    QWriteLocker locker(&d->lock);
+    if (d->links.value(link->remoteNode()) == link)
+        d->sessions[QXmppUtils::jidToBareJid(jid)].insert(jid, link->remoteNode());
+}
+
+void QXmppCluster::_q_remoteUnbind(const QString &jid)
+{
+    QXmppClusterLink *link = qobject_cast<QXmppClusterLink*>(sender());
+    if (!link)
+        return;
+
+    QWriteLocker locker(&d->lock);
+    QHash<QString, QHash<QString, QString> >::iterator it = d->sessions.find(QXmppUtils::jidToBareJid(jid));
+    if (it == d->sessions.end() || it.value().value(jid) != link->remoteNode())
+        return;
+    it.value().remove(jid);
+    if (it.value().isEmpty())
+        d->sessions.erase(it);
+}
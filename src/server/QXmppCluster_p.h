@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPCLUSTER_P_H
+#define QXMPPCLUSTER_P_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QStringList>
+
+#include "QXmppLogger.h"
+
+class QTcpSocket;
+class QXmppClusterPrivate;
+class QXmppClusterLinkPrivate;
+class QXmppJid;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppClusterLink class represents a persistent connection between
+/// two nodes of a cluster.
+///
+/// All the traffic between the two nodes is multiplexed over the link as
+/// length-prefixed binary frames: the handshake, the binding and unbinding
+/// of sessions, and the stanzas themselves, whose bytes are forwarded
+/// as-is without being parsed.
+
+class QXMPP_AUTOTEST_EXPORT QXmppClusterLink : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    enum FrameType
+    {
+        HelloFrame = 1,
+        AuthFrame,
+        BindFrame,
+        UnbindFrame,
+        StanzaFrame
+    };
+
+    QXmppClusterLink(const QString &localNode, const QByteArray &secret, QTcpSocket *socket = 0, QObject *parent = 0);
+    ~QXmppClusterLink();
+
+    bool isAuthenticated() const;
+    QString remoteNode() const;
+
+signals:
+    /// This signal is emitted once both nodes have proven that they know
+    /// the cluster's secret.
+    void authenticated();
+
+    /// This signal is emitted when the link is closed.
+    void disconnected();
+
+    /// This signal is emitted when the remote node binds a session.
+    void bindReceived(const QString &jid);
+
+    /// This signal is emitted when the remote node unbinds a session.
+    void unbindReceived(const QString &jid);
+
+    /// This signal is emitted when the remote node forwards a stanza.
+    void stanzaReceived(const QString &to, const QByteArray &data);
+
+public slots:
+    void connectToHost(const QString &host, quint16 port);
+    void disconnectFromHost();
+    void sendBind(const QString &jid);
+    void sendUnbind(const QString &jid);
+    void sendStanza(const QString &to, const QByteArray &data);
+
+private slots:
+    void _q_handshakeTimeout();
+    void _q_socketConnected();
+    void _q_socketDisconnected();
+    void _q_socketReadyRead();
+
+private:
+    void handleFrame(int type, const QByteArray &payload);
+    void sendFrame(int type, const QByteArray &payload);
+
+    QXmppClusterLinkPrivate * const d;
+};
+
+/// \internal
+///
+/// The QXmppCluster class lets several QXmppServer nodes serve the same
+/// domain.
+///
+/// Each node keeps a link to every other node, and announces the sessions
+/// bound by its clients over the links. The resulting registry tells which
+/// nodes serve the resources of a JID, so that stanzas for clients of
+/// another node are forwarded to it.
+
+class QXMPP_AUTOTEST_EXPORT QXmppCluster : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppCluster(QObject *parent = 0);
+    ~QXmppCluster();
+
+    QString nodeName() const;
+    void setNodeName(const QString &name);
+
+    void setSecret(const QString &secret);
+
+    void addNode(const QString &name, const QString &host, quint16 port);
+    QStringList connectedNodes() const;
+    QHash<QString, int> sessionCounts() const;
+
+    bool listen(const QHostAddress &address, quint16 port);
+    void close();
+
+    void bindSession(const QString &jid);
+    void unbindSession(const QString &jid);
+
+    bool route(const QXmppJid &to, const QByteArray &data);
+
+signals:
+    /// This signal is emitted when a link to the node called \a name is
+    /// established.
+    void nodeConnected(const QString &name);
+
+    /// This signal is emitted when the link to the node called \a name
+    /// is lost.
+    void nodeDisconnected(const QString &name);
+
+    /// This signal is emitted when another node forwards a stanza for
+    /// one of the local sessions.
+    void stanzaReceived(const QString &to, const QByteArray &data);
+
+private slots:
+    void _q_connectNodes();
+    void _q_linkAuthenticated();
+    void _q_linkDisconnected();
+    void _q_newConnection();
+    void _q_remoteBind(const QString &jid);
+    void _q_remoteUnbind(const QString &jid);
+
+private:
+    void addLink(QXmppClusterLink *link);
+
+    QXmppClusterPrivate * const d;
+};
+
+#endif
@@ -24,6 +24,8 @@
 #ifndef QXMPPDIALBACK_H
 #define QXMPPDIALBACK_H
 
+#include <QMetaType>
+
 #include "QXmppStanza.h"
 
 /// \brief The QXmppDialback class represents a stanza used for the Server
@@ -66,4 +68,6 @@ private:
     QString m_type;
 };
 
+Q_DECLARE_METATYPE(QXmppDialback)
+
 #endif
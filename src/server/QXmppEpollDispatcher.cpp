@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include "QXmppEpollDispatcher_p.h"
+
+#if defined(Q_OS_LINUX) && QT_VERSION >= 0x050000
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSocketNotifier>
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// maximum number of ready sockets returned by a single wait
+static const int maximumEvents = 256;
+
+// exported by QtCore, used by Qt's own dispatchers
+extern uint qGlobalPostedEventsCount();
+
+class QXmppEpollSocket
+{
+public:
+    QXmppEpollSocket()
+    {
+        notifiers[QSocketNotifier::Read] = 0;
+        notifiers[QSocketNotifier::Write] = 0;
+        notifiers[QSocketNotifier::Exception] = 0;
+    }
+
+    quint32 events() const
+    {
+        quint32 events = 0;
+        if (notifiers[QSocketNotifier::Read])
+            events |= EPOLLIN;
+        if (notifiers[QSocketNotifier::Write])
+            events |= EPOLLOUT;
+        if (notifiers[QSocketNotifier::Exception])
+            events |= EPOLLPRI;
+        return events;
+    }
+
+    bool isEmpty() const
+    {
+        return !events();
+    }
+
+    QSocketNotifier *notifiers[3];
+};
+
+class QXmppEpollTimer
+{
+public:
+    int id;
+    int interval;
+    Qt::TimerType type;
+    QObject *object;
+    qint64 deadline;
+    bool active;
+};
+
+class QXmppEpollEventDispatcherPrivate
+{
+public:
+    QXmppEpollEventDispatcherPrivate();
+    bool updateSocket(int fd, bool added);
+    int timeout(qint64 now) const;
+    int activateTimers();
+
+    int epollFd;
+    int eventFd;
+    QAtomicInt interrupted;
+    QElapsedTimer clock;
+    QHash<int, QXmppEpollSocket> sockets;
+    QHash<int, QXmppEpollTimer> timers;
+};
+
+QXmppEpollEventDispatcherPrivate::QXmppEpollEventDispatcherPrivate()
+    : epollFd(-1)
+    , eventFd(-1)
+{
+    clock.start();
+}
+
+/// Tells epoll which events to watch on the socket \a fd.
+
+bool QXmppEpollEventDispatcherPrivate::updateSocket(int fd, bool added)
+{
+    QHash<int, QXmppEpollSocket>::iterator it = sockets.find(fd);
+    if (it == sockets.end())
+        return false;
+
+    if (it->isEmpty()) {
+        sockets.erase(it);
+        // the descriptor may already be closed
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, 0);
+        return true;
+    }
+
+    struct epoll_event event;
+    event.events = it->events();
+    event.data.fd = fd;
+    return epoll_ctl(epollFd, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+/// Returns the time in milliseconds until the next timer is due, or -1 if
+/// there are no timers.
+
+int QXmppEpollEventDispatcherPrivate::timeout(qint64 now) const
+{
+    qint64 next = -1;
+    QHash<int, QXmppEpollTimer>::const_iterator it;
+    for (it = timers.constBegin(); it != timers.constEnd(); ++it) {
+        if (it->active)
+            continue;
+        if (it->deadline <= now)
+            return 0;
+        if (next < 0 || it->deadline < next)
+            next = it->deadline;
+    }
+    return next < 0 ? -1 : int(qMin(next - now, qint64(INT_MAX)));
+}
+
+/// Sends a timer event for each timer which is due, and returns their
+/// number.
+///
+/// A timer whose event handler does not return before it is due again is
+/// not activated recursively.
+
+int QXmppEpollEventDispatcherPrivate::activateTimers()
+{
+    const qint64 now = clock.elapsed();
+    QList<int> due;
+    QHash<int, QXmppEpollTimer>::iterator it;
+    for (it = timers.begin(); it != timers.end(); ++it) {
+        if (!it->active && it->deadline <= now)
+            due << it->id;
+    }
+
+    int activated = 0;
+    foreach (int id, due) {
+        // an earlier handler may have removed the timer
+        it = timers.find(id);
+        if (it == timers.end() || it->active)
+            continue;
+
+        it->deadline += it->interval;
+        if (it->deadline <= now)
+            it->deadline = now + it->interval;
+        it->active = true;
+        QObject *object = it->object;
+
+        QTimerEvent event(id);
+        QCoreApplication::sendEvent(object, &event);
+        activated++;
+
+        it = timers.find(id);
+        if (it != timers.end())
+            it->active = false;
+    }
+    return activated;
+}
+
+/// Constructs a new event dispatcher.
+
+QXmppEpollEventDispatcher::QXmppEpollEventDispatcher(QObject *parent)
+    : QAbstractEventDispatcher(parent)
+    , d(new QXmppEpollEventDispatcherPrivate)
+{
+    d->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    d->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (d->epollFd >= 0 && d->eventFd >= 0) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = d->eventFd;
+        epoll_ctl(d->epollFd, EPOLL_CTL_ADD, d->eventFd, &event);
+    } else {
+        qWarning("QXmppEpollEventDispatcher: could not create the epoll descriptors");
+    }
+}
+
+/// Destroys the event dispatcher.
+
+QXmppEpollEventDispatcher::~QXmppEpollEventDispatcher()
+{
+    if (d->eventFd >= 0)
+        ::close(d->eventFd);
+    if (d->epollFd >= 0)
+        ::close(d->epollFd);
+    delete d;
+}
+
+/// Returns true if the epoll descriptors were created.
+
+bool QXmppEpollEventDispatcher::isValid() const
+{
+    return d->epollFd >= 0 && d->eventFd >= 0;
+}
+
+bool QXmppEpollEventDispatcher::processEvents(QEventLoop::ProcessEventsFlags flags)
+{
+    d->interrupted.store(0);
+    emit awake();
+    QCoreApplication::sendPostedEvents();
+
+    // events posted meanwhile wake the wait up through the eventfd
+    const bool canWait = (flags & QEventLoop::WaitForMoreEvents) && !d->interrupted.load();
+    if (canWait)
+        emit aboutToBlock();
+    if (d->interrupted.load())
+        return false;
+
+    const bool includeTimers = !(flags & QEventLoop::X11ExcludeTimers);
+    const bool includeNotifiers = !(flags & QEventLoop::ExcludeSocketNotifiers);
+    int timeout = 0;
+    if (canWait)
+        timeout = includeTimers ? d->timeout(d->clock.elapsed()) : -1;
+
+    struct epoll_event events[maximumEvents];
+    int count = epoll_wait(d->epollFd, events, maximumEvents, timeout);
+    if (count < 0) {
+        if (errno != EINTR)
+            qWarning("QXmppEpollEventDispatcher: epoll_wait failed");
+        count = 0;
+    }
+
+    // collect the notifiers first, as handlers may unregister others
+    QList<QSocketNotifier*> ready;
+    for (int i = 0; i < count; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == d->eventFd) {
+            quint64 value;
+            while (::read(d->eventFd, &value, sizeof(value)) > 0)
+                ;
+            continue;
+        }
+        if (!includeNotifiers)
+            continue;
+
+        QHash<int, QXmppEpollSocket>::const_iterator it = d->sockets.constFind(fd);
+        if (it == d->sockets.constEnd())
+            continue;
+
+        // errors and hang-ups are reported to the read and write notifiers,
+        // whose handlers find out about them
+        const quint32 revents = events[i].events;
+        if ((revents & (EPOLLIN | EPOLLERR | EPOLLHUP)) && it->notifiers[QSocketNotifier::Read])
+            ready << it->notifiers[QSocketNotifier::Read];
+        if ((revents & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && it->notifiers[QSocketNotifier::Write])
+            ready << it->notifiers[QSocketNotifier::Write];
+        if ((revents & EPOLLPRI) && it->notifiers[QSocketNotifier::Exception])
+            ready << it->notifiers[QSocketNotifier::Exception];
+    }
+
+    int activated = 0;
+    foreach (QSocketNotifier *notifier, ready) {
+        QHash<int, QXmppEpollSocket>::const_iterator it = d->sockets.constFind(notifier->socket());
+        if (it == d->sockets.constEnd() || it->notifiers[notifier->type()] != notifier)
+            continue;
+
+        QEvent event(QEvent::SockAct);
+        QCoreApplication::sendEvent(notifier, &event);
+        activated++;
+    }
+
+    if (includeTimers)
+        activated += d->activateTimers();
+    return activated > 0;
+}
+
+bool QXmppEpollEventDispatcher::hasPendingEvents()
+{
+    return qGlobalPostedEventsCount() > 0;
+}
+
+void QXmppEpollEventDispatcher::registerSocketNotifier(QSocketNotifier *notifier)
+{
+    const int fd = notifier->socket();
+    const bool added = !d->sockets.contains(fd);
+    QXmppEpollSocket &socket = d->sockets[fd];
+    if (socket.notifiers[notifier->type()]) {
+        qWarning("QXmppEpollEventDispatcher: socket notifier for %d already registered", fd);
+        return;
+    }
+    socket.notifiers[notifier->type()] = notifier;
+    if (!d->updateSocket(fd, added))
+        qWarning("QXmppEpollEventDispatcher: could not watch socket %d", fd);
+}
+
+void QXmppEpollEventDispatcher::unregisterSocketNotifier(QSocketNotifier *notifier)
+{
+    const int fd = notifier->socket();
+    QHash<int, QXmppEpollSocket>::iterator it = d->sockets.find(fd);
+    if (it == d->sockets.end() || it->notifiers[notifier->type()] != notifier)
+        return;
+    it->notifiers[notifier->type()] = 0;
+    d->updateSocket(fd, false);
+}
+
+void QXmppEpollEventDispatcher::registerTimer(int timerId, int interval, Qt::TimerType timerType, QObject *object)
+{
+    QXmppEpollTimer timer;
+    timer.id = timerId;
+    timer.interval = interval;
+    timer.type = timerType;
+    timer.object = object;
+    timer.deadline = d->clock.elapsed() + interval;
+    timer.active = false;
+    d->timers.insert(timerId, timer);
+}
+
+bool QXmppEpollEventDispatcher::unregisterTimer(int timerId)
+{
+    return d->timers.remove(timerId) > 0;
+}
+
+bool QXmppEpollEventDispatcher::unregisterTimers(QObject *object)
+{
+    bool found = false;
+    QHash<int, QXmppEpollTimer>::iterator it = d->timers.begin();
+    while (it != d->timers.end()) {
+        if (it->object == object) {
+            it = d->timers.erase(it);
+            found = true;
+        } else {
+            ++it;
+        }
+    }
+    return found;
+}
+
+QList<QAbstractEventDispatcher::TimerInfo> QXmppEpollEventDispatcher::registeredTimers(QObject *object) const
+{
+    QList<TimerInfo> result;
+    QHash<int, QXmppEpollTimer>::const_iterator it;
+    for (it = d->timers.constBegin(); it != d->timers.constEnd(); ++it) {
+        if (it->object == object)
+            result << TimerInfo(it->id, it->interval, it->type);
+    }
+    return result;
+}
+
+int QXmppEpollEventDispatcher::remainingTime(int timerId)
+{
+    QHash<int, QXmppEpollTimer>::const_iterator it = d->timers.constFind(timerId);
+    if (it == d->timers.constEnd())
+        return -1;
+    return int(qMax(it->deadline - d->clock.elapsed(), qint64(0)));
+}
+
+void QXmppEpollEventDispatcher::wakeUp()
+{
+    const quint64 value = 1;
+    if (::write(d->eventFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        qWarning("QXmppEpollEventDispatcher: could not wake up");
+}
+
+void QXmppEpollEventDispatcher::interrupt()
+{
+    d->interrupted.store(1);
+    wakeUp();
+}
+
+void QXmppEpollEventDispatcher::flush()
+{
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPEPOLLDISPATCHER_P_H
+#define QXMPPEPOLLDISPATCHER_P_H
+
+#include <QAbstractEventDispatcher>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+#if defined(Q_OS_LINUX) && QT_VERSION >= 0x050000
+
+class QXmppEpollEventDispatcherPrivate;
+
+/// \internal
+///
+/// The QXmppEpollEventDispatcher class is an event dispatcher based on
+/// Linux's epoll, for threads which watch many sockets.
+///
+/// Qt's default dispatcher polls every socket notifier of the thread each
+/// time it waits for events, so its cost grows with the number of
+/// connections even when few of them are active. Here the sockets are
+/// registered with the kernel once, and waiting only returns the ready
+/// ones. Posted events wake the thread through an eventfd.
+///
+/// Sockets are watched level-triggered, as QSocketNotifier expects to be
+/// activated again while data remains to be read.
+
+class QXMPP_AUTOTEST_EXPORT QXmppEpollEventDispatcher : public QAbstractEventDispatcher
+{
+    Q_OBJECT
+
+public:
+    explicit QXmppEpollEventDispatcher(QObject *parent = 0);
+    ~QXmppEpollEventDispatcher();
+
+    bool isValid() const;
+
+    bool processEvents(QEventLoop::ProcessEventsFlags flags);
+    bool hasPendingEvents();
+
+    void registerSocketNotifier(QSocketNotifier *notifier);
+    void unregisterSocketNotifier(QSocketNotifier *notifier);
+
+    void registerTimer(int timerId, int interval, Qt::TimerType timerType, QObject *object);
+    bool unregisterTimer(int timerId);
+    bool unregisterTimers(QObject *object);
+    QList<TimerInfo> registeredTimers(QObject *object) const;
+    int remainingTime(int timerId);
+
+    void wakeUp();
+    void interrupt();
+    void flush();
+
+private:
+    QXmppEpollEventDispatcherPrivate * const d;
+};
+
+#endif
+
+#endif
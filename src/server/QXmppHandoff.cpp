@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QtEndian>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "QXmppHandoff_p.h"
+
+#ifdef Q_OS_UNIX
+// the most listening sockets which are handed off at once
+static const int maximumDescriptors = 64;
+
+union ControlBuffer
+{
+    struct cmsghdr header;
+    char data[CMSG_SPACE(sizeof(int) * maximumDescriptors)];
+};
+
+// Waits until the socket is ready for the given events, or the time is up.
+static bool waitForSocket(int socket, short events, const QElapsedTimer &timer, int msecs)
+{
+    struct pollfd pfd;
+    pfd.fd = socket;
+    pfd.events = events;
+    pfd.revents = 0;
+    forever {
+        const int remaining = int(qMax(qint64(0), msecs - timer.elapsed()));
+        const int ret = ::poll(&pfd, 1, remaining);
+        if (ret > 0)
+            return true;
+        if (ret == 0 || errno != EINTR)
+            return false;
+    }
+}
+
+// Receives the header and the descriptors, then the blob.
+static bool receiveFrom(int socket, QList<int> *descriptors, QByteArray *data, int msecs)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    quint32 length = 0;
+    struct iovec iov;
+    iov.iov_base = &length;
+    iov.iov_len = sizeof(length);
+
+    ControlBuffer control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    if (!waitForSocket(socket, POLLIN, timer, msecs))
+        return false;
+    ssize_t ret;
+    do {
+        ret = ::recvmsg(socket, &msg, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        const int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int *fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        for (int i = 0; i < count; ++i)
+            descriptors->append(fds[i]);
+    }
+    if (ret != ssize_t(sizeof(length)) || (msg.msg_flags & MSG_CTRUNC))
+        return false;
+
+    data->resize(qFromBigEndian(length));
+    int received = 0;
+    while (received < data->size()) {
+        if (!waitForSocket(socket, POLLIN, timer, msecs))
+            return false;
+        ret = ::recv(socket, data->data() + received, data->size() - received, 0);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        received += ret;
+    }
+    return true;
+}
+#endif
+
+/// Closes the \a descriptors which were received but are not used.
+///
+/// \param descriptors
+
+void QXmppHandoff::close(const QList<int> &descriptors)
+{
+#ifdef Q_OS_UNIX
+    foreach (int descriptor, descriptors)
+        ::close(descriptor);
+#else
+    Q_UNUSED(descriptors);
+#endif
+}
+
+/// Returns the path of the Unix domain socket which QLocalServer listens
+/// on for the given \a name.
+///
+/// \param name
+
+QString QXmppHandoff::socketPath(const QString &name)
+{
+    if (name.startsWith(QLatin1Char('/')))
+        return name;
+    return QDir::tempPath() + QLatin1Char('/') + name;
+}
+
+/// Returns true if the process at the other end of the connected Unix
+/// domain \a socket runs as the same user as this process.
+///
+/// The credentials are read with SO_PEERCRED on Linux and getpeereid()
+/// elsewhere, a peer whose credentials cannot be read is not trusted.
+///
+/// \param socket
+
+bool QXmppHandoff::isPeerTrusted(int socket)
+{
+#if defined(Q_OS_UNIX) && defined(SO_PEERCRED)
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (::getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0)
+        return false;
+    return credentials.uid == ::getuid();
+#elif defined(Q_OS_UNIX)
+    uid_t uid;
+    gid_t gid;
+    if (::getpeereid(socket, &uid, &gid) != 0)
+        return false;
+    return uid == ::getuid();
+#else
+    Q_UNUSED(socket);
+    return false;
+#endif
+}
+
+/// Connects to the server listening for a handoff on \a name and receives
+/// its listening sockets and its state in \a data.
+///
+/// The server must run as the same user as this process, otherwise
+/// nothing is received.
+///
+/// On failure, the \a descriptors which were received are closed.
+///
+/// \param name
+/// \param descriptors
+/// \param data
+/// \param msecs
+
+bool QXmppHandoff::receive(const QString &name, QList<int> *descriptors, QByteArray *data, int msecs)
+{
+#ifdef Q_OS_UNIX
+    const QByteArray path = QFile::encodeName(socketPath(name));
+    struct sockaddr_un addr;
+    if (path.size() >= int(sizeof(addr.sun_path)))
+        return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.constData(), path.size());
+
+    const int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket < 0)
+        return false;
+
+    descriptors->clear();
+    bool ok = ::connect(socket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0 &&
+              isPeerTrusted(socket) &&
+              receiveFrom(socket, descriptors, data, msecs);
+    ::close(socket);
+    if (!ok) {
+        close(*descriptors);
+        descriptors->clear();
+    }
+    return ok;
+#else
+    Q_UNUSED(name);
+    Q_UNUSED(descriptors);
+    Q_UNUSED(data);
+    Q_UNUSED(msecs);
+    return false;
+#endif
+}
+
+/// Sends the listening \a descriptors and the state in \a data over the
+/// connected Unix domain \a socket, which may be non-blocking.
+///
+/// The descriptors are duplicated into the receiving process, the caller
+/// still owns its own copies.
+///
+/// \param socket
+/// \param descriptors
+/// \param data
+/// \param msecs
+
+bool QXmppHandoff::send(int socket, const QList<int> &descriptors, const QByteArray &data, int msecs)
+{
+#ifdef Q_OS_UNIX
+    if (descriptors.size() > maximumDescriptors)
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    quint32 length = qToBigEndian(quint32(data.size()));
+    struct iovec iov;
+    iov.iov_base = &length;
+    iov.iov_len = sizeof(length);
+
+    ControlBuffer control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (!descriptors.isEmpty()) {
+        msg.msg_control = control.data;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * descriptors.size());
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * descriptors.size());
+        int *fds = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+        for (int i = 0; i < descriptors.size(); ++i)
+            fds[i] = descriptors.at(i);
+    }
+
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
+    ssize_t ret;
+    forever {
+        if (!waitForSocket(socket, POLLOUT, timer, msecs))
+            return false;
+        ret = ::sendmsg(socket, &msg, flags);
+        if (ret >= 0 || (errno != EINTR && errno != EAGAIN))
+            break;
+    }
+    if (ret != ssize_t(sizeof(length)))
+        return false;
+
+    int written = 0;
+    while (written < data.size()) {
+        if (!waitForSocket(socket, POLLOUT, timer, msecs))
+            return false;
+        ret = ::send(socket, data.constData() + written, data.size() - written, flags);
+        if (ret < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (ret <= 0)
+            return false;
+        written += ret;
+    }
+    return true;
+#else
+    Q_UNUSED(socket);
+    Q_UNUSED(descriptors);
+    Q_UNUSED(data);
+    Q_UNUSED(msecs);
+    return false;
+#endif
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPHANDOFF_P_H
+#define QXMPPHANDOFF_P_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppHandoff class passes the listening sockets of a server and a
+/// blob describing its state to another process over a Unix domain socket.
+///
+/// The sockets travel as SCM_RIGHTS ancillary data along with the length
+/// of the blob, which follows on the same connection. It is not available
+/// on other platforms.
+///
+/// Only a peer running as the same user is trusted with the sockets.
+
+class QXMPP_AUTOTEST_EXPORT QXmppHandoff
+{
+public:
+    static void close(const QList<int> &descriptors);
+    static bool isPeerTrusted(int socket);
+    static QString socketPath(const QString &name);
+    static bool receive(const QString &name, QList<int> *descriptors, QByteArray *data, int msecs);
+    static bool send(int socket, const QList<int> &descriptors, const QByteArray &data, int msecs);
+};
+
+#endif
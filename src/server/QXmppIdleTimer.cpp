@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QBasicTimer>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QList>
+#include <QPointer>
+#include <QThreadStorage>
+#include <QTimerEvent>
+
+#include "QXmppIdleTimer_p.h"
+
+// duration of a tick of the wheel in milliseconds, and number of slots
+static const int timerWheelTick = 250;
+static const int timerWheelSlots = 256;
+
+// Monotonic clock shared by the timers of all threads, so that a timer's
+// last activity remains valid when it moves to another thread.
+class QXmppIdleClock
+{
+public:
+    QXmppIdleClock()
+    {
+        clock.start();
+    }
+
+    QElapsedTimer clock;
+};
+
+Q_GLOBAL_STATIC(QXmppIdleClock, idleClock)
+
+static qint64 idleNow()
+{
+    return idleClock()->clock.elapsed();
+}
+
+/// \internal
+///
+/// The QXmppTimerWheel class checks the idle timers of all the connections
+/// living in a thread using a single coarse timer.
+///
+/// Each timer is linked into the slot of the tick at which it is due to
+/// expire. When the wheel reaches a slot, the timers which were restarted
+/// in the meantime are moved to the slot of their new expiry time, and the
+/// others time out.
+
+class QXmppTimerWheel : public QObject
+{
+public:
+    QXmppTimerWheel();
+    ~QXmppTimerWheel();
+
+    static QXmppTimerWheel *instance();
+
+    void link(QXmppIdleTimer *timer);
+    void unlink(QXmppIdleTimer *timer);
+
+protected:
+    void timerEvent(QTimerEvent *event);
+
+private:
+    void insert(QXmppIdleTimer *timer);
+
+    QXmppIdleTimer *m_slots[timerWheelSlots];
+    // the last tick which was processed
+    qint64 m_tick;
+    int m_count;
+    QBasicTimer m_timer;
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<QXmppTimerWheel*>, timerWheelStorage)
+
+QXmppTimerWheel::QXmppTimerWheel()
+    : m_tick(0)
+    , m_count(0)
+{
+    for (int i = 0; i < timerWheelSlots; ++i)
+        m_slots[i] = 0;
+}
+
+QXmppTimerWheel::~QXmppTimerWheel()
+{
+    for (int i = 0; i < timerWheelSlots; ++i) {
+        QXmppIdleTimer *timer = m_slots[i];
+        while (timer) {
+            QXmppIdleTimer *next = timer->m_next;
+            timer->m_wheel = 0;
+            timer->m_previous = 0;
+            timer->m_next = 0;
+            timer = next;
+        }
+    }
+}
+
+/// Returns the timer wheel for the current thread.
+
+QXmppTimerWheel *QXmppTimerWheel::instance()
+{
+    QThreadStorage<QXmppTimerWheel*> *storage = timerWheelStorage();
+    if (!storage->hasLocalData())
+        storage->setLocalData(new QXmppTimerWheel);
+    return storage->localData();
+}
+
+/// Starts checking the given \a timer.
+
+void QXmppTimerWheel::link(QXmppIdleTimer *timer)
+{
+    if (!m_count) {
+        m_tick = idleNow() / timerWheelTick;
+        m_timer.start(timerWheelTick, this);
+    }
+    m_count++;
+    insert(timer);
+}
+
+/// Stops checking the given \a timer.
+
+void QXmppTimerWheel::unlink(QXmppIdleTimer *timer)
+{
+    if (timer->m_previous)
+        timer->m_previous->m_next = timer->m_next;
+    else
+        m_slots[timer->m_slot] = timer->m_next;
+    if (timer->m_next)
+        timer->m_next->m_previous = timer->m_previous;
+    timer->m_wheel = 0;
+    timer->m_previous = 0;
+    timer->m_next = 0;
+
+    if (!--m_count)
+        m_timer.stop();
+}
+
+/// Links the \a timer into the slot of the first tick after its expiry.
+
+void QXmppTimerWheel::insert(QXmppIdleTimer *timer)
+{
+    const qint64 deadline = timer->m_lastActivity + timer->m_interval;
+    const qint64 tick = qMax((deadline + timerWheelTick - 1) / timerWheelTick, m_tick + 1);
+    const int slot = int(tick % timerWheelSlots);
+
+    timer->m_wheel = this;
+    timer->m_slot = slot;
+    timer->m_previous = 0;
+    timer->m_next = m_slots[slot];
+    if (m_slots[slot])
+        m_slots[slot]->m_previous = timer;
+    m_slots[slot] = timer;
+}
+
+void QXmppTimerWheel::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() != m_timer.timerId()) {
+        QObject::timerEvent(event);
+        return;
+    }
+
+    const qint64 now = idleNow();
+    const qint64 nowTick = now / timerWheelTick;
+
+    // process the ticks which elapsed, visiting each slot at most once
+    QList<QPointer<QXmppIdleTimer> > expired;
+    const qint64 lastTick = qMin(nowTick, m_tick + timerWheelSlots);
+    while (m_tick < lastTick) {
+        ++m_tick;
+        const int slot = int(m_tick % timerWheelSlots);
+        QXmppIdleTimer *timer = m_slots[slot];
+        m_slots[slot] = 0;
+        while (timer) {
+            QXmppIdleTimer *next = timer->m_next;
+            if (timer->m_lastActivity + timer->m_interval <= now) {
+                timer->m_wheel = 0;
+                timer->m_previous = 0;
+                timer->m_next = 0;
+                timer->m_active = false;
+                m_count--;
+                expired << timer;
+            } else {
+                insert(timer);
+            }
+            timer = next;
+        }
+    }
+    m_tick = qMax(m_tick, nowTick);
+
+    if (!m_count)
+        m_timer.stop();
+
+    // the handlers may delete or restart other timers
+    foreach (const QPointer<QXmppIdleTimer> &timer, expired) {
+        if (timer && !timer->m_active)
+            emit timer->timeout();
+    }
+}
+
+/// Constructs a new idle timer with the given \a parent.
+
+QXmppIdleTimer::QXmppIdleTimer(QObject *parent)
+    : QObject(parent)
+    , m_interval(0)
+    , m_active(false)
+    , m_lastActivity(0)
+    , m_wheel(0)
+    , m_slot(0)
+    , m_previous(0)
+    , m_next(0)
+{
+}
+
+/// Destroys the idle timer.
+
+QXmppIdleTimer::~QXmppIdleTimer()
+{
+    if (m_wheel)
+        m_wheel->unlink(this);
+}
+
+/// Returns the interval in milliseconds after which the timer times out
+/// if it is not restarted.
+
+int QXmppIdleTimer::interval() const
+{
+    return m_interval;
+}
+
+/// Sets the interval in milliseconds after which the timer times out
+/// if it is not restarted.
+///
+/// A timer with an interval of 0 never times out.
+
+void QXmppIdleTimer::setInterval(int msecs)
+{
+    m_interval = qMax(0, msecs);
+    if (m_wheel)
+        m_wheel->unlink(this);
+    if (m_active)
+        start();
+}
+
+/// Returns true if the timer is running.
+
+bool QXmppIdleTimer::isActive() const
+{
+    return m_active;
+}
+
+/// Starts or restarts the timer, recording activity on the connection.
+
+void QXmppIdleTimer::start()
+{
+    if (!m_interval) {
+        stop();
+        return;
+    }
+
+    m_lastActivity = idleNow();
+    m_active = true;
+    if (!m_wheel)
+        QXmppTimerWheel::instance()->link(this);
+}
+
+/// Stops the timer.
+
+void QXmppIdleTimer::stop()
+{
+    m_active = false;
+    if (m_wheel)
+        m_wheel->unlink(this);
+}
+
+bool QXmppIdleTimer::event(QEvent *event)
+{
+    // the wheel belongs to the thread, move to the new thread's wheel
+    // once the move is complete
+    if (event->type() == QEvent::ThreadChange && m_wheel) {
+        m_wheel->unlink(this);
+        QMetaObject::invokeMethod(this, "_q_threadChanged", Qt::QueuedConnection);
+    }
+    return QObject::event(event);
+}
+
+void QXmppIdleTimer::_q_threadChanged()
+{
+    if (m_active && !m_wheel)
+        QXmppTimerWheel::instance()->link(this);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPIDLETIMER_P_H
+#define QXMPPIDLETIMER_P_H
+
+#include <QObject>
+
+#include "QXmppGlobal.h"
+
+class QXmppTimerWheel;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppIdleTimer class detects connections which stay inactive for
+/// longer than a given interval.
+///
+/// Unlike a QTimer, restarting it with start() only records the time of
+/// the activity. The timers of all the connections in a thread are kept
+/// in a single hashed timer wheel, which checks them in coarse ticks,
+/// so restarting a timer on every stanza costs no timer bookkeeping.
+
+class QXMPP_AUTOTEST_EXPORT QXmppIdleTimer : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppIdleTimer(QObject *parent = 0);
+    ~QXmppIdleTimer();
+
+    int interval() const;
+    void setInterval(int msecs);
+
+    bool isActive() const;
+
+signals:
+    /// This signal is emitted when the interval elapses without the timer
+    /// being restarted.
+    void timeout();
+
+public slots:
+    void start();
+    void stop();
+
+protected:
+    bool event(QEvent *event);
+
+private slots:
+    void _q_threadChanged();
+
+private:
+    friend class QXmppTimerWheel;
+
+    int m_interval;
+    bool m_active;
+    qint64 m_lastActivity;
+
+    // position in the wheel, while the timer is linked into it
+    QXmppTimerWheel *m_wheel;
+    int m_slot;
+    QXmppIdleTimer *m_previous;
+    QXmppIdleTimer *m_next;
+};
+
+#endif
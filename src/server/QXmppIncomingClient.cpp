@@ -21,20 +21,31 @@
  *
  */
 
+#include <QDateTime>
 #include <QDomElement>
+#include <QHash>
 #include <QHostAddress>
+#include <QLocalSocket>
 #include <QSslKey>
 #include <QSslSocket>
 #include <QTimer>
 
 #include "QXmppBindIq.h"
+#include "QXmppBoshServer_p.h"
 #include "QXmppConstants.h"
+#include "QXmppElement.h"
+#include "QXmppIdleTimer_p.h"
+#include "QXmppLoginTokenStore_p.h"
+#include "QXmppMemoryStats_p.h"
 #include "QXmppMessage.h"
+#include "QXmppOutputScheduler_p.h"
 #include "QXmppPasswordChecker.h"
 #include "QXmppSasl_p.h"
 #include "QXmppSessionIq.h"
 #include "QXmppStreamFeatures.h"
+#include "QXmppTracepoints_p.h"
 #include "QXmppUtils.h"
+#include "QXmppWebSocket_p.h"
 
 #include "QXmppIncomingClient.h"
 
@@ -42,16 +53,54 @@ class QXmppIncomingClientPrivate
 {
 public:
     QXmppIncomingClientPrivate(QXmppIncomingClient *qq);
-    QTimer *idleTimer;
+    QXmppIdleTimer *idleTimer;
 
     QString domain;
     QString jid;
     QString resource;
     QXmppPasswordChecker *passwordChecker;
+    QHash<QString, QXmppPasswordChecker*> hostedDomains;
     QXmppSaslServer *saslServer;
+    bool streamCompressionEnabled;
 
+    // login tokens for fast reconnection
+    QSharedPointer<QXmppLoginTokenStore> loginTokens;
+
+    // XEP-0198: Stream Management
+    bool smEnabled;
+    bool smResuming;
+    bool smDetached;
+    quint32 smInbound;
+    quint32 smOutbound;
+    quint32 smAcked;
+    QList<QByteArray> smUnacked;
+    qint64 smUnackedSize;
+    QList<QByteArray> smPending;
+    QString smResumeId;
+    QTimer *resumptionTimer;
+
+    // XEP-0352: Client State Indication
+    bool csiInactive;
+    QHash<QByteArray, QByteArray> csiPresences;
+    QList<QByteArray> csiOrder;
+    qint64 csiSize;
+
+#ifdef QXMPP_MEMORY_STATS
+    qint64 clientMemoryBytes;
+    qint64 smMemoryBytes;
+#endif
+
+    void init(QIODevice *device);
+    void acknowledge(quint32 handled);
     void checkCredentials(const QByteArray &response);
+    bool loginTokensEnabled() const;
+    QVariantMap exportSession();
+    void importSession(const QVariantMap &session);
+    void flushPresences();
+    void handleStreamManagement(const QDomElement &element);
+    void sendStreamManagementFailure(const QString &condition);
     QString origin() const;
+    void updateMemoryStats();
 
 private:
     QXmppIncomingClient *q;
@@ -61,12 +110,92 @@ QXmppIncomingClientPrivate::QXmppIncomingClientPrivate(QXmppIncomingClient *qq)
     : idleTimer(0)
     , passwordChecker(0)
     , saslServer(0)
+    , streamCompressionEnabled(false)
+    , smEnabled(false)
+    , smResuming(false)
+    , smDetached(false)
+    , smInbound(0)
+    , smOutbound(0)
+    , smAcked(0)
+    , smUnackedSize(0)
+    , resumptionTimer(0)
+    , csiInactive(false)
+    , csiSize(0)
+#ifdef QXMPP_MEMORY_STATS
+    , clientMemoryBytes(0)
+    , smMemoryBytes(0)
+#endif
     , q(qq)
 {
 }
 
+void QXmppIncomingClientPrivate::init(QIODevice *device)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (device) {
+        // sockets tell us when the peer goes away, other devices when
+        // they are closed
+        if (device->metaObject()->indexOfSignal("disconnected()") >= 0)
+            check = QObject::connect(device, SIGNAL(disconnected()),
+                                     q, SLOT(onSocketDisconnected()));
+        else
+            check = QObject::connect(device, SIGNAL(aboutToClose()),
+                                     q, SLOT(onSocketDisconnected()));
+        Q_ASSERT(check);
+
+        q->setDevice(device);
+    }
+
+    q->info(QString("Incoming client connection from %1").arg(origin()));
+
+    // create inactivity timer
+    idleTimer = new QXmppIdleTimer(q);
+    check = QObject::connect(idleTimer, SIGNAL(timeout()),
+                             q, SLOT(onTimeout()));
+    Q_ASSERT(check);
+
+    // create resumption timer
+    resumptionTimer = new QTimer(q);
+    resumptionTimer->setInterval(0);
+    resumptionTimer->setSingleShot(true);
+    check = QObject::connect(resumptionTimer, SIGNAL(timeout()),
+                             q, SLOT(_q_resumptionTimeout()));
+    Q_ASSERT(check);
+
+    // messages are usually forwarded as-is, don't build a DOM for them
+    q->setRawStanzaNames(QStringList() << QLatin1String("message"));
+}
+
 void QXmppIncomingClientPrivate::checkCredentials(const QByteArray &response)
 {
+    QXMPP_TRACEPOINT1(sasl__check, q);
+
+    // login tokens are checked locally, without the password checker
+    if (saslServer->mechanism() == "X-QXMPP-TOKEN") {
+        const QString bareJid = QString("%1@%2").arg(saslServer->username(), domain);
+        if (!loginTokensEnabled() || !loginTokens->take(bareJid, QString::fromUtf8(saslServer->password()))) {
+            q->warning(QString("Login token rejected for '%1' from %2").arg(bareJid, origin()));
+            q->updateCounter("incoming-client.auth.token-rejected");
+            q->sendPacket(QXmppSaslFailure("not-authorized"));
+
+            // let the client fall back to its password
+            delete saslServer;
+            saslServer = 0;
+            return;
+        }
+
+        jid = bareJid;
+        q->info(QString("Token authentication succeeded for '%1' from %2").arg(jid, origin()));
+        q->updateCounter("incoming-client.auth.token");
+
+        // the token was consumed, hand out a new one
+        q->sendPacket(QXmppSaslSuccess(loginTokens->issue(jid).toUtf8()));
+        q->handleStart();
+        return;
+    }
+
     QXmppPasswordRequest request;
     request.setDomain(domain);
     request.setUsername(saslServer->username());
@@ -88,11 +217,190 @@ void QXmppIncomingClientPrivate::checkCredentials(const QByteArray &response)
     }
 }
 
+/// Returns true if login tokens can be used.
+
+bool QXmppIncomingClientPrivate::loginTokensEnabled() const
+{
+    return loginTokens && !loginTokens->secret().isEmpty();
+}
+
+/// Drops the outgoing stanzas acknowledged by the client, given the total
+/// number of stanzas it has \a handled.
+
+void QXmppIncomingClientPrivate::acknowledge(quint32 handled)
+{
+    quint32 count = handled - smAcked;
+    if (count > quint32(smUnacked.size())) {
+        q->warning(QString("Client acknowledged %1 stanzas, only %2 are unacknowledged").arg(
+            QString::number(count), QString::number(smUnacked.size())));
+        count = smUnacked.size();
+    }
+    for (quint32 i = 0; i < count; ++i)
+        smUnackedSize -= smUnacked.takeFirst().size();
+    smAcked += count;
+    updateMemoryStats();
+}
+
+/// Accounts for the client's session state and for the stanzas kept for
+/// stream management.
+
+/// Sends the presences which were held back while the client was inactive.
+
+// Takes the resumable session out of this stream.
+QVariantMap QXmppIncomingClientPrivate::exportSession()
+{
+    QVariantList stanzas;
+    foreach (const QByteArray &stanza, smUnacked)
+        stanzas << stanza;
+
+    QVariantMap session;
+    session.insert("id", smResumeId);
+    session.insert("jid", jid);
+    session.insert("inbound", uint(smInbound));
+    session.insert("acked", uint(smAcked));
+    session.insert("stanzas", stanzas);
+
+    smEnabled = false;
+    smUnacked.clear();
+    smUnackedSize = 0;
+    smResumeId.clear();
+    resumptionTimer->stop();
+    updateMemoryStats();
+    return session;
+}
+
+// Loads a session exported by another stream.
+void QXmppIncomingClientPrivate::importSession(const QVariantMap &session)
+{
+    jid = session.value("jid").toString();
+    resource = QXmppUtils::jidToResource(jid);
+    smEnabled = true;
+    q->setOutputSchedulingWindow(0);
+    smResumeId = session.value("id").toString();
+    smInbound = session.value("inbound").toUInt();
+    smAcked = session.value("acked").toUInt();
+    smUnacked.clear();
+    smUnackedSize = 0;
+    foreach (const QVariant &stanza, session.value("stanzas").toList()) {
+        smUnacked << stanza.toByteArray();
+        smUnackedSize += smUnacked.last().size();
+    }
+    smOutbound = smAcked + smUnacked.size();
+}
+
+void QXmppIncomingClientPrivate::flushPresences()
+{
+    if (csiOrder.isEmpty())
+        return;
+
+    const QList<QByteArray> order = csiOrder;
+    const QHash<QByteArray, QByteArray> presences = csiPresences;
+    csiOrder.clear();
+    csiPresences.clear();
+    csiSize = 0;
+
+    const bool inactive = csiInactive;
+    csiInactive = false;
+    foreach (const QByteArray &from, order)
+        q->sendData(presences.value(from));
+    csiInactive = inactive;
+    updateMemoryStats();
+}
+
+void QXmppIncomingClientPrivate::updateMemoryStats()
+{
+#ifdef QXMPP_MEMORY_STATS
+    const qint64 stringBytes = sizeof(QChar) * qint64(domain.capacity() + jid.capacity()
+        + resource.capacity() + smResumeId.capacity());
+    const qint64 clientBytes = sizeof(QXmppIncomingClient) + sizeof(QXmppIncomingClientPrivate)
+        + sizeof(QXmppIdleTimer) + sizeof(QTimer) + stringBytes + csiSize;
+    QXmppMemoryStats::resize(QXmppMemoryStats::ClientState, clientMemoryBytes, clientBytes);
+
+    qint64 smBytes = smUnackedSize + (smUnacked.size() + smPending.size()) * qint64(sizeof(QByteArray));
+    foreach (const QByteArray &data, smPending)
+        smBytes += data.size();
+    QXmppMemoryStats::resize(QXmppMemoryStats::StreamManagement, smMemoryBytes, smBytes);
+#endif
+}
+
+void QXmppIncomingClientPrivate::handleStreamManagement(const QDomElement &element)
+{
+    const QString tagName = element.tagName();
+    if (tagName == QLatin1String("enable")) {
+        if (resource.isEmpty() || smEnabled) {
+            sendStreamManagementFailure("unexpected-request");
+            return;
+        }
+
+        // resumption needs someone to keep track of the session
+        const QString resume = element.attribute("resume");
+        const bool resumable = (resume == QLatin1String("true") || resume == QLatin1String("1")) &&
+                               resumptionTimer->interval() > 0 &&
+                               q->receivers(SIGNAL(resumptionEnabled(QString))) > 0;
+
+        // acknowledgements count stanzas in the order they were sent
+        q->setOutputSchedulingWindow(0);
+        smEnabled = true;
+        smInbound = 0;
+        smOutbound = 0;
+        smAcked = 0;
+
+        QString data = QString("<enabled xmlns='%1'").arg(ns_stream_management);
+        if (resumable) {
+            smResumeId = QXmppUtils::generateStanzaHash();
+            data += QString(" id='%1' resume='true' max='%2'").arg(
+                smResumeId, QString::number(resumptionTimer->interval() / 1000));
+        }
+        data += "/>";
+        q->QXmppStream::sendData(data.toUtf8());
+
+        if (resumable)
+            emit q->resumptionEnabled(smResumeId);
+    }
+    else if (tagName == QLatin1String("r")) {
+        if (smEnabled)
+            q->QXmppStream::sendData(QString("<a xmlns='%1' h='%2'/>").arg(
+                ns_stream_management, QString::number(smInbound)).toUtf8());
+    }
+    else if (tagName == QLatin1String("a")) {
+        bool ok;
+        const quint32 handled = element.attribute("h").toUInt(&ok);
+        if (smEnabled && ok)
+            acknowledge(handled);
+    }
+    else if (tagName == QLatin1String("resume")) {
+        bool ok;
+        const uint handled = element.attribute("h").toUInt(&ok);
+        const QString previd = element.attribute("previd");
+        if (jid.isEmpty() || !resource.isEmpty() || smResuming) {
+            sendStreamManagementFailure("unexpected-request");
+        } else if (!ok || previd.isEmpty() ||
+                   q->receivers(SIGNAL(resumeRequested(QString,uint))) <= 0) {
+            sendStreamManagementFailure("item-not-found");
+        } else {
+            smResuming = true;
+            emit q->resumeRequested(previd, handled);
+        }
+    }
+}
+
+void QXmppIncomingClientPrivate::sendStreamManagementFailure(const QString &condition)
+{
+    q->QXmppStream::sendData(QString("<failed xmlns='%1'><%2 xmlns='%3'/></failed>").arg(
+        ns_stream_management, condition, ns_stanza).toUtf8());
+}
+
 QString QXmppIncomingClientPrivate::origin() const
 {
     QSslSocket *socket = q->socket();
     if (socket)
         return socket->peerAddress().toString() + " " + QString::number(socket->peerPort());
+    else if (QLocalSocket *localSocket = qobject_cast<QLocalSocket*>(q->device()))
+        return localSocket->fullServerName();
+    else if (QXmppWebSocket *webSocket = qobject_cast<QXmppWebSocket*>(q->device()))
+        return webSocket->socket()->peerAddress().toString() + " " + QString::number(webSocket->socket()->peerPort());
+    else if (QXmppBoshSession *session = qobject_cast<QXmppBoshSession*>(q->device()))
+        return "BOSH " + session->sid();
     else
         return "<unknown>";
 }
@@ -107,28 +415,30 @@ QString QXmppIncomingClientPrivate::origin() const
 QXmppIncomingClient::QXmppIncomingClient(QSslSocket *socket, const QString &domain, QObject *parent)
     : QXmppStream(parent)
 {
-    bool check;
-    Q_UNUSED(check);
-
     d = new QXmppIncomingClientPrivate(this);
     d->domain = domain;
+    d->init(socket);
+    d->updateMemoryStats();
+}
 
-    if (socket) {
-        check = connect(socket, SIGNAL(disconnected()),
-                        this, SLOT(onSocketDisconnected()));
-        Q_ASSERT(check);
-
-        setSocket(socket);
-    }
-
-    info(QString("Incoming client connection from %1").arg(d->origin()));
+/// Constructs a new incoming client stream transported by an arbitrary
+/// device, such as a QLocalSocket or an in-process pipe.
+///
+/// The device must already be open. STARTTLS is not offered on such
+/// streams.
+///
+/// \param device The device for the XMPP stream.
+/// \param domain The local domain.
+/// \param parent The parent QObject for the stream (optional).
+///
 
-    // create inactivity timer
-    d->idleTimer = new QTimer(this);
-    d->idleTimer->setSingleShot(true);
-    check = connect(d->idleTimer, SIGNAL(timeout()),
-                    this, SLOT(onTimeout()));
-    Q_ASSERT(check);
+QXmppIncomingClient::QXmppIncomingClient(QIODevice *device, const QString &domain, QObject *parent)
+    : QXmppStream(parent)
+{
+    d = new QXmppIncomingClientPrivate(this);
+    d->domain = domain;
+    d->init(device);
+    d->updateMemoryStats();
 }
 
 /// Destroys the current stream.
@@ -136,6 +446,10 @@ QXmppIncomingClient::QXmppIncomingClient(QSslSocket *socket, const QString &doma
 
 QXmppIncomingClient::~QXmppIncomingClient()
 {
+#ifdef QXMPP_MEMORY_STATS
+    QXmppMemoryStats::resize(QXmppMemoryStats::ClientState, d->clientMemoryBytes, 0);
+    QXmppMemoryStats::resize(QXmppMemoryStats::StreamManagement, d->smMemoryBytes, 0);
+#endif
     delete d;
 }
 
@@ -179,6 +493,284 @@ void QXmppIncomingClient::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+/// Sets the other local \a domains the client can connect to, with the
+/// password checker used to verify the credentials of their clients.
+///
+/// The domain requested by the client's stream header is adopted until
+/// the client has authenticated.
+///
+/// \param domains
+
+void QXmppIncomingClient::setHostedDomains(const QHash<QString, QXmppPasswordChecker*> &domains)
+{
+    d->hostedDomains = domains;
+}
+
+/// Sets whether XEP-0138: Stream Compression is offered to the client
+/// once it has authenticated. This requires QXmpp to be built with zlib
+/// support.
+///
+/// \param enabled
+
+void QXmppIncomingClient::setStreamCompressionEnabled(bool enabled)
+{
+    d->streamCompressionEnabled = enabled;
+}
+
+/// Returns the number of seconds during which a session can be resumed
+/// after its stream was lost, or 0 if resumption is disabled.
+
+int QXmppIncomingClient::resumptionTimeout() const
+{
+    return d->resumptionTimer->interval() / 1000;
+}
+
+/// Sets the number of seconds during which a session can be resumed as
+/// defined by XEP-0198: Stream Management, after its stream was lost.
+///
+/// While the session waits to be resumed, the stanzas sent to it are
+/// kept. Set \a secs to 0 to disable resumption, which is the default.
+///
+/// \param secs
+
+void QXmppIncomingClient::setResumptionTimeout(int secs)
+{
+    d->resumptionTimer->setInterval(qMax(0, secs) * 1000);
+}
+
+/// \cond
+/// Sets the \a store which issues and checks login tokens.
+///
+/// When the store has a secret, clients which authenticated with their
+/// password can request a login token, and later authenticate with it
+/// using the X-QXMPP-TOKEN mechanism without consulting the password
+/// checker. A token is only accepted once, and each use returns a fresh
+/// one.
+///
+/// \param store
+
+void QXmppIncomingClient::setLoginTokenStore(const QSharedPointer<QXmppLoginTokenStore> &store)
+{
+    d->loginTokens = store;
+}
+/// \endcond
+
+/// Hands over the session to another stream which resumes it.
+///
+/// The stanzas the client has not \a handled are emitted with the rest of
+/// the session by sessionDetached(), then this stream is closed.
+///
+/// \param handled
+
+void QXmppIncomingClient::detachSession(uint handled)
+{
+    if (d->smResumeId.isEmpty())
+        return;
+
+    d->acknowledge(handled);
+    const QVariantMap session = d->exportSession();
+    emit sessionDetached(session);
+
+    if (d->smDetached) {
+        d->smDetached = false;
+        emit disconnected();
+    } else {
+        info(QString("Session for '%1' resumed by another stream").arg(d->jid));
+        disconnectFromHost();
+    }
+}
+
+/// Hands over the session to another server process, see
+/// QXmppServer::listenForHandoff().
+///
+/// The session is emitted by sessionDetached(), then the connection is
+/// dropped without closing the XML stream, so that the client resumes the
+/// session once it reconnects. A stream which cannot be resumed is closed.
+
+void QXmppIncomingClient::handOffSession()
+{
+    if (d->smResumeId.isEmpty()) {
+        disconnectFromHost();
+        return;
+    }
+
+    const QVariantMap session = d->exportSession();
+    emit sessionDetached(session);
+
+    if (d->smDetached) {
+        d->smDetached = false;
+        emit disconnected();
+    } else {
+        info(QString("Session for '%1' handed off to another process").arg(d->jid));
+        QXmppStream::disconnectFromHost(false);
+    }
+}
+
+/// Restores a \a session handed off by another server process on this
+/// stream, which has no connection yet.
+///
+/// The session is kept for resumptionTimeout() seconds, holding the stanzas
+/// routed to it until the client resumes it on another stream.
+///
+/// \param session
+
+void QXmppIncomingClient::restoreSession(const QVariantMap &session)
+{
+    if (d->smEnabled || resumptionTimeout() <= 0)
+        return;
+
+    d->importSession(session);
+    d->smDetached = true;
+    d->idleTimer->stop();
+    d->resumptionTimer->start();
+    d->updateMemoryStats();
+
+    info(QString("Restored session for '%1', waiting for it to be resumed").arg(d->jid));
+    emit resumptionEnabled(d->smResumeId);
+}
+
+/// Closes the stream, which ends the session.
+///
+/// \param sendCloseStream
+
+void QXmppIncomingClient::disconnectFromHost(const bool sendCloseStream)
+{
+    d->smResumeId.clear();
+    if (d->smDetached) {
+        d->smDetached = false;
+        d->resumptionTimer->stop();
+        emit disconnected();
+        return;
+    }
+    QXmppStream::disconnectFromHost(sendCloseStream);
+}
+
+/// Refuses the client's request to resume a session, the client can then
+/// bind a resource as usual.
+
+void QXmppIncomingClient::rejectResume()
+{
+    if (!d->smResuming)
+        return;
+
+    d->smResuming = false;
+    d->smPending.clear();
+    d->updateMemoryStats();
+    d->sendStreamManagementFailure("item-not-found");
+}
+
+/// Resumes a \a session handed over by detachSession() on the stream which
+/// requested it.
+///
+/// The stanzas the client did not acknowledge are sent again, followed by
+/// those routed to this stream while the session was being resumed.
+///
+/// \param session
+
+void QXmppIncomingClient::resumeSession(const QVariantMap &session)
+{
+    if (!d->smResuming)
+        return;
+
+    d->smResuming = false;
+    d->importSession(session);
+
+    info(QString("Resumed session for '%1' from %2").arg(d->jid, d->origin()));
+    updateCounter("incoming-client.resumed");
+
+    QXmppStream::sendData(QString("<resumed xmlns='%1' previd='%2' h='%3'/>").arg(
+        ns_stream_management, d->smResumeId, QString::number(d->smInbound)).toUtf8());
+    foreach (const QByteArray &stanza, d->smUnacked)
+        QXmppStream::sendData(stanza);
+
+    const QList<QByteArray> pending = d->smPending;
+    d->smPending.clear();
+    foreach (const QByteArray &stanza, pending)
+        sendData(stanza);
+    d->updateMemoryStats();
+
+    emit resumptionEnabled(d->smResumeId);
+}
+
+/// Sends raw data to the client.
+///
+/// While the client says it is inactive, as defined by XEP-0352: Client
+/// State Indication, presence updates are held back and only the last one
+/// of each sender is sent once the client is active again, or before any
+/// other stanza.
+///
+/// Once stream management is enabled, the stanzas are kept until the
+/// client acknowledges them, and they are no longer scheduled by
+/// priority, see QXmppStream::setOutputSchedulingWindow().
+///
+/// \param data
+
+bool QXmppIncomingClient::sendData(const QByteArray &data)
+{
+    const bool isStanza = data.startsWith("<message") ||
+                          data.startsWith("<presence") ||
+                          data.startsWith("<iq");
+    if (!isStanza)
+        return d->smDetached ? false : QXmppStream::sendData(data);
+
+    // XEP-0352: while the client is inactive, hold back presence updates,
+    // keeping the last one of each sender, until something urgent is sent
+    if (d->csiInactive) {
+        if (data.startsWith("<presence")) {
+            const QByteArray type = QXmppOutputScheduler::startTagAttribute(data, "type");
+            if (type.isEmpty() || type == "unavailable") {
+                const QByteArray from = QXmppOutputScheduler::startTagAttribute(data, "from");
+                QHash<QByteArray, QByteArray>::iterator it = d->csiPresences.find(from);
+                if (it == d->csiPresences.end()) {
+                    d->csiOrder << from;
+                    d->csiPresences.insert(from, data);
+                } else {
+                    updateCounter("incoming-client.csi.coalesced");
+                    d->csiSize -= it.value().size();
+                    it.value() = data;
+                }
+                d->csiSize += data.size();
+                d->updateMemoryStats();
+                return true;
+            }
+        }
+        d->flushPresences();
+    }
+
+    // hold stanzas back until the session is resumed
+    if (d->smResuming) {
+        d->smPending << data;
+        d->updateMemoryStats();
+        return true;
+    }
+
+    // presence shed by the output queue policy never reaches the client
+    if (!d->smEnabled ||
+        (!d->smDetached && isOutputQueueFull() &&
+         outputQueuePolicy() == DropPresencePolicy &&
+         data.startsWith("<presence")))
+        return QXmppStream::sendData(data);
+
+    d->smUnacked << data;
+    d->smUnackedSize += data.size();
+    d->smOutbound++;
+    d->updateMemoryStats();
+
+    if (d->smDetached) {
+        // give up the session if too much data piles up
+        if (outputHighWatermark() > 0 && d->smUnackedSize > outputHighWatermark()) {
+            warning(QString("Too much data for detached session '%1', closing it").arg(d->jid));
+            disconnectFromHost();
+        }
+        return true;
+    }
+
+    const bool written = QXmppStream::sendData(data);
+    if ((d->smOutbound - d->smAcked) % 8 == 0)
+        QXmppStream::sendData(QString("<r xmlns='%1'/>").arg(ns_stream_management).toUtf8());
+    return written;
+}
+
 /// \cond
 void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
 {
@@ -189,6 +781,13 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
         d->saslServer = 0;
     }
 
+    // serve the requested domain if it is hosted
+    const QString to = streamElement.attribute("to");
+    if (d->jid.isEmpty() && to != d->domain && d->hostedDomains.contains(to)) {
+        d->domain = to;
+        d->passwordChecker = d->hostedDomains.value(to);
+    }
+
     // start stream
     const QByteArray sessionId = QXmppUtils::generateStanzaHash().toLatin1();
     QString response = QString("<?xml version='1.0'?><stream:stream"
@@ -201,14 +800,14 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
     sendData(response.toUtf8());
 
     // check requested domain
-    if (streamElement.attribute("to") != d->domain)
+    if (to != d->domain)
     {
         QString response = QString("<stream:error>"
             "<host-unknown xmlns=\"urn:ietf:params:xml:ns:xmpp-streams\"/>"
             "<text xmlns=\"urn:ietf:params:xml:ns:xmpp-streams\">"
                 "This server does not serve %1"
             "</text>"
-            "</stream:error>").arg(streamElement.attribute("to"));
+            "</stream:error>").arg(to);
         sendData(response.toUtf8());
         disconnectFromHost();
         return;
@@ -222,10 +821,16 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
     {
         features.setBindMode(QXmppStreamFeatures::Required);
         features.setSessionMode(QXmppStreamFeatures::Enabled);
+        features.setStreamManagementMode(QXmppStreamFeatures::Enabled);
+        features.setClientStateIndicationMode(QXmppStreamFeatures::Enabled);
+        if (d->streamCompressionEnabled && isCompressionSupported() && !isCompressed())
+            features.setCompressionMethods(QStringList() << "zlib");
     }
     else if (d->passwordChecker)
     {
         QStringList mechanisms;
+        if (d->loginTokensEnabled())
+            mechanisms << "X-QXMPP-TOKEN";
         mechanisms << "PLAIN";
         if (d->passwordChecker->hasGetPassword())
             mechanisms << "DIGEST-MD5";
@@ -234,6 +839,41 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
     sendPacket(features);
 }
 
+void QXmppIncomingClient::handleRawStanza(const QXmppRawStanza &stanza)
+{
+    // forward messages without building a DOM, if someone is listening
+    if (stanza.tagName() != QLatin1String("message") ||
+        stanza.namespaceURI() != ns_client ||
+        !isConnected() ||
+        receivers(SIGNAL(rawStanzaReceived(QXmppRawStanza))) <= 0)
+    {
+        QXmppStream::handleRawStanza(stanza);
+        return;
+    }
+
+    if (d->idleTimer->interval())
+        d->idleTimer->start();
+    if (d->smEnabled)
+        d->smInbound++;
+
+    // check the sender is legitimate
+    const QString from = stanza.from();
+    if (!from.isEmpty() && from != d->jid && from != QXmppUtils::jidToBareJid(d->jid))
+    {
+        warning(QString("Received a stanza from unexpected JID %1").arg(from));
+        return;
+    }
+
+    // fill in the sender and recipient as handleStanza() does
+    QXmppRawStanza stanzaFull(stanza);
+    if (from.isEmpty())
+        stanzaFull.setAttribute("from", d->jid);
+    if (stanzaFull.to().isEmpty())
+        stanzaFull.setAttribute("to", d->domain);
+
+    emit rawStanzaReceived(stanzaFull);
+}
+
 void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
 {
     const QString ns = nodeRecv.namespaceURI();
@@ -243,11 +883,29 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
 
     if (ns == ns_tls && nodeRecv.tagName() == QLatin1String("starttls"))
     {
+        if (!socket()) {
+            sendData("<failure xmlns='urn:ietf:params:xml:ns:xmpp-tls'/>");
+            disconnectFromHost();
+            return;
+        }
         sendData("<proceed xmlns='urn:ietf:params:xml:ns:xmpp-tls'/>");
-        socket()->flush();
+        flush();
         socket()->startServerEncryption();
         return;
     }
+    else if (ns == ns_compress && nodeRecv.tagName() == QLatin1String("compress"))
+    {
+        if (!d->streamCompressionEnabled || !isCompressionSupported() || d->jid.isEmpty() || isCompressed()) {
+            sendData("<failure xmlns='http://jabber.org/protocol/compress'><setup-failed/></failure>");
+        } else if (nodeRecv.firstChildElement("method").text() != QLatin1String("zlib")) {
+            sendData("<failure xmlns='http://jabber.org/protocol/compress'><unsupported-method/></failure>");
+        } else {
+            sendData("<compressed xmlns='http://jabber.org/protocol/compress'/>");
+            startCompression();
+            handleStart();
+        }
+        return;
+    }
     else if (ns == ns_sasl)
     {
         if (!d->passwordChecker) {
@@ -272,6 +930,7 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
 
             QByteArray challenge;
             QXmppSaslServer::Response result = d->saslServer->respond(auth.value(), challenge);
+            QXMPP_TRACEPOINT3(sasl__step, this, 0, int(result));
 
             if (result == QXmppSaslServer::InputNeeded) {
                 // check credentials
@@ -299,6 +958,7 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
 
             QByteArray challenge;
             QXmppSaslServer::Response result = d->saslServer->respond(response.value(), challenge);
+            QXMPP_TRACEPOINT3(sasl__step, this, 1, int(result));
             if (result == QXmppSaslServer::InputNeeded) {
                 // check credentials
                 d->checkCredentials(response.value());
@@ -316,8 +976,29 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
             }
         }
     }
+    else if (ns == ns_stream_management)
+    {
+        d->handleStreamManagement(nodeRecv);
+        return;
+    }
+    else if (ns == ns_csi)
+    {
+        // XEP-0352: Client State Indication
+        if (!d->resource.isEmpty()) {
+            if (nodeRecv.tagName() == QLatin1String("inactive")) {
+                d->csiInactive = true;
+            } else if (nodeRecv.tagName() == QLatin1String("active")) {
+                d->csiInactive = false;
+                d->flushPresences();
+            }
+        }
+        return;
+    }
     else if (ns == ns_client)
     {
+        if (d->smEnabled)
+            d->smInbound++;
+
         if (nodeRecv.tagName() == QLatin1String("iq"))
         {
             const QString type = nodeRecv.attribute("type");
@@ -329,6 +1010,7 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 if (d->resource.isEmpty())
                     d->resource = QXmppUtils::generateStanzaHash();
                 d->jid = QString("%1/%2").arg(QXmppUtils::jidToBareJid(d->jid), d->resource);
+                d->updateMemoryStats();
 
                 QXmppBindIq bindResult;
                 bindResult.setType(QXmppIq::Result);
@@ -340,6 +1022,34 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 emit connected();
                 return;
             }
+            else if (nodeRecv.firstChildElement("token").namespaceURI() == ns_login_token &&
+                     type == QLatin1String("get") && !d->resource.isEmpty())
+            {
+                QXmppIq tokenResult;
+                tokenResult.setType(QXmppIq::Result);
+                tokenResult.setId(nodeRecv.attribute("id"));
+                tokenResult.setTo(d->jid);
+
+                // only issue tokens if a secret is set
+                qint64 expiry = 0;
+                const QString value = d->loginTokensEnabled() ? d->loginTokens->issue(QXmppUtils::jidToBareJid(d->jid), &expiry) : QString();
+                if (value.isEmpty()) {
+                    tokenResult.setType(QXmppIq::Error);
+                    tokenResult.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::FeatureNotImplemented));
+                    sendPacket(tokenResult);
+                    return;
+                }
+
+                QXmppElement token;
+                token.setTagName("token");
+                token.setAttribute("xmlns", ns_login_token);
+                token.setAttribute("expiry", QXmppUtils::datetimeToString(QDateTime::fromTime_t(expiry)));
+                token.setValue(value);
+                tokenResult.setExtensions(QXmppElementList() << token);
+                sendPacket(tokenResult);
+                updateCounter("incoming-client.token.issued");
+                return;
+            }
             else if (QXmppSessionIq::isSessionIq(nodeRecv) && type == QLatin1String("set"))
             {
                 QXmppSessionIq sessionSet;
@@ -397,6 +1107,7 @@ void QXmppIncomingClient::onDigestReply()
     if (!reply)
         return;
     reply->deleteLater();
+    QXMPP_TRACEPOINT2(sasl__reply, this, int(reply->error()));
 
     if (reply->error() == QXmppPasswordReply::TemporaryError) {
         warning(QString("Temporary authentication failure for '%1' from %2").arg(d->saslServer->username(), d->origin()));
@@ -428,6 +1139,7 @@ void QXmppIncomingClient::onPasswordReply()
     if (!reply)
         return;
     reply->deleteLater();
+    QXMPP_TRACEPOINT2(sasl__reply, this, int(reply->error()));
 
     const QString jid = QString("%1@%2").arg(d->saslServer->username(), d->domain);
     switch (reply->error()) {
@@ -455,10 +1167,35 @@ void QXmppIncomingClient::onPasswordReply()
 
 void QXmppIncomingClient::onSocketDisconnected()
 {
+    // keep the session if it can be resumed
+    if (!d->smResumeId.isEmpty() && !d->smDetached) {
+        info(QString("Socket disconnected for '%1' from %2, session kept for %3s").arg(
+            d->jid, d->origin(), QString::number(resumptionTimeout())));
+        d->smDetached = true;
+        d->idleTimer->stop();
+
+        // the held presences are part of the session
+        d->csiInactive = false;
+        d->flushPresences();
+        d->resumptionTimer->start();
+        return;
+    }
+
     info(QString("Socket disconnected for '%1' from %2").arg(d->jid, d->origin()));
     emit disconnected();
 }
 
+void QXmppIncomingClient::_q_resumptionTimeout()
+{
+    if (!d->smDetached)
+        return;
+
+    info(QString("Session for '%1' was not resumed").arg(d->jid));
+    d->smDetached = false;
+    d->smResumeId.clear();
+    emit disconnected();
+}
+
 void QXmppIncomingClient::onTimeout()
 {
     warning(QString("Idle timeout for '%1' from %2").arg(d->jid, d->origin()));
@@ -24,9 +24,14 @@
 #ifndef QXMPPINCOMINGCLIENT_H
 #define QXMPPINCOMINGCLIENT_H
 
+#include <QSharedPointer>
+#include <QVariantMap>
+
+#include "QXmppRawStanza.h"
 #include "QXmppStream.h"
 
 class QXmppIncomingClientPrivate;
+class QXmppLoginTokenStore;
 class QXmppPasswordChecker;
 
 /// \brief Interface for password checkers.
@@ -42,6 +47,7 @@ class QXMPP_EXPORT QXmppIncomingClient : public QXmppStream
 
 public:
     QXmppIncomingClient(QSslSocket *socket, const QString &domain, QObject *parent = 0);
+    QXmppIncomingClient(QIODevice *device, const QString &domain, QObject *parent = 0);
     ~QXmppIncomingClient();
 
     bool isConnected() const;
@@ -49,14 +55,57 @@ public:
 
     void setInactivityTimeout(int secs);
     void setPasswordChecker(QXmppPasswordChecker *checker);
+    void setHostedDomains(const QHash<QString, QXmppPasswordChecker*> &domains);
+    void setStreamCompressionEnabled(bool enabled);
+
+    int resumptionTimeout() const;
+    void setResumptionTimeout(int secs);
+
+    /// \cond
+    void setLoginTokenStore(const QSharedPointer<QXmppLoginTokenStore> &store);
+    /// \endcond
 
 signals:
     /// This signal is emitted when an element is received.
     void elementReceived(const QDomElement &element);
 
+    /// This signal is emitted when a message stanza which can be forwarded
+    /// as-is is received.
+    ///
+    /// If nothing is connected to this signal, the stanza is emitted using
+    /// elementReceived() instead.
+    void rawStanzaReceived(const QXmppRawStanza &stanza);
+
+    /// This signal is emitted when the client enables XEP-0198: Stream
+    /// Management with resumption. The session can later be resumed by
+    /// another stream using the given \a id.
+    ///
+    /// Resumption is only offered if this signal is connected.
+    void resumptionEnabled(const QString &id);
+
+    /// This signal is emitted when the client asks to resume the session
+    /// identified by \a id, having handled \a handled stanzas from it.
+    ///
+    /// The receiver must answer with resumeSession() or rejectResume().
+    void resumeRequested(const QString &id, uint handled);
+
+    /// This signal is emitted when the stream hands over its \a session
+    /// after detachSession() was called.
+    void sessionDetached(const QVariantMap &session);
+
+public slots:
+    void detachSession(uint handled);
+    void disconnectFromHost(const bool sendCloseStream = true);
+    void handOffSession();
+    void rejectResume();
+    void restoreSession(const QVariantMap &session);
+    void resumeSession(const QVariantMap &session);
+    bool sendData(const QByteArray &data);
+
 protected:
     /// \cond
     void handleStream(const QDomElement &element);
+    void handleRawStanza(const QXmppRawStanza &stanza);
     void handleStanza(const QDomElement &element);
     /// \endcond
 
@@ -65,6 +114,7 @@ private slots:
     void onPasswordReply();
     void onSocketDisconnected();
     void onTimeout();
+    void _q_resumptionTimeout();
 
 private:
     Q_DISABLE_COPY(QXmppIncomingClient)
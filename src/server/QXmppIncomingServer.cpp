@@ -37,19 +37,91 @@ class QXmppIncomingServerPrivate
 {
 public:
     QXmppIncomingServerPrivate(QXmppIncomingServer *qq);
+    void handleStreamManagement(const QDomElement &element);
     QString origin() const;
+    void sendStreamManagementFailure(const QString &condition);
 
     QSet<QString> authenticated;
     QString domain;
+    QSet<QString> hostedDomains;
     QString localStreamId;
 
+    // stream management, see XEP-0198, only the stanzas received are
+    // counted as the stream carries none the other way
+    int resumptionTimeout;
+    bool smEnabled;
+    bool smResuming;
+    quint32 smInbound;
+    QString smResumeId;
+
 private:
     QXmppIncomingServer *q;
 };
 
 QXmppIncomingServerPrivate::QXmppIncomingServerPrivate(QXmppIncomingServer *qq)
-    : q(qq)
+    : resumptionTimeout(0)
+    , smEnabled(false)
+    , smResuming(false)
+    , smInbound(0)
+    , q(qq)
+{
+}
+
+void QXmppIncomingServerPrivate::handleStreamManagement(const QDomElement &element)
+{
+    const QString tagName = element.tagName();
+    if (tagName == QLatin1String("enable")) {
+        if (authenticated.isEmpty() || smEnabled || smResuming) {
+            sendStreamManagementFailure("unexpected-request");
+            return;
+        }
+
+        // resumption needs someone to keep track of the session
+        const QString resume = element.attribute("resume");
+        const bool resumable = (resume == QLatin1String("true") || resume == QLatin1String("1")) &&
+                               resumptionTimeout > 0 &&
+                               q->receivers(SIGNAL(resumptionEnabled(QString))) > 0;
+
+        smEnabled = true;
+        smInbound = 0;
+
+        QString data = QString("<enabled xmlns='%1'").arg(ns_stream_management);
+        if (resumable) {
+            smResumeId = QXmppUtils::generateStanzaHash();
+            data += QString(" id='%1' resume='true' max='%2'").arg(
+                smResumeId, QString::number(resumptionTimeout));
+        }
+        data += "/>";
+        q->sendData(data.toUtf8());
+
+        if (resumable)
+            emit q->resumptionEnabled(smResumeId);
+    }
+    else if (tagName == QLatin1String("r")) {
+        if (smEnabled)
+            q->sendData(QString("<a xmlns='%1' h='%2'/>").arg(
+                ns_stream_management, QString::number(smInbound)).toUtf8());
+    }
+    else if (tagName == QLatin1String("resume")) {
+        bool ok;
+        const uint handled = element.attribute("h").toUInt(&ok);
+        const QString previd = element.attribute("previd");
+        if (authenticated.isEmpty() || smEnabled || smResuming) {
+            sendStreamManagementFailure("unexpected-request");
+        } else if (!ok || previd.isEmpty() ||
+                   q->receivers(SIGNAL(resumeRequested(QString,uint))) <= 0) {
+            sendStreamManagementFailure("item-not-found");
+        } else {
+            smResuming = true;
+            emit q->resumeRequested(previd, handled);
+        }
+    }
+}
+
+void QXmppIncomingServerPrivate::sendStreamManagementFailure(const QString &condition)
 {
+    q->sendData(QString("<failed xmlns='%1'><%2 xmlns='%3'/></failed>").arg(
+        ns_stream_management, condition, ns_stanza).toUtf8());
 }
 
 QString QXmppIncomingServerPrivate::origin() const
@@ -103,6 +175,35 @@ QString QXmppIncomingServer::localStreamId() const
     return d->localStreamId;
 }
 
+/// Returns the number of seconds during which a session can be resumed
+/// after its stream was lost, or 0 if stream management is not offered.
+
+int QXmppIncomingServer::resumptionTimeout() const
+{
+    return d->resumptionTimeout;
+}
+
+/// Sets the number of seconds during which a session can be resumed as
+/// defined by XEP-0198: Stream Management, after its stream was lost.
+///
+/// Stream management is offered to the remote server if \a secs is
+/// not 0. Set \a secs to 0 to disable it, which is the default.
+///
+/// \param secs
+
+void QXmppIncomingServer::setResumptionTimeout(int secs)
+{
+    d->resumptionTimeout = qMax(0, secs);
+}
+
+/// Sets the local \a domains the remote server can be authorized for,
+/// in addition to the domain the stream was constructed with.
+
+void QXmppIncomingServer::setHostedDomains(const QStringList &domains)
+{
+    d->hostedDomains = domains.toSet();
+}
+
 /// \cond
 void QXmppIncomingServer::handleStream(const QDomElement &streamElement)
 {
@@ -125,6 +226,8 @@ void QXmppIncomingServer::handleStream(const QDomElement &streamElement)
     QXmppStreamFeatures features;
     if (!socket()->isEncrypted() && !socket()->localCertificate().isNull() && !socket()->privateKey().isNull())
         features.setTlsMode(QXmppStreamFeatures::Enabled);
+    if (d->resumptionTimeout > 0)
+        features.setStreamManagementMode(QXmppStreamFeatures::Enabled);
     sendPacket(features);
 }
 
@@ -135,7 +238,7 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
     if (ns == ns_tls && stanza.tagName() == QLatin1String("starttls"))
     {
         sendData("<proceed xmlns='urn:ietf:params:xml:ns:xmpp-tls'/>");
-        socket()->flush();
+        flush();
         socket()->startServerEncryption();
         return;
     }
@@ -146,7 +249,7 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
         // check the request is valid
         if (!request.type().isEmpty() ||
             request.from().isEmpty() ||
-            request.to() != d->domain ||
+            (request.to() != d->domain && !d->hostedDomains.contains(request.to())) ||
             request.key().isEmpty())
         {
             warning(QString("Invalid dialback received on %1").arg(d->origin()));
@@ -158,8 +261,21 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
         {
             debug(QString("Received a dialback result from '%1' on %2").arg(domain, d->origin()));
 
+            // let the owner verify the key, for instance over an existing
+            // connection to the remote server
+            if (receivers(SIGNAL(dialbackVerifyRequested(QXmppDialback))) > 0) {
+                QXmppDialback verify;
+                verify.setCommand(QXmppDialback::Verify);
+                verify.setId(d->localStreamId);
+                verify.setFrom(request.to());
+                verify.setTo(domain);
+                verify.setKey(request.key());
+                emit dialbackVerifyRequested(verify);
+                return;
+            }
+
             // establish dialback connection
-            QXmppOutgoingServer *stream = new QXmppOutgoingServer(d->domain, this);
+            QXmppOutgoingServer *stream = new QXmppOutgoingServer(request.to(), this);
             bool check = connect(stream, SIGNAL(dialbackResponseReceived(QXmppDialback)),
                                  this, SLOT(slotDialbackResponseReceived(QXmppDialback)));
             Q_ASSERT(check);
@@ -174,9 +290,20 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
         }
 
     }
+    else if (ns == ns_stream_management)
+    {
+        d->handleStreamManagement(stanza);
+    }
     else if (d->authenticated.contains(QXmppUtils::jidToDomain(stanza.attribute("from"))))
     {
         // relay stanza if the remote party is authenticated
+        if (d->smEnabled) {
+            const QString tagName = stanza.tagName();
+            if (tagName == QLatin1String("message") ||
+                tagName == QLatin1String("presence") ||
+                tagName == QLatin1String("iq"))
+                ++d->smInbound;
+        }
         emit elementReceived(stanza);
     } else {
         warning(QString("Received an element from unverified domain '%1' on %2").arg(QXmppUtils::jidToDomain(stanza.attribute("from")), d->origin()));
@@ -208,11 +335,29 @@ void QXmppIncomingServer::slotDialbackResponseReceived(const QXmppDialback &dial
         dialback.from() != stream->remoteDomain())
         return;
 
+    handleDialbackResponse(dialback);
+
+    // disconnect dialback
+    stream->disconnectFromHost();
+    stream->deleteLater();
+}
+
+/// Handles the response to a dialback verify request, and relays the
+/// result to the remote server.
+///
+/// \param dialback
+
+void QXmppIncomingServer::handleDialbackResponse(const QXmppDialback &dialback)
+{
+    if (dialback.command() != QXmppDialback::Verify ||
+        dialback.id() != d->localStreamId)
+        return;
+
     // relay verify response
     QXmppDialback response;
     response.setCommand(QXmppDialback::Result);
     response.setTo(dialback.from());
-    response.setFrom(d->domain);
+    response.setFrom(dialback.to().isEmpty() ? d->domain : dialback.to());
     response.setType(dialback.type());
     sendPacket(response);
 
@@ -222,20 +367,88 @@ void QXmppIncomingServer::slotDialbackResponseReceived(const QXmppDialback &dial
         info(QString("Verified incoming domain '%1' on %2").arg(dialback.from(), d->origin()));
         const bool wasConnected = !d->authenticated.isEmpty();
         d->authenticated.insert(dialback.from());
+        emit domainVerified(dialback.from());
         if (!wasConnected)
             emit connected();
     } else {
         warning(QString("Failed to verify incoming domain '%1' on %2").arg(dialback.from(), d->origin()));
         disconnectFromHost();
     }
+}
 
-    // disconnect dialback
-    stream->disconnectFromHost();
-    stream->deleteLater();
+/// Hands over the session to another stream which resumes it, by emitting
+/// sessionDetached(), then closes this stream.
+
+void QXmppIncomingServer::detachSession()
+{
+    if (d->smResumeId.isEmpty())
+        return;
+
+    const QString id = d->smResumeId;
+    d->smEnabled = false;
+    d->smResumeId.clear();
+    emit sessionDetached(id, d->smInbound);
+
+    info(QString("Session on %1 resumed by another stream").arg(d->origin()));
+    disconnectFromHost();
+}
+
+/// Closes the stream, which ends the session.
+///
+/// \param sendCloseStream
+
+void QXmppIncomingServer::disconnectFromHost(const bool sendCloseStream)
+{
+    d->smResumeId.clear();
+    QXmppStream::disconnectFromHost(sendCloseStream);
+}
+
+/// Refuses the remote server's request to resume a session, it can then
+/// enable stream management as usual.
+
+void QXmppIncomingServer::rejectResume()
+{
+    if (!d->smResuming)
+        return;
+
+    d->smResuming = false;
+    d->sendStreamManagementFailure("item-not-found");
+}
+
+/// Resumes the session identified by \a id, in which \a handled stanzas
+/// were received, on the stream which requested it.
+///
+/// \param id
+/// \param handled
+
+void QXmppIncomingServer::resumeSession(const QString &id, uint handled)
+{
+    if (!d->smResuming)
+        return;
+
+    d->smResuming = false;
+    d->smEnabled = true;
+    d->smResumeId = id;
+    d->smInbound = handled;
+
+    info(QString("Resumed session on %1").arg(d->origin()));
+    updateCounter("incoming-server.resumed");
+
+    sendData(QString("<resumed xmlns='%1' previd='%2' h='%3'/>").arg(
+        ns_stream_management, d->smResumeId, QString::number(d->smInbound)).toUtf8());
+
+    emit resumptionEnabled(d->smResumeId);
 }
 
 void QXmppIncomingServer::slotSocketDisconnected()
 {
     info(QString("Socket disconnected from %1").arg(d->origin()));
+
+    // the session can be resumed by another stream
+    if (!d->smResumeId.isEmpty()) {
+        const QString id = d->smResumeId;
+        d->smResumeId.clear();
+        emit sessionDetached(id, d->smInbound);
+    }
     emit disconnected();
 }
@@ -24,6 +24,8 @@
 #ifndef QXMPPINCOMINGSERVER_H
 #define QXMPPINCOMINGSERVER_H
 
+#include <QStringList>
+
 #include "QXmppStream.h"
 
 class QXmppDialback;
@@ -45,13 +47,57 @@ public:
     bool isConnected() const;
     QString localStreamId() const;
 
+    int resumptionTimeout() const;
+    void setResumptionTimeout(int secs);
+
 signals:
     /// This signal is emitted when a dialback verify request is received.
     void dialbackRequestReceived(const QXmppDialback &result);
 
+    /// This signal is emitted when a dialback key received on this stream
+    /// needs to be verified by the remote server.
+    ///
+    /// If this signal is connected, the receiver is responsible for sending
+    /// the \a verify request and passing the response to
+    /// handleDialbackResponse(). Otherwise the stream opens a dedicated
+    /// connection to the remote server.
+    void dialbackVerifyRequested(const QXmppDialback &verify);
+
+    /// This signal is emitted when the remote server is authenticated
+    /// for \a domain.
+    void domainVerified(const QString &domain);
+
     /// This signal is emitted when an element is received.
     void elementReceived(const QDomElement &element);
 
+    /// This signal is emitted when the remote server enables XEP-0198:
+    /// Stream Management with resumption. The session can later be resumed
+    /// by another stream using the given \a id.
+    ///
+    /// Resumption is only offered if this signal is connected.
+    void resumptionEnabled(const QString &id);
+
+    /// This signal is emitted when the remote server asks to resume the
+    /// session identified by \a id, having handled \a handled stanzas
+    /// from it.
+    ///
+    /// The receiver must answer with resumeSession() or rejectResume().
+    void resumeRequested(const QString &id, uint handled);
+
+    /// This signal is emitted when the stream no longer holds the session
+    /// identified by \a id, either because the connection was lost or
+    /// because detachSession() was called. \a handled is the number of
+    /// stanzas received in the session.
+    void sessionDetached(const QString &id, uint handled);
+
+public slots:
+    void detachSession();
+    void disconnectFromHost(const bool sendCloseStream = true);
+    void handleDialbackResponse(const QXmppDialback &dialback);
+    void rejectResume();
+    void resumeSession(const QString &id, uint handled);
+    void setHostedDomains(const QStringList &domains);
+
 protected:
     /// \cond
     void handleStanza(const QDomElement &stanzaElement);
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDateTime>
+#include <QStringList>
+
+#include "QXmppLoginTokenStore_p.h"
+#include "QXmppUtils.h"
+
+// tokens kept per user, the ones closest to expiry are dropped first
+static const int maximumTokensPerUser = 16;
+static const int nonceSize = 12;
+
+static qint64 currentTime()
+{
+    return QDateTime::currentDateTime().toTime_t();
+}
+
+QXmppLoginTokenStore::QXmppLoginTokenStore()
+    : m_lifetime(604800)
+{
+}
+
+/// Returns the secret used to sign tokens, tokens are disabled if it is
+/// empty.
+
+QByteArray QXmppLoginTokenStore::secret() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_secret;
+}
+
+/// Sets the \a secret used to sign tokens, which invalidates all the
+/// tokens issued so far.
+///
+/// \param secret
+
+void QXmppLoginTokenStore::setSecret(const QByteArray &secret)
+{
+    QMutexLocker locker(&m_mutex);
+    if (secret != m_secret)
+        m_tokens.clear();
+    m_secret = secret;
+}
+
+/// Returns the number of seconds during which a token is valid.
+
+int QXmppLoginTokenStore::lifetime() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_lifetime;
+}
+
+/// Sets the number of seconds during which a token is valid.
+///
+/// \param secs
+
+void QXmppLoginTokenStore::setLifetime(int secs)
+{
+    QMutexLocker locker(&m_mutex);
+    m_lifetime = qMax(0, secs);
+}
+
+/// Issues a token for \a bareJid, or returns an empty string if tokens
+/// are disabled.
+///
+/// \param bareJid
+/// \param expiry if not null, receives the token's expiry in seconds
+/// since the epoch
+
+QString QXmppLoginTokenStore::issue(const QString &bareJid, qint64 *expiry)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_secret.isEmpty())
+        return QString();
+
+    const qint64 now = currentTime();
+    const qint64 tokenExpiry = now + m_lifetime;
+    const QByteArray nonce = QXmppUtils::generateRandomBytes(nonceSize).toHex();
+
+    // drop the expired tokens, then the oldest ones if there are too many
+    QHash<QByteArray, qint64> &tokens = m_tokens[bareJid];
+    QHash<QByteArray, qint64>::iterator it = tokens.begin();
+    while (it != tokens.end()) {
+        if (it.value() < now)
+            it = tokens.erase(it);
+        else
+            ++it;
+    }
+    while (tokens.size() >= maximumTokensPerUser) {
+        QHash<QByteArray, qint64>::iterator oldest = tokens.begin();
+        for (it = tokens.begin(); it != tokens.end(); ++it) {
+            if (it.value() < oldest.value())
+                oldest = it;
+        }
+        tokens.erase(oldest);
+    }
+    tokens.insert(nonce, tokenExpiry);
+
+    if (expiry)
+        *expiry = tokenExpiry;
+    return QString::number(tokenExpiry) + QLatin1Char('.') +
+        QString::fromLatin1(nonce) + QLatin1Char('.') +
+        QString::fromLatin1(sign(bareJid, tokenExpiry, nonce));
+}
+
+/// Checks and consumes a \a token of \a bareJid.
+///
+/// Returns true if the token was issued to the user, has not expired and
+/// was neither used nor revoked.
+///
+/// \param bareJid
+/// \param token
+
+bool QXmppLoginTokenStore::take(const QString &bareJid, const QString &token)
+{
+    const QStringList parts = token.split(QLatin1Char('.'));
+    if (parts.size() != 3)
+        return false;
+
+    bool ok = false;
+    const qint64 expiry = parts[0].toLongLong(&ok);
+    const QByteArray nonce = parts[1].toLatin1();
+    if (!ok || expiry < currentTime())
+        return false;
+
+    QMutexLocker locker(&m_mutex);
+    if (m_secret.isEmpty())
+        return false;
+
+    // compare in constant time
+    const QByteArray expected = sign(bareJid, expiry, nonce);
+    const QByteArray received = parts[2].toLatin1();
+    if (expected.size() != received.size())
+        return false;
+    char diff = 0;
+    for (int i = 0; i < expected.size(); ++i)
+        diff |= expected[i] ^ received[i];
+    if (diff != 0)
+        return false;
+
+    // the token must still be held, and is only accepted once
+    QHash<QString, QHash<QByteArray, qint64> >::iterator user = m_tokens.find(bareJid);
+    if (user == m_tokens.end() || user->take(nonce) != expiry)
+        return false;
+    if (user->isEmpty())
+        m_tokens.erase(user);
+    return true;
+}
+
+/// Revokes all the tokens of \a bareJid.
+///
+/// \param bareJid
+
+void QXmppLoginTokenStore::revoke(const QString &bareJid)
+{
+    QMutexLocker locker(&m_mutex);
+    m_tokens.remove(bareJid);
+}
+
+/// Returns the number of tokens held for \a bareJid, including expired
+/// ones which were not dropped yet.
+///
+/// \param bareJid
+
+int QXmppLoginTokenStore::count(const QString &bareJid) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_tokens.value(bareJid).size();
+}
+
+QByteArray QXmppLoginTokenStore::sign(const QString &bareJid, qint64 expiry, const QByteArray &nonce) const
+{
+    const QByteArray text = bareJid.toUtf8() + '\0' + QByteArray::number(expiry) + '\0' + nonce;
+    return QXmppUtils::generateHmacSha1(m_secret, text).toBase64();
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPLOGINTOKENSTORE_P_H
+#define QXMPPLOGINTOKENSTORE_P_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer and QXmppIncomingClient classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppLoginTokenStore class issues and checks the login tokens of a
+/// server's users.
+///
+/// A token carries its expiry and a random nonce, signed with the store's
+/// secret. The nonces of the tokens which were issued are kept, so that a
+/// token is only accepted once, and that all the tokens of a user can be
+/// revoked, for instance when their password changes.
+///
+/// The store is shared by the streams of all the worker threads.
+
+class QXMPP_AUTOTEST_EXPORT QXmppLoginTokenStore
+{
+public:
+    QXmppLoginTokenStore();
+
+    QByteArray secret() const;
+    void setSecret(const QByteArray &secret);
+
+    int lifetime() const;
+    void setLifetime(int secs);
+
+    QString issue(const QString &bareJid, qint64 *expiry = 0);
+    bool take(const QString &bareJid, const QString &token);
+    void revoke(const QString &bareJid);
+    int count(const QString &bareJid) const;
+
+private:
+    QByteArray sign(const QString &bareJid, qint64 expiry, const QByteArray &nonce) const;
+
+    mutable QMutex m_mutex;
+    QByteArray m_secret;
+    int m_lifetime;
+
+    // the expiry of the tokens issued to each user, by nonce
+    QHash<QString, QHash<QByteArray, qint64> > m_tokens;
+};
+
+#endif
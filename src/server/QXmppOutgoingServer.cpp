@@ -22,33 +22,65 @@
  */
 
 #include <QDomElement>
+#include <QElapsedTimer>
+#include <QPair>
+#include <QSslConfiguration>
 #include <QSslKey>
 #include <QSslSocket>
 #include <QTimer>
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
-#include <QDnsLookup>
-#else
-#include "qdnslookup.h"
-#endif
 
+#include "QXmppCertificateCache_p.h"
 #include "QXmppConstants.h"
 #include "QXmppDialback.h"
+#include "QXmppIdleTimer_p.h"
 #include "QXmppOutgoingServer.h"
+#include "QXmppSrvLookup_p.h"
 #include "QXmppStreamFeatures.h"
+#include "QXmppStreamSplitter_p.h"
 #include "QXmppUtils.h"
 
 class QXmppOutgoingServerPrivate
 {
 public:
-    QList<QByteArray> dataQueue;
-    QDnsLookup dns;
+    // data queued until the stream is ready
+    QByteArray dataQueue;
+    qint64 maximumQueueSize;
+    QXmppSrvLookup dns;
     QString localDomain;
     QString localStreamKey;
     QString remoteDomain;
     QString verifyId;
     QString verifyKey;
+    // dialback verify requests held until the stream is negotiated
+    QList<QPair<QString, QString> > verifyQueue;
     QTimer *dialbackTimer;
+    QXmppIdleTimer *idleTimer;
+    bool dialbackSent;
     bool ready;
+
+    // verified certificates are remembered for this many seconds, and
+    // whether the handshake skipped verification thanks to the cache
+    int certificateCacheTimeout;
+    bool certificateCached;
+    bool sslErrorsSeen;
+
+    // stream management, see XEP-0198, the stanzas which were sent are
+    // kept until the remote server acknowledges them
+    int resumptionTimeout;
+    bool smOffered;
+    bool smEnabled;
+    bool smAckRequested;
+    bool smResuming;
+    quint32 smAcked;
+    QList<QByteArray> smUnacked;
+    QString smResumeId;
+    int smResumeMax;
+    QXmppStreamSplitter smSplitter;
+
+    // reconnection after the stream was lost, until the session expires
+    QElapsedTimer suspendedTimer;
+    QTimer *reconnectTimer;
+    int reconnectDelay;
 };
 
 /// Constructs a new outgoing server-to-server stream.
@@ -76,7 +108,9 @@ QXmppOutgoingServer::QXmppOutgoingServer(const QString &domain, QObject *parent)
                     this, SLOT(socketError(QAbstractSocket::SocketError)));
     Q_ASSERT(check);
 
-    // DNS lookups
+    // DNS lookups, the lookup follows the stream if it is moved to
+    // another thread
+    d->dns.setParent(this);
     check = connect(&d->dns, SIGNAL(finished()),
                     this, SLOT(_q_dnsLookupFinished()));
     Q_ASSERT(check);
@@ -88,8 +122,36 @@ QXmppOutgoingServer::QXmppOutgoingServer(const QString &domain, QObject *parent)
                     this, SLOT(sendDialback()));
     Q_ASSERT(check);
 
+    d->idleTimer = new QXmppIdleTimer(this);
+    check = connect(d->idleTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_idleTimeout()));
+    Q_ASSERT(check);
+
+    d->reconnectTimer = new QTimer(this);
+    d->reconnectTimer->setSingleShot(true);
+    check = connect(d->reconnectTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_reconnect()));
+    Q_ASSERT(check);
+
     d->localDomain = domain;
+    d->maximumQueueSize = 0;
+    d->dialbackSent = false;
     d->ready = false;
+    d->certificateCacheTimeout = 0;
+    d->certificateCached = false;
+    d->sslErrorsSeen = false;
+    d->resumptionTimeout = 0;
+    d->smOffered = false;
+    d->smEnabled = false;
+    d->smAckRequested = false;
+    d->smResuming = false;
+    d->smAcked = 0;
+    d->smResumeMax = 0;
+    d->reconnectDelay = 0;
+
+    check = connect(socket, SIGNAL(encrypted()),
+                    this, SLOT(_q_socketEncrypted()));
+    Q_ASSERT(check);
 
     check = connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
                     this, SLOT(slotSslErrors(QList<QSslError>)));
@@ -114,9 +176,7 @@ void QXmppOutgoingServer::connectToHost(const QString &domain)
 
     // lookup server for domain
     debug(QString("Looking up server for domain %1").arg(domain));
-    d->dns.setName("_xmpp-server._tcp." + domain);
-    d->dns.setType(QDnsLookup::SRV);
-    d->dns.lookup();
+    d->dns.lookup("_xmpp-server._tcp." + domain);
 }
 
 void QXmppOutgoingServer::_q_dnsLookupFinished()
@@ -150,7 +210,26 @@ void QXmppOutgoingServer::_q_dnsLookupFinished()
 void QXmppOutgoingServer::_q_socketDisconnected()
 {
     debug("Socket disconnected");
-    emit disconnected();
+    if (!suspend())
+        emit disconnected();
+}
+
+/// Closes the stream, which ends its stream management session.
+///
+/// \param sendCloseStream
+
+void QXmppOutgoingServer::disconnectFromHost(const bool sendCloseStream)
+{
+    // a stream waiting to reconnect has no socket to close
+    const bool suspended = d->suspendedTimer.isValid() &&
+        socket()->state() != QAbstractSocket::ConnectedState;
+
+    d->smResumeId.clear();
+    d->suspendedTimer.invalidate();
+    d->reconnectTimer->stop();
+    QXmppStream::disconnectFromHost(sendCloseStream);
+    if (suspended)
+        emit disconnected();
 }
 
 /// \cond
@@ -170,6 +249,7 @@ void QXmppOutgoingServer::handleStart()
 void QXmppOutgoingServer::handleStream(const QDomElement &streamElement)
 {
     Q_UNUSED(streamElement);
+    d->smOffered = false;
 
     // gmail.com servers are broken: they never send <stream:features>,
     // so we schedule sending the dialback in a couple of seconds
@@ -180,10 +260,14 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
 {
     const QString ns = stanza.namespaceURI();
 
+    if (d->idleTimer->interval() > 0 && d->ready)
+        d->idleTimer->start();
+
     if(QXmppStreamFeatures::isStreamFeatures(stanza))
     {
         QXmppStreamFeatures features;
         features.parse(stanza);
+        d->smOffered = features.streamManagementMode() != QXmppStreamFeatures::Disabled;
 
         if (!socket()->isEncrypted())
         {
@@ -213,6 +297,18 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
     {
         if (stanza.tagName() == QLatin1String("proceed"))
         {
+            // a certificate which was recently verified for the domain
+            // only needs to be compared once the handshake is done
+            d->certificateCached = d->certificateCacheTimeout > 0 &&
+                QXmppCertificateCache::instance()->contains(d->remoteDomain);
+            d->sslErrorsSeen = false;
+            socket()->setPeerVerifyMode(d->certificateCached ? QSslSocket::VerifyNone : QSslSocket::AutoVerifyPeer);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 13, 0))
+            QSslConfiguration sslConfiguration = socket()->sslConfiguration();
+            sslConfiguration.setOcspStaplingEnabled(!d->certificateCached && d->certificateCacheTimeout > 0);
+            socket()->setSslConfiguration(sslConfiguration);
+#endif
+
             debug("Starting encryption");
             socket()->startClientEncryption();
             return;
@@ -236,15 +332,16 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
             if (response.type() == QLatin1String("valid"))
             {
                 info(QString("Outgoing server stream to %1 is ready").arg(response.from()));
-                d->ready = true;
-
-                // send queued data
-                foreach (const QByteArray &data, d->dataQueue)
-                    sendData(data);
-                d->dataQueue.clear();
-
-                // emit signal
-                emit connected();
+                if (d->smOffered && !d->smResumeId.isEmpty()) {
+                    // the queued data waits for the session to be resumed
+                    d->smResuming = true;
+                    sendData(QString("<resume xmlns='%1' previd='%2' h='0'/>").arg(
+                        ns_stream_management, d->smResumeId).toUtf8());
+                    return;
+                }
+
+                enableStreamManagement();
+                setReady();
             }
         }
         else if (response.command() == QXmppDialback::Verify)
@@ -253,9 +350,203 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
         }
 
     }
+    else if (ns == ns_stream_management)
+    {
+        handleStreamManagement(stanza);
+    }
 }
 /// \endcond
 
+void QXmppOutgoingServer::handleStreamManagement(const QDomElement &element)
+{
+    const QString tagName = element.tagName();
+    if (tagName == QLatin1String("enabled")) {
+        const QString resume = element.attribute("resume");
+        if (d->smEnabled && (resume == QLatin1String("true") || resume == QLatin1String("1"))) {
+            d->smResumeId = element.attribute("id");
+            d->smResumeMax = element.attribute("max").toInt();
+        }
+    }
+    else if (tagName == QLatin1String("a")) {
+        bool ok;
+        const quint32 handled = element.attribute("h").toUInt(&ok);
+        if (!d->smEnabled || !ok)
+            return;
+        acknowledge(handled);
+
+        // keep a single request in flight
+        d->smAckRequested = false;
+        if (!d->smUnacked.isEmpty() && d->ready) {
+            d->smAckRequested = true;
+            sendData(QString("<r xmlns='%1'/>").arg(ns_stream_management).toUtf8());
+        }
+    }
+    else if (tagName == QLatin1String("resumed")) {
+        bool ok;
+        const quint32 handled = element.attribute("h").toUInt(&ok);
+        if (!d->smResuming || !ok)
+            return;
+        acknowledge(handled);
+
+        info(QString("Resumed session with %1, %2 stanzas sent again").arg(
+            d->remoteDomain, QString::number(d->smUnacked.size())));
+        updateCounter("outgoing-server.resumed");
+
+        d->suspendedTimer.invalidate();
+        QByteArray data;
+        foreach (const QByteArray &stanza, d->smUnacked)
+            data += stanza;
+        sendData(data);
+        setReady();
+    }
+    else if (tagName == QLatin1String("failed")) {
+        if (d->smResuming) {
+            warning(QString("Could not resume session with %1").arg(d->remoteDomain));
+            enableStreamManagement();
+            setReady();
+        } else {
+            warning(QString("Could not enable stream management with %1").arg(d->remoteDomain));
+            d->smEnabled = false;
+            d->smAckRequested = false;
+            d->smUnacked.clear();
+        }
+    }
+}
+
+/// Drops the stanzas acknowledged by the remote server, given the total
+/// number of stanzas it has \a handled.
+
+void QXmppOutgoingServer::acknowledge(quint32 handled)
+{
+    quint32 count = handled - d->smAcked;
+    if (count > quint32(d->smUnacked.size())) {
+        warning(QString("Server %1 acknowledged %2 stanzas, only %3 are unacknowledged").arg(
+            d->remoteDomain, QString::number(count), QString::number(d->smUnacked.size())));
+        count = d->smUnacked.size();
+    }
+    for (quint32 i = 0; i < count; ++i)
+        d->smUnacked.removeFirst();
+    d->smAcked += count;
+}
+
+/// Starts a new stream management session if the remote server offers it.
+///
+/// The stanzas of a previous session which were not acknowledged are
+/// sent first, as the remote server may not have received them.
+
+void QXmppOutgoingServer::enableStreamManagement()
+{
+    if (!d->smUnacked.isEmpty()) {
+        QByteArray data;
+        foreach (const QByteArray &stanza, d->smUnacked)
+            data += stanza;
+        d->dataQueue.prepend(data);
+        d->smUnacked.clear();
+    }
+    d->smEnabled = false;
+    d->smAckRequested = false;
+    d->smResumeId.clear();
+    d->smResumeMax = 0;
+    d->suspendedTimer.invalidate();
+    if (!d->smOffered || d->resumptionTimeout <= 0)
+        return;
+
+    // acknowledgements count stanzas in the order they were sent
+    setOutputSchedulingWindow(0);
+    d->smEnabled = true;
+    d->smAcked = 0;
+    d->smSplitter.clear();
+    const QByteArray header = QString("<stream:stream xmlns='%1'>").arg(ns_server).toUtf8();
+    d->smSplitter.addData(header.constData(), header.size());
+    d->smSplitter.readNext();
+    sendData(QString("<enable xmlns='%1' resume='true' max='%2'/>").arg(
+        ns_stream_management, QString::number(d->resumptionTimeout)).toUtf8());
+}
+
+/// Sends data, keeping track of the stanzas until they are acknowledged.
+
+void QXmppOutgoingServer::sendStanzas(const QByteArray &data)
+{
+    sendData(data);
+    if (!d->smEnabled)
+        return;
+
+    d->smSplitter.addData(data.constData(), data.size());
+    while (d->smSplitter.readNext() == QXmppStreamSplitter::ElementToken) {
+        const QByteArray stanza = d->smSplitter.data();
+        const QByteArray name = QXmppStreamSplitter::tagName(stanza);
+        if (name == "message" || name == "presence" || name == "iq")
+            d->smUnacked << stanza;
+    }
+    if (!d->smAckRequested && !d->smUnacked.isEmpty()) {
+        d->smAckRequested = true;
+        sendData(QString("<r xmlns='%1'/>").arg(ns_stream_management).toUtf8());
+    }
+}
+
+/// Marks the stream as ready, and sends the data which was queued.
+
+void QXmppOutgoingServer::setReady()
+{
+    d->ready = true;
+    d->smResuming = false;
+    d->reconnectDelay = 0;
+
+    // send queued data in a single write
+    if (!d->dataQueue.isEmpty()) {
+        const QByteArray data = d->dataQueue;
+        d->dataQueue.clear();
+        sendStanzas(data);
+    } else if (!d->smAckRequested && !d->smUnacked.isEmpty()) {
+        d->smAckRequested = true;
+        sendData(QString("<r xmlns='%1'/>").arg(ns_stream_management).toUtf8());
+    }
+    if (d->idleTimer->interval() > 0)
+        d->idleTimer->start();
+
+    // emit signal
+    emit connected();
+}
+
+/// Schedules a new connection after the stream was lost, if its session
+/// can be resumed. Returns false if the stream is over.
+
+bool QXmppOutgoingServer::suspend()
+{
+    if (d->smResumeId.isEmpty())
+        return false;
+    if (d->reconnectTimer->isActive())
+        return true;
+
+    // the session expires after the shorter of both servers' timeouts
+    int timeout = d->resumptionTimeout;
+    if (d->smResumeMax > 0)
+        timeout = qMin(timeout, d->smResumeMax);
+    if (!d->suspendedTimer.isValid())
+        d->suspendedTimer.start();
+    const qint64 remaining = qint64(timeout) * 1000 - d->suspendedTimer.elapsed();
+    if (remaining <= 0) {
+        warning(QString("Session with %1 expired").arg(d->remoteDomain));
+        d->smResumeId.clear();
+        d->suspendedTimer.invalidate();
+        return false;
+    }
+
+    d->ready = false;
+    d->dialbackSent = false;
+    d->smResuming = false;
+    d->smAckRequested = false;
+    d->dialbackTimer->stop();
+    d->idleTimer->stop();
+
+    // wait longer after each failed attempt
+    d->reconnectDelay = d->reconnectDelay ? qMin(d->reconnectDelay * 2, 30000) : 1000;
+    const int delay = int(qMin(qint64(d->reconnectDelay), remaining));
+    info(QString("Reconnecting to %1 in %2 ms").arg(d->remoteDomain, QString::number(delay)));
+    d->reconnectTimer->start(delay);
+    return true;
+}
+
 /// Returns true if the socket is connected and authentication succeeded.
 ///
 
@@ -297,10 +588,156 @@ void QXmppOutgoingServer::setVerify(const QString &id, const QString &key)
 
 void QXmppOutgoingServer::queueData(const QByteArray &data)
 {
-    if (isConnected())
-        sendData(data);
-    else
+    if (isConnected()) {
+        if (d->idleTimer->interval() > 0)
+            d->idleTimer->start();
+        sendStanzas(data);
+    } else if (d->maximumQueueSize > 0 &&
+               d->dataQueue.size() + data.size() > d->maximumQueueSize) {
+        warning(QString("Dropping data for %1, queue is full").arg(d->remoteDomain));
+        updateCounter("outgoing-server.queue.dropped");
+    } else {
         d->dataQueue.append(data);
+    }
+}
+
+/// Asks the remote server to verify a dialback key it sent on one of our
+/// incoming streams.
+///
+/// Several requests can be sent over the same stream, and the responses
+/// are reported by dialbackResponseReceived(). If the stream is not
+/// negotiated yet, the request is sent once it is.
+///
+/// \param id the identifier of the incoming stream
+/// \param key the dialback key to verify
+
+void QXmppOutgoingServer::queueVerify(const QString &id, const QString &key)
+{
+    if (d->dialbackSent) {
+        debug(QString("Sending dialback verify to %1").arg(d->remoteDomain));
+        QXmppDialback verify;
+        verify.setCommand(QXmppDialback::Verify);
+        verify.setId(id);
+        verify.setFrom(d->localDomain);
+        verify.setTo(d->remoteDomain);
+        verify.setKey(key);
+        sendPacket(verify);
+    } else {
+        d->verifyQueue << qMakePair(id, key);
+    }
+}
+
+/// Returns the time in milliseconds after which the stream is closed if it
+/// carries no data, or 0 if it is kept open until the remote end closes it.
+
+int QXmppOutgoingServer::idleTimeout() const
+{
+    return d->idleTimer->interval();
+}
+
+/// Sets the time in milliseconds after which the stream is closed if it
+/// carries no data.
+///
+/// Set \a msecs to 0 to keep the stream open until the remote end closes
+/// it, which is the default.
+
+void QXmppOutgoingServer::setIdleTimeout(int msecs)
+{
+    d->idleTimer->setInterval(qMax(0, msecs));
+}
+
+/// Returns the time in seconds for which the certificates which passed
+/// verification are remembered, or 0 if they are not.
+
+int QXmppOutgoingServer::certificateCacheTimeout() const
+{
+    return d->certificateCacheTimeout;
+}
+
+/// Sets the time in seconds for which the certificates which passed
+/// verification are remembered, so that the next streams to the same
+/// domain skip certificate chain verification.
+///
+/// The certificates are shared by the streams of the process, by remote
+/// domain and fingerprint, and are forgotten when they expire. With Qt 5.13
+/// or later, a certificate is only cached if no stapled OCSP response
+/// revoked it.
+///
+/// Set \a secs to 0 to verify the certificate of each stream, which is
+/// the default.
+
+void QXmppOutgoingServer::setCertificateCacheTimeout(int secs)
+{
+    d->certificateCacheTimeout = qMax(0, secs);
+}
+
+/// Returns the number of seconds during which the stream's session can be
+/// resumed after the connection was lost, or 0 if stream management is
+/// not used.
+
+int QXmppOutgoingServer::resumptionTimeout() const
+{
+    return d->resumptionTimeout;
+}
+
+/// Sets the number of seconds during which the stream's session can be
+/// resumed as defined by XEP-0198: Stream Management, after the
+/// connection was lost.
+///
+/// If the remote server offers stream management, the stanzas sent are
+/// kept until it acknowledges them. When the connection is lost, the
+/// stream reconnects and resumes the session instead of emitting
+/// disconnected(), then sends the stanzas which were not acknowledged
+/// followed by the queued data. The stream gives up once the session
+/// expired, or if it is closed with disconnectFromHost().
+///
+/// Set \a secs to 0 to disable stream management, which is the default.
+///
+/// \param secs
+
+void QXmppOutgoingServer::setResumptionTimeout(int secs)
+{
+    d->resumptionTimeout = qMax(0, secs);
+}
+
+/// Returns the maximum amount of data in bytes which is queued until the
+/// stream is ready, or 0 if there is no limit.
+
+qint64 QXmppOutgoingServer::maximumQueueSize() const
+{
+    return d->maximumQueueSize;
+}
+
+/// Sets the maximum amount of data in bytes which is queued until the
+/// stream is ready. Data which does not fit is dropped.
+///
+/// Set \a size to 0 to disable the limit, which is the default.
+
+void QXmppOutgoingServer::setMaximumQueueSize(qint64 size)
+{
+    d->maximumQueueSize = size;
+}
+
+/// Returns the amount of data in bytes which is waiting to be sent, either
+/// queued until the stream is ready or in the output queue.
+
+qint64 QXmppOutgoingServer::queuedDataSize() const
+{
+    return d->dataQueue.size() + outputQueueSize();
+}
+
+/// \cond
+void QXmppOutgoingServer::handlePostedData(const QByteArray &data)
+{
+    queueData(data);
+}
+/// \endcond
+
+/// Returns the local domain the stream is authorized for.
+
+QString QXmppOutgoingServer::localDomain() const
+{
+    return d->localDomain;
 }
 
 /// Returns the remote server's domain.
@@ -312,6 +749,8 @@ QString QXmppOutgoingServer::remoteDomain() const
 
 void QXmppOutgoingServer::sendDialback()
 {
+    d->dialbackSent = true;
+
     if (!d->localStreamKey.isEmpty())
     {
         // send dialback key
@@ -323,22 +762,60 @@ void QXmppOutgoingServer::sendDialback()
         dialback.setKey(d->localStreamKey);
         sendPacket(dialback);
     }
-    else if (!d->verifyId.isEmpty() && !d->verifyKey.isEmpty())
-    {
-        // send dialback verify
-        debug(QString("Sending dialback verify to %1").arg(d->remoteDomain));
-        QXmppDialback verify;
-        verify.setCommand(QXmppDialback::Verify);
-        verify.setId(d->verifyId);
-        verify.setFrom(d->localDomain);
-        verify.setTo(d->remoteDomain);
-        verify.setKey(d->verifyKey);
-        sendPacket(verify);
+
+    // send dialback verify requests
+    if (!d->verifyId.isEmpty() && !d->verifyKey.isEmpty()) {
+        queueVerify(d->verifyId, d->verifyKey);
+        d->verifyId.clear();
+        d->verifyKey.clear();
+    }
+    const QList<QPair<QString, QString> > verifyQueue = d->verifyQueue;
+    d->verifyQueue.clear();
+    for (int i = 0; i < verifyQueue.size(); ++i)
+        queueVerify(verifyQueue.at(i).first, verifyQueue.at(i).second);
+}
+
+void QXmppOutgoingServer::_q_idleTimeout()
+{
+    if (queuedDataSize() > 0 || !d->smUnacked.isEmpty()) {
+        d->idleTimer->start();
+        return;
+    }
+    info(QString("Closing idle outgoing server stream to %1").arg(d->remoteDomain));
+    disconnectFromHost();
+}
+
+void QXmppOutgoingServer::_q_reconnect()
+{
+    connectToHost(d->remoteDomain);
+}
+
+void QXmppOutgoingServer::_q_socketEncrypted()
+{
+    if (d->certificateCacheTimeout <= 0)
+        return;
+
+    QXmppCertificateCache *cache = QXmppCertificateCache::instance();
+    const QSslCertificate certificate = socket()->peerCertificate();
+    if (d->certificateCached) {
+        if (cache->isVerified(d->remoteDomain, certificate)) {
+            updateCounter("outgoing-server.certificate-cache.hit");
+        } else {
+            // the certificate changed, the next stream verifies it
+            warning(QString("Certificate of %1 was not verified as it changed").arg(d->remoteDomain));
+            cache->remove(d->remoteDomain);
+            updateCounter("outgoing-server.certificate-cache.miss");
+        }
+    } else {
+        if (!d->sslErrorsSeen)
+            cache->insert(d->remoteDomain, certificate, d->certificateCacheTimeout);
+        updateCounter("outgoing-server.certificate-cache.miss");
     }
 }
 
 void QXmppOutgoingServer::slotSslErrors(const QList<QSslError> &errors)
 {
+    d->sslErrorsSeen = true;
     warning("SSL errors");
     for(int i = 0; i < errors.count(); ++i)
         warning(errors.at(i).errorString());
@@ -348,6 +825,7 @@ void QXmppOutgoingServer::slotSslErrors(const QList<QSslError> &errors)
 void QXmppOutgoingServer::socketError(QAbstractSocket::SocketError error)
 {
     Q_UNUSED(error);
-    emit disconnected();
+    if (!suspend())
+        emit disconnected();
 }
 
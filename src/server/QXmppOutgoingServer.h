@@ -51,8 +51,22 @@ public:
     void setLocalStreamKey(const QString &key);
     void setVerify(const QString &id, const QString &key);
 
+    QString localDomain() const;
     QString remoteDomain() const;
 
+    qint64 maximumQueueSize() const;
+    void setMaximumQueueSize(qint64 size);
+    qint64 queuedDataSize() const;
+
+    int idleTimeout() const;
+    void setIdleTimeout(int msecs);
+
+    int certificateCacheTimeout() const;
+    void setCertificateCacheTimeout(int secs);
+
+    int resumptionTimeout() const;
+    void setResumptionTimeout(int secs);
+
 signals:
     /// This signal is emitted when a dialback verify response is received.
     void dialbackResponseReceived(const QXmppDialback &response);
@@ -62,20 +76,33 @@ protected:
     void handleStart();
     void handleStream(const QDomElement &streamElement);
     void handleStanza(const QDomElement &stanzaElement);
+    void handlePostedData(const QByteArray &data);
     /// \endcond
 
 public slots:
     void connectToHost(const QString &domain);
+    void disconnectFromHost(const bool sendCloseStream = true);
     void queueData(const QByteArray &data);
+    void queueVerify(const QString &id, const QString &key);
 
 private slots:
     void _q_dnsLookupFinished();
+    void _q_idleTimeout();
+    void _q_reconnect();
+    void _q_socketEncrypted();
     void _q_socketDisconnected();
     void sendDialback();
     void slotSslErrors(const QList<QSslError> &errors);
     void socketError(QAbstractSocket::SocketError error);
 
 private:
+    void acknowledge(quint32 handled);
+    void enableStreamManagement();
+    void handleStreamManagement(const QDomElement &element);
+    void sendStanzas(const QByteArray &data);
+    void setReady();
+    bool suspend();
+
     Q_DISABLE_COPY(QXmppOutgoingServer)
     QXmppOutgoingServerPrivate* const d;
 };
@@ -22,10 +22,34 @@
  */
 
 #include <QCryptographicHash>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
 #include <QString>
+#include <QThreadPool>
 #include <QTimer>
 
 #include "QXmppPasswordChecker.h"
+#include "QXmppPasswordChecker_p.h"
+#include "QXmppTask.h"
+
+static QByteArray credentialsDigest(const QXmppPasswordRequest &request, const QString &password)
+{
+    return QCryptographicHash::hash(
+        (request.username() + ":" + request.domain() + ":" + password).toUtf8(),
+        QCryptographicHash::Md5);
+}
+
+// Fills a \a reply from the digest of the user's credentials.
+static void setReplyResult(QXmppPasswordReply *reply, const QXmppPasswordRequest &request, bool checkPassword, QXmppPasswordReply::Error error, const QByteArray &digest)
+{
+    if (error != QXmppPasswordReply::NoError)
+        reply->setError(error);
+    else if (!checkPassword)
+        reply->setDigest(digest);
+    else if (credentialsDigest(request, request.password()) != digest)
+        reply->setError(QXmppPasswordReply::AuthorizationError);
+}
 
 /// Returns the requested domain.
 
@@ -80,7 +104,8 @@ void QXmppPasswordRequest::setUsername(const QString &username)
 QXmppPasswordReply::QXmppPasswordReply(QObject *parent)
     : QObject(parent),
     m_error(QXmppPasswordReply::NoError),
-    m_isFinished(false)
+    m_isFinished(false),
+    m_task(0)
 {
 }
 
@@ -121,7 +146,13 @@ void QXmppPasswordReply::setError(QXmppPasswordReply::Error error)
 void QXmppPasswordReply::finish()
 {
     m_isFinished = true;
+
+    // the reply may be deleted by a receiver of finished()
+    QXmppTask *task = m_task;
+    m_task = 0;
     emit finished();
+    if (task)
+        task->resume();
 }
 
 /// Delay marking reply as finished.
@@ -138,6 +169,23 @@ bool QXmppPasswordReply::isFinished() const
     return m_isFinished;
 }
 
+/// Sets the \a task to resume once the reply is finished, after the
+/// finished() signal is emitted.
+///
+/// If the reply is already finished, the task is resumed right away.
+///
+/// \param task
+
+void QXmppPasswordReply::setTask(QXmppTask *task)
+{
+    if (task && m_isFinished) {
+        m_task = 0;
+        task->resume();
+        return;
+    }
+    m_task = task;
+}
+
 /// Returns the received password.
 
 QString QXmppPasswordReply::password() const
@@ -192,9 +240,7 @@ QXmppPasswordReply *QXmppPasswordChecker::getDigest(const QXmppPasswordRequest &
     QString secret;
     QXmppPasswordReply::Error error = getPassword(request, secret);
     if (error == QXmppPasswordReply::NoError) {
-        reply->setDigest(QCryptographicHash::hash(
-            (request.username() + ":" + request.domain() + ":" + secret).toUtf8(),
-            QCryptographicHash::Md5));
+        reply->setDigest(credentialsDigest(request, secret));
     } else {
         reply->setError(error);
     }
@@ -226,3 +272,237 @@ bool QXmppPasswordChecker::hasGetPassword() const
     return false;
 }
 
+
+class QXmppThreadedPasswordCheckerPrivate
+{
+public:
+    struct CacheEntry
+    {
+        QByteArray digest;
+        QDateTime expiry;
+    };
+
+    QXmppPasswordReply *createReply(const QXmppPasswordRequest &request, bool checkPassword);
+    void lookupFinished(const QString &key, QXmppPasswordReply::Error error, const QByteArray &digest);
+    static QString key(const QXmppPasswordRequest &request);
+
+    QXmppThreadedPasswordChecker *q;
+
+    // protects the cache and lookups
+    QMutex mutex;
+    QHash<QString, CacheEntry> cache;
+    int cacheInsertions;
+    int cacheTimeout;
+    QHash<QString, QXmppPasswordLookup*> lookups;
+    QThreadPool pool;
+};
+
+QString QXmppThreadedPasswordCheckerPrivate::key(const QXmppPasswordRequest &request)
+{
+    return request.username() + QLatin1Char('@') + request.domain();
+}
+
+/// Creates a reply for the given \a request, which is completed from the
+/// cache or once the lookup for the user has finished.
+
+QXmppPasswordReply *QXmppThreadedPasswordCheckerPrivate::createReply(const QXmppPasswordRequest &request, bool checkPassword)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppPasswordReply *reply = new QXmppPasswordReply;
+    const QString userKey = key(request);
+
+    QMutexLocker locker(&mutex);
+
+    // use the cached digest if it is still valid
+    QHash<QString, CacheEntry>::iterator it = cache.find(userKey);
+    if (it != cache.end()) {
+        if (it->expiry > QDateTime::currentDateTime()) {
+            setReplyResult(reply, request, checkPassword, QXmppPasswordReply::NoError, it->digest);
+            reply->finishLater();
+            return reply;
+        }
+        cache.erase(it);
+    }
+
+    // wait for the lookup for this user, starting one if needed
+    QXmppPasswordLookup *lookup = lookups.value(userKey);
+    const bool start = !lookup;
+    if (start) {
+        QXmppPasswordRequest lookupRequest(request);
+        lookupRequest.setPassword(QString());
+        lookup = new QXmppPasswordLookup(q, lookupRequest);
+        lookups.insert(userKey, lookup);
+    }
+
+    QXmppPasswordReplyHandler *handler = new QXmppPasswordReplyHandler(reply, request, checkPassword);
+    check = QObject::connect(lookup, SIGNAL(finished(int,QByteArray)),
+                             handler, SLOT(complete(int,QByteArray)));
+    Q_ASSERT(check);
+
+    locker.unlock();
+    if (start)
+        pool.start(lookup);
+    return reply;
+}
+
+/// Records the result of the lookup for the user identified by \a key.
+///
+/// This is called from the worker thread, before the lookup reports its
+/// result and is destroyed.
+
+void QXmppThreadedPasswordCheckerPrivate::lookupFinished(const QString &key, QXmppPasswordReply::Error error, const QByteArray &digest)
+{
+    QMutexLocker locker(&mutex);
+    lookups.remove(key);
+
+    if (error != QXmppPasswordReply::NoError || cacheTimeout <= 0)
+        return;
+
+    // drop expired entries from time to time
+    if (++cacheInsertions >= 1024) {
+        const QDateTime now = QDateTime::currentDateTime();
+        QHash<QString, CacheEntry>::iterator it = cache.begin();
+        while (it != cache.end()) {
+            if (it->expiry <= now)
+                it = cache.erase(it);
+            else
+                ++it;
+        }
+        cacheInsertions = 0;
+    }
+
+    CacheEntry entry;
+    entry.digest = digest;
+    entry.expiry = QDateTime::currentDateTime().addMSecs(cacheTimeout);
+    cache.insert(key, entry);
+}
+
+QXmppPasswordLookup::QXmppPasswordLookup(QXmppThreadedPasswordChecker *checker, const QXmppPasswordRequest &request)
+    : m_checker(checker),
+    m_request(request)
+{
+}
+
+void QXmppPasswordLookup::run()
+{
+    QString password;
+    const QXmppPasswordReply::Error error = m_checker->getPassword(m_request, password);
+    const QByteArray digest = (error == QXmppPasswordReply::NoError) ?
+        credentialsDigest(m_request, password) : QByteArray();
+
+    m_checker->d->lookupFinished(QXmppThreadedPasswordCheckerPrivate::key(m_request), error, digest);
+    emit finished(error, digest);
+}
+
+QXmppPasswordReplyHandler::QXmppPasswordReplyHandler(QXmppPasswordReply *reply, const QXmppPasswordRequest &request, bool checkPassword)
+    : QObject(reply),
+    m_reply(reply),
+    m_request(request),
+    m_checkPassword(checkPassword)
+{
+}
+
+void QXmppPasswordReplyHandler::complete(int error, const QByteArray &digest)
+{
+    setReplyResult(m_reply, m_request, m_checkPassword, QXmppPasswordReply::Error(error), digest);
+    m_reply->finish();
+    deleteLater();
+}
+
+/// Constructs a new threaded password checker.
+
+QXmppThreadedPasswordChecker::QXmppThreadedPasswordChecker()
+    : d(new QXmppThreadedPasswordCheckerPrivate)
+{
+    d->q = this;
+    d->cacheInsertions = 0;
+    d->cacheTimeout = 30000;
+}
+
+/// Destroys the password checker, after waiting for the running lookups.
+///
+/// As getPassword() is reimplemented by a subclass, the subclass should
+/// make sure no requests are pending before it is destroyed.
+
+QXmppThreadedPasswordChecker::~QXmppThreadedPasswordChecker()
+{
+    d->pool.waitForDone();
+    delete d;
+}
+
+/// Checks that the given credentials are valid.
+///
+/// The password is retrieved in a worker thread, or taken from the cache.
+///
+/// \param request
+
+QXmppPasswordReply *QXmppThreadedPasswordChecker::checkPassword(const QXmppPasswordRequest &request)
+{
+    return d->createReply(request, true);
+}
+
+/// Retrieves the MD5 digest for the given username.
+///
+/// The password is retrieved in a worker thread, or taken from the cache.
+///
+/// \param request
+
+QXmppPasswordReply *QXmppThreadedPasswordChecker::getDigest(const QXmppPasswordRequest &request)
+{
+    return d->createReply(request, false);
+}
+
+/// Returns true, as this checker relies on getPassword() being
+/// reimplemented.
+
+bool QXmppThreadedPasswordChecker::hasGetPassword() const
+{
+    return true;
+}
+
+/// Returns how long in milliseconds a successful lookup is cached.
+
+int QXmppThreadedPasswordChecker::cacheTimeout() const
+{
+    return d->cacheTimeout;
+}
+
+/// Sets how long in milliseconds a successful lookup is cached.
+///
+/// Set \a msecs to 0 to disable the cache. The default is 30 seconds.
+///
+/// \param msecs
+
+void QXmppThreadedPasswordChecker::setCacheTimeout(int msecs)
+{
+    QMutexLocker locker(&d->mutex);
+    d->cacheTimeout = qMax(0, msecs);
+    if (!d->cacheTimeout)
+        d->cache.clear();
+}
+
+/// Forgets all the cached lookups, for instance after a password change.
+
+void QXmppThreadedPasswordChecker::clearCache()
+{
+    QMutexLocker locker(&d->mutex);
+    d->cache.clear();
+}
+
+/// Returns the maximum number of worker threads used for lookups.
+
+int QXmppThreadedPasswordChecker::maximumThreadCount() const
+{
+    return d->pool.maxThreadCount();
+}
+
+/// Sets the maximum number of worker threads used for lookups.
+///
+/// \param count
+
+void QXmppThreadedPasswordChecker::setMaximumThreadCount(int count)
+{
+    d->pool.setMaxThreadCount(count);
+}
@@ -28,6 +28,9 @@
 
 #include "QXmppGlobal.h"
 
+class QXmppTask;
+class QXmppThreadedPasswordCheckerPrivate;
+
 /// \brief The QXmppPasswordRequest class represents a password request.
 ///
 class QXMPP_EXPORT QXmppPasswordRequest
@@ -80,6 +83,8 @@ public:
 
     bool isFinished() const;
 
+    void setTask(QXmppTask *task);
+
 public slots:
     void finish();
     void finishLater();
@@ -93,6 +98,7 @@ private:
     QString m_password;
     QXmppPasswordReply::Error m_error;
     bool m_isFinished;
+    QXmppTask *m_task;
 };
 
 /// \brief The QXmppPasswordChecker class represents an abstract password checker.
@@ -109,4 +115,37 @@ protected:
     virtual QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password);
 };
 
+/// \brief The QXmppThreadedPasswordChecker class is a password checker
+/// which retrieves passwords in a pool of worker threads.
+///
+/// Reimplement getPassword() to query your backend. It is called from the
+/// worker threads, so it must be thread-safe, but it may block.
+///
+/// Concurrent requests for the same user share a single call to
+/// getPassword(), and successful lookups are cached for cacheTimeout()
+/// milliseconds. The cache only holds digests of the credentials.
+
+class QXMPP_EXPORT QXmppThreadedPasswordChecker : public QXmppPasswordChecker
+{
+public:
+    QXmppThreadedPasswordChecker();
+    ~QXmppThreadedPasswordChecker();
+
+    QXmppPasswordReply *checkPassword(const QXmppPasswordRequest &request);
+    QXmppPasswordReply *getDigest(const QXmppPasswordRequest &request);
+    bool hasGetPassword() const;
+
+    int cacheTimeout() const;
+    void setCacheTimeout(int msecs);
+    void clearCache();
+
+    int maximumThreadCount() const;
+    void setMaximumThreadCount(int count);
+
+private:
+    Q_DISABLE_COPY(QXmppThreadedPasswordChecker)
+    QXmppThreadedPasswordCheckerPrivate * const d;
+    friend class QXmppPasswordLookup;
+};
+
 #endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPPASSWORDCHECKER_P_H
+#define QXMPPPASSWORDCHECKER_P_H
+
+#include <QObject>
+#include <QRunnable>
+
+#include "QXmppPasswordChecker.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppThreadedPasswordChecker class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppPasswordLookup class runs QXmppPasswordChecker::getPassword()
+/// for one user in a worker thread.
+///
+/// The result is reported as the digest of the user's credentials, so
+/// that every reply waiting for the same user can be completed from it.
+
+class QXmppPasswordLookup : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    QXmppPasswordLookup(QXmppThreadedPasswordChecker *checker, const QXmppPasswordRequest &request);
+    void run();
+
+signals:
+    void finished(int error, const QByteArray &digest);
+
+private:
+    QXmppThreadedPasswordChecker *m_checker;
+    QXmppPasswordRequest m_request;
+};
+
+/// \internal
+///
+/// The QXmppPasswordReplyHandler class completes a QXmppPasswordReply once
+/// the lookup it waits for has finished.
+///
+/// The handler is a child of the reply, so it lives in the reply's thread
+/// and goes away with it.
+
+class QXmppPasswordReplyHandler : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppPasswordReplyHandler(QXmppPasswordReply *reply, const QXmppPasswordRequest &request, bool checkPassword);
+
+public slots:
+    void complete(int error, const QByteArray &digest);
+
+private:
+    QXmppPasswordReply *m_reply;
+    QXmppPasswordRequest m_request;
+    bool m_checkPassword;
+};
+
+#endif
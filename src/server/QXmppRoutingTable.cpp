@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QSet>
+
+#include "QXmppMemoryStats_p.h"
+#include "QXmppRoutingTable_p.h"
+#include "QXmppUtils.h"
+
+#ifdef QXMPP_MEMORY_STATS
+// estimated sizes of the hash nodes and JID strings of an entry
+static const int estimatedJidEntrySize = 64;
+static const int estimatedBareJidEntrySize = 96;
+#endif
+
+class QXmppRoutingTableShard
+{
+public:
+    QXmppRoutingTableShard();
+    ~QXmppRoutingTableShard();
+    void updateMemoryStats();
+
+    mutable QReadWriteLock lock;
+    QHash<QString, QXmppIncomingClient*> byJid;
+    QHash<QString, QSet<QXmppIncomingClient*> > byBareJid;
+
+#ifdef QXMPP_MEMORY_STATS
+    qint64 memoryBytes;
+#endif
+};
+
+QXmppRoutingTableShard::QXmppRoutingTableShard()
+#ifdef QXMPP_MEMORY_STATS
+    : memoryBytes(0)
+#endif
+{
+}
+
+QXmppRoutingTableShard::~QXmppRoutingTableShard()
+{
+#ifdef QXMPP_MEMORY_STATS
+    QXmppMemoryStats::resize(QXmppMemoryStats::RoutingTable, memoryBytes, 0);
+#endif
+}
+
+/// Accounts for the shard's entries, must be called with the write lock held.
+
+void QXmppRoutingTableShard::updateMemoryStats()
+{
+#ifdef QXMPP_MEMORY_STATS
+    const qint64 bytes = sizeof(QXmppRoutingTableShard)
+        + (byJid.capacity() + byBareJid.capacity()) * qint64(sizeof(void*))
+        + byJid.size() * qint64(estimatedJidEntrySize)
+        + byBareJid.size() * qint64(estimatedBareJidEntrySize);
+    QXmppMemoryStats::resize(QXmppMemoryStats::RoutingTable, memoryBytes, bytes);
+#endif
+}
+
+/// Constructs an empty routing table split into \a shardCount shards.
+
+QXmppRoutingTable::QXmppRoutingTable(int shardCount)
+    : m_shardCount(qMax(1, shardCount))
+{
+    m_shards = new QXmppRoutingTableShard[m_shardCount];
+}
+
+/// Destroys the routing table.
+
+QXmppRoutingTable::~QXmppRoutingTable()
+{
+    delete [] m_shards;
+}
+
+QXmppRoutingTableShard *QXmppRoutingTable::shard(const QString &bareJid) const
+{
+    return &m_shards[qHash(bareJid) % uint(m_shardCount)];
+}
+
+/// Binds the full \a jid to \a client.
+///
+/// Returns the client which was previously bound to the JID, if any. The
+/// previous client still counts towards the bare JID until it is removed.
+
+QXmppIncomingClient *QXmppRoutingTable::insert(const QString &jid, QXmppIncomingClient *client)
+{
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    QXmppRoutingTableShard *s = shard(bareJid);
+    QWriteLocker locker(&s->lock);
+
+    QXmppIncomingClient *old = s->byJid.value(jid);
+    s->byJid.insert(jid, client);
+    s->byBareJid[bareJid].insert(client);
+    s->updateMemoryStats();
+    return old;
+}
+
+/// Unbinds \a client from the full \a jid.
+///
+/// Returns true if the client was bound to the JID.
+
+bool QXmppRoutingTable::remove(const QString &jid, QXmppIncomingClient *client)
+{
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    QXmppRoutingTableShard *s = shard(bareJid);
+    QWriteLocker locker(&s->lock);
+
+    QHash<QString, QXmppIncomingClient*>::iterator it = s->byJid.find(jid);
+    if (it != s->byJid.end() && it.value() == client) {
+        s->byJid.erase(it);
+        s->updateMemoryStats();
+    }
+
+    QHash<QString, QSet<QXmppIncomingClient*> >::iterator bareIt = s->byBareJid.find(bareJid);
+    if (bareIt == s->byBareJid.end() || !bareIt.value().remove(client))
+        return false;
+    if (bareIt.value().isEmpty())
+        s->byBareJid.erase(bareIt);
+    s->updateMemoryStats();
+    return true;
+}
+
+/// Returns the client bound to the full \a jid, or 0 if there is none.
+
+QXmppIncomingClient *QXmppRoutingTable::value(const QString &jid) const
+{
+    QXmppRoutingTableShard *s = shard(QXmppUtils::jidToBareJid(jid));
+    QReadLocker locker(&s->lock);
+    return s->byJid.value(jid);
+}
+
+/// Returns the clients bound to resources of the \a bareJid.
+
+QList<QXmppIncomingClient*> QXmppRoutingTable::values(const QString &bareJid) const
+{
+    QXmppRoutingTableShard *s = shard(bareJid);
+    QReadLocker locker(&s->lock);
+    return s->byBareJid.value(bareJid).toList();
+}
+
+/// Returns the number of bound full JIDs.
+
+int QXmppRoutingTable::size() const
+{
+    int count = 0;
+    for (int i = 0; i < m_shardCount; ++i) {
+        QReadLocker locker(&m_shards[i].lock);
+        count += m_shards[i].byJid.size();
+    }
+    return count;
+}
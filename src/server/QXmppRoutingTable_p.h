@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPROUTINGTABLE_P_H
+#define QXMPPROUTINGTABLE_P_H
+
+#include <QList>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+class QXmppIncomingClient;
+class QXmppRoutingTableShard;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppRoutingTable class maps the full and bare JIDs of bound
+/// resources to the client streams serving them.
+///
+/// The table is split into shards by bare JID, each protected by its own
+/// read-write lock, so that lookups from several threads can proceed in
+/// parallel with binds and unbinds.
+
+class QXMPP_AUTOTEST_EXPORT QXmppRoutingTable
+{
+public:
+    QXmppRoutingTable(int shardCount = 64);
+    ~QXmppRoutingTable();
+
+    QXmppIncomingClient *insert(const QString &jid, QXmppIncomingClient *client);
+    bool remove(const QString &jid, QXmppIncomingClient *client);
+
+    QXmppIncomingClient *value(const QString &jid) const;
+    QList<QXmppIncomingClient*> values(const QString &bareJid) const;
+
+    int size() const;
+
+private:
+    Q_DISABLE_COPY(QXmppRoutingTable)
+    QXmppRoutingTableShard *shard(const QString &bareJid) const;
+
+    QXmppRoutingTableShard *m_shards;
+    int m_shardCount;
+};
+
+#endif
@@ -22,83 +22,310 @@
  */
 
 #include <QCoreApplication>
+#include <QDataStream>
 #include <QDomElement>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QLocalServer>
+#include <QLocalSocket>
 #include <QPluginLoader>
+#include <QQueue>
 #include <QSslCertificate>
+#include <QSslConfiguration>
 #include <QSslKey>
 #include <QSslSocket>
+#include <QThread>
+#include <QTimer>
 
+#include "QXmppBoshServer_p.h"
+#include "QXmppCluster_p.h"
+#include "QXmppCompactStanza.h"
 #include "QXmppConstants.h"
 #include "QXmppDialback.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppEpollDispatcher_p.h"
+#include "QXmppHandoff_p.h"
 #include "QXmppIq.h"
 #include "QXmppIncomingClient.h"
 #include "QXmppIncomingServer.h"
+#include "QXmppJid.h"
+#include "QXmppLoginTokenStore_p.h"
+#include "QXmppMetrics.h"
 #include "QXmppOutgoingServer.h"
 #include "QXmppPresence.h"
+#include "QXmppRawStanza.h"
+#include "QXmppRateLimiter.h"
+#include "QXmppRoutingTable_p.h"
 #include "QXmppServer.h"
 #include "QXmppServerExtension.h"
 #include "QXmppServerPlugin.h"
+#include "QXmppStanzaTrace_p.h"
+#include "QXmppStreamSplitter_p.h"
+#include "QXmppTracepoints_p.h"
+#include "QXmppTrafficCapture_p.h"
 #include "QXmppUtils.h"
+#include "QXmppWebSocket_p.h"
 
-static void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement& element, const QStringList &omitNamespaces)
-{
-    stream->writeStartElement(element.tagName());
+// version of the state handed off to another process
+static const quint8 handoffVersion = 1;
+
+/// \internal
+///
+/// The QXmppServerDomain class holds the state of a domain hosted by the
+/// server: the clients bound to it, how their credentials are checked
+/// and which extensions handle its stanzas.
 
-    /* attributes */
-    QString xmlns = element.namespaceURI();
-    if (!xmlns.isEmpty() && !omitNamespaces.contains(xmlns))
-        stream->writeAttribute("xmlns", xmlns);
-    QDomNamedNodeMap attrs = element.attributes();
-    for (int i = 0; i < attrs.size(); i++)
+class QXmppServerDomain
+{
+public:
+    QXmppServerDomain()
+        : passwordChecker(0)
     {
-        QDomAttr attr = attrs.item(i).toAttr();
-        stream->writeAttribute(attr.name(), attr.value());
     }
 
-    /* children */
-    QDomNode childNode = element.firstChild();
-    while (!childNode.isNull())
+    // the domain's own password checker, or 0 to use the server's one
+    QXmppPasswordChecker *passwordChecker;
+    QXmppRoutingTable clientRoutes;
+
+    // the names of the extensions enabled for the domain, all of them if
+    // the list is empty, and the matching extensions
+    QStringList extensionNames;
+    QSet<QXmppServerExtension*> extensions;
+
+    // the domain's service discovery responses, serialized without their
+    // id and recipient, and rebuilt when the extensions change
+    QByteArray discoveryInfoData;
+    QByteArray discoveryItemsData;
+
+private:
+    Q_DISABLE_COPY(QXmppServerDomain)
+};
+
+/// \internal
+///
+/// The QXmppSuspendedServerSession class holds a server-to-server session
+/// whose incoming stream was lost, until the remote server resumes it or
+/// it expires.
+
+class QXmppSuspendedServerSession
+{
+public:
+    QXmppSuspendedServerSession()
+        : handled(0)
+        , expiry(0)
     {
-        if (childNode.isElement())
-        {
-            helperToXmlAddDomElement(stream, childNode.toElement(), QStringList() << xmlns);
-        } else if (childNode.isText()) {
-            stream->writeCharacters(childNode.toText().data());
-        }
-        childNode = childNode.nextSibling();
     }
-    stream->writeEndElement();
-}
+
+    // the remote domains verified on the stream, and the number of
+    // stanzas received from them
+    QStringList domains;
+    uint handled;
+    qint64 expiry;
+};
 
 class QXmppServerPrivate
 {
 public:
     QXmppServerPrivate(QXmppServer *qq);
     void loadExtensions(QXmppServer *server);
+    void insertExtension(QXmppServerExtension *extension);
+    void takeExtension(QXmppServerExtension *extension);
+    QList<QXmppServerExtension*> createExtensions(const QString &fileName, const QHash<QString, QByteArray> &states);
+    void unloadExtensions(const QString &fileName, QHash<QString, QByteArray> *states);
+    QXmppServerDomain *hostedDomain(const QString &domain, bool *isSubdomain = 0) const;
+    QXmppRoutingTable *clientRoutes(const QString &jid) const;
+    bool isEnabled(const QXmppServerDomain *hosted, QXmppServerExtension *extension) const;
+    void updateDomains();
+    void updateDomainExtensions();
     bool routeData(const QString &to, const QByteArray &data);
+    bool sendToClients(QXmppRoutingTable *routes, const QXmppJid &to, const QByteArray &data);
+    void updateClusterSession(const QString &jid);
+    QString redirectHost();
+    QXmppOutgoingServer *connectToDomain(const QString &toDomain, const QString &fromDomain);
+    int broadcastData(const QByteArray &data, const QSet<QString> &recipients);
+    void setupStream(QXmppStream *stream);
+    QXmppSslServer *createListener(const QString &kind);
+    void addListener(QXmppSslServer *server, const QString &kind);
+    void restoreClientSession(const QVariantMap &session);
+    void moveToWorker(QXmppStream *stream);
+    void releaseWorker(QXmppStream *stream);
+    void rebalanceWorkers();
+    void stopWorkers();
+    void updateOutputQueueGauge();
     void startExtensions();
     void stopExtensions();
+    void updateStanzaHandlers();
+    bool dispatchStanza(const QDomElement &element);
+    bool handleDiscovery(const QDomElement &element);
+    void updateDiscovery(const QString &domain, QXmppServerDomain *hosted);
+    void clearDiscovery();
+    void handleElement(const QDomElement &element);
+    bool needsElement(const QString &tagName, const QString &to) const;
+    bool startTrace();
+    void finishTrace();
+    void attachLimiter(QXmppStream *stream, QHash<QString, QWeakPointer<QXmppRateLimiter> > &limiters, const QString &key, qint64 bytesPerSecond, int stanzasPerSecond);
+    void detachLimiter(QXmppStream *stream, QHash<QString, QWeakPointer<QXmppRateLimiter> > &limiters, const QString &key);
+    void updateConnectionLimiter(QXmppStream *stream);
+    void updateLimiterGauges();
+    bool shedStanza(const QString &tagName, const QString &type);
+    QString dialbackKey(const QString &toDomain);
+    bool isVerifiedKey(const QString &verifyKey);
 
     void info(const QString &message);
     void warning(const QString &message);
 
     QString domain;
+    // the hosted domains, including the primary one, the lengths of their
+    // names, which are the only suffixes worth looking up for subdomains,
+    // and the password checker to use for each of them
+    QHash<QString, QXmppServerDomain*> domains;
+    QList<int> domainLengths;
+    QHash<QString, QXmppPasswordChecker*> domainCheckers;
+    int restrictedDomainCount;
     QList<QXmppServerExtension*> extensions;
+    // plugins loaded at runtime, and the extensions they created
+    QHash<QString, QPluginLoader*> pluginLoaders;
+    QMultiHash<QString, QXmppServerExtension*> pluginExtensions;
+
+    // extensions interested in each stanza tag name, in priority order
+    typedef QPair<QXmppServerExtension*, QXmppServerExtension::StanzaFilter> StanzaHandler;
+    QHash<QString, QList<StanzaHandler> > stanzaHandlers;
+    QList<StanzaHandler> defaultStanzaHandlers;
+
     QXmppLogger *logger;
     QXmppPasswordChecker *passwordChecker;
 
+    // limits for streams
+    int maximumStanzaSize;
+    qint64 maximumBufferSize;
+    qint64 outputLowWatermark;
+    qint64 outputHighWatermark;
+    QXmppStream::OutputQueuePolicy outputQueuePolicy;
+    qint64 outputSchedulingWindow;
+    bool outputPresenceCoalescing;
+    bool streamCompressionEnabled;
+    QSharedPointer<QXmppLoginTokenStore> loginTokens;
+    bool tlsSessionResumptionEnabled;
+    QList<QSslCipher> tlsCiphers;
+    int maximumHandshakes;
+    int connectionAdmissionRate;
+
+    // rate limits in bytes and stanzas per second, for each incoming
+    // stream, for all the streams of a user and for all the streams of a
+    // remote domain
+    qint64 connectionByteRate;
+    int connectionStanzaRate;
+    qint64 userByteRate;
+    int userStanzaRate;
+    qint64 domainByteRate;
+    int domainStanzaRate;
+    QHash<QXmppStream*, QSharedPointer<QXmppRateLimiter> > connectionLimiters;
+    // the streams hold the shared limiters, which go away with the last one
+    QHash<QString, QWeakPointer<QXmppRateLimiter> > userLimiters;
+    QHash<QString, QWeakPointer<QXmppRateLimiter> > domainLimiters;
+    QHash<QXmppIncomingServer*, QStringList> verifiedDomains;
+
+    // load shedding
+    int overloadStanzaRate;
+    QXmppRateLimiter overloadLimiter;
+    bool overloaded;
+
+    // stanza tracing
+    int stanzaTraceInterval;
+    int stanzaTraceCount;
+
+    // capture of the data received from clients
+    QSharedPointer<QXmppTrafficCapture> trafficCapture;
+
+    // threads running the streams
+    int workerThreadCount;
+    QXmppServer::EventDispatcher workerEventDispatcher;
+    QList<QThread*> workerThreads;
+    QHash<QThread*, int> workerLoads;
+    QHash<QXmppStream*, QThread*> streamWorkers;
+
+    // migration of busy client streams between worker threads
+    int workerRebalanceInterval;
+    QTimer *workerRebalanceTimer;
+    QHash<QXmppIncomingClient*, qint64> clientProcessingTimes;
+
     // client-to-server
     QSet<QXmppIncomingClient*> incomingClients;
-    QHash<QString, QXmppIncomingClient*> incomingClientsByJid;
-    QHash<QString, QSet<QXmppIncomingClient*> > incomingClientsByBareJid;
+    int streamResumptionTimeout;
+    // sessions which can be resumed, by resumption id
+    QHash<QString, QXmppIncomingClient*> resumableClients;
+    QHash<QXmppIncomingClient*, QString> resumptionIds;
+    // streams handing over their session, and the stream resuming it
+    QHash<QXmppIncomingClient*, QXmppIncomingClient*> resumingClients;
+    QSet<QXmppIncomingClient*> detachedClients;
     QSet<QXmppSslServer*> serversForClients;
+    QSet<QLocalServer*> localServersForClients;
+    QXmppBoshServer *boshServer;
+    // the kind of each listener, which says how to serve its connections
+    QHash<QXmppSslServer*, QString> listenerKinds;
+
+    // handoff of the listeners and sessions to another process: the
+    // streams which have not handed off their session yet, and the
+    // sessions which were handed off
+    QLocalServer *handoffServer;
+    QLocalSocket *handoffSocket;
+    QTimer *handoffTimer;
+    QSet<QXmppIncomingClient*> handoffClients;
+    QVariantList handoffSessions;
 
     // server-to-server
     QSet<QXmppIncomingServer*> incomingServers;
     QSet<QXmppOutgoingServer*> outgoingServers;
+    QMultiHash<QString, QXmppOutgoingServer*> outgoingServersByDomain;
+    // the domain each outgoing stream is filed under in outgoingServersByDomain,
+    // the stream itself lives in a worker thread and is not asked for it
+    QHash<QXmppOutgoingServer*, QString> outgoingServerDomains;
+    int serverStreamResumptionTimeout;
+    bool serverStreamPipelining;
+    // incoming sessions which can be resumed, by resumption id, the
+    // streams handing over their session and the stream resuming it, and
+    // the sessions whose stream was lost
+    QHash<QString, QXmppIncomingServer*> resumableServers;
+    QHash<QXmppIncomingServer*, QString> serverResumptionIds;
+    QHash<QXmppIncomingServer*, QXmppIncomingServer*> resumingServers;
+    QHash<QString, QXmppSuspendedServerSession> suspendedServerSessions;
+    int maximumOutgoingServerLinks;
+    qint64 outgoingServerLinkBacklog;
+    int outgoingServerIdleTimeout;
+    int certificateCacheTimeout;
+    QStringList preconnectDomains;
+    QTimer *preconnectTimer;
+    // incoming streams waiting for a dialback verify response,
+    // by remote domain and stream id
+    QHash<QString, QXmppIncomingServer*> pendingVerifies;
+    // dialback keys are shared by the streams opened to a domain, and the
+    // keys verified for a remote domain are remembered, for a short time,
+    // so that parallel streams need a single verify round trip
+    int dialbackCacheTimeout;
+    QElapsedTimer dialbackClock;
+    QHash<QString, QPair<QString, qint64> > dialbackKeys;
+    QHash<QString, qint64> verifiedKeys;
+    // verify requests in flight by remote domain and stream id, and the
+    // streams waiting for them, by remote domain, local domain and key
+    QHash<QString, QString> pendingVerifyKeys;
+    QSet<QString> verifyingKeys;
+    QMultiHash<QString, QPair<QXmppIncomingServer*, QString> > verifyWaiters;
     QSet<QXmppSslServer*> serversForServers;
 
+    // other nodes serving the same domain, and the host their clients
+    // connect to
+    QXmppCluster *cluster;
+    QHash<QString, QString> clusterRedirectHosts;
+
+    // client streams which are closed at a limited rate, the streams which
+    // were told to leave and the clients sent to each node meanwhile
+    QTimer *drainTimer;
+    int drainRate;
+    int drainCount;
+    int drainReconnectDelay;
+    QSet<QXmppIncomingClient*> drainedClients;
+    QHash<QString, int> drainRedirects;
+
     // ssl
     QList<QSslCertificate> caCertificates;
     QSslCertificate localCertificate;
@@ -111,695 +338,3821 @@ private:
 };
 
 QXmppServerPrivate::QXmppServerPrivate(QXmppServer *qq)
-    : logger(0),
+    : restrictedDomainCount(0),
+    logger(0),
     passwordChecker(0),
+    boshServer(0),
+    handoffServer(0),
+    handoffSocket(0),
+    handoffTimer(0),
+    maximumStanzaSize(0),
+    maximumBufferSize(0),
+    outputLowWatermark(0),
+    outputHighWatermark(0),
+    outputQueuePolicy(QXmppStream::StallPolicy),
+    outputSchedulingWindow(0),
+    outputPresenceCoalescing(false),
+    streamCompressionEnabled(false),
+    loginTokens(new QXmppLoginTokenStore),
+    tlsSessionResumptionEnabled(false),
+    maximumHandshakes(0),
+    connectionAdmissionRate(0),
+    connectionByteRate(0),
+    connectionStanzaRate(0),
+    userByteRate(0),
+    userStanzaRate(0),
+    domainByteRate(0),
+    domainStanzaRate(0),
+    overloadStanzaRate(0),
+    overloaded(false),
+    stanzaTraceInterval(0),
+    stanzaTraceCount(0),
+    workerThreadCount(0),
+    workerEventDispatcher(QXmppServer::QtEventDispatcher),
+    workerRebalanceInterval(0),
+    workerRebalanceTimer(0),
+    streamResumptionTimeout(0),
+    serverStreamResumptionTimeout(0),
+    serverStreamPipelining(false),
+    maximumOutgoingServerLinks(1),
+    outgoingServerLinkBacklog(65536),
+    outgoingServerIdleTimeout(0),
+    certificateCacheTimeout(0),
+    preconnectTimer(0),
+    dialbackCacheTimeout(60),
+    cluster(0),
+    drainTimer(0),
+    drainRate(100),
+    drainCount(0),
+    drainReconnectDelay(0),
     loaded(false),
     started(false),
     q(qq)
 {
+    dialbackClock.start();
 }
 
-/// Routes XMPP data to the given recipient.
-///
-/// \param to
-/// \param data
-///
+/// Applies the limits configured for the server to a new \a stream.
 
-bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
+void QXmppServerPrivate::setupStream(QXmppStream *stream)
 {
-    // refuse to route packets to empty destination, own domain or sub-domains
-    const QString toDomain = QXmppUtils::jidToDomain(to);
-    if (to.isEmpty() || to == domain || toDomain.endsWith("." + domain))
-        return false;
-
-    if (toDomain == domain) {
-
-        // look for a client connection
-        QList<QXmppIncomingClient*> found;
-        if (QXmppUtils::jidToResource(to).isEmpty()) {
-            foreach (QXmppIncomingClient *conn, incomingClientsByBareJid.value(to))
-                found << conn;
-        } else {
-            QXmppIncomingClient *conn = incomingClientsByJid.value(to);
-            if (conn)
-                found << conn;
-        }
-
-        // send data
-        foreach (QXmppStream *conn, found)
-            QMetaObject::invokeMethod(conn, "sendData", Q_ARG(QByteArray, data));
-        return !found.isEmpty();
+    bool check;
+    Q_UNUSED(check);
 
-    } else if (!serversForServers.isEmpty()) {
+    stream->setMaximumStanzaSize(maximumStanzaSize);
+    stream->setMaximumBufferSize(maximumBufferSize);
+    stream->setOutputWatermarks(outputLowWatermark, outputHighWatermark);
+    stream->setOutputQueuePolicy(outputQueuePolicy);
+    stream->setOutputSchedulingWindow(outputSchedulingWindow);
+    stream->setOutputPresenceCoalescingEnabled(outputPresenceCoalescing);
+    stream->setStanzaTraceInterval(stanzaTraceInterval);
 
-        bool check;
-        Q_UNUSED(check);
+    check = QObject::connect(stream, SIGNAL(outputHighWatermarkReached()),
+                             q, SLOT(_q_outputQueueChanged()));
+    Q_ASSERT(check);
 
-        // look for an outgoing S2S connection
-        foreach (QXmppOutgoingServer *conn, outgoingServers) {
-            if (conn->remoteDomain() == toDomain) {
-                // send or queue data
-                QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
-                return true;
-            }
-        }
+    check = QObject::connect(stream, SIGNAL(outputLowWatermarkReached()),
+                             q, SLOT(_q_outputQueueChanged()));
+    Q_ASSERT(check);
+}
 
-        // if we did not find an outgoing server,
-        // we need to establish the S2S connection
-        QXmppOutgoingServer *conn = new QXmppOutgoingServer(domain, 0);
-        conn->setLocalStreamKey(QXmppUtils::generateStanzaHash().toLatin1());
-        conn->moveToThread(q->thread());
-        conn->setParent(q);
+/// Creates a listener whose connections are served according to its
+/// \a kind, which is one of "clients", "bosh", "websocket" or "servers".
+///
+/// Returns 0 if the kind is not known.
 
-        check = QObject::connect(conn, SIGNAL(disconnected()),
-                                 q, SLOT(_q_outgoingServerDisconnected()));
-        Q_UNUSED(check);
+QXmppSslServer *QXmppServerPrivate::createListener(const QString &kind)
+{
+    bool check;
+    Q_UNUSED(check);
 
-        // add stream
-        outgoingServers.insert(conn);
-        q->setGauge("outgoing-server.count", outgoingServers.size());
+    const char *slot;
+    if (kind == QLatin1String("clients"))
+        slot = SLOT(_q_clientConnection(QSslSocket*));
+    else if (kind == QLatin1String("bosh"))
+        slot = SLOT(_q_boshConnection(QSslSocket*));
+    else if (kind == QLatin1String("websocket"))
+        slot = SLOT(_q_webSocketConnection(QSslSocket*));
+    else if (kind == QLatin1String("servers"))
+        slot = SLOT(_q_serverConnection(QSslSocket*));
+    else
+        return 0;
+
+    QXmppSslServer *server = new QXmppSslServer(q);
+    server->addCaCertificates(caCertificates);
+    server->setLocalCertificate(localCertificate);
+    server->setPrivateKey(privateKey);
+    server->setSessionResumptionEnabled(tlsSessionResumptionEnabled);
+    server->setCiphers(tlsCiphers);
+    server->setMaximumHandshakes(maximumHandshakes);
+    server->setAdmissionRate(connectionAdmissionRate);
+
+    check = QObject::connect(server, SIGNAL(newConnection(QSslSocket*)),
+                             q, slot);
+    Q_ASSERT(check);
+    return server;
+}
 
-        // queue data and connect to remote server
-        QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
-        QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, toDomain));
-        return true;
+/// Adds a listening \a server created by createListener() for \a kind.
 
-    } else {
+void QXmppServerPrivate::addListener(QXmppSslServer *server, const QString &kind)
+{
+    bool check;
+    Q_UNUSED(check);
 
-        // S2S is disabled, failed to route data
-        return false;
+    listenerKinds.insert(server, kind);
+    if (kind == QLatin1String("servers")) {
+        serversForServers.insert(server);
 
+        // open streams to the preconnected domains
+        q->_q_preconnectDomains();
+        preconnectTimer->start();
+        return;
+    }
+    serversForClients.insert(server);
+
+    // all the BOSH listeners share the sessions
+    if (kind == QLatin1String("bosh") && !boshServer) {
+        boshServer = new QXmppBoshServer(q);
+        check = QObject::connect(boshServer, SIGNAL(newSession(QXmppBoshSession*)),
+                                 q, SLOT(_q_boshSession(QXmppBoshSession*)));
+        Q_ASSERT(check);
     }
 }
 
-/// Handles an incoming XML element.
-///
-/// \param server
-/// \param stream
-/// \param element
+/// Restores a client \a session handed off by another process on a stream
+/// which waits for the client to resume it.
 
-static void handleStanza(QXmppServer *server, const QDomElement &element)
+void QXmppServerPrivate::restoreClientSession(const QVariantMap &session)
 {
-    // try extensions
-    foreach (QXmppServerExtension *extension, server->extensions())
-        if (extension->handleStanza(element))
-            return;
-
-    // default handlers
-    const QString domain = server->domain();
-    const QString to = element.attribute("to");
-    if (to == domain) {
-        if (element.tagName() == QLatin1String("iq")) {
-            // we do not support the given IQ
-            QXmppIq request;
-            request.parse(element);
+    const QString jid = session.value("jid").toString();
+    QXmppRoutingTable *routes = clientRoutes(jid);
+    if (!routes || !streamResumptionTimeout)
+        return;
 
-            if (request.type() != QXmppIq::Error && request.type() != QXmppIq::Result) {
-                QXmppIq response(QXmppIq::Error);
-                response.setId(request.id());
-                response.setFrom(domain);
-                response.setTo(request.from());
-                QXmppStanza::Error error(QXmppStanza::Error::Cancel,
-                    QXmppStanza::Error::FeatureNotImplemented);
-                response.setError(error);
-                server->sendPacket(response);
-            }
-        }
+    QXmppIncomingClient *stream = new QXmppIncomingClient(static_cast<QIODevice*>(0), QXmppUtils::jidToDomain(jid), q);
+    q->addIncomingClient(stream);
+    stream->restoreSession(session);
+    routes->insert(jid, stream);
+    updateClusterSession(jid);
+}
 
-    } else {
+/// Adds the limiter which the streams of \a key share to \a stream,
+/// creating it if needed, unless the rates are 0.
 
-        // route element or reply on behalf of missing peer
-        if (!server->sendElement(element) && element.tagName() == QLatin1String("iq")) {
-            QXmppIq request;
-            request.parse(element);
+void QXmppServerPrivate::attachLimiter(QXmppStream *stream, QHash<QString, QWeakPointer<QXmppRateLimiter> > &limiters, const QString &key, qint64 bytesPerSecond, int stanzasPerSecond)
+{
+    if (!bytesPerSecond && !stanzasPerSecond)
+        return;
 
-            QXmppIq response(QXmppIq::Error);
-            response.setId(request.id());
-            response.setFrom(request.to());
-            response.setTo(request.from());
-            QXmppStanza::Error error(QXmppStanza::Error::Cancel,
-                QXmppStanza::Error::ServiceUnavailable);
-            response.setError(error);
-            server->sendPacket(response);
-        }
+    QSharedPointer<QXmppRateLimiter> limiter = limiters.value(key).toStrongRef();
+    if (!limiter) {
+        limiter = QSharedPointer<QXmppRateLimiter>(new QXmppRateLimiter(bytesPerSecond, stanzasPerSecond));
+        limiters.insert(key, limiter);
     }
+    stream->addRateLimiter(limiter);
 }
 
-void QXmppServerPrivate::info(const QString &message)
-{
-    if (logger)
-        logger->log(QXmppLogger::InformationMessage, message);
-}
+/// Removes the limiter which the streams of \a key share from \a stream,
+/// and forgets it once no stream holds it.
 
-void QXmppServerPrivate::warning(const QString &message)
+void QXmppServerPrivate::detachLimiter(QXmppStream *stream, QHash<QString, QWeakPointer<QXmppRateLimiter> > &limiters, const QString &key)
 {
-    if (logger)
-        logger->log(QXmppLogger::WarningMessage, message);
+    QSharedPointer<QXmppRateLimiter> limiter = limiters.value(key).toStrongRef();
+    if (limiter) {
+        stream->removeRateLimiter(limiter);
+        limiter.clear();
+    }
+    if (limiters.value(key).isNull())
+        limiters.remove(key);
 }
 
-/// Load the server's extensions.
-///
-/// \param server
+/// Applies the per-connection rate limits to an incoming \a stream.
 
-void QXmppServerPrivate::loadExtensions(QXmppServer *server)
+void QXmppServerPrivate::updateConnectionLimiter(QXmppStream *stream)
 {
-    if (!loaded) {
-        QObjectList plugins = QPluginLoader::staticInstances();
-        foreach (QObject *object, plugins) {
-            QXmppServerPlugin *plugin = qobject_cast<QXmppServerPlugin*>(object);
-            if (!plugin)
-                continue;
-
-            foreach (const QString &key, plugin->keys())
-                server->addExtension(plugin->create(key));
+    QSharedPointer<QXmppRateLimiter> limiter = connectionLimiters.value(stream);
+    if (connectionByteRate || connectionStanzaRate) {
+        if (limiter) {
+            limiter->setRates(connectionByteRate, connectionStanzaRate);
+        } else {
+            limiter = QSharedPointer<QXmppRateLimiter>(new QXmppRateLimiter(connectionByteRate, connectionStanzaRate));
+            connectionLimiters.insert(stream, limiter);
+            stream->addRateLimiter(limiter);
         }
-        loaded = true;
+    } else if (limiter) {
+        stream->removeRateLimiter(limiter);
+        connectionLimiters.remove(stream);
     }
 }
 
-/// Start the server's extensions.
-
-void QXmppServerPrivate::startExtensions()
+void QXmppServerPrivate::updateLimiterGauges()
 {
-    if (!started) {
-        foreach (QXmppServerExtension *extension, extensions)
-            if (!extension->start())
-                warning(QString("Could not start extension %1").arg(extension->extensionName()));
-        started = true;
-    }
+    q->setGauge("rate-limit.connection-count", connectionLimiters.size());
+    q->setGauge("rate-limit.user-count", userLimiters.size());
+    q->setGauge("rate-limit.domain-count", domainLimiters.size());
 }
 
-/// Stop the server's extensions (in reverse order).
+/// Returns true if an incoming stanza should be dropped because the
+/// server is overloaded.
 ///
+/// The server is overloaded while it receives more stanzas than the
+/// overload rate. Only presences are dropped, except unavailable ones,
+/// so that the presence of users who go offline is still known.
 
-void QXmppServerPrivate::stopExtensions()
+bool QXmppServerPrivate::shedStanza(const QString &tagName, const QString &type)
 {
-    if (started) {
-        for (int i = extensions.size() - 1; i >= 0; --i)
-            extensions[i]->stop();
-        started = false;
+    if (!overloadStanzaRate)
+        return false;
+
+    // stanzas received while overloaded are not counted, so the overload
+    // ends as soon as the backlog of the limiter is absorbed
+    const bool wasOverloaded = overloaded;
+    overloaded = overloadLimiter.delay() > 0;
+    if (!overloaded)
+        overloadLimiter.consume(0, 1);
+    if (overloaded != wasOverloaded) {
+        q->setGauge("server.overloaded", overloaded ? 1 : 0);
+        if (overloaded)
+            warning(QString("Server is overloaded, dropping presences"));
     }
+
+    if (overloaded &&
+        tagName == QLatin1String("presence") &&
+        type != QLatin1String("unavailable")) {
+        q->updateCounter("server.shed-presences");
+        return true;
+    }
+    return false;
 }
 
-/// Constructs a new XMPP server instance.
+/// Returns the dialback key for a new outgoing stream to \a toDomain.
 ///
-/// \param parent
+/// The streams opened to a domain within the cache timeout share their
+/// key, so that the remote server can verify it once.
 
-QXmppServer::QXmppServer(QObject *parent)
-    : QXmppLoggable(parent)
-    , d(new QXmppServerPrivate(this))
+QString QXmppServerPrivate::dialbackKey(const QString &toDomain)
 {
-    qRegisterMetaType<QDomElement>("QDomElement");
+    const qint64 now = dialbackClock.elapsed();
+    QHash<QString, QPair<QString, qint64> >::const_iterator it = dialbackKeys.constFind(toDomain);
+    if (it != dialbackKeys.constEnd() && it.value().second > now)
+        return it.value().first;
+
+    const QString key = QXmppUtils::generateStanzaHash();
+    if (dialbackCacheTimeout > 0)
+        dialbackKeys.insert(toDomain, qMakePair(key, now + dialbackCacheTimeout * 1000));
+    return key;
 }
 
-/// Destroys an XMPP server instance.
-///
+/// Returns true if \a verifyKey, made of the remote domain, the local
+/// domain and the dialback key, was recently verified.
 
-QXmppServer::~QXmppServer()
+bool QXmppServerPrivate::isVerifiedKey(const QString &verifyKey)
 {
-    close();
-    delete d;
+    QHash<QString, qint64>::iterator it = verifiedKeys.find(verifyKey);
+    if (it == verifiedKeys.end())
+        return false;
+    if (it.value() > dialbackClock.elapsed())
+        return true;
+    verifiedKeys.erase(it);
+    return false;
 }
 
-/// Registers a new extension with the server.
+/// Returns the hosted domain which serves \a domain, either because it
+/// is the hosted domain itself or one of its subdomains, or 0 if the
+/// domain is not hosted.
 ///
-/// \param extension
+/// Only the suffixes whose length matches that of a hosted domain are
+/// looked up, and they are not copied.
 
-void QXmppServer::addExtension(QXmppServerExtension *extension)
+QXmppServerDomain *QXmppServerPrivate::hostedDomain(const QString &domain, bool *isSubdomain) const
 {
-    if (!extension || d->extensions.contains(extension))
-        return;
-    d->info(QString("Added extension %1").arg(extension->extensionName()));
-    extension->setParent(this);
-    extension->setServer(this);
-
-    // keep extensions sorted by priority
-    for (int i = 0; i < d->extensions.size(); ++i) {
-        QXmppServerExtension *other = d->extensions[i];
-        if (other->extensionPriority() < extension->extensionPriority()) {
-            d->extensions.insert(i, extension);
-            return;
+    if (isSubdomain)
+        *isSubdomain = false;
+
+    QHash<QString, QXmppServerDomain*>::const_iterator it = domains.constFind(domain);
+    if (it != domains.constEnd())
+        return it.value();
+
+    const int size = domain.size();
+    foreach (int length, domainLengths) {
+        if (length >= size)
+            break;
+        if (domain.at(size - length - 1) != QLatin1Char('.'))
+            continue;
+        it = domains.constFind(QString::fromRawData(domain.constData() + size - length, length));
+        if (it != domains.constEnd()) {
+            if (isSubdomain)
+                *isSubdomain = true;
+            return it.value();
         }
     }
-    d->extensions << extension;
+    return 0;
 }
 
-/// Returns the list of loaded extensions.
-///
+/// Returns the routing table for the clients of the hosted domain of
+/// \a jid, or 0 if the domain is not hosted.
 
-QList<QXmppServerExtension*> QXmppServer::extensions()
+QXmppRoutingTable *QXmppServerPrivate::clientRoutes(const QString &jid) const
 {
-    d->loadExtensions(this);
-    return d->extensions;
+    QXmppServerDomain *hosted = domains.value(QXmppUtils::jidToDomain(jid));
+    return hosted ? &hosted->clientRoutes : 0;
 }
 
-/// Returns the server's domain.
-///
+/// Returns true if \a extension handles the stanzas of the \a hosted
+/// domain.
 
-QString QXmppServer::domain() const
+bool QXmppServerPrivate::isEnabled(const QXmppServerDomain *hosted, QXmppServerExtension *extension) const
 {
-    return d->domain;
+    return !hosted || hosted->extensionNames.isEmpty() || hosted->extensions.contains(extension);
 }
 
-/// Sets the server's domain.
-///
-/// \param domain
+/// Updates the lookup structures derived from the hosted domains, and
+/// tells the incoming server streams which domains they can be
+/// authorized for.
 
-void QXmppServer::setDomain(const QString &domain)
+void QXmppServerPrivate::updateDomains()
 {
-    d->domain = domain;
+    domainLengths.clear();
+    domainCheckers.clear();
+    restrictedDomainCount = 0;
+    QHash<QString, QXmppServerDomain*>::const_iterator it;
+    for (it = domains.constBegin(); it != domains.constEnd(); ++it) {
+        if (!domainLengths.contains(it.key().size()))
+            domainLengths << it.key().size();
+        domainCheckers.insert(it.key(), it.value()->passwordChecker ? it.value()->passwordChecker : passwordChecker);
+        if (!it.value()->extensionNames.isEmpty())
+            restrictedDomainCount++;
+    }
+    qSort(domainLengths);
+    updateDomainExtensions();
+    clearDiscovery();
+
+    const QStringList names = domains.keys();
+    foreach (QXmppIncomingServer *stream, incomingServers)
+        QMetaObject::invokeMethod(stream, "setHostedDomains", Q_ARG(QStringList, names));
 }
 
-/// Returns the QXmppLogger associated with the server.
-///
+/// Resolves the names of the extensions enabled for each hosted domain.
 
-QXmppLogger *QXmppServer::logger()
+void QXmppServerPrivate::updateDomainExtensions()
 {
-    return d->logger;
+    foreach (QXmppServerDomain *hosted, domains) {
+        hosted->extensions.clear();
+        foreach (QXmppServerExtension *extension, extensions)
+            if (hosted->extensionNames.contains(extension->extensionName()))
+                hosted->extensions.insert(extension);
+    }
 }
 
-/// Sets the QXmppLogger associated with the server.
-///
-/// \param logger
+/// Moves a new \a stream created by the server to the least loaded worker
+/// thread, if worker threads are enabled.
 
-void QXmppServer::setLogger(QXmppLogger *logger)
+void QXmppServerPrivate::moveToWorker(QXmppStream *stream)
 {
-    if (logger != d->logger) {
-        if (d->logger) {
-            disconnect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                       d->logger, SLOT(log(QXmppLogger::MessageType,QString)));
-            disconnect(this, SIGNAL(setGauge(QString,double)),
-                       d->logger, SLOT(setGauge(QString,double)));
-            disconnect(this, SIGNAL(updateCounter(QString,qint64)),
-                       d->logger, SLOT(updateCounter(QString,qint64)));
-        }
+    bool check;
+    Q_UNUSED(check);
 
-        d->logger = logger;
-        if (d->logger) {
-            connect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
-                    d->logger, SLOT(log(QXmppLogger::MessageType,QString)));
-            connect(this, SIGNAL(setGauge(QString,double)),
-                    d->logger, SLOT(setGauge(QString,double)));
-            connect(this, SIGNAL(updateCounter(QString,qint64)),
-                    d->logger, SLOT(updateCounter(QString,qint64)));
+    if (workerThreadCount <= 0)
+        return;
+
+    // start worker threads
+    while (workerThreads.size() < workerThreadCount) {
+        QThread *thread = new QThread;
+#if defined(Q_OS_LINUX) && QT_VERSION >= 0x050000
+        if (workerEventDispatcher == QXmppServer::EpollEventDispatcher) {
+            QXmppEpollEventDispatcher *dispatcher = new QXmppEpollEventDispatcher;
+            if (dispatcher->isValid())
+                thread->setEventDispatcher(dispatcher);
+            else
+                delete dispatcher;
         }
+#endif
+        thread->start();
+        workerThreads << thread;
+        workerLoads.insert(thread, 0);
+    }
 
-        emit loggerChanged(d->logger);
+    QThread *worker = workerThreads.first();
+    foreach (QThread *thread, workerThreads) {
+        if (workerLoads.value(thread) < workerLoads.value(worker))
+            worker = thread;
     }
-}
+    workerLoads[worker]++;
+    streamWorkers.insert(stream, worker);
+    if (workerRebalanceInterval > 0 && !workerRebalanceTimer->isActive())
+        workerRebalanceTimer->start();
 
-/// Returns the password checker used to verify client credentials.
-///
+    // an object with a parent cannot be moved to another thread, so
+    // relay the stream's logging and statistics explicitly
+    stream->setParent(0);
 
-QXmppPasswordChecker *QXmppServer::passwordChecker()
-{
-    return d->passwordChecker;
-}
+    check = QObject::connect(stream, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+                             q, SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
+    Q_ASSERT(check);
 
-/// Sets the password checker used to verify client credentials.
-///
-/// \param checker
-///
+    check = QObject::connect(stream, SIGNAL(setGauge(QString,double)),
+                             q, SIGNAL(setGauge(QString,double)));
+    Q_ASSERT(check);
 
-void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker)
-{
-    d->passwordChecker = checker;
+    check = QObject::connect(stream, SIGNAL(updateCounter(QString,qint64)),
+                             q, SIGNAL(updateCounter(QString,qint64)));
+    Q_ASSERT(check);
+
+    stream->moveToThread(worker);
 }
 
-/// Returns the statistics for the server.
+/// Accounts for a \a stream leaving its worker thread.
 
-QVariantMap QXmppServer::statistics() const
+void QXmppServerPrivate::releaseWorker(QXmppStream *stream)
 {
-    QVariantMap stats;
-    stats["version"] = qApp->applicationVersion();
-    stats["incoming-clients"] = d->incomingClients.size();
-    stats["incoming-servers"] = d->incomingServers.size();
-    stats["outgoing-servers"] = d->outgoingServers.size();
-    return stats;
+    QHash<QThread*, int>::iterator it = workerLoads.find(streamWorkers.take(stream));
+    if (it != workerLoads.end())
+        it.value()--;
 }
 
-/// Sets the path for additional SSL CA certificates.
+/// Moves a client stream from the busiest worker thread to the least busy
+/// one, if the time they spent handling the data received by their client
+/// streams since the last check differs enough.
 ///
-/// \param path
+/// The stream whose load is closest to half of the difference is moved,
+/// so that the move narrows the gap between the two threads.
 
-void QXmppServer::addCaCertificates(const QString &path)
+void QXmppServerPrivate::rebalanceWorkers()
 {
-    // load certificates
-    if (path.isEmpty()) {
-        d->caCertificates = QList<QSslCertificate>();
-    } else if (QFileInfo(path).isReadable()) {
-        d->caCertificates = QSslCertificate::fromPath(path);
-    } else {
-        d->warning(QString("SSL CA certificates are not readable %1").arg(path));
-        d->caCertificates = QList<QSslCertificate>();
+    QHash<QThread*, qint64> threadLoads;
+    foreach (QThread *thread, workerThreads)
+        threadLoads.insert(thread, 0);
+
+    // the processing time is in microseconds
+    QHash<QXmppIncomingClient*, qint64> processingTimes;
+    QHash<QXmppIncomingClient*, qint64> clientLoads;
+    foreach (QXmppIncomingClient *stream, incomingClients) {
+        QThread *thread = streamWorkers.value(stream);
+        if (!thread)
+            continue;
+        const qint64 time = stream->processingTime();
+        const qint64 load = time - clientProcessingTimes.value(stream, time);
+        processingTimes.insert(stream, time);
+        clientLoads.insert(stream, load);
+        threadLoads[thread] += load;
     }
+    clientProcessingTimes = processingTimes;
+    if (threadLoads.size() < 2)
+        return;
 
-    // reconfigure servers
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
-        server->addCaCertificates(d->caCertificates);
+    QThread *busiest = workerThreads.first();
+    QThread *idlest = workerThreads.first();
+    foreach (QThread *thread, workerThreads) {
+        if (threadLoads.value(thread) > threadLoads.value(busiest))
+            busiest = thread;
+        if (threadLoads.value(thread) < threadLoads.value(idlest))
+            idlest = thread;
+    }
+
+    // ignore differences below a tenth of the interval
+    const qint64 gap = threadLoads.value(busiest) - threadLoads.value(idlest);
+    if (gap * 10 < qint64(workerRebalanceInterval) * 1000)
+        return;
+
+    QXmppIncomingClient *candidate = 0;
+    qint64 distance = 0;
+    QHash<QXmppIncomingClient*, qint64>::const_iterator it;
+    for (it = clientLoads.constBegin(); it != clientLoads.constEnd(); ++it) {
+        if (it.value() <= 0 || it.value() >= gap || streamWorkers.value(it.key()) != busiest)
+            continue;
+        const qint64 offset = qAbs(gap / 2 - it.value());
+        if (!candidate || offset < distance) {
+            candidate = it.key();
+            distance = offset;
+        }
+    }
+    if (!candidate)
+        return;
+
+    workerLoads[busiest]--;
+    workerLoads[idlest]++;
+    streamWorkers.insert(candidate, idlest);
+    candidate->postMoveToThread(idlest);
+    q->updateCounter("worker.migrations");
 }
 
-/// Sets the path for the local SSL certificate.
-///
-/// \param path
+/// Destroys the streams running in worker threads, then stops the threads.
 
-void QXmppServer::setLocalCertificate(const QString &path)
+void QXmppServerPrivate::stopWorkers()
 {
-    // load certificate
-    QSslCertificate certificate;
-    QFile file(path);
-    if (path.isEmpty()) {
-        d->localCertificate = QSslCertificate();
-    } else if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        d->localCertificate = QSslCertificate(file.readAll());
-    } else {
-        d->warning(QString("SSL certificate is not readable %1").arg(path));
-        d->localCertificate = QSslCertificate();
+    if (workerThreads.isEmpty())
+        return;
+
+    // streams in a worker thread are deleted when the thread finishes
+    foreach (QXmppIncomingClient *stream, incomingClients)
+        if (stream->thread() != q->thread())
+            stream->deleteLater();
+    foreach (QXmppIncomingServer *stream, incomingServers)
+        if (stream->thread() != q->thread())
+            stream->deleteLater();
+    foreach (QXmppOutgoingServer *stream, outgoingServers)
+        if (stream->thread() != q->thread())
+            stream->deleteLater();
+
+    foreach (QThread *thread, workerThreads) {
+        thread->quit();
+        thread->wait();
+        delete thread;
     }
+    workerThreads.clear();
+    workerLoads.clear();
+    streamWorkers.clear();
+    clientProcessingTimes.clear();
+    workerRebalanceTimer->stop();
+}
 
-    // reconfigure servers
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
-        server->setLocalCertificate(d->localCertificate);
+/// Updates the gauge for the number of streams whose output queue is full.
+
+void QXmppServerPrivate::updateOutputQueueGauge()
+{
+    int count = 0;
+    foreach (QXmppIncomingClient *stream, incomingClients)
+        if (stream->isOutputQueueFull())
+            count++;
+    foreach (QXmppIncomingServer *stream, incomingServers)
+        if (stream->isOutputQueueFull())
+            count++;
+    foreach (QXmppOutgoingServer *stream, outgoingServers)
+        if (stream->isOutputQueueFull())
+            count++;
+    q->setGauge("stream.output-queue.full", count);
 }
 
-/// Sets the local SSL certificate
+/// Holds back the data written to \a stream until control returns to the
+/// event loop, so that all the stanzas routed to it meanwhile are written
+/// to its socket at once.
 ///
-/// \param certificate
+/// Streams running in another thread already receive the stanzas as a
+/// batch of queued calls, and are left alone.
 
-void QXmppServer::setLocalCertificate(const QSslCertificate &certificate)
+static void corkUntilIdle(QXmppStream *stream)
 {
-    d->localCertificate = certificate;
-
-    // reconfigure servers
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
-        server->setLocalCertificate(d->localCertificate);
+    if (stream->thread() == QThread::currentThread() && !stream->isCorked()) {
+        stream->cork();
+        QMetaObject::invokeMethod(stream, "uncork", Qt::QueuedConnection);
+    }
 }
 
-/// Sets the path for the local SSL private key.
+/// Routes XMPP data to the given recipient.
+///
+/// \param to
+/// \param data
 ///
-/// \param path
 
-void QXmppServer::setPrivateKey(const QString &path)
+bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
 {
-    // load key
-    QSslKey key;
-    QFile file(path);
-    if (path.isEmpty()) {
-        d->privateKey = QSslKey();
-    } else if (file.open(QIODevice::ReadOnly)) {
-        d->privateKey = QSslKey(file.readAll(), QSsl::Rsa);
+    QXMPP_TRACEPOINT2(server__route, data.constData(), data.size());
+
+    // refuse to route packets to empty destination, hosted domains or
+    // their sub-domains
+    const QXmppJid toJid(to);
+    const QString toDomain = toJid.domain();
+    bool isSubdomain = false;
+    QXmppServerDomain *hosted = hostedDomain(toDomain, &isSubdomain);
+    if (to.isEmpty() || (hosted && (isSubdomain || to == toDomain)))
+        return false;
+
+    if (hosted) {
+
+        // deliver to the local clients, then to the other nodes of the
+        // cluster which serve resources of the recipient
+        bool sent = sendToClients(&hosted->clientRoutes, toJid, data);
+        if (!sent || toJid.isBare())
+            sent = cluster->route(toJid, data) || sent;
+
+        // let the extensions take charge of undelivered stanzas
+        if (!sent) {
+            foreach (QXmppServerExtension *extension, extensions) {
+                if (isEnabled(hosted, extension) && extension->handleUndeliveredStanza(to, data))
+                    return true;
+            }
+        }
+        return sent;
+
+    } else if (!serversForServers.isEmpty()) {
+
+        // the stream must be authorized for the sender's domain, which
+        // only needs to be read from the stanza if several are hosted
+        QString fromDomain = domain;
+        if (domains.size() > 1) {
+            const int end = data.indexOf('>');
+            const QByteArray from = QXmppStreamSplitter::attribute(data.left(end), "from");
+            if (!from.isEmpty())
+                fromDomain = QXmppUtils::jidToDomain(QString::fromUtf8(from));
+        }
+
+        // look for the outgoing S2S connection with the smallest backlog,
+        // which may still be connecting in which case the data is queued
+        //
+        // NOTE: the backlog of streams in worker threads cannot be read
+        // safely, so their data is not spread over several connections
+        QList<QXmppOutgoingServer*> links = outgoingServersByDomain.values(toDomain);
+        if (domains.size() > 1) {
+            QMutableListIterator<QXmppOutgoingServer*> it(links);
+            while (it.hasNext())
+                if (it.next()->localDomain() != fromDomain)
+                    it.remove();
+        }
+        QXmppOutgoingServer *existing = 0;
+        bool spread = links.size() < maximumOutgoingServerLinks;
+        foreach (QXmppOutgoingServer *link, links) {
+            if (link->thread() != QThread::currentThread()) {
+                existing = link;
+                spread = false;
+                break;
+            }
+            if (!existing || link->queuedDataSize() < existing->queuedDataSize())
+                existing = link;
+        }
+        if (existing && (!spread || existing->queuedDataSize() < outgoingServerLinkBacklog)) {
+            if (existing->thread() == QThread::currentThread()) {
+                corkUntilIdle(existing);
+                existing->queueData(data);
+            } else {
+                existing->postData(data);
+            }
+            return true;
+        }
+
+        // if we did not find an outgoing server,
+        // we need to establish the S2S connection
+        QXmppOutgoingServer *conn = connectToDomain(toDomain, fromDomain);
+        QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
+        return true;
+
     } else {
-        d->warning(QString("SSL key is not readable %1").arg(path));
-        d->privateKey = QSslKey();
-    }
 
-    // reconfigure servers
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
-        server->setPrivateKey(d->privateKey);
+        // S2S is disabled, failed to route data
+        return false;
+
+    }
 }
 
-/// Sets the local SSL private key.
+/// Sends XMPP data to the local client streams bound to the recipient.
 ///
-/// \param key
+/// \param routes The routing table of the recipient's domain.
+/// \param to
+/// \param data
 
-void QXmppServer::setPrivateKey(const QSslKey &key)
+bool QXmppServerPrivate::sendToClients(QXmppRoutingTable *routes, const QXmppJid &to, const QByteArray &data)
 {
-    d->privateKey = key;
+    if (!routes)
+        return false;
 
-    // reconfigure servers
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
-        server->setPrivateKey(d->privateKey);
+    // look for a client connection
+    QXmppStanzaTrace *trace = QXmppStanzaTrace::current();
+    const qint64 lookupTime = trace ? QXmppStanzaTrace::now() : 0;
+    QList<QXmppIncomingClient*> found;
+    if (to.isBare()) {
+        found = routes->values(to.toString());
+    } else {
+        QXmppIncomingClient *conn = routes->value(to.toString());
+        if (conn)
+            found << conn;
+    }
+    if (trace)
+        trace->addDuration("route", QXmppStanzaTrace::now() - lookupTime);
+
+    // send data, directly if the stream runs in this thread
+    foreach (QXmppStream *conn, found) {
+        if (conn->thread() == QThread::currentThread()) {
+            corkUntilIdle(conn);
+            conn->sendData(data);
+        } else {
+            conn->postData(data);
+        }
+    }
+    return !found.isEmpty();
 }
 
-/// Listen for incoming XMPP client connections.
+/// Announces to the other nodes of the cluster whether the full \a jid is
+/// bound to one of the local client streams.
+
+void QXmppServerPrivate::updateClusterSession(const QString &jid)
+{
+    QXmppRoutingTable *routes = clientRoutes(jid);
+    if (routes && routes->value(jid))
+        cluster->bindSession(jid);
+    else
+        cluster->unbindSession(jid);
+}
+
+/// Returns the host of the connected cluster node serving the fewest
+/// sessions, counting the clients it was sent while draining, or an empty
+/// string if there is none to send clients to.
+
+QString QXmppServerPrivate::redirectHost()
+{
+    QString best;
+    int bestLoad = 0;
+    const QHash<QString, int> counts = cluster->sessionCounts();
+    for (QHash<QString, int>::const_iterator it = counts.constBegin(); it != counts.constEnd(); ++it) {
+        if (!clusterRedirectHosts.contains(it.key()))
+            continue;
+        const int load = it.value() + drainRedirects.value(it.key());
+        if (best.isEmpty() || load < bestLoad) {
+            best = it.key();
+            bestLoad = load;
+        }
+    }
+    if (best.isEmpty())
+        return QString();
+    drainRedirects[best]++;
+    return clusterRedirectHosts.value(best);
+}
+
+/// Opens a new outgoing S2S connection to the given domain, authorized
+/// for the hosted domain \a fromDomain.
 ///
-/// \param address
-/// \param port
+/// The connection is kept until it has been idle for the configured
+/// timeout, unless the domain is one of the preconnected domains.
+///
+/// \param toDomain
+/// \param fromDomain
 
-bool QXmppServer::listenForClients(const QHostAddress &address, quint16 port)
+QXmppOutgoingServer *QXmppServerPrivate::connectToDomain(const QString &toDomain, const QString &fromDomain)
 {
     bool check;
     Q_UNUSED(check);
 
-    if (d->domain.isEmpty()) {
-        d->warning("No domain was specified!");
-        return false;
-    }
-
-    // create new server
-    QXmppSslServer *server = new QXmppSslServer(this);
-    server->addCaCertificates(d->caCertificates);
-    server->setLocalCertificate(d->localCertificate);
-    server->setPrivateKey(d->privateKey);
+    QXmppOutgoingServer *conn = new QXmppOutgoingServer(fromDomain, 0);
+    conn->setLocalStreamKey(dialbackKey(toDomain));
+    conn->moveToThread(q->thread());
+    conn->setParent(q);
+    setupStream(conn);
+    conn->setMaximumQueueSize(outputHighWatermark);
+    if (!preconnectDomains.contains(toDomain))
+        conn->setIdleTimeout(outgoingServerIdleTimeout);
+    conn->setCertificateCacheTimeout(certificateCacheTimeout);
+    conn->setResumptionTimeout(serverStreamResumptionTimeout);
+
+    check = QObject::connect(conn, SIGNAL(disconnected()),
+                             q, SLOT(_q_outgoingServerDisconnected()));
+    Q_ASSERT(check);
 
-    check = connect(server, SIGNAL(newConnection(QSslSocket*)),
-                    this, SLOT(_q_clientConnection(QSslSocket*)));
+    check = QObject::connect(conn, SIGNAL(dialbackResponseReceived(QXmppDialback)),
+                             q, SLOT(_q_dialbackResponseReceived(QXmppDialback)));
     Q_ASSERT(check);
 
-    if (!server->listen(address, port)) {
-        d->warning(QString("Could not start listening for C2S on %1 %2").arg(address.toString(), QString::number(port)));
-        delete server;
-        return false;
-    }
-    d->serversForClients.insert(server);
+    moveToWorker(conn);
 
-    // start extensions
-    d->loadExtensions(this);
-    d->startExtensions();
-    return true;
+    // add stream
+    outgoingServers.insert(conn);
+    outgoingServersByDomain.insert(toDomain, conn);
+    outgoingServerDomains.insert(conn, toDomain);
+    q->setGauge("outgoing-server.count", outgoingServers.size());
+
+    // connect to remote server
+    QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, toDomain));
+    return conn;
 }
 
-/// Closes the server.
-///
+/// Rebuilds the index of the extensions interested in each stanza.
 
-void QXmppServer::close()
+void QXmppServerPrivate::updateStanzaHandlers()
 {
-    // prevent new connections
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers) {
-        server->close();
-        delete server;
+    stanzaHandlers.clear();
+    defaultStanzaHandlers.clear();
+
+    QList<QList<QXmppServerExtension::StanzaFilter> > filters;
+    foreach (QXmppServerExtension *extension, extensions) {
+        filters << extension->stanzaFilters();
+        foreach (const QXmppServerExtension::StanzaFilter &filter, filters.last())
+            stanzaHandlers[filter.tagName()];
     }
-    d->serversForClients.clear();
-    d->serversForServers.clear();
-
-    // stop extensions
-    d->stopExtensions();
 
-    // close XMPP streams
-    foreach (QXmppIncomingClient *stream, d->incomingClients)
-       stream->disconnectFromHost();
-    foreach (QXmppIncomingServer *stream, d->incomingServers)
-       stream->disconnectFromHost();
-    foreach (QXmppOutgoingServer *stream, d->outgoingServers)
-       stream->disconnectFromHost();
+    for (int i = 0; i < extensions.size(); ++i) {
+        QXmppServerExtension *extension = extensions[i];
+        if (filters[i].isEmpty()) {
+            // the extension is offered all stanzas
+            const StanzaHandler handler(extension, QXmppServerExtension::StanzaFilter());
+            defaultStanzaHandlers << handler;
+            QHash<QString, QList<StanzaHandler> >::iterator it;
+            for (it = stanzaHandlers.begin(); it != stanzaHandlers.end(); ++it)
+                it.value() << handler;
+        } else {
+            foreach (const QXmppServerExtension::StanzaFilter &filter, filters[i]) {
+                if (filter.tagName().isEmpty()) {
+                    QHash<QString, QList<StanzaHandler> >::iterator it;
+                    for (it = stanzaHandlers.begin(); it != stanzaHandlers.end(); ++it)
+                        it.value() << StanzaHandler(extension, filter);
+                    defaultStanzaHandlers << StanzaHandler(extension, filter);
+                } else {
+                    stanzaHandlers[filter.tagName()] << StanzaHandler(extension, filter);
+                }
+            }
+        }
+    }
+    updateDomainExtensions();
 }
 
-/// Listen for incoming XMPP server connections.
+/// Offers an incoming \a element to the extensions interested in it.
 ///
-/// \param address
-/// \param port
+/// Returns true if an extension handled the element.
 
-bool QXmppServer::listenForServers(const QHostAddress &address, quint16 port)
+bool QXmppServerPrivate::dispatchStanza(const QDomElement &element)
 {
-    bool check;
-    Q_UNUSED(check);
+    QHash<QString, QList<StanzaHandler> >::const_iterator it = stanzaHandlers.constFind(element.tagName());
+    const QList<StanzaHandler> &handlers = (it != stanzaHandlers.constEnd()) ? it.value() : defaultStanzaHandlers;
+
+    // the stanza is handled by the extensions enabled for the hosted
+    // domain of its recipient, or else of its sender
+    const QXmppServerDomain *hosted = 0;
+    if (restrictedDomainCount) {
+        hosted = hostedDomain(QXmppUtils::jidToDomain(element.attribute("to")));
+        if (!hosted)
+            hosted = hostedDomain(QXmppUtils::jidToDomain(element.attribute("from")));
+    }
 
-    if (d->domain.isEmpty()) {
-        d->warning("No domain was specified!");
-        return false;
+    // an extension with several matching filters is only called once
+    QXmppStanzaTrace *trace = QXmppStanzaTrace::current();
+    QXmppServerExtension *last = 0;
+    foreach (const StanzaHandler &handler, handlers) {
+        if (handler.first == last || !handler.second.matches(element) ||
+            !isEnabled(hosted, handler.first))
+            continue;
+        last = handler.first;
+        const qint64 dispatchTime = trace ? QXmppStanzaTrace::now() : 0;
+        QXMPP_TRACEPOINT1(server__dispatch__start, handler.first->metaObject()->className());
+        const bool handled = handler.first->handleStanza(element);
+        QXMPP_TRACEPOINT2(server__dispatch__done, handler.first->metaObject()->className(), handled);
+        if (trace)
+            trace->addDuration("dispatch." + handler.first->extensionName(), QXmppStanzaTrace::now() - dispatchTime);
+        if (handled)
+            return true;
     }
+    return false;
+}
 
-    // create new server
-    QXmppSslServer *server = new QXmppSslServer(this);
-    server->addCaCertificates(d->caCertificates);
-    server->setLocalCertificate(d->localCertificate);
-    server->setPrivateKey(d->privateKey);
+/// Returns true if the DOM tree of a stanza with the given \a tagName and
+/// recipient \a to is needed, because it is addressed to the server or an
+/// extension may handle it.
 
-    check = connect(server, SIGNAL(newConnection(QSslSocket*)),
-                    this, SLOT(_q_serverConnection(QSslSocket*)));
-    Q_ASSERT(check);
+bool QXmppServerPrivate::needsElement(const QString &tagName, const QString &to) const
+{
+    if (domains.contains(to))
+        return true;
 
-    if (!server->listen(address, port)) {
-        d->warning(QString("Could not start listening for S2S on %1 %2").arg(address.toString(), QString::number(port)));
-        delete server;
-        return false;
+    QHash<QString, QList<StanzaHandler> >::const_iterator it = stanzaHandlers.constFind(tagName);
+    const QList<StanzaHandler> &handlers = (it != stanzaHandlers.constEnd()) ? it.value() : defaultStanzaHandlers;
+    QString toDomain;
+    foreach (const StanzaHandler &handler, handlers) {
+        const QString filterDomain = handler.second.domain();
+        if (filterDomain.isEmpty())
+            return true;
+        if (toDomain.isEmpty())
+            toDomain = QXmppUtils::jidToDomain(to);
+        if (filterDomain == toDomain)
+            return true;
     }
-    d->serversForServers.insert(server);
-
-    // start extensions
-    d->loadExtensions(this);
-    d->startExtensions();
-    return true;
+    return false;
 }
 
-/// Route an XMPP stanza.
+/// Starts tracing a stanza received from a stream which runs in another
+/// thread, and whose trace therefore stopped at the thread boundary.
 ///
-/// \param element
+/// Returns true if a trace was started.
 
-bool QXmppServer::sendElement(const QDomElement &element)
+bool QXmppServerPrivate::startTrace()
 {
-    // serialize data
-    QByteArray data;
-    QXmlStreamWriter xmlStream(&data);
-    const QStringList omitNamespaces = QStringList() << ns_client << ns_server;
-    helperToXmlAddDomElement(&xmlStream, element, omitNamespaces);
+    if (stanzaTraceInterval <= 0 || QXmppStanzaTrace::current())
+        return false;
 
-    // route data
-    return d->routeData(element.attribute("to"), data);
+    const bool sampled = ++stanzaTraceCount >= stanzaTraceInterval;
+    if (sampled)
+        stanzaTraceCount = 0;
+    return QXmppStanzaTrace::start(QXmppStanzaTrace::now(), sampled) != 0;
 }
 
-/// Route an XMPP packet.
+void QXmppServerPrivate::finishTrace()
+{
+    const QString summary = QXmppStanzaTrace::finish();
+    if (!summary.isEmpty() && logger)
+        logger->log(QXmppLogger::DebugMessage, summary);
+}
+
+// Returns the UTF-8 encoding of an attribute value quoted with apostrophes.
+
+static QByteArray attributeValue(const QString &value)
+{
+    QByteArray data = value.toUtf8();
+    data.replace('&', "&amp;");
+    data.replace('<', "&lt;");
+    data.replace('\'', "&apos;");
+    return data;
+}
+
+/// Routes a copy of the stanza \a data serialized by QXmlStreamWriter to
+/// each of the \a recipients, replacing the 'to' attribute in its start
+/// tag for each recipient.
 ///
-/// \param packet
+/// Returns the number of recipients the stanza was routed to.
 
-bool QXmppServer::sendPacket(const QXmppStanza &packet)
+int QXmppServerPrivate::broadcastData(const QByteArray &data, const QSet<QString> &recipients)
 {
-    // serialize data
-    QByteArray data;
-    QXmlStreamWriter xmlStream(&data);
-    packet.toXml(&xmlStream);
+    // attribute values are escaped, so the first '>' ends the start tag
+    int pos = data.indexOf('>');
+    if (pos < 0)
+        return 0;
+    if (pos > 0 && data.at(pos - 1) == '/')
+        pos--;
+    QByteArray head = data.left(pos);
+    const QByteArray tail = data.mid(pos);
+
+    // remove the original recipient, QXmlStreamWriter uses double quotes
+    const int start = head.indexOf(" to=\"");
+    if (start >= 0) {
+        const int end = head.indexOf('"', start + 5);
+        if (end >= 0)
+            head.remove(start, end + 1 - start);
+    }
 
-    // route data
-    return d->routeData(packet.to(), data);
+    int count = 0;
+    foreach (const QString &to, recipients) {
+        const QByteArray value = attributeValue(to);
+
+        QByteArray stanza;
+        stanza.reserve(head.size() + value.size() + tail.size() + 6);
+        stanza += head;
+        stanza += " to='";
+        stanza += value;
+        stanza += '\'';
+        stanza += tail;
+        if (routeData(to, stanza))
+            count++;
+    }
+    return count;
 }
 
-/// Add a new incoming client \a stream.
+/// Answers a service discovery request addressed to a hosted domain with
+/// the cached response.
 ///
-/// This method can be used for instance to implement BOSH support
-/// as a server extension.
+/// Returns true if the element was such a request.
 
-void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
+bool QXmppServerPrivate::handleDiscovery(const QDomElement &element)
 {
-    bool check;
-    Q_UNUSED(check);
+    if (element.tagName() != QLatin1String("iq") ||
+        element.attribute("type") != QLatin1String("get"))
+        return false;
 
-    stream->setPasswordChecker(d->passwordChecker);
+    const QString domain = element.attribute("to");
+    QXmppServerDomain *hosted = domains.value(domain);
+    if (!hosted)
+        return false;
 
-    check = connect(stream, SIGNAL(connected()),
-                    this, SLOT(_q_clientConnected()));
-    Q_ASSERT(check);
+    const QDomElement queryElement = element.firstChildElement("query");
+    if (queryElement.isNull() || queryElement.hasAttribute("node"))
+        return false;
 
-    check = connect(stream, SIGNAL(disconnected()),
-                    this, SLOT(_q_clientDisconnected()));
-    Q_ASSERT(check);
+    const QString xmlns = queryElement.namespaceURI();
+    if (xmlns != ns_disco_info && xmlns != ns_disco_items)
+        return false;
 
-    check = connect(stream, SIGNAL(elementReceived(QDomElement)),
-                    this, SLOT(handleElement(QDomElement)));
-    Q_ASSERT(check);
+    if (hosted->discoveryInfoData.isEmpty())
+        updateDiscovery(domain, hosted);
+    const QByteArray &cached = (xmlns == ns_disco_info) ? hosted->discoveryInfoData : hosted->discoveryItemsData;
 
-    // add stream
-    d->incomingClients.insert(stream);
-    setGauge("incoming-client.count", d->incomingClients.size());
+    // splice the request's id and sender into the cached response
+    const QString to = element.attribute("from");
+    const QByteArray id = attributeValue(element.attribute("id"));
+    const QByteArray recipient = attributeValue(to);
+    QByteArray data;
+    data.reserve(cached.size() + id.size() + recipient.size() + 12);
+    data += "<iq id='";
+    data += id;
+    data += "' to='";
+    data += recipient;
+    data += '\'';
+    data += cached.mid(3);
+    routeData(to, data);
+    return true;
 }
 
-/// Handle a new incoming TCP connection from a client.
-///
-/// \param socket
+/// Builds the service discovery responses of the \a hosted domain from
+/// the features and items of its extensions.
 
-void QXmppServer::_q_clientConnection(QSslSocket *socket)
+void QXmppServerPrivate::updateDiscovery(const QString &domain, QXmppServerDomain *hosted)
 {
-    // check the socket didn't die since the signal was emitted
-    if (socket->state() != QAbstractSocket::ConnectedState) {
-        delete socket;
-        return;
+    QStringList features;
+    features << ns_disco_info << ns_disco_items;
+    QList<QXmppDiscoveryIq::Item> items;
+    foreach (QXmppServerExtension *extension, extensions) {
+        if (!isEnabled(hosted, extension))
+            continue;
+        foreach (const QString &feature, extension->discoveryFeatures()) {
+            if (!features.contains(feature))
+                features << feature;
+        }
+        foreach (const QString &jid, extension->discoveryItems()) {
+            QXmppDiscoveryIq::Item item;
+            item.setJid(jid);
+            items << item;
+        }
     }
 
-    QXmppIncomingClient *stream = new QXmppIncomingClient(socket, d->domain, this);
-    stream->setInactivityTimeout(120);
-    socket->setParent(stream);
-    addIncomingClient(stream);
+    QXmppDiscoveryIq::Identity identity;
+    identity.setCategory("server");
+    identity.setType("im");
+
+    QXmppDiscoveryIq info;
+    info.setType(QXmppIq::Result);
+    info.setId(QString());
+    info.setFrom(domain);
+    info.setQueryType(QXmppDiscoveryIq::InfoQuery);
+    info.setIdentities(QList<QXmppDiscoveryIq::Identity>() << identity);
+    info.setFeatures(features);
+    hosted->discoveryInfoData = helperToXmlData(info);
+
+    QXmppDiscoveryIq itemsIq;
+    itemsIq.setType(QXmppIq::Result);
+    itemsIq.setId(QString());
+    itemsIq.setFrom(domain);
+    itemsIq.setQueryType(QXmppDiscoveryIq::ItemsQuery);
+    itemsIq.setItems(items);
+    hosted->discoveryItemsData = helperToXmlData(itemsIq);
+}
+
+/// Discards the cached service discovery responses.
+
+void QXmppServerPrivate::clearDiscovery()
+{
+    foreach (QXmppServerDomain *hosted, domains) {
+        hosted->discoveryInfoData.clear();
+        hosted->discoveryItemsData.clear();
+    }
+}
+
+/// Handles an incoming XML element which no extension handled.
+///
+/// \param server
+/// \param element
+/// \param hosted Whether the element is addressed to a hosted domain.
+
+static void handleStanza(QXmppServer *server, const QDomElement &element, bool hosted)
+{
+    // default handlers
+    const QString to = element.attribute("to");
+    if (hosted) {
+        if (element.tagName() == QLatin1String("iq")) {
+            // we do not support the given IQ
+            QXmppIq request;
+            request.parse(element);
+
+            if (request.type() != QXmppIq::Error && request.type() != QXmppIq::Result) {
+                QXmppIq response(QXmppIq::Error);
+                response.setId(request.id());
+                response.setFrom(to);
+                response.setTo(request.from());
+                QXmppStanza::Error error(QXmppStanza::Error::Cancel,
+                    QXmppStanza::Error::FeatureNotImplemented);
+                response.setError(error);
+                server->sendPacket(response);
+            }
+        }
+
+    } else {
+
+        // route element or reply on behalf of missing peer
+        if (!server->sendElement(element) && element.tagName() == QLatin1String("iq")) {
+            QXmppIq request;
+            request.parse(element);
+
+            QXmppIq response(QXmppIq::Error);
+            response.setId(request.id());
+            response.setFrom(request.to());
+            response.setTo(request.from());
+            QXmppStanza::Error error(QXmppStanza::Error::Cancel,
+                QXmppStanza::Error::ServiceUnavailable);
+            response.setError(error);
+            server->sendPacket(response);
+        }
+    }
+}
+
+/// Handles an incoming XML element, which was not shed.
+
+void QXmppServerPrivate::handleElement(const QDomElement &element)
+{
+    loadExtensions(q);
+    const bool traced = startTrace();
+    if (!dispatchStanza(element) && !handleDiscovery(element))
+        handleStanza(q, element, domains.contains(element.attribute("to")));
+    if (traced)
+        finishTrace();
+}
+
+void QXmppServerPrivate::info(const QString &message)
+{
+    if (logger)
+        logger->log(QXmppLogger::InformationMessage, message);
+}
+
+void QXmppServerPrivate::warning(const QString &message)
+{
+    if (logger)
+        logger->log(QXmppLogger::WarningMessage, message);
+}
+
+/// Load the server's extensions.
+///
+/// \param server
+
+void QXmppServerPrivate::loadExtensions(QXmppServer *server)
+{
+    if (!loaded) {
+        QObjectList plugins = QPluginLoader::staticInstances();
+        foreach (QObject *object, plugins) {
+            QXmppServerPlugin *plugin = qobject_cast<QXmppServerPlugin*>(object);
+            if (!plugin)
+                continue;
+
+            foreach (const QString &key, plugin->keys())
+                server->addExtension(plugin->create(key));
+        }
+        loaded = true;
+    }
+}
+
+/// Start the server's extensions.
+
+/// Adds an \a extension to the list, which is kept sorted by priority,
+/// and starts it if the other extensions are started.
+
+void QXmppServerPrivate::insertExtension(QXmppServerExtension *extension)
+{
+    int i = 0;
+    while (i < extensions.size() &&
+           extensions[i]->extensionPriority() >= extension->extensionPriority())
+        ++i;
+    extensions.insert(i, extension);
+
+    if (started && !extension->start())
+        warning(QString("Could not start extension %1").arg(extension->extensionName()));
+    updateStanzaHandlers();
+    clearDiscovery();
+}
+
+/// Stops an \a extension if the extensions are started, and removes it
+/// from the list.
+///
+/// The stanza handlers are rebuilt right away. As stanzas are dispatched
+/// in the server's thread, no stanza is dispatched to the other
+/// extensions while this happens.
+
+void QXmppServerPrivate::takeExtension(QXmppServerExtension *extension)
+{
+    if (started)
+        extension->stop();
+    extensions.removeAll(extension);
+    updateStanzaHandlers();
+    clearDiscovery();
+}
+
+/// Creates the extensions of the plugin loaded from \a fileName, and
+/// restores their \a states, by extension name.
+
+QList<QXmppServerExtension*> QXmppServerPrivate::createExtensions(const QString &fileName, const QHash<QString, QByteArray> &states)
+{
+    QList<QXmppServerExtension*> created;
+    QPluginLoader *loader = pluginLoaders.value(fileName);
+    QXmppServerPlugin *plugin = loader ? qobject_cast<QXmppServerPlugin*>(loader->instance()) : 0;
+    if (!plugin) {
+        warning(QString("Could not load plugin %1").arg(fileName));
+        return created;
+    }
+
+    foreach (const QString &key, plugin->keys()) {
+        QXmppServerExtension *extension = plugin->create(key);
+        if (!extension)
+            continue;
+        const QString name = extension->extensionName();
+        if (states.contains(name) && !extension->restoreState(states.value(name)))
+            warning(QString("Could not restore the state of extension %1").arg(name));
+        q->addExtension(extension);
+        pluginExtensions.insert(fileName, extension);
+        created << extension;
+    }
+    return created;
+}
+
+/// Stops and destroys the extensions of the plugin loaded from \a fileName,
+/// after saving their \a states, by extension name.
+
+void QXmppServerPrivate::unloadExtensions(const QString &fileName, QHash<QString, QByteArray> *states)
+{
+    foreach (QXmppServerExtension *extension, pluginExtensions.values(fileName)) {
+        if (states)
+            states->insert(extension->extensionName(), extension->saveState());
+        takeExtension(extension);
+        info(QString("Removed extension %1").arg(extension->extensionName()));
+        delete extension;
+    }
+    pluginExtensions.remove(fileName);
+}
+
+void QXmppServerPrivate::startExtensions()
+{
+    if (!started) {
+        foreach (QXmppServerExtension *extension, extensions)
+            if (!extension->start())
+                warning(QString("Could not start extension %1").arg(extension->extensionName()));
+        started = true;
+        updateStanzaHandlers();
+        clearDiscovery();
+    }
+}
+
+/// Stop the server's extensions (in reverse order).
+///
+
+void QXmppServerPrivate::stopExtensions()
+{
+    if (started) {
+        for (int i = extensions.size() - 1; i >= 0; --i)
+            extensions[i]->stop();
+        started = false;
+    }
+}
+
+/// Constructs a new XMPP server instance.
+///
+/// \param parent
+
+QXmppServer::QXmppServer(QObject *parent)
+    : QXmppLoggable(parent)
+    , d(new QXmppServerPrivate(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    qRegisterMetaType<QDomElement>("QDomElement");
+    qRegisterMetaType<QXmppDialback>("QXmppDialback");
+    qRegisterMetaType<QXmppRawStanza>("QXmppRawStanza");
+    qRegisterMetaType<QXmppCompactStanza>("QXmppCompactStanza");
+
+    d->preconnectTimer = new QTimer(this);
+    d->preconnectTimer->setInterval(60000);
+    check = connect(d->preconnectTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_preconnectDomains()));
+    Q_ASSERT(check);
+
+    d->handoffTimer = new QTimer(this);
+    d->handoffTimer->setInterval(5000);
+    d->handoffTimer->setSingleShot(true);
+    check = connect(d->handoffTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_finishHandoff()));
+    Q_ASSERT(check);
+
+    d->workerRebalanceTimer = new QTimer(this);
+    check = connect(d->workerRebalanceTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_rebalanceWorkers()));
+    Q_ASSERT(check);
+
+    d->cluster = new QXmppCluster(this);
+    check = connect(d->cluster, SIGNAL(stanzaReceived(QString,QByteArray)),
+                    this, SLOT(_q_clusterStanzaReceived(QString,QByteArray)));
+    Q_ASSERT(check);
+
+    d->drainTimer = new QTimer(this);
+    d->drainTimer->setInterval(100);
+    check = connect(d->drainTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_drainClients()));
+    Q_ASSERT(check);
+}
+
+/// Destroys an XMPP server instance.
+///
+
+QXmppServer::~QXmppServer()
+{
+    close();
+    d->stopWorkers();
+    qDeleteAll(d->domains);
+    delete d;
+}
+
+/// Registers a new extension with the server.
+///
+/// \param extension
+
+void QXmppServer::addExtension(QXmppServerExtension *extension)
+{
+    if (!extension || d->extensions.contains(extension))
+        return;
+    d->info(QString("Added extension %1").arg(extension->extensionName()));
+    extension->setParent(this);
+    extension->setServer(this);
+    d->insertExtension(extension);
+}
+
+/// Removes an \a extension from the server, stopping it if needed.
+///
+/// The ownership of the extension is transferred to the caller. The other
+/// extensions and the connected streams are not affected.
+///
+/// \param extension
+
+bool QXmppServer::removeExtension(QXmppServerExtension *extension)
+{
+    if (!extension || !d->extensions.contains(extension))
+        return false;
+    d->takeExtension(extension);
+    QMutableHashIterator<QString, QXmppServerExtension*> it(d->pluginExtensions);
+    while (it.hasNext())
+        if (it.next().value() == extension)
+            it.remove();
+    extension->setParent(0);
+    d->info(QString("Removed extension %1").arg(extension->extensionName()));
+    return true;
+}
+
+/// Replaces an \a extension with a \a replacement, handing over the state
+/// returned by QXmppServerExtension::saveState().
+///
+/// The replaced extension is stopped and destroyed, then the replacement
+/// restores the state and is started. Only the stanza handlers of the
+/// extensions are updated, connected streams are not affected.
+///
+/// \param extension
+/// \param replacement
+
+bool QXmppServer::replaceExtension(QXmppServerExtension *extension, QXmppServerExtension *replacement)
+{
+    if (!replacement || replacement == extension ||
+        d->extensions.contains(replacement) || !removeExtension(extension))
+        return false;
+
+    const QByteArray state = extension->saveState();
+    delete extension;
+    if (!replacement->restoreState(state))
+        d->warning(QString("Could not restore the state of extension %1").arg(replacement->extensionName()));
+    addExtension(replacement);
+    return true;
+}
+
+/// Loads the plugin in \a fileName and adds the extensions it provides.
+///
+/// Returns the extensions which were added.
+///
+/// \param fileName
+
+QList<QXmppServerExtension*> QXmppServer::loadPlugin(const QString &fileName)
+{
+    if (d->pluginLoaders.contains(fileName)) {
+        d->warning(QString("Plugin %1 is already loaded").arg(fileName));
+        return QList<QXmppServerExtension*>();
+    }
+
+    d->pluginLoaders.insert(fileName, new QPluginLoader(fileName, this));
+    const QList<QXmppServerExtension*> created = d->createExtensions(fileName, QHash<QString, QByteArray>());
+    if (created.isEmpty())
+        unloadPlugin(fileName);
+    return created;
+}
+
+/// Removes the extensions of the plugin in \a fileName and unloads it.
+///
+/// \param fileName
+
+bool QXmppServer::unloadPlugin(const QString &fileName)
+{
+    QPluginLoader *loader = d->pluginLoaders.take(fileName);
+    if (!loader)
+        return false;
+
+    d->unloadExtensions(fileName, 0);
+    loader->unload();
+    delete loader;
+    return true;
+}
+
+/// Reloads the plugin in \a fileName, for instance after it was upgraded,
+/// without disconnecting the streams.
+///
+/// Each extension of the plugin hands over its state, see
+/// QXmppServerExtension::saveState(), to the extension of the same name
+/// created by the new version of the plugin.
+///
+/// \param fileName
+
+bool QXmppServer::reloadPlugin(const QString &fileName)
+{
+    QPluginLoader *loader = d->pluginLoaders.value(fileName);
+    if (!loader)
+        return false;
+
+    QHash<QString, QByteArray> states;
+    d->unloadExtensions(fileName, &states);
+    loader->unload();
+    if (d->createExtensions(fileName, states).isEmpty()) {
+        unloadPlugin(fileName);
+        return false;
+    }
+    return true;
+}
+
+/// Returns the list of loaded extensions.
+///
+
+QList<QXmppServerExtension*> QXmppServer::extensions()
+{
+    d->loadExtensions(this);
+    return d->extensions;
+}
+
+/// Returns the server's domain.
+///
+
+QString QXmppServer::domain() const
+{
+    return d->domain;
+}
+
+/// Sets the server's domain.
+///
+/// This is the primary domain, which keeps the clients bound to it and
+/// the settings made for it with setDomainPasswordChecker() and
+/// setDomainExtensions() when it is renamed.
+///
+/// \param domain
+
+void QXmppServer::setDomain(const QString &domain)
+{
+    if (domain == d->domain)
+        return;
+
+    QXmppServerDomain *primary = d->domains.take(d->domain);
+    delete d->domains.take(domain);
+    d->domain = domain;
+    if (!domain.isEmpty())
+        d->domains.insert(domain, primary ? primary : new QXmppServerDomain);
+    else
+        delete primary;
+    d->updateDomains();
+}
+
+/// Returns the domains hosted by the server, including its primary
+/// domain().
+
+QStringList QXmppServer::domains() const
+{
+    return d->domains.keys();
+}
+
+/// Adds a \a domain to the domains hosted by the server.
+///
+/// Each hosted domain and its subdomains have their own clients, and
+/// their stanzas are routed without going through server-to-server
+/// streams. All the domains share the server's listeners, worker threads
+/// and outgoing server streams.
+///
+/// \param domain
+
+void QXmppServer::addDomain(const QString &domain)
+{
+    if (domain.isEmpty() || d->domains.contains(domain))
+        return;
+
+    d->domains.insert(domain, new QXmppServerDomain);
+    d->updateDomains();
+}
+
+/// Removes a \a domain from the domains hosted by the server, and
+/// disconnects the clients bound to it.
+///
+/// The primary domain() cannot be removed.
+///
+/// \param domain
+
+void QXmppServer::removeDomain(const QString &domain)
+{
+    if (domain == d->domain || !d->domains.contains(domain))
+        return;
+
+    delete d->domains.take(domain);
+    d->updateDomains();
+    foreach (QXmppIncomingClient *stream, d->incomingClients) {
+        if (QXmppUtils::jidToDomain(stream->jid()) == domain)
+            QMetaObject::invokeMethod(stream, "disconnectFromHost");
+    }
+}
+
+/// Returns the password checker used to verify the credentials of the
+/// clients of a hosted \a domain, or 0 if it uses the server's
+/// passwordChecker().
+///
+/// \param domain
+
+QXmppPasswordChecker *QXmppServer::domainPasswordChecker(const QString &domain) const
+{
+    QXmppServerDomain *hosted = d->domains.value(domain);
+    return hosted ? hosted->passwordChecker : 0;
+}
+
+/// Sets the password checker used to verify the credentials of the
+/// clients of a hosted \a domain, or 0 to use the server's
+/// passwordChecker().
+///
+/// It applies to the clients which connect afterwards.
+///
+/// \param domain
+/// \param checker
+
+void QXmppServer::setDomainPasswordChecker(const QString &domain, QXmppPasswordChecker *checker)
+{
+    QXmppServerDomain *hosted = d->domains.value(domain);
+    if (!hosted)
+        return;
+
+    hosted->passwordChecker = checker;
+    d->updateDomains();
+}
+
+/// Returns the names of the extensions which handle the stanzas of a
+/// hosted \a domain, or an empty list if all the extensions do.
+///
+/// \param domain
+
+QStringList QXmppServer::domainExtensions(const QString &domain) const
+{
+    QXmppServerDomain *hosted = d->domains.value(domain);
+    return hosted ? hosted->extensionNames : QStringList();
+}
+
+/// Sets the names of the extensions which handle the stanzas of a hosted
+/// \a domain, or an empty list for all the extensions, which is the
+/// default.
+///
+/// A stanza is handled by the extensions of the hosted domain of its
+/// recipient, or else of its sender. The service discovery responses of
+/// the domain only list the features and items of these extensions.
+///
+/// \param domain
+/// \param names
+
+void QXmppServer::setDomainExtensions(const QString &domain, const QStringList &names)
+{
+    QXmppServerDomain *hosted = d->domains.value(domain);
+    if (!hosted)
+        return;
+
+    hosted->extensionNames = names;
+    d->updateDomains();
+}
+
+/// Returns the QXmppLogger associated with the server.
+///
+
+QXmppLogger *QXmppServer::logger()
+{
+    return d->logger;
+}
+
+/// Sets the QXmppLogger associated with the server.
+///
+/// \param logger
+
+void QXmppServer::setLogger(QXmppLogger *logger)
+{
+    if (logger != d->logger) {
+        if (d->logger) {
+            disconnect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+                       d->logger, SLOT(log(QXmppLogger::MessageType,QString)));
+            disconnect(this, SIGNAL(setGauge(QString,double)),
+                       d->logger, SLOT(setGauge(QString,double)));
+            disconnect(this, SIGNAL(updateCounter(QString,qint64)),
+                       d->logger, SLOT(updateCounter(QString,qint64)));
+        }
+
+        d->logger = logger;
+        if (d->logger) {
+            connect(this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+                    d->logger, SLOT(log(QXmppLogger::MessageType,QString)));
+            connect(this, SIGNAL(setGauge(QString,double)),
+                    d->logger, SLOT(setGauge(QString,double)));
+            connect(this, SIGNAL(updateCounter(QString,qint64)),
+                    d->logger, SLOT(updateCounter(QString,qint64)));
+        }
+
+        emit loggerChanged(d->logger);
+    }
+}
+
+/// Returns the password checker used to verify client credentials.
+///
+
+QXmppPasswordChecker *QXmppServer::passwordChecker()
+{
+    return d->passwordChecker;
+}
+
+/// Sets the password checker used to verify client credentials.
+///
+/// \param checker
+///
+
+void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker)
+{
+    d->passwordChecker = checker;
+    d->updateDomains();
+}
+
+/// Returns the maximum size in bytes of a stanza received from a client
+/// or a server, or 0 if there is no limit.
+
+int QXmppServer::maximumStanzaSize() const
+{
+    return d->maximumStanzaSize;
+}
+
+/// Sets the maximum size in bytes of a stanza received from a client
+/// or a server. This applies to streams accepted after the call.
+///
+/// \param size
+///
+/// \sa QXmppStream::setMaximumStanzaSize()
+
+void QXmppServer::setMaximumStanzaSize(int size)
+{
+    d->maximumStanzaSize = size;
+}
+
+/// Returns the maximum amount of data in bytes which is buffered for each
+/// incoming stream, or 0 if there is no limit.
+
+qint64 QXmppServer::maximumBufferSize() const
+{
+    return d->maximumBufferSize;
+}
+
+/// Sets the maximum amount of data in bytes which is buffered for each
+/// incoming stream. This applies to streams accepted after the call.
+///
+/// \param size
+///
+/// \sa QXmppStream::setMaximumBufferSize()
+
+void QXmppServer::setMaximumBufferSize(qint64 size)
+{
+    d->maximumBufferSize = size;
+}
+
+/// Returns the low watermark in bytes for the output queue of each stream.
+
+qint64 QXmppServer::outputLowWatermark() const
+{
+    return d->outputLowWatermark;
+}
+
+/// Returns the high watermark in bytes for the output queue of each stream,
+/// or 0 if output queues are not limited.
+
+qint64 QXmppServer::outputHighWatermark() const
+{
+    return d->outputHighWatermark;
+}
+
+/// Sets the \a low and \a high watermarks in bytes for the output queue of
+/// each stream. This applies to streams created after the call.
+///
+/// The number of streams whose output queue is full is reported by the
+/// "stream.output-queue.full" gauge.
+///
+/// \sa QXmppStream::setOutputWatermarks()
+
+void QXmppServer::setOutputWatermarks(qint64 low, qint64 high)
+{
+    d->outputLowWatermark = low;
+    d->outputHighWatermark = high;
+}
+
+/// Returns what happens to outgoing data once a stream's output queue
+/// is full.
+
+QXmppStream::OutputQueuePolicy QXmppServer::outputQueuePolicy() const
+{
+    return d->outputQueuePolicy;
+}
+
+/// Sets what happens to outgoing data once a stream's output queue is full.
+/// This applies to streams created after the call.
+///
+/// \param policy
+
+void QXmppServer::setOutputQueuePolicy(QXmppStream::OutputQueuePolicy policy)
+{
+    d->outputQueuePolicy = policy;
+}
+
+/// Returns the amount of outgoing data in bytes past which the stanzas of
+/// each stream are scheduled by priority, or 0 if they are written in
+/// order.
+
+qint64 QXmppServer::outputSchedulingWindow() const
+{
+    return d->outputSchedulingWindow;
+}
+
+/// Sets the amount of outgoing data in bytes past which the stanzas of
+/// each stream are scheduled by priority. This applies to streams created
+/// after the call.
+///
+/// \sa QXmppStream::setOutputSchedulingWindow()
+
+void QXmppServer::setOutputSchedulingWindow(qint64 window)
+{
+    d->outputSchedulingWindow = window;
+}
+
+/// Returns true if the presences held back by the output scheduler of a
+/// stream are coalesced.
+
+bool QXmppServer::isOutputPresenceCoalescingEnabled() const
+{
+    return d->outputPresenceCoalescing;
+}
+
+/// Sets whether the presences held back by the output scheduler of a
+/// stream are coalesced. This applies to streams created after the call.
+///
+/// \sa QXmppStream::setOutputPresenceCoalescingEnabled()
+
+void QXmppServer::setOutputPresenceCoalescingEnabled(bool enabled)
+{
+    d->outputPresenceCoalescing = enabled;
+}
+
+/// Returns whether XEP-0138: Stream Compression is offered to clients.
+
+bool QXmppServer::streamCompressionEnabled() const
+{
+    return d->streamCompressionEnabled;
+}
+
+/// Sets whether XEP-0138: Stream Compression is offered to clients.
+/// This applies to clients which connect after the call.
+///
+/// \param enabled
+
+void QXmppServer::setStreamCompressionEnabled(bool enabled)
+{
+    d->streamCompressionEnabled = enabled;
+}
+
+/// Returns the secret used to sign login tokens, or an empty byte array
+/// if login tokens are disabled.
+
+QByteArray QXmppServer::loginTokenSecret() const
+{
+    return d->loginTokens->secret();
+}
+
+/// Sets the \a secret used to sign login tokens, which lets clients
+/// reconnect without their password being checked again.
+///
+/// The server keeps track of the tokens it issued: each token is only
+/// accepted once, and revokeLoginTokens() invalidates the tokens of a user.
+/// Tokens are therefore only valid on the server which issued them, and
+/// changing the secret invalidates all of them.
+///
+/// \param secret
+
+void QXmppServer::setLoginTokenSecret(const QByteArray &secret)
+{
+    d->loginTokens->setSecret(secret);
+}
+
+/// Returns the number of seconds during which a login token is valid.
+
+int QXmppServer::loginTokenLifetime() const
+{
+    return d->loginTokens->lifetime();
+}
+
+/// Sets the number of seconds during which a login token is valid.
+/// The default is one week.
+///
+/// \param secs
+
+void QXmppServer::setLoginTokenLifetime(int secs)
+{
+    d->loginTokens->setLifetime(secs);
+}
+
+/// Revokes the login tokens issued to \a bareJid, for instance when the
+/// user's password changes or their account is deleted.
+///
+/// The sessions which are open are not affected.
+///
+/// \param bareJid
+
+void QXmppServer::revokeLoginTokens(const QString &bareJid)
+{
+    d->loginTokens->revoke(bareJid);
+}
+
+/// Returns the interval at which the traces of received stanzas are
+/// logged, or 0 if stanzas are not traced.
+
+int QXmppServer::stanzaTraceInterval() const
+{
+    return d->stanzaTraceInterval;
+}
+
+/// Sets the interval at which the traces of received stanzas are logged.
+/// This applies to streams accepted after the call.
+///
+/// When non-zero, the time taken by each phase of the handling of every
+/// received stanza is recorded in QXmppMetrics, and reported by
+/// statistics(). In addition to the phases recorded by the streams, the
+/// server records the time spent in each extension's handleStanza() as
+/// "dispatch.<extensionName>", and the time spent looking up the route to
+/// local clients as "route".
+///
+/// Stanzas received by streams running in worker threads are traced from
+/// the time they reach the server's thread.
+///
+/// \param interval
+///
+/// \sa QXmppStream::setStanzaTraceInterval()
+
+void QXmppServer::setStanzaTraceInterval(int interval)
+{
+    d->stanzaTraceInterval = interval;
+    d->stanzaTraceCount = 0;
+    if (interval > 0)
+        QXmppStanzaTrace::setEnabled();
+}
+
+/// Returns the file to which the data received from clients is captured,
+/// or an empty string if it is not captured.
+
+QString QXmppServer::trafficCaptureFile() const
+{
+    return d->trafficCapture ? d->trafficCapture->fileName() : QString();
+}
+
+/// Captures the raw data received from the clients accepted after the call
+/// to \a fileName, with the time it was received, so that it can be
+/// replayed by the qxmppreplay benchmark.
+///
+/// The data is captured as it is read from the socket, after TLS
+/// decryption. Set \a fileName to an empty string to stop capturing.
+///
+/// \note The captured data contains the clients' credentials and messages.
+///
+/// \param fileName
+
+void QXmppServer::setTrafficCaptureFile(const QString &fileName)
+{
+    d->trafficCapture.clear();
+    if (fileName.isEmpty())
+        return;
+
+    QSharedPointer<QXmppTrafficCapture> capture(new QXmppTrafficCapture);
+    if (!capture->open(fileName)) {
+        d->warning(QString("Could not open traffic capture file %1").arg(fileName));
+        return;
+    }
+    d->trafficCapture = capture;
+}
+
+/// Returns whether TLS sessions established with the server can be resumed.
+
+bool QXmppServer::tlsSessionResumptionEnabled() const
+{
+    return d->tlsSessionResumptionEnabled;
+}
+
+/// Sets whether TLS sessions established with the server can be resumed,
+/// using session IDs or tickets, which spares full handshakes when clients
+/// reconnect. This requires Qt 5.4 or later.
+///
+/// \param enabled
+
+void QXmppServer::setTlsSessionResumptionEnabled(bool enabled)
+{
+    d->tlsSessionResumptionEnabled = enabled;
+
+    // reconfigure servers
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+        server->setSessionResumptionEnabled(enabled);
+}
+
+/// Returns the ciphers offered to incoming TLS connections, or an empty
+/// list if Qt's default ciphers are used.
+
+QList<QSslCipher> QXmppServer::tlsCiphers() const
+{
+    return d->tlsCiphers;
+}
+
+/// Sets the ciphers offered to incoming TLS connections, in order of
+/// preference.
+///
+/// Encryption can take most of a busy server's time, so
+/// QXmppSslServer::efficientCiphers() is a good choice. Set an empty
+/// list to use Qt's default ciphers, which is the default.
+///
+/// \param ciphers
+
+void QXmppServer::setTlsCiphers(const QList<QSslCipher> &ciphers)
+{
+    d->tlsCiphers = ciphers;
+
+    // reconfigure servers
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+        server->setCiphers(ciphers);
+}
+
+/// Returns the maximum number of incoming connections whose TLS handshake
+/// may be in progress at the same time, or 0 if it is not limited.
+
+int QXmppServer::maximumHandshakes() const
+{
+    return d->maximumHandshakes;
+}
+
+/// Sets the maximum number of incoming connections whose TLS handshake
+/// may be in progress at the same time.
+///
+/// Once the limit is reached, further connections wait in a queue, so
+/// that a wave of reconnecting clients does not starve the streams which
+/// are already established. The default of 0 disables the limit.
+///
+/// \param count
+
+void QXmppServer::setMaximumHandshakes(int count)
+{
+    d->maximumHandshakes = qMax(0, count);
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+        server->setMaximumHandshakes(d->maximumHandshakes);
+}
+
+/// Returns the maximum number of incoming connections admitted per second,
+/// or 0 if it is not limited.
+
+int QXmppServer::connectionAdmissionRate() const
+{
+    return d->connectionAdmissionRate;
+}
+
+/// Sets the maximum number of incoming connections admitted per second.
+///
+/// Connections above this rate wait in a queue. The default of 0 disables
+/// the limit.
+///
+/// \param connectionsPerSecond
+
+void QXmppServer::setConnectionAdmissionRate(int connectionsPerSecond)
+{
+    d->connectionAdmissionRate = qMax(0, connectionsPerSecond);
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+        server->setAdmissionRate(d->connectionAdmissionRate);
+}
+
+/// Returns the number of seconds during which a client session can be
+/// resumed after its stream was lost, or 0 if resumption is disabled.
+
+int QXmppServer::streamResumptionTimeout() const
+{
+    return d->streamResumptionTimeout;
+}
+
+/// Sets the number of seconds during which a client session can be
+/// resumed as defined by XEP-0198: Stream Management, after its stream
+/// was lost.
+///
+/// A resumed session keeps its full JID and receives the stanzas it
+/// missed, without authenticating, binding or broadcasting presence
+/// again. Set \a secs to 0 to disable resumption, which is the default.
+///
+/// \param secs
+
+void QXmppServer::setStreamResumptionTimeout(int secs)
+{
+    d->streamResumptionTimeout = qMax(0, secs);
+}
+
+/// Returns the number of seconds during which a server-to-server session
+/// can be resumed after its stream was lost, or 0 if stream management is
+/// not used with other servers.
+
+int QXmppServer::serverStreamResumptionTimeout() const
+{
+    return d->serverStreamResumptionTimeout;
+}
+
+/// Sets the number of seconds during which a server-to-server session can
+/// be resumed as defined by XEP-0198: Stream Management, after its stream
+/// was lost.
+///
+/// Stream management is then offered on the incoming server streams and
+/// used on the outgoing ones if the remote server offers it. The stanzas
+/// sent to a remote server are kept until it acknowledges them, and when
+/// a link is lost it is reconnected and resumed, so that only the stanzas
+/// which were not acknowledged are sent again. Set \a secs to 0 to disable
+/// stream management with other servers, which is the default.
+///
+/// The setting applies to the streams opened afterwards.
+///
+/// \param secs
+
+void QXmppServer::setServerStreamResumptionTimeout(int secs)
+{
+    d->serverStreamResumptionTimeout = qMax(0, secs);
+}
+
+/// Returns true if the stanzas received on incoming server-to-server
+/// streams are parsed by a pool of worker threads.
+
+bool QXmppServer::isServerStreamPipeliningEnabled() const
+{
+    return d->serverStreamPipelining;
+}
+
+/// Sets whether the stanzas received on incoming server-to-server streams
+/// are parsed by a pool of worker threads, so that a single busy link
+/// from another server is not limited by one CPU core.
+///
+/// The stream's thread then only delimits the stanzas, and they are
+/// still handled in the order they were received, see
+/// QXmppStream::setPipelinedParsingEnabled(). The default is false.
+///
+/// The setting applies to the streams opened afterwards.
+///
+/// \param enabled
+
+void QXmppServer::setServerStreamPipeliningEnabled(bool enabled)
+{
+    d->serverStreamPipelining = enabled;
+}
+
+/// Returns the number of worker threads which run the server's streams,
+/// or 0 if the streams run in the server's thread.
+
+int QXmppServer::workerThreadCount() const
+{
+    return d->workerThreadCount;
+}
+
+/// Sets the number of worker threads which run the server's streams.
+///
+/// Each new stream accepted or opened by the server is assigned to the
+/// worker thread with the fewest streams, where its TLS, parsing and
+/// serialization take place. Routing and extensions still run in the
+/// server's thread. Set \a count to 0 to run all the streams in the
+/// server's thread, which is the default.
+///
+/// This should be called before the server starts listening. Note that
+/// the password checker is then called from the worker threads.
+///
+/// \param count
+
+void QXmppServer::setWorkerThreadCount(int count)
+{
+    d->workerThreadCount = qMax(0, count);
+}
+
+/// Returns the event dispatcher used by the worker threads.
+
+QXmppServer::EventDispatcher QXmppServer::workerEventDispatcher() const
+{
+    return d->workerEventDispatcher;
+}
+
+/// Sets the event dispatcher used by the worker threads.
+///
+/// With many connections per worker thread, Qt's default dispatcher
+/// spends most of its time polling idle sockets, as it hands all of
+/// them to the kernel each time it waits. EpollEventDispatcher only
+/// registers each socket once and is woken up for the ready ones. It
+/// requires Qt 5 on Linux, elsewhere Qt's dispatcher is used.
+///
+/// This should be called before the server starts listening. The default
+/// is QtEventDispatcher.
+///
+/// \param dispatcher
+
+void QXmppServer::setWorkerEventDispatcher(EventDispatcher dispatcher)
+{
+    d->workerEventDispatcher = dispatcher;
+}
+
+/// Returns the interval in milliseconds at which the load of the worker
+/// threads is compared, or 0 if client streams stay in the worker thread
+/// they were first assigned to.
+
+int QXmppServer::workerRebalanceInterval() const
+{
+    return d->workerRebalanceInterval;
+}
+
+/// Sets the interval in milliseconds at which the load of the worker
+/// threads is compared.
+///
+/// A few very active clients, such as bots or gateways, can keep their
+/// worker thread busy while the others are idle. At each interval, the
+/// time each worker thread spent handling the data received by its
+/// client streams is compared, and if the busiest thread spent over a
+/// tenth of the interval more than the least busy one, a client stream
+/// is moved between them. The stream moves between two stanzas, with its
+/// socket, parser state and timers, and the data routed to it meanwhile
+/// is sent in order.
+///
+/// Set \a msecs to 0 to disable moving streams, which is the default.
+///
+/// \param msecs
+
+void QXmppServer::setWorkerRebalanceInterval(int msecs)
+{
+    d->workerRebalanceInterval = qMax(0, msecs);
+    if (d->workerRebalanceInterval > 0) {
+        d->workerRebalanceTimer->setInterval(d->workerRebalanceInterval);
+        if (!d->workerThreads.isEmpty())
+            d->workerRebalanceTimer->start();
+    } else {
+        d->workerRebalanceTimer->stop();
+        d->clientProcessingTimes.clear();
+    }
+}
+
+/// Returns the maximum number of outgoing server streams opened to a
+/// single remote domain.
+
+int QXmppServer::maximumOutgoingServerLinks() const
+{
+    return d->maximumOutgoingServerLinks;
+}
+
+/// Returns the backlog in bytes above which another outgoing server
+/// stream is opened to a remote domain.
+
+qint64 QXmppServer::outgoingServerLinkBacklog() const
+{
+    return d->outgoingServerLinkBacklog;
+}
+
+/// Sets how many outgoing server streams may be opened to a single
+/// remote domain.
+///
+/// Stanzas for a remote domain go to the stream with the smallest
+/// backlog. Once all the streams have a backlog of at least \a backlog
+/// bytes, another stream is opened, up to \a maximum streams. The
+/// default is a single stream per domain.
+///
+/// \param maximum
+/// \param backlog
+
+void QXmppServer::setOutgoingServerLinks(int maximum, qint64 backlog)
+{
+    d->maximumOutgoingServerLinks = qMax(1, maximum);
+    d->outgoingServerLinkBacklog = backlog;
+}
+
+/// Returns the time in milliseconds after which an idle outgoing server
+/// stream is closed, or 0 if it is kept until the remote server closes it.
+
+int QXmppServer::outgoingServerIdleTimeout() const
+{
+    return d->outgoingServerIdleTimeout;
+}
+
+/// Sets the time in milliseconds after which an idle outgoing server
+/// stream is closed.
+///
+/// Keeping streams open lets later stanzas to the same domain skip the
+/// DNS lookup, TLS handshake and dialback. The default of 0 keeps streams
+/// open until the remote server closes them.
+///
+/// \param msecs
+
+void QXmppServer::setOutgoingServerIdleTimeout(int msecs)
+{
+    d->outgoingServerIdleTimeout = qMax(0, msecs);
+}
+
+/// Returns the time in seconds for which the certificates of remote
+/// servers which passed verification are remembered, or 0 if they are not.
+
+int QXmppServer::certificateCacheTimeout() const
+{
+    return d->certificateCacheTimeout;
+}
+
+/// Sets the time in seconds for which the certificates of remote servers
+/// which passed verification are remembered.
+///
+/// The outgoing server streams opened to a domain meanwhile skip the
+/// verification of the certificate chain if the remote server presents
+/// the same certificate. The entries never outlive their certificate.
+/// Incoming server streams are authenticated using dialback, and are not
+/// concerned.
+///
+/// Set \a secs to 0 to verify each certificate, which is the default.
+
+void QXmppServer::setCertificateCacheTimeout(int secs)
+{
+    d->certificateCacheTimeout = qMax(0, secs);
+}
+
+/// Returns the remote domains to which outgoing server streams are
+/// opened in advance.
+
+QStringList QXmppServer::preconnectDomains() const
+{
+    return d->preconnectDomains;
+}
+
+/// Sets the remote domains to which outgoing server streams are opened
+/// in advance.
+///
+/// Once the server listens for servers, it opens a stream to each of
+/// these domains, and reopens it whenever it is lost. These streams are
+/// never closed for being idle.
+///
+/// \param domains
+
+void QXmppServer::setPreconnectDomains(const QStringList &domains)
+{
+    d->preconnectDomains = domains;
+    if (!d->serversForServers.isEmpty())
+        _q_preconnectDomains();
+}
+
+/// Returns the time in seconds during which dialback keys are reused and
+/// remembered once verified.
+
+int QXmppServer::dialbackCacheTimeout() const
+{
+    return d->dialbackCacheTimeout;
+}
+
+/// Sets the time in seconds during which dialback keys are reused and
+/// remembered once verified.
+///
+/// The outgoing streams opened to a domain within this time share their
+/// dialback key, and a key received from a remote domain is only verified
+/// once within this time, even if several streams present it at once.
+/// The default is 60 seconds, and 0 verifies every key.
+///
+/// \param secs
+
+void QXmppServer::setDialbackCacheTimeout(int secs)
+{
+    d->dialbackCacheTimeout = qMax(0, secs);
+    d->dialbackKeys.clear();
+    d->verifiedKeys.clear();
+}
+
+/// Returns the maximum rate of incoming data for each incoming stream in
+/// bytes per second, or 0 if it is not limited.
+
+qint64 QXmppServer::connectionByteRate() const
+{
+    return d->connectionByteRate;
+}
+
+/// Returns the maximum rate of incoming stanzas for each incoming stream,
+/// or 0 if it is not limited.
+
+int QXmppServer::connectionStanzaRate() const
+{
+    return d->connectionStanzaRate;
+}
+
+/// Sets the maximum rates of incoming data for each incoming stream, from
+/// clients and servers alike.
+///
+/// Once a stream exceeds one of the rates, the server stops reading from
+/// its socket until the stream is back within the limits. The limits can
+/// be changed at any time, and a rate of 0, the default, disables the
+/// corresponding limit.
+///
+/// \param bytesPerSecond
+/// \param stanzasPerSecond
+
+void QXmppServer::setConnectionRateLimit(qint64 bytesPerSecond, int stanzasPerSecond)
+{
+    d->connectionByteRate = qMax(qint64(0), bytesPerSecond);
+    d->connectionStanzaRate = qMax(0, stanzasPerSecond);
+    foreach (QXmppIncomingClient *stream, d->incomingClients)
+        d->updateConnectionLimiter(stream);
+    foreach (QXmppIncomingServer *stream, d->incomingServers)
+        d->updateConnectionLimiter(stream);
+    d->updateLimiterGauges();
+}
+
+/// Returns the maximum rate of incoming data for all the streams of a
+/// user in bytes per second, or 0 if it is not limited.
+
+qint64 QXmppServer::userByteRate() const
+{
+    return d->userByteRate;
+}
+
+/// Returns the maximum rate of incoming stanzas for all the streams of a
+/// user, or 0 if it is not limited.
+
+int QXmppServer::userStanzaRate() const
+{
+    return d->userStanzaRate;
+}
+
+/// Sets the maximum rates of incoming data for all the streams of a user,
+/// that is of a bare JID.
+///
+/// The limits can be changed at any time, and a rate of 0, the default,
+/// disables the corresponding limit.
+///
+/// \param bytesPerSecond
+/// \param stanzasPerSecond
+
+void QXmppServer::setUserRateLimit(qint64 bytesPerSecond, int stanzasPerSecond)
+{
+    d->userByteRate = qMax(qint64(0), bytesPerSecond);
+    d->userStanzaRate = qMax(0, stanzasPerSecond);
+    foreach (QXmppIncomingClient *stream, d->incomingClients) {
+        const QString bareJid = QXmppUtils::jidToBareJid(stream->jid());
+        if (bareJid.isEmpty())
+            continue;
+        QSharedPointer<QXmppRateLimiter> limiter = d->userLimiters.value(bareJid).toStrongRef();
+        if (limiter)
+            limiter->setRates(d->userByteRate, d->userStanzaRate);
+        if (d->userByteRate || d->userStanzaRate)
+            d->attachLimiter(stream, d->userLimiters, bareJid, d->userByteRate, d->userStanzaRate);
+        else
+            d->detachLimiter(stream, d->userLimiters, bareJid);
+    }
+    d->updateLimiterGauges();
+}
+
+/// Returns the maximum rate of incoming data for all the streams of a
+/// remote domain in bytes per second, or 0 if it is not limited.
+
+qint64 QXmppServer::domainByteRate() const
+{
+    return d->domainByteRate;
+}
+
+/// Returns the maximum rate of incoming stanzas for all the streams of a
+/// remote domain, or 0 if it is not limited.
+
+int QXmppServer::domainStanzaRate() const
+{
+    return d->domainStanzaRate;
+}
+
+/// Sets the maximum rates of incoming data for all the streams of a
+/// remote domain, once it has been verified.
+///
+/// The limits can be changed at any time, and a rate of 0, the default,
+/// disables the corresponding limit.
+///
+/// \param bytesPerSecond
+/// \param stanzasPerSecond
+
+void QXmppServer::setDomainRateLimit(qint64 bytesPerSecond, int stanzasPerSecond)
+{
+    d->domainByteRate = qMax(qint64(0), bytesPerSecond);
+    d->domainStanzaRate = qMax(0, stanzasPerSecond);
+    QHash<QXmppIncomingServer*, QStringList>::const_iterator it;
+    for (it = d->verifiedDomains.constBegin(); it != d->verifiedDomains.constEnd(); ++it) {
+        foreach (const QString &domain, it.value()) {
+            QSharedPointer<QXmppRateLimiter> limiter = d->domainLimiters.value(domain).toStrongRef();
+            if (limiter)
+                limiter->setRates(d->domainByteRate, d->domainStanzaRate);
+            if (d->domainByteRate || d->domainStanzaRate)
+                d->attachLimiter(it.key(), d->domainLimiters, domain, d->domainByteRate, d->domainStanzaRate);
+            else
+                d->detachLimiter(it.key(), d->domainLimiters, domain);
+        }
+    }
+    d->updateLimiterGauges();
+}
+
+/// Returns the rate of incoming stanzas above which the server is
+/// overloaded, or 0 if overload detection is disabled.
+
+int QXmppServer::overloadStanzaRate() const
+{
+    return d->overloadStanzaRate;
+}
+
+/// Sets the rate of incoming stanzas above which the server is overloaded.
+///
+/// While the server is overloaded, it drops the incoming presences, other
+/// than unavailable ones, so that it keeps up with messages and IQs. The
+/// "server.overloaded" gauge tells whether this is the case. The default
+/// of 0 disables overload detection.
+///
+/// \param stanzasPerSecond
+
+void QXmppServer::setOverloadStanzaRate(int stanzasPerSecond)
+{
+    d->overloadStanzaRate = qMax(0, stanzasPerSecond);
+    d->overloadLimiter.setRates(0, d->overloadStanzaRate);
+    if (d->overloaded) {
+        d->overloaded = false;
+        setGauge("server.overloaded", 0);
+    }
+}
+
+/// Returns the name of this node within its cluster.
+
+QString QXmppServer::clusterNodeName() const
+{
+    return d->cluster->nodeName();
+}
+
+/// Sets the name of this node within its cluster.
+///
+/// Several servers can serve the same domain as the nodes of a cluster,
+/// each node being known to the others by a unique name. Stanzas for the
+/// clients of another node are forwarded to it over a persistent link.
+///
+/// \param name
+
+void QXmppServer::setClusterNodeName(const QString &name)
+{
+    d->cluster->setNodeName(name);
+}
+
+/// Sets the secret shared by the nodes of the cluster, which they use to
+/// authenticate each other.
+///
+/// \param secret
+
+void QXmppServer::setClusterSecret(const QString &secret)
+{
+    d->cluster->setSecret(secret);
+}
+
+/// Adds another node of the cluster, which listens for links from the
+/// other nodes on the given \a host and \a port.
+///
+/// Every node should be added on all the other nodes. Of any two nodes,
+/// the one whose name sorts first opens the link between them, and
+/// reopens it whenever it is lost.
+///
+/// \param name
+/// \param host
+/// \param port
+
+void QXmppServer::addClusterNode(const QString &name, const QString &host, quint16 port)
+{
+    d->cluster->addNode(name, host, port);
+}
+
+/// Sets the \a host which clients are sent to when they are moved to the
+/// node called \a name, see drainClients().
+///
+/// The host is given to the clients in a see-other-host stream error, it
+/// may include a port, for instance "node2.example.com:5222".
+///
+/// \param name
+/// \param host
+
+void QXmppServer::setClusterNodeRedirectHost(const QString &name, const QString &host)
+{
+    if (host.isEmpty())
+        d->clusterRedirectHosts.remove(name);
+    else
+        d->clusterRedirectHosts.insert(name, host);
+}
+
+/// Returns the number of client streams closed per second when draining.
+
+int QXmppServer::drainRate() const
+{
+    return d->drainRate;
+}
+
+/// Sets the number of client streams closed per second when draining, so
+/// that the clients do not all reconnect at once.
+///
+/// The default is 100.
+///
+/// \param streamsPerSecond
+
+void QXmppServer::setDrainRate(int streamsPerSecond)
+{
+    d->drainRate = qMax(1, streamsPerSecond);
+}
+
+/// Returns the statistics for the server, along with the metrics of the
+/// process recorded by QXmppMetrics.
+
+QVariantMap QXmppServer::statistics() const
+{
+    QVariantMap stats = QXmppMetrics::snapshot();
+    stats["version"] = qApp->applicationVersion();
+    stats["incoming-clients"] = d->incomingClients.size();
+    stats["incoming-servers"] = d->incomingServers.size();
+    stats["outgoing-servers"] = d->outgoingServers.size();
+
+    int queuedConnections = 0;
+    int handshakes = 0;
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers) {
+        queuedConnections += server->queuedConnectionCount();
+        handshakes += server->handshakeCount();
+    }
+    stats["queued-connections"] = queuedConnections;
+    stats["handshakes"] = handshakes;
+
+    qint64 outputQueueSize = 0;
+    foreach (QXmppIncomingClient *stream, d->incomingClients)
+        outputQueueSize += stream->outputQueueSize();
+    foreach (QXmppIncomingServer *stream, d->incomingServers)
+        outputQueueSize += stream->outputQueueSize();
+    foreach (QXmppOutgoingServer *stream, d->outgoingServers)
+        outputQueueSize += stream->outputQueueSize();
+    stats["output-queue-bytes"] = outputQueueSize;
+    return stats;
+}
+
+namespace
+{
+    // Orders stream statistics by decreasing value of a key.
+    class QXmppStatisticsGreaterThan
+    {
+    public:
+        QXmppStatisticsGreaterThan(const QString &key)
+            : m_key(key)
+        {
+        }
+
+        bool operator()(const QVariantMap &s1, const QVariantMap &s2) const
+        {
+            return s1.value(m_key).toDouble() > s2.value(m_key).toDouble();
+        }
+
+    private:
+        QString m_key;
+    };
+}
+
+/// Returns the traffic and resource usage of the server's streams, as
+/// given by QXmppStream::statistics(), heaviest first.
+///
+/// The entries also contain the "type" of the stream, which is one of
+/// "incoming-client", "incoming-server" or "outgoing-server", and the
+/// "peer" for client streams and outgoing server streams.
+///
+/// \param count the maximum number of streams to return, or 0 for all
+/// \param key the statistic by which to order the streams
+
+QList<QVariantMap> QXmppServer::streamStatistics(int count, const QString &key) const
+{
+    QList<QVariantMap> streams;
+    foreach (QXmppIncomingClient *stream, d->incomingClients) {
+        QVariantMap stats = stream->statistics();
+        stats["type"] = QLatin1String("incoming-client");
+        const QString jid = stream->jid();
+        if (!jid.isEmpty())
+            stats["peer"] = jid;
+        streams << stats;
+    }
+    foreach (QXmppIncomingServer *stream, d->incomingServers) {
+        QVariantMap stats = stream->statistics();
+        stats["type"] = QLatin1String("incoming-server");
+        streams << stats;
+    }
+    foreach (QXmppOutgoingServer *stream, d->outgoingServers) {
+        QVariantMap stats = stream->statistics();
+        stats["type"] = QLatin1String("outgoing-server");
+        stats["peer"] = stream->remoteDomain();
+        streams << stats;
+    }
+
+    qStableSort(streams.begin(), streams.end(), QXmppStatisticsGreaterThan(key));
+    if (count > 0 && streams.size() > count)
+        streams = streams.mid(0, count);
+    return streams;
+}
+
+/// Sets the path for additional SSL CA certificates.
+///
+/// \param path
+
+void QXmppServer::addCaCertificates(const QString &path)
+{
+    // load certificates
+    if (path.isEmpty()) {
+        d->caCertificates = QList<QSslCertificate>();
+    } else if (QFileInfo(path).isReadable()) {
+        d->caCertificates = QSslCertificate::fromPath(path);
+    } else {
+        d->warning(QString("SSL CA certificates are not readable %1").arg(path));
+        d->caCertificates = QList<QSslCertificate>();
+    }
+
+    // reconfigure servers
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+        server->addCaCertificates(d->caCertificates);
+}
+
+/// Sets the path for the local SSL certificate.
+///
+/// \param path
+
+void QXmppServer::setLocalCertificate(const QString &path)
+{
+    // load certificate
+    QSslCertificate certificate;
+    QFile file(path);
+    if (path.isEmpty()) {
+        d->localCertificate = QSslCertificate();
+    } else if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        d->localCertificate = QSslCertificate(file.readAll());
+    } else {
+        d->warning(QString("SSL certificate is not readable %1").arg(path));
+        d->localCertificate = QSslCertificate();
+    }
+
+    // reconfigure servers
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+        server->setLocalCertificate(d->localCertificate);
+}
+
+/// Sets the local SSL certificate
+///
+/// \param certificate
+
+void QXmppServer::setLocalCertificate(const QSslCertificate &certificate)
+{
+    d->localCertificate = certificate;
+
+    // reconfigure servers
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+        server->setLocalCertificate(d->localCertificate);
+}
+
+/// Sets the path for the local SSL private key.
+///
+/// \param path
+
+void QXmppServer::setPrivateKey(const QString &path)
+{
+    // load key
+    QSslKey key;
+    QFile file(path);
+    if (path.isEmpty()) {
+        d->privateKey = QSslKey();
+    } else if (file.open(QIODevice::ReadOnly)) {
+        d->privateKey = QSslKey(file.readAll(), QSsl::Rsa);
+    } else {
+        d->warning(QString("SSL key is not readable %1").arg(path));
+        d->privateKey = QSslKey();
+    }
+
+    // reconfigure servers
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+        server->setPrivateKey(d->privateKey);
+}
+
+/// Sets the local SSL private key.
+///
+/// \param key
+
+void QXmppServer::setPrivateKey(const QSslKey &key)
+{
+    d->privateKey = key;
+
+    // reconfigure servers
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+        server->setPrivateKey(d->privateKey);
+}
+
+/// Listen for incoming XMPP client connections.
+///
+/// \param address
+/// \param port
+
+bool QXmppServer::listenForClients(const QHostAddress &address, quint16 port)
+{
+    if (d->domain.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    // create new server
+    QXmppSslServer *server = d->createListener("clients");
+    if (!server->listen(address, port)) {
+        d->warning(QString("Could not start listening for C2S on %1 %2").arg(address.toString(), QString::number(port)));
+        delete server;
+        return false;
+    }
+    d->addListener(server, "clients");
+
+    // start extensions
+    d->loadExtensions(this);
+    d->startExtensions();
+    return true;
+}
+
+/// Listen for incoming XMPP client connections on a local socket, for
+/// instance a Unix domain socket.
+///
+/// Streams on local sockets are not encrypted.
+///
+/// \param name The name of the local socket, see QLocalServer::listen().
+
+bool QXmppServer::listenForLocalClients(const QString &name)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->domain.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    // create new server
+    QLocalServer *server = new QLocalServer(this);
+
+    check = connect(server, SIGNAL(newConnection()),
+                    this, SLOT(_q_localClientConnection()));
+    Q_ASSERT(check);
+
+    if (!server->listen(name)) {
+        d->warning(QString("Could not start listening for C2S on %1").arg(name));
+        delete server;
+        return false;
+    }
+    d->localServersForClients.insert(server);
+
+    // start extensions
+    d->loadExtensions(this);
+    d->startExtensions();
+    return true;
+}
+
+/// Listen for incoming XMPP client connections over BOSH, as defined by
+/// XEP-0124: Bidirectional-streams Over Synchronous HTTP and XEP-0206:
+/// XMPP Over BOSH.
+///
+/// Requests are accepted on any path. If a local certificate and private
+/// key are set, the connections are encrypted from the start (https://).
+///
+/// Each session may hold up to two requests open, so that clients can
+/// pipeline their requests. The streams of BOSH sessions are handled in
+/// the server's thread rather than by worker threads.
+///
+/// \param address
+/// \param port
+
+bool QXmppServer::listenForBoshClients(const QHostAddress &address, quint16 port)
+{
+    if (d->domain.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    // create new server
+    QXmppSslServer *server = d->createListener("bosh");
+    if (!server->listen(address, port)) {
+        d->warning(QString("Could not start listening for BOSH C2S on %1 %2").arg(address.toString(), QString::number(port)));
+        delete server;
+        return false;
+    }
+    d->addListener(server, "bosh");
+
+    // start extensions
+    d->loadExtensions(this);
+    d->startExtensions();
+    return true;
+}
+
+/// Listen for incoming XMPP client connections over WebSocket, as defined
+/// by RFC 7395: XMPP Subprotocol for WebSocket.
+///
+/// If a local certificate and private key are set, the connections are
+/// encrypted from the start (wss://). Messages are compressed if the
+/// client offers the permessage-deflate extension.
+///
+/// \param address
+/// \param port
+
+bool QXmppServer::listenForWebSocketClients(const QHostAddress &address, quint16 port)
+{
+    if (d->domain.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    // create new server
+    QXmppSslServer *server = d->createListener("websocket");
+    if (!server->listen(address, port)) {
+        d->warning(QString("Could not start listening for WebSocket C2S on %1 %2").arg(address.toString(), QString::number(port)));
+        delete server;
+        return false;
+    }
+    d->addListener(server, "websocket");
+
+    // start extensions
+    d->loadExtensions(this);
+    d->startExtensions();
+    return true;
+}
+
+/// Closes the server.
+///
+
+void QXmppServer::close()
+{
+    // prevent new connections
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers) {
+        server->close();
+        delete server;
+    }
+    d->serversForClients.clear();
+    d->serversForServers.clear();
+    d->listenerKinds.clear();
+    d->preconnectTimer->stop();
+    d->drainTimer->stop();
+    foreach (QLocalServer *server, d->localServersForClients) {
+        server->close();
+        delete server;
+    }
+    d->localServersForClients.clear();
+    d->cluster->close();
+
+    // stop extensions
+    d->stopExtensions();
+
+    // close XMPP streams
+    foreach (QXmppIncomingClient *stream, d->incomingClients)
+       QMetaObject::invokeMethod(stream, "disconnectFromHost");
+    foreach (QXmppIncomingServer *stream, d->incomingServers)
+       QMetaObject::invokeMethod(stream, "disconnectFromHost");
+    foreach (QXmppOutgoingServer *stream, d->outgoingServers)
+       QMetaObject::invokeMethod(stream, "disconnectFromHost");
+}
+
+/// Moves \a count client streams away from this server, or all of them if
+/// \a count is negative, for instance before shutting it down.
+///
+/// The streams are closed at the rate set by setDrainRate(). Each client is
+/// sent to the connected cluster node serving the fewest sessions with a
+/// see-other-host stream error, see setClusterNodeRedirectHost(). If there
+/// is no such node, the client is told to reconnect after a delay picked
+/// at random up to \a reconnectDelay seconds, so that the reconnections of
+/// the clients are spread out.
+///
+/// When all the streams are moved away, the server stops accepting client
+/// connections first. clientsDrained() is emitted once they are closed.
+///
+/// \param count
+/// \param reconnectDelay
+
+void QXmppServer::drainClients(int count, int reconnectDelay)
+{
+    if (count < 0) {
+        foreach (QXmppSslServer *server, d->serversForClients) {
+            server->close();
+            d->listenerKinds.remove(server);
+            delete server;
+        }
+        d->serversForClients.clear();
+        foreach (QLocalServer *server, d->localServersForClients) {
+            server->close();
+            delete server;
+        }
+        d->localServersForClients.clear();
+        count = d->incomingClients.size();
+    }
+
+    d->info(QString("Draining %1 client streams").arg(QString::number(count)));
+    d->drainCount = count;
+    d->drainReconnectDelay = qMax(0, reconnectDelay);
+    d->drainRedirects.clear();
+    d->drainTimer->start();
+    _q_drainClients();
+}
+
+/// Listen for incoming XMPP server connections.
+///
+/// \param address
+/// \param port
+
+bool QXmppServer::listenForServers(const QHostAddress &address, quint16 port)
+{
+    if (d->domain.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    // create new server
+    QXmppSslServer *server = d->createListener("servers");
+    if (!server->listen(address, port)) {
+        d->warning(QString("Could not start listening for S2S on %1 %2").arg(address.toString(), QString::number(port)));
+        delete server;
+        return false;
+    }
+    d->addListener(server, "servers");
+
+    // start extensions
+    d->loadExtensions(this);
+    d->startExtensions();
+    return true;
+}
+
+/// Listen for links from the other nodes of the cluster.
+///
+/// The links are not encrypted, so they should only be used on a trusted
+/// network.
+///
+/// \param address
+/// \param port
+
+bool QXmppServer::listenForClusterNodes(const QHostAddress &address, quint16 port)
+{
+    if (d->domain.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    return d->cluster->listen(address, port);
+}
+
+/// Listens on the local socket \a name for a new server process which
+/// takes over from this one, see takeOverFrom().
+///
+/// When it connects, the client streams hand off their sessions: those
+/// which can be resumed, as defined by XEP-0198: Stream Management, are
+/// closed without ending the XML stream so that the clients reconnect and
+/// resume them, the others are closed. The listening sockets, the state of
+/// the extensions and the sessions are then passed to the new process,
+/// which accepts the connections from then on, and this server is closed.
+///
+/// Only a process running as the same user as this server is handed the
+/// sockets, the credentials of any other peer are checked and it is
+/// disconnected. As the socket is created in the temporary directory when
+/// \a name is not an absolute path, prefer a path in a directory which
+/// only this user can write to.
+///
+/// Only available on Unix.
+///
+/// \param name The name of the local socket, see QLocalServer::listen().
+
+bool QXmppServer::listenForHandoff(const QString &name)
+{
+#ifndef Q_OS_UNIX
+    Q_UNUSED(name);
+    d->warning("Handing off the server is only supported on Unix");
+    return false;
+#else
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->handoffServer) {
+        d->warning("Already listening for a handoff");
+        return false;
+    }
+
+    QLocalServer::removeServer(name);
+    QLocalServer *server = new QLocalServer(this);
+#if QT_VERSION >= 0x050000
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+#endif
+
+    check = connect(server, SIGNAL(newConnection()),
+                    this, SLOT(_q_handoffConnection()));
+    Q_ASSERT(check);
+
+    if (!server->listen(name)) {
+        d->warning(QString("Could not start listening for a handoff on %1").arg(name));
+        delete server;
+        return false;
+    }
+    d->handoffServer = server;
+    return true;
+#endif
+}
+
+/// Takes over from the server process listening for a handoff on the local
+/// socket \a name, see listenForHandoff().
+///
+/// The listening sockets of the other process are adopted, the extensions
+/// restore the state it saved, and the client sessions it handed off are
+/// kept for streamResumptionTimeout() seconds, holding the stanzas routed
+/// to them until their clients resume them.
+///
+/// This is called instead of the listenFor*() methods, once the server is
+/// configured. The server can then listen for the next handoff on the same
+/// \a name.
+///
+/// \param name The name of the local socket.
+/// \param msecs How long to wait for the other process.
+
+bool QXmppServer::takeOverFrom(const QString &name, int msecs)
+{
+    if (d->domain.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    QList<int> descriptors;
+    QByteArray data;
+    if (!QXmppHandoff::receive(name, &descriptors, &data, msecs)) {
+        d->warning(QString("Could not take over from the server on %1").arg(name));
+        return false;
+    }
+
+    quint8 version = 0;
+    QStringList kinds;
+    QVariantList sessions;
+    QVariantMap states;
+    QDataStream stream(data);
+    stream >> version >> kinds >> sessions >> states;
+    if (stream.status() != QDataStream::Ok || version != handoffVersion ||
+        kinds.size() != descriptors.size()) {
+        d->warning(QString("Received an invalid handoff from the server on %1").arg(name));
+        QXmppHandoff::close(descriptors);
+        return false;
+    }
+
+    // adopt the listeners
+    for (int i = 0; i < descriptors.size(); ++i) {
+        QXmppSslServer *server = d->createListener(kinds.at(i));
+        if (!server || !server->setSocketDescriptor(descriptors.at(i))) {
+            d->warning(QString("Could not take over a listener for %1").arg(kinds.at(i)));
+            delete server;
+            QXmppHandoff::close(QList<int>() << descriptors.at(i));
+            continue;
+        }
+        d->addListener(server, kinds.at(i));
+    }
+
+    // restore the extensions before they start
+    d->loadExtensions(this);
+    foreach (QXmppServerExtension *extension, d->extensions) {
+        const QString extensionName = extension->extensionName();
+        if (states.contains(extensionName) &&
+            !extension->restoreState(states.value(extensionName).toByteArray()))
+            d->warning(QString("Could not restore the state of extension %1").arg(extensionName));
+    }
+
+    foreach (const QVariant &session, sessions)
+        d->restoreClientSession(session.toMap());
+
+    d->info(QString("Took over %1 listeners and %2 sessions from the server on %3").arg(
+        QString::number(d->serversForClients.size() + d->serversForServers.size()),
+        QString::number(sessions.size()), name));
+
+    // start extensions
+    d->startExtensions();
+    return true;
+}
+
+/// Route serialized XMPP data.
+///
+/// The data may hold several stanzas for the same recipient, in which
+/// case they are written to the recipient's stream at once.
+///
+/// \param to
+/// \param data
+
+bool QXmppServer::sendData(const QString &to, const QByteArray &data)
+{
+    return d->routeData(to, data);
+}
+
+/// Route an XMPP stanza.
+///
+/// \param element
+
+bool QXmppServer::sendElement(const QDomElement &element)
+{
+    // serialize data
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    const QStringList omitNamespaces = QStringList() << ns_client << ns_server;
+    helperToXmlAddDomElement(&xmlStream, element, omitNamespaces);
+
+    // route data
+    return d->routeData(element.attribute("to"), data);
+}
+
+/// Routes a copy of an XML element to each of the given recipients, for
+/// instance a presence to a user's subscribers.
+///
+/// The element is only serialized once, its 'to' attribute being replaced
+/// for each recipient. The data routed to a given stream is written to
+/// its socket at once when the server returns to the event loop.
+///
+/// Returns the number of recipients the element was routed to.
+///
+/// \param element
+/// \param recipients
+
+int QXmppServer::broadcastElement(const QDomElement &element, const QSet<QString> &recipients)
+{
+    // serialize data
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    const QStringList omitNamespaces = QStringList() << ns_client << ns_server;
+    helperToXmlAddDomElement(&xmlStream, element, omitNamespaces);
+
+    return d->broadcastData(data, recipients);
+}
+
+/// Routes a copy of an XMPP packet to each of the given recipients.
+///
+/// \sa broadcastElement()
+///
+/// \param stanza
+/// \param recipients
+
+int QXmppServer::broadcastPacket(const QXmppStanza &stanza, const QSet<QString> &recipients)
+{
+    // serialize data
+    const QByteArray data = helperToXmlData(stanza);
+
+    return d->broadcastData(data, recipients);
+}
+
+/// Route an XMPP packet.
+///
+/// \param packet
+
+bool QXmppServer::sendPacket(const QXmppStanza &packet)
+{
+    // serialize data
+    const QByteArray data = helperToXmlData(packet);
+
+    // route data
+    return d->routeData(packet.to(), data);
+}
+
+/// Add a new incoming client \a stream.
+///
+/// This method can be used for instance to implement BOSH support
+/// as a server extension.
+
+void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    stream->setPasswordChecker(d->passwordChecker);
+    stream->setHostedDomains(d->domainCheckers);
+    stream->setStreamCompressionEnabled(d->streamCompressionEnabled);
+    stream->setLoginTokenStore(d->loginTokens);
+    stream->setResumptionTimeout(d->streamResumptionTimeout);
+    d->setupStream(stream);
+    if (d->trafficCapture)
+        stream->setTrafficCapture(d->trafficCapture);
+
+    check = connect(stream, SIGNAL(connected()),
+                    this, SLOT(_q_clientConnected()));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(disconnected()),
+                    this, SLOT(_q_clientDisconnected()));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(elementReceived(QDomElement)),
+                    this, SLOT(handleElement(QDomElement)));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(rawStanzaReceived(QXmppRawStanza)),
+                    this, SLOT(handleRawStanza(QXmppRawStanza)));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(resumptionEnabled(QString)),
+                    this, SLOT(_q_clientResumptionEnabled(QString)));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(resumeRequested(QString,uint)),
+                    this, SLOT(_q_clientResumeRequested(QString,uint)));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(sessionDetached(QVariantMap)),
+                    this, SLOT(_q_clientSessionDetached(QVariantMap)));
+    Q_ASSERT(check);
+
+    // add stream
+    d->incomingClients.insert(stream);
+    d->updateConnectionLimiter(stream);
+    setGauge("incoming-client.count", d->incomingClients.size());
+    d->updateLimiterGauges();
+}
+
+/// Handle a new incoming TCP connection from a client.
+///
+/// \param socket
+
+void QXmppServer::_q_clientConnection(QSslSocket *socket)
+{
+    // check the socket didn't die since the signal was emitted
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        delete socket;
+        return;
+    }
+
+    QXmppIncomingClient *stream = new QXmppIncomingClient(socket, d->domain, this);
+    stream->setInactivityTimeout(120);
+    socket->setParent(stream);
+    addIncomingClient(stream);
+    d->moveToWorker(stream);
+}
+
+/// Handle a new incoming BOSH connection from a client.
+///
+/// \param socket
+
+void QXmppServer::_q_boshConnection(QSslSocket *socket)
+{
+    // check the socket didn't die since the signal was emitted
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        delete socket;
+        return;
+    }
+
+    if (!socket->localCertificate().isNull() && !socket->privateKey().isNull())
+        socket->startServerEncryption();
+    d->boshServer->addConnection(socket);
+}
+
+/// Handle a new BOSH session.
+///
+/// \param session
+
+void QXmppServer::_q_boshSession(QXmppBoshSession *session)
+{
+    QXmppIncomingClient *stream = new QXmppIncomingClient(session, d->domain, this);
+    stream->setInactivityTimeout(120);
+    session->setParent(stream);
+    addIncomingClient(stream);
+}
+
+/// Handle a new incoming WebSocket connection from a client.
+///
+/// \param socket
+
+void QXmppServer::_q_webSocketConnection(QSslSocket *socket)
+{
+    // check the socket didn't die since the signal was emitted
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        delete socket;
+        return;
+    }
+
+    if (!socket->localCertificate().isNull() && !socket->privateKey().isNull())
+        socket->startServerEncryption();
+
+    QXmppWebSocket *webSocket = new QXmppWebSocket(socket);
+    QXmppIncomingClient *stream = new QXmppIncomingClient(webSocket, d->domain, this);
+    stream->setInactivityTimeout(120);
+    webSocket->setParent(stream);
+    addIncomingClient(stream);
+    d->moveToWorker(stream);
+}
+
+/// Handle new incoming local connections from clients.
+///
+
+void QXmppServer::_q_localClientConnection()
+{
+    QLocalServer *server = qobject_cast<QLocalServer*>(sender());
+    if (!server)
+        return;
+
+    while (QLocalSocket *socket = server->nextPendingConnection()) {
+        QXmppIncomingClient *stream = new QXmppIncomingClient(socket, d->domain, this);
+        stream->setInactivityTimeout(120);
+        socket->setParent(stream);
+        addIncomingClient(stream);
+        d->moveToWorker(stream);
+    }
+}
+
+/// Handle a successful stream connection for a client.
+///
+
+void QXmppServer::_q_clientConnected()
+{
+    QXmppIncomingClient *client = qobject_cast<QXmppIncomingClient*>(sender());
+    if (!client)
+        return;
+
+    // FIXME: at this point the JID must contain a resource, assert it?
+    const QString jid = client->jid();
+
+    // the domain may have been removed since the client authenticated
+    QXmppRoutingTable *routes = d->clientRoutes(jid);
+    if (!routes) {
+        QMetaObject::invokeMethod(client, "disconnectFromHost");
+        return;
+    }
+
+    // check whether the connection conflicts with another one
+    QXmppIncomingClient *old = routes->insert(jid, client);
+    if (old && old != client) {
+        const QByteArray data("<stream:error><conflict xmlns='urn:ietf:params:xml:ns:xmpp-streams'/><text xmlns='urn:ietf:params:xml:ns:xmpp-streams'>Replaced by new connection</text></stream:error>");
+        QMetaObject::invokeMethod(old, "sendData", Q_ARG(QByteArray, data));
+        QMetaObject::invokeMethod(old, "disconnectFromHost");
+    }
+    d->updateClusterSession(jid);
+    d->attachLimiter(client, d->userLimiters, QXmppUtils::jidToBareJid(jid), d->userByteRate, d->userStanzaRate);
+    d->updateLimiterGauges();
+
+    // emit signal
+    emit clientConnected(jid);
+}
+
+/// Handle a stream disconnection for a client.
+
+void QXmppServer::_q_clientDisconnected()
+{
+    QXmppIncomingClient *client  = qobject_cast<QXmppIncomingClient *>(sender());
+    if (!client)
+        return;
+
+    if (d->incomingClients.remove(client)) {
+        // forget the session's resumption id
+        const QString resumptionId = d->resumptionIds.take(client);
+        if (d->resumableClients.value(resumptionId) == client)
+            d->resumableClients.remove(resumptionId);
+
+        // remove stream from routing tables
+        const QString jid = client->jid();
+        QXmppRoutingTable *routes = d->clientRoutes(jid);
+        if (routes)
+            routes->remove(jid, client);
+
+        // a session which was handed over to another stream goes on
+        bool sessionEnded = !jid.isEmpty();
+        if (d->detachedClients.remove(client)) {
+            sessionEnded = false;
+        } else if (d->resumingClients.contains(client)) {
+            // the session ended before it could be handed over
+            QXmppIncomingClient *resuming = d->resumingClients.take(client);
+            if (routes)
+                routes->remove(jid, resuming);
+            if (d->incomingClients.contains(resuming))
+                QMetaObject::invokeMethod(resuming, "rejectResume");
+        }
+
+        if (!jid.isEmpty())
+            d->updateClusterSession(jid);
+
+        // release rate limiters
+        d->connectionLimiters.remove(client);
+        if (!jid.isEmpty())
+            d->detachLimiter(client, d->userLimiters, QXmppUtils::jidToBareJid(jid));
+
+        // destroy client
+        const bool outputQueueFull = client->isOutputQueueFull();
+        d->releaseWorker(client);
+        client->deleteLater();
+
+        // emit signal
+        if (sessionEnded)
+            emit clientDisconnected(jid);
+
+        // update counter
+        setGauge("incoming-client.count", d->incomingClients.size());
+        d->updateLimiterGauges();
+        if (outputQueueFull)
+            d->updateOutputQueueGauge();
+
+        // the last stream which was not resumable went away
+        if (d->handoffClients.remove(client) && d->handoffClients.isEmpty())
+            _q_finishHandoff();
+
+        if (d->drainedClients.remove(client) && d->drainedClients.isEmpty() && !d->drainTimer->isActive())
+            emit clientsDrained();
+    }
+}
+
+void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
+{
+    QXmppIncomingServer *stream = qobject_cast<QXmppIncomingServer *>(sender());
+    if (!stream)
+        return;
+
+    if (dialback.command() == QXmppDialback::Verify)
+    {
+        // handle a verify request
+        const QList<QXmppOutgoingServer*> links = d->outgoingServersByDomain.values(dialback.from());
+        if (!links.isEmpty()) {
+            bool isValid = false;
+            foreach (QXmppOutgoingServer *out, links)
+                if (dialback.key() == out->localStreamKey())
+                    isValid = true;
+            const QPair<QString, qint64> shared = d->dialbackKeys.value(dialback.from());
+            if (dialback.key() == shared.first && shared.second > d->dialbackClock.elapsed())
+                isValid = true;
+            QXmppDialback verify;
+            verify.setCommand(QXmppDialback::Verify);
+            verify.setId(dialback.id());
+            verify.setTo(dialback.from());
+            verify.setFrom(d->domains.contains(dialback.to()) ? dialback.to() : d->domain);
+            verify.setType(isValid ? "valid" : "invalid");
+
+            const QByteArray data = helperToXmlData(verify);
+            QMetaObject::invokeMethod(stream, "sendData", Q_ARG(QByteArray, data));
+            return;
+        }
+    }
+}
+
+/// Close the next batch of client streams being drained.
+
+void QXmppServer::_q_drainClients()
+{
+    int batch = qMax(1, d->drainRate * d->drainTimer->interval() / 1000);
+    foreach (QXmppIncomingClient *stream, d->incomingClients) {
+        if (!d->drainCount || !batch)
+            break;
+        if (d->drainedClients.contains(stream))
+            continue;
+
+        QByteArray data("<stream:error>");
+        const QString host = d->redirectHost();
+        if (!host.isEmpty()) {
+            data += "<see-other-host xmlns='urn:ietf:params:xml:ns:xmpp-streams'>" + host.toUtf8() + "</see-other-host>";
+        } else {
+            data += "<system-shutdown xmlns='urn:ietf:params:xml:ns:xmpp-streams'/>";
+            if (d->drainReconnectDelay > 0)
+                data += QString("<reconnect xmlns='%1' delay='%2'/>").arg(ns_reconnect,
+                    QString::number(qrand() % (d->drainReconnectDelay + 1))).toUtf8();
+        }
+        data += "</stream:error>";
+
+        d->drainedClients.insert(stream);
+        QMetaObject::invokeMethod(stream, "sendData", Q_ARG(QByteArray, data));
+        QMetaObject::invokeMethod(stream, "disconnectFromHost");
+        updateCounter(host.isEmpty() ? "incoming-client.drained" : "incoming-client.redirected");
+        d->drainCount--;
+        batch--;
+    }
+
+    if (!d->drainCount || d->drainedClients.size() == d->incomingClients.size()) {
+        d->drainTimer->stop();
+        if (d->drainedClients.isEmpty())
+            emit clientsDrained();
+    }
+}
+
+/// Handle another server process taking over, the client streams hand
+/// off their sessions first.
+
+void QXmppServer::_q_handoffConnection()
+{
+    QLocalSocket *socket = d->handoffServer->nextPendingConnection();
+    if (!socket || d->handoffSocket) {
+        delete socket;
+        return;
+    }
+    if (!QXmppHandoff::isPeerTrusted(int(socket->socketDescriptor()))) {
+        d->warning("Rejected a handoff to a process running as another user");
+        delete socket;
+        return;
+    }
+
+    // only one process takes over, and it may listen for the next one
+    d->handoffServer->close();
+    d->handoffSocket = socket;
+    d->info("Handing off to another process");
+
+    d->handoffSessions.clear();
+    foreach (QXmppIncomingClient *stream, d->incomingClients) {
+        d->handoffClients.insert(stream);
+        QMetaObject::invokeMethod(stream, "handOffSession");
+    }
+
+    // do not wait forever for streams which are stuck
+    if (d->handoffClients.isEmpty())
+        _q_finishHandoff();
+    else
+        d->handoffTimer->start();
+}
+
+/// Pass the listeners, the state of the extensions and the sessions which
+/// were handed off to the process taking over, then close the server.
+
+void QXmppServer::_q_finishHandoff()
+{
+    if (!d->handoffSocket)
+        return;
+    d->handoffTimer->stop();
+    d->handoffClients.clear();
+
+    QVariantMap states;
+    foreach (QXmppServerExtension *extension, d->extensions)
+        states.insert(extension->extensionName(), extension->saveState());
+
+    QList<int> descriptors;
+    QStringList kinds;
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers) {
+        descriptors << int(server->socketDescriptor());
+        kinds << d->listenerKinds.value(server);
+    }
+
+    const QVariantList sessions = d->handoffSessions;
+    d->handoffSessions.clear();
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << handoffVersion << kinds << sessions << states;
+
+    const bool sent = QXmppHandoff::send(int(d->handoffSocket->socketDescriptor()), descriptors, data, 5000);
+    d->handoffSocket->deleteLater();
+    d->handoffSocket = 0;
+    d->handoffServer->deleteLater();
+    d->handoffServer = 0;
+
+    if (!sent) {
+        // keep serving, the sessions which were handed off are over
+        d->warning("Could not hand off to the other process");
+        foreach (const QVariant &session, sessions) {
+            const QString jid = session.toMap().value("jid").toString();
+            d->updateClusterSession(jid);
+            emit clientDisconnected(jid);
+        }
+        return;
+    }
+
+    d->info(QString("Handed off %1 listeners and %2 sessions").arg(
+        QString::number(descriptors.size()), QString::number(sessions.size())));
+    close();
+    emit handedOff();
+}
+
+/// Handle a client session becoming resumable under the given \a id.
+
+void QXmppServer::_q_clientResumptionEnabled(const QString &id)
+{
+    QXmppIncomingClient *client = qobject_cast<QXmppIncomingClient*>(sender());
+    if (!client || !d->incomingClients.contains(client))
+        return;
+
+    d->resumableClients.insert(id, client);
+    d->resumptionIds.insert(client, id);
+}
+
+/// Handle a client asking to resume the session identified by \a id.
+///
+/// Stanzas for the session are routed to the new stream straight away,
+/// which holds them back until it has received the session.
+
+void QXmppServer::_q_clientResumeRequested(const QString &id, uint handled)
+{
+    QXmppIncomingClient *client = qobject_cast<QXmppIncomingClient*>(sender());
+    if (!client || !d->incomingClients.contains(client))
+        return;
+
+    // the session must belong to the same user
+    QXmppIncomingClient *old = d->resumableClients.value(id);
+    if (!old || old == client ||
+        QXmppUtils::jidToBareJid(old->jid()) != client->jid()) {
+        QMetaObject::invokeMethod(client, "rejectResume");
+        return;
+    }
+
+    QXmppRoutingTable *routes = d->clientRoutes(old->jid());
+    if (!routes) {
+        QMetaObject::invokeMethod(client, "rejectResume");
+        return;
+    }
+
+    d->resumableClients.remove(id);
+    d->resumptionIds.remove(old);
+    d->resumingClients.insert(old, client);
+    routes->insert(old->jid(), client);
+    QMetaObject::invokeMethod(old, "detachSession", Q_ARG(uint, handled));
+}
+
+/// Handle a client stream handing over its session to the stream which
+/// asked to resume it.
+
+void QXmppServer::_q_clientSessionDetached(const QVariantMap &session)
+{
+    QXmppIncomingClient *old = qobject_cast<QXmppIncomingClient*>(sender());
+    if (!old)
+        return;
+
+    // the session goes on in the process taking over
+    if (d->handoffClients.remove(old)) {
+        const QString jid = session.value("jid").toString();
+        QXmppRoutingTable *routes = d->clientRoutes(jid);
+        if (routes)
+            routes->remove(jid, old);
+        d->detachedClients.insert(old);
+        d->resumingClients.remove(old);
+        d->handoffSessions << session;
+        if (d->handoffClients.isEmpty())
+            _q_finishHandoff();
+        return;
+    }
+
+    if (!d->resumingClients.contains(old))
+        return;
+
+    QXmppIncomingClient *client = d->resumingClients.take(old);
+    d->detachedClients.insert(old);
+    if (d->incomingClients.contains(client)) {
+        QMetaObject::invokeMethod(client, "resumeSession", Q_ARG(QVariantMap, session));
+    } else {
+        // the new stream went away meanwhile, the session is over
+        const QString jid = session.value("jid").toString();
+        QXmppRoutingTable *routes = d->clientRoutes(jid);
+        if (routes)
+            routes->remove(jid, client);
+        d->updateClusterSession(jid);
+        emit clientDisconnected(jid);
+    }
+}
+
+/// Handle a dialback key received on an incoming server stream, which
+/// needs to be verified by the remote server.
+///
+/// The request is sent over an existing outgoing stream to the remote
+/// server if there is one, which saves setting up a new connection.
+
+void QXmppServer::_q_dialbackVerifyRequested(const QXmppDialback &verify)
+{
+    QXmppIncomingServer *stream = qobject_cast<QXmppIncomingServer *>(sender());
+    if (!stream || !d->incomingServers.contains(stream))
+        return;
+
+    // a key which was recently verified is valid for all the streams
+    const QString verifyKey = verify.to() + ' ' + verify.from() + ' ' + verify.key();
+    if (d->isVerifiedKey(verifyKey)) {
+        QXmppDialback response;
+        response.setCommand(QXmppDialback::Verify);
+        response.setId(verify.id());
+        response.setFrom(verify.to());
+        response.setTo(verify.from());
+        response.setType("valid");
+        QMetaObject::invokeMethod(stream, "handleDialbackResponse",
+                                  Q_ARG(QXmppDialback, response));
+        updateCounter("server.dialback-cache-hits");
+        return;
+    }
+
+    // wait for the verification of the same key which is in progress
+    if (d->verifyingKeys.contains(verifyKey)) {
+        d->verifyWaiters.insert(verifyKey, qMakePair(stream, verify.id()));
+        return;
+    }
+
+    // prefer a stream authorized for the local domain the key was sent to
+    QXmppOutgoingServer *link = 0;
+    foreach (QXmppOutgoingServer *out, d->outgoingServersByDomain.values(verify.to())) {
+        if (!link || out->localDomain() == verify.from())
+            link = out;
+    }
+    if (!link)
+        link = d->connectToDomain(verify.to(), verify.from());
+
+    const QString pendingKey = verify.to() + ' ' + verify.id();
+    d->pendingVerifies.insert(pendingKey, stream);
+    d->pendingVerifyKeys.insert(pendingKey, verifyKey);
+    d->verifyingKeys.insert(verifyKey);
+    QMetaObject::invokeMethod(link, "queueVerify",
+                              Q_ARG(QString, verify.id()),
+                              Q_ARG(QString, verify.key()));
+}
+
+/// Handle a dialback verify response received on an outgoing server
+/// stream, and pass it to the incoming stream which requested it.
+
+void QXmppServer::_q_dialbackResponseReceived(const QXmppDialback &response)
+{
+    QXmppOutgoingServer *outgoing = qobject_cast<QXmppOutgoingServer *>(sender());
+    if (!outgoing || !d->outgoingServersByDomain.contains(response.from(), outgoing))
+        return;
+
+    const QString pendingKey = response.from() + ' ' + response.id();
+    QXmppIncomingServer *stream = d->pendingVerifies.take(pendingKey);
+    if (stream)
+        QMetaObject::invokeMethod(stream, "handleDialbackResponse",
+                                  Q_ARG(QXmppDialback, response));
+
+    // pass the result on to the streams waiting for the same key
+    const QString verifyKey = d->pendingVerifyKeys.take(pendingKey);
+    if (verifyKey.isEmpty())
+        return;
+    d->verifyingKeys.remove(verifyKey);
+    if (response.type() == QLatin1String("valid") && d->dialbackCacheTimeout > 0) {
+        const qint64 now = d->dialbackClock.elapsed();
+        QMutableHashIterator<QString, qint64> it(d->verifiedKeys);
+        while (it.hasNext())
+            if (it.next().value() <= now)
+                it.remove();
+        d->verifiedKeys.insert(verifyKey, now + d->dialbackCacheTimeout * 1000);
+    }
+
+    typedef QPair<QXmppIncomingServer*, QString> Waiter;
+    foreach (const Waiter &waiter, d->verifyWaiters.values(verifyKey)) {
+        QXmppDialback waiterResponse = response;
+        waiterResponse.setId(waiter.second);
+        QMetaObject::invokeMethod(waiter.first, "handleDialbackResponse",
+                                  Q_ARG(QXmppDialback, waiterResponse));
+    }
+    d->verifyWaiters.remove(verifyKey);
+}
+
+void QXmppServer::_q_rebalanceWorkers()
+{
+    d->rebalanceWorkers();
 }
 
-/// Handle a successful stream connection for a client.
-///
+/// Open outgoing server streams to the preconnected domains which have none.
 
-void QXmppServer::_q_clientConnected()
+void QXmppServer::_q_preconnectDomains()
 {
-    QXmppIncomingClient *client = qobject_cast<QXmppIncomingClient*>(sender());
-    if (!client)
+    if (d->serversForServers.isEmpty())
         return;
 
-    // FIXME: at this point the JID must contain a resource, assert it?
-    const QString jid = client->jid();
-
-    // check whether the connection conflicts with another one
-    QXmppIncomingClient *old = d->incomingClientsByJid.value(jid);
-    if (old && old != client) {
-        old->sendData("<stream:error><conflict xmlns='urn:ietf:params:xml:ns:xmpp-streams'/><text xmlns='urn:ietf:params:xml:ns:xmpp-streams'>Replaced by new connection</text></stream:error>");
-        old->disconnectFromHost();
+    foreach (const QString &domain, d->preconnectDomains) {
+        if (!domain.isEmpty() && !d->hostedDomain(domain) &&
+            !d->outgoingServersByDomain.contains(domain))
+            d->connectToDomain(domain, d->domain);
     }
-    d->incomingClientsByJid.insert(jid, client);
-    d->incomingClientsByBareJid[QXmppUtils::jidToBareJid(jid)].insert(client);
-
-    // emit signal
-    emit clientConnected(jid);
 }
 
-/// Handle a stream disconnection for a client.
+/// Handle an incoming XML element.
 
-void QXmppServer::_q_clientDisconnected()
+void QXmppServer::handleElement(const QDomElement &element)
 {
-    QXmppIncomingClient *client  = qobject_cast<QXmppIncomingClient *>(sender());
-    if (!client)
+    if (d->shedStanza(element.tagName(), element.attribute("type")))
         return;
+    d->handleElement(element);
+}
 
-    if (d->incomingClients.remove(client)) {
-        // remove stream from routing tables
-        const QString jid = client->jid();
-        if (!jid.isEmpty()) {
-            if (d->incomingClientsByJid.value(jid) == client)
-                d->incomingClientsByJid.remove(jid);
-            const QString bareJid = QXmppUtils::jidToBareJid(jid);
-            if (d->incomingClientsByBareJid.contains(bareJid)) {
-                d->incomingClientsByBareJid[bareJid].remove(client);
-                if (d->incomingClientsByBareJid[bareJid].isEmpty())
-                    d->incomingClientsByBareJid.remove(bareJid);
-            }
-        }
-
-        // destroy client
-        client->deleteLater();
+/// Handle an incoming stanza in its original form.
+///
+/// If no extension needs to inspect the stanza, its original bytes are
+/// routed as-is. Otherwise the stanza's DOM is built and handled like any
+/// other element.
 
-        // emit signal
-        if (!jid.isEmpty())
-            emit clientDisconnected(jid);
+void QXmppServer::handleRawStanza(const QXmppRawStanza &stanza)
+{
+    if (d->shedStanza(stanza.tagName(), stanza.type()))
+        return;
 
-        // update counter
-        setGauge("incoming-client.count", d->incomingClients.size());
+    d->loadExtensions(this);
+    if (d->needsElement(stanza.tagName(), stanza.to())) {
+        d->handleElement(stanza.element());
+        return;
     }
+
+    const bool traced = d->startTrace();
+    d->routeData(stanza.to(), stanza.data());
+    if (traced)
+        d->finishTrace();
 }
 
-void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
+/// Handle a stanza from a component running in the same process.
+///
+/// Unlike a QDomElement, a QXmppCompactStanza can be queued safely from
+/// another thread. If no extension needs to inspect the stanza, it is
+/// written straight to the recipient's stream without building a DOM
+/// tree. Otherwise the stanza is handled like any other element.
+
+void QXmppServer::handleCompactStanza(const QXmppCompactStanza &stanza)
 {
-    QXmppIncomingServer *stream = qobject_cast<QXmppIncomingServer *>(sender());
-    if (!stream)
+    d->loadExtensions(this);
+    const QString to = stanza.attribute("to");
+    if (d->needsElement(stanza.tagName(), to)) {
+        d->handleElement(stanza.toElement());
         return;
-
-    if (dialback.command() == QXmppDialback::Verify)
-    {
-        // handle a verify request
-        foreach (QXmppOutgoingServer *out, d->outgoingServers) {
-            if (out->remoteDomain() != dialback.from())
-                continue;
-
-            bool isValid = dialback.key() == out->localStreamKey();
-            QXmppDialback verify;
-            verify.setCommand(QXmppDialback::Verify);
-            verify.setId(dialback.id());
-            verify.setTo(dialback.from());
-            verify.setFrom(d->domain);
-            verify.setType(isValid ? "valid" : "invalid");
-            stream->sendPacket(verify);
-            return;
-        }
     }
+
+    const bool traced = d->startTrace();
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    stanza.toXml(&xmlStream);
+    const bool routed = d->routeData(to, data);
+    if (traced)
+        d->finishTrace();
+
+    // let the default handler reply on behalf of a missing peer
+    if (!routed)
+        handleStanza(this, stanza.toElement(), d->domains.contains(to));
 }
 
-/// Handle an incoming XML element.
+/// Handle a stanza forwarded by another node of the cluster.
+///
+/// The stanza was routed by the node which received it, so it is only
+/// delivered to the local clients.
 
-void QXmppServer::handleElement(const QDomElement &element)
+void QXmppServer::_q_clusterStanzaReceived(const QString &to, const QByteArray &data)
 {
-    handleStanza(this, element);
+    if (!d->sendToClients(d->clientRoutes(to), QXmppJid(to), data))
+        d->info(QString("Dropped stanza from cluster for unknown recipient %1").arg(to));
 }
 
 /// Handle a stream disconnection for an outgoing server.
@@ -811,11 +4164,23 @@ void QXmppServer::_q_outgoingServerDisconnected()
         return;
 
     if (d->outgoingServers.remove(outgoing)) {
+        d->outgoingServersByDomain.remove(d->outgoingServerDomains.take(outgoing), outgoing);
+        const bool outputQueueFull = outgoing->isOutputQueueFull();
+        d->releaseWorker(outgoing);
         outgoing->deleteLater();
         setGauge("outgoing-server.count", d->outgoingServers.size());
+        if (outputQueueFull)
+            d->updateOutputQueueGauge();
     }
 }
 
+/// Handle a stream's output queue reaching its high or low watermark.
+
+void QXmppServer::_q_outputQueueChanged()
+{
+    d->updateOutputQueueGauge();
+}
+
 /// Handle a new incoming TCP connection from a server.
 ///
 /// \param socket
@@ -832,6 +4197,10 @@ void QXmppServer::_q_serverConnection(QSslSocket *socket)
     }
 
     QXmppIncomingServer *stream = new QXmppIncomingServer(socket, d->domain, this);
+    stream->setHostedDomains(d->domains.keys());
+    stream->setResumptionTimeout(d->serverStreamResumptionTimeout);
+    stream->setPipelinedParsingEnabled(d->serverStreamPipelining);
+    d->setupStream(stream);
     socket->setParent(stream);
 
     check = connect(stream, SIGNAL(disconnected()),
@@ -842,13 +4211,54 @@ void QXmppServer::_q_serverConnection(QSslSocket *socket)
                     this, SLOT(_q_dialbackRequestReceived(QXmppDialback)));
     Q_ASSERT(check);
 
+    check = connect(stream, SIGNAL(dialbackVerifyRequested(QXmppDialback)),
+                    this, SLOT(_q_dialbackVerifyRequested(QXmppDialback)));
+    Q_ASSERT(check);
+
     check = connect(stream, SIGNAL(elementReceived(QDomElement)),
                     this, SLOT(handleElement(QDomElement)));
     Q_ASSERT(check);
 
+    check = connect(stream, SIGNAL(domainVerified(QString)),
+                    this, SLOT(_q_serverDomainVerified(QString)));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(resumptionEnabled(QString)),
+                    this, SLOT(_q_serverResumptionEnabled(QString)));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(resumeRequested(QString,uint)),
+                    this, SLOT(_q_serverResumeRequested(QString,uint)));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(sessionDetached(QString,uint)),
+                    this, SLOT(_q_serverSessionDetached(QString,uint)));
+    Q_ASSERT(check);
+
     // add stream
     d->incomingServers.insert(stream);
+    d->updateConnectionLimiter(stream);
     setGauge("incoming-server.count", d->incomingServers.size());
+    d->updateLimiterGauges();
+    d->moveToWorker(stream);
+}
+
+/// Handle the verification of a remote domain on an incoming server stream.
+///
+/// \param domain
+
+void QXmppServer::_q_serverDomainVerified(const QString &domain)
+{
+    QXmppIncomingServer *incoming = qobject_cast<QXmppIncomingServer *>(sender());
+    if (!incoming || !d->incomingServers.contains(incoming))
+        return;
+
+    QStringList &domains = d->verifiedDomains[incoming];
+    if (domains.contains(domain))
+        return;
+    domains << domain;
+    d->attachLimiter(incoming, d->domainLimiters, domain, d->domainByteRate, d->domainStanzaRate);
+    d->updateLimiterGauges();
 }
 
 /// Handle a stream disconnection for an incoming server.
@@ -860,19 +4270,195 @@ void QXmppServer::_q_serverDisconnected()
         return;
 
     if (d->incomingServers.remove(incoming)) {
+        // verify requests which other streams are waiting for stay in
+        // progress
+        QMutableHashIterator<QString, QXmppIncomingServer*> it(d->pendingVerifies);
+        while (it.hasNext()) {
+            if (it.next().value() != incoming)
+                continue;
+            if (d->verifyWaiters.contains(d->pendingVerifyKeys.value(it.key()))) {
+                it.setValue(0);
+            } else {
+                d->verifyingKeys.remove(d->pendingVerifyKeys.take(it.key()));
+                it.remove();
+            }
+        }
+
+        typedef QPair<QXmppIncomingServer*, QString> Waiter;
+        QMutableHashIterator<QString, Waiter> waiters(d->verifyWaiters);
+        while (waiters.hasNext())
+            if (waiters.next().value().first == incoming)
+                waiters.remove();
+
+        const QString resumptionId = d->serverResumptionIds.take(incoming);
+        if (d->resumableServers.value(resumptionId) == incoming)
+            d->resumableServers.remove(resumptionId);
+        if (d->resumingServers.contains(incoming)) {
+            // the stream went away without handing over its session
+            QMetaObject::invokeMethod(d->resumingServers.take(incoming), "rejectResume");
+        }
+        QMutableHashIterator<QXmppIncomingServer*, QXmppIncomingServer*> resuming(d->resumingServers);
+        while (resuming.hasNext())
+            if (resuming.next().value() == incoming)
+                resuming.remove();
+
+        d->connectionLimiters.remove(incoming);
+        foreach (const QString &domain, d->verifiedDomains.take(incoming))
+            d->detachLimiter(incoming, d->domainLimiters, domain);
+
+        const bool outputQueueFull = incoming->isOutputQueueFull();
+        d->releaseWorker(incoming);
         incoming->deleteLater();
         setGauge("incoming-server.count", d->incomingServers.size());
+        d->updateLimiterGauges();
+        if (outputQueueFull)
+            d->updateOutputQueueGauge();
+    }
+}
+
+/// Handle an incoming server session becoming resumable under the
+/// given \a id.
+
+void QXmppServer::_q_serverResumptionEnabled(const QString &id)
+{
+    QXmppIncomingServer *incoming = qobject_cast<QXmppIncomingServer*>(sender());
+    if (!incoming || !d->incomingServers.contains(incoming))
+        return;
+
+    d->resumableServers.insert(id, incoming);
+    d->serverResumptionIds.insert(incoming, id);
+}
+
+// Returns true if both lists have a domain in common.
+
+static bool shareDomain(const QStringList &domains, const QStringList &others)
+{
+    foreach (const QString &domain, domains) {
+        if (others.contains(domain))
+            return true;
+    }
+    return false;
+}
+
+/// Handle a remote server asking to resume the session identified by
+/// \a id, which must have been held by a stream verified for one of the
+/// same remote domains.
+
+void QXmppServer::_q_serverResumeRequested(const QString &id, uint handled)
+{
+    Q_UNUSED(handled);
+
+    QXmppIncomingServer *incoming = qobject_cast<QXmppIncomingServer*>(sender());
+    if (!incoming || !d->incomingServers.contains(incoming))
+        return;
+    const QStringList domains = d->verifiedDomains.value(incoming);
+
+    // the stream holding the session may not have noticed that its
+    // connection is gone
+    QXmppIncomingServer *old = d->resumableServers.value(id);
+    if (old && old != incoming && shareDomain(d->verifiedDomains.value(old), domains)) {
+        d->resumableServers.remove(id);
+        d->serverResumptionIds.remove(old);
+        d->resumingServers.insert(old, incoming);
+        QMetaObject::invokeMethod(old, "detachSession");
+        return;
+    }
+
+    QHash<QString, QXmppSuspendedServerSession>::iterator it = d->suspendedServerSessions.find(id);
+    if (it != d->suspendedServerSessions.end() &&
+        it.value().expiry > d->dialbackClock.elapsed() &&
+        shareDomain(it.value().domains, domains)) {
+        const uint inbound = it.value().handled;
+        d->suspendedServerSessions.erase(it);
+        QMetaObject::invokeMethod(incoming, "resumeSession",
+                                  Q_ARG(QString, id),
+                                  Q_ARG(uint, inbound));
+        return;
+    }
+
+    QMetaObject::invokeMethod(incoming, "rejectResume");
+}
+
+/// Handle an incoming server stream which no longer holds the session
+/// identified by \a id, in which \a handled stanzas were received.
+///
+/// The session goes to the stream which asked to resume it, otherwise it
+/// is kept until it expires.
+
+void QXmppServer::_q_serverSessionDetached(const QString &id, uint handled)
+{
+    QXmppIncomingServer *old = qobject_cast<QXmppIncomingServer*>(sender());
+    if (!old || !d->incomingServers.contains(old))
+        return;
+
+    if (d->serverResumptionIds.value(old) == id) {
+        d->serverResumptionIds.remove(old);
+        d->resumableServers.remove(id);
     }
+
+    QXmppIncomingServer *incoming = d->resumingServers.take(old);
+    if (incoming && d->incomingServers.contains(incoming)) {
+        QMetaObject::invokeMethod(incoming, "resumeSession",
+                                  Q_ARG(QString, id),
+                                  Q_ARG(uint, handled));
+        return;
+    }
+
+    // forget the sessions which expired
+    const qint64 now = d->dialbackClock.elapsed();
+    QMutableHashIterator<QString, QXmppSuspendedServerSession> it(d->suspendedServerSessions);
+    while (it.hasNext())
+        if (it.next().value().expiry <= now)
+            it.remove();
+
+    QXmppSuspendedServerSession session;
+    session.domains = d->verifiedDomains.value(old);
+    session.handled = handled;
+    session.expiry = now + qint64(d->serverStreamResumptionTimeout) * 1000;
+    d->suspendedServerSessions.insert(id, session);
 }
 
 class QXmppSslServerPrivate
 {
 public:
+    QXmppSslServerPrivate();
+
     QList<QSslCertificate> caCertificates;
     QSslCertificate localCertificate;
     QSslKey privateKey;
+
+    // The configuration of an encrypted socket carries its SSL context, so
+    // sockets which are given this configuration share the context's
+    // session cache and ticket keys, and can resume each other's sessions.
+    bool sessionResumptionEnabled;
+    QSslConfiguration sessionConfiguration;
+    QList<QSslCipher> ciphers;
+
+    // admission control: accepted descriptors wait in a queue until they
+    // are within the admission rate and a handshake slot is free
+#if QT_VERSION < 0x050000
+    typedef int Descriptor;
+#else
+    typedef qintptr Descriptor;
+#endif
+    QQueue<Descriptor> queue;
+    int maximumQueuedConnections;
+    int maximumHandshakes;
+    QSet<QObject*> handshakes;
+    QXmppRateLimiter admissionLimiter;
+    bool admissionScheduled;
+    bool acceptingPaused;
 };
 
+QXmppSslServerPrivate::QXmppSslServerPrivate()
+    : sessionResumptionEnabled(false)
+    , maximumQueuedConnections(1024)
+    , maximumHandshakes(0)
+    , admissionScheduled(false)
+    , acceptingPaused(false)
+{
+}
+
 /// Constructs a new SSL server instance.
 ///
 /// \param parent
@@ -897,6 +4483,45 @@ void QXmppSslServer::incomingConnection(int socketDescriptor)
 void QXmppSslServer::incomingConnection(qintptr socketDescriptor)
 #endif
 {
+    if (d->queue.isEmpty() && d->admissionLimiter.delay() == 0 &&
+        (!d->maximumHandshakes || d->handshakes.size() < d->maximumHandshakes)) {
+        d->admissionLimiter.consume(0, 1);
+        admitConnection(socketDescriptor);
+        return;
+    }
+
+    if (d->queue.size() >= d->maximumQueuedConnections) {
+        // the queue is full, refuse the connection
+        QTcpSocket socket;
+        if (socket.setSocketDescriptor(socketDescriptor))
+            socket.abort();
+        return;
+    }
+
+    d->queue.enqueue(socketDescriptor);
+#if QT_VERSION >= 0x050000
+    // leave further connections in the kernel's backlog
+    if (d->queue.size() >= d->maximumQueuedConnections) {
+        d->acceptingPaused = true;
+        pauseAccepting();
+    }
+#endif
+    _q_admitConnections();
+}
+
+/// Creates the socket for an admitted connection.
+///
+/// \param socketDescriptor
+
+#if QT_VERSION < 0x050000
+void QXmppSslServer::admitConnection(int socketDescriptor)
+#else
+void QXmppSslServer::admitConnection(qintptr socketDescriptor)
+#endif
+{
+    bool check;
+    Q_UNUSED(check);
+
     QSslSocket *socket = new QSslSocket;
     if (!socket->setSocketDescriptor(socketDescriptor)) {
         delete socket;
@@ -904,14 +4529,175 @@ void QXmppSslServer::incomingConnection(qintptr socketDescriptor)
     }
 
     if (!d->localCertificate.isNull() && !d->privateKey.isNull()) {
+        // the connection holds a handshake slot until it is encrypted or
+        // it goes away
+        if (d->maximumHandshakes) {
+            d->handshakes.insert(socket);
+            check = connect(socket, SIGNAL(encrypted()),
+                            this, SLOT(_q_handshakeFinished()));
+            Q_ASSERT(check);
+
+            check = connect(socket, SIGNAL(disconnected()),
+                            this, SLOT(_q_handshakeFinished()));
+            Q_ASSERT(check);
+
+            check = connect(socket, SIGNAL(destroyed()),
+                            this, SLOT(_q_handshakeFinished()));
+            Q_ASSERT(check);
+        }
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 4, 0))
+        if (d->sessionResumptionEnabled && !d->sessionConfiguration.isNull()) {
+            socket->setSslConfiguration(d->sessionConfiguration);
+            emit newConnection(socket);
+            return;
+        }
+#endif
         socket->setProtocol(QSsl::AnyProtocol);
         socket->addCaCertificates(d->caCertificates);
         socket->setLocalCertificate(d->localCertificate);
         socket->setPrivateKey(d->privateKey);
+        if (!d->ciphers.isEmpty())
+            socket->setCiphers(d->ciphers);
+
+        if (d->sessionResumptionEnabled) {
+            check = connect(socket, SIGNAL(encrypted()),
+                            this, SLOT(_q_socketEncrypted()));
+            Q_ASSERT(check);
+        }
     }
     emit newConnection(socket);
 }
 
+/// Admits the queued connections which are within the limits.
+
+void QXmppSslServer::_q_admitConnections()
+{
+    d->admissionScheduled = false;
+    while (!d->queue.isEmpty()) {
+        if (d->maximumHandshakes && d->handshakes.size() >= d->maximumHandshakes)
+            break;
+
+        const int delay = d->admissionLimiter.delay();
+        if (delay > 0) {
+            if (!d->admissionScheduled) {
+                d->admissionScheduled = true;
+                QTimer::singleShot(delay, this, SLOT(_q_admitConnections()));
+            }
+            break;
+        }
+
+        d->admissionLimiter.consume(0, 1);
+        admitConnection(d->queue.dequeue());
+    }
+
+#if QT_VERSION >= 0x050000
+    if (d->acceptingPaused && d->queue.size() < d->maximumQueuedConnections) {
+        d->acceptingPaused = false;
+        resumeAccepting();
+    }
+#endif
+}
+
+void QXmppSslServer::_q_handshakeFinished()
+{
+    if (d->handshakes.remove(sender()) && !d->queue.isEmpty())
+        _q_admitConnections();
+}
+
+void QXmppSslServer::_q_socketEncrypted()
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    if (!socket)
+        return;
+
+    disconnect(socket, SIGNAL(encrypted()), this, SLOT(_q_socketEncrypted()));
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 4, 0))
+    if (d->sessionResumptionEnabled && d->sessionConfiguration.isNull())
+        d->sessionConfiguration = socket->sslConfiguration();
+#endif
+}
+
+/// Returns the number of accepted connections waiting to be admitted.
+
+int QXmppSslServer::queuedConnectionCount() const
+{
+    return d->queue.size();
+}
+
+/// Returns the number of admitted connections whose TLS handshake has not
+/// completed yet, if the number of handshakes is limited.
+
+int QXmppSslServer::handshakeCount() const
+{
+    return d->handshakes.size();
+}
+
+/// Returns the maximum number of connections waiting to be admitted.
+
+int QXmppSslServer::maximumQueuedConnections() const
+{
+    return d->maximumQueuedConnections;
+}
+
+/// Sets the maximum number of connections waiting to be admitted.
+///
+/// Once the queue is full, the server stops accepting connections, which
+/// are left in the backlog of the listening socket. The default is 1024.
+///
+/// \param count
+
+void QXmppSslServer::setMaximumQueuedConnections(int count)
+{
+    d->maximumQueuedConnections = qMax(1, count);
+    _q_admitConnections();
+}
+
+/// Returns the maximum number of admitted connections whose TLS handshake
+/// may be in progress at the same time, or 0 if it is not limited.
+
+int QXmppSslServer::maximumHandshakes() const
+{
+    return d->maximumHandshakes;
+}
+
+/// Sets the maximum number of admitted connections whose TLS handshake
+/// may be in progress at the same time.
+///
+/// A connection holds a handshake slot from the moment it is admitted
+/// until it is encrypted or disconnected. The default of 0 disables the
+/// limit.
+///
+/// \param count
+
+void QXmppSslServer::setMaximumHandshakes(int count)
+{
+    d->maximumHandshakes = qMax(0, count);
+    if (!d->maximumHandshakes)
+        d->handshakes.clear();
+    _q_admitConnections();
+}
+
+/// Returns the maximum number of connections admitted per second, or 0 if
+/// it is not limited.
+
+int QXmppSslServer::admissionRate() const
+{
+    return d->admissionLimiter.stanzasPerSecond();
+}
+
+/// Sets the maximum number of connections admitted per second.
+///
+/// The default of 0 disables the limit.
+///
+/// \param connectionsPerSecond
+
+void QXmppSslServer::setAdmissionRate(int connectionsPerSecond)
+{
+    d->admissionLimiter.setRates(0, connectionsPerSecond);
+    _q_admitConnections();
+}
+
 /// Adds the given certificates to the CA certificate database to be used
 /// for incoming connnections.
 ///
@@ -920,6 +4706,7 @@ void QXmppSslServer::incomingConnection(qintptr socketDescriptor)
 void QXmppSslServer::addCaCertificates(const QList<QSslCertificate> &certificates)
 {
     d->caCertificates += certificates;
+    d->sessionConfiguration = QSslConfiguration();
 }
 
 /// Sets the local certificate to be used for incoming connections.
@@ -929,6 +4716,7 @@ void QXmppSslServer::addCaCertificates(const QList<QSslCertificate> &certificate
 void QXmppSslServer::setLocalCertificate(const QSslCertificate &certificate)
 {
     d->localCertificate = certificate;
+    d->sessionConfiguration = QSslConfiguration();
 }
 
 /// Sets the local private key to be used for incoming connections.
@@ -938,5 +4726,90 @@ void QXmppSslServer::setLocalCertificate(const QSslCertificate &certificate)
 void QXmppSslServer::setPrivateKey(const QSslKey &key)
 {
     d->privateKey = key;
+    d->sessionConfiguration = QSslConfiguration();
+}
+
+/// Returns whether sessions established with incoming connections can be
+/// resumed by later connections.
+
+bool QXmppSslServer::isSessionResumptionEnabled() const
+{
+    return d->sessionResumptionEnabled;
+}
+
+/// Sets whether sessions established with incoming connections can be
+/// resumed by later connections.
+///
+/// \param enabled
+
+void QXmppSslServer::setSessionResumptionEnabled(bool enabled)
+{
+    d->sessionResumptionEnabled = enabled;
+    d->sessionConfiguration = QSslConfiguration();
+}
+
+/// Returns the ciphers offered to incoming connections, or an empty list
+/// if Qt's default ciphers are used.
+
+QList<QSslCipher> QXmppSslServer::ciphers() const
+{
+    return d->ciphers;
+}
+
+/// Sets the ciphers offered to incoming connections, in order of
+/// preference. An empty list means Qt's default ciphers are used.
+///
+/// \param ciphers
+
+void QXmppSslServer::setCiphers(const QList<QSslCipher> &ciphers)
+{
+    d->ciphers = ciphers;
+    d->sessionConfiguration = QSslConfiguration();
+}
+
+// Ranks ciphers by their cost: authenticated encryption modes, which
+// processors accelerate and which need no separate MAC pass, come first,
+// then ephemeral elliptic curve key exchanges, which are much cheaper
+// than finite field Diffie-Hellman.
+
+static int cipherCost(const QSslCipher &cipher)
+{
+    const QString name = cipher.name();
+    int cost = 0;
+    if (!name.contains(QLatin1String("GCM")) && !name.contains(QLatin1String("CHACHA20")))
+        cost += 2;
+    if (cipher.keyExchangeMethod().startsWith(QLatin1String("DH")))
+        cost += 1;
+    return cost;
+}
+
+static bool cipherLessCostly(const QSslCipher &c1, const QSslCipher &c2)
+{
+    return cipherCost(c1) < cipherCost(c2);
+}
+
+/// Returns the ciphers supported by the SSL library which provide forward
+/// secrecy, ordered so that the least costly ones are preferred.
+///
+/// Ciphers using AES-GCM or ChaCha20-Poly1305 come first, as they encrypt
+/// and authenticate in a single pass which modern processors accelerate,
+/// followed by the other ciphers. Within each group, elliptic curve key
+/// exchanges are preferred over finite field Diffie-Hellman, which makes
+/// handshakes much cheaper.
+
+QList<QSslCipher> QXmppSslServer::efficientCiphers()
+{
+    QList<QSslCipher> ciphers;
+    foreach (const QSslCipher &cipher, QSslSocket::supportedCiphers()) {
+        const QString keyExchange = cipher.keyExchangeMethod();
+        // TLS 1.3 ciphers are not tied to a key exchange, which is always
+        // ephemeral
+        if (keyExchange.startsWith(QLatin1String("ECDH")) ||
+            keyExchange.startsWith(QLatin1String("DH")) ||
+            keyExchange == QLatin1String("any"))
+            ciphers << cipher;
+    }
+    qStableSort(ciphers.begin(), ciphers.end(), cipherLessCostly);
+    return ciphers;
 }
 
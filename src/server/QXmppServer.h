@@ -24,26 +24,32 @@
 #ifndef QXMPPSERVER_H
 #define QXMPPSERVER_H
 
+#include <QSet>
+#include <QStringList>
 #include <QTcpServer>
 #include <QVariantMap>
 
 #include "QXmppLogger.h"
+#include "QXmppStream.h"
 
 class QDomElement;
 class QSslCertificate;
+class QSslCipher;
 class QSslKey;
 class QSslSocket;
 
+class QXmppBoshSession;
+class QXmppCompactStanza;
 class QXmppDialback;
 class QXmppIncomingClient;
 class QXmppOutgoingServer;
 class QXmppPasswordChecker;
 class QXmppPresence;
+class QXmppRawStanza;
 class QXmppServerExtension;
 class QXmppServerPrivate;
 class QXmppSslServer;
 class QXmppStanza;
-class QXmppStream;
 
 /// \brief The QXmppServer class represents an XMPP server.
 ///
@@ -62,22 +68,151 @@ class QXMPP_EXPORT QXmppServer : public QXmppLoggable
     Q_PROPERTY(QXmppLogger* logger READ logger WRITE setLogger NOTIFY loggerChanged)
 
 public:
+    /// This enum describes how the worker threads wait for network events.
+    enum EventDispatcher
+    {
+        QtEventDispatcher = 0,  ///< Qt's default event dispatcher.
+        EpollEventDispatcher    ///< A dispatcher based on epoll, which scales to many connections per thread. Requires Qt 5 on Linux.
+    };
+
     QXmppServer(QObject *parent = 0);
     ~QXmppServer();
 
     void addExtension(QXmppServerExtension *extension);
     QList<QXmppServerExtension*> extensions();
+    bool removeExtension(QXmppServerExtension *extension);
+    bool replaceExtension(QXmppServerExtension *extension, QXmppServerExtension *replacement);
+
+    QList<QXmppServerExtension*> loadPlugin(const QString &fileName);
+    bool unloadPlugin(const QString &fileName);
+    bool reloadPlugin(const QString &fileName);
 
     QString domain() const;
     void setDomain(const QString &domain);
 
+    QStringList domains() const;
+    void addDomain(const QString &domain);
+    void removeDomain(const QString &domain);
+
+    QXmppPasswordChecker *domainPasswordChecker(const QString &domain) const;
+    void setDomainPasswordChecker(const QString &domain, QXmppPasswordChecker *checker);
+
+    QStringList domainExtensions(const QString &domain) const;
+    void setDomainExtensions(const QString &domain, const QStringList &names);
+
     QXmppLogger *logger();
     void setLogger(QXmppLogger *logger);
 
     QXmppPasswordChecker *passwordChecker();
     void setPasswordChecker(QXmppPasswordChecker *checker);
 
+    int maximumStanzaSize() const;
+    void setMaximumStanzaSize(int size);
+
+    qint64 maximumBufferSize() const;
+    void setMaximumBufferSize(qint64 size);
+
+    qint64 outputLowWatermark() const;
+    qint64 outputHighWatermark() const;
+    void setOutputWatermarks(qint64 low, qint64 high);
+
+    QXmppStream::OutputQueuePolicy outputQueuePolicy() const;
+    void setOutputQueuePolicy(QXmppStream::OutputQueuePolicy policy);
+
+    qint64 outputSchedulingWindow() const;
+    void setOutputSchedulingWindow(qint64 window);
+
+    bool isOutputPresenceCoalescingEnabled() const;
+    void setOutputPresenceCoalescingEnabled(bool enabled);
+
+    bool streamCompressionEnabled() const;
+    void setStreamCompressionEnabled(bool enabled);
+
+    QByteArray loginTokenSecret() const;
+    void setLoginTokenSecret(const QByteArray &secret);
+
+    int loginTokenLifetime() const;
+    void setLoginTokenLifetime(int secs);
+    void revokeLoginTokens(const QString &bareJid);
+
+    bool tlsSessionResumptionEnabled() const;
+    void setTlsSessionResumptionEnabled(bool enabled);
+
+    QList<QSslCipher> tlsCiphers() const;
+    void setTlsCiphers(const QList<QSslCipher> &ciphers);
+
+    int maximumHandshakes() const;
+    void setMaximumHandshakes(int count);
+
+    int connectionAdmissionRate() const;
+    void setConnectionAdmissionRate(int connectionsPerSecond);
+
+    int stanzaTraceInterval() const;
+    void setStanzaTraceInterval(int interval);
+
+    QString trafficCaptureFile() const;
+    void setTrafficCaptureFile(const QString &fileName);
+
+    int streamResumptionTimeout() const;
+    void setStreamResumptionTimeout(int secs);
+
+    int serverStreamResumptionTimeout() const;
+    void setServerStreamResumptionTimeout(int secs);
+
+    bool isServerStreamPipeliningEnabled() const;
+    void setServerStreamPipeliningEnabled(bool enabled);
+
+    int workerThreadCount() const;
+    void setWorkerThreadCount(int count);
+
+    EventDispatcher workerEventDispatcher() const;
+    void setWorkerEventDispatcher(EventDispatcher dispatcher);
+
+    int workerRebalanceInterval() const;
+    void setWorkerRebalanceInterval(int msecs);
+
+    int maximumOutgoingServerLinks() const;
+    qint64 outgoingServerLinkBacklog() const;
+    void setOutgoingServerLinks(int maximum, qint64 backlog);
+
+    int outgoingServerIdleTimeout() const;
+    void setOutgoingServerIdleTimeout(int msecs);
+
+    int certificateCacheTimeout() const;
+    void setCertificateCacheTimeout(int secs);
+
+    QStringList preconnectDomains() const;
+    void setPreconnectDomains(const QStringList &domains);
+
+    int dialbackCacheTimeout() const;
+    void setDialbackCacheTimeout(int secs);
+
+    qint64 connectionByteRate() const;
+    int connectionStanzaRate() const;
+    void setConnectionRateLimit(qint64 bytesPerSecond, int stanzasPerSecond);
+
+    qint64 userByteRate() const;
+    int userStanzaRate() const;
+    void setUserRateLimit(qint64 bytesPerSecond, int stanzasPerSecond);
+
+    qint64 domainByteRate() const;
+    int domainStanzaRate() const;
+    void setDomainRateLimit(qint64 bytesPerSecond, int stanzasPerSecond);
+
+    int overloadStanzaRate() const;
+    void setOverloadStanzaRate(int stanzasPerSecond);
+
+    QString clusterNodeName() const;
+    void setClusterNodeName(const QString &name);
+    void setClusterSecret(const QString &secret);
+    void addClusterNode(const QString &name, const QString &host, quint16 port = 5270);
+    void setClusterNodeRedirectHost(const QString &name, const QString &host);
+
+    int drainRate() const;
+    void setDrainRate(int streamsPerSecond);
+
     QVariantMap statistics() const;
+    QList<QVariantMap> streamStatistics(int count = 0, const QString &key = QLatin1String("processing-time")) const;
 
     void addCaCertificates(const QString &caCertificates);
     void setLocalCertificate(const QString &path);
@@ -86,12 +221,23 @@ public:
     void setPrivateKey(const QSslKey &key);
 
     void close();
+    void drainClients(int count = -1, int reconnectDelay = 0);
     bool listenForClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5222);
+    bool listenForLocalClients(const QString &name);
+    bool listenForBoshClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5281);
+    bool listenForWebSocketClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5280);
     bool listenForServers(const QHostAddress &address = QHostAddress::Any, quint16 port = 5269);
+    bool listenForClusterNodes(const QHostAddress &address = QHostAddress::Any, quint16 port = 5270);
+    bool listenForHandoff(const QString &name);
+    bool takeOverFrom(const QString &name, int msecs = 30000);
 
+    bool sendData(const QString &to, const QByteArray &data);
     bool sendElement(const QDomElement &element);
     bool sendPacket(const QXmppStanza &stanza);
 
+    int broadcastElement(const QDomElement &element, const QSet<QString> &recipients);
+    int broadcastPacket(const QXmppStanza &stanza, const QSet<QString> &recipients);
+
     void addIncomingClient(QXmppIncomingClient *stream);
 
 signals:
@@ -101,20 +247,50 @@ signals:
     /// This signal is emitted when a client has disconnected.
     void clientDisconnected(const QString &jid);
 
+    /// This signal is emitted when the client streams closed by
+    /// drainClients() are all gone.
+    void clientsDrained();
+
+    /// This signal is emitted when the server has handed off to another
+    /// process and was closed, see listenForHandoff().
+    void handedOff();
+
     /// This signal is emitted when the logger changes.
     void loggerChanged(QXmppLogger *logger);
 
 public slots:
     void handleElement(const QDomElement &element);
+    void handleRawStanza(const QXmppRawStanza &stanza);
+    void handleCompactStanza(const QXmppCompactStanza &stanza);
 
 private slots:
+    void _q_boshConnection(QSslSocket *socket);
+    void _q_boshSession(QXmppBoshSession *session);
     void _q_clientConnection(QSslSocket *socket);
     void _q_clientConnected();
     void _q_clientDisconnected();
+    void _q_clientResumeRequested(const QString &id, uint handled);
+    void _q_clientResumptionEnabled(const QString &id);
+    void _q_clientSessionDetached(const QVariantMap &session);
+    void _q_clusterStanzaReceived(const QString &to, const QByteArray &data);
+    void _q_localClientConnection();
     void _q_dialbackRequestReceived(const QXmppDialback &dialback);
+    void _q_dialbackResponseReceived(const QXmppDialback &response);
+    void _q_dialbackVerifyRequested(const QXmppDialback &verify);
+    void _q_drainClients();
+    void _q_finishHandoff();
+    void _q_handoffConnection();
     void _q_outgoingServerDisconnected();
+    void _q_outputQueueChanged();
+    void _q_preconnectDomains();
+    void _q_rebalanceWorkers();
     void _q_serverConnection(QSslSocket *socket);
     void _q_serverDisconnected();
+    void _q_serverDomainVerified(const QString &domain);
+    void _q_serverResumeRequested(const QString &id, uint handled);
+    void _q_serverResumptionEnabled(const QString &id);
+    void _q_serverSessionDetached(const QString &id, uint handled);
+    void _q_webSocketConnection(QSslSocket *socket);
 
 private:
     friend class QXmppServerPrivate;
@@ -138,14 +314,40 @@ public:
     void setLocalCertificate(const QSslCertificate &certificate);
     void setPrivateKey(const QSslKey &key);
 
+    bool isSessionResumptionEnabled() const;
+    void setSessionResumptionEnabled(bool enabled);
+
+    QList<QSslCipher> ciphers() const;
+    void setCiphers(const QList<QSslCipher> &ciphers);
+    static QList<QSslCipher> efficientCiphers();
+
+    int maximumQueuedConnections() const;
+    void setMaximumQueuedConnections(int count);
+
+    int maximumHandshakes() const;
+    void setMaximumHandshakes(int count);
+
+    int admissionRate() const;
+    void setAdmissionRate(int connectionsPerSecond);
+
+    int queuedConnectionCount() const;
+    int handshakeCount() const;
+
 signals:
     /// This signal is emitted when a new connection is established.
     void newConnection(QSslSocket *socket);
 
+private slots:
+    void _q_admitConnections();
+    void _q_handshakeFinished();
+    void _q_socketEncrypted();
+
 private:
     #if QT_VERSION < 0x050000
+    void admitConnection(int socketDescriptor);
     void incomingConnection(int socketDescriptor);
     #else
+    void admitConnection(qintptr socketDescriptor);
     void incomingConnection(qintptr socketDescriptor);
     #endif
     QXmppSslServerPrivate * const d;
@@ -0,0 +1,1241 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QDir>
+#include <QDomElement>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include <QXmlStreamWriter>
+#include <QtEndian>
+
+#if defined(Q_OS_WIN)
+#include <io.h>
+#elif defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+#include "QXmppConstants.h"
+#include "QXmppServer.h"
+#include "QXmppServerArchive.h"
+#include "QXmppServerArchive_p.h"
+#include "QXmppSimpleArchiveIq.h"
+#include "QXmppUtils.h"
+
+// type of the records in the segments
+static const int messageRecord = 1;
+
+// size of the header preceding each record, and of the fixed part of a
+// record's payload: id, timestamp and size of the peer's JID
+static const int recordHeaderSize = 5;
+static const int recordFixedSize = 20;
+
+// size of an index entry: id, timestamp and offset
+static const int indexEntrySize = 24;
+
+// records whose id is a multiple of this are indexed, as well as the
+// first record of each segment
+static const quint64 indexInterval = 64;
+
+// size above which a new segment is started (16 MB)
+static const qint64 defaultSegmentSize = 16 * 1024 * 1024;
+
+// size of the pending records above which they are committed at once,
+// rather than once the server is idle (1 MB)
+static const qint64 commitBatchSize = 1024 * 1024;
+
+static bool syncFile(QFile *file)
+{
+    if (!file->flush())
+        return false;
+#if defined(Q_OS_WIN)
+    return _commit(file->handle()) == 0;
+#elif defined(Q_OS_UNIX)
+    return ::fsync(file->handle()) == 0;
+#else
+    return true;
+#endif
+}
+
+static QByteArray encodeRecord(quint64 id, qint64 stamp, const QString &with, const QByteArray &data)
+{
+    const QByteArray withData = with.toUtf8();
+    const int payloadSize = recordFixedSize + withData.size() + data.size();
+
+    QByteArray record(recordHeaderSize + recordFixedSize, '\0');
+    uchar *ptr = reinterpret_cast<uchar*>(record.data());
+    qToBigEndian<quint32>(payloadSize + 1, ptr);
+    ptr[4] = messageRecord;
+    qToBigEndian<quint64>(id, ptr + recordHeaderSize);
+    qToBigEndian<qint64>(stamp, ptr + recordHeaderSize + 8);
+    qToBigEndian<quint32>(withData.size(), ptr + recordHeaderSize + 16);
+    record += withData;
+    record += data;
+    return record;
+}
+
+// Reads the id and timestamp of the record at \a ptr, and returns its
+// size, or -1 if the \a available data does not hold a whole record.
+
+static qint64 readRecord(const uchar *ptr, qint64 available, quint64 *id, qint64 *stamp)
+{
+    if (available < recordHeaderSize + recordFixedSize)
+        return -1;
+    const quint32 length = qFromBigEndian<quint32>(ptr);
+    if (length < quint32(recordFixedSize + 1) || ptr[4] != messageRecord)
+        return -1;
+    const qint64 size = recordHeaderSize + qint64(length) - 1;
+    const quint32 withSize = qFromBigEndian<quint32>(ptr + recordHeaderSize + 16);
+    if (size > available || recordFixedSize + qint64(withSize) > qint64(length) - 1)
+        return -1;
+    *id = qFromBigEndian<quint64>(ptr + recordHeaderSize);
+    *stamp = qFromBigEndian<qint64>(ptr + recordHeaderSize + 8);
+    return size;
+}
+
+static QString recordWith(const uchar *ptr)
+{
+    const quint32 withSize = qFromBigEndian<quint32>(ptr + recordHeaderSize + 16);
+    return QString::fromUtf8(reinterpret_cast<const char*>(ptr) + recordHeaderSize + recordFixedSize, withSize);
+}
+
+static QByteArray recordData(const uchar *ptr, qint64 size)
+{
+    const quint32 withSize = qFromBigEndian<quint32>(ptr + recordHeaderSize + 16);
+    const int offset = recordHeaderSize + recordFixedSize + withSize;
+    return QByteArray(reinterpret_cast<const char*>(ptr) + offset, size - offset);
+}
+
+// Returns true if the peer's JID of a record matches the \a with of a
+// query, which only matches a resource if it has one.
+
+static bool matchesWith(const QString &recordWith, const QString &with)
+{
+    if (with.isEmpty())
+        return true;
+    if (with.contains(QLatin1Char('/')))
+        return recordWith == with;
+    return QXmppUtils::jidToBareJid(recordWith) == with;
+}
+
+class QXmppArchiveIndexEntry
+{
+public:
+    quint64 id;
+    qint64 stamp;
+    qint64 offset;
+};
+
+static QByteArray encodeIndexEntry(const QXmppArchiveIndexEntry &entry)
+{
+    QByteArray data(indexEntrySize, '\0');
+    uchar *ptr = reinterpret_cast<uchar*>(data.data());
+    qToBigEndian<quint64>(entry.id, ptr);
+    qToBigEndian<qint64>(entry.stamp, ptr + 8);
+    qToBigEndian<qint64>(entry.offset, ptr + 16);
+    return data;
+}
+
+class QXmppArchiveSegment
+{
+public:
+    QXmppArchiveSegment(quint32 n = 0)
+        : number(n), size(0), firstId(0), lastId(0), firstStamp(0), lastStamp(0)
+    {
+    }
+
+    bool isEmpty() const
+    {
+        return !firstId;
+    }
+
+    void add(quint64 id, qint64 stamp, qint64 offset, QByteArray *indexData)
+    {
+        if (isEmpty() || id % indexInterval == 0) {
+            QXmppArchiveIndexEntry entry;
+            entry.id = id;
+            entry.stamp = stamp;
+            entry.offset = offset;
+            index << entry;
+            if (indexData)
+                *indexData += encodeIndexEntry(entry);
+        }
+        if (isEmpty()) {
+            firstId = id;
+            firstStamp = stamp;
+        }
+        lastId = id;
+        lastStamp = stamp;
+    }
+
+    quint32 number;
+    qint64 size;
+    quint64 firstId;
+    quint64 lastId;
+    qint64 firstStamp;
+    qint64 lastStamp;
+    QList<QXmppArchiveIndexEntry> index;
+};
+
+/// \internal
+///
+/// The QXmppArchiveFile class gives access to the contents of a segment,
+/// mapping it into memory if possible.
+
+class QXmppArchiveFile
+{
+public:
+    QXmppArchiveFile()
+        : data(0), size(0), m_map(0)
+    {
+    }
+
+    ~QXmppArchiveFile()
+    {
+        close();
+    }
+
+    bool open(const QString &path, qint64 length)
+    {
+        close();
+        m_file.setFileName(path);
+        if (!m_file.open(QIODevice::ReadOnly))
+            return false;
+        size = qMin(length, m_file.size());
+        if (size <= 0)
+            return true;
+
+        m_map = m_file.map(0, size);
+        if (m_map) {
+            data = m_map;
+        } else {
+            m_buffer = m_file.read(size);
+            size = m_buffer.size();
+            data = reinterpret_cast<const uchar*>(m_buffer.constData());
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (m_map)
+            m_file.unmap(m_map);
+        m_map = 0;
+        m_file.close();
+        m_buffer.clear();
+        data = 0;
+        size = 0;
+    }
+
+    const uchar *data;
+    qint64 size;
+
+private:
+    QFile m_file;
+    uchar *m_map;
+    QByteArray m_buffer;
+};
+
+class QXmppArchiveUser
+{
+public:
+    QXmppArchiveUser()
+        : nextId(1), lastStamp(0)
+    {
+    }
+
+    QString path;
+
+    // segments in order, the last one being appended to
+    QList<QXmppArchiveSegment> segments;
+    quint64 nextId;
+    qint64 lastStamp;
+
+    // records and index entries waiting to be committed
+    QByteArray pending;
+    QByteArray pendingIndex;
+};
+
+class QXmppArchiveStorePrivate
+{
+public:
+    QXmppArchiveStorePrivate();
+    QXmppArchiveUser *user(const QString &bareJid);
+    bool loadSegment(QXmppArchiveUser *user, quint32 number);
+    bool commitUser(QXmppArchiveUser *user);
+    bool rewriteSegments(QXmppArchiveUser *user, int first, int last, qint64 before);
+    void removeSegment(QXmppArchiveUser *user, int i);
+    void locate(QXmppArchiveUser *user, bool byId, quint64 id, qint64 stamp, int *segment, int *entry) const;
+
+    static QString segmentPath(const QXmppArchiveUser *user, quint32 number);
+    static QString indexPath(const QXmppArchiveUser *user, quint32 number);
+
+    QString path;
+    bool opened;
+    qint64 maximumSegmentSize;
+    qint64 pendingSize;
+    QHash<QString, QXmppArchiveUser*> users;
+    QSet<QXmppArchiveUser*> dirtyUsers;
+};
+
+QXmppArchiveStorePrivate::QXmppArchiveStorePrivate()
+    : opened(false)
+    , maximumSegmentSize(defaultSegmentSize)
+    , pendingSize(0)
+{
+}
+
+QString QXmppArchiveStorePrivate::segmentPath(const QXmppArchiveUser *user, quint32 number)
+{
+    return QDir(user->path).filePath(QString("%1.seg").arg(number, 8, 10, QLatin1Char('0')));
+}
+
+QString QXmppArchiveStorePrivate::indexPath(const QXmppArchiveUser *user, quint32 number)
+{
+    return QDir(user->path).filePath(QString("%1.idx").arg(number, 8, 10, QLatin1Char('0')));
+}
+
+/// Returns the archive of the \a bareJid, reading the indexes of its
+/// segments the first time.
+
+QXmppArchiveUser *QXmppArchiveStorePrivate::user(const QString &bareJid)
+{
+    QXmppArchiveUser *user = users.value(bareJid);
+    if (user)
+        return user;
+
+    user = new QXmppArchiveUser;
+    user->path = QDir(path).filePath(QString::fromLatin1(bareJid.toUtf8().toHex()));
+    users.insert(bareJid, user);
+
+    QDir dir(user->path);
+    if (dir.exists()) {
+        // finish the replacement of a segment by compaction
+        foreach (const QString &name, dir.entryList(QStringList() << "*.seg.new", QDir::Files)) {
+            const QString target = name.left(name.size() - 4);
+            if (dir.exists(target))
+                dir.remove(name);
+            else
+                dir.rename(name, target);
+        }
+
+        QList<quint32> numbers;
+        foreach (const QString &name, dir.entryList(QStringList() << "*.seg", QDir::Files)) {
+            bool ok;
+            const quint32 number = name.left(name.size() - 4).toUInt(&ok);
+            if (ok)
+                numbers << number;
+        }
+        qSort(numbers);
+        foreach (quint32 number, numbers)
+            loadSegment(user, number);
+
+        // a compaction which was interrupted may leave segments whose
+        // records were copied to a later one
+        for (int i = user->segments.size() - 2; i >= 0; --i) {
+            const QXmppArchiveSegment &segment = user->segments.at(i);
+            if (segment.isEmpty() || segment.lastId >= user->segments.at(i + 1).firstId)
+                removeSegment(user, i);
+        }
+    }
+
+    if (user->segments.isEmpty())
+        user->segments << QXmppArchiveSegment(1);
+    else if (user->segments.last().size >= maximumSegmentSize)
+        user->segments << QXmppArchiveSegment(user->segments.last().number + 1);
+    foreach (const QXmppArchiveSegment &segment, user->segments) {
+        if (!segment.isEmpty()) {
+            user->nextId = segment.lastId + 1;
+            user->lastStamp = segment.lastStamp;
+        }
+    }
+    return user;
+}
+
+/// Reads the index of a segment, and checks the records which follow its
+/// last entry, truncating a record which was only partly written.
+
+bool QXmppArchiveStorePrivate::loadSegment(QXmppArchiveUser *user, quint32 number)
+{
+    QXmppArchiveSegment segment(number);
+
+    QFile indexFile(indexPath(user, number));
+    QByteArray indexData;
+    if (indexFile.open(QIODevice::ReadOnly))
+        indexData = indexFile.readAll();
+    indexFile.close();
+
+    QFile file(segmentPath(user, number));
+    if (!file.open(QIODevice::ReadWrite))
+        return false;
+    const qint64 fileSize = file.size();
+
+    const uchar *ptr = reinterpret_cast<const uchar*>(indexData.constData());
+    const int entryCount = indexData.size() / indexEntrySize;
+    for (int i = 0; i < entryCount; ++i, ptr += indexEntrySize) {
+        QXmppArchiveIndexEntry entry;
+        entry.id = qFromBigEndian<quint64>(ptr);
+        entry.stamp = qFromBigEndian<qint64>(ptr + 8);
+        entry.offset = qFromBigEndian<qint64>(ptr + 16);
+        if (entry.offset >= fileSize)
+            break;
+        segment.index << entry;
+    }
+
+    QXmppArchiveFile reader;
+    if (!reader.open(file.fileName(), fileSize))
+        return false;
+
+    // scan the records from the last indexed one, going further back if
+    // it turns out not to be valid
+    qint64 offset = 0;
+    bool found = false;
+    while (!found) {
+        offset = 0;
+        if (!segment.index.isEmpty())
+            offset = segment.index.takeLast().offset;
+        if (segment.index.isEmpty()) {
+            segment.firstId = 0;
+        } else {
+            segment.firstId = segment.index.first().id;
+            segment.firstStamp = segment.index.first().stamp;
+        }
+
+        quint64 id;
+        qint64 stamp;
+        qint64 size;
+        while ((size = readRecord(reader.data + offset, reader.size - offset, &id, &stamp)) > 0) {
+            segment.add(id, stamp, offset, 0);
+            offset += size;
+            found = true;
+        }
+        if (!offset)
+            break;
+    }
+    reader.close();
+    segment.size = offset;
+
+    if (offset < fileSize)
+        file.resize(offset);
+    file.close();
+
+    // the index is rebuilt the same way, so it only changed if it has a
+    // different number of entries
+    if (segment.index.size() != entryCount) {
+        QByteArray data;
+        foreach (const QXmppArchiveIndexEntry &entry, segment.index)
+            data += encodeIndexEntry(entry);
+        indexFile.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        indexFile.write(data);
+        indexFile.close();
+    }
+
+    user->segments << segment;
+    return true;
+}
+
+/// Writes the pending records of a \a user with a single write, and waits
+/// until they are stored.
+
+bool QXmppArchiveStorePrivate::commitUser(QXmppArchiveUser *user)
+{
+    if (user->pending.isEmpty())
+        return true;
+
+    QXmppArchiveSegment &segment = user->segments.last();
+    if (!QDir().mkpath(user->path))
+        return false;
+
+    QFile file(segmentPath(user, segment.number));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+    const qint64 committedSize = segment.size - user->pending.size();
+    if (file.size() != committedSize ||
+        file.write(user->pending) != user->pending.size() ||
+        !syncFile(&file)) {
+        file.resize(committedSize);
+        return false;
+    }
+    file.close();
+
+    // the index is rebuilt from the records if it was not written
+    QFile indexFile(indexPath(user, segment.number));
+    if (indexFile.open(QIODevice::WriteOnly | QIODevice::Append))
+        indexFile.write(user->pendingIndex);
+
+    pendingSize -= user->pending.size();
+    user->pending.clear();
+    user->pendingIndex.clear();
+
+    if (segment.size >= maximumSegmentSize)
+        user->segments << QXmppArchiveSegment(segment.number + 1);
+    return true;
+}
+
+/// Replaces the segments from \a first to \a last of a \a user by a
+/// single one, without the records older than \a before.
+///
+/// The new segment is written next to the last one, then takes its
+/// place, and only then are the other segments removed.
+
+bool QXmppArchiveStorePrivate::rewriteSegments(QXmppArchiveUser *user, int first, int last, qint64 before)
+{
+    QXmppArchiveSegment merged(user->segments.at(last).number);
+    const QString targetPath = segmentPath(user, merged.number);
+
+    QFile file(targetPath + QLatin1String(".new"));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QByteArray indexData;
+    QXmppArchiveFile reader;
+    for (int i = first; i <= last; ++i) {
+        const QXmppArchiveSegment &segment = user->segments.at(i);
+        if (!reader.open(segmentPath(user, segment.number), segment.size)) {
+            file.remove();
+            return false;
+        }
+
+        // copy the records which are recent enough, in runs
+        qint64 offset = 0;
+        qint64 runStart = 0;
+        qint64 kept = 0;
+        quint64 id;
+        qint64 stamp;
+        qint64 size;
+        while ((size = readRecord(reader.data + offset, reader.size - offset, &id, &stamp)) > 0) {
+            if (stamp < before) {
+                if (offset > runStart)
+                    file.write(reinterpret_cast<const char*>(reader.data) + runStart, offset - runStart);
+                runStart = offset + size;
+            } else {
+                merged.add(id, stamp, merged.size + kept, &indexData);
+                kept += size;
+            }
+            offset += size;
+        }
+        if (offset > runStart)
+            file.write(reinterpret_cast<const char*>(reader.data) + runStart, offset - runStart);
+        merged.size += kept;
+        reader.close();
+    }
+
+    if (!syncFile(&file)) {
+        file.remove();
+        return false;
+    }
+    file.close();
+
+    if (merged.isEmpty()) {
+        file.remove();
+        for (int i = last; i >= first; --i)
+            removeSegment(user, i);
+        return true;
+    }
+
+    QFile::remove(targetPath);
+    if (!file.rename(targetPath))
+        return false;
+    QFile indexFile(indexPath(user, merged.number));
+    if (indexFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        indexFile.write(indexData);
+
+    user->segments[last] = merged;
+    for (int i = last - 1; i >= first; --i)
+        removeSegment(user, i);
+    return true;
+}
+
+void QXmppArchiveStorePrivate::removeSegment(QXmppArchiveUser *user, int i)
+{
+    const quint32 number = user->segments.at(i).number;
+    QFile::remove(segmentPath(user, number));
+    QFile::remove(indexPath(user, number));
+    user->segments.removeAt(i);
+}
+
+/// Finds the last indexed record of a \a user whose id is at most \a id,
+/// or if \a byId is false, whose timestamp is before \a stamp.
+///
+/// The \a segment is -1 if there is no such record.
+
+void QXmppArchiveStorePrivate::locate(QXmppArchiveUser *user, bool byId, quint64 id, qint64 stamp, int *segment, int *entry) const
+{
+    // the first segment which starts past the target
+    int lo = 0;
+    int hi = user->segments.size();
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        const QXmppArchiveSegment &candidate = user->segments.at(mid);
+        const bool before = !candidate.isEmpty() &&
+            (byId ? candidate.firstId <= id : candidate.firstStamp < stamp);
+        if (before)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *segment = lo - 1;
+    *entry = 0;
+    if (*segment < 0)
+        return;
+
+    // the first index entry past the target
+    const QList<QXmppArchiveIndexEntry> &index = user->segments.at(*segment).index;
+    lo = 0;
+    hi = index.size();
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        const QXmppArchiveIndexEntry &candidate = index.at(mid);
+        if (byId ? candidate.id <= id : candidate.stamp < stamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *entry = lo - 1;
+}
+
+/// Constructs a closed store.
+
+QXmppArchiveStore::QXmppArchiveStore()
+    : d(new QXmppArchiveStorePrivate)
+{
+}
+
+/// Destroys the store, committing any pending records.
+
+QXmppArchiveStore::~QXmppArchiveStore()
+{
+    close();
+    delete d;
+}
+
+/// Opens the store in the directory at \a path, creating it if needed.
+///
+/// The archive of each user is only read when it is first used.
+
+bool QXmppArchiveStore::open(const QString &path)
+{
+    close();
+
+    QDir dir(path);
+    if (!dir.exists() && !dir.mkpath("."))
+        return false;
+    d->path = dir.absolutePath();
+    d->opened = true;
+    return true;
+}
+
+/// Commits any pending records and closes the store.
+
+void QXmppArchiveStore::close()
+{
+    if (d->opened)
+        commit();
+    qDeleteAll(d->users);
+    d->users.clear();
+    d->dirtyUsers.clear();
+    d->pendingSize = 0;
+    d->opened = false;
+}
+
+/// Returns true if the store is open.
+
+bool QXmppArchiveStore::isOpen() const
+{
+    return d->opened;
+}
+
+/// Returns the size above which a new segment is started.
+
+qint64 QXmppArchiveStore::maximumSegmentSize() const
+{
+    return d->maximumSegmentSize;
+}
+
+/// Sets the size above which a new segment is started, which is also the
+/// size up to which compact() merges segments.
+///
+/// \param size
+
+void QXmppArchiveStore::setMaximumSegmentSize(qint64 size)
+{
+    d->maximumSegmentSize = size;
+}
+
+/// Appends a message to the archive of the \a bareJid, which is only
+/// written to disk by the next commit().
+///
+/// Returns the id of the record, or 0 if the store is not open.
+///
+/// \param bareJid
+/// \param with The JID of the peer the message was exchanged with.
+/// \param stamp The time at which the message was archived. It is moved
+/// forward if needed, so that timestamps follow ids.
+/// \param data The serialized message.
+
+quint64 QXmppArchiveStore::append(const QString &bareJid, const QString &with, const QDateTime &stamp, const QByteArray &data)
+{
+    if (!d->opened)
+        return 0;
+
+    QXmppArchiveUser *user = d->user(bareJid);
+    const quint64 id = user->nextId++;
+    user->lastStamp = qMax(user->lastStamp, stamp.toMSecsSinceEpoch());
+
+    const QByteArray record = encodeRecord(id, user->lastStamp, with, data);
+    QXmppArchiveSegment &segment = user->segments.last();
+    segment.add(id, user->lastStamp, segment.size, &user->pendingIndex);
+    segment.size += record.size();
+
+    user->pending += record;
+    d->pendingSize += record.size();
+    d->dirtyUsers.insert(user);
+    return id;
+}
+
+/// Writes the pending records to disk, and waits until they are stored.
+///
+/// Returns true if all the records were stored. Otherwise the records of
+/// the users which failed are kept for the next attempt.
+
+bool QXmppArchiveStore::commit()
+{
+    bool ok = true;
+    QSet<QXmppArchiveUser*>::iterator it = d->dirtyUsers.begin();
+    while (it != d->dirtyUsers.end()) {
+        if (d->commitUser(*it)) {
+            it = d->dirtyUsers.erase(it);
+        } else {
+            ok = false;
+            ++it;
+        }
+    }
+    return ok;
+}
+
+/// Returns the size of the records waiting to be committed.
+
+qint64 QXmppArchiveStore::pendingSize() const
+{
+    return d->pendingSize;
+}
+
+/// Returns the records of the archive of the \a bareJid which match a
+/// query, in chronological order, committing its pending records first.
+///
+/// If \a before is not 0, the last \a max records before it are returned,
+/// otherwise the first \a max records after \a after, skipping the first
+/// \a index ones. A negative \a max means there is no limit.
+///
+/// \param bareJid
+/// \param with The JID of the peer, or its bare JID for all its resources.
+/// \param start The earliest timestamp, if valid.
+/// \param end The latest timestamp, if valid.
+/// \param after
+/// \param before
+/// \param index
+/// \param max
+/// \param complete Set to true if no other records match the query.
+
+QList<QXmppArchiveStore::Record> QXmppArchiveStore::records(const QString &bareJid, const QString &with, const QDateTime &start, const QDateTime &end, quint64 after, quint64 before, int index, int max, bool *complete)
+{
+    QList<Record> result;
+    if (complete)
+        *complete = true;
+    if (!d->opened)
+        return result;
+
+    QXmppArchiveUser *user = d->user(bareJid);
+    if (!d->commitUser(user))
+        return result;
+    d->dirtyUsers.remove(user);
+
+    const qint64 startStamp = start.isValid() ? start.toMSecsSinceEpoch() : Q_INT64_C(-0x7fffffffffffffff);
+    const qint64 endStamp = end.isValid() ? end.toMSecsSinceEpoch() : Q_INT64_C(0x7fffffffffffffff);
+    const bool backward = before > 0;
+
+    // the block to start reading from, a block being the records from
+    // one index entry to the next
+    int segment, entry;
+    if (backward) {
+        int stampSegment, stampEntry;
+        d->locate(user, true, before - 1, 0, &segment, &entry);
+        d->locate(user, false, 0, endStamp == Q_INT64_C(0x7fffffffffffffff) ? endStamp : endStamp + 1, &stampSegment, &stampEntry);
+        if (stampSegment < segment || (stampSegment == segment && stampEntry < entry)) {
+            segment = stampSegment;
+            entry = stampEntry;
+        }
+    } else {
+        int stampSegment, stampEntry;
+        d->locate(user, true, after + 1, 0, &segment, &entry);
+        d->locate(user, false, 0, startStamp, &stampSegment, &stampEntry);
+        if (stampSegment > segment || (stampSegment == segment && stampEntry > entry)) {
+            segment = stampSegment;
+            entry = stampEntry;
+        }
+        if (segment < 0) {
+            segment = 0;
+            entry = 0;
+        }
+    }
+
+    QXmppArchiveFile reader;
+    int readerSegment = -1;
+    int skipped = 0;
+    bool done = false;
+    while (!done && segment >= 0 && segment < user->segments.size()) {
+        const QXmppArchiveSegment &current = user->segments.at(segment);
+        if (current.index.isEmpty()) {
+            segment += backward ? -1 : 1;
+            entry = backward ? -1 : 0;
+            continue;
+        }
+        if (backward && entry < 0)
+            entry = current.index.size() - 1;
+        if (readerSegment != segment) {
+            if (!reader.open(QXmppArchiveStorePrivate::segmentPath(user, current.number), current.size))
+                break;
+            readerSegment = segment;
+        }
+
+        // read the block sequentially
+        qint64 offset = current.index.at(entry).offset;
+        const qint64 blockEnd = (entry + 1 < current.index.size()) ? current.index.at(entry + 1).offset : reader.size;
+        QList<Record> block;
+        quint64 id;
+        qint64 stamp;
+        qint64 size;
+        while (offset < blockEnd && (size = readRecord(reader.data + offset, reader.size - offset, &id, &stamp)) > 0) {
+            const uchar *ptr = reader.data + offset;
+            offset += size;
+            if ((backward && id >= before) || stamp > endStamp) {
+                done = !backward;
+                break;
+            }
+            if (id <= after || stamp < startStamp)
+                continue;
+            if (!with.isEmpty() && !matchesWith(recordWith(ptr), with))
+                continue;
+            if (!backward && skipped < index) {
+                skipped++;
+                continue;
+            }
+
+            // one more record tells whether the result is complete
+            if (!backward && max >= 0 && result.size() >= max) {
+                if (complete)
+                    *complete = false;
+                done = true;
+                break;
+            }
+
+            Record record;
+            record.id = id;
+            record.stamp = QDateTime::fromMSecsSinceEpoch(stamp).toUTC();
+            record.with = recordWith(ptr);
+            record.data = recordData(ptr, size);
+            block << record;
+        }
+
+        if (backward) {
+            result = block + result;
+            if (max >= 0 && result.size() > max) {
+                if (complete)
+                    *complete = false;
+                result = result.mid(result.size() - max);
+                done = true;
+            }
+            if (current.index.at(entry).stamp < startStamp)
+                done = true;
+            if (--entry < 0)
+                segment--;
+        } else {
+            result += block;
+            if (++entry >= current.index.size()) {
+                segment++;
+                entry = 0;
+            }
+        }
+    }
+    return result;
+}
+
+/// Removes the records of the archive of the \a bareJid which are older
+/// than \a before, and merges its segments which are smaller than
+/// maximumSegmentSize() together.
+///
+/// The segment being appended to is left untouched.
+///
+/// \param bareJid
+/// \param before
+
+bool QXmppArchiveStore::compact(const QString &bareJid, const QDateTime &before)
+{
+    if (!d->opened)
+        return false;
+
+    QXmppArchiveUser *user = d->user(bareJid);
+    if (!d->commitUser(user))
+        return false;
+    d->dirtyUsers.remove(user);
+
+    const qint64 beforeStamp = before.isValid() ? before.toMSecsSinceEpoch() : Q_INT64_C(-0x7fffffffffffffff);
+
+    // drop the segments which only hold old records
+    while (user->segments.size() > 1 && user->segments.first().lastStamp < beforeStamp)
+        d->removeSegment(user, 0);
+
+    // rewrite runs of small segments, and those holding old records
+    int i = 0;
+    while (i < user->segments.size() - 1) {
+        int last = i;
+        qint64 total = user->segments.at(i).size;
+        while (last + 1 < user->segments.size() - 1 &&
+               total + user->segments.at(last + 1).size <= d->maximumSegmentSize) {
+            total += user->segments.at(++last).size;
+        }
+
+        const int count = user->segments.size();
+        if (last > i || user->segments.at(i).firstStamp < beforeStamp) {
+            if (!d->rewriteSegments(user, i, last, beforeStamp))
+                return false;
+        }
+        if (user->segments.size() == count - (last - i) - 1)
+            continue;
+        ++i;
+    }
+    return true;
+}
+
+/// Returns the bare JIDs of the users who have an archive on disk.
+
+QStringList QXmppArchiveStore::users() const
+{
+    QStringList result;
+    if (!d->opened)
+        return result;
+
+    QDir dir(d->path);
+    foreach (const QString &name, dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+        result << QString::fromUtf8(QByteArray::fromHex(name.toLatin1()));
+    return result;
+}
+
+/// Returns the number of segments of the archive of the \a bareJid.
+///
+/// \param bareJid
+
+int QXmppArchiveStore::segmentCount(const QString &bareJid)
+{
+    if (!d->opened)
+        return 0;
+    return d->user(bareJid)->segments.size();
+}
+
+static QByteArray escapeAttribute(const QString &value)
+{
+    QByteArray escaped = value.toUtf8();
+    escaped.replace('&', "&amp;");
+    escaped.replace('<', "&lt;");
+    escaped.replace('\'', "&apos;");
+    return escaped;
+}
+
+class QXmppServerArchivePrivate
+{
+public:
+    bool isLocal(const QString &jid) const;
+    bool handleQuery(const QDomElement &stanza);
+
+    QXmppServer *server;
+    QString path;
+    int maximumAge;
+    int maximumResults;
+    QXmppArchiveStore store;
+    QTimer *commitTimer;
+    QTimer *compactTimer;
+};
+
+/// Returns true if the \a jid belongs to a user of the server.
+
+bool QXmppServerArchivePrivate::isLocal(const QString &jid) const
+{
+    return !QXmppUtils::jidToUser(jid).isEmpty() &&
+           QXmppUtils::jidToDomain(jid) == server->domain();
+}
+
+/// Answers a query of a local user for its archive, sending the matching
+/// messages and the result in a single write.
+
+bool QXmppServerArchivePrivate::handleQuery(const QDomElement &stanza)
+{
+    const QString from = stanza.attribute("from");
+    const QString to = stanza.attribute("to");
+    const QString bareJid = QXmppUtils::jidToBareJid(from);
+    const QString type = stanza.attribute("type");
+    if (!isLocal(from) || (!to.isEmpty() && to != bareJid) ||
+        (type != QLatin1String("get") && type != QLatin1String("set")))
+        return false;
+
+    QXmppSimpleArchiveQueryIq request;
+    request.parse(stanza);
+    const QXmppResultSetQuery rsm = request.resultSetQuery();
+
+    int max = rsm.max();
+    if (max < 0 || (maximumResults > 0 && max > maximumResults))
+        max = maximumResults > 0 ? maximumResults : -1;
+
+    // ids are the RSM identifiers of the records
+    const quint64 after = rsm.after().toULongLong();
+    const quint64 before = rsm.before().toULongLong();
+    const QList<QXmppArchiveStore::Record> records = store.records(
+        bareJid, request.with(), request.start(), request.end(),
+        after, before, qMax(rsm.index(), 0), max);
+
+    QByteArray data;
+    const QByteArray queryId = escapeAttribute(request.queryId());
+    foreach (const QXmppArchiveStore::Record &record, records) {
+        QByteArray message = record.data;
+        if (message.startsWith("<message"))
+            message.insert(8, " xmlns='" + QByteArray(ns_client.latin1()) + "'");
+
+        data += "<message to='" + escapeAttribute(from) + "'>"
+                "<result xmlns='" + QByteArray(ns_simple_archive.latin1()) +
+                "' queryid='" + queryId +
+                "' id='" + QByteArray::number(record.id) + "'>"
+                "<forwarded xmlns='" + QByteArray(ns_stanza_forwarding.latin1()) + "'>"
+                "<delay xmlns='" + QByteArray(ns_delayed_delivery.latin1()) +
+                "' stamp='" + QXmppUtils::datetimeToString(record.stamp).toLatin1() + "'/>" +
+                message +
+                "</forwarded></result></message>";
+    }
+
+    QXmppSimpleArchiveQueryIq response;
+    response.setType(QXmppIq::Result);
+    response.setId(request.id());
+    response.setTo(from);
+    response.setQueryId(request.queryId());
+    if (!records.isEmpty()) {
+        QXmppResultSetReply reply;
+        reply.setFirst(QString::number(records.first().id));
+        reply.setLast(QString::number(records.last().id));
+        response.setResultSetReply(reply);
+    }
+    data += helperToXmlData(response);
+
+    server->sendData(from, data);
+    return true;
+}
+
+/// Constructs a new message archive.
+
+QXmppServerArchive::QXmppServerArchive()
+    : d(new QXmppServerArchivePrivate)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->server = 0;
+    d->maximumAge = 0;
+    d->maximumResults = 50;
+
+    // commit the messages archived while handling a batch of incoming
+    // data once the server is idle
+    d->commitTimer = new QTimer(this);
+    d->commitTimer->setInterval(0);
+    d->commitTimer->setSingleShot(true);
+    check = connect(d->commitTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_commit()));
+    Q_ASSERT(check);
+
+    d->compactTimer = new QTimer(this);
+    d->compactTimer->setInterval(3600 * 1000);
+    check = connect(d->compactTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_compact()));
+    Q_ASSERT(check);
+}
+
+/// Destroys the message archive.
+
+QXmppServerArchive::~QXmppServerArchive()
+{
+    delete d;
+}
+
+/// Returns the path of the directory holding the archives.
+
+QString QXmppServerArchive::path() const
+{
+    return d->path;
+}
+
+/// Sets the path of the directory holding the archives.
+///
+/// \param path
+
+void QXmppServerArchive::setPath(const QString &path)
+{
+    d->path = path;
+}
+
+/// Returns the number of days after which archived messages are removed.
+
+int QXmppServerArchive::maximumAge() const
+{
+    return d->maximumAge;
+}
+
+/// Sets the number of days after which archived messages are removed,
+/// 0 meaning they are kept forever.
+///
+/// The default is 0.
+///
+/// \param days
+
+void QXmppServerArchive::setMaximumAge(int days)
+{
+    d->maximumAge = days;
+}
+
+/// Returns the maximum number of messages returned for a query.
+
+int QXmppServerArchive::maximumResults() const
+{
+    return d->maximumResults;
+}
+
+/// Sets the maximum number of messages returned for a query, 0 meaning
+/// no limit. A client pages through larger results using Result Set
+/// Management.
+///
+/// The default is 50.
+///
+/// \param count
+
+void QXmppServerArchive::setMaximumResults(int count)
+{
+    d->maximumResults = count;
+}
+
+/// \cond
+QStringList QXmppServerArchive::discoveryFeatures() const
+{
+    return QStringList() << ns_simple_archive;
+}
+
+bool QXmppServerArchive::handleStanza(const QDomElement &stanza)
+{
+    if (!d->store.isOpen())
+        return false;
+
+    if (stanza.tagName() == QLatin1String("iq"))
+        return d->handleQuery(stanza);
+
+    // only archive messages of type "normal" and "chat" with a body
+    const QString type = stanza.attribute("type");
+    if ((!type.isEmpty() && type != QLatin1String("normal") && type != QLatin1String("chat")) ||
+        stanza.firstChildElement("body").isNull())
+        return false;
+
+    const QString from = stanza.attribute("from");
+    const QString to = stanza.attribute("to");
+    const QString fromBareJid = QXmppUtils::jidToBareJid(from);
+    const QString toBareJid = QXmppUtils::jidToBareJid(to);
+    const bool fromLocal = d->isLocal(from);
+    const bool toLocal = d->isLocal(to) && toBareJid != fromBareJid;
+    if (!fromLocal && !toLocal)
+        return false;
+
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    const QStringList omitNamespaces = QStringList() << ns_client << ns_server;
+    helperToXmlAddDomElement(&xmlStream, stanza, omitNamespaces);
+
+    const QDateTime stamp = QDateTime::currentDateTime().toUTC();
+    if (fromLocal)
+        d->store.append(fromBareJid, to, stamp, data);
+    if (toLocal)
+        d->store.append(toBareJid, from, stamp, data);
+    updateCounter("archive.stored");
+
+    if (d->store.pendingSize() >= commitBatchSize)
+        _q_commit();
+    else if (!d->commitTimer->isActive())
+        d->commitTimer->start();
+
+    // let the server route the message
+    return false;
+}
+
+QList<QXmppServerExtension::StanzaFilter> QXmppServerArchive::stanzaFilters() const
+{
+    return QList<StanzaFilter>()
+        << StanzaFilter("message")
+        << StanzaFilter("iq", ns_simple_archive);
+}
+
+bool QXmppServerArchive::start()
+{
+    if (d->path.isEmpty()) {
+        warning("No path was specified for the message archive");
+        return false;
+    }
+    if (!d->store.open(d->path)) {
+        warning(QString("Could not open the message archive in %1").arg(d->path));
+        return false;
+    }
+
+    d->server = server();
+    if (d->maximumAge > 0) {
+        d->compactTimer->start();
+        _q_compact();
+    }
+    return true;
+}
+
+void QXmppServerArchive::stop()
+{
+    d->commitTimer->stop();
+    d->compactTimer->stop();
+    d->store.close();
+}
+/// \endcond
+
+void QXmppServerArchive::_q_commit()
+{
+    d->commitTimer->stop();
+    if (!d->store.commit())
+        warning(QString("Could not write the message archive to %1").arg(d->path));
+}
+
+void QXmppServerArchive::_q_compact()
+{
+    const QDateTime before = QDateTime::currentDateTime().toUTC().addDays(-d->maximumAge);
+    foreach (const QString &bareJid, d->store.users()) {
+        if (!d->store.compact(bareJid, before))
+            warning(QString("Could not compact the message archive of %1").arg(bareJid));
+    }
+}
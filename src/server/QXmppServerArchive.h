@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPSERVERARCHIVE_H
+#define QXMPPSERVERARCHIVE_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerArchivePrivate;
+
+/// \brief The QXmppServerArchive class is a server extension which keeps
+/// an archive of the messages exchanged by local users, and lets them
+/// query it as defined by XEP-0313: Message Archive Management.
+///
+/// Messages of type "normal" and "chat" with a body are stored in the
+/// archive of their local sender and recipient, in the directory given by
+/// setPath(). Each archive is made of append-only segments with a sparse
+/// index of record ids and timestamps, so that paging through a large
+/// archive only reads the records it returns.
+///
+/// Messages are written in batches, like QXmppServerOffline. If a maximum
+/// age is set, older messages are removed hourly.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerArchive : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "archive")
+    Q_PROPERTY(QString path READ path WRITE setPath)
+    Q_PROPERTY(int maximumAge READ maximumAge WRITE setMaximumAge)
+    Q_PROPERTY(int maximumResults READ maximumResults WRITE setMaximumResults)
+
+public:
+    QXmppServerArchive();
+    ~QXmppServerArchive();
+
+    QString path() const;
+    void setPath(const QString &path);
+
+    int maximumAge() const;
+    void setMaximumAge(int days);
+
+    int maximumResults() const;
+    void setMaximumResults(int count);
+
+    /// \cond
+    QStringList discoveryFeatures() const;
+    bool handleStanza(const QDomElement &stanza);
+    QList<StanzaFilter> stanzaFilters() const;
+
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_commit();
+    void _q_compact();
+
+private:
+    QXmppServerArchivePrivate * const d;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPSERVERARCHIVE_P_H
+#define QXMPPSERVERARCHIVE_P_H
+
+#include <QDateTime>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "QXmppGlobal.h"
+
+class QXmppArchiveStorePrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServerArchive class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppArchiveStore class stores the message archive of each user in
+/// append-only segment files.
+///
+/// Each user has a directory of numbered segments. Each record gets an
+/// id which grows with its timestamp, and a sparse index of the id,
+/// timestamp and offset of every 64th record is kept next to each
+/// segment, so that a query seeks to the nearest indexed record and reads
+/// sequentially from there, using memory-mapped segments. Appended
+/// records are buffered until commit() writes them with a single write
+/// and a single sync per user.
+///
+/// compact() drops the records older than a given time and merges small
+/// segments into larger ones.
+
+class QXMPP_AUTOTEST_EXPORT QXmppArchiveStore
+{
+public:
+    struct Record
+    {
+        quint64 id;
+        QDateTime stamp;
+        QString with;
+        QByteArray data;
+    };
+
+    QXmppArchiveStore();
+    ~QXmppArchiveStore();
+
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const;
+
+    qint64 maximumSegmentSize() const;
+    void setMaximumSegmentSize(qint64 size);
+
+    quint64 append(const QString &bareJid, const QString &with, const QDateTime &stamp, const QByteArray &data);
+    bool commit();
+    qint64 pendingSize() const;
+
+    QList<Record> records(const QString &bareJid, const QString &with,
+                          const QDateTime &start, const QDateTime &end,
+                          quint64 after, quint64 before, int index, int max,
+                          bool *complete = 0);
+
+    bool compact(const QString &bareJid, const QDateTime &before);
+    QStringList users() const;
+    int segmentCount(const QString &bareJid);
+
+private:
+    Q_DISABLE_COPY(QXmppArchiveStore)
+    QXmppArchiveStorePrivate * const d;
+};
+
+#endif
@@ -28,6 +28,77 @@
 #include "QXmppLogger.h"
 #include "QXmppServer.h"
 #include "QXmppServerExtension.h"
+#include "QXmppUtils.h"
+
+/// Constructs a stanza filter.
+///
+/// \param tagName The stanza's tag name, for instance "iq".
+/// \param childNamespace The namespace of a child element, for instance "jabber:iq:roster".
+/// \param childTagName The tag name of a child element, for instance "query".
+
+QXmppServerExtension::StanzaFilter::StanzaFilter(const QString &tagName, const QString &childNamespace, const QString &childTagName)
+    : m_tagName(tagName)
+    , m_childNamespace(childNamespace)
+    , m_childTagName(childTagName)
+{
+}
+
+/// Returns the tag name of the stanzas, or an empty string for any stanza.
+
+QString QXmppServerExtension::StanzaFilter::tagName() const
+{
+    return m_tagName;
+}
+
+/// Returns the namespace of the child element the stanzas must have, if any.
+
+QString QXmppServerExtension::StanzaFilter::childNamespace() const
+{
+    return m_childNamespace;
+}
+
+/// Returns the tag name of the child element the stanzas must have, if any.
+
+QString QXmppServerExtension::StanzaFilter::childTagName() const
+{
+    return m_childTagName;
+}
+
+/// Returns the domain the stanzas must be addressed to, if any.
+
+QString QXmppServerExtension::StanzaFilter::domain() const
+{
+    return m_domain;
+}
+
+/// Sets the domain the stanzas must be addressed to, for instance the
+/// domain of a component.
+///
+/// \param domain
+
+void QXmppServerExtension::StanzaFilter::setDomain(const QString &domain)
+{
+    m_domain = domain;
+}
+
+/// Returns true if the given \a stanza matches the filter.
+
+bool QXmppServerExtension::StanzaFilter::matches(const QDomElement &stanza) const
+{
+    if (!m_tagName.isEmpty() && stanza.tagName() != m_tagName)
+        return false;
+    if (!m_domain.isEmpty() && QXmppUtils::jidToDomain(stanza.attribute("to")) != m_domain)
+        return false;
+    if (m_childNamespace.isEmpty() && m_childTagName.isEmpty())
+        return true;
+
+    for (QDomElement child = stanza.firstChildElement(); !child.isNull(); child = child.nextSiblingElement()) {
+        if ((m_childNamespace.isEmpty() || child.namespaceURI() == m_childNamespace) &&
+            (m_childTagName.isEmpty() || child.tagName() == m_childTagName))
+            return true;
+    }
+    return false;
+}
 
 class QXmppServerExtensionPrivate
 {
@@ -98,6 +169,39 @@ bool QXmppServerExtension::handleStanza(const QDomElement &stanza)
     return false;
 }
 
+/// Handles a stanza for a user of the server's domain which could not be
+/// delivered because none of the user's resources is connected.
+///
+/// Unlike handleStanza(), this is called with the serialized stanza, which
+/// saves building a DOM tree for the stanzas the extension does not keep.
+///
+/// Return true if the extension took charge of the stanza, false otherwise.
+///
+/// \param to The recipient of the stanza.
+/// \param data The serialized stanza.
+
+bool QXmppServerExtension::handleUndeliveredStanza(const QString &to, const QByteArray &data)
+{
+    Q_UNUSED(to);
+    Q_UNUSED(data);
+    return false;
+}
+
+/// Returns the incoming stanzas which handleStanza() should be called for.
+///
+/// The server only offers an extension the stanzas which match one of
+/// its filters, which saves extensions from inspecting stanzas they do
+/// not handle. The filters are read when the extension is added and
+/// when the server starts.
+///
+/// The default implementation returns an empty list, in which case
+/// handleStanza() is called for all stanzas.
+
+QList<QXmppServerExtension::StanzaFilter> QXmppServerExtension::stanzaFilters() const
+{
+    return QList<StanzaFilter>();
+}
+
 /// Returns the list of subscribers for the given JID.
 ///
 /// \param jid
@@ -118,6 +222,28 @@ QSet<QString> QXmppServerExtension::presenceSubscriptions(const QString &jid)
     return QSet<QString>();
 }
 
+/// Returns the in-memory state of the extension, so that it can be
+/// handed over to the extension which replaces it.
+///
+/// \sa QXmppServer::replaceExtension(), QXmppServer::reloadPlugin()
+
+QByteArray QXmppServerExtension::saveState() const
+{
+    return QByteArray();
+}
+
+/// Restores a \a state saved by saveState(), possibly by another version
+/// of the extension. This is called before the extension is started.
+///
+/// Return true if the state was restored, false otherwise.
+///
+/// \param state
+
+bool QXmppServerExtension::restoreState(const QByteArray &state)
+{
+    return state.isEmpty();
+}
+
 /// Starts the extension.
 ///
 /// Return true if the extension was started, false otherwise.
@@ -24,6 +24,7 @@
 #ifndef QXMPPSERVEREXTENSION_H
 #define QXMPPSERVEREXTENSION_H
 
+#include <QList>
 #include <QVariant>
 
 #include "QXmppLogger.h"
@@ -50,6 +51,40 @@ class QXMPP_EXPORT QXmppServerExtension : public QXmppLoggable
     Q_OBJECT
 
 public:
+    /// \brief The StanzaFilter class describes incoming stanzas which an
+    /// extension handles.
+    ///
+    /// A stanza matches if its tag name is tagName() and, if a child
+    /// namespace or tag name is set, it has a child element with that
+    /// namespace and tag name. An empty tag name matches any stanza.
+    ///
+    /// If a domain is set, only the stanzas addressed to that domain
+    /// match, which lets the server route all the other stanzas without
+    /// building their DOM tree.
+
+    class QXMPP_EXPORT StanzaFilter
+    {
+    public:
+        StanzaFilter(const QString &tagName = QString(),
+                     const QString &childNamespace = QString(),
+                     const QString &childTagName = QString());
+
+        QString tagName() const;
+        QString childNamespace() const;
+        QString childTagName() const;
+
+        QString domain() const;
+        void setDomain(const QString &domain);
+
+        bool matches(const QDomElement &stanza) const;
+
+    private:
+        QString m_tagName;
+        QString m_childNamespace;
+        QString m_childTagName;
+        QString m_domain;
+    };
+
     QXmppServerExtension();
     ~QXmppServerExtension();
     virtual QString extensionName() const;
@@ -58,9 +93,14 @@ public:
     virtual QStringList discoveryFeatures() const;
     virtual QStringList discoveryItems() const;
     virtual bool handleStanza(const QDomElement &stanza);
+    virtual bool handleUndeliveredStanza(const QString &to, const QByteArray &data);
+    virtual QList<StanzaFilter> stanzaFilters() const;
     virtual QSet<QString> presenceSubscribers(const QString &jid);
     virtual QSet<QString> presenceSubscriptions(const QString &jid);
 
+    virtual QByteArray saveState() const;
+    virtual bool restoreState(const QByteArray &state);
+
     virtual bool start();
     virtual void stop();
 
@@ -0,0 +1,681 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDateTime>
+#include <QDomElement>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+#include "QXmppConstants.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppMessage.h"
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppServerMuc.h"
+#include "QXmppUtils.h"
+
+// status code of the presences an occupant receives about itself
+static const int selfPresenceStatus = 110;
+
+static QByteArray escapeJid(const QString &jid)
+{
+    QByteArray escaped = jid.toUtf8();
+    escaped.replace('&', "&amp;");
+    escaped.replace('<', "&lt;");
+    escaped.replace('\'', "&apos;");
+    return escaped;
+}
+
+/// \internal
+///
+/// The QXmppServerMucTemplate class holds a serialized stanza without a
+/// recipient, and the position at which the "to" attribute of each copy
+/// is inserted.
+
+class QXmppServerMucTemplate
+{
+public:
+    QXmppServerMucTemplate(const QByteArray &data = QByteArray())
+        : m_data(data)
+    {
+        // attribute values are escaped, so the first '>' ends the start tag
+        m_position = data.indexOf('>');
+        if (m_position > 0 && data.at(m_position - 1) == '/')
+            m_position--;
+    }
+
+    bool isNull() const
+    {
+        return m_position < 0;
+    }
+
+    /// Appends the copy of the stanza for the given escaped recipient
+    /// \a to to \a out.
+
+    void appendTo(QByteArray &out, const QByteArray &to) const
+    {
+        if (m_position < 0)
+            return;
+        out.append(m_data.constData(), m_position);
+        out.append(" to='");
+        out.append(to);
+        out.append('\'');
+        out.append(m_data.constData() + m_position, m_data.size() - m_position);
+    }
+
+    int size() const
+    {
+        return m_data.size();
+    }
+
+private:
+    QByteArray m_data;
+    int m_position;
+};
+
+/// \internal
+///
+/// The QXmppServerMucRoom class holds the state of a room.
+///
+/// The occupants are stored in parallel arrays, which broadcasts walk
+/// through in order. Leaving occupants are replaced by the last one, so
+/// the arrays never have holes.
+
+class QXmppServerMucRoom
+{
+public:
+    QXmppServerMucRoom(const QString &jid, int historySize);
+
+    int addOccupant(const QString &nick, const QString &jid, const QString &domain);
+    void removeOccupant(int index);
+
+    void addHistory(const QXmppServerMucTemplate &message);
+    const QXmppServerMucTemplate &historyAt(int i) const;
+    int historyCount() const;
+
+    QString jid;
+    QString owner;
+    QXmppServerMucTemplate subject;
+
+    // occupants
+    QVector<QString> nicks;
+    QVector<QString> jids;
+    QVector<QString> domains;
+    QVector<QByteArray> recipients;
+    QVector<QXmppServerMucTemplate> presences;
+    QHash<QString, int> nickIndexes;
+    QHash<QString, int> jidIndexes;
+
+private:
+    // ring buffer of the last messages
+    QVector<QXmppServerMucTemplate> m_history;
+    int m_historyStart;
+    int m_historyCount;
+};
+
+QXmppServerMucRoom::QXmppServerMucRoom(const QString &jid, int historySize)
+    : jid(jid)
+    , m_history(qMax(0, historySize))
+    , m_historyStart(0)
+    , m_historyCount(0)
+{
+}
+
+/// Adds an occupant and returns its index.
+
+int QXmppServerMucRoom::addOccupant(const QString &nick, const QString &jid, const QString &domain)
+{
+    const int index = jids.size();
+    nicks << nick;
+    jids << jid;
+    domains << domain;
+    recipients << escapeJid(jid);
+    presences << QXmppServerMucTemplate();
+    nickIndexes.insert(nick, index);
+    jidIndexes.insert(jid, index);
+    return index;
+}
+
+/// Removes the occupant at \a index, moving the last occupant in its place.
+
+void QXmppServerMucRoom::removeOccupant(int index)
+{
+    nickIndexes.remove(nicks[index]);
+    jidIndexes.remove(jids[index]);
+
+    const int last = jids.size() - 1;
+    if (index != last) {
+        nicks[index] = nicks[last];
+        jids[index] = jids[last];
+        domains[index] = domains[last];
+        recipients[index] = recipients[last];
+        presences[index] = presences[last];
+        nickIndexes.insert(nicks[index], index);
+        jidIndexes.insert(jids[index], index);
+    }
+    nicks.resize(last);
+    jids.resize(last);
+    domains.resize(last);
+    recipients.resize(last);
+    presences.resize(last);
+}
+
+void QXmppServerMucRoom::addHistory(const QXmppServerMucTemplate &message)
+{
+    const int capacity = m_history.size();
+    if (!capacity)
+        return;
+    if (m_historyCount < capacity) {
+        m_history[(m_historyStart + m_historyCount++) % capacity] = message;
+    } else {
+        m_history[m_historyStart] = message;
+        m_historyStart = (m_historyStart + 1) % capacity;
+    }
+}
+
+/// Returns the \a i-th message of the history, from the oldest one.
+
+const QXmppServerMucTemplate &QXmppServerMucRoom::historyAt(int i) const
+{
+    return m_history.at((m_historyStart + i) % m_history.size());
+}
+
+int QXmppServerMucRoom::historyCount() const
+{
+    return m_historyCount;
+}
+
+class QXmppServerMucPrivate
+{
+public:
+    QXmppServerMucPrivate();
+    void broadcast(QXmppServerMucRoom *room, const QXmppServerMucTemplate &stanza, int except = -1);
+    void join(QXmppServerMucRoom *room, const QString &jid, const QString &nick, const QXmppPresence &presence, int maxStanzas);
+    void leave(QXmppServerMucRoom *room, int index, const QXmppPresence &presence);
+    QXmppServerMucTemplate occupantPresence(QXmppServerMucRoom *room, int index, QXmppPresence presence, bool self) const;
+    void sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition);
+
+    void handleIq(const QDomElement &element);
+    bool handleMessage(const QDomElement &element);
+    void handlePresence(const QDomElement &element);
+
+    QString jid;
+    int historySize;
+    QXmppServer *server;
+    QHash<QString, QXmppServerMucRoom*> rooms;
+
+    // rooms joined by each occupant, by full JID
+    QHash<QString, QSet<QString> > occupantRooms;
+};
+
+QXmppServerMucPrivate::QXmppServerMucPrivate()
+    : historySize(20)
+    , server(0)
+{
+}
+
+/// Sends a copy of the \a stanza to each occupant of the \a room, except
+/// the occupant at index \a except.
+///
+/// The copies for the occupants of a remote domain are sent at once.
+
+void QXmppServerMucPrivate::broadcast(QXmppServerMucRoom *room, const QXmppServerMucTemplate &stanza, int except)
+{
+    const QString localDomain = server->domain();
+    QHash<QString, QPair<QString, QByteArray> > remoteBatches;
+
+    const int count = room->jids.size();
+    for (int i = 0; i < count; ++i) {
+        if (i == except)
+            continue;
+        if (room->domains[i] == localDomain) {
+            QByteArray data;
+            data.reserve(stanza.size() + room->recipients[i].size() + 6);
+            stanza.appendTo(data, room->recipients[i]);
+            server->sendData(room->jids[i], data);
+        } else {
+            QPair<QString, QByteArray> &batch = remoteBatches[room->domains[i]];
+            if (batch.first.isEmpty())
+                batch.first = room->jids[i];
+            stanza.appendTo(batch.second, room->recipients[i]);
+        }
+    }
+
+    QHash<QString, QPair<QString, QByteArray> >::const_iterator it;
+    for (it = remoteBatches.constBegin(); it != remoteBatches.constEnd(); ++it)
+        server->sendData(it.value().first, it.value().second);
+}
+
+/// Adds an occupant to the \a room, and sends it the presences of the other
+/// occupants, followed by the history and subject of the room.
+
+void QXmppServerMucPrivate::join(QXmppServerMucRoom *room, const QString &jid, const QString &nick, const QXmppPresence &presence, int maxStanzas)
+{
+    const int index = room->addOccupant(nick, jid, QXmppUtils::jidToDomain(jid));
+    room->presences[index] = occupantPresence(room, index, presence, false);
+    occupantRooms[jid].insert(room->jid);
+
+    // everything the new occupant receives is sent at once
+    const QByteArray recipient = room->recipients[index];
+    QByteArray data;
+    for (int i = 0; i < room->jids.size(); ++i) {
+        if (i != index)
+            room->presences[i].appendTo(data, recipient);
+    }
+    occupantPresence(room, index, presence, true).appendTo(data, recipient);
+
+    const int historyCount = room->historyCount();
+    const int first = (maxStanzas >= 0 && maxStanzas < historyCount) ? historyCount - maxStanzas : 0;
+    for (int i = first; i < historyCount; ++i)
+        room->historyAt(i).appendTo(data, recipient);
+    room->subject.appendTo(data, recipient);
+    server->sendData(jid, data);
+
+    broadcast(room, room->presences[index], index);
+}
+
+/// Removes the occupant at \a index from the \a room, and tells the
+/// occupants that it left.
+
+void QXmppServerMucPrivate::leave(QXmppServerMucRoom *room, int index, const QXmppPresence &presence)
+{
+    QXmppPresence unavailable(presence);
+    unavailable.setType(QXmppPresence::Unavailable);
+
+    const QString jid = room->jids[index];
+    QByteArray data;
+    occupantPresence(room, index, unavailable, true).appendTo(data, room->recipients[index]);
+    const QXmppServerMucTemplate stanza = occupantPresence(room, index, unavailable, false);
+
+    room->removeOccupant(index);
+    broadcast(room, stanza);
+    server->sendData(jid, data);
+
+    QHash<QString, QSet<QString> >::iterator it = occupantRooms.find(jid);
+    if (it != occupantRooms.end()) {
+        it.value().remove(room->jid);
+        if (it.value().isEmpty())
+            occupantRooms.erase(it);
+    }
+
+    if (room->jids.isEmpty()) {
+        rooms.remove(room->jid);
+        delete room;
+    }
+}
+
+/// Serializes the presence of the occupant at \a index as seen by the
+/// other occupants, or by the occupant itself if \a self is true.
+
+QXmppServerMucTemplate QXmppServerMucPrivate::occupantPresence(QXmppServerMucRoom *room, int index, QXmppPresence presence, bool self) const
+{
+    presence.setFrom(room->jid + "/" + room->nicks[index]);
+    presence.setTo(QString());
+    presence.setMucSupported(false);
+    presence.setMucPassword(QString());
+
+    QXmppMucItem item;
+    if (QXmppUtils::jidToBareJid(room->jids[index]) == room->owner) {
+        item.setAffiliation(QXmppMucItem::OwnerAffiliation);
+        item.setRole(QXmppMucItem::ModeratorRole);
+    } else {
+        item.setAffiliation(QXmppMucItem::NoAffiliation);
+        item.setRole(QXmppMucItem::ParticipantRole);
+    }
+    if (presence.type() == QXmppPresence::Unavailable)
+        item.setRole(QXmppMucItem::NoRole);
+    presence.setMucItem(item);
+    presence.setMucStatusCodes(self ? QList<int>() << selfPresenceStatus : QList<int>());
+    return QXmppServerMucTemplate(helperToXmlData(presence));
+}
+
+/// Replies to the given \a element with an error.
+
+void QXmppServerMucPrivate::sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition)
+{
+    if (element.attribute("type") == QLatin1String("error"))
+        return;
+
+    const QXmppStanza::Error error(type, condition);
+    if (element.tagName() == QLatin1String("iq")) {
+        QXmppIq response(QXmppIq::Error);
+        response.setId(element.attribute("id"));
+        response.setFrom(element.attribute("to"));
+        response.setTo(element.attribute("from"));
+        response.setError(error);
+        server->sendPacket(response);
+    } else if (element.tagName() == QLatin1String("message")) {
+        QXmppMessage response;
+        response.setType(QXmppMessage::Error);
+        response.setId(element.attribute("id"));
+        response.setFrom(element.attribute("to"));
+        response.setTo(element.attribute("from"));
+        response.setError(error);
+        server->sendPacket(response);
+    } else if (element.tagName() == QLatin1String("presence")) {
+        QXmppPresence response(QXmppPresence::Error);
+        response.setId(element.attribute("id"));
+        response.setFrom(element.attribute("to"));
+        response.setTo(element.attribute("from"));
+        response.setError(error);
+        server->sendPacket(response);
+    }
+}
+
+void QXmppServerMucPrivate::handleIq(const QDomElement &element)
+{
+    const QString to = element.attribute("to");
+    QXmppServerMucRoom *room = rooms.value(to);
+
+    if (QXmppDiscoveryIq::isDiscoveryIq(element) && (to == jid || room)) {
+        QXmppDiscoveryIq request;
+        request.parse(element);
+        if (request.type() != QXmppIq::Get)
+            return;
+
+        QXmppDiscoveryIq response;
+        response.setType(QXmppIq::Result);
+        response.setId(request.id());
+        response.setFrom(to);
+        response.setTo(request.from());
+        response.setQueryType(request.queryType());
+
+        if (request.queryType() == QXmppDiscoveryIq::InfoQuery) {
+            QXmppDiscoveryIq::Identity identity;
+            identity.setCategory("conference");
+            identity.setType("text");
+            QStringList features = QStringList() << ns_disco_info << ns_disco_items << ns_muc;
+            if (room) {
+                identity.setName(QXmppUtils::jidToUser(room->jid));
+                features << "muc_temporary" << "muc_open" << "muc_semianonymous" << "muc_unmoderated";
+            } else {
+                identity.setName("Chatrooms");
+            }
+            response.setIdentities(QList<QXmppDiscoveryIq::Identity>() << identity);
+            response.setFeatures(features);
+        } else if (!room) {
+            QList<QXmppDiscoveryIq::Item> items;
+            foreach (QXmppServerMucRoom *room, rooms) {
+                QXmppDiscoveryIq::Item item;
+                item.setJid(room->jid);
+                item.setName(QXmppUtils::jidToUser(room->jid));
+                items << item;
+            }
+            response.setItems(items);
+        }
+        server->sendPacket(response);
+        return;
+    }
+
+    const QString type = element.attribute("type");
+    if (type == QLatin1String("get") || type == QLatin1String("set")) {
+        if (to == jid || room)
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::FeatureNotImplemented);
+        else
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+    }
+}
+
+/// Handles a message sent to a room or to one of its occupants.
+///
+/// Returns true if the message was broadcast to the room.
+
+bool QXmppServerMucPrivate::handleMessage(const QDomElement &element)
+{
+    const QString from = element.attribute("from");
+    const QString to = element.attribute("to");
+    const QString type = element.attribute("type");
+    if (type == QLatin1String("error"))
+        return false;
+
+    // only occupants may send messages
+    QXmppServerMucRoom *room = rooms.value(QXmppUtils::jidToBareJid(to));
+    const int index = room ? room->jidIndexes.value(from, -1) : -1;
+    if (index < 0) {
+        sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::NotAcceptable);
+        return false;
+    }
+
+    QXmppMessage message;
+    message.parse(element);
+    message.setFrom(room->jid + "/" + room->nicks[index]);
+
+    const QString nick = QXmppUtils::jidToResource(to);
+    if (!nick.isEmpty()) {
+        // private message to another occupant
+        const int target = room->nickIndexes.value(nick, -1);
+        if (target < 0) {
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+            return false;
+        }
+        message.setTo(room->jids[target]);
+        server->sendPacket(message);
+        return false;
+    }
+
+    if (type != QLatin1String("groupchat")) {
+        sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+        return false;
+    }
+
+    // serialize the message once for all the occupants
+    message.setTo(QString());
+    const QXmppServerMucTemplate stanza(helperToXmlData(message));
+    broadcast(room, stanza);
+
+    if (!message.subject().isEmpty() && message.body().isEmpty()) {
+        room->subject = stanza;
+    } else {
+        message.setStamp(QDateTime::currentDateTime().toUTC());
+        room->addHistory(QXmppServerMucTemplate(helperToXmlData(message)));
+    }
+    return true;
+}
+
+void QXmppServerMucPrivate::handlePresence(const QDomElement &element)
+{
+    QXmppPresence presence;
+    presence.parse(element);
+
+    const QString from = presence.from();
+    const QString to = presence.to();
+    QXmppServerMucRoom *room = rooms.value(QXmppUtils::jidToBareJid(to));
+    const int index = room ? room->jidIndexes.value(from, -1) : -1;
+
+    if (presence.type() == QXmppPresence::Unavailable) {
+        if (index >= 0)
+            leave(room, index, presence);
+        return;
+    } else if (presence.type() != QXmppPresence::Available) {
+        return;
+    }
+
+    const QString nick = QXmppUtils::jidToResource(to);
+    if (nick.isEmpty() || QXmppUtils::jidToUser(to).isEmpty()) {
+        sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::JidMalformed);
+        return;
+    }
+
+    if (room) {
+        const int nickIndex = room->nickIndexes.value(nick, -1);
+        if (index >= 0) {
+            // changing nickname is not supported
+            if (nickIndex != index) {
+                sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::NotAcceptable);
+                return;
+            }
+
+            // presence update
+            room->presences[index] = occupantPresence(room, index, presence, false);
+            broadcast(room, room->presences[index], index);
+            QByteArray data;
+            occupantPresence(room, index, presence, true).appendTo(data, room->recipients[index]);
+            server->sendData(from, data);
+            return;
+        } else if (nickIndex >= 0) {
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::Conflict);
+            return;
+        }
+    } else {
+        room = new QXmppServerMucRoom(QXmppUtils::jidToBareJid(to), historySize);
+        room->owner = QXmppUtils::jidToBareJid(from);
+        rooms.insert(room->jid, room);
+    }
+
+    // number of history messages requested by the new occupant
+    int maxStanzas = -1;
+    for (QDomElement x = element.firstChildElement("x"); !x.isNull(); x = x.nextSiblingElement("x")) {
+        if (x.namespaceURI() == ns_muc) {
+            const QDomElement history = x.firstChildElement("history");
+            if (history.hasAttribute("maxstanzas"))
+                maxStanzas = history.attribute("maxstanzas").toInt();
+        }
+    }
+
+    join(room, from, nick, presence, maxStanzas);
+}
+
+/// Constructs a new multi-user chat service.
+
+QXmppServerMuc::QXmppServerMuc()
+    : d(new QXmppServerMucPrivate)
+{
+}
+
+/// Destroys the multi-user chat service.
+
+QXmppServerMuc::~QXmppServerMuc()
+{
+    qDeleteAll(d->rooms);
+    delete d;
+}
+
+/// Returns the JID of the service.
+
+QString QXmppServerMuc::jid() const
+{
+    return d->jid;
+}
+
+/// Sets the JID of the service.
+///
+/// The default is "conference." followed by the server's domain.
+///
+/// \param jid
+
+void QXmppServerMuc::setJid(const QString &jid)
+{
+    d->jid = jid;
+}
+
+/// Returns the number of messages kept for each room.
+
+int QXmppServerMuc::historySize() const
+{
+    return d->historySize;
+}
+
+/// Sets the number of messages kept for each room, which new occupants
+/// receive when they join the room.
+///
+/// The default is 20. It applies to the rooms created afterwards.
+///
+/// \param size
+
+void QXmppServerMuc::setHistorySize(int size)
+{
+    d->historySize = size;
+}
+
+/// \cond
+QStringList QXmppServerMuc::discoveryItems() const
+{
+    return QStringList() << d->jid;
+}
+
+bool QXmppServerMuc::handleStanza(const QDomElement &stanza)
+{
+    if (QXmppUtils::jidToDomain(stanza.attribute("to")) != d->jid)
+        return false;
+
+    if (stanza.tagName() == QLatin1String("message")) {
+        if (d->handleMessage(stanza))
+            updateCounter("muc.messages");
+    } else if (stanza.tagName() == QLatin1String("presence")) {
+        d->handlePresence(stanza);
+    } else if (stanza.tagName() == QLatin1String("iq")) {
+        d->handleIq(stanza);
+    }
+    return true;
+}
+
+QList<QXmppServerExtension::StanzaFilter> QXmppServerMuc::stanzaFilters() const
+{
+    QList<StanzaFilter> filters;
+    filters << StanzaFilter("iq") << StanzaFilter("message") << StanzaFilter("presence");
+    for (int i = 0; i < filters.size(); ++i)
+        filters[i].setDomain(d->jid);
+    return filters;
+}
+
+bool QXmppServerMuc::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->server = server();
+    if (d->jid.isEmpty())
+        d->jid = "conference." + server()->domain();
+
+    check = connect(server(), SIGNAL(clientDisconnected(QString)),
+                    this, SLOT(_q_clientDisconnected(QString)));
+    Q_ASSERT(check);
+    return true;
+}
+
+void QXmppServerMuc::stop()
+{
+    disconnect(server(), SIGNAL(clientDisconnected(QString)),
+               this, SLOT(_q_clientDisconnected(QString)));
+
+    qDeleteAll(d->rooms);
+    d->rooms.clear();
+    d->occupantRooms.clear();
+}
+/// \endcond
+
+void QXmppServerMuc::_q_clientDisconnected(const QString &jid)
+{
+    // the occupant leaves all the rooms it joined
+    const QSet<QString> roomJids = d->occupantRooms.value(jid);
+    foreach (const QString &roomJid, roomJids) {
+        QXmppServerMucRoom *room = d->rooms.value(roomJid);
+        const int index = room ? room->jidIndexes.value(jid, -1) : -1;
+        if (index >= 0)
+            d->leave(room, index, QXmppPresence(QXmppPresence::Unavailable));
+    }
+}
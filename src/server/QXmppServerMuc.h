@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSERVERMUC_H
+#define QXMPPSERVERMUC_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerMucPrivate;
+
+/// \brief The QXmppServerMuc class is a server extension which provides
+/// multi-user chat rooms, as defined by XEP-0045: Multi-User Chat.
+///
+/// Rooms are created when their first occupant joins, and destroyed when
+/// their last occupant leaves. The user who created a room is its owner.
+///
+/// Each message sent to a room is serialized once, and the copy sent to
+/// each occupant only differs by its "to" attribute. The copies for the
+/// occupants of a remote domain are sent in a single write. The last
+/// messages of each room are kept, see setHistorySize(), and sent to new
+/// occupants.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerMuc : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "muc")
+    Q_PROPERTY(QString jid READ jid WRITE setJid)
+    Q_PROPERTY(int historySize READ historySize WRITE setHistorySize)
+
+public:
+    QXmppServerMuc();
+    ~QXmppServerMuc();
+
+    QString jid() const;
+    void setJid(const QString &jid);
+
+    int historySize() const;
+    void setHistorySize(int size);
+
+    /// \cond
+    QStringList discoveryItems() const;
+    bool handleStanza(const QDomElement &stanza);
+    QList<StanzaFilter> stanzaFilters() const;
+
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_clientDisconnected(const QString &jid);
+
+private:
+    QXmppServerMucPrivate * const d;
+};
+
+#endif
@@ -0,0 +1,705 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QDir>
+#include <QDomElement>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <QXmlStreamReader>
+#include <QtEndian>
+
+#if defined(Q_OS_WIN)
+#include <io.h>
+#elif defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+#include "QXmppConstants.h"
+#include "QXmppServer.h"
+#include "QXmppServerOffline.h"
+#include "QXmppServerOffline_p.h"
+#include "QXmppUtils.h"
+
+// types of the records in the log
+static const int messageRecord = 1;
+static const int purgeRecord = 2;
+
+// size of the header preceding each record
+static const int recordHeaderSize = 5;
+
+// size above which a new segment is started (64 MB)
+static const qint64 defaultSegmentSize = 64 * 1024 * 1024;
+
+// size of the pending records above which they are committed at once,
+// rather than once the server is idle (1 MB)
+static const qint64 commitBatchSize = 1024 * 1024;
+
+static QByteArray recordHeader(int type, int payloadSize)
+{
+    QByteArray header(recordHeaderSize, '\0');
+    qToBigEndian<quint32>(payloadSize + 1, reinterpret_cast<uchar*>(header.data()));
+    header[4] = char(type);
+    return header;
+}
+
+static bool syncFile(QFile *file)
+{
+    if (!file->flush())
+        return false;
+#if defined(Q_OS_WIN)
+    return _commit(file->handle()) == 0;
+#elif defined(Q_OS_UNIX)
+    return ::fsync(file->handle()) == 0;
+#else
+    return true;
+#endif
+}
+
+class QXmppOfflineLogEntry
+{
+public:
+    quint64 sequence;
+    quint32 segment;
+    qint64 offset;
+    int size;
+};
+
+class QXmppOfflineLogPrivate
+{
+public:
+    QXmppOfflineLogPrivate();
+    QString segmentPath(quint32 segment) const;
+    bool openSegment(quint32 segment);
+    bool recoverSegment(quint32 segment);
+    void appendRecord(int type, const QByteArray &payload);
+    void removeEntries(const QString &bareJid, quint64 sequence);
+    void removeDeadSegments();
+
+    QString path;
+    qint64 maximumSegmentSize;
+
+    // segment being appended to, and its size including pending records
+    QFile *file;
+    quint32 currentSegment;
+    qint64 segmentSize;
+
+    // records waiting to be committed
+    QByteArray pending;
+
+    quint64 nextSequence;
+    QHash<QString, QList<QXmppOfflineLogEntry> > entries;
+
+    // number of messages left in each segment on disk
+    QMap<quint32, int> segments;
+};
+
+QXmppOfflineLogPrivate::QXmppOfflineLogPrivate()
+    : maximumSegmentSize(defaultSegmentSize)
+    , file(0)
+    , currentSegment(0)
+    , segmentSize(0)
+    , nextSequence(1)
+{
+}
+
+QString QXmppOfflineLogPrivate::segmentPath(quint32 segment) const
+{
+    return QDir(path).filePath(QString("%1.log").arg(segment, 8, 10, QLatin1Char('0')));
+}
+
+/// Makes the given \a segment the one records are appended to.
+
+bool QXmppOfflineLogPrivate::openSegment(quint32 segment)
+{
+    QFile *segmentFile = new QFile(segmentPath(segment));
+    if (!segmentFile->open(QIODevice::WriteOnly | QIODevice::Append)) {
+        delete segmentFile;
+        return false;
+    }
+
+    delete file;
+    file = segmentFile;
+    currentSegment = segment;
+    segmentSize = file->size();
+    if (!segments.contains(segment))
+        segments.insert(segment, 0);
+    return true;
+}
+
+/// Rebuilds the index from the records of the given \a segment.
+///
+/// A record which was only partly written is truncated.
+
+bool QXmppOfflineLogPrivate::recoverSegment(quint32 segment)
+{
+    QFile segmentFile(segmentPath(segment));
+    if (!segmentFile.open(QIODevice::ReadWrite))
+        return false;
+    segments.insert(segment, 0);
+
+    qint64 offset = 0;
+    for (;;) {
+        const QByteArray header = segmentFile.read(recordHeaderSize);
+        if (header.size() < recordHeaderSize)
+            break;
+        const quint32 length = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(header.constData()));
+        const int type = quint8(header.at(4));
+        if (length < 1)
+            break;
+        const QByteArray payload = segmentFile.read(length - 1);
+        if (payload.size() != int(length - 1))
+            break;
+
+        QDataStream stream(payload);
+        stream.setVersion(QDataStream::Qt_4_5);
+        quint64 sequence;
+        QString bareJid;
+        stream >> sequence >> bareJid;
+        if (stream.status() != QDataStream::Ok)
+            break;
+
+        if (type == messageRecord) {
+            QXmppOfflineLogEntry entry;
+            entry.sequence = sequence;
+            entry.segment = segment;
+            entry.offset = offset;
+            entry.size = recordHeaderSize + payload.size();
+            entries[bareJid] << entry;
+            segments[segment]++;
+            nextSequence = qMax(nextSequence, sequence + 1);
+        } else if (type == purgeRecord) {
+            removeEntries(bareJid, sequence);
+        }
+        offset += recordHeaderSize + payload.size();
+    }
+
+    if (offset < segmentFile.size())
+        segmentFile.resize(offset);
+    return true;
+}
+
+void QXmppOfflineLogPrivate::appendRecord(int type, const QByteArray &payload)
+{
+    pending += recordHeader(type, payload.size());
+    pending += payload;
+    segmentSize += recordHeaderSize + payload.size();
+}
+
+/// Forgets the messages of the \a bareJid up to the given \a sequence.
+
+void QXmppOfflineLogPrivate::removeEntries(const QString &bareJid, quint64 sequence)
+{
+    QHash<QString, QList<QXmppOfflineLogEntry> >::iterator it = entries.find(bareJid);
+    if (it == entries.end())
+        return;
+
+    QList<QXmppOfflineLogEntry> &list = it.value();
+    while (!list.isEmpty() && list.first().sequence <= sequence)
+        segments[list.takeFirst().segment]--;
+    if (list.isEmpty())
+        entries.erase(it);
+}
+
+/// Deletes the oldest segments once none of their messages are left.
+///
+/// Segments are only deleted in order, so that a purge record is never
+/// deleted while the messages it removed are still on disk, which would
+/// make them reappear.
+
+void QXmppOfflineLogPrivate::removeDeadSegments()
+{
+    while (!segments.isEmpty()) {
+        QMap<quint32, int>::iterator it = segments.begin();
+        if (it.key() == currentSegment || it.value() > 0)
+            break;
+        QFile::remove(segmentPath(it.key()));
+        segments.erase(it);
+    }
+}
+
+/// Constructs a closed log.
+
+QXmppOfflineLog::QXmppOfflineLog()
+    : d(new QXmppOfflineLogPrivate)
+{
+}
+
+/// Destroys the log, committing any pending records.
+
+QXmppOfflineLog::~QXmppOfflineLog()
+{
+    close();
+    delete d;
+}
+
+/// Opens the log stored in the directory at \a path, creating it if needed.
+
+bool QXmppOfflineLog::open(const QString &path)
+{
+    close();
+
+    QDir dir(path);
+    if (!dir.exists() && !dir.mkpath("."))
+        return false;
+    d->path = dir.absolutePath();
+
+    // read the existing segments in order
+    QList<quint32> numbers;
+    foreach (const QString &name, dir.entryList(QStringList() << "*.log", QDir::Files)) {
+        bool ok;
+        const quint32 number = name.left(name.size() - 4).toUInt(&ok);
+        if (ok)
+            numbers << number;
+    }
+    qSort(numbers);
+    foreach (quint32 number, numbers) {
+        if (!d->recoverSegment(number)) {
+            close();
+            return false;
+        }
+    }
+
+    // new records go to a new segment
+    if (!d->openSegment(numbers.isEmpty() ? 1 : numbers.last() + 1)) {
+        close();
+        return false;
+    }
+    d->removeDeadSegments();
+    return true;
+}
+
+/// Commits any pending records and closes the log.
+
+void QXmppOfflineLog::close()
+{
+    if (d->file) {
+        commit();
+        delete d->file;
+        d->file = 0;
+    }
+    d->pending.clear();
+    d->entries.clear();
+    d->segments.clear();
+    d->segmentSize = 0;
+    d->nextSequence = 1;
+}
+
+/// Returns true if the log is open.
+
+bool QXmppOfflineLog::isOpen() const
+{
+    return d->file != 0;
+}
+
+/// Returns the size above which a new segment is started.
+
+qint64 QXmppOfflineLog::maximumSegmentSize() const
+{
+    return d->maximumSegmentSize;
+}
+
+/// Sets the size above which a new segment is started.
+///
+/// \param size
+
+void QXmppOfflineLog::setMaximumSegmentSize(qint64 size)
+{
+    d->maximumSegmentSize = size;
+}
+
+/// Appends a message for the \a bareJid, which is only written to disk by
+/// the next commit().
+///
+/// \param bareJid
+/// \param stamp The time at which the message was stored.
+/// \param data The serialized message.
+
+void QXmppOfflineLog::append(const QString &bareJid, const QDateTime &stamp, const QByteArray &data)
+{
+    if (!d->file)
+        return;
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream << quint64(d->nextSequence) << bareJid << stamp.toUTC() << data;
+
+    QXmppOfflineLogEntry entry;
+    entry.sequence = d->nextSequence++;
+    entry.segment = d->currentSegment;
+    entry.offset = d->segmentSize;
+    entry.size = recordHeaderSize + payload.size();
+    d->entries[bareJid] << entry;
+    d->segments[d->currentSegment]++;
+
+    d->appendRecord(messageRecord, payload);
+}
+
+/// Removes all the messages of the \a bareJid.
+///
+/// \param bareJid
+
+void QXmppOfflineLog::remove(const QString &bareJid)
+{
+    QHash<QString, QList<QXmppOfflineLogEntry> >::const_iterator it = d->entries.constFind(bareJid);
+    if (!d->file || it == d->entries.constEnd())
+        return;
+
+    const quint64 sequence = it.value().last().sequence;
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream << sequence << bareJid;
+    d->appendRecord(purgeRecord, payload);
+
+    d->removeEntries(bareJid, sequence);
+    d->removeDeadSegments();
+}
+
+/// Writes the pending records to disk with a single write, and waits
+/// until they are stored.
+///
+/// Returns true if the records were stored. Otherwise they are kept for
+/// the next attempt.
+
+bool QXmppOfflineLog::commit()
+{
+    if (!d->file || d->pending.isEmpty())
+        return true;
+
+    const qint64 committedSize = d->segmentSize - d->pending.size();
+    if (d->file->write(d->pending) != d->pending.size() || !syncFile(d->file)) {
+        d->file->resize(committedSize);
+        return false;
+    }
+    d->pending.clear();
+
+    if (d->segmentSize >= d->maximumSegmentSize) {
+        d->openSegment(d->currentSegment + 1);
+        d->removeDeadSegments();
+    }
+    return true;
+}
+
+/// Returns the number of messages stored for the \a bareJid.
+///
+/// \param bareJid
+
+int QXmppOfflineLog::count(const QString &bareJid) const
+{
+    return d->entries.value(bareJid).size();
+}
+
+/// Returns the messages stored for the \a bareJid along with the time
+/// they were stored at, committing the pending records first.
+///
+/// \param bareJid
+
+QList<QXmppOfflineLog::Message> QXmppOfflineLog::messages(const QString &bareJid)
+{
+    QList<Message> result;
+    const QList<QXmppOfflineLogEntry> entries = d->entries.value(bareJid);
+    if (entries.isEmpty() || !commit())
+        return result;
+
+    QFile segmentFile;
+    foreach (const QXmppOfflineLogEntry &entry, entries) {
+        if (!segmentFile.isOpen() || segmentFile.fileName() != d->segmentPath(entry.segment)) {
+            segmentFile.close();
+            segmentFile.setFileName(d->segmentPath(entry.segment));
+            if (!segmentFile.open(QIODevice::ReadOnly))
+                continue;
+        }
+
+        QByteArray record;
+        if (segmentFile.seek(entry.offset))
+            record = segmentFile.read(entry.size);
+        if (record.size() != entry.size)
+            continue;
+
+        QDataStream stream(record.mid(recordHeaderSize));
+        stream.setVersion(QDataStream::Qt_4_5);
+        quint64 sequence;
+        QString jid;
+        Message message;
+        stream >> sequence >> jid >> message.first >> message.second;
+        if (stream.status() == QDataStream::Ok)
+            result << message;
+    }
+    return result;
+}
+
+/// Returns the size of the records waiting to be committed.
+
+qint64 QXmppOfflineLog::pendingSize() const
+{
+    return d->pending.size();
+}
+
+/// Returns the number of segment files.
+
+int QXmppOfflineLog::segmentCount() const
+{
+    return d->segments.size();
+}
+
+class QXmppServerOfflinePrivate
+{
+public:
+    QByteArray delayed(const QByteArray &data, const QString &from, const QDateTime &stamp) const;
+
+    QString path;
+    int maximumUserMessages;
+    QXmppOfflineLog log;
+    QTimer *commitTimer;
+
+    // connected resources of users with stored messages, which are
+    // waiting for the resource's initial presence
+    QSet<QString> waitingClients;
+    bool delivering;
+};
+
+/// Adds a delay element to the serialized message \a data.
+
+QByteArray QXmppServerOfflinePrivate::delayed(const QByteArray &data, const QString &from, const QDateTime &stamp) const
+{
+    const QByteArray delay = "<delay xmlns='" + QByteArray(ns_delayed_delivery.latin1()) +
+                             "' from='" + from.toUtf8() +
+                             "' stamp='" + QXmppUtils::datetimeToString(stamp).toLatin1() +
+                             "'>Offline Storage</delay>";
+
+    QByteArray result = data;
+    if (result.endsWith("/>")) {
+        // empty element, close it explicitly
+        int nameEnd = 1;
+        while (nameEnd < result.size() && !QChar(result.at(nameEnd)).isSpace() && result.at(nameEnd) != '/')
+            ++nameEnd;
+        const QByteArray tagName = result.mid(1, nameEnd - 1);
+        result.chop(2);
+        result += ">" + delay + "</" + tagName + ">";
+    } else {
+        const int pos = result.lastIndexOf("</");
+        if (pos >= 0)
+            result.insert(pos, delay);
+    }
+    return result;
+}
+
+/// Constructs a new offline message store.
+
+QXmppServerOffline::QXmppServerOffline()
+    : d(new QXmppServerOfflinePrivate)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->maximumUserMessages = 100;
+    d->delivering = false;
+
+    // commit the messages stored while handling a batch of incoming data
+    // once the server is idle
+    d->commitTimer = new QTimer(this);
+    d->commitTimer->setInterval(0);
+    d->commitTimer->setSingleShot(true);
+    check = connect(d->commitTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_commit()));
+    Q_ASSERT(check);
+}
+
+/// Destroys the offline message store.
+
+QXmppServerOffline::~QXmppServerOffline()
+{
+    delete d;
+}
+
+/// Returns the path of the directory holding the stored messages.
+
+QString QXmppServerOffline::path() const
+{
+    return d->path;
+}
+
+/// Sets the path of the directory holding the stored messages.
+///
+/// \param path
+
+void QXmppServerOffline::setPath(const QString &path)
+{
+    d->path = path;
+}
+
+/// Returns the maximum number of messages stored for a user.
+
+int QXmppServerOffline::maximumUserMessages() const
+{
+    return d->maximumUserMessages;
+}
+
+/// Sets the maximum number of messages stored for a user, 0 meaning no
+/// limit. Messages above the limit are not stored.
+///
+/// The default is 100.
+///
+/// \param count
+
+void QXmppServerOffline::setMaximumUserMessages(int count)
+{
+    d->maximumUserMessages = count;
+}
+
+/// \cond
+QStringList QXmppServerOffline::discoveryFeatures() const
+{
+    return QStringList() << "msgoffline";
+}
+
+bool QXmppServerOffline::handleStanza(const QDomElement &stanza)
+{
+    // deliver the stored messages on the initial available presence
+    const QString from = stanza.attribute("from");
+    if (stanza.tagName() != QLatin1String("presence") ||
+        !stanza.attribute("to").isEmpty() ||
+        !stanza.attribute("type").isEmpty() ||
+        !d->waitingClients.contains(from) ||
+        stanza.firstChildElement("priority").text().toInt() < 0)
+        return false;
+    d->waitingClients.remove(from);
+
+    const QString bareJid = QXmppUtils::jidToBareJid(from);
+    const QList<QXmppOfflineLog::Message> messages = d->log.messages(bareJid);
+    if (messages.isEmpty())
+        return false;
+
+    // send all the messages at once
+    QByteArray data;
+    foreach (const QXmppOfflineLog::Message &message, messages)
+        data += d->delayed(message.second, server()->domain(), message.first);
+
+    d->delivering = true;
+    const bool sent = server()->sendData(from, data);
+    d->delivering = false;
+    if (sent) {
+        d->log.remove(bareJid);
+        d->commitTimer->start();
+        updateCounter("offline.delivered", messages.size());
+    }
+    return false;
+}
+
+bool QXmppServerOffline::handleUndeliveredStanza(const QString &to, const QByteArray &data)
+{
+    if (d->delivering || !d->log.isOpen())
+        return false;
+
+    // only store messages of type "normal" and "chat"
+    QXmlStreamReader reader(data);
+    reader.setNamespaceProcessing(false);
+    if (!reader.readNextStartElement() || reader.name() != QLatin1String("message"))
+        return false;
+    const QStringRef type = reader.attributes().value("type");
+    if (!type.isEmpty() && type != QLatin1String("normal") && type != QLatin1String("chat"))
+        return false;
+
+    const QString bareJid = QXmppUtils::jidToBareJid(to);
+    if (d->maximumUserMessages > 0 && d->log.count(bareJid) >= d->maximumUserMessages) {
+        updateCounter("offline.refused");
+        return false;
+    }
+
+    d->log.append(bareJid, QDateTime::currentDateTime().toUTC(), data);
+    updateCounter("offline.stored");
+
+    if (d->log.pendingSize() >= commitBatchSize)
+        _q_commit();
+    else if (!d->commitTimer->isActive())
+        d->commitTimer->start();
+    return true;
+}
+
+QList<QXmppServerExtension::StanzaFilter> QXmppServerOffline::stanzaFilters() const
+{
+    return QList<StanzaFilter>() << StanzaFilter("presence");
+}
+
+bool QXmppServerOffline::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->path.isEmpty()) {
+        warning("No path was specified for offline messages");
+        return false;
+    }
+    if (!d->log.open(d->path)) {
+        warning(QString("Could not open offline messages in %1").arg(d->path));
+        return false;
+    }
+
+    check = connect(server(), SIGNAL(clientConnected(QString)),
+                    this, SLOT(_q_clientConnected(QString)));
+    Q_ASSERT(check);
+
+    check = connect(server(), SIGNAL(clientDisconnected(QString)),
+                    this, SLOT(_q_clientDisconnected(QString)));
+    Q_ASSERT(check);
+
+    return true;
+}
+
+void QXmppServerOffline::stop()
+{
+    disconnect(server(), SIGNAL(clientConnected(QString)),
+               this, SLOT(_q_clientConnected(QString)));
+    disconnect(server(), SIGNAL(clientDisconnected(QString)),
+               this, SLOT(_q_clientDisconnected(QString)));
+
+    d->commitTimer->stop();
+    d->log.close();
+    d->waitingClients.clear();
+}
+/// \endcond
+
+void QXmppServerOffline::_q_clientConnected(const QString &jid)
+{
+    if (d->log.count(QXmppUtils::jidToBareJid(jid)) > 0)
+        d->waitingClients.insert(jid);
+}
+
+void QXmppServerOffline::_q_clientDisconnected(const QString &jid)
+{
+    d->waitingClients.remove(jid);
+}
+
+void QXmppServerOffline::_q_commit()
+{
+    d->commitTimer->stop();
+    if (!d->log.commit())
+        warning(QString("Could not write offline messages to %1").arg(d->path));
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSERVEROFFLINE_H
+#define QXMPPSERVEROFFLINE_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerOfflinePrivate;
+
+/// \brief The QXmppServerOffline class is a server extension which stores
+/// the messages sent to offline users, as defined by XEP-0160: Best
+/// Practices for Handling Offline Messages.
+///
+/// Messages of type "normal" and "chat" for a user who has no connected
+/// resource are written to an append-only log in the directory given by
+/// setPath(). They are delivered in a single write, with a delay element
+/// giving the time they were stored, once one of the user's resources
+/// sends an available presence with a non-negative priority.
+///
+/// Messages are written in batches: all the messages received while the
+/// server processes a batch of incoming data are committed to disk with
+/// a single sync.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerOffline : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "offline")
+    Q_PROPERTY(QString path READ path WRITE setPath)
+    Q_PROPERTY(int maximumUserMessages READ maximumUserMessages WRITE setMaximumUserMessages)
+
+public:
+    QXmppServerOffline();
+    ~QXmppServerOffline();
+
+    QString path() const;
+    void setPath(const QString &path);
+
+    int maximumUserMessages() const;
+    void setMaximumUserMessages(int count);
+
+    /// \cond
+    QStringList discoveryFeatures() const;
+    bool handleStanza(const QDomElement &stanza);
+    bool handleUndeliveredStanza(const QString &to, const QByteArray &data);
+    QList<StanzaFilter> stanzaFilters() const;
+
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_clientConnected(const QString &jid);
+    void _q_clientDisconnected(const QString &jid);
+    void _q_commit();
+
+private:
+    QXmppServerOfflinePrivate * const d;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSERVEROFFLINE_P_H
+#define QXMPPSERVEROFFLINE_P_H
+
+#include <QDateTime>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+class QXmppOfflineLogPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServerOffline class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppOfflineLog class stores the messages of offline users in an
+/// append-only log.
+///
+/// The log is split into numbered segment files, which all the users
+/// share. Appended records are buffered until commit() writes them with
+/// a single write and a single sync, and an index kept in memory tells
+/// where the messages of each user are. Removing the messages of a user
+/// appends a purge record, and the oldest segments are deleted once
+/// none of their messages are left.
+
+class QXMPP_AUTOTEST_EXPORT QXmppOfflineLog
+{
+public:
+    typedef QPair<QDateTime, QByteArray> Message;
+
+    QXmppOfflineLog();
+    ~QXmppOfflineLog();
+
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const;
+
+    qint64 maximumSegmentSize() const;
+    void setMaximumSegmentSize(qint64 size);
+
+    void append(const QString &bareJid, const QDateTime &stamp, const QByteArray &data);
+    void remove(const QString &bareJid);
+    bool commit();
+
+    int count(const QString &bareJid) const;
+    QList<Message> messages(const QString &bareJid);
+
+    qint64 pendingSize() const;
+    int segmentCount() const;
+
+private:
+    Q_DISABLE_COPY(QXmppOfflineLog)
+    QXmppOfflineLogPrivate * const d;
+};
+
+#endif
@@ -0,0 +1,677 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QCryptographicHash>
+#include <QDomElement>
+#include <QHash>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include "QXmppByteStreamIq.h"
+#include "QXmppConstants.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppServer.h"
+#include "QXmppServerProxy65.h"
+#include "QXmppServerProxy65_p.h"
+#include "QXmppSocks.h"
+#include "QXmppUtils.h"
+
+// size of the buffer used to relay data, which also bounds the data
+// buffered for each connection (64 kB)
+static const int relayBufferSize = 65536;
+
+// time the initiator has to activate a bytestream (60 seconds)
+static const int relayActivationTimeout = 60000;
+
+// interval at which the bandwidth of the users is replenished (100 ms)
+static const int bandwidthInterval = 100;
+
+class QXmppServerProxy65Private
+{
+public:
+    QXmppServerProxy65Private(QXmppServerProxy65 *qq);
+    qint64 takeCredit(const QString &user, qint64 wanted);
+    void relayed(qint64 bytes);
+
+    QString jid;
+    QString host;
+    quint16 port;
+    int activeStreams;
+    int maximumUserStreams;
+    qint64 maximumUserBandwidth;
+
+    // the data being relayed, shared by all the relays
+    QByteArray buffer;
+
+    QTimer *bandwidthTimer;
+    QHash<QString, qint64> userCredits;
+    QHash<QString, int> userStreams;
+    QHash<QString, QXmppServerProxy65Relay*> relays;
+    QXmppSocksServer *socksServer;
+
+private:
+    QXmppServerProxy65 *q;
+};
+
+QXmppServerProxy65Private::QXmppServerProxy65Private(QXmppServerProxy65 *qq)
+    : port(7777)
+    , activeStreams(0)
+    , maximumUserStreams(0)
+    , maximumUserBandwidth(0)
+    , bandwidthTimer(0)
+    , socksServer(0)
+    , q(qq)
+{
+    buffer.resize(relayBufferSize);
+}
+
+/// Returns the number of bytes out of \a wanted which \a user may relay
+/// now, and deducts them from the user's remaining bandwidth.
+
+qint64 QXmppServerProxy65Private::takeCredit(const QString &user, qint64 wanted)
+{
+    if (maximumUserBandwidth <= 0)
+        return wanted;
+
+    QHash<QString, qint64>::iterator it = userCredits.find(user);
+    if (it == userCredits.end())
+        it = userCredits.insert(user, qMax(qint64(1), maximumUserBandwidth * bandwidthInterval / 1000));
+
+    const qint64 granted = qMin(wanted, it.value());
+    it.value() -= granted;
+    if (!bandwidthTimer->isActive())
+        bandwidthTimer->start();
+    return granted;
+}
+
+void QXmppServerProxy65Private::relayed(qint64 bytes)
+{
+    q->updateCounter("proxy65.bytes", bytes);
+}
+
+/// \cond
+QXmppServerProxy65Relay::QXmppServerProxy65Relay(const QString &hash, QXmppServerProxy65Private *proxy, QObject *parent)
+    : QObject(parent)
+    , m_hash(hash)
+    , m_proxy(proxy)
+    , m_target(0)
+    , m_initiator(0)
+    , m_active(false)
+    , m_finished(false)
+    , m_throttled(false)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    check = connect(m_timer, SIGNAL(timeout()),
+                    this, SLOT(_q_timeout()));
+    Q_ASSERT(check);
+    m_timer->start(relayActivationTimeout);
+}
+
+/// Adds a connection to the relay, the target connects first and the
+/// initiator second.
+///
+/// Returns false if the relay already has both connections.
+
+bool QXmppServerProxy65Relay::addSocket(QTcpSocket *socket)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (m_finished || m_initiator)
+        return false;
+
+    socket->setParent(this);
+    socket->setReadBufferSize(relayBufferSize);
+    if (!m_target)
+        m_target = socket;
+    else
+        m_initiator = socket;
+
+    check = connect(socket, SIGNAL(disconnected()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+    return true;
+}
+
+/// Starts relaying data on behalf of \a user.
+
+void QXmppServerProxy65Relay::activate(const QString &user)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_active = true;
+    m_user = user;
+    m_timer->stop();
+
+    QTcpSocket *sockets[] = { m_target, m_initiator };
+    for (int i = 0; i < 2; ++i) {
+        check = connect(sockets[i], SIGNAL(readyRead()),
+                        this, SLOT(_q_readyRead()));
+        Q_ASSERT(check);
+
+        check = connect(sockets[i], SIGNAL(bytesWritten(qint64)),
+                        this, SLOT(_q_bytesWritten()));
+        Q_ASSERT(check);
+    }
+
+    // relay the data which was received before the activation
+    resume();
+}
+
+QString QXmppServerProxy65Relay::hash() const
+{
+    return m_hash;
+}
+
+QString QXmppServerProxy65Relay::user() const
+{
+    return m_user;
+}
+
+bool QXmppServerProxy65Relay::isActive() const
+{
+    return m_active;
+}
+
+/// Returns true if both parties are connected.
+
+bool QXmppServerProxy65Relay::isReady() const
+{
+    return !m_finished &&
+           m_target && m_target->state() == QAbstractSocket::ConnectedState &&
+           m_initiator && m_initiator->state() == QAbstractSocket::ConnectedState;
+}
+
+/// Returns true if the relay waits for its user's bandwidth to be
+/// replenished.
+
+bool QXmppServerProxy65Relay::isThrottled() const
+{
+    return m_throttled;
+}
+
+void QXmppServerProxy65Relay::resume()
+{
+    if (!m_active || m_finished)
+        return;
+    m_throttled = false;
+    if (transfer(m_target, m_initiator, false))
+        transfer(m_initiator, m_target, false);
+}
+
+void QXmppServerProxy65Relay::finish()
+{
+    if (m_finished)
+        return;
+    m_finished = true;
+    m_timer->stop();
+
+    // let the connections deliver the data they buffer before closing them
+    QTcpSocket *sockets[] = { m_target, m_initiator };
+    for (int i = 0; i < 2; ++i) {
+        QTcpSocket *socket = sockets[i];
+        if (!socket)
+            continue;
+        socket->disconnect(this);
+        socket->setParent(0);
+        if (socket->state() == QAbstractSocket::UnconnectedState) {
+            socket->deleteLater();
+        } else {
+            connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+            socket->disconnectFromHost();
+        }
+    }
+    m_target = 0;
+    m_initiator = 0;
+
+    emit finished();
+    deleteLater();
+}
+
+QTcpSocket *QXmppServerProxy65Relay::peer(QObject *socket) const
+{
+    if (socket == m_target)
+        return m_initiator;
+    else if (socket == m_initiator)
+        return m_target;
+    return 0;
+}
+
+/// Copies the data available on \a from to \a to, as long as \a to does not
+/// buffer too much data and the user has enough bandwidth left.
+///
+/// If \a force is true, all the data is copied regardless.
+///
+/// Returns false if the relay finished.
+
+bool QXmppServerProxy65Relay::transfer(QTcpSocket *from, QTcpSocket *to, bool force)
+{
+    if (!from || !to)
+        return false;
+
+    char *buffer = m_proxy->buffer.data();
+    qint64 available;
+    while ((available = from->bytesAvailable()) > 0) {
+        qint64 wanted = qMin(available, qint64(relayBufferSize));
+        if (!force) {
+            // wait for the receiver to catch up
+            if (to->bytesToWrite() >= relayBufferSize)
+                break;
+
+            // wait for the user's bandwidth to be replenished
+            wanted = m_proxy->takeCredit(m_user, wanted);
+            if (!wanted) {
+                m_throttled = true;
+                break;
+            }
+        }
+
+        const qint64 length = from->read(buffer, wanted);
+        if (length <= 0)
+            break;
+        if (to->write(buffer, length) != length) {
+            finish();
+            return false;
+        }
+        m_proxy->relayed(length);
+    }
+    return true;
+}
+
+void QXmppServerProxy65Relay::_q_bytesWritten()
+{
+    QTcpSocket *to = qobject_cast<QTcpSocket*>(sender());
+    if (m_active && !m_finished && !m_throttled)
+        transfer(peer(to), to, false);
+}
+
+void QXmppServerProxy65Relay::_q_disconnected()
+{
+    QTcpSocket *from = qobject_cast<QTcpSocket*>(sender());
+
+    // deliver the data which the closed connection sent before closing
+    if (m_active && !m_finished) {
+        QTcpSocket *to = peer(from);
+        if (to && to->state() == QAbstractSocket::ConnectedState)
+            transfer(from, to, true);
+    }
+    finish();
+}
+
+void QXmppServerProxy65Relay::_q_readyRead()
+{
+    QTcpSocket *from = qobject_cast<QTcpSocket*>(sender());
+    if (m_active && !m_finished && !m_throttled)
+        transfer(from, peer(from), false);
+}
+
+void QXmppServerProxy65Relay::_q_timeout()
+{
+    finish();
+}
+/// \endcond
+
+/// Constructs a new SOCKS5 bytestream proxy.
+
+QXmppServerProxy65::QXmppServerProxy65()
+    : d(new QXmppServerProxy65Private(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->bandwidthTimer = new QTimer(this);
+    d->bandwidthTimer->setInterval(bandwidthInterval);
+    check = connect(d->bandwidthTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_bandwidthTimeout()));
+    Q_ASSERT(check);
+}
+
+QXmppServerProxy65::~QXmppServerProxy65()
+{
+    delete d;
+}
+
+/// Returns the JID of the proxy.
+///
+/// If no JID is set, "proxy." followed by the server's domain is used.
+
+QString QXmppServerProxy65::jid() const
+{
+    return d->jid;
+}
+
+/// Sets the JID of the proxy.
+///
+/// \param jid
+
+void QXmppServerProxy65::setJid(const QString &jid)
+{
+    d->jid = jid;
+}
+
+/// Returns the host name or address which clients connect to.
+///
+/// If no host is set, the server's domain is used.
+
+QString QXmppServerProxy65::host() const
+{
+    return d->host;
+}
+
+/// Sets the host name or address which clients connect to.
+///
+/// \param host
+
+void QXmppServerProxy65::setHost(const QString &host)
+{
+    d->host = host;
+}
+
+/// Returns the port which clients connect to.
+///
+/// The default value is 7777.
+
+quint16 QXmppServerProxy65::port() const
+{
+    return d->port;
+}
+
+/// Sets the port which clients connect to.
+///
+/// \param port
+
+void QXmppServerProxy65::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+/// Returns the maximum number of active bytestreams of each user, or 0 if
+/// it is not limited.
+///
+/// The default value is 0.
+
+int QXmppServerProxy65::maximumUserStreams() const
+{
+    return d->maximumUserStreams;
+}
+
+/// Sets the maximum number of active bytestreams of each user, or 0 if it
+/// should not be limited.
+///
+/// Activation requests beyond the limit are refused with a
+/// resource-constraint error. Streams are counted for the bare JID of the
+/// user who activates them, who is the file's sender.
+///
+/// \param count
+
+void QXmppServerProxy65::setMaximumUserStreams(int count)
+{
+    d->maximumUserStreams = qMax(0, count);
+}
+
+/// Returns the maximum bandwidth of each user in bytes per second, or 0 if
+/// it is not limited.
+///
+/// The default value is 0.
+
+qint64 QXmppServerProxy65::maximumUserBandwidth() const
+{
+    return d->maximumUserBandwidth;
+}
+
+/// Sets the maximum bandwidth of each user in bytes per second, or 0 if it
+/// should not be limited.
+///
+/// The limit applies to the sum of the user's active bytestreams, in both
+/// directions. When a user exceeds the limit, the proxy stops reading from
+/// the user's connections, and TCP flow control slows down the sender.
+///
+/// \param bytesPerSecond
+
+void QXmppServerProxy65::setMaximumUserBandwidth(qint64 bytesPerSecond)
+{
+    d->maximumUserBandwidth = qMax(qint64(0), bytesPerSecond);
+    d->userCredits.clear();
+}
+
+/// \cond
+QStringList QXmppServerProxy65::discoveryItems() const
+{
+    return QStringList() << d->jid;
+}
+
+bool QXmppServerProxy65::handleStanza(const QDomElement &element)
+{
+    if (element.attribute("to") != d->jid)
+        return false;
+
+    if (QXmppDiscoveryIq::isDiscoveryIq(element))
+    {
+        QXmppDiscoveryIq discoIq;
+        discoIq.parse(element);
+
+        if (discoIq.type() == QXmppIq::Get)
+        {
+            QXmppDiscoveryIq responseIq;
+            responseIq.setTo(discoIq.from());
+            responseIq.setFrom(discoIq.to());
+            responseIq.setId(discoIq.id());
+            responseIq.setType(QXmppIq::Result);
+            responseIq.setQueryType(discoIq.queryType());
+
+            if (discoIq.queryType() == QXmppDiscoveryIq::InfoQuery)
+            {
+                QStringList features = QStringList() << ns_disco_info << ns_disco_items << ns_bytestreams;
+
+                QList<QXmppDiscoveryIq::Identity> identities;
+                QXmppDiscoveryIq::Identity identity;
+                identity.setCategory("proxy");
+                identity.setType("bytestreams");
+                identity.setName("SOCKS5 Bytestreams");
+                identities.append(identity);
+                responseIq.setIdentities(identities);
+
+                responseIq.setFeatures(features);
+            }
+
+            server()->sendPacket(responseIq);
+            return true;
+        }
+    }
+    else if (QXmppByteStreamIq::isByteStreamIq(element))
+    {
+        QXmppByteStreamIq bsIq;
+        bsIq.parse(element);
+
+        QXmppByteStreamIq responseIq;
+        responseIq.setTo(bsIq.from());
+        responseIq.setFrom(bsIq.to());
+        responseIq.setId(bsIq.id());
+
+        // only serve local users
+        if (QXmppUtils::jidToDomain(bsIq.from()) != server()->domain())
+        {
+            if (bsIq.type() == QXmppIq::Get || bsIq.type() == QXmppIq::Set)
+            {
+                responseIq.setType(QXmppIq::Error);
+                responseIq.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::Forbidden));
+                server()->sendPacket(responseIq);
+            }
+            return true;
+        }
+
+        if (bsIq.type() == QXmppIq::Get)
+        {
+            QXmppByteStreamIq::StreamHost streamHost;
+            streamHost.setJid(d->jid);
+            streamHost.setHost(d->host);
+            streamHost.setPort(d->port);
+
+            responseIq.setType(QXmppIq::Result);
+            responseIq.setSid(bsIq.sid());
+            responseIq.setStreamHosts(QList<QXmppByteStreamIq::StreamHost>() << streamHost);
+            server()->sendPacket(responseIq);
+        }
+        else if (bsIq.type() == QXmppIq::Set)
+        {
+            const QString user = QXmppUtils::jidToBareJid(bsIq.from());
+            QCryptographicHash hash(QCryptographicHash::Sha1);
+            hash.addData((bsIq.sid() + bsIq.from() + bsIq.activate()).toUtf8());
+            const QString hostName = hash.result().toHex();
+
+            QXmppServerProxy65Relay *relay = d->relays.value(hostName);
+            if (!relay || relay->isActive() || !relay->isReady())
+            {
+                warning(QString("Not activating bytestream %1 for %2").arg(hostName, bsIq.from()));
+                responseIq.setType(QXmppIq::Error);
+                responseIq.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound));
+            }
+            else if (d->maximumUserStreams > 0 && d->userStreams.value(user) >= d->maximumUserStreams)
+            {
+                warning(QString("Too many bytestreams for %1").arg(user));
+                responseIq.setType(QXmppIq::Error);
+                responseIq.setError(QXmppStanza::Error(QXmppStanza::Error::Wait, QXmppStanza::Error::ResourceConstraint));
+            }
+            else
+            {
+                info(QString("Activating bytestream %1 for %2").arg(hostName, bsIq.from()));
+                d->userStreams[user]++;
+                setGauge("proxy65.active", ++d->activeStreams);
+                relay->activate(user);
+                responseIq.setType(QXmppIq::Result);
+            }
+            server()->sendPacket(responseIq);
+        }
+        return true;
+    }
+    return false;
+}
+
+QList<QXmppServerExtension::StanzaFilter> QXmppServerProxy65::stanzaFilters() const
+{
+    return QList<StanzaFilter>()
+        << StanzaFilter("iq", ns_bytestreams, "query")
+        << StanzaFilter("iq", ns_disco_info, "query")
+        << StanzaFilter("iq", ns_disco_items, "query");
+}
+
+bool QXmppServerProxy65::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->jid.isEmpty())
+        d->jid = "proxy." + server()->domain();
+    if (d->host.isEmpty())
+        d->host = server()->domain();
+
+    d->socksServer = new QXmppSocksServer(this);
+    check = connect(d->socksServer, SIGNAL(newConnection(QTcpSocket*,QString,quint16)),
+                    this, SLOT(_q_socksServerConnected(QTcpSocket*,QString,quint16)));
+    Q_ASSERT(check);
+
+    if (!d->socksServer->listen(d->port)) {
+        warning(QString("Could not start SOCKS5 proxy on port %1").arg(QString::number(d->port)));
+        delete d->socksServer;
+        d->socksServer = 0;
+        return false;
+    }
+    return true;
+}
+
+void QXmppServerProxy65::stop()
+{
+    foreach (QXmppServerProxy65Relay *relay, d->relays)
+        delete relay;
+    d->relays.clear();
+    d->activeStreams = 0;
+    d->userCredits.clear();
+    d->userStreams.clear();
+    d->bandwidthTimer->stop();
+
+    if (d->socksServer) {
+        d->socksServer->close();
+        delete d->socksServer;
+        d->socksServer = 0;
+    }
+}
+/// \endcond
+
+void QXmppServerProxy65::_q_bandwidthTimeout()
+{
+    d->userCredits.clear();
+
+    bool throttled = false;
+    foreach (QXmppServerProxy65Relay *relay, d->relays) {
+        if (relay->isThrottled()) {
+            relay->resume();
+            throttled = true;
+        }
+    }
+    if (!throttled)
+        d->bandwidthTimer->stop();
+}
+
+void QXmppServerProxy65::_q_relayFinished()
+{
+    QXmppServerProxy65Relay *relay = qobject_cast<QXmppServerProxy65Relay*>(sender());
+    if (!relay || d->relays.value(relay->hash()) != relay)
+        return;
+
+    d->relays.remove(relay->hash());
+    if (relay->isActive()) {
+        QHash<QString, int>::iterator it = d->userStreams.find(relay->user());
+        if (it != d->userStreams.end() && --it.value() <= 0)
+            d->userStreams.erase(it);
+        setGauge("proxy65.active", --d->activeStreams);
+    }
+}
+
+void QXmppServerProxy65::_q_socksServerConnected(QTcpSocket *socket, const QString &hostName, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+    Q_UNUSED(port);
+
+    QXmppServerProxy65Relay *relay = d->relays.value(hostName);
+    if (!relay) {
+        relay = new QXmppServerProxy65Relay(hostName, d, this);
+        check = connect(relay, SIGNAL(finished()),
+                        this, SLOT(_q_relayFinished()));
+        Q_ASSERT(check);
+        d->relays.insert(hostName, relay);
+    }
+
+    if (!relay->addSocket(socket)) {
+        warning(QString("Refusing extra connection for bytestream %1").arg(hostName));
+        socket->disconnectFromHost();
+        socket->deleteLater();
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSERVERPROXY65_H
+#define QXMPPSERVERPROXY65_H
+
+#include "QXmppServerExtension.h"
+
+class QTcpSocket;
+class QXmppServerProxy65Private;
+
+/// \brief The QXmppServerProxy65 class is a server extension which provides
+/// a SOCKS5 bytestream proxy, as defined by XEP-0065: SOCKS5 Bytestreams.
+///
+/// When two parties cannot connect to each other directly, they can both
+/// connect to the proxy, which relays the data between them.
+///
+/// The proxy only serves the users of the server's domain. The number of
+/// streams and the bandwidth of each user can be limited with
+/// setMaximumUserStreams() and setMaximumUserBandwidth().
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerProxy65 : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "proxy65")
+    Q_PROPERTY(QString jid READ jid WRITE setJid)
+    Q_PROPERTY(QString host READ host WRITE setHost)
+    Q_PROPERTY(quint16 port READ port WRITE setPort)
+
+public:
+    QXmppServerProxy65();
+    ~QXmppServerProxy65();
+
+    QString jid() const;
+    void setJid(const QString &jid);
+
+    QString host() const;
+    void setHost(const QString &host);
+
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    int maximumUserStreams() const;
+    void setMaximumUserStreams(int count);
+
+    qint64 maximumUserBandwidth() const;
+    void setMaximumUserBandwidth(qint64 bytesPerSecond);
+
+    /// \cond
+    QStringList discoveryItems() const;
+    bool handleStanza(const QDomElement &stanza);
+    QList<StanzaFilter> stanzaFilters() const;
+
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_bandwidthTimeout();
+    void _q_relayFinished();
+    void _q_socksServerConnected(QTcpSocket *socket, const QString &hostName, quint16 port);
+
+private:
+    QXmppServerProxy65Private * const d;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSERVERPROXY65_P_H
+#define QXMPPSERVERPROXY65_P_H
+
+#include <QObject>
+
+class QTcpSocket;
+class QTimer;
+class QXmppServerProxy65Private;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServerProxy65 class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppServerProxy65Relay class pairs the two SOCKS5 connections of a
+/// bytestream and splices them once the initiator activated the stream.
+
+class QXmppServerProxy65Relay : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppServerProxy65Relay(const QString &hash, QXmppServerProxy65Private *proxy, QObject *parent);
+
+    bool addSocket(QTcpSocket *socket);
+    void activate(const QString &user);
+
+    QString hash() const;
+    QString user() const;
+    bool isActive() const;
+    bool isReady() const;
+    bool isThrottled() const;
+
+    void resume();
+
+signals:
+    void finished();
+
+private slots:
+    void _q_bytesWritten();
+    void _q_disconnected();
+    void _q_readyRead();
+    void _q_timeout();
+
+private:
+    void finish();
+    QTcpSocket *peer(QObject *socket) const;
+    bool transfer(QTcpSocket *from, QTcpSocket *to, bool force);
+
+    QString m_hash;
+    QString m_user;
+    QXmppServerProxy65Private *m_proxy;
+    QTcpSocket *m_target;
+    QTcpSocket *m_initiator;
+    QTimer *m_timer;
+    bool m_active;
+    bool m_finished;
+    bool m_throttled;
+};
+
+#endif
@@ -0,0 +1,611 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDomElement>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+#include "QXmppConstants.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppMessage.h"
+#include "QXmppPubSubIq.h"
+#include "QXmppServer.h"
+#include "QXmppServerPubSub.h"
+#include "QXmppUtils.h"
+
+static const QLatin1String ns_pubsub("http://jabber.org/protocol/pubsub");
+
+class QXmppServerPubSubNode
+{
+public:
+    QXmppServerPubSubNode()
+        : hasItem(false)
+    {
+    }
+
+    QString owner;
+    QXmppPubSubItem lastItem;
+    bool hasItem;
+
+    // explicit subscriptions, for the nodes of the publish-subscribe service
+    QSet<QString> subscribers;
+};
+
+class QXmppServerPubSubPrivate
+{
+public:
+    QXmppServerPubSubPrivate();
+    QXmppMessage eventMessage(const QString &service, const QString &node, const QXmppPubSubItem &item) const;
+    bool isLocalBareJid(const QString &jid) const;
+    QSet<QString> pepRecipients(const QString &owner, const QString &node);
+    void removeResource(const QString &jid);
+    void sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition);
+    void sendLastItems(const QString &jid);
+    QSet<QString> subscribers(const QString &bareJid);
+
+    void handleCapabilities(const QDomElement &element);
+    int handlePubSub(const QDomElement &element, const QString &service);
+    void handlePresence(const QDomElement &element);
+    void handleServiceIq(const QDomElement &element);
+
+    QString jid;
+    QXmppServer *server;
+
+    // nodes by owner, which is a user's bare JID or the service's JID
+    QHash<QString, QHash<QString, QXmppServerPubSubNode> > nodes;
+
+    // capabilities key of the available resources, by bare JID
+    QHash<QString, QHash<QString, QString> > resources;
+
+    // nodes for which each capabilities key wants notifications
+    QHash<QString, QSet<QString> > capabilities;
+
+    // capabilities queries by IQ id, and the resources waiting for them
+    QHash<QString, QString> capabilityQueries;
+    QHash<QString, QSet<QString> > capabilityWaiters;
+
+    // presence subscribers by bare JID
+    QHash<QString, QSet<QString> > subscriberIndex;
+};
+
+QXmppServerPubSubPrivate::QXmppServerPubSubPrivate()
+    : server(0)
+{
+}
+
+/// Builds the notification of an \a item published to a \a node of
+/// \a service, without a recipient.
+
+QXmppMessage QXmppServerPubSubPrivate::eventMessage(const QString &service, const QString &node, const QXmppPubSubItem &item) const
+{
+    QXmppElement itemElement;
+    itemElement.setTagName("item");
+    if (!item.id().isEmpty())
+        itemElement.setAttribute("id", item.id());
+    if (!item.contents().isNull())
+        itemElement.appendChild(item.contents());
+
+    QXmppElement itemsElement;
+    itemsElement.setTagName("items");
+    itemsElement.setAttribute("node", node);
+    itemsElement.appendChild(itemElement);
+
+    QXmppElement eventElement;
+    eventElement.setTagName("event");
+    eventElement.setAttribute("xmlns", ns_personal_eventing_protocol);
+    eventElement.appendChild(itemsElement);
+
+    QXmppMessage message;
+    message.setFrom(service);
+    message.setType(QXmppMessage::Headline);
+    message.setExtensions(QXmppElementList() << eventElement);
+    return message;
+}
+
+bool QXmppServerPubSubPrivate::isLocalBareJid(const QString &jid) const
+{
+    return QXmppUtils::jidToDomain(jid) == server->domain() &&
+           !QXmppUtils::jidToUser(jid).isEmpty() &&
+           QXmppUtils::jidToResource(jid).isEmpty();
+}
+
+/// Returns the resources to notify of an item published to the personal
+/// \a node of \a owner: the resources of the owner and of its subscribers
+/// which want notifications for the node.
+
+QSet<QString> QXmppServerPubSubPrivate::pepRecipients(const QString &owner, const QString &node)
+{
+    QSet<QString> recipients;
+    QSet<QString> contacts = subscribers(owner);
+    contacts.insert(owner);
+    foreach (const QString &contact, contacts) {
+        QHash<QString, QHash<QString, QString> >::const_iterator it = resources.constFind(contact);
+        if (it == resources.constEnd())
+            continue;
+        QHash<QString, QString>::const_iterator res;
+        for (res = it.value().constBegin(); res != it.value().constEnd(); ++res) {
+            if (capabilities.value(res.value()).contains(node))
+                recipients.insert(res.key());
+        }
+    }
+    return recipients;
+}
+
+void QXmppServerPubSubPrivate::removeResource(const QString &jid)
+{
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    QHash<QString, QHash<QString, QString> >::iterator it = resources.find(bareJid);
+    if (it == resources.end())
+        return;
+
+    it.value().remove(jid);
+    if (it.value().isEmpty()) {
+        resources.erase(it);
+        subscriberIndex.remove(bareJid);
+    }
+}
+
+/// Replies to the IQ \a element with an error.
+
+void QXmppServerPubSubPrivate::sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition)
+{
+    QXmppIq response(QXmppIq::Error);
+    response.setId(element.attribute("id"));
+    response.setFrom(element.attribute("to"));
+    response.setTo(element.attribute("from"));
+    response.setError(QXmppStanza::Error(type, condition));
+    server->sendPacket(response);
+}
+
+/// Sends to the resource \a jid the last items of the personal nodes of
+/// its contacts, and of its own, for which it wants notifications.
+
+void QXmppServerPubSubPrivate::sendLastItems(const QString &jid)
+{
+    const QSet<QString> wanted = capabilities.value(resources.value(QXmppUtils::jidToBareJid(jid)).value(jid));
+    if (wanted.isEmpty())
+        return;
+
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    QSet<QString> contacts;
+    foreach (QXmppServerExtension *extension, server->extensions())
+        contacts += extension->presenceSubscriptions(bareJid);
+    contacts.insert(bareJid);
+
+    // send all the items at once
+    QByteArray data;
+    foreach (const QString &contact, contacts) {
+        QHash<QString, QHash<QString, QXmppServerPubSubNode> >::const_iterator it = nodes.constFind(contact);
+        if (it == nodes.constEnd())
+            continue;
+        QHash<QString, QXmppServerPubSubNode>::const_iterator node;
+        for (node = it.value().constBegin(); node != it.value().constEnd(); ++node) {
+            if (node.value().hasItem && wanted.contains(node.key())) {
+                QXmppMessage message = eventMessage(contact, node.key(), node.value().lastItem);
+                message.setTo(jid);
+                data += helperToXmlData(message);
+            }
+        }
+    }
+    if (!data.isEmpty())
+        server->sendData(jid, data);
+}
+
+/// Returns the presence subscribers of the user \a bareJid.
+///
+/// They are asked to the extensions once, then kept until the user's
+/// subscriptions change or its last resource goes offline.
+
+QSet<QString> QXmppServerPubSubPrivate::subscribers(const QString &bareJid)
+{
+    QHash<QString, QSet<QString> >::const_iterator it = subscriberIndex.constFind(bareJid);
+    if (it != subscriberIndex.constEnd())
+        return it.value();
+
+    QSet<QString> result;
+    foreach (QXmppServerExtension *extension, server->extensions())
+        result += extension->presenceSubscribers(bareJid);
+    subscriberIndex.insert(bareJid, result);
+    return result;
+}
+
+/// Handles the result of a query for the features of a capabilities key.
+
+void QXmppServerPubSubPrivate::handleCapabilities(const QDomElement &element)
+{
+    const QString key = capabilityQueries.take(element.attribute("id"));
+
+    // a failed query is not repeated
+    QSet<QString> wanted;
+    if (element.attribute("type") == QLatin1String("result")) {
+        QXmppDiscoveryIq response;
+        response.parse(element);
+        foreach (const QString &feature, response.features()) {
+            if (feature.endsWith(QLatin1String("+notify")))
+                wanted.insert(feature.left(feature.lastIndexOf(QLatin1Char('+'))));
+        }
+    }
+    capabilities.insert(key, wanted);
+
+    foreach (const QString &jid, capabilityWaiters.take(key)) {
+        if (resources.value(QXmppUtils::jidToBareJid(jid)).contains(jid))
+            sendLastItems(jid);
+    }
+}
+
+/// Handles a publish-subscribe IQ addressed to the personal nodes of a
+/// user, or to the publish-subscribe \a service if it is not empty.
+///
+/// Returns the number of notifications sent for a published item, or -1
+/// if no item was published.
+
+int QXmppServerPubSubPrivate::handlePubSub(const QDomElement &element, const QString &service)
+{
+    const QString from = element.attribute("from");
+    const QString fromBare = QXmppUtils::jidToBareJid(from);
+    const QString to = element.attribute("to");
+    const QString owner = !service.isEmpty() ? service : (to.isEmpty() ? fromBare : to);
+    const QString type = element.attribute("type");
+    if (type != QLatin1String("get") && type != QLatin1String("set"))
+        return -1;
+
+    const QDomElement query = element.firstChildElement("pubsub").firstChildElement();
+    const QString nodeName = query.attribute("node");
+    if (nodeName.isEmpty()) {
+        sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+        return -1;
+    }
+
+    QXmppIq response(QXmppIq::Result);
+    response.setId(element.attribute("id"));
+    response.setFrom(to);
+    response.setTo(from);
+
+    if (query.tagName() == QLatin1String("publish") && type == QLatin1String("set")) {
+        // only the owner of a node publishes to it
+        if (service.isEmpty() && owner != fromBare) {
+            sendError(element, QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden);
+            return -1;
+        }
+        QHash<QString, QXmppServerPubSubNode> &ownerNodes = nodes[owner];
+        QHash<QString, QXmppServerPubSubNode>::iterator it = ownerNodes.find(nodeName);
+        if (it != ownerNodes.end() && it.value().owner != fromBare) {
+            sendError(element, QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden);
+            return -1;
+        } else if (it == ownerNodes.end()) {
+            it = ownerNodes.insert(nodeName, QXmppServerPubSubNode());
+            it.value().owner = fromBare;
+        }
+
+        QXmppPubSubItem item;
+        item.parse(query.firstChildElement("item"));
+        if (item.id().isEmpty())
+            item.setId(QXmppUtils::generateStanzaHash());
+        it.value().lastItem = item;
+        it.value().hasItem = true;
+
+        QXmppPubSubItem publishedItem;
+        publishedItem.setId(item.id());
+        QXmppPubSubIq published;
+        published.setType(QXmppIq::Result);
+        published.setId(response.id());
+        published.setFrom(response.from());
+        published.setTo(response.to());
+        published.setQueryType(QXmppPubSubIq::PublishQuery);
+        published.setQueryNode(nodeName);
+        published.setItems(QList<QXmppPubSubItem>() << publishedItem);
+        server->sendPacket(published);
+
+        // serialize the notification once for all the recipients
+        const QSet<QString> recipients = service.isEmpty() ?
+            pepRecipients(owner, nodeName) : it.value().subscribers;
+        if (recipients.isEmpty())
+            return 0;
+        return server->broadcastPacket(eventMessage(owner, nodeName, item), recipients);
+    }
+
+    QHash<QString, QHash<QString, QXmppServerPubSubNode> >::iterator ownerIt = nodes.find(owner);
+    if (ownerIt == nodes.end() || !ownerIt.value().contains(nodeName)) {
+        sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+        return -1;
+    }
+    QXmppServerPubSubNode &node = ownerIt.value()[nodeName];
+
+    if (query.tagName() == QLatin1String("items") && type == QLatin1String("get")) {
+        // personal nodes are only visible to the owner and its subscribers
+        if (service.isEmpty() && owner != fromBare && !subscribers(owner).contains(fromBare)) {
+            sendError(element, QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden);
+            return -1;
+        }
+
+        QXmppPubSubIq items;
+        items.setType(QXmppIq::Result);
+        items.setId(response.id());
+        items.setFrom(response.from());
+        items.setTo(response.to());
+        items.setQueryType(QXmppPubSubIq::ItemsQuery);
+        items.setQueryNode(nodeName);
+        if (node.hasItem)
+            items.setItems(QList<QXmppPubSubItem>() << node.lastItem);
+        server->sendPacket(items);
+    } else if (!service.isEmpty() && type == QLatin1String("set") &&
+               (query.tagName() == QLatin1String("subscribe") || query.tagName() == QLatin1String("unsubscribe"))) {
+        const QString jid = query.attribute("jid");
+        if (QXmppUtils::jidToBareJid(jid) != fromBare) {
+            sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+            return -1;
+        }
+
+        if (query.tagName() == QLatin1String("subscribe")) {
+            node.subscribers.insert(jid);
+            server->sendPacket(response);
+            if (node.hasItem) {
+                QXmppMessage message = eventMessage(owner, nodeName, node.lastItem);
+                message.setTo(jid);
+                server->sendPacket(message);
+            }
+        } else {
+            node.subscribers.remove(jid);
+            server->sendPacket(response);
+        }
+    } else {
+        sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::FeatureNotImplemented);
+    }
+    return -1;
+}
+
+/// Tracks the available resources and their capabilities, and sends them
+/// the last items they want notifications for.
+
+void QXmppServerPubSubPrivate::handlePresence(const QDomElement &element)
+{
+    const QString from = element.attribute("from");
+    const QString to = element.attribute("to");
+    const QString type = element.attribute("type");
+
+    if (type.startsWith(QLatin1String("subscribe")) || type.startsWith(QLatin1String("unsubscribe"))) {
+        subscriberIndex.remove(QXmppUtils::jidToBareJid(from));
+        subscriberIndex.remove(QXmppUtils::jidToBareJid(to));
+        return;
+    }
+
+    // only broadcast presences tell about the resources of a contact
+    if (QXmppUtils::jidToResource(from).isEmpty() || !(to.isEmpty() || isLocalBareJid(to)))
+        return;
+
+    if (type == QLatin1String("unavailable")) {
+        removeResource(from);
+        return;
+    } else if (!type.isEmpty()) {
+        return;
+    }
+
+    QString key;
+    for (QDomElement c = element.firstChildElement("c"); !c.isNull(); c = c.nextSiblingElement("c")) {
+        if (c.namespaceURI() == ns_capabilities) {
+            key = c.attribute("node") + "#" + c.attribute("ver");
+            break;
+        }
+    }
+
+    QHash<QString, QString> &bareResources = resources[QXmppUtils::jidToBareJid(from)];
+    QHash<QString, QString>::iterator it = bareResources.find(from);
+    if (it != bareResources.end() && it.value() == key)
+        return;
+    bareResources.insert(from, key);
+    if (key.isEmpty())
+        return;
+
+    if (capabilities.contains(key)) {
+        sendLastItems(from);
+    } else {
+        // query the features of the capabilities key once
+        QSet<QString> &waiters = capabilityWaiters[key];
+        if (waiters.isEmpty()) {
+            QXmppDiscoveryIq request;
+            request.setType(QXmppIq::Get);
+            request.setFrom(server->domain());
+            request.setTo(from);
+            request.setQueryType(QXmppDiscoveryIq::InfoQuery);
+            request.setQueryNode(key);
+            capabilityQueries.insert(request.id(), key);
+            server->sendPacket(request);
+        }
+        waiters.insert(from);
+    }
+}
+
+/// Handles an IQ addressed to the publish-subscribe service, other than a
+/// publish-subscribe request.
+
+void QXmppServerPubSubPrivate::handleServiceIq(const QDomElement &element)
+{
+    const QString type = element.attribute("type");
+    if (type != QLatin1String("get") && type != QLatin1String("set"))
+        return;
+
+    if (!QXmppDiscoveryIq::isDiscoveryIq(element) || type != QLatin1String("get")) {
+        sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::FeatureNotImplemented);
+        return;
+    }
+
+    QXmppDiscoveryIq request;
+    request.parse(element);
+
+    QXmppDiscoveryIq response;
+    response.setType(QXmppIq::Result);
+    response.setId(request.id());
+    response.setFrom(jid);
+    response.setTo(request.from());
+    response.setQueryType(request.queryType());
+    if (request.queryType() == QXmppDiscoveryIq::InfoQuery) {
+        QXmppDiscoveryIq::Identity identity;
+        identity.setCategory("pubsub");
+        identity.setType("service");
+        identity.setName("Publish-Subscribe");
+        response.setIdentities(QList<QXmppDiscoveryIq::Identity>() << identity);
+        response.setFeatures(QStringList() << ns_disco_info << ns_disco_items << ns_pubsub);
+    } else {
+        QList<QXmppDiscoveryIq::Item> items;
+        foreach (const QString &node, nodes.value(jid).keys()) {
+            QXmppDiscoveryIq::Item item;
+            item.setJid(jid);
+            item.setNode(node);
+            items << item;
+        }
+        response.setItems(items);
+    }
+    server->sendPacket(response);
+}
+
+/// Constructs a new publish-subscribe extension.
+
+QXmppServerPubSub::QXmppServerPubSub()
+    : d(new QXmppServerPubSubPrivate)
+{
+}
+
+/// Destroys the publish-subscribe extension.
+
+QXmppServerPubSub::~QXmppServerPubSub()
+{
+    delete d;
+}
+
+/// Returns the JID of the publish-subscribe service.
+
+QString QXmppServerPubSub::jid() const
+{
+    return d->jid;
+}
+
+/// Sets the JID of the publish-subscribe service.
+///
+/// The default is "pubsub." followed by the server's domain.
+///
+/// \param jid
+
+void QXmppServerPubSub::setJid(const QString &jid)
+{
+    d->jid = jid;
+}
+
+/// \cond
+QStringList QXmppServerPubSub::discoveryFeatures() const
+{
+    return QStringList() << ns_pubsub;
+}
+
+QStringList QXmppServerPubSub::discoveryItems() const
+{
+    return QStringList() << d->jid;
+}
+
+bool QXmppServerPubSub::handleStanza(const QDomElement &stanza)
+{
+    if (stanza.tagName() == QLatin1String("presence")) {
+        d->handlePresence(stanza);
+        return false;
+    } else if (stanza.tagName() != QLatin1String("iq")) {
+        return false;
+    }
+
+    const QString to = stanza.attribute("to");
+    const QString type = stanza.attribute("type");
+    if (to == server()->domain() && (type == QLatin1String("result") || type == QLatin1String("error"))) {
+        if (!d->capabilityQueries.contains(stanza.attribute("id")))
+            return false;
+        d->handleCapabilities(stanza);
+        return true;
+    }
+
+    const QDomElement pubsub = stanza.firstChildElement("pubsub");
+    const bool isPubSub = !pubsub.isNull() && pubsub.namespaceURI() == ns_pubsub;
+    int notified = -1;
+    if (to == d->jid) {
+        if (isPubSub)
+            notified = d->handlePubSub(stanza, d->jid);
+        else
+            d->handleServiceIq(stanza);
+    } else if (isPubSub && (to.isEmpty() || d->isLocalBareJid(to))) {
+        notified = d->handlePubSub(stanza, QString());
+    } else {
+        return false;
+    }
+
+    if (notified >= 0) {
+        updateCounter("pubsub.published");
+        updateCounter("pubsub.notifications", notified);
+    }
+    return true;
+}
+
+QList<QXmppServerExtension::StanzaFilter> QXmppServerPubSub::stanzaFilters() const
+{
+    // replies to the capabilities queries are addressed to the server
+    StanzaFilter replies("iq");
+    replies.setDomain(server()->domain());
+    StanzaFilter service("iq");
+    service.setDomain(d->jid);
+
+    return QList<StanzaFilter>()
+        << StanzaFilter("iq", ns_pubsub, "pubsub")
+        << replies
+        << service
+        << StanzaFilter("presence");
+}
+
+bool QXmppServerPubSub::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->server = server();
+    if (d->jid.isEmpty())
+        d->jid = "pubsub." + server()->domain();
+
+    check = connect(server(), SIGNAL(clientDisconnected(QString)),
+                    this, SLOT(_q_clientDisconnected(QString)));
+    Q_ASSERT(check);
+    return true;
+}
+
+void QXmppServerPubSub::stop()
+{
+    disconnect(server(), SIGNAL(clientDisconnected(QString)),
+               this, SLOT(_q_clientDisconnected(QString)));
+
+    d->nodes.clear();
+    d->resources.clear();
+    d->capabilityQueries.clear();
+    d->capabilityWaiters.clear();
+    d->subscriberIndex.clear();
+}
+/// \endcond
+
+void QXmppServerPubSub::_q_clientDisconnected(const QString &jid)
+{
+    d->removeResource(jid);
+}
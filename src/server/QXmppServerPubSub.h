@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSERVERPUBSUB_H
+#define QXMPPSERVERPUBSUB_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerPubSubPrivate;
+
+/// \brief The QXmppServerPubSub class is a server extension which provides
+/// XEP-0163: Personal Eventing Protocol for the server's users, and a
+/// generic XEP-0060: Publish-Subscribe service.
+///
+/// The nodes are held in memory, and only their last item is kept.
+///
+/// Personal eventing nodes belong to a user's bare JID. When the user
+/// publishes an item, it is sent to the available resources of the user
+/// and of its presence subscribers, as given by the extensions'
+/// presenceSubscribers(), which advertise the node with the "+notify"
+/// suffix in their entity capabilities. The features of each capabilities
+/// version are discovered once and shared by all the resources which use
+/// it.
+///
+/// Nodes of the publish-subscribe service are created by the first item
+/// published to them, and notify the JIDs which explicitly subscribed.
+///
+/// Each notification is serialized once for all its recipients.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerPubSub : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "pubsub")
+    Q_PROPERTY(QString jid READ jid WRITE setJid)
+
+public:
+    QXmppServerPubSub();
+    ~QXmppServerPubSub();
+
+    QString jid() const;
+    void setJid(const QString &jid);
+
+    /// \cond
+    QStringList discoveryFeatures() const;
+    QStringList discoveryItems() const;
+    bool handleStanza(const QDomElement &stanza);
+    QList<StanzaFilter> stanzaFilters() const;
+
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_clientDisconnected(const QString &jid);
+
+private:
+    QXmppServerPubSubPrivate * const d;
+};
+
+#endif
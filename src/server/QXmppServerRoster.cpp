@@ -0,0 +1,1006 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QDomDocument>
+#include <QDomElement>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QXmlStreamWriter>
+
+#include "QXmppConstants.h"
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppServerRoster.h"
+#include "QXmppServerRoster_p.h"
+#include "QXmppUtils.h"
+
+// bits of a subscription type
+enum SubscriptionBit
+{
+    FromBit = QXmppRosterIq::Item::From,
+    ToBit = QXmppRosterIq::Item::To
+};
+
+static void removeId(QVector<int> &ids, int id)
+{
+    const int index = ids.indexOf(id);
+    if (index >= 0) {
+        ids[index] = ids.last();
+        ids.resize(ids.size() - 1);
+    }
+}
+
+class QXmppRosterGraphEntry
+{
+public:
+    QXmppRosterGraphEntry()
+        : contact(-1), subscription(0), ask(false)
+    {
+    }
+
+    int contact;
+    quint8 subscription;
+    bool ask;
+    QString name;
+    QStringList groups;
+};
+
+class QXmppRosterGraphNode
+{
+public:
+    QXmppRosterGraphNode()
+        : loaded(false)
+    {
+    }
+
+    int indexOf(int contact) const
+    {
+        for (int i = 0; i < entries.size(); ++i) {
+            if (entries[i].contact == contact)
+                return i;
+        }
+        return -1;
+    }
+
+    QVector<QXmppRosterGraphEntry> entries;
+    QVector<int> subscribers;
+    QVector<int> subscriptions;
+    bool loaded;
+};
+
+class QXmppRosterGraphPrivate
+{
+public:
+    QXmppRosterIq::Item item(const QXmppRosterGraphEntry &entry) const;
+
+    QHash<QString, int> ids;
+    QVector<QString> jids;
+    QVector<QXmppRosterGraphNode> nodes;
+    const QVector<int> none;
+};
+
+QXmppRosterIq::Item QXmppRosterGraphPrivate::item(const QXmppRosterGraphEntry &entry) const
+{
+    QXmppRosterIq::Item item;
+    item.setBareJid(jids[entry.contact]);
+    item.setName(entry.name);
+    item.setGroups(entry.groups.toSet());
+    item.setSubscriptionType(static_cast<QXmppRosterIq::Item::SubscriptionType>(entry.subscription));
+    if (entry.ask)
+        item.setSubscriptionStatus("subscribe");
+    return item;
+}
+
+QXmppRosterGraph::QXmppRosterGraph()
+    : d(new QXmppRosterGraphPrivate)
+{
+}
+
+QXmppRosterGraph::~QXmppRosterGraph()
+{
+    delete d;
+}
+
+/// Returns the id of the bare \a jid, allocating one if needed.
+///
+/// Allocating an id invalidates the references returned by subscribers()
+/// and subscriptions().
+
+int QXmppRosterGraph::intern(const QString &jid)
+{
+    QHash<QString, int>::const_iterator it = d->ids.constFind(jid);
+    if (it != d->ids.constEnd())
+        return it.value();
+
+    const int id = d->jids.size();
+    d->ids.insert(jid, id);
+    d->jids.append(jid);
+    d->nodes.append(QXmppRosterGraphNode());
+    return id;
+}
+
+/// Returns the id of the bare \a jid, or -1 if it has none.
+
+int QXmppRosterGraph::find(const QString &jid) const
+{
+    return d->ids.value(jid, -1);
+}
+
+/// Returns the bare JID with the given \a id.
+
+QString QXmppRosterGraph::jid(int id) const
+{
+    return d->jids.value(id);
+}
+
+/// Returns the number of interned JIDs.
+
+int QXmppRosterGraph::size() const
+{
+    return d->jids.size();
+}
+
+/// Returns true if the roster of the \a user was loaded.
+
+bool QXmppRosterGraph::isLoaded(int user) const
+{
+    return d->nodes[user].loaded;
+}
+
+void QXmppRosterGraph::setLoaded(int user, bool loaded)
+{
+    d->nodes[user].loaded = loaded;
+}
+
+/// Returns true if the roster of the \a user has an item for the \a contact.
+
+bool QXmppRosterGraph::hasItem(int user, int contact) const
+{
+    return d->nodes[user].indexOf(contact) >= 0;
+}
+
+/// Returns the item for the \a contact in the roster of the \a user.
+///
+/// If there is no such item, the returned item has an empty bare JID.
+
+QXmppRosterIq::Item QXmppRosterGraph::item(int user, int contact) const
+{
+    const QXmppRosterGraphNode &node = d->nodes[user];
+    const int index = node.indexOf(contact);
+    if (index < 0)
+        return QXmppRosterIq::Item();
+    return d->item(node.entries[index]);
+}
+
+/// Returns the items of the roster of the \a user.
+
+QList<QXmppRosterIq::Item> QXmppRosterGraph::items(int user) const
+{
+    QList<QXmppRosterIq::Item> items;
+    foreach (const QXmppRosterGraphEntry &entry, d->nodes[user].entries)
+        items << d->item(entry);
+    return items;
+}
+
+/// Adds or replaces an \a item of the roster of the \a user.
+
+void QXmppRosterGraph::setItem(int user, const QXmppRosterIq::Item &item)
+{
+    const int contact = intern(item.bareJid());
+    if (item.subscriptionType() == QXmppRosterIq::Item::Remove) {
+        removeItem(user, contact);
+        return;
+    }
+
+    QXmppRosterGraphNode &node = d->nodes[user];
+    int index = node.indexOf(contact);
+    if (index < 0) {
+        index = node.entries.size();
+        node.entries.append(QXmppRosterGraphEntry());
+        node.entries[index].contact = contact;
+    }
+
+    QXmppRosterGraphEntry &entry = node.entries[index];
+    const quint8 subscription = (item.subscriptionType() == QXmppRosterIq::Item::NotSet) ?
+        quint8(QXmppRosterIq::Item::None) : quint8(item.subscriptionType());
+    const quint8 added = subscription & ~entry.subscription;
+    const quint8 removed = entry.subscription & ~subscription;
+    if (added & FromBit)
+        node.subscribers.append(contact);
+    else if (removed & FromBit)
+        removeId(node.subscribers, contact);
+    if (added & ToBit)
+        node.subscriptions.append(contact);
+    else if (removed & ToBit)
+        removeId(node.subscriptions, contact);
+
+    entry.subscription = subscription;
+    entry.ask = item.subscriptionStatus() == QLatin1String("subscribe");
+    entry.name = item.name();
+    entry.groups = item.groups().toList();
+}
+
+/// Removes the item for the \a contact from the roster of the \a user.
+
+void QXmppRosterGraph::removeItem(int user, int contact)
+{
+    QXmppRosterGraphNode &node = d->nodes[user];
+    const int index = node.indexOf(contact);
+    if (index < 0)
+        return;
+
+    const quint8 subscription = node.entries[index].subscription;
+    if (subscription & FromBit)
+        removeId(node.subscribers, contact);
+    if (subscription & ToBit)
+        removeId(node.subscriptions, contact);
+    node.entries.remove(index);
+}
+
+/// Returns the ids of the contacts subscribed to the presence of the \a user.
+
+const QVector<int> &QXmppRosterGraph::subscribers(int user) const
+{
+    if (user < 0 || user >= d->nodes.size())
+        return d->none;
+    return d->nodes[user].subscribers;
+}
+
+/// Returns the ids of the contacts to whose presence the \a user is
+/// subscribed.
+
+const QVector<int> &QXmppRosterGraph::subscriptions(int user) const
+{
+    if (user < 0 || user >= d->nodes.size())
+        return d->none;
+    return d->nodes[user].subscriptions;
+}
+
+/// Removes all the JIDs and rosters.
+
+void QXmppRosterGraph::clear()
+{
+    d->ids.clear();
+    d->jids.clear();
+    d->nodes.clear();
+}
+
+/// Constructs a new roster store.
+///
+/// \param parent
+
+QXmppRosterStore::QXmppRosterStore(QObject *parent)
+    : QObject(parent)
+{
+}
+
+class QXmppServerRosterPrivate
+{
+public:
+    QXmppServerRosterPrivate(QXmppServerRoster *qq);
+    QDomElement createPresence(const QString &from, const QString &to, const QString &type);
+    bool ensureLoaded(int user, const QDomElement &element);
+    bool isLocalUser(const QString &bareJid) const;
+    void pushItem(int user, int contact);
+    void resourceUnavailable(const QString &jid, const QDomElement &presence);
+    void sendPresences(const QString &bareJid, const QString &to, bool available);
+    bool updateItem(int user, int contact, quint8 addBits, quint8 removeBits, int ask);
+
+    void handleBroadcast(const QDomElement &element);
+    void handleProbe(const QDomElement &element);
+    void handleRosterIq(const QDomElement &element);
+    void handleSubscription(const QDomElement &element);
+
+    QXmppRosterGraph graph;
+    QXmppRosterStore *store;
+    QXmppServer *server;
+
+    // available presence of the resources of the local users, by bare JID
+    QHash<QString, QHash<QString, QDomElement> > available;
+    bool suppressDuplicates;
+
+    // recipients of the directed presences of each resource
+    QHash<QString, QSet<QString> > directed;
+
+    // resources which requested their roster, by bare JID
+    QHash<QString, QSet<QString> > interested;
+
+    // stanzas waiting for a roster to be loaded
+    QHash<int, QList<QDomElement> > waiting;
+
+    QDomDocument document;
+
+private:
+    QXmppServerRoster *q;
+};
+
+QXmppServerRosterPrivate::QXmppServerRosterPrivate(QXmppServerRoster *qq)
+    : store(0)
+    , server(0)
+    , suppressDuplicates(true)
+    , q(qq)
+{
+}
+
+QDomElement QXmppServerRosterPrivate::createPresence(const QString &from, const QString &to, const QString &type)
+{
+    QDomElement element = document.createElement("presence");
+    element.setAttribute("from", from);
+    element.setAttribute("to", to);
+    if (!type.isEmpty())
+        element.setAttribute("type", type);
+    return element;
+}
+
+/// Returns true if the roster of the \a user is available. Otherwise the
+/// \a element is handled again once it is loaded.
+
+bool QXmppServerRosterPrivate::ensureLoaded(int user, const QDomElement &element)
+{
+    if (!store || graph.isLoaded(user))
+        return true;
+
+    QList<QDomElement> &elements = waiting[user];
+    elements << element;
+    if (elements.size() == 1)
+        store->loadRoster(graph.jid(user));
+    return false;
+}
+
+bool QXmppServerRosterPrivate::isLocalUser(const QString &bareJid) const
+{
+    return QXmppUtils::jidToDomain(bareJid) == server->domain() &&
+           !QXmppUtils::jidToUser(bareJid).isEmpty();
+}
+
+/// Sends the item for the \a contact in the roster of the \a user to the
+/// user's interested resources, and saves it.
+
+void QXmppServerRosterPrivate::pushItem(int user, int contact)
+{
+    QXmppRosterIq::Item item = graph.item(user, contact);
+    if (item.bareJid().isEmpty()) {
+        item.setBareJid(graph.jid(contact));
+        item.setSubscriptionType(QXmppRosterIq::Item::Remove);
+    }
+
+    const QString bareJid = graph.jid(user);
+    foreach (const QString &resource, interested.value(bareJid)) {
+        QXmppRosterIq push;
+        push.setType(QXmppIq::Set);
+        push.setFrom(bareJid);
+        push.setTo(resource);
+        push.addItem(item);
+        server->sendPacket(push);
+    }
+
+    if (store)
+        store->saveItem(bareJid, item);
+}
+
+/// Tells the subscribers of the resource \a jid, its other resources and
+/// the recipients of its directed presences that it is unavailable.
+
+void QXmppServerRosterPrivate::resourceUnavailable(const QString &jid, const QDomElement &presence)
+{
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    QHash<QString, QHash<QString, QDomElement> >::iterator it = available.find(bareJid);
+    if (it != available.end()) {
+        it.value().remove(jid);
+        if (it.value().isEmpty())
+            available.erase(it);
+    }
+
+    QSet<QString> recipients = directed.take(jid);
+    recipients.insert(bareJid);
+    foreach (int subscriber, graph.subscribers(graph.find(bareJid)))
+        recipients.insert(graph.jid(subscriber));
+
+    if (presence.isNull()) {
+        QXmppPresence unavailable(QXmppPresence::Unavailable);
+        unavailable.setFrom(jid);
+        server->broadcastPacket(unavailable, recipients);
+    } else {
+        server->broadcastElement(presence, recipients);
+    }
+}
+
+/// Sends the presence of the resources of the user \a bareJid to \a to,
+/// as available presences if \a available is true, or as unavailable ones.
+
+void QXmppServerRosterPrivate::sendPresences(const QString &bareJid, const QString &to, bool available)
+{
+    const QHash<QString, QDomElement> resources = this->available.value(bareJid);
+    QHash<QString, QDomElement>::const_iterator it;
+    for (it = resources.constBegin(); it != resources.constEnd(); ++it) {
+        if (it.key() == to)
+            continue;
+        if (available) {
+            server->broadcastElement(it.value(), QSet<QString>() << to);
+        } else {
+            QXmppPresence unavailable(QXmppPresence::Unavailable);
+            unavailable.setFrom(it.key());
+            unavailable.setTo(to);
+            server->sendPacket(unavailable);
+        }
+    }
+}
+
+/// Changes the subscription of the item for the \a contact in the roster of
+/// the \a user, and its pending subscription request unless \a ask is
+/// negative. The item is created if needed.
+///
+/// Returns true if the item changed, in which case it is pushed.
+
+bool QXmppServerRosterPrivate::updateItem(int user, int contact, quint8 addBits, quint8 removeBits, int ask)
+{
+    QXmppRosterIq::Item item = graph.item(user, contact);
+    const bool exists = !item.bareJid().isEmpty();
+    if (!exists) {
+        item.setBareJid(graph.jid(contact));
+        item.setSubscriptionType(QXmppRosterIq::Item::None);
+    }
+
+    const quint8 oldSubscription = item.subscriptionType();
+    const quint8 subscription = (oldSubscription | addBits) & ~removeBits;
+    const bool oldAsk = item.subscriptionStatus() == QLatin1String("subscribe");
+    const bool newAsk = ask < 0 ? oldAsk : ask > 0;
+    if (exists && subscription == oldSubscription && newAsk == oldAsk)
+        return false;
+
+    item.setSubscriptionType(static_cast<QXmppRosterIq::Item::SubscriptionType>(subscription));
+    item.setSubscriptionStatus(newAsk ? QString("subscribe") : QString());
+    graph.setItem(user, item);
+    pushItem(user, contact);
+    return true;
+}
+
+// Returns true if two elements have the same name, attributes and
+// content. The id of the top-level elements is ignored.
+
+static bool isSameElement(const QDomElement &a, const QDomElement &b, bool topLevel)
+{
+    if (a.tagName() != b.tagName() || a.namespaceURI() != b.namespaceURI())
+        return false;
+
+    const QDomNamedNodeMap attributes = a.attributes();
+    int count = 0;
+    for (int i = 0; i < attributes.count(); ++i) {
+        const QDomAttr attribute = attributes.item(i).toAttr();
+        if (topLevel && attribute.name() == QLatin1String("id"))
+            continue;
+        if (!b.hasAttribute(attribute.name()) || b.attribute(attribute.name()) != attribute.value())
+            return false;
+        count++;
+    }
+    if (b.attributes().count() - ((topLevel && b.hasAttribute("id")) ? 1 : 0) != count)
+        return false;
+
+    QDomNode aChild = a.firstChild();
+    QDomNode bChild = b.firstChild();
+    while (!aChild.isNull() && !bChild.isNull()) {
+        if (aChild.nodeType() != bChild.nodeType())
+            return false;
+        if (aChild.isElement()) {
+            if (!isSameElement(aChild.toElement(), bChild.toElement(), false))
+                return false;
+        } else if (aChild.nodeValue() != bChild.nodeValue()) {
+            return false;
+        }
+        aChild = aChild.nextSibling();
+        bChild = bChild.nextSibling();
+    }
+    return aChild.isNull() && bChild.isNull();
+}
+
+/// Handles an available or unavailable presence which a local resource
+/// broadcasts to its subscribers.
+
+void QXmppServerRosterPrivate::handleBroadcast(const QDomElement &element)
+{
+    const QString from = element.attribute("from");
+    const QString bareJid = QXmppUtils::jidToBareJid(from);
+    const int user = graph.intern(bareJid);
+    if (!ensureLoaded(user, element))
+        return;
+
+    if (element.attribute("type") == QLatin1String("unavailable")) {
+        resourceUnavailable(from, element);
+        return;
+    }
+
+    QHash<QString, QDomElement> &resources = available[bareJid];
+    QHash<QString, QDomElement>::iterator it = resources.find(from);
+    const bool initial = (it == resources.end());
+
+    // the subscribers already know this presence
+    if (!initial && suppressDuplicates && isSameElement(it.value(), element, true)) {
+        q->updateCounter("roster.duplicate-presences");
+        return;
+    }
+    resources.insert(from, element);
+
+    // the presence is serialized once for all the recipients
+    QSet<QString> recipients;
+    recipients.reserve(graph.subscribers(user).size() + 1);
+    recipients.insert(bareJid);
+    foreach (int subscriber, graph.subscribers(user))
+        recipients.insert(graph.jid(subscriber));
+    server->broadcastElement(element, recipients);
+
+    if (!initial)
+        return;
+
+    // the new resource learns the presence of its contacts, local contacts
+    // do not need to be probed
+    foreach (int contact, graph.subscriptions(user)) {
+        const QString contactJid = graph.jid(contact);
+        if (isLocalUser(contactJid)) {
+            sendPresences(contactJid, from, true);
+        } else {
+            QXmppPresence probe(QXmppPresence::Probe);
+            probe.setFrom(bareJid);
+            probe.setTo(contactJid);
+            server->sendPacket(probe);
+        }
+    }
+    sendPresences(bareJid, from, true);
+}
+
+/// Answers a presence probe addressed to a local user.
+
+void QXmppServerRosterPrivate::handleProbe(const QDomElement &element)
+{
+    const QString from = element.attribute("from");
+    const QString bareJid = QXmppUtils::jidToBareJid(element.attribute("to"));
+    const int user = graph.intern(bareJid);
+    if (!ensureLoaded(user, element))
+        return;
+
+    const int contact = graph.find(QXmppUtils::jidToBareJid(from));
+    if (contact >= 0 && (graph.item(user, contact).subscriptionType() & FromBit))
+        sendPresences(bareJid, from, true);
+}
+
+/// Handles a roster get or set from a local resource.
+
+void QXmppServerRosterPrivate::handleRosterIq(const QDomElement &element)
+{
+    const QString from = element.attribute("from");
+    const QString bareJid = QXmppUtils::jidToBareJid(from);
+    const int user = graph.intern(bareJid);
+    if (!ensureLoaded(user, element))
+        return;
+
+    QXmppRosterIq request;
+    request.parse(element);
+
+    QXmppRosterIq response;
+    response.setType(QXmppIq::Result);
+    response.setId(request.id());
+    response.setTo(from);
+
+    if (request.type() == QXmppIq::Get) {
+        interested[bareJid].insert(from);
+        foreach (const QXmppRosterIq::Item &item, graph.items(user))
+            response.addItem(item);
+        server->sendPacket(response);
+        return;
+    } else if (request.type() != QXmppIq::Set) {
+        return;
+    }
+
+    const QList<QXmppRosterIq::Item> items = request.items();
+    const QString contactJid = items.isEmpty() ? QString() : QXmppUtils::jidToBareJid(items.first().bareJid());
+    if (items.size() != 1 || contactJid.isEmpty() || contactJid == bareJid) {
+        QXmppIq error(QXmppIq::Error);
+        error.setId(request.id());
+        error.setTo(from);
+        error.setError(QXmppStanza::Error(QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest));
+        server->sendPacket(error);
+        return;
+    }
+
+    const int contact = graph.intern(contactJid);
+    const QXmppRosterIq::Item current = graph.item(user, contact);
+    if (items.first().subscriptionType() == QXmppRosterIq::Item::Remove) {
+        // cancel the subscriptions in both directions
+        if (!current.bareJid().isEmpty()) {
+            if ((current.subscriptionType() & ToBit) || current.subscriptionStatus() == QLatin1String("subscribe"))
+                handleSubscription(createPresence(bareJid, contactJid, "unsubscribe"));
+            if (current.subscriptionType() & FromBit)
+                handleSubscription(createPresence(bareJid, contactJid, "unsubscribed"));
+            graph.removeItem(user, contact);
+            pushItem(user, contact);
+        }
+    } else {
+        // clients may only change the name and groups of an item
+        QXmppRosterIq::Item item = items.first();
+        item.setBareJid(contactJid);
+        if (current.bareJid().isEmpty()) {
+            item.setSubscriptionType(QXmppRosterIq::Item::None);
+            item.setSubscriptionStatus(QString());
+        } else {
+            item.setSubscriptionType(current.subscriptionType());
+            item.setSubscriptionStatus(current.subscriptionStatus());
+        }
+        graph.setItem(user, item);
+        pushItem(user, contact);
+    }
+    server->sendPacket(response);
+}
+
+/// Handles a subscription request or answer, on behalf of the sender if it
+/// is a local user and of the recipient if it is a local user.
+
+void QXmppServerRosterPrivate::handleSubscription(const QDomElement &element)
+{
+    const QString type = element.attribute("type");
+    const QString fromJid = QXmppUtils::jidToBareJid(element.attribute("from"));
+    const QString toJid = QXmppUtils::jidToBareJid(element.attribute("to"));
+    const bool fromLocal = isLocalUser(fromJid);
+    const bool toLocal = isLocalUser(toJid);
+
+    const int sender = graph.intern(fromJid);
+    const int recipient = graph.intern(toJid);
+    if ((fromLocal && !ensureLoaded(sender, element)) ||
+        (toLocal && !ensureLoaded(recipient, element)))
+        return;
+
+    // subscriptions are between bare JIDs
+    QDomElement stanza = element;
+    stanza.setAttribute("from", fromJid);
+    stanza.setAttribute("to", toJid);
+
+    if (fromLocal) {
+        if (type == QLatin1String("subscribe")) {
+            updateItem(sender, recipient, 0, 0, 1);
+        } else if (type == QLatin1String("subscribed")) {
+            updateItem(sender, recipient, FromBit, 0, -1);
+        } else if (type == QLatin1String("unsubscribe")) {
+            updateItem(sender, recipient, 0, ToBit, 0);
+        } else if (type == QLatin1String("unsubscribed")) {
+            updateItem(sender, recipient, 0, FromBit, -1);
+        }
+    }
+
+    bool deliver = true;
+    if (toLocal) {
+        const QXmppRosterIq::Item item = graph.item(recipient, sender);
+        if (type == QLatin1String("subscribe")) {
+            // approve subscriptions which were already approved
+            if (item.subscriptionType() & FromBit) {
+                deliver = false;
+                handleSubscription(createPresence(toJid, fromJid, "subscribed"));
+            }
+        } else if (type == QLatin1String("subscribed")) {
+            deliver = item.subscriptionStatus() == QLatin1String("subscribe");
+            if (deliver)
+                updateItem(recipient, sender, ToBit, 0, 0);
+        } else if (type == QLatin1String("unsubscribe")) {
+            updateItem(recipient, sender, 0, FromBit, -1);
+        } else if (type == QLatin1String("unsubscribed")) {
+            updateItem(recipient, sender, 0, ToBit, 0);
+        }
+    }
+
+    if (deliver)
+        server->sendElement(stanza);
+
+    // the contact learns the presence of the user after the answer
+    if (fromLocal && type == QLatin1String("subscribed"))
+        sendPresences(fromJid, toJid, true);
+    else if (fromLocal && type == QLatin1String("unsubscribed"))
+        sendPresences(fromJid, toJid, false);
+}
+
+/// Constructs a new roster extension.
+
+QXmppServerRoster::QXmppServerRoster()
+    : d(new QXmppServerRosterPrivate(this))
+{
+}
+
+/// Destroys the roster extension.
+
+QXmppServerRoster::~QXmppServerRoster()
+{
+    delete d;
+}
+
+/// Returns the store of the rosters.
+
+QXmppRosterStore *QXmppServerRoster::store() const
+{
+    return d->store;
+}
+
+/// Returns true if a resource sending the same available presence again
+/// is not broadcast to its subscribers.
+
+bool QXmppServerRoster::duplicatePresenceSuppressionEnabled() const
+{
+    return d->suppressDuplicates;
+}
+
+/// Sets whether a resource sending the same available presence again is
+/// broadcast to its subscribers.
+///
+/// Presences are compared with the last available presence of the
+/// resource, ignoring their id. This is enabled by default.
+///
+/// \param enabled
+
+void QXmppServerRoster::setDuplicatePresenceSuppressionEnabled(bool enabled)
+{
+    d->suppressDuplicates = enabled;
+}
+
+/// Sets the store of the rosters.
+///
+/// The extension does not take ownership of the store.
+///
+/// \param store
+
+void QXmppServerRoster::setStore(QXmppRosterStore *store)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (store == d->store)
+        return;
+
+    if (d->store)
+        disconnect(d->store, 0, this, 0);
+    d->store = store;
+    if (store) {
+        check = connect(store, SIGNAL(rosterLoaded(QString,QList<QXmppRosterIq::Item>)),
+                        this, SLOT(_q_rosterLoaded(QString,QList<QXmppRosterIq::Item>)));
+        Q_ASSERT(check);
+    }
+}
+
+/// \cond
+int QXmppServerRoster::extensionPriority() const
+{
+    // let the other extensions see the presences first
+    return -1;
+}
+
+bool QXmppServerRoster::handleStanza(const QDomElement &stanza)
+{
+    const QString from = stanza.attribute("from");
+    const QString to = stanza.attribute("to");
+    const QString type = stanza.attribute("type");
+    const bool fromLocal = d->isLocalUser(QXmppUtils::jidToBareJid(from));
+
+    if (stanza.tagName() == QLatin1String("iq")) {
+        if (!fromLocal || !(to.isEmpty() || to == QXmppUtils::jidToBareJid(from)) ||
+            !QXmppRosterIq::isRosterIq(stanza))
+            return false;
+        d->handleRosterIq(stanza);
+        return true;
+    } else if (stanza.tagName() != QLatin1String("presence")) {
+        return false;
+    }
+
+    if (type == QLatin1String("subscribe") || type == QLatin1String("subscribed") ||
+        type == QLatin1String("unsubscribe") || type == QLatin1String("unsubscribed")) {
+        if (!to.isEmpty())
+            d->handleSubscription(stanza);
+        return true;
+    } else if (type == QLatin1String("probe")) {
+        if (!d->isLocalUser(QXmppUtils::jidToBareJid(to)))
+            return false;
+        d->handleProbe(stanza);
+        return true;
+    } else if (!type.isEmpty() && type != QLatin1String("unavailable")) {
+        return false;
+    }
+
+    if (!fromLocal || QXmppUtils::jidToResource(from).isEmpty())
+        return false;
+
+    if (to.isEmpty()) {
+        d->handleBroadcast(stanza);
+        updateCounter("roster.presence-broadcasts");
+        return true;
+    }
+
+    // remember directed presences to cancel them when the resource leaves
+    if (type.isEmpty()) {
+        d->directed[from].insert(to);
+    } else {
+        QHash<QString, QSet<QString> >::iterator it = d->directed.find(from);
+        if (it != d->directed.end()) {
+            it.value().remove(to);
+            if (it.value().isEmpty())
+                d->directed.erase(it);
+        }
+    }
+    return false;
+}
+
+QList<QXmppServerExtension::StanzaFilter> QXmppServerRoster::stanzaFilters() const
+{
+    return QList<StanzaFilter>()
+        << StanzaFilter("iq", ns_roster, "query")
+        << StanzaFilter("presence");
+}
+
+QSet<QString> QXmppServerRoster::presenceSubscribers(const QString &jid)
+{
+    QSet<QString> jids;
+    foreach (int subscriber, d->graph.subscribers(d->graph.find(jid)))
+        jids.insert(d->graph.jid(subscriber));
+    return jids;
+}
+
+QSet<QString> QXmppServerRoster::presenceSubscriptions(const QString &jid)
+{
+    QSet<QString> jids;
+    foreach (int contact, d->graph.subscriptions(d->graph.find(jid)))
+        jids.insert(d->graph.jid(contact));
+    return jids;
+}
+
+// The rosters are only saved if there is no store to load them from. The
+// presences are kept, so that a handoff to another process goes unnoticed
+// by the contacts of the users whose sessions are resumed.
+QByteArray QXmppServerRoster::saveState() const
+{
+    QHash<QString, QList<QByteArray> > rosters;
+    if (!d->store) {
+        for (int user = 0; user < d->graph.size(); ++user) {
+            QList<QByteArray> items;
+            foreach (const QXmppRosterIq::Item &item, d->graph.items(user)) {
+                QByteArray data;
+                QXmlStreamWriter writer(&data);
+                item.toXml(&writer);
+                items << data;
+            }
+            if (!items.isEmpty())
+                rosters.insert(d->graph.jid(user), items);
+        }
+    }
+
+    QHash<QString, QHash<QString, QByteArray> > available;
+    QHash<QString, QHash<QString, QDomElement> >::const_iterator it;
+    for (it = d->available.constBegin(); it != d->available.constEnd(); ++it) {
+        QHash<QString, QByteArray> &resources = available[it.key()];
+        QHash<QString, QDomElement>::const_iterator jt;
+        for (jt = it.value().constBegin(); jt != it.value().constEnd(); ++jt) {
+            QByteArray data;
+            QXmlStreamWriter writer(&data);
+            helperToXmlAddDomElement(&writer, jt.value(), QStringList());
+            resources.insert(jt.key(), data);
+        }
+    }
+
+    QByteArray state;
+    QDataStream stream(&state, QIODevice::WriteOnly);
+    stream << quint8(1) << rosters << available << d->directed << d->interested;
+    return state;
+}
+
+bool QXmppServerRoster::restoreState(const QByteArray &state)
+{
+    if (state.isEmpty())
+        return true;
+
+    quint8 version = 0;
+    QHash<QString, QList<QByteArray> > rosters;
+    QHash<QString, QHash<QString, QByteArray> > available;
+    QHash<QString, QSet<QString> > directed;
+    QHash<QString, QSet<QString> > interested;
+    QDataStream stream(state);
+    stream >> version >> rosters >> available >> directed >> interested;
+    if (stream.status() != QDataStream::Ok || version != 1)
+        return false;
+
+    QHash<QString, QList<QByteArray> >::const_iterator rt;
+    for (rt = rosters.constBegin(); rt != rosters.constEnd(); ++rt) {
+        const int user = d->graph.intern(rt.key());
+        foreach (const QByteArray &data, rt.value()) {
+            QDomDocument doc;
+            if (!doc.setContent(data))
+                return false;
+            QXmppRosterIq::Item item;
+            item.parse(doc.documentElement());
+            d->graph.setItem(user, item);
+        }
+    }
+
+    QHash<QString, QHash<QString, QByteArray> >::const_iterator it;
+    for (it = available.constBegin(); it != available.constEnd(); ++it) {
+        QHash<QString, QDomElement> &resources = d->available[it.key()];
+        QHash<QString, QByteArray>::const_iterator jt;
+        for (jt = it.value().constBegin(); jt != it.value().constEnd(); ++jt) {
+            QDomDocument doc;
+            if (!doc.setContent(jt.value(), true))
+                return false;
+            resources.insert(jt.key(), doc.documentElement());
+        }
+    }
+
+    d->directed = directed;
+    d->interested = interested;
+    return true;
+}
+
+bool QXmppServerRoster::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->server = server();
+    check = connect(server(), SIGNAL(clientDisconnected(QString)),
+                    this, SLOT(_q_clientDisconnected(QString)));
+    Q_ASSERT(check);
+    return true;
+}
+
+void QXmppServerRoster::stop()
+{
+    disconnect(server(), SIGNAL(clientDisconnected(QString)),
+               this, SLOT(_q_clientDisconnected(QString)));
+
+    d->graph.clear();
+    d->available.clear();
+    d->directed.clear();
+    d->interested.clear();
+    d->waiting.clear();
+}
+/// \endcond
+
+void QXmppServerRoster::_q_clientDisconnected(const QString &jid)
+{
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    QHash<QString, QSet<QString> >::iterator it = d->interested.find(bareJid);
+    if (it != d->interested.end()) {
+        it.value().remove(jid);
+        if (it.value().isEmpty())
+            d->interested.erase(it);
+    }
+
+    // the resource left without sending an unavailable presence
+    if (d->available.value(bareJid).contains(jid) || d->directed.contains(jid))
+        d->resourceUnavailable(jid, QDomElement());
+}
+
+void QXmppServerRoster::_q_rosterLoaded(const QString &bareJid, const QList<QXmppRosterIq::Item> &items)
+{
+    const int user = d->graph.intern(bareJid);
+    if (d->graph.isLoaded(user))
+        return;
+
+    foreach (const QXmppRosterIq::Item &item, items)
+        d->graph.setItem(user, item);
+    d->graph.setLoaded(user, true);
+
+    foreach (const QDomElement &element, d->waiting.take(user))
+        handleStanza(element);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSERVERROSTER_H
+#define QXMPPSERVERROSTER_H
+
+#include "QXmppRosterIq.h"
+#include "QXmppServerExtension.h"
+
+class QXmppServerRosterPrivate;
+
+/// \brief The QXmppRosterStore class is the base class for the storage
+/// backends of QXmppServerRoster.
+///
+/// Both operations are asynchronous: loadRoster() returns at once and the
+/// store emits rosterLoaded() when the items are available, and saveItem()
+/// may write the item in the background.
+
+class QXMPP_EXPORT QXmppRosterStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppRosterStore(QObject *parent = 0);
+
+    /// Starts loading the roster of the user \a bareJid. The store must
+    /// emit rosterLoaded() once it is loaded, even if it is empty.
+    virtual void loadRoster(const QString &bareJid) = 0;
+
+    /// Saves an \a item of the roster of the user \a bareJid. An item whose
+    /// subscription type is QXmppRosterIq::Item::Remove must be deleted.
+    virtual void saveItem(const QString &bareJid, const QXmppRosterIq::Item &item) = 0;
+
+signals:
+    /// This signal is emitted when the roster of the user \a bareJid has
+    /// been loaded. It must be emitted from the server's thread.
+    void rosterLoaded(const QString &bareJid, const QList<QXmppRosterIq::Item> &items);
+};
+
+/// \brief The QXmppServerRoster class is a server extension which manages
+/// the users' rosters and presence subscriptions, and broadcasts their
+/// presence, as defined by RFC 6121.
+///
+/// The subscriptions of all the users are kept in memory as a graph, which
+/// the other extensions query with presenceSubscribers() and
+/// presenceSubscriptions(). Rosters are loaded from the store, if one is
+/// set, the first time a user needs them. Without a store, rosters only
+/// live as long as the server.
+///
+/// The server also keeps track of the directed presences each resource
+/// sent, so that its unavailable presence reaches exactly the entities
+/// which knew it was available.
+///
+/// A resource which sends the same available presence again, as many
+/// clients do on timers, is not broadcast to its subscribers a second
+/// time, see setDuplicatePresenceSuppressionEnabled().
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerRoster : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "roster")
+
+public:
+    QXmppServerRoster();
+    ~QXmppServerRoster();
+
+    QXmppRosterStore *store() const;
+    void setStore(QXmppRosterStore *store);
+
+    bool duplicatePresenceSuppressionEnabled() const;
+    void setDuplicatePresenceSuppressionEnabled(bool enabled);
+
+    /// \cond
+    int extensionPriority() const;
+    bool handleStanza(const QDomElement &stanza);
+    QList<StanzaFilter> stanzaFilters() const;
+    QSet<QString> presenceSubscribers(const QString &jid);
+    QSet<QString> presenceSubscriptions(const QString &jid);
+
+    QByteArray saveState() const;
+    bool restoreState(const QByteArray &state);
+
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_clientDisconnected(const QString &jid);
+    void _q_rosterLoaded(const QString &bareJid, const QList<QXmppRosterIq::Item> &items);
+
+private:
+    QXmppServerRosterPrivate * const d;
+    friend class QXmppServerRosterPrivate;
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPSERVERROSTER_P_H
+#define QXMPPSERVERROSTER_P_H
+
+#include <QList>
+#include <QVector>
+
+#include "QXmppRosterIq.h"
+
+class QXmppRosterGraphPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServerRoster class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppRosterGraph class holds the rosters of the users and the
+/// presence subscriptions between JIDs.
+///
+/// Bare JIDs are interned as integer ids. For each id, the graph keeps
+/// the roster items and two adjacency lists: the contacts subscribed to
+/// its presence, and the contacts whose presence it is subscribed to.
+/// The lists are updated along with the items, so that looking up the
+/// subscribers of a user does not allocate.
+
+class QXMPP_AUTOTEST_EXPORT QXmppRosterGraph
+{
+public:
+    QXmppRosterGraph();
+    ~QXmppRosterGraph();
+
+    int intern(const QString &jid);
+    int find(const QString &jid) const;
+    QString jid(int id) const;
+    int size() const;
+
+    bool isLoaded(int user) const;
+    void setLoaded(int user, bool loaded);
+
+    bool hasItem(int user, int contact) const;
+    QXmppRosterIq::Item item(int user, int contact) const;
+    QList<QXmppRosterIq::Item> items(int user) const;
+    void setItem(int user, const QXmppRosterIq::Item &item);
+    void removeItem(int user, int contact);
+
+    const QVector<int> &subscribers(int user) const;
+    const QVector<int> &subscriptions(int user) const;
+
+    void clear();
+
+private:
+    Q_DISABLE_COPY(QXmppRosterGraph)
+    QXmppRosterGraphPrivate * const d;
+};
+
+#endif
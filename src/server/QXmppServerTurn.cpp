@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QDateTime>
+#include <QDomElement>
+#include <QStringList>
+
+#include "QXmppConstants.h"
+#include "QXmppElement.h"
+#include "QXmppIq.h"
+#include "QXmppServer.h"
+#include "QXmppServerTurn.h"
+#include "QXmppTurnServer.h"
+#include "QXmppUtils.h"
+
+class QXmppServerTurnPrivate
+{
+public:
+    QXmppElement service(const QString &type) const;
+
+    QString host;
+    quint16 port;
+    int credentialLifetime;
+    QXmppTurnServer *turnServer;
+};
+
+QXmppElement QXmppServerTurnPrivate::service(const QString &type) const
+{
+    QXmppElement service;
+    service.setTagName("service");
+    service.setAttribute("host", host);
+    service.setAttribute("port", QString::number(port));
+    service.setAttribute("transport", "udp");
+    service.setAttribute("type", type);
+    return service;
+}
+
+/// Constructs a new TURN server extension.
+
+QXmppServerTurn::QXmppServerTurn()
+    : d(new QXmppServerTurnPrivate)
+{
+    d->port = 3478;
+    d->credentialLifetime = 86400;
+    d->turnServer = new QXmppTurnServer(this);
+}
+
+/// Destroys the TURN server extension.
+
+QXmppServerTurn::~QXmppServerTurn()
+{
+    delete d;
+}
+
+/// Returns the host name or address which clients send requests to.
+///
+/// If no host is set, the server's domain is used.
+
+QString QXmppServerTurn::host() const
+{
+    return d->host;
+}
+
+/// Sets the host name or address which clients send requests to.
+///
+/// \param host
+
+void QXmppServerTurn::setHost(const QString &host)
+{
+    d->host = host;
+}
+
+/// Returns the UDP port of the STUN and TURN server.
+///
+/// The default value is 3478.
+
+quint16 QXmppServerTurn::port() const
+{
+    return d->port;
+}
+
+/// Sets the UDP port of the STUN and TURN server.
+///
+/// \param port
+
+void QXmppServerTurn::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+/// Returns the number of seconds for which the issued credentials are
+/// valid.
+///
+/// The default value is 86400 (one day).
+
+int QXmppServerTurn::credentialLifetime() const
+{
+    return d->credentialLifetime;
+}
+
+/// Sets the number of seconds for which the issued credentials are valid.
+///
+/// Allocations can not be refreshed once their credentials expire, so the
+/// lifetime should exceed the duration of the longest calls.
+///
+/// \param secs
+
+void QXmppServerTurn::setCredentialLifetime(int secs)
+{
+    d->credentialLifetime = qMax(1, secs);
+}
+
+/// Returns the TURN server run by the extension.
+
+QXmppTurnServer *QXmppServerTurn::turnServer() const
+{
+    return d->turnServer;
+}
+
+/// \cond
+QStringList QXmppServerTurn::discoveryFeatures() const
+{
+    return QStringList() << ns_extdisco;
+}
+
+bool QXmppServerTurn::handleStanza(const QDomElement &element)
+{
+    const QString domain = server()->domain();
+    const QDomElement query = element.firstChildElement();
+    if (element.attribute("to") != domain ||
+        element.attribute("type") != QLatin1String("get") ||
+        query.namespaceURI() != ns_extdisco ||
+        (query.tagName() != QLatin1String("services") && query.tagName() != QLatin1String("credentials")))
+        return false;
+
+    const QString from = element.attribute("from");
+    QXmppIq response(QXmppIq::Result);
+    response.setId(element.attribute("id"));
+    response.setFrom(domain);
+    response.setTo(from);
+
+    // only serve local users
+    if (QXmppUtils::jidToDomain(from) != domain) {
+        response.setType(QXmppIq::Error);
+        response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::Forbidden));
+        server()->sendPacket(response);
+        return true;
+    }
+
+    // a credentials request names the service in a child element
+    QString type = query.attribute("type");
+    if (query.tagName() == QLatin1String("credentials"))
+        type = query.firstChildElement("service").attribute("type");
+
+    QXmppElement services;
+    services.setTagName(query.tagName());
+    services.setAttribute("xmlns", ns_extdisco);
+    if (type.isEmpty() || type == QLatin1String("stun"))
+        services.appendChild(d->service("stun"));
+    if (type.isEmpty() || type == QLatin1String("turn")) {
+        const QDateTime expiry = QDateTime::currentDateTime().toUTC().addSecs(d->credentialLifetime);
+        const QString username = QString("%1:%2").arg(
+            QString::number(expiry.toTime_t()), QXmppUtils::jidToBareJid(from));
+
+        QXmppElement turn = d->service("turn");
+        turn.setAttribute("expires", QXmppUtils::datetimeToString(expiry));
+        turn.setAttribute("password", QXmppTurnServer::generatePassword(d->turnServer->sharedSecret(), username));
+        turn.setAttribute("restricted", "1");
+        turn.setAttribute("username", username);
+        services.appendChild(turn);
+        updateCounter("turn.credentials");
+    }
+    response.setExtensions(QXmppElementList() << services);
+    server()->sendPacket(response);
+    return true;
+}
+
+QList<QXmppServerExtension::StanzaFilter> QXmppServerTurn::stanzaFilters() const
+{
+    return QList<StanzaFilter>()
+        << StanzaFilter("iq", ns_extdisco, "services")
+        << StanzaFilter("iq", ns_extdisco, "credentials");
+}
+
+bool QXmppServerTurn::start()
+{
+    if (d->host.isEmpty())
+        d->host = server()->domain();
+
+    // passwords issued before a restart are no longer valid
+    d->turnServer->setRealm(server()->domain());
+    d->turnServer->setSharedSecret(QXmppUtils::generateRandomBytes(32));
+    if (d->turnServer->relayAddress().isNull()) {
+        const QHostAddress address(d->host);
+        if (address.protocol() == QAbstractSocket::IPv4Protocol)
+            d->turnServer->setRelayAddress(address);
+    }
+    return d->turnServer->listen(QHostAddress::Any, d->port);
+}
+
+void QXmppServerTurn::stop()
+{
+    d->turnServer->close();
+}
+/// \endcond
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPSERVERTURN_H
+#define QXMPPSERVERTURN_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerTurnPrivate;
+class QXmppTurnServer;
+
+/// \brief The QXmppServerTurn class is a server extension which runs a
+/// STUN and TURN server, and issues time-limited credentials for it as
+/// defined by XEP-0215: External Service Discovery.
+///
+/// Local users request the services with an IQ addressed to the server's
+/// domain. The TURN service is returned with a user name and password
+/// which are valid for credentialLifetime() seconds. The secret from which
+/// the passwords are derived is generated each time the extension starts.
+///
+/// The TURN server itself can be configured through turnServer(), for
+/// instance to set its relay address or to limit the bandwidth of each
+/// allocation.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerTurn : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "turn")
+    Q_PROPERTY(QString host READ host WRITE setHost)
+    Q_PROPERTY(quint16 port READ port WRITE setPort)
+    Q_PROPERTY(int credentialLifetime READ credentialLifetime WRITE setCredentialLifetime)
+
+public:
+    QXmppServerTurn();
+    ~QXmppServerTurn();
+
+    QString host() const;
+    void setHost(const QString &host);
+
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    int credentialLifetime() const;
+    void setCredentialLifetime(int secs);
+
+    QXmppTurnServer *turnServer() const;
+
+    /// \cond
+    QStringList discoveryFeatures() const;
+    bool handleStanza(const QDomElement &stanza);
+    QList<StanzaFilter> stanzaFilters() const;
+
+    bool start();
+    void stop();
+    /// \endcond
+
+private:
+    QXmppServerTurnPrivate * const d;
+};
+
+#endif
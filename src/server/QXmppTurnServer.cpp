@@ -0,0 +1,752 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QUdpSocket>
+#include <QtEndian>
+
+#include "QXmppStun.h"
+#include "QXmppStun_p.h"
+#include "QXmppTurnServer.h"
+#include "QXmppTurnServer_p.h"
+#include "QXmppUtils.h"
+
+// STUN attributes which QXmppStunMessage does not report
+static const quint16 integrityAttribute = 0x0008;
+static const quint16 lifetimeAttribute = 0x000d;
+
+// lifetimes from RFC 5766, in seconds
+static const quint32 defaultLifetime = 600;
+static const quint32 maximumLifetime = 3600;
+static const quint32 permissionLifetime = 300;
+static const quint32 channelLifetime = 600;
+
+// interval at which expired allocations, permissions and channels
+// are removed (5 seconds)
+static const int expireInterval = 5000;
+
+// the UDP transport protocol number, for REQUESTED-TRANSPORT
+static const quint8 udpTransport = 17;
+
+// Returns true if the STUN message in \a buffer, which was successfully
+// decoded, has an attribute of the given \a type.
+
+static bool hasAttribute(const QByteArray &buffer, quint16 type)
+{
+    const uchar *data = reinterpret_cast<const uchar*>(buffer.constData());
+    int pos = 20;
+    while (pos + 4 <= buffer.size()) {
+        if (qFromBigEndian<quint16>(data + pos) == type)
+            return true;
+        const quint16 length = qFromBigEndian<quint16>(data + pos + 2);
+        pos += 4 + 4 * ((length + 3) / 4);
+    }
+    return false;
+}
+
+class QXmppTurnServerPrivate
+{
+public:
+    typedef QXmppTurnServerAllocation::Address Address;
+
+    QXmppTurnServerPrivate(QXmppTurnServer *qq);
+    bool authenticate(const QXmppStunMessage &request, const QByteArray &buffer, const Address &client, QXmppTurnServerAllocation *allocation, QByteArray *key);
+    QString password(const QString &username) const;
+    void relayToClient(QXmppTurnServerAllocation *allocation, const QByteArray &datagram, const QHostAddress &host, quint16 port);
+    void relayToPeer(QXmppTurnServerAllocation *allocation, const char *data, qint64 size, const Address &peer, qint64 now);
+    void removeAllocation(QXmppTurnServerAllocation *allocation);
+    void sendError(const QXmppStunMessage &request, int code, const QString &phrase, const Address &client, const QByteArray &key = QByteArray());
+    void sendStun(const QXmppStunMessage &message, const Address &client, const QByteArray &key = QByteArray());
+
+    QString realm;
+    QByteArray secret;
+    QByteArray nonce;
+    QHostAddress relayAddress;
+    QHostAddress listenRelayAddress;
+    qint64 maximumAllocationBandwidth;
+
+    QElapsedTimer clock;
+    QTimer *expireTimer;
+    QUdpSocket *socket;
+    QXmppUdpTransport *transport;
+    QHash<Address, QXmppTurnServerAllocation*> allocations;
+
+    // the ChannelData messages sent to clients, framed in a reused buffer
+    QByteArray frame;
+
+private:
+    QXmppTurnServer *q;
+};
+
+QXmppTurnServerPrivate::QXmppTurnServerPrivate(QXmppTurnServer *qq)
+    : realm("qxmpp")
+    , maximumAllocationBandwidth(0)
+    , expireTimer(0)
+    , socket(0)
+    , transport(0)
+    , q(qq)
+{
+    clock.start();
+}
+
+/// Checks the long-term credentials of a request, and sends the error
+/// response if they are missing or invalid.
+
+bool QXmppTurnServerPrivate::authenticate(const QXmppStunMessage &request, const QByteArray &buffer, const Address &client, QXmppTurnServerAllocation *allocation, QByteArray *key)
+{
+    if (request.username().isEmpty() || !hasAttribute(buffer, integrityAttribute)) {
+        sendError(request, 401, "Unauthorized", client);
+        return false;
+    }
+    if (request.nonce() != nonce) {
+        sendError(request, 438, "Stale Nonce", client);
+        return false;
+    }
+
+    const QString pass = password(request.username());
+    if (pass.isEmpty()) {
+        sendError(request, 401, "Unauthorized", client);
+        return false;
+    }
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData((request.username() + ":" + realm + ":" + pass).toUtf8());
+    *key = hash.result();
+
+    QXmppStunMessage verified;
+    if (!verified.decode(buffer, *key)) {
+        key->clear();
+        sendError(request, 401, "Unauthorized", client);
+        return false;
+    }
+    if (allocation && allocation->username != request.username()) {
+        sendError(request, 441, "Wrong Credentials", client, *key);
+        return false;
+    }
+    return true;
+}
+
+/// Returns the password for the given user name, or an empty string if the
+/// credentials have expired.
+
+QString QXmppTurnServerPrivate::password(const QString &username) const
+{
+    if (secret.isEmpty())
+        return QString();
+
+    bool ok = false;
+    const uint expiry = username.section(QLatin1Char(':'), 0, 0).toUInt(&ok);
+    if (!ok || expiry <= QDateTime::currentDateTime().toTime_t())
+        return QString();
+
+    return QXmppTurnServer::generatePassword(secret, username);
+}
+
+/// Relays a datagram received from a peer on the allocation's relayed
+/// address to the client, in a ChannelData message if a channel is bound
+/// to the peer and in a Data indication otherwise.
+
+void QXmppTurnServerPrivate::relayToClient(QXmppTurnServerAllocation *allocation, const QByteArray &datagram, const QHostAddress &host, quint16 port)
+{
+    const qint64 now = clock.elapsed();
+    if (!allocation->hasPermission(host, now))
+        return;
+    if (!allocation->takeCredit(datagram.size(), maximumAllocationBandwidth, now)) {
+        q->updateCounter("turn.dropped");
+        return;
+    }
+
+    const Address client = allocation->client();
+    const quint16 channel = allocation->channel(qMakePair(host, port), now);
+    if (channel) {
+        frame.resize(4 + datagram.size());
+        uchar *data = reinterpret_cast<uchar*>(frame.data());
+        qToBigEndian(channel, data);
+        qToBigEndian(quint16(datagram.size()), data + 2);
+        memcpy(data + 4, datagram.constData(), datagram.size());
+        socket->writeDatagram(frame, client.first, client.second);
+    } else {
+        QXmppStunMessage indication;
+        indication.setType(QXmppStunMessage::Data | QXmppStunMessage::Indication);
+        indication.setId(QXmppUtils::generateRandomBytes(12));
+        indication.setData(datagram);
+        indication.xorPeerHost = host;
+        indication.xorPeerPort = port;
+        socket->writeDatagram(indication.encode(QByteArray(), false), client.first, client.second);
+    }
+    q->updateCounter("turn.bytes", datagram.size());
+}
+
+/// Relays data received from the client to a peer, from the allocation's
+/// relayed address.
+
+void QXmppTurnServerPrivate::relayToPeer(QXmppTurnServerAllocation *allocation, const char *data, qint64 size, const Address &peer, qint64 now)
+{
+    if (!allocation->takeCredit(size, maximumAllocationBandwidth, now)) {
+        q->updateCounter("turn.dropped");
+        return;
+    }
+    allocation->writeDatagram(data, size, peer);
+    q->updateCounter("turn.bytes", size);
+}
+
+void QXmppTurnServerPrivate::removeAllocation(QXmppTurnServerAllocation *allocation)
+{
+    allocations.remove(allocation->client());
+    delete allocation;
+    q->setGauge("turn.allocations", allocations.size());
+}
+
+void QXmppTurnServerPrivate::sendError(const QXmppStunMessage &request, int code, const QString &phrase, const Address &client, const QByteArray &key)
+{
+    QXmppStunMessage response;
+    response.setType(request.messageMethod() | QXmppStunMessage::Error);
+    response.setId(request.id());
+    response.errorCode = code;
+    response.errorPhrase = phrase;
+    if (code == 401 || code == 438) {
+        response.setNonce(nonce);
+        response.setRealm(realm);
+    }
+    sendStun(response, client, key);
+}
+
+void QXmppTurnServerPrivate::sendStun(const QXmppStunMessage &message, const Address &client, const QByteArray &key)
+{
+    socket->writeDatagram(message.encode(key), client.first, client.second);
+}
+
+/// \cond
+QXmppTurnServerAllocation::QXmppTurnServerAllocation(const Address &client, QXmppTurnServerPrivate *server, QObject *parent)
+    : QObject(parent)
+    , deadline(0)
+    , m_client(client)
+    , m_server(server)
+    , m_credit(0)
+    , m_creditTime(-1)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_socket = new QUdpSocket(this);
+    m_transport = new QXmppUdpTransport(m_socket, this);
+    check = connect(m_transport, SIGNAL(datagramReceived(QByteArray,QHostAddress,quint16)),
+                    this, SLOT(_q_datagramReceived(QByteArray,QHostAddress,quint16)));
+    Q_ASSERT(check);
+}
+
+/// Binds the relayed socket to an ephemeral port of the given \a address.
+
+bool QXmppTurnServerAllocation::bind(const QHostAddress &address)
+{
+    return m_socket->bind(address, 0);
+}
+
+QXmppTurnServerAllocation::Address QXmppTurnServerAllocation::client() const
+{
+    return m_client;
+}
+
+QXmppTurnServerAllocation::Address QXmppTurnServerAllocation::relayed() const
+{
+    return qMakePair(m_socket->localAddress(), m_socket->localPort());
+}
+
+void QXmppTurnServerAllocation::addPermission(const QHostAddress &host, qint64 deadline)
+{
+    m_permissions.insert(host, deadline);
+}
+
+bool QXmppTurnServerAllocation::hasPermission(const QHostAddress &host, qint64 now) const
+{
+    QHash<QHostAddress, qint64>::const_iterator it = m_permissions.constFind(host);
+    return it != m_permissions.constEnd() && it.value() > now;
+}
+
+/// Binds \a channel to \a peer, or refreshes the binding. A channel can
+/// not be rebound to another peer, nor a peer to another channel.
+
+bool QXmppTurnServerAllocation::bindChannel(quint16 channel, const Address &peer, qint64 deadline)
+{
+    QHash<quint16, Channel>::iterator it = m_channels.find(channel);
+    if (it != m_channels.end()) {
+        if (it.value().peer != peer)
+            return false;
+        it.value().deadline = deadline;
+        return true;
+    }
+    if (m_peerChannels.contains(peer))
+        return false;
+
+    Channel binding;
+    binding.peer = peer;
+    binding.deadline = deadline;
+    m_channels.insert(channel, binding);
+    m_peerChannels.insert(peer, channel);
+    return true;
+}
+
+/// Returns the channel bound to \a peer, or 0 if there is none.
+
+quint16 QXmppTurnServerAllocation::channel(const Address &peer, qint64 now) const
+{
+    const quint16 channel = m_peerChannels.value(peer);
+    if (channel && m_channels.value(channel).deadline > now)
+        return channel;
+    return 0;
+}
+
+/// Looks up the peer bound to \a channel.
+
+bool QXmppTurnServerAllocation::peer(quint16 channel, qint64 now, Address *peer) const
+{
+    QHash<quint16, Channel>::const_iterator it = m_channels.constFind(channel);
+    if (it == m_channels.constEnd() || it.value().deadline <= now)
+        return false;
+    *peer = it.value().peer;
+    return true;
+}
+
+/// Removes the expired permissions and channel bindings.
+
+void QXmppTurnServerAllocation::expire(qint64 now)
+{
+    QHash<QHostAddress, qint64>::iterator pit = m_permissions.begin();
+    while (pit != m_permissions.end()) {
+        if (pit.value() <= now)
+            pit = m_permissions.erase(pit);
+        else
+            ++pit;
+    }
+
+    QHash<quint16, Channel>::iterator cit = m_channels.begin();
+    while (cit != m_channels.end()) {
+        if (cit.value().deadline <= now) {
+            m_peerChannels.remove(cit.value().peer);
+            cit = m_channels.erase(cit);
+        } else {
+            ++cit;
+        }
+    }
+}
+
+/// Deducts \a bytes from the allocation's bandwidth, which accumulates up
+/// to one second of traffic. Returns false if the datagram must be dropped.
+
+bool QXmppTurnServerAllocation::takeCredit(qint64 bytes, qint64 bytesPerSecond, qint64 now)
+{
+    if (bytesPerSecond <= 0)
+        return true;
+
+    if (m_creditTime < 0)
+        m_credit = bytesPerSecond;
+    else
+        m_credit = qMin(bytesPerSecond, m_credit + (now - m_creditTime) * bytesPerSecond / 1000);
+    m_creditTime = now;
+
+    if (bytes > m_credit)
+        return false;
+    m_credit -= bytes;
+    return true;
+}
+
+qint64 QXmppTurnServerAllocation::writeDatagram(const char *data, qint64 size, const Address &peer)
+{
+    return m_socket->writeDatagram(data, size, peer.first, peer.second);
+}
+
+void QXmppTurnServerAllocation::_q_datagramReceived(const QByteArray &datagram, const QHostAddress &host, quint16 port)
+{
+    m_server->relayToClient(this, datagram, host, port);
+}
+/// \endcond
+
+/// Constructs a new TURN server.
+///
+/// \param parent
+
+QXmppTurnServer::QXmppTurnServer(QObject *parent)
+    : QXmppLoggable(parent)
+    , d(new QXmppTurnServerPrivate(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->expireTimer = new QTimer(this);
+    d->expireTimer->setInterval(expireInterval);
+    check = connect(d->expireTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_expire()));
+    Q_ASSERT(check);
+}
+
+/// Destroys the TURN server.
+
+QXmppTurnServer::~QXmppTurnServer()
+{
+    close();
+    delete d;
+}
+
+/// Returns the realm of the server's long-term credentials.
+///
+/// The default value is "qxmpp".
+
+QString QXmppTurnServer::realm() const
+{
+    return d->realm;
+}
+
+/// Sets the realm of the server's long-term credentials.
+///
+/// \param realm
+
+void QXmppTurnServer::setRealm(const QString &realm)
+{
+    d->realm = realm;
+}
+
+/// Returns the secret from which the passwords are derived.
+
+QByteArray QXmppTurnServer::sharedSecret() const
+{
+    return d->secret;
+}
+
+/// Sets the secret from which the passwords are derived, see
+/// generatePassword(). Allocations are refused if no secret is set.
+///
+/// \param secret
+
+void QXmppTurnServer::setSharedSecret(const QByteArray &secret)
+{
+    d->secret = secret;
+}
+
+/// Returns the address on which relayed ports are allocated.
+
+QHostAddress QXmppTurnServer::relayAddress() const
+{
+    return d->relayAddress;
+}
+
+/// Sets the address on which relayed ports are allocated. It must be an
+/// IPv4 address which peers can reach.
+///
+/// If no address is set, the address the server listens on is used, or
+/// the first IPv4 address of the host if it listens on all addresses.
+///
+/// \param address
+
+void QXmppTurnServer::setRelayAddress(const QHostAddress &address)
+{
+    d->relayAddress = address;
+}
+
+/// Returns the maximum bandwidth of each allocation in bytes per second,
+/// or 0 if it is not limited.
+///
+/// The default value is 0.
+
+qint64 QXmppTurnServer::maximumAllocationBandwidth() const
+{
+    return d->maximumAllocationBandwidth;
+}
+
+/// Sets the maximum bandwidth of each allocation in bytes per second, or 0
+/// if it should not be limited.
+///
+/// The limit applies to the data relayed in both directions. An allocation
+/// may exceed it by up to one second of traffic after being idle, beyond
+/// which datagrams are dropped.
+///
+/// \param bytesPerSecond
+
+void QXmppTurnServer::setMaximumAllocationBandwidth(qint64 bytesPerSecond)
+{
+    d->maximumAllocationBandwidth = qMax(qint64(0), bytesPerSecond);
+}
+
+/// Returns the number of active allocations.
+
+int QXmppTurnServer::allocationCount() const
+{
+    return d->allocations.size();
+}
+
+/// Returns true if the server is listening for requests.
+
+bool QXmppTurnServer::isListening() const
+{
+    return d->socket != 0;
+}
+
+/// Listens for STUN and TURN requests on the given \a address and \a port.
+///
+/// Returns true on success.
+
+bool QXmppTurnServer::listen(const QHostAddress &address, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    close();
+
+    QUdpSocket *socket = new QUdpSocket(this);
+    if (!socket->bind(address, port)) {
+        warning(QString("Could not start TURN server on port %1: %2").arg(
+            QString::number(port), socket->errorString()));
+        delete socket;
+        return false;
+    }
+
+    // pick the relay address
+    d->listenRelayAddress = d->relayAddress;
+    if (d->listenRelayAddress.isNull()) {
+        if (address != QHostAddress::Any && address != QHostAddress::AnyIPv6) {
+            d->listenRelayAddress = address;
+        } else {
+            foreach (const QHostAddress &candidate, QXmppIceComponent::discoverAddresses()) {
+                if (candidate.protocol() == QAbstractSocket::IPv4Protocol) {
+                    d->listenRelayAddress = candidate;
+                    break;
+                }
+            }
+            if (d->listenRelayAddress.isNull())
+                d->listenRelayAddress = QHostAddress::LocalHost;
+        }
+    }
+
+    d->socket = socket;
+    d->transport = new QXmppUdpTransport(socket, this);
+    check = connect(d->transport, SIGNAL(datagramReceived(QByteArray,QHostAddress,quint16)),
+                    this, SLOT(_q_datagramReceived(QByteArray,QHostAddress,quint16)));
+    Q_ASSERT(check);
+
+    d->nonce = QXmppUtils::generateStanzaHash(16).toLatin1();
+    d->expireTimer->start();
+    info(QString("TURN server listening on port %1, relaying on %2").arg(
+        QString::number(socket->localPort()), d->listenRelayAddress.toString()));
+    return true;
+}
+
+/// Stops listening and releases all the allocations.
+
+void QXmppTurnServer::close()
+{
+    foreach (QXmppTurnServerAllocation *allocation, d->allocations)
+        delete allocation;
+    d->allocations.clear();
+    d->expireTimer->stop();
+
+    if (d->socket) {
+        delete d->transport;
+        d->transport = 0;
+        d->socket->close();
+        delete d->socket;
+        d->socket = 0;
+    }
+}
+
+/// Returns the address the server is listening on.
+
+QHostAddress QXmppTurnServer::serverAddress() const
+{
+    return d->socket ? d->socket->localAddress() : QHostAddress();
+}
+
+/// Returns the port the server is listening on.
+
+quint16 QXmppTurnServer::serverPort() const
+{
+    return d->socket ? d->socket->localPort() : 0;
+}
+
+/// Returns the password for the given \a username, which is the base64
+/// encoded HMAC-SHA1 of the user name keyed with the shared \a secret.
+///
+/// \param secret
+/// \param username
+
+QString QXmppTurnServer::generatePassword(const QByteArray &secret, const QString &username)
+{
+    return QString::fromLatin1(QXmppUtils::generateHmacSha1(secret, username.toUtf8()).toBase64());
+}
+
+void QXmppTurnServer::_q_datagramReceived(const QByteArray &datagram, const QHostAddress &host, quint16 port)
+{
+    typedef QXmppTurnServerAllocation::Address Address;
+    const Address client = qMakePair(host, port);
+
+    // relay ChannelData messages without decoding them
+    if (datagram.size() >= 4 && (datagram[0] & 0xc0) == 0x40) {
+        QXmppTurnServerAllocation *allocation = d->allocations.value(client);
+        if (!allocation)
+            return;
+
+        const uchar *data = reinterpret_cast<const uchar*>(datagram.constData());
+        const quint16 channel = qFromBigEndian<quint16>(data);
+        const quint16 length = qFromBigEndian<quint16>(data + 2);
+        const qint64 now = d->clock.elapsed();
+        Address peer;
+        if (length <= datagram.size() - 4 && allocation->peer(channel, now, &peer))
+            d->relayToPeer(allocation, datagram.constData() + 4, length, peer, now);
+        return;
+    }
+
+    QXmppStunMessage request;
+    if (!request.decode(datagram))
+        return;
+
+    const quint16 method = request.messageMethod();
+    QXmppTurnServerAllocation *allocation = d->allocations.value(client);
+    const qint64 now = d->clock.elapsed();
+
+    // Send indications are not authenticated
+    if (request.messageClass() == QXmppStunMessage::Indication) {
+        if (method == QXmppStunMessage::Send && allocation &&
+            allocation->hasPermission(request.xorPeerHost, now)) {
+            const QByteArray data = request.data();
+            d->relayToPeer(allocation, data.constData(), data.size(),
+                           qMakePair(request.xorPeerHost, request.xorPeerPort), now);
+        }
+        return;
+    } else if (request.messageClass() != QXmppStunMessage::Request) {
+        return;
+    }
+
+    QXmppStunMessage response;
+    response.setType(method | QXmppStunMessage::Response);
+    response.setId(request.id());
+
+    // Binding requests are not authenticated
+    if (method == QXmppStunMessage::Binding) {
+        response.xorMappedHost = host;
+        response.xorMappedPort = port;
+        d->sendStun(response, client);
+        return;
+    }
+
+    QByteArray key;
+    if (!d->authenticate(request, datagram, client, allocation, &key))
+        return;
+
+    if (method == QXmppStunMessage::Allocate) {
+
+        // answer retransmissions of the request which created the allocation
+        if (allocation && allocation->transactionId != request.id()) {
+            d->sendError(request, 437, "Allocation Mismatch", client, key);
+            return;
+        } else if (!allocation) {
+            if (request.requestedTransport() != udpTransport) {
+                d->sendError(request, 442, "Unsupported Transport Protocol", client, key);
+                return;
+            }
+
+            allocation = new QXmppTurnServerAllocation(client, d, this);
+            if (!allocation->bind(d->listenRelayAddress)) {
+                warning(QString("Could not allocate a relayed port on %1").arg(d->listenRelayAddress.toString()));
+                delete allocation;
+                d->sendError(request, 508, "Insufficient Capacity", client, key);
+                return;
+            }
+
+            quint32 lifetime = defaultLifetime;
+            if (hasAttribute(datagram, lifetimeAttribute))
+                lifetime = qBound(defaultLifetime, request.lifetime(), maximumLifetime);
+            allocation->username = request.username();
+            allocation->key = key;
+            allocation->transactionId = request.id();
+            allocation->deadline = now + lifetime * 1000;
+            d->allocations.insert(client, allocation);
+            setGauge("turn.allocations", d->allocations.size());
+            updateCounter("turn.allocated");
+        }
+
+        const Address relayed = allocation->relayed();
+        response.xorRelayedHost = relayed.first;
+        response.xorRelayedPort = relayed.second;
+        response.xorMappedHost = host;
+        response.xorMappedPort = port;
+        response.setLifetime((allocation->deadline - now + 999) / 1000);
+        d->sendStun(response, client, key);
+        return;
+    }
+
+    if (!allocation) {
+        d->sendError(request, 437, "Allocation Mismatch", client, key);
+        return;
+    }
+
+    if (method == QXmppStunMessage::Refresh) {
+
+        quint32 lifetime = defaultLifetime;
+        if (hasAttribute(datagram, lifetimeAttribute))
+            lifetime = request.lifetime() ? qBound(defaultLifetime, request.lifetime(), maximumLifetime) : 0;
+        response.setLifetime(lifetime);
+        d->sendStun(response, client, key);
+
+        if (lifetime)
+            allocation->deadline = now + lifetime * 1000;
+        else
+            d->removeAllocation(allocation);
+
+    } else if (method == QXmppStunMessage::CreatePermission) {
+
+        if (request.xorPeerHost.isNull()) {
+            d->sendError(request, 400, "Bad Request", client, key);
+            return;
+        }
+        allocation->addPermission(request.xorPeerHost, now + permissionLifetime * 1000);
+        d->sendStun(response, client, key);
+
+    } else if (method == QXmppStunMessage::ChannelBind) {
+
+        const quint16 channel = request.channelNumber();
+        const Address peer = qMakePair(request.xorPeerHost, request.xorPeerPort);
+        if (channel < 0x4000 || channel > 0x7ffe || peer.first.isNull() ||
+            !allocation->bindChannel(channel, peer, now + channelLifetime * 1000)) {
+            d->sendError(request, 400, "Bad Request", client, key);
+            return;
+        }
+        allocation->addPermission(peer.first, now + permissionLifetime * 1000);
+        d->sendStun(response, client, key);
+
+    } else {
+        d->sendError(request, 400, "Bad Request", client, key);
+    }
+}
+
+void QXmppTurnServer::_q_expire()
+{
+    const qint64 now = d->clock.elapsed();
+    foreach (QXmppTurnServerAllocation *allocation, d->allocations) {
+        if (allocation->deadline <= now)
+            d->removeAllocation(allocation);
+        else
+            allocation->expire(now);
+    }
+}
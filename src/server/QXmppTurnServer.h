@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPTURNSERVER_H
+#define QXMPPTURNSERVER_H
+
+#include <QHostAddress>
+
+#include "QXmppLogger.h"
+
+class QXmppTurnServerAllocation;
+class QXmppTurnServerPrivate;
+
+/// \brief The QXmppTurnServer class is a STUN and TURN server, as defined
+/// by RFC 5389 Session Traversal Utilities for NAT and RFC 5766 Traversal
+/// Using Relays around NAT, for UDP transport.
+///
+/// Binding requests are answered without authentication. Allocations
+/// require time-limited credentials derived from the secret given to
+/// setSharedSecret(): the user name is the UNIX time at which the
+/// credentials expire followed by a colon and an identifier of the user,
+/// and the password is computed by generatePassword(). Requests made with
+/// expired credentials are refused, including refreshes of existing
+/// allocations.
+///
+/// Allocations are indexed by the client's address and port, and channels
+/// by their number, so that ChannelData messages are relayed with two hash
+/// lookups and without being decoded as STUN messages. On Linux, datagrams
+/// are received in batches. The bandwidth relayed by each allocation can
+/// be limited with setMaximumAllocationBandwidth().
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppTurnServer : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppTurnServer(QObject *parent = 0);
+    ~QXmppTurnServer();
+
+    QString realm() const;
+    void setRealm(const QString &realm);
+
+    QByteArray sharedSecret() const;
+    void setSharedSecret(const QByteArray &secret);
+
+    QHostAddress relayAddress() const;
+    void setRelayAddress(const QHostAddress &address);
+
+    qint64 maximumAllocationBandwidth() const;
+    void setMaximumAllocationBandwidth(qint64 bytesPerSecond);
+
+    int allocationCount() const;
+
+    bool isListening() const;
+    bool listen(const QHostAddress &address = QHostAddress::Any, quint16 port = 3478);
+    void close();
+
+    QHostAddress serverAddress() const;
+    quint16 serverPort() const;
+
+    static QString generatePassword(const QByteArray &secret, const QString &username);
+
+private slots:
+    void _q_datagramReceived(const QByteArray &datagram, const QHostAddress &host, quint16 port);
+    void _q_expire();
+
+private:
+    QXmppTurnServerPrivate * const d;
+};
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPTURNSERVER_P_H
+#define QXMPPTURNSERVER_P_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QObject>
+#include <QPair>
+
+class QUdpSocket;
+class QXmppTurnServerPrivate;
+class QXmppUdpTransport;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppTurnServer class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppTurnServerAllocation class holds the relayed socket of a TURN
+/// allocation, along with its permissions and channel bindings.
+///
+/// Deadlines are given in milliseconds of the server's clock.
+
+class QXmppTurnServerAllocation : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef QPair<QHostAddress, quint16> Address;
+
+    QXmppTurnServerAllocation(const Address &client, QXmppTurnServerPrivate *server, QObject *parent);
+
+    bool bind(const QHostAddress &address);
+    Address client() const;
+    Address relayed() const;
+
+    void addPermission(const QHostAddress &host, qint64 deadline);
+    bool hasPermission(const QHostAddress &host, qint64 now) const;
+
+    bool bindChannel(quint16 channel, const Address &peer, qint64 deadline);
+    quint16 channel(const Address &peer, qint64 now) const;
+    bool peer(quint16 channel, qint64 now, Address *peer) const;
+
+    void expire(qint64 now);
+    bool takeCredit(qint64 bytes, qint64 bytesPerSecond, qint64 now);
+    qint64 writeDatagram(const char *data, qint64 size, const Address &peer);
+
+    // the credentials and transaction which created the allocation
+    QString username;
+    QByteArray key;
+    QByteArray transactionId;
+    qint64 deadline;
+
+private slots:
+    void _q_datagramReceived(const QByteArray &datagram, const QHostAddress &host, quint16 port);
+
+private:
+    struct Channel
+    {
+        Address peer;
+        qint64 deadline;
+    };
+
+    Address m_client;
+    QXmppTurnServerPrivate *m_server;
+    QUdpSocket *m_socket;
+    QXmppUdpTransport *m_transport;
+    QHash<QHostAddress, qint64> m_permissions;
+    QHash<quint16, Channel> m_channels;
+    QHash<Address, quint16> m_peerChannels;
+    qint64 m_credit;
+    qint64 m_creditTime;
+};
+
+#endif
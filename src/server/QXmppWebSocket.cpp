@@ -0,0 +1,583 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <string.h>
+
+#include <QCryptographicHash>
+#include <QList>
+#include <QMap>
+#include <QTcpSocket>
+#include <QtEndian>
+
+#include "QXmppConstants.h"
+#include "QXmppStreamCompressor_p.h"
+#include "QXmppStreamSplitter_p.h"
+#include "QXmppWebSocket_p.h"
+
+// the GUID which is appended to the client's key, see RFC 6455
+static const char webSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// the trailer which permessage-deflate strips from each message
+static const char deflateTrailer[] = "\x00\x00\xff\xff";
+
+// the largest upgrade request which is accepted
+static const int maximumRequestSize = 8192;
+
+// the largest message which is accepted, once decompressed
+static const int maximumMessageSize = 1048576;
+
+enum Opcode
+{
+    ContinuationFrame = 0x0,
+    TextFrame = 0x1,
+    BinaryFrame = 0x2,
+    CloseFrame = 0x8,
+    PingFrame = 0x9,
+    PongFrame = 0xa
+};
+
+enum CloseCode
+{
+    NormalClosure = 1000,
+    ProtocolError = 1002,
+    UnsupportedData = 1003,
+    MessageTooBig = 1009
+};
+
+// Appends an unmasked frame to the output, as sent by a server.
+
+static void appendFrame(QByteArray &output, int opcode, const QByteArray &payload, bool compressed = false)
+{
+    uchar header[10];
+    int headerSize = 2;
+    header[0] = 0x80 | (compressed ? 0x40 : 0) | opcode;
+    if (payload.size() < 126) {
+        header[1] = payload.size();
+    } else if (payload.size() < 65536) {
+        header[1] = 126;
+        qToBigEndian<quint16>(payload.size(), header + 2);
+        headerSize = 4;
+    } else {
+        header[1] = 127;
+        qToBigEndian<quint64>(payload.size(), header + 2);
+        headerSize = 10;
+    }
+    output.append(reinterpret_cast<const char*>(header), headerSize);
+    output.append(payload);
+}
+
+// Returns true if the message is an element with the given tag name.
+
+static bool isElement(const QByteArray &data, const char *name)
+{
+    return data.startsWith('<') && QXmppStreamSplitter::tagName(data) == name;
+}
+
+static bool isNamespaceDeclaration(const QByteArray &name)
+{
+    return name == "xmlns" || name.startsWith("xmlns:");
+}
+
+// Returns true if a permessage-deflate offer can be accepted without
+// parameters, that is if it lets the server keep its compression context
+// with the default window size.
+
+static bool isAcceptableDeflateOffer(const QByteArray &offer)
+{
+    const QList<QByteArray> params = offer.split(';');
+    if (params.first().trimmed() != "permessage-deflate")
+        return false;
+
+    for (int i = 1; i < params.size(); ++i) {
+        const QByteArray param = params[i].trimmed();
+        const int equals = param.indexOf('=');
+        const QByteArray name = (equals < 0 ? param : param.left(equals)).trimmed();
+        QByteArray value = equals < 0 ? QByteArray() : param.mid(equals + 1).trimmed();
+        if (value.startsWith('"') && value.endsWith('"'))
+            value = value.mid(1, value.size() - 2);
+
+        // the client's own context is its business
+        if (name == "client_no_context_takeover" || name == "client_max_window_bits")
+            continue;
+        if (name == "server_max_window_bits" && value == "15")
+            continue;
+        return false;
+    }
+    return true;
+}
+
+class QXmppWebSocketPrivate
+{
+public:
+    enum State
+    {
+        HandshakeState = 0,
+        OpenState,
+        ClosingState,
+        ClosedState
+    };
+
+    QXmppWebSocketPrivate(QXmppWebSocket *qq);
+
+    bool handshake();
+    void reject(const QByteArray &status, const QByteArray &headers = QByteArray());
+    void readFrames();
+    void readMessage();
+    void sendClose(const QByteArray &payload);
+    void fail(quint16 code);
+
+    void writeMessage(QByteArray &output, const QByteArray &message);
+
+    QTcpSocket *socket;
+    QXmppStreamCompressor *compressor;
+    State state;
+
+    // incoming data which was not parsed yet
+    QByteArray inputBuffer;
+    // the frames of the incoming message
+    QByteArray message;
+    bool messageStarted;
+    bool messageCompressed;
+    // the incoming stream, ready to be read
+    QByteArray readBuffer;
+
+    // the outgoing stream
+    QXmppStreamSplitter splitter;
+
+private:
+    QXmppWebSocket *q;
+};
+
+QXmppWebSocketPrivate::QXmppWebSocketPrivate(QXmppWebSocket *qq)
+    : socket(0)
+    , compressor(0)
+    , state(HandshakeState)
+    , messageStarted(false)
+    , messageCompressed(false)
+    , q(qq)
+{
+}
+
+// Answers the client's upgrade request, returns true once it succeeded.
+
+bool QXmppWebSocketPrivate::handshake()
+{
+    inputBuffer += socket->readAll();
+    const int end = inputBuffer.indexOf("\r\n\r\n");
+    if (end < 0) {
+        if (inputBuffer.size() > maximumRequestSize)
+            reject("431 Request Header Fields Too Large");
+        return false;
+    }
+
+    const QList<QByteArray> lines = inputBuffer.left(end).split('\n');
+    inputBuffer.remove(0, end + 4);
+
+    // header names are case-insensitive, repeated headers are combined
+    QMap<QByteArray, QByteArray> headers;
+    for (int i = 1; i < lines.size(); ++i) {
+        const QByteArray line = lines[i].trimmed();
+        const int colon = line.indexOf(':');
+        if (colon <= 0)
+            continue;
+        const QByteArray name = line.left(colon).trimmed().toLower();
+        const QByteArray value = line.mid(colon + 1).trimmed();
+        if (headers.contains(name))
+            headers[name] += ", " + value;
+        else
+            headers.insert(name, value);
+    }
+
+    const QList<QByteArray> request = lines.first().simplified().split(' ');
+    const QByteArray key = headers.value("sec-websocket-key");
+    if (request.size() != 3 || request[0] != "GET" ||
+        !headers.value("upgrade").toLower().contains("websocket") ||
+        !headers.value("connection").toLower().contains("upgrade") ||
+        key.isEmpty()) {
+        reject("400 Bad Request");
+        return false;
+    }
+    if (headers.value("sec-websocket-version") != "13") {
+        reject("426 Upgrade Required", "Sec-WebSocket-Version: 13\r\n");
+        return false;
+    }
+
+    // the client must ask for the XMPP subprotocol
+    bool xmpp = false;
+    foreach (const QByteArray &protocol, headers.value("sec-websocket-protocol").split(',')) {
+        if (protocol.trimmed() == "xmpp") {
+            xmpp = true;
+            break;
+        }
+    }
+    if (!xmpp) {
+        reject("400 Bad Request");
+        return false;
+    }
+
+    QByteArray response = "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: " +
+        QCryptographicHash::hash(key + webSocketGuid, QCryptographicHash::Sha1).toBase64() + "\r\n"
+        "Sec-WebSocket-Protocol: xmpp\r\n";
+    if (QXmppStreamCompressor::isSupported()) {
+        foreach (const QByteArray &offer, headers.value("sec-websocket-extensions").split(',')) {
+            if (isAcceptableDeflateOffer(offer)) {
+                compressor = new QXmppStreamCompressor(QXmppStreamCompressor::RawDeflateFormat);
+                response += "Sec-WebSocket-Extensions: permessage-deflate\r\n";
+                break;
+            }
+        }
+    }
+    response += "\r\n";
+    socket->write(response);
+    state = OpenState;
+    return true;
+}
+
+void QXmppWebSocketPrivate::reject(const QByteArray &status, const QByteArray &headers)
+{
+    socket->write("HTTP/1.1 " + status + "\r\n" + headers +
+                  "Content-Length: 0\r\n"
+                  "Connection: close\r\n"
+                  "\r\n");
+    state = ClosedState;
+    socket->disconnectFromHost();
+}
+
+// Parses the complete frames received so far.
+
+void QXmppWebSocketPrivate::readFrames()
+{
+    inputBuffer += socket->readAll();
+    const int readBufferSize = readBuffer.size();
+    int pos = 0;
+    while (state == OpenState) {
+        const int available = inputBuffer.size() - pos;
+        if (available < 2)
+            break;
+
+        const uchar *header = reinterpret_cast<const uchar*>(inputBuffer.constData() + pos);
+        const bool fin = header[0] & 0x80;
+        const bool compressed = header[0] & 0x40;
+        const int opcode = header[0] & 0x0f;
+        quint64 length = header[1] & 0x7f;
+        int headerSize = 2;
+        if (length == 126) {
+            headerSize = 4;
+            if (available < headerSize)
+                break;
+            length = qFromBigEndian<quint16>(header + 2);
+        } else if (length == 127) {
+            headerSize = 10;
+            if (available < headerSize)
+                break;
+            length = qFromBigEndian<quint64>(header + 2);
+        }
+
+        // frames from clients are masked, and only permessage-deflate
+        // uses a reserved bit
+        if (!(header[1] & 0x80) || (header[0] & 0x30) || (compressed && !compressor)) {
+            fail(ProtocolError);
+            break;
+        }
+        if (length > quint64(maximumMessageSize - message.size())) {
+            fail(MessageTooBig);
+            break;
+        }
+        if (available < headerSize + 4 + int(length))
+            break;
+
+        const uchar *mask = header + headerSize;
+        QByteArray payload(reinterpret_cast<const char*>(mask + 4), int(length));
+        char *data = payload.data();
+        for (int i = 0; i < int(length); ++i)
+            data[i] ^= mask[i % 4];
+        pos += headerSize + 4 + int(length);
+
+        if (opcode & 0x8) {
+            // control frames
+            if (!fin || compressed || length > 125) {
+                fail(ProtocolError);
+            } else if (opcode == CloseFrame) {
+                sendClose(payload.left(2));
+            } else if (opcode == PingFrame) {
+                QByteArray output;
+                appendFrame(output, PongFrame, payload);
+                socket->write(output);
+            } else if (opcode != PongFrame) {
+                fail(ProtocolError);
+            }
+            continue;
+        }
+
+        // data frames
+        if (opcode == TextFrame && !messageStarted) {
+            messageStarted = true;
+            messageCompressed = compressed;
+        } else if (opcode == BinaryFrame && !messageStarted) {
+            // RFC 7395 only uses text messages
+            fail(UnsupportedData);
+            break;
+        } else if (opcode != ContinuationFrame || !messageStarted || compressed) {
+            fail(ProtocolError);
+            break;
+        }
+        message += payload;
+        if (fin) {
+            readMessage();
+            message.clear();
+            messageStarted = false;
+        }
+    }
+    inputBuffer.remove(0, pos);
+
+    if (readBuffer.size() > readBufferSize)
+        emit q->readyRead();
+}
+
+// Translates a complete message into the classic XMPP stream.
+
+void QXmppWebSocketPrivate::readMessage()
+{
+    QByteArray data = message;
+    if (messageCompressed) {
+        QByteArray decompressed;
+        data.append(deflateTrailer, 4);
+        if (!compressor->decompress(data, decompressed, maximumMessageSize)) {
+            fail(ProtocolError);
+            return;
+        }
+        if (decompressed.size() > maximumMessageSize) {
+            fail(MessageTooBig);
+            return;
+        }
+        data = decompressed;
+    }
+
+    const QByteArray trimmed = data.trimmed();
+    if (isElement(trimmed, "open")) {
+        readBuffer += "<stream:stream xmlns='" + QByteArray(ns_client.latin1()) + "' xmlns:stream='" + ns_stream.latin1() + "'";
+        foreach (const QXmppStreamSplitter::Attribute &attribute, QXmppStreamSplitter::attributes(trimmed)) {
+            if (!isNamespaceDeclaration(attribute.first))
+                readBuffer += " " + attribute.first + "=" + attribute.second;
+        }
+        readBuffer += ">";
+    } else if (isElement(trimmed, "close")) {
+        readBuffer += "</stream:stream>";
+    } else {
+        readBuffer += data;
+    }
+}
+
+// Sends a close frame, if none was sent yet, and closes the connection.
+
+void QXmppWebSocketPrivate::sendClose(const QByteArray &payload)
+{
+    if (state != OpenState)
+        return;
+
+    QByteArray output;
+    appendFrame(output, CloseFrame, payload);
+    socket->write(output);
+    state = ClosingState;
+    socket->disconnectFromHost();
+}
+
+void QXmppWebSocketPrivate::fail(quint16 code)
+{
+    QByteArray payload(2, 0);
+    qToBigEndian<quint16>(code, reinterpret_cast<uchar*>(payload.data()));
+    sendClose(payload);
+}
+
+void QXmppWebSocketPrivate::writeMessage(QByteArray &output, const QByteArray &message)
+{
+    if (compressor) {
+        QByteArray compressed;
+        if (compressor->compress(message, compressed) &&
+            compressed.endsWith(QByteArray::fromRawData(deflateTrailer, 4))) {
+            compressed.chop(4);
+            appendFrame(output, TextFrame, compressed, true);
+            return;
+        }
+    }
+    appendFrame(output, TextFrame, message);
+}
+
+/// Constructs a WebSocket device for the given socket, which becomes its
+/// child.
+///
+/// The socket must be connected, the client's upgrade request is read
+/// from it.
+///
+/// \param socket
+/// \param parent
+
+QXmppWebSocket::QXmppWebSocket(QTcpSocket *socket, QObject *parent)
+    : QIODevice(parent)
+    , d(new QXmppWebSocketPrivate(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->socket = socket;
+    socket->setParent(this);
+
+    check = connect(socket, SIGNAL(bytesWritten(qint64)),
+                    this, SIGNAL(bytesWritten(qint64)));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(disconnected()),
+                    this, SLOT(_q_socketDisconnected()));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(readyRead()),
+                    this, SLOT(_q_socketReadyRead()));
+    Q_ASSERT(check);
+
+    open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+
+    // the request may have arrived already
+    if (socket->bytesAvailable())
+        QMetaObject::invokeMethod(this, "_q_socketReadyRead", Qt::QueuedConnection);
+}
+
+/// Destroys the WebSocket device.
+
+QXmppWebSocket::~QXmppWebSocket()
+{
+    delete d->compressor;
+    delete d;
+}
+
+/// Returns true if the permessage-deflate extension is used.
+
+bool QXmppWebSocket::isCompressed() const
+{
+    return d->compressor != 0;
+}
+
+/// Returns the underlying socket.
+
+QTcpSocket *QXmppWebSocket::socket() const
+{
+    return d->socket;
+}
+
+/// Returns the number of bytes of the XMPP stream which can be read.
+
+qint64 QXmppWebSocket::bytesAvailable() const
+{
+    return d->readBuffer.size() + QIODevice::bytesAvailable();
+}
+
+/// Returns the number of bytes which were written but not sent yet.
+
+qint64 QXmppWebSocket::bytesToWrite() const
+{
+    return d->socket->bytesToWrite() + d->splitter.bufferSize();
+}
+
+/// Closes the WebSocket connection.
+
+void QXmppWebSocket::close()
+{
+    if (d->state == QXmppWebSocketPrivate::OpenState) {
+        d->fail(NormalClosure);
+    } else if (d->state == QXmppWebSocketPrivate::HandshakeState) {
+        d->state = QXmppWebSocketPrivate::ClosedState;
+        d->socket->disconnectFromHost();
+    }
+    QIODevice::close();
+}
+
+/// Returns true, as the XMPP stream is sequential.
+
+bool QXmppWebSocket::isSequential() const
+{
+    return true;
+}
+
+qint64 QXmppWebSocket::readData(char *data, qint64 maxSize)
+{
+    const int size = int(qMin(maxSize, qint64(d->readBuffer.size())));
+    memcpy(data, d->readBuffer.constData(), size);
+    d->readBuffer.remove(0, size);
+    return size;
+}
+
+qint64 QXmppWebSocket::writeData(const char *data, qint64 size)
+{
+    if (d->state != QXmppWebSocketPrivate::OpenState)
+        return -1;
+
+    d->splitter.addData(data, int(size));
+
+    // send each top-level element as a message
+    QByteArray output;
+    QXmppStreamSplitter::Token token;
+    while ((token = d->splitter.readNext()) != QXmppStreamSplitter::NoToken) {
+        if (token == QXmppStreamSplitter::StreamStartToken) {
+            // stream restarts are sent as a new <open/>
+            QByteArray open = "<open xmlns='" + QByteArray(ns_framing.latin1()) + "'";
+            foreach (const QXmppStreamSplitter::Attribute &attribute, QXmppStreamSplitter::attributes(d->splitter.data())) {
+                if (!isNamespaceDeclaration(attribute.first))
+                    open += " " + attribute.first + "=" + attribute.second;
+            }
+            d->writeMessage(output, open + "/>");
+        } else if (token == QXmppStreamSplitter::ElementToken) {
+            d->writeMessage(output, d->splitter.data());
+        } else {
+            d->writeMessage(output, "<close xmlns='" + QByteArray(ns_framing.latin1()) + "'/>");
+        }
+    }
+    if (!output.isEmpty())
+        d->socket->write(output);
+    return size;
+}
+
+void QXmppWebSocket::_q_socketDisconnected()
+{
+    d->state = QXmppWebSocketPrivate::ClosedState;
+    if (isOpen())
+        QIODevice::close();
+    emit disconnected();
+}
+
+void QXmppWebSocket::_q_socketReadyRead()
+{
+    if (d->state == QXmppWebSocketPrivate::HandshakeState) {
+        if (!d->handshake())
+            return;
+        emit connected();
+    }
+
+    if (d->state == QXmppWebSocketPrivate::OpenState)
+        d->readFrames();
+    else
+        d->socket->readAll();
+}
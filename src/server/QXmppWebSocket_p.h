@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#ifndef QXMPPWEBSOCKET_P_H
+#define QXMPPWEBSOCKET_P_H
+
+#include <QIODevice>
+
+#include "QXmppGlobal.h"
+
+class QTcpSocket;
+class QXmppWebSocketPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServer class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppWebSocket class carries an XMPP stream over a WebSocket
+/// connection, as defined by RFC 7395.
+///
+/// The device answers the client's HTTP upgrade request, then translates
+/// between WebSocket messages and the classic XMPP stream, so that a
+/// QXmppIncomingClient can use it like a socket. Incoming <open/> and
+/// <close/> elements become the stream's header and footer, and each
+/// top-level element written to the device is sent as one message with
+/// the namespaces it inherits from the stream declared on it.
+///
+/// If the client offers it, messages are compressed with the
+/// permessage-deflate extension of RFC 7692, keeping the deflate
+/// contexts from one message to the next.
+
+class QXMPP_AUTOTEST_EXPORT QXmppWebSocket : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    QXmppWebSocket(QTcpSocket *socket, QObject *parent = 0);
+    ~QXmppWebSocket();
+
+    bool isCompressed() const;
+    QTcpSocket *socket() const;
+
+    qint64 bytesAvailable() const;
+    qint64 bytesToWrite() const;
+    void close();
+    bool isSequential() const;
+
+signals:
+    /// This signal is emitted when the WebSocket handshake succeeds.
+    void connected();
+
+    /// This signal is emitted when the connection is closed.
+    void disconnected();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 size);
+
+private slots:
+    void _q_socketDisconnected();
+    void _q_socketReadyRead();
+
+private:
+    QXmppWebSocketPrivate * const d;
+    friend class QXmppWebSocketPrivate;
+};
+
+#endif
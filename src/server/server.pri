@@ -1,20 +1,66 @@
 # Headers
 INSTALL_HEADERS += \
+    server/QXmppAsyncServerExtension.h \
     server/QXmppDialback.h \
     server/QXmppIncomingClient.h \
     server/QXmppIncomingServer.h \
     server/QXmppOutgoingServer.h \
     server/QXmppPasswordChecker.h \
     server/QXmppServer.h \
+    server/QXmppServerArchive.h \
     server/QXmppServerExtension.h \
-    server/QXmppServerPlugin.h
+    server/QXmppServerMuc.h \
+    server/QXmppServerOffline.h \
+    server/QXmppServerPlugin.h \
+    server/QXmppServerProxy65.h \
+    server/QXmppServerPubSub.h \
+    server/QXmppServerRoster.h \
+    server/QXmppServerTurn.h \
+    server/QXmppTurnServer.h
+
+HEADERS += \
+    server/QXmppBoshServer_p.h \
+    server/QXmppCluster_p.h \
+    server/QXmppHandoff_p.h \
+    server/QXmppIdleTimer_p.h \
+    server/QXmppLoginTokenStore_p.h \
+    server/QXmppPasswordChecker_p.h \
+    server/QXmppRoutingTable_p.h \
+    server/QXmppServerArchive_p.h \
+    server/QXmppServerOffline_p.h \
+    server/QXmppServerProxy65_p.h \
+    server/QXmppServerRoster_p.h \
+    server/QXmppTurnServer_p.h \
+    server/QXmppWebSocket_p.h
 
 # Source files
 SOURCES += \
+    server/QXmppAsyncServerExtension.cpp \
+    server/QXmppBoshServer.cpp \
+    server/QXmppCluster.cpp \
     server/QXmppDialback.cpp \
+    server/QXmppHandoff.cpp \
+    server/QXmppIdleTimer.cpp \
     server/QXmppIncomingClient.cpp \
     server/QXmppIncomingServer.cpp \
+    server/QXmppLoginTokenStore.cpp \
     server/QXmppOutgoingServer.cpp \
     server/QXmppPasswordChecker.cpp \
+    server/QXmppRoutingTable.cpp \
     server/QXmppServer.cpp \
-    server/QXmppServerExtension.cpp
+    server/QXmppServerArchive.cpp \
+    server/QXmppServerExtension.cpp \
+    server/QXmppServerMuc.cpp \
+    server/QXmppServerOffline.cpp \
+    server/QXmppServerProxy65.cpp \
+    server/QXmppServerPubSub.cpp \
+    server/QXmppServerRoster.cpp \
+    server/QXmppServerTurn.cpp \
+    server/QXmppTurnServer.cpp \
+    server/QXmppWebSocket.cpp
+
+# epoll event dispatcher for worker threads
+linux*:!contains(qt_version, 4) {
+    HEADERS += server/QXmppEpollDispatcher_p.h
+    SOURCES += server/QXmppEpollDispatcher.cpp
+}
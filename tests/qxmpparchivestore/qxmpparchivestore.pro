@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpparchivestore
+SOURCES += tst_qxmpparchivestore.cpp
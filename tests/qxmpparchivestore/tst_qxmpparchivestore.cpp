@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QDir>
+#include <QFile>
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppServerArchive_p.h"
+
+class tst_QXmppArchiveStore : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void testAppend();
+    void testCompact();
+    void testPaging();
+    void testTruncated();
+
+private:
+    QDir m_dir;
+};
+
+static QByteArray message(int i)
+{
+    return "<message><body>" + QByteArray::number(i) + "</body></message>";
+}
+
+void tst_QXmppArchiveStore::init()
+{
+    m_dir = QDir(QDir::temp().filePath("qxmpp-archivestore-test"));
+    foreach (const QString &name, m_dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QDir userDir(m_dir.filePath(name));
+        foreach (const QString &file, userDir.entryList(QDir::Files))
+            userDir.remove(file);
+        m_dir.rmdir(name);
+    }
+}
+
+void tst_QXmppArchiveStore::testAppend()
+{
+    const QDateTime stamp(QDate(2015, 9, 2), QTime(12, 30, 0), Qt::UTC);
+
+    QXmppArchiveStore store;
+    QVERIFY(store.open(m_dir.path()));
+    QVERIFY(store.isOpen());
+
+    QCOMPARE(store.append("foo@example.com", "bar@example.com/a", stamp, message(1)), quint64(1));
+    QCOMPARE(store.append("foo@example.com", "bar@example.com/b", stamp.addSecs(1), message(2)), quint64(2));
+    QCOMPARE(store.append("foo@example.com", "baz@example.com/a", stamp.addSecs(2), message(3)), quint64(3));
+    QCOMPARE(store.append("bar@example.com", "foo@example.com/a", stamp, message(4)), quint64(1));
+    QVERIFY(store.pendingSize() > 0);
+
+    QList<QXmppArchiveStore::Record> records = store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 0, 0, 0, -1);
+    QCOMPARE(records.size(), 3);
+    QCOMPARE(records[0].id, quint64(1));
+    QCOMPARE(records[0].stamp, stamp);
+    QCOMPARE(records[0].with, QString("bar@example.com/a"));
+    QCOMPARE(records[0].data, message(1));
+    QCOMPARE(records[2].id, quint64(3));
+    QCOMPARE(records[2].stamp, stamp.addSecs(2));
+
+    // a bare JID matches all the resources
+    records = store.records("foo@example.com", "bar@example.com", QDateTime(), QDateTime(), 0, 0, 0, -1);
+    QCOMPARE(records.size(), 2);
+    records = store.records("foo@example.com", "bar@example.com/b", QDateTime(), QDateTime(), 0, 0, 0, -1);
+    QCOMPARE(records.size(), 1);
+    QCOMPARE(records[0].data, message(2));
+
+    // time range
+    records = store.records("foo@example.com", QString(), stamp.addSecs(1), stamp.addSecs(1), 0, 0, 0, -1);
+    QCOMPARE(records.size(), 1);
+    QCOMPARE(records[0].id, quint64(2));
+
+    // timestamps do not go back
+    QCOMPARE(store.append("foo@example.com", "bar@example.com/a", stamp, message(5)), quint64(4));
+    store.close();
+    QVERIFY(!store.isOpen());
+
+    QVERIFY(store.open(m_dir.path()));
+    QStringList users = store.users();
+    users.sort();
+    QCOMPARE(users, QStringList() << "bar@example.com" << "foo@example.com");
+    records = store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 0, 0, 0, -1);
+    QCOMPARE(records.size(), 4);
+    QCOMPARE(records[3].stamp, stamp.addSecs(2));
+    QCOMPARE(store.append("foo@example.com", "bar@example.com/a", stamp, message(6)), quint64(5));
+}
+
+void tst_QXmppArchiveStore::testCompact()
+{
+    const QDateTime stamp(QDate(2015, 9, 2), QTime(12, 30, 0), Qt::UTC);
+
+    // every commit starts a new segment
+    QXmppArchiveStore store;
+    store.setMaximumSegmentSize(1);
+    QVERIFY(store.open(m_dir.path()));
+    for (int i = 1; i <= 5; ++i) {
+        store.append("foo@example.com", "bar@example.com", stamp.addSecs(i), message(i));
+        QVERIFY(store.commit());
+    }
+    QCOMPARE(store.segmentCount("foo@example.com"), 6);
+
+    // old segments are dropped
+    QVERIFY(store.compact("foo@example.com", stamp.addSecs(3)));
+    QCOMPARE(store.segmentCount("foo@example.com"), 4);
+
+    // small segments are merged
+    store.setMaximumSegmentSize(1024 * 1024);
+    QVERIFY(store.compact("foo@example.com", QDateTime()));
+    QCOMPARE(store.segmentCount("foo@example.com"), 2);
+
+    QList<QXmppArchiveStore::Record> records = store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 0, 0, 0, -1);
+    QCOMPARE(records.size(), 3);
+    QCOMPARE(records[0].id, quint64(3));
+    QCOMPARE(records[2].id, quint64(5));
+    QCOMPARE(records[2].data, message(5));
+    store.close();
+
+    QVERIFY(store.open(m_dir.path()));
+    QCOMPARE(store.segmentCount("foo@example.com"), 2);
+    QCOMPARE(store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 0, 0, 0, -1).size(), 3);
+    QCOMPARE(store.append("foo@example.com", "bar@example.com", stamp.addSecs(6), message(6)), quint64(6));
+}
+
+void tst_QXmppArchiveStore::testPaging()
+{
+    const QDateTime stamp(QDate(2015, 9, 2), QTime(12, 30, 0), Qt::UTC);
+
+    QXmppArchiveStore store;
+    QVERIFY(store.open(m_dir.path()));
+    for (int i = 1; i <= 200; ++i)
+        store.append("foo@example.com", "bar@example.com", stamp.addSecs(i), message(i));
+
+    // forward
+    bool complete;
+    QList<QXmppArchiveStore::Record> records = store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 100, 0, 0, 10, &complete);
+    QCOMPARE(records.size(), 10);
+    QCOMPARE(records.first().id, quint64(101));
+    QCOMPARE(records.last().id, quint64(110));
+    QCOMPARE(records.last().data, message(110));
+    QVERIFY(!complete);
+
+    records = store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 195, 0, 0, 10, &complete);
+    QCOMPARE(records.size(), 5);
+    QCOMPARE(records.last().id, quint64(200));
+    QVERIFY(complete);
+
+    // index
+    records = store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 0, 0, 3, 2);
+    QCOMPARE(records.size(), 2);
+    QCOMPARE(records.first().id, quint64(4));
+
+    // backward
+    records = store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 0, 130, 0, 5, &complete);
+    QCOMPARE(records.size(), 5);
+    QCOMPARE(records.first().id, quint64(125));
+    QCOMPARE(records.last().id, quint64(129));
+    QVERIFY(!complete);
+
+    records = store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 0, 4, 0, 5, &complete);
+    QCOMPARE(records.size(), 3);
+    QCOMPARE(records.first().id, quint64(1));
+    QVERIFY(complete);
+
+    // time range
+    records = store.records("foo@example.com", QString(), stamp.addSecs(150), stamp.addSecs(159), 0, 0, 0, -1);
+    QCOMPARE(records.size(), 10);
+    QCOMPARE(records.first().id, quint64(150));
+    records = store.records("foo@example.com", QString(), stamp.addSecs(150), stamp.addSecs(159), 0, 201, 0, 3);
+    QCOMPARE(records.size(), 3);
+    QCOMPARE(records.first().id, quint64(157));
+}
+
+void tst_QXmppArchiveStore::testTruncated()
+{
+    const QDateTime stamp(QDate(2015, 9, 2), QTime(12, 30, 0), Qt::UTC);
+
+    QXmppArchiveStore store;
+    QVERIFY(store.open(m_dir.path()));
+    store.append("foo@example.com", "bar@example.com", stamp, message(1));
+    store.append("foo@example.com", "bar@example.com", stamp, message(2));
+    store.close();
+
+    // simulate a crash while the last record was written
+    const QStringList users = m_dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    QCOMPARE(users.size(), 1);
+    QDir userDir(m_dir.filePath(users.first()));
+    const QStringList names = userDir.entryList(QStringList() << "*.seg", QDir::Files);
+    QCOMPARE(names.size(), 1);
+    QFile file(userDir.filePath(names.first()));
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.resize(file.size() - 10));
+    file.close();
+
+    QVERIFY(store.open(m_dir.path()));
+    const QList<QXmppArchiveStore::Record> records = store.records("foo@example.com", QString(), QDateTime(), QDateTime(), 0, 0, 0, -1);
+    QCOMPARE(records.size(), 1);
+    QCOMPARE(records.first().data, message(1));
+    QCOMPARE(store.append("foo@example.com", "bar@example.com", stamp, message(3)), quint64(2));
+}
+
+QTEST_MAIN(tst_QXmppArchiveStore)
+#include "tst_qxmpparchivestore.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppbase64
+SOURCES += tst_qxmppbase64.cpp
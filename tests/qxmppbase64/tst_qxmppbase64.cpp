@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppBase64_p.h"
+
+// Returns \a size bytes of pseudo-random data.
+static QByteArray randomData(int size)
+{
+    QByteArray data(size, 0);
+    for (int i = 0; i < size; ++i)
+        data[i] = char(qrand() & 0xff);
+    return data;
+}
+
+class tst_QXmppBase64 : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testEncode_data();
+    void testEncode();
+    void testDecodeInvalid_data();
+    void testDecodeInvalid();
+    void testChunks();
+    void testRandom();
+};
+
+void tst_QXmppBase64::testEncode_data()
+{
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<QByteArray>("encoded");
+
+    // RFC 4648 test vectors
+    QTest::newRow("empty") << QByteArray() << QByteArray();
+    QTest::newRow("f") << QByteArray("f") << QByteArray("Zg==");
+    QTest::newRow("fo") << QByteArray("fo") << QByteArray("Zm8=");
+    QTest::newRow("foo") << QByteArray("foo") << QByteArray("Zm9v");
+    QTest::newRow("foob") << QByteArray("foob") << QByteArray("Zm9vYg==");
+    QTest::newRow("fooba") << QByteArray("fooba") << QByteArray("Zm9vYmE=");
+    QTest::newRow("foobar") << QByteArray("foobar") << QByteArray("Zm9vYmFy");
+
+    // long enough for whole vector blocks
+    QTest::newRow("alphabet")
+        << QByteArray::fromHex("00108310518720928b30d38f41149351559761969b71d79f8218a39259a7a29aabb2dbafc31cb3d35db7e39ebbf3dfbf")
+        << QByteArray("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/");
+}
+
+void tst_QXmppBase64::testEncode()
+{
+    QFETCH(QByteArray, data);
+    QFETCH(QByteArray, encoded);
+
+    QCOMPARE(QXmppBase64::encode(data), encoded);
+    QCOMPARE(QXmppBase64::decode(encoded), data);
+    QCOMPARE(QXmppBase64::decode(QString::fromLatin1(encoded)), data);
+}
+
+void tst_QXmppBase64::testDecodeInvalid_data()
+{
+    QTest::addColumn<QString>("encoded");
+
+    // invalid characters are skipped, like QByteArray::fromBase64() does
+    QTest::newRow("whitespace") << QString("Zm9v\nYmFy\r\n Zm9v YmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFy\n");
+    QTest::newRow("padding") << QString("Zg==Zm8=Zm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFy");
+    QTest::newRow("non latin1") << QString::fromUtf8("Zm9vYmFyZm9v\xc5\x81YmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFy");
+    QTest::newRow("latin1") << QString::fromUtf8("Zm9vYmFyZm9vYmFyZm9vYmFyZm9v\xc3\xa9YmFyZm9vYmFyZm9vYmFyZm9vYmFy");
+}
+
+void tst_QXmppBase64::testDecodeInvalid()
+{
+    QFETCH(QString, encoded);
+
+    QCOMPARE(QXmppBase64::decode(encoded), QByteArray::fromBase64(encoded.toLatin1()));
+    QCOMPARE(QXmppBase64::decode(encoded.toLatin1()), QByteArray::fromBase64(encoded.toLatin1()));
+}
+
+void tst_QXmppBase64::testChunks()
+{
+    const QByteArray data = randomData(1000);
+    const QByteArray encoded = data.toBase64();
+
+    for (int chunkSize = 1; chunkSize < 70; ++chunkSize) {
+        QXmppBase64Encoder encoder;
+        QByteArray output;
+        for (int i = 0; i < data.size(); i += chunkSize)
+            encoder.encode(data.mid(i, chunkSize), output);
+        encoder.finish(output);
+        QCOMPARE(output, encoded);
+
+        QXmppBase64Decoder decoder;
+        output.clear();
+        for (int i = 0; i < encoded.size(); i += chunkSize)
+            decoder.decode(encoded.mid(i, chunkSize), output);
+        QCOMPARE(output, data);
+    }
+
+    // caller-provided buffers
+    QXmppBase64Encoder encoder;
+    QByteArray buffer(QXmppBase64Encoder::encodedSize(10), 0);
+    QCOMPARE(encoder.encode(data.constData(), 10, buffer.data()), 12);
+    QCOMPARE(encoder.finish(buffer.data() + 12), 4);
+    QCOMPARE(buffer, data.left(10).toBase64());
+
+    QXmppBase64Decoder decoder;
+    buffer.fill(0, QXmppBase64Decoder::maximumDecodedSize(16));
+    QCOMPARE(decoder.decode(encoded.constData(), 16, buffer.data()), 12);
+    QCOMPARE(buffer.left(12), data.left(12));
+}
+
+void tst_QXmppBase64::testRandom()
+{
+    for (int size = 0; size < 300; ++size) {
+        const QByteArray data = randomData(size);
+        const QByteArray encoded = QXmppBase64::encode(data);
+        QCOMPARE(encoded, data.toBase64());
+        QCOMPARE(QXmppBase64::decode(encoded), data);
+
+        // insert line breaks
+        QByteArray wrapped;
+        for (int i = 0; i < encoded.size(); i += 76)
+            wrapped += encoded.mid(i, 76) + "\n";
+        QCOMPARE(QXmppBase64::decode(wrapped), data);
+    }
+}
+
+QTEST_MAIN(tst_QXmppBase64)
+#include "tst_qxmppbase64.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppbookmarkmanager
+SOURCES += tst_qxmppbookmarkmanager.cpp
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+
+#include "QXmppBookmarkManager.h"
+#include "QXmppBookmarkSet.h"
+#include "QXmppClient.h"
+#include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "QXmppUtils.h"
+#include "util.h"
+
+// Serves the bookmarks of XEP-0402: PEP Native Bookmarks, whose names are
+// also their nicknames.
+class TestBookmarkExtension : public QXmppServerExtension
+{
+public:
+    bool handleStanza(const QDomElement &element)
+    {
+        if (element.tagName() != QLatin1String("iq"))
+            return false;
+
+        const QDomElement queryElement = element.firstChildElement();
+        const QString to = element.attribute("from");
+        const QString id = element.attribute("id");
+        clientJid = to;
+
+        QString payload;
+        if (queryElement.namespaceURI() == QLatin1String("http://jabber.org/protocol/disco#items") &&
+            queryElement.attribute("node") == QLatin1String("urn:xmpp:bookmarks:1")) {
+            requests << "ids";
+            payload = "<query xmlns=\"http://jabber.org/protocol/disco#items\" node=\"urn:xmpp:bookmarks:1\">";
+            foreach (const QString &itemId, rooms)
+                payload += QString("<item jid=\"user1@localhost\" name=\"%1\"/>").arg(itemId);
+            payload += "</query>";
+        } else if (queryElement.namespaceURI() == QLatin1String("http://jabber.org/protocol/pubsub")) {
+            const QDomElement actionElement = queryElement.firstChildElement();
+            if (actionElement.attribute("node") != QLatin1String("urn:xmpp:bookmarks:1"))
+                return false;
+
+            QStringList itemIds;
+            for (QDomElement itemElement = actionElement.firstChildElement("item");
+                 !itemElement.isNull();
+                 itemElement = itemElement.nextSiblingElement("item"))
+                itemIds << itemElement.attribute("id");
+
+            if (actionElement.tagName() == QLatin1String("items")) {
+                requests << "items:" + itemIds.join(",");
+                payload = "<pubsub xmlns=\"http://jabber.org/protocol/pubsub\"><items node=\"urn:xmpp:bookmarks:1\">";
+                foreach (const QString &itemId, itemIds)
+                    payload += conference(itemId);
+                payload += "</items></pubsub>";
+            } else if (actionElement.tagName() == QLatin1String("publish")) {
+                requests << "publish:" + itemIds.join(",");
+                if (!queryElement.firstChildElement("publish-options").isNull())
+                    requests.last() += "+options";
+                rooms << itemIds;
+            } else if (actionElement.tagName() == QLatin1String("retract")) {
+                requests << "retract:" + itemIds.join(",");
+                foreach (const QString &itemId, itemIds)
+                    rooms.removeAll(itemId);
+            } else {
+                return false;
+            }
+        } else {
+            return false;
+        }
+
+        const QString xml = QString("<iq xmlns=\"jabber:client\" type=\"result\" id=\"%1\" to=\"%2\">%3</iq>").arg(id, to, payload);
+        server()->sendData(to, xml.toUtf8());
+        return true;
+    }
+
+    static QString conference(const QString &itemId)
+    {
+        return QString("<item id=\"%1\"><conference xmlns=\"urn:xmpp:bookmarks:1\" autojoin=\"true\" name=\"%2\">"
+            "<nick>%2</nick></conference></item>").arg(itemId, QXmppUtils::jidToUser(itemId));
+    }
+
+    QString clientJid;
+    QStringList requests;
+    QStringList rooms;
+};
+
+class TestBookmarkCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    QList<QXmppBookmarkSet> received;
+
+public slots:
+    void bookmarksReceived(const QXmppBookmarkSet &bookmarks)
+    {
+        received << bookmarks;
+    }
+};
+
+static QStringList roomJids(const QXmppBookmarkSet &bookmarks)
+{
+    QStringList jids;
+    foreach (const QXmppBookmarkConference &conference, bookmarks.conferences())
+        jids << conference.jid();
+    jids.sort();
+    return jids;
+}
+
+static QXmppBookmarkConference roomBookmark(const QString &jid)
+{
+    QXmppBookmarkConference conference;
+    conference.setJid(jid);
+    conference.setName(QXmppUtils::jidToUser(jid));
+    conference.setNickName(QXmppUtils::jidToUser(jid));
+    conference.setAutoJoin(true);
+    return conference;
+}
+
+class tst_QXmppBookmarkManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testSync();
+    void testAddRemove();
+    void testNotification();
+
+private:
+    TestPasswordChecker m_passwordChecker;
+    TestBookmarkExtension *m_bookmarks;
+    QXmppServer *m_server;
+    QXmppClient *m_client;
+    QXmppBookmarkManager *m_manager;
+};
+
+void tst_QXmppBookmarkManager::initTestCase()
+{
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12362;
+
+    m_passwordChecker.addCredentials("user1", "testpwd");
+    m_bookmarks = new TestBookmarkExtension;
+    m_server = new QXmppServer;
+    m_server->setDomain("localhost");
+    m_server->setPasswordChecker(&m_passwordChecker);
+    m_server->addExtension(m_bookmarks);
+    QVERIFY(m_server->listenForClients(testHost, testPort));
+
+    m_client = new QXmppClient;
+    m_manager = new QXmppBookmarkManager;
+    m_manager->setPepEnabled(true);
+    m_client->addExtension(m_manager);
+}
+
+void tst_QXmppBookmarkManager::cleanupTestCase()
+{
+    delete m_client;
+    delete m_server;
+}
+
+void tst_QXmppBookmarkManager::testSync()
+{
+    m_bookmarks->rooms << "a@conference.localhost" << "b@conference.localhost";
+
+    // one cached bookmark is still on the server, the other was removed
+    QXmppBookmarkSet cached;
+    cached.setConferences(QList<QXmppBookmarkConference>()
+        << roomBookmark("a@conference.localhost")
+        << roomBookmark("c@conference.localhost"));
+    m_manager->setCachedBookmarks(cached);
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(12362);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+
+    m_client->connectToServer(config);
+    for (int i = 0; i < 50 && !m_manager->areBookmarksReceived(); ++i)
+        QTest::qWait(100);
+    QVERIFY(m_manager->areBookmarksReceived());
+
+    // only the missing bookmark is downloaded
+    QCOMPARE(m_bookmarks->requests, QStringList() << "ids" << "items:b@conference.localhost");
+    QCOMPARE(roomJids(m_manager->bookmarks()), QStringList()
+        << "a@conference.localhost"
+        << "b@conference.localhost");
+
+    const QXmppBookmarkConference received = m_manager->bookmarks().conferences().last();
+    QCOMPARE(received.name(), QLatin1String("b"));
+    QCOMPARE(received.nickName(), QLatin1String("b"));
+    QCOMPARE(received.autoJoin(), true);
+}
+
+void tst_QXmppBookmarkManager::testAddRemove()
+{
+    TestBookmarkCollector collector;
+    connect(m_manager, SIGNAL(bookmarksReceived(QXmppBookmarkSet)),
+            &collector, SLOT(bookmarksReceived(QXmppBookmarkSet)));
+    QList<QXmppBookmarkSet> &received = collector.received;
+    m_bookmarks->requests.clear();
+
+    QVERIFY(m_manager->addBookmark(roomBookmark("d@conference.localhost")));
+    for (int i = 0; i < 50 && received.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(m_bookmarks->requests, QStringList() << "publish:d@conference.localhost+options");
+    QCOMPARE(roomJids(m_manager->bookmarks()).size(), 3);
+
+    // replacing the whole set only sends the differences
+    received.clear();
+    m_bookmarks->requests.clear();
+    QXmppBookmarkSet bookmarks = m_manager->bookmarks();
+    QList<QXmppBookmarkConference> conferences = bookmarks.conferences();
+    conferences.removeFirst();
+    bookmarks.setConferences(conferences);
+    QVERIFY(m_manager->setBookmarks(bookmarks));
+    for (int i = 0; i < 50 && received.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(m_bookmarks->requests, QStringList() << "retract:a@conference.localhost");
+    QCOMPARE(roomJids(m_manager->bookmarks()), QStringList()
+        << "b@conference.localhost"
+        << "d@conference.localhost");
+}
+
+void tst_QXmppBookmarkManager::testNotification()
+{
+    TestBookmarkCollector collector;
+    connect(m_manager, SIGNAL(bookmarksReceived(QXmppBookmarkSet)),
+            &collector, SLOT(bookmarksReceived(QXmppBookmarkSet)));
+    QList<QXmppBookmarkSet> &received = collector.received;
+
+    // a bookmark was added by another resource
+    const QString xml = QString("<message xmlns=\"jabber:client\" from=\"user1@localhost\" to=\"%1\">"
+        "<event xmlns=\"http://jabber.org/protocol/pubsub#event\">"
+        "<items node=\"urn:xmpp:bookmarks:1\">%2<retract id=\"b@conference.localhost\"/></items>"
+        "</event></message>").arg(m_bookmarks->clientJid, TestBookmarkExtension::conference("e@conference.localhost"));
+    m_server->sendData(m_bookmarks->clientJid, xml.toUtf8());
+    for (int i = 0; i < 50 && received.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received.size(), 1);
+    QCOMPARE(roomJids(m_manager->bookmarks()), QStringList()
+        << "d@conference.localhost"
+        << "e@conference.localhost");
+}
+
+QTEST_MAIN(tst_QXmppBookmarkManager)
+#include "tst_qxmppbookmarkmanager.moc"
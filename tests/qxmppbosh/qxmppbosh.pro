@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppbosh
+SOURCES += tst_qxmppbosh.cpp
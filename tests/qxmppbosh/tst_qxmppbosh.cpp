@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QEventLoop>
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrl>
+#include <QtTest>
+
+#include "QXmppBoshClient_p.h"
+#include "QXmppBoshServer_p.h"
+
+static const QHostAddress testHost = QHostAddress::LocalHost;
+static const quint16 testPort = 12375;
+
+static const QByteArray serverHeader =
+    "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'"
+    " id='abc' from='example.com' version='1.0'>";
+
+// Runs the event loop until the signal is emitted, or a second elapsed.
+static void waitForSignal(QObject *sender, const char *signal)
+{
+    QEventLoop loop;
+    QObject::connect(sender, signal, &loop, SLOT(quit()));
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+// Reads from the device until the data ends with \a end.
+static QByteArray readUntil(QIODevice *device, const QByteArray &end)
+{
+    QByteArray data = device->readAll();
+    while (!data.endsWith(end)) {
+        waitForSignal(device, SIGNAL(readyRead()));
+        const QByteArray more = device->readAll();
+        if (more.isEmpty())
+            break;
+        data += more;
+    }
+    return data;
+}
+
+// Sends a request with the given body.
+static void postBody(QTcpSocket *socket, const QByteArray &body)
+{
+    socket->write("POST /http-bind HTTP/1.1\r\n"
+                  "Host: example.com\r\n"
+                  "Content-Type: text/xml; charset=utf-8\r\n"
+                  "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                  "\r\n" + body);
+}
+
+// Returns the body of the next response.
+static QByteArray readBody(QTcpSocket *socket)
+{
+    QByteArray data;
+    for (;;) {
+        const int headerEnd = data.indexOf("\r\n\r\n");
+        if (headerEnd >= 0) {
+            const int start = data.indexOf("Content-Length: ");
+            const int length = data.mid(start + 16, headerEnd - start - 16).split('\r').first().toInt();
+            if (data.size() >= headerEnd + 4 + length)
+                return data.mid(headerEnd + 4, length);
+        }
+        if (!socket->bytesAvailable())
+            waitForSignal(socket, SIGNAL(readyRead()));
+        const QByteArray more = socket->readAll();
+        if (more.isEmpty())
+            return QByteArray();
+        data += more;
+    }
+}
+
+class tst_QXmppBosh : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void acceptConnection();
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testPipelinedRequests();
+    void testSession();
+    void testUnknownSession();
+
+private:
+    QTcpSocket *connectSocket();
+
+    QTcpServer *listener;
+    QXmppBoshServer *server;
+};
+
+void tst_QXmppBosh::acceptConnection()
+{
+    while (listener->hasPendingConnections())
+        server->addConnection(listener->nextPendingConnection());
+}
+
+void tst_QXmppBosh::init()
+{
+    server = new QXmppBoshServer;
+    listener = new QTcpServer;
+    connect(listener, SIGNAL(newConnection()), this, SLOT(acceptConnection()));
+    QVERIFY(listener->listen(testHost, testPort));
+}
+
+void tst_QXmppBosh::cleanup()
+{
+    delete listener;
+    delete server;
+}
+
+QTcpSocket *tst_QXmppBosh::connectSocket()
+{
+    QTcpSocket *socket = new QTcpSocket(this);
+    socket->connectToHost(testHost, testPort);
+    socket->waitForConnected();
+    return socket;
+}
+
+void tst_QXmppBosh::testPipelinedRequests()
+{
+    QTcpSocket *first = connectSocket();
+    QTcpSocket *second = connectSocket();
+
+    postBody(first, "<body xmlns='http://jabber.org/protocol/httpbind' rid='100' to='example.com'"
+                    " hold='2' wait='5' ver='1.11' xmpp:version='1.0' xmlns:xmpp='urn:xmpp:xbosh'/>");
+    waitForSignal(server, SIGNAL(newSession(QXmppBoshSession*)));
+    QCOMPARE(server->sessionCount(), 1);
+    QXmppBoshSession *session = server->findChild<QXmppBoshSession*>();
+    QVERIFY(session);
+    QCOMPARE(session->hold(), 2);
+    QCOMPARE(session->wait(), 5);
+
+    session->write(serverHeader + "<stream:features/>");
+    const QByteArray created = readBody(first);
+    QVERIFY(created.contains(" sid='" + session->sid().toUtf8() + "'"));
+    QVERIFY(created.contains(" requests='3'"));
+    QVERIFY(created.contains(" authid='abc'"));
+    QVERIFY(created.contains("<stream:features xmlns:stream='http://etherx.jabber.org/streams'/>"));
+
+    // the second request arrives after the third one, on another connection
+    const QByteArray sid = session->sid().toUtf8();
+    postBody(first, "<body xmlns='http://jabber.org/protocol/httpbind' rid='102' sid='" + sid + "'>"
+                    "<message xmlns='jabber:client' to='b@example.com'/></body>");
+    waitForSignal(first, SIGNAL(bytesWritten(qint64)));
+    QTest::qWait(50);
+    QCOMPARE(session->bytesAvailable(), qint64(0));
+    postBody(second, "<body xmlns='http://jabber.org/protocol/httpbind' rid='101' sid='" + sid + "'>"
+                     "<message xmlns='jabber:client' to='a@example.com'/></body>");
+    const QByteArray stream = readUntil(session, "to='b@example.com'/>");
+    QVERIFY(stream.endsWith("<message xmlns='jabber:client' to='a@example.com'/>"
+                            "<message xmlns='jabber:client' to='b@example.com'/>"));
+
+    // both requests are held, the oldest one carries the next data
+    QTest::qWait(50);
+    QCOMPARE(second->bytesAvailable(), qint64(0));
+    session->write("<message to='c@example.com'/>");
+    QCOMPARE(readBody(second), QByteArray(
+        "<body xmlns='http://jabber.org/protocol/httpbind'>"
+        "<message xmlns='jabber:client' to='c@example.com'/></body>"));
+
+    // the session ends with the client's request
+    QSignalSpy disconnectedSpy(session, SIGNAL(disconnected()));
+    postBody(second, "<body xmlns='http://jabber.org/protocol/httpbind' rid='103' sid='" + sid + "' type='terminate'/>");
+    QVERIFY(readBody(first).contains("type='terminate'"));
+    QVERIFY(readBody(second).contains("type='terminate'"));
+    if (!disconnectedSpy.count())
+        waitForSignal(session, SIGNAL(disconnected()));
+    QCOMPARE(disconnectedSpy.count(), 1);
+}
+
+void tst_QXmppBosh::testSession()
+{
+    QXmppBoshClient client;
+    QSignalSpy connectedSpy(&client, SIGNAL(connected()));
+    QSignalSpy disconnectedSpy(&client, SIGNAL(disconnected()));
+    client.connectToUrl(QUrl(QString("http://127.0.0.1:%1/http-bind").arg(testPort)), "example.com");
+    QCOMPARE(client.state(), QAbstractSocket::ConnectingState);
+    waitForSignal(&client, SIGNAL(connected()));
+    QCOMPARE(connectedSpy.count(), 1);
+    QCOMPARE(client.state(), QAbstractSocket::ConnectedState);
+
+    // the stream header creates the session
+    client.write("<?xml version='1.0'?><stream:stream to='example.com' xmlns='jabber:client'"
+                 " xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>");
+    waitForSignal(server, SIGNAL(newSession(QXmppBoshSession*)));
+    QXmppBoshSession *session = server->findChild<QXmppBoshSession*>();
+    QVERIFY(session);
+    QCOMPARE(readUntil(session, ">"), QByteArray(
+        "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'"
+        " to='example.com' version='1.0'>"));
+
+    session->write(serverHeader + "<stream:features/>");
+    QCOMPARE(readUntil(&client, "/>"), QByteArray(
+        "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'"
+        " id='abc' version='1.0' from='example.com'>"
+        "<stream:features xmlns:stream='http://etherx.jabber.org/streams'/>"));
+    QCOMPARE(client.sid(), session->sid());
+
+    // data flows both ways while a request is held
+    client.write("<message to='a@example.com'/>");
+    QCOMPARE(readUntil(session, "/>"), QByteArray("<message xmlns='jabber:client' to='a@example.com'/>"));
+    session->write("<message to='b@example.com'/>");
+    QCOMPARE(readUntil(&client, "/>"), QByteArray("<message xmlns='jabber:client' to='b@example.com'/>"));
+    QVERIFY(client.connectionCount() <= client.maximumConnections());
+
+    // the stream is restarted
+    client.write("<?xml version='1.0'?><stream:stream to='example.com' xmlns='jabber:client'"
+                 " xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>");
+    QVERIFY(readUntil(session, ">").startsWith("<stream:stream "));
+    session->write(serverHeader + "<stream:features/>");
+    QVERIFY(readUntil(&client, "/>").startsWith("<stream:stream "));
+
+    // the client ends the session
+    QSignalSpy sessionDisconnectedSpy(session, SIGNAL(disconnected()));
+    client.write("</stream:stream>");
+    client.close();
+    QCOMPARE(disconnectedSpy.count(), 1);
+    QCOMPARE(client.state(), QAbstractSocket::UnconnectedState);
+    waitForSignal(session, SIGNAL(disconnected()));
+    QCOMPARE(sessionDisconnectedSpy.count(), 1);
+    QVERIFY(readUntil(session, "</stream:stream>").endsWith("</stream:stream>"));
+}
+
+void tst_QXmppBosh::testUnknownSession()
+{
+    QTcpSocket *socket = connectSocket();
+    postBody(socket, "<body xmlns='http://jabber.org/protocol/httpbind' rid='100' sid='unknown'/>");
+    QCOMPARE(readBody(socket), QByteArray(
+        "<body xmlns='http://jabber.org/protocol/httpbind' type='terminate' condition='item-not-found'/>"));
+    QCOMPARE(server->sessionCount(), 0);
+}
+
+QTEST_MAIN(tst_QXmppBosh)
+#include "tst_qxmppbosh.moc"
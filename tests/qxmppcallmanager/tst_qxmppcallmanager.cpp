@@ -37,6 +37,7 @@ class tst_QXmppCallManager : public QObject
 
 private slots:
     void init();
+    void testCall_data();
     void testCall();
 
     void acceptCall(QXmppCall *call);
@@ -56,8 +57,18 @@ void tst_QXmppCallManager::acceptCall(QXmppCall *call)
     call->accept();
 }
 
+void tst_QXmppCallManager::testCall_data()
+{
+    QTest::addColumn<bool>("mediaThread");
+
+    QTest::newRow("main thread") << false;
+    QTest::newRow("media thread") << true;
+}
+
 void tst_QXmppCallManager::testCall()
 {
+    QFETCH(bool, mediaThread);
+
     const QString testDomain("localhost");
     const QHostAddress testHost(QHostAddress::LocalHost);
     const quint16 testPort = 12345;
@@ -78,6 +89,8 @@ void tst_QXmppCallManager::testCall()
     // prepare sender
     QXmppClient sender;
     QXmppCallManager *senderManager = new QXmppCallManager;
+    senderManager->setMediaThreadEnabled(mediaThread);
+    QCOMPARE(senderManager->isMediaThreadEnabled(), mediaThread);
     sender.addExtension(senderManager);
     sender.setLogger(&logger);
 
@@ -98,6 +111,7 @@ void tst_QXmppCallManager::testCall()
     // prepare receiver
     QXmppClient receiver;
     QXmppCallManager *receiverManager = new QXmppCallManager;
+    receiverManager->setMediaThreadEnabled(mediaThread);
     connect(receiverManager, SIGNAL(callReceived(QXmppCall*)),
             this, SLOT(acceptCall(QXmppCall*)));
     receiver.addExtension(receiverManager);
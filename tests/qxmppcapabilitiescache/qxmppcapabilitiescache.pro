@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppcapabilitiescache
+SOURCES += tst_qxmppcapabilitiescache.cpp
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDir>
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppCapabilitiesCache.h"
+#include "util.h"
+
+static const char *exodusNode = "http://code.google.com/p/exodus";
+
+class tst_QXmppCapabilitiesCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testInsert();
+    void testSaveLoad();
+
+private:
+    QXmppDiscoveryIq exodusInfo() const;
+};
+
+QXmppDiscoveryIq tst_QXmppCapabilitiesCache::exodusInfo() const
+{
+    const QByteArray xml(
+        "<iq id=\"disco1\" from=\"benvolio@capulet.lit/230193\" type=\"result\">"
+        "<query xmlns=\"http://jabber.org/protocol/disco#info\">"
+        "<identity category=\"client\" name=\"Exodus 0.9.1\" type=\"pc\"/>"
+        "<feature var=\"http://jabber.org/protocol/caps\"/>"
+        "<feature var=\"http://jabber.org/protocol/disco#info\"/>"
+        "<feature var=\"http://jabber.org/protocol/disco#items\"/>"
+        "<feature var=\"http://jabber.org/protocol/muc\"/>"
+        "</query>"
+        "</iq>");
+
+    QXmppDiscoveryIq disco;
+    parsePacket(disco, xml);
+    return disco;
+}
+
+void tst_QXmppCapabilitiesCache::testInsert()
+{
+    const QByteArray ver = QByteArray::fromBase64("QgayPKawpkPSDYmwT/WM94uAlu0=");
+    const QXmppDiscoveryIq info = exodusInfo();
+
+    QXmppCapabilitiesCache cache;
+    QVERIFY(!cache.contains(exodusNode, ver, "sha-1"));
+
+    // mismatching verification strings and unknown hashes are rejected
+    QVERIFY(!cache.insert(exodusNode, QByteArray("bogus"), "sha-1", info));
+    QVERIFY(!cache.insert(exodusNode, ver, "md5", info));
+    QVERIFY(!cache.contains(exodusNode, ver, "md5"));
+
+    QVERIFY(cache.insert(exodusNode, ver, "sha-1", info));
+    QVERIFY(cache.contains(exodusNode, ver, "sha-1"));
+
+    const QXmppDiscoveryIq cached = cache.info(exodusNode, ver, "sha-1");
+    QCOMPARE(cached.features(), info.features());
+    QCOMPARE(cached.identities().size(), 1);
+    QCOMPARE(cached.verificationString(), ver);
+}
+
+void tst_QXmppCapabilitiesCache::testSaveLoad()
+{
+    const QByteArray ver = QByteArray::fromBase64("QgayPKawpkPSDYmwT/WM94uAlu0=");
+    const QString path = QDir::temp().filePath("tst_qxmppcapabilitiescache.dat");
+
+    QXmppCapabilitiesCache cache;
+    QVERIFY(cache.insert(exodusNode, ver, "sha-1", exodusInfo()));
+    QVERIFY(cache.save(path));
+
+    QXmppCapabilitiesCache loaded;
+    QVERIFY(loaded.load(path));
+    QVERIFY(loaded.contains(exodusNode, ver, "sha-1"));
+    QCOMPARE(loaded.info(exodusNode, ver, "sha-1").verificationString(), ver);
+    QFile::remove(path);
+
+    QVERIFY(!loaded.load(path));
+}
+
+QTEST_MAIN(tst_QXmppCapabilitiesCache)
+#include "tst_qxmppcapabilitiescache.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppcertificatecache
+SOURCES += tst_qxmppcertificatecache.cpp
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+#include <QSslCertificate>
+
+#include "QXmppCertificateCache_p.h"
+#include "util.h"
+
+// self-signed certificates valid until 2046, and one which expired in 2001
+static const char firstPem[] =
+    "-----BEGIN CERTIFICATE-----\n"
+    "MIICDDCCAXWgAwIBAgIUa+mPOeOTKRmW1SYaKlEIfvOi4pwwDQYJKoZIhvcNAQEL\n"
+    "BQAwGDEWMBQGA1UEAwwNYS5leGFtcGxlLmNvbTAeFw0yNjEwMTUwNDQ2MDlaFw00\n"
+    "NjEwMTAwNDQ2MDlaMBgxFjAUBgNVBAMMDWEuZXhhbXBsZS5jb20wgZ8wDQYJKoZI\n"
+    "hvcNAQEBBQADgY0AMIGJAoGBANik/l8XPHBxSG9KHsaaIiUdjIBArOxB76yyrBMF\n"
+    "D4mKmQTP1aKn+rTbqcAQTbae3GgXaF9DtZSWJ6+T8xw0TPZSYsGeSuJjnoy6K8aY\n"
+    "VFb4X5kZueKsyPb8I1UzhgEoH74YdSyvKNfCoMBftcm5V5wX1Bh7TZSJTYyyfTqR\n"
+    "GsPHAgMBAAGjUzBRMB0GA1UdDgQWBBSK7JsLF34RelDtzrGj35BBmqjZ3jAfBgNV\n"
+    "HSMEGDAWgBSK7JsLF34RelDtzrGj35BBmqjZ3jAPBgNVHRMBAf8EBTADAQH/MA0G\n"
+    "CSqGSIb3DQEBCwUAA4GBAJ0QQ3Y3rmktKzMLlaPy+SYDQ7xUOFyhsrqioap4YXCU\n"
+    "VEWCwUDSwMdpQuNfSgjpOvyzW3gF5a3oNhQ+NLhuqDfQNbkuad0HYocMSUAufgjp\n"
+    "u4qp+IhLU4FCkLiXpCeb1iwJlcuMP6IsORl+FVQzk4gTIYttbEw0m8FaQDaqdqUH\n"
+    "-----END CERTIFICATE-----\n";
+
+static const char secondPem[] =
+    "-----BEGIN CERTIFICATE-----\n"
+    "MIICDDCCAXWgAwIBAgIUROWN5jVtthcVZO6CcGzaIxX89+UwDQYJKoZIhvcNAQEL\n"
+    "BQAwGDEWMBQGA1UEAwwNYi5leGFtcGxlLmNvbTAeFw0yNjEwMTUwNDQ2MDlaFw00\n"
+    "NjEwMTAwNDQ2MDlaMBgxFjAUBgNVBAMMDWIuZXhhbXBsZS5jb20wgZ8wDQYJKoZI\n"
+    "hvcNAQEBBQADgY0AMIGJAoGBALK+VgMt7a61IM4JCfJ/SFB6AAvQxoVannSWf8TF\n"
+    "WanK/0P92BgXAWEpd8szJvK6PJNPrciUJHpsF58FaY4pN50tmofDmd0zr2NbasmD\n"
+    "nkCom7zTomCVHf9D9iXab6gUTIr0QP6bE2h36iDqGTTugQbjFLpfWHgDEhnCC+IR\n"
+    "lFH5AgMBAAGjUzBRMB0GA1UdDgQWBBQWqBDE0xZKveK046WZciqIrv8y7DAfBgNV\n"
+    "HSMEGDAWgBQWqBDE0xZKveK046WZciqIrv8y7DAPBgNVHRMBAf8EBTADAQH/MA0G\n"
+    "CSqGSIb3DQEBCwUAA4GBADgkNhNqoLjjuMwDaQy3Lj6133nN/+go9pwoKHw3Kvsm\n"
+    "eXQa+tckDX/KIhfH6rHrBgxuuh0ADG4X496myEcDkjwl3cPRHWkCikYeS4eyCA1B\n"
+    "pHomPh71wU2EFzY6XIyg2twGPjwrYRkkpRln8MZz3PCu404HUMlKbjLNglIRl91X\n"
+    "-----END CERTIFICATE-----\n";
+
+static const char expiredPem[] =
+    "-----BEGIN CERTIFICATE-----\n"
+    "MIIBozCCAQwCAQEwDQYJKoZIhvcNAQELBQAwGjEYMBYGA1UEAwwPb2xkLmV4YW1w\n"
+    "bGUuY29tMB4XDTAwMDEwMTAwMDAwMFoXDTAxMDEwMTAwMDAwMFowGjEYMBYGA1UE\n"
+    "AwwPb2xkLmV4YW1wbGUuY29tMIGfMA0GCSqGSIb3DQEBAQUAA4GNADCBiQKBgQCY\n"
+    "vbiTyh59KGaAtv+dMXcpRvQX6jw5eNVNYhKhyfPe5OzC9noRl9o0WDgSciexNW1q\n"
+    "C4H/Ix5NCMkS0LY130QUw2IFtnXkx093OvHVQSEjRv85HTVRkPyJIfLeMbyW5d/O\n"
+    "+QCsNYf6D2Qfpt1hIzoyzDsRrZrVPjHuGXqRLriaawIDAQABMA0GCSqGSIb3DQEB\n"
+    "CwUAA4GBADSyGkk17OEgAG4+taaFfeqYlLBihT7qj5/tRYcdvWaA/+xmz682Ka7x\n"
+    "FAa+SWgKvHswVSlXnnRb2C9cwRnr80O3uLjVwREImCeMTy9R434fapv5TL8pvd2p\n"
+    "FKnoNPz2nq3D6frg/Uzl8yEz+FkUpSOXhVFVZkf/Pw8A7RVKfkNC\n"
+    "-----END CERTIFICATE-----\n";
+
+class tst_QXmppCertificateCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void testExpired();
+    void testInsert();
+    void testRemove();
+
+private:
+    QSslCertificate first;
+    QSslCertificate second;
+    QSslCertificate expired;
+};
+
+void tst_QXmppCertificateCache::initTestCase()
+{
+    first = QSslCertificate(QByteArray(firstPem));
+    second = QSslCertificate(QByteArray(secondPem));
+    expired = QSslCertificate(QByteArray(expiredPem));
+    QVERIFY(!first.isNull());
+    QVERIFY(!second.isNull());
+    QVERIFY(!expired.isNull());
+}
+
+void tst_QXmppCertificateCache::testExpired()
+{
+    QXmppCertificateCache cache;
+    QVERIFY(!cache.insert("example.com", expired, 3600));
+    QVERIFY(!cache.insert("example.com", first, 0));
+    QVERIFY(!cache.insert("example.com", QSslCertificate(), 3600));
+    QVERIFY(!cache.contains("example.com"));
+    QCOMPARE(cache.size(), 0);
+}
+
+void tst_QXmppCertificateCache::testInsert()
+{
+    QXmppCertificateCache cache;
+    QVERIFY(!cache.contains("example.com"));
+    QVERIFY(!cache.isVerified("example.com", first));
+
+    QVERIFY(cache.insert("example.com", first, 3600));
+    QVERIFY(cache.contains("example.com"));
+    QVERIFY(cache.isVerified("example.com", first));
+    QCOMPARE(cache.size(), 1);
+
+    // the entry is bound to both the certificate and the domain
+    QVERIFY(!cache.isVerified("example.com", second));
+    QVERIFY(!cache.isVerified("example.org", first));
+    QVERIFY(!cache.contains("example.org"));
+
+    // inserting the same certificate again refreshes its entry
+    QVERIFY(cache.insert("example.com", first, 3600));
+    QCOMPARE(cache.size(), 1);
+
+    // a domain can have several certificates
+    QVERIFY(cache.insert("example.com", second, 3600));
+    QVERIFY(cache.isVerified("example.com", first));
+    QVERIFY(cache.isVerified("example.com", second));
+    QCOMPARE(cache.size(), 2);
+}
+
+void tst_QXmppCertificateCache::testRemove()
+{
+    QXmppCertificateCache cache;
+    QVERIFY(cache.insert("example.com", first, 3600));
+    QVERIFY(cache.insert("example.org", second, 3600));
+
+    cache.remove("example.com");
+    QVERIFY(!cache.contains("example.com"));
+    QVERIFY(!cache.isVerified("example.com", first));
+    QVERIFY(cache.isVerified("example.org", second));
+    QCOMPARE(cache.size(), 1);
+}
+
+QTEST_MAIN(tst_QXmppCertificateCache)
+#include "tst_qxmppcertificatecache.moc"
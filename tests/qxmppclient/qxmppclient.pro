@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppclient
+SOURCES += tst_qxmppclient.cpp
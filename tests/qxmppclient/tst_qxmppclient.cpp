@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "QXmppClient.h"
+#include "QXmppConfiguration.h"
+#include "QXmppDiscoveryManager.h"
+#include "QXmppEntityTimeManager.h"
+#include "QXmppPEPManager.h"
+#include "QXmppRosterManager.h"
+#include "QXmppVCardManager.h"
+#include "QXmppVersionManager.h"
+#include "util.h"
+
+class tst_QXmppClient : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testDefaultExtensions();
+    void testSelectedExtensions();
+    void testLazyExtensions();
+    void testScramBareSuccess();
+};
+
+void tst_QXmppClient::testDefaultExtensions()
+{
+    QXmppClient client;
+    QCOMPARE(client.extensions().size(), 6);
+    QVERIFY(client.findExtension<QXmppRosterManager>());
+    QVERIFY(client.findExtension<QXmppVCardManager>());
+    QVERIFY(client.findExtension<QXmppVersionManager>());
+    QVERIFY(client.findExtension<QXmppEntityTimeManager>());
+    QVERIFY(client.findExtension<QXmppDiscoveryManager>());
+    QVERIFY(client.findExtension<QXmppPEPManager>());
+}
+
+void tst_QXmppClient::testSelectedExtensions()
+{
+    QXmppClient bare(QXmppClient::NoExtensions);
+    QVERIFY(bare.extensions().isEmpty());
+
+    QXmppClient client(QXmppClient::DiscoveryExtension | QXmppClient::VersionExtension);
+    QCOMPARE(client.extensions().size(), 2);
+    QVERIFY(qobject_cast<QXmppVersionManager*>(client.extensions().at(0)));
+    QVERIFY(qobject_cast<QXmppDiscoveryManager*>(client.extensions().at(1)));
+    QVERIFY(!client.findExtension<QXmppRosterManager>());
+
+    // sending a message does not need a roster
+    client.sendMessage("foo@example.com", "hello");
+    QVERIFY(!client.findExtension<QXmppRosterManager>());
+}
+
+void tst_QXmppClient::testLazyExtensions()
+{
+    QXmppClient client(QXmppClient::NoExtensions);
+
+    QXmppRosterManager *roster = &client.rosterManager();
+    QCOMPARE(client.extensions().size(), 1);
+    QCOMPARE(client.findExtension<QXmppRosterManager>(), roster);
+    QCOMPARE(&client.rosterManager(), roster);
+    QCOMPARE(client.extensions().size(), 1);
+
+    client.vCardManager();
+    client.versionManager();
+    client.pepManager();
+    QCOMPARE(client.extensions().size(), 4);
+    QVERIFY(client.findExtension<QXmppVCardManager>());
+    QVERIFY(client.findExtension<QXmppVersionManager>());
+    QVERIFY(client.findExtension<QXmppPEPManager>());
+    QVERIFY(!client.findExtension<QXmppDiscoveryManager>());
+}
+
+static bool waitForData(QTcpSocket *socket, QByteArray &buffer, const QByteArray &marker)
+{
+    for (int i = 0; i < 100 && !buffer.contains(marker); ++i) {
+        QTest::qWait(20);
+        buffer += socket->readAll();
+    }
+    return buffer.contains(marker);
+}
+
+void tst_QXmppClient::testScramBareSuccess()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost, 12401));
+
+    QXmppConfiguration config;
+    config.setHost("127.0.0.1");
+    config.setPort(12401);
+    config.setDomain("example.com");
+    config.setUser("user");
+    config.setPassword("pencil");
+    config.setResource("test");
+    config.setSaslAuthMechanism("SCRAM-SHA-1");
+    config.setStreamSecurityMode(QXmppConfiguration::TLSDisabled);
+
+    QXmppClient client(QXmppClient::NoExtensions);
+    QSignalSpy connectedSpy(&client, SIGNAL(connected()));
+    client.connectToServer(config);
+
+    for (int i = 0; i < 50 && !server.hasPendingConnections(); ++i)
+        QTest::qWait(20);
+    QTcpSocket *socket = server.nextPendingConnection();
+    QVERIFY(socket);
+
+    QByteArray buffer;
+    QVERIFY(waitForData(socket, buffer, "<stream:stream"));
+    buffer.clear();
+    socket->write("<?xml version='1.0'?>"
+        "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' id='s1' from='example.com' version='1.0'>"
+        "<stream:features>"
+        "<mechanisms xmlns='urn:ietf:params:xml:ns:xmpp-sasl'><mechanism>SCRAM-SHA-1</mechanism></mechanisms>"
+        "</stream:features>");
+
+    // answer the client-first message with a valid server-first message
+    QVERIFY(waitForData(socket, buffer, "</auth>"));
+    QRegExp authRx("<auth[^>]*>([^<]*)</auth>");
+    QVERIFY(authRx.indexIn(QString::fromLatin1(buffer)) >= 0);
+    const QByteArray clientFirst = QByteArray::fromBase64(authRx.cap(1).toLatin1());
+    const QByteArray clientNonce = clientFirst.mid(clientFirst.indexOf(",r=") + 3);
+    QVERIFY(!clientNonce.isEmpty());
+    buffer.clear();
+
+    const QByteArray serverFirst = "r=" + clientNonce + "server,s=" + QByteArray("salt").toBase64() + ",i=4096";
+    socket->write("<challenge xmlns='urn:ietf:params:xml:ns:xmpp-sasl'>" + serverFirst.toBase64() + "</challenge>");
+
+    // answer the client-final message with a bare success
+    QVERIFY(waitForData(socket, buffer, "</response>"));
+    socket->write("<success xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>");
+
+    // the client must refuse the unverified server
+    for (int i = 0; i < 100 && socket->state() == QAbstractSocket::ConnectedState; ++i)
+        QTest::qWait(20);
+    QCOMPARE(socket->state(), QAbstractSocket::UnconnectedState);
+    QCOMPARE(connectedSpy.size(), 0);
+    QVERIFY(!client.isAuthenticated());
+}
+
+QTEST_MAIN(tst_QXmppClient)
+#include "tst_qxmppclient.moc"
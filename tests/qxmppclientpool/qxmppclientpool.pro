@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppclientpool
+SOURCES += tst_qxmppclientpool.cpp
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QPointer>
+#include <QtTest>
+
+#include "QXmppClient.h"
+#include "QXmppClientPool.h"
+
+class tst_QXmppClientPool : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testThreads_data();
+    void testThreads();
+    void testRemoveClient();
+};
+
+void tst_QXmppClientPool::testThreads_data()
+{
+    QTest::addColumn<int>("threadCount");
+    QTest::addColumn<int>("expectedThreads");
+
+    QTest::newRow("none") << 0 << 1;
+    QTest::newRow("two") << 2 << 2;
+}
+
+void tst_QXmppClientPool::testThreads()
+{
+    QFETCH(int, threadCount);
+    QFETCH(int, expectedThreads);
+
+    QXmppClientPool pool;
+    pool.setThreadCount(threadCount);
+    QCOMPARE(pool.threadCount(), threadCount);
+
+    QSet<QThread*> threads;
+    for (int i = 0; i < 4; ++i) {
+        QXmppClient *client = new QXmppClient;
+        pool.addClient(client);
+        threads << client->thread();
+    }
+    QCOMPARE(pool.clients().size(), 4);
+    QCOMPARE(threads.size(), expectedThreads);
+    QCOMPARE(threads.contains(pool.thread()), threadCount == 0);
+
+    // the thread count cannot change once clients were added
+    pool.setThreadCount(threadCount + 1);
+    QCOMPARE(pool.threadCount(), threadCount);
+}
+
+void tst_QXmppClientPool::testRemoveClient()
+{
+    QXmppClientPool pool;
+    pool.setThreadCount(1);
+
+    QXmppClient *client = new QXmppClient;
+    QPointer<QXmppClient> guard(client);
+    pool.addClient(client);
+    QVERIFY(client->thread() != pool.thread());
+
+    pool.removeClient(client);
+    QVERIFY(pool.clients().isEmpty());
+    QVERIFY(guard.isNull());
+}
+
+QTEST_MAIN(tst_QXmppClientPool)
+#include "tst_qxmppclientpool.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppcluster
+SOURCES += tst_qxmppcluster.cpp
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppCluster_p.h"
+#include "QXmppJid.h"
+
+static const quint16 testPort = 12370;
+
+// Waits until \a spy has caught at least \a count signals.
+static bool waitForSignals(QSignalSpy &spy, int count = 1)
+{
+    for (int i = 0; i < 50 && spy.count() < count; ++i)
+        QTest::qWait(50);
+    return spy.count() >= count;
+}
+
+// Waits until routing to \a jid through \a cluster gives \a expected.
+static bool waitForRoute(QXmppCluster *cluster, const QString &jid, bool expected)
+{
+    for (int i = 0; i < 50; ++i) {
+        if (cluster->route(QXmppJid(jid), QByteArray()) == expected)
+            return true;
+        QTest::qWait(50);
+    }
+    return false;
+}
+
+class tst_QXmppCluster : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testForward();
+    void testSnapshot();
+    void testWrongSecret();
+};
+
+void tst_QXmppCluster::testForward()
+{
+    QXmppCluster node1, node2;
+    node1.setNodeName("node1");
+    node1.setSecret("secret");
+    node2.setNodeName("node2");
+    node2.setSecret("secret");
+    QVERIFY(node2.listen(QHostAddress::LocalHost, testPort));
+
+    QSignalSpy connected1(&node1, SIGNAL(nodeConnected(QString)));
+    QSignalSpy connected2(&node2, SIGNAL(nodeConnected(QString)));
+    node1.addNode("node2", "127.0.0.1", testPort);
+    QVERIFY(waitForSignals(connected1));
+    QVERIFY(waitForSignals(connected2));
+    QCOMPARE(node1.connectedNodes(), QStringList() << "node2");
+    QCOMPARE(node2.connectedNodes(), QStringList() << "node1");
+
+    // nothing is bound yet
+    QVERIFY(!node1.route(QXmppJid("user@localhost/res"), QByteArray("<message/>")));
+
+    // the session bound on node2 becomes routable from node1
+    node2.bindSession("user@localhost/res");
+    QVERIFY(waitForRoute(&node1, "user@localhost/res", true));
+    QVERIFY(!node1.route(QXmppJid("user@localhost/other"), QByteArray("<message/>")));
+
+    QSignalSpy received(&node2, SIGNAL(stanzaReceived(QString,QByteArray)));
+    const QByteArray data("<message to='user@localhost'><body>Hello</body></message>");
+    QVERIFY(node1.route(QXmppJid("user@localhost"), data));
+    QVERIFY(waitForSignals(received));
+    QCOMPARE(received.last().at(0).toString(), QLatin1String("user@localhost"));
+    QCOMPARE(received.last().at(1).toByteArray(), data);
+
+    // the session goes away
+    node2.unbindSession("user@localhost/res");
+    QVERIFY(waitForRoute(&node1, "user@localhost", false));
+
+    // the sessions of a lost node are forgotten
+    node2.bindSession("user@localhost/res");
+    QVERIFY(waitForRoute(&node1, "user@localhost/res", true));
+    QSignalSpy disconnected1(&node1, SIGNAL(nodeDisconnected(QString)));
+    node2.close();
+    QVERIFY(waitForSignals(disconnected1));
+    QVERIFY(!node1.route(QXmppJid("user@localhost/res"), data));
+    QCOMPARE(node1.connectedNodes(), QStringList());
+}
+
+void tst_QXmppCluster::testSnapshot()
+{
+    QXmppCluster node1, node2;
+    node1.setNodeName("node1");
+    node2.setNodeName("node2");
+    QVERIFY(node1.listen(QHostAddress::LocalHost, testPort));
+
+    // sessions bound before the link is established
+    node1.bindSession("user@localhost/res1");
+    node2.bindSession("user@localhost/res2");
+
+    QSignalSpy connected1(&node1, SIGNAL(nodeConnected(QString)));
+    QSignalSpy connected2(&node2, SIGNAL(nodeConnected(QString)));
+
+    // node2 sorts last, so it waits for node1 to connect
+    node2.addNode("node1", "127.0.0.1", testPort);
+    QTest::qWait(200);
+    QCOMPARE(connected2.count(), 0);
+
+    QVERIFY(node2.listen(QHostAddress::LocalHost, testPort + 1));
+    node1.addNode("node2", "127.0.0.1", testPort + 1);
+    QVERIFY(waitForSignals(connected1));
+    QVERIFY(waitForSignals(connected2));
+
+    QVERIFY(waitForRoute(&node1, "user@localhost/res2", true));
+    QVERIFY(waitForRoute(&node2, "user@localhost/res1", true));
+}
+
+void tst_QXmppCluster::testWrongSecret()
+{
+    QXmppCluster node1, node2;
+    node1.setNodeName("node1");
+    node1.setSecret("secret");
+    node2.setNodeName("node2");
+    node2.setSecret("other");
+    QVERIFY(node2.listen(QHostAddress::LocalHost, testPort));
+    node2.bindSession("user@localhost/res");
+
+    QSignalSpy connected1(&node1, SIGNAL(nodeConnected(QString)));
+    QSignalSpy connected2(&node2, SIGNAL(nodeConnected(QString)));
+    node1.addNode("node2", "127.0.0.1", testPort);
+    QTest::qWait(500);
+    QCOMPARE(connected1.count(), 0);
+    QCOMPARE(connected2.count(), 0);
+    QVERIFY(!node1.route(QXmppJid("user@localhost/res"), QByteArray("<message/>")));
+}
+
+QTEST_MAIN(tst_QXmppCluster)
+#include "tst_qxmppcluster.moc"
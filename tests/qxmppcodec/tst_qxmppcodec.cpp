@@ -22,18 +22,249 @@
  */
 
 #include <QObject>
+#include <QtEndian>
 #include <QtTest>
+#include <qmath.h>
 #include "QXmppCodec_p.h"
+#include "QXmppRtpPacket.h"
+
+#ifdef QXMPP_USE_OPUS
+#include <opus/opus.h>
+#endif
 
 class tst_QXmppCodec : public QObject
 {
     Q_OBJECT
 
 private slots:
+    void testG711a();
+    void testG711u();
+    void testG711Stream();
+    void testG711Frame();
+    void testOpus();
+    void testOpusControls();
+    void testSpeexFrame();
     void testTheoraDecoder();
     void testTheoraEncoder();
+    void testTheoraPackets();
+    void testVideoFramePool();
+    void testVideoPacketBuffer();
+    void testVideoFragmentBuffer();
+    void testVideoConverterPacked();
+    void testVideoConverterRgb();
+    void testVideoConverterScale();
 };
 
+void tst_QXmppCodec::testG711a()
+{
+    quint8 codes[256];
+    for (int i = 0; i < 256; ++i)
+        codes[i] = i;
+
+    qint16 pcm[256];
+    QXmppG711aCodec::decode(codes, pcm, 256);
+    QCOMPARE(pcm[0xd5], qint16(8));
+    QCOMPARE(pcm[0x55], qint16(-8));
+    QCOMPARE(pcm[0xaa], qint16(32256));
+    QCOMPARE(pcm[0x2a], qint16(-32256));
+
+    // every code survives a round trip
+    quint8 encoded[256];
+    QXmppG711aCodec::encode(pcm, encoded, 256);
+    for (int i = 0; i < 256; ++i)
+        QCOMPARE(encoded[i], codes[i]);
+
+    // extreme values
+    const qint16 extremes[] = { 0, 32767, -32768 };
+    QXmppG711aCodec::encode(extremes, encoded, 3);
+    QCOMPARE(encoded[0], quint8(0xd5));
+    QCOMPARE(encoded[1], quint8(0xaa));
+    QCOMPARE(encoded[2], quint8(0x2a));
+}
+
+void tst_QXmppCodec::testG711u()
+{
+    quint8 codes[256];
+    for (int i = 0; i < 256; ++i)
+        codes[i] = i;
+
+    qint16 pcm[256];
+    QXmppG711uCodec::decode(codes, pcm, 256);
+    QCOMPARE(pcm[0xff], qint16(0));
+    QCOMPARE(pcm[0x7f], qint16(0));
+    QCOMPARE(pcm[0x80], qint16(32124));
+    QCOMPARE(pcm[0x00], qint16(-32124));
+
+    // every code but negative zero survives a round trip
+    quint8 encoded[256];
+    QXmppG711uCodec::encode(pcm, encoded, 256);
+    for (int i = 0; i < 256; ++i) {
+        if (i != 0x7f)
+            QCOMPARE(encoded[i], codes[i]);
+    }
+    QCOMPARE(encoded[0x7f], quint8(0xff));
+
+    // extreme values
+    const qint16 extremes[] = { 0, 32767, -32768 };
+    QXmppG711uCodec::encode(extremes, encoded, 3);
+    QCOMPARE(encoded[0], quint8(0xff));
+    QCOMPARE(encoded[1], quint8(0x80));
+    QCOMPARE(encoded[2], quint8(0x00));
+}
+
+void tst_QXmppCodec::testG711Stream()
+{
+    // the stream interface handles the stream's byte order
+    QByteArray pcm;
+    QDataStream pcmStream(&pcm, QIODevice::WriteOnly);
+    pcmStream.setByteOrder(QDataStream::LittleEndian);
+    pcmStream << qint16(8) << qint16(-8) << qint16(32256);
+
+    QXmppG711aCodec codec(8000);
+    QByteArray encoded;
+    QDataStream input(pcm);
+    input.setByteOrder(QDataStream::LittleEndian);
+    QDataStream output(&encoded, QIODevice::WriteOnly);
+    QCOMPARE(codec.encode(input, output), qint64(3));
+    QCOMPARE(encoded, QByteArray::fromHex("d555aa"));
+
+    QByteArray decoded;
+    QDataStream encodedInput(encoded);
+    QDataStream decodedOutput(&decoded, QIODevice::WriteOnly);
+    decodedOutput.setByteOrder(QDataStream::LittleEndian);
+    QCOMPARE(codec.decode(encodedInput, decodedOutput), qint64(3));
+    QCOMPARE(decoded, pcm);
+}
+
+void tst_QXmppCodec::testG711Frame()
+{
+    // samples are encoded in place, in any number
+    const qint16 pcm[] = { 8, -8, 32256 };
+    QXmppG711aCodec codec(8000);
+    QCOMPARE(codec.frameSamples(), 0);
+
+    uchar encoded[3];
+    QCOMPARE(codec.encodeFrame(pcm, 3, encoded, sizeof(encoded)), 3);
+    QCOMPARE(QByteArray(reinterpret_cast<const char*>(encoded), 3), QByteArray::fromHex("d555aa"));
+
+    // the output buffer is too small
+    QCOMPARE(codec.encodeFrame(pcm, 3, encoded, 2), -1);
+
+    // the encoder has no controls
+    QVERIFY(!codec.setBitrate(32000));
+    QVERIFY(!codec.setComplexity(5));
+    QVERIFY(!codec.setForwardErrorCorrection(true));
+    QVERIFY(!codec.setPacketLossPercentage(10));
+}
+
+void tst_QXmppCodec::testOpus()
+{
+#ifdef QXMPP_USE_OPUS
+    const int frameSamples = 960;
+    QXmppOpusCodec encoder(48000, 1);
+    QXmppOpusCodec decoder(48000, 1);
+
+    QList<QByteArray> packets;
+    for (int i = 0; i < 10; ++i) {
+        QByteArray pcm(frameSamples * 2, 0);
+        for (int j = 0; j < frameSamples; ++j)
+            qToLittleEndian<qint16>(qint16(8000 * qSin(2 * 3.14159265 * 440 * (i * frameSamples + j) / 48000.0)), (uchar*)pcm.data() + 2 * j);
+
+        QDataStream input(pcm);
+        QByteArray packet;
+        QDataStream output(&packet, QIODevice::WriteOnly);
+        QCOMPARE(encoder.encode(input, output), qint64(frameSamples));
+        QVERIFY(!packet.isEmpty());
+        packets << packet;
+    }
+
+    // decode a packet
+    QByteArray decoded;
+    QDataStream output(&decoded, QIODevice::WriteOnly);
+    QDataStream input(packets[0]);
+    QCOMPARE(decoder.decode(input, output), qint64(frameSamples));
+    QCOMPARE(decoded.size(), frameSamples * 2);
+
+    // recover two lost frames using the next packet's FEC data
+    QByteArray recovered;
+    QDataStream recoveredOutput(&recovered, QIODevice::WriteOnly);
+    QDataStream recoveredInput(packets[3]);
+    QCOMPARE(decoder.recover(recoveredInput, recoveredOutput, 2 * frameSamples), qint64(2 * frameSamples));
+    QCOMPARE(recovered.size(), 2 * frameSamples * 2);
+#endif
+}
+
+void tst_QXmppCodec::testOpusControls()
+{
+#ifdef QXMPP_USE_OPUS
+    QXmppOpusCodec codec(48000, 1);
+    QCOMPARE(codec.bitrate(), OPUS_AUTO);
+    QCOMPARE(codec.complexity(), 10);
+    QVERIFY(codec.forwardErrorCorrection());
+    QCOMPARE(codec.packetLossPercentage(), 20);
+
+    QVERIFY(codec.setBitrate(16000));
+    QVERIFY(codec.setComplexity(3));
+    QVERIFY(codec.setForwardErrorCorrection(false));
+    QVERIFY(codec.setPacketLossPercentage(5));
+    QVERIFY(!codec.setComplexity(11));
+    QCOMPARE(codec.bitrate(), 16000);
+    QCOMPARE(codec.complexity(), 3);
+    QVERIFY(!codec.forwardErrorCorrection());
+    QCOMPARE(codec.packetLossPercentage(), 5);
+
+    // frames are still encoded with the new controls
+    QVector<qint16> pcm(960);
+    for (int i = 0; i < pcm.size(); ++i)
+        pcm[i] = qint16(8000 * qSin(2 * 3.14159265 * 440 * i / 48000.0));
+    uchar encoded[4000];
+    QVERIFY(codec.encodeFrame(pcm.constData(), pcm.size(), encoded, sizeof(encoded)) > 0);
+
+    // a codec given back to the pool is reset to the defaults
+    codec.reset();
+    QCOMPARE(codec.bitrate(), OPUS_AUTO);
+    QCOMPARE(codec.complexity(), 10);
+    QVERIFY(codec.forwardErrorCorrection());
+    QCOMPARE(codec.packetLossPercentage(), 20);
+#endif
+}
+
+void tst_QXmppCodec::testSpeexFrame()
+{
+#ifdef QXMPP_USE_SPEEX
+    QXmppSpeexCodec encoder(8000);
+    QXmppSpeexCodec decoder(8000);
+    QCOMPARE(encoder.frameSamples(), 160);
+    QVERIFY(encoder.discontinuousTransmission());
+
+    // two frames of tone are packed in a packet
+    QVector<qint16> pcm(320);
+    for (int i = 0; i < pcm.size(); ++i)
+        pcm[i] = qint16(8000 * qSin(2 * 3.14159265 * 440 * i / 8000.0));
+    QByteArray packet(2000, 0);
+    const int length = encoder.encodeFrame(pcm.constData(), pcm.size(), reinterpret_cast<uchar*>(packet.data()), packet.size());
+    QVERIFY(length > 0);
+    packet.resize(length);
+
+    QByteArray decoded;
+    QDataStream input(packet);
+    QDataStream output(&decoded, QIODevice::WriteOnly);
+    QCOMPARE(decoder.decode(input, output), qint64(320));
+
+    // the samples must be whole frames
+    QCOMPARE(encoder.encodeFrame(pcm.constData(), 100, reinterpret_cast<uchar*>(packet.data()), 2000), -1);
+
+    // once the encoder has detected silence, nothing is transmitted
+    QVector<qint16> silence(160, 0);
+    int silent = 0;
+    for (int i = 0; i < 50; ++i) {
+        if (!encoder.encodeFrame(silence.constData(), silence.size(), reinterpret_cast<uchar*>(packet.data()), 2000))
+            silent++;
+    }
+    QVERIFY(silent > 0);
+#endif
+}
+
 void tst_QXmppCodec::testTheoraDecoder()
 {
 #ifdef QXMPP_USE_THEORA
@@ -66,5 +297,215 @@ void tst_QXmppCodec::testTheoraEncoder()
 #endif
 }
 
+void tst_QXmppCodec::testTheoraPackets()
+{
+#ifdef QXMPP_USE_THEORA
+    QXmppVideoFormat format;
+    format.setFrameSize(QSize(320, 240));
+    format.setPixelFormat(QXmppVideoFrame::Format_YUV420P);
+
+    QXmppTheoraEncoder encoder;
+    QVERIFY(encoder.setFormat(format));
+
+    QXmppTheoraDecoder decoder;
+    QVERIFY(decoder.setParameters(encoder.parameters()));
+
+    // the packets of each frame are decoded back to a frame
+    QXmppVideoPacketBuffer packets;
+    QXmppVideoFrame frame(320 * 240 * 3 / 2, format.frameSize(), 320, QXmppVideoFrame::Format_YUV420P);
+    for (int i = 0; i < 2; ++i) {
+        packets.clear();
+        encoder.handleFrame(frame, &packets);
+        QVERIFY(packets.count() > 0);
+
+        QList<QXmppVideoFrame> frames;
+        for (int j = 0; j < packets.count(); ++j) {
+            QXmppRtpPacket packet;
+            packet.setSequence(j);
+            packet.setPayload(packets.payload(j));
+            frames << decoder.handlePacket(packet);
+        }
+        QCOMPARE(frames.size(), 1);
+        QCOMPARE(frames[0].size(), format.frameSize());
+    }
+#endif
+}
+
+static const uchar *constBits(const QXmppVideoFrame &frame)
+{
+    // avoid QXmppVideoFrame::bits() detaching the buffer
+    return frame.bits();
+}
+
+void tst_QXmppCodec::testVideoFramePool()
+{
+    const QSize size(32, 16);
+    const int bytes = 32 * 16 * 3 / 2;
+    QXmppVideoFramePool pool(2);
+
+    // a released buffer is reused
+    QXmppVideoFrame frame = pool.frame(bytes, size, 32, QXmppVideoFrame::Format_YUV420P);
+    QVERIFY(frame.isValid());
+    QCOMPARE(frame.mappedBytes(), bytes);
+    const uchar *bits = constBits(frame);
+    frame = QXmppVideoFrame();
+
+    frame = pool.frame(bytes, size, 32, QXmppVideoFrame::Format_YUV420P);
+    QVERIFY(constBits(frame) == bits);
+    QCOMPARE(frame.size(), size);
+
+    // writing through the pool is visible in the returned frame
+    QXmppVideoFramePool::bits(frame)[0] = 0x42;
+    QCOMPARE(int(constBits(frame)[0]), 0x42);
+
+    // a buffer which is still in use is not handed out again
+    QXmppVideoFrame other = pool.frame(bytes, size, 32, QXmppVideoFrame::Format_YUV420P);
+    QVERIFY(constBits(other) != bits);
+
+    // once the pool is full, further frames are not recycled
+    QXmppVideoFrame extra = pool.frame(bytes, size, 32, QXmppVideoFrame::Format_YUV420P);
+    QVERIFY(constBits(extra) != bits);
+    QVERIFY(constBits(extra) != constBits(other));
+}
+
+void tst_QXmppCodec::testVideoPacketBuffer()
+{
+    QXmppVideoPacketBuffer packets;
+    QCOMPARE(packets.count(), 0);
+
+    // each payload follows the room for its RTP header
+    memcpy(packets.addPacket(3), "abc", 3);
+    memcpy(packets.addPacket(5000), QByteArray(5000, 'x').constData(), 5000);
+    memcpy(packets.addPacket(2), "de", 2);
+    QCOMPARE(packets.count(), 3);
+    QCOMPARE(packets.packetSize(0), QXmppVideoPacketBuffer::headerRoom + 3);
+    QCOMPARE(packets.packetSize(1), QXmppVideoPacketBuffer::headerRoom + 5000);
+    QCOMPARE(packets.packetSize(2), QXmppVideoPacketBuffer::headerRoom + 2);
+    QCOMPARE(packets.payload(0), QByteArray("abc"));
+    QCOMPARE(packets.payload(1), QByteArray(5000, 'x'));
+    QCOMPARE(packets.payload(2), QByteArray("de"));
+
+    // the header room is writable in place
+    memset(packets.packet(2), 'h', QXmppVideoPacketBuffer::headerRoom);
+    QCOMPARE(QByteArray(reinterpret_cast<const char*>(packets.packet(2)), packets.packetSize(2)),
+             QByteArray(QXmppVideoPacketBuffer::headerRoom, 'h') + "de");
+
+    // the memory is kept for the next frame
+    const uchar *data = packets.packet(0);
+    packets.clear();
+    QCOMPARE(packets.count(), 0);
+    memcpy(packets.addPacket(4), "wxyz", 4);
+    QVERIFY(packets.packet(0) == data);
+    QCOMPARE(packets.count(), 1);
+    QCOMPARE(packets.payload(0), QByteArray("wxyz"));
+}
+
+void tst_QXmppCodec::testVideoFragmentBuffer()
+{
+    QXmppVideoFragmentBuffer buffer;
+    QVERIFY(buffer.isEmpty());
+
+    const QByteArray first(3000, 'a');
+    const QByteArray second("bcd");
+    buffer.append(reinterpret_cast<const uchar*>(first.constData()), first.size());
+    buffer.append(reinterpret_cast<const uchar*>(second.constData()), second.size());
+    QVERIFY(!buffer.isEmpty());
+    QCOMPARE(QByteArray(reinterpret_cast<const char*>(buffer.data()), buffer.size()), first + second);
+
+    // the memory is kept for the next frame
+    const uchar *data = buffer.data();
+    buffer.clear();
+    QVERIFY(buffer.isEmpty());
+    buffer.append(reinterpret_cast<const uchar*>(second.constData()), second.size());
+    QVERIFY(buffer.data() == data);
+    QCOMPARE(QByteArray(reinterpret_cast<const char*>(buffer.data()), buffer.size()), second);
+}
+
+void tst_QXmppCodec::testVideoConverterPacked()
+{
+    // the width exercises both the vector and the scalar code
+    const QSize size(40, 4);
+    QXmppVideoFrame yuyv(40 * 2 * 4, size, 40 * 2, QXmppVideoFrame::Format_YUYV);
+    uchar *bits = yuyv.bits();
+    for (int y = 0; y < size.height(); ++y) {
+        for (int x = 0; x < size.width(); x += 2) {
+            uchar *pixel = bits + y * yuyv.bytesPerLine() + 2 * x;
+            pixel[0] = x + y;
+            pixel[1] = 100 + x;
+            pixel[2] = x + y + 1;
+            pixel[3] = 200 - x;
+        }
+    }
+
+    QXmppVideoFrame uyvy = QXmppVideoConverter::convert(yuyv, QXmppVideoFrame::Format_UYVY);
+    QCOMPARE(uyvy.pixelFormat(), QXmppVideoFrame::Format_UYVY);
+    QCOMPARE(int(constBits(uyvy)[0]), 100);
+    QCOMPARE(int(constBits(uyvy)[1]), 0);
+    QCOMPARE(int(constBits(uyvy)[78]), 162);
+    QCOMPARE(int(constBits(uyvy)[79]), 39);
+
+    // the chroma is the same on each line, so nothing is lost
+    QXmppVideoFrame planar = QXmppVideoConverter::convert(uyvy, QXmppVideoFrame::Format_YUV420P);
+    QCOMPARE(planar.pixelFormat(), QXmppVideoFrame::Format_YUV420P);
+    QCOMPARE(planar.size(), size);
+    const uchar *y = constBits(planar);
+    const uchar *u = y + planar.bytesPerLine() * 4;
+    const uchar *v = u + planar.bytesPerLine() / 2 * 2;
+    QCOMPARE(int(y[3 * planar.bytesPerLine() + 39]), 42);
+    QCOMPARE(int(u[19]), 138);
+    QCOMPARE(int(v[19]), 162);
+
+    QXmppVideoFrame packed = QXmppVideoConverter::convert(planar, QXmppVideoFrame::Format_YUYV);
+    QCOMPARE(packed.pixelFormat(), QXmppVideoFrame::Format_YUYV);
+    for (int line = 0; line < size.height(); ++line) {
+        QCOMPARE(QByteArray((const char*)constBits(packed) + line * packed.bytesPerLine(), 80),
+                 QByteArray((const char*)constBits(yuyv) + line * yuyv.bytesPerLine(), 80));
+    }
+}
+
+void tst_QXmppCodec::testVideoConverterRgb()
+{
+    const QSize size(4, 2);
+    QXmppVideoFrame rgb(4 * 4 * 2, size, 4 * 4, QXmppVideoFrame::Format_RGB32);
+    quint32 *pixels = reinterpret_cast<quint32*>(rgb.bits());
+    for (int i = 0; i < 8; ++i)
+        pixels[i] = 0xffff0000;
+
+    QXmppVideoFrame rgb24 = QXmppVideoConverter::convert(rgb, QXmppVideoFrame::Format_RGB24);
+    QCOMPARE(rgb24.bytesPerLine(), 12);
+    QCOMPARE(QByteArray((const char*)constBits(rgb24), 3), QByteArray("\xff\x00\x00", 3));
+
+    // ITU-R BT.601
+    QXmppVideoFrame planar = QXmppVideoConverter::convert(rgb24, QXmppVideoFrame::Format_YUV420P);
+    const uchar *y = constBits(planar);
+    QCOMPARE(int(y[0]), 82);
+    QCOMPARE(int(y[4 * 2]), 90);
+    QCOMPARE(int(y[4 * 2 + 2]), 240);
+
+    QXmppVideoFrame back = QXmppVideoConverter::convert(planar, QXmppVideoFrame::Format_RGB32);
+    QCOMPARE(reinterpret_cast<const quint32*>(constBits(back))[7], quint32(0xffff0100));
+
+    // unsupported formats
+    QVERIFY(!QXmppVideoConverter::convert(rgb, QXmppVideoFrame::Format_Invalid).isValid());
+}
+
+void tst_QXmppCodec::testVideoConverterScale()
+{
+    const QSize size(64, 48);
+    QXmppVideoFrame frame(64 * 48 * 2, size, 64 * 2, QXmppVideoFrame::Format_YUYV);
+    memset(frame.bits(), 100, frame.mappedBytes());
+
+    QXmppVideoFrame scaled = QXmppVideoConverter::convert(frame, QXmppVideoFrame::Format_YUYV, QSize(32, 24));
+    QCOMPARE(scaled.size(), QSize(32, 24));
+    QCOMPARE(scaled.bytesPerLine(), 64);
+    const QByteArray expected(32 * 2, 100);
+    for (int line = 0; line < 24; ++line)
+        QCOMPARE(QByteArray((const char*)constBits(scaled) + line * 64, 64), expected);
+
+    // the same format and size leaves the frame unchanged
+    QXmppVideoFrame same = QXmppVideoConverter::convert(frame, QXmppVideoFrame::Format_YUYV, size);
+    QVERIFY(constBits(same) == constBits(frame));
+}
+
 QTEST_MAIN(tst_QXmppCodec)
 #include "tst_qxmppcodec.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppcompactstanza
+SOURCES += tst_qxmppcompactstanza.cpp
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QObject>
+#include "QXmppCompactStanza.h"
+#include "QXmppMessage.h"
+#include "util.h"
+
+class tst_QXmppCompactStanza : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testElement();
+    void testStanza();
+    void testBinary();
+    void testInvalid();
+};
+
+static const QByteArray xml(
+    "<message to=\"foo@example.com/QXmpp\">"
+    "<body>Hello &lt;b&gt;world</body>"
+    "<html xmlns=\"http://jabber.org/protocol/xhtml-im\">"
+    "<body xmlns=\"http://www.w3.org/1999/xhtml\">Hello <b>world</b>!</body>"
+    "</html>"
+    "</message>");
+
+void tst_QXmppCompactStanza::testElement()
+{
+    QDomDocument doc;
+    QVERIFY(doc.setContent("<stream xmlns=\"jabber:client\">" + xml + "</stream>", true));
+
+    QXmppCompactStanza stanza(doc.documentElement().firstChildElement());
+    QVERIFY(!stanza.isNull());
+    QCOMPARE(stanza.tagName(), QLatin1String("message"));
+    QCOMPARE(stanza.namespaceURI(), QLatin1String("jabber:client"));
+    QCOMPARE(stanza.attribute("to"), QLatin1String("foo@example.com/QXmpp"));
+    QCOMPARE(stanza.attribute("id"), QString());
+    serializePacket(stanza, xml);
+
+    // the DOM tree has the same content
+    const QDomElement element = stanza.toElement();
+    QCOMPARE(element.namespaceURI(), QLatin1String("jabber:client"));
+    QCOMPARE(element.firstChildElement("body").text(), QLatin1String("Hello <b>world"));
+    QCOMPARE(element.firstChildElement("html").namespaceURI(), QLatin1String("http://jabber.org/protocol/xhtml-im"));
+    QXmppCompactStanza rebuilt(element);
+    serializePacket(rebuilt, xml);
+}
+
+void tst_QXmppCompactStanza::testStanza()
+{
+    QXmppMessage message;
+    parsePacket(message, xml);
+
+    QXmppCompactStanza stanza(message);
+    QCOMPARE(stanza.tagName(), QLatin1String("message"));
+    QCOMPARE(stanza.attribute("to"), QLatin1String("foo@example.com/QXmpp"));
+
+    QXmppMessage copy;
+    copy.parse(stanza.toElement());
+    QCOMPARE(copy.to(), message.to());
+    QCOMPARE(copy.body(), message.body());
+    QCOMPARE(copy.xhtml(), message.xhtml());
+}
+
+void tst_QXmppCompactStanza::testBinary()
+{
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+
+    const QXmppCompactStanza stanza(doc.documentElement());
+    QXmppCompactStanza copy = QXmppCompactStanza::fromByteArray(stanza.toByteArray());
+    QVERIFY(!copy.isNull());
+    QCOMPARE(copy.attribute("to"), QLatin1String("foo@example.com/QXmpp"));
+    serializePacket(copy, xml);
+}
+
+void tst_QXmppCompactStanza::testInvalid()
+{
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+    const QByteArray data = QXmppCompactStanza(doc.documentElement()).toByteArray();
+
+    QVERIFY(QXmppCompactStanza(QDomElement()).isNull());
+    QVERIFY(QXmppCompactStanza::fromByteArray(QByteArray()).isNull());
+    QVERIFY(QXmppCompactStanza::fromByteArray(data.left(data.size() - 1)).isNull());
+
+    // a node index pointing past the string pool
+    QByteArray corrupt = data;
+    corrupt[corrupt.size() - 1] = '\x7f';
+    QVERIFY(QXmppCompactStanza::fromByteArray(corrupt).isNull());
+}
+
+QTEST_MAIN(tst_QXmppCompactStanza)
+#include "tst_qxmppcompactstanza.moc"
@@ -34,6 +34,7 @@ private slots:
     void testSimple();
     void testSubmit();
     void testMedia();
+    void testFieldLookup();
 };
 
 void tst_QXmppDataForm::testSimple()
@@ -112,5 +113,38 @@ void tst_QXmppDataForm::testMedia()
     serializePacket(form, xml);
 }
 
+void tst_QXmppDataForm::testFieldLookup()
+{
+    const QByteArray xml(
+        "<x xmlns=\"jabber:x:data\" type=\"form\">"
+        "<field type=\"hidden\" var=\"FORM_TYPE\">"
+        "<value>urn:xmpp:dataforms:softwareinfo</value>"
+        "</field>"
+        "<field type=\"list-single\" var=\"os\">"
+        "<value>linux</value>"
+        "<option label=\"Linux\"><value>linux</value></option>"
+        "<option label=\"Mac OS\"><value>mac</value></option>"
+        "</field>"
+        "</x>");
+
+    QXmppDataForm form;
+    parsePacket(form, xml);
+    QCOMPARE(form.formType(), QLatin1String("urn:xmpp:dataforms:softwareinfo"));
+    QCOMPARE(form.field("os").value().toString(), QLatin1String("linux"));
+    QCOMPARE(form.field("os").options().size(), 2);
+    QCOMPARE(form.field("os").options().at(1).first, QLatin1String("Mac OS"));
+    QCOMPARE(form.field("os").options().at(1).second, QLatin1String("mac"));
+    QCOMPARE(form.field("missing").key(), QString());
+    serializePacket(form, xml);
+
+    // modifying the fields in place is seen by lookups
+    form.fields()[1].setKey("system");
+    QCOMPARE(form.field("os").key(), QString());
+    QCOMPARE(form.field("system").value().toString(), QLatin1String("linux"));
+
+    form.setFields(QList<QXmppDataForm::Field>());
+    QCOMPARE(form.formType(), QString());
+}
+
 QTEST_MAIN(tst_QXmppDataForm)
 #include "tst_qxmppdataform.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppdatagramstream
+SOURCES += tst_qxmppdatagramstream.cpp
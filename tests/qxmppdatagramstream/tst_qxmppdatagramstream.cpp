@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppDatagramStream_p.h"
+
+// Carries datagrams to a stream after a delay, dropping some of them.
+
+class TestLink : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestLink(QXmppDatagramStream *target, int delay, int lossInterval)
+        : m_count(0)
+        , m_delay(delay)
+        , m_lossInterval(lossInterval)
+        , m_target(target)
+    {
+    }
+
+public slots:
+    void sendDatagram(const QByteArray &datagram)
+    {
+        if (m_lossInterval && !(++m_count % m_lossInterval))
+            return;
+        m_queue << datagram;
+        QTimer::singleShot(m_delay, this, SLOT(deliver()));
+    }
+
+private slots:
+    void deliver()
+    {
+        m_target->datagramReceived(m_queue.takeFirst());
+    }
+
+private:
+    int m_count;
+    int m_delay;
+    int m_lossInterval;
+    QList<QByteArray> m_queue;
+    QXmppDatagramStream *m_target;
+};
+
+static QByteArray generateData(int size)
+{
+    QByteArray data;
+    data.reserve(size);
+    for (int i = 0; i < size; ++i)
+        data.append(char(qrand() & 0xff));
+    return data;
+}
+
+class tst_QXmppDatagramStream : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testPacketType();
+    void testReceiveWindow();
+    void testTransfer_data();
+    void testTransfer();
+};
+
+void tst_QXmppDatagramStream::testPacketType()
+{
+    QCOMPARE(QXmppDatagramStream::isDatagramStreamPacket(QByteArray()), false);
+    QCOMPARE(QXmppDatagramStream::isDatagramStreamPacket(QByteArray("\x00\x01", 2)), false);
+    QCOMPARE(QXmppDatagramStream::isDatagramStreamPacket(QByteArray("\x80\x00", 2)), false);
+    QCOMPARE(QXmppDatagramStream::isDatagramStreamPacket(QByteArray("\xe0\x00", 2)), true);
+    QCOMPARE(QXmppDatagramStream::isDatagramStreamPacket(QByteArray("\xe1\x00", 2)), true);
+
+    // anything else is ignored
+    QXmppDatagramStream stream;
+    stream.open(QIODevice::ReadWrite);
+    stream.datagramReceived(QByteArray("\xe0\x00", 2));
+    stream.datagramReceived(QByteArray("\x80\x00\x00\x00\x00\x00\x00\x00\x00\x00", 10));
+    QCOMPARE(stream.bytesAvailable(), qint64(0));
+}
+
+void tst_QXmppDatagramStream::testReceiveWindow()
+{
+    QXmppDatagramStream sender;
+    QXmppDatagramStream receiver;
+    TestLink forward(&receiver, 5, 0);
+    TestLink backward(&sender, 5, 0);
+    connect(&sender, SIGNAL(sendDatagram(QByteArray)),
+            &forward, SLOT(sendDatagram(QByteArray)));
+    connect(&receiver, SIGNAL(sendDatagram(QByteArray)),
+            &backward, SLOT(sendDatagram(QByteArray)));
+    sender.open(QIODevice::ReadWrite);
+    receiver.open(QIODevice::ReadWrite);
+
+    // the receiver does not read, so the sender stops once its buffer
+    // is full
+    const QByteArray data = generateData(6 * 1048576);
+    sender.write(data);
+    for (int i = 0; i < 100 && receiver.bytesAvailable() < 4 * 1048576 - 2048; ++i)
+        QTest::qWait(100);
+    QTest::qWait(500);
+    QVERIFY(receiver.bytesAvailable() > 4 * 1048576 - 2048);
+    QVERIFY(receiver.bytesAvailable() <= 4 * 1048576);
+    QVERIFY(sender.bytesToWrite() > 0);
+
+    // reading opens the window again
+    QByteArray received;
+    for (int i = 0; i < 200 && received.size() < data.size(); ++i) {
+        received += receiver.readAll();
+        QTest::qWait(50);
+    }
+    QCOMPARE(received.size(), data.size());
+    QVERIFY(received == data);
+}
+
+void tst_QXmppDatagramStream::testTransfer_data()
+{
+    QTest::addColumn<int>("delay");
+    QTest::addColumn<int>("lossInterval");
+
+    QTest::newRow("clean") << 5 << 0;
+    QTest::newRow("lossy") << 5 << 20;
+    QTest::newRow("slow") << 50 << 50;
+}
+
+void tst_QXmppDatagramStream::testTransfer()
+{
+    QFETCH(int, delay);
+    QFETCH(int, lossInterval);
+
+    QXmppDatagramStream sender;
+    QXmppDatagramStream receiver;
+    TestLink forward(&receiver, delay, lossInterval);
+    TestLink backward(&sender, delay, lossInterval);
+    connect(&sender, SIGNAL(sendDatagram(QByteArray)),
+            &forward, SLOT(sendDatagram(QByteArray)));
+    connect(&receiver, SIGNAL(sendDatagram(QByteArray)),
+            &backward, SLOT(sendDatagram(QByteArray)));
+    sender.open(QIODevice::ReadWrite);
+    receiver.open(QIODevice::ReadWrite);
+
+    QSignalSpy writtenSpy(&sender, SIGNAL(bytesWritten(qint64)));
+
+    // write in blocks which do not match the packet size
+    const QByteArray data = generateData(262144);
+    for (int offset = 0; offset < data.size(); offset += 10000)
+        sender.write(data.mid(offset, 10000));
+    QCOMPARE(sender.bytesToWrite(), qint64(data.size()));
+
+    QByteArray received;
+    for (int i = 0; i < 400 && received.size() < data.size(); ++i) {
+        QTest::qWait(50);
+        received += receiver.readAll();
+    }
+    QCOMPARE(received.size(), data.size());
+    QVERIFY(received == data);
+
+    // the last acknowledgements may still be on their way
+    for (int i = 0; i < 100 && sender.bytesToWrite(); ++i)
+        QTest::qWait(50);
+    QCOMPARE(sender.bytesToWrite(), qint64(0));
+    QVERIFY(writtenSpy.count() > 0);
+    QVERIFY(sender.roundTripTime() >= 2 * delay);
+}
+
+QTEST_MAIN(tst_QXmppDatagramStream)
+#include "tst_qxmppdatagramstream.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppdirecttls
+SOURCES += tst_qxmppdirecttls.cpp
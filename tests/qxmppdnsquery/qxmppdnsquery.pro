@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppdnsquery
+SOURCES += tst_qxmppdnsquery.cpp
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QDataStream>
+#include <QEventLoop>
+#include <QObject>
+#include <QSignalSpy>
+#include <QUdpSocket>
+#include <QtTest>
+
+#include "QXmppDnsQuery_p.h"
+
+// Appends a domain name to a DNS message.
+static void writeName(QDataStream &stream, const QByteArray &name)
+{
+    foreach (const QByteArray &label, name.split('.')) {
+        stream << quint8(label.size());
+        stream.writeRawData(label.constData(), label.size());
+    }
+    stream << quint8(0);
+}
+
+class tst_QXmppDnsQuery : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void testInvalidName();
+    void testNotFound();
+    void testServiceRecords();
+    void testTimeout();
+
+private:
+    QByteArray receiveQuery();
+    void sendReply(const QByteArray &query, quint16 flags, quint16 answerCount, const QByteArray &answers);
+
+    QUdpSocket *m_server;
+    QHostAddress m_queryHost;
+    quint16 m_queryPort;
+};
+
+void tst_QXmppDnsQuery::init()
+{
+    m_server = new QUdpSocket;
+    QVERIFY(m_server->bind(QHostAddress::LocalHost, 0));
+}
+
+void tst_QXmppDnsQuery::cleanup()
+{
+    delete m_server;
+}
+
+QByteArray tst_QXmppDnsQuery::receiveQuery()
+{
+    if (!m_server->hasPendingDatagrams()) {
+        QEventLoop loop;
+        connect(m_server, SIGNAL(readyRead()), &loop, SLOT(quit()));
+        QTimer::singleShot(5000, &loop, SLOT(quit()));
+        loop.exec();
+    }
+
+    QByteArray query;
+    query.resize(m_server->pendingDatagramSize());
+    m_server->readDatagram(query.data(), query.size(), &m_queryHost, &m_queryPort);
+    return query;
+}
+
+void tst_QXmppDnsQuery::sendReply(const QByteArray &query, quint16 flags, quint16 answerCount, const QByteArray &answers)
+{
+    QByteArray reply = query;
+    QDataStream stream(&reply, QIODevice::ReadWrite);
+    stream.device()->seek(2);
+    stream << flags << quint16(1) << answerCount;
+    stream.device()->seek(reply.size());
+    stream.writeRawData(answers.constData(), answers.size());
+    m_server->writeDatagram(reply, m_queryHost, m_queryPort);
+}
+
+void tst_QXmppDnsQuery::testInvalidName()
+{
+    QXmppDnsQuery query;
+    QSignalSpy spy(&query, SIGNAL(finished()));
+    query.setNameServers(QList<QHostAddress>() << QHostAddress(QHostAddress::LocalHost), m_server->localPort());
+    query.lookup(QLatin1String("example..com"));
+    QCOMPARE(spy.count(), 0);
+
+    QEventLoop loop;
+    connect(&query, SIGNAL(finished()), &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(query.error(), QDnsLookup::InvalidRequestError);
+}
+
+void tst_QXmppDnsQuery::testNotFound()
+{
+    QXmppDnsQuery query;
+    query.setNameServers(QList<QHostAddress>() << QHostAddress(QHostAddress::LocalHost), m_server->localPort());
+    query.lookup(QLatin1String("_xmpp-server._tcp.example.com"));
+
+    const QByteArray data = receiveQuery();
+    QVERIFY(data.size() > 12);
+
+    QEventLoop loop;
+    connect(&query, SIGNAL(finished()), &loop, SLOT(quit()));
+    sendReply(data, 0x8183, 0, QByteArray());
+    loop.exec();
+
+    QVERIFY(query.isFinished());
+    QCOMPARE(query.error(), QDnsLookup::NotFoundError);
+    QVERIFY(query.serviceRecords().isEmpty());
+}
+
+void tst_QXmppDnsQuery::testServiceRecords()
+{
+    QXmppDnsQuery query;
+    query.setNameServers(QList<QHostAddress>() << QHostAddress(QHostAddress::LocalHost), m_server->localPort());
+    query.lookup(QLatin1String("_xmpp-server._tcp.example.com"));
+
+    const QByteArray data = receiveQuery();
+    QVERIFY(data.size() > 12);
+
+    // a reply with the wrong identifier is ignored
+    QByteArray spoofed = data;
+    spoofed[0] = spoofed[0] ^ 0x01;
+    sendReply(spoofed, 0x8183, 0, QByteArray());
+
+    QByteArray answers;
+    QDataStream stream(&answers, QIODevice::WriteOnly);
+    // a record whose name points to the question
+    stream << quint16(0xc00c) << quint16(33) << quint16(1) << quint32(3600);
+    stream << quint16(6 + 19) << quint16(10) << quint16(20) << quint16(5269);
+    writeName(stream, "xmpp1.example.com");
+    // a record whose target points to the first target
+    stream << quint16(0xc00c) << quint16(33) << quint16(1) << quint32(600);
+    stream << quint16(6 + 8) << quint16(20) << quint16(0) << quint16(5270);
+    stream << quint8(5);
+    stream.writeRawData("xmpp2", 5);
+    stream << quint16(0xc000 | (data.size() + 12 + 6 + 6));
+
+    QEventLoop loop;
+    connect(&query, SIGNAL(finished()), &loop, SLOT(quit()));
+    sendReply(data, 0x8180, 2, answers);
+    loop.exec();
+
+    QCOMPARE(query.error(), QDnsLookup::NoError);
+    const QList<QXmppSrvRecord> records = query.serviceRecords();
+    QCOMPARE(records.size(), 2);
+    QCOMPARE(records[0].target(), QLatin1String("xmpp1.example.com"));
+    QCOMPARE(records[0].port(), quint16(5269));
+    QCOMPARE(records[0].priority(), quint16(10));
+    QCOMPARE(records[0].weight(), quint16(20));
+    QCOMPARE(records[0].timeToLive(), quint32(3600));
+    QCOMPARE(records[1].target(), QLatin1String("xmpp2.example.com"));
+    QCOMPARE(records[1].port(), quint16(5270));
+    QCOMPARE(records[1].priority(), quint16(20));
+    QCOMPARE(records[1].timeToLive(), quint32(600));
+}
+
+void tst_QXmppDnsQuery::testTimeout()
+{
+    QXmppDnsQuery query;
+    query.setNameServers(QList<QHostAddress>() << QHostAddress(QHostAddress::LocalHost), m_server->localPort());
+    query.setAttempts(2);
+    query.setTimeout(100);
+    query.lookup(QLatin1String("_xmpp-server._tcp.example.com"));
+
+    QEventLoop loop;
+    connect(&query, SIGNAL(finished()), &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(query.error(), QDnsLookup::ResolverError);
+
+    // the query was sent twice
+    QVERIFY(!receiveQuery().isEmpty());
+    QVERIFY(!receiveQuery().isEmpty());
+    QVERIFY(!m_server->hasPendingDatagrams());
+}
+
+QTEST_MAIN(tst_QXmppDnsQuery)
+#include "tst_qxmppdnsquery.moc"
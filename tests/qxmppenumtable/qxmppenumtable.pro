@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppenumtable
+SOURCES += tst_qxmppenumtable.cpp
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppEnumTable_p.h"
+
+static const char* test_names[] = {
+    "",
+    "away",
+    "xa",
+    "dnd"
+};
+
+class tst_QXmppEnumTable : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testFromString_data();
+    void testFromString();
+    void testToString();
+};
+
+void tst_QXmppEnumTable::testFromString_data()
+{
+    QTest::addColumn<QString>("name");
+    QTest::addColumn<int>("value");
+
+    QTest::newRow("empty") << QString() << 0;
+    QTest::newRow("away") << "away" << 1;
+    QTest::newRow("xa") << "xa" << 2;
+    QTest::newRow("dnd") << "dnd" << 3;
+    QTest::newRow("unknown") << "chat" << -1;
+    QTest::newRow("case") << "DND" << -1;
+}
+
+void tst_QXmppEnumTable::testFromString()
+{
+    QFETCH(QString, name);
+    QFETCH(int, value);
+
+    QXmppEnumTable table(test_names, 4);
+    QCOMPARE(table.fromString(name), value);
+    QCOMPARE(table.fromString(name, 42), value < 0 ? 42 : value);
+}
+
+void tst_QXmppEnumTable::testToString()
+{
+    QXmppEnumTable table(test_names, 4);
+    QCOMPARE(table.count(), 4);
+    QCOMPARE(table.toString(0), QString());
+    QCOMPARE(table.toString(1), QString("away"));
+    QCOMPARE(table.toString(3), QString("dnd"));
+    QCOMPARE(table.toString(-1), QString());
+    QCOMPARE(table.toString(4), QString());
+}
+
+QTEST_MAIN(tst_QXmppEnumTable)
+#include "tst_qxmppenumtable.moc"
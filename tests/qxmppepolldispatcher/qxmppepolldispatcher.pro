@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppepolldispatcher
+SOURCES += tst_qxmppepolldispatcher.cpp
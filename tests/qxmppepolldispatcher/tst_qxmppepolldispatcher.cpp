@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QtTest>
+
+#include "QXmppEpollDispatcher_p.h"
+
+class TestWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestWorker()
+        : ticks(0), timer(0), socket(0)
+    {
+    }
+
+    QList<int> received;
+    int ticks;
+    quint16 port;
+    QByteArray reply;
+
+public slots:
+    void append(int value)
+    {
+        received << value;
+    }
+
+    // hands the worker back to the main thread, which destroys it
+    void quit()
+    {
+        if (socket) {
+            socket->disconnect(this);
+            socket->abort();
+        }
+        moveToThread(QCoreApplication::instance()->thread());
+        QThread::currentThread()->quit();
+    }
+
+    void startTimer()
+    {
+        timer = new QTimer(this);
+        timer->setInterval(20);
+        connect(timer, SIGNAL(timeout()), this, SLOT(tick()));
+        timer->start();
+    }
+
+    void tick()
+    {
+        if (++ticks == 5) {
+            timer->stop();
+            quit();
+        }
+    }
+
+    void startSocket()
+    {
+        socket = new QTcpSocket(this);
+        connect(socket, SIGNAL(connected()), this, SLOT(socketConnected()));
+        connect(socket, SIGNAL(readyRead()), this, SLOT(socketReadyRead()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(quit()));
+        socket->connectToHost(QHostAddress::LocalHost, port);
+    }
+
+    void socketConnected()
+    {
+        socket->write("ping");
+    }
+
+    void socketReadyRead()
+    {
+        reply += socket->readAll();
+        if (reply.size() >= 4)
+            quit();
+    }
+
+private:
+    QTimer *timer;
+    QTcpSocket *socket;
+};
+
+class tst_QXmppEpollDispatcher : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testPostedEvents();
+    void testSocket();
+    void testTimer();
+};
+
+#if defined(Q_OS_LINUX) && QT_VERSION >= 0x050000
+static QThread *startThread(TestWorker *worker)
+{
+    QThread *thread = new QThread;
+    QXmppEpollEventDispatcher *dispatcher = new QXmppEpollEventDispatcher;
+    if (!dispatcher->isValid()) {
+        delete dispatcher;
+        delete thread;
+        return 0;
+    }
+    thread->setEventDispatcher(dispatcher);
+    worker->moveToThread(thread);
+    thread->start();
+    return thread;
+}
+#endif
+
+void tst_QXmppEpollDispatcher::testPostedEvents()
+{
+#if defined(Q_OS_LINUX) && QT_VERSION >= 0x050000
+    TestWorker worker;
+    QThread *thread = startThread(&worker);
+    QVERIFY(thread);
+
+    // posted events are handled in order
+    QList<int> expected;
+    for (int i = 0; i < 100; ++i) {
+        QMetaObject::invokeMethod(&worker, "append", Qt::QueuedConnection, Q_ARG(int, i));
+        expected << i;
+    }
+    QMetaObject::invokeMethod(&worker, "quit", Qt::QueuedConnection);
+    QVERIFY(thread->wait(5000));
+    QCOMPARE(worker.received, expected);
+    delete thread;
+#else
+#if QT_VERSION < 0x050000
+    QSKIP("epoll is not available", SkipAll);
+#else
+    QSKIP("epoll is not available");
+#endif
+#endif
+}
+
+void tst_QXmppEpollDispatcher::testSocket()
+{
+#if defined(Q_OS_LINUX) && QT_VERSION >= 0x050000
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    TestWorker worker;
+    worker.port = server.serverPort();
+    QThread *thread = startThread(&worker);
+    QVERIFY(thread);
+    QMetaObject::invokeMethod(&worker, "startSocket", Qt::QueuedConnection);
+
+    QVERIFY(server.waitForNewConnection(5000));
+    QTcpSocket *peer = server.nextPendingConnection();
+    QVERIFY(peer);
+    QByteArray request;
+    while (request.size() < 4 && peer->waitForReadyRead(5000))
+        request += peer->readAll();
+    QCOMPARE(request, QByteArray("ping"));
+
+    peer->write("pong");
+    QVERIFY(peer->waitForBytesWritten(5000));
+    QVERIFY(thread->wait(5000));
+    QCOMPARE(worker.reply, QByteArray("pong"));
+    delete thread;
+#else
+#if QT_VERSION < 0x050000
+    QSKIP("epoll is not available", SkipAll);
+#else
+    QSKIP("epoll is not available");
+#endif
+#endif
+}
+
+void tst_QXmppEpollDispatcher::testTimer()
+{
+#if defined(Q_OS_LINUX) && QT_VERSION >= 0x050000
+    TestWorker worker;
+    QThread *thread = startThread(&worker);
+    QVERIFY(thread);
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QMetaObject::invokeMethod(&worker, "startTimer", Qt::QueuedConnection);
+    QVERIFY(thread->wait(5000));
+    QCOMPARE(worker.ticks, 5);
+    QVERIFY(elapsed.elapsed() >= 90);
+    delete thread;
+#else
+#if QT_VERSION < 0x050000
+    QSKIP("epoll is not available", SkipAll);
+#else
+    QSKIP("epoll is not available");
+#endif
+#endif
+}
+
+QTEST_MAIN(tst_QXmppEpollDispatcher)
+#include "tst_qxmppepolldispatcher.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpphandoff
+SOURCES += tst_qxmpphandoff.cpp
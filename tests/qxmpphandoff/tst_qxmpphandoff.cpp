@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QDir>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QtTest>
+
+#include "QXmppHandoff_p.h"
+
+class HandoffReceiver : public QThread
+{
+public:
+    HandoffReceiver(const QString &socketName)
+        : name(socketName)
+        , ok(false)
+    {
+    }
+
+    void run()
+    {
+        ok = QXmppHandoff::receive(name, &descriptors, &data, 5000);
+    }
+
+    QString name;
+    bool ok;
+    QList<int> descriptors;
+    QByteArray data;
+};
+
+class tst_QXmppHandoff : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testNoServer();
+    void testPeerTrusted();
+    void testSocketPath();
+    void testTransfer_data();
+    void testTransfer();
+};
+
+void tst_QXmppHandoff::testNoServer()
+{
+    QLocalServer::removeServer("qxmpp-handoff-none");
+
+    QList<int> descriptors;
+    QByteArray data;
+    QVERIFY(!QXmppHandoff::receive("qxmpp-handoff-none", &descriptors, &data, 100));
+    QVERIFY(descriptors.isEmpty());
+}
+
+void tst_QXmppHandoff::testPeerTrusted()
+{
+#ifndef Q_OS_UNIX
+#if QT_VERSION < 0x050000
+    QSKIP("Handoff is only supported on Unix", SkipAll);
+#else
+    QSKIP("Handoff is only supported on Unix");
+#endif
+#endif
+    const QString name("qxmpp-handoff-peer");
+    QLocalServer::removeServer(name);
+    QLocalServer server;
+    QVERIFY(server.listen(name));
+
+    QLocalSocket client;
+    client.connectToServer(name);
+    QVERIFY(server.waitForNewConnection(5000));
+    QLocalSocket *socket = server.nextPendingConnection();
+    QVERIFY(socket);
+
+    // both ends run as the current user
+    QVERIFY(QXmppHandoff::isPeerTrusted(int(socket->socketDescriptor())));
+    QVERIFY(QXmppHandoff::isPeerTrusted(int(client.socketDescriptor())));
+
+    // a descriptor which is not a socket has no credentials
+    QVERIFY(!QXmppHandoff::isPeerTrusted(-1));
+    delete socket;
+}
+
+void tst_QXmppHandoff::testSocketPath()
+{
+    QCOMPARE(QXmppHandoff::socketPath("/run/qxmpp.sock"), QString("/run/qxmpp.sock"));
+    QCOMPARE(QXmppHandoff::socketPath("qxmpp.sock"), QDir::tempPath() + QString("/qxmpp.sock"));
+}
+
+void tst_QXmppHandoff::testTransfer_data()
+{
+    QTest::addColumn<int>("size");
+
+    QTest::newRow("empty") << 0;
+    QTest::newRow("small") << 16;
+    QTest::newRow("large") << 4 * 1024 * 1024;
+}
+
+void tst_QXmppHandoff::testTransfer()
+{
+#ifndef Q_OS_UNIX
+#if QT_VERSION < 0x050000
+    QSKIP("Handoff is only supported on Unix", SkipAll);
+#else
+    QSKIP("Handoff is only supported on Unix");
+#endif
+#endif
+    QFETCH(int, size);
+
+    const QString name("qxmpp-handoff-test");
+    QLocalServer::removeServer(name);
+    QLocalServer server;
+    QVERIFY(server.listen(name));
+
+    QTcpServer listener;
+    QVERIFY(listener.listen(QHostAddress::LocalHost));
+
+    QByteArray data(size, 'x');
+    if (size)
+        data[size - 1] = 'y';
+
+    // the receiver blocks, so it runs in another thread
+    HandoffReceiver receiver(name);
+    receiver.start();
+    QVERIFY(server.waitForNewConnection(5000));
+    QLocalSocket *socket = server.nextPendingConnection();
+    QVERIFY(socket);
+    QVERIFY(QXmppHandoff::send(int(socket->socketDescriptor()), QList<int>() << int(listener.socketDescriptor()), data, 5000));
+    QVERIFY(receiver.wait(5000));
+
+    QVERIFY(receiver.ok);
+    QCOMPARE(receiver.data, data);
+    QCOMPARE(receiver.descriptors.size(), 1);
+
+    // the copy of the listening socket accepts connections
+    const quint16 port = listener.serverPort();
+    listener.close();
+    QTcpServer adopted;
+    QVERIFY(adopted.setSocketDescriptor(receiver.descriptors.first()));
+    QCOMPARE(adopted.serverPort(), port);
+
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(adopted.waitForNewConnection(5000));
+    delete socket;
+}
+
+QTEST_MAIN(tst_QXmppHandoff)
+#include "tst_qxmpphandoff.moc"
@@ -33,6 +33,9 @@ private slots:
     void testBind();
     void testBindStun();
     void testConnect();
+    void testConnectTrickle();
+    void testConsent();
+    void testRestart();
 };
 
 void tst_QXmppIceConnection::testBind()
@@ -116,6 +119,9 @@ void tst_QXmppIceConnection::testConnect()
     connect(&clientL, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
             &logger, SLOT(log(QXmppLogger::MessageType,QString)));
     clientL.setIceControlling(true);
+    QCOMPARE(clientL.checkInterval(), 20);
+    clientL.setCheckInterval(5);
+    QCOMPARE(clientL.checkInterval(), 5);
     clientL.addComponent(componentId);
     clientL.bind(QXmppIceComponent::discoverAddresses());
 
@@ -151,6 +157,169 @@ void tst_QXmppIceConnection::testConnect()
     loop.exec();
     QVERIFY(clientL.isConnected());
     QVERIFY(clientR.isConnected());
+
+    // media flows on the selected pair
+    QSignalSpy spy(clientR.component(componentId), SIGNAL(datagramReceived(QByteArray)));
+    QVERIFY(clientL.component(componentId)->sendDatagram("media") > 0);
+    for (int i = 0; i < 50 && spy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spy.size(), 1);
+    QCOMPARE(spy[0][0].toByteArray(), QByteArray("media"));
+}
+
+void tst_QXmppIceConnection::testConnectTrickle()
+{
+    const int componentId = 1024;
+
+    QXmppIceConnection clientL;
+    clientL.setIceControlling(true);
+    clientL.addComponent(componentId);
+    clientL.bind(QXmppIceComponent::discoverAddresses());
+
+    QXmppIceConnection clientR;
+    clientR.setIceControlling(false);
+    clientR.addComponent(componentId);
+    clientR.bind(QXmppIceComponent::discoverAddresses());
+
+    // exchange credentials
+    clientL.setRemoteUser(clientR.localUser());
+    clientL.setRemotePassword(clientR.localPassword());
+    clientR.setRemoteUser(clientL.localUser());
+    clientR.setRemotePassword(clientL.localPassword());
+
+    // start ICE before any candidates are known
+    QEventLoop loop;
+    connect(&clientL, SIGNAL(connected()), &loop, SLOT(quit()));
+    connect(&clientR, SIGNAL(connected()), &loop, SLOT(quit()));
+
+    clientL.connectToHost();
+    clientR.connectToHost();
+    QVERIFY(!clientL.isConnected());
+    QVERIFY(!clientR.isConnected());
+
+    // trickle candidates
+    foreach (const QXmppJingleCandidate &candidate, clientR.localCandidates())
+        clientL.addRemoteCandidate(candidate);
+    foreach (const QXmppJingleCandidate &candidate, clientL.localCandidates())
+        clientR.addRemoteCandidate(candidate);
+
+    // check both clients are connected
+    loop.exec();
+    loop.exec();
+    QVERIFY(clientL.isConnected());
+    QVERIFY(clientR.isConnected());
+}
+
+static void exchangeCredentials(QXmppIceConnection *clientL, QXmppIceConnection *clientR)
+{
+    clientL->setRemoteUser(clientR->localUser());
+    clientL->setRemotePassword(clientR->localPassword());
+    foreach (const QXmppJingleCandidate &candidate, clientR->localCandidates())
+        clientL->addRemoteCandidate(candidate);
+
+    clientR->setRemoteUser(clientL->localUser());
+    clientR->setRemotePassword(clientL->localPassword());
+    foreach (const QXmppJingleCandidate &candidate, clientL->localCandidates())
+        clientR->addRemoteCandidate(candidate);
+}
+
+void tst_QXmppIceConnection::testConsent()
+{
+    const int componentId = 1024;
+
+    QXmppIceConnection clientL;
+    clientL.setIceControlling(true);
+    QCOMPARE(clientL.consentTimeout(), 30000);
+    clientL.setConsentTimeout(300);
+    QCOMPARE(clientL.consentTimeout(), 300);
+    clientL.addComponent(componentId);
+    clientL.bind(QXmppIceComponent::discoverAddresses());
+
+    QXmppIceConnection clientR;
+    clientR.setIceControlling(false);
+    clientR.addComponent(componentId);
+    clientR.bind(QXmppIceComponent::discoverAddresses());
+
+    exchangeCredentials(&clientL, &clientR);
+
+    QEventLoop loop;
+    connect(&clientL, SIGNAL(connected()), &loop, SLOT(quit()));
+    connect(&clientR, SIGNAL(connected()), &loop, SLOT(quit()));
+    clientL.connectToHost();
+    clientR.connectToHost();
+    loop.exec();
+    loop.exec();
+    QVERIFY(clientL.isConnected());
+
+    // consent is maintained while the remote party answers
+    QSignalSpy spy(&clientL, SIGNAL(disconnected()));
+    QTest::qWait(600);
+    QCOMPARE(spy.size(), 0);
+    QVERIFY(clientL.isConnected());
+
+    // consent is lost once the remote party goes away
+    clientR.close();
+    for (int i = 0; i < 100 && spy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spy.size(), 1);
+    QVERIFY(!clientL.isConnected());
+}
+
+void tst_QXmppIceConnection::testRestart()
+{
+    const int componentId = 1024;
+
+    QXmppIceConnection clientL;
+    clientL.setIceControlling(true);
+    clientL.addComponent(componentId);
+    clientL.bind(QXmppIceComponent::discoverAddresses());
+
+    QXmppIceConnection clientR;
+    clientR.setIceControlling(false);
+    clientR.addComponent(componentId);
+    clientR.bind(QXmppIceComponent::discoverAddresses());
+
+    exchangeCredentials(&clientL, &clientR);
+
+    QEventLoop loop;
+    connect(&clientL, SIGNAL(connected()), &loop, SLOT(quit()));
+    connect(&clientR, SIGNAL(connected()), &loop, SLOT(quit()));
+    clientL.connectToHost();
+    clientR.connectToHost();
+    loop.exec();
+    loop.exec();
+    QVERIFY(clientL.isConnected());
+    QVERIFY(clientR.isConnected());
+
+    // restart with new credentials
+    const QString oldUser = clientL.localUser();
+    QVERIFY(clientL.restart(QXmppIceComponent::discoverAddresses()));
+    QVERIFY(clientR.restart(QXmppIceComponent::discoverAddresses()));
+    QVERIFY(clientL.localUser() != oldUser);
+    QVERIFY(!clientL.isConnected());
+    QVERIFY(!clientR.isConnected());
+
+    // media keeps flowing on the previous pair
+    QSignalSpy spy(clientR.component(componentId), SIGNAL(datagramReceived(QByteArray)));
+    QVERIFY(clientL.component(componentId)->sendDatagram("media") > 0);
+    for (int i = 0; i < 50 && spy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spy.size(), 1);
+
+    // negotiate again
+    exchangeCredentials(&clientL, &clientR);
+    clientL.connectToHost();
+    clientR.connectToHost();
+    loop.exec();
+    loop.exec();
+    QVERIFY(clientL.isConnected());
+    QVERIFY(clientR.isConnected());
+
+    spy.clear();
+    QVERIFY(clientL.component(componentId)->sendDatagram("media") > 0);
+    for (int i = 0; i < 50 && spy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spy.size(), 1);
 }
 
 QTEST_MAIN(tst_QXmppIceConnection)
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppidletimer
+SOURCES += tst_qxmppidletimer.cpp
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppIdleTimer_p.h"
+
+class tst_QXmppIdleTimer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testTimeout();
+    void testRestart();
+    void testStop();
+    void testZeroInterval();
+};
+
+void tst_QXmppIdleTimer::testTimeout()
+{
+    QXmppIdleTimer timer;
+    QSignalSpy spy(&timer, SIGNAL(timeout()));
+    timer.setInterval(300);
+    timer.start();
+    QVERIFY(timer.isActive());
+
+    QTest::qWait(100);
+    QCOMPARE(spy.count(), 0);
+
+    QTest::qWait(800);
+    QCOMPARE(spy.count(), 1);
+    QVERIFY(!timer.isActive());
+}
+
+void tst_QXmppIdleTimer::testRestart()
+{
+    QXmppIdleTimer timer;
+    QSignalSpy spy(&timer, SIGNAL(timeout()));
+    timer.setInterval(600);
+    timer.start();
+
+    // activity keeps the timer from expiring
+    for (int i = 0; i < 6; ++i) {
+        QTest::qWait(200);
+        timer.start();
+    }
+    QCOMPARE(spy.count(), 0);
+
+    QTest::qWait(1200);
+    QCOMPARE(spy.count(), 1);
+}
+
+void tst_QXmppIdleTimer::testStop()
+{
+    QXmppIdleTimer timer;
+    QSignalSpy spy(&timer, SIGNAL(timeout()));
+    timer.setInterval(200);
+    timer.start();
+    timer.stop();
+    QVERIFY(!timer.isActive());
+
+    // a deleted timer must leave the wheel
+    QXmppIdleTimer *other = new QXmppIdleTimer;
+    other->setInterval(200);
+    other->start();
+    delete other;
+
+    QTest::qWait(700);
+    QCOMPARE(spy.count(), 0);
+}
+
+void tst_QXmppIdleTimer::testZeroInterval()
+{
+    QXmppIdleTimer timer;
+    QSignalSpy spy(&timer, SIGNAL(timeout()));
+    timer.start();
+    QVERIFY(!timer.isActive());
+
+    QTest::qWait(500);
+    QCOMPARE(spy.count(), 0);
+}
+
+QTEST_MAIN(tst_QXmppIdleTimer)
+#include "tst_qxmppidletimer.moc"
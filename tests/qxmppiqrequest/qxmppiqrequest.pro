@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppiqrequest
+SOURCES += tst_qxmppiqrequest.cpp
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+
+#include "QXmppClient.h"
+#include "QXmppIq.h"
+#include "QXmppIqRequest.h"
+#include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "util.h"
+
+// Answers the IQs sent to the server whose ID starts with "test-": with a
+// result for "test-ok", an error for "test-error" and not at all for
+// "test-drop".
+class TestResponderExtension : public QXmppServerExtension
+{
+public:
+    bool handleStanza(const QDomElement &element)
+    {
+        const QString id = element.attribute("id");
+        if (element.tagName() != QLatin1String("iq") ||
+            element.attribute("to") != QLatin1String("localhost") ||
+            !id.startsWith("test-"))
+            return false;
+
+        QXmppIq response(QXmppIq::Result);
+        response.setId(id);
+        response.setFrom("localhost");
+        response.setTo(element.attribute("from"));
+        if (id.startsWith("test-error")) {
+            response.setType(QXmppIq::Error);
+            response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound));
+        }
+        if (!id.startsWith("test-drop"))
+            server()->sendPacket(response);
+        return true;
+    }
+};
+
+class tst_QXmppIqRequest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testResult();
+    void testError();
+    void testTimeout();
+    void testCancel();
+    void testDuplicateId();
+    void testPipeline();
+
+private:
+    QXmppIqRequest *send(const QString &id, int timeout = 30000);
+    void waitFinished(QXmppIqRequest *request);
+
+    TestPasswordChecker m_passwordChecker;
+    QXmppServer *m_server;
+    QXmppClient *m_client;
+};
+
+void tst_QXmppIqRequest::initTestCase()
+{
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12371;
+
+    m_passwordChecker.addCredentials("user1", "testpwd");
+    m_server = new QXmppServer;
+    m_server->setDomain("localhost");
+    m_server->setPasswordChecker(&m_passwordChecker);
+    m_server->addExtension(new TestResponderExtension);
+    QVERIFY(m_server->listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+
+    m_client = new QXmppClient;
+    QSignalSpy connected(m_client, SIGNAL(connected()));
+    m_client->connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(m_client->isConnected());
+}
+
+void tst_QXmppIqRequest::cleanupTestCase()
+{
+    delete m_client;
+    delete m_server;
+}
+
+QXmppIqRequest *tst_QXmppIqRequest::send(const QString &id, int timeout)
+{
+    QXmppIq iq(QXmppIq::Get);
+    iq.setId(id);
+    iq.setTo("localhost");
+    return m_client->sendIq(iq, timeout);
+}
+
+void tst_QXmppIqRequest::waitFinished(QXmppIqRequest *request)
+{
+    for (int i = 0; i < 50 && !request->isFinished(); ++i)
+        QTest::qWait(100);
+}
+
+void tst_QXmppIqRequest::testResult()
+{
+    QXmppIqRequest *request = send("test-ok-1");
+    QSignalSpy finished(request, SIGNAL(finished()));
+    QCOMPARE(request->id(), QString("test-ok-1"));
+    QCOMPARE(request->state(), QXmppIqRequest::PendingState);
+    QVERIFY(request->response().isNull());
+
+    // the response is not dispatched as an unhandled IQ
+    QSignalSpy iqReceived(m_client, SIGNAL(iqReceived(QXmppIq)));
+    waitFinished(request);
+    QCOMPARE(finished.size(), 1);
+    QCOMPARE(request->state(), QXmppIqRequest::ResultState);
+    QCOMPARE(iqReceived.size(), 0);
+
+    QXmppIq response;
+    response.parse(request->response());
+    QCOMPARE(response.id(), QString("test-ok-1"));
+    QCOMPARE(response.type(), QXmppIq::Result);
+    delete request;
+}
+
+void tst_QXmppIqRequest::testError()
+{
+    QXmppIqRequest *request = send("test-error-1");
+    waitFinished(request);
+    QCOMPARE(request->state(), QXmppIqRequest::ErrorState);
+    QCOMPARE(request->error().type(), QXmppStanza::Error::Cancel);
+    QCOMPARE(request->error().condition(), QXmppStanza::Error::ItemNotFound);
+    delete request;
+}
+
+void tst_QXmppIqRequest::testTimeout()
+{
+    QXmppIqRequest *request = send("test-drop-1", 300);
+    QSignalSpy finished(request, SIGNAL(finished()));
+    QTest::qWait(200);
+    QVERIFY(!request->isFinished());
+    waitFinished(request);
+    QCOMPARE(finished.size(), 1);
+    QCOMPARE(request->state(), QXmppIqRequest::TimeoutState);
+    delete request;
+}
+
+void tst_QXmppIqRequest::testCancel()
+{
+    QXmppIqRequest *request = send("test-ok-2");
+    QSignalSpy finished(request, SIGNAL(finished()));
+    request->cancel();
+    QCOMPARE(finished.size(), 1);
+    QCOMPARE(request->state(), QXmppIqRequest::CancelledState);
+
+    // the response which is received afterwards is ignored
+    QTest::qWait(500);
+    QCOMPARE(finished.size(), 1);
+    QCOMPARE(request->state(), QXmppIqRequest::CancelledState);
+    delete request;
+
+    // deleting a pending request cancels it
+    request = send("test-ok-3");
+    delete request;
+    QTest::qWait(500);
+}
+
+void tst_QXmppIqRequest::testDuplicateId()
+{
+    QXmppIqRequest *first = send("test-ok-4");
+    QXmppIqRequest *second = send("test-ok-4");
+    QVERIFY(second->id().isEmpty());
+    waitFinished(first);
+    waitFinished(second);
+    QCOMPARE(first->state(), QXmppIqRequest::ResultState);
+    QCOMPARE(second->state(), QXmppIqRequest::CancelledState);
+    delete first;
+    delete second;
+}
+
+void tst_QXmppIqRequest::testPipeline()
+{
+    QList<QXmppIqRequest*> requests;
+    for (int i = 0; i < 100; ++i)
+        requests << send(QString("test-ok-pipeline-%1").arg(i));
+    waitFinished(requests.last());
+    foreach (QXmppIqRequest *request, requests)
+        waitFinished(request);
+    foreach (QXmppIqRequest *request, requests)
+        QCOMPARE(request->state(), QXmppIqRequest::ResultState);
+    qDeleteAll(requests);
+}
+
+QTEST_MAIN(tst_QXmppIqRequest)
+#include "tst_qxmppiqrequest.moc"
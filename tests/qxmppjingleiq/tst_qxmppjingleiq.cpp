@@ -32,12 +32,15 @@ class tst_QXmppJingleIq : public QObject
 private slots:
     void testCandidate();
     void testContent();
+    void testContentCrypto();
     void testContentFingerprint();
     void testContentSdp();
     void testContentSdpReflexive();
     void testContentSdpFingerprint();
     void testContentSdpParameters();
     void testSession();
+    void testSessionFileTransfer();
+    void testSessionForward();
     void testTerminate();
     void testAudioPayloadType();
     void testVideoPayloadType();
@@ -145,6 +148,51 @@ void tst_QXmppJingleIq::testContent()
     serializePacket(content, xml);
 }
 
+void tst_QXmppJingleIq::testContentCrypto()
+{
+    const QByteArray xml(
+    "<content creator=\"initiator\" name=\"voice\">"
+      "<description xmlns=\"urn:xmpp:jingle:apps:rtp:1\" media=\"audio\">"
+        "<payload-type id=\"0\" name=\"PCMU\"/>"
+        "<encryption>"
+          "<crypto crypto-suite=\"AES_CM_128_HMAC_SHA1_80\""
+                 " key-params=\"inline:WVNfX19zZW1jdGwgKCkgewkyMjA7fQp9CnVubGVz|2^20|1:32\""
+                 " tag=\"1\"/>"
+          "<crypto crypto-suite=\"AES_CM_128_HMAC_SHA1_32\""
+                 " key-params=\"inline:NzB4d1BINUAvLEw6UzF3WSJ+PSdFcGdUJShpX1Zj\""
+                 " session-params=\"KDR=1\""
+                 " tag=\"2\"/>"
+        "</encryption>"
+      "</description>"
+    "</content>");
+
+    QXmppJingleIq::Content content;
+    parsePacket(content, xml);
+
+    QCOMPARE(content.payloadTypes().size(), 1);
+    QCOMPARE(content.cryptoElements().size(), 2);
+    QCOMPARE(content.cryptoElements()[0].tag(), 1);
+    QCOMPARE(content.cryptoElements()[0].cryptoSuite(), QLatin1String("AES_CM_128_HMAC_SHA1_80"));
+    QCOMPARE(content.cryptoElements()[0].keyParams(), QLatin1String("inline:WVNfX19zZW1jdGwgKCkgewkyMjA7fQp9CnVubGVz|2^20|1:32"));
+    QCOMPARE(content.cryptoElements()[0].sessionParams(), QString());
+    QCOMPARE(content.cryptoElements()[1].tag(), 2);
+    QCOMPARE(content.cryptoElements()[1].cryptoSuite(), QLatin1String("AES_CM_128_HMAC_SHA1_32"));
+    QCOMPARE(content.cryptoElements()[1].sessionParams(), QLatin1String("KDR=1"));
+
+    serializePacket(content, xml);
+
+    const QString sdp = content.toSdp();
+    QVERIFY(sdp.contains("a=crypto:1 AES_CM_128_HMAC_SHA1_80 inline:WVNfX19zZW1jdGwgKCkgewkyMjA7fQp9CnVubGVz|2^20|1:32\r\n"));
+    QVERIFY(sdp.contains("a=crypto:2 AES_CM_128_HMAC_SHA1_32 inline:NzB4d1BINUAvLEw6UzF3WSJ+PSdFcGdUJShpX1Zj KDR=1\r\n"));
+
+    QXmppJingleIq::Content parsed;
+    QVERIFY(parsed.parseSdp(sdp));
+    QCOMPARE(parsed.cryptoElements().size(), 2);
+    QCOMPARE(parsed.cryptoElements()[1].tag(), 2);
+    QCOMPARE(parsed.cryptoElements()[1].keyParams(), QLatin1String("inline:NzB4d1BINUAvLEw6UzF3WSJ+PSdFcGdUJShpX1Zj"));
+    QCOMPARE(parsed.cryptoElements()[1].sessionParams(), QLatin1String("KDR=1"));
+}
+
 void tst_QXmppJingleIq::testContentFingerprint()
 {
     const QByteArray xml(
@@ -402,6 +450,95 @@ void tst_QXmppJingleIq::testSession()
     serializePacket(session, xml);
 }
 
+void tst_QXmppJingleIq::testSessionFileTransfer()
+{
+    const QByteArray xml(
+        "<iq"
+        " id=\"nzu25s8\""
+        " to=\"juliet@capulet.lit/chamber\""
+        " from=\"romeo@montague.lit/orchard\""
+        " type=\"set\">"
+        "<jingle xmlns=\"urn:xmpp:jingle:1\""
+        " action=\"session-initiate\""
+        " initiator=\"romeo@montague.lit/orchard\""
+        " sid=\"851ba2\">"
+        "<content creator=\"initiator\" name=\"a-file-offer\" senders=\"initiator\">"
+        "<description xmlns=\"urn:xmpp:jingle:apps:file-transfer:4\">"
+        "<file>"
+        "<date>2015-07-26T21:46:00Z</date>"
+        "<desc>This is a test. If this were a real file...</desc>"
+        "<hash xmlns=\"urn:xmpp:hashes:2\" algo=\"md5\">9XBYrZX7UUXwT+kYpXOTRw==</hash>"
+        "<name>test.txt</name>"
+        "<range/>"
+        "<size>6144</size>"
+        "</file>"
+        "</description>"
+        "</content>"
+        "</jingle>"
+        "</iq>");
+
+    QXmppJingleIq session;
+    parsePacket(session, xml);
+    QCOMPARE(session.action(), QXmppJingleIq::SessionInitiate);
+    QCOMPARE(session.contents().size(), 1);
+
+    const QXmppJingleIq::Content content = session.contents()[0];
+    QCOMPARE(content.descriptionMedia(), QString());
+    QCOMPARE(content.payloadTypes().size(), 0);
+
+    const QXmppElement file = content.descriptionFile();
+    QCOMPARE(file.isNull(), false);
+    QCOMPARE(file.firstChildElement("name").value(), QLatin1String("test.txt"));
+    QCOMPARE(file.firstChildElement("size").value(), QLatin1String("6144"));
+    QCOMPARE(file.firstChildElement("range").isNull(), false);
+    serializePacket(session, xml);
+}
+
+void tst_QXmppJingleIq::testSessionForward()
+{
+    const QByteArray xml(
+        "<iq"
+        " id=\"zid615d9\""
+        " to=\"juliet@capulet.lit/balcony\""
+        " from=\"romeo@montague.lit/orchard\""
+        " type=\"set\">"
+        "<jingle xmlns=\"urn:xmpp:jingle:1\""
+        " action=\"transport-info\""
+        " initiator=\"romeo@montague.lit/orchard\""
+        " sid=\"a73sjjvkla37jfea\">"
+        "<content creator=\"initiator\" name=\"voice\">"
+        "<transport xmlns=\"urn:xmpp:jingle:transports:ice-udp:1\" pwd=\"asd88fgpdd777uzjYhagZg\" ufrag=\"8hhy\">"
+        "<candidate component=\"1\" foundation=\"1\" generation=\"0\" id=\"el0747fg11\" ip=\"10.0.1.1\" network=\"1\" port=\"8998\" priority=\"2130706431\" protocol=\"udp\" type=\"host\"/>"
+        "</transport>"
+        "</content>"
+        "</jingle>"
+        "</iq>");
+
+    // the contents are written as they were received
+    QXmppJingleIq session;
+    parsePacket(session, xml);
+    QCOMPARE(session.action(), QXmppJingleIq::TransportInfo);
+    QCOMPARE(session.sid(), QLatin1String("a73sjjvkla37jfea"));
+    serializePacket(session, xml);
+
+    // the contents are parsed on access
+    QXmppJingleIq copy = session;
+    QCOMPARE(copy.contents().size(), 1);
+    QCOMPARE(copy.contents()[0].name(), QLatin1String("voice"));
+    QCOMPARE(copy.contents()[0].transportUser(), QLatin1String("8hhy"));
+    QCOMPARE(copy.contents()[0].transportCandidates().size(), 1);
+    QCOMPARE(copy.contents()[0].transportCandidates()[0].port(), quint16(8998));
+
+    // adding a content keeps the received ones
+    QXmppJingleIq::Content content;
+    content.setCreator("initiator");
+    content.setName("video");
+    session.addContent(content);
+    QCOMPARE(session.contents().size(), 2);
+    QCOMPARE(session.contents()[0].name(), QLatin1String("voice"));
+    QCOMPARE(session.contents()[1].name(), QLatin1String("video"));
+}
+
 void tst_QXmppJingleIq::testTerminate()
 {
     const QByteArray xml(
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpplogger
+SOURCES += tst_qxmpplogger.cpp
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDir>
+#include <QFile>
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppLogger.h"
+
+static QStringList readLines(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QStringList();
+    QStringList lines = QString::fromLocal8Bit(file.readAll()).split("\n");
+    if (!lines.isEmpty() && lines.last().isEmpty())
+        lines.removeLast();
+    return lines;
+}
+
+class tst_QXmppLogger : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void testFile();
+    void testFileBuffered();
+    void testRotation();
+
+private:
+    QString m_path;
+};
+
+void tst_QXmppLogger::init()
+{
+    m_path = QDir::temp().filePath("tst_qxmpplogger.log");
+    QFile::remove(m_path);
+    QFile::remove(m_path + ".1");
+}
+
+void tst_QXmppLogger::cleanup()
+{
+    QFile::remove(m_path);
+    QFile::remove(m_path + ".1");
+}
+
+void tst_QXmppLogger::testFile()
+{
+    QXmppLogger logger;
+    logger.setLogFilePath(m_path);
+    logger.setLoggingType(QXmppLogger::FileLogging);
+    logger.setMessageTypes(QXmppLogger::InformationMessage | QXmppLogger::WarningMessage);
+
+    logger.log(QXmppLogger::InformationMessage, "hello");
+    logger.log(QXmppLogger::DebugMessage, "ignored");
+    logger.log(QXmppLogger::WarningMessage, "world");
+
+    const QStringList lines = readLines(m_path);
+    QCOMPARE(lines.size(), 2);
+    QVERIFY(lines[0].endsWith(" INFO hello"));
+    QVERIFY(lines[1].endsWith(" WARNING world"));
+}
+
+void tst_QXmppLogger::testFileBuffered()
+{
+    QXmppLogger logger;
+    logger.setLogFilePath(m_path);
+    logger.setLoggingType(QXmppLogger::FileLogging);
+    logger.setBufferSize(1000);
+    QCOMPARE(logger.bufferSize(), 1000);
+
+    for (int i = 0; i < 100; ++i)
+        logger.log(QXmppLogger::InformationMessage, QString("message %1").arg(i));
+    logger.flush();
+
+    const QStringList lines = readLines(m_path);
+    QCOMPARE(lines.size(), 100);
+    QVERIFY(lines[0].endsWith(" INFO message 0"));
+    QVERIFY(lines[99].endsWith(" INFO message 99"));
+    QCOMPARE(logger.droppedMessages(), qint64(0));
+
+    // going back to direct writes keeps the messages in order
+    logger.log(QXmppLogger::InformationMessage, "buffered");
+    logger.setBufferSize(0);
+    logger.log(QXmppLogger::InformationMessage, "direct");
+
+    const QStringList moreLines = readLines(m_path);
+    QCOMPARE(moreLines.size(), 102);
+    QVERIFY(moreLines[100].endsWith(" INFO buffered"));
+    QVERIFY(moreLines[101].endsWith(" INFO direct"));
+}
+
+void tst_QXmppLogger::testRotation()
+{
+    QXmppLogger logger;
+    logger.setLogFilePath(m_path);
+    logger.setLoggingType(QXmppLogger::FileLogging);
+    logger.setMaximumFileSize(100);
+    QCOMPARE(logger.maximumFileSize(), qint64(100));
+
+    logger.log(QXmppLogger::InformationMessage, "first");
+    logger.log(QXmppLogger::InformationMessage, QString(100, QLatin1Char('x')));
+    logger.log(QXmppLogger::InformationMessage, "third");
+
+    // each message went over the limit, only the last two files are kept
+    QStringList lines = readLines(m_path + ".1");
+    QCOMPARE(lines.size(), 1);
+    QVERIFY(lines[0].endsWith(QString(100, QLatin1Char('x'))));
+
+    lines = readLines(m_path);
+    QCOMPARE(lines.size(), 1);
+    QVERIFY(lines[0].endsWith(" INFO third"));
+}
+
+QTEST_MAIN(tst_QXmppLogger)
+#include "tst_qxmpplogger.moc"
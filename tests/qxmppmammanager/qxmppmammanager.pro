@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppmammanager
+SOURCES += tst_qxmppmammanager.cpp
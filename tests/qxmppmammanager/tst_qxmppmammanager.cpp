@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+
+#include "QXmppClient.h"
+#include "QXmppMamManager.h"
+#include "QXmppMessage.h"
+#include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "QXmppSimpleArchiveIq.h"
+#include "util.h"
+
+// Serves an archive of numbered messages, whose IDs are their numbers.
+class TestArchiveExtension : public QXmppServerExtension
+{
+public:
+    TestArchiveExtension()
+        : archiveSize(0)
+    {
+    }
+
+    bool handleStanza(const QDomElement &element)
+    {
+        if (element.tagName() != QLatin1String("iq") ||
+            !QXmppSimpleArchiveQueryIq::isSimpleArchiveQueryIq(element))
+            return false;
+
+        QXmppSimpleArchiveQueryIq request;
+        request.parse(element);
+        requests << request.resultSetQuery().after();
+
+        const QString to = element.attribute("from");
+        const int first = request.resultSetQuery().after().toInt() + 1;
+        const int last = qMin(archiveSize, first + request.resultSetQuery().max() - 1);
+        for (int i = first; i <= last; ++i) {
+            const QString xml = QString("<message xmlns=\"jabber:client\" to=\"%1\">"
+                "<result xmlns=\"urn:xmpp:mam:tmp\" queryid=\"%2\" id=\"%3\">"
+                "<forwarded xmlns=\"urn:xmpp:forward:0\">"
+                "<message from=\"user2@localhost/QXmpp\" to=\"user1@localhost\" type=\"chat\"><body>message %3</body></message>"
+                "</forwarded></result></message>").arg(to, request.queryId(), QString::number(i));
+            server()->sendData(to, xml.toUtf8());
+        }
+
+        QXmppIq result(QXmppIq::Result);
+        result.setId(request.id());
+        result.setTo(to);
+        server()->sendPacket(result);
+        return true;
+    }
+
+    int archiveSize;
+    QStringList requests;
+};
+
+class TestStore : public QXmppMamStore
+{
+public:
+    QString lastStanzaId(const QString &jid)
+    {
+        return lastIds.value(jid);
+    }
+
+    void storeMessage(const QString &jid, const QString &stanzaId, const QXmppMessage &message)
+    {
+        lastIds.insert(jid, stanzaId);
+        bodies << message.body();
+    }
+
+    QHash<QString, QString> lastIds;
+    QStringList bodies;
+};
+
+class TestMessageCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    QStringList queryIds;
+    QStringList jids;
+    QStringList stanzaIds;
+    QStringList bodies;
+
+public slots:
+    void messageReceived(const QString &queryId, const QString &jid, const QString &stanzaId, const QXmppMessage &message)
+    {
+        queryIds << queryId;
+        jids << jid;
+        stanzaIds << stanzaId;
+        bodies << message.body();
+    }
+};
+
+class tst_QXmppMamManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testCatchUp();
+    void testRetrieve();
+
+private:
+    TestPasswordChecker m_passwordChecker;
+    TestArchiveExtension *m_archive;
+    QXmppServer *m_server;
+    QXmppClient *m_client;
+    QXmppMamManager *m_manager;
+};
+
+void tst_QXmppMamManager::initTestCase()
+{
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12360;
+
+    m_passwordChecker.addCredentials("user1", "testpwd");
+    m_archive = new TestArchiveExtension;
+    m_server = new QXmppServer;
+    m_server->setDomain("localhost");
+    m_server->setPasswordChecker(&m_passwordChecker);
+    m_server->addExtension(m_archive);
+    QVERIFY(m_server->listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+
+    m_client = new QXmppClient;
+    m_manager = new QXmppMamManager;
+    m_client->addExtension(m_manager);
+    QSignalSpy connected(m_client, SIGNAL(connected()));
+    m_client->connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(m_client->isConnected());
+}
+
+void tst_QXmppMamManager::cleanupTestCase()
+{
+    delete m_client;
+    delete m_server;
+}
+
+void tst_QXmppMamManager::testCatchUp()
+{
+    TestStore store;
+    m_manager->setStore(&store);
+    m_manager->setPageSize(5);
+    m_archive->archiveSize = 12;
+    m_archive->requests.clear();
+
+    // without stored messages, everything is retrieved
+    QSignalSpy finished(m_manager, SIGNAL(queryFinished(QString,QString,bool)));
+    QVERIFY(!m_manager->catchUp("user2@localhost").isEmpty());
+    for (int i = 0; i < 50 && finished.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(finished.size(), 1);
+    QCOMPARE(finished[0][2].toBool(), true);
+    QCOMPARE(store.bodies.size(), 12);
+    QCOMPARE(store.lastIds.value("user2@localhost"), QLatin1String("12"));
+
+    // after new messages are archived, only those are retrieved
+    m_archive->archiveSize = 15;
+    m_archive->requests.clear();
+    store.bodies.clear();
+    finished.clear();
+    QVERIFY(!m_manager->catchUp("user2@localhost").isEmpty());
+    for (int i = 0; i < 50 && finished.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(finished.size(), 1);
+    QCOMPARE(m_archive->requests, QStringList() << "12");
+    QCOMPARE(store.bodies, QStringList() << "message 13" << "message 14" << "message 15");
+
+    m_manager->setStore(0);
+}
+
+void tst_QXmppMamManager::testRetrieve()
+{
+    m_manager->setPageSize(10);
+    m_archive->archiveSize = 25;
+    m_archive->requests.clear();
+
+    TestMessageCollector received;
+    connect(m_manager, SIGNAL(messageReceived(QString,QString,QString,QXmppMessage)),
+            &received, SLOT(messageReceived(QString,QString,QString,QXmppMessage)));
+    QSignalSpy finished(m_manager, SIGNAL(queryFinished(QString,QString,bool)));
+    const QString queryId = m_manager->retrieveMessages("user2@localhost");
+    QVERIFY(!queryId.isEmpty());
+    for (int i = 0; i < 50 && finished.isEmpty(); ++i)
+        QTest::qWait(100);
+
+    // the pages are requested one after the other
+    QCOMPARE(m_archive->requests, QStringList() << "" << "10" << "20");
+
+    // the messages are delivered in order, as they arrive
+    QCOMPARE(received.bodies.size(), 25);
+    for (int i = 0; i < received.bodies.size(); ++i) {
+        QCOMPARE(received.queryIds[i], queryId);
+        QCOMPARE(received.jids[i], QLatin1String("user2@localhost"));
+        QCOMPARE(received.stanzaIds[i], QString::number(i + 1));
+        QCOMPARE(received.bodies[i], QString("message %1").arg(i + 1));
+    }
+
+    QCOMPARE(finished.size(), 1);
+    QCOMPARE(finished[0][0].toString(), queryId);
+    QCOMPARE(finished[0][2].toBool(), true);
+}
+
+QTEST_MAIN(tst_QXmppMamManager)
+#include "tst_qxmppmammanager.moc"
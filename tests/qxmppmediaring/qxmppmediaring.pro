@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppmediaring
+SOURCES += tst_qxmppmediaring.cpp
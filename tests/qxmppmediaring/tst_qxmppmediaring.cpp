@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppMediaRing.h"
+
+class tst_QXmppMediaRing : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testCreate();
+    void testWrite();
+    void testReserve();
+    void testDrop();
+    void testOverrun();
+    void testShared();
+};
+
+static QXmppMediaRing::Frame audioFrame(int size, qint64 timestamp)
+{
+    QXmppMediaRing::Frame frame;
+    frame.type = QXmppMediaRing::AudioMedia;
+    frame.size = size;
+    frame.timestamp = timestamp;
+    frame.clockrate = 8000;
+    return frame;
+}
+
+void tst_QXmppMediaRing::testCreate()
+{
+    QXmppMediaRing ring;
+    QVERIFY(!ring.isValid());
+    QVERIFY(!ring.create(QString(), 0, 100));
+    QVERIFY(!ring.create(QString(), 4, 0));
+
+    QVERIFY(ring.create(QString(), 4, 100));
+    QVERIFY(ring.isValid());
+    QCOMPARE(ring.key(), QString());
+    QCOMPARE(ring.slotCount(), 4);
+    QCOMPARE(ring.slotSize(), 128);
+    QCOMPARE(ring.droppedFrames(), quint32(0));
+
+    ring.detach();
+    QVERIFY(!ring.isValid());
+}
+
+void tst_QXmppMediaRing::testWrite()
+{
+    QXmppMediaRing ring;
+    QVERIFY(ring.create(QString(), 4, 100));
+
+    QXmppMediaRing::Frame frame;
+    QVERIFY(!ring.acquire(&frame));
+
+    const QByteArray data("hello");
+    QVERIFY(ring.write(audioFrame(data.size(), 160), reinterpret_cast<const uchar*>(data.constData())));
+
+    QVERIFY(ring.acquire(&frame));
+    QCOMPARE(frame.type, QXmppMediaRing::AudioMedia);
+    QCOMPARE(frame.sequence, quint32(1));
+    QCOMPARE(frame.timestamp, qint64(160));
+    QCOMPARE(frame.clockrate, 8000);
+    QCOMPARE(QByteArray(reinterpret_cast<const char*>(frame.data), frame.size), data);
+    ring.release(frame);
+
+    QVERIFY(!ring.acquire(&frame));
+
+    // frames which do not fit in a slot are dropped
+    QVERIFY(!ring.write(audioFrame(200, 320), reinterpret_cast<const uchar*>(QByteArray(200, 'x').constData())));
+    QCOMPARE(ring.droppedFrames(), quint32(1));
+}
+
+void tst_QXmppMediaRing::testReserve()
+{
+    QXmppMediaRing ring;
+    QVERIFY(ring.create(QString(), 2, 64));
+
+    // frames are written in place
+    uchar *data = ring.reserve(3);
+    QVERIFY(data);
+    QCOMPARE(ring.reservation(), data);
+    QCOMPARE(ring.reserve(3), data);
+    memcpy(data, "abc", 3);
+
+    QXmppMediaRing::Frame frame;
+    QVERIFY(!ring.acquire(&frame));
+
+    QXmppMediaRing::Frame video;
+    video.type = QXmppMediaRing::VideoMedia;
+    video.size = 3;
+    video.width = 3;
+    video.height = 1;
+    video.bytesPerLine = 3;
+    QVERIFY(ring.publish(video));
+    QVERIFY(!ring.reservation());
+    QVERIFY(!ring.publish(video));
+
+    QVERIFY(ring.acquire(&frame));
+    QCOMPARE(frame.type, QXmppMediaRing::VideoMedia);
+    QCOMPARE(frame.width, 3);
+    QCOMPARE(frame.data, static_cast<const uchar*>(data));
+    QCOMPARE(QByteArray(reinterpret_cast<const char*>(frame.data), frame.size), QByteArray("abc"));
+    ring.release(frame);
+}
+
+void tst_QXmppMediaRing::testDrop()
+{
+    QXmppMediaRing ring;
+    QVERIFY(ring.create(QString(), 4, 16));
+    const uchar data[16] = {0};
+
+    QXmppMediaRing::Frame held;
+    QVERIFY(ring.write(audioFrame(16, 0), data));
+    QVERIFY(ring.acquire(&held));
+
+    // the producer does not overwrite a slot which is referenced
+    for (int i = 1; i < 4; ++i)
+        QVERIFY(ring.write(audioFrame(16, i), data));
+    QVERIFY(!ring.write(audioFrame(16, 4), data));
+    QCOMPARE(ring.droppedFrames(), quint32(1));
+    QCOMPARE(held.timestamp, qint64(0));
+
+    ring.release(held);
+    QVERIFY(ring.write(audioFrame(16, 5), data));
+}
+
+void tst_QXmppMediaRing::testOverrun()
+{
+    QXmppMediaRing ring;
+    QVERIFY(ring.create(QString(), 4, 16));
+    const uchar data[16] = {0};
+
+    for (int i = 0; i < 10; ++i)
+        QVERIFY(ring.write(audioFrame(16, i), data));
+
+    // a consumer which fell behind skips to the oldest frame
+    QXmppMediaRing::Frame frame;
+    for (int i = 6; i < 10; ++i) {
+        QVERIFY(ring.acquire(&frame));
+        QCOMPARE(frame.timestamp, qint64(i));
+        ring.release(frame);
+    }
+    QVERIFY(!ring.acquire(&frame));
+}
+
+void tst_QXmppMediaRing::testShared()
+{
+    const QString key = QString("tst_qxmppmediaring_%1").arg(QCoreApplication::applicationPid());
+
+    QXmppMediaRing producer;
+    if (!producer.create(key, 2, 32)) {
+#if QT_VERSION < 0x050000
+        QSKIP("Shared memory is not available", SkipAll);
+#else
+        QSKIP("Shared memory is not available");
+#endif
+    }
+    QCOMPARE(producer.key(), key);
+
+    QXmppMediaRing consumer;
+    QVERIFY(consumer.attach(key));
+    QCOMPARE(consumer.slotCount(), 2);
+    QCOMPARE(consumer.slotSize(), 64);
+
+    QXmppMediaRing::Frame frame;
+    QVERIFY(!consumer.acquire(&frame));
+
+    const QByteArray data("shared");
+    QVERIFY(producer.write(audioFrame(data.size(), 160), reinterpret_cast<const uchar*>(data.constData())));
+    QVERIFY(consumer.acquire(&frame));
+    QCOMPARE(QByteArray(reinterpret_cast<const char*>(frame.data), frame.size), data);
+    consumer.release(frame);
+
+    QXmppMediaRing other;
+    QVERIFY(!other.attach(key + "_missing"));
+}
+
+QTEST_MAIN(tst_QXmppMediaRing)
+#include "tst_qxmppmediaring.moc"
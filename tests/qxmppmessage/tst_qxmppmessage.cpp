@@ -358,6 +358,17 @@ void tst_QXmppMessage::testSubextensions()
     QCOMPARE(message.extensions().size(), 1);
     QCOMPARE(message.extensions().first().tagName(), QLatin1String("result"));
     serializePacket(message, xml);
+
+    // accessing the extension builds its tree
+    const QXmppElement result = message.extensions().first();
+    QCOMPARE(result.attribute("queryid"), QLatin1String("f27"));
+    const QXmppElement forwarded = result.firstChildElement("forwarded");
+    QCOMPARE(forwarded.attribute("xmlns"), QLatin1String("urn:xmpp:forward:0"));
+    const QXmppElement delay = forwarded.firstChildElement();
+    QCOMPARE(delay.tagName(), QLatin1String("delay"));
+    QCOMPARE(delay.nextSiblingElement().tagName(), QLatin1String("message"));
+    QVERIFY(delay.nextSiblingElement().nextSiblingElement().isNull());
+    serializePacket(message, xml);
 }
 
 void tst_QXmppMessage::testForwarding()
@@ -585,8 +596,10 @@ void tst_QXmppMessage::testMessageCarbons()
     QXmppMessage message;
     parsePacket(message, xml);
     QCOMPARE(message.hasMessageCarbon(), true);
+    QCOMPARE(message.carbonDirection(), QXmppMessage::NoCarbon);
 
     QXmppMessage fwd = message.carbonMessage();
+    QCOMPARE(fwd.carbonDirection(), QXmppMessage::SentCarbon);
     QCOMPARE(fwd.stamp(), QDateTime(QDate(2010, 06, 29), QTime(8, 23, 6), Qt::UTC));
     QCOMPARE(fwd.body(), QString("ABC"));
     QCOMPARE(fwd.to(), QString("foo@example.com/QXmpp"));
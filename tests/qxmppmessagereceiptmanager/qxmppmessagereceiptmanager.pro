@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppmessagereceiptmanager
+SOURCES += tst_qxmppmessagereceiptmanager.cpp
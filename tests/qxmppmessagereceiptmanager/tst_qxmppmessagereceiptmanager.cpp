@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppMessageReceiptManager.h"
+#include "QXmppServer.h"
+#include "util.h"
+
+class TestMarkerCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    QStringList jids;
+    QStringList ids;
+    QList<QXmppMessage::Marker> markers;
+
+public slots:
+    void markerReceived(const QString &jid, const QString &id, QXmppMessage::Marker marker)
+    {
+        jids << jid;
+        ids << id;
+        markers << marker;
+    }
+};
+
+class tst_QXmppMessageReceiptManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testCoalesced();
+    void testReceipts();
+
+private:
+    bool sendMessages(int count, bool markable);
+
+    TestPasswordChecker m_passwordChecker;
+    QXmppServer *m_server;
+    QXmppClient *m_sender;
+    QXmppClient *m_receiver;
+    QXmppMessageReceiptManager *m_senderManager;
+    QXmppMessageReceiptManager *m_receiverManager;
+};
+
+void tst_QXmppMessageReceiptManager::initTestCase()
+{
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12361;
+
+    m_passwordChecker.addCredentials("user1", "testpwd");
+    m_passwordChecker.addCredentials("user2", "testpwd");
+    m_server = new QXmppServer;
+    m_server->setDomain("localhost");
+    m_server->setPasswordChecker(&m_passwordChecker);
+    QVERIFY(m_server->listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+
+    m_sender = new QXmppClient;
+    m_senderManager = new QXmppMessageReceiptManager;
+    m_sender->addExtension(m_senderManager);
+    QSignalSpy senderConnected(m_sender, SIGNAL(connected()));
+    config.setUser("user1");
+    m_sender->connectToServer(config);
+
+    m_receiver = new QXmppClient;
+    m_receiverManager = new QXmppMessageReceiptManager;
+    m_receiver->addExtension(m_receiverManager);
+    QSignalSpy receiverConnected(m_receiver, SIGNAL(connected()));
+    config.setUser("user2");
+    m_receiver->connectToServer(config);
+
+    for (int i = 0; i < 50 && (senderConnected.isEmpty() || receiverConnected.isEmpty()); ++i)
+        QTest::qWait(100);
+    QVERIFY(m_sender->isConnected());
+    QVERIFY(m_receiver->isConnected());
+}
+
+void tst_QXmppMessageReceiptManager::cleanupTestCase()
+{
+    delete m_sender;
+    delete m_receiver;
+    delete m_server;
+}
+
+bool tst_QXmppMessageReceiptManager::sendMessages(int count, bool markable)
+{
+    for (int i = 1; i <= count; ++i) {
+        QXmppMessage message(QString(), "user2@localhost/QXmpp", QString("message %1").arg(i));
+        message.setId(QString("msg%1").arg(i));
+        message.setReceiptRequested(true);
+        message.setMarkable(markable);
+        if (!m_sender->sendPacket(message))
+            return false;
+    }
+    return true;
+}
+
+void tst_QXmppMessageReceiptManager::testCoalesced()
+{
+    m_receiverManager->setCoalescingInterval(300);
+    m_receiverManager->setCoalescedMarker(QXmppMessage::Displayed);
+
+    // a single marker acknowledges all the messages
+    QSignalSpy delivered(m_senderManager, SIGNAL(messageDelivered(QString,QString)));
+    TestMarkerCollector marked;
+    connect(m_senderManager, SIGNAL(markerReceived(QString,QString,QXmppMessage::Marker)),
+            &marked, SLOT(markerReceived(QString,QString,QXmppMessage::Marker)));
+    QVERIFY(sendMessages(5, true));
+    for (int i = 0; i < 50 && marked.ids.isEmpty(); ++i)
+        QTest::qWait(100);
+    QTest::qWait(500);
+
+    QCOMPARE(delivered.size(), 0);
+    QCOMPARE(marked.ids, QStringList() << "msg5");
+    QCOMPARE(marked.jids, QStringList() << "user2@localhost/QXmpp");
+    QCOMPARE(marked.markers.first(), QXmppMessage::Displayed);
+
+    // messages which are not markable still get receipts
+    QVERIFY(sendMessages(2, false));
+    for (int i = 0; i < 50 && delivered.size() < 2; ++i)
+        QTest::qWait(100);
+    QCOMPARE(delivered.size(), 2);
+    QCOMPARE(marked.ids.size(), 1);
+
+    m_receiverManager->setCoalescingInterval(0);
+}
+
+void tst_QXmppMessageReceiptManager::testReceipts()
+{
+    QCOMPARE(m_receiverManager->coalescingInterval(), 0);
+
+    // each message gets its own receipt
+    QSignalSpy delivered(m_senderManager, SIGNAL(messageDelivered(QString,QString)));
+    QVERIFY(sendMessages(3, true));
+    for (int i = 0; i < 50 && delivered.size() < 3; ++i)
+        QTest::qWait(100);
+    QCOMPARE(delivered.size(), 3);
+    QCOMPARE(delivered[0][1].toString(), QLatin1String("msg1"));
+    QCOMPARE(delivered[2][1].toString(), QLatin1String("msg3"));
+}
+
+QTEST_MAIN(tst_QXmppMessageReceiptManager)
+#include "tst_qxmppmessagereceiptmanager.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppmetrics
+SOURCES += tst_qxmppmetrics.cpp
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QThread>
+#include <QtTest>
+
+#include "QXmppLogger.h"
+#include "QXmppMetrics.h"
+
+class MetricsThread : public QThread
+{
+public:
+    MetricsThread(int counter)
+        : m_counter(counter)
+    {
+    }
+
+protected:
+    void run()
+    {
+        for (int i = 0; i < 1000; ++i)
+            QXmppMetrics::updateCounter(m_counter);
+    }
+
+private:
+    int m_counter;
+};
+
+class tst_QXmppMetrics : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testCounter();
+    void testGauge();
+    void testHistogram();
+    void testLogger();
+};
+
+void tst_QXmppMetrics::testCounter()
+{
+    const int counter = QXmppMetrics::counter("test.counter");
+    QVERIFY(counter >= 0);
+    QCOMPARE(QXmppMetrics::counter("test.counter"), counter);
+    QVERIFY(QXmppMetrics::counter("test.other-counter") != counter);
+    QCOMPARE(QXmppMetrics::snapshot().value("test.counter").toLongLong(), qint64(0));
+
+    QXmppMetrics::updateCounter(counter);
+    QXmppMetrics::updateCounter(counter, 2);
+    QCOMPARE(QXmppMetrics::snapshot().value("test.counter").toLongLong(), qint64(3));
+
+    // counts from other threads are kept once they end
+    MetricsThread thread1(counter);
+    MetricsThread thread2(counter);
+    thread1.start();
+    thread2.start();
+    QVERIFY(thread1.wait());
+    QVERIFY(thread2.wait());
+    QCOMPARE(QXmppMetrics::snapshot().value("test.counter").toLongLong(), qint64(2003));
+}
+
+void tst_QXmppMetrics::testGauge()
+{
+    const int gauge = QXmppMetrics::gauge("test.gauge");
+    QXmppMetrics::setGauge(gauge, 1.5);
+    QCOMPARE(QXmppMetrics::snapshot().value("test.gauge").toDouble(), 1.5);
+    QXmppMetrics::setGauge(gauge, 3.0);
+    QCOMPARE(QXmppMetrics::snapshot().value("test.gauge").toDouble(), 3.0);
+}
+
+void tst_QXmppMetrics::testHistogram()
+{
+    const int histogram = QXmppMetrics::histogram("test.latency");
+    QVERIFY(!QXmppMetrics::snapshot().contains("test.latency.count"));
+
+    for (int i = 1; i <= 1000; ++i)
+        QXmppMetrics::recordValue(histogram, i);
+
+    const QVariantMap values = QXmppMetrics::snapshot();
+    QCOMPARE(values.value("test.latency.count").toLongLong(), qint64(1000));
+    QCOMPARE(values.value("test.latency.mean").toDouble(), 500.5);
+    QCOMPARE(values.value("test.latency.max").toLongLong(), qint64(1000));
+
+    // percentiles are within 12.5% of the exact value
+    const qint64 p50 = values.value("test.latency.p50").toLongLong();
+    QVERIFY(p50 >= 500 && p50 <= 563);
+    const qint64 p99 = values.value("test.latency.p99").toLongLong();
+    QVERIFY(p99 >= 990 && p99 <= 1000);
+}
+
+void tst_QXmppMetrics::testLogger()
+{
+    QXmppLogger logger;
+    logger.updateCounter("test.logger-counter", 5);
+    logger.setGauge("test.logger-gauge", 2.0);
+
+    const QVariantMap values = QXmppMetrics::snapshot();
+    QCOMPARE(values.value("test.logger-counter").toLongLong(), qint64(5));
+    QCOMPARE(values.value("test.logger-gauge").toDouble(), 2.0);
+}
+
+QTEST_MAIN(tst_QXmppMetrics)
+#include "tst_qxmppmetrics.moc"
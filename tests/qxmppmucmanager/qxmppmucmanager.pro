@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppmucmanager
+SOURCES += tst_qxmppmucmanager.cpp
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppMucManager.h"
+#include "QXmppServer.h"
+#include "QXmppServerMuc.h"
+#include "QXmppUtils.h"
+#include "util.h"
+
+class TestMessageCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    QList<QXmppMessage> messages;
+
+public slots:
+    void messageReceived(const QXmppMessage &message)
+    {
+        messages << message;
+    }
+};
+
+class tst_QXmppMucManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testJoinRooms();
+
+private:
+    bool connectClient(QXmppClient *client, const QString &user);
+
+    TestPasswordChecker m_passwordChecker;
+    QXmppServer *m_server;
+};
+
+bool tst_QXmppMucManager::connectClient(QXmppClient *client, const QString &user)
+{
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12382);
+    config.setUser(user);
+    config.setPassword("testpwd");
+
+    QSignalSpy connected(client, SIGNAL(connected()));
+    client->connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    return client->isConnected();
+}
+
+void tst_QXmppMucManager::initTestCase()
+{
+    m_passwordChecker.addCredentials("user1", "testpwd");
+    m_passwordChecker.addCredentials("user2", "testpwd");
+
+    m_server = new QXmppServer;
+    m_server->setDomain("localhost");
+    m_server->setPasswordChecker(&m_passwordChecker);
+    m_server->addExtension(new QXmppServerMuc);
+    QVERIFY(m_server->listenForClients(QHostAddress::LocalHost, 12382));
+}
+
+void tst_QXmppMucManager::cleanupTestCase()
+{
+    delete m_server;
+}
+
+void tst_QXmppMucManager::testJoinRooms()
+{
+    // user1 creates a room and talks
+    QXmppClient client1;
+    QVERIFY(connectClient(&client1, "user1"));
+
+    QXmppPresence join;
+    join.setTo("room1@conference.localhost/alice");
+    join.setMucSupported(true);
+    QVERIFY(client1.sendPacket(join));
+    QXmppMessage message(QString(), "room1@conference.localhost", "First");
+    message.setType(QXmppMessage::GroupChat);
+    QVERIFY(client1.sendPacket(message));
+    QTest::qWait(200);
+
+    // user2 joins several rooms at once
+    QXmppClient client2;
+    QXmppMucManager *manager = new QXmppMucManager;
+    client2.addExtension(manager);
+    QVERIFY(connectClient(&client2, "user2"));
+
+    const QStringList roomJids = QStringList()
+        << "room1@conference.localhost"
+        << "room2@conference.localhost"
+        << "room3@conference.localhost";
+    const QList<QXmppMucRoom*> rooms = manager->joinRooms(roomJids, "bob");
+    QCOMPARE(rooms.size(), 3);
+    QCOMPARE(manager->rooms().size(), 3);
+
+    QXmppMucRoom *room1 = rooms[0];
+    QVERIFY(room1->coalesceUpdates());
+    TestMessageCollector received;
+    connect(room1, SIGNAL(messageReceived(QXmppMessage)),
+            &received, SLOT(messageReceived(QXmppMessage)));
+    QSignalSpy updates(room1, SIGNAL(participantsUpdated(QStringList,QStringList,QStringList)));
+
+    for (int i = 0; i < 50; ++i) {
+        bool done = true;
+        foreach (QXmppMucRoom *room, rooms)
+            done = done && room->isJoined() && !room->name().isEmpty();
+        if (done)
+            break;
+        QTest::qWait(100);
+    }
+    foreach (QXmppMucRoom *room, rooms) {
+        QVERIFY(room->isJoined());
+        QCOMPARE(room->nickName(), QLatin1String("bob"));
+        QCOMPARE(room->name(), QXmppUtils::jidToUser(room->jid()));
+    }
+
+    // the history was not requested, only the subject was received
+    foreach (const QXmppMessage &msg, received.messages)
+        QVERIFY(msg.body().isEmpty());
+    received.messages.clear();
+
+    // the occupants were reported at once
+    QCOMPARE(updates.size(), 1);
+    QStringList added = updates[0][0].toStringList();
+    added.sort();
+    QCOMPARE(added, QStringList()
+        << "room1@conference.localhost/alice"
+        << "room1@conference.localhost/bob");
+
+    // new messages are dispatched to their room
+    message.setBody("Second");
+    QVERIFY(client1.sendPacket(message));
+    for (int i = 0; i < 50 && received.messages.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received.messages.size(), 1);
+    QCOMPARE(received.messages[0].body(), QLatin1String("Second"));
+    QVERIFY(room1->lastMessageTime().isValid());
+}
+
+QTEST_MAIN(tst_QXmppMucManager)
+#include "tst_qxmppmucmanager.moc"
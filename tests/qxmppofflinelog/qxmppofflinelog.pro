@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppofflinelog
+SOURCES += tst_qxmppofflinelog.cpp
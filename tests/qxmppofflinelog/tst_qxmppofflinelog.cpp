@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDir>
+#include <QFile>
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppServerOffline_p.h"
+
+class tst_QXmppOfflineLog : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void testAppend();
+    void testRecover();
+    void testSegments();
+    void testTruncated();
+
+private:
+    QDir m_dir;
+};
+
+void tst_QXmppOfflineLog::init()
+{
+    m_dir = QDir(QDir::temp().filePath("qxmpp-offlinelog-test"));
+    foreach (const QString &name, m_dir.entryList(QDir::Files))
+        m_dir.remove(name);
+}
+
+void tst_QXmppOfflineLog::testAppend()
+{
+    const QDateTime stamp(QDate(2015, 9, 2), QTime(12, 30, 0), Qt::UTC);
+
+    QXmppOfflineLog log;
+    QVERIFY(log.open(m_dir.path()));
+    QVERIFY(log.isOpen());
+
+    log.append("foo@example.com", stamp, "<message><body>1</body></message>");
+    log.append("bar@example.com", stamp, "<message><body>2</body></message>");
+    log.append("foo@example.com", stamp.addSecs(1), "<message><body>3</body></message>");
+    QVERIFY(log.pendingSize() > 0);
+    QCOMPARE(log.count("foo@example.com"), 2);
+    QCOMPARE(log.count("bar@example.com"), 1);
+    QCOMPARE(log.count("baz@example.com"), 0);
+
+    // reading the messages commits them
+    const QList<QXmppOfflineLog::Message> messages = log.messages("foo@example.com");
+    QCOMPARE(log.pendingSize(), qint64(0));
+    QCOMPARE(messages.size(), 2);
+    QCOMPARE(messages[0].first, stamp);
+    QCOMPARE(messages[0].second, QByteArray("<message><body>1</body></message>"));
+    QCOMPARE(messages[1].first, stamp.addSecs(1));
+    QCOMPARE(messages[1].second, QByteArray("<message><body>3</body></message>"));
+
+    log.remove("foo@example.com");
+    QCOMPARE(log.count("foo@example.com"), 0);
+    QVERIFY(log.messages("foo@example.com").isEmpty());
+    QCOMPARE(log.count("bar@example.com"), 1);
+}
+
+void tst_QXmppOfflineLog::testRecover()
+{
+    const QDateTime stamp(QDate(2015, 9, 2), QTime(12, 30, 0), Qt::UTC);
+
+    QXmppOfflineLog log;
+    QVERIFY(log.open(m_dir.path()));
+    log.append("foo@example.com", stamp, "<message><body>1</body></message>");
+    log.append("bar@example.com", stamp, "<message><body>2</body></message>");
+    log.remove("foo@example.com");
+    log.append("foo@example.com", stamp, "<message><body>3</body></message>");
+    QVERIFY(log.commit());
+    log.close();
+    QVERIFY(!log.isOpen());
+
+    // the index is rebuilt from the records
+    QVERIFY(log.open(m_dir.path()));
+    QCOMPARE(log.count("foo@example.com"), 1);
+    QCOMPARE(log.messages("foo@example.com").first().second, QByteArray("<message><body>3</body></message>"));
+    QCOMPARE(log.count("bar@example.com"), 1);
+
+    // purges survive a new opening
+    log.remove("foo@example.com");
+    log.close();
+    QVERIFY(log.open(m_dir.path()));
+    QCOMPARE(log.count("foo@example.com"), 0);
+    QCOMPARE(log.count("bar@example.com"), 1);
+}
+
+void tst_QXmppOfflineLog::testSegments()
+{
+    const QDateTime stamp(QDate(2015, 9, 2), QTime(12, 30, 0), Qt::UTC);
+
+    QXmppOfflineLog log;
+    log.setMaximumSegmentSize(1);
+    QVERIFY(log.open(m_dir.path()));
+    QCOMPARE(log.segmentCount(), 1);
+
+    // every commit starts a new segment
+    log.append("foo@example.com", stamp, "<message><body>1</body></message>");
+    QVERIFY(log.commit());
+    log.append("bar@example.com", stamp, "<message><body>2</body></message>");
+    QVERIFY(log.commit());
+    QCOMPARE(log.segmentCount(), 3);
+
+    // the second segment cannot be deleted before the first one
+    log.remove("bar@example.com");
+    QVERIFY(log.commit());
+    QCOMPARE(log.segmentCount(), 4);
+
+    // segments are deleted once they hold no messages
+    log.remove("foo@example.com");
+    QVERIFY(log.commit());
+    QCOMPARE(log.segmentCount(), 1);
+    QCOMPARE(m_dir.entryList(QDir::Files).size(), 1);
+}
+
+void tst_QXmppOfflineLog::testTruncated()
+{
+    const QDateTime stamp(QDate(2015, 9, 2), QTime(12, 30, 0), Qt::UTC);
+
+    QXmppOfflineLog log;
+    QVERIFY(log.open(m_dir.path()));
+    log.append("foo@example.com", stamp, "<message><body>1</body></message>");
+    log.append("foo@example.com", stamp, "<message><body>2</body></message>");
+    log.close();
+
+    // simulate a crash while the last record was written
+    const QStringList names = m_dir.entryList(QDir::Files);
+    QCOMPARE(names.size(), 1);
+    QFile file(m_dir.filePath(names.first()));
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.resize(file.size() - 10));
+    file.close();
+
+    QVERIFY(log.open(m_dir.path()));
+    QCOMPARE(log.count("foo@example.com"), 1);
+    QCOMPARE(log.messages("foo@example.com").first().second, QByteArray("<message><body>1</body></message>"));
+}
+
+QTEST_MAIN(tst_QXmppOfflineLog)
+#include "tst_qxmppofflinelog.moc"
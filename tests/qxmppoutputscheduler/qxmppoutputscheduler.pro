@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppoutputscheduler
+SOURCES += tst_qxmppoutputscheduler.cpp
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+
+#include "QXmppOutputScheduler_p.h"
+#include "util.h"
+
+Q_DECLARE_METATYPE(QXmppOutputScheduler::Class)
+
+static QByteArray bulkData(int size)
+{
+    const QByteArray head = "<iq type='set' to='a@localhost/r' id='x'><data xmlns='http://jabber.org/protocol/ibb' seq='0' sid='s'>";
+    const QByteArray tail = "</data></iq>";
+    return head + QByteArray(size - head.size() - tail.size(), 'A') + tail;
+}
+
+static QByteArray groupChatMessage(int size)
+{
+    const QByteArray head = "<message type='groupchat' to='a@localhost/r'><body>";
+    const QByteArray tail = "</body></message>";
+    return head + QByteArray(size - head.size() - tail.size(), 'B') + tail;
+}
+
+class tst_QXmppOutputScheduler : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testClassify_data();
+    void testClassify();
+    void testControlFirst();
+    void testOrder();
+    void testPriority();
+    void testWeights();
+    void testCoalescing();
+    void testClear();
+};
+
+void tst_QXmppOutputScheduler::testClassify_data()
+{
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<QXmppOutputScheduler::Class>("cls");
+
+    QTest::newRow("stream-error") << QByteArray("<stream:error><policy-violation xmlns='urn:ietf:params:xml:ns:xmpp-streams'/></stream:error>") << QXmppOutputScheduler::ControlClass;
+    QTest::newRow("whitespace") << QByteArray(" ") << QXmppOutputScheduler::ControlClass;
+    QTest::newRow("iq") << QByteArray("<iq type='result' id='1'/>") << QXmppOutputScheduler::IqClass;
+    QTest::newRow("iq-ibb") << bulkData(256) << QXmppOutputScheduler::BulkClass;
+    QTest::newRow("message") << QByteArray("<message to='a@localhost'><body>hi</body></message>") << QXmppOutputScheduler::ChatClass;
+    QTest::newRow("message-chat") << QByteArray("<message type=\"chat\" to='a@localhost'><body>hi</body></message>") << QXmppOutputScheduler::ChatClass;
+    QTest::newRow("message-groupchat") << QByteArray("<message type=\"groupchat\" to='a@localhost'><body>hi</body></message>") << QXmppOutputScheduler::GroupChatClass;
+    QTest::newRow("message-ibb") << QByteArray("<message to='a@localhost'><data xmlns='http://jabber.org/protocol/ibb' seq='0' sid='s'>AAAA</data></message>") << QXmppOutputScheduler::BulkClass;
+    QTest::newRow("presence") << QByteArray("<presence from='a@localhost/r'/>") << QXmppOutputScheduler::PresenceClass;
+}
+
+void tst_QXmppOutputScheduler::testClassify()
+{
+    QFETCH(QByteArray, data);
+    QFETCH(QXmppOutputScheduler::Class, cls);
+
+    QCOMPARE(int(QXmppOutputScheduler::classify(data)), int(cls));
+}
+
+void tst_QXmppOutputScheduler::testControlFirst()
+{
+    QXmppOutputScheduler scheduler;
+    scheduler.enqueue(bulkData(1000));
+    scheduler.enqueue("<iq type='result' id='1'/>");
+    scheduler.enqueue("</stream:stream>");
+    QCOMPARE(scheduler.count(), 3);
+
+    QCOMPARE(scheduler.dequeue(), QByteArray("</stream:stream>"));
+    QCOMPARE(scheduler.dequeue(), QByteArray("<iq type='result' id='1'/>"));
+    QCOMPARE(scheduler.dequeue(), bulkData(1000));
+    QVERIFY(scheduler.isEmpty());
+    QVERIFY(scheduler.dequeue().isEmpty());
+}
+
+void tst_QXmppOutputScheduler::testOrder()
+{
+    QXmppOutputScheduler scheduler;
+    for (int i = 0; i < 10; ++i)
+        scheduler.enqueue(QString("<iq type='result' id='%1'/>").arg(i).toUtf8());
+    for (int i = 0; i < 10; ++i)
+        QCOMPARE(scheduler.dequeue(), QString("<iq type='result' id='%1'/>").arg(i).toUtf8());
+}
+
+void tst_QXmppOutputScheduler::testPriority()
+{
+    // IQ results queued behind bulk data go out first
+    QXmppOutputScheduler scheduler;
+    for (int i = 0; i < 20; ++i)
+        scheduler.enqueue(bulkData(4000));
+    for (int i = 0; i < 20; ++i)
+        scheduler.enqueue("<iq type='result' id='1'/>");
+    QCOMPARE(scheduler.count(), 40);
+    QCOMPARE(scheduler.size(), qint64(20 * 4000 + 20 * 26));
+
+    for (int i = 0; i < 20; ++i)
+        QCOMPARE(scheduler.dequeue(), QByteArray("<iq type='result' id='1'/>"));
+    for (int i = 0; i < 20; ++i)
+        QCOMPARE(scheduler.dequeue(), bulkData(4000));
+    QVERIFY(scheduler.isEmpty());
+    QCOMPARE(scheduler.size(), qint64(0));
+}
+
+void tst_QXmppOutputScheduler::testWeights()
+{
+    // groupchat messages get twice the share of bulk data, which is
+    // not starved
+    QXmppOutputScheduler scheduler;
+    for (int i = 0; i < 20; ++i) {
+        scheduler.enqueue(bulkData(2000));
+        scheduler.enqueue(groupChatMessage(2000));
+    }
+
+    int groupChat = 0;
+    int bulk = 0;
+    for (int i = 0; i < 12; ++i) {
+        if (scheduler.dequeue() == bulkData(2000))
+            bulk++;
+        else
+            groupChat++;
+    }
+    QCOMPARE(groupChat, 8);
+    QCOMPARE(bulk, 4);
+
+    // with equal weights, they alternate
+    scheduler.clear();
+    scheduler.setWeight(QXmppOutputScheduler::GroupChatClass, 1);
+    QCOMPARE(scheduler.weight(QXmppOutputScheduler::GroupChatClass), 1);
+    for (int i = 0; i < 20; ++i) {
+        scheduler.enqueue(bulkData(2000));
+        scheduler.enqueue(groupChatMessage(2000));
+    }
+    groupChat = 0;
+    bulk = 0;
+    for (int i = 0; i < 12; ++i) {
+        if (scheduler.dequeue() == bulkData(2000))
+            bulk++;
+        else
+            groupChat++;
+    }
+    QCOMPARE(groupChat, 6);
+    QCOMPARE(bulk, 6);
+}
+
+void tst_QXmppOutputScheduler::testCoalescing()
+{
+    const QByteArray available1 = "<presence from='a@localhost/r' to='b@localhost'><show>away</show></presence>";
+    const QByteArray available2 = "<presence from='c@localhost/r' to='b@localhost'/>";
+    const QByteArray unavailable1 = "<presence from='a@localhost/r' to='b@localhost' type='unavailable'/>";
+    const QByteArray subscribe1 = "<presence from='a@localhost' to='b@localhost' type='subscribe'/>";
+
+    QXmppOutputScheduler scheduler;
+    QVERIFY(!scheduler.presenceCoalescingEnabled());
+    QVERIFY(!scheduler.enqueue(available1));
+    QVERIFY(!scheduler.enqueue(unavailable1));
+    QCOMPARE(scheduler.count(), 2);
+    scheduler.clear();
+
+    scheduler.setPresenceCoalescingEnabled(true);
+    QVERIFY(!scheduler.enqueue(available1));
+    QVERIFY(!scheduler.enqueue(available2));
+    QVERIFY(!scheduler.enqueue(subscribe1));
+    QVERIFY(scheduler.enqueue(unavailable1));
+    QCOMPARE(scheduler.count(), 3);
+    QCOMPARE(scheduler.size(), qint64(available2.size() + subscribe1.size() + unavailable1.size()));
+
+    // the newer presence takes the place of the older one
+    QCOMPARE(scheduler.dequeue(), unavailable1);
+    QCOMPARE(scheduler.dequeue(), available2);
+    QCOMPARE(scheduler.dequeue(), subscribe1);
+
+    // once written, a presence is no longer replaced
+    QVERIFY(!scheduler.enqueue(available1));
+    QCOMPARE(scheduler.count(), 1);
+}
+
+void tst_QXmppOutputScheduler::testClear()
+{
+    QXmppOutputScheduler scheduler;
+    scheduler.setPresenceCoalescingEnabled(true);
+    scheduler.enqueue("<presence from='a@localhost/r'/>");
+    scheduler.enqueue(bulkData(1000));
+    scheduler.clear();
+    QVERIFY(scheduler.isEmpty());
+    QCOMPARE(scheduler.count(), 0);
+    QCOMPARE(scheduler.size(), qint64(0));
+    QVERIFY(!scheduler.enqueue("<presence from='a@localhost/r'/>"));
+    QCOMPARE(scheduler.count(), 1);
+}
+
+QTEST_MAIN(tst_QXmppOutputScheduler)
+#include "tst_qxmppoutputscheduler.moc"
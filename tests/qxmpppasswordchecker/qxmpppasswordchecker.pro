@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpppasswordchecker
+SOURCES += tst_qxmpppasswordchecker.cpp
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QObject>
+#include <QSemaphore>
+#include <QtTest>
+
+#include "QXmppPasswordChecker.h"
+
+class TestThreadedPasswordChecker : public QXmppThreadedPasswordChecker
+{
+public:
+    TestThreadedPasswordChecker()
+        : m_calls(0)
+    {
+    }
+
+    int calls()
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_calls;
+    }
+
+    // lets the pending lookups proceed
+    QSemaphore gate;
+
+protected:
+    QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password)
+    {
+        gate.acquire();
+
+        QMutexLocker locker(&m_mutex);
+        m_calls++;
+        if (request.username() == QLatin1String("testuser")) {
+            password = QLatin1String("testpwd");
+            return QXmppPasswordReply::NoError;
+        }
+        return QXmppPasswordReply::AuthorizationError;
+    }
+
+private:
+    QMutex m_mutex;
+    int m_calls;
+};
+
+static QXmppPasswordRequest passwordRequest(const QString &username, const QString &password)
+{
+    QXmppPasswordRequest request;
+    request.setDomain("example.com");
+    request.setUsername(username);
+    request.setPassword(password);
+    return request;
+}
+
+static void waitForReply(QXmppPasswordReply *reply)
+{
+    if (!reply->isFinished()) {
+        QEventLoop loop;
+        QObject::connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+        QTimer::singleShot(5000, &loop, SLOT(quit()));
+        loop.exec();
+    }
+    QVERIFY(reply->isFinished());
+}
+
+class tst_QXmppPasswordChecker : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testCheckPassword_data();
+    void testCheckPassword();
+    void testCoalesce();
+    void testCache();
+    void testDigest();
+};
+
+void tst_QXmppPasswordChecker::testCheckPassword_data()
+{
+    QTest::addColumn<QString>("username");
+    QTest::addColumn<QString>("password");
+    QTest::addColumn<int>("error");
+
+    QTest::newRow("good") << "testuser" << "testpwd" << int(QXmppPasswordReply::NoError);
+    QTest::newRow("bad-password") << "testuser" << "badpwd" << int(QXmppPasswordReply::AuthorizationError);
+    QTest::newRow("bad-username") << "baduser" << "testpwd" << int(QXmppPasswordReply::AuthorizationError);
+}
+
+void tst_QXmppPasswordChecker::testCheckPassword()
+{
+    QFETCH(QString, username);
+    QFETCH(QString, password);
+    QFETCH(int, error);
+
+    TestThreadedPasswordChecker checker;
+    checker.gate.release(1);
+
+    QXmppPasswordReply *reply = checker.checkPassword(passwordRequest(username, password));
+    waitForReply(reply);
+    QCOMPARE(int(reply->error()), error);
+    delete reply;
+}
+
+void tst_QXmppPasswordChecker::testCoalesce()
+{
+    TestThreadedPasswordChecker checker;
+    checker.setCacheTimeout(0);
+
+    // the lookup is held until all the requests are made
+    QList<QXmppPasswordReply*> replies;
+    for (int i = 0; i < 10; ++i)
+        replies << checker.checkPassword(passwordRequest("testuser", i % 2 ? "testpwd" : "badpwd"));
+    checker.gate.release(1);
+
+    for (int i = 0; i < replies.size(); ++i) {
+        waitForReply(replies[i]);
+        QCOMPARE(replies[i]->error(), i % 2 ? QXmppPasswordReply::NoError : QXmppPasswordReply::AuthorizationError);
+    }
+    QCOMPARE(checker.calls(), 1);
+    qDeleteAll(replies);
+}
+
+void tst_QXmppPasswordChecker::testCache()
+{
+    TestThreadedPasswordChecker checker;
+    checker.gate.release(1);
+
+    QXmppPasswordReply *reply = checker.checkPassword(passwordRequest("testuser", "testpwd"));
+    waitForReply(reply);
+    QCOMPARE(reply->error(), QXmppPasswordReply::NoError);
+    delete reply;
+
+    // the second request is answered from the cache
+    reply = checker.checkPassword(passwordRequest("testuser", "badpwd"));
+    waitForReply(reply);
+    QCOMPARE(reply->error(), QXmppPasswordReply::AuthorizationError);
+    delete reply;
+    QCOMPARE(checker.calls(), 1);
+
+    // clearing the cache causes a new lookup
+    checker.clearCache();
+    checker.gate.release(1);
+    reply = checker.checkPassword(passwordRequest("testuser", "testpwd"));
+    waitForReply(reply);
+    QCOMPARE(reply->error(), QXmppPasswordReply::NoError);
+    delete reply;
+    QCOMPARE(checker.calls(), 2);
+}
+
+void tst_QXmppPasswordChecker::testDigest()
+{
+    TestThreadedPasswordChecker checker;
+    checker.gate.release(1);
+
+    QXmppPasswordReply *reply = checker.getDigest(passwordRequest("testuser", QString()));
+    waitForReply(reply);
+    QCOMPARE(reply->error(), QXmppPasswordReply::NoError);
+    QCOMPARE(reply->digest(), QCryptographicHash::hash("testuser:example.com:testpwd", QCryptographicHash::Md5));
+    delete reply;
+}
+
+QTEST_MAIN(tst_QXmppPasswordChecker)
+#include "tst_qxmpppasswordchecker.moc"
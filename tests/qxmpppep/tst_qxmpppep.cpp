@@ -22,6 +22,8 @@
  */
 
 #include <QObject>
+#include "QXmppClient.h"
+#include "QXmppDiscoveryManager.h"
 #include "QXmppReachAddress.h"
 #include "QXmppPEPManager.h"
 #include "QXmppPubSubIq.h"
@@ -33,6 +35,22 @@
 
 #include <QDebug>
 
+class TestGamingCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    QList<QXmppGaming> games;
+
+public slots:
+    void gamingReceived(const QString &jid, const QString &id, const QXmppGaming &gaming)
+    {
+        Q_UNUSED(jid);
+        Q_UNUSED(id);
+        games << gaming;
+    }
+};
+
 class tst_QXmppPep : public QObject
 {
     Q_OBJECT
@@ -45,6 +63,7 @@ private slots:
     void testReachabilityAddressReceivedSlot(const QString &jid, const QString &id, const QXmppReachAddress& reachAddres);
     void testPublishReachabilityAddress();
     void testCreateGamingItem();
+    void testLastItemCache();
 private:
      QXmppPEPManager *m_PEPmanager;
 
@@ -260,5 +279,59 @@ void tst_QXmppPep::testCreateGamingItem()
     serializePacket(gaming, expectedXml);
 }
 
+void tst_QXmppPep::testLastItemCache()
+{
+    QXmppClient client;
+    QXmppPEPManager *manager = client.findExtension<QXmppPEPManager>();
+    QXmppDiscoveryManager *discoManager = client.findExtension<QXmppDiscoveryManager>();
+    QVERIFY(manager);
+    QVERIFY(discoManager);
+
+    // notifications are only requested once someone listens to them
+    QVERIFY(discoManager->capabilities().features().contains(ns_user_gaming));
+    QVERIFY(!discoManager->capabilities().features().contains(ns_user_gaming_notify));
+
+    TestGamingCollector collector;
+    QVERIFY(connect(manager, SIGNAL(gamingReceived(QString,QString,QXmppGaming)),
+                    &collector, SLOT(gamingReceived(QString,QString,QXmppGaming))));
+    QVERIFY(discoManager->capabilities().features().contains(ns_user_gaming_notify));
+
+    const QString eventXml(
+        "<message from='romeo@montague.lit' to='juliet@capulet.lit'>"
+        "<event xmlns='http://jabber.org/protocol/pubsub#event'>"
+        "<items node='urn:xmpp:gaming:0'>"
+        "<item id='%1'>"
+        "<game xmlns='urn:xmpp:gaming:0'><name>%2</name></game>"
+        "</item>"
+        "</items>"
+        "</event>"
+        "</message>");
+
+    QDomDocument doc;
+    QVERIFY(doc.setContent(eventXml.arg("item1", "chess"), true));
+    QVERIFY(manager->handleStanza(doc.documentElement()));
+    QCOMPARE(collector.games.size(), 1);
+    QCOMPARE(manager->lastItemId("romeo@montague.lit", ns_user_gaming), QLatin1String("item1"));
+    QCOMPARE(manager->gaming("romeo@montague.lit").name(), QLatin1String("chess"));
+    QVERIFY(manager->gaming("juliet@capulet.lit").name().isEmpty());
+
+    // the same item is not reported again
+    QVERIFY(doc.setContent(eventXml.arg("item1", "chess"), true));
+    QVERIFY(manager->handleStanza(doc.documentElement()));
+    QCOMPARE(collector.games.size(), 1);
+
+    // an item published again under the same ID is reported
+    QVERIFY(doc.setContent(eventXml.arg("item1", "go"), true));
+    QVERIFY(manager->handleStanza(doc.documentElement()));
+    QCOMPARE(collector.games.size(), 2);
+    QCOMPARE(collector.games[1].name(), QLatin1String("go"));
+
+    // so is a new item with the same payload
+    QVERIFY(doc.setContent(eventXml.arg("item2", "go"), true));
+    QVERIFY(manager->handleStanza(doc.documentElement()));
+    QCOMPARE(collector.games.size(), 3);
+    QCOMPARE(manager->lastItemId("romeo@montague.lit", ns_user_gaming), QLatin1String("item2"));
+}
+
 QTEST_MAIN(tst_QXmppPep)
 #include "tst_qxmpppep.moc"
@@ -33,6 +33,7 @@ private slots:
     void testItems();
     void testItemsResponse();
     void testPublish();
+    void testPublishOptions();
     void testRetractItem();
     void testSubscribe();
     void testSubscription();
@@ -136,6 +137,43 @@ void tst_QXmppPubSubIq::testPublish()
     serializePacket(iq, xml);
 }
 
+void tst_QXmppPubSubIq::testPublishOptions()
+{
+    const QByteArray xml(
+        "<iq"
+        " id=\"pub1\""
+        " type=\"set\">"
+        "<pubsub xmlns=\"http://jabber.org/protocol/pubsub\">"
+        "<publish node=\"urn:xmpp:bookmarks:1\">"
+          "<item id=\"theplay@conference.shakespeare.lit\">"
+            "<conference xmlns=\"urn:xmpp:bookmarks:1\" autojoin=\"true\"/>"
+          "</item>"
+        "</publish>"
+        "<publish-options>"
+          "<x xmlns=\"jabber:x:data\" type=\"submit\">"
+            "<field type=\"hidden\" var=\"FORM_TYPE\">"
+              "<value>http://jabber.org/protocol/pubsub#publish-options</value>"
+            "</field>"
+            "<field type=\"list-single\" var=\"pubsub#access_model\">"
+              "<value>whitelist</value>"
+            "</field>"
+          "</x>"
+        "</publish-options>"
+        "</pubsub>"
+        "</iq>");
+
+    QXmppPubSubIq iq;
+    parsePacket(iq, xml);
+    QCOMPARE(iq.queryType(), QXmppPubSubIq::PublishQuery);
+    QCOMPARE(iq.queryNode(), QLatin1String("urn:xmpp:bookmarks:1"));
+    QCOMPARE(iq.items().size(), 1);
+    QCOMPARE(iq.publishOptions().type(), QXmppDataForm::Submit);
+    QCOMPARE(iq.publishOptions().fields().size(), 2);
+    QCOMPARE(iq.publishOptions().fields()[1].key(), QLatin1String("pubsub#access_model"));
+    QCOMPARE(iq.publishOptions().fields()[1].value().toString(), QLatin1String("whitelist"));
+    serializePacket(iq, xml);
+}
+
 void tst_QXmppPubSubIq::testRetractItem()
 {
     const QByteArray xml(
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppquerylimiter
+SOURCES += tst_qxmppquerylimiter.cpp
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppQueryLimiter_p.h"
+
+class tst_QXmppQueryLimiter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testUnlimited();
+    void testLimit();
+    void testInterval();
+};
+
+void tst_QXmppQueryLimiter::testUnlimited()
+{
+    QXmppQueryLimiter limiter;
+    QCOMPARE(limiter.limit(), 0);
+    for (int i = 0; i < 100; ++i)
+        QVERIFY(limiter.accept("romeo@montague.net/orchard"));
+}
+
+void tst_QXmppQueryLimiter::testLimit()
+{
+    QXmppQueryLimiter limiter;
+    limiter.setLimit(2);
+    QVERIFY(limiter.accept("romeo@montague.net/orchard"));
+    QVERIFY(limiter.accept("romeo@montague.net/orchard"));
+    QVERIFY(!limiter.accept("romeo@montague.net/orchard"));
+
+    // the resources of a requester share its quota
+    QVERIFY(!limiter.accept("romeo@montague.net/garden"));
+
+    // other requesters are not affected
+    QVERIFY(limiter.accept("juliet@capulet.com/balcony"));
+}
+
+void tst_QXmppQueryLimiter::testInterval()
+{
+    QXmppQueryLimiter limiter;
+    limiter.setLimit(1);
+    limiter.setInterval(200);
+    QVERIFY(limiter.accept("romeo@montague.net/orchard"));
+    QVERIFY(!limiter.accept("romeo@montague.net/orchard"));
+
+    // the quota is restored once the interval has elapsed
+    QTest::qWait(300);
+    QVERIFY(limiter.accept("romeo@montague.net/orchard"));
+    QVERIFY(!limiter.accept("romeo@montague.net/orchard"));
+}
+
+QTEST_MAIN(tst_QXmppQueryLimiter)
+#include "tst_qxmppquerylimiter.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppratelimiter
+SOURCES += tst_qxmppratelimiter.cpp
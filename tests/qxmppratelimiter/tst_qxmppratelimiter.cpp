@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppRateLimiter.h"
+
+class tst_QXmppRateLimiter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBytes();
+    void testStanzas();
+    void testSetRates();
+    void testUnlimited();
+};
+
+void tst_QXmppRateLimiter::testBytes()
+{
+    QXmppRateLimiter limiter(1000, 0);
+    QCOMPARE(limiter.bytesPerSecond(), qint64(1000));
+    QCOMPARE(limiter.stanzasPerSecond(), 0);
+
+    // a burst of one second is accepted
+    QCOMPARE(limiter.consume(1000, 10), 0);
+    QCOMPARE(limiter.delay(), 0);
+
+    // half a second worth of debt
+    const int delay = limiter.consume(500, 0);
+    QVERIFY(delay > 400);
+    QVERIFY(delay <= 500);
+    QVERIFY(limiter.delay() > 0);
+
+    QTest::qWait(delay + 50);
+    QCOMPARE(limiter.delay(), 0);
+}
+
+void tst_QXmppRateLimiter::testStanzas()
+{
+    QXmppRateLimiter limiter(0, 10);
+    for (int i = 0; i < 10; ++i)
+        QCOMPARE(limiter.consume(100000, 1), 0);
+
+    const int delay = limiter.consume(0, 1);
+    QVERIFY(delay > 0);
+    QVERIFY(delay <= 100);
+}
+
+void tst_QXmppRateLimiter::testSetRates()
+{
+    QXmppRateLimiter limiter(0, 1);
+    QCOMPARE(limiter.consume(0, 1), 0);
+    QVERIFY(limiter.consume(0, 1) > 0);
+
+    // new rates refill the buckets
+    limiter.setRates(100, 5);
+    QCOMPARE(limiter.bytesPerSecond(), qint64(100));
+    QCOMPARE(limiter.stanzasPerSecond(), 5);
+    QCOMPARE(limiter.delay(), 0);
+    QCOMPARE(limiter.consume(100, 5), 0);
+    QVERIFY(limiter.consume(1, 0) > 0);
+}
+
+void tst_QXmppRateLimiter::testUnlimited()
+{
+    QXmppRateLimiter limiter;
+    QCOMPARE(limiter.consume(1000000, 1000), 0);
+    QCOMPARE(limiter.delay(), 0);
+
+    limiter.setRates(-1, -1);
+    QCOMPARE(limiter.bytesPerSecond(), qint64(0));
+    QCOMPARE(limiter.stanzasPerSecond(), 0);
+    QCOMPARE(limiter.consume(1000000, 1000), 0);
+}
+
+QTEST_MAIN(tst_QXmppRateLimiter)
+#include "tst_qxmppratelimiter.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpprostercache
+SOURCES += tst_qxmpprostercache.cpp
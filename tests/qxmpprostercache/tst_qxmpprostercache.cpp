@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDir>
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppRosterCache.h"
+
+class tst_QXmppRosterCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void testMissing();
+    void testStoreLoad();
+
+private:
+    QString m_directory;
+};
+
+void tst_QXmppRosterCache::init()
+{
+    m_directory = QDir::temp().filePath("tst_qxmpprostercache");
+    QDir().mkpath(m_directory);
+}
+
+void tst_QXmppRosterCache::cleanup()
+{
+    QDir dir(m_directory);
+    foreach (const QString &name, dir.entryList(QDir::Files))
+        dir.remove(name);
+    QDir().rmdir(m_directory);
+}
+
+void tst_QXmppRosterCache::testMissing()
+{
+    QXmppRosterFileCache cache(m_directory);
+    QCOMPARE(cache.directory(), m_directory);
+
+    QString version;
+    QHash<QString, QXmppRosterIq::Item> entries;
+    QVERIFY(!cache.load("foo@example.com", version, entries));
+    QVERIFY(version.isNull());
+    QVERIFY(entries.isEmpty());
+}
+
+void tst_QXmppRosterCache::testStoreLoad()
+{
+    QXmppRosterIq::Item item;
+    item.setBareJid("bar@example.com");
+    item.setName("Bar");
+    item.setGroups(QSet<QString>() << "Friends" << "Work");
+    item.setSubscriptionType(QXmppRosterIq::Item::Both);
+    item.setSubscriptionStatus("subscribe");
+
+    QHash<QString, QXmppRosterIq::Item> stored;
+    stored.insert(item.bareJid(), item);
+
+    QXmppRosterFileCache cache(m_directory);
+    cache.store("foo@example.com", "ver14", stored);
+
+    QString version;
+    QHash<QString, QXmppRosterIq::Item> entries;
+    QVERIFY(cache.load("foo@example.com", version, entries));
+    QCOMPARE(version, QLatin1String("ver14"));
+    QCOMPARE(entries.size(), 1);
+
+    const QXmppRosterIq::Item loaded = entries.value("bar@example.com");
+    QCOMPARE(loaded.bareJid(), item.bareJid());
+    QCOMPARE(loaded.name(), item.name());
+    QCOMPARE(loaded.groups(), item.groups());
+    QCOMPARE(loaded.subscriptionType(), item.subscriptionType());
+    QCOMPARE(loaded.subscriptionStatus(), item.subscriptionStatus());
+
+    // rosters are stored per account
+    QVERIFY(!cache.load("other@example.com", version, entries));
+}
+
+QTEST_MAIN(tst_QXmppRosterCache)
+#include "tst_qxmpprostercache.moc"
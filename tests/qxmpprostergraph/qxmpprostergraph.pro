@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpprostergraph
+SOURCES += tst_qxmpprostergraph.cpp
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppServerRoster_p.h"
+
+static QXmppRosterIq::Item rosterItem(const QString &jid, QXmppRosterIq::Item::SubscriptionType type)
+{
+    QXmppRosterIq::Item item;
+    item.setBareJid(jid);
+    item.setSubscriptionType(type);
+    return item;
+}
+
+class tst_QXmppRosterGraph : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testIntern();
+    void testItems();
+    void testSubscriptions();
+};
+
+void tst_QXmppRosterGraph::testIntern()
+{
+    QXmppRosterGraph graph;
+    QCOMPARE(graph.find("alice@example.com"), -1);
+
+    const int alice = graph.intern("alice@example.com");
+    const int bob = graph.intern("bob@example.com");
+    QVERIFY(alice != bob);
+    QCOMPARE(graph.intern("alice@example.com"), alice);
+    QCOMPARE(graph.find("bob@example.com"), bob);
+    QCOMPARE(graph.jid(alice), QLatin1String("alice@example.com"));
+    QCOMPARE(graph.size(), 2);
+
+    graph.clear();
+    QCOMPARE(graph.size(), 0);
+    QCOMPARE(graph.find("alice@example.com"), -1);
+}
+
+void tst_QXmppRosterGraph::testItems()
+{
+    QXmppRosterGraph graph;
+    const int alice = graph.intern("alice@example.com");
+    QVERIFY(!graph.isLoaded(alice));
+    graph.setLoaded(alice, true);
+    QVERIFY(graph.isLoaded(alice));
+
+    QXmppRosterIq::Item item = rosterItem("bob@example.com", QXmppRosterIq::Item::None);
+    item.setName("Bob");
+    item.setGroups(QSet<QString>() << "Friends");
+    item.setSubscriptionStatus("subscribe");
+    graph.setItem(alice, item);
+
+    const int bob = graph.find("bob@example.com");
+    QVERIFY(bob >= 0);
+    QVERIFY(graph.hasItem(alice, bob));
+    QVERIFY(!graph.hasItem(bob, alice));
+
+    const QXmppRosterIq::Item stored = graph.item(alice, bob);
+    QCOMPARE(stored.bareJid(), QLatin1String("bob@example.com"));
+    QCOMPARE(stored.name(), QLatin1String("Bob"));
+    QCOMPARE(stored.groups(), QSet<QString>() << "Friends");
+    QCOMPARE(stored.subscriptionStatus(), QLatin1String("subscribe"));
+    QCOMPARE(int(stored.subscriptionType()), int(QXmppRosterIq::Item::None));
+    QCOMPARE(graph.items(alice).size(), 1);
+
+    graph.setItem(alice, rosterItem("bob@example.com", QXmppRosterIq::Item::Remove));
+    QVERIFY(!graph.hasItem(alice, bob));
+    QVERIFY(graph.item(alice, bob).bareJid().isEmpty());
+    QCOMPARE(graph.items(alice).size(), 0);
+}
+
+void tst_QXmppRosterGraph::testSubscriptions()
+{
+    QXmppRosterGraph graph;
+    const int alice = graph.intern("alice@example.com");
+    graph.setItem(alice, rosterItem("bob@example.com", QXmppRosterIq::Item::From));
+    graph.setItem(alice, rosterItem("carol@example.com", QXmppRosterIq::Item::Both));
+    graph.setItem(alice, rosterItem("dave@example.com", QXmppRosterIq::Item::To));
+    const int bob = graph.find("bob@example.com");
+    const int carol = graph.find("carol@example.com");
+    const int dave = graph.find("dave@example.com");
+
+    QCOMPARE(graph.subscribers(alice).size(), 2);
+    QVERIFY(graph.subscribers(alice).contains(bob));
+    QVERIFY(graph.subscribers(alice).contains(carol));
+    QCOMPARE(graph.subscriptions(alice).size(), 2);
+    QVERIFY(graph.subscriptions(alice).contains(carol));
+    QVERIFY(graph.subscriptions(alice).contains(dave));
+
+    // the lists only reflect the user's own roster
+    QVERIFY(graph.subscribers(bob).isEmpty());
+    QVERIFY(graph.subscriptions(-1).isEmpty());
+
+    // changing a subscription updates both lists
+    graph.setItem(alice, rosterItem("carol@example.com", QXmppRosterIq::Item::To));
+    QCOMPARE(graph.subscribers(alice).size(), 1);
+    QVERIFY(!graph.subscribers(alice).contains(carol));
+    QCOMPARE(graph.subscriptions(alice).size(), 2);
+
+    graph.setItem(alice, rosterItem("bob@example.com", QXmppRosterIq::Item::Both));
+    QCOMPARE(graph.subscribers(alice).size(), 1);
+    QCOMPARE(graph.subscriptions(alice).size(), 3);
+
+    graph.removeItem(alice, dave);
+    QCOMPARE(graph.subscriptions(alice).size(), 2);
+    QVERIFY(!graph.subscriptions(alice).contains(dave));
+}
+
+QTEST_MAIN(tst_QXmppRosterGraph)
+#include "tst_qxmpprostergraph.moc"
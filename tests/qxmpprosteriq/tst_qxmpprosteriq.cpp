@@ -32,6 +32,8 @@ class tst_QXmppRosterIq : public QObject
 private slots:
     void testItem_data();
     void testItem();
+    void testVersion_data();
+    void testVersion();
 };
 
 void tst_QXmppRosterIq::testItem_data()
@@ -87,5 +89,36 @@ void tst_QXmppRosterIq::testItem()
     serializePacket(item, xml);
 }
 
+void tst_QXmppRosterIq::testVersion_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+    QTest::addColumn<bool>("isNull");
+    QTest::addColumn<QString>("version");
+
+    QTest::newRow("none")
+        << QByteArray("<iq id=\"bv1bs71f\" type=\"get\"><query xmlns=\"jabber:iq:roster\"/></iq>")
+        << true << QString();
+    QTest::newRow("empty")
+        << QByteArray("<iq id=\"bv1bs71f\" type=\"get\"><query xmlns=\"jabber:iq:roster\" ver=\"\"/></iq>")
+        << false << QString();
+    QTest::newRow("version")
+        << QByteArray("<iq id=\"bv1bs71f\" type=\"get\"><query xmlns=\"jabber:iq:roster\" ver=\"ver14\"/></iq>")
+        << false << QString("ver14");
+}
+
+void tst_QXmppRosterIq::testVersion()
+{
+    QFETCH(QByteArray, xml);
+    QFETCH(bool, isNull);
+    QFETCH(QString, version);
+
+    QXmppRosterIq iq;
+    parsePacket(iq, xml);
+    QCOMPARE(iq.version().isNull(), isNull);
+    QCOMPARE(iq.version(), version);
+    QCOMPARE(iq.items().size(), 0);
+    serializePacket(iq, xml);
+}
+
 QTEST_MAIN(tst_QXmppRosterIq)
 #include "tst_qxmpprosteriq.moc"
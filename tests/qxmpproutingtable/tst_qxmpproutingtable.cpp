@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppRoutingTable_p.h"
+
+static QXmppIncomingClient *fakeClient(int i)
+{
+    // the table never dereferences the clients
+    return reinterpret_cast<QXmppIncomingClient*>(quintptr(i + 1) * 16);
+}
+
+class tst_QXmppRoutingTable : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testInsert();
+    void testRemove();
+    void testReplace();
+    void benchmarkLookup_data();
+    void benchmarkLookup();
+};
+
+void tst_QXmppRoutingTable::testInsert()
+{
+    QXmppRoutingTable table;
+    QCOMPARE(table.size(), 0);
+    QCOMPARE(table.value("foo@example.com/a"), (QXmppIncomingClient*)0);
+    QVERIFY(table.values("foo@example.com").isEmpty());
+
+    QCOMPARE(table.insert("foo@example.com/a", fakeClient(1)), (QXmppIncomingClient*)0);
+    QCOMPARE(table.insert("foo@example.com/b", fakeClient(2)), (QXmppIncomingClient*)0);
+    QCOMPARE(table.insert("bar@example.com/a", fakeClient(3)), (QXmppIncomingClient*)0);
+    QCOMPARE(table.size(), 3);
+
+    QCOMPARE(table.value("foo@example.com/a"), fakeClient(1));
+    QCOMPARE(table.value("foo@example.com/b"), fakeClient(2));
+    QCOMPARE(table.value("foo@example.com/c"), (QXmppIncomingClient*)0);
+
+    QList<QXmppIncomingClient*> clients = table.values("foo@example.com");
+    QCOMPARE(clients.size(), 2);
+    QVERIFY(clients.contains(fakeClient(1)));
+    QVERIFY(clients.contains(fakeClient(2)));
+    QCOMPARE(table.values("bar@example.com"), QList<QXmppIncomingClient*>() << fakeClient(3));
+}
+
+void tst_QXmppRoutingTable::testRemove()
+{
+    QXmppRoutingTable table;
+    table.insert("foo@example.com/a", fakeClient(1));
+    table.insert("foo@example.com/b", fakeClient(2));
+
+    // removing another client has no effect
+    QVERIFY(!table.remove("foo@example.com/a", fakeClient(3)));
+    QCOMPARE(table.value("foo@example.com/a"), fakeClient(1));
+
+    QVERIFY(table.remove("foo@example.com/a", fakeClient(1)));
+    QCOMPARE(table.value("foo@example.com/a"), (QXmppIncomingClient*)0);
+    QCOMPARE(table.values("foo@example.com"), QList<QXmppIncomingClient*>() << fakeClient(2));
+
+    QVERIFY(table.remove("foo@example.com/b", fakeClient(2)));
+    QVERIFY(table.values("foo@example.com").isEmpty());
+    QCOMPARE(table.size(), 0);
+}
+
+void tst_QXmppRoutingTable::testReplace()
+{
+    QXmppRoutingTable table;
+    table.insert("foo@example.com/a", fakeClient(1));
+
+    // a new client takes over the full JID
+    QCOMPARE(table.insert("foo@example.com/a", fakeClient(2)), fakeClient(1));
+    QCOMPARE(table.value("foo@example.com/a"), fakeClient(2));
+    QCOMPARE(table.size(), 1);
+
+    // the old client does not unbind the new one
+    QVERIFY(table.remove("foo@example.com/a", fakeClient(1)));
+    QCOMPARE(table.value("foo@example.com/a"), fakeClient(2));
+    QCOMPARE(table.values("foo@example.com"), QList<QXmppIncomingClient*>() << fakeClient(2));
+}
+
+void tst_QXmppRoutingTable::benchmarkLookup_data()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("100k") << 100000;
+    QTest::newRow("1M") << 1000000;
+}
+
+void tst_QXmppRoutingTable::benchmarkLookup()
+{
+    QFETCH(int, count);
+
+    QXmppRoutingTable table;
+    QStringList jids;
+    for (int i = 0; i < count; ++i) {
+        const QString jid = QString("user%1@example.com/resource").arg(i);
+        table.insert(jid, fakeClient(i));
+        if (i % qMax(1, count / 1000) == 0)
+            jids << jid;
+    }
+    QCOMPARE(table.size(), count);
+
+    QBENCHMARK {
+        foreach (const QString &jid, jids)
+            table.value(jid);
+    }
+}
+
+QTEST_MAIN(tst_QXmppRoutingTable)
+#include "tst_qxmpproutingtable.moc"
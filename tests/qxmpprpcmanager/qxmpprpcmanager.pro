@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpprpcmanager
+SOURCES += tst_qxmpprpcmanager.cpp
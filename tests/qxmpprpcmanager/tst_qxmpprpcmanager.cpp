@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include "QXmppClient.h"
+#include "QXmppInvokable.h"
+#include "QXmppLogger.h"
+#include "QXmppRpcManager.h"
+#include "QXmppServer.h"
+#include "util.h"
+
+class TestInterface : public QXmppInvokable
+{
+    Q_OBJECT
+
+public:
+    TestInterface(QObject *parent = 0) : QXmppInvokable(parent) {}
+
+    bool isAuthorized(const QString &jid) const
+    {
+        Q_UNUSED(jid);
+        return true;
+    }
+
+public slots:
+    int add(int a, int b)
+    {
+        return a + b;
+    }
+};
+
+class TestResultCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestResultCollector() : rpcStanzas(0) {}
+
+    QMap<QString, QXmppRemoteMethodResult> results;
+    int rpcStanzas;
+
+public slots:
+    void logReceived(QXmppLogger::MessageType type, const QString &text)
+    {
+        if (type == QXmppLogger::ReceivedMessage && text.contains("jabber:iq:rpc"))
+            rpcStanzas++;
+    }
+
+    void remoteMethodFinished(const QString &id, const QXmppRemoteMethodResult &result)
+    {
+        results.insert(id, result);
+    }
+};
+
+class tst_QXmppRpcManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testMulticall();
+
+private:
+    bool connectClient(QXmppClient *client, const QString &user);
+
+    TestPasswordChecker m_passwordChecker;
+    QXmppServer *m_server;
+};
+
+bool tst_QXmppRpcManager::connectClient(QXmppClient *client, const QString &user)
+{
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12383);
+    config.setUser(user);
+    config.setPassword("testpwd");
+
+    QSignalSpy connected(client, SIGNAL(connected()));
+    client->connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    return client->isConnected();
+}
+
+void tst_QXmppRpcManager::initTestCase()
+{
+    m_passwordChecker.addCredentials("caller", "testpwd");
+    m_passwordChecker.addCredentials("callee", "testpwd");
+
+    m_server = new QXmppServer;
+    m_server->setDomain("localhost");
+    m_server->setPasswordChecker(&m_passwordChecker);
+    QVERIFY(m_server->listenForClients(QHostAddress::LocalHost, 12383));
+}
+
+void tst_QXmppRpcManager::cleanupTestCase()
+{
+    delete m_server;
+}
+
+void tst_QXmppRpcManager::testMulticall()
+{
+    TestResultCollector collector;
+
+    // the callee exposes an interface
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+    connect(&logger, SIGNAL(message(QXmppLogger::MessageType,QString)),
+            &collector, SLOT(logReceived(QXmppLogger::MessageType,QString)));
+
+    QXmppClient callee;
+    callee.setLogger(&logger);
+    QXmppRpcManager *calleeManager = new QXmppRpcManager;
+    calleeManager->addInvokableInterface(new TestInterface(&callee));
+    callee.addExtension(calleeManager);
+    QVERIFY(connectClient(&callee, "callee"));
+
+    // the caller coalesces its calls
+    QXmppClient caller;
+    QXmppRpcManager *callerManager = new QXmppRpcManager;
+    callerManager->setBatchingEnabled(true);
+    callerManager->setBatchInterval(50);
+    callerManager->setMulticallEnabled(true);
+    caller.addExtension(callerManager);
+    connect(callerManager, SIGNAL(remoteMethodFinished(QString,QXmppRemoteMethodResult)),
+            &collector, SLOT(remoteMethodFinished(QString,QXmppRemoteMethodResult)));
+    QVERIFY(connectClient(&caller, "caller"));
+
+    const QString jid = "callee@localhost/QXmpp";
+    const QString id1 = callerManager->invokeRemoteMethod(jid, "TestInterface.add", QVariantList() << 1 << 2);
+    const QString id2 = callerManager->invokeRemoteMethod(jid, "TestInterface.add", QVariantList() << 3 << 4);
+    const QString id3 = callerManager->invokeRemoteMethod(jid, "TestInterface.missing");
+    QVERIFY(!id1.isEmpty());
+    QVERIFY(!id2.isEmpty());
+    QVERIFY(!id3.isEmpty());
+
+    for (int i = 0; i < 50 && collector.results.size() < 3; ++i)
+        QTest::qWait(100);
+    QCOMPARE(collector.results.size(), 3);
+
+    // the calls were carried by a single request
+    QCOMPARE(collector.rpcStanzas, 1);
+
+    QVERIFY(!collector.results[id1].hasError);
+    QCOMPARE(collector.results[id1].result, QVariant(3));
+    QVERIFY(!collector.results[id2].hasError);
+    QCOMPARE(collector.results[id2].result, QVariant(7));
+    QVERIFY(collector.results[id3].hasError);
+    QCOMPARE(collector.results[id3].code, -32601);
+}
+
+QTEST_MAIN(tst_QXmppRpcManager)
+#include "tst_qxmpprpcmanager.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpprtcpsession
+SOURCES += tst_qxmpprtcpsession.cpp
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppRtcpPacket.h"
+#include "QXmppRtcpSession_p.h"
+#include "QXmppRtpPacket.h"
+
+static QXmppRtpPacket rtpPacket(quint32 ssrc, quint16 sequence)
+{
+    QXmppRtpPacket packet;
+    packet.setType(0);
+    packet.setSsrc(ssrc);
+    packet.setSequence(sequence);
+    packet.setStamp(sequence * 160);
+    return packet;
+}
+
+class tst_QXmppRtcpSession : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testLoss();
+    void testReport();
+    void testRoundTrip();
+    void testGoodbye();
+    void testInterval();
+};
+
+void tst_QXmppRtcpSession::testLoss()
+{
+    QXmppRtcpSession session;
+
+    // 10 packets expected, 2 lost, one of them across the wrap around
+    const quint16 sequences[] = {65532, 65533, 65535, 0, 1, 2, 4, 5};
+    for (unsigned int i = 0; i < sizeof(sequences) / sizeof(sequences[0]); ++i)
+        session.packetReceived(rtpPacket(0x1234, sequences[i]), 8000);
+
+    QXmppRtpStatistics stats = session.statistics();
+    QCOMPARE(stats.packetsReceived(), quint32(8));
+    QCOMPARE(stats.packetsLost(), 2);
+    QCOMPARE(stats.fractionLost(), 0.0);
+
+    // the fraction lost is measured over the reporting interval
+    session.generateReport(0x5678);
+    stats = session.statistics();
+    QCOMPARE(stats.fractionLost(), 51 / 256.0);
+
+    session.packetReceived(rtpPacket(0x1234, 6), 8000);
+    session.generateReport(0x5678);
+    QCOMPARE(session.statistics().fractionLost(), 0.0);
+    QCOMPARE(session.statistics().packetsLost(), 2);
+}
+
+void tst_QXmppRtcpSession::testReport()
+{
+    QXmppRtcpSession session;
+    session.packetReceived(rtpPacket(0x1234, 1), 8000);
+    session.packetReceived(rtpPacket(0x1234, 3), 8000);
+
+    // a receiver report followed by a source description
+    QByteArray datagram = session.generateReport(0x5678);
+    QDataStream stream(datagram);
+    QXmppRtcpPacket packet;
+    QVERIFY(packet.read(stream));
+    QCOMPARE(packet.type(), quint8(QXmppRtcpPacket::ReceiverReport));
+    QCOMPARE(packet.ssrc(), quint32(0x5678));
+    QCOMPARE(packet.receiverReports().size(), 1);
+    QCOMPARE(packet.receiverReports()[0].ssrc(), quint32(0x1234));
+    QCOMPARE(packet.receiverReports()[0].highestSequence(), quint32(3));
+    QCOMPARE(packet.receiverReports()[0].totalLost(), quint32(1));
+    QCOMPARE(packet.receiverReports()[0].fractionLost(), quint8(85));
+    QVERIFY(packet.read(stream));
+    QCOMPARE(packet.type(), quint8(QXmppRtcpPacket::SourceDescription));
+    QCOMPARE(packet.sourceDescriptions().size(), 1);
+    QCOMPARE(packet.sourceDescriptions()[0].ssrc(), quint32(0x5678));
+    QCOMPARE(packet.sourceDescriptions()[0].cname(), session.cname());
+    QVERIFY(stream.atEnd());
+
+    // once packets were sent, a sender report
+    session.packetSent(320, 160);
+    session.packetSent(480, 160);
+    datagram = session.generateReport(0x5678);
+    QDataStream stream2(datagram);
+    QVERIFY(packet.read(stream2));
+    QCOMPARE(packet.type(), quint8(QXmppRtcpPacket::SenderReport));
+    QCOMPARE(packet.senderInfo().packetCount(), quint32(2));
+    QCOMPARE(packet.senderInfo().octetCount(), quint32(320));
+    QCOMPARE(packet.senderInfo().rtpStamp(), quint32(480));
+
+    const QXmppRtpStatistics stats = session.statistics();
+    QCOMPARE(stats.packetsSent(), quint32(2));
+    QCOMPARE(stats.octetsSent(), quint32(320));
+}
+
+void tst_QXmppRtcpSession::testRoundTrip()
+{
+    QXmppRtcpSession sender;
+    QXmppRtcpSession receiver;
+    QCOMPARE(sender.statistics().roundTripTime(), -1);
+
+    // the sender reports, the receiver sends back the stamp of the report
+    sender.packetSent(160, 160);
+    receiver.packetReceived(rtpPacket(0x1111, 1), 8000);
+    QVERIFY(!receiver.handleReport(sender.generateReport(0x1111), 0x2222));
+    QVERIFY(sender.handleReport(receiver.generateReport(0x2222), 0x1111));
+
+    const QXmppRtpStatistics stats = sender.statistics();
+    QVERIFY(stats.roundTripTime() >= 0);
+    QVERIFY(stats.roundTripTime() < 1000);
+    QCOMPARE(stats.remoteFractionLost(), 0.0);
+    QCOMPARE(stats.remotePacketsLost(), quint32(0));
+
+    // reports about other sources are ignored
+    QVERIFY(!sender.handleReport(receiver.generateReport(0x2222), 0x3333));
+}
+
+void tst_QXmppRtcpSession::testGoodbye()
+{
+    QXmppRtcpSession local;
+    QXmppRtcpSession remote;
+    local.packetReceived(rtpPacket(0x1111, 1), 8000);
+    QCOMPARE(local.statistics().packetsReceived(), quint32(1));
+
+    const QByteArray datagram = remote.generateReport(0x1111, true);
+    QDataStream stream(datagram);
+    QXmppRtcpPacket packet;
+    QVERIFY(packet.read(stream));
+    QVERIFY(packet.read(stream));
+    QVERIFY(packet.read(stream));
+    QCOMPARE(packet.type(), quint8(QXmppRtcpPacket::Goodbye));
+    QCOMPARE(packet.goodbyeSsrcs(), QList<quint32>() << 0x1111);
+
+    local.handleReport(datagram, 0x2222);
+    QCOMPARE(local.statistics().packetsReceived(), quint32(0));
+}
+
+void tst_QXmppRtcpSession::testInterval()
+{
+    QXmppRtcpSession session;
+    session.setBandwidth(256000);
+
+    // the initial minimum of 360 / 256 seconds is halved, then randomized
+    int interval = session.reportInterval();
+    QVERIFY(interval >= 288);
+    QVERIFY(interval <= 866);
+
+    session.generateReport(0x1234);
+    interval = session.reportInterval();
+    QVERIFY(interval >= 577);
+    QVERIFY(interval <= 1732);
+
+    // the minimum is at most 5 seconds
+    session.setBandwidth(16000);
+    interval = session.reportInterval();
+    QVERIFY(interval >= 2052);
+    QVERIFY(interval <= 6157);
+}
+
+QTEST_MAIN(tst_QXmppRtcpSession)
+#include "tst_qxmpprtcpsession.moc"
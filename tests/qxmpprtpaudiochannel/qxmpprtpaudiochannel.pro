@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpprtpaudiochannel
+SOURCES += tst_qxmpprtpaudiochannel.cpp
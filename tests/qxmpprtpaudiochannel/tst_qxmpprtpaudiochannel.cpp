@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtEndian>
+#include <QtTest>
+#include <qmath.h>
+
+#include "QXmppJingleIq.h"
+#include "QXmppRtpChannel.h"
+#include "QXmppRtpPacket.h"
+
+// Returns an RTP packet carrying 20 ms of PCMA audio, all samples being 8.
+static QByteArray pcmaPacket(quint16 sequence, quint32 stamp)
+{
+    QXmppRtpPacket packet;
+    packet.setType(8);
+    packet.setSequence(sequence);
+    packet.setStamp(stamp);
+    packet.setSsrc(1234);
+    packet.setPayload(QByteArray(160, '\xd5'));
+    return packet.encode();
+}
+
+// Returns an RFC 4733 telephone event packet.
+static QByteArray eventPacket(quint16 sequence, quint32 stamp, quint8 event, bool end, quint16 duration)
+{
+    QXmppRtpPacket packet;
+    packet.setType(101);
+    packet.setSequence(sequence);
+    packet.setStamp(stamp);
+    packet.setSsrc(1234);
+    QByteArray payload(4, '\0');
+    payload[0] = event;
+    payload[1] = end ? 0x8a : 0x0a;
+    qToBigEndian<quint16>(duration, reinterpret_cast<uchar*>(payload.data() + 2));
+    packet.setPayload(payload);
+    return packet.encode();
+}
+
+// Returns \a count decoded samples of value \a value.
+static QByteArray samples(int count, qint16 value)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    for (int i = 0; i < count; ++i)
+        stream << value;
+    return data;
+}
+
+class TestToneCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    QList<QXmppRtpAudioChannel::Tone> tones;
+
+public slots:
+    void toneReceived(QXmppRtpAudioChannel::Tone tone)
+    {
+        tones << tone;
+    }
+};
+
+class tst_QXmppRtpAudioChannel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBuffering();
+    void testCrypto();
+    void testEncoderControl();
+    void testLoss();
+    void testReuse();
+    void testTaps();
+    void testToneEcho();
+    void testToneReceived();
+
+private:
+    void setupChannel(QXmppRtpAudioChannel *channel);
+};
+
+void tst_QXmppRtpAudioChannel::setupChannel(QXmppRtpAudioChannel *channel)
+{
+    QXmppJinglePayloadType payload;
+    payload.setId(8);
+    payload.setChannels(1);
+    payload.setName("PCMA");
+    payload.setClockrate(8000);
+    channel->setRemotePayloadTypes(QList<QXmppJinglePayloadType>() << payload);
+    QCOMPARE(channel->payloadType().name(), QString("PCMA"));
+}
+
+void tst_QXmppRtpAudioChannel::testBuffering()
+{
+    QXmppRtpAudioChannel channel;
+    setupChannel(&channel);
+
+    // until five packets are buffered, silence is played
+    for (int i = 0; i < 4; ++i)
+        channel.datagramReceived(pcmaPacket(i + 1, i * 160));
+    QCOMPARE(channel.bytesAvailable(), qint64(1280));
+    QCOMPARE(channel.read(320), QByteArray(320, '\0'));
+    QCOMPARE(channel.pos(), qint64(0));
+
+    channel.datagramReceived(pcmaPacket(5, 640));
+    QCOMPARE(channel.bytesAvailable(), qint64(1600));
+    QCOMPARE(channel.read(1600), samples(800, 8));
+    QCOMPARE(channel.pos(), qint64(1600));
+    QCOMPARE(channel.bytesAvailable(), qint64(0));
+
+    // running out of data fills the buffer again
+    QCOMPARE(channel.read(320), QByteArray(320, '\0'));
+    channel.datagramReceived(pcmaPacket(6, 960));
+    QCOMPARE(channel.read(320), QByteArray(320, '\0'));
+}
+
+void tst_QXmppRtpAudioChannel::testCrypto()
+{
+    QXmppRtpAudioChannel offerer;
+    QXmppRtpAudioChannel answerer;
+    QVERIFY(!offerer.isEncrypted());
+
+    // one attribute is offered per crypto suite
+    const QList<QXmppJingleRtpCryptoElement> offer = offerer.localCryptoElements();
+    QCOMPARE(offer.size(), 2);
+    QCOMPARE(offer[0].tag(), 1);
+    QCOMPARE(offer[0].cryptoSuite(), QLatin1String("AES_CM_128_HMAC_SHA1_80"));
+    QCOMPARE(offer[1].tag(), 2);
+    QCOMPARE(offer[1].cryptoSuite(), QLatin1String("AES_CM_128_HMAC_SHA1_32"));
+    QVERIFY(offer[0].keyParams().startsWith("inline:"));
+    QVERIFY(offer[0].keyParams() != offer[1].keyParams());
+
+    // unsupported attributes are refused
+    QXmppJingleRtpCryptoElement unsupported = offer[0];
+    unsupported.setCryptoSuite("AEAD_AES_256_GCM");
+    QVERIFY(!answerer.setRemoteCryptoElement(unsupported));
+    unsupported = offer[0];
+    unsupported.setKeyParams("inline:c2hvcnQ=");
+    QVERIFY(!answerer.setRemoteCryptoElement(unsupported));
+    QVERIFY(!answerer.isEncrypted());
+
+    // the answer carries the tag of the accepted attribute
+    QVERIFY(answerer.setRemoteCryptoElement(offer[1]));
+    QVERIFY(answerer.isEncrypted());
+    const QList<QXmppJingleRtpCryptoElement> answer = answerer.localCryptoElements();
+    QCOMPARE(answer.size(), 1);
+    QCOMPARE(answer[0].tag(), 2);
+    QCOMPARE(answer[0].cryptoSuite(), QLatin1String("AES_CM_128_HMAC_SHA1_32"));
+
+    QVERIFY(offerer.setRemoteCryptoElement(answer[0]));
+    QVERIFY(offerer.isEncrypted());
+    QCOMPARE(offerer.localCryptoElements().size(), 1);
+    QCOMPARE(offerer.localCryptoElements()[0].keyParams(), offer[1].keyParams());
+
+    // unprotected packets are dropped
+    setupChannel(&answerer);
+    for (int i = 0; i < 5; ++i)
+        answerer.datagramReceived(pcmaPacket(i + 1, i * 160));
+    QCOMPARE(answerer.bytesAvailable(), qint64(0));
+}
+
+void tst_QXmppRtpAudioChannel::testEncoderControl()
+{
+    // G.711 has a fixed bitrate and complexity
+    QXmppRtpAudioChannel channel;
+    setupChannel(&channel);
+    QCOMPARE(channel.bitrate(), 0);
+    QCOMPARE(channel.complexity(), 0);
+    QCOMPARE(channel.maximumBitrate(), 40000);
+    channel.setMaximumBitrate(1000);
+    QCOMPARE(channel.maximumBitrate(), 6000);
+
+    // the CPU budget is shared by the process
+    QCOMPARE(QXmppRtpAudioChannel::encoderCpuBudget(), 0.0);
+    QXmppRtpAudioChannel::setEncoderCpuBudget(0.5);
+    QCOMPARE(QXmppRtpAudioChannel::encoderCpuBudget(), 0.5);
+    QXmppRtpAudioChannel::setEncoderCpuBudget(-1);
+    QCOMPARE(QXmppRtpAudioChannel::encoderCpuBudget(), 0.0);
+    QVERIFY(QXmppRtpAudioChannel::encoderCpuLoad() >= 0.0);
+}
+
+void tst_QXmppRtpAudioChannel::testLoss()
+{
+    QXmppRtpAudioChannel channel;
+    setupChannel(&channel);
+
+    for (int i = 0; i < 5; ++i)
+        channel.datagramReceived(pcmaPacket(i + 1, i * 160));
+    QCOMPARE(channel.read(1600), samples(800, 8));
+
+    // G.711 has no loss concealment, so a lost packet is replaced by silence
+    channel.datagramReceived(pcmaPacket(6, 800));
+    channel.datagramReceived(pcmaPacket(8, 1120));
+    QCOMPARE(channel.bytesAvailable(), qint64(960));
+    QCOMPARE(channel.read(960), samples(160, 8) + samples(160, 0) + samples(160, 8));
+
+    // a late packet which can still be played replaces the silence
+    channel.datagramReceived(pcmaPacket(9, 1280));
+    channel.datagramReceived(pcmaPacket(11, 1600));
+    channel.datagramReceived(pcmaPacket(10, 1440));
+    QCOMPARE(channel.read(960), samples(480, 8));
+}
+
+void tst_QXmppRtpAudioChannel::testReuse()
+{
+    // the codecs of a closed channel are reused by the next one
+    for (int round = 0; round < 3; ++round) {
+        QXmppRtpAudioChannel channel;
+        QCOMPARE(channel.localPayloadTypes().size(), QXmppRtpAudioChannel().localPayloadTypes().size());
+        setupChannel(&channel);
+
+        for (int i = 0; i < 5; ++i)
+            channel.datagramReceived(pcmaPacket(i + 1, i * 160));
+        QCOMPARE(channel.read(1600), samples(800, 8));
+    }
+}
+
+void tst_QXmppRtpAudioChannel::testTaps()
+{
+    QXmppRtpAudioChannel channel;
+    setupChannel(&channel);
+    QXmppRtpAudioTap *first = channel.createTap();
+    QXmppRtpAudioTap *second = channel.createTap();
+    QSignalSpy readySpy(first, SIGNAL(readyRead()));
+
+    channel.datagramReceived(pcmaPacket(1, 0));
+    channel.datagramReceived(pcmaPacket(2, 160));
+    QCOMPARE(readySpy.count(), 2);
+    QCOMPARE(first->bytesAvailable(), qint64(640));
+    QCOMPARE(second->bytesAvailable(), qint64(640));
+
+    // the taps share the decoded blocks, but read them independently
+    const QByteArray block = first->readBlock();
+    QCOMPARE(block, samples(160, 8));
+    QCOMPARE(first->bytesAvailable(), qint64(320));
+    QCOMPARE(second->read(100), samples(50, 8));
+    QCOMPARE(second->readBlock(), samples(110, 8));
+    QCOMPARE(second->read(1000), samples(160, 8));
+    QCOMPARE(second->bytesAvailable(), qint64(0));
+    QVERIFY(second->readBlock().isEmpty());
+
+    // the channel's own buffer is unaffected
+    QCOMPARE(channel.bytesAvailable(), qint64(640));
+
+    // a tap which is not read drops its oldest blocks
+    for (int i = 0; i < 60; ++i)
+        channel.datagramReceived(pcmaPacket(i + 3, (i + 2) * 160));
+    QCOMPARE(second->bytesAvailable(), qint64(50 * 320));
+
+    // deleted taps stop receiving audio
+    delete first;
+    channel.datagramReceived(pcmaPacket(63, 62 * 160));
+    QCOMPARE(second->bytesAvailable(), qint64(50 * 320));
+}
+
+void tst_QXmppRtpAudioChannel::testToneEcho()
+{
+    QXmppRtpAudioChannel channel;
+    setupChannel(&channel);
+    for (int i = 0; i < 5; ++i)
+        channel.datagramReceived(pcmaPacket(i + 1, i * 160));
+
+    // the tone played locally matches the reference waveform
+    channel.startTone(QXmppRtpAudioChannel::Tone_1);
+    const QByteArray data = channel.read(1600);
+    QCOMPARE(data.size(), 1600);
+    for (int i = 0; i < 800; ++i) {
+        const double expected = 16383.0 * (qSin(2.0 * M_PI * 697 * i / 8000) + qSin(2.0 * M_PI * 1209 * i / 8000));
+        const qint16 sample = qFromLittleEndian<qint16>(reinterpret_cast<const uchar*>(data.constData() + 2 * i));
+        QVERIFY(qAbs(sample - expected) <= 1.0);
+    }
+}
+
+void tst_QXmppRtpAudioChannel::testToneReceived()
+{
+    QXmppJinglePayloadType events;
+    events.setId(101);
+    events.setChannels(1);
+    events.setName("telephone-event");
+    events.setClockrate(8000);
+    QXmppRtpAudioChannel channel;
+    QXmppJinglePayloadType payload;
+    payload.setId(8);
+    payload.setChannels(1);
+    payload.setName("PCMA");
+    payload.setClockrate(8000);
+    channel.setRemotePayloadTypes(QList<QXmppJinglePayloadType>() << payload << events);
+
+    TestToneCollector collector;
+    connect(&channel, SIGNAL(toneReceived(QXmppRtpAudioChannel::Tone)),
+            &collector, SLOT(toneReceived(QXmppRtpAudioChannel::Tone)));
+    const QList<QXmppRtpAudioChannel::Tone> &received = collector.tones;
+
+    // the packets of an event, including the retransmitted end packets,
+    // are reported once
+    quint16 sequence = 1;
+    channel.datagramReceived(eventPacket(sequence++, 1000, 5, false, 160));
+    channel.datagramReceived(eventPacket(sequence++, 1000, 5, false, 320));
+    for (int i = 0; i < 3; ++i)
+        channel.datagramReceived(eventPacket(sequence++, 1000, 5, true, 480));
+    QCOMPARE(received.size(), 1);
+    QCOMPARE(received[0], QXmppRtpAudioChannel::Tone_5);
+
+    channel.datagramReceived(eventPacket(sequence++, 2000, 11, false, 160));
+    QCOMPARE(received.size(), 2);
+    QCOMPARE(received[1], QXmppRtpAudioChannel::Tone_Pound);
+
+    // events are not played as audio
+    QCOMPARE(channel.bytesAvailable(), qint64(0));
+}
+
+QTEST_MAIN(tst_QXmppRtpAudioChannel)
+#include "tst_qxmpprtpaudiochannel.moc"
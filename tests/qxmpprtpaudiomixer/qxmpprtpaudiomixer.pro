@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpprtpaudiomixer
+SOURCES += tst_qxmpprtpaudiomixer.cpp
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppJingleIq.h"
+#include "QXmppRtpAudioMixer.h"
+#include "QXmppRtpChannel.h"
+#include "QXmppRtpPacket.h"
+
+// Returns an RTP packet carrying 20 ms of PCMA audio, all bytes being \a value.
+static QByteArray pcmaPacket(quint16 sequence, quint32 stamp, char value)
+{
+    QXmppRtpPacket packet;
+    packet.setType(8);
+    packet.setSequence(sequence);
+    packet.setStamp(stamp);
+    packet.setSsrc(1234);
+    packet.setPayload(QByteArray(160, value));
+    return packet.encode();
+}
+
+// Returns true if one of the datagrams sent carries the given payload.
+static bool hasPayload(const QSignalSpy &spy, const QByteArray &payload)
+{
+    for (int i = 0; i < spy.size(); ++i) {
+        QXmppRtpPacket packet;
+        if (packet.decode(spy[i][0].toByteArray()) && packet.payload() == payload)
+            return true;
+    }
+    return false;
+}
+
+class tst_QXmppRtpAudioMixer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testChannels();
+    void testMix();
+
+private:
+    void setupChannel(QXmppRtpAudioChannel *channel);
+};
+
+void tst_QXmppRtpAudioMixer::setupChannel(QXmppRtpAudioChannel *channel)
+{
+    QXmppJinglePayloadType payload;
+    payload.setId(8);
+    payload.setChannels(1);
+    payload.setName("PCMA");
+    payload.setClockrate(8000);
+    channel->setRemotePayloadTypes(QList<QXmppJinglePayloadType>() << payload);
+    QCOMPARE(channel->payloadType().name(), QString("PCMA"));
+}
+
+void tst_QXmppRtpAudioMixer::testChannels()
+{
+    QXmppRtpAudioMixer mixer;
+    QCOMPARE(mixer.clockrate(), quint32(8000));
+    QCOMPARE(mixer.channels().size(), 0);
+
+    QXmppRtpAudioChannel *a = new QXmppRtpAudioChannel;
+    QXmppRtpAudioChannel b;
+    mixer.addChannel(a);
+    mixer.addChannel(&b);
+    mixer.addChannel(&b);
+    QCOMPARE(mixer.channels(), QList<QXmppRtpAudioChannel*>() << a << &b);
+
+    // destroyed channels are removed
+    delete a;
+    QCOMPARE(mixer.channels(), QList<QXmppRtpAudioChannel*>() << &b);
+
+    mixer.removeChannel(&b);
+    QCOMPARE(mixer.channels().size(), 0);
+}
+
+void tst_QXmppRtpAudioMixer::testMix()
+{
+    QXmppRtpAudioChannel a, b, c;
+    setupChannel(&a);
+    setupChannel(&b);
+    setupChannel(&c);
+
+    // a is speaking loudly, b is near silent and c sent nothing
+    for (int i = 0; i < 5; ++i) {
+        a.datagramReceived(pcmaPacket(i + 1, i * 160, '\xaa'));
+        b.datagramReceived(pcmaPacket(i + 1, i * 160, '\xd5'));
+    }
+
+    QSignalSpy aSpy(&a, SIGNAL(sendDatagram(QByteArray)));
+    QSignalSpy bSpy(&b, SIGNAL(sendDatagram(QByteArray)));
+    QSignalSpy cSpy(&c, SIGNAL(sendDatagram(QByteArray)));
+
+    QXmppRtpAudioMixer mixer;
+    QSignalSpy activeSpy(&mixer, SIGNAL(activeChannelsChanged()));
+    mixer.addChannel(&a);
+    mixer.addChannel(&b);
+    mixer.addChannel(&c);
+    mixer.mix();
+    QCOMPARE(mixer.activeChannels(), QList<QXmppRtpAudioChannel*>() << &a);
+    QCOMPARE(activeSpy.size(), 1);
+
+    QTest::qWait(100);
+
+    // b and c hear a, a does not hear itself
+    const QByteArray loud(160, '\xaa');
+    QVERIFY(!hasPayload(aSpy, loud));
+    QVERIFY(hasPayload(bSpy, loud));
+    QVERIFY(hasPayload(cSpy, loud));
+}
+
+QTEST_MAIN(tst_QXmppRtpAudioMixer)
+#include "tst_qxmpprtpaudiomixer.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpprtpforwarder
+SOURCES += tst_qxmpprtpforwarder.cpp
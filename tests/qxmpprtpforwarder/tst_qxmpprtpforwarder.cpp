@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppRtpForwarder.h"
+#include "QXmppRtpPacket.h"
+#include "QXmppStun.h"
+
+// Returns an RTP packet with the given header fields.
+static QByteArray rtpPacket(quint32 ssrc, quint16 sequence, quint32 stamp, const QByteArray &payload)
+{
+    QXmppRtpPacket packet;
+    packet.setType(96);
+    packet.setSequence(sequence);
+    packet.setStamp(stamp);
+    packet.setSsrc(ssrc);
+    packet.setPayload(payload);
+    return packet.encode();
+}
+
+class tst_QXmppRtpForwarder : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void testForwardAll();
+    void testForwardActiveSpeaker();
+
+private:
+    void connectPair();
+    QXmppRtpPacket receive(int index);
+
+    QList<QXmppIceConnection*> clients;
+    QList<QXmppIceConnection*> servers;
+    QList<QSignalSpy*> rtpSpies;
+    QList<QSignalSpy*> rtcpSpies;
+};
+
+void tst_QXmppRtpForwarder::init()
+{
+    for (int i = 0; i < 3; ++i)
+        connectPair();
+}
+
+void tst_QXmppRtpForwarder::cleanup()
+{
+    qDeleteAll(rtpSpies);
+    rtpSpies.clear();
+    qDeleteAll(rtcpSpies);
+    rtcpSpies.clear();
+    qDeleteAll(clients);
+    clients.clear();
+    qDeleteAll(servers);
+    servers.clear();
+}
+
+void tst_QXmppRtpForwarder::connectPair()
+{
+    QXmppIceConnection *client = new QXmppIceConnection;
+    client->setIceControlling(true);
+    client->addComponent(1);
+    client->addComponent(2);
+    client->bind(QXmppIceComponent::discoverAddresses());
+
+    QXmppIceConnection *server = new QXmppIceConnection;
+    server->setIceControlling(false);
+    server->addComponent(1);
+    server->addComponent(2);
+    server->bind(QXmppIceComponent::discoverAddresses());
+
+    client->setRemoteUser(server->localUser());
+    client->setRemotePassword(server->localPassword());
+    server->setRemoteUser(client->localUser());
+    server->setRemotePassword(client->localPassword());
+    foreach (const QXmppJingleCandidate &candidate, server->localCandidates())
+        client->addRemoteCandidate(candidate);
+    foreach (const QXmppJingleCandidate &candidate, client->localCandidates())
+        server->addRemoteCandidate(candidate);
+
+    QEventLoop loop;
+    connect(client, SIGNAL(connected()), &loop, SLOT(quit()));
+    connect(server, SIGNAL(connected()), &loop, SLOT(quit()));
+    client->connectToHost();
+    server->connectToHost();
+    while (!client->isConnected() || !server->isConnected())
+        loop.exec();
+
+    clients << client;
+    servers << server;
+    rtpSpies << new QSignalSpy(client->component(1), SIGNAL(datagramReceived(QByteArray)));
+    rtcpSpies << new QSignalSpy(client->component(2), SIGNAL(datagramReceived(QByteArray)));
+}
+
+// Waits for the client with the given index to receive an RTP packet.
+QXmppRtpPacket tst_QXmppRtpForwarder::receive(int index)
+{
+    QXmppRtpPacket packet;
+    QSignalSpy *spy = rtpSpies[index];
+    for (int i = 0; i < 50 && spy->isEmpty(); ++i)
+        QTest::qWait(10);
+    if (!spy->isEmpty())
+        packet.decode(spy->takeFirst().at(0).toByteArray());
+    return packet;
+}
+
+void tst_QXmppRtpForwarder::testForwardAll()
+{
+    QXmppRtpForwarder forwarder;
+    foreach (QXmppIceConnection *server, servers)
+        forwarder.addConnection(server);
+    QCOMPARE(forwarder.connections(), servers);
+    QCOMPARE(forwarder.mode(), QXmppRtpForwarder::ForwardAll);
+
+    // the stream of client 0 reaches the others unchanged
+    clients[0]->component(1)->sendDatagram(rtpPacket(1000, 10, 100, "hello"));
+    for (int i = 1; i < 3; ++i) {
+        const QXmppRtpPacket packet = receive(i);
+        QCOMPARE(packet.ssrc(), quint32(1000));
+        QCOMPARE(packet.sequence(), quint16(10));
+        QCOMPARE(packet.stamp(), quint32(100));
+        QCOMPARE(packet.payload(), QByteArray("hello"));
+    }
+    QVERIFY(rtpSpies[0]->isEmpty());
+
+    // receivers starting the stream ask for a key frame
+    for (int i = 0; i < 50 && rtcpSpies[0]->isEmpty(); ++i)
+        QTest::qWait(10);
+    QVERIFY(!rtcpSpies[0]->isEmpty());
+    const QByteArray pli = rtcpSpies[0]->takeFirst().at(0).toByteArray();
+    QCOMPARE(pli.size(), 12);
+    QCOMPARE(quint8(pli[0]), quint8(0x81));
+    QCOMPARE(quint8(pli[1]), quint8(206));
+
+    // stop forwarding client 0 to client 1 and resume
+    QVERIFY(forwarder.isForwarding(servers[1], servers[0]));
+    forwarder.setForwarding(servers[1], servers[0], false);
+    QVERIFY(!forwarder.isForwarding(servers[1], servers[0]));
+    clients[0]->component(1)->sendDatagram(rtpPacket(1000, 11, 200, "skipped"));
+    QCOMPARE(receive(2).sequence(), quint16(11));
+    QVERIFY(rtpSpies[1]->isEmpty());
+
+    // the gap is hidden from client 1
+    forwarder.setForwarding(servers[1], servers[0], true);
+    clients[0]->component(1)->sendDatagram(rtpPacket(1000, 12, 300, "resumed"));
+    const QXmppRtpPacket packet = receive(1);
+    QCOMPARE(packet.ssrc(), quint32(1000));
+    QCOMPARE(packet.sequence(), quint16(11));
+    QCOMPARE(packet.payload(), QByteArray("resumed"));
+}
+
+void tst_QXmppRtpForwarder::testForwardActiveSpeaker()
+{
+    QXmppRtpForwarder forwarder;
+    forwarder.setMode(QXmppRtpForwarder::ForwardActiveSpeaker);
+    foreach (QXmppIceConnection *server, servers)
+        forwarder.addConnection(server);
+    forwarder.setActiveSpeaker(servers[0]);
+    QCOMPARE(forwarder.activeSpeaker(), servers[0]);
+
+    // only the active speaker is forwarded
+    clients[2]->component(1)->sendDatagram(rtpPacket(3000, 500, 9000, "client 2"));
+    clients[0]->component(1)->sendDatagram(rtpPacket(1000, 10, 100, "client 0"));
+    QXmppRtpPacket packet = receive(1);
+    QCOMPARE(packet.payload(), QByteArray("client 0"));
+    QCOMPARE(packet.sequence(), quint16(10));
+    const quint32 ssrc = packet.ssrc();
+    QVERIFY(ssrc != quint32(1000));
+    QCOMPARE(receive(2).payload(), QByteArray("client 0"));
+    QVERIFY(rtpSpies[0]->isEmpty());
+    QVERIFY(rtpSpies[1]->isEmpty());
+
+    // switching speakers keeps the receiver's stream continuous
+    forwarder.setActiveSpeaker(servers[2]);
+    clients[2]->component(1)->sendDatagram(rtpPacket(3000, 501, 9100, "client 2"));
+    packet = receive(1);
+    QCOMPARE(packet.payload(), QByteArray("client 2"));
+    QCOMPARE(packet.ssrc(), ssrc);
+    QCOMPARE(packet.sequence(), quint16(11));
+
+    // the active speaker sees the previous one
+    QCOMPARE(receive(0).payload(), QByteArray("client 2"));
+    QVERIFY(rtpSpies[2]->isEmpty());
+}
+
+QTEST_MAIN(tst_QXmppRtpForwarder)
+#include "tst_qxmpprtpforwarder.moc"
@@ -33,6 +33,9 @@ private slots:
     void testBad();
     void testSimple();
     void testWithCsrc();
+    void testWithExtension();
+    void testWithPadding();
+    void testEncodeBuffer();
 };
 
 void tst_QXmppRtpPacket::testBad()
@@ -42,7 +45,12 @@ void tst_QXmppRtpPacket::testBad()
     // too short
     QCOMPARE(packet.decode(QByteArray()), false);
     QCOMPARE(packet.decode(QByteArray("\x80\x00\x3e", 3)), false);
-    QCOMPARE(packet.decode(QByteArray("\x84\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e", 12)), false);
+    QCOMPARE(packet.decode(QByteArray("\x82\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e", 12)), false);
+    QCOMPARE(packet.decode(QByteArray("\x90\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xbe\xde\x00\x01", 16)), false);
+
+    // bad padding
+    QCOMPARE(packet.decode(QByteArray("\xa0\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x00", 14)), false);
+    QCOMPARE(packet.decode(QByteArray("\xa0\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x03", 14)), false);
 
     // wrong RTP version
     QCOMPARE(packet.decode(QByteArray("\x40\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e", 12)), false);
@@ -65,7 +73,7 @@ void tst_QXmppRtpPacket::testSimple()
 
 void tst_QXmppRtpPacket::testWithCsrc()
 {
-    QByteArray data("\x84\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xab\xcd\xef\x01\xde\xad\xbe\xef\x12\x34\x56", 23);
+    QByteArray data("\x82\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xab\xcd\xef\x01\xde\xad\xbe\xef\x12\x34\x56", 23);
     QXmppRtpPacket packet;
     QCOMPARE(packet.decode(data), true);
     QCOMPARE(packet.marker(), false);
@@ -78,5 +86,66 @@ void tst_QXmppRtpPacket::testWithCsrc()
     QCOMPARE(packet.encode(), data);
 }
 
+void tst_QXmppRtpPacket::testWithExtension()
+{
+    QByteArray data("\x91\x80\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xab\xcd\xef\x01\xbe\xde\x00\x01\x10\xaa\x00\x00\x12\x34\x56", 27);
+    QXmppRtpPacket packet;
+    QCOMPARE(packet.decode(data), true);
+    QCOMPARE(packet.marker(), true);
+    QCOMPARE(packet.type(), quint8(0));
+    QCOMPARE(packet.sequence(), quint16(16082));
+    QCOMPARE(packet.stamp(), quint32(144));
+    QCOMPARE(packet.ssrc(), quint32(1606227614));
+    QCOMPARE(packet.csrc(), QList<quint32>() << quint32(0xabcdef01));
+    QCOMPARE(packet.hasExtension(), true);
+    QCOMPARE(packet.extensionProfile(), quint16(0xbede));
+    QCOMPARE(packet.extension(), QByteArray("\x10\xaa\x00\x00", 4));
+    QVERIFY(packet.extensionData() == data.constData() + 20);
+    QCOMPARE(packet.extensionSize(), 4);
+    QCOMPARE(packet.payload(), QByteArray("\x12\x34\x56", 3));
+    QVERIFY(packet.payloadData() == data.constData() + 24);
+    QCOMPARE(packet.payloadSize(), 3);
+    QCOMPARE(packet.encode(), data);
+
+    // the extension is padded to a multiple of 4 bytes
+    packet.setExtension(0xbede, QByteArray("\x10\xaa", 2));
+    QCOMPARE(packet.encode(), data);
+
+    packet.clearExtension();
+    QCOMPARE(packet.hasExtension(), false);
+    QCOMPARE(packet.encode(), QByteArray("\x81\x80\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xab\xcd\xef\x01\x12\x34\x56", 19));
+}
+
+void tst_QXmppRtpPacket::testWithPadding()
+{
+    QByteArray data("\xa0\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x34\x56\x00\x00\x03", 18);
+    QXmppRtpPacket packet;
+    QCOMPARE(packet.decode(data), true);
+    QCOMPARE(packet.sequence(), quint16(16082));
+    QCOMPARE(packet.payload(), QByteArray("\x12\x34\x56", 3));
+    QCOMPARE(packet.encode(), QByteArray("\x80\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x34\x56", 15));
+}
+
+void tst_QXmppRtpPacket::testEncodeBuffer()
+{
+    const QByteArray data("\x80\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x34\x56", 15);
+    QXmppRtpPacket packet;
+    QCOMPARE(packet.decode(data), true);
+
+    // the buffer is reused
+    QByteArray buffer;
+    buffer.reserve(64);
+    const char *ptr = buffer.constData();
+    packet.encode(&buffer);
+    QCOMPARE(buffer, data);
+    QVERIFY(buffer.constData() == ptr);
+
+    packet.setSequence(16083);
+    packet.setPayload(QByteArray("\x12\x34\x56\x78\x9a", 5));
+    packet.encode(&buffer);
+    QCOMPARE(buffer, QByteArray("\x80\x00\x3e\xd3\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x34\x56\x78\x9a", 17));
+    QVERIFY(buffer.constData() == ptr);
+}
+
 QTEST_MAIN(tst_QXmppRtpPacket)
 #include "tst_qxmpprtppacket.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpprtpvideochannel
+SOURCES += tst_qxmpprtpvideochannel.cpp
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppJingleIq.h"
+#include "QXmppRtcpPacket.h"
+#include "QXmppRtpChannel.h"
+#include "QXmppRtpPacket.h"
+
+class tst_QXmppRtpVideoChannel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBitrate();
+    void testReceiverReport();
+
+private:
+    void receiveReport(QXmppRtpVideoChannel *channel, quint8 fractionLost);
+    void setupChannel(QXmppRtpVideoChannel *channel);
+};
+
+void tst_QXmppRtpVideoChannel::receiveReport(QXmppRtpVideoChannel *channel, quint8 fractionLost)
+{
+    QXmppRtcpReceiverReport report;
+    report.setSsrc(channel->localSsrc());
+    report.setFractionLost(fractionLost);
+
+    QXmppRtcpPacket packet;
+    packet.setType(QXmppRtcpPacket::ReceiverReport);
+    packet.setSsrc(1234);
+    packet.setReceiverReports(QList<QXmppRtcpReceiverReport>() << report);
+    channel->rtcpDatagramReceived(packet.encode());
+}
+
+void tst_QXmppRtpVideoChannel::setupChannel(QXmppRtpVideoChannel *channel)
+{
+    QXmppJinglePayloadType payload;
+    payload.setId(96);
+    payload.setName("vp8");
+    payload.setClockrate(90000);
+    channel->setRemotePayloadTypes(QList<QXmppJinglePayloadType>() << payload);
+}
+
+void tst_QXmppRtpVideoChannel::testBitrate()
+{
+    QXmppRtpVideoChannel channel;
+    QCOMPARE(channel.bitrate(), 256000);
+    QCOMPARE(channel.maximumBitrate(), 256000);
+    QCOMPARE(channel.roundTripTime(), -1);
+
+    // heavy loss reduces the bitrate
+    QSignalSpy spy(&channel, SIGNAL(statisticsChanged()));
+    receiveReport(&channel, 128);
+    QCOMPARE(channel.bitrate(), 192000);
+    QCOMPARE(spy.size(), 1);
+    QCOMPARE(channel.statistics().remoteFractionLost(), 0.5);
+
+    // moderate loss keeps it
+    receiveReport(&channel, 13);
+    QCOMPARE(channel.bitrate(), 192000);
+
+    // no loss increases it
+    receiveReport(&channel, 0);
+    QCOMPARE(channel.bitrate(), 207360);
+
+    // the bitrate is bounded
+    for (int i = 0; i < 50; ++i)
+        receiveReport(&channel, 255);
+    QCOMPARE(channel.bitrate(), 32000);
+
+    channel.setMaximumBitrate(128000);
+    for (int i = 0; i < 50; ++i)
+        receiveReport(&channel, 0);
+    QCOMPARE(channel.bitrate(), 128000);
+
+    // reports about other sources are ignored
+    QXmppRtcpReceiverReport report;
+    report.setSsrc(channel.localSsrc() + 1);
+    report.setFractionLost(255);
+    QXmppRtcpPacket packet;
+    packet.setType(QXmppRtcpPacket::ReceiverReport);
+    packet.setReceiverReports(QList<QXmppRtcpReceiverReport>() << report);
+    channel.rtcpDatagramReceived(packet.encode());
+    QCOMPARE(channel.bitrate(), 128000);
+}
+
+void tst_QXmppRtpVideoChannel::testReceiverReport()
+{
+    QXmppRtpVideoChannel channel;
+    setupChannel(&channel);
+
+    // receive ten packets, one of which is lost
+    for (int i = 1; i <= 10; ++i) {
+        if (i == 5)
+            continue;
+        QXmppRtpPacket packet;
+        packet.setType(96);
+        packet.setSequence(i);
+        packet.setStamp(i * 3000);
+        packet.setSsrc(1234);
+        packet.setPayload(QByteArray(10, 'x'));
+        channel.datagramReceived(packet.encode());
+    }
+
+    QSignalSpy spy(&channel, SIGNAL(sendRtcpDatagram(QByteArray)));
+    QEventLoop loop;
+    connect(&channel, SIGNAL(sendRtcpDatagram(QByteArray)), &loop, SLOT(quit()));
+    QTimer::singleShot(2000, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(spy.size(), 1);
+
+    QXmppRtcpPacket packet;
+    QVERIFY(packet.decode(spy[0][0].toByteArray()));
+    QCOMPARE(packet.type(), quint8(QXmppRtcpPacket::ReceiverReport));
+    QCOMPARE(packet.ssrc(), channel.localSsrc());
+    QCOMPARE(packet.receiverReports().size(), 1);
+
+    const QXmppRtcpReceiverReport report = packet.receiverReports().first();
+    QCOMPARE(report.ssrc(), quint32(1234));
+    QCOMPARE(report.highestSequence(), quint32(10));
+    QCOMPARE(report.totalLost(), quint32(1));
+    QCOMPARE(report.fractionLost(), quint8(25));
+    QCOMPARE(report.lsr(), quint32(0));
+    QCOMPARE(report.dlsr(), quint32(0));
+}
+
+QTEST_MAIN(tst_QXmppRtpVideoChannel)
+#include "tst_qxmpprtpvideochannel.moc"
@@ -49,6 +49,10 @@ private slots:
     void testClientFacebook();
     void testClientGoogle();
     void testClientPlain();
+    void testClientScram_data();
+    void testClientScram();
+    void testClientScramIterations();
+    void testClientToken();
     void testClientWindowsLive();
 
     // server
@@ -57,6 +61,9 @@ private slots:
     void testServerDigestMd5();
     void testServerPlain();
     void testServerPlainChallenge();
+    void testServerScram_data();
+    void testServerScram();
+    void testServerToken();
 };
 
 void tst_QXmppSasl::testParsing()
@@ -182,11 +189,23 @@ void tst_QXmppSasl::testSuccess()
     QXmppSaslSuccess stanza;
     parsePacket(stanza, xml);
     serializePacket(stanza, xml);
+
+    // with additional data
+    const QByteArray dataXml = "<success xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\">Zm9v</success>";
+    QXmppSaslSuccess dataStanza;
+    parsePacket(dataStanza, dataXml);
+    QCOMPARE(dataStanza.value(), QByteArray("foo"));
+    serializePacket(dataStanza, dataXml);
 }
 
 void tst_QXmppSasl::testClientAvailableMechanisms()
 {
-    QCOMPARE(QXmppSaslClient::availableMechanisms(), QStringList() << "PLAIN" << "DIGEST-MD5" << "ANONYMOUS" << "X-FACEBOOK-PLATFORM" << "X-MESSENGER-OAUTH2" << "X-OAUTH2");
+    QStringList expected;
+#if QT_VERSION >= 0x050000
+    expected << "SCRAM-SHA-256";
+#endif
+    expected << "SCRAM-SHA-1" << "PLAIN" << "DIGEST-MD5" << "ANONYMOUS" << "X-FACEBOOK-PLATFORM" << "X-MESSENGER-OAUTH2" << "X-OAUTH2" << "X-QXMPP-TOKEN";
+    QCOMPARE(QXmppSaslClient::availableMechanisms(), expected);
 }
 
 void tst_QXmppSasl::testClientBadMechanism()
@@ -316,6 +335,122 @@ void tst_QXmppSasl::testClientPlain()
     delete client;
 }
 
+void tst_QXmppSasl::testClientScram_data()
+{
+    QTest::addColumn<QString>("mechanism");
+    QTest::addColumn<QByteArray>("nonce");
+    QTest::addColumn<QByteArray>("serverFirst");
+    QTest::addColumn<QByteArray>("clientFinal");
+    QTest::addColumn<QByteArray>("serverFinal");
+
+    // test vectors from RFC 5802 and RFC 7677
+    QTest::newRow("sha-1")
+        << "SCRAM-SHA-1"
+        << QByteArray("fyko+d2lbbFgONRv9qkxdawL")
+        << QByteArray("r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,s=QSXCR+Q6sek8bf92,i=4096")
+        << QByteArray("c=biws,r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,p=v0X8v3Bz2T0CJGbJQyF0X+HI4Ts=")
+        << QByteArray("v=rmF9pqV8S7suAoZWja4dJRkFsKQ=");
+
+#if QT_VERSION >= 0x050000
+    QTest::newRow("sha-256")
+        << "SCRAM-SHA-256"
+        << QByteArray("rOprNGfwEbeRWgbNEkqO")
+        << QByteArray("r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=4096")
+        << QByteArray("c=biws,r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,p=dHzbZapWIk4jUhN+Ute9ytag9zjfMHgsqmmiz7AndVQ=")
+        << QByteArray("v=6rriTRBi23WpRR/wtup+mMhUZUn/dB5nLTJRsjl95G4=");
+#endif
+}
+
+void tst_QXmppSasl::testClientScram()
+{
+    QFETCH(QString, mechanism);
+    QFETCH(QByteArray, nonce);
+    QFETCH(QByteArray, serverFirst);
+    QFETCH(QByteArray, clientFinal);
+    QFETCH(QByteArray, serverFinal);
+
+    QXmppSaslDigestMd5::setNonce(nonce);
+    QXmppSaslScram::clearCache();
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        QXmppSaslClient *client = QXmppSaslClient::create(mechanism);
+        QVERIFY(client != 0);
+        QCOMPARE(client->mechanism(), mechanism);
+
+        client->setUsername("user");
+        client->setPassword("pencil");
+
+        // initial step returns data
+        QByteArray response;
+        QVERIFY(client->respond(QByteArray(), response));
+        QCOMPARE(response, QByteArray("n,,n=user,r=") + nonce);
+
+        // second step returns the proof, re-using cached keys on second attempt
+        QVERIFY(client->respond(serverFirst, response));
+        QCOMPARE(response, clientFinal);
+        QCOMPARE(QXmppSaslScram::cacheSize(), 1);
+
+        // third step checks the server's signature
+        QVERIFY(!client->respond(QByteArray("v=AAAA"), response));
+        delete client;
+    }
+
+    // valid server signature
+    QXmppSaslClient *client = QXmppSaslClient::create(mechanism);
+    client->setUsername("user");
+    client->setPassword("pencil");
+    QByteArray response;
+    QVERIFY(client->respond(QByteArray(), response));
+    QVERIFY(client->respond(serverFirst, response));
+    QVERIFY(!static_cast<QXmppSaslClientScram*>(client)->isServerVerified());
+    QVERIFY(client->respond(serverFinal, response));
+    QCOMPARE(response, QByteArray());
+    QVERIFY(static_cast<QXmppSaslClientScram*>(client)->isServerVerified());
+
+    // any further step is an error
+    QVERIFY(!client->respond(QByteArray(), response));
+
+    delete client;
+}
+
+void tst_QXmppSasl::testClientScramIterations()
+{
+    QXmppSaslDigestMd5::setNonce("fyko+d2lbbFgONRv9qkxdawL");
+
+    QXmppSaslClient *client = QXmppSaslClient::create("SCRAM-SHA-1");
+    QVERIFY(client != 0);
+    client->setUsername("user");
+    client->setPassword("pencil");
+
+    QByteArray response;
+    QVERIFY(client->respond(QByteArray(), response));
+
+    // an excessive iteration count is refused
+    QVERIFY(!client->respond(QByteArray("r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,s=QSXCR+Q6sek8bf92,i=100000000"), response));
+
+    delete client;
+}
+
+void tst_QXmppSasl::testClientToken()
+{
+    QXmppSaslClient *client = QXmppSaslClient::create("X-QXMPP-TOKEN");
+    QVERIFY(client != 0);
+    QCOMPARE(client->mechanism(), QLatin1String("X-QXMPP-TOKEN"));
+
+    client->setUsername("foo");
+    client->setPassword("123.abc");
+
+    // initial step returns data
+    QByteArray response;
+    QVERIFY(client->respond(QByteArray(), response));
+    QCOMPARE(response, QByteArray("foo\0" "123.abc", 11));
+
+    // any further step is an error
+    QVERIFY(!client->respond(QByteArray(), response));
+
+    delete client;
+}
+
 void tst_QXmppSasl::testClientWindowsLive()
 {
     QXmppSaslClient *client = QXmppSaslClient::create("X-MESSENGER-OAUTH2");
@@ -433,5 +568,90 @@ void tst_QXmppSasl::testServerPlainChallenge()
     delete server;
 }
 
+void tst_QXmppSasl::testServerScram_data()
+{
+    QTest::addColumn<QString>("mechanism");
+
+    QTest::newRow("sha-1") << "SCRAM-SHA-1";
+#if QT_VERSION >= 0x050000
+    QTest::newRow("sha-256") << "SCRAM-SHA-256";
+#endif
+}
+
+void tst_QXmppSasl::testServerScram()
+{
+    QFETCH(QString, mechanism);
+
+    QXmppSaslDigestMd5::setNonce("c2VydmVybm9uY2U=");
+    QXmppSaslScram::clearCache();
+
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        // the last attempt uses a bad password
+        const bool valid = attempt < 2;
+
+        QXmppSaslClient *client = QXmppSaslClient::create(mechanism);
+        QVERIFY(client != 0);
+        client->setUsername("foo,bar=");
+        client->setPassword(valid ? "secret" : "wrong");
+
+        QXmppSaslServer *server = QXmppSaslServer::create(mechanism);
+        QVERIFY(server != 0);
+        QCOMPARE(server->mechanism(), mechanism);
+
+        // password needed
+        QByteArray request;
+        QByteArray response;
+        QVERIFY(client->respond(QByteArray(), request));
+        QCOMPARE(request, QByteArray("n,,n=foo=2Cbar=3D,r=c2VydmVybm9uY2U="));
+        QCOMPARE(server->respond(request, response), QXmppSaslServer::InputNeeded);
+        QCOMPARE(server->username(), QLatin1String("foo,bar="));
+        server->setPassword("secret");
+
+        // first challenge
+        QCOMPARE(server->respond(request, response), QXmppSaslServer::Challenge);
+        QVERIFY(response.startsWith("r=c2VydmVybm9uY2U=c2VydmVybm9uY2U=,s="));
+        QVERIFY(response.endsWith(",i=4096"));
+        QVERIFY(client->respond(response, request));
+
+        if (!valid) {
+            QCOMPARE(server->respond(request, response), QXmppSaslServer::Failed);
+        } else {
+            // second challenge
+            QCOMPARE(server->respond(request, response), QXmppSaslServer::Challenge);
+            QVERIFY(client->respond(response, request));
+            QCOMPARE(request, QByteArray());
+
+            // success
+            QCOMPARE(server->respond(request, response), QXmppSaslServer::Succeeded);
+            QCOMPARE(response, QByteArray());
+
+            // the keys are shared by the client and the server
+            QCOMPARE(QXmppSaslScram::cacheSize(), 1);
+        }
+
+        delete client;
+        delete server;
+    }
+}
+
+void tst_QXmppSasl::testServerToken()
+{
+    QXmppSaslServer *server = QXmppSaslServer::create("X-QXMPP-TOKEN");
+    QVERIFY(server != 0);
+    QCOMPARE(server->mechanism(), QLatin1String("X-QXMPP-TOKEN"));
+
+    // initial step needs the token to be checked
+    QByteArray response;
+    QCOMPARE(server->respond(QByteArray("foo\0" "123.abc", 11), response), QXmppSaslServer::InputNeeded);
+    QCOMPARE(response, QByteArray());
+    QCOMPARE(server->username(), QLatin1String("foo"));
+    QCOMPARE(server->password(), QLatin1String("123.abc"));
+
+    // any further step is an error
+    QCOMPARE(server->respond(QByteArray(), response), QXmppSaslServer::Failed);
+
+    delete server;
+}
+
 QTEST_MAIN(tst_QXmppSasl)
 #include "tst_qxmppsasl.moc"
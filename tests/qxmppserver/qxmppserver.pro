@@ -1,3 +1,4 @@
 include(../tests.pri)
 TARGET = tst_qxmppserver
 SOURCES += tst_qxmppserver.cpp
+HEADERS += ../tcprelay.h
@@ -21,33 +21,722 @@
  *
  */
 
+#include <QDir>
+#include <QElapsedTimer>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMutex>
+#include <QSslCipher>
+#include <QSslSocket>
+#include <QTcpSocket>
+#include <QWaitCondition>
+
+#include "QXmppAsyncServerExtension.h"
 #include "QXmppClient.h"
+#include "QXmppClientExtension.h"
+#include "QXmppDiscoveryManager.h"
+#include "QXmppMessage.h"
+#include "QXmppRosterManager.h"
 #include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "QXmppServerMuc.h"
+#include "QXmppServerOffline.h"
+#include "QXmppServerPubSub.h"
+#include "QXmppServerRoster.h"
+#include "tcprelay.h"
 #include "util.h"
 
+class TestExtension : public QXmppServerExtension
+{
+public:
+    TestExtension(const QList<StanzaFilter> &filters, int priority)
+        : m_filters(filters), m_priority(priority)
+    {
+    }
+
+    int extensionPriority() const
+    {
+        return m_priority;
+    }
+
+    bool handleStanza(const QDomElement &stanza)
+    {
+        received << stanza.tagName();
+        return false;
+    }
+
+    QList<StanzaFilter> stanzaFilters() const
+    {
+        return m_filters;
+    }
+
+    QByteArray saveState() const
+    {
+        return received.join(",").toUtf8();
+    }
+
+    bool restoreState(const QByteArray &state)
+    {
+        received = QString::fromUtf8(state).split(',', QString::SkipEmptyParts);
+        return true;
+    }
+
+    QStringList received;
+
+private:
+    QList<StanzaFilter> m_filters;
+    int m_priority;
+};
+
+class TestDiscoveryExtension : public QXmppServerExtension
+{
+public:
+    QStringList discoveryFeatures() const
+    {
+        calls++;
+        return features;
+    }
+
+    QStringList discoveryItems() const
+    {
+        return items;
+    }
+
+    QStringList features;
+    QStringList items;
+    mutable int calls;
+};
+
+class TestAsyncExtension : public QXmppAsyncServerExtension
+{
+public:
+    ~TestAsyncExtension()
+    {
+        waitForDone();
+    }
+
+    QList<StanzaFilter> stanzaFilters() const
+    {
+        return QList<StanzaFilter>() << StanzaFilter("iq", "urn:test:async");
+    }
+
+protected:
+    bool claimStanza(const QDomElement &stanza)
+    {
+        return stanza.attribute("type") == QLatin1String("get");
+    }
+
+    void processStanza(const QDomElement &stanza)
+    {
+        // block the worker, as a database query would
+        QMutex mutex;
+        QWaitCondition condition;
+        mutex.lock();
+        condition.wait(&mutex, 300);
+        mutex.unlock();
+
+        QXmppIq response(QXmppIq::Result);
+        response.setId(stanza.attribute("id"));
+        response.setFrom(stanza.attribute("to"));
+        response.setTo(stanza.attribute("from"));
+        sendResponse(response);
+    }
+};
+
+class TestSequenceExtension : public QXmppClientExtension
+{
+public:
+    bool handleStanza(const QDomElement &stanza)
+    {
+        if (stanza.tagName() == QLatin1String("message")) {
+            received << "message";
+            return true;
+        } else if (stanza.tagName() == QLatin1String("iq")) {
+            received << QString("iq:%1:%2").arg(stanza.attribute("id"), stanza.attribute("type"));
+            return true;
+        }
+        return false;
+    }
+
+    QStringList received;
+};
+
+class TestSubscribersExtension : public QXmppServerExtension
+{
+public:
+    QSet<QString> presenceSubscribers(const QString &jid)
+    {
+        return subscribers.value(jid);
+    }
+
+    QHash<QString, QSet<QString> > subscribers;
+};
+
+class TestMessageCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    QList<QXmppMessage> messages;
+
+public slots:
+    void messageReceived(const QXmppMessage &message)
+    {
+        messages << message;
+    }
+};
+
+class TestDiscoveryCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    QList<QXmppDiscoveryIq> infos;
+    QList<QXmppDiscoveryIq> items;
+
+public slots:
+    void infoReceived(const QXmppDiscoveryIq &iq)
+    {
+        infos << iq;
+    }
+
+    void itemsReceived(const QXmppDiscoveryIq &iq)
+    {
+        items << iq;
+    }
+};
+
+// Reads from a raw client stream until the received data contains \a text.
+static QByteArray waitForData(QTcpSocket *socket, const QByteArray &text)
+{
+    QByteArray received;
+    for (int i = 0; i < 50 && !received.contains(text); ++i) {
+        QTest::qWait(50);
+        received += socket->readAll();
+    }
+    return received;
+}
+
+// Opens a raw client stream and authenticates as \a user.
+static bool openStream(QTcpSocket *socket, const QHostAddress &host, quint16 port, const QByteArray &user = "user1")
+{
+    const QByteArray header("<?xml version='1.0'?><stream:stream to='localhost' version='1.0'"
+                            " xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>");
+
+    socket->connectToHost(host, port);
+    socket->write(header);
+    if (!waitForData(socket, "</stream:features>").contains("PLAIN"))
+        return false;
+
+    socket->write("<auth xmlns='urn:ietf:params:xml:ns:xmpp-sasl' mechanism='PLAIN'>" +
+                  (QByteArray(1, '\0') + user + QByteArray("\0testpwd", 8)).toBase64() + "</auth>");
+    if (!waitForData(socket, "<success").contains("<success"))
+        return false;
+
+    socket->write(header);
+    return waitForData(socket, "</stream:features>").contains("urn:xmpp:sm:3");
+}
+
 class tst_QXmppServer : public QObject
 {
     Q_OBJECT
 
 private slots:
+    void testAdmission();
+    void testAsyncExtension();
+    void testBroadcast();
+    void testClientResumption();
+    void testClientStateIndication();
+    void testDiscovery();
+    void testDrain();
+    void testEfficientCiphers();
+    void testExtensionFilters();
     void testConnect_data();
     void testConnect();
+    void testConnectLocal();
+    void testLoginToken();
+    void testMessageCarbons();
+    void testMuc();
+    void testOfflineMessages();
+    void testPersonalEventing();
+    void testReconnectionHint();
+    void testRedirect();
+    void testReplaceExtension();
+    void testRoster();
+    void testSendQueue();
+    void testStreamCompression();
+    void testStreamResumption();
+    void testVirtualHosting();
+    void testWorkerRebalance();
 };
 
+void tst_QXmppServer::testAdmission()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12352;
+    const QByteArray header("<?xml version='1.0'?><stream:stream to='localhost' version='1.0'"
+                            " xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setConnectionAdmissionRate(1);
+    QCOMPARE(server.connectionAdmissionRate(), 1);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // the first connections use the burst, the others wait
+    QTcpSocket sockets[4];
+    for (int i = 0; i < 4; ++i) {
+        sockets[i].connectToHost(testHost, testPort);
+        QVERIFY(sockets[i].waitForConnected());
+        sockets[i].write(header);
+    }
+    QVERIFY(waitForData(&sockets[0], "</stream:features>").contains("</stream:features>"));
+    QCOMPARE(server.statistics().value("queued-connections").toInt(), 2);
+    QCOMPARE(server.statistics().value("incoming-clients").toInt(), 2);
+
+    // the waiting connections are admitted over time
+    QVERIFY(waitForData(&sockets[2], "</stream:features>").contains("</stream:features>"));
+    QCOMPARE(server.statistics().value("queued-connections").toInt(), 1);
+}
+
+void tst_QXmppServer::testAsyncExtension()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12373;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+
+    TestAsyncExtension *extension = new TestAsyncExtension;
+    extension->setMaximumThreadCount(1);
+    extension->setMaximumQueueDepth(2);
+    QCOMPARE(extension->maximumQueueDepth(), 2);
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(extension);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+
+    QXmppClient client;
+    TestSequenceExtension *sequence = new TestSequenceExtension;
+    client.addExtension(sequence);
+    QSignalSpy connected(&client, SIGNAL(connected()));
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+
+    QXmppElement query;
+    query.setTagName("query");
+    query.setAttribute("xmlns", "urn:test:async");
+
+    QXmppIq request;
+    request.setTo(testDomain);
+    request.setExtensions(QXmppElementList() << query);
+
+    // the message is routed while the first request is being processed,
+    // and the third request finds the queue full
+    request.setId("slow1");
+    QVERIFY(client.sendPacket(request));
+    QVERIFY(client.sendPacket(QXmppMessage(QString(), client.configuration().jid(), "hello")));
+    request.setId("slow2");
+    QVERIFY(client.sendPacket(request));
+    request.setId("slow3");
+    QVERIFY(client.sendPacket(request));
+
+    for (int i = 0; i < 50 && sequence->received.size() < 4; ++i)
+        QTest::qWait(100);
+    QCOMPARE(sequence->received, QStringList()
+        << "message"
+        << "iq:slow3:error"
+        << "iq:slow1:result"
+        << "iq:slow2:result");
+    QCOMPARE(extension->queueDepth(), 0);
+}
+
+void tst_QXmppServer::testBroadcast()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12346;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+    passwordChecker.addCredentials("user2", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // connect two clients
+    QXmppClient client1, client2;
+    QSignalSpy connected1(&client1, SIGNAL(connected()));
+    QSignalSpy connected2(&client2, SIGNAL(connected()));
+    TestMessageCollector received1, received2;
+    connect(&client1, SIGNAL(messageReceived(QXmppMessage)),
+            &received1, SLOT(messageReceived(QXmppMessage)));
+    connect(&client2, SIGNAL(messageReceived(QXmppMessage)),
+            &received2, SLOT(messageReceived(QXmppMessage)));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+    config.setUser("user1");
+    client1.connectToServer(config);
+    config.setUser("user2");
+    client2.connectToServer(config);
+    for (int i = 0; i < 50 && (connected1.isEmpty() || connected2.isEmpty()); ++i)
+        QTest::qWait(100);
+    QVERIFY(client1.isConnected());
+    QVERIFY(client2.isConnected());
+
+    // the recipient is replaced for each copy
+    QXmppMessage message(testDomain, "original@localhost", "Hello");
+    const QSet<QString> recipients = QSet<QString>()
+        << "user1@localhost" << "user2@localhost" << "nobody@localhost";
+    QCOMPARE(server.broadcastPacket(message, recipients), 2);
+
+    for (int i = 0; i < 50 && (received1.messages.isEmpty() || received2.messages.isEmpty()); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received1.messages.size(), 1);
+    QCOMPARE(received1.messages.first().to(), QLatin1String("user1@localhost"));
+    QCOMPARE(received1.messages.first().body(), QLatin1String("Hello"));
+    QCOMPARE(received2.messages.size(), 1);
+    QCOMPARE(received2.messages.first().to(), QLatin1String("user2@localhost"));
+}
+
+void tst_QXmppServer::testClientResumption()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12399;
+    const quint16 relayPort = 12400;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setStreamResumptionTimeout(60);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // the client goes through a relay which can cut its connection
+    TestTcpRelay relay;
+    relay.setTargetPort(testPort);
+    QVERIFY(relay.listen(testHost, relayPort));
+
+    QXmppClient client;
+    QSignalSpy connected(&client, SIGNAL(connected()));
+    QSignalSpy disconnected(&client, SIGNAL(disconnected()));
+    QSignalSpy resumed(&client, SIGNAL(resumed()));
+    QSignalSpy sessionEnded(&client, SIGNAL(sessionEnded()));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(relayPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setStreamManagementMode(QXmppConfiguration::SMSessionResumptionEnabled);
+    config.setReconnectionInitialDelay(100);
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && !client.isSessionResumable(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(connected.size(), 1);
+    QVERIFY(client.isSessionResumable());
+
+    // the session survives the loss of the connection and is resumed
+    relay.dropConnections();
+    for (int i = 0; i < 50 && resumed.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(resumed.size(), 1);
+    QCOMPARE(disconnected.size(), 1);
+    QCOMPARE(connected.size(), 1);
+    QCOMPARE(sessionEnded.size(), 0);
+    QCOMPARE(relay.connections, 2);
+    QVERIFY(client.isConnected());
+    QVERIFY(client.isSessionResumable());
+
+    // closing the stream ends the session
+    client.disconnectFromServer();
+    for (int i = 0; i < 50 && sessionEnded.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(sessionEnded.size(), 1);
+    QCOMPARE(resumed.size(), 1);
+    QVERIFY(!client.isSessionResumable());
+}
+
+void tst_QXmppServer::testClientStateIndication()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12353;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QTcpSocket socket;
+    QVERIFY(openStream(&socket, testHost, testPort));
+    socket.write("<iq type='set' id='bind1'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+                 "<resource>phone</resource></bind></iq>");
+    QVERIFY(waitForData(&socket, "</iq>").contains("user1@localhost/phone"));
+
+    const QString to("user1@localhost/phone");
+    QXmppPresence presence;
+    presence.setTo(to);
+
+    // presence updates are held back while the client is inactive
+    socket.write("<inactive xmlns='urn:xmpp:csi:0'/>");
+    QTest::qWait(100);
+    presence.setFrom("user2@localhost/a");
+    presence.setStatusText("first");
+    QVERIFY(server.sendPacket(presence));
+    presence.setStatusText("second");
+    QVERIFY(server.sendPacket(presence));
+    presence.setFrom("user3@localhost/b");
+    presence.setStatusText("third");
+    QVERIFY(server.sendPacket(presence));
+    QTest::qWait(200);
+    QVERIFY(!socket.readAll().contains("<presence"));
+
+    // only the last presence of each sender is sent once the client is active
+    socket.write("<active xmlns='urn:xmpp:csi:0'/>");
+    QByteArray received = waitForData(&socket, "third");
+    QVERIFY(!received.contains("first"));
+    QVERIFY(received.indexOf("second") >= 0);
+    QVERIFY(received.indexOf("second") < received.indexOf("third"));
+
+    // other stanzas are sent immediately, after the held presences
+    socket.write("<inactive xmlns='urn:xmpp:csi:0'/>");
+    QTest::qWait(100);
+    presence.setStatusText("fourth");
+    QVERIFY(server.sendPacket(presence));
+    QVERIFY(server.sendPacket(QXmppMessage(testDomain, to, "urgent")));
+    received = waitForData(&socket, "</message>");
+    QVERIFY(received.indexOf("fourth") >= 0);
+    QVERIFY(received.indexOf("fourth") < received.indexOf("urgent"));
+}
+
+void tst_QXmppServer::testDiscovery()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12372;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+
+    TestDiscoveryExtension *extension = new TestDiscoveryExtension;
+    extension->calls = 0;
+    extension->features << "urn:example:feature";
+    extension->items << "service.localhost";
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(extension);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppClient client;
+    QXmppDiscoveryManager *discoveryManager = client.findExtension<QXmppDiscoveryManager>();
+    QVERIFY(discoveryManager);
+    TestDiscoveryCollector received;
+    connect(discoveryManager, SIGNAL(infoReceived(QXmppDiscoveryIq)),
+            &received, SLOT(infoReceived(QXmppDiscoveryIq)));
+    connect(discoveryManager, SIGNAL(itemsReceived(QXmppDiscoveryIq)),
+            &received, SLOT(itemsReceived(QXmppDiscoveryIq)));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+
+    QSignalSpy connected(&client, SIGNAL(connected()));
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+
+    // the responses are built once, and spliced with each request's id
+    for (int request = 0; request < 2; ++request) {
+        const QString id = discoveryManager->requestInfo(testDomain);
+        for (int i = 0; i < 50 && received.infos.size() <= request; ++i)
+            QTest::qWait(100);
+        QCOMPARE(received.infos.size(), request + 1);
+        const QXmppDiscoveryIq info = received.infos.last();
+        QCOMPARE(info.id(), id);
+        QCOMPARE(info.from(), testDomain);
+        QCOMPARE(info.type(), QXmppIq::Result);
+        QVERIFY(info.features().contains("urn:example:feature"));
+        QCOMPARE(info.identities().size(), 1);
+        QCOMPARE(info.identities().first().category(), QLatin1String("server"));
+    }
+    QCOMPARE(extension->calls, 1);
+
+    discoveryManager->requestItems(testDomain);
+    for (int i = 0; i < 50 && received.items.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received.items.size(), 1);
+    const QXmppDiscoveryIq items = received.items.first();
+    QCOMPARE(items.items().size(), 1);
+    QCOMPARE(items.items().first().jid(), QLatin1String("service.localhost"));
+
+    // changing the extensions rebuilds the responses
+    TestDiscoveryExtension *other = new TestDiscoveryExtension;
+    other->calls = 0;
+    other->features << "urn:example:other";
+    server.addExtension(other);
+    discoveryManager->requestInfo(testDomain);
+    for (int i = 0; i < 50 && received.infos.size() < 3; ++i)
+        QTest::qWait(100);
+    QCOMPARE(received.infos.size(), 3);
+    const QXmppDiscoveryIq info = received.infos.last();
+    QVERIFY(info.features().contains("urn:example:feature"));
+    QVERIFY(info.features().contains("urn:example:other"));
+    QCOMPARE(extension->calls, 2);
+}
+
+void tst_QXmppServer::testDrain()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12378;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+    config.setAutoReconnectionEnabled(false);
+
+    QXmppClient client;
+    QSignalSpy connected(&client, SIGNAL(connected()));
+    QSignalSpy disconnected(&client, SIGNAL(disconnected()));
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+
+    // there is no other node, the client is told to come back later
+    QSignalSpy drained(&server, SIGNAL(clientsDrained()));
+    server.drainClients(-1, 10);
+    for (int i = 0; i < 50 && (disconnected.isEmpty() || drained.isEmpty()); ++i)
+        QTest::qWait(100);
+    QCOMPARE(disconnected.size(), 1);
+    QCOMPARE(drained.size(), 1);
+
+    // no new clients are accepted
+    QTcpSocket socket;
+    socket.connectToHost(testHost, testPort);
+    QVERIFY(!socket.waitForConnected(1000));
+}
+
+void tst_QXmppServer::testEfficientCiphers()
+{
+    if (!QSslSocket::supportsSsl()) {
+#if QT_VERSION < 0x050000
+        QSKIP("SSL is not supported", SkipSingle);
+#else
+        QSKIP("SSL is not supported");
+#endif
+    }
+
+    const QList<QSslCipher> ciphers = QXmppSslServer::efficientCiphers();
+    QVERIFY(!ciphers.isEmpty());
+
+    // single-pass ciphers come first
+    bool singlePass = true;
+    foreach (const QSslCipher &cipher, ciphers) {
+        const bool aead = cipher.name().contains("GCM") || cipher.name().contains("CHACHA20");
+        if (!aead)
+            singlePass = false;
+        else
+            QVERIFY(singlePass);
+    }
+
+    QXmppServer server;
+    server.setTlsCiphers(ciphers);
+    QCOMPARE(server.tlsCiphers().size(), ciphers.size());
+}
+
+void tst_QXmppServer::testExtensionFilters()
+{
+    QXmppServer server;
+    server.setDomain("localhost");
+
+    TestExtension *all = new TestExtension(QList<QXmppServerExtension::StanzaFilter>(), 0);
+    TestExtension *roster = new TestExtension(QList<QXmppServerExtension::StanzaFilter>()
+        << QXmppServerExtension::StanzaFilter("iq", "jabber:iq:roster", "query")
+        << QXmppServerExtension::StanzaFilter("iq", "jabber:iq:roster"), 1);
+    TestExtension *presence = new TestExtension(QList<QXmppServerExtension::StanzaFilter>()
+        << QXmppServerExtension::StanzaFilter("presence"), 2);
+    server.addExtension(all);
+    server.addExtension(roster);
+    server.addExtension(presence);
+
+    QDomDocument doc;
+    QVERIFY(doc.setContent(QByteArray("<stream xmlns='jabber:client'>"
+        "<iq type='get' from='a@localhost/r' to='a@localhost'><query xmlns='jabber:iq:roster'/></iq>"
+        "<iq type='get' from='a@localhost/r' to='a@localhost'><query xmlns='jabber:iq:version'/></iq>"
+        "<presence from='a@localhost/r'/>"
+        "<message from='a@localhost/r' to='b@localhost'/>"
+        "</stream>"), true));
+    for (QDomElement element = doc.documentElement().firstChildElement(); !element.isNull(); element = element.nextSiblingElement())
+        server.handleElement(element);
+
+    QCOMPARE(all->received, QStringList() << "iq" << "iq" << "presence" << "message");
+    QCOMPARE(roster->received, QStringList() << "iq");
+    QCOMPARE(presence->received, QStringList() << "presence");
+}
+
 void tst_QXmppServer::testConnect_data()
 {
     QTest::addColumn<QString>("username");
     QTest::addColumn<QString>("password");
     QTest::addColumn<QString>("mechanism");
     QTest::addColumn<bool>("connected");
+    QTest::addColumn<int>("workers");
+
+    QTest::newRow("plain-good") << "testuser" << "testpwd" << "PLAIN" << true << 0;
+    QTest::newRow("plain-bad-username") << "baduser" << "testpwd" << "PLAIN" << false << 0;
+    QTest::newRow("plain-bad-password") << "testuser" << "badpwd" << "PLAIN" << false << 0;
 
-    QTest::newRow("plain-good") << "testuser" << "testpwd" << "PLAIN" << true;
-    QTest::newRow("plain-bad-username") << "baduser" << "testpwd" << "PLAIN" << false;
-    QTest::newRow("plain-bad-password") << "testuser" << "badpwd" << "PLAIN" << false;
+    QTest::newRow("digest-good") << "testuser" << "testpwd" << "DIGEST-MD5" << true << 0;
+    QTest::newRow("digest-bad-username") << "baduser" << "testpwd" << "DIGEST-MD5" << false << 0;
+    QTest::newRow("digest-bad-password") << "testuser" << "badpwd" << "DIGEST-MD5" << false << 0;
 
-    QTest::newRow("digest-good") << "testuser" << "testpwd" << "DIGEST-MD5" << true;
-    QTest::newRow("digest-bad-username") << "baduser" << "testpwd" << "DIGEST-MD5" << false;
-    QTest::newRow("digest-bad-password") << "testuser" << "badpwd" << "DIGEST-MD5" << false;
+    QTest::newRow("plain-good-workers") << "testuser" << "testpwd" << "PLAIN" << true << 2;
+    QTest::newRow("digest-good-workers") << "testuser" << "testpwd" << "DIGEST-MD5" << true << 2;
 }
 
 void tst_QXmppServer::testConnect()
@@ -56,6 +745,7 @@ void tst_QXmppServer::testConnect()
     QFETCH(QString, password);
     QFETCH(QString, mechanism);
     QFETCH(bool, connected);
+    QFETCH(int, workers);
 
     const QString testDomain("localhost");
     const QHostAddress testHost(QHostAddress::LocalHost);
@@ -72,6 +762,7 @@ void tst_QXmppServer::testConnect()
     server.setDomain(testDomain);
     server.setLogger(&logger);
     server.setPasswordChecker(&passwordChecker);
+    server.setWorkerThreadCount(workers);
     server.listenForClients(testHost, testPort);
 
     // prepare client
@@ -96,5 +787,967 @@ void tst_QXmppServer::testConnect()
     QCOMPARE(client.isConnected(), connected);
 }
 
+void tst_QXmppServer::testConnectLocal()
+{
+    const QString testDomain("localhost");
+    const QString testName("qxmpp-test-server");
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QLocalServer::removeServer(testName);
+    QVERIFY(server.listenForLocalClients(testName));
+
+    // open a stream over a local socket
+    QLocalSocket socket;
+    QEventLoop loop;
+    connect(&socket, SIGNAL(readyRead()),
+            &loop, SLOT(quit()));
+    connect(&socket, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+
+    socket.connectToServer(testName);
+    QVERIFY(socket.waitForConnected());
+    socket.write("<?xml version='1.0'?><stream:stream to='localhost' version='1.0'"
+                 " xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>");
+
+    QByteArray received;
+    while (!received.contains("</stream:features>") && socket.state() == QLocalSocket::ConnectedState) {
+        loop.exec();
+        received += socket.readAll();
+    }
+
+    // authentication is offered, but not STARTTLS
+    QVERIFY(received.contains("<stream:stream"));
+    QVERIFY(received.contains("<mechanism>PLAIN</mechanism>"));
+    QVERIFY(!received.contains("starttls"));
+
+    // the traffic is accounted for
+    const QList<QVariantMap> streams = server.streamStatistics();
+    QCOMPARE(streams.size(), 1);
+    QCOMPARE(streams[0].value("type").toString(), QLatin1String("incoming-client"));
+    QVERIFY(!streams[0].contains("peer"));
+    QCOMPARE(streams[0].value("bytes-received").toLongLong(), qint64(135));
+    QCOMPARE(streams[0].value("bytes-sent").toLongLong(), qint64(received.size()));
+    QCOMPARE(streams[0].value("stanzas-received").toLongLong(), qint64(0));
+    QVERIFY(!streams[0].contains("tls-handshake-time"));
+    QCOMPARE(server.streamStatistics(1, "bytes-sent").size(), 1);
+}
+
+void tst_QXmppServer::testLoginToken()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12381;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setLoginTokenSecret("secret");
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+
+    // a password login is followed by a token
+    QXmppClient client;
+    QSignalSpy tokenChanged(&client, SIGNAL(loginTokenChanged(QString)));
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && tokenChanged.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+    QCOMPARE(tokenChanged.size(), 1);
+    const QString token = tokenChanged.takeFirst().at(0).toString();
+    QVERIFY(!token.isEmpty());
+    client.disconnectFromServer();
+
+    // the token is enough to log in, and is rotated
+    config.setPassword("badpwd");
+    config.setLoginToken(token);
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && tokenChanged.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+    QCOMPARE(tokenChanged.size(), 1);
+    const QString rotatedToken = tokenChanged.takeFirst().at(0).toString();
+    QVERIFY(!rotatedToken.isEmpty());
+    QVERIFY(rotatedToken != token);
+    client.disconnectFromServer();
+
+    // the rotated-out token is rejected, and so is the password
+    QTest::qWait(100);
+    QSignalSpy disconnected(&client, SIGNAL(disconnected()));
+    config.setLoginToken(token);
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && (tokenChanged.isEmpty() || disconnected.isEmpty()); ++i)
+        QTest::qWait(100);
+    QVERIFY(!client.isConnected());
+    QCOMPARE(tokenChanged.size(), 1);
+    QVERIFY(tokenChanged.takeFirst().at(0).toString().isEmpty());
+    disconnected.clear();
+
+    // a revoked token is rejected
+    server.revokeLoginTokens("testuser@localhost");
+    config.setLoginToken(rotatedToken);
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && (tokenChanged.isEmpty() || disconnected.isEmpty()); ++i)
+        QTest::qWait(100);
+    QVERIFY(!client.isConnected());
+    QCOMPARE(tokenChanged.size(), 1);
+    QVERIFY(tokenChanged.takeFirst().at(0).toString().isEmpty());
+
+    // a bad token falls back to the password
+    config.setPassword("testpwd");
+    config.setLoginToken(token + "x");
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && tokenChanged.size() < 2; ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+    QCOMPARE(tokenChanged.size(), 2);
+    QVERIFY(tokenChanged.at(0).at(0).toString().isEmpty());
+    QVERIFY(!tokenChanged.at(1).at(0).toString().isEmpty());
+    client.disconnectFromServer();
+}
+
+void tst_QXmppServer::testMessageCarbons()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12354;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+
+    QXmppClient client;
+    TestMessageCollector received;
+    connect(&client, SIGNAL(messageReceived(QXmppMessage)),
+            &received, SLOT(messageReceived(QXmppMessage)));
+    QSignalSpy connected(&client, SIGNAL(connected()));
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+
+    // carbons are delivered as the message they carry, unless they are forged
+    const QString carbon("<message from=\"%1\" to=\"user1@localhost/QXmpp\">"
+        "<%2 xmlns=\"urn:xmpp:carbons:2\"><forwarded xmlns=\"urn:xmpp:forward:0\">"
+        "<message xmlns=\"jabber:client\" from=\"%3\" to=\"%4\" type=\"chat\"><body>%5</body></message>"
+        "</forwarded></%2></message>");
+    QVERIFY(server.sendData("user1@localhost/QXmpp", carbon.arg("user2@localhost", "received",
+        "user2@localhost/phone", "user1@localhost/tablet", "Forged").toUtf8()));
+    QVERIFY(server.sendData("user1@localhost/QXmpp", carbon.arg("user1@localhost", "received",
+        "user2@localhost/phone", "user1@localhost/tablet", "Hello").toUtf8()));
+    QVERIFY(server.sendData("user1@localhost/QXmpp", carbon.arg("user1@localhost", "sent",
+        "user1@localhost/tablet", "user2@localhost/phone", "Bye").toUtf8()));
+    for (int i = 0; i < 50 && received.messages.size() < 2; ++i)
+        QTest::qWait(100);
+    QTest::qWait(100);
+
+    QCOMPARE(received.messages.size(), 2);
+    QCOMPARE(received.messages[0].body(), QLatin1String("Hello"));
+    QCOMPARE(received.messages[0].from(), QLatin1String("user2@localhost/phone"));
+    QCOMPARE(received.messages[0].carbonDirection(), QXmppMessage::ReceivedCarbon);
+    QCOMPARE(received.messages[1].body(), QLatin1String("Bye"));
+    QCOMPARE(received.messages[1].to(), QLatin1String("user2@localhost/phone"));
+    QCOMPARE(received.messages[1].carbonDirection(), QXmppMessage::SentCarbon);
+}
+
+void tst_QXmppServer::testMuc()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12349;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+    passwordChecker.addCredentials("user2", "testpwd");
+
+    QXmppServerMuc *muc = new QXmppServerMuc;
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(muc);
+    QVERIFY(server.listenForClients(testHost, testPort));
+    QCOMPARE(muc->jid(), QLatin1String("conference.localhost"));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+
+    QXmppClient client1;
+    TestMessageCollector received1;
+    connect(&client1, SIGNAL(messageReceived(QXmppMessage)),
+            &received1, SLOT(messageReceived(QXmppMessage)));
+    QSignalSpy connected1(&client1, SIGNAL(connected()));
+    config.setUser("user1");
+    client1.connectToServer(config);
+
+    QXmppClient client2;
+    TestMessageCollector received2;
+    connect(&client2, SIGNAL(messageReceived(QXmppMessage)),
+            &received2, SLOT(messageReceived(QXmppMessage)));
+    QSignalSpy connected2(&client2, SIGNAL(connected()));
+    config.setUser("user2");
+    client2.connectToServer(config);
+
+    for (int i = 0; i < 50 && (connected1.isEmpty() || connected2.isEmpty()); ++i)
+        QTest::qWait(100);
+    QVERIFY(client1.isConnected());
+    QVERIFY(client2.isConnected());
+
+    // user1 creates the room and talks
+    QXmppPresence join;
+    join.setTo("room@conference.localhost/alice");
+    join.setMucSupported(true);
+    QVERIFY(client1.sendPacket(join));
+    QXmppMessage message(QString(), "room@conference.localhost", "First");
+    message.setType(QXmppMessage::GroupChat);
+    QVERIFY(client1.sendPacket(message));
+    for (int i = 0; i < 50 && received1.messages.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received1.messages.size(), 1);
+    QCOMPARE(received1.messages[0].from(), QLatin1String("room@conference.localhost/alice"));
+
+    // user2 joins and receives the history
+    join.setTo("room@conference.localhost/bob");
+    QVERIFY(client2.sendPacket(join));
+    for (int i = 0; i < 50 && received2.messages.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received2.messages.size(), 1);
+    QCOMPARE(received2.messages[0].body(), QLatin1String("First"));
+    QVERIFY(received2.messages[0].stamp().isValid());
+
+    // both occupants receive new messages
+    message.setBody("Second");
+    QVERIFY(client2.sendPacket(message));
+    for (int i = 0; i < 50 && (received1.messages.size() < 2 || received2.messages.size() < 2); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received1.messages.size(), 2);
+    QCOMPARE(received1.messages[1].body(), QLatin1String("Second"));
+    QCOMPARE(received1.messages[1].from(), QLatin1String("room@conference.localhost/bob"));
+    QCOMPARE(received2.messages.size(), 2);
+    QCOMPARE(received2.messages[1].to(), QLatin1String("user2@localhost/QXmpp"));
+}
+
+void tst_QXmppServer::testOfflineMessages()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12348;
+
+    QDir dir(QDir::temp().filePath("qxmpp-offline-test"));
+    foreach (const QString &name, dir.entryList(QDir::Files))
+        dir.remove(name);
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+    passwordChecker.addCredentials("user2", "testpwd");
+
+    QXmppServerOffline *offline = new QXmppServerOffline;
+    offline->setPath(dir.path());
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(offline);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+
+    // user1 writes to user2, who is offline
+    QXmppClient client1;
+    QSignalSpy connected1(&client1, SIGNAL(connected()));
+    config.setUser("user1");
+    client1.connectToServer(config);
+    for (int i = 0; i < 50 && connected1.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client1.isConnected());
+
+    QVERIFY(client1.sendPacket(QXmppMessage(QString(), "user2@localhost", "First")));
+    QVERIFY(client1.sendPacket(QXmppMessage(QString(), "user2@localhost", "Second")));
+    QXmppMessage headline(QString(), "user2@localhost", "Headline");
+    headline.setType(QXmppMessage::Headline);
+    QVERIFY(client1.sendPacket(headline));
+    QTest::qWait(500);
+    QVERIFY(!dir.entryList(QDir::Files).isEmpty());
+
+    // the messages are delivered once user2 is available
+    QXmppClient client2;
+    TestMessageCollector received2;
+    connect(&client2, SIGNAL(messageReceived(QXmppMessage)),
+            &received2, SLOT(messageReceived(QXmppMessage)));
+    config.setUser("user2");
+    client2.connectToServer(config);
+    for (int i = 0; i < 50 && received2.messages.size() < 2; ++i)
+        QTest::qWait(100);
+    QCOMPARE(received2.messages.size(), 2);
+    QCOMPARE(received2.messages[0].body(), QLatin1String("First"));
+    QCOMPARE(received2.messages[1].body(), QLatin1String("Second"));
+    QVERIFY(received2.messages[0].stamp().isValid());
+
+    // they are only delivered once
+    client2.disconnectFromServer();
+    QTest::qWait(500);
+    received2.messages.clear();
+    client2.connectToServer(config);
+    QTest::qWait(1000);
+    QVERIFY(client2.isConnected());
+    QCOMPARE(received2.messages.size(), 0);
+}
+
+void tst_QXmppServer::testPersonalEventing()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12350;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+    passwordChecker.addCredentials("user2", "testpwd");
+
+    TestSubscribersExtension *roster = new TestSubscribersExtension;
+    roster->subscribers.insert("user1@localhost", QSet<QString>() << "user2@localhost");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(roster);
+    server.addExtension(new QXmppServerPubSub);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // user2 advertises its capabilities, whose features are queried
+    QTcpSocket socket2;
+    QVERIFY(openStream(&socket2, testHost, testPort, "user2"));
+    socket2.write("<iq type='set' id='bind2'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+                  "<resource>desk</resource></bind></iq>");
+    QVERIFY(waitForData(&socket2, "</iq>").contains("user2@localhost/desk"));
+    socket2.write("<presence><c xmlns='http://jabber.org/protocol/caps' hash='sha-1' node='test' ver='v1'/></presence>");
+    QByteArray received = waitForData(&socket2, "</iq>");
+    QVERIFY(received.contains("node=\"test#v1\""));
+    QRegExp idRegExp("<iq [^>]*id=\"([^\"]+)\"");
+    QVERIFY(idRegExp.indexIn(QString::fromUtf8(received)) >= 0);
+    socket2.write("<iq type='result' id='" + idRegExp.cap(1).toUtf8() + "' to='localhost'>"
+                  "<query xmlns='http://jabber.org/protocol/disco#info' node='test#v1'>"
+                  "<feature var='urn:test:tune+notify'/></query></iq>");
+    QTest::qWait(200);
+
+    // user1 publishes, user2 is notified
+    QTcpSocket socket1;
+    QVERIFY(openStream(&socket1, testHost, testPort, "user1"));
+    socket1.write("<iq type='set' id='bind1'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+                  "<resource>phone</resource></bind></iq>");
+    QVERIFY(waitForData(&socket1, "</iq>").contains("user1@localhost/phone"));
+    socket1.write("<iq type='set' id='pub1'><pubsub xmlns='http://jabber.org/protocol/pubsub'>"
+                  "<publish node='urn:test:tune'><item id='a'><tune xmlns='urn:test:tune'>song</tune></item>"
+                  "</publish></pubsub></iq>");
+    QVERIFY(waitForData(&socket1, "</iq>").contains("pub1"));
+    received = waitForData(&socket2, "</message>");
+    QVERIFY(received.contains("from=\"user1@localhost\""));
+    QVERIFY(received.contains("<items node=\"urn:test:tune\">"));
+    QVERIFY(received.contains("song"));
+
+    // nodes the resource is not interested in are not notified
+    socket1.write("<iq type='set' id='pub2'><pubsub xmlns='http://jabber.org/protocol/pubsub'>"
+                  "<publish node='urn:test:mood'><item><mood xmlns='urn:test:mood'>happy</mood></item>"
+                  "</publish></pubsub></iq>");
+    QVERIFY(waitForData(&socket1, "</iq>").contains("pub2"));
+    QVERIFY(!waitForData(&socket2, "</message>").contains("happy"));
+
+    // subscribers can retrieve the last item
+    socket2.write("<iq type='get' id='items1' to='user1@localhost'><pubsub xmlns='http://jabber.org/protocol/pubsub'>"
+                  "<items node='urn:test:tune'/></pubsub></iq>");
+    received = waitForData(&socket2, "</iq>");
+    QVERIFY(received.contains("items1"));
+    QVERIFY(received.contains("song"));
+}
+
+void tst_QXmppServer::testReconnectionHint()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12356;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+    config.setReconnectionInitialDelay(500);
+
+    QXmppClient client;
+    QSignalSpy connected(&client, SIGNAL(connected()));
+    QSignalSpy disconnected(&client, SIGNAL(disconnected()));
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+
+    // the server asks the client to come back in one second
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(server.sendData("user1@localhost/QXmpp",
+        "<stream:error><system-shutdown xmlns=\"urn:ietf:params:xml:ns:xmpp-streams\"/>"
+        "<reconnect xmlns=\"urn:qxmpp:reconnect:0\" delay=\"1\"/></stream:error>"));
+    for (int i = 0; i < 50 && disconnected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(disconnected.size(), 1);
+
+    for (int i = 0; i < 50 && connected.size() < 2; ++i)
+        QTest::qWait(100);
+    QCOMPARE(connected.size(), 2);
+    QVERIFY(timer.elapsed() >= 1000);
+}
+
+void tst_QXmppServer::testRedirect()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12379;
+    const quint16 otherPort = 12380;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppServer other;
+    other.setDomain(testDomain);
+    other.setPasswordChecker(&passwordChecker);
+    QVERIFY(other.listenForClients(testHost, otherPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+
+    QXmppClient client;
+    QSignalSpy connected(&client, SIGNAL(connected()));
+    QSignalSpy disconnected(&client, SIGNAL(disconnected()));
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+
+    // the client goes straight to the other server
+    QSignalSpy otherConnected(&other, SIGNAL(clientConnected(QString)));
+    QVERIFY(server.sendData("user1@localhost/QXmpp",
+        QString("<stream:error><see-other-host xmlns=\"urn:ietf:params:xml:ns:xmpp-streams\">%1:%2</see-other-host></stream:error>").arg(
+            testHost.toString(), QString::number(otherPort)).toUtf8()));
+    for (int i = 0; i < 50 && otherConnected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(otherConnected.size(), 1);
+    QCOMPARE(disconnected.size(), 0);
+}
+
+void tst_QXmppServer::testReplaceExtension()
+{
+    QXmppServer server;
+    server.setDomain("localhost");
+
+    TestExtension *presence = new TestExtension(QList<QXmppServerExtension::StanzaFilter>()
+        << QXmppServerExtension::StanzaFilter("presence"), 0);
+    TestExtension *message = new TestExtension(QList<QXmppServerExtension::StanzaFilter>()
+        << QXmppServerExtension::StanzaFilter("message"), 0);
+    server.addExtension(presence);
+    server.addExtension(message);
+
+    QDomDocument doc;
+    QVERIFY(doc.setContent(QByteArray("<stream xmlns='jabber:client'>"
+        "<presence from='a@localhost/r'/>"
+        "<message from='a@localhost/r' to='b@localhost'/>"
+        "</stream>"), true));
+    const QDomElement presenceElement = doc.documentElement().firstChildElement("presence");
+    const QDomElement messageElement = doc.documentElement().firstChildElement("message");
+    server.handleElement(presenceElement);
+    server.handleElement(messageElement);
+
+    // the replacement takes over the state and the stanzas
+    TestExtension *replacement = new TestExtension(QList<QXmppServerExtension::StanzaFilter>()
+        << QXmppServerExtension::StanzaFilter("presence"), 0);
+    QVERIFY(server.replaceExtension(presence, replacement));
+    QVERIFY(!server.extensions().contains(presence));
+    QVERIFY(server.extensions().contains(replacement));
+    QCOMPARE(replacement->received, QStringList() << "presence");
+
+    server.handleElement(presenceElement);
+    server.handleElement(messageElement);
+    QCOMPARE(replacement->received, QStringList() << "presence" << "presence");
+    QCOMPARE(message->received, QStringList() << "message" << "message");
+
+    // a removed extension no longer receives stanzas
+    QVERIFY(server.removeExtension(message));
+    QVERIFY(!server.removeExtension(message));
+    server.handleElement(messageElement);
+    QCOMPARE(message->received, QStringList() << "message" << "message");
+    delete message;
+}
+
+void tst_QXmppServer::testRoster()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12351;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+    passwordChecker.addCredentials("user2", "testpwd");
+
+    QXmppServerRoster *roster = new QXmppServerRoster;
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(roster);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+
+    QXmppClient client1;
+    QSignalSpy connected1(&client1, SIGNAL(connected()));
+    config.setUser("user1");
+    client1.connectToServer(config);
+
+    QXmppClient client2;
+    QSignalSpy connected2(&client2, SIGNAL(connected()));
+    QSignalSpy subscriptions2(&client2.rosterManager(), SIGNAL(subscriptionReceived(QString,QString)));
+    config.setUser("user2");
+    client2.connectToServer(config);
+
+    for (int i = 0; i < 50 && (connected1.isEmpty() || connected2.isEmpty()); ++i)
+        QTest::qWait(100);
+    QVERIFY(client1.isConnected());
+    QVERIFY(client2.isConnected());
+
+    // user1 subscribes to user2, who approves
+    QVERIFY(client1.rosterManager().subscribe("user2@localhost"));
+    for (int i = 0; i < 50 && subscriptions2.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(subscriptions2.size(), 1);
+    QCOMPARE(subscriptions2[0][0].toString(), QLatin1String("user1@localhost"));
+    QVERIFY(client2.rosterManager().acceptSubscription("user1@localhost"));
+
+    for (int i = 0; i < 50 && client1.rosterManager().getResources("user2@localhost").isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(client1.rosterManager().getResources("user2@localhost"), QStringList() << "QXmpp");
+    QCOMPARE(int(client1.rosterManager().getRosterEntry("user2@localhost").subscriptionType()),
+             int(QXmppRosterIq::Item::To));
+    QCOMPARE(roster->presenceSubscribers("user2@localhost"),
+             QSet<QString>() << "user1@localhost");
+
+    // user2 repeats its presence, which the server does not broadcast
+    QSignalSpy presences1(&client1.rosterManager(), SIGNAL(presenceChanged(QString,QString)));
+    QXmppPresence presence = client2.clientPresence();
+    client2.setClientPresence(presence);
+    presence.setStatusText("Away");
+    client2.setClientPresence(presence);
+    for (int i = 0; i < 50 && presences1.isEmpty(); ++i)
+        QTest::qWait(100);
+    QTest::qWait(100);
+    QCOMPARE(presences1.size(), 1);
+    QCOMPARE(client1.rosterManager().getPresence("user2@localhost", "QXmpp").statusText(), QLatin1String("Away"));
+
+    // with the server broadcasting everything, the roster suppresses the repeat
+    roster->setDuplicatePresenceSuppressionEnabled(false);
+    client1.rosterManager().setDuplicatePresenceSuppressionEnabled(true);
+    presences1.clear();
+    client2.setClientPresence(presence);
+    presence.setStatusText("Back");
+    client2.setClientPresence(presence);
+    for (int i = 0; i < 50 && presences1.isEmpty(); ++i)
+        QTest::qWait(100);
+    QTest::qWait(100);
+    QCOMPARE(presences1.size(), 1);
+    QCOMPARE(client1.rosterManager().getPresence("user2@localhost", "QXmpp").statusText(), QLatin1String("Back"));
+
+    // user2 leaves
+    client2.disconnectFromServer();
+    for (int i = 0; i < 50 && !client1.rosterManager().getResources("user2@localhost").isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client1.rosterManager().getResources("user2@localhost").isEmpty());
+}
+
+void tst_QXmppServer::testSendQueue()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12355;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+    passwordChecker.addCredentials("user2", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+
+    QXmppClient client2;
+    TestMessageCollector received;
+    connect(&client2, SIGNAL(messageReceived(QXmppMessage)),
+            &received, SLOT(messageReceived(QXmppMessage)));
+    QSignalSpy connected2(&client2, SIGNAL(connected()));
+    config.setUser("user2");
+    client2.connectToServer(config);
+    for (int i = 0; i < 50 && connected2.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client2.isConnected());
+
+    // without a send queue, stanzas are dropped while disconnected
+    QXmppClient client1;
+    QCOMPARE(client1.sendQueueSize(), 0);
+    QCOMPARE(client1.sendQueueExpiry(QXmppStanza::Message), 0);
+    QVERIFY(!client1.sendPacket(QXmppMessage(QString(), "user2@localhost/QXmpp", "Lost")));
+
+    // with a send queue, they are held back until the client connects
+    client1.setSendQueueSize(3);
+    client1.setSendQueueExpiry(QXmppStanza::Presence, 1);
+    QVERIFY(client1.sendPacket(QXmppMessage(QString(), "user2@localhost/QXmpp", "First")));
+    QXmppPresence presence;
+    presence.setTo("user2@localhost/QXmpp");
+    QVERIFY(client1.sendPacket(presence));
+    QVERIFY(client1.sendPacket(QXmppMessage(QString(), "user2@localhost/QXmpp", "Second")));
+    QVERIFY(!client1.sendPacket(QXmppMessage(QString(), "user2@localhost/QXmpp", "Third")));
+    QTest::qWait(50);
+
+    // the presence expires, which makes room for another message
+    QVERIFY(client1.sendPacket(QXmppMessage(QString(), "user2@localhost/QXmpp", "Third")));
+
+    QSignalSpy connected1(&client1, SIGNAL(connected()));
+    config.setUser("user1");
+    client1.connectToServer(config);
+    for (int i = 0; i < 50 && received.messages.size() < 3; ++i)
+        QTest::qWait(100);
+    QVERIFY(!connected1.isEmpty());
+
+    QCOMPARE(received.messages.size(), 3);
+    QCOMPARE(received.messages[0].body(), QLatin1String("First"));
+    QCOMPARE(received.messages[1].body(), QLatin1String("Second"));
+    QCOMPARE(received.messages[2].body(), QLatin1String("Third"));
+}
+
+void tst_QXmppServer::testStreamCompression()
+{
+    if (!QXmppStream::isCompressionSupported()) {
+#if QT_VERSION < 0x050000
+        QSKIP("Compression is not supported", SkipSingle);
+#else
+        QSKIP("Compression is not supported");
+#endif
+    }
+
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12386;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setStreamCompressionEnabled(true);
+    QVERIFY(server.listenForClients(testHost, testPort));
+    QSignalSpy serverCounters(&server, SIGNAL(updateCounter(QString,qint64)));
+
+    QXmppClient client;
+    QSignalSpy connected(&client, SIGNAL(connected()));
+    QSignalSpy clientCounters(&client, SIGNAL(updateCounter(QString,qint64)));
+    TestMessageCollector received;
+    connect(&client, SIGNAL(messageReceived(QXmppMessage)),
+            &received, SLOT(messageReceived(QXmppMessage)));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setStreamCompressionEnabled(true);
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+
+    // stanzas travel over the compressed stream in both directions
+    const QString jid = client.configuration().jid();
+    for (int i = 0; i < 10; ++i)
+        client.sendPacket(QXmppMessage(QString(), jid, QString("Hello %1").arg(i)));
+    for (int i = 0; i < 50 && received.messages.size() < 10; ++i)
+        QTest::qWait(100);
+    QCOMPARE(received.messages.size(), 10);
+    QCOMPARE(received.messages.last().body(), QLatin1String("Hello 9"));
+
+    // the repeated messages compress well
+    qint64 compressed = 0;
+    qint64 uncompressed = 0;
+    for (int i = 0; i < serverCounters.size(); ++i) {
+        const QString counter = serverCounters.at(i).at(0).toString();
+        if (counter == QLatin1String("stream.compression.compressed-bytes"))
+            compressed += serverCounters.at(i).at(1).toLongLong();
+        else if (counter == QLatin1String("stream.compression.uncompressed-bytes"))
+            uncompressed += serverCounters.at(i).at(1).toLongLong();
+    }
+    QVERIFY(compressed > 0);
+    QVERIFY(compressed < uncompressed);
+
+    bool clientCompressed = false;
+    for (int i = 0; i < clientCounters.size(); ++i)
+        if (clientCounters.at(i).at(0).toString() == QLatin1String("stream.compression.compressed-bytes"))
+            clientCompressed = true;
+    QVERIFY(clientCompressed);
+}
+
+void tst_QXmppServer::testStreamResumption()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12347;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setStreamResumptionTimeout(60);
+    QVERIFY(server.listenForClients(testHost, testPort));
+    QSignalSpy disconnectedSpy(&server, SIGNAL(clientDisconnected(QString)));
+
+    // bind a resource and enable resumption
+    QTcpSocket socket1;
+    QVERIFY(openStream(&socket1, testHost, testPort));
+    socket1.write("<iq type='set' id='bind1'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+                  "<resource>phone</resource></bind></iq>");
+    QVERIFY(waitForData(&socket1, "</iq>").contains("user1@localhost/phone"));
+    socket1.write("<enable xmlns='urn:xmpp:sm:3' resume='true'/>");
+    QByteArray received = waitForData(&socket1, "<enabled");
+    QRegExp idRegExp("<enabled [^>]*id='([^']+)'");
+    QVERIFY(idRegExp.indexIn(QString::fromUtf8(received)) >= 0);
+    const QString resumeId = idRegExp.cap(1);
+
+    // lose the stream, stanzas for the session are kept
+    socket1.abort();
+    QTest::qWait(200);
+    QVERIFY(server.sendPacket(QXmppMessage(testDomain, "user1@localhost/phone", "missed")));
+
+    // resume the session on a new stream
+    QTcpSocket socket2;
+    QVERIFY(openStream(&socket2, testHost, testPort));
+    socket2.write("<resume xmlns='urn:xmpp:sm:3' previd='" + resumeId.toUtf8() + "' h='0'/>");
+    received = waitForData(&socket2, "</message>");
+    QVERIFY(received.contains("<resumed xmlns='urn:xmpp:sm:3' previd='" + resumeId.toUtf8() + "' h='0'/>"));
+    QVERIFY(received.contains("<body>missed</body>"));
+    QCOMPARE(disconnectedSpy.size(), 0);
+
+    // unknown sessions cannot be resumed
+    QTcpSocket socket3;
+    QVERIFY(openStream(&socket3, testHost, testPort));
+    socket3.write("<resume xmlns='urn:xmpp:sm:3' previd='bogus' h='0'/>");
+    QVERIFY(waitForData(&socket3, "</failed>").contains("item-not-found"));
+}
+
+void tst_QXmppServer::testVirtualHosting()
+{
+    const QString testDomain("localhost");
+    const QString virtualDomain("example.test");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12376;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+    TestPasswordChecker virtualChecker;
+    virtualChecker.addCredentials("user2", "virtualpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addDomain(virtualDomain);
+    server.setDomainPasswordChecker(virtualDomain, &virtualChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+    QCOMPARE(server.domains().size(), 2);
+    QVERIFY(server.domains().contains(virtualDomain));
+
+    QXmppConfiguration config;
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+
+    // each domain checks the credentials of its own clients
+    QXmppClient client1;
+    TestMessageCollector received1;
+    connect(&client1, SIGNAL(messageReceived(QXmppMessage)),
+            &received1, SLOT(messageReceived(QXmppMessage)));
+    QSignalSpy connected1(&client1, SIGNAL(connected()));
+    config.setDomain(testDomain);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+    client1.connectToServer(config);
+
+    QXmppClient client2;
+    TestMessageCollector received2;
+    connect(&client2, SIGNAL(messageReceived(QXmppMessage)),
+            &received2, SLOT(messageReceived(QXmppMessage)));
+    QSignalSpy connected2(&client2, SIGNAL(connected()));
+    config.setDomain(virtualDomain);
+    config.setUser("user2");
+    config.setPassword("virtualpwd");
+    client2.connectToServer(config);
+
+    QXmppClient client3;
+    QSignalSpy disconnected3(&client3, SIGNAL(disconnected()));
+    config.setUser("user1");
+    config.setPassword("testpwd");
+    client3.connectToServer(config);
+
+    for (int i = 0; i < 50 && (connected1.isEmpty() || connected2.isEmpty() || disconnected3.isEmpty()); ++i)
+        QTest::qWait(100);
+    QVERIFY(client1.isConnected());
+    QVERIFY(client2.isConnected());
+    QVERIFY(!client3.isConnected());
+
+    // stanzas between the hosted domains are routed locally
+    QVERIFY(client1.sendPacket(QXmppMessage(QString(), "user2@example.test", "Hello")));
+    for (int i = 0; i < 50 && received2.messages.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received2.messages.size(), 1);
+    QCOMPARE(received2.messages[0].from(), QLatin1String("user1@localhost/QXmpp"));
+
+    QVERIFY(client2.sendPacket(QXmppMessage(QString(), "user1@localhost/QXmpp", "Hi")));
+    for (int i = 0; i < 50 && received1.messages.isEmpty(); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received1.messages.size(), 1);
+    QCOMPARE(received1.messages[0].from(), QLatin1String("user2@example.test/QXmpp"));
+
+    // removing the domain disconnects its clients
+    QSignalSpy disconnected2(&client2, SIGNAL(disconnected()));
+    server.removeDomain(virtualDomain);
+    for (int i = 0; i < 50 && disconnected2.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(!client2.isConnected());
+    QVERIFY(client1.isConnected());
+}
+
+void tst_QXmppServer::testWorkerRebalance()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12385;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("user1", "testpwd");
+    passwordChecker.addCredentials("user2", "testpwd");
+    passwordChecker.addCredentials("user3", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setWorkerThreadCount(2);
+    server.setWorkerRebalanceInterval(100);
+    QVERIFY(server.listenForClients(testHost, testPort));
+    QSignalSpy counters(&server, SIGNAL(updateCounter(QString,qint64)));
+
+    // the first and the third clients share a worker, the second one
+    // idles on the other worker
+    QXmppClient clients[3];
+    TestMessageCollector received[3];
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+    for (int i = 0; i < 3; ++i) {
+        connect(&clients[i], SIGNAL(messageReceived(QXmppMessage)),
+                &received[i], SLOT(messageReceived(QXmppMessage)));
+        QSignalSpy connected(&clients[i], SIGNAL(connected()));
+        config.setUser(QString("user%1").arg(i + 1));
+        clients[i].connectToServer(config);
+        for (int j = 0; j < 50 && connected.isEmpty(); ++j)
+            QTest::qWait(100);
+        QVERIFY(clients[i].isConnected());
+    }
+
+    // the busy clients send numbered messages to themselves until one of
+    // their streams moves to the idle worker
+    const QString jid1 = clients[0].configuration().jid();
+    const QString jid3 = clients[2].configuration().jid();
+    int sent = 0;
+    bool migrated = false;
+    for (int i = 0; i < 200 && !migrated; ++i) {
+        for (int j = 0; j < 100; ++j, ++sent) {
+            clients[0].sendPacket(QXmppMessage(QString(), jid1, QString::number(sent)));
+            clients[2].sendPacket(QXmppMessage(QString(), jid3, QString::number(sent)));
+        }
+        QTest::qWait(50);
+        for (int j = 0; j < counters.size(); ++j)
+            if (counters.at(j).at(0).toString() == QLatin1String("worker.migrations"))
+                migrated = true;
+    }
+    QVERIFY(migrated);
+
+    // the data posted around the move is delivered in order
+    for (int i = 0; i < 100 && (received[0].messages.size() < sent || received[2].messages.size() < sent); ++i)
+        QTest::qWait(100);
+    QCOMPARE(received[0].messages.size(), sent);
+    QCOMPARE(received[2].messages.size(), sent);
+    for (int i = 0; i < sent; ++i) {
+        QCOMPARE(received[0].messages.at(i).body(), QString::number(i));
+        QCOMPARE(received[2].messages.at(i).body(), QString::number(i));
+    }
+    QVERIFY(received[1].messages.isEmpty());
+    QVERIFY(clients[0].isConnected());
+    QVERIFY(clients[2].isConnected());
+}
+
 QTEST_MAIN(tst_QXmppServer)
 #include "tst_qxmppserver.moc"
@@ -0,0 +1,4 @@
+include(../tests.pri)
+TARGET = tst_qxmppserverlink
+SOURCES += tst_qxmppserverlink.cpp
+HEADERS += ../tcprelay.h
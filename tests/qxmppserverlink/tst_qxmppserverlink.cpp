@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppServer.h"
+#include "QXmppSrvLookup_p.h"
+#include "tcprelay.h"
+#include "util.h"
+
+class TestMessageCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    QStringList bodies;
+
+public slots:
+    void messageReceived(const QXmppMessage &message)
+    {
+        bodies << message.body();
+    }
+};
+
+// Two servers for alpha.test and beta.test, which find each other through
+// SRV records pinned in the cache. The streams to beta.test go through a
+// relay. Ports from basePort to basePort + 4 are used.
+class TestFederation
+{
+public:
+    TestFederation(quint16 basePort)
+        : m_basePort(basePort)
+    {
+        alphaPasswords.addCredentials("alice", "testpwd");
+        alpha.setDomain("alpha.test");
+        alpha.setPasswordChecker(&alphaPasswords);
+
+        betaPasswords.addCredentials("bob", "testpwd");
+        beta.setDomain("beta.test");
+        beta.setPasswordChecker(&betaPasswords);
+
+        QObject::connect(&bob, SIGNAL(messageReceived(QXmppMessage)),
+                         &bobMessages, SLOT(messageReceived(QXmppMessage)));
+    }
+
+    // Starts the servers and connects alice@alpha.test and bob@beta.test.
+    bool start()
+    {
+        const QHostAddress host(QHostAddress::LocalHost);
+        if (!alpha.listenForClients(host, m_basePort) ||
+            !alpha.listenForServers(host, m_basePort + 1) ||
+            !beta.listenForClients(host, m_basePort + 2) ||
+            !beta.listenForServers(host, m_basePort + 3) ||
+            !relay.listen(host, m_basePort + 4))
+            return false;
+        relay.setTargetPort(m_basePort + 3);
+
+        QXmppSrvRecord record;
+        record.setTarget(host.toString());
+        record.setTimeToLive(60);
+        record.setPort(m_basePort + 1);
+        QXmppSrvLookup::insertCache("_xmpp-server._tcp.alpha.test", QList<QXmppSrvRecord>() << record);
+        record.setPort(m_basePort + 4);
+        QXmppSrvLookup::insertCache("_xmpp-server._tcp.beta.test", QList<QXmppSrvRecord>() << record);
+
+        return connectClient(&alice, "alice", "alpha.test", m_basePort) &&
+               connectClient(&bob, "bob", "beta.test", m_basePort + 2);
+    }
+
+    // Returns the number of streams of the given type on the server.
+    static int streamCount(const QXmppServer &server, const QString &type)
+    {
+        int count = 0;
+        foreach (const QVariantMap &stats, server.streamStatistics())
+            if (stats.value("type").toString() == type)
+                count++;
+        return count;
+    }
+
+    // Sends numbered messages from alice to bob.
+    void sendMessages(int first, int count)
+    {
+        const QString to = bob.configuration().jid();
+        for (int i = first; i < first + count; ++i)
+            alice.sendPacket(QXmppMessage(QString(), to, QString::number(i)));
+    }
+
+    // Waits until bob received \a count messages.
+    bool waitForMessages(int count)
+    {
+        for (int i = 0; i < 100 && bobMessages.bodies.size() < count; ++i)
+            QTest::qWait(100);
+        return bobMessages.bodies.size() >= count;
+    }
+
+    TestPasswordChecker alphaPasswords;
+    TestPasswordChecker betaPasswords;
+    QXmppServer alpha;
+    QXmppServer beta;
+    TestTcpRelay relay;
+    QXmppClient alice;
+    QXmppClient bob;
+    TestMessageCollector bobMessages;
+
+private:
+    static bool connectClient(QXmppClient *client, const QString &user, const QString &domain, quint16 port)
+    {
+        QSignalSpy connected(client, SIGNAL(connected()));
+
+        QXmppConfiguration config;
+        config.setDomain(domain);
+        config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+        config.setPort(port);
+        config.setUser(user);
+        config.setPassword("testpwd");
+        client->connectToServer(config);
+        for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+            QTest::qWait(100);
+        return client->isConnected();
+    }
+
+    quint16 m_basePort;
+};
+
+static bool numberLessThan(const QString &s1, const QString &s2)
+{
+    return s1.toInt() < s2.toInt();
+}
+
+class tst_QXmppServerLink : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+    void testPooledLinks();
+    void testStreamResumption();
+};
+
+void tst_QXmppServerLink::cleanup()
+{
+    QXmppSrvLookup::clearCache();
+}
+
+void tst_QXmppServerLink::testPooledLinks()
+{
+    TestFederation federation(12394);
+    federation.alpha.setOutgoingServerLinks(2, 1);
+    QCOMPARE(federation.alpha.maximumOutgoingServerLinks(), 2);
+    QCOMPARE(federation.alpha.outgoingServerLinkBacklog(), qint64(1));
+    QVERIFY(federation.start());
+
+    // while the first link connects, its backlog opens a second one
+    federation.sendMessages(0, 20);
+    QVERIFY(federation.waitForMessages(20));
+    QCOMPARE(federation.relay.connections, 2);
+    QCOMPARE(TestFederation::streamCount(federation.alpha, "outgoing-server"), 2);
+    QCOMPARE(TestFederation::streamCount(federation.beta, "incoming-server"), 2);
+
+    // both links were verified over a single stream back to alpha.test
+    QCOMPARE(TestFederation::streamCount(federation.beta, "outgoing-server"), 1);
+    QCOMPARE(TestFederation::streamCount(federation.alpha, "incoming-server"), 1);
+
+    // the links may reorder the messages, but none is lost
+    QStringList bodies = federation.bobMessages.bodies;
+    qSort(bodies.begin(), bodies.end(), numberLessThan);
+    QStringList expected;
+    for (int i = 0; i < 20; ++i)
+        expected << QString::number(i);
+    QCOMPARE(bodies, expected);
+}
+
+void tst_QXmppServerLink::testStreamResumption()
+{
+    TestFederation federation(12389);
+    federation.alpha.setServerStreamResumptionTimeout(30);
+    federation.beta.setServerStreamResumptionTimeout(30);
+    QCOMPARE(federation.alpha.serverStreamResumptionTimeout(), 30);
+    QSignalSpy counters(&federation.alpha, SIGNAL(updateCounter(QString,qint64)));
+    QVERIFY(federation.start());
+
+    // the first message opens the link, which enables stream management
+    federation.sendMessages(0, 1);
+    QVERIFY(federation.waitForMessages(1));
+    QCOMPARE(federation.relay.connections, 1);
+
+    // the link is cut, the messages sent meanwhile wait for it to resume
+    federation.relay.dropConnections();
+    federation.sendMessages(1, 9);
+    QVERIFY(federation.waitForMessages(10));
+    QCOMPARE(federation.relay.connections, 2);
+
+    bool resumed = false;
+    for (int i = 0; i < counters.size(); ++i)
+        if (counters.at(i).at(0).toString() == QLatin1String("outgoing-server.resumed"))
+            resumed = true;
+    QVERIFY(resumed);
+
+    // nothing was lost, duplicated or reordered
+    QTest::qWait(500);
+    QStringList expected;
+    for (int i = 0; i < 10; ++i)
+        expected << QString::number(i);
+    QCOMPARE(federation.bobMessages.bodies, expected);
+    QCOMPARE(TestFederation::streamCount(federation.alpha, "outgoing-server"), 1);
+}
+
+QTEST_MAIN(tst_QXmppServerLink)
+#include "tst_qxmppserverlink.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppsrtp
+SOURCES += tst_qxmppsrtp.cpp
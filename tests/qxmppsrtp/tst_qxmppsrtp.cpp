@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppSrtp_p.h"
+
+static const QByteArray masterKey = QByteArray::fromHex("e1f97a0d3e018be0d64fa32c06de4139");
+static const QByteArray masterSalt = QByteArray::fromHex("0ec675ad498afeebb6960b3aabe6");
+
+// Returns an RTP packet with the given sequence number.
+static QByteArray rtpPacket(quint16 sequence)
+{
+    QByteArray packet = QByteArray::fromHex("800f1234decafbadcafebabeabababababababababababababababab");
+    packet[2] = char(sequence >> 8);
+    packet[3] = char(sequence & 0xff);
+    return packet;
+}
+
+class tst_QXmppSrtp : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testAesBlock();
+    void testAesCounter();
+    void testKeyDerivation();
+    void testRtp();
+    void testRtpRollover();
+    void testRtpTampered();
+    void testRtcp();
+    void testCryptoSuite();
+};
+
+void tst_QXmppSrtp::testAesBlock()
+{
+    // FIPS-197 Appendix C.1
+    QXmppAesCipher cipher;
+    cipher.setKey(QByteArray::fromHex("000102030405060708090a0b0c0d0e0f"));
+
+    const QByteArray input = QByteArray::fromHex("00112233445566778899aabbccddeeff");
+    QByteArray output(16, '\0');
+    cipher.encryptBlock(reinterpret_cast<const uchar*>(input.constData()), reinterpret_cast<uchar*>(output.data()));
+    QCOMPARE(output, QByteArray::fromHex("69c4e0d86a7b0430d8cdb78070b4c55a"));
+}
+
+void tst_QXmppSrtp::testAesCounter()
+{
+    // RFC 3711 Appendix B.2
+    QXmppAesCipher cipher;
+    cipher.setKey(QByteArray::fromHex("2b7e151628aed2a6abf7158809cf4f3c"));
+
+    const QByteArray iv = QByteArray::fromHex("f0f1f2f3f4f5f6f7f8f9fafbfcfd0000");
+    QByteArray keystream(48, '\0');
+    cipher.encryptCounter(reinterpret_cast<const uchar*>(iv.constData()), reinterpret_cast<uchar*>(keystream.data()), keystream.size());
+    QCOMPARE(keystream, QByteArray::fromHex(
+        "e03ead0935c95e80e166b16dd92b4eb4"
+        "d23513162b02d0f72a43a2fe4a5f97ab"
+        "41e95b3bb0a2e8dd477901e4fca894c0"));
+}
+
+void tst_QXmppSrtp::testKeyDerivation()
+{
+    // RFC 3711 Appendix B.3
+    QCOMPARE(QXmppSrtpSession::deriveKey(masterKey, masterSalt, 0, 16),
+             QByteArray::fromHex("c61e7a93744f39ee10734afe3ff7a087"));
+    QCOMPARE(QXmppSrtpSession::deriveKey(masterKey, masterSalt, 1, 20),
+             QByteArray::fromHex("cebe321f6ff7716b6fd4ab49af256a156d38baa4"));
+    QCOMPARE(QXmppSrtpSession::deriveKey(masterKey, masterSalt, 2, 14),
+             QByteArray::fromHex("30cbbc08863d8c85d49db34a9ae1"));
+}
+
+void tst_QXmppSrtp::testRtp()
+{
+    QXmppSrtpSession sender(QXmppSrtpSession::AES_CM_128_HMAC_SHA1_80, masterKey, masterSalt);
+    QXmppSrtpSession receiver(QXmppSrtpSession::AES_CM_128_HMAC_SHA1_80, masterKey, masterSalt);
+
+    QByteArray packet = rtpPacket(0x1234);
+    QVERIFY(sender.protectRtp(&packet));
+    QCOMPARE(packet, QByteArray::fromHex(
+        "800f1234decafbadcafebabe"
+        "4e55dc4ce79978d88ca4d215949d2402"
+        "b78d6acc99ea179b8dbb"));
+
+    QByteArray replayed = packet;
+    QVERIFY(receiver.unprotectRtp(&packet));
+    QCOMPARE(packet, rtpPacket(0x1234));
+
+    // a packet is only accepted once
+    QVERIFY(!receiver.unprotectRtp(&replayed));
+
+    // reordered packets are accepted
+    QByteArray later = rtpPacket(0x1236);
+    QByteArray earlier = rtpPacket(0x1235);
+    QVERIFY(sender.protectRtp(&earlier));
+    QVERIFY(sender.protectRtp(&later));
+    QVERIFY(receiver.unprotectRtp(&later));
+    QVERIFY(receiver.unprotectRtp(&earlier));
+    QCOMPARE(earlier, rtpPacket(0x1235));
+}
+
+void tst_QXmppSrtp::testRtpRollover()
+{
+    QXmppSrtpSession sender(QXmppSrtpSession::AES_CM_128_HMAC_SHA1_32, masterKey, masterSalt);
+    QXmppSrtpSession receiver(QXmppSrtpSession::AES_CM_128_HMAC_SHA1_32, masterKey, masterSalt);
+
+    // the rollover counter follows the sequence numbers across the wrap
+    for (int i = 65530; i < 65530 + 12; ++i) {
+        QByteArray packet = rtpPacket(quint16(i));
+        QVERIFY(sender.protectRtp(&packet));
+        QCOMPARE(packet.size(), rtpPacket(0).size() + 4);
+        QVERIFY(receiver.unprotectRtp(&packet));
+        QCOMPARE(packet, rtpPacket(quint16(i)));
+    }
+}
+
+void tst_QXmppSrtp::testRtpTampered()
+{
+    QXmppSrtpSession sender(QXmppSrtpSession::AES_CM_128_HMAC_SHA1_80, masterKey, masterSalt);
+    QXmppSrtpSession receiver(QXmppSrtpSession::AES_CM_128_HMAC_SHA1_80, masterKey, masterSalt);
+
+    QByteArray packet = rtpPacket(1);
+    QVERIFY(sender.protectRtp(&packet));
+
+    QByteArray tampered = packet;
+    tampered[14] = tampered[14] ^ 1;
+    QVERIFY(!receiver.unprotectRtp(&tampered));
+
+    QByteArray truncated = packet.left(20);
+    QVERIFY(!receiver.unprotectRtp(&truncated));
+
+    // the genuine packet is still accepted
+    QVERIFY(receiver.unprotectRtp(&packet));
+    QCOMPARE(packet, rtpPacket(1));
+}
+
+void tst_QXmppSrtp::testRtcp()
+{
+    QXmppSrtpSession sender(QXmppSrtpSession::AES_CM_128_HMAC_SHA1_32, masterKey, masterSalt);
+    QXmppSrtpSession receiver(QXmppSrtpSession::AES_CM_128_HMAC_SHA1_32, masterKey, masterSalt);
+
+    const QByteArray original = QByteArray::fromHex("80c80006cafebabe0102030405060708090a0b0c0d0e0f10");
+    QByteArray packet = original;
+    QVERIFY(sender.protectRtcp(&packet));
+
+    // the header is in clear, followed by the E flag and index, then an
+    // 80-bit tag whatever the suite
+    QCOMPARE(packet.size(), original.size() + 4 + 10);
+    QCOMPARE(packet.left(8), original.left(8));
+    QVERIFY(packet.mid(8, original.size() - 8) != original.mid(8));
+    QCOMPARE(packet.mid(original.size(), 4), QByteArray::fromHex("80000000"));
+
+    QByteArray tampered = packet;
+    tampered[9] = tampered[9] ^ 1;
+    QVERIFY(!receiver.unprotectRtcp(&tampered));
+
+    QByteArray replayed = packet;
+    QVERIFY(receiver.unprotectRtcp(&packet));
+    QCOMPARE(packet, original);
+    QVERIFY(!receiver.unprotectRtcp(&replayed));
+
+    // the index increases with each packet
+    packet = original;
+    QVERIFY(sender.protectRtcp(&packet));
+    QCOMPARE(packet.mid(original.size(), 4), QByteArray::fromHex("80000001"));
+    QVERIFY(receiver.unprotectRtcp(&packet));
+    QCOMPARE(packet, original);
+}
+
+void tst_QXmppSrtp::testCryptoSuite()
+{
+    QXmppSrtpSession::CryptoSuite suite;
+    QVERIFY(QXmppSrtpSession::cryptoSuiteFromString("AES_CM_128_HMAC_SHA1_32", &suite));
+    QCOMPARE(suite, QXmppSrtpSession::AES_CM_128_HMAC_SHA1_32);
+    QCOMPARE(QXmppSrtpSession::cryptoSuiteToString(suite), QLatin1String("AES_CM_128_HMAC_SHA1_32"));
+    QVERIFY(QXmppSrtpSession::cryptoSuiteFromString("AES_CM_128_HMAC_SHA1_80", &suite));
+    QCOMPARE(suite, QXmppSrtpSession::AES_CM_128_HMAC_SHA1_80);
+    QVERIFY(!QXmppSrtpSession::cryptoSuiteFromString("AEAD_AES_128_GCM", &suite));
+
+    QCOMPARE(QXmppSrtpSession::generateKeyMaterial().size(), 30);
+}
+
+QTEST_MAIN(tst_QXmppSrtp)
+#include "tst_qxmppsrtp.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppsrvlookup
+SOURCES += tst_qxmppsrvlookup.cpp
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QEventLoop>
+#include <QObject>
+#include <QSignalSpy>
+#include <QtTest>
+
+#include "QXmppMetrics.h"
+#include "QXmppSrvLookup_p.h"
+
+static qint64 counterValue(const QString &name)
+{
+    return QXmppMetrics::snapshot().value(name).toLongLong();
+}
+
+class tst_QXmppSrvLookup : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void testCoalesced();
+    void testHandOver();
+    void testInsertCache();
+    void testNegativeCache();
+};
+
+void tst_QXmppSrvLookup::init()
+{
+    QXmppSrvLookup::clearCache();
+}
+
+void tst_QXmppSrvLookup::testCoalesced()
+{
+    const qint64 queries = counterValue("srv-lookup.query");
+    const qint64 coalesced = counterValue("srv-lookup.coalesced");
+
+    QXmppSrvLookup lookup1;
+    QSignalSpy spy1(&lookup1, SIGNAL(finished()));
+    QXmppSrvLookup lookup2;
+    QSignalSpy spy2(&lookup2, SIGNAL(finished()));
+
+    QEventLoop loop;
+    connect(&lookup2, SIGNAL(finished()), &loop, SLOT(quit()));
+    lookup1.lookup(QString());
+    lookup2.lookup(QString());
+    loop.exec();
+
+    QCOMPARE(spy1.count(), 1);
+    QCOMPARE(spy2.count(), 1);
+    QCOMPARE(lookup1.error(), QDnsLookup::InvalidRequestError);
+    QCOMPARE(lookup2.error(), QDnsLookup::InvalidRequestError);
+    QCOMPARE(counterValue("srv-lookup.query"), queries + 1);
+    QCOMPARE(counterValue("srv-lookup.coalesced"), coalesced + 1);
+}
+
+void tst_QXmppSrvLookup::testHandOver()
+{
+    const qint64 queries = counterValue("srv-lookup.query");
+
+    QXmppSrvLookup lookup1;
+    QSignalSpy spy1(&lookup1, SIGNAL(finished()));
+    QXmppSrvLookup lookup2;
+    QSignalSpy spy2(&lookup2, SIGNAL(finished()));
+
+    QEventLoop loop;
+    connect(&lookup2, SIGNAL(finished()), &loop, SLOT(quit()));
+    lookup1.lookup(QString());
+    lookup2.lookup(QString());
+
+    // the waiting lookup sends the query instead
+    lookup1.abort();
+    QCOMPARE(spy1.count(), 1);
+    QCOMPARE(lookup1.error(), QDnsLookup::OperationCancelledError);
+    loop.exec();
+
+    QCOMPARE(spy1.count(), 1);
+    QCOMPARE(spy2.count(), 1);
+    QCOMPARE(lookup2.error(), QDnsLookup::InvalidRequestError);
+    QCOMPARE(counterValue("srv-lookup.query"), queries + 2);
+}
+
+void tst_QXmppSrvLookup::testInsertCache()
+{
+    const QString name = QLatin1String("_xmpp-client._tcp.qxmpp.invalid");
+    const qint64 queries = counterValue("srv-lookup.query");
+
+    QXmppSrvRecord record;
+    record.setTarget("127.0.0.1");
+    record.setPort(5222);
+    record.setTimeToLive(60);
+    QXmppSrvLookup::insertCache(name, QList<QXmppSrvRecord>() << record);
+
+    // the inserted records are served without a query
+    QXmppSrvLookup lookup;
+    QEventLoop loop;
+    connect(&lookup, SIGNAL(finished()), &loop, SLOT(quit()));
+    lookup.lookup(name);
+    loop.exec();
+
+    QCOMPARE(lookup.error(), QDnsLookup::NoError);
+    QCOMPARE(lookup.serviceRecords().size(), 1);
+    QCOMPARE(lookup.serviceRecords().first().target(), QLatin1String("127.0.0.1"));
+    QCOMPARE(lookup.serviceRecords().first().port(), quint16(5222));
+    QCOMPARE(counterValue("srv-lookup.query"), queries);
+}
+
+void tst_QXmppSrvLookup::testNegativeCache()
+{
+    const QString name = QLatin1String("_xmpp-server._tcp.qxmpp.invalid");
+
+    QXmppSrvLookup lookup;
+    QEventLoop loop;
+    connect(&lookup, SIGNAL(finished()), &loop, SLOT(quit()));
+    lookup.lookup(name);
+    loop.exec();
+
+    const QDnsLookup::Error error = lookup.error();
+    QVERIFY(error != QDnsLookup::NoError);
+    QVERIFY(lookup.serviceRecords().isEmpty());
+
+    // the failure is served from the cache
+    const qint64 queries = counterValue("srv-lookup.query");
+    const qint64 hits = counterValue("srv-lookup.cache-hit");
+    lookup.lookup(name);
+    QVERIFY(!lookup.isFinished());
+    loop.exec();
+
+    QCOMPARE(lookup.error(), error);
+    QCOMPARE(counterValue("srv-lookup.query"), queries);
+    QCOMPARE(counterValue("srv-lookup.cache-hit"), hits + 1);
+}
+
+QTEST_MAIN(tst_QXmppSrvLookup)
+#include "tst_qxmppsrvlookup.moc"
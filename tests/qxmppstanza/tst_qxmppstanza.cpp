@@ -32,6 +32,8 @@ class tst_QXmppStanza : public QObject
 private slots:
     void testExtendedAddress_data();
     void testExtendedAddress();
+    void testError_data();
+    void testError();
 };
 
 void tst_QXmppStanza::testExtendedAddress_data()
@@ -74,5 +76,43 @@ void tst_QXmppStanza::testExtendedAddress()
     serializePacket(address, xml);
 }
 
+void tst_QXmppStanza::testError_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+    QTest::addColumn<int>("type");
+    QTest::addColumn<int>("condition");
+
+    QTest::newRow("cancel")
+        << QByteArray("<error type=\"cancel\"><item-not-found xmlns=\"urn:ietf:params:xml:ns:xmpp-stanzas\"/></error>")
+        << int(QXmppStanza::Error::Cancel)
+        << int(QXmppStanza::Error::ItemNotFound);
+    QTest::newRow("wait")
+        << QByteArray("<error type=\"wait\"><resource-constraint xmlns=\"urn:ietf:params:xml:ns:xmpp-stanzas\"/></error>")
+        << int(QXmppStanza::Error::Wait)
+        << int(QXmppStanza::Error::ResourceConstraint);
+    QTest::newRow("last")
+        << QByteArray("<error type=\"modify\"><unexpected-request xmlns=\"urn:ietf:params:xml:ns:xmpp-stanzas\"/></error>")
+        << int(QXmppStanza::Error::Modify)
+        << int(QXmppStanza::Error::UnexpectedRequest);
+}
+
+void tst_QXmppStanza::testError()
+{
+    QFETCH(QByteArray, xml);
+    QFETCH(int, type);
+    QFETCH(int, condition);
+
+    QXmppStanza::Error error;
+    parsePacket(error, xml);
+    QCOMPARE(int(error.type()), type);
+    QCOMPARE(int(error.condition()), condition);
+    serializePacket(error, xml);
+
+    // unknown values
+    QXmppStanza::Error unknown("foo", "bar");
+    QCOMPARE(int(unknown.type()), -1);
+    QCOMPARE(int(unknown.condition()), -1);
+}
+
 QTEST_MAIN(tst_QXmppStanza)
 #include "tst_qxmppstanza.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppstanzapipeline
+SOURCES += tst_qxmppstanzapipeline.cpp
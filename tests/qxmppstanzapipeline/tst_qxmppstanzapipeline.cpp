@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppStanzaPipeline_p.h"
+#include "QXmppStreamParser_p.h"
+
+class tst_QXmppStanzaPipeline : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testClear();
+    void testInvalid();
+    void testOrder();
+};
+
+// Returns the raw stanzas framed from the given top-level elements.
+
+static QList<QXmppRawStanza> frameStanzas(const QByteArray &data)
+{
+    QXmppStreamParser parser;
+    parser.setFramingOnly(true);
+    parser.addData("<stream:stream xmlns='jabber:server' xmlns:stream='http://etherx.jabber.org/streams'>" + data);
+
+    QList<QXmppRawStanza> stanzas;
+    QXmppStreamParser::Token token;
+    while ((token = parser.readNext()) != QXmppStreamParser::NoToken) {
+        if (token == QXmppStreamParser::StanzaToken)
+            stanzas << parser.rawStanza();
+    }
+    return stanzas;
+}
+
+void tst_QXmppStanzaPipeline::testClear()
+{
+    QXmppStanzaPipeline pipeline;
+    QSignalSpy readySpy(&pipeline, SIGNAL(readyRead()));
+    foreach (const QXmppRawStanza &stanza, frameStanzas("<iq id='1'/><iq id='2'/>"))
+        pipeline.submit(stanza, true);
+    QCOMPARE(pipeline.size(), 2);
+
+    // the stanzas which were submitted are dropped
+    pipeline.clear();
+    QCOMPARE(pipeline.size(), 0);
+    QTest::qWait(100);
+    QXmppRawStanza stanza;
+    bool wellFormed;
+    QVERIFY(!pipeline.readNext(&stanza, &wellFormed));
+
+    // new stanzas go through
+    pipeline.submit(frameStanzas("<iq id='3'/>").first(), true);
+    for (int i = 0; i < 100 && readySpy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QVERIFY(pipeline.readNext(&stanza, &wellFormed));
+    QCOMPARE(stanza.id(), QLatin1String("3"));
+    QCOMPARE(pipeline.size(), 0);
+}
+
+void tst_QXmppStanzaPipeline::testInvalid()
+{
+    QXmppStanzaPipeline pipeline;
+    QSignalSpy readySpy(&pipeline, SIGNAL(readyRead()));
+    pipeline.submit(frameStanzas("<iq id='1'><ping></pong></iq>").first(), true);
+    for (int i = 0; i < 100 && readySpy.isEmpty(); ++i)
+        QTest::qWait(10);
+
+    QXmppRawStanza stanza;
+    bool wellFormed = true;
+    QVERIFY(pipeline.readNext(&stanza, &wellFormed));
+    QVERIFY(!wellFormed);
+}
+
+void tst_QXmppStanzaPipeline::testOrder()
+{
+    const int count = 200;
+    QByteArray data;
+    for (int i = 0; i < count; ++i)
+        data += "<message id='" + QByteArray::number(i) + "'><body>" + QByteArray(i % 7 * 100, 'x') + "</body></message>";
+    const QList<QXmppRawStanza> stanzas = frameStanzas(data);
+    QCOMPARE(stanzas.size(), count);
+
+    // every third stanza is not parsed
+    QXmppStanzaPipeline pipeline;
+    QSignalSpy readySpy(&pipeline, SIGNAL(readyRead()));
+    for (int i = 0; i < count; ++i)
+        pipeline.submit(stanzas[i], i % 3 != 0);
+    QCOMPARE(pipeline.size(), count);
+
+    // the stanzas come out in the order they were submitted
+    QXmppRawStanza stanza;
+    bool wellFormed;
+    int read = 0;
+    QElapsedTimer timer;
+    timer.start();
+    while (read < count && timer.elapsed() < 5000) {
+        if (!pipeline.readNext(&stanza, &wellFormed)) {
+            QTest::qWait(10);
+            continue;
+        }
+        QVERIFY(wellFormed);
+        QCOMPARE(stanza.id(), QString::number(read));
+        if (read % 3 != 0)
+            QCOMPARE(stanza.element().firstChildElement("body").text().size(), read % 7 * 100);
+        ++read;
+    }
+    QCOMPARE(read, count);
+    QCOMPARE(pipeline.size(), 0);
+    QVERIFY(readySpy.size() > 0);
+}
+
+QTEST_MAIN(tst_QXmppStanzaPipeline)
+#include "tst_qxmppstanzapipeline.moc"
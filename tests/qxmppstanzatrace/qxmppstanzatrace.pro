@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppstanzatrace
+SOURCES += tst_qxmppstanzatrace.cpp
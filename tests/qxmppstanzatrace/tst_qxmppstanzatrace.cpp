@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppMetrics.h"
+#include "QXmppStanzaTrace_p.h"
+
+class tst_QXmppStanzaTrace : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testSampled();
+    void testNotSampled();
+};
+
+void tst_QXmppStanzaTrace::testSampled()
+{
+    QXmppStanzaTrace::setEnabled();
+    QVERIFY(QXmppStanzaTrace::isEnabled());
+    QVERIFY(!QXmppStanzaTrace::current());
+
+    QXmppStanzaTrace *trace = QXmppStanzaTrace::start(QXmppStanzaTrace::now() - 100, true);
+    QVERIFY(trace);
+    QCOMPARE(QXmppStanzaTrace::current(), trace);
+    trace->mark("parse");
+    trace->addDuration("dispatch.test", 42);
+
+    const QString summary = QXmppStanzaTrace::finish();
+    QVERIFY(!QXmppStanzaTrace::current());
+    QVERIFY(summary.startsWith("Stanza trace: parse "));
+    QVERIFY(summary.contains(", dispatch.test 42us, total "));
+
+    const QVariantMap values = QXmppMetrics::snapshot();
+    QCOMPARE(values.value("stanza-trace.dispatch.test.count").toLongLong(), qint64(1));
+    QCOMPARE(values.value("stanza-trace.dispatch.test.max").toLongLong(), qint64(42));
+    QVERIFY(values.value("stanza-trace.parse.max").toLongLong() >= 100);
+}
+
+void tst_QXmppStanzaTrace::testNotSampled()
+{
+    QXmppStanzaTrace *trace = QXmppStanzaTrace::start(QXmppStanzaTrace::now(), false);
+    QVERIFY(trace);
+    trace->addDuration("dispatch.other", 10);
+    QCOMPARE(QXmppStanzaTrace::finish(), QString());
+    QCOMPARE(QXmppStanzaTrace::finish(), QString());
+
+    // histograms are recorded even if the trace is not logged
+    QCOMPARE(QXmppMetrics::snapshot().value("stanza-trace.dispatch.other.count").toLongLong(), qint64(1));
+}
+
+QTEST_MAIN(tst_QXmppStanzaTrace)
+#include "tst_qxmppstanzatrace.moc"
@@ -29,10 +29,25 @@ class tst_QXmppStreamFeatures : public QObject
     Q_OBJECT
 
 private slots:
+    void testClientStateIndication();
     void testEmpty();
     void testFull();
+    void testRosterVersioning();
+    void testSessionOptional();
 };
 
+void tst_QXmppStreamFeatures::testClientStateIndication()
+{
+    const QByteArray xml("<stream:features>"
+        "<csi xmlns=\"urn:xmpp:csi:0\"/>"
+        "</stream:features>");
+
+    QXmppStreamFeatures features;
+    parsePacket(features, xml);
+    QCOMPARE(features.clientStateIndicationMode(), QXmppStreamFeatures::Enabled);
+    serializePacket(features, xml);
+}
+
 void tst_QXmppStreamFeatures::testEmpty()
 {
     const QByteArray xml("<stream:features/>");
@@ -45,6 +60,7 @@ void tst_QXmppStreamFeatures::testEmpty()
     QCOMPARE(features.tlsMode(), QXmppStreamFeatures::Disabled);
     QCOMPARE(features.authMechanisms(), QStringList());
     QCOMPARE(features.compressionMethods(), QStringList());
+    QCOMPARE(features.clientStateIndicationMode(), QXmppStreamFeatures::Disabled);
     serializePacket(features, xml);
 }
 
@@ -63,6 +79,7 @@ void tst_QXmppStreamFeatures::testFull()
     parsePacket(features, xml);
     QCOMPARE(features.bindMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features.sessionMode(), QXmppStreamFeatures::Enabled);
+    QCOMPARE(features.sessionOptional(), false);
     QCOMPARE(features.nonSaslAuthMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features.tlsMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features.authMechanisms(), QStringList() << "PLAIN");
@@ -70,5 +87,33 @@ void tst_QXmppStreamFeatures::testFull()
     serializePacket(features, xml);
 }
 
+void tst_QXmppStreamFeatures::testRosterVersioning()
+{
+    const QByteArray xml("<stream:features>"
+        "<ver xmlns=\"urn:xmpp:features:rosterver\"/>"
+        "</stream:features>");
+
+    QXmppStreamFeatures features;
+    parsePacket(features, xml);
+    QCOMPARE(features.streamManagementMode(), QXmppStreamFeatures::Disabled);
+    QCOMPARE(features.rosterVersioningMode(), QXmppStreamFeatures::Enabled);
+    serializePacket(features, xml);
+}
+
+void tst_QXmppStreamFeatures::testSessionOptional()
+{
+    const QByteArray xml("<stream:features>"
+        "<bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\"/>"
+        "<session xmlns=\"urn:ietf:params:xml:ns:xmpp-session\"><optional/></session>"
+        "</stream:features>");
+
+    QXmppStreamFeatures features;
+    parsePacket(features, xml);
+    QCOMPARE(features.bindMode(), QXmppStreamFeatures::Enabled);
+    QCOMPARE(features.sessionMode(), QXmppStreamFeatures::Enabled);
+    QCOMPARE(features.sessionOptional(), true);
+    serializePacket(features, xml);
+}
+
 QTEST_MAIN(tst_QXmppStreamFeatures)
 #include "tst_qxmppstreamfeatures.moc"
@@ -45,6 +45,8 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
     QTest::addColumn<QByteArray>("hash");
     QTest::addColumn<QString>("name");
     QTest::addColumn<qint64>("size");
+    QTest::addColumn<bool>("rangeSupported");
+    QTest::addColumn<qint64>("rangeOffset");
 
     QTest::newRow("normal")
         << QByteArray("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" name=\"test.txt\" size=\"1022\"/>")
@@ -52,7 +54,9 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
         << QString()
         << QByteArray()
         << QString("test.txt")
-        << qint64(1022);
+        << qint64(1022)
+        << false
+        << qint64(0);
 
     QTest::newRow("full")
         << QByteArray("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" "
@@ -66,7 +70,33 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
         << QString("This is a test. If this were a real file...")
         << QByteArray::fromHex("552da749930852c69ae5d2141d3766b1")
         << QString("test.txt")
-        << qint64(1022);
+        << qint64(1022)
+        << false
+        << qint64(0);
+
+    QTest::newRow("range")
+        << QByteArray("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" name=\"test.txt\" size=\"1022\">"
+                "<range/>"
+            "</file>")
+        << QDateTime()
+        << QString()
+        << QByteArray()
+        << QString("test.txt")
+        << qint64(1022)
+        << true
+        << qint64(0);
+
+    QTest::newRow("range offset")
+        << QByteArray("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\">"
+                "<range offset=\"252\"/>"
+            "</file>")
+        << QDateTime()
+        << QString()
+        << QByteArray()
+        << QString()
+        << qint64(0)
+        << true
+        << qint64(252);
 }
 
 void tst_QXmppStreamInitiationIq::testFileInfo()
@@ -77,6 +107,8 @@ void tst_QXmppStreamInitiationIq::testFileInfo()
     QFETCH(QByteArray, hash);
     QFETCH(QString, name);
     QFETCH(qint64, size);
+    QFETCH(bool, rangeSupported);
+    QFETCH(qint64, rangeOffset);
 
     QXmppTransferFileInfo info;
     parsePacket(info, xml);
@@ -85,6 +117,8 @@ void tst_QXmppStreamInitiationIq::testFileInfo()
     QCOMPARE(info.hash(), hash);
     QCOMPARE(info.name(), name);
     QCOMPARE(info.size(), size);
+    QCOMPARE(info.isRangeSupported(), rangeSupported);
+    QCOMPARE(info.rangeOffset(), rangeOffset);
     serializePacket(info, xml);
 }
 
@@ -47,6 +47,8 @@ private slots:
     void testFailedResumeOrEnabled();
     void testLoadOutboundBuffer();
     void testAckReceived();
+    void testAckPolicy();
+    void testAdaptiveAckPolicy();
 
 private:
     QXmppStreamManagement *streamManagement;
@@ -203,6 +205,77 @@ void tst_QXmppStreamManagement::testAckReceived()
     QCOMPARE(doc.setContent(xml, true), true);
 
     streamManagement->ackReceived(doc.documentElement());
+    QCOMPARE(streamManagement->outBoundBuffer().size(), 2);
+
+    // the remaining stanzas are kept as they were serialized
+    const QList<QByteArray> data = streamManagement->outboundData();
+    QCOMPARE(data.size(), 2);
+    QVERIFY(data[0].startsWith("<message"));
+    QVERIFY(data[1].startsWith("<iq"));
+
+    // acknowledge the remaining stanzas
+    QCOMPARE(doc.setContent(QByteArray("<a xmlns='urn:xmpp:sm:3' h=\"3\"/>"), true), true);
+    streamManagement->ackReceived(doc.documentElement());
+    QCOMPARE(streamManagement->outBoundBuffer().size(), 0);
+    QCOMPARE(streamManagement->outboundData().size(), 0);
+}
+
+void tst_QXmppStreamManagement::testAckPolicy()
+{
+    QXmppStreamManagement sm;
+    sm.enableSent();
+    sm.setAckPolicy(3, 0, 0, false);
+    QCOMPARE(sm.ackRequestInterval(), 0);
+
+    QXmppMessage message;
+    sm.stanzaSent(message);
+    sm.stanzaSent(message);
+    QCOMPARE(sm.isAckRequestDue(), false);
+    QCOMPARE(sm.isAckRequestDue(true), true);
+    sm.stanzaSent(message);
+    QCOMPARE(sm.isAckRequestDue(), true);
+    QCOMPARE(sm.unacknowledgedCount(), 3);
+    QVERIFY(sm.unacknowledgedBytes() > 0);
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    sm.requestToXml(&writer);
+    QCOMPARE(sm.isAckRequestDue(), false);
+
+    QDomDocument doc;
+    QCOMPARE(doc.setContent(QByteArray("<a xmlns='urn:xmpp:sm:3' h=\"3\"/>"), true), true);
+    sm.ackReceived(doc.documentElement());
+    QCOMPARE(sm.unacknowledgedCount(), 0);
+    QCOMPARE(sm.unacknowledgedBytes(), qint64(0));
+    QVERIFY(sm.ackLatency() >= 0);
+
+    const QList<int> histogram = sm.ackLatencyHistogram();
+    QCOMPARE(histogram.size(), QXmppStreamManagement::ackLatencyBuckets().size() + 1);
+    int answered = 0;
+    foreach (int count, histogram)
+        answered += count;
+    QCOMPARE(answered, 1);
+}
+
+void tst_QXmppStreamManagement::testAdaptiveAckPolicy()
+{
+    QXmppStreamManagement sm;
+    sm.enableSent();
+    sm.setAckPolicy(1, 0, 1000, true);
+    QCOMPARE(sm.ackRequestInterval(), 1000);
+
+    QXmppMessage message;
+    sm.stanzaSent(message);
+    QCOMPARE(sm.isAckRequestDue(), true);
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    sm.requestToXml(&writer);
+
+    // no further request while one is pending
+    sm.stanzaSent(message);
+    QCOMPARE(sm.isAckRequestDue(), false);
+    QCOMPARE(sm.isAckRequestDue(true), false);
 }
 
 void tst_QXmppStreamManagement::messageACKReceived(const QXmppMessage& message, bool ack)
@@ -0,0 +1,361 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QObject>
+#include <QtTest>
+#include <QXmlStreamWriter>
+
+#include "QXmppConstants.h"
+#include "QXmppMessage.h"
+#include "QXmppStreamParser_p.h"
+
+class tst_QXmppStreamParser : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testStream();
+    void testFragmented();
+    void testWhitespace();
+    void testInvalid();
+    void testMaximumElementSize();
+    void testClear();
+    void testFramingOnly();
+    void testRawStanza();
+    void testRawStanzaNames();
+    void testRawStanzaSetAttribute();
+    void testRawStanzaFromStanza();
+    void testManyNames();
+};
+
+static const QByteArray streamStart(
+    "<?xml version='1.0'?>"
+    "<stream:stream from='example.com' id='abc' version='1.0'"
+    " xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>");
+
+static const QByteArray stanza(
+    "<message to='foo@example.com' xml:lang='en' type='chat'>"
+    "<body>Hello &amp; welcome</body>"
+    "<x xmlns='jabber:x:oob'><url>http://example.com/</url></x>"
+    "</message>");
+
+void tst_QXmppStreamParser::testStream()
+{
+    QXmppStreamParser parser;
+    QCOMPARE(parser.readNext(), QXmppStreamParser::NoToken);
+
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+    QDomElement element = parser.element();
+    QCOMPARE(element.tagName(), QLatin1String("stream"));
+    QCOMPARE(element.namespaceURI(), QLatin1String(ns_stream));
+    QCOMPARE(element.attribute("from"), QLatin1String("example.com"));
+    QCOMPARE(element.attribute("id"), QLatin1String("abc"));
+    QCOMPARE(parser.readNext(), QXmppStreamParser::NoToken);
+    QCOMPARE(parser.depth(), 1);
+
+    parser.addData(stanza);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    element = parser.element();
+    QCOMPARE(element.tagName(), QLatin1String("message"));
+    QCOMPARE(element.namespaceURI(), QLatin1String(ns_client));
+    QCOMPARE(element.attribute("to"), QLatin1String("foo@example.com"));
+    QCOMPARE(element.attribute("xml:lang"), QLatin1String("en"));
+    QCOMPARE(element.firstChildElement("body").text(), QLatin1String("Hello & welcome"));
+    QCOMPARE(element.firstChildElement("x").namespaceURI(), QLatin1String("jabber:x:oob"));
+    QCOMPARE(element.firstChildElement("x").firstChildElement("url").namespaceURI(), QLatin1String("jabber:x:oob"));
+    QCOMPARE(parser.readNext(), QXmppStreamParser::NoToken);
+
+    parser.addData("</stream:stream>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamEndToken);
+    QCOMPARE(parser.depth(), 0);
+}
+
+void tst_QXmppStreamParser::testFragmented()
+{
+    const QByteArray data = streamStart + stanza + stanza;
+
+    // feed the data one byte at a time
+    QXmppStreamParser parser;
+    QList<QXmppStreamParser::Token> tokens;
+    for (int i = 0; i < data.size(); ++i) {
+        parser.addData(data.mid(i, 1));
+        QXmppStreamParser::Token token;
+        while ((token = parser.readNext()) != QXmppStreamParser::NoToken) {
+            tokens << token;
+            if (token == QXmppStreamParser::StanzaToken) {
+                QCOMPARE(parser.rawStanza().data(), stanza);
+                QCOMPARE(parser.element().firstChildElement("body").text(), QLatin1String("Hello & welcome"));
+            }
+        }
+    }
+    QCOMPARE(tokens.size(), 3);
+    QCOMPARE(tokens[0], QXmppStreamParser::StreamStartToken);
+    QCOMPARE(tokens[1], QXmppStreamParser::StanzaToken);
+    QCOMPARE(tokens[2], QXmppStreamParser::StanzaToken);
+}
+
+void tst_QXmppStreamParser::testWhitespace()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+
+    parser.addData(" \n");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::WhitespaceToken);
+}
+
+void tst_QXmppStreamParser::testInvalid()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+
+    parser.addData("<message></iq>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::ErrorToken);
+    QVERIFY(!parser.errorString().isEmpty());
+
+    // the parser stays in error state
+    parser.addData(stanza);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::ErrorToken);
+}
+
+void tst_QXmppStreamParser::testMaximumElementSize()
+{
+    QXmppStreamParser parser;
+    parser.setMaximumElementSize(stanza.size());
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+
+    // an element within the limit is accepted
+    parser.addData(stanza);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    QCOMPARE(parser.error(), QXmppStreamParser::NoError);
+
+    // a larger element is refused before it is complete
+    parser.addData("<message><body>");
+    parser.addData(QByteArray(stanza.size(), 'a'));
+    QCOMPARE(parser.readNext(), QXmppStreamParser::ErrorToken);
+    QCOMPARE(parser.error(), QXmppStreamParser::ElementTooLargeError);
+
+    // the stream's root element is also limited
+    parser.clear();
+    parser.setMaximumElementSize(16);
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::ErrorToken);
+    QCOMPARE(parser.error(), QXmppStreamParser::ElementTooLargeError);
+}
+
+void tst_QXmppStreamParser::testClear()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+    parser.addData("<success xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    QCOMPARE(parser.rawStanza().data(), QByteArray("<success xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>"));
+
+    // a new stream starts
+    parser.clear();
+    QCOMPARE(parser.readNext(), QXmppStreamParser::NoToken);
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+    parser.addData(stanza);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+}
+
+void tst_QXmppStreamParser::testFramingOnly()
+{
+    const QByteArray result("<db:result from='a&amp;b.example' to='example.com'>key</db:result>");
+    const QByteArray invalid("<iq type='get'><ping></pong></iq>");
+
+    QXmppStreamParser parser;
+    parser.setFramingOnly(true);
+    QVERIFY(parser.isFramingOnly());
+    parser.addData(streamStart.left(streamStart.size() - 1) + " xmlns:db='jabber:server:dialback'>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+    QCOMPARE(parser.element().attribute("id"), QLatin1String("abc"));
+
+    // the name and attributes are read from the start tag
+    parser.addData(stanza + " " + result + invalid);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    QXmppRawStanza raw = parser.rawStanza();
+    QCOMPARE(raw.data(), stanza);
+    QCOMPARE(raw.tagName(), QLatin1String("message"));
+    QCOMPARE(raw.namespaceURI(), QLatin1String(ns_client));
+    QCOMPARE(raw.to(), QLatin1String("foo@example.com"));
+    QCOMPARE(raw.type(), QLatin1String("chat"));
+    QCOMPARE(raw.element().firstChildElement("body").text(), QLatin1String("Hello & welcome"));
+
+    QCOMPARE(parser.readNext(), QXmppStreamParser::WhitespaceToken);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    raw = parser.rawStanza();
+    QCOMPARE(raw.tagName(), QLatin1String("result"));
+    QCOMPARE(raw.namespaceURI(), QLatin1String("jabber:server:dialback"));
+    QCOMPARE(raw.from(), QLatin1String("a&b.example"));
+
+    // checking that the element is well-formed is left to the DOM parser
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    raw = parser.rawStanza();
+    QCOMPARE(raw.data(), invalid);
+    QVERIFY(raw.element().isNull());
+
+    QCOMPARE(parser.readNext(), QXmppStreamParser::NoToken);
+    parser.addData("</stream:stream>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamEndToken);
+    QCOMPARE(parser.depth(), 0);
+}
+
+void tst_QXmppStreamParser::testRawStanza()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+    QVERIFY(parser.rawStanza().isNull());
+
+    // whitespace and markup between stanzas are not part of the raw data
+    const QByteArray iq("<iq id='a>b' type=\"get\"><ping xmlns='urn:xmpp:ping'/></iq>");
+    parser.addData(" <!-- comment -->" + iq + "\n" + stanza);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::WhitespaceToken);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    QXmppRawStanza raw = parser.rawStanza();
+    QCOMPARE(raw.data(), iq);
+    QCOMPARE(raw.tagName(), QLatin1String("iq"));
+    QCOMPARE(raw.id(), QLatin1String("a>b"));
+    QCOMPARE(raw.type(), QLatin1String("get"));
+
+    QCOMPARE(parser.readNext(), QXmppStreamParser::WhitespaceToken);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    raw = parser.rawStanza();
+    QCOMPARE(raw.data(), stanza);
+    QCOMPARE(raw.tagName(), QLatin1String("message"));
+    QCOMPARE(raw.namespaceURI(), QLatin1String(ns_client));
+    QCOMPARE(raw.to(), QLatin1String("foo@example.com"));
+    QCOMPARE(raw.from(), QString());
+    QCOMPARE(raw.type(), QLatin1String("chat"));
+    QCOMPARE(raw.element().tagName(), QLatin1String("message"));
+}
+
+void tst_QXmppStreamParser::testRawStanzaNames()
+{
+    QXmppStreamParser parser;
+    parser.setRawStanzaNames(QStringList() << "message");
+    parser.addData(streamStart + stanza);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    QCOMPARE(parser.rawStanza().data(), stanza);
+
+    // the DOM is built on demand
+    const QDomElement element = parser.element();
+    QCOMPARE(element.tagName(), QLatin1String("message"));
+    QCOMPARE(element.namespaceURI(), QLatin1String(ns_client));
+    QCOMPARE(element.attribute("to"), QLatin1String("foo@example.com"));
+    QCOMPARE(element.firstChildElement("body").text(), QLatin1String("Hello & welcome"));
+    QCOMPARE(element.firstChildElement("x").namespaceURI(), QLatin1String("jabber:x:oob"));
+}
+
+void tst_QXmppStreamParser::testRawStanzaSetAttribute()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart + stanza + "<presence/>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+
+    QXmppRawStanza raw = parser.rawStanza();
+    raw.setAttribute("from", "bar@example.com/res");
+    raw.setAttribute("to", "it's@example.com");
+    QCOMPARE(raw.data(), QByteArray(
+        "<message to='it&apos;s@example.com' xml:lang='en' type='chat' from='bar@example.com/res'>"
+        "<body>Hello &amp; welcome</body>"
+        "<x xmlns='jabber:x:oob'><url>http://example.com/</url></x>"
+        "</message>"));
+    QCOMPARE(raw.from(), QLatin1String("bar@example.com/res"));
+    QCOMPARE(raw.to(), QLatin1String("it's@example.com"));
+    QCOMPARE(raw.element().attribute("to"), QLatin1String("it's@example.com"));
+
+    // the original stanza is left untouched
+    QCOMPARE(parser.rawStanza().data(), stanza);
+
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    raw = parser.rawStanza();
+    raw.setAttribute("to", "example.com");
+    QCOMPARE(raw.data(), QByteArray("<presence to='example.com'/>"));
+}
+
+void tst_QXmppStreamParser::testRawStanzaFromStanza()
+{
+    QXmppMessage message("foo@example.com/res", "bar@example.com/a", QString::fromUtf8("Hello & welcome \xc3\xa9\xe2\x82\xac <3"));
+    message.setId("msg1");
+
+    QXmppRawStanza raw(message);
+    QVERIFY(!raw.isNull());
+
+    // the data is the same as written by QXmlStreamWriter to a device
+    QByteArray expected;
+    QXmlStreamWriter writer(&expected);
+    message.toXml(&writer);
+    QCOMPARE(raw.data(), expected);
+
+    QCOMPARE(raw.tagName(), QLatin1String("message"));
+    QCOMPARE(raw.from(), QLatin1String("foo@example.com/res"));
+    QCOMPARE(raw.id(), QLatin1String("msg1"));
+    QCOMPARE(raw.to(), QLatin1String("bar@example.com/a"));
+    QCOMPARE(raw.type(), QLatin1String("chat"));
+
+    // the serialized message is only rewritten for each recipient
+    raw.setAttribute("to", "bar@example.com/b");
+    QCOMPARE(raw.to(), QLatin1String("bar@example.com/b"));
+    const QDomElement element = raw.element();
+    QCOMPARE(element.tagName(), QLatin1String("message"));
+    QCOMPARE(element.attribute("from"), QLatin1String("foo@example.com/res"));
+    QCOMPARE(element.attribute("to"), QLatin1String("bar@example.com/b"));
+    QCOMPARE(element.attribute("type"), QLatin1String("chat"));
+    QCOMPARE(element.firstChildElement("body").text(), message.body());
+}
+
+void tst_QXmppStreamParser::testManyNames()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStartToken);
+
+    // element and attribute names are still correct once the parser
+    // stops remembering new names
+    for (int i = 0; i < 300; ++i) {
+        const QByteArray name = "x" + QByteArray::number(i);
+        parser.addData("<" + name + " " + name + "='v'><" + name + "/></" + name + ">");
+        QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+        const QDomElement element = parser.element();
+        QCOMPARE(element.tagName(), QString::fromLatin1(name));
+        QCOMPARE(element.attribute(QString::fromLatin1(name)), QLatin1String("v"));
+        QCOMPARE(element.firstChildElement().tagName(), QString::fromLatin1(name));
+        QCOMPARE(parser.rawStanza().tagName(), QString::fromLatin1(name));
+    }
+
+    parser.addData(stanza);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StanzaToken);
+    QCOMPARE(parser.element().firstChildElement("body").text(), QLatin1String("Hello & welcome"));
+}
+
+QTEST_MAIN(tst_QXmppStreamParser)
+#include "tst_qxmppstreamparser.moc"
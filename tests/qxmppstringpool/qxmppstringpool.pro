@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppstringpool
+SOURCES += tst_qxmppstringpool.cpp
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QDomDocument>
+#include <QObject>
+
+#include "QXmppPresence.h"
+#include "QXmppStringPool_p.h"
+#include "util.h"
+
+class tst_QXmppStringPool : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testDisabled();
+    void testIntern();
+    void testCapacity();
+    void testPresence();
+};
+
+void tst_QXmppStringPool::testDisabled()
+{
+    QXmppStringPool pool;
+    QVERIFY(!pool.isEnabled());
+
+    const QString value("Available");
+    QCOMPARE(pool.intern(value), value);
+    QCOMPARE(pool.intern(QByteArray("ver")), QByteArray("ver"));
+    QCOMPARE(pool.size(), 0);
+}
+
+void tst_QXmppStringPool::testIntern()
+{
+    QXmppStringPool pool;
+    pool.setEnabled(true);
+
+    const QString first = QString("Avail") + QString("able");
+    const QString second = QString("Availa") + QString("ble");
+    QVERIFY(first.constData() != second.constData());
+
+    const QString pooledFirst = pool.intern(first);
+    const QString pooledSecond = pool.intern(second);
+    QCOMPARE(pooledSecond, second);
+    QCOMPARE(pooledFirst.constData(), pooledSecond.constData());
+
+    const QByteArray bytes = pool.intern(QByteArray("ver") + QByteArray("sion"));
+    QCOMPARE(pool.intern(QByteArray("version")).constData(), bytes.constData());
+    QCOMPARE(pool.size(), 2);
+
+    // empty values are not pooled
+    QCOMPARE(pool.intern(QString()), QString());
+    QCOMPARE(pool.size(), 2);
+
+    pool.clear();
+    QCOMPARE(pool.size(), 0);
+}
+
+void tst_QXmppStringPool::testCapacity()
+{
+    QXmppStringPool pool;
+    pool.setEnabled(true);
+    pool.setCapacity(2);
+    QCOMPARE(pool.capacity(), 2);
+
+    pool.intern(QString("a"));
+    pool.intern(QByteArray("b"));
+    QCOMPARE(pool.size(), 2);
+
+    // values which do not fit are returned as they are
+    const QString value("c");
+    QCOMPARE(pool.intern(value).constData(), value.constData());
+    QCOMPARE(pool.size(), 2);
+}
+
+void tst_QXmppStringPool::testPresence()
+{
+    const QByteArray xml(
+        "<presence to=\"foo@example.com/QXmpp\" from=\"bar@example.com/%1\">"
+        "<status>In a meeting</status>"
+        "<c xmlns=\"http://jabber.org/protocol/caps\" hash=\"sha-1\" node=\"https://github.com/qxmpp-project/qxmpp\" ver=\"QgayPKawpkPSDYmwT/WM94uAlu0=\"/>"
+        "</presence>");
+
+    QXmppStanza::setStringPoolEnabled(true);
+    QVERIFY(QXmppStanza::isStringPoolEnabled());
+
+    QXmppPresence first;
+    parsePacket(first, QString::fromLatin1(xml).arg("a").toUtf8());
+    QXmppPresence second;
+    parsePacket(second, QString::fromLatin1(xml).arg("b").toUtf8());
+
+    QCOMPARE(second.statusText(), QLatin1String("In a meeting"));
+    QCOMPARE(first.statusText().constData(), second.statusText().constData());
+    QCOMPARE(first.capabilityNode().constData(), second.capabilityNode().constData());
+    QCOMPARE(first.capabilityHash().constData(), second.capabilityHash().constData());
+    QCOMPARE(first.capabilityVer().constData(), second.capabilityVer().constData());
+    QCOMPARE(first.to().constData(), second.to().constData());
+
+    QXmppStanza::setStringPoolEnabled(false);
+    QVERIFY(!QXmppStanza::isStringPoolEnabled());
+    QXmppPresence third;
+    parsePacket(third, QString::fromLatin1(xml).arg("c").toUtf8());
+    QCOMPARE(third.statusText(), first.statusText());
+    QVERIFY(third.statusText().constData() != first.statusText().constData());
+}
+
+QTEST_MAIN(tst_QXmppStringPool)
+#include "tst_qxmppstringpool.moc"
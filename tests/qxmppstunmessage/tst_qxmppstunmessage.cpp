@@ -34,6 +34,7 @@ private slots:
     void testIntegrity();
     void testIPv4Address();
     void testIPv6Address();
+    void testPeekType();
     void testXorIPv4Address();
     void testXorIPv6Address();
 };
@@ -95,6 +96,28 @@ void tst_QXmppStunMessage::testIPv6Address()
     QCOMPARE(msg2.mappedPort, quint16(12345));
 }
 
+void tst_QXmppStunMessage::testPeekType()
+{
+    QXmppStunMessage msg;
+    msg.setId(QByteArray("0123456789ab"));
+    msg.setType(QXmppStunMessage::Binding | QXmppStunMessage::Response);
+    const QByteArray packet = msg.encode(QByteArray(), true);
+
+    quint32 cookie = 0;
+    QByteArray id;
+    QCOMPARE(QXmppStunMessage::peekType(packet, cookie, id), quint16(0x0101));
+    QCOMPARE(cookie, quint32(0x2112A442));
+    QCOMPARE(id, QByteArray("0123456789ab"));
+
+    // truncated packet
+    QCOMPARE(QXmppStunMessage::peekType(packet.left(packet.size() - 1), cookie, id), quint16(0));
+
+    // RTP packet
+    QByteArray rtp = packet;
+    rtp[0] = '\x80';
+    QCOMPARE(QXmppStunMessage::peekType(rtp, cookie, id), quint16(0));
+}
+
 void tst_QXmppStunMessage::testXorIPv4Address()
 {
     // encode
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpptask
+SOURCES += tst_qxmpptask.cpp
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppClient.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppIqRequest.h"
+#include "QXmppServer.h"
+#include "QXmppTask.h"
+#include "util.h"
+
+// Checks several passwords in sequence.
+class PasswordTask : public QXmppTask
+{
+public:
+    PasswordTask(QXmppPasswordChecker *checker, const QStringList &passwords)
+        : m_checker(checker), m_passwords(passwords), m_index(0), m_reply(0)
+    {
+    }
+
+    QList<QXmppPasswordReply::Error> errors;
+
+protected:
+    void run()
+    {
+        QXMPP_TASK_BEGIN
+        for (m_index = 0; m_index < m_passwords.size(); ++m_index) {
+            {
+                QXmppPasswordRequest request;
+                request.setDomain("localhost");
+                request.setUsername("user1");
+                request.setPassword(m_passwords[m_index]);
+                m_reply = m_checker->checkPassword(request);
+            }
+            QXMPP_TASK_AWAIT(m_reply->setTask(this));
+            errors << m_reply->error();
+            m_reply->deleteLater();
+        }
+        QXMPP_TASK_END
+    }
+
+private:
+    QXmppPasswordChecker *m_checker;
+    QStringList m_passwords;
+    int m_index;
+    QXmppPasswordReply *m_reply;
+};
+
+// Queries the server's features, then sends it an empty query.
+class IqTask : public QXmppTask
+{
+public:
+    IqTask(QXmppClient *client)
+        : m_client(client), m_request(0)
+    {
+    }
+
+    QList<QXmppIqRequest::State> states;
+
+protected:
+    void run()
+    {
+        QXMPP_TASK_BEGIN
+        {
+            QXmppDiscoveryIq iq;
+            iq.setTo("localhost");
+            iq.setQueryType(QXmppDiscoveryIq::InfoQuery);
+            m_request = m_client->sendIq(iq, 5000);
+        }
+        QXMPP_TASK_AWAIT(m_request->setTask(this));
+        states << m_request->state();
+        m_request->deleteLater();
+
+        {
+            QXmppIq iq(QXmppIq::Get);
+            iq.setTo("localhost");
+            m_request = m_client->sendIq(iq, 5000);
+        }
+        QXMPP_TASK_AWAIT(m_request->setTask(this));
+        states << m_request->state();
+        m_request->deleteLater();
+        QXMPP_TASK_END
+    }
+
+private:
+    QXmppClient *m_client;
+    QXmppIqRequest *m_request;
+};
+
+class tst_QXmppTask : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testFinishedReply();
+    void testIqRequests();
+    void testPasswordChecks();
+};
+
+void tst_QXmppTask::testFinishedReply()
+{
+    // a reply which is already finished resumes the task right away
+    QXmppPasswordReply *reply = new QXmppPasswordReply;
+    reply->finish();
+
+    class ReplyTask : public QXmppTask
+    {
+    public:
+        ReplyTask(QXmppPasswordReply *reply) : steps(0), m_reply(reply) {}
+        int steps;
+
+    protected:
+        void run()
+        {
+            QXMPP_TASK_BEGIN
+            steps++;
+            QXMPP_TASK_AWAIT(m_reply->setTask(this));
+            steps++;
+            QXMPP_TASK_END
+        }
+
+    private:
+        QXmppPasswordReply *m_reply;
+    };
+
+    ReplyTask task(reply);
+    task.setAutoDelete(false);
+    QVERIFY(!task.isFinished());
+    task.start();
+    QVERIFY(task.isFinished());
+    QCOMPARE(task.steps, 2);
+    delete reply;
+}
+
+void tst_QXmppTask::testIqRequests()
+{
+    TestPasswordChecker checker;
+    checker.addCredentials("user1", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&checker);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12384));
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12384);
+    config.setUser("user1");
+    config.setPassword("testpwd");
+
+    QXmppClient client;
+    QSignalSpy connected(&client, SIGNAL(connected()));
+    client.connectToServer(config);
+    for (int i = 0; i < 50 && connected.isEmpty(); ++i)
+        QTest::qWait(100);
+    QVERIFY(client.isConnected());
+
+    IqTask task(&client);
+    task.setAutoDelete(false);
+    task.start();
+    QVERIFY(!task.isFinished());
+    for (int i = 0; i < 50 && !task.isFinished(); ++i)
+        QTest::qWait(100);
+    QVERIFY(task.isFinished());
+
+    // the server answers disco#info, and rejects the empty query
+    QCOMPARE(task.states, QList<QXmppIqRequest::State>()
+        << QXmppIqRequest::ResultState
+        << QXmppIqRequest::ErrorState);
+}
+
+void tst_QXmppTask::testPasswordChecks()
+{
+    TestPasswordChecker checker;
+    checker.addCredentials("user1", "testpwd");
+
+    PasswordTask task(&checker, QStringList() << "testpwd" << "badpwd" << "testpwd");
+    task.setAutoDelete(false);
+    task.start();
+
+    // the replies finish from the event loop
+    QVERIFY(!task.isFinished());
+    for (int i = 0; i < 50 && !task.isFinished(); ++i)
+        QTest::qWait(10);
+    QVERIFY(task.isFinished());
+    QCOMPARE(task.errors, QList<QXmppPasswordReply::Error>()
+        << QXmppPasswordReply::NoError
+        << QXmppPasswordReply::AuthorizationError
+        << QXmppPasswordReply::NoError);
+}
+
+QTEST_MAIN(tst_QXmppTask)
+#include "tst_qxmpptask.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpptimerwheel
+SOURCES += tst_qxmpptimerwheel.cpp
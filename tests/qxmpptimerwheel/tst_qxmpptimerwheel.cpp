@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppTimerWheel_p.h"
+
+class tst_QXmppTimerWheel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testExpire();
+    void testInsertPast();
+    void testRemove();
+    void testWrap();
+};
+
+void tst_QXmppTimerWheel::testExpire()
+{
+    QXmppTimerWheel wheel(100, 8);
+    QCOMPARE(wheel.resolution(), 100);
+    wheel.insert("late", 30000);
+    wheel.insert("soon", 1000);
+    wheel.insert("now", 150);
+    QCOMPARE(wheel.count(), 3);
+
+    // deadlines are rounded up, keys never expire early
+    QCOMPARE(wheel.expire(100), QStringList());
+    QCOMPARE(wheel.expire(199), QStringList());
+    QCOMPARE(wheel.expire(200), QStringList() << "now");
+    QCOMPARE(wheel.expire(999), QStringList());
+    QCOMPARE(wheel.expire(1000), QStringList() << "soon");
+    QVERIFY(wheel.contains("late"));
+    QCOMPARE(wheel.expire(30000), QStringList() << "late");
+    QCOMPARE(wheel.count(), 0);
+}
+
+void tst_QXmppTimerWheel::testInsertPast()
+{
+    QXmppTimerWheel wheel(100, 8);
+    QCOMPARE(wheel.expire(2000), QStringList());
+
+    // a deadline which passed expires on the next tick
+    wheel.insert("past", 10);
+    QCOMPARE(wheel.expire(2099), QStringList());
+    QCOMPARE(wheel.expire(2100), QStringList() << "past");
+}
+
+void tst_QXmppTimerWheel::testRemove()
+{
+    QXmppTimerWheel wheel(100, 8);
+    wheel.insert("a", 500);
+    QVERIFY(wheel.remove("a"));
+    QVERIFY(!wheel.remove("a"));
+    QVERIFY(!wheel.contains("a"));
+    QCOMPARE(wheel.expire(1000), QStringList());
+
+    // inserting a key again replaces its deadline
+    wheel.insert("b", 5000);
+    wheel.insert("b", 2000);
+    QCOMPARE(wheel.count(), 1);
+    QCOMPARE(wheel.expire(2000), QStringList() << "b");
+}
+
+void tst_QXmppTimerWheel::testWrap()
+{
+    // deadlines beyond one turn of the wheel wait for their turn
+    QXmppTimerWheel wheel(100, 8);
+    wheel.insert("far", 100000);
+    QCOMPARE(wheel.expire(50000), QStringList());
+    QCOMPARE(wheel.expire(99999), QStringList());
+    QCOMPARE(wheel.expire(200000), QStringList() << "far");
+}
+
+QTEST_MAIN(tst_QXmppTimerWheel)
+#include "tst_qxmpptimerwheel.moc"
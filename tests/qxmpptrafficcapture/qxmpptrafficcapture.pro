@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpptrafficcapture
+SOURCES += tst_qxmpptrafficcapture.cpp
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+#include <QTemporaryFile>
+#include <QtTest>
+
+#include "QXmppTrafficCapture_p.h"
+
+class tst_QXmppTrafficCapture : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRecord();
+};
+
+void tst_QXmppTrafficCapture::testRecord()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+
+    QXmppTrafficCapture capture;
+    QVERIFY(capture.open(file.fileName()));
+    QCOMPARE(capture.fileName(), file.fileName());
+
+    const int first = capture.openSession();
+    const int second = capture.openSession();
+    QCOMPARE(first, 1);
+    QCOMPARE(second, 2);
+    capture.record(second, "<presence/>");
+    capture.record(first, QByteArray());
+    capture.closeSession(second);
+
+    QList<QList<QByteArray> > records;
+    foreach (const QByteArray &line, file.readAll().split('\n')) {
+        if (!line.isEmpty())
+            records << line.split(' ');
+    }
+    QCOMPARE(records.size(), 5);
+    QCOMPARE(records[0], QList<QByteArray>() << "#" << "qxmpp-capture" << "1");
+    QCOMPARE(records[1].mid(1), QList<QByteArray>() << "1" << "open");
+    QCOMPARE(records[2].mid(1), QList<QByteArray>() << "2" << "open");
+    QCOMPARE(records[3].mid(1), QList<QByteArray>() << "2" << "data" << QByteArray("<presence/>").toBase64());
+    QCOMPARE(records[4].mid(1), QList<QByteArray>() << "2" << "close");
+
+    // times are increasing
+    QVERIFY(records[1][0].toLongLong() <= records[4][0].toLongLong());
+}
+
+QTEST_MAIN(tst_QXmppTrafficCapture)
+#include "tst_qxmpptrafficcapture.moc"
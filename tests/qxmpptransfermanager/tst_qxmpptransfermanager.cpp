@@ -26,6 +26,7 @@
 
 #include "QXmppClient.h"
 #include "QXmppServer.h"
+#include "QXmppServerProxy65.h"
 #include "QXmppTransferManager.h"
 #include "util.h"
 
@@ -39,11 +40,15 @@ private slots:
     void init();
     void testSendFile_data();
     void testSendFile();
+    void testSendConcurrentFiles();
 
     void acceptFile(QXmppTransferJob *job);
+    void acceptConcurrentFile(QXmppTransferJob *job);
 
 private:
+    QList<QXmppTransferJob*> concurrentJobs;
     QBuffer receiverBuffer;
+    QByteArray receiverResumeData;
     QXmppTransferJob *receiverJob;
 };
 
@@ -51,41 +56,83 @@ void tst_QXmppTransferManager::init()
 {
     receiverBuffer.close();
     receiverBuffer.setData(QByteArray());
+    receiverResumeData = QByteArray();
     receiverJob = 0;
 }
 
 void tst_QXmppTransferManager::acceptFile(QXmppTransferJob *job)
 {
     receiverJob = job;
-    receiverBuffer.open(QIODevice::WriteOnly);
-    job->accept(&receiverBuffer);
+    if (receiverResumeData.isEmpty()) {
+        receiverBuffer.open(QIODevice::WriteOnly);
+        job->accept(&receiverBuffer);
+    } else {
+        receiverBuffer.setData(receiverResumeData);
+        receiverBuffer.open(QIODevice::ReadWrite);
+        job->resume(&receiverBuffer);
+    }
+}
+
+void tst_QXmppTransferManager::acceptConcurrentFile(QXmppTransferJob *job)
+{
+    concurrentJobs << job;
+    QBuffer *buffer = new QBuffer(job);
+    buffer->open(QIODevice::WriteOnly);
+    job->accept(buffer);
 }
 
 void tst_QXmppTransferManager::testSendFile_data()
 {
     QTest::addColumn<QXmppTransferJob::Method>("senderMethods");
     QTest::addColumn<QXmppTransferJob::Method>("receiverMethods");
+    QTest::addColumn<bool>("ibbMessages");
+    QTest::addColumn<bool>("proxy");
+    QTest::addColumn<bool>("resume");
     QTest::addColumn<bool>("works");
 
-    QTest::newRow("any - any") << QXmppTransferJob::AnyMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("any - inband") << QXmppTransferJob::AnyMethod << QXmppTransferJob::InBandMethod << true;
-    QTest::newRow("any - socks") << QXmppTransferJob::AnyMethod << QXmppTransferJob::SocksMethod << true;
-
-    QTest::newRow("inband - any") << QXmppTransferJob::InBandMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("inband - inband") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << true;
-    QTest::newRow("inband - socks") << QXmppTransferJob::InBandMethod << QXmppTransferJob::SocksMethod << false;
-
-    QTest::newRow("socks - any") << QXmppTransferJob::SocksMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("socks - inband") << QXmppTransferJob::SocksMethod << QXmppTransferJob::InBandMethod << false;
-    QTest::newRow("socks - socks") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << true;
+    QTest::newRow("any - any") << QXmppTransferJob::AnyMethod << QXmppTransferJob::AnyMethod << false << false << false << true;
+    QTest::newRow("any - inband") << QXmppTransferJob::AnyMethod << QXmppTransferJob::InBandMethod << false << false << false << true;
+    QTest::newRow("any - socks") << QXmppTransferJob::AnyMethod << QXmppTransferJob::SocksMethod << false << false << false << true;
+
+    QTest::newRow("inband - any") << QXmppTransferJob::InBandMethod << QXmppTransferJob::AnyMethod << false << false << false << true;
+    QTest::newRow("inband - inband") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << false << false << false << true;
+    QTest::newRow("inband - inband resume") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << false << false << true << true;
+    QTest::newRow("inband - inband messages") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << true << false << false << true;
+    QTest::newRow("inband - socks") << QXmppTransferJob::InBandMethod << QXmppTransferJob::SocksMethod << false << false << false << false;
+
+    QTest::newRow("socks - any") << QXmppTransferJob::SocksMethod << QXmppTransferJob::AnyMethod << false << false << false << true;
+    QTest::newRow("socks - inband") << QXmppTransferJob::SocksMethod << QXmppTransferJob::InBandMethod << false << false << false << false;
+    QTest::newRow("socks - socks") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << false << false << false << true;
+    QTest::newRow("socks - socks resume") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << false << false << true << true;
+    QTest::newRow("socks - socks proxy") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << false << true << false << true;
+
+    const QXmppTransferJob::Method jingleOrAny = QXmppTransferJob::Method(QXmppTransferJob::JingleMethod | QXmppTransferJob::AnyMethod);
+    QTest::newRow("jingle - any") << QXmppTransferJob::JingleMethod << QXmppTransferJob::AnyMethod << false << false << false << false;
+    QTest::newRow("jingle - jingle") << QXmppTransferJob::JingleMethod << QXmppTransferJob::JingleMethod << false << false << false << true;
+    QTest::newRow("jingle - jingle resume") << QXmppTransferJob::JingleMethod << QXmppTransferJob::JingleMethod << false << false << true << true;
+    QTest::newRow("jingle+any - any") << jingleOrAny << QXmppTransferJob::AnyMethod << false << false << false << true;
+    QTest::newRow("jingle+any - jingle+any") << jingleOrAny << jingleOrAny << false << false << false << true;
 }
 
 void tst_QXmppTransferManager::testSendFile()
 {
     QFETCH(QXmppTransferJob::Method, senderMethods);
     QFETCH(QXmppTransferJob::Method, receiverMethods);
+    QFETCH(bool, ibbMessages);
+    QFETCH(bool, proxy);
+    QFETCH(bool, resume);
     QFETCH(bool, works);
 
+    QFile expectedFile(":/test.svg");
+    QVERIFY(expectedFile.open(QIODevice::ReadOnly));
+    const QByteArray expectedData = expectedFile.readAll();
+    expectedFile.close();
+
+    // keep the first half of the file, as if an earlier transfer was
+    // interrupted
+    if (resume)
+        receiverResumeData = expectedData.left(expectedData.size() / 2);
+
     const QString testDomain("localhost");
     const QHostAddress testHost(QHostAddress::LocalHost);
     const quint16 testPort = 12345;
@@ -102,12 +149,24 @@ void tst_QXmppTransferManager::testSendFile()
     server.setDomain(testDomain);
     server.setLogger(&logger);
     server.setPasswordChecker(&passwordChecker);
+    if (proxy) {
+        QXmppServerProxy65 *proxyExtension = new QXmppServerProxy65;
+        proxyExtension->setHost(testHost.toString());
+        proxyExtension->setPort(17777);
+        server.addExtension(proxyExtension);
+    }
     server.listenForClients(testHost, testPort);
 
     // prepare sender
     QXmppClient sender;
     QXmppTransferManager *senderManager = new QXmppTransferManager;
     senderManager->setSupportedMethods(senderMethods);
+    senderManager->setIbbBlockSize(1024);
+    senderManager->setIbbMessagesEnabled(ibbMessages);
+    if (proxy) {
+        senderManager->setProxy("proxy.localhost");
+        senderManager->setProxyOnly(true);
+    }
     sender.addExtension(senderManager);
     sender.setLogger(&logger);
 
@@ -164,9 +223,6 @@ void tst_QXmppTransferManager::testSendFile()
         QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
 
         // check received file
-        QFile expectedFile(":/test.svg");
-        QVERIFY(expectedFile.open(QIODevice::ReadOnly));
-        const QByteArray expectedData = expectedFile.readAll();
         QCOMPARE(receiverBuffer.data(), expectedData);
     } else {
         QCOMPARE(senderJob->state(), QXmppTransferJob::FinishedState);
@@ -178,5 +234,100 @@ void tst_QXmppTransferManager::testSendFile()
     }
 }
 
+void tst_QXmppTransferManager::testSendConcurrentFiles()
+{
+    const int jobCount = 8;
+
+    QFile expectedFile(":/test.svg");
+    QVERIFY(expectedFile.open(QIODevice::ReadOnly));
+    const QByteArray expectedData = expectedFile.readAll();
+    expectedFile.close();
+
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(testHost, testPort);
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+
+    // prepare sender, with small in-band blocks so that the data IQs of
+    // all the jobs are interleaved
+    QXmppClient sender;
+    QXmppTransferManager *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    senderManager->setIbbBlockSize(512);
+    sender.addExtension(senderManager);
+
+    QEventLoop senderLoop;
+    connect(&sender, SIGNAL(connected()), &senderLoop, SLOT(quit()));
+    connect(&sender, SIGNAL(disconnected()), &senderLoop, SLOT(quit()));
+    config.setUser("sender");
+    sender.connectToServer(config);
+    senderLoop.exec();
+    QCOMPARE(sender.isConnected(), true);
+
+    // prepare receiver
+    QXmppClient receiver;
+    QXmppTransferManager *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    connect(receiverManager, SIGNAL(fileReceived(QXmppTransferJob*)),
+            this, SLOT(acceptConcurrentFile(QXmppTransferJob*)));
+    receiver.addExtension(receiverManager);
+
+    QEventLoop receiverLoop;
+    connect(&receiver, SIGNAL(connected()), &receiverLoop, SLOT(quit()));
+    connect(&receiver, SIGNAL(disconnected()), &receiverLoop, SLOT(quit()));
+    config.setUser("receiver");
+    receiver.connectToServer(config);
+    receiverLoop.exec();
+    QCOMPARE(receiver.isConnected(), true);
+
+    // send the files at once
+    concurrentJobs.clear();
+    QList<QXmppTransferJob*> senderJobs;
+    for (int i = 0; i < jobCount; ++i) {
+        QXmppTransferJob *job = senderManager->sendFile("receiver@localhost/QXmpp", ":/test.svg");
+        QVERIFY(job);
+        senderJobs << job;
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        int finished = 0;
+        foreach (QXmppTransferJob *job, senderJobs + concurrentJobs) {
+            if (job->state() == QXmppTransferJob::FinishedState)
+                finished++;
+        }
+        if (concurrentJobs.size() == jobCount && finished == 2 * jobCount)
+            break;
+        QTest::qWait(100);
+    }
+
+    foreach (QXmppTransferJob *job, senderJobs) {
+        QCOMPARE(job->state(), QXmppTransferJob::FinishedState);
+        QCOMPARE(job->error(), QXmppTransferJob::NoError);
+    }
+    QCOMPARE(concurrentJobs.size(), jobCount);
+    foreach (QXmppTransferJob *job, concurrentJobs) {
+        QCOMPARE(job->state(), QXmppTransferJob::FinishedState);
+        QCOMPARE(job->error(), QXmppTransferJob::NoError);
+        QBuffer *buffer = job->findChild<QBuffer*>();
+        QVERIFY(buffer);
+        QCOMPARE(buffer->data(), expectedData);
+    }
+}
+
 QTEST_MAIN(tst_QXmppTransferManager)
 #include "tst_qxmpptransfermanager.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppturnserver
+SOURCES += tst_qxmppturnserver.cpp
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QDateTime>
+#include <QObject>
+#include <QUdpSocket>
+#include <QtTest>
+
+#include "QXmppStun_p.h"
+#include "QXmppTurnServer.h"
+#include "QXmppUtils.h"
+
+static const QHostAddress testHost(QHostAddress::LocalHost);
+static const quint16 testPort = 12377;
+
+class tst_QXmppTurnServer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void datagramReceived(const QByteArray &datagram, const QHostAddress &host, quint16 port);
+
+    void testBandwidth();
+    void testExpiredCredentials();
+    void testPassword();
+    void testRelay();
+
+private:
+    bool allocate(QXmppTurnAllocation *allocation, int expiry);
+    QXmppTurnServer *createServer();
+
+    QByteArray m_datagram;
+    QHostAddress m_host;
+    quint16 m_port;
+};
+
+void tst_QXmppTurnServer::datagramReceived(const QByteArray &datagram, const QHostAddress &host, quint16 port)
+{
+    m_datagram = datagram;
+    m_host = host;
+    m_port = port;
+}
+
+bool tst_QXmppTurnServer::allocate(QXmppTurnAllocation *allocation, int expiry)
+{
+    const QString username = QString("%1:alice@example.com").arg(
+        QString::number(QDateTime::currentDateTime().toTime_t() + expiry));
+
+    QEventLoop loop;
+    connect(allocation, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(allocation, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+
+    allocation->setServer(testHost, testPort);
+    allocation->setUser(username);
+    allocation->setPassword(QXmppTurnServer::generatePassword("secret", username));
+    allocation->connectToHost();
+    loop.exec();
+    return allocation->state() == QXmppTurnAllocation::ConnectedState;
+}
+
+QXmppTurnServer *tst_QXmppTurnServer::createServer()
+{
+    QXmppTurnServer *server = new QXmppTurnServer(this);
+    server->setSharedSecret("secret");
+    server->setRelayAddress(testHost);
+    if (!server->listen(testHost, testPort)) {
+        delete server;
+        return 0;
+    }
+    return server;
+}
+
+void tst_QXmppTurnServer::testBandwidth()
+{
+    QXmppTurnServer *server = createServer();
+    QVERIFY(server);
+    server->setMaximumAllocationBandwidth(1000);
+
+    QXmppTurnAllocation allocation;
+    QVERIFY(allocate(&allocation, 3600));
+
+    QUdpSocket peer;
+    QVERIFY(peer.bind(testHost, 0));
+
+    // the first second of traffic goes through, the rest is dropped
+    const QByteArray data(600, 'x');
+    for (int i = 0; i < 3; ++i)
+        allocation.writeDatagram(data, testHost, peer.localPort());
+
+    int received = 0;
+    for (int i = 0; i < 20; ++i) {
+        QTest::qWait(10);
+        while (peer.hasPendingDatagrams()) {
+            QByteArray buffer(peer.pendingDatagramSize(), 0);
+            peer.readDatagram(buffer.data(), buffer.size());
+            QCOMPARE(buffer, data);
+            received++;
+        }
+    }
+    QCOMPARE(received, 1);
+
+    delete server;
+}
+
+void tst_QXmppTurnServer::testExpiredCredentials()
+{
+    QXmppTurnServer *server = createServer();
+    QVERIFY(server);
+
+    QXmppTurnAllocation allocation;
+    QVERIFY(!allocate(&allocation, -60));
+    QCOMPARE(server->allocationCount(), 0);
+
+    delete server;
+}
+
+void tst_QXmppTurnServer::testPassword()
+{
+    const QString username("1445000000:alice@example.com");
+    QCOMPARE(QXmppTurnServer::generatePassword("secret", username),
+             QString::fromLatin1(QXmppUtils::generateHmacSha1("secret", username.toUtf8()).toBase64()));
+    QVERIFY(QXmppTurnServer::generatePassword("other", username) !=
+            QXmppTurnServer::generatePassword("secret", username));
+}
+
+void tst_QXmppTurnServer::testRelay()
+{
+    QXmppTurnServer *server = createServer();
+    QVERIFY(server);
+    QVERIFY(server->isListening());
+    QCOMPARE(server->serverPort(), testPort);
+
+    QXmppTurnAllocation allocation;
+    QVERIFY(allocate(&allocation, 3600));
+    QCOMPARE(allocation.relayedHost(), testHost);
+    QVERIFY(allocation.relayedPort() != 0);
+    QCOMPARE(server->allocationCount(), 1);
+
+    QUdpSocket peer;
+    QVERIFY(peer.bind(testHost, 0));
+
+    // the client's data reaches the peer from the relayed address
+    allocation.writeDatagram("hello", testHost, peer.localPort());
+    for (int i = 0; i < 100 && !peer.hasPendingDatagrams(); ++i)
+        QTest::qWait(10);
+    QVERIFY(peer.hasPendingDatagrams());
+
+    QByteArray buffer(peer.pendingDatagramSize(), 0);
+    QHostAddress host;
+    quint16 port;
+    peer.readDatagram(buffer.data(), buffer.size(), &host, &port);
+    QCOMPARE(buffer, QByteArray("hello"));
+    QCOMPARE(host, allocation.relayedHost());
+    QCOMPARE(port, allocation.relayedPort());
+
+    // the peer's reply reaches the client
+    m_datagram.clear();
+    connect(&allocation, SIGNAL(datagramReceived(QByteArray,QHostAddress,quint16)),
+            this, SLOT(datagramReceived(QByteArray,QHostAddress,quint16)));
+    peer.writeDatagram("world", host, port);
+    for (int i = 0; i < 100 && m_datagram.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(m_datagram, QByteArray("world"));
+    QCOMPARE(m_host, testHost);
+    QCOMPARE(m_port, peer.localPort());
+
+    // releasing the allocation removes it from the server
+    allocation.disconnectFromHost();
+    for (int i = 0; i < 100 && server->allocationCount(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(server->allocationCount(), 0);
+
+    delete server;
+}
+
+QTEST_MAIN(tst_QXmppTurnServer)
+#include "tst_qxmppturnserver.moc"
@@ -23,6 +23,7 @@
  */
 
 #include <QObject>
+#include "QXmppJid.h"
 #include "QXmppUtils.h"
 #include "util.h"
 
@@ -32,10 +33,13 @@ class tst_QXmppUtils : public QObject
 
 private slots:
     void testCrc32();
+    void testDatetime();
     void testHmac();
     void testJid();
+    void testJidClass();
     void testMime();
     void testLibVersion();
+    void testSecureRandomBytes();
     void testTimezoneOffset();
 };
 
@@ -46,6 +50,42 @@ void tst_QXmppUtils::testCrc32()
 
     crc = QXmppUtils::generateCrc32(QByteArray("Hi There"));
     QCOMPARE(crc, 0xDB143BBEu);
+
+    const QByteArray data("Hi There, this is a longer string for slicing by 8!");
+    crc = QXmppUtils::generateCrc32(data);
+    QCOMPARE(crc, 0x119771A6u);
+
+    // streaming
+    crc = QXmppUtils::updateCrc32(0, data.left(13));
+    crc = QXmppUtils::updateCrc32(crc, data.mid(13));
+    QCOMPARE(crc, 0x119771A6u);
+}
+
+void tst_QXmppUtils::testDatetime()
+{
+    // parsing
+    QCOMPARE(QXmppUtils::datetimeFromString("1991-08-25T20:50:26Z"),
+             QDateTime(QDate(1991, 8, 25), QTime(20, 50, 26), Qt::UTC));
+    QCOMPARE(QXmppUtils::datetimeFromString("1991-08-25T20:50:26.1Z"),
+             QDateTime(QDate(1991, 8, 25), QTime(20, 50, 26, 100), Qt::UTC));
+    QCOMPARE(QXmppUtils::datetimeFromString("1991-08-25T20:50:26.123456Z"),
+             QDateTime(QDate(1991, 8, 25), QTime(20, 50, 26, 123), Qt::UTC));
+    QCOMPARE(QXmppUtils::datetimeFromString("1991-08-25T20:50:26+01:30"),
+             QDateTime(QDate(1991, 8, 25), QTime(19, 20, 26), Qt::UTC));
+    QCOMPARE(QXmppUtils::datetimeFromString("1991-08-25T23:50:26.5-01:30"),
+             QDateTime(QDate(1991, 8, 26), QTime(1, 20, 26, 500), Qt::UTC));
+    QVERIFY(!QXmppUtils::datetimeFromString(QString()).isValid());
+    QVERIFY(!QXmppUtils::datetimeFromString("1991-08-25T20:50:26").isValid());
+    QVERIFY(!QXmppUtils::datetimeFromString("1991-08-25 20:50:26Z").isValid());
+    QVERIFY(!QXmppUtils::datetimeFromString("1991-13-25T20:50:26Z").isValid());
+    QVERIFY(!QXmppUtils::datetimeFromString("1991-08-25T20:50:26.Z").isValid());
+
+    // serialization
+    QCOMPARE(QXmppUtils::datetimeToString(QDateTime(QDate(1991, 8, 25), QTime(20, 50, 26), Qt::UTC)),
+             QLatin1String("1991-08-25T20:50:26Z"));
+    QCOMPARE(QXmppUtils::datetimeToString(QDateTime(QDate(1991, 8, 25), QTime(20, 50, 26, 7), Qt::UTC)),
+             QLatin1String("1991-08-25T20:50:26.007Z"));
+    QCOMPARE(QXmppUtils::datetimeToString(QDateTime()), QString());
 }
 
 void tst_QXmppUtils::testHmac()
@@ -58,6 +98,16 @@ void tst_QXmppUtils::testHmac()
 
     hmac = QXmppUtils::generateHmacMd5(QByteArray(16, '\xaa'), QByteArray(50, '\xdd'));
     QCOMPARE(hmac, QByteArray::fromHex("56be34521d144c88dbb8c733f0e8b3f6"));
+
+    // key larger than the block size
+    hmac = QXmppUtils::generateHmacMd5(QByteArray(80, '\xaa'), QByteArray("Test Using Larger Than Block-Size Key - Hash Key First"));
+    QCOMPARE(hmac, QByteArray::fromHex("6b1ab7fe4bd7bf8f0b62e6ce61b9d0cd"));
+
+    hmac = QXmppUtils::generateHmacSha1(QByteArray(20, '\x0b'), QByteArray("Hi There"));
+    QCOMPARE(hmac, QByteArray::fromHex("b617318655057264e28bc0b6fb378c8ef146be00"));
+
+    hmac = QXmppUtils::generateHmacSha1(QByteArray(80, '\xaa'), QByteArray("Test Using Larger Than Block-Size Key - Hash Key First"));
+    QCOMPARE(hmac, QByteArray::fromHex("aa4ae5e15272d00e95705637ce8a3b55ed402112"));
 }
 
 void tst_QXmppUtils::testJid()
@@ -83,6 +133,35 @@ void tst_QXmppUtils::testJid()
     QCOMPARE(QXmppUtils::jidToUser(QString()), QString());
 }
 
+void tst_QXmppUtils::testJidClass()
+{
+    QXmppJid jid("foo@example.com/resource/with@at");
+    QVERIFY(!jid.isNull());
+    QVERIFY(!jid.isBare());
+    QCOMPARE(jid.bareJid(), QLatin1String("foo@example.com"));
+    QCOMPARE(jid.bareJidHash(), qHash(QString("foo@example.com")));
+    QCOMPARE(jid.user(), QLatin1String("foo"));
+    QCOMPARE(jid.domain(), QLatin1String("example.com"));
+    QCOMPARE(jid.resource(), QLatin1String("resource/with@at"));
+    QCOMPARE(jid.toString(), QLatin1String("foo@example.com/resource/with@at"));
+
+    QXmppJid bare("example.com");
+    QVERIFY(bare.isBare());
+    QCOMPARE(bare.bareJid(), QLatin1String("example.com"));
+    QCOMPARE(bare.user(), QString());
+    QCOMPARE(bare.domain(), QLatin1String("example.com"));
+    QCOMPARE(bare.resource(), QString());
+    QCOMPARE(qHash(bare), qHash(QString("example.com")));
+
+    QXmppJid null;
+    QVERIFY(null.isNull());
+    QCOMPARE(null.bareJid(), QString());
+    QCOMPARE(null.domain(), QString());
+
+    QVERIFY(jid == QXmppJid("foo@example.com/resource/with@at"));
+    QVERIFY(jid != bare);
+}
+
 // FIXME: how should we test MIME detection without expose getImageType?
 #if 0
 QString getImageType(const QByteArray &contents);
@@ -117,6 +196,16 @@ void tst_QXmppUtils::testLibVersion()
     QCOMPARE(QXmppVersion(), QString("0.9.2"));
 }
 
+void tst_QXmppUtils::testSecureRandomBytes()
+{
+    const QByteArray first = QXmppUtils::generateSecureRandomBytes(32);
+    const QByteArray second = QXmppUtils::generateSecureRandomBytes(32);
+    QCOMPARE(first.size(), 32);
+    QCOMPARE(second.size(), 32);
+    QVERIFY(first != second);
+    QVERIFY(QXmppUtils::generateSecureRandomBytes(0).isEmpty());
+}
+
 void tst_QXmppUtils::testTimezoneOffset()
 {
     // parsing
@@ -125,6 +214,7 @@ void tst_QXmppUtils::testTimezoneOffset()
     QCOMPARE(QXmppUtils::timezoneOffsetFromString("-00:00"), 0);
     QCOMPARE(QXmppUtils::timezoneOffsetFromString("+01:30"), 5400);
     QCOMPARE(QXmppUtils::timezoneOffsetFromString("-01:30"), -5400);
+    QCOMPARE(QXmppUtils::timezoneOffsetFromString("+0130"), 0);
 
     // serialization
     QCOMPARE(QXmppUtils::timezoneOffsetToString(0), QLatin1String("Z"));
@@ -211,6 +211,12 @@ void tst_QXmppVCardIq::testVCard()
         "UIgAAFCIBjw1HyAAAAAd0SU1FB9oIHQInNvuJovgAAAAiSURBVAjXY2TQ+s/AwMDAwPD/GiMDlP"
         "WfgYGBiQEHGJwSAK2BBQ1f3uvpAAAAAElFTkSuQmCC"));
     QCOMPARE(vcard.photoType(), QLatin1String("image/png"));
+
+    // photos set explicitly replace the received ones
+    QXmppVCardIq copy = vcard;
+    copy.setPhoto(QByteArray("foo"));
+    QCOMPARE(copy.photo(), QByteArray("foo"));
+    QCOMPARE(vcard.photo().size(), 144);
     QCOMPARE(vcard.url(), QLatin1String("https://github.com/qxmpp-project/qxmpp/"));
 
     const QXmppVCardOrganization &orgInfo = vcard.organization();
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppwebsocket
+SOURCES += tst_qxmppwebsocket.cpp
@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+
+#include <QEventLoop>
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QtEndian>
+#include <QtTest>
+
+#include "QXmppStreamCompressor_p.h"
+#include "QXmppWebSocket_p.h"
+
+static const QHostAddress testHost = QHostAddress::LocalHost;
+static const quint16 testPort = 12374;
+
+static const char deflateTrailer[] = "\x00\x00\xff\xff";
+
+// Runs the event loop until the signal is emitted, or a second elapsed.
+static void waitForSignal(QObject *sender, const char *signal)
+{
+    QEventLoop loop;
+    QObject::connect(sender, signal, &loop, SLOT(quit()));
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+// Returns a masked frame, as sent by a client.
+static QByteArray clientFrame(int opcode, const QByteArray &payload, bool final = true, bool compressed = false)
+{
+    static const uchar mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+    QByteArray frame;
+    frame += char((final ? 0x80 : 0) | (compressed ? 0x40 : 0) | opcode);
+    if (payload.size() < 126) {
+        frame += char(0x80 | payload.size());
+    } else {
+        uchar length[2];
+        qToBigEndian<quint16>(payload.size(), length);
+        frame += char(0x80 | 126);
+        frame.append(reinterpret_cast<const char*>(length), 2);
+    }
+    frame.append(reinterpret_cast<const char*>(mask), 4);
+    for (int i = 0; i < payload.size(); ++i)
+        frame += char(payload[i] ^ mask[i % 4]);
+    return frame;
+}
+
+// Takes the first complete frame sent by the server out of the buffer.
+static bool takeServerFrame(QByteArray &buffer, int &opcode, bool &compressed, QByteArray &payload)
+{
+    if (buffer.size() < 2)
+        return false;
+    const uchar *header = reinterpret_cast<const uchar*>(buffer.constData());
+    int length = header[1] & 0x7f;
+    int headerSize = 2;
+    if (length == 126) {
+        if (buffer.size() < 4)
+            return false;
+        length = qFromBigEndian<quint16>(header + 2);
+        headerSize = 4;
+    }
+    if (buffer.size() < headerSize + length)
+        return false;
+    opcode = header[0] & 0x0f;
+    compressed = header[0] & 0x40;
+    payload = buffer.mid(headerSize, length);
+    buffer.remove(0, headerSize + length);
+    return true;
+}
+
+class tst_QXmppWebSocket : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testCompression();
+    void testCompressionTooBig();
+    void testHandshake();
+    void testHandshakeRejected();
+    void testPing();
+    void testStream();
+    void testUnmaskedFrame();
+
+private:
+    QByteArray handshake(const QByteArray &extraHeaders = QByteArray());
+    QList<QByteArray> readMessages(int count, QXmppStreamCompressor *compressor = 0);
+
+    QTcpServer *server;
+    QTcpSocket *client;
+    QXmppWebSocket *device;
+    QByteArray clientBuffer;
+};
+
+void tst_QXmppWebSocket::init()
+{
+    server = new QTcpServer;
+    QVERIFY(server->listen(testHost, testPort));
+
+    client = new QTcpSocket;
+    client->connectToHost(testHost, testPort);
+    QVERIFY(client->waitForConnected());
+    QVERIFY(server->waitForNewConnection(1000));
+
+    device = new QXmppWebSocket(server->nextPendingConnection());
+    clientBuffer.clear();
+}
+
+void tst_QXmppWebSocket::cleanup()
+{
+    delete device;
+    delete client;
+    delete server;
+}
+
+// Sends the upgrade request and returns the server's response.
+QByteArray tst_QXmppWebSocket::handshake(const QByteArray &extraHeaders)
+{
+    client->write("GET /xmpp-websocket HTTP/1.1\r\n"
+                  "Host: example.com\r\n"
+                  "Upgrade: websocket\r\n"
+                  "Connection: Upgrade\r\n"
+                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                  "Sec-WebSocket-Version: 13\r\n" + extraHeaders + "\r\n");
+    while (!clientBuffer.contains("\r\n\r\n")) {
+        waitForSignal(client, SIGNAL(readyRead()));
+        const QByteArray data = client->readAll();
+        if (data.isEmpty())
+            break;
+        clientBuffer += data;
+    }
+
+    const int end = clientBuffer.indexOf("\r\n\r\n");
+    if (end < 0)
+        return QByteArray();
+    const QByteArray response = clientBuffer.left(end + 4);
+    clientBuffer.remove(0, end + 4);
+    return response;
+}
+
+// Returns the payloads of the next text messages sent by the server.
+QList<QByteArray> tst_QXmppWebSocket::readMessages(int count, QXmppStreamCompressor *compressor)
+{
+    QList<QByteArray> messages;
+    while (messages.size() < count) {
+        int opcode;
+        bool compressed;
+        QByteArray payload;
+        if (takeServerFrame(clientBuffer, opcode, compressed, payload)) {
+            if (opcode != 0x1)
+                continue;
+            if (compressed && compressor) {
+                QByteArray decompressed;
+                payload.append(deflateTrailer, 4);
+                compressor->decompress(payload, decompressed);
+                payload = decompressed;
+            }
+            messages << payload;
+            continue;
+        }
+
+        waitForSignal(client, SIGNAL(readyRead()));
+        const QByteArray data = client->readAll();
+        if (data.isEmpty())
+            break;
+        clientBuffer += data;
+    }
+    return messages;
+}
+
+void tst_QXmppWebSocket::testCompression()
+{
+    if (!QXmppStreamCompressor::isSupported()) {
+#if QT_VERSION < 0x050000
+        QSKIP("Compression is not supported", SkipAll);
+#else
+        QSKIP("Compression is not supported");
+#endif
+    }
+
+    const QByteArray response = handshake("Sec-WebSocket-Protocol: xmpp\r\n"
+        "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n");
+    QVERIFY(response.contains("\r\nSec-WebSocket-Extensions: permessage-deflate\r\n"));
+    QVERIFY(device->isCompressed());
+
+    // the client keeps its context from one message to the next
+    QXmppStreamCompressor compressor(QXmppStreamCompressor::RawDeflateFormat);
+    const QByteArray messages[2] = {
+        "<open xmlns='urn:ietf:params:xml:ns:xmpp-framing' to='example.com' version='1.0'/>",
+        "<message xmlns='jabber:client' to='example.com'><body>hello</body></message>"
+    };
+    for (int i = 0; i < 2; ++i) {
+        QByteArray compressed;
+        QVERIFY(compressor.compress(messages[i], compressed));
+        QVERIFY(compressed.endsWith(QByteArray(deflateTrailer, 4)));
+        compressed.chop(4);
+        client->write(clientFrame(0x1, compressed, true, true));
+    }
+    QByteArray stream;
+    while (!stream.endsWith("</message>")) {
+        waitForSignal(device, SIGNAL(readyRead()));
+        const QByteArray data = device->readAll();
+        if (data.isEmpty())
+            break;
+        stream += data;
+    }
+    QCOMPARE(stream, QByteArray(
+        "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' to='example.com' version='1.0'>"
+        "<message xmlns='jabber:client' to='example.com'><body>hello</body></message>"));
+
+    device->write("<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' id='1' from='example.com' version='1.0'>");
+    device->write("<message to='example.com'><body>hello</body></message>");
+    device->write("<message to='example.com'><body>hello</body></message>");
+    const QList<QByteArray> received = readMessages(3, &compressor);
+    QCOMPARE(received.size(), 3);
+    QCOMPARE(received[0], QByteArray("<open xmlns='urn:ietf:params:xml:ns:xmpp-framing' id='1' from='example.com' version='1.0'/>"));
+    QCOMPARE(received[1], QByteArray("<message xmlns='jabber:client' to='example.com'><body>hello</body></message>"));
+    QCOMPARE(received[2], received[1]);
+}
+
+void tst_QXmppWebSocket::testCompressionTooBig()
+{
+    if (!QXmppStreamCompressor::isSupported()) {
+#if QT_VERSION < 0x050000
+        QSKIP("Compression is not supported", SkipAll);
+#else
+        QSKIP("Compression is not supported");
+#endif
+    }
+
+    QVERIFY(handshake("Sec-WebSocket-Protocol: xmpp\r\n"
+        "Sec-WebSocket-Extensions: permessage-deflate\r\n").startsWith("HTTP/1.1 101 "));
+    QVERIFY(device->isCompressed());
+
+    // a few kilobytes which inflate to far more than the largest message
+    QXmppStreamCompressor compressor(QXmppStreamCompressor::RawDeflateFormat);
+    QByteArray compressed;
+    QVERIFY(compressor.compress(QByteArray(16 * 1048576, ' '), compressed));
+    QVERIFY(compressed.size() < 65536);
+    compressed.chop(4);
+    client->write(clientFrame(0x1, compressed, true, true));
+
+    int opcode = 0;
+    bool frameCompressed;
+    QByteArray payload;
+    while (!takeServerFrame(clientBuffer, opcode, frameCompressed, payload)) {
+        waitForSignal(client, SIGNAL(readyRead()));
+        const QByteArray data = client->readAll();
+        if (data.isEmpty())
+            break;
+        clientBuffer += data;
+    }
+    QCOMPARE(opcode, 0x8);
+    QCOMPARE(payload, QByteArray("\x03\xf1", 2));
+    QCOMPARE(device->bytesAvailable(), qint64(0));
+}
+
+void tst_QXmppWebSocket::testHandshake()
+{
+    QSignalSpy connectedSpy(device, SIGNAL(connected()));
+    const QByteArray response = handshake("Sec-WebSocket-Protocol: chat, xmpp\r\n");
+    QVERIFY(response.startsWith("HTTP/1.1 101 "));
+    QVERIFY(response.contains("\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZK+xOo4k=\r\n"));
+    QVERIFY(response.contains("\r\nSec-WebSocket-Protocol: xmpp\r\n"));
+    QVERIFY(!response.contains("Sec-WebSocket-Extensions"));
+    QCOMPARE(connectedSpy.count(), 1);
+    QVERIFY(!device->isCompressed());
+}
+
+void tst_QXmppWebSocket::testHandshakeRejected()
+{
+    QSignalSpy connectedSpy(device, SIGNAL(connected()));
+    const QByteArray response = handshake("Sec-WebSocket-Protocol: chat\r\n");
+    QVERIFY(response.startsWith("HTTP/1.1 400 "));
+    QCOMPARE(connectedSpy.count(), 0);
+
+    if (client->state() == QAbstractSocket::ConnectedState)
+        waitForSignal(client, SIGNAL(disconnected()));
+    QCOMPARE(client->state(), QAbstractSocket::UnconnectedState);
+}
+
+void tst_QXmppWebSocket::testPing()
+{
+    QVERIFY(handshake("Sec-WebSocket-Protocol: xmpp\r\n").startsWith("HTTP/1.1 101 "));
+
+    client->write(clientFrame(0x9, "ping"));
+    int opcode = 0;
+    bool compressed;
+    QByteArray payload;
+    while (!takeServerFrame(clientBuffer, opcode, compressed, payload)) {
+        waitForSignal(client, SIGNAL(readyRead()));
+        const QByteArray data = client->readAll();
+        if (data.isEmpty())
+            break;
+        clientBuffer += data;
+    }
+    QCOMPARE(opcode, 0xa);
+    QCOMPARE(payload, QByteArray("ping"));
+}
+
+void tst_QXmppWebSocket::testStream()
+{
+    QVERIFY(handshake("Sec-WebSocket-Protocol: xmpp\r\n").startsWith("HTTP/1.1 101 "));
+
+    // incoming messages, one of which is fragmented
+    client->write(clientFrame(0x1, "<open xmlns='urn:ietf:params:xml:ns:xmpp-framing' to='example.com' version='1.0'/>"));
+    client->write(clientFrame(0x1, "<message xmlns='jabber:client' ", false));
+    client->write(clientFrame(0x0, "to='example.com'/>"));
+    client->write(clientFrame(0x1, "<close xmlns='urn:ietf:params:xml:ns:xmpp-framing'/>"));
+    QByteArray stream;
+    while (!stream.endsWith("</stream:stream>")) {
+        waitForSignal(device, SIGNAL(readyRead()));
+        const QByteArray data = device->readAll();
+        if (data.isEmpty())
+            break;
+        stream += data;
+    }
+    QCOMPARE(stream, QByteArray(
+        "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' to='example.com' version='1.0'>"
+        "<message xmlns='jabber:client' to='example.com'/>"
+        "</stream:stream>"));
+
+    // outgoing elements, split across writes
+    device->write("<?xml version='1.0'?><stream:stream xmlns=\"jabber:client\" xmlns:stream=\"http://etherx.jabber.org/streams\""
+                  " id=\"abc\" from=\"example.com\" version=\"1.0\" xml:lang=\"en\">");
+    device->write("<stream:features><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/></stream:features> <message to='a@");
+    device->write("example.com' type='chat'><body>a &gt; b</body></message>");
+    device->write("<iq type='result' id='1'/></stream:stream>");
+
+    const QList<QByteArray> messages = readMessages(5);
+    QCOMPARE(messages.size(), 5);
+    QCOMPARE(messages[0], QByteArray("<open xmlns='urn:ietf:params:xml:ns:xmpp-framing' id=\"abc\" from=\"example.com\" version=\"1.0\" xml:lang=\"en\"/>"));
+    QCOMPARE(messages[1], QByteArray("<stream:features xmlns:stream='http://etherx.jabber.org/streams'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/></stream:features>"));
+    QCOMPARE(messages[2], QByteArray("<message xmlns='jabber:client' to='a@example.com' type='chat'><body>a &gt; b</body></message>"));
+    QCOMPARE(messages[3], QByteArray("<iq xmlns='jabber:client' type='result' id='1'/>"));
+    QCOMPARE(messages[4], QByteArray("<close xmlns='urn:ietf:params:xml:ns:xmpp-framing'/>"));
+}
+
+void tst_QXmppWebSocket::testUnmaskedFrame()
+{
+    QVERIFY(handshake("Sec-WebSocket-Protocol: xmpp\r\n").startsWith("HTTP/1.1 101 "));
+
+    QByteArray frame = clientFrame(0x1, "<presence/>");
+    frame[1] = frame[1] & 0x7f;
+    client->write(frame);
+
+    int opcode = 0;
+    bool compressed;
+    QByteArray payload;
+    while (!takeServerFrame(clientBuffer, opcode, compressed, payload)) {
+        waitForSignal(client, SIGNAL(readyRead()));
+        const QByteArray data = client->readAll();
+        if (data.isEmpty())
+            break;
+        clientBuffer += data;
+    }
+    QCOMPARE(opcode, 0x8);
+    QCOMPARE(payload, QByteArray("\x03\xea", 2));
+}
+
+QTEST_MAIN(tst_QXmppWebSocket)
+#include "tst_qxmppwebsocket.moc"
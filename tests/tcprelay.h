@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef TCPRELAY_H
+#define TCPRELAY_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+// Relays TCP connections to a local port, so that the links going through
+// it can be cut.
+class TestTcpRelay : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    TestTcpRelay()
+        : connections(0)
+        , m_port(0)
+    {
+        connect(this, SIGNAL(newConnection()), this, SLOT(_q_newConnection()));
+    }
+
+    void setTargetPort(quint16 port)
+    {
+        m_port = port;
+    }
+
+    void dropConnections()
+    {
+        const QList<QTcpSocket*> sockets = m_peers.keys();
+        m_peers.clear();
+        foreach (QTcpSocket *socket, sockets) {
+            socket->abort();
+            socket->deleteLater();
+        }
+    }
+
+    int connections;
+
+private slots:
+    void _q_newConnection()
+    {
+        while (QTcpSocket *socket = nextPendingConnection()) {
+            connections++;
+            QTcpSocket *backend = new QTcpSocket(this);
+            m_peers.insert(socket, backend);
+            m_peers.insert(backend, socket);
+            foreach (QTcpSocket *end, QList<QTcpSocket*>() << socket << backend) {
+                connect(end, SIGNAL(readyRead()), this, SLOT(_q_readyRead()));
+                connect(end, SIGNAL(disconnected()), this, SLOT(_q_disconnected()));
+            }
+            backend->connectToHost(QHostAddress::LocalHost, m_port);
+        }
+    }
+
+    void _q_readyRead()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+        QTcpSocket *peer = m_peers.value(socket);
+        if (peer)
+            peer->write(socket->readAll());
+    }
+
+    void _q_disconnected()
+    {
+        QTcpSocket *peer = m_peers.value(qobject_cast<QTcpSocket*>(sender()));
+        if (peer)
+            peer->disconnectFromHost();
+    }
+
+private:
+    QHash<QTcpSocket*, QTcpSocket*> m_peers;
+    quint16 m_port;
+};
+
+#endif
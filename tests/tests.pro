@@ -2,23 +2,42 @@ TEMPLATE = subdirs
 SUBDIRS = \
     qxmpparchiveiq \
     qxmppbindiq \
+    qxmppbookmarkmanager \
     qxmppcallmanager \
+    qxmppcapabilitiescache \
+    qxmppclient \
+    qxmppclientpool \
+    qxmppcompactstanza \
     qxmppdataform \
     qxmppdiscoveryiq \
     qxmppentitytimeiq \
     qxmppiceconnection \
+    qxmppiqrequest \
     qxmppiq \
     qxmppjingleiq \
+    qxmppmammanager \
+    qxmppmediaring \
     qxmppmessage \
+    qxmppmessagereceiptmanager \
+    qxmppmetrics \
+    qxmppmucmanager \
     qxmppnonsaslauthiq \
+    qxmpppasswordchecker \
     qxmpppresence \
     qxmpppubsubiq \
+    qxmppratelimiter \
     qxmppregisteriq \
     qxmppresultset \
+    qxmpprostercache \
     qxmpprosteriq \
     qxmpprpciq \
+    qxmpprpcmanager \
     qxmpprtcppacket \
+    qxmpprtpaudiochannel \
+    qxmpprtpaudiomixer \
+    qxmpprtpforwarder \
     qxmpprtppacket \
+    qxmpprtpvideochannel \
     qxmppserver \
     qxmppsessioniq \
     qxmppsimplearchiveiq \
@@ -26,16 +45,56 @@ SUBDIRS = \
     qxmppstanza \
     qxmppstreamfeatures \
     qxmppstunmessage \
+    qxmpptask \
     qxmpptransfermanager \
     qxmpputils \
     qxmppvcardiq \
     qxmppversioniq \
     qxmpplastactivityiq \
+    qxmpplogger \
     qxmppstreammanagement \
     qxmpppep
 
 !isEmpty(QXMPP_AUTOTEST_INTERNAL) {
+    SUBDIRS += qxmpparchivestore
+    SUBDIRS += qxmppbase64
+    SUBDIRS += qxmppbosh
+    SUBDIRS += qxmppcertificatecache
+    SUBDIRS += qxmppcluster
     SUBDIRS += qxmppcodec
+    SUBDIRS += qxmppdatagramstream
+    SUBDIRS += qxmppdirecttls
+    SUBDIRS += qxmppdnsquery
+    SUBDIRS += qxmppenumtable
+    SUBDIRS += qxmppepolldispatcher
+    SUBDIRS += qxmpphandoff
+    SUBDIRS += qxmppidletimer
+    SUBDIRS += qxmppofflinelog
+    SUBDIRS += qxmppoutputscheduler
+    SUBDIRS += qxmppquerylimiter
+    SUBDIRS += qxmpprostergraph
+    SUBDIRS += qxmpprtcpsession
     SUBDIRS += qxmppsasl
+    SUBDIRS += qxmppserverlink
+    SUBDIRS += qxmppsrtp
+    SUBDIRS += qxmppsrvlookup
     SUBDIRS += qxmppstreaminitiationiq
+    SUBDIRS += qxmpproutingtable
+    SUBDIRS += qxmppstanzapipeline
+    SUBDIRS += qxmppstanzatrace
+    SUBDIRS += qxmppstreamparser
+    SUBDIRS += qxmppstringpool
+    SUBDIRS += qxmpptimerwheel
+    SUBDIRS += qxmpptrafficcapture
+    SUBDIRS += qxmppturnserver
+    SUBDIRS += qxmppwebsocket
+}
+
+# "make check-perf" runs the benchmarks and compares their results with the
+# baselines in benchmarks/baselines, failing on regressions. Pass
+# PERF_ARGS=--record to append the results to the baselines.
+!isEmpty(QXMPP_BENCHMARKS) {
+    check-perf.commands = $$OUT_PWD/../benchmarks/qxmppperfgate/qxmppperfgate \
+        --build-dir $$OUT_PWD/../benchmarks $(PERF_ARGS) $$PWD/../benchmarks/baselines/*.baseline
+    QMAKE_EXTRA_TARGETS += check-perf
 }